@@ -25,8 +25,11 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <cstdlib>
 #include <filesystem>
+#include <seastar/core/scheduling.hh>
 #include <seastar/core/smp.hh>
 
+#include <k2/common/HugePagePool.h>
+
 namespace k2 {
 
 int App::start(int argc, char** argv) {
@@ -45,12 +48,57 @@ int App::start(int argc, char** argv) {
     ("prometheus_port", bpo::value<uint16_t>()->default_value(8089), "HTTP port for the prometheus server")
     ("prometheus_push_address", bpo::value<k2::String>(), "Address for the prometheus push proxy, e.g. localhost:1234")
     ("prometheus_push_interval", bpo::value<k2::ParseableDuration>(), "How often to push metrics to prometheus push proxy, e.g. 10s ")
+    ("profiler_frequency", bpo::value<uint32_t>(), "Samples per CPU second of the sampling profiler of each core, whose folded stacks are served at GET /api/profile by the API server. 0 disables the profiler")
     ("tcp_port", bpo::value<uint16_t>(), "If specified, this TCP port will be opened on all shards (kernel-based incoming connection load-balancing via shared bind on same port from multiple listeners. Conflicts with --tcp_endpoints")
     ("tcp_endpoints", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of TCP listening endpoints to assign to each core. You can specify either full endpoints, e.g. 'tcp+k2rpc://192.168.1.2:12345' or just ports , e.g. '12345'. If simple ports are specified, the stack will bind to 0.0.0.0. Conflicts with --tcp_port")
-    ("enable_tx_checksum", bpo::value<bool>()->default_value(false), "enables transport-level checksums (and validation) on all messages. it incurs double read penalty(data is read separately to compute checksum)")
+    ("enable_tx_checksum", bpo::value<bool>()->default_value(false), "enables transport-level crc32c checksums (and validation) on all messages. Outgoing data is read an extra time to compute the checksum; incoming data is validated as it arrives")
+    ("tcp_port_steering", bpo::value<bool>()->default_value(false), "With --tcp_port, advertise a separate endpoint for each core (e.g. 'tcp+k2rpc://10.0.0.1:12345?core=3&cores=8'). Clients connect to the target core by picking a matching source port, since the server assigns connections to cores by source port")
+    ("tcp_connections_per_endpoint", bpo::value<size_t>()->default_value(1), "The number of TCP connections opened to each remote endpoint. Messages are striped over them")
+    ("tcp_bulk_verbs", bpo::value<std::vector<int>>()->multitoken()->default_value(std::vector<int>{}, ""), "A list(space-delimited) of verbs for bulk messages (e.g. queries). With more than one connection per endpoint, bulk messages are sent round-robin over all but the first connection, which is left to all other messages. When empty, all messages are sent round-robin over all connections")
+    ("tx_low_priority_verbs", bpo::value<std::vector<int>>()->multitoken()->default_value(std::vector<int>{}, ""), "A list(space-delimited) of verbs (e.g. queries or background work) whose incoming requests are handled in a low-priority scheduling group")
+    ("tx_low_priority_shares", bpo::value<float>()->default_value(200), "The CPU shares of the low-priority scheduling group for incoming requests. The main group has 1000 shares")
+    ("memory_hugepage_pool", bpo::value<size_t>()->default_value(0), "Bytes per core of huge page backed, NUMA-local memory for partition data: the nodes of the indexes and version chains and the record slabs. 0 disables the pool, and the data is allocated from the heap")
+    ("memory_hugepage_size", bpo::value<k2::String>()->default_value("2M"), "The size of the pages of the huge page pool: 2M or 1G. Without reserved huge pages of this size the pool uses regular pages, with transparent huge pages requested")
+    ("memory_numa_local", bpo::value<bool>()->default_value(true), "Allocate the huge page pool of each core from the NUMA node of the core")
+    ("tx_local_dispatch", bpo::value<bool>()->default_value(true), "RPCs to an endpoint of the calling core are handed to the observer of their verb directly, without serializing the request or the response")
+    ("tcp_compressed_hosts", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>{}, ""), "A list(space-delimited) of hosts(IPs) behind bandwidth-constrained links. Large messages sent over TCP to these hosts are LZ4-compressed")
+    ("tcp_compression_threshold", bpo::value<size_t>()->default_value(4096), "Messages to tcp_compressed_hosts are compressed if their payload has at least this many bytes")
+    ("tcp_max_batch_bytes", bpo::value<size_t>()->default_value(256 * 1024), "Messages sent on a TCP channel while a flush is in flight are coalesced into one write. A batch stops growing once it reaches this many bytes")
+    ("tcp_max_batch_messages", bpo::value<size_t>()->default_value(64), "A TCP send batch stops growing once it holds this many messages")
+    ("tcp_max_batch_latency", bpo::value<k2::ParseableDuration>(), "A TCP send batch stops growing once its oldest message has waited this long, e.g. 1ms")
+    ("tso_client_prefetch", bpo::value<bool>()->default_value(true), "The TSO client requests timestamp batches ahead of demand, based on the recent request rate")
+    ("tso_client_mock", bpo::value<bool>()->default_value(false), "Don't contact a TSO: timestamps are issued from the local clock. For in-process benchmarks only")
+    ("tso_client_min_batch_size", bpo::value<uint16_t>()->default_value(4), "The smallest timestamp batch the TSO client requests")
+    ("tso_client_max_batch_size", bpo::value<uint16_t>()->default_value(32), "The largest timestamp batch the TSO client requests")
+    ("tso_client_broker_cores", bpo::value<uint32_t>()->default_value(0), "When set, only this many cores get timestamp batches from the TSO, and they share them with the other cores in the process. 0 means that every core gets its own batches")
+    ("tso_client_broker_batch_size", bpo::value<uint16_t>()->default_value(128), "The size of the timestamp batches broker cores get from the TSO")
+    ("tx_metrics_verbs", bpo::value<std::vector<int>>()->multitoken()->default_value(std::vector<int>{}, ""), "A list(space-delimited) of verbs which get transport metrics(messages and bytes) of their own. The other verbs are counted together under verb=\"other\". When empty, every verb gets its own")
+    ("tx_metrics_max_peers", bpo::value<size_t>()->default_value(16), "The number of peers which get a request RTT histogram of their own. Requests to peers past these are counted together under peer=\"other\". 0 turns RTT tracking off")
+    ("tx_task_stall_threshold", bpo::value<k2::ParseableDuration>(), "Tasks handling a verb which run longer than this without yielding are logged with their verb, e.g. 10ms")
+    ("tx_task_time_window", bpo::value<k2::ParseableDuration>(), "The window over which the longest task time of each verb is exported, e.g. 10s")
+    ("tx_slow_request_threshold", bpo::value<k2::ParseableDuration>(), "Requests whose handlers take longer than this are logged with their context and time breakdown, e.g. 100ms. 0 disables the slow request log")
+    ("tx_slow_request_log_rate", bpo::value<uint32_t>(), "The most slow requests logged per second on each core. The rest are counted")
+    ("tx_admission_control", bpo::value<bool>()->default_value(false), "Reject the requests which can't be handled before the deadline of their sender, or which are over the concurrency limit of their verb, with a retryable status. The limits adapt to the latency of the requests")
+    ("tx_admission_target_latency", bpo::value<k2::ParseableDuration>(), "With tx_admission_control, the concurrency limit of a verb grows while its requests complete within this long of being received, and is cut back when they take longer, e.g. 20ms")
+    ("tx_admission_initial_limit", bpo::value<uint32_t>(), "With tx_admission_control, the concurrency limit each verb starts with on each core")
+    ("tx_admission_min_limit", bpo::value<uint32_t>(), "With tx_admission_control, the lowest concurrency limit of a verb on each core")
+    ("tx_admission_max_limit", bpo::value<uint32_t>(), "With tx_admission_control, the highest concurrency limit of a verb on each core")
+    ("bench_results", bpo::value<k2::String>(), "Benchmarks append their results to this file, as JSON lines of the common benchmark result schema(k2/transport/BenchResult.h). Combine the files of several clients with bench_combine")
+    ("trace_sample_rate", bpo::value<double>()->default_value(0), "The fraction(0..1) of the transactions to trace across the client, the partitions and the TSO. 0 turns tracing off")
+    ("trace_ring_size", bpo::value<size_t>()->default_value(4096), "The number of finished spans each core holds until they are exported. The oldest span is lost when the ring is full")
+    ("trace_export_interval", bpo::value<k2::ParseableDuration>(), "How often each core writes its spans to the k2::trace log as OTLP/JSON, e.g. 1s")
     ("log_level", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of log levels. The very first entry must be one of VERBOSE|DEBUG|INFO|WARN|ERROR|FATAL and it sets the global log level. Subsequent entries are of the form <log_module_name>=<log_level> and allow the user to override the log level for particular log modules")
+    ("log_async", bpo::value<bool>()->default_value(false), "Queue the log lines below ERROR in per-core rings which a separate thread writes out, instead of writing and flushing each line on the logging core. Lines are dropped(and counted in the log) when a ring is full")
+    ("log_async_ring_size", bpo::value<size_t>()->default_value(16384), "With log_async, the number of log lines each core can queue")
+    ("log_async_flush_interval", bpo::value<k2::ParseableDuration>(), "With log_async, how long the log writer sleeps when there is nothing to write, e.g. 1ms")
     ;
 
+    // the transport knobs which are read as they are used, and so can be changed with the config API
+    config::markReloadable({"tcp_max_batch_bytes", "tcp_max_batch_messages", "tcp_max_batch_latency",
+                            "tx_slow_request_threshold", "tx_slow_request_log_rate", "trace_sample_rate",
+                            "tx_admission_target_latency", "tx_admission_min_limit", "tx_admission_max_limit"});
+    config::setOptions(_app.get_options_description());
+
     //modify some seastar::reactor default options so that it's straight-forward to write simple apps (1 core/50M memory)
     {
         auto smpopt = _app.get_options_description().find_nothrow("smp", false);
@@ -114,6 +162,11 @@ int App::start(int argc, char** argv) {
             }
         })
         .then([&] {
+            if (config["log_async"].as<bool>()) {
+                Duration flushInterval = config.count("log_async_flush_interval") ?
+                    config["log_async_flush_interval"].as<ParseableDuration>().value : Duration(1ms);
+                logging::AsyncLog::start(config["log_async_ring_size"].as<size_t>(), flushInterval);
+            }
             K2LOG_I(log::appbase, "Starting {}, with args", argv[0]);
             for (int i = 1; i < argc; i++) {
                 K2LOG_I(log::appbase, "\t {}", argv[i]);
@@ -174,6 +227,11 @@ int App::start(int argc, char** argv) {
                         K2LOG_W_EXC(log::appbase, exc, "caught exception in hard stop");
                     });
             });
+            seastar::engine().at_exit([&] {
+                // the background starts see that their applets were stopped and give up
+                K2LOG_I(log::appbase, "wait for background starts");
+                return std::move(_backgroundStarts);
+            });
             seastar::engine().at_exit([&] {
                 K2LOG_I(log::appbase, "graceful stop user applets");
                 return seastar::do_for_each(_gracefulStoppers.rbegin(), _gracefulStoppers.rend(), [](auto& func) {
@@ -191,6 +249,18 @@ int App::start(int argc, char** argv) {
             K2LOG_I(log::appbase, "create config");
             return ConfigDist().start(config);  // initialize global config
         })
+        .then([&] {
+            K2LOG_I(log::appbase, "configure memory pools");
+            return seastar::smp::invoke_on_all([] {
+                ConfigVar<size_t> poolBytes{"memory_hugepage_pool", 0};
+                ConfigVar<k2::String> pageSize{"memory_hugepage_size", "2M"};
+                ConfigVar<bool> numaLocal{"memory_numa_local", true};
+                if (pageSize() != "2M" && pageSize() != "1G") {
+                    throw std::runtime_error("memory_hugepage_size must be 2M or 1G");
+                }
+                mem::HugePagePool::local().configure(poolBytes(), pageSize() == "1G" ? 1ul << 30 : 2ul << 20, numaLocal());
+            });
+        })
         .then([&] {
             K2LOG_I(log::appbase, "create prometheus");
             static k2::String prommsg = _name + " metrics";
@@ -222,6 +292,22 @@ int App::start(int argc, char** argv) {
             K2LOG_I(log::appbase, "create dispatcher");
             return RPCDist().start();
         })
+        .then([&]() {
+            static ConfigVar<std::vector<int>> lowPriorityVerbs{"tx_low_priority_verbs"};
+            static ConfigVar<float> lowPriorityShares{"tx_low_priority_shares", 200};
+            if (lowPriorityVerbs().empty()) {
+                return seastar::make_ready_future();
+            }
+            K2LOG_I(log::appbase, "create low-priority scheduling group for {} verbs", lowPriorityVerbs().size());
+            return seastar::create_scheduling_group("k2_low_priority", lowPriorityShares())
+                .then([verbs=lowPriorityVerbs()] (seastar::scheduling_group group) {
+                    return RPCDist().invoke_on_all([verbs, group] (RPCDispatcher& disp) {
+                        for (auto verb : verbs) {
+                            disp.setVerbSchedulingGroup(Verb(verb), group);
+                        }
+                    });
+                });
+        })
         .then([&]() {
             K2LOG_I(log::appbase, "create user applets");
             std::vector<seastar::future<>> ctorFutures;
@@ -268,11 +354,7 @@ int App::start(int argc, char** argv) {
         })
         .then([&]() {
             K2LOG_I(log::appbase, "start user applets");
-            std::vector<seastar::future<>> startFutures;
-            for (auto& starter : _starters) {
-                startFutures.push_back(starter());
-            }
-            return seastar::when_all_succeed(startFutures.begin(), startFutures.end()).discard_result();
+            return _startApplets();
         })
         .handle_exception([](auto exc) {
             K2LOG_W_EXC(log::appbase, exc, "Startup sequence failed");
@@ -280,6 +362,63 @@ int App::start(int argc, char** argv) {
         });
     });
     K2LOG_I(log::appbase, "Shutdown was successful!");
+    logging::AsyncLog::stop();
     return result;
 }
+
+seastar::future<> App::_startApplets() {
+    // a dependency cycle would never start, so refuse it upfront
+    std::vector<int> state(_starters.size(), 0);  // 0: not visited, 1: on the current path, 2: done
+    std::function<void(size_t)> visit = [&](size_t i) {
+        if (state[i] == 1) {
+            throw std::runtime_error("applet start dependencies have a cycle");
+        }
+        if (state[i] == 2) {
+            return;
+        }
+        state[i] = 1;
+        for (auto dep : _startDeps[i]) {
+            if (_backgroundStart[dep]) {
+                throw std::runtime_error("applets can't start after a background applet");
+            }
+            visit(dep);
+        }
+        state[i] = 2;
+    };
+    for (size_t i = 0; i < _starters.size(); ++i) {
+        visit(i);
+    }
+
+    // Every applet starts as soon as its dependencies have, so independent applets start in parallel. The
+    // shared promises are kept alive by the continuations of the applets which wait on them
+    auto started = seastar::make_lw_shared<std::vector<seastar::shared_promise<>>>(_starters.size());
+    std::vector<seastar::future<>> startFutures;
+    std::vector<seastar::future<>> backgroundFutures;
+    for (size_t i = 0; i < _starters.size(); ++i) {
+        std::vector<seastar::future<>> deps;
+        for (auto dep : _startDeps[i]) {
+            deps.push_back((*started)[dep].get_shared_future());
+        }
+        auto fut = seastar::when_all_succeed(deps.begin(), deps.end()).discard_result()
+            .then([this, i] { return _starters[i](); })
+            .then_wrapped([started, i] (auto&& fut) {
+                if (fut.failed()) {
+                    auto exc = fut.get_exception();
+                    (*started)[i].set_exception(exc);
+                    return seastar::make_exception_future(exc);
+                }
+                (*started)[i].set_value();
+                return seastar::make_ready_future();
+            });
+        if (_backgroundStart[i]) {
+            backgroundFutures.push_back(std::move(fut).handle_exception([] (auto exc) {
+                K2LOG_W_EXC(log::appbase, exc, "background applet start failed");
+            }));
+        } else {
+            startFutures.push_back(std::move(fut));
+        }
+    }
+    _backgroundStarts = seastar::when_all_succeed(backgroundFutures.begin(), backgroundFutures.end()).discard_result();
+    return seastar::when_all_succeed(startFutures.begin(), startFutures.end()).discard_result();
+}
 }  // ns k2
@@ -24,15 +24,16 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 // stl
+#include <algorithm>
 #include <string>
 
 // third-party
 #include <boost/program_options.hpp>
 #include <boost/pointer_cast.hpp>
 #include <seastar/core/app-template.hh>  // for app_template
+#include <seastar/core/shared_future.hh>
 
 // k2 base
-#include <k2/common/TypeMap.h>
 
 // k2 transport
 #include <k2/transport/AutoRRDMARPCProtocol.h>
@@ -119,20 +120,30 @@ public:  // API
     // This container can then be used to perform map/reduce type operations (see ss::distributed API)
     template <typename AppletType>
     seastar::distributed<AppletType>& getDist() {
-        auto findIter = _applets.find<AppletType>();
-        if (findIter == _applets.end()) {
+        seastar::distributed<AppletType>* dist = _dist<AppletType>;
+        if (dist == nullptr) {
             throw std::runtime_error("applet not found");
         }
-        // this is safe, since we created the object ourselves, based on AppletType
-        // in other words, if we found an entry of type AppletType, then the value stored in the map
-        // is guaranteed to be of type seastar::distributed<AppletType>*
-        return *(static_cast<seastar::distributed<AppletType>*>(findIter->second));
+        return *dist;
+    }
+
+    // Returns the instance of the AppletType on this core, i.e. getDist<AppletType>().local(), for hot paths.
+    // The instance is cached per thread until applets are added or removed, so a call is a load and a compare
+    template <typename AppletType>
+    AppletType& getLocal() {
+        thread_local uint64_t cachedGeneration = 0;
+        thread_local AppletType* cached = nullptr;
+        if (cachedGeneration != _appletsGeneration) {
+            cached = &getDist<AppletType>().local();
+            cachedGeneration = _appletsGeneration;
+        }
+        return *cached;
     }
 
     // Add a applet to the app
     template <typename AppletType, typename... ConstructorArgs>
     void addApplet(ConstructorArgs&&... ctorArgs) {
-        if (_applets.find<AppletType>() != _applets.end()) {
+        if (_dist<AppletType> != nullptr) {
             throw std::runtime_error("duplicate applets not allowed");
         }
 
@@ -149,10 +160,33 @@ public:  // API
         _starters.push_back([dd]() mutable { return dd->invoke_on_all(&AppletType::start); });
         _gracefulStoppers.push_back([dd]() mutable { return dd->invoke_on_all(&AppletType::gracefulStop); });
         _stoppers.push_back([dd]() mutable { return dd->stop(); });
-        _dtors.push_back([dd]() mutable { delete dd; });
+        _dtors.push_back([dd]() mutable {
+            delete dd;
+            _dist<AppletType> = nullptr;
+            _appletsGeneration++;
+        });
+        _startDeps.emplace_back();
+        _backgroundStart.push_back(false);
+
+        _dist<AppletType> = dd;
+        _appletsGeneration++;
+        _appletOrder.push_back((void*)dd);
+    }
 
-        // type-erase the container and put it in the map.
-        _applets.put<AppletType>((void*)dd);
+    // Makes the start() of AppletType wait for the start() of each of the DependencyTypes, e.g. so that an applet
+    // only handles requests once the applets it calls into are ready. Applets without dependencies start in parallel
+    template <typename AppletType, typename... DependencyTypes>
+    void startAfter() {
+        auto& deps = _startDeps[_appletIndex<AppletType>()];
+        (deps.push_back(_appletIndex<DependencyTypes>()), ...);
+    }
+
+    // The app doesn't wait for the start() of AppletType to be up, and a failed start is logged instead of failing
+    // the startup. For applets off the critical path of serving, e.g. clients which discover their remote service
+    // and make their callers wait until it is found. Other applets can't start after a background applet
+    template <typename AppletType>
+    void startInBackground() {
+        _backgroundStart[_appletIndex<AppletType>()] = true;
     }
 
     // This method should be called to initialize the system.
@@ -167,14 +201,32 @@ public:  // API
     }
 
 private:
+    template <typename AppletType>
+    size_t _appletIndex() {
+        void* dist = &getDist<AppletType>();
+        return std::find(_appletOrder.begin(), _appletOrder.end(), dist) - _appletOrder.begin();
+    }
+
+    // starts the user applets in dependency order. Resolves once all but the background ones are started
+    seastar::future<> _startApplets();
+
     String _name;
     seastar::app_template _app;
-    TypeMap<void*> _applets;
+    // The container of each applet type, in a slot per type so that getDist() is a direct load. There is one
+    // app per process(see AppBase()), so the slots are static
+    template <typename AppletType>
+    inline static seastar::distributed<AppletType>* _dist = nullptr;
+    // changes whenever an applet is added or removed, which invalidates the caches of getLocal()
+    inline static uint64_t _appletsGeneration = 1;
     std::vector<std::function<seastar::future<>()>> _ctors;     // functors which create user applets
     std::vector<std::function<seastar::future<>()>> _starters;  // functors which call start() on user applets
     std::vector<std::function<seastar::future<>()>> _gracefulStoppers;  // functors which call gracefulStop() on user applets
     std::vector<std::function<seastar::future<>()>> _stoppers;  // functors which call stop() on user applets and delete them
     std::vector<std::function<void()>> _dtors;                  // functors which delete the distributed containers
+    std::vector<void*> _appletOrder;                            // the applets, in the order they were added
+    std::vector<std::vector<size_t>> _startDeps;                // per applet, the applets its start() waits for
+    std::vector<bool> _backgroundStart;                         // per applet, whether the app waits for its start()
+    seastar::future<> _backgroundStarts = seastar::make_ready_future();  // the start() of the background applets
 };                                                              // class App
 
 // global access to the AppBase
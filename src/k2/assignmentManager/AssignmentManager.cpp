@@ -55,6 +55,10 @@ seastar::future<> AssignmentManager::start() {
     RPC().registerRPCObserver<dto::AssignmentOffloadRequest, dto::AssignmentOffloadResponse>(dto::Verbs::K2_ASSIGNMENT_OFFLOAD, [this](dto::AssignmentOffloadRequest&& request) {
         return handleOffload(std::move(request));
     });
+
+    RPC().registerRPCObserver<dto::AssignmentLoadRequest, dto::AssignmentLoadResponse>(dto::Verbs::K2_ASSIGNMENT_LOAD, [this](dto::AssignmentLoadRequest&& request) {
+        return handleLoad(std::move(request));
+    });
     return seastar::make_ready_future<>();
 }
 
@@ -63,7 +67,7 @@ AssignmentManager::handleAssign(dto::AssignmentCreateRequest&& request) {
     K2LOG_I(log::amgr, "Received request to create assignment in collection {}, for partition {}", request.collectionMeta.name, request.partition);
     // TODO, consider current load on all cores and potentially re-route the assignment to a different core
     // for now, simply pass it onto local handler
-    return PManager().assignPartition(std::move(request.collectionMeta), std::move(request.partition))
+    return PManager().assignPartition(std::move(request.collectionMeta), std::move(request.partition), request.migrationTarget, std::move(request.followPersistence))
         .then([](auto&& partition) {
             auto status = (partition.astate == dto::AssignmentState::Assigned) ? Statuses::S201_Created("assignment accepted") : Statuses::S403_Forbidden("partition assignment was not allowed");
             dto::AssignmentCreateResponse resp{.assignedPartition = std::move(partition)};
@@ -80,4 +84,10 @@ AssignmentManager::handleOffload(dto::AssignmentOffloadRequest&& request) {
     return RPCResponse(Statuses::S501_Not_Implemented("offload has not been implemented"), dto::AssignmentOffloadResponse());
 }
 
+seastar::future<std::tuple<Status, dto::AssignmentLoadResponse>>
+AssignmentManager::handleLoad(dto::AssignmentLoadRequest&& request) {
+    (void) request;
+    return RPCResponse(Statuses::S200_OK("load"), PManager().getLoad());
+}
+
 }  // namespace k2
@@ -50,6 +50,9 @@ public:  // application lifespan
 
     seastar::future<std::tuple<Status, dto::AssignmentOffloadResponse>>
     handleOffload(dto::AssignmentOffloadRequest&& request);
+
+    seastar::future<std::tuple<Status, dto::AssignmentLoadResponse>>
+    handleLoad(dto::AssignmentLoadRequest&& request);
 };  // class AssignmentManager
 
 } // namespace k2
@@ -30,7 +30,17 @@ int main(int argc, char** argv) {
     app.addOptions()
         ("assignment_timeout", bpo::value<k2::ParseableDuration>(), "Timeout for K2 partition assignment")
         ("heartbeat_deadline", bpo::value<k2::ParseableDuration>(), "K2 Txn heartbeat deadline")
-        ("data_dir", bpo::value<k2::String>(), "The directory where we can keep data");
+        ("data_dir", bpo::value<k2::String>(), "The directory where we can keep data")
+        ("split_timeout", bpo::value<k2::ParseableDuration>(), "Timeout for moving the keys of a partition split")
+        ("migration_timeout", bpo::value<k2::ParseableDuration>(), "Timeout for moving a partition to another core")
+        ("change_notify_timeout", bpo::value<k2::ParseableDuration>(), "Timeout for pushing a partition map change to a subscribed client")
+        ("load_check_interval", bpo::value<k2::ParseableDuration>(), "How often to check the load of the cluster for splits and rebalancing. 0 disables both")
+        ("node_heartbeat_expiry", bpo::value<k2::ParseableDuration>(), "How long the load reported in a node heartbeat is used before the core is polled instead")
+        ("split_load_threshold", bpo::value<double>(), "Partitions with more requests per second than this are split")
+        ("node_load_skew", bpo::value<double>(), "Nodes with more than this many times the mean request rate are rebalanced. 0 disables rebalancing")
+        ("read_follower_fraction", bpo::value<double>(), "Partitions above split_load_threshold with at least this fraction of snapshot reads get a read follower instead of a split")
+        ("max_read_followers", bpo::value<uint32_t>(), "The most followers a partition gets for its read load, placed on free cores of its own node first. 0 disables load driven followers. The partitions need k23si_closed_timestamp_interval for their followers to serve reads")
+        ("placement_endpoints", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "A space-delimited list of the k2 endpoints the CPO can place partitions on");
     app.addApplet<k2::CPOService>([]() mutable -> seastar::distributed<k2::CPOService>& {
         return k2::AppBase().getDist<k2::CPOService>();
     });
@@ -27,6 +27,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/infrastructure/APIServer.h>
 #include <k2/nodePoolMonitor/NodePoolMonitor.h>
 #include <k2/partitionManager/PartitionManager.h>
+#include <k2/module/k23si/routines/TxnRoutineService.h>
 #include <k2/tso/client/tso_clientlib.h>
 
 int main(int argc, char** argv) {
@@ -38,9 +39,71 @@ int main(int argc, char** argv) {
         ("cpo_request_timeout", bpo::value<k2::ParseableDuration>(), "CPO request timeout")
         ("cpo_request_backoff", bpo::value<k2::ParseableDuration>(), "CPO request backoff")
         ("k23si_cpo_endpoint", bpo::value<k2::String>(), "the endpoint for k2 CPO service")
+        ("collection_cache_fetch_timeout", bpo::value<k2::ParseableDuration>(), "Timeout for fetching a collection into the node's collection metadata cache")
+        ("collection_cache_subscribe", bpo::value<bool>(), "Subscribe the collection metadata cache to the partition map changes pushed by the CPO")
+        ("nodepool_heartbeat_interval", bpo::value<k2::ParseableDuration>(), "How often the node reports the health and load of its cores to the CPO. 0 disables heartbeats")
+        ("nodepool_heartbeat_timeout", bpo::value<k2::ParseableDuration>(), "Timeout of a heartbeat sent to the CPO")
+        ("k23si_conflict_wait_timeout", bpo::value<k2::ParseableDuration>(), "How long a request which finds the WI of another transaction waits for it to be finalized before it PUSHes. 0 PUSHes right away")
         ("k23si_query_pagination_limit", bpo::value<uint32_t>(), "Max records to return in a single query response")
         ("k23si_query_push_limit", bpo::value<uint32_t>(), "Min records in response needed to avoid a push during query processing")
-        ("k23si_persistence_endpoints", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "A space-delimited list of k2 persistence endpoints, each core will pick one endpoint");
+        ("k23si_query_page_bytes", bpo::value<uint32_t>(), "Target size in bytes of the records in a query response")
+        ("k23si_query_filter_batch_size", bpo::value<uint32_t>(), "Number of records a query scan gathers before applying the filter to them as a batch")
+        ("k23si_query_stream_max_credits", bpo::value<uint32_t>(), "Max number of pages a streaming query may have prepared ahead of its client")
+        ("k23si_query_stream_idle_timeout", bpo::value<k2::ParseableDuration>(), "How long an idle streaming query is kept before it is dropped")
+        ("k23si_prepared_queries_max", bpo::value<uint32_t>(), "Max number of prepared queries a partition keeps")
+        ("k23si_txn_finalize_batch_size", bpo::value<uint64_t>(), "Max number of keys in a single batched finalize request")
+        ("k23si_one_phase_commit_max_keys", bpo::value<uint64_t>(), "Max keys of a transaction committed in one phase when all of them are in the TRH partition. 0 disables one-phase commits")
+        ("k23si_read_cache_size", bpo::value<uint64_t>(), "Max number of entries in the read cache of each partition")
+        ("k23si_snapshot_read_cache_size", bpo::value<uint64_t>(), "Max number of key ranges in the snapshot read cache of each partition")
+        ("k23si_txn_finalize_max_inflight", bpo::value<uint64_t>(), "Max number of batched finalize requests in flight per core")
+        ("k23si_txn_expiry_batch_size", bpo::value<uint32_t>(), "Max number of expired transactions processed concurrently before yielding")
+        ("k23si_txn_finalized_linger", bpo::value<k2::ParseableDuration>(), "How long to keep compacted records of finalized transactions")
+        ("k23si_read_cache_ts_bucket", bpo::value<k2::ParseableDuration>(), "Round read cache timestamps up to a multiple of this duration. 0 disables bucketing")
+        ("k23si_read_cache_coalesce", bpo::value<bool>(), "Merge read cache intervals into overlapping ranges with close timestamps")
+        ("k23si_read_cache_coalesce_window", bpo::value<k2::ParseableDuration>(), "Timestamps within this window are close for read cache coalescing")
+        ("k23si_snapshot_read_min_staleness", bpo::value<k2::ParseableDuration>(), "Minimum staleness of snapshot reads relative to the current TSO time")
+        ("k23si_record_arena_slab_size", bpo::value<uint64_t>(), "Size of the slabs used to store record payloads in each partition")
+        ("k23si_record_arena_compaction_threshold", bpo::value<double>(), "Fraction of live data below which records in a slab are relocated")
+        ("retention_minimum", bpo::value<k2::ParseableDuration>(), "The minimum retention window of the collections. Shorter retention windows are raised to it")
+        ("retention_ts_update_interval", bpo::value<k2::ParseableDuration>(), "How often the partitions move their retention window forward")
+        ("k23si_gc_interval", bpo::value<k2::ParseableDuration>(), "How often to run garbage collection of versions outside of the retention window")
+        ("k23si_gc_chunk_size", bpo::value<uint32_t>(), "How many keys the garbage collector examines before checking if it should yield")
+        ("k23si_key_filter_bits_per_key", bpo::value<uint32_t>(), "Bits per key of the filters used to reject reads of absent keys. 0 disables them")
+        ("k23si_point_indexes", bpo::value<bool>(), "Keep a hash index of the keys next to the ordered index, for the point operations")
+        ("k23si_cold_block_rows", bpo::value<uint32_t>(), "How many cold records the garbage collector re-encodes together column-wise, up to 256. 0 disables cold blocks")
+        ("k23si_cold_spill_dir", bpo::value<k2::String>(), "A directory on local disk to spill cold blocks into. Empty keeps them in memory")
+        ("k23si_cold_spill_segment_bytes", bpo::value<uint64_t>(), "The size of the files cold blocks are spilled into")
+        ("k23si_persistence_endpoints", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "A space-delimited list of k2 persistence endpoints, each core will pick one endpoint")
+        ("k23si_checkpoint_interval", bpo::value<k2::ParseableDuration>(), "How often to checkpoint partitions into persistence. 0 disables checkpoints")
+        ("k23si_closed_timestamp_interval", bpo::value<k2::ParseableDuration>(), "How often partitions write a closed timestamp to the WAL for their followers. 0 disables closed timestamps")
+        ("k23si_follower_poll_interval", bpo::value<k2::ParseableDuration>(), "How often follower partitions poll persistence for new WAL records")
+        ("k23si_checkpoint_chunk_bytes", bpo::value<uint64_t>(), "Approximate size of each streamed checkpoint chunk")
+        ("k23si_recovery_parallelism", bpo::value<uint32_t>(), "How many checkpoint chunks or WAL ranges are fetched concurrently during recovery")
+        ("k23si_recovery_wal_range", bpo::value<uint64_t>(), "How many WAL records are requested at a time during recovery")
+        ("k23si_split_transfer_timeout", bpo::value<k2::ParseableDuration>(), "Timeout for each chunk of keys moved to the new partition by a split")
+        ("k23si_load_key_samples", bpo::value<uint32_t>(), "How many request keys are sampled to pick the split key of a partition")
+        ("k23si_hot_keys", bpo::value<uint32_t>(), "How many of the most contended keys each partition tracks for the hot keys inspect request. 0 disables tracking")
+        ("k23si_hot_keys_sample_interval", bpo::value<uint32_t>(), "Only one in this many reads and writes is counted towards the hot keys")
+        ("k23si_migration_catch_up_rounds", bpo::value<uint32_t>(), "How many rounds of changed keys a migrated partition sends before it is fenced")
+        ("k23si_migration_fence_keys", bpo::value<uint32_t>(), "A migrated partition is fenced once a round has no more than this many changed keys")
+        ("k23si_export_bytes_per_sec", bpo::value<uint64_t>(), "Partition exports are paced to this many bytes per second on each partition. 0 disables the pacing")
+        ("k23si_export_page_bytes", bpo::value<uint64_t>(), "Default size of each page of a partition export")
+        ("k23si_changes_retained", bpo::value<uint64_t>(), "How many committed changes each partition keeps for change stream subscribers. 0 disables change streams")
+        ("k23si_changes_poll_interval", bpo::value<k2::ParseableDuration>(), "How often a waiting change poll checks for new changes")
+        ("k23si_changes_max_wait", bpo::value<k2::ParseableDuration>(), "The longest a change poll waits for changes")
+        ("k23si_persistence_replicas", bpo::value<uint32_t>(), "How many persistence endpoints each core replicates its writes to")
+        ("k23si_persistence_write_quorum", bpo::value<uint32_t>(), "How many persistence replicas must acknowledge a write. 0 means a majority")
+        ("k23si_persistence_batch_bytes", bpo::value<uint64_t>(), "A persistence batch is sent once it holds this many bytes")
+        ("k23si_persistence_batch_window", bpo::value<k2::ParseableDuration>(), "Max time a value waits to be batched with others before it is sent to persistence")
+        ("k23si_persistence_timeout", bpo::value<k2::ParseableDuration>(), "Timeout of the calls to persistence. A write which can't be persisted in time fails")
+        ("k23si_persistence_mock", bpo::value<bool>(), "Don't persist anything. Persistence calls succeed right away. For benchmarking only")
+        ("k23si_partitions_per_core", bpo::value<uint32_t>(), "How many partitions each core can host. Their requests are routed by PVID")
+        ("k23si_partition_scheduling_groups", bpo::value<uint32_t>(), "With more than one partition per core, the number of equal-share scheduling groups the partitions of a core are spread over. Seastar has few scheduling groups, so partitions may share one");
+
+    // these are read as they are used, or resized on reload, so they can be tuned with the config API under load
+    k2::config::markReloadable({"k23si_query_pagination_limit", "k23si_query_push_limit", "k23si_query_page_bytes",
+                                "k23si_query_filter_batch_size", "k23si_txn_finalize_batch_size", "k23si_read_cache_size",
+                                "k23si_snapshot_read_cache_size", "k23si_export_bytes_per_sec", "k23si_conflict_wait_timeout"});
 
     app.addApplet<k2::APIServer>();
     app.addApplet<k2::TSO_ClientLib>();
@@ -48,6 +111,11 @@ int main(int argc, char** argv) {
     app.addApplet<k2::NodePoolMonitor>();
     app.addApplet<k2::AssignmentManager>();
     app.addApplet<k2::PartitionManager>();
+    app.addApplet<k2::TxnRoutineService>();
+    // assignments are accepted as soon as the partition manager is up. The TSO client finds the TSO in the
+    // background, and the partitions wait for it on their first timestamp
+    app.startAfter<k2::AssignmentManager, k2::PartitionManager>();
+    app.startInBackground<k2::TSO_ClientLib>();
 
     return app.start(argc, argv);
 }
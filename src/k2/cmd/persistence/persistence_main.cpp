@@ -26,6 +26,10 @@ Copyright(c) 2020 Futurewei Cloud
 
 int main(int argc, char** argv) {
     k2::App app("PersistenceService");
+    app.addOptions()
+        ("persistence_wal_path", bpo::value<k2::String>(), "The directory under which each shard places its WAL plogs")
+        ("persistence_group_commit_window", bpo::value<k2::ParseableDuration>(), "Writes arriving within this window are committed to the WAL together")
+        ("persistence_group_commit_bytes", bpo::value<uint64_t>(), "A WAL commit group is flushed early once it reaches this many bytes");
     // pass the ss::distributed container to the PersistenceService constructor
     app.addApplet<k2::PersistenceService>();
     return app.start(argc, argv);
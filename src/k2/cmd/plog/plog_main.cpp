@@ -27,6 +27,10 @@ Copyright(c) 2020 Futurewei Cloud
 
 int main(int argc, char** argv) {
     k2::App app("PlogServer");
+    app.addOptions()
+        ("plog_data_dir", bpo::value<k2::String>(), "The directory for the per-shard plog files. Plogs are kept in memory if not set")
+        ("plog_max_size", bpo::value<uint32_t>(), "The maximum size in bytes of a plog, up to 4GB")
+        ("plog_preallocated_extents", bpo::value<uint64_t>(), "The number of plog extents by which a shard file is grown at a time");
     app.addApplet<k2::PlogServer>();
     return app.start(argc, argv);
 }
@@ -32,19 +32,21 @@ Copyright(c) 2020 Futurewei Cloud
 #include "schema.h"
 #include "tpcc_rand.h"
 
-typedef std::vector<std::function<seastar::future<k2::WriteResult>(k2::K2TxnHandle&)>> TPCCData;
+// The rows are converted into SKVRecords lazily, since the schemas are not known at generation time
+typedef std::vector<std::function<k2::dto::SKVRecord()>> TPCCData;
 
 struct TPCCDataGen {
-    TPCCData generateItemData()
+    // the items with ids in [id_start, id_end). All of them by default
+    TPCCData generateItemData(uint32_t id_start=1, uint32_t id_end=100001)
     {
         TPCCData data;
-        data.reserve(100000);
-        RandomContext random(0);
+        data.reserve(id_end - id_start);
+        RandomContext random(id_start - 1);
 
-        for (int i=1; i<=100000; ++i) {
+        for (uint32_t i=id_start; i < id_end; ++i) {
             auto item = Item(random, i);
-            data.push_back([_item=std::move(item)] (k2::K2TxnHandle& txn) mutable {
-                return writeRow<Item>(_item, txn);
+            data.push_back([_item=std::move(item)] () mutable {
+                return toSKVRecord<Item>(_item);
             });
         }
 
@@ -55,13 +57,13 @@ struct TPCCDataGen {
     {
         for (uint16_t i=1; i <= _customers_per_district(); ++i) {
             auto customer = Customer(random, w_id, d_id, i);
-            data.push_back([_customer=std::move(customer)] (k2::K2TxnHandle& txn) mutable {
-                return writeRow<Customer>(_customer, txn);
+            data.push_back([_customer=std::move(customer)] () mutable {
+                return toSKVRecord<Customer>(_customer);
             });
 
             auto history = History(random, w_id, d_id, i);
-            data.push_back([_history=std::move(history)] (k2::K2TxnHandle& txn) mutable {
-                return writeRow<History>(_history, txn);
+            data.push_back([_history=std::move(history)] () mutable {
+                return toSKVRecord<History>(_history);
             });
         }
     }
@@ -82,20 +84,20 @@ struct TPCCDataGen {
 
             for (int j=1; j<=order.OrderLineCount; ++j) {
                 auto order_line = OrderLine(random, order, j);
-                data.push_back([_order_line=std::move(order_line)] (k2::K2TxnHandle& txn) mutable {
-                    return writeRow<OrderLine>(_order_line, txn);
+                data.push_back([_order_line=std::move(order_line)] () mutable {
+                    return toSKVRecord<OrderLine>(_order_line);
                 });
             }
 
             if (i >= 2101) {
                 auto new_order = NewOrder(order);
-                data.push_back([_new_order=std::move(new_order)] (k2::K2TxnHandle& txn) mutable {
-                    return writeRow<NewOrder>(_new_order, txn);
+                data.push_back([_new_order=std::move(new_order)] () mutable {
+                    return toSKVRecord<NewOrder>(_new_order);
                 });
             }
 
-            data.push_back([_order=std::move(order)] (k2::K2TxnHandle& txn) mutable {
-                return writeRow<Order>(_order, txn);
+            data.push_back([_order=std::move(order)] () mutable {
+                return toSKVRecord<Order>(_order);
             });
         }
     }
@@ -120,21 +122,21 @@ struct TPCCDataGen {
         for (uint32_t i=id_start; i < id_end; ++i) {
             auto warehouse = Warehouse(random, i);
 
-            data.push_back([_warehouse=std::move(warehouse)] (k2::K2TxnHandle& txn) mutable {
-                return writeRow<Warehouse>(_warehouse, txn);
+            data.push_back([_warehouse=std::move(warehouse)] () mutable {
+                return toSKVRecord<Warehouse>(_warehouse);
             });
 
             for (uint32_t j=1; j<100001; ++j) {
                 auto stock = Stock(random, i, j);
-                data.push_back([_stock=std::move(stock)] (k2::K2TxnHandle& txn) mutable {
-                    return writeRow<Stock>(_stock, txn);
+                data.push_back([_stock=std::move(stock)] () mutable {
+                    return toSKVRecord<Stock>(_stock);
                 });
             }
 
             for (uint16_t j=1; j <= _districts_per_warehouse(); ++j) {
                 auto district = District(random, i, j);
-                data.push_back([_district=std::move(district)] (k2::K2TxnHandle& txn) mutable {
-                    return writeRow<District>(_district, txn);
+                data.push_back([_district=std::move(district)] () mutable {
+                    return toSKVRecord<District>(_district);
                 });
 
                 generateCustomerData(data, random, i, j);
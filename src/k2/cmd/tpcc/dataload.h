@@ -43,6 +43,8 @@ public:
     DataLoader() = default;
     DataLoader(TPCCData&& data) : _data(std::move(data)) {}
 
+    // Loads the data with pipeline_depth concurrent sessions. Each session keeps committing transactions of up to
+    // writes_per_load_txn rows until the data runs out, without waiting for the other sessions
     future<> loadData(K23SIClient& client, int pipeline_depth)
     {
         K2TxnOptions options{};
@@ -50,51 +52,89 @@ public:
         options.syncFinalize = true;
         std::vector<future<>> futures;
 
-        return do_until(
-            [this] { return _data.size() == 0; },
-            [this, options, pipeline_depth, &client] {
-                std::vector<future<>> futures;
-
-                for (int i=0; i < pipeline_depth; ++i) {
-                    futures.push_back(client.beginTxn(options).then([this] (K2TxnHandle&& t) {
-                            K2LOG_D(log::tpcc, "txn begin in load data");
-                            return do_with(std::move(t), [this] (K2TxnHandle& txn) {
-                                return insertDataLoop(txn);
+        for (int i=0; i < pipeline_depth; ++i) {
+            futures.push_back(do_until(
+                [this] { return _data.size() == 0; },
+                [this, options, &client] {
+                    if (_bulk_ingest()) {
+                        return bulkIngestBatch(client);
+                    }
+                    return client.beginTxn(options).then([this] (K2TxnHandle&& t) {
+                        K2LOG_D(log::tpcc, "txn begin in load data");
+                        return do_with(std::move(t), [this] (K2TxnHandle& txn) {
+                            return insertDataLoop(txn);
                         });
-                    }));
-                }
+                    });
+            }));
+        }
 
-                return when_all_succeed(futures.begin(), futures.end());
-        });
+        return when_all_succeed(futures.begin(), futures.end()).discard_result();
     }
 
 private:
+    // takes the next batch of writes_per_load_txn rows off the data
+    std::vector<dto::SKVRecord> nextBatch()
+    {
+        std::vector<dto::SKVRecord> records;
+        while (_data.size() > 0 && records.size() < _writes_per_load_txn()) {
+            records.push_back(_data.back()());
+            _data.pop_back();
+        }
+        K2LOG_D(log::tpcc, "remaining data size={}", _data.size());
+        return records;
+    }
+
+    // ingests the next batch directly, outside of a transaction. The collection has to be created with bulkLoad
+    future<> bulkIngestBatch(K23SIClient& client)
+    {
+        return do_with(nextBatch(), [&client] (std::vector<dto::SKVRecord>& records) {
+            return client.bulkIngest(records).then([] (Status&& status) {
+                if (!status.is2xxOK()) {
+                    K2LOG_E(log::tpcc, "Failed to bulk ingest: {}", status);
+                    return make_exception_future<>(std::runtime_error("Bulk ingest failed during data load"));
+                }
+                return make_ready_future<>();
+            });
+        });
+    }
+
     future<> insertDataLoop(K2TxnHandle& txn)
     {
-        return do_with((size_t)0, [this, &txn] (size_t& current_size) {
-            return do_until(
-                [this, &current_size] { return _data.size() == 0 || current_size >= _writes_per_load_txn(); },
-                [this, &current_size, &txn] () {
-                K2LOG_D(log::tpcc, "remaining data size={}", _data.size());
-                auto write_func = std::move(_data.back());
-                _data.pop_back();
-                ++current_size;
-
-                return write_func(txn).discard_result();
-            }).then([&txn] () {
-                return txn.end(true);
-            }).then([] (EndResult&& result) {
-                if (!result.status.is2xxOK()) {
-                    K2LOG_E(log::tpcc, "Failed to commit: {}", result.status);
-                    return make_exception_future<>(std::runtime_error("Commit failed during bulk data load"));
+        std::vector<dto::SKVRecord> records = nextBatch();
+
+        // all rows of the txn are written with a single batched write per partition, or as async writes whose
+        // errors are returned by end()
+        return do_with(std::move(records), [this, &txn] (std::vector<dto::SKVRecord>& records) {
+            if (_async_load_writes()) {
+                return do_for_each(records, [&txn] (dto::SKVRecord& record) {
+                    return txn.writeAsync(record);
+                }).then([&txn] {
+                    return txn.end(true);
+                });
+            }
+            return txn.writeMany(records).then([&txn] (std::vector<WriteResult>&& results) {
+                for (auto& result : results) {
+                    if (!result.status.is2xxOK()) {
+                        K2LOG_E(log::tpcc, "Failed to write: {}", result.status);
+                        return make_exception_future<EndResult>(std::runtime_error("Write failed during bulk data load"));
+                    }
                 }
 
-                return make_ready_future<>();
+                return txn.end(true);
             });
+        }).then([] (EndResult&& result) {
+            if (!result.status.is2xxOK()) {
+                K2LOG_E(log::tpcc, "Failed to commit: {}", result.status);
+                return make_exception_future<>(std::runtime_error("Commit failed during bulk data load"));
+            }
+
+            return make_ready_future<>();
         });
     }
 
     TPCCData _data;
     ConfigVar<size_t> _writes_per_load_txn{"writes_per_load_txn"};
+    ConfigVar<bool> _async_load_writes{"async_load_writes", false};
+    ConfigVar<bool> _bulk_ingest{"bulk_ingest", false};
 };
 
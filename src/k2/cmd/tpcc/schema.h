@@ -58,6 +58,14 @@ seastar::future<WriteResult> writeRow(ValueType& row, K2TxnHandle& txn, bool era
     });
 }
 
+template<typename ValueType>
+dto::SKVRecord toSKVRecord(ValueType& row)
+{
+    dto::SKVRecord record(row.collectionName, row.schema);
+    row.__writeFields(record);
+    return record;
+}
+
 template<typename ValueType, typename FieldType>
 seastar::future<PartialUpdateResult>
 partialUpdateRow(ValueType& row, FieldType fieldsToUpdate, K2TxnHandle& txn) {
@@ -71,6 +79,20 @@ partialUpdateRow(ValueType& row, FieldType fieldsToUpdate, K2TxnHandle& txn) {
     });
 }
 
+// Applies the field operations to the row on the server, see K2TxnHandle::updateFields
+template<typename ValueType>
+seastar::future<FieldOpsResult<ValueType>>
+updateRowFields(ValueType& row, std::vector<dto::K23SIFieldOp> fieldOps, K2TxnHandle& txn) {
+    return txn.updateFields<ValueType>(row, std::move(fieldOps)).then([] (FieldOpsResult<ValueType>&& result) {
+        if (!result.status.is2xxOK()) {
+            K2LOG_D(log::tpcc, "updateRowFields failed: {}", result.status);
+            return seastar::make_exception_future<FieldOpsResult<ValueType>>(std::runtime_error("updateRowFields failed!"));
+        }
+
+        return seastar::make_ready_future<FieldOpsResult<ValueType>>(std::move(result));
+    });
+}
+
 struct Address {
     Address () = default;
     Address (RandomContext& random) {
@@ -22,13 +22,17 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 // stl
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <random>
 
 #include <k2/appbase/Appbase.h>
 #include <k2/appbase/AppEssentials.h>
 #include <k2/dto/FieldTypes.h>
 #include <k2/module/k23si/client/k23si_client.h>
+#include <k2/transport/BenchResult.h>
+#include <k2/transport/Prometheus.h>
 #include <k2/transport/RetryStrategy.h>
 #include <k2/tso/client/tso_clientlib.h>
 #include <seastar/core/sleep.hh>
@@ -43,6 +47,11 @@ Copyright(c) 2020 Futurewei Cloud
 using namespace k2;
 
 std::atomic<uint32_t> cores_finished = 0;
+// the New Order transactions committed by all cores and the cores which added theirs, for the tpmC of the run
+std::atomic<uint64_t> new_orders_committed = 0;
+std::atomic<uint32_t> cores_reported = 0;
+
+K2_DEF_ENUM(TxnType, NewOrder, Payment, OrderStatus, Delivery, StockLevel);
 
 std::vector<String> getRangeEnds(uint32_t numPartitions, uint32_t numWarehouses) {
     uint32_t share = numWarehouses / numPartitions;
@@ -67,7 +76,7 @@ public:  // application lifespan
         _testDuration(k2::Config()["test_duration_s"].as<uint32_t>()*1s),
         _stopped(true),
         _timer(seastar::timer<>([this] {
-            _stopped = true;
+            _stepDone = true;
         })) {
         K2LOG_I(log::tpcc, "ctor");
     };
@@ -91,19 +100,33 @@ public:  // application lifespan
         std::vector<sm::label_instance> labels;
         labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
 
-        _metric_groups.add_group("TPC-C", {
+        std::vector<sm::metric_definition> metrics{
             sm::make_counter("completed_txns", _completedTxns, sm::description("Number of completed TPC-C transactions"), labels),
-            sm::make_counter("new_order_txns", _newOrderTxns, sm::description("Number of completed New Order transactions"), labels),
-            sm::make_counter("payment_txns", _paymentTxns, sm::description("Number of completed Payment transactions"), labels),
-            sm::make_counter("order_status_txns", _orderStatusTxns, sm::description("Number of completed Order Status transactions"), labels),
-            sm::make_histogram("new_order_latency", [this]{ return _newOrderLatency.getHistogram();},
-                    sm::description("Latency of New Order transactions"), labels),
-            sm::make_histogram("payment_latency", [this]{ return _paymentLatency.getHistogram();},
-                    sm::description("Latency of Payment transactions"), labels),
-            sm::make_histogram("order_status_latency", [this]{ return _orderStatusLatency.getHistogram();},
-                    sm::description("Latency of Order Status transactions"), labels)
-
-        });
+            sm::make_gauge("tpmC", [this] { return _tpmC(_stats[to_integral(TxnType::NewOrder)].committed, k2::Clock::now() - _start); },
+                    sm::description("New Order transactions committed per minute since the start of the run"), labels)
+        };
+        for (size_t type = 0; type < _stats.size(); ++type) {
+            auto& stats = _stats[type];
+            std::vector<sm::label_instance> typeLabels = labels;
+            typeLabels.push_back(sm::label_instance("type", TxnTypeNames[type]));
+            metrics.push_back(sm::make_counter("committed_txns", stats.committed,
+                    sm::description("Number of committed transactions"), typeLabels));
+            for (size_t reason = 0; reason < stats.failures.size(); ++reason) {
+                std::vector<sm::label_instance> reasonLabels = typeLabels;
+                reasonLabels.push_back(sm::label_instance("reason", TxnFailureNames[reason]));
+                metrics.push_back(sm::make_counter("failed_txns", stats.failures[reason],
+                        sm::description("Number of transactions which failed, by the reason of the failure"), reasonLabels));
+            }
+            for (auto& def : stats.latency.metricDefinitions("latency",
+                    "Latency of the committed transactions from their start", typeLabels)) {
+                metrics.push_back(std::move(def));
+            }
+            for (auto& def : stats.intendedLatency.metricDefinitions("intended_latency",
+                    "Latency of the committed transactions from their arrival, including the time they waited for a free session", typeLabels)) {
+                metrics.push_back(std::move(def));
+            }
+        }
+        _metric_groups.add_group("TPC-C", metrics);
     }
 
     seastar::future<> start() {
@@ -200,95 +223,253 @@ private:
         return seastar::when_all_succeed(schema_futures.begin(), schema_futures.end());
     }
 
+    // The ids in [1, 1+count) which this shard loads: each shard loads a contiguous share, with the remainder
+    // spread over the first shards
+    static std::pair<uint32_t, uint32_t> _shardShare(uint32_t count) {
+        uint32_t cpus = seastar::smp::count;
+        uint32_t id = seastar::this_shard_id();
+        uint32_t share = count / cpus;
+        uint32_t extra = count % cpus;
+        uint32_t start = 1 + id*share + std::min(id, extra);
+        return {start, start + share + (id < extra ? 1 : 0)};
+    }
+
+    // Every shard loads its share of the items and of the warehouses. The warehouses are generated and loaded one
+    // at a time, so that only the rows of one warehouse are in memory at once
     seastar::future<> _data_load() {
         K2LOG_I(log::tpcc, "Creating DataLoader");
-        int cpus = seastar::smp::count;
         int id = seastar::this_shard_id();
-        int share = _max_warehouses() / cpus;
-        if (_max_warehouses() % cpus != 0) {
-            K2LOG_W(log::tpcc, "CPUs must divide evenly into num warehouses!");
-            return make_ready_future<>();
-        }
 
         auto f = seastar::sleep(5s);
         if (id == 0) {
             f = f.then ([this] {
                 K2LOG_I(log::tpcc, "Creating collection");
+                if (_bulk_ingest()) {
+                    // the rows are ingested directly, which the collection has to allow
+                    dto::CollectionMetadata metadata{
+                        .name = "TPCC",
+                        .hashScheme = dto::HashScheme::Range,
+                        .storageDriver = dto::StorageDriver::K23SI,
+                        .capacity = {},
+                        .retentionPeriod = Duration(_client.retention_window()),
+                        .heartbeatDeadline = Duration(0),
+                        .bulkLoad = true
+                    };
+                    return _client.makeCollection(std::move(metadata), std::vector<String>(_tcpRemotes()), getRangeEnds(_tcpRemotes().size(), _max_warehouses()));
+                }
                 return _client.makeCollection("TPCC", getRangeEnds(_tcpRemotes().size(), _max_warehouses()));
             }).discard_result()
             .then([this] () {
                 return _schema_load();
-            })
-            .then([this] {
-                K2LOG_I(log::tpcc, "Starting item data load");
-                _item_loader = DataLoader(TPCCDataGen().generateItemData());
-                return _item_loader.loadData(_client, _num_concurrent_txns());
             });
         } else {
             f = f.then([] { return seastar::sleep(5s); });
         }
 
-        return f.then ([this, share, id] {
-            K2LOG_I(log::tpcc, "Starting data gen");
-            _loader = DataLoader(TPCCDataGen().generateWarehouseData(1+(id*share), 1+(id*share)+share));
-            K2LOG_I(log::tpcc, "Starting load to server");
-            return _loader.loadData(_client, _num_concurrent_txns());
+        return f.then ([this] {
+            auto [item_start, item_end] = _shardShare(100000);
+            K2LOG_I(log::tpcc, "Starting load of items [{}, {})", item_start, item_end);
+            _item_loader = DataLoader(TPCCDataGen().generateItemData(item_start, item_end));
+            return _item_loader.loadData(_client, _loadConcurrency());
+        }).then ([this] {
+            auto [wh_start, wh_end] = _shardShare(_max_warehouses());
+            K2LOG_I(log::tpcc, "Starting load of warehouses [{}, {})", wh_start, wh_end);
+            return do_with(wh_start, [this, wh_end=wh_end] (uint32_t& w_id) {
+                return do_until(
+                    [&w_id, wh_end] { return w_id >= wh_end; },
+                    [this, &w_id] {
+                        K2LOG_I(log::tpcc, "Starting data gen of warehouse {}", w_id);
+                        _loader = DataLoader(TPCCDataGen().generateWarehouseData(w_id, w_id + 1));
+                        ++w_id;
+                        return _loader.loadData(_client, _loadConcurrency());
+                    });
+            });
         }).then ([this] {
             K2LOG_I(log::tpcc, "Data load done");
         });
     }
 
+    int _loadConcurrency() {
+        return _load_concurrent_txns() > 0 ? _load_concurrent_txns() : _num_concurrent_txns();
+    }
+
+    // The counts and latencies of one type of transaction
+    struct TxnStats {
+        uint64_t committed = 0;
+        std::array<uint64_t, std::size(TxnFailureNames)> failures{};
+        k2::LogLinearHistogram latency;
+        k2::LogLinearHistogram intendedLatency;
+    };
+
+    static double _tpmC(uint64_t newOrders, k2::Duration duration) {
+        auto mins = ((double)k2::msec(duration).count())/60000.0;
+        return mins > 0 ? (double)newOrders/mins : 0;
+    }
+
+    // In open-loop mode, the transactions of this core arrive as a Poisson process of the target rate, and each
+    // transaction starts at its arrival time or as soon as one of the sessions is free. Its intended latency is
+    // measured from its arrival, so that the time it waited because the sessions fell behind is counted. In
+    // closed-loop mode a transaction arrives when a session is ready to start it
+    k2::TimePoint _nextArrival() {
+        auto now = k2::Clock::now();
+        if (_targetRate <= 0) {
+            return now;
+        }
+        auto result = _arrival;
+        double gapSec = std::exponential_distribution<double>(_targetRate)(_arrivalGen);
+        _arrival += std::chrono::duration_cast<k2::Duration>(std::chrono::duration<double>(gapSec));
+        return result;
+    }
+
+    void _record(TxnType type, bool success, TxnFailure failure, k2::Duration latency, k2::Duration intendedLatency) {
+        for (auto* stats : {&_stats[to_integral(type)], &_stepStats[to_integral(type)]}) {
+            if (!success) {
+                stats->failures[to_integral(failure)]++;
+                continue;
+            }
+            stats->committed++;
+            stats->latency.add(latency);
+            stats->intendedLatency.add(intendedLatency);
+        }
+        if (success) {
+            _completedTxns++;
+        }
+    }
+
     seastar::future<> _tpcc() {
         return seastar::do_until(
-            [this] { return _stopped; },
+            [this] { return _stopped || _stepDone; },
             [this] {
-                uint32_t txn_type = _random.UniformRandom(1, 100);
-                uint32_t w_id = (seastar::this_shard_id() % _max_warehouses()) + 1;
-                TPCCTxn* curTxn;
-                if (txn_type <= 43) {
-                    curTxn = (TPCCTxn*) new PaymentT(_random, _client, w_id, _max_warehouses());
-                } else if (txn_type <= 47) {
-                    curTxn = (TPCCTxn*) new OrderStatusT(_random, _client, w_id);
-                } else if (txn_type <= 51) {
-                    // range from 1-10 is allowed, otherwise set to 10
-                    uint16_t batch_size = (_delivery_txn_batch_size() <= 10 && _delivery_txn_batch_size() > 0) ? batch_size : 10;
-                    curTxn = (TPCCTxn*) new DeliveryT(_random, _client, w_id, batch_size);
-                } else {
-                    curTxn = (TPCCTxn*) new NewOrderT(_random, _client, w_id, _max_warehouses());
-                }
-
-                auto txn_start = k2::Clock::now();
-                return curTxn->run()
-                .then([this, txn_type, txn_start] (bool success) {
-                    if (!success) {
-                        return;
-                    }
-
-                    _completedTxns++;
-                    auto end = k2::Clock::now();
-                    auto dur = end - txn_start;
-
-                    if (txn_type <= 43) {
-                        _paymentTxns++;
-                        _paymentLatency.add(dur);
-                    } else if (txn_type <= 47) {
-                        _orderStatusTxns++;
-                        _orderStatusLatency.add(dur);
-                    } else if (txn_type <= 51) {
-                        _deliveryTxns++;
-                        _deliveryLatency.add(dur);
-                    } else {
-                        _newOrderTxns++;
-                        _newOrderLatency.add(dur);
+                auto arrival = _nextArrival();
+                auto wait = arrival - k2::Clock::now();
+                auto f = wait > 0ns ? seastar::sleep(wait) : make_ready_future<>();
+                return f.then([this, arrival] {
+                    if (_stopped || _stepDone) {
+                        return make_ready_future<>();
                     }
-                })
-                .finally([curTxn] () {
-                    delete curTxn;
+                    return _runTxn(arrival);
                 });
             }
         );
     }
 
+    // Runs one transaction, picked with the minimum mix of the spec
+    seastar::future<> _runTxn(k2::TimePoint arrival) {
+        uint32_t txn_type = _random.UniformRandom(1, 100);
+        uint32_t w_id = (seastar::this_shard_id() % _max_warehouses()) + 1;
+        TPCCTxn* curTxn;
+        TxnType type;
+        if (txn_type <= 43) {
+            type = TxnType::Payment;
+            curTxn = (TPCCTxn*) new PaymentT(_random, _client, w_id, _max_warehouses());
+        } else if (txn_type <= 47) {
+            type = TxnType::OrderStatus;
+            curTxn = (TPCCTxn*) new OrderStatusT(_random, _client, w_id);
+        } else if (txn_type <= 51) {
+            type = TxnType::Delivery;
+            // range from 1-10 is allowed, otherwise set to 10
+            uint16_t batch_size = (_delivery_txn_batch_size() <= 10 && _delivery_txn_batch_size() > 0) ? _delivery_txn_batch_size() : 10;
+            curTxn = (TPCCTxn*) new DeliveryT(_random, _client, w_id, batch_size);
+        } else if (txn_type <= 55) {
+            type = TxnType::StockLevel;
+            curTxn = (TPCCTxn*) new StockLevelT(_random, _client, w_id);
+        } else {
+            type = TxnType::NewOrder;
+            curTxn = (TPCCTxn*) new NewOrderT(_random, _client, w_id, _max_warehouses());
+        }
+
+        auto txn_start = k2::Clock::now();
+        return curTxn->run()
+        .then([this, type, txn_start, arrival, curTxn] (bool success) {
+            auto end = k2::Clock::now();
+            _record(type, success, curTxn->failure(), end - txn_start, end - arrival);
+        })
+        .finally([curTxn] () {
+            delete curTxn;
+        });
+    }
+
+    // Runs the sessions for one step of the test at the given target rate(0 for closed-loop)
+    seastar::future<> _runStep(double targetRate) {
+        _targetRate = targetRate;
+        _stepDone = false;
+        _stepStats = decltype(_stepStats){};
+        _stepStart = k2::Clock::now();
+        _arrival = _stepStart;
+        _timer.arm(_testDuration);
+        _tpcc_futures.clear();
+        for (int i=0; i < _num_concurrent_txns(); ++i) {
+            _tpcc_futures.emplace_back(_tpcc());
+        }
+        return when_all(_tpcc_futures.begin(), _tpcc_futures.end()).discard_result()
+        .then([this, targetRate] {
+            _reportStep(targetRate, k2::Clock::now() - _stepStart);
+        });
+    }
+
+    // Logs the throughput, the tpmC, the abort rates and the latency percentiles of a step, i.e. one point of the
+    // latency-versus-throughput curve
+    void _reportStep(double targetRate, k2::Duration duration) {
+        auto totalsecs = ((double)k2::msec(duration).count())/1000.0;
+        uint64_t committed = 0;
+        for (auto& stats : _stepStats) {
+            committed += stats.committed;
+        }
+        K2LOG_I(log::tpcc, "step with target_tps={}: committed {} per sec, tpmC={}",
+            targetRate > 0 ? std::to_string(targetRate) : String("closed-loop"), (double)committed/totalsecs,
+            _tpmC(_stepStats[to_integral(TxnType::NewOrder)].committed, duration));
+        for (size_t type = 0; type < _stepStats.size(); ++type) {
+            auto& stats = _stepStats[type];
+            uint64_t failed = 0;
+            String failures;
+            for (size_t reason = 0; reason < stats.failures.size(); ++reason) {
+                failed += stats.failures[reason];
+                failures += fmt::format("{}{}={}", reason ? ", " : "", TxnFailureNames[reason], stats.failures[reason]);
+            }
+            auto total = stats.committed + failed;
+            if (total == 0) {
+                continue;
+            }
+            K2LOG_I(log::tpcc,
+                "{}: committed={}, failed={} ({}%: {}), latency p50={}us, p90={}us, p99={}us, p99.9={}us, intended p50={}us, p90={}us, p99={}us, p99.9={}us",
+                TxnTypeNames[type], stats.committed, failed, 100.0*failed/total, failures,
+                stats.latency.percentile(0.5), stats.latency.percentile(0.9), stats.latency.percentile(0.99),
+                stats.latency.percentile(0.999), stats.intendedLatency.percentile(0.5),
+                stats.intendedLatency.percentile(0.9), stats.intendedLatency.percentile(0.99),
+                stats.intendedLatency.percentile(0.999));
+        }
+        _writeBenchResults(targetRate, duration);
+    }
+
+    // appends the step to the bench_results file, in the common benchmark result schema: one result for each
+    // transaction type
+    void _writeBenchResults(double targetRate, k2::Duration duration) {
+        if (_benchResults().empty()) {
+            return;
+        }
+        String step = targetRate > 0 ? fmt::format("{}tps", targetRate) : String("closed-loop");
+        std::vector<k2::BenchResult> results;
+        for (size_t type = 0; type < _stepStats.size(); ++type) {
+            auto& stats = _stepStats[type];
+            auto result = k2::BenchResult::make("tpcc", fmt::format("{}/{}", step, TxnTypeNames[type]));
+            result.config = {
+                {"num_warehouses", std::to_string(_max_warehouses())}, {"num_concurrent_txns", std::to_string(_num_concurrent_txns())},
+                {"target_tps", std::to_string(targetRate)}
+            };
+            result.counters["committed"] = stats.committed;
+            for (size_t reason = 0; reason < stats.failures.size(); ++reason) {
+                result.counters[fmt::format("failed_{}", TxnFailureNames[reason])] = stats.failures[reason];
+            }
+            result.histograms.emplace("latency", stats.latency);
+            result.histograms.emplace("intended_latency", stats.intendedLatency);
+            result.elapsed = duration;
+            results.push_back(std::move(result));
+        }
+        if (!k2::appendBenchResults(_benchResults(), results)) {
+            K2LOG_E(log::tpcc, "unable to write the benchmark results to {}", _benchResults());
+        }
+    }
+
     seastar::future<> _benchmark() {
         K2LOG_I(log::tpcc, "Creating K23SIClient");
 
@@ -300,15 +481,20 @@ private:
         .then([this] {
             K2LOG_I(log::tpcc, "Starting transactions...");
 
-            _timer.arm(_testDuration);
             _start = k2::Clock::now();
             _random = RandomContext(seastar::this_shard_id());
-            for (int i=0; i < _num_concurrent_txns(); ++i) {
-                _tpcc_futures.emplace_back(_tpcc());
+            _arrivalGen.seed(seastar::this_shard_id());
+            if (_targetTPS().empty()) {
+                return _runStep(0);
             }
-            return when_all(_tpcc_futures.begin(), _tpcc_futures.end());
+            // each target rate is a step of test_duration_s
+            return seastar::do_for_each(_targetTPS(), [this] (double rate) {
+                if (_stopped) {
+                    return make_ready_future<>();
+                }
+                return _runStep(rate);
+            });
         })
-        .discard_result()
         .finally([this] () {
             auto duration = k2::Clock::now() - _start;
             auto totalsecs = ((double)k2::msec(duration).count())/1000.0;
@@ -320,6 +506,11 @@ private:
             K2LOG_I(log::tpcc, "read ops {} per sec", readpsec);
             K2LOG_I(log::tpcc, "write ops {} per sec", writepsec);
             K2LOG_I(log::tpcc, "query ops {} per sec", querypsec);
+
+            new_orders_committed += _stats[to_integral(TxnType::NewOrder)].committed;
+            if (++cores_reported == seastar::smp::count) {
+                K2LOG_I(log::tpcc, "tpmC of all cores={}", _tpmC(new_orders_committed, duration));
+            }
             return make_ready_future();
         });
     }
@@ -333,6 +524,11 @@ private:
     RandomContext _random;
     k2::TimePoint _start;
     seastar::timer<> _timer;
+    bool _stepDone = false;
+    k2::TimePoint _stepStart;
+    double _targetRate = 0;
+    k2::TimePoint _arrival;
+    std::mt19937_64 _arrivalGen;
     std::vector<future<>> _tpcc_futures;
     seastar::future<> _benchFuture = seastar::make_ready_future<>();
 
@@ -341,18 +537,17 @@ private:
     ConfigVar<bool> _do_verification{"do_verification"};
     ConfigVar<int> _max_warehouses{"num_warehouses"};
     ConfigVar<int> _num_concurrent_txns{"num_concurrent_txns"};
+    ConfigVar<int> _load_concurrent_txns{"load_concurrent_txns", 0};
+    ConfigVar<bool> _bulk_ingest{"bulk_ingest", false};
     ConfigVar<uint16_t> _delivery_txn_batch_size{"delivery_txn_batch_size"};
+    ConfigVar<std::vector<double>> _targetTPS{"target_tps"};
+    ConfigVar<String> _benchResults{"bench_results", ""};
 
     sm::metric_groups _metric_groups;
-    k2::ExponentialHistogram _newOrderLatency;
-    k2::ExponentialHistogram _paymentLatency;
-    k2::ExponentialHistogram _orderStatusLatency;
-    k2::ExponentialHistogram _deliveryLatency;
+    // for the whole run, and for the current step
+    std::array<TxnStats, std::size(TxnTypeNames)> _stats;
+    std::array<TxnStats, std::size(TxnTypeNames)> _stepStats;
     uint64_t _completedTxns{0};
-    uint64_t _newOrderTxns{0};
-    uint64_t _paymentTxns{0};
-    uint64_t _orderStatusTxns{0};
-    uint64_t _deliveryTxns{0};
     uint64_t _readOps{0};
     uint64_t _writeOps{0};
 }; // class Client
@@ -366,15 +561,23 @@ int main(int argc, char** argv) {;
         ("data_load", bpo::value<bool>()->default_value(false), "If true, only data gen and load are performed. If false, only benchmark is performed.")
         ("num_warehouses", bpo::value<int>()->default_value(2), "Number of TPC-C Warehouses.")
         ("num_concurrent_txns", bpo::value<int>()->default_value(2), "Number of concurrent transactions to use")
+        ("target_tps", bpo::value<std::vector<double>>()->multitoken(), "A list(space-delimited) of rates of transactions per second per core. Each is run open-loop for test_duration_s and reported as one point of the latency-versus-throughput curve, with num_concurrent_txns sessions serving the arrivals. If not given, the sessions run closed-loop")
         ("test_duration_s", bpo::value<uint32_t>()->default_value(30), "How long in seconds to run")
         ("partition_request_timeout", bpo::value<ParseableDuration>(), "Timeout of K23SI operations, as chrono literals")
         ("dataload_txn_timeout", bpo::value<ParseableDuration>(), "Timeout of dataload txn, as chrono literal")
+        ("bulk_ingest", bpo::value<bool>()->default_value(false), "If true, the load phase creates the collection for bulk loading and ingests the rows directly instead of writing them in transactions")
+        ("load_concurrent_txns", bpo::value<int>(), "Number of concurrent transactions each core loads data with. Defaults to num_concurrent_txns")
         ("writes_per_load_txn", bpo::value<size_t>()->default_value(10), "The number of writes to do in the load phase between txn commit calls")
+        ("async_load_writes", bpo::value<bool>()->default_value(false), "If true, the load phase writes each row with an async write instead of one batched write per partition")
         ("districts_per_warehouse", bpo::value<uint16_t>()->default_value(10), "The number of districts per warehouse")
         ("customers_per_district", bpo::value<uint32_t>()->default_value(3000), "The number of customers per district")
         ("do_verification", bpo::value<bool>()->default_value(true), "Run verification tests after run")
         ("cpo_request_timeout", bpo::value<ParseableDuration>(), "CPO request timeout")
         ("cpo_request_backoff", bpo::value<ParseableDuration>(), "CPO request backoff")
+        ("schema_negative_cache_ttl", bpo::value<ParseableDuration>(), "How long a schema the CPO did not have is reported as not found without asking the CPO again")
+        ("schema_prefetch_collections", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of collections whose schemas are fetched on start")
+        ("heartbeat_batch_window", bpo::value<ParseableDuration>(), "How long transaction heartbeats wait to be sent in one request with other heartbeats to the same TRH partition. 0 sends each on its own")
+        ("warmup_connections", bpo::value<bool>(), "Open the connections to all partitions of a collection when its partition map is fetched, and on start for the schema_prefetch_collections")
         ("delivery_txn_batch_size", bpo::value<uint16_t>()->default_value(10), "The batch number of Delivery transaction");
 
     app.addApplet<k2::TSO_ClientLib>();
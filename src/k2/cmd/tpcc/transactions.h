@@ -23,6 +23,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <set>
 #include <utility>
 
 #include <k2/appbase/Appbase.h>
@@ -48,10 +49,39 @@ struct CIdSortElement {
 
 class AtomicVerify;
 
+// Why a transaction failed, for the abort rates
+K2_DEF_ENUM(TxnFailure,
+    Conflict,   // the server aborted it in a conflict with another transaction
+    TooOld,     // it ran for longer than the retention window
+    Timeout,    // one of its requests timed out
+    Error       // any other failed read, write or query
+);
+
 class TPCCTxn {
 public:
     virtual future<bool> run() = 0;
     virtual ~TPCCTxn() = default;
+
+    // why the transaction failed, once run() returned false
+    TxnFailure failure() const { return _failure; }
+
+protected:
+    // Records why the transaction failed. The status which failed the transaction handle, e.g. the abort of one of
+    // its operations, takes precedence over the status of the end request
+    void _recordFailure(const K2TxnHandle& txn, const Status& endStatus=dto::K23SIStatus::OK) {
+        const Status& status = txn.failed() ? txn.failedStatus() : endStatus;
+        if (status == dto::K23SIStatus::AbortConflict) {
+            _failure = TxnFailure::Conflict;
+        } else if (status == dto::K23SIStatus::AbortRequestTooOld) {
+            _failure = TxnFailure::TooOld;
+        } else if (status == Statuses::S408_Request_Timeout) {
+            _failure = TxnFailure::Timeout;
+        } else {
+            _failure = TxnFailure::Error;
+        }
+    }
+
+    TxnFailure _failure = TxnFailure::Error;
 };
 
 class PaymentT : public TPCCTxn
@@ -121,6 +151,7 @@ private:
                 if (fut.failed()) {
                     _failed = true;
                     fut.ignore_ready_future();
+                    _recordFailure(_txn);
                     return make_ready_future<bool>(false);
                 }
 
@@ -130,30 +161,28 @@ private:
                     return make_ready_future<bool>(true);
                 }
 
+                _recordFailure(_txn, result.status);
                 return make_ready_future<bool>(false);
             });
         });
     }
 
     future<> warehouseUpdate() {
-        return _txn.read<Warehouse>(Warehouse(_w_id))
+        // YTD is incremented on the server, which returns the row with the Name we need
+        Warehouse warehouse(_w_id);
+        warehouse.YTD = _amount;
+        return updateRowFields<Warehouse>(warehouse, {{2, dto::FieldOperation::Add}}, _txn)
         .then([this] (auto&& result) {
-            CHECK_READ_STATUS(result);
             _w_name = *(result.value.Name);
-            Warehouse warehouse(_w_id);
-            warehouse.YTD = *(result.value.YTD) + _amount;
-            return partialUpdateRow<Warehouse, std::vector<uint32_t>>(warehouse, {2}, _txn).discard_result();
         });
     }
 
     future<> districtUpdate() {
-        return _txn.read<District>(District(_w_id, _d_id))
+        District district(_w_id, _d_id);
+        district.YTD = _amount;
+        return updateRowFields<District>(district, {{3, dto::FieldOperation::Add}}, _txn)
         .then([this] (auto&& result) {
-            CHECK_READ_STATUS(result);
             _d_name = *(result.value.Name);
-            District district(_w_id, _d_id);
-            district.YTD = *(result.value.YTD) + _amount;
-            return partialUpdateRow<District, std::vector<uint32_t>>(district, {3}, _txn).discard_result();
         });
     }
 
@@ -328,16 +357,13 @@ private:
             return make_ready_future();
         });
 
-         future<> main_f = _txn.read<District>(District(_w_id, *(_order.DistrictID)))
+        // NextOrderID is incremented on the server, which returns the district row as written
+        District district(_w_id, *(_order.DistrictID));
+        district.NextOrderID = 1;
+        future<> main_f = updateRowFields<District>(district, {{4, dto::FieldOperation::Add}}, _txn)
         .then([this] (auto&& result) {
-            CHECK_READ_STATUS(result);
-
-            // Get and write NextOrderID in district row
-            _order.OrderID = *(result.value.NextOrderID);
+            _order.OrderID = *(result.value.NextOrderID) - 1;
             _d_tax = *(result.value.Tax);
-            District district(*result.value.WarehouseID, *result.value.DistrictID);
-            district.NextOrderID = (*result.value.NextOrderID) + 1;
-            future<PartialUpdateResult> district_update = partialUpdateRow<District, std::vector<k2::String>>(district, {"NextOID"}, _txn);
 
             // Write NewOrder row
             NewOrder new_order(_order);
@@ -387,7 +413,7 @@ private:
                 });
             });
 
-            return when_all_succeed(std::move(line_updates), std::move(order_update), std::move(new_order_update), std::move(district_update)).discard_result();
+            return when_all_succeed(std::move(line_updates), std::move(order_update), std::move(new_order_update)).discard_result();
         });
 
         return when_all_succeed(std::move(main_f), std::move(customer_f), std::move(warehouse_f)).discard_result()
@@ -408,6 +434,7 @@ private:
             if (fut.failed()) {
                 _failed = true;
                 fut.ignore_ready_future();
+                _recordFailure(_txn);
                 return make_ready_future<bool>(false);
             }
 
@@ -417,6 +444,7 @@ private:
                 return make_ready_future<bool>(true);
             }
 
+            _recordFailure(_txn, result.status);
             return make_ready_future<bool>(false);
         });
     }
@@ -483,6 +511,8 @@ public:
     future<bool> run() override {
         K2TxnOptions options{};
         options.deadline = Deadline(5s);
+        // Order-Status only reads
+        options.readOnly = true;
         return _client.beginTxn(options)
         .then([this] (K2TxnHandle&& txn) {
             _txn = std::move(txn);
@@ -528,6 +558,7 @@ private:
             if (fut.failed()) {
                 _failed = true;
                 fut.ignore_ready_future();
+                _recordFailure(_txn);
                 return make_ready_future<bool>(false);
             }
 
@@ -536,6 +567,7 @@ private:
                 return make_ready_future<bool>(true);
             }
 
+            _recordFailure(_txn, result.status);
             return make_ready_future<bool>(false);
         });
     }
@@ -850,6 +882,13 @@ public:
                     if (fut.failed()) {
                         _failed = true;
                         fut.ignore_ready_future();
+                        _recordFailure(_txn);
+                        return;
+                    }
+                    EndResult result = fut.get0();
+                    if (_failed || !result.status.is2xxOK()) {
+                        _failed = true;
+                        _recordFailure(_txn, result.status);
                     }
                 });
             })
@@ -1175,3 +1214,141 @@ private:
     std::vector<int32_t> _O_C_ID = std::vector<int32_t>(10, -1); // ORDER table info: customer ID
     std::vector<std::decimal::decimal64> _OL_SUM_AMOUNT = std::vector<std::decimal::decimal64>(10, -1); // ORDER-LINE table info: sum of all amount
 };
+
+class StockLevelT : public TPCCTxn
+{
+public:
+    StockLevelT(RandomContext& random, K23SIClient& client, int16_t w_id) :
+                        _random(random), _client(client), _w_id(w_id) {
+        _d_id = random.UniformRandom(1, _districts_per_warehouse());
+        _threshold = random.UniformRandom(10, 20);
+        _failed = false;
+    }
+
+    future<bool> run() override {
+        K2TxnOptions options{};
+        options.deadline = Deadline(5s);
+        return _client.beginTxn(options)
+        .then([this] (K2TxnHandle&& txn) {
+            _txn = std::move(txn);
+            return runWithTxn();
+        }).handle_exception([] (auto exc) {
+            K2LOG_W_EXC(log::tpcc, exc, "Failed to start txn");
+            return make_ready_future<bool>(false);
+        });
+    }
+
+private:
+    future<bool> runWithTxn() {
+        // the last 20 orders of the district are the ones below its next order ID
+        return _txn.read<District>(District(_w_id, _d_id))
+        .then([this] (auto&& result) {
+            CHECK_READ_STATUS(result);
+            _next_o_id = *(result.value.NextOrderID);
+            return getItemIDs();
+        })
+        .then([this] {
+            return countLowStock();
+        })
+        // commit txn
+        .then_wrapped([this] (auto&& fut) {
+            if (fut.failed()) {
+                _failed = true;
+                fut.ignore_ready_future();
+                return _txn.end(false);
+            }
+
+            fut.ignore_ready_future();
+            K2LOG_D(log::tpcc, "StockLevel txn finished, low stock={}", _out_low_stock);
+
+            return _txn.end(true);
+        }).then_wrapped([this] (auto&& fut) {
+            if (fut.failed()) {
+                _failed = true;
+                fut.ignore_ready_future();
+                _recordFailure(_txn);
+                return make_ready_future<bool>(false);
+            }
+
+            EndResult result = fut.get0();
+            if (result.status.is2xxOK() && !_failed) {
+                return make_ready_future<bool>(true);
+            }
+
+            _recordFailure(_txn, result.status);
+            return make_ready_future<bool>(false);
+        });
+    }
+
+    // Get the distinct item IDs of the Order-Line rows of the last 20 orders of the district
+    future<> getItemIDs() {
+        return _client.createQuery(tpccCollectionName, "orderline")
+        .then([this](auto&& response) mutable {
+            CHECK_READ_STATUS(response);
+
+            _query_order_line = std::move(response.query);
+            _query_order_line.startScanRecord.serializeNext<int16_t>(_w_id);
+            _query_order_line.startScanRecord.serializeNext<int16_t>(_d_id);
+            _query_order_line.startScanRecord.serializeNext<int64_t>(_next_o_id - 20);
+            _query_order_line.endScanRecord.serializeNext<int16_t>(_w_id);
+            _query_order_line.endScanRecord.serializeNext<int16_t>(_d_id);
+            _query_order_line.endScanRecord.serializeNext<int64_t>(_next_o_id);
+            _query_order_line.setLimit(-1);
+            _query_order_line.setReverseDirection(false);
+
+            std::vector<String> projection{"ItemID"}; // make projection
+            _query_order_line.addProjection(projection);
+            dto::expression::Expression filter{};   // make filter Expression
+            _query_order_line.setFilterExpression(std::move(filter));
+
+            return do_with(false, [this] (bool& done) {
+                return do_until(
+                [&done] () { return done; },
+                [this, &done] () {
+                    return _txn.query(_query_order_line)
+                    .then([this, &done] (auto&& response) {
+                        CHECK_READ_STATUS(response);
+                        done = _query_order_line.isDone();
+                        for (auto& rec : response.records) {
+                            std::optional<int32_t> itemIDOpt = rec.deserializeField<int32_t>("ItemID");
+                            _item_ids.insert(*itemIDOpt);
+                        }
+                        return make_ready_future();
+                    });
+                });
+            });
+        });
+    }
+
+    // Count the items whose stock in the warehouse is below the threshold
+    future<> countLowStock() {
+        return parallel_for_each(_item_ids.begin(), _item_ids.end(), [this] (int32_t i_id) {
+            return _txn.read<Stock>(Stock(_w_id, i_id))
+            .then([this] (auto&& result) {
+                CHECK_READ_STATUS(result);
+                if (*(result.value.Quantity) < _threshold) {
+                    _out_low_stock++;
+                }
+                return make_ready_future();
+            });
+        });
+    }
+
+    RandomContext& _random;
+    K23SIClient& _client;
+    K2TxnHandle _txn;
+    bool _failed;
+    int16_t _w_id;
+    int16_t _d_id;
+    int16_t _threshold;
+    int64_t _next_o_id;
+    Query _query_order_line;
+    std::set<int32_t> _item_ids;
+
+private:
+    ConfigVar<uint16_t> _districts_per_warehouse{"districts_per_warehouse"};
+
+private:
+    // output data that StockLevelT wanna get
+    uint32_t _out_low_stock = 0;
+};
@@ -0,0 +1,116 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Combines the --bench_results files of the clients of a benchmark run into one result per measurement, so that
+// e.g. the p99 of a multi-client rpcbench run is the p99 of all samples. Also takes the JSON output of the
+// microbenchmarks(core_bench --benchmark_format=json) so that every benchmark can be compared in one schema.
+//   bench_combine [--output <file>] <results file>...
+// The combined results are written as JSON lines to the output file, or to stdout
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <k2/transport/BenchResult.h>
+
+using namespace k2;
+
+// the results in a google-benchmark JSON document. The times are kept in the config since they aren't counts
+static std::vector<BenchResult> fromGoogleBenchmark(const nlohmann::json& doc) {
+    std::vector<BenchResult> results;
+    auto context = doc.value("context", nlohmann::json::object());
+    auto executable = context.value("executable", std::string("microbench"));
+    auto benchmark = executable.substr(executable.find_last_of('/') + 1);
+    for (auto& bench : doc.at("benchmarks")) {
+        BenchResult result;
+        result.benchmark = benchmark;
+        result.name = bench.at("name").get<std::string>();
+        result.host = context.value("host_name", std::string());
+        result.cores = context.value("num_cpus", uint32_t(0));
+        auto unit = bench.value("time_unit", std::string("ns"));
+        result.config["real_time_" + unit] = std::to_string(bench.value("real_time", 0.0));
+        result.config["cpu_time_" + unit] = std::to_string(bench.value("cpu_time", 0.0));
+        result.counters["iterations"] = bench.value("iterations", uint64_t(0));
+        results.push_back(std::move(result));
+    }
+    return results;
+}
+
+static std::vector<BenchResult> readResults(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("unable to open " + path);
+    }
+    // a google-benchmark document is a single JSON object over many lines. Anything else is JSON lines
+    std::stringstream contents;
+    contents << in.rdbuf();
+    auto doc = nlohmann::json::parse(contents.str(), nullptr, false);
+    if (!doc.is_discarded() && doc.is_object() && doc.contains("benchmarks")) {
+        return fromGoogleBenchmark(doc);
+    }
+    return readBenchResults(String(path));
+}
+
+int main(int argc, char** argv) {
+    std::string output;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty()) {
+        std::cerr << "usage: " << argv[0] << " [--output <file>] <results file>..." << std::endl;
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    try {
+        for (auto& input : inputs) {
+            auto fileResults = readResults(input);
+            std::move(fileResults.begin(), fileResults.end(), std::back_inserter(results));
+        }
+    } catch (std::exception& exc) {
+        std::cerr << exc.what() << std::endl;
+        return 1;
+    }
+
+    auto combined = combineBenchResults(std::move(results));
+    if (output.empty()) {
+        for (auto& result : combined) {
+            std::cout << result.toJson().dump() << std::endl;
+        }
+        return 0;
+    }
+    std::ofstream out(output, std::ios::trunc);
+    if (!out) {
+        std::cerr << "unable to write " << output << std::endl;
+        return 1;
+    }
+    for (auto& result : combined) {
+        out << result.toJson().dump() << "\n";
+    }
+    return 0;
+}
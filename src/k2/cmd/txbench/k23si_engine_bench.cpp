@@ -0,0 +1,325 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// An in-process benchmark of the K23SI partition engine. Each core runs its own partition module, which owns the
+// whole key space, and drives its verb handlers directly, with no client or transport in between. Persistence
+// and the TSO are mocked(k23si_persistence_mock, tso_client_mock), and since every key and every TRH is in the
+// local partition nothing talks to the CPO, so what is measured is the cost of the engine itself: the indexer,
+// the read cache, the write intents, the transaction records and the finalization of the writes.
+// For each phase we report the throughput and, per operation, the allocations and the TSC cycles spent on the core.
+
+// stl
+#include <atomic>
+#include <random>
+#include <x86intrin.h>
+
+#include <boost/range/irange.hpp>
+#include <seastar/core/memory.hh>
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <k2/collectionMetadataCache/CollectionMetadataCache.h>
+#include <k2/infrastructure/APIServer.h>
+#include <k2/module/k23si/Module.h>
+#include <k2/transport/BenchResult.h>
+#include <k2/tso/client/tso_clientlib.h>
+
+#include "Log.h"
+
+namespace k2 {
+
+const char* collname = "K23SIEngineBench";
+
+static std::atomic<uint32_t> cores_finished{0};
+
+class K23SIEngineBench {
+public:  // application lifespan
+    K23SIEngineBench() {
+        K2LOG_I(log::txbench, "ctor");
+    }
+
+    // required for seastar::distributed interface
+    seastar::future<> gracefulStop() {
+        K2LOG_I(log::txbench, "stopping");
+        _stopped = true;
+        return std::move(_benchFut).then([this] {
+            return _module ? _module->gracefulStop() : seastar::make_ready_future();
+        });
+    }
+
+    seastar::future<> start() {
+        if (!K23SIConfig().persistenceMock() || !_tsoMock()) {
+            return seastar::make_exception_future(std::runtime_error(
+                "the engine benchmark needs --k23si_persistence_mock=true and --tso_client_mock=true"));
+        }
+        K2LOG_I(log::txbench, "Starting engine benchmark with recordCount={}, ops={}, concurrency={}, valueSize={}, scanLength={}",
+                _recordCount(), _ops(), _concurrency(), _valueSize(), _scanLength());
+        _stopped = false;
+        _value = String(_valueSize(), '.');
+        _gen.seed(seastar::this_shard_id());
+        _keyDist = std::uniform_int_distribution<uint64_t>(0, std::max<uint64_t>(_recordCount(), 1) - 1);
+        _schemaPtr = std::make_shared<dto::Schema>(_makeSchema());
+        _makeKeys();
+
+        dto::CollectionMetadata meta{
+            .name = collname,
+            .hashScheme = dto::HashScheme::Range,
+            .storageDriver = dto::StorageDriver::K23SI,
+            .capacity = {},
+            .retentionPeriod = 1h,
+            .heartbeatDeadline = 1s,
+        };
+        dto::Partition partition{
+            .pvid = {.id = seastar::this_shard_id(), .rangeVersion = 1, .assignmentVersion = 1},
+            .startKey = "",
+            .endKey = "",
+            .endpoints = {},
+            .astate = dto::AssignmentState::Assigned,
+            .followers = {},
+        };
+        _pvid = partition.pvid;
+        _module = std::make_unique<K23SIPartitionModule>(std::move(meta), std::move(partition));
+
+        _benchFut = _module->start()
+        .then([this] {
+            return _module->handlePushSchema(dto::K23SIPushSchemaRequest{.collectionName = collname, .schema = *_schemaPtr});
+        })
+        .then([] (auto&& result) {
+            auto& [status, resp] = result;
+            if (!status.is2xxOK()) {
+                return seastar::make_exception_future(std::runtime_error(fmt::format("unable to push schema: {}", status)));
+            }
+            return seastar::make_ready_future();
+        })
+        .then([this] {
+            return _runPhase("insert", _recordCount(), [this] (uint64_t i) { return _writeTxn(i); });
+        })
+        .then([this] {
+            return _runPhase("update", _ops(), [this] (uint64_t) { return _writeTxn(_keyDist(_gen)); });
+        })
+        .then([this] {
+            return _runPhase("read", _ops(), [this] (uint64_t) { return _read(_keyDist(_gen)); });
+        })
+        .then([this] {
+            return _runPhase("query", _ops(), [this] (uint64_t) { return _query(_keyDist(_gen)); });
+        })
+        .handle_exception([] (auto exc) {
+            K2LOG_W_EXC(log::txbench, exc, "Unable to execute benchmark");
+        })
+        .finally([] {
+            K2LOG_I(log::txbench, "Done with benchmark");
+            if (++cores_finished == seastar::smp::count) {
+                seastar::engine().exit(0);
+            }
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    static dto::Schema _makeSchema() {
+        return dto::Schema {
+            .name = "bench_schema",
+            .version = 1,
+            .fields = std::vector<dto::SchemaField> {
+                {dto::FieldType::STRING, "partitionKey", false, false},
+                {dto::FieldType::STRING, "rangeKey", false, false},
+                {dto::FieldType::STRING, "data", false, false}
+            },
+            .partitionKeyFields = std::vector<uint32_t> { 0 },
+            .rangeKeyFields = std::vector<uint32_t> { 1 },
+        };
+    }
+
+    // the keys are encoded up front so that the phases don't measure the key encoding of the client
+    void _makeKeys() {
+        _keys.clear();
+        _keys.reserve(_recordCount());
+        for (uint64_t i = 0; i < _recordCount(); ++i) {
+            dto::SKVRecord record(collname, _schemaPtr);
+            record.serializeNext<String>(fmt::format("key:{:012}", i));
+            record.serializeNext<String>("");
+            _keys.push_back(record.getKey());
+        }
+    }
+
+    dto::SKVRecord _makeRecord(uint64_t id) {
+        dto::SKVRecord record(collname, _schemaPtr);
+        record.serializeNext<String>(_keys[id].partitionKey);
+        record.serializeNext<String>("");
+        record.serializeNext<String>(_value);
+        return record;
+    }
+
+    seastar::future<dto::K23SI_MTR> _newMTR() {
+        return AppBase().getLocal<TSO_ClientLib>().GetTimestampFromTSO(Clock::now())
+        .then([this] (auto&& timestamp) {
+            return dto::K23SI_MTR{.txnid = _txnidGen(), .timestamp = std::move(timestamp), .priority = dto::TxnPriority::Medium};
+        });
+    }
+
+    // a single-write transaction: the write designates the TRH and the commit finalizes synchronously
+    seastar::future<bool> _writeTxn(uint64_t id) {
+        return _newMTR().then([this, id] (auto&& mtr) {
+            auto record = _makeRecord(id);
+            dto::K23SIWriteRequest request(_pvid, collname, mtr, _keys[id], false, true, false, _keys[id],
+                                           record.storage.share(), {});
+            return _module->handleWrite(std::move(request), FastDeadline(_timeout()))
+            .then([this, id, mtr] (auto&& result) {
+                auto& [status, resp] = result;
+                if (!status.is2xxOK()) {
+                    K2LOG_D(log::txbench, "write failed with status {}", status);
+                    return seastar::make_ready_future<bool>(false);
+                }
+                dto::K23SITxnEndRequest request;
+                request.pvid = _pvid;
+                request.collectionName = collname;
+                request.key = _keys[id];
+                request.mtr = mtr;
+                request.action = dto::EndAction::Commit;
+                request.writeKeys.push_back(_keys[id]);
+                request.syncFinalize = true;
+                return _module->handleTxnEnd(std::move(request))
+                .then([] (auto&& result) {
+                    auto& [status, resp] = result;
+                    K2LOG_D(log::txbench, "commit completed with status {}", status);
+                    return status.is2xxOK();
+                });
+            });
+        });
+    }
+
+    seastar::future<bool> _read(uint64_t id) {
+        return _newMTR().then([this, id] (auto&& mtr) {
+            return _module->handleRead(dto::K23SIReadRequest(_pvid, collname, std::move(mtr), _keys[id]), FastDeadline(_timeout()))
+            .then([] (auto&& result) {
+                return std::get<0>(result).is2xxOK();
+            });
+        });
+    }
+
+    seastar::future<bool> _query(uint64_t id) {
+        return _newMTR().then([this, id] (auto&& mtr) {
+            dto::K23SIQueryRequest request;
+            request.pvid = _pvid;
+            request.collectionName = collname;
+            request.mtr = std::move(mtr);
+            request.key = _keys[id];
+            // an empty end key scans to the end of the schema
+            request.endKey.schemaName = _schemaPtr->name;
+            request.recordLimit = _scanLength();
+            return _module->handleQuery(std::move(request), dto::K23SIQueryResponse{}, FastDeadline(_timeout()))
+            .then([] (auto&& result) {
+                return std::get<0>(result).is2xxOK();
+            });
+        });
+    }
+
+    // Runs ops operations, keeping _concurrency() of them in flight, and reports the cost of an operation.
+    // The allocations and the cycles are those of the whole core over the phase, so they include the request
+    // construction here and any background work of the engine, such as the timers
+    template <typename OpFunc>
+    seastar::future<> _runPhase(const char* name, uint64_t ops, OpFunc&& op) {
+        _issued = 0;
+        _failed = 0;
+        auto startTime = Clock::now();
+        auto startCycles = __rdtsc();
+        auto startMallocs = seastar::memory::stats().mallocs();
+
+        return seastar::do_with(std::forward<OpFunc>(op), [this, ops] (auto& op) {
+            return seastar::parallel_for_each(boost::irange(0u, std::max(_concurrency(), 1u)), [this, ops, &op] (auto) {
+                return seastar::do_until([this, ops] { return _stopped || _issued >= ops; }, [this, &op] {
+                    return op(_issued++).then([this] (bool ok) {
+                        _failed += !ok;
+                    });
+                });
+            });
+        })
+        .then([this, name, startTime, startCycles, startMallocs] {
+            auto elapsed = Clock::now() - startTime;
+            auto cycles = __rdtsc() - startCycles;
+            auto mallocs = seastar::memory::stats().mallocs() - startMallocs;
+            // the last issued counter may be past ops if we were stopped
+            double ops = std::max<uint64_t>(_issued, 1);
+            double secs = std::max(k2::usec(elapsed).count(), 1l) / 1'000'000.0;
+            K2LOG_I(log::txbench, "{}: ops={}, failed={}, elapsed={}, {:.0f} ops/sec, {:.1f} allocs/op, {:.0f} cycles/op",
+                    name, _issued, _failed, elapsed, ops / secs, mallocs / ops, cycles / ops);
+            if (!_benchResults().empty()) {
+                // each core is a client of the phase, in the common benchmark result schema
+                auto result = BenchResult::make("k23si_engine_bench", name);
+                result.config = {
+                    {"record_count", std::to_string(_recordCount())}, {"concurrency", std::to_string(_concurrency())},
+                    {"value_size", std::to_string(_valueSize())}, {"scan_length", std::to_string(_scanLength())}
+                };
+                result.cores = 1;
+                result.counters = {{"ops", _issued}, {"failed", _failed}, {"mallocs", mallocs}, {"cycles", cycles}};
+                result.elapsed = elapsed;
+                if (!appendBenchResults(_benchResults(), {result})) {
+                    K2LOG_E(log::txbench, "unable to write the benchmark results to {}", _benchResults());
+                }
+            }
+        });
+    }
+
+    ConfigVar<uint64_t> _recordCount{"record_count", 100000};
+    ConfigVar<uint64_t> _ops{"ops", 1000000};
+    ConfigVar<uint32_t> _concurrency{"concurrency", 16};
+    ConfigVar<uint32_t> _valueSize{"value_size", 100};
+    ConfigVar<int32_t> _scanLength{"scan_length", 10};
+    ConfigDuration _timeout{"op_timeout", 1s};
+    ConfigVar<bool> _tsoMock{"tso_client_mock", false};
+    ConfigVar<String> _benchResults{"bench_results", ""};
+
+    seastar::future<> _benchFut = seastar::make_ready_future();
+    bool _stopped = true;
+    std::unique_ptr<K23SIPartitionModule> _module;
+    dto::Partition::PVID _pvid;
+    std::shared_ptr<dto::Schema> _schemaPtr;
+    std::vector<dto::Key> _keys;
+    String _value;
+    uint64_t _issued = 0;
+    uint64_t _failed = 0;
+    std::mt19937_64 _gen;
+    std::mt19937_64 _txnidGen{std::random_device()()};
+    std::uniform_int_distribution<uint64_t> _keyDist;
+};  // class K23SIEngineBench
+
+} // ns k2
+
+int main(int argc, char** argv) {
+    k2::App app("K23SIEngineBench");
+    app.addApplet<k2::APIServer>();
+    app.addApplet<k2::TSO_ClientLib>();
+    app.addApplet<k2::CollectionMetadataCache>();
+    app.addApplet<k2::K23SIEngineBench>();
+    app.addOptions()
+        ("record_count", bpo::value<uint64_t>(), "The number of records inserted into each core's partition, and the key space of the other phases")
+        ("ops", bpo::value<uint64_t>(), "The number of operations in each of the update, read and query phases")
+        ("concurrency", bpo::value<uint32_t>(), "How many operations to keep in flight on each core")
+        ("value_size", bpo::value<uint32_t>(), "How many bytes to write in records")
+        ("scan_length", bpo::value<int32_t>(), "The record limit of each query")
+        ("op_timeout", bpo::value<k2::ParseableDuration>(), "Timeout of each operation")
+        ("k23si_persistence_mock", bpo::value<bool>()->default_value(true), "Don't persist anything. Persistence calls succeed right away")
+        ("k23si_persistence_batch_window", bpo::value<k2::ParseableDuration>(), "Max time a value waits to be batched with others before it is sent to persistence");
+    return app.start(argc, argv);
+}
@@ -23,16 +23,21 @@ Copyright(c) 2020 Futurewei Cloud
 
 
 // stl
+#include <atomic>
 #include <optional>
 #include <random>
 
 #include <k2/appbase/AppEssentials.h>
 #include <k2/appbase/Appbase.h>
+#include <k2/dto/K23SIInspect.h>
 #include <k2/module/k23si/client/k23si_client.h>
+#include <k2/transport/BenchResult.h>
+#include <k2/transport/Prometheus.h>
 #include <k2/tso/client/tso_clientlib.h>
 
 #include <seastar/core/sleep.hh>
 #include "Log.h"
+#include "ycsb.h"
 using namespace k2;
 
 const char* collname="K23SIBench";
@@ -101,6 +106,9 @@ public:  // application lifespan
     }
 
     seastar::future<> start() {
+        if (!_workloadName().empty()) {
+            return _startYCSB();
+        }
         K2LOG_I(log::txbench,
             "Starting benchmark, with dataSize={}, with reads={}, with writes={}, with pipelineDepth={}, with testDuration={}",
             _dataSize(), _reads(), _writes(), _pipelineDepth(), _testDuration());
@@ -261,6 +269,563 @@ private:
         });
     }
 
+private: // YCSB workloads
+    // Runs the YCSB workload given by the workload option: shard 0 creates the collection and the schema, every
+    // shard loads its share of the records, and once all shards are loaded they run the workload
+    seastar::future<> _startYCSB() {
+        // the contention workload runs read-modify-writes over a small hot set, so that the transactions conflict
+        // and push each other
+        _contention = _workloadName() == "contention";
+        auto workload = _contention ?
+            std::optional<ycsb::Workload>(ycsb::Workload{.mix={.rmw=1}, .distribution=ycsb::Distribution::Uniform}) :
+            ycsb::preset(_workloadName());
+        _records = _contention ? _hotSetSize() : _recordCount();
+        if (!workload) {
+            K2LOG_E(log::txbench, "unknown workload {}, expected one of A-F or contention", _workloadName());
+            return seastar::make_exception_future(std::runtime_error("unknown workload"));
+        }
+        // the proportions and the distribution of the preset can be overridden individually
+        auto overrideWith = [](double& proportion, double value) { if (value >= 0) proportion = value; };
+        overrideWith(workload->mix.read, _readProportion());
+        overrideWith(workload->mix.update, _updateProportion());
+        overrideWith(workload->mix.insert, _insertProportion());
+        overrideWith(workload->mix.scan, _scanProportion());
+        overrideWith(workload->mix.rmw, _rmwProportion());
+        if (!_requestDistribution().empty()) {
+            auto distribution = ycsb::distributionFromString(_requestDistribution());
+            if (!distribution) {
+                K2LOG_E(log::txbench, "unknown request distribution {}, expected uniform, zipfian or latest", _requestDistribution());
+                return seastar::make_exception_future(std::runtime_error("unknown request distribution"));
+            }
+            workload->distribution = *distribution;
+        }
+        _mix = workload->mix;
+        _keyChooser.emplace(workload->distribution, _records, _zipfianConstant());
+        K2LOG_I(log::txbench,
+            "Starting YCSB workload {}, with read={}, update={}, insert={}, scan={}, rmw={}, recordCount={}, fieldCount={}, fieldLength={}, opsPerTxn={}, targetRate={}, pipelineDepth={}, testDuration={}, highPriority={}, lowPriority={}, maxRetries={}",
+            _workloadName(), _mix.read, _mix.update, _mix.insert, _mix.scan, _mix.rmw, _records, _fieldCount(),
+            _fieldLength(), _opsPerTxn(), _targetRate(), _pipelineDepth(), _testDuration(), _highPriorityFraction(),
+            _lowPriorityFraction(), _maxRetries());
+
+        dto::Schema schema{.name="ycsb", .version=1, .fields={{dto::FieldType::STRING, "key", false, false}},
+                           .partitionKeyFields={0}, .rangeKeyFields={}};
+        for (uint32_t i = 0; i < _fieldCount(); ++i) {
+            schema.fields.push_back({dto::FieldType::STRING, "field" + std::to_string(i), false, false});
+        }
+        _ycsbSchema = std::make_shared<dto::Schema>(schema);
+        _fieldData = String(_fieldLength(), 'x');
+        _stopped = false;
+        auto myid = seastar::this_shard_id();
+        _rng.seed(myid);
+
+        _benchFut = seastar::sleep(5s);
+        _benchFut = _benchFut.then([this] {return _client.start();});
+        if (myid == 0) {
+            K2LOG_I(log::txbench, "Creating collection...");
+            _benchFut = _benchFut.then([this, schema=std::move(schema)] () mutable {
+                return _client.makeCollection(collname).discard_result()
+                .then([this, schema=std::move(schema)] () mutable {
+                    return _client.createSchema(collname, std::move(schema));
+                }).discard_result();
+            });
+        } else {
+            _benchFut = _benchFut.then([] { return seastar::sleep(5s); });
+        }
+
+        _benchFut = _benchFut
+        .then([this] {
+            return _ycsbLoad();
+        })
+        .then([this] {
+            return _contention ? _startContention() : seastar::make_ready_future();
+        })
+        .then([this] {
+            registerMetrics();
+            registerYCSBMetrics();
+            std::vector<seastar::future<>> futs;
+            futs.push_back(seastar::sleep(_testDuration()).then([this] { _stopped = true; }));
+            for (size_t i = 0; i < _pipelineDepth(); ++i) {
+                futs.push_back(_startYCSBSession());
+            }
+            return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result();
+        })
+        .handle_exception([](auto exc) {
+            K2LOG_W_EXC(log::txbench, exc, "Unable to execute benchmark");
+            return seastar::make_ready_future();
+        })
+        .finally([this] {
+            _reportYCSB();
+            return _contention ? _reportContention() : seastar::make_ready_future();
+        })
+        .finally([] {
+            K2LOG_I(log::txbench, "Done with benchmark");
+        });
+
+        return seastar::make_ready_future();
+    }
+
+    // loads the records whose ids are congruent to this shard, and waits until every shard is done
+    seastar::future<> _ycsbLoad() {
+        if (!_load()) {
+            return seastar::make_ready_future();
+        }
+        _loadNext = seastar::this_shard_id();
+        return seastar::do_until(
+            [this] { return _stopped || _loadNext >= _records; },
+            [this] {
+                K2TxnOptions opts{};
+                opts.deadline = Deadline(_txnTimeout());
+                return _client.beginTxn(opts)
+                .then([this](K2TxnHandle&& txn) {
+                    return seastar::do_with(std::move(txn), [this] (auto& txn) {
+                        std::vector<seastar::future<>> writes;
+                        for (size_t i = 0; i < LoadBatch && _loadNext < _records; ++i, _loadNext += seastar::smp::count) {
+                            auto record = _makeRecord(_loadNext, true);
+                            writes.push_back(seastar::do_with(std::move(record), [&txn] (auto& record) {
+                                return txn.write(record).then([](auto&& result) {
+                                    if (!result.status.is2xxOK()) {
+                                        K2LOG_E(log::txbench, "Failed to load record due to: {}", result.status);
+                                        return seastar::make_exception_future(std::runtime_error("failed to load record"));
+                                    }
+                                    return seastar::make_ready_future();
+                                });
+                            }));
+                        }
+                        return seastar::when_all_succeed(writes.begin(), writes.end()).discard_result()
+                        .then_wrapped([&txn] (auto&& fut) {
+                            bool commit = !fut.failed();
+                            fut.ignore_ready_future();
+                            return txn.end(commit);
+                        })
+                        .then([] (EndResult&& result) {
+                            if (!result.status.is2xxOK()) {
+                                return seastar::make_exception_future(std::runtime_error("failed to commit loaded records"));
+                            }
+                            return seastar::make_ready_future();
+                        });
+                    });
+                });
+            })
+        .then([this] {
+            K2LOG_I(log::txbench, "loaded the records of shard {}", seastar::this_shard_id());
+            _loadedShards++;
+            return seastar::do_until(
+                [this] { return _stopped || _loadedShards.load() >= seastar::smp::count; },
+                [] { return seastar::sleep(100ms); });
+        });
+    }
+
+    // a record with the key of the given id, and with all fields set if withFields
+    dto::SKVRecord _makeRecord(uint64_t id, bool withFields) {
+        dto::SKVRecord record(collname, _ycsbSchema);
+        record.serializeNext<String>(ycsb::recordKey(id));
+        if (withFields) {
+            for (uint32_t i = 0; i < _fieldCount(); ++i) {
+                record.serializeNext<String>(_fieldData);
+            }
+        }
+        return record;
+    }
+
+    // the number of records inserted so far by all shards, assuming they insert at the same rate as this one
+    uint64_t _insertedRecords() const {
+        return _records + _localInserts * seastar::smp::count;
+    }
+
+    // When a target rate is given, the transactions of this shard arrive as a Poisson process of that rate, and
+    // each transaction starts at its arrival time or as soon as a session is free. The intended latency of a
+    // transaction is measured from its arrival, so that the time it waited because the sessions fell behind is
+    // counted(i.e. there is no coordinated omission). Without a target rate, the sessions run closed-loop and a
+    // transaction arrives when it starts
+    TimePoint _nextArrival() {
+        auto now = Clock::now();
+        if (_targetRate() <= 0) {
+            return now;
+        }
+        if (_arrival == TimePoint{}) {
+            _arrival = now;
+        }
+        auto result = _arrival;
+        double gapSec = std::exponential_distribution<double>(_targetRate())(_rng);
+        _arrival += std::chrono::duration_cast<Duration>(std::chrono::duration<double>(gapSec));
+        return result;
+    }
+
+    // the priority of a new transaction, picked from the priority mix
+    dto::TxnPriority _pickPriority() {
+        double pick = std::uniform_real_distribution<double>(0, 1)(_rng);
+        if ((pick -= _highPriorityFraction()) < 0) return dto::TxnPriority::High;
+        if ((pick -= _lowPriorityFraction()) < 0) return dto::TxnPriority::Low;
+        return dto::TxnPriority::Medium;
+    }
+
+    // Runs transactions back to back. A transaction which aborts is retried, as a new transaction with the same
+    // priority, up to max_retries times. Its latency is measured from the start of its first attempt
+    seastar::future<> _startYCSBSession() {
+        return seastar::do_until(
+            [this] { return _stopped; },
+            [this] {
+                auto arrival = _nextArrival();
+                auto wait = arrival - Clock::now();
+                auto fut = wait > 0ns ? seastar::sleep(wait) : seastar::make_ready_future();
+                return fut.then([this, arrival] {
+                    if (_stopped) return seastar::make_ready_future();
+                    auto priority = _pickPriority();
+                    auto start = Clock::now();
+                    return seastar::do_with(uint32_t(0), false, [this, arrival, priority, start] (uint32_t& attempts, bool& committed) {
+                        return seastar::do_until(
+                            [this, &attempts, &committed] { return _stopped || committed || attempts > _maxRetries(); },
+                            [this, &attempts, &committed, priority] {
+                                if (attempts++ > 0) {
+                                    _retriedTxns++;
+                                }
+                                return _runYCSBTxn(priority).then([&committed] (bool result) { committed = result; });
+                            })
+                        .then([this, arrival, priority, start, &committed] {
+                            if (_stopped) {
+                                return;
+                            }
+                            auto now = Clock::now();
+                            _ycsbTxnLatency.add(now - start);
+                            _ycsbIntendedLatency.add(now - arrival);
+                            auto& stats = _priorityStats[priority == dto::TxnPriority::High ? 0 : priority == dto::TxnPriority::Medium ? 1 : 2];
+                            if (committed) {
+                                _committedTxns++;
+                                stats.committed++;
+                            }
+                            else {
+                                stats.failed++;
+                            }
+                        });
+                    });
+                });
+            });
+    }
+
+    // one attempt of a transaction. Resolves to whether it committed
+    seastar::future<bool> _runYCSBTxn(dto::TxnPriority priority) {
+        K2TxnOptions opts{};
+        opts.deadline = Deadline(_txnTimeout());
+        opts.syncFinalize = _sync_finalize();
+        opts.priority = priority;
+        return _client.beginTxn(opts)
+        .then([this](K2TxnHandle&& txn) {
+            _totalTxns ++;
+            return seastar::do_with(std::move(txn), uint32_t(0), [this] (auto& txn, uint32_t& ops) {
+                return seastar::do_until(
+                    [this, &ops] { return _stopped || ops >= _opsPerTxn(); },
+                    [this, &txn, &ops] {
+                        ++ops;
+                        return _doYCSBOp(txn, _mix.choose(_rng));
+                    })
+                .then_wrapped([this, &txn] (auto&& fut) {
+                    if (_stopped) {
+                        fut.ignore_ready_future();
+                        return seastar::make_ready_future<EndResult>(EndResult(dto::K23SIStatus::OperationNotAllowed));
+                    }
+                    bool commit = !fut.failed();
+                    fut.ignore_ready_future();
+                    return txn.end(commit).then([commit] (EndResult&& result) {
+                        if (result.status.is2xxOK() && !commit) {
+                            // the transaction was aborted because one of its operations failed
+                            return EndResult(dto::K23SIStatus::AbortConflict);
+                        }
+                        return std::move(result);
+                    });
+                });
+            });
+        })
+        .then_wrapped([this] (auto&& fut) {
+            if (fut.failed()) {
+                K2LOG_W_EXC(log::txbench, fut.get_exception(), "txn failed with");
+                _abortedTxns++;
+                return false;
+            }
+            EndResult result = fut.get0();
+            if (!result.status.is2xxOK() && !_stopped) {
+                _abortedTxns++;
+            }
+            return result.status.is2xxOK();
+        });
+    }
+
+    seastar::future<> _doYCSBOp(K2TxnHandle& txn, ycsb::Op op) {
+        auto& stats = _ycsbOps[to_integral(op)];
+        stats.count++;
+        auto start = Clock::now();
+        seastar::future<> fut = seastar::make_ready_future();
+        switch (op) {
+            case ycsb::Op::Read:
+                fut = _ycsbRead(txn, _keyChooser->next(_rng, _insertedRecords()));
+                break;
+            case ycsb::Op::Update:
+                fut = _ycsbWrite(txn, _keyChooser->next(_rng, _insertedRecords()));
+                break;
+            case ycsb::Op::Insert: {
+                uint64_t id = _records + _localInserts * seastar::smp::count + seastar::this_shard_id();
+                _localInserts++;
+                fut = _ycsbWrite(txn, id);
+                break;
+            }
+            case ycsb::Op::Scan:
+                fut = _ycsbScan(txn, _keyChooser->next(_rng, _insertedRecords()),
+                                std::uniform_int_distribution<uint32_t>(1, std::max(_maxScanLength(), 1u))(_rng));
+                break;
+            case ycsb::Op::ReadModifyWrite: {
+                uint64_t id = _keyChooser->next(_rng, _insertedRecords());
+                fut = _ycsbRead(txn, id).then([this, &txn, id] { return _ycsbWrite(txn, id); });
+                break;
+            }
+        }
+        return fut.then_wrapped([&stats, start] (auto&& fut) {
+            stats.latency.add(Clock::now() - start);
+            if (fut.failed()) {
+                stats.failures++;
+            }
+            return std::move(fut);
+        });
+    }
+
+    seastar::future<> _ycsbRead(K2TxnHandle& txn, uint64_t id) {
+        return txn.read(_makeRecord(id, false))
+        .then([](auto&& result) {
+            // records which another shard has yet to insert are not found
+            if (!result.status.is2xxOK() && result.status != dto::K23SIStatus::KeyNotFound) {
+                K2LOG_E(log::txbench, "Failed to read key due to: {}", result.status);
+                return seastar::make_exception_future(std::runtime_error("failed to read key"));
+            }
+            return seastar::make_ready_future();
+        });
+    }
+
+    seastar::future<> _ycsbWrite(K2TxnHandle& txn, uint64_t id) {
+        return seastar::do_with(_makeRecord(id, true), [&txn] (auto& record) {
+            return txn.write(record)
+            .then([](auto&& result) {
+                if (!result.status.is2xxOK()) {
+                    K2LOG_E(log::txbench, "Failed to write key due to: {}", result.status);
+                    return seastar::make_exception_future(std::runtime_error("failed to write key"));
+                }
+                return seastar::make_ready_future();
+            });
+        });
+    }
+
+    // scans up to the given number of records from the key of the given id
+    seastar::future<> _ycsbScan(K2TxnHandle& txn, uint64_t id, uint32_t length) {
+        return _client.createQuery(collname, "ycsb")
+        .then([this, &txn, id, length](auto&& response) {
+            if (!response.status.is2xxOK()) {
+                K2LOG_E(log::txbench, "Failed to create scan due to: {}", response.status);
+                return seastar::make_exception_future(std::runtime_error("failed to create scan"));
+            }
+            return seastar::do_with(std::move(response.query), uint32_t(0), [&txn, id, length] (Query& query, uint32_t& found) {
+                query.startScanRecord.serializeNext<String>(ycsb::recordKey(id));
+                query.setLimit(length);
+                return seastar::do_until(
+                    [&query, &found, length] { return found >= length || query.isDone(); },
+                    [&txn, &query, &found] {
+                        return txn.query(query).then([&found] (auto&& result) {
+                            if (!result.status.is2xxOK()) {
+                                K2LOG_E(log::txbench, "Failed to scan due to: {}", result.status);
+                                return seastar::make_exception_future(std::runtime_error("failed to scan"));
+                            }
+                            found += result.records.size();
+                            return seastar::make_ready_future();
+                        });
+                    });
+            });
+        });
+    }
+
+    void registerYCSBMetrics() {
+        _ycsbMetricGroups.clear();
+        std::vector<sm::label_instance> labels;
+        labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+        std::vector<sm::metric_definition> metrics;
+        for (size_t i = 0; i < std::size(_ycsbOps); ++i) {
+            std::vector<sm::label_instance> opLabels = labels;
+            opLabels.push_back(sm::label_instance("op", _ycsbOpNames[i]));
+            metrics.push_back(sm::make_counter("ops", _ycsbOps[i].count, sm::description("Operations issued"), opLabels));
+            metrics.push_back(sm::make_counter("failed_ops", _ycsbOps[i].failures, sm::description("Operations which failed"), opLabels));
+            for (auto& def : _ycsbOps[i].latency.metricDefinitions("op_latency", "Latency of the operations", opLabels)) {
+                metrics.push_back(std::move(def));
+            }
+        }
+        metrics.push_back(sm::make_counter("retried_txns", _retriedTxns, sm::description("Attempts which retried an aborted transaction"), labels));
+        for (auto& def : _ycsbTxnLatency.metricDefinitions("txn_latency", "Latency of the transactions from their start", labels)) {
+            metrics.push_back(std::move(def));
+        }
+        for (auto& def : _ycsbIntendedLatency.metricDefinitions("txn_intended_latency",
+                "Latency of the transactions from their arrival, including the time they waited for a session", labels)) {
+            metrics.push_back(std::move(def));
+        }
+        _ycsbMetricGroups.add_group("ycsb", metrics);
+    }
+
+    void _reportYCSB() {
+        if (_ycsbIntendedLatency.count() == 0) {
+            return;
+        }
+        for (size_t i = 0; i < std::size(_ycsbOps); ++i) {
+            auto& stats = _ycsbOps[i];
+            if (stats.count == 0) continue;
+            K2LOG_I(log::txbench, "{}: ops={}, failed={}, p50={}us, p99={}us, p99.9={}us", _ycsbOpNames[i],
+                stats.count, stats.failures, stats.latency.percentile(0.5), stats.latency.percentile(0.99),
+                stats.latency.percentile(0.999));
+        }
+        K2LOG_I(log::txbench, "txns: committed={}, aborted={}, retried={}, p50={}us, p99={}us, p99.9={}us, intended p50={}us, p99={}us, p99.9={}us",
+            _committedTxns, _abortedTxns, _retriedTxns, _ycsbTxnLatency.percentile(0.5), _ycsbTxnLatency.percentile(0.99),
+            _ycsbTxnLatency.percentile(0.999), _ycsbIntendedLatency.percentile(0.5),
+            _ycsbIntendedLatency.percentile(0.99), _ycsbIntendedLatency.percentile(0.999));
+        _writeBenchResults();
+    }
+
+    // Appends the results of this core to the bench_results file, in the common benchmark result schema. The
+    // cores are separate clients of the same measurement, which the combiner merges
+    void _writeBenchResults() {
+        if (_benchResults().empty()) {
+            return;
+        }
+        auto result = BenchResult::make("k23sibench", fmt::format("ycsb-{}", _workloadName()));
+        result.config = {
+            {"workload", _workloadName().c_str()}, {"record_count", std::to_string(_records)},
+            {"field_count", std::to_string(_fieldCount())}, {"field_length", std::to_string(_fieldLength())},
+            {"ops_per_txn", std::to_string(_opsPerTxn())}, {"pipeline_depth", std::to_string(_pipelineDepth())},
+            {"target_rate", std::to_string(_targetRate())}, {"max_retries", std::to_string(_maxRetries())},
+            {"high_priority_fraction", std::to_string(_highPriorityFraction())},
+            {"low_priority_fraction", std::to_string(_lowPriorityFraction())}
+        };
+        result.cores = 1;
+        result.counters = {{"committed", _committedTxns}, {"aborted", _abortedTxns}, {"retried", _retriedTxns}};
+        result.histograms.emplace("txn_latency", _ycsbTxnLatency);
+        result.histograms.emplace("txn_intended_latency", _ycsbIntendedLatency);
+        for (size_t i = 0; i < std::size(_ycsbOps); ++i) {
+            if (_ycsbOps[i].count == 0) continue;
+            result.counters[fmt::format("{}_ops", _ycsbOpNames[i])] = _ycsbOps[i].count;
+            result.counters[fmt::format("{}_failed", _ycsbOpNames[i])] = _ycsbOps[i].failures;
+            result.histograms.emplace(fmt::format("{}_latency", _ycsbOpNames[i]), _ycsbOps[i].latency);
+        }
+        result.elapsed = _testDuration();
+        if (!appendBenchResults(_benchResults(), {result})) {
+            K2LOG_E(log::txbench, "unable to write the benchmark results to {}", _benchResults());
+        }
+    }
+
+    // Resets the push and abort totals of every partition, so that the ones at the end of the run count only the
+    // pushes of this run. Shard 0 does the reset while the others wait for it
+    seastar::future<> _startContention() {
+        if (seastar::this_shard_id() != 0) {
+            return seastar::do_until(
+                [this] { return _stopped || _contentionStarted.load(); },
+                [] { return seastar::sleep(100ms); });
+        }
+        return _inspectHotKeys(true).then([] (auto&&) {
+            _contentionStarted = true;
+        });
+    }
+
+    // the push and abort totals of all partitions, optionally resetting them
+    seastar::future<std::tuple<uint64_t, uint64_t>> _inspectHotKeys(bool reset) {
+        std::vector<String> urls;
+        for (auto& partition : _client.cpo_client.collections[collname].collection.partitionMap.partitions) {
+            if (!partition.endpoints.empty()) {
+                urls.push_back(*partition.endpoints.begin());
+            }
+        }
+        return seastar::do_with(std::move(urls), std::tuple<uint64_t, uint64_t>{0, 0}, [this, reset] (auto& urls, auto& totals) {
+            return seastar::do_for_each(urls, [this, reset, &totals] (const String& url) {
+                auto ep = RPC().getTXEndpoint(url);
+                if (!ep) {
+                    K2LOG_W(log::txbench, "unable to inspect the hot keys of partition at {}", url);
+                    return seastar::make_ready_future();
+                }
+                dto::K23SIInspectHotKeysRequest request{.reset = reset};
+                return RPC().callRPC<dto::K23SIInspectHotKeysRequest, dto::K23SIInspectHotKeysResponse>
+                    (dto::Verbs::K23SI_INSPECT_HOT_KEYS, request, *ep, _txnTimeout())
+                .then([&totals, url] (auto&& result) {
+                    auto& [status, response] = result;
+                    if (!status.is2xxOK()) {
+                        K2LOG_W(log::txbench, "unable to inspect the hot keys of partition at {} due to {}", url, status);
+                        return;
+                    }
+                    std::get<0>(totals) += response.totalPushes;
+                    std::get<1>(totals) += response.totalAborts;
+                });
+            })
+            .then([&totals] { return totals; });
+        });
+    }
+
+    // Adds the transactions of this shard to the totals of the run. The last shard to do so reports the commit
+    // rate, the abort rate, and the pushes per commit over all shards
+    seastar::future<> _reportContention() {
+        for (size_t i = 0; i < std::size(_priorityStats); ++i) {
+            if (_priorityStats[i].committed + _priorityStats[i].failed > 0) {
+                K2LOG_I(log::txbench, "{} priority txns: committed={}, failed={}", _priorityNames[i],
+                    _priorityStats[i].committed, _priorityStats[i].failed);
+            }
+        }
+        _contentionCommits += _committedTxns;
+        _contentionAttempts += _totalTxns;
+        _contentionAborts += _abortedTxns;
+        if (++_contentionReported < seastar::smp::count) {
+            return seastar::make_ready_future();
+        }
+        return _inspectHotKeys(false).then([this] (auto&& totals) {
+            auto [pushes, aborts] = totals;
+            uint64_t commits = _contentionCommits.load();
+            uint64_t attempts = _contentionAttempts.load();
+            double seconds = std::chrono::duration<double>(_testDuration()).count();
+            K2LOG_I(log::txbench,
+                "contention: commits/sec={}, attempts={}, aborted attempts={}, abort rate={}, push RPCs={}, pushes/commit={}, push aborts={}",
+                commits / seconds, attempts, _contentionAborts.load(),
+                attempts ? double(_contentionAborts.load()) / attempts : 0.0, pushes,
+                commits ? double(pushes) / commits : 0.0, aborts);
+        });
+    }
+
+    static constexpr size_t LoadBatch = 100;
+    static constexpr const char* _ycsbOpNames[] = {"read", "update", "insert", "scan", "rmw"};
+    // the shards which have loaded their records
+    static inline std::atomic<uint32_t> _loadedShards{0};
+    // the contention workload's reset of the push totals, and the totals of the shards which finished it
+    static inline std::atomic<bool> _contentionStarted{false};
+    static inline std::atomic<uint32_t> _contentionReported{0};
+    static inline std::atomic<uint64_t> _contentionCommits{0};
+    static inline std::atomic<uint64_t> _contentionAttempts{0};
+    static inline std::atomic<uint64_t> _contentionAborts{0};
+    static constexpr const char* _priorityNames[] = {"high", "medium", "low"};
+
+    struct _OpStats {
+        uint64_t count = 0;
+        uint64_t failures = 0;
+        LogLinearHistogram latency;
+    };
+    std::array<_OpStats, std::size(_ycsbOpNames)> _ycsbOps;
+    LogLinearHistogram _ycsbTxnLatency;
+    LogLinearHistogram _ycsbIntendedLatency;
+    sm::metric_groups _ycsbMetricGroups;
+
+    struct _PriorityStats {
+        uint64_t committed = 0;
+        uint64_t failed = 0;
+    };
+    std::array<_PriorityStats, std::size(_priorityNames)> _priorityStats;
+    uint64_t _retriedTxns = 0;
+    bool _contention = false;
+    // the records the workload is loaded with and picks keys from
+    uint64_t _records = 0;
+
+    ycsb::Mix _mix;
+    std::optional<ycsb::KeyChooser> _keyChooser;
+    std::shared_ptr<dto::Schema> _ycsbSchema;
+    String _fieldData;
+    std::mt19937_64 _rng;
+    uint64_t _loadNext = 0;
+    uint64_t _localInserts = 0;
+    TimePoint _arrival{};
+
 private://metrics
     void registerMetrics() {
         _metric_groups.clear();
@@ -310,6 +875,28 @@ private://metrics
     ConfigDuration _testDuration{"test_duration", 30s};
     ConfigDuration _txnTimeout{"txn_timeout", 10s};
 
+    // YCSB workloads. The proportions and the distribution default to those of the workload
+    ConfigVar<String> _workloadName{"workload", ""};
+    ConfigVar<uint64_t> _recordCount{"record_count", 100000};
+    ConfigVar<uint32_t> _fieldCount{"field_count", 10};
+    ConfigVar<uint32_t> _fieldLength{"field_length", 100};
+    ConfigVar<String> _requestDistribution{"request_distribution", ""};
+    ConfigVar<double> _readProportion{"read_proportion", -1};
+    ConfigVar<double> _updateProportion{"update_proportion", -1};
+    ConfigVar<double> _insertProportion{"insert_proportion", -1};
+    ConfigVar<double> _scanProportion{"scan_proportion", -1};
+    ConfigVar<double> _rmwProportion{"rmw_proportion", -1};
+    ConfigVar<uint32_t> _maxScanLength{"max_scan_length", 100};
+    ConfigVar<uint32_t> _opsPerTxn{"ops_per_txn", 1};
+    ConfigVar<double> _targetRate{"target_rate", 0};
+    ConfigVar<bool> _load{"ycsb_load", true};
+    ConfigVar<double> _zipfianConstant{"zipfian_constant", 0.99};
+    ConfigVar<uint64_t> _hotSetSize{"hot_set_size", 100};
+    ConfigVar<double> _highPriorityFraction{"high_priority_fraction", 0};
+    ConfigVar<double> _lowPriorityFraction{"low_priority_fraction", 0};
+    ConfigVar<uint32_t> _maxRetries{"max_retries", 0};
+    ConfigVar<String> _benchResults{"bench_results", ""};
+
     seastar::future<> _benchFut = seastar::make_ready_future();
     bool _stopped = true;
     K23SIClient _client;
@@ -330,6 +917,25 @@ int main(int argc, char** argv) {
         ("sync_finalize", bpo::value<bool>()->default_value(false), "K23SI Sync finalize option")
         ("test_duration", bpo::value<ParseableDuration>(), "How long to run")
         ("txn_timeout", bpo::value<ParseableDuration>(), "timeout for each transaction")
+        ("workload", bpo::value<String>(), "Runs the YCSB workload A, B, C, D, E or F, or the contention workload, instead of the sequential reads and writes")
+        ("record_count", bpo::value<uint64_t>(), "The number of records the YCSB workload is loaded with and picks keys from")
+        ("field_count", bpo::value<uint32_t>(), "The number of fields of each YCSB record")
+        ("field_length", bpo::value<uint32_t>(), "The bytes in each field of a YCSB record")
+        ("request_distribution", bpo::value<String>(), "The distribution of the keys of the YCSB operations: uniform, zipfian or latest. Defaults to the workload's")
+        ("zipfian_constant", bpo::value<double>(), "The skew of the zipfian and latest distributions")
+        ("read_proportion", bpo::value<double>(), "The proportion of YCSB reads. Defaults to the workload's")
+        ("update_proportion", bpo::value<double>(), "The proportion of YCSB updates. Defaults to the workload's")
+        ("insert_proportion", bpo::value<double>(), "The proportion of YCSB inserts. Defaults to the workload's")
+        ("scan_proportion", bpo::value<double>(), "The proportion of YCSB scans. Defaults to the workload's")
+        ("rmw_proportion", bpo::value<double>(), "The proportion of YCSB read-modify-writes. Defaults to the workload's")
+        ("max_scan_length", bpo::value<uint32_t>(), "YCSB scans read a uniformly distributed number of records up to this")
+        ("ops_per_txn", bpo::value<uint32_t>(), "How many YCSB operations to run in each transaction")
+        ("target_rate", bpo::value<double>(), "Transactions per second per core, arriving open-loop. 0 runs the sessions closed-loop")
+        ("ycsb_load", bpo::value<bool>(), "Whether to load the YCSB records before running the workload")
+        ("hot_set_size", bpo::value<uint64_t>(), "The number of records the contention workload is loaded with and read-modify-writes")
+        ("high_priority_fraction", bpo::value<double>(), "The fraction of YCSB transactions which run at high priority")
+        ("low_priority_fraction", bpo::value<double>(), "The fraction of YCSB transactions which run at low priority. The rest run at medium")
+        ("max_retries", bpo::value<uint32_t>(), "How many times an aborted YCSB transaction is retried")
         // config for dependencies
         ("tcp_remotes", bpo::value<std::vector<String>>()->multitoken()->default_value(std::vector<String>()), "A list(space-delimited) of endpoints to assign in the test collection")
         ("partition_request_timeout", bpo::value<ParseableDuration>(), "Timeout of K23SI operations, as chrono literals")
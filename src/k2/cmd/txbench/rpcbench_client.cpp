@@ -23,14 +23,55 @@ Copyright(c) 2020 Futurewei Cloud
 
 
 // stl
+#include <atomic>
+#include <fstream>
+
 #include <k2/appbase/Appbase.h>
 #include <k2/appbase/AppEssentials.h>
+#include <k2/transport/AutoRRDMARPCProtocol.h>
+#include <k2/transport/BenchResult.h>
+#include <k2/transport/Prometheus.h>
+#include <k2/transport/RRDMARPCProtocol.h>
+#include <k2/transport/TCPRPCProtocol.h>
 #include <seastar/core/sleep.hh>
 
 #include "rpcbench_common.h"
+#include "rpcbench_service.h"
 #include "Log.h"
 using namespace k2;
 
+// The client runs a matrix of benchmark cells: every combination of the transports, request sizes, pipeline depths
+// and connection counts. Each cell runs for test_duration on all cores and the results of all cores are reported
+// together, as CSV or JSON, once the whole matrix is done.
+// The transports are picked out of the remote endpoints by protocol("tcp" or "rrdma"); "loopback" sends to the
+// next core of this process instead, through the cross-core loopback. Without any transports, all remote endpoints
+// are used as given, as one transport named "remote".
+static std::atomic<uint32_t> cores_finished{0};
+
+// the measurements of a cell, on one core or summed over all cores
+struct CellResult {
+    String transport;
+    uint32_t requestSize = 0;
+    uint32_t responseSize = 0;
+    uint32_t pipelineDepth = 0;
+    uint32_t conns = 0;
+    uint32_t cores = 0;
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    Duration elapsed{0};
+    LogLinearHistogram latency;
+
+    void merge(const CellResult& o) {
+        cores += o.cores;
+        count += o.count;
+        bytes += o.bytes;
+        errors += o.errors;
+        elapsed = std::max(elapsed, o.elapsed);
+        latency.merge(o.latency);
+    }
+};
+
 class Client {
 public:  // application lifespan
     // required for seastar::distributed interface
@@ -44,33 +85,22 @@ public:  // application lifespan
         _metric_groups.clear();
         std::vector<sm::label_instance> labels;
         labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
-        labels.push_back(sm::label_instance("active_cores", std::min(_remotes().size(), size_t(seastar::smp::count))));
         _metric_groups.add_group("session",
         {
-            sm::make_gauge("session_id", _session.sessionId, sm::description("Session ID"), labels),
-            sm::make_counter("total_count", _session.totalCount, sm::description("Total number of requests"), labels),
-            sm::make_counter("total_bytes", _session.totalSize, sm::description("Total data bytes sent"), labels),
+            sm::make_gauge("session_id", [this] { return _session.sessionId;}, sm::description("Session ID"), labels),
+            sm::make_counter("total_count", _totalCount, sm::description("Total number of requests"), labels),
+            sm::make_counter("total_bytes", _totalSize, sm::description("Total data bytes sent"), labels),
             sm::make_histogram("request_latency", [this]{ return _requestLatency.getHistogram();}, sm::description("Latency of acks"), labels)
         });
     }
 
     seastar::future<> start() {
         _stopped = false;
-        _session = std::move(BenchSession(0, _requestSize()));
-        auto myid = seastar::this_shard_id();
-
-        // push all eps to talk to, starting with mine
-        for (size_t i = myid; i < _multiConn() + myid; ++i) {
-            _session.endpoints.push_back(k2::RPC().getTXEndpoint(_remotes()[i%_remotes().size()]));
-        }
-        K2LOG_I(log::txbench, "Setup complete. Starting session...");
+        registerMetrics();
+        K2LOG_I(log::txbench, "Setup complete. Starting benchmark matrix...");
         _benchFut = _benchFut
-        .then([this]{
-            return _startSession();
-        })
-        .then([this]() {
-            K2LOG_I(log::txbench, "Starting benchmark in session: {}", _session.sessionId);
-            return _benchmark();
+        .then([this] {
+            return _runMatrix();
         })
         .handle_exception([this](auto exc) {
             K2LOG_W_EXC(log::txbench, exc, "Unable to execute benchmark");
@@ -78,20 +108,105 @@ public:  // application lifespan
         })
         .finally([this]() {
             K2LOG_I(log::txbench, "Done with benchmark");
+            if (++cores_finished == seastar::smp::count) {
+                return _report().finally([] {
+                    seastar::engine().exit(0);
+                });
+            }
+            return seastar::make_ready_future();
         });
 
         return seastar::make_ready_future();
     }
 
+    // the results of this core, one per cell of the matrix in order
+    std::vector<CellResult> results() const { return _results; }
+
 private:
+    template <typename T>
+    static std::vector<T> _valuesOr(const std::vector<T>& values, T single) {
+        return values.empty() ? std::vector<T>{single} : values;
+    }
+
+    // the endpoint urls of the given transport
+    seastar::future<std::vector<String>> _transportURLs(const String& transport) {
+        std::vector<String> urls;
+        if (transport == "loopback") {
+            auto core = (seastar::this_shard_id() + 1) % seastar::smp::count;
+            return seastar::smp::submit_to(core, [] {
+                auto ep = RPC().getServerEndpoint(TCPRPCProtocol::proto);
+                return ep ? ep->url : String();
+            })
+            .then([] (String&& url) {
+                if (url.empty()) {
+                    return seastar::make_exception_future<std::vector<String>>(std::runtime_error("the loopback transport needs tcp_endpoints for this process"));
+                }
+                return seastar::make_ready_future<std::vector<String>>(std::vector<String>{std::move(url)});
+            });
+        }
+        for (auto& url: _remotes()) {
+            auto ep = TXEndpoint::fromURL(url, nullptr);
+            if (!ep) {
+                K2LOG_W(log::txbench, "skipping invalid remote endpoint {}", url);
+            }
+            else if (transport == "remote" || (transport == "tcp" && ep->protocol == TCPRPCProtocol::proto) ||
+                     (transport == "rrdma" && (ep->protocol == RRDMARPCProtocol::proto || ep->protocol == AutoRRDMARPCProtocol::proto))) {
+                urls.push_back(url);
+            }
+        }
+        if (urls.empty()) {
+            return seastar::make_exception_future<std::vector<String>>(std::runtime_error(fmt::format("no remote endpoints for transport {}", transport)));
+        }
+        return seastar::make_ready_future<std::vector<String>>(std::move(urls));
+    }
+
+    seastar::future<> _runMatrix() {
+        _transportList = _valuesOr(_transports(), String("remote"));
+        _sizes = _valuesOr(_requestSizes(), _requestSize());
+        _depths = _valuesOr(_pipelineDepths(), _pipelineDepth());
+        _conns = _valuesOr(_multiConns(), _multiConn());
+        return seastar::do_for_each(_transportList, [this] (const String& transport) {
+            return _transportURLs(transport).then([this, transport] (std::vector<String>&& urls) {
+                return seastar::do_with(std::move(urls), [this, transport] (auto& urls) {
+                    return seastar::do_for_each(_sizes, [this, transport, &urls] (uint32_t requestSize) {
+                        return seastar::do_for_each(_depths, [this, transport, &urls, requestSize] (uint32_t depth) {
+                            return seastar::do_for_each(_conns, [this, transport, &urls, requestSize, depth] (uint32_t conns) {
+                                if (_stopped) {
+                                    return seastar::make_ready_future();
+                                }
+                                CellResult cell{.transport = transport, .requestSize = requestSize, .responseSize = _responseSize(),
+                                                .pipelineDepth = depth, .conns = conns, .cores = 1};
+                                return _runCell(std::move(cell), urls);
+                            });
+                        });
+                    });
+                });
+            });
+        });
+    }
+
+    // runs one cell of the matrix in a new session, with each connection to the next one of the given endpoints
+    seastar::future<> _runCell(CellResult&& cell, const std::vector<String>& urls) {
+        _session = BenchSession(0, cell.requestSize);
+        auto myid = seastar::this_shard_id();
+        // push all eps to talk to, starting with mine
+        for (size_t i = myid; i < cell.conns + myid; ++i) {
+            _session.endpoints.push_back(k2::RPC().getTXEndpoint(urls[i%urls.size()]));
+        }
+        _results.push_back(std::move(cell));
+        return _startSession()
+        .then([this]() {
+            K2LOG_I(log::txbench, "Starting benchmark in session: {}", _session.sessionId);
+            return _benchmark(_results.back());
+        });
+    }
 
     seastar::future<> _startSession() {
-        registerMetrics();
         TXBenchStartSession startReq{.responseSize=_responseSize()};
         std::vector<seastar::future<>> futs;
         for (auto& ep: _session.endpoints) {
             futs.push_back(
-                k2::RPC().callRPC<TXBenchStartSession, TXBenchStartSessionAck>(MsgVerbs::START_SESSION, startReq, *ep, _multiConn()*1s)
+                k2::RPC().callRPC<TXBenchStartSession, TXBenchStartSessionAck>(MsgVerbs::START_SESSION, startReq, *ep, _session.endpoints.size()*1s)
                 .then([this](auto&& reply) mutable {
                     auto& [status, resp] = reply;
                     if (!status.is2xxOK()) {
@@ -108,70 +223,186 @@ private:
         return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result();
     }
 
-    seastar::future<> _benchmark() {
-        K2LOG_I(log::txbench, "Starting benchmark for main remote={}, with requestSize={}, with responseSize={}, with pipelineDepth={}, with multiConn={}, with copyData={}, with testDuration={}",
-            _session.endpoints[0]->url, _requestSize(), _responseSize(), _pipelineDepth(),
-             _multiConn(), _copyData(), _testDuration());
+    seastar::future<> _benchmark(CellResult& cell) {
+        K2LOG_I(log::txbench, "Starting benchmark for transport={}, main remote={}, with requestSize={}, with responseSize={}, with pipelineDepth={}, with multiConn={}, with copyData={}, with testDuration={}",
+            cell.transport, _session.endpoints[0]->url, cell.requestSize, cell.responseSize, cell.pipelineDepth,
+             cell.conns, _copyData(), _testDuration());
 
+        _cellDone = false;
         std::vector<seastar::future<>> reqFuts;
-        reqFuts.push_back(seastar::sleep(_testDuration()).then([this]{_stopped = true;}));
-        for (size_t i = 0; i < _pipelineDepth(); ++i) {
-            for (size_t j = 0; j < _multiConn(); ++j) {
-                reqFuts.push_back(_runRequest(*_session.endpoints[j]));
+        reqFuts.push_back(seastar::sleep(_testDuration()).then([this]{_cellDone = true;}));
+        for (size_t i = 0; i < cell.pipelineDepth; ++i) {
+            for (size_t j = 0; j < cell.conns; ++j) {
+                reqFuts.push_back(_runRequest(*_session.endpoints[j], cell));
             }
         }
-        return seastar::when_all_succeed(reqFuts.begin(), reqFuts.end());
+        auto started = k2::Clock::now();
+        return seastar::when_all_succeed(reqFuts.begin(), reqFuts.end()).discard_result()
+        .then([&cell, started] {
+            cell.elapsed = k2::Clock::now() - started;
+        });
     }
 
-    seastar::future<> _runRequest(k2::TXEndpoint& ep) {
+    seastar::future<> _runRequest(k2::TXEndpoint& ep, CellResult& cell) {
         return seastar::do_until(
-            [this] { return _stopped; },
-            [this, &ep] {
+            [this] { return _stopped || _cellDone; },
+            [this, &ep, &cell] {
+                auto started = k2::Clock::now();
+                auto done = [this, &cell, started] (auto&& fut) {
+                    bool ok = !fut.failed() && std::get<0>(fut.get0()).is2xxOK();
+                    if (fut.failed()) {
+                        K2LOG_W_EXC(log::txbench, fut.get_exception(), "request failed");
+                    }
+                    if (!ok) {
+                        cell.errors++;
+                        return;
+                    }
+                    auto latency = k2::Clock::now() - started;
+                    cell.count++;
+                    cell.bytes += cell.requestSize + cell.responseSize;
+                    cell.latency.add(latency);
+                    _totalCount++;
+                    _totalSize += cell.requestSize + cell.responseSize;
+                    _requestLatency.add(latency);
+                };
                 if (_copyData()) {
                     TXBenchRequest<k2::String> req;
                     req.data.val = _session.dataCopy;
                     req.sessionId = _session.sessionId;
-                    auto started = k2::Clock::now();
-                    return k2::RPC().callRPC<TXBenchRequest<k2::String>, TXBenchResponse<k2::Payload>>(MsgVerbs::REQUEST_COPY, req, ep, 1s)
-                    .then([this, started] (auto&&) {
-                        _session.totalCount ++;
-                        _session.totalSize += _requestSize() + _responseSize();
-                        _requestLatency.add(k2::Clock::now() - started);
-                    });
+                    return k2::RPC().callRPC<TXBenchRequest<k2::String>, TXBenchResponse<k2::Payload>>(MsgVerbs::REQUEST_COPY, req, ep, _requestTimeout())
+                    .then_wrapped(std::move(done));
                 }
                 else {
                     TXBenchRequest<k2::Payload> req;
                     req.data.val = _session.dataShare.shareAll();
                     req.sessionId = _session.sessionId;
-                    auto started = k2::Clock::now();
-                    return k2::RPC().callRPC<TXBenchRequest<k2::Payload>, TXBenchResponse<k2::Payload>>(MsgVerbs::REQUEST, req, ep, 1s)
-                    .then([this, started] (auto&&) {
-                        _session.totalCount ++;
-                        _session.totalSize += _requestSize() + _responseSize();
-                        _requestLatency.add(k2::Clock::now() - started);
+                    return k2::RPC().callRPC<TXBenchRequest<k2::Payload>, TXBenchResponse<k2::Payload>>(MsgVerbs::REQUEST, req, ep, _requestTimeout())
+                    .then_wrapped(std::move(done));
+                }
+            });
+    }
+
+    // sums up the results of all cores and writes them out
+    seastar::future<> _report() {
+        return AppBase().getDist<Client>().map_reduce0(
+            [] (const Client& client) { return client.results(); },
+            std::vector<CellResult>{},
+            [] (std::vector<CellResult>&& total, std::vector<CellResult>&& core) {
+                if (total.empty()) {
+                    return std::move(core);
+                }
+                for (size_t i = 0; i < std::min(total.size(), core.size()); ++i) {
+                    total[i].merge(core[i]);
+                }
+                return std::move(total);
+            })
+        .then([this] (std::vector<CellResult>&& total) {
+            _writeBenchResults(total);
+            bool json = _reportFormat() == "json";
+            nlohmann::json report = nlohmann::json::array();
+            std::vector<String> lines{"transport,request_size,response_size,pipeline_depth,conns,cores,msgs_per_sec,gbps,p50_us,p90_us,p99_us,p999_us,errors"};
+            for (auto& cell: total) {
+                double secs = std::max<double>(k2::usec(cell.elapsed).count(), 1) / 1'000'000;
+                double msgsPerSec = cell.count / secs;
+                double gbps = cell.bytes * 8 / secs / 1'000'000'000;
+                if (json) {
+                    report.push_back({
+                        {"transport", cell.transport.c_str()}, {"request_size", cell.requestSize}, {"response_size", cell.responseSize},
+                        {"pipeline_depth", cell.pipelineDepth}, {"conns", cell.conns}, {"cores", cell.cores},
+                        {"msgs_per_sec", msgsPerSec}, {"gbps", gbps}, {"p50_us", cell.latency.percentile(0.5)},
+                        {"p90_us", cell.latency.percentile(0.9)}, {"p99_us", cell.latency.percentile(0.99)},
+                        {"p999_us", cell.latency.percentile(0.999)}, {"errors", cell.errors}
                     });
+                }
+                else {
+                    lines.push_back(fmt::format("{},{},{},{},{},{},{:.0f},{:.3f},{},{},{},{},{}", cell.transport, cell.requestSize,
+                        cell.responseSize, cell.pipelineDepth, cell.conns, cell.cores, msgsPerSec, gbps,
+                        cell.latency.percentile(0.5), cell.latency.percentile(0.9), cell.latency.percentile(0.99),
+                        cell.latency.percentile(0.999), cell.errors));
+                }
+            }
+            if (json) {
+                lines = {String(report.dump(2))};
+            }
 
+            if (_reportPath().empty()) {
+                for (auto& line: lines) {
+                    K2LOG_I(log::txbench, "{}", line);
                 }
-            });
+                return;
+            }
+            std::ofstream out(_reportPath());
+            for (auto& line: lines) {
+                out << line << "\n";
+            }
+            if (!out) {
+                K2LOG_E(log::txbench, "unable to write the report to {}", _reportPath());
+                return;
+            }
+            K2LOG_I(log::txbench, "wrote the results of {} cells to {}", total.size(), _reportPath());
+        });
+    }
+
+    // appends the cells to the bench_results file, in the common benchmark result schema
+    void _writeBenchResults(const std::vector<CellResult>& total) {
+        if (_benchResults().empty()) {
+            return;
+        }
+        std::vector<k2::BenchResult> results;
+        for (auto& cell: total) {
+            auto result = k2::BenchResult::make("rpcbench", fmt::format("{}/{}/{}/{}", cell.transport, cell.requestSize,
+                cell.pipelineDepth, cell.conns));
+            result.config = {
+                {"transport", cell.transport.c_str()}, {"request_size", std::to_string(cell.requestSize)},
+                {"response_size", std::to_string(cell.responseSize)}, {"pipeline_depth", std::to_string(cell.pipelineDepth)},
+                {"conns", std::to_string(cell.conns)}, {"copy_data", std::to_string(_copyData())}
+            };
+            result.counters = {{"msgs", cell.count}, {"bytes", cell.bytes}, {"errors", cell.errors}};
+            result.histograms.emplace("latency", cell.latency);
+            result.elapsed = cell.elapsed;
+            results.push_back(std::move(result));
+        }
+        if (!k2::appendBenchResults(_benchResults(), results)) {
+            K2LOG_E(log::txbench, "unable to write the benchmark results to {}", _benchResults());
+        }
     }
 
 private:
+    k2::ConfigVar<k2::String> _benchResults{"bench_results", ""};
     k2::ConfigVar<std::vector<k2::String>> _remotes{"remote_eps"};
     k2::ConfigDuration _testDuration{"test_duration", 30s};
+    k2::ConfigDuration _requestTimeout{"request_timeout", 1s};
     k2::ConfigVar<uint32_t> _requestSize{"request_size"};
     k2::ConfigVar<uint32_t> _responseSize{"response_size"};
     k2::ConfigVar<uint32_t> _pipelineDepth{"pipeline_depth"};
     k2::ConfigVar<bool> _copyData{"copy_data"};
     k2::ConfigVar<uint32_t> _multiConn{"multi_conn"};
+    // the dimensions of the matrix. An empty list runs only the single value from the options above
+    k2::ConfigVar<std::vector<k2::String>> _transports{"transports"};
+    k2::ConfigVar<std::vector<uint32_t>> _requestSizes{"request_sizes"};
+    k2::ConfigVar<std::vector<uint32_t>> _pipelineDepths{"pipeline_depths"};
+    k2::ConfigVar<std::vector<uint32_t>> _multiConns{"multi_conns"};
+    k2::ConfigVar<k2::String> _reportFormat{"report_format", "csv"};
+    k2::ConfigVar<k2::String> _reportPath{"report_path", ""};
+    std::vector<k2::String> _transportList;
+    std::vector<uint32_t> _sizes;
+    std::vector<uint32_t> _depths;
+    std::vector<uint32_t> _conns;
     BenchSession _session;
+    std::vector<CellResult> _results;
+    uint64_t _totalCount = 0;
+    uint64_t _totalSize = 0;
     sm::metric_groups _metric_groups;
     k2::ExponentialHistogram _requestLatency;
     seastar::future<> _benchFut = seastar::make_ready_future();
     bool _stopped = true;
+    bool _cellDone = false;
 }; // class Client
 
 int main(int argc, char** argv) {
     k2::App app("RPCBenchClient");
+    // serves the loopback transport
+    app.addApplet<Service>();
     app.addApplet<Client>();
     app.addOptions()
         ("request_size", bpo::value<uint32_t>()->default_value(512), "How many bytes to send with each request")
@@ -180,6 +411,13 @@ int main(int argc, char** argv) {
         ("response_size", bpo::value<uint32_t>()->default_value(512), "How many bytes to receive with each response")
         ("pipeline_depth", bpo::value<uint32_t>()->default_value(10), "How many requests to have in the pipeline")
         ("remote_eps", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "A list(space-delimited) of remote endpoints to assign to each core. e.g. 'tcp+k2rpc://192.168.1.2:12345'")
-        ("test_duration", bpo::value<k2::ParseableDuration>(), "How long to run");
+        ("test_duration", bpo::value<k2::ParseableDuration>(), "How long to run each cell of the matrix")
+        ("request_timeout", bpo::value<k2::ParseableDuration>(), "Timeout of each request. Requests which time out are counted as errors")
+        ("transports", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of transports to run: tcp and rrdma pick the remote_eps of their protocol, loopback sends to the next core of this process(needs tcp_endpoints)")
+        ("request_sizes", bpo::value<std::vector<uint32_t>>()->multitoken(), "A list(space-delimited) of request sizes to run, instead of request_size")
+        ("pipeline_depths", bpo::value<std::vector<uint32_t>>()->multitoken(), "A list(space-delimited) of pipeline depths to run, instead of pipeline_depth")
+        ("multi_conns", bpo::value<std::vector<uint32_t>>()->multitoken(), "A list(space-delimited) of conns per core to run, instead of multi_conn")
+        ("report_format", bpo::value<k2::String>(), "The format of the results: csv or json")
+        ("report_path", bpo::value<k2::String>(), "The file to write the results to. They are logged if not set");
     return app.start(argc, argv);
 }
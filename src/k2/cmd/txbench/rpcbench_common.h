@@ -39,7 +39,7 @@ struct BenchSession {
     BenchSession(BenchSession&&)=default;
     BenchSession& operator=(BenchSession&&)=default;
     BenchSession(uint64_t sessionId, size_t dataSize): sessionId(sessionId) {
-        dataCopy = String('.', dataSize);
+        dataCopy = String(dataSize, '.');
         dataShare.write(dataCopy);
     }
 
@@ -0,0 +1,182 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <random>
+
+#include <k2/common/Common.h>
+
+// The key distributions and operation mixes of the YCSB core workloads(see the workload files of YCSB)
+namespace k2::ycsb {
+
+// Operations of a workload
+enum class Op : uint8_t {
+    Read,
+    Update,
+    Insert,
+    Scan,
+    ReadModifyWrite
+};
+
+// the proportions of the operations of a workload. They don't need to add up to 1
+struct Mix {
+    double read = 0;
+    double update = 0;
+    double insert = 0;
+    double scan = 0;
+    double rmw = 0;
+
+    Op choose(std::mt19937_64& rng) const {
+        double total = read + update + insert + scan + rmw;
+        double pick = std::uniform_real_distribution<double>(0, total)(rng);
+        if ((pick -= read) < 0) return Op::Read;
+        if ((pick -= update) < 0) return Op::Update;
+        if ((pick -= insert) < 0) return Op::Insert;
+        if ((pick -= scan) < 0) return Op::Scan;
+        return Op::ReadModifyWrite;
+    }
+};
+
+enum class Distribution : uint8_t {
+    Uniform,
+    // zipfian over the records, with the popular records scattered over the key space
+    Zipfian,
+    // zipfian over the most recently inserted records
+    Latest
+};
+
+inline std::optional<Distribution> distributionFromString(const String& name) {
+    if (name == "uniform") return Distribution::Uniform;
+    if (name == "zipfian") return Distribution::Zipfian;
+    if (name == "latest") return Distribution::Latest;
+    return std::nullopt;
+}
+
+struct Workload {
+    Mix mix;
+    Distribution distribution;
+};
+
+// The standard workloads A-F
+inline std::optional<Workload> preset(const String& name) {
+    if (name == "A") return Workload{.mix={.read=0.5, .update=0.5}, .distribution=Distribution::Zipfian};
+    if (name == "B") return Workload{.mix={.read=0.95, .update=0.05}, .distribution=Distribution::Zipfian};
+    if (name == "C") return Workload{.mix={.read=1}, .distribution=Distribution::Zipfian};
+    if (name == "D") return Workload{.mix={.read=0.95, .insert=0.05}, .distribution=Distribution::Latest};
+    if (name == "E") return Workload{.mix={.insert=0.05, .scan=0.95}, .distribution=Distribution::Zipfian};
+    if (name == "F") return Workload{.mix={.read=0.5, .rmw=0.5}, .distribution=Distribution::Zipfian};
+    return std::nullopt;
+}
+
+// Zipfian over [0, items) with 0 the most popular item, using the method of Gray et al., "Quickly generating
+// billion-record synthetic databases". The number of items may grow between calls, in which case zeta is
+// extended incrementally rather than recomputed
+class Zipfian {
+public:
+    Zipfian(uint64_t items, double theta=0.99) : _theta(theta), _alpha(1.0 / (1.0 - theta)),
+        _zeta2(_zeta(0, 2, 0)), _zetaN(_zeta(0, items, 0)), _items(items) {
+        _computeEta();
+    }
+
+    uint64_t next(std::mt19937_64& rng, uint64_t items) {
+        if (items > _items) {
+            _zetaN = _zeta(_items, items, _zetaN);
+            _items = items;
+            _computeEta();
+        }
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * _zetaN;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, _theta)) return std::min<uint64_t>(1, _items - 1);
+        auto result = uint64_t(_items * std::pow(_eta * u - _eta + 1, _alpha));
+        return std::min(result, _items - 1);
+    }
+
+private:
+    double _zeta(uint64_t from, uint64_t to, double initial) const {
+        double sum = initial;
+        for (uint64_t i = from; i < to; ++i) {
+            sum += 1.0 / std::pow(double(i + 1), _theta);
+        }
+        return sum;
+    }
+
+    void _computeEta() {
+        _eta = (1.0 - std::pow(2.0 / _items, 1.0 - _theta)) / (1.0 - _zeta2 / _zetaN);
+    }
+
+    double _theta;
+    double _alpha;
+    double _zeta2;
+    double _zetaN;
+    double _eta = 0;
+    uint64_t _items;
+};
+
+// Picks the ids of the records for the operations other than inserts, out of the records inserted so far
+class KeyChooser {
+public:
+    KeyChooser(Distribution distribution, uint64_t records, double theta) :
+        _distribution(distribution), _zipfian(std::max<uint64_t>(records, 2), theta) {}
+
+    // a record id in [0, records)
+    uint64_t next(std::mt19937_64& rng, uint64_t records) {
+        switch (_distribution) {
+            case Distribution::Uniform:
+                return std::uniform_int_distribution<uint64_t>(0, records - 1)(rng);
+            case Distribution::Zipfian:
+                return _fnv(_zipfian.next(rng, records)) % records;
+            case Distribution::Latest:
+            default:
+                return records - 1 - _zipfian.next(rng, records);
+        }
+    }
+
+private:
+    // FNV-1a over the bytes of the id, so that the popular ids are not next to each other
+    static uint64_t _fnv(uint64_t id) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (int i = 0; i < 8; ++i) {
+            hash ^= id & 0xff;
+            hash *= 1099511628211ull;
+            id >>= 8;
+        }
+        return hash;
+    }
+
+    Distribution _distribution;
+    Zipfian _zipfian;
+};
+
+// The key of a record id. Ids are zero-padded so that the scans of workload E go over consecutive ids
+inline String recordKey(uint64_t id) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user%016lu", (unsigned long)id);
+    return String(buf);
+}
+
+} // ns k2::ycsb
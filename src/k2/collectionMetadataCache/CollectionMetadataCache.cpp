@@ -22,7 +22,11 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include "CollectionMetadataCache.h"
+
 #include <k2/common/Log.h>
+#include <k2/dto/MessageVerbs.h>
+#include <k2/transport/RPCDispatcher.h>
+#include <k2/transport/TCPRPCProtocol.h>
 
 namespace k2 {
 
@@ -36,11 +40,196 @@ CollectionMetadataCache::~CollectionMetadataCache() {
 
 seastar::future<> CollectionMetadataCache::gracefulStop() {
     K2LOG_I(log::collcache, "stop");
-    return seastar::make_ready_future<>();
+    if (!_cpo.subscriber.empty()) {
+        RPC().registerMessageObserver(dto::Verbs::CPO_COLLECTION_CHANGE, nullptr);
+    }
+    return _gate.close().then([this] {
+        _entries.clear();
+    });
 }
 
 seastar::future<> CollectionMetadataCache::start() {
+    _registerMetrics();
+    if (seastar::this_shard_id() != 0) {
+        return seastar::make_ready_future<>();
+    }
+    // only core 0 talks to the CPO
+    _cpo = CPOClient(_cpoEndpoint());
+    auto ep = RPC().getServerEndpoint(TCPRPCProtocol::proto);
+    if (_subscribe() && ep) {
+        _cpo.subscriber = ep->url;
+        RPC().registerRPCObserver<dto::CollectionChangeRequest, dto::CollectionChangeResponse>
+        (dto::Verbs::CPO_COLLECTION_CHANGE, [this] (dto::CollectionChangeRequest&& request) {
+            K2LOG_D(log::collcache, "received collection change {}", request);
+            _applyChange(std::move(request));
+            return RPCResponse(Statuses::S200_OK("change applied"), dto::CollectionChangeResponse{});
+        });
+    }
     return seastar::make_ready_future<>();
 }
 
+void CollectionMetadataCache::_registerMetrics() {
+    _metricGroups.clear();
+    std::vector<sm::label_instance> labels;
+    labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+
+    _metricGroups.add_group("collection_metadata_cache", {
+        sm::make_counter("hits", _hits, sm::description("Lookups of collections which were cached on the core"), labels),
+        sm::make_counter("misses", _misses, sm::description("Lookups of collections which had to be fetched"), labels),
+        sm::make_counter("installs", _installs, sm::description("Entries published to the core by core 0"), labels),
+        sm::make_gauge("collections", [this]{ return _entries.size();}, sm::description("Number of collections cached on the core"), labels),
+    });
+}
+
+CollectionMetadataCache::EntryPtr CollectionMetadataCache::get(const String& name) const {
+    auto it = _entries.find(name);
+    return it == _entries.end() ? EntryPtr() : it->second;
+}
+
+seastar::future<std::tuple<Status, CollectionMetadataCache::EntryPtr>>
+CollectionMetadataCache::getOrFetch(const String& name) {
+    auto entry = get(name);
+    if (entry) {
+        _hits++;
+        return seastar::make_ready_future<std::tuple<Status, EntryPtr>>(std::make_tuple(Statuses::S200_OK(""), std::move(entry)));
+    }
+    _misses++;
+    return refresh(name).then([this, name] (Status&& status) {
+        return std::make_tuple(std::move(status), get(name));
+    });
+}
+
+seastar::future<Status> CollectionMetadataCache::refresh(const String& name) {
+    // the entry is installed on all cores by the time core 0 responds
+    return AppBase().getDist<CollectionMetadataCache>().invoke_on(0, &CollectionMetadataCache::_fetch, name);
+}
+
+seastar::future<> CollectionMetadataCache::invalidate(const String& name) {
+    return AppBase().getDist<CollectionMetadataCache>().invoke_on_all([name] (CollectionMetadataCache& cache) {
+        cache._entries.erase(name);
+        if (seastar::this_shard_id() == 0) {
+            cache._cpo.collections.erase(name);
+        }
+    });
+}
+
+void CollectionMetadataCache::attach(CPOClient& client) {
+    client.collectionSource = [this, &client] (const String& name) {
+        // the client asks again when its copy is missing or stale
+        auto entry = get(name);
+        auto known = client.collections.find(name);
+        if (entry && (known == client.collections.end() ||
+                      entry->collection.partitionMap.version > known->second.collection.partitionMap.version)) {
+            _hits++;
+            return seastar::make_ready_future<std::tuple<Status, dto::Collection>>(
+                std::make_tuple(Statuses::S200_OK(""), entry->collection));
+        }
+        _misses++;
+        return refresh(name).then([this, name] (Status&& status) {
+            auto entry = get(name);
+            if (!status.is2xxOK() || !entry) {
+                return std::make_tuple(std::move(status), dto::Collection{});
+            }
+            return std::make_tuple(std::move(status), entry->collection);
+        });
+    };
+    // schemas are created at any time, so a client asking for them always gets them fetched again. Concurrent
+    // requests from all cores still share one fetch
+    client.schemaSource = [this] (const String& name) {
+        return refresh(name).then([this, name] (Status&& status) {
+            auto entry = get(name);
+            if (!status.is2xxOK() || !entry) {
+                return std::make_tuple(std::move(status), std::vector<dto::Schema>{});
+            }
+            return std::make_tuple(std::move(status), entry->schemas);
+        });
+    };
+}
+
+seastar::future<Status> CollectionMetadataCache::_fetch(String name) {
+    if (_gate.is_closed()) {
+        return seastar::make_ready_future<Status>(Statuses::S503_Service_Unavailable("collection cache is stopping"));
+    }
+    return _fetches.get(name, 0s, [this, name] {
+        return seastar::with_gate(_gate, [this, name] {
+            return seastar::do_with(dto::CollectionGetRequest{.name=name, .subscriber=_cpo.subscriber}, [this] (auto& request) {
+                return RPC().callRPC<dto::CollectionGetRequest, dto::CollectionGetResponse>
+                    (dto::Verbs::CPO_COLLECTION_GET, request, *_cpo.cpo, _fetchTimeout());
+            })
+            .then([this, name] (auto&& result) {
+                auto& [status, response] = result;
+                if (!status.is2xxOK()) {
+                    K2LOG_D(log::collcache, "unable to fetch collection {}: {}", name, status);
+                    return seastar::make_ready_future<Status>(std::move(status));
+                }
+                _cpo.collections[name] = dto::PartitionGetter(std::move(response.collection));
+                return _cpo.getSchemas(name)
+                .then([this, name] (auto&& result) {
+                    auto& [status, schemas] = result;
+                    auto it = _cpo.collections.find(name);
+                    if (!status.is2xxOK() || it == _cpo.collections.end()) {
+                        K2LOG_D(log::collcache, "unable to fetch the schemas of collection {}: {}", name, status);
+                        return seastar::make_ready_future<Status>(std::move(status));
+                    }
+                    return _publish(Entry{.collection=it->second.collection, .schemas=std::move(schemas)})
+                    .then([] {
+                        return Statuses::S200_OK("collection cached");
+                    });
+                });
+            });
+        })
+        .handle_exception([name] (auto exc) {
+            K2LOG_W_EXC(log::collcache, exc, "failed to fetch collection {}", name);
+            return Statuses::S503_Service_Unavailable("unable to fetch collection");
+        });
+    });
+}
+
+seastar::future<> CollectionMetadataCache::_publish(Entry entry) {
+    entry.generation = ++_generation;
+    K2LOG_D(log::collcache, "publishing collection {} at version {}, generation {}",
+            entry.collection.metadata.name, entry.collection.partitionMap.version, entry.generation);
+    return AppBase().getDist<CollectionMetadataCache>().invoke_on_all([entry=std::move(entry)] (CollectionMetadataCache& cache) {
+        // copied on the target core so that the entry only references memory of its core
+        cache._install(Entry(entry));
+    });
+}
+
+void CollectionMetadataCache::_install(Entry&& entry) {
+    auto& current = _entries[entry.collection.metadata.name];
+    if (current && current->generation >= entry.generation) {
+        return;
+    }
+    _installs++;
+    // users of the previous entry keep it until they drop their reference to it
+    current = seastar::make_lw_shared<const Entry>(std::move(entry));
+}
+
+void CollectionMetadataCache::_applyChange(dto::CollectionChangeRequest&& change) {
+    String name = change.name;
+    auto entry = get(name);
+    if (!entry) {
+        return;
+    }
+    _cpo.applyCollectionChange(std::move(change));
+    auto it = _cpo.collections.find(name);
+    if (it == _cpo.collections.end()) {
+        // we missed a change. Fetch the whole collection again
+        if (!_gate.is_closed()) {
+            (void) seastar::with_gate(_gate, [this, name] {
+                return _fetch(name).then([name] (Status&& status) {
+                    K2LOG_D(log::collcache, "refreshed collection {} after a missed change: {}", name, status);
+                });
+            });
+        }
+        return;
+    }
+    if (it->second.collection.partitionMap.version == entry->collection.partitionMap.version || _gate.is_closed()) {
+        return;
+    }
+    (void) seastar::with_gate(_gate, [this, entry, collection=it->second.collection] () mutable {
+        return _publish(Entry{.collection=std::move(collection), .schemas=entry->schemas});
+    });
+}
+
 }  // namespace k2
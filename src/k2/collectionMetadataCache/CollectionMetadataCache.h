@@ -23,15 +23,41 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <unordered_map>
+#include <vector>
+
 // third-party
 #include <seastar/core/future.hh>  // for future stuff
+#include <seastar/core/gate.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include <k2/appbase/AppEssentials.h>
 #include <k2/common/Log.h>
+#include <k2/cpo/client/CPOClient.h>
+#include <k2/dto/Collection.h>
+#include <k2/dto/ControlPlaneOracle.h>
 
 namespace k2 {
 namespace log {
 inline thread_local k2::logging::Logger collcache("k2::collmd_cache");
 }
+
+// The collections, schemas and partition maps known to this node, shared by the modules of all cores so that
+// each collection is fetched from the CPO once per node.
+// Core 0 fetches the metadata and publishes it to every core as an immutable entry. A newer entry replaces the
+// older one on each core, and users which still hold the older entry keep it alive until they drop it, so
+// lookups are plain local reads and never wait for an update (read-copy-update).
+// Core 0 also subscribes to the changes the CPO pushes for the fetched collections, and publishes them the same way
 class CollectionMetadataCache {
+public:
+    struct Entry {
+        dto::Collection collection;
+        std::vector<dto::Schema> schemas;
+        // bumped on core 0 by every publish, so that cores never go back to an older entry
+        uint64_t generation = 0;
+    };
+    using EntryPtr = seastar::lw_shared_ptr<const Entry>;
+
 public:  // application lifespan
     CollectionMetadataCache();
     ~CollectionMetadataCache();
@@ -39,6 +65,51 @@ public:  // application lifespan
     // required for seastar::distributed interface
     seastar::future<> gracefulStop();
     seastar::future<> start();
+
+    // The current entry of the collection on this core, or null if it is not cached
+    EntryPtr get(const String& name) const;
+
+    // Same as above, fetching the collection on a miss
+    seastar::future<std::tuple<Status, EntryPtr>> getOrFetch(const String& name);
+
+    // Fetches the collection and its schemas from the CPO again and publishes them to all cores. Concurrent
+    // refreshes of a collection share one fetch
+    seastar::future<Status> refresh(const String& name);
+
+    // Drops the collection on all cores
+    seastar::future<> invalidate(const String& name);
+
+    // Makes the client look up collections and schemas here instead of in the CPO. A client which asks for a
+    // collection gets the cached entry if it is newer than its own copy, and otherwise a refreshed one.
+    // The client must not outlive this core's cache
+    void attach(CPOClient& client);
+
+private:
+    // core 0 only: fetches and publishes the collection
+    seastar::future<Status> _fetch(String name);
+    seastar::future<> _publish(Entry entry);
+    void _applyChange(dto::CollectionChangeRequest&& change);
+
+    // replaces the entry of the collection on this core, unless we have a newer one
+    void _install(Entry&& entry);
+    void _registerMetrics();
+
+    std::unordered_map<String, EntryPtr> _entries;
+
+    // core 0 only. The partition maps in the client are the master copies, which pushed changes are applied to
+    CPOClient _cpo;
+    CoalescingCache<Status> _fetches;
+    uint64_t _generation = 0;
+    seastar::gate _gate;
+
+    ConfigVar<String> _cpoEndpoint{"k23si_cpo_endpoint", "tcp+k2rpc://127.0.0.1:12345"};
+    ConfigDuration _fetchTimeout{"collection_cache_fetch_timeout", 1s};
+    ConfigVar<bool> _subscribe{"collection_cache_subscribe", true};
+
+    sm::metric_groups _metricGroups;
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+    uint64_t _installs = 0;
 };  // class CollectionMetadataCache
 
 } // namespace k2
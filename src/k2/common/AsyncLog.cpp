@@ -0,0 +1,130 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "AsyncLog.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+#include <fmt/format.h>
+
+namespace k2::logging {
+
+AsyncLog& AsyncLog::_instance() {
+    static AsyncLog instance;
+    return instance;
+}
+
+void AsyncLog::start(size_t ringCapacity, Duration flushInterval) {
+    AsyncLog& log = _instance();
+    std::lock_guard lock(log._mutex);
+    if (log._writer.joinable()) {
+        return;
+    }
+    log._ringCapacity = std::max<size_t>(1, ringCapacity);
+    log._flushInterval = flushInterval;
+    log._stopping = false;
+    log._writer = std::thread([&log] { log._run(); });
+    _enabled = true;
+}
+
+void AsyncLog::stop() {
+    AsyncLog& log = _instance();
+    std::thread writer;
+    {
+        std::lock_guard lock(log._mutex);
+        if (!log._writer.joinable()) {
+            return;
+        }
+        _enabled = false;
+        log._stopping = true;
+        writer = std::move(log._writer);
+    }
+    log._wakeup.notify_all();
+    // the writer drains the rings once more before it exits
+    writer.join();
+}
+
+bool AsyncLog::write(std::string&& line) {
+    _Ring* ring = _instance()._threadRing();
+    if (!ring->lines.push(std::move(line))) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+uint64_t AsyncLog::dropped() {
+    AsyncLog& log = _instance();
+    std::lock_guard lock(log._mutex);
+    uint64_t result = 0;
+    for (auto& ring : log._rings) {
+        result += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+AsyncLog::_Ring* AsyncLog::_threadRing() {
+    if (!_ring) {
+        std::lock_guard lock(_mutex);
+        _ring = _rings.emplace_back(std::make_unique<_Ring>(_ringCapacity)).get();
+    }
+    return _ring;
+}
+
+size_t AsyncLog::_drain(std::string& buffer) {
+    buffer.clear();
+    size_t lines = 0;
+    uint64_t drops = 0;
+    {
+        std::lock_guard lock(_mutex);
+        for (auto& ring : _rings) {
+            lines += ring->lines.drain([&buffer] (std::string&& line) { buffer.append(line); });
+            drops += ring->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    if (drops > _reportedDrops) {
+        fmt::format_to(std::back_inserter(buffer), "[async log] dropped {} log lines since the last report\n",
+                       drops - _reportedDrops);
+        _reportedDrops = drops;
+    }
+    if (!buffer.empty()) {
+        std::cout.write(buffer.data(), buffer.size());
+        std::cout.flush();
+    }
+    return lines;
+}
+
+void AsyncLog::_run() {
+    std::string buffer;
+    while (!_stopping.load(std::memory_order_acquire)) {
+        if (_drain(buffer) == 0) {
+            std::unique_lock lock(_mutex);
+            _wakeup.wait_for(lock, _flushInterval, [this] { return _stopping.load(std::memory_order_acquire); });
+        }
+    }
+    _drain(buffer);
+}
+
+} // ns k2::logging
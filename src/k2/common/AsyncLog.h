@@ -0,0 +1,92 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chrono.h"
+#include "SPSCRing.h"
+
+namespace k2::logging {
+
+// Asynchronous backend for the K2LOG macros. While it is running, log lines below ERROR are formatted by the
+// logging thread and queued in a ring of that thread instead of being written to the log stream with a flush
+// per line. A writer thread takes the lines of all rings and writes them out in batches. When the ring of a
+// thread is full, its lines are dropped and counted; the writer reports the drops in the log.
+// ERROR and FATAL lines are still written synchronously so that they are out before a crash, and they may
+// therefore show up ahead of lower level lines which were logged before them.
+class AsyncLog {
+public:
+    // Starts the writer thread. ringCapacity is the number of lines each thread can queue, and flushInterval is
+    // how long the writer sleeps when there is nothing to write
+    static void start(size_t ringCapacity, Duration flushInterval);
+
+    // Writes out the lines queued so far and stops the writer. Logging is synchronous again afterwards
+    static void stop();
+
+    static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+
+    // Queues a formatted line(with its newline) from the calling thread. Returns false if the line was dropped
+    static bool write(std::string&& line);
+
+    // the total number of lines dropped so far
+    static uint64_t dropped();
+
+private:
+    struct _Ring {
+        explicit _Ring(size_t capacity) : lines(capacity) {}
+        SPSCRing<std::string> lines;
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    _Ring* _threadRing();
+    void _run();
+    // writes out the lines queued in all rings and returns how many there were
+    size_t _drain(std::string& buffer);
+
+    static AsyncLog& _instance();
+
+    static inline std::atomic<bool> _enabled{false};
+    // the ring of the calling thread, made on its first queued line
+    static inline thread_local _Ring* _ring = nullptr;
+
+    std::mutex _mutex; // guards the rings and start/stop
+    std::condition_variable _wakeup; // wakes the writer up early to stop
+    // the rings are never released since their threads keep pointers to them. They are kept across restarts
+    std::vector<std::unique_ptr<_Ring>> _rings;
+    std::atomic<bool> _stopping{false};
+    std::thread _writer;
+    size_t _ringCapacity = 0;
+    Duration _flushInterval{};
+    uint64_t _reportedDrops = 0;
+};
+
+} // ns k2::logging
@@ -0,0 +1,104 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "Common.h"
+
+namespace k2 {
+
+namespace detail {
+// load 8 bytes as an integer which compares the same way as the bytes do
+inline uint64_t loadOrdered64(const char* p) noexcept {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return __builtin_bswap64(v);
+}
+} // ns detail
+
+// Three-way lexicographic comparison of two byte strings (bytes compared as unsigned, shorter string first
+// on common prefix), i.e. the same ordering as String::compare. Returns <0, 0 or >0.
+// The first 8 bytes are compared as a single integer for a quick reject, and long common prefixes are
+// scanned 32 bytes at a time with AVX2.
+inline int compareBytes(const char* a, size_t alen, const char* b, size_t blen) noexcept {
+    const size_t n = std::min(alen, blen);
+    size_t i = 0;
+    if (n >= 8) {
+        uint64_t x = detail::loadOrdered64(a);
+        uint64_t y = detail::loadOrdered64(b);
+        if (x != y) {
+            return x < y ? -1 : 1;
+        }
+        i = 8;
+    }
+#ifdef __AVX2__
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (diff != 0) {
+            size_t idx = i + __builtin_ctz(diff);
+            return (uint8_t)a[idx] < (uint8_t)b[idx] ? -1 : 1;
+        }
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x = detail::loadOrdered64(a + i);
+        uint64_t y = detail::loadOrdered64(b + i);
+        if (x != y) {
+            return x < y ? -1 : 1;
+        }
+    }
+    for (; i < n; ++i) {
+        if (a[i] != b[i]) {
+            return (uint8_t)a[i] < (uint8_t)b[i] ? -1 : 1;
+        }
+    }
+    return alen == blen ? 0 : (alen < blen ? -1 : 1);
+}
+
+inline int compareBytes(const String& a, const String& b) noexcept {
+    return compareBytes(a.data(), a.size(), b.data(), b.size());
+}
+
+// The first 8 bytes of the string as an integer, zero-padded if shorter. If the prefixes of two strings
+// differ, they order the same way as the strings do. Equal prefixes need a full comparison
+inline uint64_t orderedPrefix64(const char* p, size_t len) noexcept {
+    if (len >= 8) {
+        return detail::loadOrdered64(p);
+    }
+    char buf[8] = {0};
+    std::memcpy(buf, p, len);
+    return detail::loadOrdered64(buf);
+}
+
+inline uint64_t orderedPrefix64(const String& s) noexcept {
+    return orderedPrefix64(s.data(), s.size());
+}
+
+} // ns k2
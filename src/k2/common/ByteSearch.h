@@ -0,0 +1,107 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+
+#include "Common.h"
+
+namespace k2 {
+
+// A byte string prepared once to be searched for in many haystacks, e.g. the literal of a CONTAINS filter
+// which is matched against a field of every record in a query.
+// Candidate positions are found 32 at a time with AVX2 by matching the first and the last byte of the
+// needle, and only the candidates are compared in full.
+class ByteNeedle {
+public:
+    static constexpr size_t npos = size_t(-1);
+
+    ByteNeedle() = default;
+    explicit ByteNeedle(String needle) : _needle(std::move(needle)) {}
+
+    const String& bytes() const noexcept { return _needle; }
+    size_t size() const noexcept { return _needle.size(); }
+
+    // Returns the position of the first occurrence of the needle in the haystack, or npos
+    size_t find(const char* haystack, size_t len) const noexcept {
+        const size_t n = _needle.size();
+        if (n == 0) {
+            return 0;
+        }
+        if (n > len) {
+            return npos;
+        }
+        const char* needle = _needle.data();
+        if (n == 1) {
+            const void* pos = std::memchr(haystack, needle[0], len);
+            return pos == nullptr ? npos : (const char*)pos - haystack;
+        }
+        const size_t last = n - 1;
+        size_t i = 0;
+#ifdef __AVX2__
+        const __m256i firstByte = _mm256_set1_epi8(needle[0]);
+        const __m256i lastByte = _mm256_set1_epi8(needle[last]);
+        for (; i + last + 32 <= len; i += 32) {
+            __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i));
+            __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i + last));
+            uint32_t candidates = (uint32_t)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(firstByte, blockFirst), _mm256_cmpeq_epi8(lastByte, blockLast)));
+            while (candidates != 0) {
+                size_t pos = i + __builtin_ctz(candidates);
+                if (std::memcmp(haystack + pos + 1, needle + 1, last - 1) == 0) {
+                    return pos;
+                }
+                candidates &= candidates - 1;
+            }
+        }
+#endif
+        for (; i + last < len; ++i) {
+            if (haystack[i] == needle[0] && haystack[i + last] == needle[last] &&
+                std::memcmp(haystack + i + 1, needle + 1, last - 1) == 0) {
+                return i;
+            }
+        }
+        return npos;
+    }
+
+    bool isContainedIn(const char* haystack, size_t len) const noexcept {
+        return find(haystack, len) != npos;
+    }
+
+    bool isPrefixOf(const char* haystack, size_t len) const noexcept {
+        return len >= _needle.size() && std::memcmp(haystack, _needle.data(), _needle.size()) == 0;
+    }
+
+    bool isSuffixOf(const char* haystack, size_t len) const noexcept {
+        return len >= _needle.size() &&
+               std::memcmp(haystack + (len - _needle.size()), _needle.data(), _needle.size()) == 0;
+    }
+
+private:
+    String _needle;
+};
+
+} // ns k2
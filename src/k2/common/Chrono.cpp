@@ -23,6 +23,10 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include "Chrono.h"
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
 namespace k2 {
 
 CachedSteadyClock::time_point CachedSteadyClock::now(bool refresh) noexcept {
@@ -37,4 +41,82 @@ CachedSteadyClock::time_point CachedSteadyClock::now(bool refresh) noexcept {
     }
     return _now;
 }
+
+#if defined(__x86_64__)
+namespace {
+// a TSC reading paired with Clock::now(), taken as close together as we can
+struct ClockSample {
+    uint64_t tsc;
+    TimePoint time;
+};
+
+ClockSample sampleClock() {
+    uint64_t before = __rdtsc();
+    auto time = Clock::now();
+    uint64_t after = __rdtsc();
+    return {before + (after - before) / 2, time};
+}
+
+// The nanoseconds per tick in 32.32 fixed point between the two samples
+uint64_t nsPerTick(const ClockSample& from, const ClockSample& to) {
+    auto ns = nsec(to.time - from.time).count();
+    uint64_t ticks = to.tsc - from.tsc;
+    if (ns <= 0 || ticks == 0) {
+        return 0;
+    }
+    return (uint64_t)(((unsigned __int128)ns << 32) / ticks);
+}
+
+// The process-wide TSC rate, used to seed each thread. The TSC is only usable if it is invariant, i.e. it ticks at
+// the same rate regardless of the power state and is synchronized across the cores
+struct TSCCalibration {
+    bool invariant = false;
+    uint64_t nsPerTick = 0;
+
+    TSCCalibration() {
+        unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+            return;
+        }
+        // spin for a bit to get a first estimate of the rate. The threads refine it as they re-anchor
+        auto from = sampleClock();
+        auto to = from;
+        while (to.time - from.time < 10ms) {
+            to = sampleClock();
+        }
+        nsPerTick = k2::nsPerTick(from, to);
+        invariant = nsPerTick > 0;
+    }
+};
+}
+
+TSCClock::time_point TSCClock::_resync() noexcept {
+    static const TSCCalibration calibration;
+    auto& st = _state;
+    if (!calibration.invariant) {
+        st.fallback = true;
+        return Clock::now();
+    }
+    auto sample = sampleClock();
+    if (st.nsPerTick == 0) {
+        st.nsPerTick = calibration.nsPerTick;
+    } else {
+        // an anchor at least kResyncInterval old gives a precise rate. Smooth it in so that a single sample
+        // which was interrupted between its two reads can't skew the clock
+        auto measured = nsPerTick({st.anchorTsc, st.anchorTime}, sample);
+        if (measured > 0) {
+            st.nsPerTick = (7 * st.nsPerTick + measured) / 8;
+        }
+    }
+    st.anchorTsc = sample.tsc;
+    st.anchorTime = sample.time;
+    st.resyncTicks = (uint64_t)(((unsigned __int128)nsec(kResyncInterval).count() << 32) / st.nsPerTick);
+    st.last = std::max(st.last, sample.time);
+    return st.last;
+}
+#else
+TSCClock::time_point TSCClock::_resync() noexcept {
+    return Clock::now();
+}
+#endif
 } // ns k2
@@ -35,6 +35,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <seastar/core/sstring.hh>
 #include <seastar/core/temporary_buffer.hh>
 #include <set>
+#include <string_view>
 #include <unordered_set>
 #include <vector>
 
@@ -93,9 +94,41 @@ typedef seastar::sstring String;
 typedef seastar::temporary_buffer<char> Binary;
 
 //
-// The type for a function which can allocate Binary
+// The type for a function which can allocate Binary. It is called with the suggested size in bytes, but it is
+// free to return a binary of any (non-zero) size, e.g. when it hands out fixed-size segments
 //
-typedef std::function<Binary()> BinaryAllocatorFunctor;
+typedef std::function<Binary(size_t)> BinaryAllocatorFunctor;
+
+//
+// StringView is a read-only string which references (shares) the bytes of a Binary instead of owning a copy.
+// Reading one from a Payload does not allocate when the string is inside a single payload buffer, and it keeps
+// that buffer alive. Use materialize() when an owned String is needed, e.g. to store the value past the request
+//
+class StringView {
+public:
+    StringView() = default;
+    explicit StringView(Binary&& data) : _data(std::move(data)) {}
+    DEFAULT_MOVE(StringView);
+
+    const char* data() const { return _data.get(); }
+    size_t size() const { return _data.size(); }
+    bool empty() const { return _data.empty(); }
+    std::string_view view() const { return std::string_view(data(), size()); }
+
+    // another view of the same bytes
+    StringView share() { return StringView(_data.share()); }
+
+    // an owned copy of the bytes
+    String materialize() const { return String(data(), size()); }
+
+    bool operator==(const StringView& o) const { return view() == o.view(); }
+    bool operator==(const String& o) const { return view() == std::string_view(o.data(), o.size()); }
+    bool operator!=(const StringView& o) const { return !operator==(o); }
+    bool operator!=(const String& o) const { return !operator==(o); }
+
+private:
+    Binary _data;
+};
 
 class HexCodec {
 private:
@@ -227,6 +260,20 @@ struct fmt::formatter<k2::String> {
     }
 };
 
+template <> // fmt support
+struct fmt::formatter<k2::StringView> {
+    template <typename ParseContext>
+    constexpr auto parse(ParseContext& ctx) {
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(k2::StringView const& str, FormatContext& ctx) {
+        k2::String encoded = k2::HexCodec::encode(str.data(), str.size());
+        return fmt::format_to(ctx.out(), "{}", encoded.data());
+    }
+};
+
 template <> // fmt support
 struct fmt::formatter<std::set<k2::String>> {
     template <typename ParseContext>
@@ -0,0 +1,100 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace k2 {
+
+// A static search index over a sorted array of 64-bit keys, kept in Eytzinger (breadth-first) order.
+// The top levels of the implicit tree share a few cache lines, the search loop is branch-free, and the
+// children of the node being compared are prefetched, so a lookup in a large array costs far fewer cache
+// misses than std::lower_bound/std::upper_bound over the sorted array.
+// The bound functions return positions in the original sorted array, in [0, size()]
+class EytzingerIndex {
+public:
+    EytzingerIndex() = default;
+
+    // Builds the index from keys sorted in ascending order. Duplicate keys are allowed
+    explicit EytzingerIndex(const std::vector<uint64_t>& sorted) :
+        _tree(sorted.size() + 1), _pos(sorted.size() + 1) {
+        size_t next = 0;
+        _fill(sorted, next, 1);
+    }
+
+    size_t size() const { return _tree.size() > 0 ? _tree.size() - 1 : 0; }
+
+    // Position of the first key not less than x
+    size_t lowerBound(uint64_t x) const {
+        const size_t n = size();
+        size_t k = 1;
+        while (k <= n) {
+            _prefetch(k);
+            k = 2 * k + (_tree[k] < x);
+        }
+        return _position(k);
+    }
+
+    // Position of the first key greater than x
+    size_t upperBound(uint64_t x) const {
+        const size_t n = size();
+        size_t k = 1;
+        while (k <= n) {
+            _prefetch(k);
+            k = 2 * k + (_tree[k] <= x);
+        }
+        return _position(k);
+    }
+
+private:
+    // in-order walk of the implicit tree assigns the sorted keys to their breadth-first slots
+    void _fill(const std::vector<uint64_t>& sorted, size_t& next, size_t k) {
+        if (k > sorted.size()) {
+            return;
+        }
+        _fill(sorted, next, 2 * k);
+        _tree[k] = sorted[next];
+        _pos[k] = next++;
+        _fill(sorted, next, 2 * k + 1);
+    }
+
+    void _prefetch(size_t k) const {
+        // the 8 slots starting at 8k are the descendants 3 levels down, which fill one cache line
+        __builtin_prefetch(_tree.data() + (8 * k < _tree.size() ? 8 * k : 0));
+    }
+
+    // The search walked past a leaf. The answer is the last node where it went left, found by dropping
+    // the trailing right turns and the final left turn. No such node means every key compared true
+    size_t _position(size_t k) const {
+        k >>= __builtin_ffsll(~k);
+        return k == 0 ? size() : _pos[k];
+    }
+
+    std::vector<uint64_t> _tree;  // _tree[0] is unused
+    std::vector<size_t> _pos;
+};
+
+} // ns k2
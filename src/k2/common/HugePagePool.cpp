@@ -0,0 +1,192 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "HugePagePool.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <seastar/core/deleter.hh>
+#include <seastar/core/smp.hh>
+
+#include "Log.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+namespace k2::log {
+inline thread_local logging::Logger mem("k2::mem");
+}
+
+namespace k2::mem {
+
+// regions of 2MB pages are mapped this much at a time, so that the pool grows with the data it holds
+static constexpr size_t SMALL_PAGE_REGION_SIZE = 64 * 1024 * 1024;
+// MPOL_PREFERRED: allocate from the given node, and from the others if it runs out
+static constexpr int NUMA_POLICY_PREFERRED = 1;
+
+void HugePagePool::configure(size_t bytes, size_t pageSize, bool numaLocal) {
+    _pageSize = pageSize;
+    _budget = bytes == 0 ? 0 : (bytes + pageSize - 1) / pageSize * pageSize;
+    _numaLocal = numaLocal;
+    _shard = seastar::this_shard_id();
+    if (_budget > 0) {
+        K2LOG_I(log::mem, "huge page pool of {} bytes in pages of {} bytes, numa local={}", _budget, _pageSize, _numaLocal);
+    }
+}
+
+void* HugePagePool::allocatePermanent(size_t size, size_t alignment) {
+    if (!enabled() || seastar::this_shard_id() != _shard) {
+        return nullptr;
+    }
+    return _carve(size, alignment);
+}
+
+size_t HugePagePool::_sizeClass(size_t size) {
+    if (size <= MinBufferSize) {
+        return 0;
+    }
+    // the number of doublings of MinBufferSize it takes to hold the size
+    return (64 - __builtin_clzll(size - 1)) - __builtin_ctzll(MinBufferSize);
+}
+
+size_t HugePagePool::bufferCapacity(size_t size) {
+    return MinBufferSize << _sizeClass(size);
+}
+
+Binary HugePagePool::allocateBuffer(size_t size) {
+    if (!enabled() || seastar::this_shard_id() != _shard || size == 0) {
+        return Binary();
+    }
+    size_t sizeClass = _sizeClass(size);
+    size_t capacity = MinBufferSize << sizeClass;
+    char* buf = nullptr;
+    if (sizeClass < _freeBuffers.size() && !_freeBuffers[sizeClass].empty()) {
+        buf = _freeBuffers[sizeClass].back();
+        _freeBuffers[sizeClass].pop_back();
+        _freeBytes -= capacity;
+    }
+    else {
+        buf = static_cast<char*>(_carve(capacity, alignof(std::max_align_t)));
+        if (buf == nullptr) {
+            return Binary();
+        }
+    }
+    return Binary(buf, size, seastar::make_deleter([shard=_shard, buf, sizeClass] {
+        if (seastar::this_shard_id() == shard) {
+            local()._releaseBuffer(buf, sizeClass);
+            return;
+        }
+        (void)seastar::smp::submit_to(shard, [buf, sizeClass] {
+            local()._releaseBuffer(buf, sizeClass);
+        });
+    }));
+}
+
+void HugePagePool::_releaseBuffer(char* buf, size_t sizeClass) {
+    if (sizeClass >= _freeBuffers.size()) {
+        _freeBuffers.resize(sizeClass + 1);
+    }
+    _freeBuffers[sizeClass].push_back(buf);
+    _freeBytes += MinBufferSize << sizeClass;
+}
+
+void* HugePagePool::_carve(size_t size, size_t alignment) {
+    auto aligned = [&] {
+        return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(_pos) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    };
+    if (_pos == nullptr || aligned() + size > _end) {
+        if (!_mapRegion(size + alignment)) {
+            return nullptr;
+        }
+    }
+    char* result = aligned();
+    _pos = result + size;
+    return result;
+}
+
+bool HugePagePool::_mapRegion(size_t minSize) {
+    size_t regionSize = std::max(_pageSize, std::min(_budget - _mapped, SMALL_PAGE_REGION_SIZE));
+    regionSize = (std::max(regionSize, minSize) + _pageSize - 1) / _pageSize * _pageSize;
+    if (_mapped + regionSize > _budget) {
+        if (!_exhausted) {
+            K2LOG_W(log::mem, "huge page pool budget of {} bytes is used up. Allocating from the heap", _budget);
+            _exhausted = true;
+        }
+        return false;
+    }
+
+    int pageShift = __builtin_ctzll(_pageSize);
+    bool hugetlb = true;
+    void* region = ::mmap(nullptr, regionSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT), -1, 0);
+    if (region == MAP_FAILED) {
+        // no reserved huge pages(or none of this size). Take regular pages, aligned so that the kernel can
+        // back them with transparent huge pages
+        hugetlb = false;
+        size_t padded = regionSize + _pageSize;
+        void* raw = ::mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            K2LOG_W(log::mem, "unable to map a region of {} bytes: {}", regionSize, strerror(errno));
+            return false;
+        }
+        uintptr_t start = (reinterpret_cast<uintptr_t>(raw) + _pageSize - 1) & ~(uintptr_t)(_pageSize - 1);
+        size_t head = start - reinterpret_cast<uintptr_t>(raw);
+        if (head > 0) {
+            ::munmap(raw, head);
+        }
+        if (padded - head > regionSize) {
+            ::munmap(reinterpret_cast<char*>(start) + regionSize, padded - head - regionSize);
+        }
+        region = reinterpret_cast<void*>(start);
+        ::madvise(region, regionSize, MADV_HUGEPAGE);
+    }
+
+    if (_numaLocal) {
+        // the pages are only allocated when they are first touched, so the policy applies to all of them
+        unsigned cpu = 0, node = 0;
+        if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+            unsigned long nodemask = 1ul << node;
+            if (::syscall(SYS_mbind, region, regionSize, NUMA_POLICY_PREFERRED, &nodemask, sizeof(nodemask) * 8, 0) != 0) {
+                K2LOG_W(log::mem, "unable to bind a region to numa node {}: {}", node, strerror(errno));
+            }
+        }
+    }
+
+    _pos = static_cast<char*>(region);
+    _end = _pos + regionSize;
+    _mapped += regionSize;
+    if (hugetlb) {
+        _hugetlb += regionSize;
+    }
+    K2LOG_D(log::mem, "mapped a region of {} bytes, hugetlb={}, total mapped={}", regionSize, hugetlb, _mapped);
+    return true;
+}
+
+} // ns k2::mem
@@ -0,0 +1,97 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "Common.h"
+
+namespace k2::mem {
+
+// A per-core pool for the memory of long-lived data which is looked up at random, i.e. the nodes of the indexes
+// and version chains and the record slabs of the partitions. The pool maps its memory in large regions backed by
+// huge pages(2MB or 1GB), which cuts down on the TLB misses of the lookups, and binds the regions to the NUMA
+// node of the core, so that a partition's data is next to the core which serves it even when the memory comes
+// from a general-purpose allocator. If the kernel has no huge pages reserved, regions fall back to regular pages
+// with transparent huge pages requested.
+// Users ask the pool first and allocate from the heap as usual when the pool is disabled or its budget is used up.
+// Regions are never unmapped
+class HugePagePool {
+public:
+    static HugePagePool& local() {
+        static thread_local HugePagePool pool;
+        return pool;
+    }
+
+    // Enables the pool of this core with a budget of the given bytes, rounded up to whole pages of the given size.
+    // With numaLocal, the regions prefer the memory of the NUMA node of the core. 0 bytes disables the pool
+    void configure(size_t bytes, size_t pageSize, bool numaLocal);
+
+    bool enabled() const { return _budget > 0; }
+
+    // Memory which is never returned, e.g. for the slabs of a NodeArena. nullptr if the pool can't provide it
+    void* allocatePermanent(size_t size, size_t alignment);
+
+    // A buffer which goes back to the pool when it, and all binaries sharing it, are released(on any core).
+    // Buffers are carved in power-of-two size classes, starting at MinBufferSize, and a released buffer is reused
+    // for any buffer of its class. An empty binary if the pool can't provide it
+    Binary allocateBuffer(size_t size);
+
+    static constexpr size_t MinBufferSize = 4096;
+
+    // the bytes the pool sets aside for a buffer of the given size
+    static size_t bufferCapacity(size_t size);
+
+    // the bytes of the regions mapped so far, and how many of them are backed by reserved(hugetlbfs) pages
+    size_t mappedBytes() const { return _mapped; }
+    size_t hugetlbBytes() const { return _hugetlb; }
+    // the bytes of the released buffers waiting to be reused, by the capacity of their class
+    size_t freeBufferBytes() const { return _freeBytes; }
+
+private:
+    void* _carve(size_t size, size_t alignment);
+    bool _mapRegion(size_t minSize);
+    void _releaseBuffer(char* buf, size_t sizeClass);
+    static size_t _sizeClass(size_t size);
+
+    size_t _budget = 0;
+    size_t _pageSize = 0;
+    bool _numaLocal = false;
+
+    // the free part of the region being carved
+    char* _pos = nullptr;
+    char* _end = nullptr;
+
+    size_t _mapped = 0;
+    size_t _hugetlb = 0;
+    size_t _freeBytes = 0;
+    bool _exhausted = false;
+    unsigned _shard = 0;
+
+    // released buffers, by size class
+    std::vector<std::vector<char*>> _freeBuffers;
+};
+
+} // ns k2::mem
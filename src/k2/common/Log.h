@@ -31,6 +31,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <sstream>
 #include <string>
 
+#include "AsyncLog.h"
 #include "Chrono.h"
 #include "Common.h"
 #include "FormattingUtils.h"
@@ -45,16 +46,25 @@ Copyright(c) 2020 Futurewei Cloud
 
 // performance of stdout with line-flush seems best ~800ns per call.
 // For comparison, stderr's performance is ~6000-7000ns
+// With the async backend(see AsyncLog.h), lines below ERROR are only formatted by the caller and written by
+// another thread
 #define K2LOG_STREAM std::cout
 
 #define DO_K2LOG_LEVEL_FMT(level, module, fmt_str, ...)                                                      \
     {                                                                                                        \
         auto id = seastar::engine_is_ready() ? seastar::this_shard_id() : pthread_self();                    \
-        fmt::print(K2LOG_STREAM,                                                                             \
+        if (k2::logging::AsyncLog::enabled() && level < k2::logging::LogLevel::ERROR) {                      \
+            k2::logging::AsyncLog::write(fmt::format(                                                        \
                    FMT_STRING("[{}]-{}-({}:{}) [{}] [{}:{} @{}] " fmt_str "\n"),                             \
-                   k2::Clock::now(), k2::logging::Logger::procName, module, id,                              \
+                   k2::TSCClock::now(), k2::logging::Logger::procName, module, id,                           \
+                   k2::logging::LogLevelNames[to_integral(level)], __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__)); \
+        } else {                                                                                             \
+            fmt::print(K2LOG_STREAM,                                                                         \
+                   FMT_STRING("[{}]-{}-({}:{}) [{}] [{}:{} @{}] " fmt_str "\n"),                             \
+                   k2::TSCClock::now(), k2::logging::Logger::procName, module, id,                           \
                    k2::logging::LogLevelNames[to_integral(level)], __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__); \
-        K2LOG_STREAM << std::flush;                                                                          \
+            K2LOG_STREAM << std::flush;                                                                      \
+        }                                                                                                    \
     }
 
 #define K2LOG_LEVEL_FMT(level, logger, fmt_str, ...)                     \
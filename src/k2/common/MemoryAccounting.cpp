@@ -0,0 +1,82 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "MemoryAccounting.h"
+
+#include "HugePagePool.h"
+
+#include <seastar/core/memory.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/core/smp.hh>
+
+namespace k2::mem {
+namespace sm = seastar::metrics;
+
+void MemoryAccounting::start() {
+    for (size_t i = 0; i < SubsystemCount; ++i) {
+        std::vector<sm::label_instance> labels;
+        labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+        labels.push_back(sm::label_instance("subsystem", SubsystemNames[i]));
+        _metricGroups.add_group("memory", {
+            sm::make_gauge("bytes", [i] { return _usage[i].bytes; },
+                           sm::description("Bytes allocated by the subsystem and not yet released"), labels),
+            sm::make_gauge("blocks", [i] { return _usage[i].blocks; },
+                           sm::description("Blocks allocated by the subsystem and not yet released"), labels),
+        });
+    }
+    std::vector<sm::label_instance> labels;
+    labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+    _metricGroups.add_group("memory", {
+        sm::make_gauge("hugepage_pool_mapped_bytes", [] { return HugePagePool::local().mappedBytes(); },
+                       sm::description("Bytes mapped by the huge page pool"), labels),
+        sm::make_gauge("hugepage_pool_hugetlb_bytes", [] { return HugePagePool::local().hugetlbBytes(); },
+                       sm::description("Bytes of the huge page pool backed by reserved huge pages"), labels),
+        sm::make_gauge("hugepage_pool_free_buffer_bytes", [] { return HugePagePool::local().freeBufferBytes(); },
+                       sm::description("Bytes of released huge page pool buffers waiting to be reused"), labels),
+    });
+}
+
+void MemoryAccounting::stop() {
+    _metricGroups.clear();
+}
+
+String MemoryAccounting::toJSON() {
+    nlohmann::json subsystems;
+    int64_t tracked = 0;
+    for (size_t i = 0; i < SubsystemCount; ++i) {
+        subsystems[SubsystemNames[i]] = {{"bytes", _usage[i].bytes}, {"blocks", _usage[i].blocks}};
+        tracked += _usage[i].bytes;
+    }
+    auto stats = seastar::memory::stats();
+    nlohmann::json result{
+        {"core", seastar::this_shard_id()},
+        {"allocated_bytes", stats.allocated_memory()},
+        {"free_bytes", stats.free_memory()},
+        {"tracked_bytes", tracked},
+        {"hugepage_pool_bytes", HugePagePool::local().mappedBytes()},
+        {"subsystems", std::move(subsystems)}
+    };
+    return String(result.dump());
+}
+
+} // ns k2::mem
@@ -0,0 +1,127 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include <seastar/core/deleter.hh>
+#include <seastar/core/metrics_registration.hh>
+
+#include "Common.h"
+
+namespace k2::mem {
+
+// The subsystems whose memory is accounted for separately
+K2_DEF_ENUM(Subsystem,
+    Indexer,    // the nodes of the indexes of keys
+    Versions,   // the version chain nodes of the keys
+    Records,    // the arena slabs holding the record values
+    ReadCache,  // the read cache entries
+    Txns,       // the transaction records at the TRHs
+    Transport,  // the buffers of the messages sent and received
+    TSO         // the timestamp batches and waiting requests of the TSO clients
+);
+
+inline constexpr size_t SubsystemCount = std::size(SubsystemNames);
+
+// The live memory of a subsystem: the bytes and the number of blocks allocated and not yet released
+struct Usage {
+    int64_t bytes = 0;
+    int64_t blocks = 0;
+};
+
+// Per-core memory accounting by subsystem. The accounting is done at the allocation sites of each subsystem,
+// with a TrackedAllocator for its containers or with allocated()/released() for the memory it manages itself.
+// Memory released on a different core than the one which allocated it(e.g. foreign buffers) is accounted as
+// released on the core which releases it, so only the sum over all cores is exact
+class MemoryAccounting {
+public:
+    // registers the metrics of this core
+    void start();
+    void stop();
+
+    static void allocated(Subsystem s, size_t bytes) {
+        auto& usage = _usage[to_integral(s)];
+        usage.bytes += bytes;
+        usage.blocks++;
+    }
+
+    static void released(Subsystem s, size_t bytes) {
+        auto& usage = _usage[to_integral(s)];
+        usage.bytes -= bytes;
+        usage.blocks--;
+    }
+
+    static const Usage& usage(Subsystem s) { return _usage[to_integral(s)]; }
+
+    // The usage of this core as a json object, along with the memory allocated on the core in total
+    static String toJSON();
+
+private:
+    static inline thread_local std::array<Usage, SubsystemCount> _usage{};
+    seastar::metrics::metric_groups _metricGroups;
+};
+
+// A std allocator which accounts the memory of a container to a subsystem
+template <typename T, Subsystem S>
+struct TrackedAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef TrackedAllocator<U, S> other;
+    };
+
+    TrackedAllocator() noexcept = default;
+    template <typename U>
+    TrackedAllocator(const TrackedAllocator<U, S>&) noexcept {}
+
+    T* allocate(size_t n) {
+        T* result = std::allocator<T>().allocate(n);
+        MemoryAccounting::allocated(S, n * sizeof(T));
+        return result;
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        MemoryAccounting::released(S, n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const TrackedAllocator<U, S>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const TrackedAllocator<U, S>&) const noexcept { return false; }
+};
+
+// Accounts a binary to a subsystem until the binary, and all of the binaries which share its memory, are released
+inline Binary tracked(Binary&& buf, Subsystem s) {
+    size_t size = buf.size();
+    char* data = buf.get_write();
+    MemoryAccounting::allocated(s, size);
+    return Binary(data, size, seastar::make_deleter(buf.release(), [s, size] { MemoryAccounting::released(s, size); }));
+}
+
+} // ns k2::mem
@@ -0,0 +1,197 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "Profiler.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fmt/format.h>
+
+#include "Log.h"
+
+namespace k2::log {
+inline thread_local logging::Logger profiler("k2::profiler");
+}
+
+namespace k2::profiling {
+
+Profiler::~Profiler() {
+    stop();
+}
+
+void Profiler::start(uint32_t frequency) {
+    if (_timerCreated || frequency == 0) {
+        return;
+    }
+    _ring = std::make_unique<_Sample[]>(RingSize);
+    _local = this;
+
+    // the first call of backtrace() loads the unwinder, which allocates. Get that done outside of the handler
+    void* frames[1];
+    (void)::backtrace(frames, 1);
+
+    struct sigaction sa{};
+    sa.sa_sigaction = &Profiler::_onSignal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+        K2LOG_W(log::profiler, "unable to install the SIGPROF handler: {}", strerror(errno));
+        return;
+    }
+    // the reactor threads block the signals they don't handle
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPROF);
+    pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+
+    struct sigevent sev{};
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev._sigev_un._tid = syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &_timer) != 0) {
+        K2LOG_W(log::profiler, "unable to create the profiling timer: {}", strerror(errno));
+        return;
+    }
+    _timerCreated = true;
+
+    long intervalNs = std::max<long>(1'000'000'000L / frequency, 1'000'000L);
+    struct itimerspec spec{};
+    spec.it_interval.tv_sec = intervalNs / 1'000'000'000L;
+    spec.it_interval.tv_nsec = intervalNs % 1'000'000'000L;
+    spec.it_value = spec.it_interval;
+    timer_settime(_timer, 0, &spec, nullptr);
+
+    // drain well before the ring can fill up
+    _drainTimer.set_callback([this] { _drain(); });
+    _drainTimer.arm_periodic(std::chrono::nanoseconds(intervalNs * RingSize / 4));
+    K2LOG_I(log::profiler, "sampling at {} samples per CPU second", frequency);
+}
+
+void Profiler::stop() {
+    if (!_timerCreated) {
+        return;
+    }
+    _drainTimer.cancel();
+    timer_delete(_timer);
+    _timerCreated = false;
+    // a signal may still be pending
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    if (_local == this) {
+        _local = nullptr;
+    }
+}
+
+void Profiler::_onSignal(int, siginfo_t*, void*) {
+    Profiler* profiler = _local;
+    if (profiler == nullptr || !profiler->_ring) {
+        return;
+    }
+    int savedErrno = errno;
+    uint64_t head = profiler->_head.load(std::memory_order_relaxed);
+    if (head - profiler->_tail.load(std::memory_order_acquire) >= RingSize) {
+        profiler->_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        _Sample& sample = profiler->_ring[head % RingSize];
+        sample.depth = ::backtrace(sample.frames, MaxDepth);
+        profiler->_head.store(head + 1, std::memory_order_release);
+    }
+    errno = savedErrno;
+}
+
+void Profiler::_drain() {
+    uint64_t head = _head.load(std::memory_order_acquire);
+    uint64_t tail = _tail.load(std::memory_order_relaxed);
+    for (; tail < head; ++tail) {
+        _Sample& sample = _ring[tail % RingSize];
+        if (sample.depth > SkipFrames) {
+            _stacks[std::vector<void*>(sample.frames + SkipFrames, sample.frames + sample.depth)]++;
+        }
+    }
+    _tail.store(tail, std::memory_order_release);
+}
+
+const String& Profiler::_symbol(void* addr) {
+    auto it = _symbols.find(addr);
+    if (it != _symbols.end()) {
+        return it->second;
+    }
+    String name;
+    Dl_info info{};
+    if (dladdr(addr, &info) && info.dli_sname) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = status == 0 && demangled ? demangled : info.dli_sname;
+        std::free(demangled);
+    }
+    else if (info.dli_fname) {
+        const char* module = strrchr(info.dli_fname, '/');
+        name = fmt::format("{}+{:#x}", module ? module + 1 : info.dli_fname,
+                           (uintptr_t)addr - (uintptr_t)info.dli_fbase);
+    }
+    else {
+        name = fmt::format("{}", addr);
+    }
+    // ';' separates the frames of the folded format
+    std::replace(name.begin(), name.end(), ';', ':');
+    return _symbols.emplace(addr, std::move(name)).first->second;
+}
+
+String Profiler::takeFoldedStacks() {
+    if (_timerCreated) {
+        _drain();
+    }
+    String result;
+    for (auto& [frames, count] : _stacks) {
+        String line;
+        for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+            if (!line.empty()) {
+                line += ";";
+            }
+            // the return addresses point past the call, so look up the call instruction instead
+            line += _symbol((char*)*it - 1);
+        }
+        result += fmt::format("{} {}\n", line, count);
+    }
+    _stacks.clear();
+    uint64_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        result += fmt::format("[dropped] {}\n", dropped);
+    }
+    return result;
+}
+
+} // ns k2::profiling
@@ -0,0 +1,93 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <seastar/core/timer.hh>
+
+#include "Common.h"
+
+namespace k2::profiling {
+
+// A sampling profiler of the CPU time of the thread it is started on, meant for on-demand flamegraphs from
+// running nodes. A per-thread CPU-time timer sends the thread a SIGPROF at the requested frequency, and the signal
+// handler records the backtrace of the interrupted code in a ring. The ring is drained periodically on the thread
+// itself, and the stacks are aggregated until they are taken in the folded format of flamegraph.pl.
+// Frames are symbolized with the dynamic symbol table, so binaries linked without -rdynamic show most frames as
+// module+offset, which can be resolved offline with addr2line
+class Profiler {
+public:
+    ~Profiler();
+
+    // starts sampling the calling thread at the given frequency, in samples per second of CPU time
+    void start(uint32_t frequency);
+    void stop();
+
+    bool running() const { return _timerCreated; }
+
+    // the stacks sampled since the previous call, one line per distinct stack: its frames from the outermost one,
+    // separated by ';', followed by a space and the number of samples
+    String takeFoldedStacks();
+
+private:
+    static constexpr size_t MaxDepth = 48;
+    static constexpr size_t RingSize = 512;
+    // the frames of the signal handler and the signal trampoline at the top of each backtrace
+    static constexpr int SkipFrames = 2;
+
+    struct _Sample {
+        int depth = 0;
+        void* frames[MaxDepth];
+    };
+
+    static void _onSignal(int signo, siginfo_t* info, void* context);
+    void _drain();
+    const String& _symbol(void* addr);
+
+    static inline thread_local Profiler* _local = nullptr;
+
+    // written by the signal handler at _head, and drained from _tail
+    std::unique_ptr<_Sample[]> _ring;
+    std::atomic<uint64_t> _head{0};
+    std::atomic<uint64_t> _tail{0};
+    std::atomic<uint64_t> _dropped{0};
+
+    timer_t _timer{};
+    bool _timerCreated = false;
+    seastar::timer<> _drainTimer;
+
+    // the sample counts of the stacks, innermost frame first
+    std::map<std::vector<void*>, uint64_t> _stacks;
+    std::unordered_map<void*, String> _symbols;
+};
+
+} // ns k2::profiling
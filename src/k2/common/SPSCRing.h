@@ -0,0 +1,130 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+
+namespace k2 {
+
+// A bounded, lock-free, single-producer/single-consumer ring.
+// Exactly one thread may call push() and exactly one (possibly other) thread may call pop()/drain().
+// Each side caches the other side's index so that it only touches the shared cache line when the ring
+// looks full (producer) or empty (consumer).
+template <typename T>
+class SPSCRing {
+public:
+    explicit SPSCRing(size_t capacity) : _capacity(_roundUpPow2(capacity)), _mask(_capacity - 1),
+        _slots(new Slot[_capacity]) {
+    }
+
+    ~SPSCRing() {
+        while (pop());
+    }
+
+    // Producer side. Moves the item into the ring and returns true, or returns false without touching the item
+    // if the ring is full
+    bool push(T&& item) {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _producerHead == _capacity) {
+            _producerHead = _head.load(std::memory_order_acquire);
+            if (tail - _producerHead == _capacity) {
+                return false;
+            }
+        }
+        new (&_slots[tail & _mask].storage) T(std::move(item));
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Removes the oldest item, or returns nullopt if the ring is empty
+    std::optional<T> pop() {
+        auto head = _head.load(std::memory_order_relaxed);
+        if (head == _consumerTail) {
+            _consumerTail = _tail.load(std::memory_order_acquire);
+            if (head == _consumerTail) {
+                return std::nullopt;
+            }
+        }
+        T* item = std::launder(reinterpret_cast<T*>(&_slots[head & _mask].storage));
+        std::optional<T> result(std::move(*item));
+        item->~T();
+        _head.store(head + 1, std::memory_order_release);
+        return result;
+    }
+
+    // Consumer side. Removes up to maxItems items, in order, calling func(T&&) for each, and returns how many
+    // were removed. The producer's index is read once for the whole batch
+    template <typename Func>
+    size_t drain(Func&& func, size_t maxItems = size_t(-1)) {
+        auto head = _head.load(std::memory_order_relaxed);
+        _consumerTail = _tail.load(std::memory_order_acquire);
+        size_t count = std::min(size_t(_consumerTail - head), maxItems);
+        for (size_t i = 0; i < count; ++i) {
+            T* item = std::launder(reinterpret_cast<T*>(&_slots[(head + i) & _mask].storage));
+            T value(std::move(*item));
+            item->~T();
+            // release the slot before the callback so that a throwing callback leaves the ring consistent
+            _head.store(head + i + 1, std::memory_order_release);
+            func(std::move(value));
+        }
+        return count;
+    }
+
+    // Either side. Note that the answer may be stale by the time the caller looks at it
+    bool empty() const {
+        return _head.load(std::memory_order_seq_cst) == _tail.load(std::memory_order_seq_cst);
+    }
+
+    size_t capacity() const { return _capacity; }
+
+private:
+    struct Slot {
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+    };
+
+    static size_t _roundUpPow2(size_t n) {
+        size_t result = 1;
+        while (result < n) result <<= 1;
+        return result;
+    }
+
+    const size_t _capacity;
+    const size_t _mask;
+    std::unique_ptr<Slot[]> _slots;
+
+    // consumer-owned
+    alignas(64) std::atomic<size_t> _head{0};
+    size_t _consumerTail = 0;
+
+    // producer-owned
+    alignas(64) std::atomic<size_t> _tail{0};
+    size_t _producerHead = 0;
+};
+
+} // ns k2
@@ -0,0 +1,113 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace k2 {
+
+// A single-writer, multi-reader sequence lock around a small trivially-copyable value.
+// The writer never blocks and readers never write to shared memory, so readers on other cores can poll it on
+// their hot path without bouncing the cache line. A reader that races with a write simply retries.
+// The value is kept in an array of relaxed atomic words so that the racy copy is well-defined.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock requires a trivially copyable value type");
+
+public:
+    SeqLock() { _write(T{}); }
+
+    // Writer side. Only one thread may call store() at a time.
+    // The version returned by version() moves forward by 2 with each store
+    void store(const T& value) {
+        auto seq = _seq.load(std::memory_order_relaxed);
+        _seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _write(value);
+        _seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Reader side. Returns a consistent snapshot of the last stored value
+    T load() const {
+        T result;
+        while (!_tryLoad(result, _seq.load(std::memory_order_acquire)));
+        return result;
+    }
+
+    // Reader side. If the value has been stored since the given version was observed, copies it into out,
+    // updates version and returns true. Otherwise returns false after a single load of the sequence counter
+    bool loadIfChanged(uint64_t& version, T& out) const {
+        auto seq = _seq.load(std::memory_order_acquire);
+        if (seq == version) {
+            return false;
+        }
+        while (!_tryLoad(out, seq)) {
+            seq = _seq.load(std::memory_order_acquire);
+        }
+        version = seq;
+        return true;
+    }
+
+    // The current (even) version. Starts at 0 before the first store()
+    uint64_t version() const {
+        return _seq.load(std::memory_order_acquire) & ~uint64_t(1);
+    }
+
+private:
+    static constexpr size_t _words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    void _write(const T& value) {
+        uint64_t buf[_words] = {};
+        std::memcpy(buf, &value, sizeof(T));
+        for (size_t i = 0; i < _words; ++i) {
+            _data[i].store(buf[i], std::memory_order_relaxed);
+        }
+    }
+
+    // copy out the value if the given sequence number is stable (even and unchanged across the copy)
+    bool _tryLoad(T& out, uint64_t seq) const {
+        if (seq & 1) {
+            return false;
+        }
+        uint64_t buf[_words];
+        for (size_t i = 0; i < _words; ++i) {
+            buf[i] = _data[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_seq.load(std::memory_order_relaxed) != seq) {
+            return false;
+        }
+        std::memcpy(&out, buf, sizeof(T));
+        return true;
+    }
+
+    alignas(64) std::atomic<uint64_t> _seq{0};
+    std::atomic<uint64_t> _data[_words];
+};
+
+} // ns k2
@@ -23,6 +23,11 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+// stl
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
 // k2
 #include <k2/common/Common.h>
 
@@ -42,6 +47,85 @@ inline config::BPOConfigMapDist_t ___config___;
 inline config::BPOConfigMapDist_t& ConfigDist() { return ___config___; }
 inline const config::BPOVarMap& Config() { return ___config___.local(); }
 
+class ConfigReloadObserver;
+
+namespace config {
+// The options which can be changed while the app runs, with reload()
+inline std::set<String> ___reloadable___;
+// The options of the app, used to parse reloaded values
+inline const boost::program_options::options_description* ___options___ = nullptr;
+// Changes on each core when a value is reloaded on that core, so that the ConfigVars of the core re-read it
+inline thread_local uint64_t ___generation___ = 0;
+inline thread_local std::vector<ConfigReloadObserver*> ___observers___;
+
+// Marks the given options as reloadable. Must be called before the app starts, e.g. next to adding the options
+inline void markReloadable(const std::vector<String>& names) {
+    ___reloadable___.insert(names.begin(), names.end());
+}
+
+inline bool isReloadable(const String& name) {
+    return ___reloadable___.count(name) > 0;
+}
+
+// Sets the options used to parse reloaded values. Called by the app once the options are added
+inline void setOptions(const boost::program_options::options_description& options) {
+    ___options___ = &options;
+}
+
+// Sets a reloadable option to the given value, written as it would be on the command line, on all cores.
+// The ConfigVars of the option have the new value the next time they are read, after which the reload observers
+// of each core are called. The future fails with std::invalid_argument if the option is not reloadable or the
+// value does not parse
+inline seastar::future<> reload(const String& name, const String& value);
+}  // ns config
+
+// Calls the given function on the core it was created on after each reload of an option on that core, e.g. to
+// resize the structures which are sized by a reloadable option. It is removed when destroyed
+class ConfigReloadObserver {
+public:
+    explicit ConfigReloadObserver(std::function<void()> onReload) : _onReload(std::move(onReload)) {
+        config::___observers___.push_back(this);
+    }
+    ~ConfigReloadObserver() {
+        auto& observers = config::___observers___;
+        observers.erase(std::remove(observers.begin(), observers.end(), this), observers.end());
+    }
+    ConfigReloadObserver(const ConfigReloadObserver&) = delete;
+    ConfigReloadObserver& operator=(const ConfigReloadObserver&) = delete;
+
+    void operator()() const { _onReload(); }
+
+private:
+    std::function<void()> _onReload;
+};
+
+inline seastar::future<> config::reload(const String& name, const String& value) {
+    namespace bpo = boost::program_options;
+    const bpo::option_description* option = ___options___ ? ___options___->find_nothrow(name, false) : nullptr;
+    if (!option || !isReloadable(name)) {
+        return seastar::make_exception_future<>(std::invalid_argument(fmt::format("option {} is not reloadable", name)));
+    }
+    boost::any parsed;
+    try {
+        option->semantic()->parse(parsed, std::vector<std::string>{std::string(value.data(), value.size())}, true);
+    }
+    catch (std::exception& e) {
+        return seastar::make_exception_future<>(std::invalid_argument(e.what()));
+    }
+    return ConfigDist().invoke_on_all([key=std::string(name.data(), name.size()), parsed] (BPOVarMap& vm) {
+        // the variables_map only has a const operator[]. It is a std::map underneath
+        static_cast<std::map<std::string, bpo::variable_value>&>(vm)[key] = bpo::variable_value(parsed, false);
+        ___generation___++;
+        // an observer may remove itself or others
+        auto observers = ___observers___;
+        for (ConfigReloadObserver* observer : observers) {
+            if (std::find(___observers___.begin(), ___observers___.end(), observer) != ___observers___.end()) {
+                (*observer)();
+            }
+        }
+    });
+}
+
 // Helper class used to read configuration values in code.
 // To use, declare a variable for your configuration, e.g.:
 // ConfigVar<int> retries("retries", 10);
@@ -49,23 +133,37 @@ inline const config::BPOVarMap& Config() { return ___config___.local(); }
 // Then later in the code when you want to read the configured value, just use the variable as a functor
 // for(int i = 0; i < retries() << ++i) {
 // }
+// The variables of reloadable options(see config::reload) re-read the value after it is reloaded on their core
 template<typename T>
 class ConfigVar {
 public:
-    ConfigVar(String name, T defaultValue=T{}) {
-        if (Config().count(name)) {
-            _val = Config()[name].as<T>();
-        }
-        else {
-            _val = std::move(defaultValue);
-        }
+    ConfigVar(String name, T defaultValue=T{}) :
+        _reloadable(config::isReloadable(name)), _name(std::move(name)), _default(std::move(defaultValue)) {
+        _load();
     }
     ~ConfigVar(){}
     const T& operator()() const {
+        if (_reloadable && _generation != config::___generation___) {
+            _load();
+        }
         return _val;
     }
 private:
-    T _val;
+    void _load() const {
+        _generation = config::___generation___;
+        if (Config().count(_name)) {
+            _val = Config()[_name].as<T>();
+        }
+        else {
+            _val = _default;
+        }
+    }
+
+    bool _reloadable;
+    String _name;
+    T _default;
+    mutable T _val;
+    mutable uint64_t _generation = 0;
 };
 
 // This class is parseable via BoostProgramOptions to allow users to accept human-readable (think chrono literals)
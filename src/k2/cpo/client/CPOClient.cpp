@@ -28,35 +28,94 @@ Copyright(c) 2020 Futurewei Cloud
 namespace k2 {
 
 CPOClient::CPOClient(String cpo_url) {
-    cpo = RPC().getTXEndpoint(cpo_url);
+    cpo = RPC().getSharedTXEndpoint(cpo_url);
     K2ASSERT(log::cpoclient, cpo, "unable to get endpoint for url {}", cpo_url);
 }
 
-void CPOClient::FulfillWaiters(const String& name, const Status& status) {
-    auto& waiters = requestWaiters[name];
+seastar::future<Status> CPOClient::_fetchCollection(const String& name, Duration timeout) {
+    if (collectionSource) {
+        return collectionSource(name).then([this, name] (auto&& result) {
+            auto& [status, collection] = result;
+            if (status.is2xxOK()) {
+                _connect(collections[name] = dto::PartitionGetter(std::move(collection)));
+            }
+            return std::move(status);
+        });
+    }
+    dto::CollectionGetRequest request{.name = name, .subscriber = subscriber};
+    return RPC().callRPC<dto::CollectionGetRequest, dto::CollectionGetResponse>(dto::Verbs::CPO_COLLECTION_GET, request, *cpo, timeout)
+    .then([this, name] (auto&& response) {
+        auto& [status, coll_response] = response;
+        K2LOG_D(log::cpoclient, "collection get response received with status={}, for name={}", status, name);
+        if (status.is2xxOK()) {
+            _connect(collections[name] = dto::PartitionGetter(std::move(coll_response.collection)));
+        }
+        return std::move(status);
+    });
+}
+
+void CPOClient::applyCollectionChange(dto::CollectionChangeRequest&& change) {
+    auto it = collections.find(change.name);
+    if (it == collections.end() || change.version <= it->second.collection.partitionMap.version) {
+        // not cached, or we already fetched a newer partition map
+        return;
+    }
+    if (!it->second.applyChange(change.baseVersion, change.version, std::move(change.partitions))) {
+        K2LOG_D(log::cpoclient, "missed a change of collection {}, dropping it from the cache", change.name);
+        collections.erase(it);
+        return;
+    }
+    _connect(it->second);
+}
 
-    for (auto it = waiters.begin(); it != waiters.end(); ++it) {
-        it->set_value(status);
+std::vector<dto::Key> CPOClient::_routingKeys(const String& name, const std::vector<dto::Key>& keys) {
+    auto it = collections.find(name);
+    if (it == collections.end() || it->second.collection.partitionMap.partitions.empty()) {
+        return keys;
+    }
+    std::vector<dto::Key> routingKeys;
+    std::unordered_set<uint64_t> partitions;
+    for (auto& key : keys) {
+        dto::Partition* partition = it->second.getPartitionForKey(key).partition;
+        if (!partition || partitions.insert(partition->pvid.id).second) {
+            routingKeys.push_back(key);
+        }
     }
+    return routingKeys;
+}
 
-    requestWaiters.erase(name);
+void CPOClient::_connect(const dto::PartitionGetter& getter) {
+    if (!warmupConnections) {
+        return;
+    }
+    // the connections which are already open are left as they are
+    for (auto& endpoint : getter.endpoints()) {
+        RPC().connect(*endpoint);
+    }
 }
 
 seastar::future<k2::Status> CPOClient::createSchema(const String& collectionName, k2::dto::Schema schema) {
     k2::dto::CreateSchemaRequest request{ collectionName, std::move(schema) };
+    _schemaGets.invalidate(collectionName);
     return k2::RPC().callRPC<k2::dto::CreateSchemaRequest, k2::dto::CreateSchemaResponse>(k2::dto::Verbs::CPO_SCHEMA_CREATE, request, *cpo, schema_request_timeout())
-    .then([] (auto&& response) {
+    .then([this, collectionName] (auto&& response) {
         auto& [status, r] = response;
+        _schemaGets.invalidate(collectionName);
         return status;
     });
 }
 
 seastar::future<std::tuple<k2::Status, std::vector<k2::dto::Schema>>> CPOClient::getSchemas(const String& collectionName) {
-    k2::dto::GetSchemasRequest request { collectionName };
-    return k2::RPC().callRPC<k2::dto::GetSchemasRequest, k2::dto::GetSchemasResponse>(k2::dto::Verbs::CPO_SCHEMAS_GET, request, *cpo, schema_request_timeout())
-    .then([] (auto && response) {
-        auto& [status, r] = response;
-        return std::tuple(std::move(status), std::move(r.schemas));
+    return _schemaGets.get(collectionName, schema_cache_ttl(), [this, collectionName] {
+        if (schemaSource) {
+            return schemaSource(collectionName);
+        }
+        k2::dto::GetSchemasRequest request { collectionName };
+        return k2::RPC().callRPC<k2::dto::GetSchemasRequest, k2::dto::GetSchemasResponse>(k2::dto::Verbs::CPO_SCHEMAS_GET, request, *cpo, schema_request_timeout())
+        .then([] (auto && response) {
+            auto& [status, r] = response;
+            return std::tuple(std::move(status), std::move(r.schemas));
+        });
     });
 }
 
@@ -23,16 +23,21 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <functional>
+#include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <tuple>
 
 #include <seastar/core/future.hh>  // for future stuff
+#include <seastar/core/shared_future.hh>
 #include <seastar/core/sleep.hh>
 
 #include <k2/common/Chrono.h>
 #include <k2/config/Config.h>
 #include <k2/dto/Collection.h>
+#include <k2/dto/K23SI.h>
 #include <k2/dto/PersistenceCluster.h>
 #include <k2/transport/RPCDispatcher.h>
 #include <k2/transport/RPCTypes.h>
@@ -46,6 +51,54 @@ namespace log {
 inline thread_local k2::logging::Logger cpoclient("k2::cpo_client");
 }
 
+// Shares one in-flight CPO request among all concurrent callers asking for the same key, and keeps a
+// successful result for a time-to-live. A TTL of 0 only coalesces the requests in flight
+template <typename ResultT>
+class CoalescingCache {
+public:
+    template <typename Func>
+    seastar::future<ResultT> get(const String& key, Duration ttl, Func&& fetch) {
+        auto& entry = _entries[key];
+        if (entry.inflight && entry.inflight->available()) {
+            entry.inflight.reset();
+        }
+        if (entry.result && Clock::now() < entry.expiry) {
+            return seastar::make_ready_future<ResultT>(*entry.result);
+        }
+        if (!entry.inflight) {
+            entry.inflight.emplace(fetch().then([this, key, ttl] (ResultT&& result) {
+                if (ttl > 0s && _isOK(result)) {
+                    auto& entry = _entries[key];
+                    entry.result = result;
+                    entry.expiry = Clock::now() + ttl;
+                }
+                return std::move(result);
+            }));
+        }
+        return entry.inflight->get_future();
+    }
+
+    // Forgets the cached result for the key. A request in flight is still shared
+    void invalidate(const String& key) {
+        auto it = _entries.find(key);
+        if (it != _entries.end()) {
+            it->second.result.reset();
+        }
+    }
+
+private:
+    static bool _isOK(const Status& status) { return status.is2xxOK(); }
+    template <typename T>
+    static bool _isOK(const std::tuple<Status, T>& result) { return std::get<0>(result).is2xxOK(); }
+
+    struct _Entry {
+        std::optional<seastar::shared_future<ResultT>> inflight;
+        std::optional<ResultT> result;
+        TimePoint expiry;
+    };
+    std::unordered_map<String, _Entry> _entries;
+};
+
 class CPOClient {
 public:
     CPOClient(String cpo_url);
@@ -77,54 +130,22 @@ public:
     }
 
     // Get collection info from CPO, and retry if the partition for the given key
-    // is not assigned or if there was a retryable error. It allows only one outstanding
-    // request for a given collection.
+    // is not assigned or if there was a retryable error. Concurrent callers for the same
+    // collection share one outstanding request.
     template <typename ClockT=Clock>
     seastar::future<Status> GetAssignedPartitionWithRetry(Deadline<ClockT> deadline, const String& name, const dto::Key& key,
                                     bool reverse = false, bool excludedKey = false, uint8_t retries = 1) {
-        // Check if request is already issued, if so add to waiters and return
         K2LOG_D(log::cpoclient, "time remaining={}, for coll={}", deadline.getRemaining(), name);
-        auto it = requestWaiters.find(name);
-        if (it != requestWaiters.end()) {
-            K2LOG_D(log::cpoclient, "found existing waiter");
-            it->second.emplace_back(seastar::promise<Status>());
-            return it->second.back().get_future().then([this, deadline, name, key, reverse, excludedKey, retries](Status&& status) {
-                K2LOG_D(log::cpoclient, "waiter finished with status={}", status);
-                if (status.is2xxOK()) {
-                    dto::Partition* partition = collections[name].getPartitionForKey(key, reverse, excludedKey).partition;
-                    if (partition && partition->astate == dto::AssignmentState::Assigned) {
-                        return seastar::make_ready_future<Status>(std::move(status));
-                    }
-                    K2LOG_W(log::cpoclient, "Partition found but still not completed assignment");
-                }
-                else {
-                    K2LOG_W(log::cpoclient, "Partition not found with status={}", status);
-                }
-
-                if (!retries) {
-                    status = Statuses::S408_Request_Timeout("get assigned partition retries exceeded");
-                    return seastar::make_ready_future<Status>(std::move(status));
-                }
-
-                return GetAssignedPartitionWithRetry(deadline, std::move(name), std::move(key), reverse, excludedKey, retries - 1);
-            });
-        }
-        K2LOG_D(log::cpoclient, "no existing waiter for name={}. Creating new one", name);
-
-        // Register the ongoing request
-        requestWaiters[name] = std::vector<seastar::promise<Status>>();
-
         Duration timeout = std::min(deadline.getRemaining(), cpo_request_timeout());
-        dto::CollectionGetRequest request{.name = name};
 
-        return RPC().callRPC<dto::CollectionGetRequest, dto::CollectionGetResponse>(dto::Verbs::CPO_COLLECTION_GET, request, *cpo, timeout).then([this, name = request.name, key, deadline, reverse, excludedKey, retries](auto&& response) {
-            auto& [status, coll_response] = response;
+        return _collectionGets.get(name, 0s, [this, name, timeout] {
+            return _fetchCollection(name, timeout);
+        })
+        .then([this, name, key, deadline, reverse, excludedKey, retries](Status&& status) {
             bool retry = false;
-            K2LOG_D(log::cpoclient, "collection get response received with status={}, for name={}", status, name);
+            K2LOG_D(log::cpoclient, "collection get completed with status={}, for name={}", status, name);
             if (status.is2xxOK()) {
-                collections[name] = dto::PartitionGetter(std::move(coll_response.collection));
                 dto::Partition* partition = collections[name].getPartitionForKey(key, reverse, excludedKey).partition;
-                FulfillWaiters(name, status);
                 if (!partition || partition->astate != dto::AssignmentState::Assigned) {
                     K2LOG_D(log::cpoclient, "No partition or not assigned");
                     retry = true;
@@ -132,7 +153,6 @@ public:
             } else if (status.is5xxRetryable()) {
                 retry = true;
             } else {
-                FulfillWaiters(name, status);
                 return seastar::make_ready_future<Status>(std::move(status));
             }
 
@@ -142,18 +162,15 @@ public:
 
             if (status.is2xxOK() && retry && !retries) {
                 status = Statuses::S503_Service_Unavailable("not all partitions assigned in cpo");
-                FulfillWaiters(name, status);
                 return seastar::make_ready_future<Status>(std::move(status));
             }
 
             if (deadline.isOver()) {
                 status = Statuses::S408_Request_Timeout("cpo deadline exceeded");
-                FulfillWaiters(name, status);
                 return seastar::make_ready_future<Status>(std::move(status));
             }
 
             if (!retries) {
-                FulfillWaiters(name, status);
                 status = Statuses::S408_Request_Timeout("cpo retries exceeded");
                 return seastar::make_ready_future<Status>(std::move(status));
             }
@@ -165,14 +182,32 @@ public:
         });
     }
 
+    // Picks one of the given keys for each partition of the collection they fall in, so that a request covering
+    // all of them can be routed once per partition. The collection is fetched first if it isn't cached. Keys
+    // whose partition is still unknown are each routed on their own
+    template <typename ClockT=Clock>
+    seastar::future<std::vector<dto::Key>> PartitionRoutingKeys(Deadline<ClockT> deadline, const String& name, std::vector<dto::Key> keys) {
+        if (keys.empty() || collections.find(name) != collections.end()) {
+            return seastar::make_ready_future<std::vector<dto::Key>>(_routingKeys(name, keys));
+        }
+        return GetAssignedPartitionWithRetry(deadline, name, keys[0])
+        .then([this, name, keys=std::move(keys)] (Status&&) {
+            return _routingKeys(name, keys);
+        });
+    }
+
     // Gets the partition endpoint for request's key, executes the request, and refreshes the
     // partition map and retries if necessary. The caller must keep the request alive for the
     // duration of the future.
     // RequestT must have a pvid field and a collectionName field
+    // Snapshot reads go to a follower of the partition if it has any, unless allowFollower is false. If the
+    // follower can't serve the read, it is sent to the partition instead
     template<class RequestT, typename ResponseT, Verb verb, typename ClockT=Clock>
     seastar::future<std::tuple<Status, ResponseT>> PartitionRequest(Deadline<ClockT> deadline, RequestT& request,
-                                    bool reverse=false, bool exclusiveKey=false, uint8_t retries=1) {
+                                    bool reverse=false, bool exclusiveKey=false, uint8_t retries=1, bool allowFollower=true) {
         K2LOG_D(log::cpoclient, "making partition request with deadline={}", deadline.getRemaining());
+        // the calls below are made from continuations, so they re-enter the trace context of the caller
+        auto trace = tracing::current();
         // If collection is not in cache or partition is not assigned, get collection first
         seastar::future<Status> f = seastar::make_ready_future<Status>(Statuses::S200_OK("default cached response"));
         auto it = collections.find(request.collectionName);
@@ -188,7 +223,8 @@ public:
             }
         }
 
-        return f.then([this, deadline, &request, reverse, exclusiveKey, retries](Status&& status) {
+        return f.then([this, deadline, &request, reverse, exclusiveKey, retries, trace](Status&& status) {
+            tracing::Scope scope(trace);
             K2LOG_D(log::cpoclient, "Collection get completed with status={}, request={} ", status, request);
             auto it = collections.find(request.collectionName);
 
@@ -208,11 +244,26 @@ public:
 
             Duration timeout = std::min(deadline.getRemaining(), partition_request_timeout());
             request.pvid = partition.partition->pvid;
+
+            if (allowFollower && partition.followerEndpoint && _isFollowerRead(request)) {
+                K2LOG_D(log::cpoclient, "making follower call to url={}, with timeout={}", partition.followerEndpoint->url, timeout);
+                return RPC().callRPC<RequestT, ResponseT>(verb, request, *partition.followerEndpoint, timeout).
+                then([this, &request, deadline, reverse, exclusiveKey, retries, trace] (auto&& result) {
+                    auto& [status, k2response] = result;
+                    if (status.is2xxOK() || status.code == 404) {
+                        return RPCResponse(std::move(status), std::move(k2response));
+                    }
+                    // the follower is behind, gone, or doesn't follow this version of the partition
+                    K2LOG_D(log::cpoclient, "follower call completed with status={}, sending to the partition", status);
+                    tracing::Scope scope(trace);
+                    return PartitionRequest<RequestT, ResponseT, verb>(deadline, request, reverse, exclusiveKey, retries, false);
+                });
+            }
             K2LOG_D(log::cpoclient, "making partition call to url={}, with timeout={}", partition.preferredEndpoint->url, timeout);
 
             // Attempt the request RPC
             return RPC().callRPC<RequestT, ResponseT>(verb, request, *partition.preferredEndpoint, timeout).
-            then([this, &request, deadline, reverse, exclusiveKey, retries] (auto&& result) {
+            then([this, &request, deadline, reverse, exclusiveKey, retries, trace] (auto&& result) {
                 auto& [status, k2response] = result;
                 K2LOG_D(log::cpoclient, "partition call completed with status={}", status);
 
@@ -234,22 +285,26 @@ public:
 
                 // S410_Gone (refresh partition map) or retryable error
                 return GetAssignedPartitionWithRetry(deadline, request.collectionName, request.key, reverse, exclusiveKey, 1)
-                .then([this, &request, deadline, reverse, exclusiveKey, retries] (Status&& status) {
+                .then([this, &request, deadline, reverse, exclusiveKey, retries, trace] (Status&& status) {
                     K2LOG_D(log::cpoclient, "retrying partition call after status={}", status);
                     (void) status;
+                    tracing::Scope scope(trace);
                     return PartitionRequest<RequestT, ResponseT, verb>(deadline, request, reverse, exclusiveKey, retries-1);
                 });
             });
         });
     }
 
+    // Concurrent callers for the same cluster share one outstanding request, and the cluster is cached
+    // for persistence_cluster_cache_ttl
     template<typename ClockT=Clock>
     seastar::future<std::tuple<Status, dto::PersistenceClusterGetResponse>> GetPersistenceCluster(Deadline<ClockT> deadline, String name) {
-        dto::PersistenceClusterGetRequest request{.name = std::move(name)};
-
         Duration timeout = std::min(deadline.getRemaining(), cpo_request_timeout());
-        return RPC().callRPC<dto::PersistenceClusterGetRequest, dto::PersistenceClusterGetResponse>(dto::Verbs::CPO_PERSISTENCE_CLUSTER_GET, request, *cpo, timeout)
-        .then([this, &request, deadline] (auto&& result) {
+        return _persistenceClusterGets.get(name, persistence_cluster_cache_ttl(), [this, name, timeout] {
+            dto::PersistenceClusterGetRequest request{.name = name};
+            return RPC().callRPC<dto::PersistenceClusterGetRequest, dto::PersistenceClusterGetResponse>(dto::Verbs::CPO_PERSISTENCE_CLUSTER_GET, request, *cpo, timeout);
+        })
+        .then([deadline] (auto&& result) {
             auto& [status, k2response] = result;
 
             if (deadline.isOver()) {
@@ -265,16 +320,58 @@ public:
     seastar::future<k2::Status> createSchema(const String& collectionName, k2::dto::Schema schema);
     seastar::future<std::tuple<k2::Status, std::vector<k2::dto::Schema>>> getSchemas(const String& collectionName);
 
-    std::unique_ptr<TXEndpoint> cpo;
+    // Applies a partition map change pushed by the CPO to the cached collection. If a change was missed,
+    // the collection is dropped from the cache and fetched again by the next request for it
+    void applyCollectionChange(dto::CollectionChangeRequest&& change);
+
+    seastar::lw_shared_ptr<TXEndpoint> cpo;
     std::unordered_map<String, dto::PartitionGetter> collections;
+    // If set, the endpoint the CPO pushes changes of the collections we fetch to. The owner of the client
+    // must handle CPO_COLLECTION_CHANGE on it with applyCollectionChange()
+    String subscriber;
+
+    // open the connections to the partitions of the collections we fetch, and to the partitions which the changes
+    // bring in, ahead of their first requests
+    bool warmupConnections = false;
+
+    // If set, collections and schemas are looked up here instead of in the CPO, e.g. in the
+    // CollectionMetadataCache shared by the cores of a node
+    std::function<seastar::future<std::tuple<Status, dto::Collection>>(const String& name)> collectionSource;
+    std::function<seastar::future<std::tuple<Status, std::vector<dto::Schema>>>(const String& name)> schemaSource;
 
     ConfigDuration partition_request_timeout{"partition_request_timeout", 100ms};
     ConfigDuration schema_request_timeout{"schema_request_timeout", 1s};
     ConfigDuration cpo_request_timeout{"cpo_request_timeout", 100ms};
     ConfigDuration cpo_request_backoff{"cpo_request_backoff", 500ms};
+    // how long fetched schemas and persistence clusters are reused. Schemas are created at runtime and
+    // fetched again when one is missing, so by default their requests are only coalesced
+    ConfigDuration schema_cache_ttl{"schema_cache_ttl", 0s};
+    ConfigDuration persistence_cluster_cache_ttl{"persistence_cluster_cache_ttl", 10s};
 private:
-    void FulfillWaiters(const String& name, const Status& status);
-    std::unordered_map<String, std::vector<seastar::promise<Status>>> requestWaiters;
+    // true for the requests a follower can serve. Queries stay with the partition since their streams are
+    // pinned to the core which started them
+    template <typename RequestT>
+    static bool _isFollowerRead(const RequestT& request) {
+        if constexpr (std::is_same_v<RequestT, dto::K23SIReadRequest> || std::is_same_v<RequestT, dto::K23SIReadMultiRequest>) {
+            return request.snapshotRead;
+        } else {
+            (void) request;
+            return false;
+        }
+    }
+
+    // fetches the collection into the collections cache
+    seastar::future<Status> _fetchCollection(const String& name, Duration timeout);
+
+    // the first of the keys in each partition of the cached collection, and the keys with no known partition
+    std::vector<dto::Key> _routingKeys(const String& name, const std::vector<dto::Key>& keys);
+
+    // with warmupConnections, starts opening the connections to the endpoints of the partitions
+    void _connect(const dto::PartitionGetter& getter);
+
+    CoalescingCache<Status> _collectionGets;
+    CoalescingCache<std::tuple<Status, std::vector<dto::Schema>>> _schemaGets;
+    CoalescingCache<std::tuple<Status, dto::PersistenceClusterGetResponse>> _persistenceClusterGets;
 };
 
 } // ns k2
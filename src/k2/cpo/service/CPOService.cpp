@@ -28,12 +28,16 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/transport/Payload.h>  // for payload construction
 #include <k2/transport/Status.h>  // for RPC
 #include <k2/transport/RPCDispatcher.h>  // for RPC
+#include <k2/transport/Discovery.h>
 #include <k2/dto/ControlPlaneOracle.h> // our DTO
 #include <k2/dto/AssignmentManager.h> // our DTO
 #include <k2/dto/MessageVerbs.h> // our DTO
 #include <k2/dto/K23SI.h> // our DTO
 #include <k2/transport/PayloadFileUtil.h>
 
+#include <algorithm>
+#include <set>
+
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/stat.h>
@@ -56,11 +60,13 @@ seastar::future<> CPOService::gracefulStop() {
         futs.push_back(std::move(v));
     }
     _assignments.clear();
+    futs.push_back(_loadCheckTimer.stop());
+    futs.push_back(_notifyGate.close());
     return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result();
 }
 
 seastar::future<> CPOService::start() {
-    APIServer& api_server = AppBase().getDist<APIServer>().local();
+    APIServer& api_server = AppBase().getLocal<APIServer>();
 
     K2LOG_I(log::cposvr, "Registering message handlers");
     RPC().registerRPCObserver<dto::CollectionCreateRequest, dto::CollectionCreateResponse>(dto::Verbs::CPO_COLLECTION_CREATE, [this](dto::CollectionCreateRequest&& request) {
@@ -101,11 +107,49 @@ seastar::future<> CPOService::start() {
         return _dist().invoke_on(0, &CPOService::handleSchemasGet, std::move(request));
     });
 
+    RPC().registerRPCObserver<dto::PartitionSplitRequest, dto::PartitionSplitResponse>(dto::Verbs::CPO_PARTITION_SPLIT,
+    [this] (dto::PartitionSplitRequest&& request) {
+        return _dist().invoke_on(0, &CPOService::handleSplit, std::move(request));
+    });
+    api_server.registerAPIObserver<dto::PartitionSplitRequest, dto::PartitionSplitResponse>("PartitionSplit", "CPO split a partition",
+    [this] (dto::PartitionSplitRequest&& request) {
+        return _dist().invoke_on(0, &CPOService::handleSplit, std::move(request));
+    });
+
+    RPC().registerRPCObserver<dto::PartitionMigrateRequest, dto::PartitionMigrateResponse>(dto::Verbs::CPO_PARTITION_MIGRATE,
+    [this] (dto::PartitionMigrateRequest&& request) {
+        return _dist().invoke_on(0, &CPOService::handleMigrate, std::move(request));
+    });
+    api_server.registerAPIObserver<dto::PartitionMigrateRequest, dto::PartitionMigrateResponse>("PartitionMigrate", "CPO move a partition to another k2 core",
+    [this] (dto::PartitionMigrateRequest&& request) {
+        return _dist().invoke_on(0, &CPOService::handleMigrate, std::move(request));
+    });
+
+    RPC().registerRPCObserver<dto::PartitionAddFollowerRequest, dto::PartitionAddFollowerResponse>(dto::Verbs::CPO_PARTITION_ADD_FOLLOWER,
+    [this] (dto::PartitionAddFollowerRequest&& request) {
+        return _dist().invoke_on(0, &CPOService::handleAddFollower, std::move(request));
+    });
+
+    RPC().registerRPCObserver<dto::NodeHeartbeatRequest, dto::NodeHeartbeatResponse>(dto::Verbs::CPO_NODE_HEARTBEAT,
+    [this] (dto::NodeHeartbeatRequest&& request) {
+        return _dist().invoke_on(0, &CPOService::handleNodeHeartbeat, std::move(request));
+    });
+    api_server.registerAPIObserver<dto::PartitionAddFollowerRequest, dto::PartitionAddFollowerResponse>("PartitionAddFollower", "CPO add a read-only follower of a partition on another k2 core",
+    [this] (dto::PartitionAddFollowerRequest&& request) {
+        return _dist().invoke_on(0, &CPOService::handleAddFollower, std::move(request));
+    });
+
     if (seastar::this_shard_id() == 0) {
         // only core 0 handles CPO business
         if (!fileutil::makeDir(_dataDir())) {
             throw std::runtime_error("unable to create data directory");
         }
+        if (_loadCheckInterval() > 0s) {
+            _loadCheckTimer.setCallback([this] {
+                return _loadCheck();
+            });
+            _loadCheckTimer.armPeriodic(_loadCheckInterval());
+        }
     }
 
     return seastar::make_ready_future<>();
@@ -178,6 +222,9 @@ CPOService::handleCreate(dto::CollectionCreateRequest&& request) {
     if (fileutil::fileExists(cpath)) {
         return RPCResponse(Statuses::S403_Forbidden("collection already exists"), dto::CollectionCreateResponse());
     }
+    if (request.clusterEndpoints.empty()) {
+        return _placeCollection(std::move(request));
+    }
     request.metadata.heartbeatDeadline = _collectionHeartbeatDeadline();
     // create a collection from the incoming request
     dto::Collection collection;
@@ -210,6 +257,28 @@ CPOService::handleCreate(dto::CollectionCreateRequest&& request) {
     return RPCResponse(std::move(status), dto::CollectionCreateResponse());
 }
 
+seastar::future<std::tuple<Status, dto::CollectionCreateResponse>>
+CPOService::_placeCollection(dto::CollectionCreateRequest&& request) {
+    size_t count = request.metadata.hashScheme == dto::HashScheme::Range ? request.rangeEnds.size() : request.partitionCount;
+    if (count == 0) {
+        return RPCResponse(Statuses::S400_Bad_Request("no cluster endpoints or partition count given"), dto::CollectionCreateResponse());
+    }
+    return _collectLoad()
+    .then([this, count, request=std::move(request)] () mutable {
+        request.clusterEndpoints = _placement.place(count);
+        if (request.clusterEndpoints.size() < count) {
+            K2LOG_W(log::cposvr, "only {} free cores for the {} partitions of collection {}",
+                    request.clusterEndpoints.size(), count, request.metadata.name);
+            return RPCResponse(Statuses::S503_Service_Unavailable("not enough free cores"), dto::CollectionCreateResponse());
+        }
+        for (auto& ep : request.clusterEndpoints) {
+            _placement.markAssigned(ep);
+        }
+        K2LOG_I(log::cposvr, "placing collection {} on {}", request.metadata.name, request.clusterEndpoints);
+        return handleCreate(std::move(request));
+    });
+}
+
 seastar::future<std::tuple<Status, dto::CollectionGetResponse>>
 CPOService::handleGet(dto::CollectionGetRequest&& request) {
     K2LOG_I(log::cposvr, "Received collection get request for {}", request.name);
@@ -217,11 +286,48 @@ CPOService::handleGet(dto::CollectionGetRequest&& request) {
 
     dto::CollectionGetResponse response;
     if (status.is2xxOK()) {
+        if (!request.subscriber.empty()) {
+            _subscribers[request.name].insert(request.subscriber);
+        }
         response.collection = std::move(collection);
     }
     return RPCResponse(std::move(status), std::move(response));
 }
 
+void CPOService::_publishChange(const String& name, uint64_t baseVersion, uint64_t version, std::vector<dto::Partition> partitions) {
+    auto it = _subscribers.find(name);
+    if (it == _subscribers.end() || it->second.empty() || _notifyGate.is_closed()) {
+        return;
+    }
+    K2LOG_D(log::cposvr, "publishing version {} of collection {} to {} subscribers", version, name, it->second.size());
+    auto change = seastar::make_lw_shared<dto::CollectionChangeRequest>(dto::CollectionChangeRequest{
+        .name=name, .baseVersion=baseVersion, .version=version, .partitions=std::move(partitions)});
+    for (auto& subscriber : it->second) {
+        (void) seastar::with_gate(_notifyGate, [this, name, subscriber, change] {
+            auto ep = RPC().getTXEndpoint(subscriber);
+            if (!ep) {
+                return seastar::make_ready_future<Status>(Statuses::S400_Bad_Request("bad subscriber endpoint"));
+            }
+            return seastar::do_with(std::move(ep), [this, change] (auto& ep) {
+                return RPC().callRPC<dto::CollectionChangeRequest, dto::CollectionChangeResponse>
+                    (dto::Verbs::CPO_COLLECTION_CHANGE, *change, *ep, _changeNotifyTimeout())
+                .then([] (auto&& result) {
+                    return std::move(std::get<0>(result));
+                });
+            });
+        })
+        .handle_exception([] (auto exc) {
+            return Statuses::S503_Service_Unavailable(fmt::format("unable to push change: {}", exc));
+        })
+        .then([this, name, subscriber] (Status&& status) {
+            if (!status.is2xxOK()) {
+                K2LOG_W(log::cposvr, "dropping subscriber {} of collection {}: {}", subscriber, name, status);
+                _subscribers[name].erase(subscriber);
+            }
+        });
+    }
+}
+
 seastar::future<Status> CPOService::_pushSchema(const dto::Collection& collection, const dto::Schema& schema) {
     std::vector<seastar::future<std::tuple<Status, dto::K23SIPushSchemaResponse>>> pushFutures;
 
@@ -235,6 +341,16 @@ seastar::future<Status> CPOService::_pushSchema(const dto::Collection& collectio
 
         pushFutures.push_back(RPC().callRPC<dto::K23SIPushSchemaRequest, dto::K23SIPushSchemaResponse>
             (dto::Verbs::K23SI_PUSH_SCHEMA, request, *endpoint, 1s));
+
+        // followers need the schemas to serve reads
+        for (const String& url : part.followers) {
+            auto follower = RPC().getTXEndpoint(url);
+            if (!follower) {
+                return seastar::make_ready_future<Status>(Statuses::S500_Internal_Server_Error("Follower endpoint was null"));
+            }
+            pushFutures.push_back(RPC().callRPC<dto::K23SIPushSchemaRequest, dto::K23SIPushSchemaResponse>
+                (dto::Verbs::K23SI_PUSH_SCHEMA, request, *follower, 1s));
+        }
     }
 
     return when_all_succeed(pushFutures.begin(), pushFutures.end())
@@ -291,21 +407,30 @@ CPOService::handleCreateSchema(dto::CreateSchemaRequest&& request) {
         return RPCResponse(std::move(status), dto::CreateSchemaResponse{});
     }
 
-    bool validatedKeys = false;
-    for (const dto::Schema& otherSchema : schemas[request.collectionName]) {
-        if (otherSchema.name == request.schema.name && otherSchema.version == request.schema.version) {
-            return RPCResponse(Statuses::S403_Forbidden("Schema name and version already exist"), dto::CreateSchemaResponse{});
-        }
+    // the schemas of the secondary indexes are created along with the schema, and validated the same way
+    std::vector<dto::Schema> created;
+    for (const dto::SecondaryIndex& index : request.schema.secondaryIndexes) {
+        created.push_back(request.schema.makeIndexSchema(index));
+    }
+    created.insert(created.begin(), std::move(request.schema));
 
-        // As long as we validate that the key fields match with at least one
-        // other schema with the same name then they will always match
-        if (!validatedKeys && otherSchema.name == request.schema.name) {
-            validation = otherSchema.canUpgradeTo(request.schema);
-            if (!validation.is2xxOK()) {
-                return RPCResponse(std::move(validation), dto::CreateSchemaResponse{});
+    for (const dto::Schema& schema : created) {
+        bool validatedKeys = false;
+        for (const dto::Schema& otherSchema : schemas[request.collectionName]) {
+            if (otherSchema.name == schema.name && otherSchema.version == schema.version) {
+                return RPCResponse(Statuses::S403_Forbidden("Schema name and version already exist"), dto::CreateSchemaResponse{});
             }
 
-            validatedKeys = true;
+            // As long as we validate that the key fields match with at least one
+            // other schema with the same name then they will always match
+            if (!validatedKeys && otherSchema.name == schema.name) {
+                validation = otherSchema.canUpgradeTo(schema);
+                if (!validation.is2xxOK()) {
+                    return RPCResponse(std::move(validation), dto::CreateSchemaResponse{});
+                }
+
+                validatedKeys = true;
+            }
         }
     }
 
@@ -316,15 +441,714 @@ CPOService::handleCreateSchema(dto::CreateSchemaRequest&& request) {
     }
 
     // 4. Update in memory
-    schemas[request.collectionName].push_back(std::move(request.schema));
+    auto& collectionSchemas = schemas[request.collectionName];
+    size_t first = collectionSchemas.size();
+    std::move(created.begin(), created.end(), std::back_inserter(collectionSchemas));
 
     // 5. Push to K2 nodes and respond to client
-    return _pushSchema(collection, schemas[request.collectionName].back())
-    .then([] (Status&& status) {
-        return RPCResponse(std::move(status), dto::CreateSchemaResponse{});
+    std::vector<seastar::future<Status>> pushes;
+    for (size_t i = first; i < collectionSchemas.size(); ++i) {
+        pushes.push_back(_pushSchema(collection, collectionSchemas[i]));
+    }
+    return seastar::when_all_succeed(pushes.begin(), pushes.end())
+    .then([] (std::vector<Status>&& statuses) {
+        for (Status& status : statuses) {
+            if (!status.is2xxOK()) {
+                return RPCResponse(std::move(status), dto::CreateSchemaResponse{});
+            }
+        }
+        return RPCResponse(std::move(statuses[0]), dto::CreateSchemaResponse{});
+    });
+}
+
+seastar::future<std::tuple<Status, dto::PartitionSplitResponse>>
+CPOService::handleSplit(dto::PartitionSplitRequest&& request) {
+    K2LOG_I(log::cposvr, "Received partition split request {}", request);
+    auto [status, collection] = _getCollection(request.collectionName);
+    if (!status.is2xxOK()) {
+        return RPCResponse(std::move(status), dto::PartitionSplitResponse{});
+    }
+    if (_splitsInProgress.count(request.collectionName) > 0) {
+        return RPCResponse(Statuses::S409_Conflict("a split of the collection is already in progress"), dto::PartitionSplitResponse{});
+    }
+    auto& parts = collection.partitionMap.partitions;
+    auto it = std::find_if(parts.begin(), parts.end(), [&request] (const dto::Partition& part) {
+        return part.pvid == request.pvid;
+    });
+    if (it == parts.end()) {
+        return RPCResponse(Statuses::S404_Not_Found("partition not found"), dto::PartitionSplitResponse{});
+    }
+    if (it->astate != dto::AssignmentState::Assigned || it->endpoints.empty()) {
+        return RPCResponse(Statuses::S409_Conflict("partition is not assigned"), dto::PartitionSplitResponse{});
+    }
+    dto::OwnerPartition owner(dto::Partition(*it), collection.metadata.hashScheme);
+    if (request.splitKey.empty() && collection.metadata.hashScheme == dto::HashScheme::HashCRC32C) {
+        request.splitKey = owner.hashMidpoint();
+    }
+    if (!owner.canSplitAt(request.splitKey)) {
+        return RPCResponse(Statuses::S400_Bad_Request("split key is not inside the partition"), dto::PartitionSplitResponse{});
+    }
+
+    uint64_t maxId = 0;
+    for (auto& part : parts) {
+        maxId = std::max(maxId, part.pvid.id);
+    }
+    dto::Partition left = *it;
+    left.endKey = request.splitKey;
+    left.pvid.rangeVersion++;
+    // the followers keep following the old version of the partition until they are replaced
+    left.followers.clear();
+    dto::Partition right {
+        .pvid{
+            .id = maxId + 1,
+            .rangeVersion=1,
+            .assignmentVersion=1
+        },
+        .startKey=request.splitKey,
+        .endKey=it->endKey,
+        .endpoints={request.targetEndpoint},
+        .astate=dto::AssignmentState::PendingAssignment
+    };
+
+    auto name = request.collectionName;
+    auto source = *it;
+    _splitsInProgress.insert(name);
+    return _split(std::move(collection), source, left, right)
+    .then([this, name, source, left, right] (Status&& status) mutable {
+        _splitsInProgress.erase(name);
+        if (!status.is2xxOK()) {
+            K2LOG_W(log::cposvr, "split of partition {} in collection {} failed: {}", source, name, status);
+            return RPCResponse(std::move(status), dto::PartitionSplitResponse{});
+        }
+        // publish the split. Clients of the old partition are told to refresh the collection and pick it up
+        auto [getStatus, collection] = _getCollection(name);
+        if (!getStatus.is2xxOK()) {
+            return RPCResponse(std::move(getStatus), dto::PartitionSplitResponse{});
+        }
+        auto& parts = collection.partitionMap.partitions;
+        auto it = std::find_if(parts.begin(), parts.end(), [&source] (const dto::Partition& part) {
+            return part.pvid == source.pvid;
+        });
+        if (it == parts.end()) {
+            return RPCResponse(Statuses::S500_Internal_Server_Error("split partition is gone from the collection"), dto::PartitionSplitResponse{});
+        }
+        *it = left;
+        parts.insert(it + 1, right);
+        collection.partitionMap.version++;
+        auto saved = _saveCollection(collection);
+        if (!saved.is2xxOK()) {
+            return RPCResponse(std::move(saved), dto::PartitionSplitResponse{});
+        }
+        _publishChange(name, collection.partitionMap.version - 1, collection.partitionMap.version, {std::move(left), std::move(right)});
+        K2LOG_I(log::cposvr, "split partition {} in collection {}, new map: {}", source, name, collection.partitionMap);
+        return RPCResponse(Statuses::S200_OK("partition split"), dto::PartitionSplitResponse{.partitionMap=std::move(collection.partitionMap)});
+    });
+}
+
+seastar::future<Status>
+CPOService::_split(dto::Collection collection, dto::Partition source, dto::Partition left, dto::Partition right) {
+    auto srcep = RPC().getTXEndpoint(*source.endpoints.begin());
+    auto dstep = RPC().getTXEndpoint(*right.endpoints.begin());
+    if (!srcep || !dstep) {
+        return seastar::make_ready_future<Status>(Statuses::S400_Bad_Request("unable to obtain the endpoints for the split"));
+    }
+    dto::K23SISplitRequest request{.collectionName=collection.metadata.name, .pvid=source.pvid, .splitKey=right.startKey,
+                                   .partition=std::move(left), .newPartition=right, .checkOnly=true};
+
+    return seastar::do_with(std::move(collection), std::move(request), std::move(right), std::move(srcep), std::move(dstep),
+        [this] (auto& collection, auto& request, auto& right, auto& srcep, auto& dstep) {
+        // check with the source first, so that we don't assign the new partition for a split which would be refused
+        return RPC().callRPC<dto::K23SISplitRequest, dto::K23SISplitResponse>(dto::Verbs::K23SI_SPLIT, request, *srcep, _assignTimeout())
+        .then([this, &collection, &right, &dstep] (auto&& result) {
+            auto& [status, resp] = result;
+            if (!status.is2xxOK()) {
+                return seastar::make_ready_future<Status>(std::move(status));
+            }
+            dto::AssignmentCreateRequest assign;
+            assign.collectionMeta = collection.metadata;
+            assign.partition = right;
+            K2LOG_I(log::cposvr, "Sending assignment for split partition: {}", assign.partition);
+            return RPC().callRPC<dto::AssignmentCreateRequest, dto::AssignmentCreateResponse>
+                (dto::K2_ASSIGNMENT_CREATE, assign, *dstep, _assignTimeout())
+            .then([this, &collection, &right] (auto&& result) {
+                auto& [status, resp] = result;
+                if (!status.is2xxOK()) {
+                    return seastar::make_ready_future<Status>(std::move(status));
+                }
+                right.astate = resp.assignedPartition.astate;
+                right.endpoints = std::move(resp.assignedPartition.endpoints);
+                // the new partition needs all schemas before it can take the keys
+                dto::Collection target;
+                target.metadata = collection.metadata;
+                target.partitionMap.partitions.push_back(right);
+                std::vector<seastar::future<Status>> pushes;
+                for (const dto::Schema& schema : schemas[collection.metadata.name]) {
+                    pushes.push_back(_pushSchema(target, schema));
+                }
+                return seastar::when_all_succeed(pushes.begin(), pushes.end())
+                .then([] (std::vector<Status>&& statuses) {
+                    for (Status& status : statuses) {
+                        if (!status.is2xxOK()) {
+                            return std::move(status);
+                        }
+                    }
+                    return Statuses::S200_OK("");
+                });
+            });
+        })
+        .then([this, &request, &right, &srcep] (Status&& status) {
+            if (!status.is2xxOK()) {
+                return seastar::make_ready_future<Status>(std::move(status));
+            }
+            request.newPartition = right;
+            request.checkOnly = false;
+            return RPC().callRPC<dto::K23SISplitRequest, dto::K23SISplitResponse>(dto::Verbs::K23SI_SPLIT, request, *srcep, _splitTimeout())
+            .then([] (auto&& result) {
+                auto& [status, resp] = result;
+                K2LOG_I(log::cposvr, "split moved {} keys with status {}", resp.movedKeys, status);
+                return std::move(status);
+            });
+        });
+    })
+    .handle_exception([] (auto exc) {
+        K2LOG_W_EXC(log::cposvr, exc, "Failed to split partition");
+        return Statuses::S500_Internal_Server_Error("failed to split partition");
+    });
+}
+
+seastar::future<std::tuple<Status, dto::PartitionMigrateResponse>>
+CPOService::handleMigrate(dto::PartitionMigrateRequest&& request) {
+    K2LOG_I(log::cposvr, "Received partition migrate request {}", request);
+    auto [status, collection] = _getCollection(request.collectionName);
+    if (!status.is2xxOK()) {
+        return RPCResponse(std::move(status), dto::PartitionMigrateResponse{});
+    }
+    if (_splitsInProgress.count(request.collectionName) > 0) {
+        return RPCResponse(Statuses::S409_Conflict("a split or migration of the collection is already in progress"), dto::PartitionMigrateResponse{});
+    }
+    auto& parts = collection.partitionMap.partitions;
+    auto it = std::find_if(parts.begin(), parts.end(), [&request] (const dto::Partition& part) {
+        return part.pvid == request.pvid;
+    });
+    if (it == parts.end()) {
+        return RPCResponse(Statuses::S404_Not_Found("partition not found"), dto::PartitionMigrateResponse{});
+    }
+    if (it->astate != dto::AssignmentState::Assigned || it->endpoints.empty()) {
+        return RPCResponse(Statuses::S409_Conflict("partition is not assigned"), dto::PartitionMigrateResponse{});
+    }
+    if (it->endpoints.count(request.targetEndpoint) > 0) {
+        return RPCResponse(Statuses::S400_Bad_Request("partition is already assigned to the target"), dto::PartitionMigrateResponse{});
+    }
+
+    auto name = request.collectionName;
+    auto source = *it;
+    auto moved = seastar::make_lw_shared<dto::Partition>(source);
+    moved->pvid.assignmentVersion++;
+    moved->endpoints = {request.targetEndpoint};
+    moved->astate = dto::AssignmentState::PendingAssignment;
+    moved->followers.clear();
+    _splitsInProgress.insert(name);
+    return _migrate(std::move(collection), source, *moved)
+    .then([this, name, source, moved] (Status&& status) {
+        _splitsInProgress.erase(name);
+        if (!status.is2xxOK()) {
+            K2LOG_W(log::cposvr, "migration of partition {} in collection {} failed: {}", source, name, status);
+            return RPCResponse(std::move(status), dto::PartitionMigrateResponse{});
+        }
+        // publish the new assignment. Clients of the old one are told to refresh the collection and pick it up
+        auto [getStatus, collection] = _getCollection(name);
+        if (!getStatus.is2xxOK()) {
+            return RPCResponse(std::move(getStatus), dto::PartitionMigrateResponse{});
+        }
+        auto& parts = collection.partitionMap.partitions;
+        auto it = std::find_if(parts.begin(), parts.end(), [&source] (const dto::Partition& part) {
+            return part.pvid == source.pvid;
+        });
+        if (it == parts.end()) {
+            return RPCResponse(Statuses::S500_Internal_Server_Error("migrated partition is gone from the collection"), dto::PartitionMigrateResponse{});
+        }
+        *it = *moved;
+        collection.partitionMap.version++;
+        auto saved = _saveCollection(collection);
+        if (!saved.is2xxOK()) {
+            return RPCResponse(std::move(saved), dto::PartitionMigrateResponse{});
+        }
+        _publishChange(name, collection.partitionMap.version - 1, collection.partitionMap.version, {std::move(*moved)});
+        K2LOG_I(log::cposvr, "migrated partition {} in collection {}, new map: {}", source, name, collection.partitionMap);
+        return RPCResponse(Statuses::S200_OK("partition migrated"), dto::PartitionMigrateResponse{.partitionMap=std::move(collection.partitionMap)});
+    });
+}
+
+seastar::future<Status>
+CPOService::_migrate(dto::Collection collection, dto::Partition source, dto::Partition& moved) {
+    auto srcep = RPC().getTXEndpoint(*source.endpoints.begin());
+    auto dstep = RPC().getTXEndpoint(*moved.endpoints.begin());
+    if (!srcep || !dstep) {
+        return seastar::make_ready_future<Status>(Statuses::S400_Bad_Request("unable to obtain the endpoints for the migration"));
+    }
+    dto::AssignmentCreateRequest assign;
+    assign.collectionMeta = collection.metadata;
+    assign.partition = moved;
+    assign.migrationTarget = true;
+    K2LOG_I(log::cposvr, "Sending assignment for migrated partition: {}", assign.partition);
+
+    return seastar::do_with(std::move(collection), std::move(assign), std::move(source), std::move(srcep), std::move(dstep),
+        [this, &moved] (auto& collection, auto& assign, auto& source, auto& srcep, auto& dstep) {
+        return RPC().callRPC<dto::AssignmentCreateRequest, dto::AssignmentCreateResponse>
+            (dto::K2_ASSIGNMENT_CREATE, assign, *dstep, _assignTimeout())
+        .then([this, &collection, &moved] (auto&& result) {
+            auto& [status, resp] = result;
+            if (!status.is2xxOK()) {
+                return seastar::make_ready_future<Status>(std::move(status));
+            }
+            moved.astate = resp.assignedPartition.astate;
+            moved.endpoints = std::move(resp.assignedPartition.endpoints);
+            // the new core needs all schemas before it can take the keys
+            dto::Collection target;
+            target.metadata = collection.metadata;
+            target.partitionMap.partitions.push_back(moved);
+            std::vector<seastar::future<Status>> pushes;
+            for (const dto::Schema& schema : schemas[collection.metadata.name]) {
+                pushes.push_back(_pushSchema(target, schema));
+            }
+            return seastar::when_all_succeed(pushes.begin(), pushes.end())
+            .then([] (std::vector<Status>&& statuses) {
+                for (Status& status : statuses) {
+                    if (!status.is2xxOK()) {
+                        return std::move(status);
+                    }
+                }
+                return Statuses::S200_OK("");
+            });
+        })
+        .then([this, &collection, &source, &moved, &srcep] (Status&& status) {
+            if (!status.is2xxOK()) {
+                return seastar::make_ready_future<Status>(std::move(status));
+            }
+            dto::K23SIMigrateRequest request{.collectionName=collection.metadata.name, .pvid=source.pvid, .newPartition=moved};
+            return RPC().callRPC<dto::K23SIMigrateRequest, dto::K23SIMigrateResponse>(dto::Verbs::K23SI_MIGRATE, request, *srcep, _migrationTimeout())
+            .then([] (auto&& result) {
+                auto& [status, resp] = result;
+                K2LOG_I(log::cposvr, "migration moved {} keys and {} txn records with status {}", resp.movedKeys, resp.movedTxns, status);
+                return std::move(status);
+            });
+        });
+    })
+    .handle_exception([] (auto exc) {
+        K2LOG_W_EXC(log::cposvr, exc, "Failed to migrate partition");
+        return Statuses::S500_Internal_Server_Error("failed to migrate partition");
+    });
+}
+
+seastar::future<std::tuple<Status, dto::PartitionAddFollowerResponse>>
+CPOService::handleAddFollower(dto::PartitionAddFollowerRequest&& request) {
+    K2LOG_I(log::cposvr, "Received partition add follower request {}", request);
+    auto [status, collection] = _getCollection(request.collectionName);
+    if (!status.is2xxOK()) {
+        return RPCResponse(std::move(status), dto::PartitionAddFollowerResponse{});
+    }
+    if (_splitsInProgress.count(request.collectionName) > 0) {
+        return RPCResponse(Statuses::S409_Conflict("a split or migration of the collection is already in progress"), dto::PartitionAddFollowerResponse{});
+    }
+    auto& parts = collection.partitionMap.partitions;
+    auto it = std::find_if(parts.begin(), parts.end(), [&request] (const dto::Partition& part) {
+        return part.pvid == request.pvid;
+    });
+    if (it == parts.end()) {
+        return RPCResponse(Statuses::S404_Not_Found("partition not found"), dto::PartitionAddFollowerResponse{});
+    }
+    if (it->astate != dto::AssignmentState::Assigned || it->endpoints.empty()) {
+        return RPCResponse(Statuses::S409_Conflict("partition is not assigned"), dto::PartitionAddFollowerResponse{});
+    }
+    if (it->endpoints.count(request.endpoint) > 0 || it->followers.count(request.endpoint) > 0) {
+        return RPCResponse(Statuses::S400_Bad_Request("partition is already assigned to the endpoint"), dto::PartitionAddFollowerResponse{});
+    }
+
+    auto name = request.collectionName;
+    auto source = *it;
+    auto follower = seastar::make_lw_shared<String>();
+    // the partition map must not change under us while the follower is being assigned
+    _splitsInProgress.insert(name);
+    return _addFollower(std::move(collection), source, std::move(request.endpoint), *follower)
+    .then([this, name, source, follower] (Status&& status) {
+        _splitsInProgress.erase(name);
+        if (!status.is2xxOK()) {
+            K2LOG_W(log::cposvr, "adding a follower of partition {} in collection {} failed: {}", source, name, status);
+            return RPCResponse(std::move(status), dto::PartitionAddFollowerResponse{});
+        }
+        auto [getStatus, collection] = _getCollection(name);
+        if (!getStatus.is2xxOK()) {
+            return RPCResponse(std::move(getStatus), dto::PartitionAddFollowerResponse{});
+        }
+        auto& parts = collection.partitionMap.partitions;
+        auto it = std::find_if(parts.begin(), parts.end(), [&source] (const dto::Partition& part) {
+            return part.pvid == source.pvid;
+        });
+        if (it == parts.end()) {
+            return RPCResponse(Statuses::S500_Internal_Server_Error("followed partition is gone from the collection"), dto::PartitionAddFollowerResponse{});
+        }
+        it->followers.insert(*follower);
+        collection.partitionMap.version++;
+        auto saved = _saveCollection(collection);
+        if (!saved.is2xxOK()) {
+            return RPCResponse(std::move(saved), dto::PartitionAddFollowerResponse{});
+        }
+        _publishChange(name, collection.partitionMap.version - 1, collection.partitionMap.version, {*it});
+        K2LOG_I(log::cposvr, "added follower {} of partition {} in collection {}", *follower, source, name);
+        return RPCResponse(Statuses::S200_OK("follower added"), dto::PartitionAddFollowerResponse{.partitionMap=std::move(collection.partitionMap)});
+    });
+}
+
+seastar::future<Status>
+CPOService::_addFollower(dto::Collection collection, dto::Partition source, String endpoint, String& follower) {
+    auto srcep = RPC().getTXEndpoint(*source.endpoints.begin());
+    auto dstep = RPC().getTXEndpoint(endpoint);
+    if (!srcep || !dstep) {
+        return seastar::make_ready_future<Status>(Statuses::S400_Bad_Request("unable to obtain the endpoints for the follower"));
+    }
+    dto::K23SIPartitionLoadRequest loadRequest{.collectionName=collection.metadata.name, .pvid=source.pvid};
+    return seastar::do_with(std::move(collection), std::move(source), std::move(srcep), std::move(dstep), std::move(loadRequest),
+        [this, &follower] (auto& collection, auto& source, auto& srcep, auto& dstep, auto& loadRequest) {
+        // the follower replays the WAL from wherever the partition writes it
+        return RPC().callRPC<dto::K23SIPartitionLoadRequest, dto::K23SIPartitionLoadResponse>
+            (dto::Verbs::K23SI_PARTITION_LOAD, loadRequest, *srcep, 1s)
+        .then([this, &collection, &source, &dstep] (auto&& result) {
+            auto& [status, load] = result;
+            if (!status.is2xxOK() || load.persistenceEndpoint.empty()) {
+                K2LOG_W(log::cposvr, "unable to get the persistence endpoint of partition {}: {}", source, status);
+                return seastar::make_ready_future<std::tuple<Status, dto::AssignmentCreateResponse>>(
+                    std::make_tuple(Statuses::S503_Service_Unavailable("unable to get the persistence endpoint of the partition"), dto::AssignmentCreateResponse{}));
+            }
+            dto::AssignmentCreateRequest assign;
+            assign.collectionMeta = collection.metadata;
+            assign.partition = source;
+            assign.partition.followers.clear();
+            assign.followPersistence = std::move(load.persistenceEndpoint);
+            K2LOG_I(log::cposvr, "Sending assignment for follower of partition: {}", assign.partition);
+            return seastar::do_with(std::move(assign), [this, &dstep] (auto& assign) {
+                return RPC().callRPC<dto::AssignmentCreateRequest, dto::AssignmentCreateResponse>
+                    (dto::K2_ASSIGNMENT_CREATE, assign, *dstep, _assignTimeout());
+            });
+        })
+        .then([this, &collection, &follower] (auto&& result) {
+            auto& [status, resp] = result;
+            if (!status.is2xxOK()) {
+                return seastar::make_ready_future<Status>(std::move(status));
+            }
+            auto endpoint = Discovery::selectBestEndpoint(resp.assignedPartition.endpoints);
+            if (!endpoint) {
+                return seastar::make_ready_future<Status>(Statuses::S500_Internal_Server_Error("follower has no endpoints"));
+            }
+            follower = endpoint->url;
+            // the follower needs all schemas before it can serve reads
+            dto::Collection target;
+            target.metadata = collection.metadata;
+            target.partitionMap.partitions.push_back(resp.assignedPartition);
+            std::vector<seastar::future<Status>> pushes;
+            for (const dto::Schema& schema : schemas[collection.metadata.name]) {
+                pushes.push_back(_pushSchema(target, schema));
+            }
+            return seastar::when_all_succeed(pushes.begin(), pushes.end())
+            .then([] (std::vector<Status>&& statuses) {
+                for (Status& status : statuses) {
+                    if (!status.is2xxOK()) {
+                        return std::move(status);
+                    }
+                }
+                return Statuses::S200_OK("");
+            });
+        });
+    })
+    .handle_exception([] (auto exc) {
+        K2LOG_W_EXC(log::cposvr, exc, "Failed to add follower");
+        return Statuses::S500_Internal_Server_Error("failed to add follower");
     });
 }
 
+double CPOService::_requestRate(const String& endpoint, uint64_t requests) {
+    auto now = Clock::now();
+    auto it = _requestCounts.find(endpoint);
+    double rate = 0;
+    if (it != _requestCounts.end()) {
+        auto& [prevRequests, prevTime] = it->second;
+        auto elapsed = std::chrono::duration<double>(now - prevTime).count();
+        // the count restarts when the core does
+        if (requests >= prevRequests && elapsed > 0) {
+            rate = (requests - prevRequests) / elapsed;
+        }
+    }
+    _requestCounts[endpoint] = std::make_tuple(requests, now);
+    return rate;
+}
+
+seastar::future<std::tuple<Status, dto::NodeHeartbeatResponse>>
+CPOService::handleNodeHeartbeat(dto::NodeHeartbeatRequest&& request) {
+    K2LOG_D(log::cposvr, "Received heartbeat for {} cores", request.cores.size());
+    auto now = Clock::now();
+    for (auto& core : request.cores) {
+        auto rate = _requestRate(core.endpoint, core.requests);
+        auto ep = core.endpoint;
+        _heartbeats[ep] = _Heartbeat{.core=std::move(core), .requestRate=rate, .received=now};
+    }
+    return RPCResponse(Statuses::S200_OK("heartbeat recorded"), dto::NodeHeartbeatResponse{});
+}
+
+seastar::future<> CPOService::_collectLoad() {
+    std::set<String> endpoints(_placementEndpoints().begin(), _placementEndpoints().end());
+    // collection name -> partition id -> partition, to resolve the partitions in the heartbeats
+    std::unordered_map<String, std::unordered_map<uint64_t, dto::Partition>> partitions;
+    for (auto& [name, collectionSchemas] : schemas) {
+        auto [status, collection] = _getCollection(name);
+        if (!status.is2xxOK()) {
+            continue;
+        }
+        for (auto& part : collection.partitionMap.partitions) {
+            if (!part.endpoints.empty()) {
+                endpoints.insert(*part.endpoints.begin());
+            }
+            partitions[name][part.pvid.id] = part;
+        }
+    }
+    auto loads = seastar::make_lw_shared<std::vector<CoreLoad>>();
+    auto now = Clock::now();
+    for (auto it = _heartbeats.begin(); it != _heartbeats.end();) {
+        auto& [ep, hb] = *it;
+        if (now - hb.received > _heartbeatExpiry()) {
+            it = _heartbeats.erase(it);
+            continue;
+        }
+        CoreLoad load{
+            .endpoint=ep,
+            .assigned=hb.core.assigned,
+            .collectionName=hb.core.collectionName,
+            .partition={},
+            .requestRate=hb.requestRate,
+            .p99LatencyUs=hb.core.p99LatencyUs,
+            .memoryBytes=hb.core.memoryBytes,
+            .reactorUtilization=hb.core.reactorUtilization,
+            .pendingRequests=hb.core.pendingRequests
+        };
+        if (load.assigned) {
+            auto cit = partitions.find(load.collectionName);
+            if (cit == partitions.end() || cit->second.count(hb.core.pvid.id) == 0) {
+                // the heartbeat predates a change of the partition map; poll the core
+                ++it;
+                continue;
+            }
+            load.partition = cit->second[hb.core.pvid.id];
+        }
+        endpoints.erase(ep);
+        loads->push_back(std::move(load));
+        ++it;
+    }
+    return seastar::do_with(std::vector<String>(endpoints.begin(), endpoints.end()), [this, loads] (auto& endpoints) {
+        return seastar::parallel_for_each(endpoints, [this, loads] (const String& ep) {
+            auto txep = RPC().getTXEndpoint(ep);
+            if (!txep) {
+                K2LOG_W(log::cposvr, "unable to obtain endpoint for {}", ep);
+                return seastar::make_ready_future();
+            }
+            dto::AssignmentLoadRequest request;
+            return RPC().callRPC<dto::AssignmentLoadRequest, dto::AssignmentLoadResponse>
+                (dto::K2_ASSIGNMENT_LOAD, request, *txep, 1s)
+            .then([this, loads, ep] (auto&& result) {
+                auto& [status, load] = result;
+                if (!status.is2xxOK()) {
+                    K2LOG_W(log::cposvr, "unable to get the load of {} due to {}", ep, status);
+                    return;
+                }
+                loads->push_back(CoreLoad{
+                    .endpoint=ep,
+                    .assigned=load.assigned,
+                    .collectionName=std::move(load.collectionName),
+                    .partition=std::move(load.partition),
+                    .requestRate=_requestRate(ep, load.requests),
+                    .p99LatencyUs=load.p99LatencyUs,
+                    .memoryBytes=load.memoryBytes
+                });
+            })
+            .handle_exception([ep] (auto exc) {
+                K2LOG_W_EXC(log::cposvr, exc, "unable to get the load of {}", ep);
+            });
+        });
+    })
+    .then([this, loads] {
+        // a core can be known under the endpoint of each of its transports
+        std::vector<CoreLoad> cores;
+        std::set<std::tuple<String, uint64_t>> partitions;
+        std::sort(loads->begin(), loads->end(), [] (const CoreLoad& a, const CoreLoad& b) {
+            return a.endpoint < b.endpoint;
+        });
+        for (auto& core : *loads) {
+            if (core.assigned && !partitions.emplace(core.collectionName, core.partition.pvid.id).second) {
+                continue;
+            }
+            cores.push_back(std::move(core));
+        }
+        _placement.update(std::move(cores));
+    });
+}
+
+seastar::future<> CPOService::_loadCheck() {
+    return _collectLoad()
+    .then([this] {
+        std::vector<String> names;
+        for (auto& [name, collectionSchemas] : schemas) {
+            names.push_back(name);
+        }
+        return seastar::do_with(std::move(names), _loadMoves, [this] (auto& names, auto& splitsBefore) {
+            return seastar::do_for_each(names, [this] (const String& name) {
+                return _splitCheckCollection(name);
+            })
+            .then([this, &splitsBefore] {
+                // the load collected by this pass does not show the effect of its splits yet
+                if (_loadMoves != splitsBefore) {
+                    return seastar::make_ready_future();
+                }
+                return _rebalance();
+            });
+        });
+    })
+    .handle_exception([] (auto exc) {
+        K2LOG_W_EXC(log::cposvr, exc, "failed to check the load of the cluster");
+    });
+}
+
+seastar::future<> CPOService::_splitCheckCollection(const String& name) {
+    auto [status, collection] = _getCollection(name);
+    if (!status.is2xxOK() || _splitsInProgress.count(name) > 0) {
+        return seastar::make_ready_future();
+    }
+    std::vector<dto::Partition> parts;
+    std::vector<seastar::future<std::tuple<Status, dto::K23SIPartitionLoadResponse>>> loads;
+    for (auto& part : collection.partitionMap.partitions) {
+        if (part.astate != dto::AssignmentState::Assigned || part.endpoints.empty()) {
+            continue;
+        }
+        auto txep = RPC().getTXEndpoint(*part.endpoints.begin());
+        if (!txep) {
+            continue;
+        }
+        dto::K23SIPartitionLoadRequest request{.collectionName=name, .pvid=part.pvid};
+        loads.push_back(RPC().callRPC<dto::K23SIPartitionLoadRequest, dto::K23SIPartitionLoadResponse>
+            (dto::Verbs::K23SI_PARTITION_LOAD, request, *txep, 1s));
+        parts.push_back(part);
+    }
+    return seastar::when_all_succeed(loads.begin(), loads.end())
+    .then([this, name, parts=std::move(parts)] (auto&& results) {
+        if (_maxReadFollowers() > 0) {
+            // a follower takes the snapshot reads off a read-hot partition without moving any of its keys
+            size_t readHot = results.size();
+            for (size_t i = 0; i < results.size(); ++i) {
+                auto& [status, load] = results[i];
+                if (!status.is2xxOK() || load.requestRate < _splitLoadThreshold() ||
+                    load.snapshotReadRate < _readFollowerFraction() * load.requestRate ||
+                    parts[i].followers.size() >= _maxReadFollowers()) {
+                    continue;
+                }
+                if (readHot == results.size() || load.requestRate > std::get<1>(results[readHot]).requestRate) {
+                    readHot = i;
+                }
+            }
+            if (readHot != results.size()) {
+                auto& load = std::get<1>(results[readHot]);
+                K2LOG_I(log::cposvr, "adding a read follower to partition {} of collection {} with {} requests/s, {} snapshot reads/s",
+                        parts[readHot], name, load.requestRate, load.snapshotReadRate);
+                return _addReadFollower(name, parts[readHot]);
+            }
+        }
+        size_t busiest = results.size();
+        for (size_t i = 0; i < results.size(); ++i) {
+            auto& [status, load] = results[i];
+            if (!status.is2xxOK() || load.splitKey.empty() || load.requestRate < _splitLoadThreshold()) {
+                continue;
+            }
+            if (busiest == results.size() || load.requestRate > std::get<1>(results[busiest]).requestRate) {
+                busiest = i;
+            }
+        }
+        if (busiest == results.size()) {
+            return seastar::make_ready_future();
+        }
+        auto& load = std::get<1>(results[busiest]);
+        K2LOG_I(log::cposvr, "splitting partition {} of collection {} with {} requests/s at {}",
+                parts[busiest], name, load.requestRate, load.splitKey);
+        return _splitOnto(name, parts[busiest], load.splitKey);
+    })
+    .handle_exception([name] (auto exc) {
+        K2LOG_W_EXC(log::cposvr, exc, "unable to check the load of collection {}", name);
+    });
+}
+
+seastar::future<> CPOService::_rebalance() {
+    if (_nodeLoadSkew() <= 0) {
+        return seastar::make_ready_future();
+    }
+    auto node = _placement.overloadedNode(_nodeLoadSkew());
+    if (!node) {
+        return seastar::make_ready_future();
+    }
+    auto targets = _placement.place(1);
+    if (targets.empty() || PlacementEngine::nodeOf(targets[0]) == *node) {
+        K2LOG_W(log::cposvr, "node {} is overloaded, but there is no free core on another node", *node);
+        return seastar::make_ready_future();
+    }
+    // move the busiest partition which still matches the partition map
+    for (auto& core : _placement.assignedCores(*node)) {
+        if (_splitsInProgress.count(core.collectionName) > 0) {
+            continue;
+        }
+        auto [status, collection] = _getCollection(core.collectionName);
+        if (!status.is2xxOK()) {
+            continue;
+        }
+        auto it = std::find_if(collection.partitionMap.partitions.begin(), collection.partitionMap.partitions.end(),
+            [&core] (const dto::Partition& part) { return part.pvid == core.partition.pvid; });
+        if (it == collection.partitionMap.partitions.end() || it->astate != dto::AssignmentState::Assigned) {
+            continue;
+        }
+        K2LOG_I(log::cposvr, "node {} is overloaded, moving partition {} of collection {} with {} requests/s to {}",
+                *node, *it, core.collectionName, core.requestRate, targets[0]);
+        // if the migration is refused, the next load collection shows the core as free again
+        _placement.markAssigned(targets[0]);
+        ++_loadMoves;
+        dto::PartitionMigrateRequest request{.collectionName=core.collectionName, .pvid=it->pvid, .targetEndpoint=targets[0]};
+        return handleMigrate(std::move(request)).discard_result();
+    }
+    return seastar::make_ready_future();
+}
+
+seastar::future<> CPOService::_splitOnto(const String& name, const dto::Partition& part, const String& splitKey) {
+    auto targets = _placement.place(1);
+    if (targets.empty()) {
+        K2LOG_W(log::cposvr, "no free core to split partition {} of collection {} onto", part, name);
+        return seastar::make_ready_future();
+    }
+    // if the split is refused, the next load collection shows the core as free again
+    _placement.markAssigned(targets[0]);
+    ++_loadMoves;
+    dto::PartitionSplitRequest request{.collectionName=name, .pvid=part.pvid, .splitKey=splitKey,
+                                       .targetEndpoint=targets[0]};
+    return handleSplit(std::move(request)).discard_result();
+}
+
+seastar::future<> CPOService::_addReadFollower(const String& name, const dto::Partition& part) {
+    auto target = _placement.freeCoreOn(PlacementEngine::nodeOf(*part.endpoints.begin()));
+    if (!target) {
+        auto targets = _placement.place(1);
+        if (targets.empty()) {
+            K2LOG_W(log::cposvr, "no free core for a read follower of partition {} of collection {}", part, name);
+            return seastar::make_ready_future();
+        }
+        target = targets[0];
+    }
+    // if the follower is refused, the next load collection shows the core as free again
+    _placement.markAssigned(*target);
+    ++_loadMoves;
+    dto::PartitionAddFollowerRequest request{.collectionName=name, .pvid=part.pvid, .endpoint=*target};
+    return handleAddFollower(std::move(request)).discard_result();
+}
+
 String CPOService::_getCollectionPath(String name) {
     return _dataDir() + "/" + name + ".collection";
 }
@@ -26,13 +26,19 @@ Copyright(c) 2020 Futurewei Cloud
 // third-party
 #include <seastar/core/distributed.hh>
 #include <seastar/core/future.hh>  // for future stuff
+#include <seastar/core/gate.hh>
+
+#include <unordered_set>
 
 #include <k2/appbase/AppEssentials.h>
+#include <k2/common/Timer.h>
 #include <k2/dto/ControlPlaneOracle.h>
 #include <k2/dto/AssignmentManager.h>
 #include <k2/dto/PersistenceCluster.h>
 #include <k2/transport/Status.h>
 
+#include "PlacementEngine.h"
+
 namespace k2 {
 namespace log {
 inline thread_local k2::logging::Logger cposvr("k2::cpo_service");
@@ -56,6 +62,82 @@ private:
     seastar::future<Status> _pushSchema(const dto::Collection& collection, const dto::Schema& schema);
     void _handleCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request);
 
+    // Pushes a change of the partition map of a collection to its subscribers, in the background.
+    // Subscribers which can't be reached are dropped; they subscribe again when they fetch the collection
+    void _publishChange(const String& name, uint64_t baseVersion, uint64_t version, std::vector<dto::Partition> partitions);
+    ConfigDuration _changeNotifyTimeout{"change_notify_timeout", 100ms};
+    // collection name -> endpoints of the clients which get its partition map changes pushed
+    std::unordered_map<String, std::unordered_set<String>> _subscribers;
+    seastar::gate _notifyGate;
+
+    // Moves the keys of source at and past the start of right into right, which is assigned to its endpoint
+    // first. The source continues as left. Returns the status of the split; the partition map is not updated
+    seastar::future<Status> _split(dto::Collection collection, dto::Partition source, dto::Partition left, dto::Partition right);
+
+    // Assigns moved, the source partition with a bumped assignmentVersion, to its endpoint and has the source
+    // migrate into it. Updates moved to the assigned partition; the partition map is not updated
+    seastar::future<Status> _migrate(dto::Collection collection, dto::Partition source, dto::Partition& moved);
+
+    // Assigns a follower of the partition to endpoint, replaying the WAL from the persistence endpoint of the
+    // partition. Sets follower to the endpoint the follower serves at; the partition map is not updated
+    seastar::future<Status> _addFollower(dto::Collection collection, dto::Partition source, String endpoint, String& follower);
+
+    // Collects the load of all known cores for the placement engine. The cores are the placement endpoints, the
+    // endpoints of the partitions of all collections and the cores which send heartbeats. Only cores without a
+    // fresh heartbeat are polled
+    seastar::future<> _collectLoad();
+    // the requests per second of the core since its previous load report
+    double _requestRate(const String& endpoint, uint64_t requests);
+
+    struct _Heartbeat {
+        dto::CoreHeartbeat core;
+        double requestRate = 0;
+        TimePoint received;
+    };
+    // endpoint -> the last heartbeat of the core. _collectLoad does not poll cores with a fresh heartbeat
+    std::unordered_map<String, _Heartbeat> _heartbeats;
+    // heartbeats older than this are ignored and the core is polled instead
+    ConfigDuration _heartbeatExpiry{"node_heartbeat_expiry", 3s};
+
+    // Collects the load and splits the busiest partition of each collection above the load
+    // threshold, or adds a follower to it if it is read-hot. If no split was started and a node is overloaded, its
+    // busiest partition is migrated onto the least loaded node
+    seastar::future<> _loadCheck();
+    seastar::future<> _splitCheckCollection(const String& name);
+    seastar::future<> _rebalance();
+    // splits the given partition at the split key onto a free core chosen by the placement engine
+    seastar::future<> _splitOnto(const String& name, const dto::Partition& part, const String& splitKey);
+    // adds a follower of the given partition for its snapshot reads, on a free core of its own node if there is
+    // one, so that a read-hot partition uses more than its core
+    seastar::future<> _addReadFollower(const String& name, const dto::Partition& part);
+    // creates a collection on free cores chosen by the placement engine
+    seastar::future<std::tuple<Status, dto::CollectionCreateResponse>>
+    _placeCollection(dto::CollectionCreateRequest&& request);
+
+    ConfigDuration _splitTimeout{"split_timeout", 30s};
+    ConfigDuration _migrationTimeout{"migration_timeout", 60s};
+    // how often to check the load of the cores. 0 disables load driven splits and rebalancing
+    ConfigDuration _loadCheckInterval{"load_check_interval", 0s};
+    // partitions with more requests per second than this are split
+    ConfigVar<double> _splitLoadThreshold{"split_load_threshold", 10000.0};
+    // partitions above split_load_threshold with at least this fraction of snapshot reads get a read follower
+    // instead of being split
+    ConfigVar<double> _readFollowerFraction{"read_follower_fraction", 0.8};
+    // the most followers a partition gets for its read load. 0 disables load driven followers
+    ConfigVar<uint32_t> _maxReadFollowers{"max_read_followers", 0};
+    // nodes with more than this many times the mean request rate of the nodes are rebalanced. 0 disables it
+    ConfigVar<double> _nodeLoadSkew{"node_load_skew", 1.5};
+    // the endpoints of the cores the CPO can place partitions on
+    ConfigVar<std::vector<String>> _placementEndpoints{"placement_endpoints"};
+    PeriodicTimer _loadCheckTimer;
+    PlacementEngine _placement;
+    // endpoint -> the request count of the core and when it was reported
+    std::unordered_map<String, std::tuple<uint64_t, TimePoint>> _requestCounts;
+    // the number of load driven splits and migrations started, to rebalance only in passes without one
+    uint64_t _loadMoves = 0;
+    // collections with a split or migration in progress
+    std::unordered_set<String> _splitsInProgress;
+
     // Collection name -> schemas
     std::unordered_map<String, std::vector<dto::Schema>> schemas;
 
@@ -84,6 +166,23 @@ private:
 
     seastar::future<std::tuple<Status, dto::GetSchemasResponse>>
     handleSchemasGet(dto::GetSchemasRequest&& request);
+
+    // Splits a partition, at a key or for hash partitions at a hash value. Only one partition of a collection is split at a time
+    seastar::future<std::tuple<Status, dto::PartitionSplitResponse>>
+    handleSplit(dto::PartitionSplitRequest&& request);
+
+    // Moves a partition to another core. Only one partition of a collection is split or migrated at a time
+    seastar::future<std::tuple<Status, dto::PartitionMigrateResponse>>
+    handleMigrate(dto::PartitionMigrateRequest&& request);
+
+    // Adds a read-only follower of a partition on another core. Followers are dropped when the partition is
+    // split or migrated
+    seastar::future<std::tuple<Status, dto::PartitionAddFollowerResponse>>
+    handleAddFollower(dto::PartitionAddFollowerRequest&& request);
+
+    // Records the health and load of the cores of a k2 node
+    seastar::future<std::tuple<Status, dto::NodeHeartbeatResponse>>
+    handleNodeHeartbeat(dto::NodeHeartbeatRequest&& request);
 };  // class CPOService
 
 } // namespace k2
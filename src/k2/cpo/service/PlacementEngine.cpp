@@ -0,0 +1,180 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "PlacementEngine.h"
+
+#include <algorithm>
+#include <map>
+#include <string_view>
+
+namespace k2 {
+
+void PlacementEngine::update(std::vector<CoreLoad> cores) {
+    _cores = std::move(cores);
+}
+
+void PlacementEngine::markAssigned(const String& endpoint) {
+    for (auto& core : _cores) {
+        if (core.endpoint == endpoint) {
+            core.assigned = true;
+        }
+    }
+}
+
+String PlacementEngine::nodeOf(const String& endpoint) {
+    std::string_view ep(endpoint.data(), endpoint.size());
+    auto proto = ep.find("://");
+    if (proto != std::string_view::npos) {
+        ep.remove_prefix(proto + 3);
+    }
+    auto port = ep.rfind(':');
+    if (port != std::string_view::npos) {
+        ep = ep.substr(0, port);
+    }
+    return String(ep.data(), ep.size());
+}
+
+std::vector<PlacementEngine::_NodeLoad> PlacementEngine::_nodeLoads() const {
+    std::map<String, _NodeLoad> nodes;
+    for (auto& core : _cores) {
+        auto node = nodeOf(core.endpoint);
+        auto& load = nodes[node];
+        load.node = node;
+        load.memoryBytes += core.memoryBytes;
+        if (core.assigned) {
+            load.requestRate += core.requestRate;
+            load.p99LatencyUs = std::max(load.p99LatencyUs, double(core.p99LatencyUs));
+        }
+        else {
+            load.freeCores.push_back(core.endpoint);
+        }
+    }
+    std::vector<_NodeLoad> result;
+    for (auto& [node, load] : nodes) {
+        result.push_back(std::move(load));
+    }
+    return result;
+}
+
+std::vector<String> PlacementEngine::place(size_t count) const {
+    auto nodes = _nodeLoads();
+
+    // the expected load of a new partition
+    double partitionRate = 0;
+    double partitionMemory = 0;
+    size_t assigned = 0;
+    for (auto& core : _cores) {
+        if (core.assigned) {
+            partitionRate += core.requestRate;
+            partitionMemory += core.memoryBytes;
+            ++assigned;
+        }
+    }
+    if (assigned > 0) {
+        partitionRate /= assigned;
+        partitionMemory /= assigned;
+    }
+
+    std::vector<String> result;
+    while (result.size() < count) {
+        double maxRate = 0, maxMemory = 0, maxLatency = 0;
+        for (auto& node : nodes) {
+            maxRate = std::max(maxRate, node.requestRate);
+            maxMemory = std::max(maxMemory, node.memoryBytes);
+            maxLatency = std::max(maxLatency, node.p99LatencyUs);
+        }
+        auto score = [&] (const _NodeLoad& node) {
+            return (maxRate > 0 ? node.requestRate / maxRate : 0) +
+                   (maxMemory > 0 ? node.memoryBytes / maxMemory : 0) +
+                   (maxLatency > 0 ? node.p99LatencyUs / maxLatency : 0);
+        };
+
+        _NodeLoad* best = nullptr;
+        double bestScore = 0;
+        for (auto& node : nodes) {
+            if (node.freeCores.empty()) {
+                continue;
+            }
+            auto nodeScore = score(node);
+            // on a tie, spread over the nodes with the most free cores
+            if (!best || nodeScore < bestScore ||
+                (nodeScore == bestScore && node.freeCores.size() > best->freeCores.size())) {
+                best = &node;
+                bestScore = nodeScore;
+            }
+        }
+        if (!best) {
+            break;
+        }
+        result.push_back(best->freeCores.front());
+        best->freeCores.erase(best->freeCores.begin());
+        best->requestRate += partitionRate;
+        best->memoryBytes += partitionMemory;
+    }
+    return result;
+}
+
+std::optional<String> PlacementEngine::overloadedNode(double skew) const {
+    auto nodes = _nodeLoads();
+    if (nodes.size() < 2) {
+        return std::nullopt;
+    }
+    double total = 0;
+    const _NodeLoad* busiest = nullptr;
+    for (auto& node : nodes) {
+        total += node.requestRate;
+        if (!busiest || node.requestRate > busiest->requestRate) {
+            busiest = &node;
+        }
+    }
+    double mean = total / nodes.size();
+    if (mean <= 0 || busiest->requestRate <= skew * mean) {
+        return std::nullopt;
+    }
+    return busiest->node;
+}
+
+std::optional<String> PlacementEngine::freeCoreOn(const String& node) const {
+    for (auto& core : _cores) {
+        if (!core.assigned && nodeOf(core.endpoint) == node) {
+            return core.endpoint;
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<CoreLoad> PlacementEngine::assignedCores(const String& node) const {
+    std::vector<CoreLoad> result;
+    for (auto& core : _cores) {
+        if (core.assigned && nodeOf(core.endpoint) == node) {
+            result.push_back(core);
+        }
+    }
+    std::sort(result.begin(), result.end(), [] (const CoreLoad& a, const CoreLoad& b) {
+        return a.requestRate > b.requestRate;
+    });
+    return result;
+}
+
+} // namespace k2
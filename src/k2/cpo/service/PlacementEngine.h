@@ -0,0 +1,92 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <k2/common/Common.h>
+#include <k2/dto/Collection.h>
+
+namespace k2 {
+
+// The load of a k2 core, as last reported to the CPO
+struct CoreLoad {
+    String endpoint;
+    // set if a partition is assigned to the core
+    bool assigned = false;
+    String collectionName;
+    dto::Partition partition;
+    // requests per second since the previous report
+    double requestRate = 0;
+    uint64_t p99LatencyUs = 0;
+    uint64_t memoryBytes = 0;
+    // only known for cores which send heartbeats
+    double reactorUtilization = 0;
+    uint64_t pendingRequests = 0;
+};
+
+// Decides which cores new partitions are assigned to, so that the load of the k2 nodes stays balanced.
+// Cores are grouped into nodes by the host of their endpoint. A node is scored by its request rate, memory and
+// p99 latency (that of its slowest core), each relative to the highest one in the cluster
+class PlacementEngine {
+public:
+    // replaces the known cores and their load
+    void update(std::vector<CoreLoad> cores);
+
+    // marks the core with the given endpoint as assigned, e.g. after a partition was placed on it
+    void markAssigned(const String& endpoint);
+
+    // Picks free cores for up to count new partitions, each from the node with the lowest score.
+    // Every placed partition is expected to add the mean load of the assigned cores to its node
+    std::vector<String> place(size_t count) const;
+
+    // The node with the highest request rate, if that is more than skew times the mean request rate of the nodes
+    std::optional<String> overloadedNode(double skew) const;
+
+    // a free core of the given node, if it has one
+    std::optional<String> freeCoreOn(const String& node) const;
+
+    // the assigned cores of the given node, busiest first
+    std::vector<CoreLoad> assignedCores(const String& node) const;
+
+    // the node of a core endpoint, e.g. "tcp+k2rpc://10.0.0.1:10000" -> "10.0.0.1"
+    static String nodeOf(const String& endpoint);
+
+private:
+    struct _NodeLoad {
+        String node;
+        double requestRate = 0;
+        double memoryBytes = 0;
+        double p99LatencyUs = 0;
+        std::vector<String> freeCores;
+    };
+    // the load of each node, in node order
+    std::vector<_NodeLoad> _nodeLoads() const;
+
+    std::vector<CoreLoad> _cores;
+};
+
+} // namespace k2
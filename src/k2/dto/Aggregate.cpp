@@ -0,0 +1,156 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "Aggregate.h"
+
+namespace k2 {
+namespace dto {
+
+// The types which SUM accumulates in. Integer fields are widened to int64_t and floating point fields to double
+template <typename T>
+constexpr bool _isSumType = std::is_same_v<T, int64_t> || std::is_same_v<T, double> ||
+                            std::is_same_v<T, std::decimal::decimal64> || std::is_same_v<T, std::decimal::decimal128>;
+
+Aggregator::Aggregator(const Aggregate& aggregate) : _op(aggregate.op), _fieldName(aggregate.fieldName) {
+    if (_op != AggregateOp::COUNT && _fieldName.empty()) {
+        throw InvalidExpressionException();
+    }
+}
+
+int32_t Aggregator::_getFieldIndex(const std::shared_ptr<Schema>& schema) {
+    if (schema != _schema) {
+        _schema = schema;
+        _fieldIndex = schema->fieldIndex(_fieldName);
+    }
+    return _fieldIndex;
+}
+
+void Aggregator::add(SKVRecord& rec) {
+    if (_fieldName.empty()) {
+        _count++;
+        return;
+    }
+
+    int32_t fieldIndex = _getFieldIndex(rec.schema);
+    if (fieldIndex < 0) {
+        return;
+    }
+    const SchemaField& field = rec.schema->fields[fieldIndex];
+    K2_DTO_CAST_APPLY_FIELD_VALUE(_addField, field, rec, fieldIndex);
+}
+
+template <typename T>
+void Aggregator::_addField(const SchemaField&, SKVRecord& rec, uint32_t fieldIndex) {
+    std::optional<T> value = rec.deserializeField<T>(fieldIndex);
+    if (!value) {
+        return;
+    }
+
+    if (_op == AggregateOp::COUNT) {
+        _count++;
+    }
+    else if (_op != AggregateOp::SUM) {
+        _fold(std::move(*value));
+    }
+    else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+        _fold(int64_t(*value));
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+        _fold(double(*value));
+    }
+    else {
+        _fold(std::move(*value));
+    }
+}
+
+void Aggregator::merge(const expression::Value& partial) {
+    if (partial.type == FieldType::NULL_T) {
+        return;
+    }
+    Payload literal = const_cast<Payload&>(partial.literal).shareAll();
+    K2_DTO_CAST_APPLY_FIELD_VALUE(_mergeValue, partial, literal);
+}
+
+template <typename T>
+void Aggregator::_mergeValue(const expression::Value&, Payload& literal) {
+    T value{};
+    if (!literal.read(value)) {
+        throw DeserializationError("Deserialization of partial aggregate failed");
+    }
+
+    if (_op != AggregateOp::COUNT) {
+        _fold(std::move(value));
+    }
+    else if constexpr (std::is_same_v<T, int64_t>) {
+        _count += value;
+    }
+    else {
+        throw TypeMismatchException(fmt::format("partial COUNT must be INT64T, got {}", TToFieldType<T>()));
+    }
+}
+
+template <typename T>
+void Aggregator::_fold(T&& value) {
+    using VT = std::decay_t<T>;
+    if (_op == AggregateOp::SUM && !_isSumType<VT>) {
+        throw TypeMismatchException(fmt::format("cannot SUM field {} of type {}", _fieldName, TToFieldType<VT>()));
+    }
+    if (std::holds_alternative<std::monostate>(_value)) {
+        _value = std::forward<T>(value);
+        return;
+    }
+    VT* current = std::get_if<VT>(&_value);
+    if (current == nullptr) {
+        throw TypeMismatchException(fmt::format("aggregate of field {} over different types", _fieldName));
+    }
+
+    if (_op == AggregateOp::SUM) {
+        if constexpr (_isSumType<VT>) {
+            *current += value;
+        }
+    }
+    else if (_op == AggregateOp::MIN ? value < *current : *current < value) {
+        *current = std::forward<T>(value);
+    }
+}
+
+expression::Value Aggregator::result() const {
+    if (_op == AggregateOp::COUNT) {
+        return expression::makeValueLiteral<int64_t>(int64_t(_count));
+    }
+
+    return std::visit([] (const auto& value) {
+        using VT = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<VT, std::monostate>) {
+            expression::Value result{};
+            result.type = FieldType::NULL_T;
+            return result;
+        }
+        else {
+            return expression::makeValueLiteral<VT>(VT(value));
+        }
+    }, _value);
+}
+
+} // ns dto
+} // ns k2
@@ -0,0 +1,97 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <variant>
+#include <vector>
+
+#include <k2/common/Common.h>
+#include <k2/transport/PayloadSerialization.h>
+#include "Expression.h"
+#include "FieldTypes.h"
+#include "SKVRecord.h"
+
+namespace k2 {
+namespace dto {
+
+K2_DEF_ENUM(AggregateOp,
+    COUNT,  /* number of records. With a field name, only the records where the field is not null are counted */
+    SUM,    /* sum of a numeric field. Integer fields are summed as INT64T, FLOAT and DOUBLE as DOUBLE */
+    MIN,    /* smallest value of a field, in the field's type */
+    MAX     /* largest value of a field, in the field's type */
+);
+
+// An aggregate computed by a query over the records which pass its filter, instead of returning the records
+struct Aggregate {
+    AggregateOp op = AggregateOp::COUNT;
+    String fieldName; // may be empty for COUNT, which then counts all records
+
+    K2_PAYLOAD_FIELDS(op, fieldName);
+    K2_DEF_FMT(Aggregate, op, fieldName);
+};
+
+// Computes an Aggregate, either from records (on the server) or by merging the partial results computed by
+// different partitions or pages of a query (on the client). Results are expression::Value literals so that
+// they can be sent as part of a query response. Null fields, and fields which don't exist in the schema
+// version of a record, are skipped. The result is NULL_T for SUM, MIN and MAX until a value is seen.
+// The methods throw TypeMismatchException if the aggregate cannot be applied to the type of the field
+// (e.g. SUM of a STRING), or if different records have different types for the field
+class Aggregator {
+public:
+    Aggregator(const Aggregate& aggregate);
+
+    // Adds the aggregated field of the given record
+    void add(SKVRecord& rec);
+
+    // Adds a result computed by another Aggregator for the same Aggregate
+    void merge(const expression::Value& partial);
+
+    expression::Value result() const;
+
+private:
+    // the index of the aggregated field in the given schema, or -1 if the schema doesn't have the field
+    int32_t _getFieldIndex(const std::shared_ptr<Schema>& schema);
+
+    template <typename T>
+    void _addField(const SchemaField& field, SKVRecord& rec, uint32_t fieldIndex);
+
+    template <typename T>
+    void _mergeValue(const expression::Value& partial);
+
+    template <typename T>
+    void _fold(T&& value);
+
+    AggregateOp _op;
+    String _fieldName;
+    int64_t _count = 0;
+    std::variant<std::monostate, String, int16_t, int32_t, int64_t, float, double, bool,
+                 std::decimal::decimal64, std::decimal::decimal128, FieldType> _value;
+
+    // the field index for the last schema we've seen. Queries rarely see more than one schema version
+    std::shared_ptr<Schema> _schema;
+    int32_t _fieldIndex = -1;
+};
+
+} // ns dto
+} // ns k2
@@ -33,7 +33,13 @@ namespace dto {
 struct AssignmentCreateRequest {
     CollectionMetadata collectionMeta;
     Partition partition;
-    K2_PAYLOAD_FIELDS(collectionMeta, partition);
+    // set if the partition is migrated here from another core. It then takes its state from the migration
+    // instead of recovering it from persistence
+    bool migrationTarget = false;
+    // set to assign a read-only follower of the partition instead. The follower replays the WAL of the partition
+    // from this persistence endpoint and serves snapshot reads only
+    String followPersistence;
+    K2_PAYLOAD_FIELDS(collectionMeta, partition, migrationTarget, followPersistence);
 };
 
 // Response to AssignmentCreateRequest
@@ -53,5 +59,27 @@ struct AssignmentOffloadResponse {
     K2_PAYLOAD_EMPTY;
 };
 
+// Request for the load of the K2 core which receives it. Used by the CPO to place partitions
+struct AssignmentLoadRequest {
+    K2_PAYLOAD_EMPTY;
+};
+
+// Response to AssignmentLoadRequest
+struct AssignmentLoadResponse {
+    // whether a partition is assigned to the core, and if so which one
+    bool assigned = false;
+    String collectionName;
+    Partition partition;
+    // total reads, writes and queries served by the partition
+    uint64_t requests = 0;
+    // 99th percentile latency of the recent requests of the partition, in microseconds
+    uint64_t p99LatencyUs = 0;
+    // memory allocated on the core
+    uint64_t memoryBytes = 0;
+    // how many partitions the core hosts. The fields above are for the busiest of them
+    uint32_t partitions = 0;
+    K2_PAYLOAD_FIELDS(assigned, collectionName, partition, requests, p99LatencyUs, memoryBytes, partitions);
+};
+
 }  // namespace dto
 }  // namespace k2
@@ -22,9 +22,11 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include <algorithm>
+#include <random>
 #include <string>
 
 #include <crc32c/crc32c.h>
+#include <k2/common/ByteCompare.h>
 #include <k2/transport/RPCDispatcher.h>
 #include <k2/transport/Discovery.h>
 
@@ -33,15 +35,15 @@ Copyright(c) 2020 Futurewei Cloud
 namespace k2::dto {
 
 int Key::compare(const Key& o) const noexcept {
-    auto scomp = schemaName.compare(o.schemaName);
+    auto scomp = compareBytes(schemaName, o.schemaName);
     if (scomp != 0) {
         return scomp;
     }
 
-    auto pkcomp = partitionKey.compare(o.partitionKey);
+    auto pkcomp = compareBytes(partitionKey, o.partitionKey);
     if (pkcomp == 0) {
         // if the partition keys are equal, return the comparison of the range keys
-        return rangeKey.compare(o.rangeKey);
+        return compareBytes(rangeKey, o.rangeKey);
     }
     return pkcomp;
 }
@@ -86,7 +88,14 @@ bool Partition::PVID::operator!=(const Partition::PVID& o) const {
 PartitionGetter::PartitionWithEndpoint PartitionGetter::GetPartitionWithEndpoint(Partition* p) {
     PartitionWithEndpoint partition{};
     partition.partition = p;
-    partition.preferredEndpoint = Discovery::selectBestEndpoint(p->endpoints);
+    partition.preferredEndpoint = Discovery::selectBestSharedEndpoint(p->endpoints);
+    if (!p->followers.empty()) {
+        // spread the clients over the followers
+        thread_local std::mt19937 gen{std::random_device{}()};
+        auto it = p->followers.begin();
+        std::advance(it, std::uniform_int_distribution<size_t>(0, p->followers.size() - 1)(gen));
+        partition.followerEndpoint = RPC().getSharedTXEndpoint(*it);
+    }
 
     return partition;
 }
@@ -105,6 +114,12 @@ PartitionGetter::PartitionGetter(Collection&& col) : collection(std::move(col))
         }
 
         std::sort(_rangePartitionMap.begin(), _rangePartitionMap.end());
+        std::vector<uint64_t> prefixes;
+        prefixes.reserve(_rangePartitionMap.size());
+        for (auto& e : _rangePartitionMap) {
+            prefixes.push_back(orderedPrefix64(e.key.get()));
+        }
+        _rangePrefixIndex = EytzingerIndex(prefixes);
     }
 
     if (collection.metadata.hashScheme == HashScheme::HashCRC32C) {
@@ -118,7 +133,102 @@ PartitionGetter::PartitionGetter(Collection&& col) : collection(std::move(col))
         }
 
         std::sort(_hashPartitionMap.begin(), _hashPartitionMap.end());
+        std::vector<uint64_t> hvalues;
+        hvalues.reserve(_hashPartitionMap.size());
+        for (auto& e : _hashPartitionMap) {
+            hvalues.push_back(e.hvalue);
+        }
+        _hashIndex = EytzingerIndex(hvalues);
+    }
+}
+
+std::vector<PartitionGetter::RangeMapElement>::iterator PartitionGetter::_rangeBound(const String& key, bool upper) {
+    // start keys with a smaller prefix are smaller than the key and those with a larger one are larger,
+    // so only the ones with an equal prefix need the full compare
+    uint64_t prefix = orderedPrefix64(key);
+    auto lo = _rangePartitionMap.begin() + _rangePrefixIndex.lowerBound(prefix);
+    auto hi = _rangePartitionMap.begin() + _rangePrefixIndex.upperBound(prefix);
+    if (lo == hi) {
+        return lo;
+    }
+    RangeMapElement to_find(key, PartitionGetter::PartitionWithEndpoint());
+    return upper ? std::upper_bound(lo, hi, to_find) : std::lower_bound(lo, hi, to_find);
+}
+
+PartitionGetter::PartitionWithEndpoint* PartitionGetter::_findElement(const Partition& part) {
+    switch (collection.metadata.hashScheme) {
+        case HashScheme::Range: {
+            auto it = _rangeBound(part.startKey, false);
+            if (it != _rangePartitionMap.end() && it->key.get() == part.startKey) {
+                return &it->partition;
+            }
+            return nullptr;
+        }
+        case HashScheme::HashCRC32C: {
+            uint64_t hvalue = std::stoull(part.endKey);
+            size_t pos = _hashIndex.lowerBound(hvalue);
+            if (pos < _hashPartitionMap.size() && _hashPartitionMap[pos].hvalue == hvalue) {
+                return &_hashPartitionMap[pos].partition;
+            }
+            return nullptr;
+        }
+        default:
+            return nullptr;
+    }
+}
+
+std::vector<seastar::lw_shared_ptr<TXEndpoint>> PartitionGetter::endpoints() const {
+    std::vector<seastar::lw_shared_ptr<TXEndpoint>> result;
+    auto add = [&result] (const PartitionWithEndpoint& part) {
+        if (part.preferredEndpoint) {
+            result.push_back(part.preferredEndpoint);
+        }
+        if (part.followerEndpoint) {
+            result.push_back(part.followerEndpoint);
+        }
+    };
+    for (auto& e : _rangePartitionMap) {
+        add(e.partition);
+    }
+    for (auto& e : _hashPartitionMap) {
+        add(e.partition);
     }
+    return result;
+}
+
+bool PartitionGetter::applyChange(uint64_t baseVersion, uint64_t version, std::vector<Partition>&& partitions) {
+    if (collection.partitionMap.version != baseVersion) {
+        return false;
+    }
+    auto& parts = collection.partitionMap.partitions;
+    bool rebuild = false;
+    for (auto& changed : partitions) {
+        if (!rebuild) {
+            // a partition which keeps its key range only needs its element pointed at the new assignment
+            PartitionWithEndpoint* elem = _findElement(changed);
+            if (elem && elem->partition && elem->partition->pvid.id == changed.pvid.id &&
+                elem->partition->endKey == changed.endKey && elem->partition->startKey == changed.startKey) {
+                *elem->partition = std::move(changed);
+                *elem = GetPartitionWithEndpoint(elem->partition);
+                continue;
+            }
+        }
+        rebuild = true;
+        auto it = std::find_if(parts.begin(), parts.end(), [&changed] (const Partition& part) {
+            return part.pvid.id == changed.pvid.id;
+        });
+        if (it != parts.end()) {
+            *it = std::move(changed);
+        } else {
+            parts.push_back(std::move(changed));
+        }
+    }
+    collection.partitionMap.version = version;
+    if (rebuild) {
+        Collection updated = std::move(collection);
+        *this = PartitionGetter(std::move(updated));
+    }
+    return true;
 }
 
 PartitionGetter::PartitionWithEndpoint& PartitionGetter::getPartitionForKey(const Key& key, bool reverse, bool exclusiveKey) {
@@ -128,8 +238,6 @@ PartitionGetter::PartitionWithEndpoint& PartitionGetter::getPartitionForKey(cons
     switch (collection.metadata.hashScheme) {
         case HashScheme::Range:
         {
-            RangeMapElement to_find(key.partitionKey, PartitionGetter::PartitionWithEndpoint());
-
             // case 1: if get partiton in the reverse direction, and the key is empty: return the last partition;
             //         empty key in the forward direction can be well treated by upper_bound (case 3).
             // case 2: if exclusiveKey is true, use lower_bound to get partition;
@@ -141,7 +249,7 @@ PartitionGetter::PartitionWithEndpoint& PartitionGetter::getPartitionForKey(cons
             } else if (exclusiveKey) {
                 // if the 'exclusiveKey' is true (start keys are exclusive), lower_bound gives the start key,
                 // so we return the partition before the one that obtained by lower_bound.
-                it = std::lower_bound(_rangePartitionMap.begin(), _rangePartitionMap.end(), to_find);
+                it = _rangeBound(key.partitionKey, false);
                 if (it == _rangePartitionMap.begin()) {
                     throw std::runtime_error("forward direction with empry_key and true_exclusiveKey is not allowed!");
                 }
@@ -149,7 +257,7 @@ PartitionGetter::PartitionWithEndpoint& PartitionGetter::getPartitionForKey(cons
                 // We are comparing against the start keys and upper_bound gives the first start key
                 // greater than the key (start keys are inclusive), so we return the partition before
                 // the one obtained by upper_bound
-                it = std::upper_bound(_rangePartitionMap.begin(), _rangePartitionMap.end(), to_find);
+                it = _rangeBound(key.partitionKey, true);
                 K2ASSERT(log::dto, it != _rangePartitionMap.begin(), "Partition map does not begin with an empty string start key!");
             }
 
@@ -161,8 +269,7 @@ PartitionGetter::PartitionWithEndpoint& PartitionGetter::getPartitionForKey(cons
         }
         case HashScheme::HashCRC32C:
         {
-            HashMapElement to_find{.hvalue = key.partitionHash(), .partition = PartitionGetter::PartitionWithEndpoint()};
-            auto it = std::upper_bound(_hashPartitionMap.begin(), _hashPartitionMap.end(), to_find);
+            auto it = _hashPartitionMap.begin() + _hashIndex.upperBound(key.partitionHash());
             if (it != _hashPartitionMap.end()) {
                 return it->partition;
             }
@@ -209,4 +316,27 @@ bool OwnerPartition::owns(const Key& key, const bool reverse) const {
     }
 }
 
+bool OwnerPartition::canSplitAt(const String& splitKey) const {
+    switch (_scheme) {
+        case HashScheme::Range:
+            return splitKey.compare(_partition.startKey) > 0 &&
+                   (_partition.endKey == "" || splitKey.compare(_partition.endKey) < 0);
+        case HashScheme::HashCRC32C: {
+            uint64_t hvalue = 0;
+            try {
+                hvalue = std::stoull(splitKey);
+            } catch (std::exception&) {
+                return false;
+            }
+            return String(std::to_string(hvalue)) == splitKey && _hstart < hvalue && hvalue < _hend;
+        }
+        default:
+            return false;
+    }
+}
+
+String OwnerPartition::hashMidpoint() const {
+    return std::to_string(_hstart + (_hend - _hstart) / 2);
+}
+
 }  // namespace k2::dto
@@ -24,9 +24,12 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 #include <k2/common/Common.h>
+#include <k2/common/EytzingerIndex.h>
 #include <k2/transport/PayloadSerialization.h>
 #include <k2/transport/TXEndpoint.h>
 
+#include <seastar/core/shared_ptr.hh>
+
 #include <set>
 #include <iostream>
 #include <unordered_map>
@@ -104,9 +107,12 @@ struct Partition {
     std::set<String> endpoints;
     // the current assignment state of the partition
     AssignmentState astate = AssignmentState::NotAssigned;
+    // an endpoint of each follower of the partition. Followers replay the WAL of the partition and serve its
+    // snapshot reads
+    std::set<String> followers;
 
-    K2_PAYLOAD_FIELDS(pvid, startKey, endKey, endpoints, astate);
-    K2_DEF_FMT(Partition, pvid, startKey, endKey, endpoints, astate);
+    K2_PAYLOAD_FIELDS(pvid, startKey, endKey, endpoints, astate, followers);
+    K2_DEF_FMT(Partition, pvid, startKey, endKey, endpoints, astate, followers);
 
     // Partitions are ordered based on the ordering of their start keys
     bool operator<(const Partition& other) const noexcept {
@@ -145,8 +151,10 @@ struct CollectionMetadata {
     CollectionCapacity capacity;
     Duration retentionPeriod{0};
     Duration heartbeatDeadline{0}; // set by the CPO
-    K2_PAYLOAD_FIELDS(name, hashScheme, storageDriver, capacity, retentionPeriod, heartbeatDeadline);
-    K2_DEF_FMT(CollectionMetadata, name, hashScheme, storageDriver, capacity, retentionPeriod, heartbeatDeadline);
+    // the collection is being loaded: its partitions accept K23SI_BULK_INGEST
+    bool bulkLoad = false;
+    K2_PAYLOAD_FIELDS(name, hashScheme, storageDriver, capacity, retentionPeriod, heartbeatDeadline, bulkLoad);
+    K2_DEF_FMT(CollectionMetadata, name, hashScheme, storageDriver, capacity, retentionPeriod, heartbeatDeadline, bulkLoad);
 };
 
 
@@ -164,7 +172,10 @@ class PartitionGetter {
 public:
     struct PartitionWithEndpoint {
         Partition* partition;
-        std::unique_ptr<TXEndpoint> preferredEndpoint;
+        // the endpoints are shared with the other users of the same URLs on this core
+        seastar::lw_shared_ptr<TXEndpoint> preferredEndpoint;
+        // one of the followers of the partition, picked at random, or null if it has none
+        seastar::lw_shared_ptr<TXEndpoint> followerEndpoint;
         friend std::ostream& operator<<(std::ostream& os, const PartitionWithEndpoint& pwe) {
             os << "partition: ";
             if (!pwe.partition) {
@@ -192,6 +203,14 @@ public:
     // Hashes key if hashScheme is not range
     PartitionWithEndpoint& getPartitionForKey(const Key& key, bool reverse=false, bool exclusiveKey=false);
 
+    // Applies a change of the partition map pushed by the CPO. Changed partitions which keep their key range
+    // are updated in place; otherwise the lookup maps are rebuilt. Returns false without applying anything
+    // if the change is not for the current version of the partition map
+    bool applyChange(uint64_t baseVersion, uint64_t version, std::vector<Partition>&& partitions);
+
+    // The endpoints the requests to the partitions go to: the preferred endpoints and the chosen followers
+    std::vector<seastar::lw_shared_ptr<TXEndpoint>> endpoints() const;
+
     Collection collection;
 
 private:
@@ -216,8 +235,18 @@ private:
         }
     };
 
+    // The first element of the range map with a start key not less than (or, if upper, greater than) the key.
+    // The prefix index narrows the search down to the start keys which share the 8-byte prefix of the key
+    std::vector<RangeMapElement>::iterator _rangeBound(const String& key, bool upper);
+
+    // The lookup map element for the partition with the given key range, or nullptr if there is none
+    PartitionWithEndpoint* _findElement(const Partition& part);
+
     std::vector<RangeMapElement> _rangePartitionMap;
     std::vector<HashMapElement> _hashPartitionMap;
+    // search indexes over the start key prefixes of _rangePartitionMap, and the hash values of _hashPartitionMap
+    EytzingerIndex _rangePrefixIndex;
+    EytzingerIndex _hashIndex;
 };
 
 // Helper wrapper for Partitions, which allows to establish
@@ -226,6 +255,11 @@ class OwnerPartition {
 public:
     OwnerPartition(Partition&& part, HashScheme scheme);
     bool owns(const Key& key, const bool reverse = false) const;
+    // True if the partition can be split at splitKey into two non-empty partitions. The split key of a hash
+    // partition is a hash value, written in decimal like the partition bounds
+    bool canSplitAt(const String& splitKey) const;
+    // The split key in the middle of a hash partition
+    String hashMidpoint() const;
     Partition& operator()() { return _partition; }
     const Partition& operator()() const { return _partition; }
     HashScheme getHashScheme() { return _scheme; }
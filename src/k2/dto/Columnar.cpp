@@ -0,0 +1,350 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#include "Columnar.h"
+
+namespace k2 {
+namespace dto {
+
+namespace {
+// Arrow bitmaps: bit i is the (i % 8)th least significant bit of byte i / 8
+void _appendBit(std::string& bitmap, uint32_t index, bool set) {
+    if (index % 8 == 0) {
+        bitmap.push_back(0);
+    }
+    if (set) {
+        bitmap.back() |= char(1 << (index % 8));
+    }
+}
+
+bool _getBit(const String& bitmap, uint32_t index) {
+    return (uint8_t(bitmap[index / 8]) >> (index % 8)) & 1;
+}
+
+// Appends the bits of the given bitmap to out, which has outBits bits. An empty bitmap is all set
+void _appendBits(std::string& out, uint32_t outBits, const String& bitmap, uint32_t bits) {
+    for (uint32_t i = 0; i < bits; ++i) {
+        _appendBit(out, outBits + i, bitmap.empty() || _getBit(bitmap, i));
+    }
+}
+
+int32_t _getOffset(const String& offsets, uint32_t row) {
+    int32_t offset = 0;
+    std::memcpy(&offset, offsets.data() + row * sizeof(int32_t), sizeof(int32_t));
+    return offset;
+}
+
+String _toString(const std::string& buffer) {
+    return String(buffer.data(), buffer.size());
+}
+
+// A column of the given number of rows which are all null
+Column _nullColumn(const String& name, uint32_t rows) {
+    return Column{.name = name, .type = FieldType::NULL_T, .nullCount = rows,
+                  .validity = String((rows + 7) / 8, '\0'), .offsets = String(), .data = String()};
+}
+
+// Sets the value buffers of a column which had no type for the given number of rows, all of which are null
+void _zeroValues(Column& col, uint32_t rows) {
+    if (col.type == FieldType::STRING) {
+        col.offsets = String((rows + 1) * sizeof(int32_t), '\0');
+    }
+    else if (col.type == FieldType::BOOL) {
+        col.data = String((rows + 7) / 8, '\0');
+    }
+    else {
+        col.data = String(rows * Column::valueWidth(col.type), '\0');
+    }
+}
+
+// Appends the rows of src to dst, which has dstRows rows
+void _appendColumn(Column& dst, uint32_t dstRows, const Column& src, uint32_t srcRows) {
+    if (src.type != dst.type && src.type != FieldType::NULL_T && dst.type != FieldType::NULL_T) {
+        throw TypeMismatchException(fmt::format("column {} is {} and {}", dst.name, dst.type, src.type));
+    }
+    if (dst.type == FieldType::NULL_T && src.type != FieldType::NULL_T) {
+        dst.type = src.type;
+        _zeroValues(dst, dstRows);
+    }
+    bool srcValues = src.type != FieldType::NULL_T;
+
+    if (dst.nullCount > 0 || src.nullCount > 0) {
+        std::string validity;
+        _appendBits(validity, 0, dst.validity, dstRows);
+        _appendBits(validity, dstRows, src.validity, srcRows);
+        dst.validity = _toString(validity);
+    }
+    dst.nullCount += src.nullCount;
+
+    if (dst.type == FieldType::STRING) {
+        std::string offsets(dst.offsets.data(), dst.offsets.size());
+        int32_t base = _getOffset(dst.offsets, dstRows);
+        for (uint32_t i = 1; i <= srcRows; ++i) {
+            int32_t offset = base + (srcValues ? _getOffset(src.offsets, i) : 0);
+            offsets.append((const char*)&offset, sizeof(offset));
+        }
+        dst.offsets = _toString(offsets);
+        std::string data(dst.data.data(), dst.data.size());
+        data.append(src.data.data(), src.data.size());
+        dst.data = _toString(data);
+    }
+    else if (dst.type == FieldType::BOOL) {
+        std::string data(dst.data.data(), dst.data.size());
+        // an untyped source has no values, which are read as zero bits
+        String values = srcValues ? src.data : String((srcRows + 7) / 8, '\0');
+        _appendBits(data, dstRows, values, srcRows);
+        dst.data = _toString(data);
+    }
+    else if (dst.type != FieldType::NULL_T) {
+        std::string data(dst.data.data(), dst.data.size());
+        if (srcValues) {
+            data.append(src.data.data(), src.data.size());
+        }
+        else {
+            data.append(srcRows * Column::valueWidth(dst.type), '\0');
+        }
+        dst.data = _toString(data);
+    }
+}
+} // namespace
+
+size_t Column::valueWidth(FieldType type) {
+    switch (type) {
+        case FieldType::INT16T:
+            return sizeof(int16_t);
+        case FieldType::INT32T:
+        case FieldType::FLOAT:
+            return sizeof(int32_t);
+        case FieldType::INT64T:
+        case FieldType::DOUBLE:
+        case FieldType::DECIMAL64:
+            return sizeof(int64_t);
+        case FieldType::DECIMAL128:
+            return sizeof(std::decimal::decimal128);
+        case FieldType::FIELD_TYPE:
+            return sizeof(FieldType);
+        default:
+            return 0;
+    }
+}
+
+bool Column::isNull(uint32_t row) const {
+    return !validity.empty() && !_getBit(validity, row);
+}
+
+bool Column::boolValue(uint32_t row) const {
+    if (type != FieldType::BOOL) {
+        throw TypeMismatchException(fmt::format("cannot read column {} of type {} as BOOL", name, type));
+    }
+    return _getBit(data, row);
+}
+
+std::string_view Column::stringValue(uint32_t row) const {
+    if (type != FieldType::STRING) {
+        throw TypeMismatchException(fmt::format("cannot read column {} of type {} as STRING", name, type));
+    }
+    int32_t start = _getOffset(offsets, row);
+    return std::string_view(data.data() + start, _getOffset(offsets, row + 1) - start);
+}
+
+const Column* ColumnBatch::column(const String& name) const {
+    for (const Column& col : columns) {
+        if (col.name == name) {
+            return &col;
+        }
+    }
+    return nullptr;
+}
+
+void ColumnBatch::append(ColumnBatch&& other) {
+    std::vector<bool> appended(columns.size(), false);
+    for (const Column& src : other.columns) {
+        size_t i = 0;
+        while (i < columns.size() && columns[i].name != src.name) {
+            ++i;
+        }
+        if (i == columns.size()) {
+            columns.push_back(_nullColumn(src.name, numRows));
+            appended.push_back(false);
+        }
+        _appendColumn(columns[i], numRows, src, other.numRows);
+        appended[i] = true;
+    }
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (!appended[i]) {
+            _appendColumn(columns[i], numRows, _nullColumn(columns[i].name, other.numRows), other.numRows);
+        }
+    }
+    numRows += other.numRows;
+}
+
+void ColumnBatch::truncate(uint32_t rows) {
+    if (rows >= numRows) {
+        return;
+    }
+    for (Column& col : columns) {
+        if (!col.validity.empty()) {
+            col.nullCount = 0;
+            for (uint32_t i = 0; i < rows; ++i) {
+                col.nullCount += !_getBit(col.validity, i);
+            }
+            col.validity = col.nullCount > 0 ? String(col.validity.data(), (rows + 7) / 8) : String();
+        }
+        if (col.type == FieldType::STRING) {
+            col.data = String(col.data.data(), _getOffset(col.offsets, rows));
+            col.offsets = String(col.offsets.data(), (rows + 1) * sizeof(int32_t));
+        }
+        else if (col.type == FieldType::BOOL) {
+            col.data = String(col.data.data(), (rows + 7) / 8);
+        }
+        else {
+            col.data = String(col.data.data(), rows * Column::valueWidth(col.type));
+        }
+    }
+    numRows = rows;
+}
+
+ColumnBatchBuilder::ColumnBatchBuilder(std::vector<String> fieldNames) : _named(!fieldNames.empty()) {
+    for (String& name : fieldNames) {
+        _columns.push_back(_Column{.name = std::move(name)});
+    }
+}
+
+void ColumnBatchBuilder::_bindSchema(const std::shared_ptr<Schema>& schema) {
+    if (schema == _schema) {
+        return;
+    }
+    _schema = schema;
+    if (!_named && _columns.empty()) {
+        for (const SchemaField& field : schema->fields) {
+            _columns.push_back(_Column{.name = field.name});
+        }
+    }
+
+    _fieldIndexes.assign(_columns.size(), -1);
+    for (size_t i = 0; i < _columns.size(); ++i) {
+        _Column& col = _columns[i];
+        int32_t fieldIndex = schema->fieldIndex(col.name);
+        if (fieldIndex < 0) {
+            continue;
+        }
+        FieldType type = schema->fields[fieldIndex].type;
+        if (col.type == FieldType::NULL_T) {
+            // the column gets the type of the first record which has the field. The rows before it are null
+            col.type = type;
+            if (type == FieldType::STRING) {
+                col.offsets.assign(_numRows + 1, 0);
+            }
+            else if (type == FieldType::BOOL) {
+                for (uint32_t row = 0; row < _numRows; ++row) {
+                    _appendBit(col.data, row, false);
+                }
+            }
+            else {
+                col.data.append(_numRows * Column::valueWidth(type), '\0');
+            }
+        }
+        if (col.type == type) {
+            _fieldIndexes[i] = fieldIndex;
+        }
+    }
+}
+
+void ColumnBatchBuilder::_appendNulls(_Column& col, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t row = _numRows + i;
+        _appendBit(col.validity, row, false);
+        if (col.type == FieldType::STRING) {
+            col.offsets.push_back(col.offsets.back());
+        }
+        else if (col.type == FieldType::BOOL) {
+            _appendBit(col.data, row, false);
+        }
+    }
+    col.data.append(count * Column::valueWidth(col.type), '\0');
+    col.nullCount += count;
+}
+
+template <typename T>
+void ColumnBatchBuilder::_appendValue(const SchemaField&, _Column& col, SKVRecord& rec, uint32_t fieldIndex) {
+    if constexpr (std::is_same_v<T, String>) {
+        // strings are copied straight from the record's payload into the column
+        std::optional<std::string_view> value = rec.deserializeStringViewUnchecked(fieldIndex, _scratch);
+        if (!value) {
+            _appendNulls(col, 1);
+            return;
+        }
+        _appendBit(col.validity, _numRows, true);
+        col.data.append(value->data(), value->size());
+        col.offsets.push_back(col.data.size());
+    }
+    else {
+        std::optional<T> value = rec.deserializeFieldUnchecked<T>(fieldIndex);
+        if (!value) {
+            _appendNulls(col, 1);
+            return;
+        }
+        _appendBit(col.validity, _numRows, true);
+        if constexpr (std::is_same_v<T, bool>) {
+            _appendBit(col.data, _numRows, *value);
+        }
+        else {
+            col.data.append((const char*)&*value, sizeof(T));
+        }
+    }
+}
+
+void ColumnBatchBuilder::add(SKVRecord& rec) {
+    _bindSchema(rec.schema);
+    for (size_t i = 0; i < _columns.size(); ++i) {
+        _Column& col = _columns[i];
+        if (_fieldIndexes[i] < 0) {
+            _appendNulls(col, 1);
+            continue;
+        }
+        const SchemaField& field = rec.schema->fields[_fieldIndexes[i]];
+        K2_DTO_CAST_APPLY_FIELD_VALUE(_appendValue, field, col, rec, _fieldIndexes[i]);
+    }
+    _numRows++;
+}
+
+ColumnBatch ColumnBatchBuilder::finish() {
+    ColumnBatch batch;
+    batch.numRows = _numRows;
+    for (_Column& col : _columns) {
+        Column& out = batch.columns.emplace_back();
+        out.name = std::move(col.name);
+        out.type = col.type;
+        out.nullCount = col.nullCount;
+        if (col.nullCount > 0) {
+            out.validity = _toString(col.validity);
+        }
+        if (col.type == FieldType::STRING) {
+            out.offsets = String((const char*)col.offsets.data(), col.offsets.size() * sizeof(int32_t));
+        }
+        out.data = _toString(col.data);
+    }
+    return batch;
+}
+
+} // ns dto
+} // ns k2
@@ -0,0 +1,138 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <k2/common/Common.h>
+#include <k2/transport/PayloadSerialization.h>
+#include "FieldTypes.h"
+#include "SKVRecord.h"
+
+namespace k2 {
+namespace dto {
+
+// A column of a columnar query response. The buffers have the layout of an Apache Arrow array of the column's
+// type, so that they can be handed to Arrow, or to a data frame library which reads it, without touching each
+// value. Values are little endian:
+//  - validity: bit i (least significant bit first) is set if the value of row i is not null. It is empty if
+//    no value of the column is null, as Arrow allows
+//  - offsets: only for STRING, numRows+1 int32_t offsets of the values in data
+//  - data: fixed width values for the integer types, FLOAT and DOUBLE, a bitmap for BOOL, and the concatenated
+//    bytes of the values for STRING. DECIMAL64 and DECIMAL128 are the 8 and 16 byte IEEE encodings of
+//    std::decimal (an Arrow fixed size binary), and FIELD_TYPE is one byte. The slots of null values are zero
+struct Column {
+    String name;
+    // the type of the field in the first record which had it. NULL_T if no record had the field
+    FieldType type = FieldType::NULL_T;
+    uint32_t nullCount = 0;
+    String validity;
+    String offsets;
+    String data;
+
+    // The width in bytes of the values of a fixed width type, 0 for STRING, BOOL and NULL_T
+    static size_t valueWidth(FieldType type);
+
+    bool isNull(uint32_t row) const;
+
+    // The value of the given row of a fixed width column. Throws TypeMismatchException if T is not the column's type
+    template <typename T>
+    T value(uint32_t row) const {
+        if (TToFieldType<T>() != type || valueWidth(type) != sizeof(T)) {
+            throw TypeMismatchException(fmt::format("cannot read column {} of type {} as {}", name, type, TToFieldType<T>()));
+        }
+        T result;
+        std::memcpy(&result, data.data() + row * sizeof(T), sizeof(T));
+        return result;
+    }
+    bool boolValue(uint32_t row) const;
+    // The value of the given row of a STRING column, which references the column's data
+    std::string_view stringValue(uint32_t row) const;
+
+    K2_PAYLOAD_FIELDS(name, type, nullCount, validity, offsets, data);
+    K2_DEF_FMT(Column, name, type, nullCount);
+};
+
+// The rows of a query response as columns(see Column)
+struct ColumnBatch {
+    uint32_t numRows = 0;
+    std::vector<Column> columns;
+
+    // The column with the given name, or nullptr if there is none
+    const Column* column(const String& name) const;
+
+    // Appends the rows of another batch, e.g. the next page of the query. Columns are matched by name, and a
+    // column which only one of the batches has is null for the rows of the other. Throws TypeMismatchException
+    // if a column has different types in the two batches
+    void append(ColumnBatch&& other);
+
+    // Keeps only the first rows of the batch
+    void truncate(uint32_t rows);
+
+    K2_PAYLOAD_FIELDS(numRows, columns);
+    K2_DEF_FMT(ColumnBatch, numRows, columns);
+};
+
+// Builds a ColumnBatch from records, one row per record. The records may be of different schema versions;
+// a field which a record's schema doesn't have, or has with a different type than the column, is null for
+// that record
+class ColumnBatchBuilder {
+public:
+    // The columns are the given fields, in order, or all the fields of the schema of the first record if empty
+    explicit ColumnBatchBuilder(std::vector<String> fieldNames);
+
+    // Throws DeserializationError if the record's payload cannot be read
+    void add(SKVRecord& rec);
+
+    ColumnBatch finish();
+
+private:
+    // columns are built in std::strings, which grow in place, and are copied once into the batch
+    struct _Column {
+        String name;
+        FieldType type = FieldType::NULL_T;
+        uint32_t nullCount = 0;
+        std::string validity;
+        std::vector<int32_t> offsets;
+        std::string data;
+    };
+
+    // the index in the schema of each column's field, or -1 if the schema doesn't have it with the column's type
+    void _bindSchema(const std::shared_ptr<Schema>& schema);
+    void _appendNulls(_Column& col, uint32_t count);
+    template <typename T>
+    void _appendValue(const SchemaField& field, _Column& col, SKVRecord& rec, uint32_t fieldIndex);
+
+    std::vector<_Column> _columns;
+    bool _named = false;
+    uint32_t _numRows = 0;
+    std::shared_ptr<Schema> _schema;
+    std::vector<int32_t> _fieldIndexes;
+    String _scratch;
+};
+
+} // ns dto
+} // ns k2
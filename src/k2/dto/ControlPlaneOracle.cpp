@@ -23,21 +23,62 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include "ControlPlaneOracle.h"
 
+#include <algorithm>
+
 namespace k2 {
 namespace dto {
 
 void Schema::setKeyFieldsByName(const std::vector<String>& keys, std::vector<uint32_t>& keyFields) {
     for (const String& keyName : keys) {
-        bool found = false;
-        for (size_t i = 0; i < fields.size(); ++i) {
-            if (keyName == fields[i].name) {
-                found = true;
-                keyFields.push_back(i);
-                break;
+        int32_t idx = fieldIndex(keyName);
+        K2ASSERT(log::dto, idx >= 0, "failed to find field by name");
+        if (idx >= 0) {
+            keyFields.push_back((uint32_t)idx);
+        }
+    }
+    _lookups.keySlots.clear();
+}
+
+const std::vector<int32_t>& Schema::keySlots() const {
+    if (_lookups.keySlots.size() != fields.size()) {
+        _lookups.keySlots.assign(fields.size(), -1);
+        for (size_t i = 0; i < partitionKeyFields.size(); ++i) {
+            if (partitionKeyFields[i] < fields.size()) {
+                _lookups.keySlots[partitionKeyFields[i]] = (int32_t)i;
+            }
+        }
+        for (size_t i = 0; i < rangeKeyFields.size(); ++i) {
+            if (rangeKeyFields[i] < fields.size()) {
+                _lookups.keySlots[rangeKeyFields[i]] = (int32_t)(partitionKeyFields.size() + i);
             }
         }
-        K2ASSERT(log::dto, found, "failed to find field by name");
     }
+    return _lookups.keySlots;
+}
+
+int32_t Schema::fieldIndex(const String& fieldName) const {
+    if (_lookups.fieldIndexes.size() != fields.size()) {
+        _lookups.fieldIndexes.clear();
+        for (size_t i = 0; i < fields.size(); ++i) {
+            _lookups.fieldIndexes.emplace(fields[i].name, (uint32_t)i);
+        }
+    }
+    auto it = _lookups.fieldIndexes.find(fieldName);
+    return it == _lookups.fieldIndexes.end() ? -1 : (int32_t)it->second;
+}
+
+int32_t Schema::fieldIndex(const String& fieldName, FieldType type) const {
+    int32_t idx = fieldIndex(fieldName);
+    return idx >= 0 && fields[idx].type == type ? idx : -1;
+}
+
+void Schema::indexFields() const {
+    _lookups.fieldIndexes.clear();
+    for (size_t i = 0; i < fields.size(); ++i) {
+        _lookups.fieldIndexes.emplace(fields[i].name, (uint32_t)i);
+    }
+    _lookups.keySlots.clear();
+    keySlots();
 }
 
 void Schema::setPartitionKeyFieldsByName(const std::vector<String>& keys) {
@@ -59,6 +100,10 @@ Status Schema::basicValidation() const {
         }
     }
 
+    if (ttl < Duration(0)) {
+        return Statuses::S400_Bad_Request("Negative schema TTL");
+    }
+
     if (partitionKeyFields.size() == 0) {
         K2LOG_W(log::dto, "Bad CreateSchemaRequest: No partitionKeyFields defined");
         return Statuses::S400_Bad_Request("No partitionKeyFields defined");
@@ -113,9 +158,62 @@ Status Schema::basicValidation() const {
         }
     }
 
+    std::unordered_set<String> indexNames;
+    for (const SecondaryIndex& index : secondaryIndexes) {
+        auto [it, isUnique] = indexNames.insert(index.name);
+        if (!isUnique || index.name == "" || index.name.find('.') != String::npos) {
+            K2LOG_W(log::dto, "Bad CreateSchemaRequest: invalid or duplicated secondary index name {}", index.name);
+            return Statuses::S400_Bad_Request("Invalid or duplicated secondary index name");
+        }
+        if (index.fields.size() == 0) {
+            return Statuses::S400_Bad_Request("No fields defined for secondary index");
+        }
+        std::unordered_set<String> indexFields;
+        for (const String& fieldName : index.fields) {
+            if (uniqueNames.find(fieldName) == uniqueNames.end() || !indexFields.insert(fieldName).second) {
+                K2LOG_W(log::dto, "Bad CreateSchemaRequest: unknown or duplicated field {} in index {}", fieldName, index.name);
+                return Statuses::S400_Bad_Request("Unknown or duplicated field in secondary index");
+            }
+        }
+    }
+
     return Statuses::S200_OK("basic validation passed");
 }
 
+String Schema::indexSchemaName(const String& schemaName, const String& indexName) {
+    return schemaName + "." + indexName;
+}
+
+Schema Schema::makeIndexSchema(const SecondaryIndex& index) const {
+    Schema result;
+    result.name = indexSchemaName(name, index.name);
+    result.version = version;
+    // the index records are written along with the records, and expire with them
+    result.ttl = ttl;
+
+    for (const String& fieldName : index.fields) {
+        int32_t idx = fieldIndex(fieldName);
+        K2ASSERT(log::dto, idx >= 0, "failed to find index field by name");
+        result.fields.push_back(fields[idx]);
+    }
+
+    // the key fields of the indexed record make the index records unique
+    std::vector<String> rangeKeys;
+    std::vector<uint32_t> keyFields = partitionKeyFields;
+    keyFields.insert(keyFields.end(), rangeKeyFields.begin(), rangeKeyFields.end());
+    for (uint32_t keyField : keyFields) {
+        const SchemaField& field = fields[keyField];
+        if (std::find(index.fields.begin(), index.fields.end(), field.name) == index.fields.end()) {
+            result.fields.push_back(field);
+            rangeKeys.push_back(field.name);
+        }
+    }
+
+    result.setPartitionKeyFieldsByName(index.fields);
+    result.setRangeKeyFieldsByName(rangeKeys);
+    return result;
+}
+
 // Used to make sure that the partition and range key definitions do not change between versions
 Status Schema::canUpgradeTo(const dto::Schema& other) const {
     if (partitionKeyFields.size() != other.partitionKeyFields.size()) {
@@ -164,6 +262,17 @@ Status Schema::canUpgradeTo(const dto::Schema& other) const {
         }
     }
 
+    // records written with one version have to be found through the same indexes as with any other version
+    if (secondaryIndexes.size() != other.secondaryIndexes.size()) {
+        return Statuses::S409_Conflict("secondary indexes of schema versions do not match");
+    }
+    for (size_t i = 0; i < secondaryIndexes.size(); ++i) {
+        if (secondaryIndexes[i].name != other.secondaryIndexes[i].name ||
+            secondaryIndexes[i].fields != other.secondaryIndexes[i].fields) {
+            return Statuses::S409_Conflict("secondary indexes of schema versions do not match");
+        }
+    }
+
     return Statuses::S200_OK("Upgrade compatible");
 }
 
@@ -23,6 +23,8 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <unordered_map>
+
 #include <k2/transport/Status.h>
 
 #include "Collection.h"
@@ -44,14 +46,18 @@ struct CPOClientException : public std::exception {
 struct CollectionCreateRequest {
     // The metadata which describes the collection K2 should create
     CollectionMetadata metadata;
-    // the endpoints of the k2 cluster to use for setting up this collection
+    // the endpoints of the k2 cluster to use for setting up this collection. If empty, the CPO places
+    // the partitions by the load of the cluster
     std::vector<String> clusterEndpoints;
     // Only relevant for range partitioned collections. Contains the key range
     // endpoints for each partition.
     std::vector<String> rangeEnds;
+    // Only relevant for hash partitioned collections created without clusterEndpoints: the number of
+    // partitions the CPO places on the least loaded cores
+    uint32_t partitionCount = 0;
 
-    K2_PAYLOAD_FIELDS(metadata, clusterEndpoints, rangeEnds);
-    K2_DEF_FMT(CollectionCreateRequest, metadata, clusterEndpoints, rangeEnds);
+    K2_PAYLOAD_FIELDS(metadata, clusterEndpoints, rangeEnds, partitionCount);
+    K2_DEF_FMT(CollectionCreateRequest, metadata, clusterEndpoints, rangeEnds, partitionCount);
 };
 
 // Response to CollectionCreateRequest
@@ -64,8 +70,11 @@ struct CollectionCreateResponse {
 struct CollectionGetRequest {
     // The name of the collection to get
     String name;
-    K2_PAYLOAD_FIELDS(name);
-    K2_DEF_FMT(CollectionGetRequest, name);
+    // If set, the endpoint which the CPO pushes the changes of the partition map of the collection to,
+    // with CPO_COLLECTION_CHANGE
+    String subscriber;
+    K2_PAYLOAD_FIELDS(name, subscriber);
+    K2_DEF_FMT(CollectionGetRequest, name, subscriber);
 };
 
 // Response to CollectionGetRequest
@@ -76,6 +85,119 @@ struct CollectionGetResponse {
     K2_DEF_FMT(CollectionGetResponse, collection);
 };
 
+// Sent by the CPO to the subscribers of a collection when its partition map changes
+struct CollectionChangeRequest {
+    String name;
+    // the version of the partition map the change applies to
+    uint64_t baseVersion = 0;
+    // the version of the partition map after the change
+    uint64_t version = 0;
+    // the new and changed partitions. A changed partition has the pvid.id of the partition it replaces
+    std::vector<Partition> partitions;
+    K2_PAYLOAD_FIELDS(name, baseVersion, version, partitions);
+    K2_DEF_FMT(CollectionChangeRequest, name, baseVersion, version, partitions);
+};
+
+// Response to CollectionChangeRequest
+struct CollectionChangeResponse {
+    K2_PAYLOAD_EMPTY;
+    K2_DEF_FMT(CollectionChangeResponse);
+};
+
+// Request to split a partition. The keys at and past splitKey move into a new partition, assigned to the node
+// at targetEndpoint. Hash partitions are split at a hash value, which is how hash partitioned collections scale out:
+// only the keys hashing into the upper part of the split partition move
+struct PartitionSplitRequest {
+    String collectionName;
+    // the partition to split. Must be the current version of the partition
+    Partition::PVID pvid;
+    // must be strictly inside the key range of the partition. For hash partitions, a hash value in decimal.
+    // If empty, a hash partition is split in the middle of its hash range
+    String splitKey;
+    String targetEndpoint;
+    K2_PAYLOAD_FIELDS(collectionName, pvid, splitKey, targetEndpoint);
+    K2_DEF_FMT(PartitionSplitRequest, collectionName, pvid, splitKey, targetEndpoint);
+};
+
+// Response to PartitionSplitRequest
+struct PartitionSplitResponse {
+    // the partition map of the collection after the split
+    PartitionMap partitionMap;
+    K2_PAYLOAD_FIELDS(partitionMap);
+    K2_DEF_FMT(PartitionSplitResponse, partitionMap);
+};
+
+// Request to move a partition of a collection to the k2 core at targetEndpoint, without losing its in-memory state
+struct PartitionMigrateRequest {
+    String collectionName;
+    // the partition to move. Must be the current version of the partition
+    Partition::PVID pvid;
+    String targetEndpoint;
+    K2_PAYLOAD_FIELDS(collectionName, pvid, targetEndpoint);
+    K2_DEF_FMT(PartitionMigrateRequest, collectionName, pvid, targetEndpoint);
+};
+
+// Response to PartitionMigrateRequest
+struct PartitionMigrateResponse {
+    // the partition map of the collection after the migration
+    PartitionMap partitionMap;
+    K2_PAYLOAD_FIELDS(partitionMap);
+    K2_DEF_FMT(PartitionMigrateResponse, partitionMap);
+};
+
+// The health and load of a k2 core, sampled by the NodePoolMonitor of its node
+struct CoreHeartbeat {
+    // the endpoint of the core
+    String endpoint;
+    // the fraction of the time the reactor of the core was busy since the previous heartbeat
+    double reactorUtilization = 0;
+    // memory allocated on the core
+    uint64_t memoryBytes = 0;
+    // requests the core sent which are still waiting for their replies
+    uint64_t pendingRequests = 0;
+    // whether a partition is assigned to the core, and if so which one
+    bool assigned = false;
+    String collectionName;
+    Partition::PVID pvid;
+    // total reads, writes and queries served by the partition
+    uint64_t requests = 0;
+    // 99th percentile latency of the recent requests of the partition, in microseconds
+    uint64_t p99LatencyUs = 0;
+    K2_PAYLOAD_FIELDS(endpoint, reactorUtilization, memoryBytes, pendingRequests, assigned, collectionName, pvid, requests, p99LatencyUs);
+    K2_DEF_FMT(CoreHeartbeat, endpoint, reactorUtilization, memoryBytes, pendingRequests, assigned, collectionName, pvid, requests, p99LatencyUs);
+};
+
+// Sent periodically by each k2 node to the CPO, with the health and load of all its cores
+struct NodeHeartbeatRequest {
+    std::vector<CoreHeartbeat> cores;
+    K2_PAYLOAD_FIELDS(cores);
+    K2_DEF_FMT(NodeHeartbeatRequest, cores);
+};
+
+struct NodeHeartbeatResponse {
+    K2_PAYLOAD_EMPTY;
+    K2_DEF_FMT(NodeHeartbeatResponse);
+};
+
+// Request to add a read-only follower of a partition of a collection on the k2 core at endpoint. The follower
+// replays the WAL of the partition and serves its snapshot reads
+struct PartitionAddFollowerRequest {
+    String collectionName;
+    // the partition to follow. Must be the current version of the partition
+    Partition::PVID pvid;
+    String endpoint;
+    K2_PAYLOAD_FIELDS(collectionName, pvid, endpoint);
+    K2_DEF_FMT(PartitionAddFollowerRequest, collectionName, pvid, endpoint);
+};
+
+// Response to PartitionAddFollowerRequest
+struct PartitionAddFollowerResponse {
+    // the partition map of the collection with the new follower
+    PartitionMap partitionMap;
+    K2_PAYLOAD_FIELDS(partitionMap);
+    K2_DEF_FMT(PartitionAddFollowerResponse, partitionMap);
+};
+
 struct SchemaField {
     FieldType type;
     String name;
@@ -90,6 +212,29 @@ struct SchemaField {
     K2_DEF_FMT(SchemaField, type, name, descending, nullLast);
 };
 
+// A secondary index of a schema, which allows lookups by the values of the indexed fields.
+// Each index is kept in a schema of its own, made by Schema::makeIndexSchema and created by the CPO along with
+// the indexed schema. Its records have the indexed fields as their partition key and the key fields of the
+// indexed schema as their range key, so that the primary key of a record can be found with a query on the index.
+// The client writes the index record in the same transaction as the indexed record. Index records are not
+// removed when the record is erased or its indexed fields change, so lookups have to check that the indexed
+// record still matches the index record(see K2TxnHandle::queryIndex)
+struct SecondaryIndex {
+    String name; // unique within the schema, and without '.'
+    std::vector<String> fields; // the indexed fields, by name
+
+    K2_PAYLOAD_FIELDS(name, fields);
+    K2_DEF_FMT(SecondaryIndex, name, fields);
+};
+
+// The lookups which a Schema builds from its fields on first use. Only the Schema reaches them, through
+// keySlots() and fieldIndex(). They are kept in a type of their own so that Schema remains an aggregate
+class SchemaFieldLookups {
+    friend struct Schema;
+    std::vector<int32_t> keySlots;
+    std::unordered_map<String, uint32_t> fieldIndexes;
+};
+
 struct Schema {
     String name;
     uint32_t version = 0;
@@ -109,9 +254,37 @@ struct Schema {
     // Used to make sure that the partition and range key definitions do not change between versions
     Status canUpgradeTo(const dto::Schema& other) const;
 
-    K2_PAYLOAD_FIELDS(name, version, fields, partitionKeyFields, rangeKeyFields);
+    std::vector<SecondaryIndex> secondaryIndexes;
+
+    // For each field, the position of its encoding among the key strings of a record: its index in
+    // partitionKeyFields, or the number of partition key fields plus its index in rangeKeyFields, or -1 if it isn't
+    // a key field. Computed on first use, so the key fields must not be changed directly after that
+    const std::vector<int32_t>& keySlots() const;
+
+    // The index of the field with the given name, or -1 if there is no such field. The name lookup is built on
+    // first use and rebuilt if fields are added, so that callers don't have to scan the fields on every call
+    int32_t fieldIndex(const String& fieldName) const;
+    // Same as above, but -1 also if the field has a different type
+    int32_t fieldIndex(const String& fieldName, FieldType type) const;
+    // Builds the name lookup and the key slots up front. Schemas are indexed when they are installed(created,
+    // pushed or fetched), so that lookups on a shared schema only read it
+    void indexFields() const;
+
+    // The name of the schema of the given index of the given schema
+    static String indexSchemaName(const String& schemaName, const String& indexName);
+    // Makes the schema which holds the records of the given index of this schema. The schema has the same version
+    // as this schema, the indexed fields followed by the key fields which are not indexed, and only key fields
+    Schema makeIndexSchema(const SecondaryIndex& index) const;
+
+    // the records of the schema expire this long after they were written, unless the write has its own TTL.
+    // 0 for never. Expired records are invisible to reads and reclaimed by the version GC
+    Duration ttl{0};
+
+    mutable SchemaFieldLookups _lookups; // cache for keySlots() and fieldIndex(), not serialized
+
+    K2_PAYLOAD_FIELDS(name, version, fields, partitionKeyFields, rangeKeyFields, secondaryIndexes, ttl);
 
-    K2_DEF_FMT(Schema, name, version, fields, partitionKeyFields, rangeKeyFields);
+    K2_DEF_FMT(Schema, name, version, fields, partitionKeyFields, rangeKeyFields, secondaryIndexes, ttl);
 };
 
 // Request to create a schema and attach it to a collection
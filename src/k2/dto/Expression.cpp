@@ -22,6 +22,16 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include "Expression.h"
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+
+#include <k2/common/ByteCompare.h>
+#include <k2/common/ByteSearch.h>
+
 namespace k2 {
 namespace dto {
 namespace expression {
@@ -32,13 +42,11 @@ struct SchematizedValue {
     SchematizedValue(Value& v, SKVRecord& rec) : val(v), rec(rec), type(v.type) {
         K2ASSERT(log::dto, rec.schema, "Record must have a schema");
         if (val.isReference()) {
-            for (size_t i = 0; i < rec.schema->fields.size(); ++i) {
-                if (rec.schema->fields[i].name == val.fieldName) {
-                    sfieldIndex = i;
-                    nullLast = rec.schema->fields[i].nullLast;
-                    type = rec.schema->fields[i].type;
-                    break;
-                }
+            int32_t i = rec.schema->fieldIndex(val.fieldName);
+            if (i >= 0) {
+                sfieldIndex = i;
+                nullLast = rec.schema->fields[i].nullLast;
+                type = rec.schema->fields[i].type;
             }
             // If a fieldName has been provided(meaning this is a reference value), and we can't find it in the incoming
             // schema, then we can't
@@ -148,6 +156,53 @@ int _compareSValues(SchematizedValue& a, SchematizedValue& b) {
     return result;
 }
 
+// A STARTS_WITH B for two (possibly null) strings
+bool _startsWith(const std::optional<String>& aOpt, const std::optional<String>& bOpt) {
+    if (!bOpt) return true; // all strings start with nothing
+    if (!aOpt) return false; // empty strings do not start with anything
+
+    if (aOpt->size() < bOpt->size()) return false; // B is bigger so A cannot start with B
+
+    return ::memcmp(aOpt->c_str(), bOpt->c_str(), bOpt->size()) == 0;
+}
+
+// A CONTAINS B for two (possibly null) strings
+bool _contains(const std::optional<String>& aOpt, const std::optional<String>& bOpt) {
+    if (!bOpt) return true;   // all strings contain a null
+    if (!aOpt) return false;  // a null string doesn't contain other strings
+
+    return aOpt->find(*bOpt) != String::npos;
+}
+
+// A ENDS_WITH B for two (possibly null) strings
+bool _endsWith(const std::optional<String>& aOpt, const std::optional<String>& bOpt) {
+    if (!bOpt) return true;   // all strings end with nothing
+    if (!aOpt) return false;  // null strings do not end with anything
+
+    if (aOpt->size() < bOpt->size()) return false;  // B is bigger so A cannot start with B
+
+    return ::memcmp(aOpt->c_str() + (aOpt->size() - bOpt->size()), bOpt->c_str(), bOpt->size()) == 0;
+}
+
+// The same predicates for compiled expressions: A is read in place from the record, and B is prepared for search
+bool _startsWithInPlace(const std::optional<std::string_view>& aOpt, const ByteNeedle* b) {
+    if (!b) return true;
+    if (!aOpt) return false;
+    return b->isPrefixOf(aOpt->data(), aOpt->size());
+}
+
+bool _containsInPlace(const std::optional<std::string_view>& aOpt, const ByteNeedle* b) {
+    if (!b) return true;
+    if (!aOpt) return false;
+    return b->isContainedIn(aOpt->data(), aOpt->size());
+}
+
+bool _endsWithInPlace(const std::optional<std::string_view>& aOpt, const ByteNeedle* b) {
+    if (!b) return true;
+    if (!aOpt) return false;
+    return b->isSuffixOf(aOpt->data(), aOpt->size());
+}
+
 void Expression::copyPayloads() {
     for (Value& value : valueChildren) {
         Payload copied = value.literal.copy();
@@ -203,6 +258,9 @@ bool Expression::evaluate(SKVRecord& rec) {
         case Operation::NOT: {
             return NOT_handler(rec);
         }
+        case Operation::IN: {
+            return IN_handler(rec);
+        }
         case Operation::UNKNOWN: {
             if (valueChildren.size() + expressionChildren.size() == 0) {
                 // empty expression - allow it
@@ -314,12 +372,7 @@ bool Expression::STARTS_WITH_handler(SKVRecord& rec) {
     }
     auto aOpt = std::get<1>(aVal.get<String>());
     auto bOpt = std::get<1>(bVal.get<String>());
-    if (!bOpt) return true; // all strings start with nothing
-    if (!aOpt) return false; // empty strings do not start with anything
-
-    if (aOpt->size() < bOpt->size()) return false; // B is bigger so A cannot start with B
-
-    return ::memcmp(aOpt->c_str(), bOpt->c_str(), bOpt->size()) == 0;
+    return _startsWith(aOpt, bOpt);
 }
 
 bool Expression::CONTAINS_handler(SKVRecord& rec) {
@@ -335,10 +388,7 @@ bool Expression::CONTAINS_handler(SKVRecord& rec) {
     }
     auto aOpt = std::get<1>(aVal.get<String>());
     auto bOpt = std::get<1>(bVal.get<String>());
-    if (!bOpt) return true;   // all strings contain a null
-    if (!aOpt) return false;  // a null string doesn't contain other strings
-
-    return aOpt->find(*bOpt) != String::npos;
+    return _contains(aOpt, bOpt);
 }
 
 bool Expression::ENDS_WITH_handler(SKVRecord& rec) {
@@ -354,12 +404,7 @@ bool Expression::ENDS_WITH_handler(SKVRecord& rec) {
     }
     auto aOpt = std::get<1>(aVal.get<String>());
     auto bOpt = std::get<1>(bVal.get<String>());
-    if (!bOpt) return true;   // all strings end with nothing
-    if (!aOpt) return false;  // null strings do not end with anything
-
-    if (aOpt->size() < bOpt->size()) return false;  // B is bigger so A cannot start with B
-
-    return ::memcmp(aOpt->c_str() + (aOpt->size() - bOpt->size()), bOpt->c_str(), bOpt->size()) == 0;
+    return _endsWith(aOpt, bOpt);
 }
 
 bool Expression::AND_handler(SKVRecord& rec) {
@@ -484,6 +529,972 @@ bool Expression::NOT_handler(SKVRecord& rec) {
     return !expressionChildren[0].evaluate(rec);
 }
 
+bool Expression::IN_handler(SKVRecord& rec) {
+    // this op evaluates a value against one or more literals. It cannot be composed with other children
+    if (valueChildren.size() < 2 || expressionChildren.size() > 0) {
+        throw InvalidExpressionException();
+    }
+    for (size_t i = 1; i < valueChildren.size(); ++i) {
+        if (valueChildren[i].isReference()) {
+            throw InvalidExpressionException();
+        }
+    }
+    SchematizedValue aVal(valueChildren[0], rec);
+    // compare with all literals in order to trigger type exceptions if any
+    bool found = false;
+    for (size_t i = 1; i < valueChildren.size(); ++i) {
+        SchematizedValue bVal(valueChildren[i], rec);
+        found |= _compareSValues(aVal, bVal) == 0;
+    }
+    return found;
+}
+
+// This class holds the resolution of a given Value against a schema. It is the compile-time counterpart of
+// SchematizedValue: the field lookup is done once per schema instead of once per record.
+struct ResolvedValue {
+    ResolvedValue(Value& v, const std::shared_ptr<Schema>& schema) : val(v), type(v.type) {
+        K2ASSERT(log::dto, schema, "Record must have a schema");
+        if (val.isReference()) {
+            int32_t i = schema->fieldIndex(val.fieldName);
+            if (i >= 0) {
+                sfieldIndex = i;
+                nullLast = schema->fields[i].nullLast;
+                type = schema->fields[i].type;
+            }
+            if (type == FieldType::NOT_KNOWN) {
+                throw NoFieldFoundException();
+            }
+        }
+    }
+    Value& val;
+    FieldType type = FieldType::NOT_KNOWN;
+    bool nullLast = false;
+    int sfieldIndex = -1;
+};
+
+// A ResolvedValue bound to its type. A literal is decoded once, here. A reference is deserialized
+// from each record passed to get()
+template <typename T>
+struct TypedOperand {
+    TypedOperand(ResolvedValue& rv) : sfieldIndex(rv.sfieldIndex), value(rv.nullLast, std::nullopt) {
+        if (TToFieldType<T>() != rv.type) {
+            auto msg = fmt::format("bad type in schematized value get: have {}, got {}", rv.type, TToFieldType<T>());
+            throw TypeMismatchException(msg);
+        }
+        if (!rv.val.isReference()) {
+            rv.val.literal.seek(0);
+            T result{};
+            if (!rv.val.literal.read(result)) {
+                throw DeserializationError();
+            }
+            std::get<1>(value) = std::move(result);
+        }
+    }
+
+    // Same as SchematizedValue::get(), but the returned tuple is only valid until the next call
+    std::tuple<bool, std::optional<T>>& get(SKVRecord& rec) {
+        if (sfieldIndex >= 0) {
+            std::get<1>(value) = rec.deserializeField<T>(sfieldIndex);
+        }
+        return value;
+    }
+
+    int sfieldIndex = -1;
+    std::tuple<bool, std::optional<T>> value;
+};
+
+// A boolean operand of a logical operation: either a BOOL value, or a compiled child expression
+struct BoolOperand {
+    std::optional<TypedOperand<bool>> value;
+    CompiledExpression::Program expr;
+
+    std::optional<bool> get(SKVRecord& rec) {
+        if (value) {
+            return std::get<1>(value->get(rec));
+        }
+        return expr(rec);
+    }
+};
+
+CompiledExpression::Program _compileNode(Expression& expr, const std::shared_ptr<Schema>& schema);
+
+template <typename A_TYPE, typename B_TYPE>
+CompiledExpression::Program _makeCompare(TypedOperand<A_TYPE>&& a, TypedOperand<B_TYPE>&& b, Operation op) {
+    if constexpr (!is_comparable<A_TYPE, B_TYPE>::value) {
+        auto msg = fmt::format("non-comparable types: {}, {}", TToFieldType<A_TYPE>(), TToFieldType<B_TYPE>());
+        throw TypeMismatchException(msg);
+    }
+    else {
+        auto cmp = [a = std::move(a), b = std::move(b)](SKVRecord& rec) mutable {
+            return compareOptionals(a.get(rec), b.get(rec));
+        };
+        switch (op) {
+            case Operation::EQ:
+                return [cmp = std::move(cmp)](SKVRecord& rec) mutable { return cmp(rec) == 0; };
+            case Operation::GT:
+                return [cmp = std::move(cmp)](SKVRecord& rec) mutable { return cmp(rec) > 0; };
+            case Operation::GTE:
+                return [cmp = std::move(cmp)](SKVRecord& rec) mutable { return cmp(rec) >= 0; };
+            case Operation::LT:
+                return [cmp = std::move(cmp)](SKVRecord& rec) mutable { return cmp(rec) < 0; };
+            case Operation::LTE:
+                return [cmp = std::move(cmp)](SKVRecord& rec) mutable { return cmp(rec) <= 0; };
+            default:
+                throw InvalidExpressionException();
+        }
+    }
+}
+
+template <typename B_TYPE, typename A_TYPE>
+void _innerCompileCompareHelper(ResolvedValue& b, TypedOperand<A_TYPE>& a, Operation op, CompiledExpression::Program& result) {
+    result = _makeCompare(std::move(a), TypedOperand<B_TYPE>(b), op);
+}
+
+template <typename A_TYPE>
+void _outerCompileCompareHelper(ResolvedValue& a, ResolvedValue& b, Operation op, CompiledExpression::Program& result) {
+    TypedOperand<A_TYPE> aOp(a);
+    // This relies on partial template deduction of the last template argument of innerHelper
+    K2_DTO_CAST_APPLY_FIELD_VALUE(_innerCompileCompareHelper, b, aOp, op, result);
+}
+
+CompiledExpression::Program _compileCompare(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    // this op evaluates exactly two values only. It cannot be composed with other children
+    if (expr.valueChildren.size() != 2 || expr.expressionChildren.size() > 0) {
+        throw InvalidExpressionException();
+    }
+    ResolvedValue aVal(expr.valueChildren[0], schema);
+    ResolvedValue bVal(expr.valueChildren[1], schema);
+    CompiledExpression::Program result;
+    K2_DTO_CAST_APPLY_FIELD_VALUE(_outerCompileCompareHelper, aVal, bVal, expr.op, result);
+    return result;
+}
+
+template <typename T>
+void _isNullCompileHelper(ResolvedValue& rv, CompiledExpression::Program& result) {
+    result = [sfieldIndex = rv.sfieldIndex](SKVRecord& rec) {
+        return !rec.deserializeField<T>(sfieldIndex).has_value();
+    };
+}
+
+CompiledExpression::Program _compileIsNull(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    // this op evaluates exactly one reference leaf only. It cannot be composed with other children
+    if (expr.valueChildren.size() != 1 || expr.expressionChildren.size() > 0 || !expr.valueChildren[0].isReference()) {
+        throw InvalidExpressionException();
+    }
+    ResolvedValue ref(expr.valueChildren[0], schema);
+    CompiledExpression::Program result;
+    K2_DTO_CAST_APPLY_FIELD_VALUE(_isNullCompileHelper, ref, result);
+    return result;
+}
+
+CompiledExpression::Program _compileIsExactType(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    // this op evaluates a field reference againts a string literal(the type in question)
+    if (expr.valueChildren.size() != 2 || expr.expressionChildren.size() > 0 ||
+        !expr.valueChildren[0].isReference() || expr.valueChildren[1].isReference()) {
+        throw InvalidExpressionException();
+    }
+    ResolvedValue ref(expr.valueChildren[0], schema);
+    ResolvedValue expTypeVal(expr.valueChildren[1], schema);
+    FieldType expected = std::get<1>(TypedOperand<FieldType>(expTypeVal).value).value();
+
+    // the outcome depends only on the schema
+    return [match = (expected == ref.type)](SKVRecord&) { return match; };
+}
+
+// The string operand of a STARTS_WITH, CONTAINS or ENDS_WITH. A field is read in place from each record
+struct StringOperand {
+    StringOperand(ResolvedValue& rv) : sfieldIndex(rv.sfieldIndex) {
+        if (sfieldIndex < 0) {
+            literal = std::get<1>(TypedOperand<String>(rv).value);
+        }
+    }
+
+    // the view is valid until the next call
+    std::optional<std::string_view> get(SKVRecord& rec) {
+        if (sfieldIndex >= 0) {
+            return rec.deserializeStringViewUnchecked(sfieldIndex, scratch);
+        }
+        return std::string_view(literal->data(), literal->size());
+    }
+
+    int sfieldIndex = -1;
+    std::optional<String> literal;
+    String scratch;
+};
+
+// The pattern operand of a STARTS_WITH, CONTAINS or ENDS_WITH. A literal is prepared for search once, and a
+// field for each record
+struct PatternOperand {
+    PatternOperand(ResolvedValue& rv) : sfieldIndex(rv.sfieldIndex) {
+        if (sfieldIndex < 0) {
+            needle = ByteNeedle(*std::get<1>(TypedOperand<String>(rv).value));
+        }
+    }
+
+    // Returns nullptr for a null field. The needle is valid until the next call
+    const ByteNeedle* get(SKVRecord& rec) {
+        if (sfieldIndex >= 0) {
+            auto view = rec.deserializeStringViewUnchecked(sfieldIndex, scratch);
+            if (!view) {
+                return nullptr;
+            }
+            needle = ByteNeedle(String(view->data(), view->size()));
+        }
+        return &needle;
+    }
+
+    int sfieldIndex = -1;
+    ByteNeedle needle;
+    String scratch;
+};
+
+template <typename StringOp>
+CompiledExpression::Program _compileStringOp(Expression& expr, const std::shared_ptr<Schema>& schema, StringOp strOp) {
+    // this op evaluates exactly two values only. It cannot be composed with other children
+    if (expr.valueChildren.size() != 2 || expr.expressionChildren.size() > 0) {
+        throw InvalidExpressionException();
+    }
+    ResolvedValue aVal(expr.valueChildren[0], schema);
+    ResolvedValue bVal(expr.valueChildren[1], schema);
+    if (aVal.type != FieldType::STRING || bVal.type != FieldType::STRING) {
+        auto msg = fmt::format("{} handler non-string fields: {}, {}", expr.op, aVal.type, bVal.type);
+        throw TypeMismatchException(msg);
+    }
+    return [a = StringOperand(aVal), b = PatternOperand(bVal), strOp](SKVRecord& rec) mutable {
+        auto aOpt = a.get(rec);
+        return strOp(aOpt, b.get(rec));
+    };
+}
+
+// AND, OR and XOR. The combination is applied only if both operands are non-null
+template <typename LogicalOp>
+CompiledExpression::Program _compileLogical(Expression& expr, const std::shared_ptr<Schema>& schema, LogicalOp logicalOp) {
+    // this op evaluates exactly two children only
+    if (expr.valueChildren.size() + expr.expressionChildren.size() != 2) {
+        throw InvalidExpressionException();
+    }
+    std::vector<ResolvedValue> values;
+    for (auto& value : expr.valueChildren) {
+        values.emplace_back(value, schema);
+    }
+    for (auto& rv : values) {
+        if (rv.type != FieldType::BOOL) {
+            auto msg = fmt::format("{} handler non-bool field: {}", expr.op, rv.type);
+            throw TypeMismatchException(msg);
+        }
+    }
+    // value operands are evaluated before the expression operands, same as in the interpreter
+    std::array<BoolOperand, 2> operands;
+    size_t i = 0;
+    for (auto& rv : values) {
+        operands[i++].value.emplace(rv);
+    }
+    for (auto& child : expr.expressionChildren) {
+        operands[i++].expr = _compileNode(child, schema);
+    }
+    return [a = std::move(operands[0]), b = std::move(operands[1]), logicalOp](SKVRecord& rec) mutable {
+        // always evaluate fully both operands to trigger exceptions if any
+        auto aOpt = a.get(rec);
+        auto bOpt = b.get(rec);
+        return aOpt.has_value() && bOpt.has_value() && logicalOp(*aOpt, *bOpt);
+    };
+}
+
+CompiledExpression::Program _compileNot(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    // this op evaluates exactly 1 child only
+    if (expr.valueChildren.size() + expr.expressionChildren.size() != 1) {
+        throw InvalidExpressionException();
+    }
+    if (expr.valueChildren.size() == 1) {
+        ResolvedValue aVal(expr.valueChildren[0], schema);
+        if (aVal.type != FieldType::BOOL) {
+            auto msg = fmt::format("NOT handler single non-bool field: {}", aVal.type);
+            throw TypeMismatchException(msg);
+        }
+        return [a = TypedOperand<bool>(aVal)](SKVRecord& rec) mutable {
+            auto& aOpt = std::get<1>(a.get(rec));
+            // no value means "false". That means we need to return not(false), i.e. "true" if not set
+            return !aOpt.has_value() || !(*aOpt);
+        };
+    }
+    return [child = _compileNode(expr.expressionChildren[0], schema)](SKVRecord& rec) {
+        return !child(rec);
+    };
+}
+
+// The literals of an IN, decoded once. They are kept in a hash set for the types with a std::hash, and in a
+// sorted vector for the others (decimals)
+template <typename T>
+struct LiteralSet {
+    static constexpr bool hashed = std::is_default_constructible_v<std::hash<T>>;
+
+    void add(T value) {
+        if (!(value == value)) {
+            // NaN is not equal to anything
+            return;
+        }
+        if constexpr (hashed) {
+            values.insert(std::move(value));
+        }
+        else {
+            values.push_back(std::move(value));
+        }
+    }
+
+    // must be called after the last add() and before the first contains()
+    void seal() {
+        if constexpr (!hashed) {
+            std::sort(values.begin(), values.end());
+            values.erase(std::unique(values.begin(), values.end()), values.end());
+        }
+    }
+
+    bool contains(const T& value) const {
+        if constexpr (hashed) {
+            return values.find(value) != values.end();
+        }
+        else {
+            auto it = std::lower_bound(values.begin(), values.end(), value);
+            return it != values.end() && *it == value;
+        }
+    }
+
+    std::conditional_t<hashed, std::unordered_set<T>, std::vector<T>> values;
+};
+
+template <typename A_TYPE>
+void _compileInHelper(ResolvedValue& a, std::vector<ResolvedValue>& literals, CompiledExpression::Program& result) {
+    LiteralSet<A_TYPE> set;
+    // literals of another type than A are compared the same way as by EQ. Each of these reads A again
+    std::vector<CompiledExpression::Program> others;
+    for (auto& lit : literals) {
+        if (lit.type == a.type) {
+            set.add(*std::get<1>(TypedOperand<A_TYPE>(lit).value));
+            continue;
+        }
+        TypedOperand<A_TYPE> aOp(a);
+        CompiledExpression::Program other;
+        K2_DTO_CAST_APPLY_FIELD_VALUE(_innerCompileCompareHelper, lit, aOp, Operation::EQ, other);
+        others.push_back(std::move(other));
+    }
+    set.seal();
+    result = [a = TypedOperand<A_TYPE>(a), set = std::move(set), others = std::move(others)](SKVRecord& rec) mutable {
+        auto& aOpt = std::get<1>(a.get(rec));
+        if (aOpt && set.contains(*aOpt)) {
+            return true;
+        }
+        for (auto& other : others) {
+            if (other(rec)) {
+                return true;
+            }
+        }
+        return false;
+    };
+}
+
+CompiledExpression::Program _compileIn(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    // this op evaluates a value against one or more literals. It cannot be composed with other children
+    if (expr.valueChildren.size() < 2 || expr.expressionChildren.size() > 0) {
+        throw InvalidExpressionException();
+    }
+    for (size_t i = 1; i < expr.valueChildren.size(); ++i) {
+        if (expr.valueChildren[i].isReference()) {
+            throw InvalidExpressionException();
+        }
+    }
+    ResolvedValue aVal(expr.valueChildren[0], schema);
+    std::vector<ResolvedValue> literals;
+    for (size_t i = 1; i < expr.valueChildren.size(); ++i) {
+        literals.emplace_back(expr.valueChildren[i], schema);
+    }
+    CompiledExpression::Program result;
+    K2_DTO_CAST_APPLY_FIELD_VALUE(_compileInHelper, aVal, literals, result);
+    return result;
+}
+
+CompiledExpression::Program _compile(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    switch (expr.op) {
+        case Operation::EQ:
+        case Operation::GT:
+        case Operation::GTE:
+        case Operation::LT:
+        case Operation::LTE:
+            return _compileCompare(expr, schema);
+        case Operation::IS_NULL:
+            return _compileIsNull(expr, schema);
+        case Operation::IS_EXACT_TYPE:
+            return _compileIsExactType(expr, schema);
+        case Operation::STARTS_WITH:
+            return _compileStringOp(expr, schema, _startsWithInPlace);
+        case Operation::CONTAINS:
+            return _compileStringOp(expr, schema, _containsInPlace);
+        case Operation::ENDS_WITH:
+            return _compileStringOp(expr, schema, _endsWithInPlace);
+        case Operation::AND:
+            return _compileLogical(expr, schema, [](bool a, bool b) { return a && b; });
+        case Operation::OR:
+            return _compileLogical(expr, schema, [](bool a, bool b) { return a || b; });
+        case Operation::XOR:
+            return _compileLogical(expr, schema, [](bool a, bool b) { return a != b; });
+        case Operation::NOT:
+            return _compileNot(expr, schema);
+        case Operation::IN:
+            return _compileIn(expr, schema);
+        case Operation::UNKNOWN: {
+            if (expr.valueChildren.size() + expr.expressionChildren.size() == 0) {
+                // empty expression - allow it
+                return [](SKVRecord&) { return true; };
+            }
+            throw InvalidExpressionException();
+        }
+        default:
+            throw InvalidExpressionException();
+    }
+}
+
+// Compiles the given node. If the node cannot be compiled for this schema, the resulting program raises
+// the compilation error when it runs. This keeps the order in which errors surface the same as in
+// Expression::evaluate(), which evaluates all children of a node before combining them.
+CompiledExpression::Program _compileNode(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    try {
+        return _compile(expr, schema);
+    }
+    catch (...) {
+        return [exc = std::current_exception()](SKVRecord&) -> bool {
+            std::rethrow_exception(exc);
+        };
+    }
+}
+
+// The values of one operand of a batch comparison: a field extracted from each record, or a literal repeated
+template <typename T>
+struct BatchColumn {
+    std::vector<T> values;
+    std::vector<uint8_t> present;
+};
+
+// The values compared by the batch kernels for a field type T. Decimals are compared as their ordinals, which
+// order the same way. NaN has no ordinal, so a batch which contains one is not compared by the kernels
+template <typename T>
+struct BatchValue {
+    using type = T;
+    static bool get(const T& value, T& out) {
+        out = value;
+        return true;
+    }
+};
+
+template <>
+struct BatchValue<std::decimal::decimal64> {
+    using type = int64_t;
+    static bool get(const std::decimal::decimal64& value, int64_t& out) { return DecimalOrdinal(value, out); }
+};
+
+template <>
+struct BatchValue<std::decimal::decimal128> {
+    using type = __int128;
+    static bool get(const std::decimal::decimal128& value, __int128& out) { return DecimalOrdinal(value, out); }
+};
+
+// One operand of a batch comparison
+template <typename T>
+struct BatchOperand {
+    using ValueT = typename BatchValue<T>::type;
+
+    BatchOperand(ResolvedValue& rv) : op(rv), nullLast(rv.nullLast) {}
+
+    // Loads the column for the given records. Returns false if a value cannot be compared by the kernels
+    bool load(std::vector<SKVRecord>& records) {
+        size_t n = records.size();
+        column.values.resize(n);
+        column.present.resize(n);
+        bool ordered = true;
+        if (op.sfieldIndex < 0) {
+            // literals are never null
+            ValueT literal{};
+            ordered = BatchValue<T>::get(*std::get<1>(op.value), literal);
+            std::fill(column.values.begin(), column.values.end(), literal);
+            std::fill(column.present.begin(), column.present.end(), 1);
+            return ordered;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            auto value = records[i].deserializeField<T>(op.sfieldIndex);
+            column.present[i] = value.has_value();
+            column.values[i] = ValueT{};
+            if (value) {
+                ordered &= BatchValue<T>::get(*value, column.values[i]);
+            }
+        }
+        return ordered;
+    }
+
+    TypedOperand<T> op;
+    bool nullLast;
+    BatchColumn<ValueT> column;
+};
+
+// The comparison kernel. It computes the same result as compareOptionals() for each pair of values, as the
+// two flags eq and gt, without branches so that the compiler can vectorize the loop
+template <Operation OP, typename T>
+void _compareKernel(const BatchColumn<T>& a, const BatchColumn<T>& b, uint8_t aNullLast, uint8_t bNullLast,
+                    std::vector<uint8_t>& out) {
+    size_t n = out.size();
+    const T* av = a.values.data();
+    const T* bv = b.values.data();
+    const uint8_t* ap = a.present.data();
+    const uint8_t* bp = b.present.data();
+    uint8_t* res = out.data();
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t both = ap[i] & bp[i];
+        uint8_t none = (ap[i] | bp[i]) ^ 1;
+        // NULLs compare as equal to each other, and before or after values according to their nullLast flag
+        uint8_t eq = (both & uint8_t(av[i] == bv[i])) | none;
+        uint8_t gt = (both & uint8_t(av[i] > bv[i])) | ((ap[i] ^ 1) & bp[i] & bNullLast) |
+                     (ap[i] & (bp[i] ^ 1) & (aNullLast ^ 1));
+        if constexpr (OP == Operation::EQ) {
+            res[i] = eq;
+        }
+        else if constexpr (OP == Operation::GT) {
+            res[i] = gt;
+        }
+        else if constexpr (OP == Operation::GTE) {
+            res[i] = eq | gt;
+        }
+        else if constexpr (OP == Operation::LT) {
+            res[i] = (eq | gt) ^ 1;
+        }
+        else {
+            res[i] = gt ^ 1;
+        }
+    }
+}
+
+template <typename T>
+CompiledExpression::BatchProgram _makeBatchCompare(Expression& expr, const std::shared_ptr<Schema>& schema,
+                                                   ResolvedValue& aVal, ResolvedValue& bVal) {
+    using ValueT = typename BatchValue<T>::type;
+    auto kernel = _compareKernel<Operation::EQ, ValueT>;
+    switch (expr.op) {
+        case Operation::EQ: kernel = _compareKernel<Operation::EQ, ValueT>; break;
+        case Operation::GT: kernel = _compareKernel<Operation::GT, ValueT>; break;
+        case Operation::GTE: kernel = _compareKernel<Operation::GTE, ValueT>; break;
+        case Operation::LT: kernel = _compareKernel<Operation::LT, ValueT>; break;
+        case Operation::LTE: kernel = _compareKernel<Operation::LTE, ValueT>; break;
+        default:
+            throw InvalidExpressionException();
+    }
+    if constexpr (std::is_same_v<ValueT, T>) {
+        return [a = BatchOperand<T>(aVal), b = BatchOperand<T>(bVal), kernel](std::vector<SKVRecord>& records,
+                                                                               std::vector<uint8_t>& out) mutable {
+            a.load(records);
+            b.load(records);
+            kernel(a.column, b.column, a.nullLast, b.nullLast, out);
+        };
+    }
+    else {
+        // batches with values that have no ordinal are evaluated record by record
+        return [a = BatchOperand<T>(aVal), b = BatchOperand<T>(bVal), kernel, program = _compile(expr, schema)]
+                (std::vector<SKVRecord>& records, std::vector<uint8_t>& out) mutable {
+            bool ordered = a.load(records);
+            ordered &= b.load(records);
+            if (ordered) {
+                kernel(a.column, b.column, a.nullLast, b.nullLast, out);
+                return;
+            }
+            for (size_t i = 0; i < records.size(); ++i) {
+                out[i] = program(records[i]);
+            }
+        };
+    }
+}
+
+// Evaluates a node record by record, for the nodes which have no batch kernel
+CompiledExpression::BatchProgram _makeBatchFallback(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    return [program = _compile(expr, schema)](std::vector<SKVRecord>& records, std::vector<uint8_t>& out) {
+        for (size_t i = 0; i < records.size(); ++i) {
+            out[i] = program(records[i]);
+        }
+    };
+}
+
+// Compiles the given node for batch evaluation. Throws if the node cannot be compiled for the schema
+CompiledExpression::BatchProgram _compileBatch(Expression& expr, const std::shared_ptr<Schema>& schema) {
+    switch (expr.op) {
+        case Operation::EQ:
+        case Operation::GT:
+        case Operation::GTE:
+        case Operation::LT:
+        case Operation::LTE: {
+            if (expr.valueChildren.size() != 2 || expr.expressionChildren.size() > 0) {
+                throw InvalidExpressionException();
+            }
+            ResolvedValue aVal(expr.valueChildren[0], schema);
+            ResolvedValue bVal(expr.valueChildren[1], schema);
+            if (aVal.type == bVal.type && (aVal.val.isReference() || bVal.val.isReference())) {
+                // kernels are provided for fields compared with fields or literals of the same numeric type
+                switch (aVal.type) {
+                    case FieldType::INT16T: return _makeBatchCompare<int16_t>(expr, schema, aVal, bVal);
+                    case FieldType::INT32T: return _makeBatchCompare<int32_t>(expr, schema, aVal, bVal);
+                    case FieldType::INT64T: return _makeBatchCompare<int64_t>(expr, schema, aVal, bVal);
+                    case FieldType::FLOAT: return _makeBatchCompare<float>(expr, schema, aVal, bVal);
+                    case FieldType::DOUBLE: return _makeBatchCompare<double>(expr, schema, aVal, bVal);
+                    case FieldType::DECIMAL64: return _makeBatchCompare<std::decimal::decimal64>(expr, schema, aVal, bVal);
+                    case FieldType::DECIMAL128: return _makeBatchCompare<std::decimal::decimal128>(expr, schema, aVal, bVal);
+                    default: break;
+                }
+            }
+            return _makeBatchFallback(expr, schema);
+        }
+        case Operation::AND:
+        case Operation::OR:
+        case Operation::XOR: {
+            if (expr.valueChildren.size() != 0 || expr.expressionChildren.size() != 2) {
+                return _makeBatchFallback(expr, schema);
+            }
+            // both children are always evaluated fully, same as in the interpreter
+            return [op = expr.op, a = _compileBatch(expr.expressionChildren[0], schema),
+                    b = _compileBatch(expr.expressionChildren[1], schema), bsel = std::vector<uint8_t>()]
+                    (std::vector<SKVRecord>& records, std::vector<uint8_t>& out) mutable {
+                a(records, out);
+                bsel.resize(records.size());
+                b(records, bsel);
+                size_t n = out.size();
+                uint8_t* res = out.data();
+                const uint8_t* bres = bsel.data();
+                if (op == Operation::AND) {
+                    for (size_t i = 0; i < n; ++i) res[i] &= bres[i];
+                }
+                else if (op == Operation::OR) {
+                    for (size_t i = 0; i < n; ++i) res[i] |= bres[i];
+                }
+                else {
+                    for (size_t i = 0; i < n; ++i) res[i] ^= bres[i];
+                }
+            };
+        }
+        case Operation::NOT: {
+            if (expr.valueChildren.size() != 0 || expr.expressionChildren.size() != 1) {
+                return _makeBatchFallback(expr, schema);
+            }
+            return [child = _compileBatch(expr.expressionChildren[0], schema)]
+                    (std::vector<SKVRecord>& records, std::vector<uint8_t>& out) {
+                child(records, out);
+                size_t n = out.size();
+                uint8_t* res = out.data();
+                for (size_t i = 0; i < n; ++i) res[i] ^= 1;
+            };
+        }
+        default:
+            return _makeBatchFallback(expr, schema);
+    }
+}
+
+CompiledExpression::CompiledExpression(Expression& expr) : _expr(expr) {
+}
+
+CompiledExpression::_Compiled& CompiledExpression::_getCompiled(const std::shared_ptr<Schema>& schema) {
+    for (auto& compiled : _programs) {
+        if (compiled.schema == schema) {
+            return compiled;
+        }
+    }
+    _programs.push_back(_Compiled{.schema = schema, .program = _compileNode(_expr, schema)});
+    return _programs.back();
+}
+
+bool CompiledExpression::evaluate(SKVRecord& rec) {
+    return _getCompiled(rec.schema).program(rec);
+}
+
+bool CompiledExpression::evaluate(std::vector<SKVRecord>& records, std::vector<uint8_t>& selection) {
+    selection.resize(records.size());
+    if (records.empty()) {
+        return true;
+    }
+    for (auto& rec : records) {
+        if (rec.schema != records[0].schema) {
+            return false;
+        }
+    }
+
+    auto& compiled = _getCompiled(records[0].schema);
+    if (!compiled.batchCompiled) {
+        compiled.batchCompiled = true;
+        try {
+            compiled.batch = _compileBatch(_expr, compiled.schema);
+        }
+        catch (...) {
+            // leave it to the per-record evaluation to report the error for each record
+        }
+    }
+    if (!compiled.batch) {
+        return false;
+    }
+    compiled.batch(records, selection);
+    return true;
+}
+
+// The bounds on one key field which key-range narrowing found in a filter, as key strings
+struct _KeyFieldBounds {
+    std::optional<String> eq;
+    std::optional<String> lower;
+    std::optional<String> upper;
+};
+
+template <typename T>
+void _literalToKeyString(const Value& value, std::optional<String>& result) {
+    Payload literal = const_cast<Payload&>(value.literal).shareAll();
+    T obj{};
+    if (!literal.read(obj)) {
+        return;
+    }
+    try {
+        result = FieldToKeyString<T>(obj);
+    }
+    catch (FieldNotSupportedAsKeyException&) {
+    }
+    catch (SKVKeyEncodingException&) {
+    }
+}
+
+// Collects the bounds from a comparison between a key field and a literal of the field's type
+void _collectComparisonBounds(const Expression& expr, const Schema& schema, std::vector<_KeyFieldBounds>& bounds) {
+    if (expr.valueChildren.size() != 2 || expr.expressionChildren.size() > 0 ||
+        expr.valueChildren[0].isReference() == expr.valueChildren[1].isReference()) {
+        return;
+    }
+    bool refFirst = expr.valueChildren[0].isReference();
+    const Value& ref = expr.valueChildren[refFirst ? 0 : 1];
+    const Value& lit = expr.valueChildren[refFirst ? 1 : 0];
+    const auto& slots = schema.keySlots();
+    for (size_t i = 0; i < schema.fields.size(); ++i) {
+        if (schema.fields[i].name != ref.fieldName) {
+            continue;
+        }
+        if (slots[i] < 0 || schema.fields[i].type != lit.type) {
+            return;
+        }
+        std::optional<String> key;
+        K2_DTO_CAST_APPLY_FIELD_VALUE(_literalToKeyString, lit, key);
+        if (!key) {
+            return;
+        }
+        // the comparison as ref OP literal
+        Operation op = expr.op;
+        if (!refFirst) {
+            op = op == Operation::GT ? Operation::LT : op == Operation::GTE ? Operation::LTE :
+                 op == Operation::LT ? Operation::GT : op == Operation::LTE ? Operation::GTE : op;
+        }
+        // exclusive bounds are kept as inclusive, which only widens the range
+        auto& b = bounds[slots[i]];
+        if (op == Operation::EQ) {
+            if (!b.eq) b.eq = std::move(key);
+        }
+        else if (op == Operation::GT || op == Operation::GTE) {
+            if (!b.lower || compareBytes(*key, *b.lower) > 0) b.lower = std::move(key);
+        }
+        else if (!b.upper || compareBytes(*key, *b.upper) < 0) {
+            b.upper = std::move(key);
+        }
+        return;
+    }
+}
+
+// Collects the bounds from an IN of a key field over literals of the field's type: the smallest and the largest
+// of the literals, or an EQ if there is only one
+void _collectInBounds(const Expression& expr, const Schema& schema, std::vector<_KeyFieldBounds>& bounds) {
+    if (expr.valueChildren.size() < 2 || expr.expressionChildren.size() > 0 || !expr.valueChildren[0].isReference()) {
+        return;
+    }
+    const Value& ref = expr.valueChildren[0];
+    int32_t i = schema.fieldIndex(ref.fieldName);
+    if (i < 0 || schema.keySlots()[i] < 0) {
+        return;
+    }
+    std::optional<String> low;
+    std::optional<String> high;
+    for (size_t c = 1; c < expr.valueChildren.size(); ++c) {
+        const Value& lit = expr.valueChildren[c];
+        if (lit.isReference() || schema.fields[i].type != lit.type) {
+            return;
+        }
+        std::optional<String> key;
+        K2_DTO_CAST_APPLY_FIELD_VALUE(_literalToKeyString, lit, key);
+        if (!key) {
+            return;
+        }
+        if (!low || compareBytes(*key, *low) < 0) low = *key;
+        if (!high || compareBytes(*key, *high) > 0) high = std::move(key);
+    }
+    auto& b = bounds[schema.keySlots()[i]];
+    if (compareBytes(*low, *high) == 0) {
+        if (!b.eq) b.eq = std::move(low);
+        return;
+    }
+    if (!b.lower || compareBytes(*low, *b.lower) > 0) b.lower = std::move(low);
+    if (!b.upper || compareBytes(*high, *b.upper) < 0) b.upper = std::move(high);
+}
+
+// Collects the bounds from the conjunction at the top of the filter
+void _collectKeyBounds(const Expression& expr, const Schema& schema, std::vector<_KeyFieldBounds>& bounds) {
+    switch (expr.op) {
+        case Operation::AND:
+            if (expr.valueChildren.size() + expr.expressionChildren.size() != 2) {
+                return;
+            }
+            for (auto& child : expr.expressionChildren) {
+                _collectKeyBounds(child, schema, bounds);
+            }
+            return;
+        case Operation::EQ:
+        case Operation::GT:
+        case Operation::GTE:
+        case Operation::LT:
+        case Operation::LTE:
+            _collectComparisonBounds(expr, schema, bounds);
+            return;
+        case Operation::IN:
+            _collectInBounds(expr, schema, bounds);
+            return;
+        default:
+            return;
+    }
+}
+
+void narrowKeyRange(const Expression& filter, const Schema& schema, bool reverse, Key& start, Key& end) {
+    size_t partitionFields = schema.partitionKeyFields.size();
+    std::vector<_KeyFieldBounds> bounds(partitionFields + schema.rangeKeyFields.size());
+    if (bounds.empty()) {
+        return;
+    }
+    _collectKeyBounds(filter, schema, bounds);
+    if (!bounds[0].eq && !bounds[0].lower && !bounds[0].upper) {
+        // nothing constrains the first key field
+        return;
+    }
+
+    // The key fields pinned by EQ from the first one form a prefix of the matching keys, and the bounds on the
+    // field after them bound the keys with that prefix. No key continues a prefix with 0xFF 0xFF since a
+    // NULL_LAST type byte is always followed by ESCAPE
+    const String pastPrefix("\xff\xff", 2);
+    String partitionKey;
+    String prefix;
+    std::optional<String> lower;
+    std::optional<String> upper;
+    bool inRangeKey = false;
+    for (size_t slot = 0; slot < bounds.size() && !lower; ++slot) {
+        if (slot == partitionFields) {
+            partitionKey = std::move(prefix);
+            prefix = String();
+            inRangeKey = true;
+        }
+        auto& b = bounds[slot];
+        if (b.eq) {
+            prefix += *b.eq;
+            continue;
+        }
+        lower = prefix + (b.lower ? *b.lower : String());
+        upper = prefix + (b.upper ? *b.upper : String()) + pastPrefix;
+    }
+    if (!lower) {
+        // all key fields are pinned
+        lower = prefix;
+        upper = prefix + pastPrefix;
+    }
+    if (!lower->empty()) {
+        // every encoded field ends with ESCAPE TERM. Lowering the TERM keeps the bound below the keys which
+        // continue it, so that it also works as the exclusive low end of a reverse scan
+        (*lower)[lower->size() - 1] = '\0';
+    }
+
+    Key low = inRangeKey ? Key{start.schemaName, partitionKey, std::move(*lower)} :
+                           Key{start.schemaName, std::move(*lower), ""};
+    Key high = inRangeKey ? Key{start.schemaName, std::move(partitionKey), std::move(*upper)} :
+                            Key{start.schemaName, std::move(*upper), ""};
+    if (!reverse) {
+        if (start < low) start = std::move(low);
+        if (end.partitionKey == "" || high < end) end = std::move(high);
+        if (end < start) end = start;
+    }
+    else {
+        if (start.partitionKey == "" || high < start) start = std::move(high);
+        if (end < low) end = std::move(low);
+        if (start < end) end = start;
+    }
+}
+
+Expression copyExpression(const Expression& expr) {
+    Expression result{.op = expr.op, .valueChildren = {}, .expressionChildren = {}};
+    for (const Value& value : expr.valueChildren) {
+        result.valueChildren.push_back(Value{.fieldName = value.fieldName, .type = value.type,
+                                             .literal = const_cast<Payload&>(value.literal).copy()});
+    }
+    for (const Expression& child : expr.expressionChildren) {
+        result.expressionChildren.push_back(copyExpression(child));
+    }
+    return result;
+}
+
+void collectLiterals(const Expression& filter, std::vector<Value>& literals) {
+    for (const Value& value : filter.valueChildren) {
+        if (!value.isReference()) {
+            literals.push_back(Value{.fieldName = "", .type = value.type,
+                                     .literal = const_cast<Payload&>(value.literal).shareAll()});
+        }
+    }
+    for (const Expression& child : filter.expressionChildren) {
+        collectLiterals(child, literals);
+    }
+}
+
+Expression _bindLiterals(const Expression& filter, std::vector<Value>& literals, size_t& next) {
+    Expression result{.op = filter.op, .valueChildren = {}, .expressionChildren = {}};
+    for (const Value& value : filter.valueChildren) {
+        if (value.isReference()) {
+            result.valueChildren.push_back(Value{.fieldName = value.fieldName, .type = value.type,
+                                                 .literal = Payload(Payload::DefaultAllocator)});
+            continue;
+        }
+        if (next >= literals.size()) {
+            throw InvalidExpressionException();
+        }
+        result.valueChildren.push_back(std::move(literals[next++]));
+    }
+    for (const Expression& child : filter.expressionChildren) {
+        result.expressionChildren.push_back(_bindLiterals(child, literals, next));
+    }
+    return result;
+}
+
+Expression bindLiterals(const Expression& filter, std::vector<Value>& literals) {
+    size_t next = 0;
+    Expression result = _bindLiterals(filter, literals, next);
+    if (next != literals.size()) {
+        throw InvalidExpressionException();
+    }
+    return result;
+}
+
+void _hashCombine(size_t& hash, size_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+}
+
+size_t shapeHash(const Expression& filter) {
+    size_t hash = 0;
+    _hashCombine(hash, static_cast<size_t>(filter.op));
+    for (const Value& value : filter.valueChildren) {
+        _hashCombine(hash, static_cast<size_t>(value.type));
+        _hashCombine(hash, std::hash<String>()(value.fieldName));
+    }
+    // the number of children separates the values of an expression from those of its children
+    _hashCombine(hash, filter.valueChildren.size());
+    _hashCombine(hash, filter.expressionChildren.size());
+    for (const Expression& child : filter.expressionChildren) {
+        _hashCombine(hash, shapeHash(child));
+    }
+    return hash;
+}
+
 } // ns expression
 } // dto
 } // k2
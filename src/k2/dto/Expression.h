@@ -61,6 +61,7 @@ K2_DEF_ENUM(Operation,
     OR,             /* A OR B. Each of A and B must be a boolean value, or an expression */
     XOR,            /* A XOR B. Each of A and B must be a boolean value, or an expression */
     NOT,            /* NOT A. A must be a boolean value, or an expression */
+    IN,             /* A IN (B, C, ...). A must be a value, the rest literals comparable with A */
     UNKNOWN
 );
 
@@ -164,8 +165,75 @@ struct Expression {
     bool OR_handler(SKVRecord& rec);
     bool XOR_handler(SKVRecord& rec);
     bool NOT_handler(SKVRecord& rec);
+    bool IN_handler(SKVRecord& rec);
 };
 
+// An Expression compiled for evaluation over many records, e.g. by a query scan. The expression tree is
+// compiled once per schema seen: references are resolved to field indexes, literals are decoded into
+// typed values and each node becomes a closure calling its children directly. The result and the exceptions
+// of evaluate() are the same as those of Expression::evaluate(); errors found while compiling (e.g. the
+// field of a reference does not exist in the schema) are raised when a record of that schema is evaluated.
+// The referenced Expression must outlive this object.
+class CompiledExpression {
+public:
+    using Program = std::function<bool(SKVRecord&)>;
+    // Evaluates a batch of records, setting the i-th selection entry to 1 if the i-th record passes
+    using BatchProgram = std::function<void(std::vector<SKVRecord>&, std::vector<uint8_t>&)>;
+
+    CompiledExpression(Expression& expr);
+
+    // Evaluates the given record against the compiled expression. See Expression::evaluate
+    bool evaluate(SKVRecord& rec);
+
+    // Evaluates a batch of records column by column: the fields referenced by numeric comparisons are
+    // extracted into contiguous typed arrays and the comparisons and logical operations run as tight loops
+    // over those arrays, producing one selection byte per record.
+    // Returns false, without evaluating, if the records have different schemas or the expression cannot be
+    // compiled for their schema. Any exception thrown means the same as for evaluate(), but it may come from
+    // any of the records. In both cases, callers which need per-record results should use evaluate() instead.
+    bool evaluate(std::vector<SKVRecord>& records, std::vector<uint8_t>& selection);
+
+private:
+    struct _Compiled {
+        std::shared_ptr<Schema> schema;
+        Program program;
+        // compiled on first use. Empty if the expression cannot be compiled for the schema
+        BatchProgram batch;
+        bool batchCompiled = false;
+    };
+    _Compiled& _getCompiled(const std::shared_ptr<Schema>& schema);
+
+    Expression& _expr;
+    // The compiled programs for each schema we've evaluated records of. Queries rarely see more
+    // than a couple of schema versions so a linear search is cheaper than a map
+    std::vector<_Compiled> _programs;
+};
+
+// Narrows the key range of a scan over the records of the given schema to a range which holds all of the records
+// that can pass the filter. The range is derived from the EQ, GT, GTE, LT and LTE comparisons of key fields with
+// literals of the field's own type which are ANDed at the top of the filter: the key fields pinned by EQ from
+// the first one, and the bounds on the key field after them. For a forward scan start is the inclusive and end
+// the exclusive (empty for unbounded) end of the range. For a reverse scan start is the high end (empty for the
+// end of the collection) and end the exclusive low end. The filter still needs to be applied to the records
+void narrowKeyRange(const Expression& filter, const Schema& schema, bool reverse, Key& start, Key& end);
+
+// Prepared queries send the filter to a partition once, and after that only the literals of the queries with
+// the same filter shape(the filter with its literals taken out). The literals of a filter are its non-reference
+// values, in the depth-first order which visits the values of an expression before its children.
+
+// Returns a deep copy of the expression. The literals are copied into new buffers
+Expression copyExpression(const Expression& expr);
+
+// Appends copies of the literals of the filter to literals
+void collectLiterals(const Expression& filter, std::vector<Value>& literals);
+
+// Returns a copy of the given filter in which the literals are replaced, in order, by the given ones, which are
+// moved from. Throws InvalidExpressionException if the number of literals doesn't match the filter
+Expression bindLiterals(const Expression& filter, std::vector<Value>& literals);
+
+// A hash of the filter shape: the operations, references and literal types but not the literal values
+size_t shapeHash(const Expression& filter);
+
 // helper builder: creates a value literal
 template <typename T>
 inline Value makeValueLiteral(T&& literal) {
@@ -0,0 +1,100 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "FieldBitmap.h"
+
+namespace k2 {
+namespace dto {
+
+FieldBitmap::FieldBitmap(size_t size, bool value) : _size(size) {
+    if (_wordsFor(size) > 1) {
+        _overflow.resize(_wordsFor(size) - 1, 0);
+    }
+    if (value) {
+        for (size_t i = 0; i < size; ++i) {
+            set(i, true);
+        }
+    }
+}
+
+FieldBitmap::FieldBitmap(std::initializer_list<bool> bits) : FieldBitmap(bits.size(), false) {
+    size_t i = 0;
+    for (bool bit : bits) {
+        set(i++, bit);
+    }
+}
+
+void FieldBitmap::__writeFields(Payload& payload) const {
+    payload.write(_size);
+    if (_size == 0) {
+        return;
+    }
+    payload.write(_inline);
+    for (uint64_t word : _overflow) {
+        payload.write(word);
+    }
+}
+
+bool FieldBitmap::__readFields(Payload& payload) {
+    if (!payload.read(_size)) {
+        return false;
+    }
+    _inline = 0;
+    _overflow.clear();
+    if (_size == 0) {
+        return true;
+    }
+    if (!payload.read(_inline)) {
+        return false;
+    }
+    _overflow.resize(_wordsFor(_size) - 1, 0);
+    for (uint64_t& word : _overflow) {
+        if (!payload.read(word)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+String FieldBitmap::toString() const {
+    String result(String::initialized_later{}, _size);
+    for (size_t i = 0; i < _size; ++i) {
+        result[i] = test(i) ? '1' : '0';
+    }
+    return result;
+}
+
+void to_json(nlohmann::json& j, const FieldBitmap& o) {
+    j = nlohmann::json{{"bits", o.toString()}};
+}
+
+void from_json(const nlohmann::json& j, FieldBitmap& o) {
+    String bits = j.at("bits").get<String>();
+    o = FieldBitmap(bits.size(), false);
+    for (size_t i = 0; i < bits.size(); ++i) {
+        o.set(i, bits[i] == '1');
+    }
+}
+
+} // ns dto
+} // ns k2
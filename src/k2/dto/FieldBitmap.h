@@ -0,0 +1,120 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <initializer_list>
+#include <vector>
+
+#include <k2/common/Common.h>
+#include <k2/transport/PayloadSerialization.h>
+
+namespace k2 {
+namespace dto {
+
+// A bitmap with one bit per field of a schema, e.g. the fields excluded from an SKVRecord.
+// The bits of the first 64 fields are kept inline, so that the records of most schemas don't need
+// an allocation, and the bits of any further fields are kept in overflow words.
+// On the wire, the bitmap is the number of bits followed by the words which hold them.
+class FieldBitmap {
+public:
+    static constexpr size_t BitsPerWord = 64;
+
+    // Reference to a single bit, so that bits can be assigned with bitmap[i] = value
+    class Reference {
+    public:
+        Reference& operator=(bool value) {
+            _bitmap.set(_index, value);
+            return *this;
+        }
+        Reference& operator=(const Reference& other) {
+            return *this = (bool)other;
+        }
+        operator bool() const { return _bitmap.test(_index); }
+
+    private:
+        friend class FieldBitmap;
+        Reference(FieldBitmap& bitmap, size_t index) : _bitmap(bitmap), _index(index) {}
+        FieldBitmap& _bitmap;
+        size_t _index;
+    };
+
+    FieldBitmap() = default;
+    FieldBitmap(size_t size, bool value);
+    FieldBitmap(std::initializer_list<bool> bits);
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    bool test(size_t index) const {
+        return index < BitsPerWord ? (_inline >> index) & 1 : (_overflow[index / BitsPerWord - 1] >> (index % BitsPerWord)) & 1;
+    }
+    void set(size_t index, bool value) {
+        uint64_t& word = index < BitsPerWord ? _inline : _overflow[index / BitsPerWord - 1];
+        uint64_t mask = uint64_t(1) << (index % BitsPerWord);
+        word = value ? word | mask : word & ~mask;
+    }
+
+    bool operator[](size_t index) const { return test(index); }
+    Reference operator[](size_t index) { return Reference(*this, index); }
+
+    bool operator==(const FieldBitmap& o) const {
+        return _size == o._size && _inline == o._inline && _overflow == o._overflow;
+    }
+    bool operator!=(const FieldBitmap& o) const { return !operator==(o); }
+
+    // Payload serialization
+    struct __K2PayloadSerializableTraitTag__ {};
+    void __writeFields(Payload& payload) const;
+    bool __readFields(Payload& payload);
+    size_t __serializedSize() const {
+        return sizeof(_size) + (_size == 0 ? 0 : sizeof(_inline) + _overflow.size() * sizeof(uint64_t));
+    }
+
+    // Formatted as a string of 0s and 1s, in field order
+    String toString() const;
+
+    template <typename OStream_T>
+    friend OStream_T& operator<<(OStream_T& os, const FieldBitmap& o) {
+        if constexpr (std::is_same<OStream_T, std::ostream>::value) {
+            fmt::print(os, FMT_STRING("{}"), o.toString());
+        } else {
+            fmt::format_to(os.out(), FMT_COMPILE("{}"), o.toString());
+        }
+        return os;
+    }
+
+    friend void to_json(nlohmann::json& j, const FieldBitmap& o);
+    friend void from_json(const nlohmann::json& j, FieldBitmap& o);
+
+private:
+    // the number of words needed for the given number of bits, including the inline word
+    static size_t _wordsFor(size_t bits) { return (bits + BitsPerWord - 1) / BitsPerWord; }
+
+    uint32_t _size = 0;
+    uint64_t _inline = 0;
+    std::vector<uint64_t> _overflow;
+};
+
+} // ns dto
+} // ns k2
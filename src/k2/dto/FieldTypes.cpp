@@ -53,43 +53,28 @@ template <> FieldType TToFieldType<FieldType>() { return FieldType::FIELD_TYPE;
 
 // All conversion assume ascending ordering
 
-template <> String FieldToKeyString<String>(const String& field) {
-    size_t pos = 0;
-    std::vector<size_t> foundNulls;
-
-    while (pos != String::npos && pos < field.size()) {
-        pos = field.find(ESCAPE, pos);
-        if (pos != String::npos) {
-            foundNulls.push_back(pos);
-            ++pos;
-        }
-    }
-
+template <> size_t KeyStringSize<String>(const String& field) {
     // Size is original +1 type byte +1 byte per null and +2 terminator bytes
-    String escapedString(String::initialized_later(), field.size() + foundNulls.size() + 3);
-    size_t originalCursor = 0;
-    size_t escapedCursor = 1;
-    for (size_t nullPos : foundNulls) {
-        std::copy(field.begin() + originalCursor, field.begin() + nullPos + 1,
-                  escapedString.begin() + escapedCursor);
-
-        size_t count = nullPos - originalCursor + 1;
-        originalCursor += count;
-        escapedCursor += count;
-        escapedString[escapedCursor] = ESCAPED_NULL;
-        ++escapedCursor;
-    }
+    return field.size() + std::count(field.begin(), field.end(), ESCAPE) + 3;
+}
 
-    if (originalCursor < field.size()) {
-        std::copy(field.begin() + originalCursor, field.end(),
-                  escapedString.begin() + escapedCursor);
+template <> char* EncodeKeyString<String>(const String& field, char* out) {
+    *out++ = (char) FieldType::STRING;
+    const char* pos = field.begin();
+    const char* end = field.end();
+    while (pos != end) {
+        const char* nullPos = (const char*) std::memchr(pos, ESCAPE, end - pos);
+        if (nullPos == nullptr) {
+            out = std::copy(pos, end, out);
+            break;
+        }
+        out = std::copy(pos, nullPos + 1, out);
+        *out++ = ESCAPED_NULL;
+        pos = nullPos + 1;
     }
-
-    escapedString[0] = (char) FieldType::STRING;
-    escapedString[escapedString.size() - 2] = ESCAPE;
-    escapedString[escapedString.size() - 1] = TERM;
-
-    return escapedString;
+    *out++ = ESCAPE;
+    *out++ = TERM;
+    return out;
 }
 
 // Strategy for intxx_t conversions:
@@ -99,10 +84,10 @@ template <> String FieldToKeyString<String>(const String& field) {
 // If originally -, subtract each byte from 255
 // 0 is encoded as +0
 
-template <> String FieldToKeyString<int16_t>(const int16_t& field)
-{
-    // type byte + sign byte + 2 bytes + ESCAPE + TERM
-    String s(String::initialized_later(), 6);
+// type byte + sign byte + 2 bytes + ESCAPE + TERM
+template <> size_t KeyStringSize<int16_t>(const int16_t&) { return 6; }
+
+template <> char* EncodeKeyString<int16_t>(const int16_t& field, char* s) {
     s[0] = (char) FieldType::INT16T;
 
     if (field >= 0) {
@@ -119,13 +104,13 @@ template <> String FieldToKeyString<int16_t>(const int16_t& field)
     s[4] = ESCAPE;
     s[5] = TERM;
 
-    return s;
+    return s + 6;
 }
 
-template <> String FieldToKeyString<int64_t>(const int64_t& field)
-{
-    // type byte + sign byte + 8 bytes + ESCAPE + TERM
-    String s(String::initialized_later(), 12);
+// type byte + sign byte + 8 bytes + ESCAPE + TERM
+template <> size_t KeyStringSize<int64_t>(const int64_t&) { return 12; }
+
+template <> char* EncodeKeyString<int64_t>(const int64_t& field, char* s) {
     s[0] = (char) FieldType::INT64T;
 
     if (field >= 0) {
@@ -154,12 +139,13 @@ template <> String FieldToKeyString<int64_t>(const int64_t& field)
     s[10] = ESCAPE;
     s[11] = TERM;
 
-    return s;
+    return s + 12;
 }
 
-template <> String FieldToKeyString<int32_t>(const int32_t& field) {
-    // type byte + sign byte + 4 bytes + ESCAPE + TERM
-    String s(String::initialized_later(), 8);
+// type byte + sign byte + 4 bytes + ESCAPE + TERM
+template <> size_t KeyStringSize<int32_t>(const int32_t&) { return 8; }
+
+template <> char* EncodeKeyString<int32_t>(const int32_t& field, char* s) {
     s[0] = (char) FieldType::INT32T;
 
     if (field >= 0) {
@@ -180,16 +166,132 @@ template <> String FieldToKeyString<int32_t>(const int32_t& field) {
     s[6] = ESCAPE;
     s[7] = TERM;
 
-    return s;
+    return s + 8;
 }
 
-template <> String FieldToKeyString<bool>(const bool& field) {
-    String s(String::initialized_later(), 4);
+template <> size_t KeyStringSize<bool>(const bool&) { return 4; }
+
+template <> char* EncodeKeyString<bool>(const bool& field, char* s) {
     s[0] = (char) FieldType::BOOL;
     s[1] = field ? 1 : 0;
     s[2] = ESCAPE;
     s[3] = TERM;
-    return s;
+    return s + 4;
+}
+
+// Decimal ordinals. Both types are BID-encoded (IEEE 754-2008 binary integer decimal): a sign bit, a biased
+// exponent and a binary coefficient. The magnitude of the ordinal is
+//     (exponent - digit shift + shift offset) * 10^precision + coefficient scaled to precision digits
+// so that magnitudes compare first by the position of the leading digit and then by the digits. Zero is 0 and
+// the infinities lie past every finite value. Non-canonical coefficients are zero, as in the standard
+static constexpr uint64_t DECIMAL64_PRECISION = 10000000000000000ull; // 10^16
+static constexpr unsigned __int128 DECIMAL128_PRECISION =
+    (unsigned __int128)10000000000000000ull * 10000000000000000ull * 100; // 10^34
+
+bool DecimalOrdinal(const std::decimal::decimal64& value, int64_t& ordinal) {
+    auto raw = const_cast<std::decimal::decimal64&>(value).__getval();
+    uint64_t bits;
+    std::memcpy(&bits, &raw, sizeof(bits));
+    uint64_t combination = (bits >> 58) & 0x1F;
+    if (combination == 0x1F) {
+        return false;
+    }
+
+    uint64_t magnitude = 0;
+    if (combination == 0x1E) {
+        // infinity: one past the largest exponent
+        magnitude = 784 * DECIMAL64_PRECISION;
+    }
+    else {
+        int64_t exponent;
+        uint64_t coefficient;
+        if (((bits >> 61) & 0x3) == 0x3) {
+            exponent = (bits >> 51) & 0x3FF;
+            coefficient = (1ull << 53) | (bits & ((1ull << 51) - 1));
+        }
+        else {
+            exponent = (bits >> 53) & 0x3FF;
+            coefficient = bits & ((1ull << 53) - 1);
+        }
+        if (coefficient > 0 && coefficient < DECIMAL64_PRECISION) {
+            // scale to 16 digits. The shifted exponent is in [-15, 767], and in [1, 783] once offset
+            while (coefficient < DECIMAL64_PRECISION / 10) {
+                coefficient *= 10;
+                --exponent;
+            }
+            magnitude = (exponent + 16) * DECIMAL64_PRECISION + coefficient;
+        }
+    }
+    ordinal = (bits >> 63) ? -(int64_t)magnitude : (int64_t)magnitude;
+    return true;
+}
+
+bool DecimalOrdinal(const std::decimal::decimal128& value, __int128& ordinal) {
+    auto raw = const_cast<std::decimal::decimal128&>(value).__getval();
+    uint64_t words[2];  // little endian: words[1] holds the sign, exponent and top of the coefficient
+    std::memcpy(words, &raw, sizeof(words));
+    uint64_t combination = (words[1] >> 58) & 0x1F;
+    if (combination == 0x1F) {
+        return false;
+    }
+
+    unsigned __int128 magnitude = 0;
+    if (combination == 0x1E) {
+        magnitude = 12322 * DECIMAL128_PRECISION;
+    }
+    else if (((words[1] >> 61) & 0x3) != 0x3) {
+        // the other form encodes coefficients of at least 2^113, which are all non-canonical
+        int64_t exponent = (words[1] >> 49) & 0x3FFF;
+        unsigned __int128 coefficient = ((unsigned __int128)(words[1] & ((1ull << 49) - 1)) << 64) | words[0];
+        if (coefficient > 0 && coefficient < DECIMAL128_PRECISION) {
+            // scale to 34 digits. The shifted exponent is in [-33, 12287], and in [1, 12321] once offset
+            while (coefficient < DECIMAL128_PRECISION / 10) {
+                coefficient *= 10;
+                --exponent;
+            }
+            magnitude = (exponent + 34) * DECIMAL128_PRECISION + coefficient;
+        }
+    }
+    ordinal = (words[1] >> 63) ? -(__int128)magnitude : (__int128)magnitude;
+    return true;
+}
+
+// Decimals are encoded as their ordinal, with the same strategy as the intxx_t conversions
+template <typename OrdinalT>
+static char* _encodeOrdinal(FieldType type, OrdinalT ordinal, char* s) {
+    constexpr size_t bytes = sizeof(OrdinalT);
+    s[0] = (char) type;
+    s[1] = ordinal >= 0 ? SIGN_POS : SIGN_NEG;
+    OrdinalT magnitude = ordinal >= 0 ? ordinal : -ordinal;
+    for (size_t i = 0; i < bytes; ++i) {
+        char byte = (char)(magnitude >> (8 * (bytes - 1 - i)));
+        s[2 + i] = ordinal >= 0 ? byte : 255 - byte;
+    }
+    s[2 + bytes] = ESCAPE;
+    s[3 + bytes] = TERM;
+    return s + 4 + bytes;
+}
+
+// type byte + sign byte + 8 bytes + ESCAPE + TERM
+template <> size_t KeyStringSize<std::decimal::decimal64>(const std::decimal::decimal64&) { return 12; }
+
+template <> char* EncodeKeyString<std::decimal::decimal64>(const std::decimal::decimal64& field, char* s) {
+    int64_t ordinal;
+    if (!DecimalOrdinal(field, ordinal)) {
+        throw SKVKeyEncodingException("NaN cannot be encoded as a key field");
+    }
+    return _encodeOrdinal(FieldType::DECIMAL64, ordinal, s);
+}
+
+// type byte + sign byte + 16 bytes + ESCAPE + TERM
+template <> size_t KeyStringSize<std::decimal::decimal128>(const std::decimal::decimal128&) { return 20; }
+
+template <> char* EncodeKeyString<std::decimal::decimal128>(const std::decimal::decimal128& field, char* s) {
+    __int128 ordinal;
+    if (!DecimalOrdinal(field, ordinal)) {
+        throw SKVKeyEncodingException("NaN cannot be encoded as a key field");
+    }
+    return _encodeOrdinal(FieldType::DECIMAL128, ordinal, s);
 }
 
 String NullFirstToKeyString() {
@@ -77,24 +77,57 @@ enum class FieldType : uint8_t {
 template <typename T>
 FieldType TToFieldType();
 
-// Converts a field type to a string suitable for being part of a key
+// Encodes key fields directly into a buffer: KeyStringSize is the size of the encoding of the field and
+// EncodeKeyString writes it at out, and returns the position past it. This lets a key made of several fields
+// be encoded into a single buffer sized up front
+template<typename T>
+size_t KeyStringSize(const T&);
 template<typename T>
-String FieldToKeyString(const T&);
+char* EncodeKeyString(const T&, char* out);
 
 // these types are supported as key fields
-template<> String FieldToKeyString<int16_t>(const int16_t&);
-template<> String FieldToKeyString<int32_t>(const int32_t&);
-template<> String FieldToKeyString<int64_t>(const int64_t&);
-template<> String FieldToKeyString<String>(const String&);
-template<> String FieldToKeyString<bool>(const bool&);
+template<> size_t KeyStringSize<int16_t>(const int16_t&);
+template<> size_t KeyStringSize<int32_t>(const int32_t&);
+template<> size_t KeyStringSize<int64_t>(const int64_t&);
+template<> size_t KeyStringSize<String>(const String&);
+template<> size_t KeyStringSize<bool>(const bool&);
+template<> size_t KeyStringSize<std::decimal::decimal64>(const std::decimal::decimal64&);
+template<> size_t KeyStringSize<std::decimal::decimal128>(const std::decimal::decimal128&);
+template<> char* EncodeKeyString<int16_t>(const int16_t&, char*);
+template<> char* EncodeKeyString<int32_t>(const int32_t&, char*);
+template<> char* EncodeKeyString<int64_t>(const int64_t&, char*);
+template<> char* EncodeKeyString<String>(const String&, char*);
+template<> char* EncodeKeyString<bool>(const bool&, char*);
+template<> char* EncodeKeyString<std::decimal::decimal64>(const std::decimal::decimal64&, char*);
+template<> char* EncodeKeyString<std::decimal::decimal128>(const std::decimal::decimal128&, char*);
 
 // all other types are not supported as key fields
 template <typename T>
-String FieldToKeyString(const T&) {
+size_t KeyStringSize(const T&) {
     std::ostringstream msg;
     msg << "Key encoding for " << TToFieldType<T>() << " not implemented yet";
     throw FieldNotSupportedAsKeyException(msg.str().c_str());
 }
+template <typename T>
+char* EncodeKeyString(const T& field, char*) {
+    KeyStringSize<T>(field);
+    return nullptr;
+}
+
+// Decimals are compared and key-encoded through their ordinal: an integer which orders the same as the decimal
+// value does, and which is the same for all representations of a value (e.g. 1.5 and 1.50). It is the sign
+// applied to the adjusted exponent followed by the coefficient, scaled to the full precision of the type.
+// NaN is unordered and has no ordinal: the functions return false for it
+bool DecimalOrdinal(const std::decimal::decimal64& value, int64_t& ordinal);
+bool DecimalOrdinal(const std::decimal::decimal128& value, __int128& ordinal);
+
+// Converts a field type to a string suitable for being part of a key
+template<typename T>
+String FieldToKeyString(const T& field) {
+    String s(String::initialized_later(), KeyStringSize<T>(field));
+    EncodeKeyString<T>(field, s.data());
+    return s;
+}
 
 String NullFirstToKeyString();
 String NullLastToKeyString();
@@ -31,6 +31,9 @@ Copyright(c) 2020 Futurewei Cloud
 #include "SKVRecord.h"
 #include "Timestamp.h"
 #include "Expression.h"
+#include "Aggregate.h"
+#include "OrderBy.h"
+#include "Columnar.h"
 
 namespace k2 {
 namespace dto {
@@ -126,6 +129,8 @@ namespace dto {
 
 // A record in the 3SI version cache.
 struct DataRecord {
+    // NB: The K23SI module does not keep the key in the records it stores in its indexer, since the key is
+    // already held by the index. It is populated in records sent over the wire
     dto::Key key;
     SKVRecord::Storage value;
     bool isTombstone = false;
@@ -135,8 +140,14 @@ struct DataRecord {
         Committed,    // the record has been committed and we should use the key/value
         Aborted       // the record has been aborted and should be removed
     } status;
-    K2_PAYLOAD_FIELDS(key, value, isTombstone, txnId, status);
-    K2_DEF_FMT(DataRecord, key, value, isTombstone, txnId, status);
+    // the record expires this long after its timestamp, and reads at or after that don't see it. 0 for never
+    Duration ttl{0};
+    // true if the record is a tombstone or has expired as of the given timestamp
+    bool isDeletedAt(const Timestamp& timestamp) const {
+        return isTombstone || (ttl > Duration(0) && timestamp.compareCertain(txnId.mtr.timestamp + ttl) >= 0);
+    }
+    K2_PAYLOAD_FIELDS(key, value, isTombstone, txnId, status, ttl);
+    K2_DEF_FMT(DataRecord, key, value, isTombstone, txnId, status, ttl);
 };
 
 K2_DEF_ENUM(TxnRecordState,
@@ -146,7 +157,8 @@ K2_DEF_ENUM(TxnRecordState,
         Aborted,
         Committed,
         Deleted,
-        Unknown
+        Unknown,
+        Staging
 );
 
 // The main READ DTO.
@@ -156,13 +168,17 @@ struct K23SIReadRequest {
     K23SI_MTR mtr; // the MTR for the issuing transaction
     // use the name "key" so that we can use common routing from CPO client
     Key key; // the key to read
+    // bounded-staleness read: served from committed versions only, without updating the read cache or pushing.
+    // The timestamp must be older than the server's k23si_snapshot_read_min_staleness
+    bool snapshotRead = false;
+    std::vector<String> projection; // Fields by name to include in the returned value, same as for queries. Empty for all
 
     K23SIReadRequest() = default;
     K23SIReadRequest(Partition::PVID p, String cname, K23SI_MTR _mtr, Key _key) :
         pvid(std::move(p)), collectionName(std::move(cname)), mtr(std::move(_mtr)), key(std::move(_key)) {}
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, key);
-    K2_DEF_FMT(K23SIReadRequest, pvid, collectionName, mtr, key);
+    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, key, snapshotRead, projection);
+    K2_DEF_FMT(K23SIReadRequest, pvid, collectionName, mtr, key, snapshotRead, projection);
 };
 
 // The response for READs
@@ -172,6 +188,28 @@ struct K23SIReadResponse {
     K2_DEF_FMT(K23SIReadResponse, value);
 };
 
+// Batched READ of multiple keys which belong to the same partition
+struct K23SIReadMultiRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName; // the name of the collection
+    K23SI_MTR mtr; // the MTR for the issuing transaction
+    // the routing key, used by the CPO client to find the partition. Normally the first of the keys to read
+    Key key;
+    std::vector<Key> keys; // the keys to read
+    bool snapshotRead = false; // bounded-staleness read, same as in K23SIReadRequest
+
+    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, key, keys, snapshotRead);
+    K2_DEF_FMT(K23SIReadMultiRequest, pvid, collectionName, mtr, key, keys, snapshotRead);
+};
+
+// The response for batched READs. There is a status and a value for each key in the request, in the same order
+struct K23SIReadMultiResponse {
+    std::vector<Status> statuses;
+    std::vector<SKVRecord::Storage> values;
+    K2_PAYLOAD_FIELDS(statuses, values);
+    K2_DEF_FMT(K23SIReadMultiResponse, statuses);
+};
+
 // status codes for reads
 struct K23SIStatus {
     static const inline Status KeyNotFound=k2::Statuses::S404_Not_Found;
@@ -187,6 +225,22 @@ struct K23SIStatus {
     static const inline Status InternalError=k2::Statuses::S500_Internal_Server_Error;
 };
 
+// The operations a write can apply to a field of the latest version of its record on the server, see
+// K23SIWriteRequest::fieldOps. The operand is the value of the field in the write
+K2_DEF_ENUM(FieldOperation,
+        Add,            // field = latest + operand. Numeric fields only
+        CompareAndSet,  // field = operand if latest equals the expected value of the field, else ConditionFailed
+        Min,            // field = min(latest, operand). Numeric fields only
+        Max             // field = max(latest, operand). Numeric fields only
+);
+
+struct K23SIFieldOp {
+    uint32_t fieldIdx = 0; // the field of the write's schema the operation applies to
+    FieldOperation op = FieldOperation::Add;
+    K2_PAYLOAD_FIELDS(fieldIdx, op);
+    K2_DEF_FMT(K23SIFieldOp, fieldIdx, op);
+};
+
 struct K23SIWriteRequest {
     Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
     String collectionName; // the name of the collection
@@ -206,6 +260,22 @@ struct K23SIWriteRequest {
     Key key; // the key for the write
     SKVRecord::Storage value; // the value of the write
     std::vector<uint32_t> fieldsForPartialUpdate; // if size() > 0 then this is a partial update
+    // the heartbeat deadline the TRH should apply to this transaction. Only used when designateTRH is set.
+    // Zero means the collection's heartbeat deadline
+    Duration trhHeartbeatDeadline{0};
+    // if set, the server responds as soon as the WI is in place, without waiting for it to be persisted. The
+    // client must then send a K23SITxnAwaitDurableRequest to the partition before committing
+    bool pipelined = false;
+    // Field operations applied by a partial update against the latest version of the record, instead of the
+    // client reading the record and writing the new values back. Their fields must be in fieldsForPartialUpdate
+    // and must not be key fields. The response has the record as written
+    std::vector<K23SIFieldOp> fieldOps;
+    // the expected values of the CompareAndSet fields, as a record of the schema of value. A null field means
+    // the latest version must not have a value for it
+    SKVRecord::Storage expected;
+    // If set, the write is applied only if the latest version of the record passes this filter, and is rejected
+    // with ConditionFailed otherwise, like a failed rejectIfExists. A record which doesn't exist doesn't pass
+    expression::Expression condition;
 
     K23SIWriteRequest() = default;
     K23SIWriteRequest(Partition::PVID _pvid, String cname, K23SI_MTR _mtr, Key _trh, bool _isDelete,
@@ -215,13 +285,40 @@ struct K23SIWriteRequest {
         isDelete(_isDelete), designateTRH(_designateTRH), rejectIfExists(_rejectIfExists),
         key(std::move(_key)), value(std::move(_value)), fieldsForPartialUpdate(std::move(_fields)) {}
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, trh, isDelete, designateTRH, rejectIfExists, key, value, fieldsForPartialUpdate);
-    K2_DEF_FMT(K23SIWriteRequest, pvid, collectionName, mtr, trh, isDelete, designateTRH, rejectIfExists, key, value, fieldsForPartialUpdate);
+    // the TTL of the record(see DataRecord::ttl). 0 means the TTL of the schema
+    Duration ttl{0};
+
+    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, trh, isDelete, designateTRH, rejectIfExists, key, value, fieldsForPartialUpdate, trhHeartbeatDeadline, pipelined, fieldOps, expected, condition, ttl);
+    K2_DEF_FMT(K23SIWriteRequest, pvid, collectionName, mtr, trh, isDelete, designateTRH, rejectIfExists, key, value, fieldsForPartialUpdate, trhHeartbeatDeadline, pipelined, fieldOps, condition, ttl);
 };
 
 struct K23SIWriteResponse {
-    K2_PAYLOAD_EMPTY;
-    K2_DEF_FMT(K23SIWriteResponse);
+    // the record as written, for a write with fieldOps. Empty otherwise
+    SKVRecord::Storage value;
+    K2_PAYLOAD_FIELDS(value);
+    K2_DEF_FMT(K23SIWriteResponse, value);
+};
+
+// Batched WRITE. All writes must be for the same partition and are executed on behalf of the same transaction.
+// The pvid, collectionName and mtr of the batch override the ones in the individual writes.
+// The writes are applied in order and the resulting WIs are persisted with a single persistence call
+struct K23SIWriteMultiRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName; // the name of the collection
+    K23SI_MTR mtr; // the MTR for the issuing transaction
+    // the routing key, used by the CPO client to find the partition. Normally the key of the first write
+    Key key;
+    std::vector<K23SIWriteRequest> writes; // the writes to apply
+
+    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, key, writes);
+    K2_DEF_FMT(K23SIWriteMultiRequest, pvid, collectionName, mtr, key, writes);
+};
+
+// The response for batched WRITEs. There is a status for each write in the request, in the same order
+struct K23SIWriteMultiResponse {
+    std::vector<Status> statuses;
+    K2_PAYLOAD_FIELDS(statuses);
+    K2_DEF_FMT(K23SIWriteMultiResponse, statuses);
 };
 
 struct K23SIQueryRequest {
@@ -234,24 +331,73 @@ struct K23SIQueryRequest {
     bool exclusiveKey = false; // Used to indicate key(aka startKey) is excluded in results
 
     int32_t recordLimit = -1; // Max number of records server should return, negative is no limit
+    uint32_t responseBytesLimit = 0; // Target size in bytes of the records in a response, 0 for the server default
     bool includeVersionMismatch = false; // Whether mismatched schema versions should be included in results
     bool reverseDirection = false; // If true, key should be high and endKey low
 
     expression::Expression filterExpression; // the filter expression for this query
     std::vector<String> projection; // Fields by name to include in projection
+    bool snapshotRead = false; // bounded-staleness query, same as in K23SIReadRequest
+    // Number of pages the server may prepare ahead of the client for the rest of the scan in this partition.
+    // 0 is a plain paginated query
+    uint32_t streamCredits = 0;
+    // If not empty, the records which pass the filter are aggregated instead of returned. The record limit
+    // and page sizes then apply to the number of records aggregated
+    std::vector<Aggregate> aggregates;
+    // If true, the records are returned as the columns of the projection(see ColumnBatch) instead of as records
+    bool columnar = false;
+    // If it has a field, each response only has the first orderBy.limit records of the page in the order of the
+    // field, instead of all the records in key order. The record limit and page sizes then apply to the number of
+    // records ranked. Not allowed with aggregates. With a projection, the field must be projected
+    OrderBy orderBy;
+    // If not 0, this is a prepared query and this is the id of its filter shape and projection. With prepare, the
+    // request has the filter and projection and the partition keeps them under this id. Otherwise they are empty
+    // and the partition uses the ones it kept, with the literals of the filter replaced by the parameters(see
+    // expression::bindLiterals). The status is KeyNotFound if the partition doesn't have them
+    uint64_t preparedQueryId = 0;
+    bool prepare = false;
+    std::vector<expression::Value> parameters;
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, key, endKey, exclusiveKey, recordLimit, includeVersionMismatch,
-                      reverseDirection, filterExpression, projection);
+    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, key, endKey, exclusiveKey, recordLimit, responseBytesLimit,
+                      includeVersionMismatch, reverseDirection, filterExpression, projection, snapshotRead,
+                      streamCredits, aggregates, columnar, orderBy, preparedQueryId, prepare, parameters);
     K2_DEF_FMT(K23SIQueryRequest, pvid, collectionName, mtr, key, endKey, exclusiveKey, recordLimit,
-        includeVersionMismatch, reverseDirection, filterExpression, projection);
+        responseBytesLimit, includeVersionMismatch, reverseDirection, filterExpression, projection, snapshotRead,
+        streamCredits, aggregates, columnar, orderBy, preparedQueryId, prepare, parameters);
 };
 
 struct K23SIQueryResponse {
     Key nextToScan; // For continuation token
     bool exclusiveToken = false; // whether nextToScan should be excluded or included
+    // If not 0, the next page of this partition can be fetched from the server's stream with a K23SIQueryNextRequest
+    uint64_t streamId = 0;
     std::vector<SKVRecord::Storage> results;
-    K2_PAYLOAD_FIELDS(nextToScan, exclusiveToken, results);
-    K2_DEF_FMT(K23SIQueryResponse, nextToScan, exclusiveToken, results);
+    // For aggregate queries, the partial result of each of the request's aggregates over the records of this
+    // response, and the number of those records. Partials are combined by the client with Aggregator::merge
+    std::vector<expression::Value> aggregates;
+    uint32_t aggregatedRecords = 0;
+    // For columnar queries, the records of this response. results is then empty
+    ColumnBatch columns;
+    // For ordered queries, the number of records ranked for this response. results has the first of them
+    uint32_t rankedRecords = 0;
+    K2_PAYLOAD_FIELDS(nextToScan, exclusiveToken, streamId, results, aggregates, aggregatedRecords, columns,
+                      rankedRecords);
+    K2_DEF_FMT(K23SIQueryResponse, nextToScan, exclusiveToken, streamId, results, aggregates, aggregatedRecords,
+        columns, rankedRecords);
+};
+
+// Fetches the next page of a streaming query. The response is a K23SIQueryResponse
+struct K23SIQueryNextRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName;
+    // use the name "key" so that we can use common routing from CPO client. This is the nextToScan of
+    // the previous page, so that the request goes to the partition which has the stream
+    Key key;
+    uint64_t streamId = 0; // the streamId from the previous page
+    uint32_t credits = 0; // Number of additional pages the server may prepare ahead
+
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, streamId, credits);
+    K2_DEF_FMT(K23SIQueryNextRequest, pvid, collectionName, key, streamId, credits);
 };
 
 struct K23SITxnHeartbeatRequest {
@@ -264,9 +410,11 @@ struct K23SITxnHeartbeatRequest {
     Key key;
     // the MTR for the transaction we want to heartbeat
     K23SI_MTR mtr;
+    // the heartbeat deadline for this transaction. Zero means the collection's heartbeat deadline
+    Duration heartbeatDeadline{0};
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, key, mtr);
-    K2_DEF_FMT(K23SITxnHeartbeatRequest, pvid, collectionName, key, mtr);
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, mtr, heartbeatDeadline);
+    K2_DEF_FMT(K23SITxnHeartbeatRequest, pvid, collectionName, key, mtr, heartbeatDeadline);
 };
 
 struct K23SITxnHeartbeatResponse {
@@ -274,11 +422,33 @@ struct K23SITxnHeartbeatResponse {
     K2_DEF_FMT(K23SITxnHeartbeatResponse);
 };
 
+// Batched HEARTBEAT of transactions whose TRHs are in the same partition.
+// The pvid and collectionName of the batch override the ones in the individual requests
+struct K23SITxnHeartbeatMultiRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName; // the name of the collection
+    // the routing key, used by the CPO client to find the partition. Normally the TRH of the first heartbeat
+    Key key;
+    std::vector<K23SITxnHeartbeatRequest> heartbeats;
+
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, heartbeats);
+    K2_DEF_FMT(K23SITxnHeartbeatMultiRequest, pvid, collectionName, key, heartbeats);
+};
+
+// The response for batched HEARTBEATs. There is a status for each heartbeat in the request, in the same order
+struct K23SITxnHeartbeatMultiResponse {
+    std::vector<Status> statuses;
+    K2_PAYLOAD_FIELDS(statuses);
+    K2_DEF_FMT(K23SITxnHeartbeatMultiResponse, statuses);
+};
+
 template <typename ValueType>
 struct K23SI_PersistenceRequest {
+    // identifies the partition which wrote the value, so that its part of the WAL can be replayed on recovery
+    String source;
     SerializeAsPayload<ValueType> value;  // the value of the write
-    K2_PAYLOAD_FIELDS(value);
-    K2_DEF_FMT(K23SI_PersistenceRequest);
+    K2_PAYLOAD_FIELDS(source, value);
+    K2_DEF_FMT(K23SI_PersistenceRequest, source);
 };
 
 struct K23SI_PersistenceResponse {
@@ -291,9 +461,120 @@ struct K23SI_PersistenceRecoveryRequest {
     K2_DEF_FMT(K23SI_PersistenceRecoveryRequest);
 };
 
+// The new status of a record which was finalized
+struct K23SIFinalizedRecord {
+    Key key;
+    // the timestamp of the transaction which wrote the record
+    Timestamp timestamp;
+    DataRecord::Status status;
+    K2_PAYLOAD_FIELDS(key, timestamp, status);
+    K2_DEF_FMT(K23SIFinalizedRecord, key, timestamp, status);
+};
+
 struct K23SI_PersistencePartialUpdate {
+    std::vector<K23SIFinalizedRecord> finalized;
+    K2_PAYLOAD_FIELDS(finalized);
+    K2_DEF_FMT(K23SI_PersistencePartialUpdate, finalized);
+};
+
+// The type of each value in a persistence batch. Values are preceded by their type so that the WAL can be replayed
+enum class PersistenceRecordType : uint8_t {
+    DataRecord,     // a write intent, including its key
+    TxnRecord,      // the state of a transaction record
+    PartialUpdate,  // a K23SI_PersistencePartialUpdate
+    Recovery,       // a K23SI_PersistenceRecoveryRequest
+    ClosedTimestamp, // a K23SI_PersistenceClosedTimestamp
+    RangeTombstone   // a K23SI_PersistenceRangeTombstone
+};
+
+// Written to the WAL by a partition which promises not to accept writes at or below the closed timestamp anymore.
+// Followers serve snapshot reads up to the newest closed timestamp they replayed
+struct K23SI_PersistenceClosedTimestamp {
+    Timestamp closed;
+    K2_PAYLOAD_FIELDS(closed);
+    K2_DEF_FMT(K23SI_PersistenceClosedTimestamp, closed);
+};
+
+// Starts a new checkpoint for the given source. The checkpoint covers all WAL records below the returned LSN
+struct K23SICheckpointBeginRequest {
+    String source;
+    K2_PAYLOAD_FIELDS(source);
+    K2_DEF_FMT(K23SICheckpointBeginRequest, source);
+};
+
+struct K23SICheckpointBeginResponse {
+    uint64_t checkpointId = 0;
+    uint64_t lsn = 0;
+    K2_PAYLOAD_FIELDS(checkpointId, lsn);
+    K2_DEF_FMT(K23SICheckpointBeginResponse, checkpointId, lsn);
+};
+
+// One chunk of a checkpoint. Chunks hold consecutive keys in index order. For each key, the chunk has the key, the
+// number of versions and the versions(without their key), newest first
+struct K23SICheckpointChunkRequest {
+    String source;
+    uint64_t checkpointId = 0;
+    Payload entries;
+    K2_PAYLOAD_FIELDS(source, checkpointId, entries);
+    K2_DEF_FMT(K23SICheckpointChunkRequest, source, checkpointId);
+};
+
+struct K23SICheckpointChunkResponse {
     K2_PAYLOAD_EMPTY;
-    K2_DEF_FMT(K23SI_PersistencePartialUpdate);
+    K2_DEF_FMT(K23SICheckpointChunkResponse);
+};
+
+// Completes the checkpoint. It replaces the previous checkpoint of the source and allows the WAL to be truncated
+struct K23SICheckpointEndRequest {
+    String source;
+    uint64_t checkpointId = 0;
+    K2_PAYLOAD_FIELDS(source, checkpointId);
+    K2_DEF_FMT(K23SICheckpointEndRequest, source, checkpointId);
+};
+
+struct K23SICheckpointEndResponse {
+    // all WAL records below this LSN have been dropped
+    uint64_t truncatedLSN = 0;
+    K2_PAYLOAD_FIELDS(truncatedLSN);
+    K2_DEF_FMT(K23SICheckpointEndResponse, truncatedLSN);
+};
+
+// Reads a chunk of the latest completed checkpoint of the source
+struct K23SIRecoverCheckpointRequest {
+    String source;
+    uint64_t chunkIndex = 0;
+    K2_PAYLOAD_FIELDS(source, chunkIndex);
+    K2_DEF_FMT(K23SIRecoverCheckpointRequest, source, chunkIndex);
+};
+
+struct K23SIRecoverCheckpointResponse {
+    // false if the source has no completed checkpoint
+    bool found = false;
+    uint64_t checkpointId = 0;
+    // the WAL replay has to start at this LSN
+    uint64_t lsn = 0;
+    uint64_t chunkCount = 0;
+    Payload entries;
+    K2_PAYLOAD_FIELDS(found, checkpointId, lsn, chunkCount, entries);
+    K2_DEF_FMT(K23SIRecoverCheckpointResponse, found, checkpointId, lsn, chunkCount);
+};
+
+// Reads the WAL records of the source in the LSN range [fromLSN, toLSN)
+struct K23SIRecoverWALRequest {
+    String source;
+    uint64_t fromLSN = 0;
+    uint64_t toLSN = 0;
+    K2_PAYLOAD_FIELDS(source, fromLSN, toLSN);
+    K2_DEF_FMT(K23SIRecoverWALRequest, source, fromLSN, toLSN);
+};
+
+struct K23SIRecoverWALResponse {
+    // the LSN of the next record to be written to the WAL
+    uint64_t endLSN = 0;
+    // the batches written by the source in the requested range, in LSN order
+    std::vector<Payload> records;
+    K2_PAYLOAD_FIELDS(endLSN, records);
+    K2_DEF_FMT(K23SIRecoverWALResponse, endLSN);
 };
 
 // we route requests to the TRH the same way as standard keys therefore we need pvid and collection name
@@ -330,6 +611,15 @@ K2_DEF_ENUM(EndAction,
     Commit
 );
 
+// The write keys of a transaction which belong to the same partition, as seen by the client when it wrote them
+struct K23SIWriteKeyGroup {
+    Partition::PVID pvid;
+    std::vector<Key> keys;
+
+    K2_PAYLOAD_FIELDS(pvid, keys);
+    K2_DEF_FMT(K23SIWriteKeyGroup, pvid, keys);
+};
+
 struct K23SITxnEndRequest {
     // the partition version ID for the TRH. Should be coming from an up-to-date partition map
     Partition::PVID pvid;
@@ -353,9 +643,19 @@ struct K23SITxnEndRequest {
     bool syncFinalize=false;
     // The interval from end to Finalize for a transaction
     Duration timeToFinalize{0};
+    // the keys this transaction wrote, already grouped by partition. If set, writeKeys is ignored and the TRH
+    // sends one batched finalize per group without having to look up the partition of each key
+    std::vector<K23SIWriteKeyGroup> writeKeyGroups;
+    // if set, the client finalizes the write intents itself once the End succeeds. The TRH then only finalizes
+    // in the background, after timeToFinalize, to clean up after clients which fail to do so
+    bool clientFinalize=false;
+    // if set, the pipelined writes of a committing transaction may still be in flight. The TRH stages the
+    // transaction, waits for the writes to become durable in all partitions, and then commits it, or aborts it if
+    // any of them failed
+    bool parallelCommit=false;
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, key, mtr, action, writeKeys, syncFinalize, timeToFinalize);
-    K2_DEF_FMT(K23SITxnEndRequest, pvid, collectionName, key, mtr, action, syncFinalize, timeToFinalize, writeKeys);
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, mtr, action, writeKeys, syncFinalize, timeToFinalize, writeKeyGroups, clientFinalize, parallelCommit);
+    K2_DEF_FMT(K23SITxnEndRequest, pvid, collectionName, key, mtr, action, syncFinalize, timeToFinalize, writeKeys, writeKeyGroups, clientFinalize, parallelCommit);
 };
 
 struct K23SITxnEndResponse {
@@ -386,6 +686,44 @@ struct K23SITxnFinalizeResponse {
     K2_DEF_FMT(K23SITxnFinalizeResponse);
 };
 
+// Batched FINALIZE of keys in the same partition. The finalizes may belong to different transactions.
+// The pvid and collectionName of the batch override the ones in the individual requests
+struct K23SITxnFinalizeMultiRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName; // the name of the collection
+    // the routing key, used by the CPO client to find the partition. Normally the key of the first finalize
+    Key key;
+    std::vector<K23SITxnFinalizeRequest> finalizes; // the keys to finalize
+
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, finalizes);
+    K2_DEF_FMT(K23SITxnFinalizeMultiRequest, pvid, collectionName, key, finalizes);
+};
+
+// The response for batched FINALIZEs. There is a status for each finalize in the request, in the same order
+struct K23SITxnFinalizeMultiResponse {
+    std::vector<Status> statuses;
+    K2_PAYLOAD_FIELDS(statuses);
+    K2_DEF_FMT(K23SITxnFinalizeMultiResponse, statuses);
+};
+
+// Waits until all pipelined writes of the transaction in the partition are durable. Fails if any of them
+// could not be persisted, in which case the transaction must be aborted
+struct K23SITxnAwaitDurableRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName; // the name of the collection
+    // the routing key, used by the CPO client to find the partition. Any key the transaction wrote in the partition
+    Key key;
+    K23SI_MTR mtr; // the MTR of the transaction which issued the pipelined writes
+
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, mtr);
+    K2_DEF_FMT(K23SITxnAwaitDurableRequest, pvid, collectionName, key, mtr);
+};
+
+struct K23SITxnAwaitDurableResponse {
+    K2_PAYLOAD_EMPTY;
+    K2_DEF_FMT(K23SITxnAwaitDurableResponse);
+};
+
 struct K23SIPushSchemaRequest {
     String collectionName;
     Schema schema;
@@ -398,5 +736,291 @@ struct K23SIPushSchemaResponse {
     K2_DEF_FMT(K23SIPushSchemaResponse);
 };
 
+// Sent by the CPO to split a partition. The partition stops serving the keys at and past splitKey, streams
+// their versions to newPartition(which must already be assigned), and then continues as partition, which owns the
+// keys below splitKey. The split key of a hash partition is a hash value, and the keys hashing at and past it move
+struct K23SISplitRequest {
+    String collectionName;
+    Partition::PVID pvid; // the partition to split
+    String splitKey;
+    Partition partition; // the lower half, with a bumped rangeVersion
+    Partition newPartition; // the upper half
+    // only check whether the partition could be split now, without splitting it
+    bool checkOnly = false;
+    K2_PAYLOAD_FIELDS(collectionName, pvid, splitKey, partition, newPartition, checkOnly);
+    K2_DEF_FMT(K23SISplitRequest, collectionName, pvid, splitKey, partition, newPartition, checkOnly);
+};
+
+struct K23SISplitResponse {
+    // number of keys moved to the new partition
+    uint64_t movedKeys = 0;
+    K2_PAYLOAD_FIELDS(movedKeys);
+    K2_DEF_FMT(K23SISplitResponse, movedKeys);
+};
+
+// A transaction record moved along with its partition by a migration
+struct K23SIMigratedTxn {
+    TxnId txnId;
+    TxnRecordState state = TxnRecordState::Created;
+    bool finalized = false;
+    std::vector<Key> writeKeys;
+    std::vector<K23SIWriteKeyGroup> writeKeyGroups;
+    Duration hbDeadline{0};
+    bool syncFinalize = false;
+    bool clientFinalize = false;
+    Duration timeToFinalize{0};
+    K2_PAYLOAD_FIELDS(txnId, state, finalized, writeKeys, writeKeyGroups, hbDeadline, syncFinalize, clientFinalize, timeToFinalize);
+    K2_DEF_FMT(K23SIMigratedTxn, txnId, state, finalized);
+};
+
+// One chunk of the keys moved by a split or a migration, in the format of K23SICheckpointChunkRequest. A key
+// without versions was removed. The last chunk has done set and carries the watermark below which the new partition
+// must reject writes, since the old partition may have served reads up to it. For a migration, it also carries the
+// transaction records of the partition
+// One record of a bulk ingest
+struct K23SIBulkIngestRecord {
+    Key key;
+    SKVRecord::Storage value;
+    K2_PAYLOAD_FIELDS(key, value);
+    K2_DEF_FMT(K23SIBulkIngestRecord, key, value);
+};
+
+// Installs the records as committed versions at the given timestamp, without WIs, a TRH or finalization. Only
+// allowed in a collection created with bulkLoad, and only for keys which have no versions at or after the
+// timestamp and weren't read after it. The records are sorted by key and all belong to the partition
+struct K23SIBulkIngestRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName;
+    // the routing key, used by the CPO client to find the partition. The key of the first record
+    Key key;
+    Timestamp timestamp;
+    std::vector<K23SIBulkIngestRecord> records;
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, timestamp, records);
+    K2_DEF_FMT(K23SIBulkIngestRequest, pvid, collectionName, key, timestamp);
+};
+
+struct K23SIBulkIngestResponse {
+    uint64_t ingested = 0;
+    K2_PAYLOAD_FIELDS(ingested);
+    K2_DEF_FMT(K23SIBulkIngestResponse, ingested);
+};
+
+// Erases all keys in [key, endKey) as of the given timestamp, without WIs, a TRH or finalization. The partition
+// records the range with a single tombstone instead of erasing the keys one by one. An empty endKey.partitionKey
+// means the end of the schema. The request goes to the partition of the start key and the response tells the
+// client where the range continues
+struct K23SIRangeDeleteRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName;
+    // the start of the range, also used for routing. For the partitions after the first, where the range continues
+    Key key;
+    Key endKey;
+    Timestamp timestamp;
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, endKey, timestamp);
+    K2_DEF_FMT(K23SIRangeDeleteRequest, pvid, collectionName, key, endKey, timestamp);
+};
+
+struct K23SIRangeDeleteResponse {
+    // where the range continues in the next partition, or an empty partitionKey if the range is done
+    Key nextKey;
+    K2_PAYLOAD_FIELDS(nextKey);
+    K2_DEF_FMT(K23SIRangeDeleteResponse, nextKey);
+};
+
+// A range delete, as written to the WAL. It stays in the WAL, carried over by checkpoints, until the retention
+// window passes its timestamp
+struct K23SI_PersistenceRangeTombstone {
+    Key key;
+    Key endKey;
+    Timestamp timestamp;
+    bool operator==(const K23SI_PersistenceRangeTombstone& o) const {
+        return key == o.key && endKey == o.endKey && timestamp.compareCertain(o.timestamp) == Timestamp::EQ;
+    }
+    K2_PAYLOAD_FIELDS(key, endKey, timestamp);
+    K2_DEF_FMT(K23SI_PersistenceRangeTombstone, key, endKey, timestamp);
+};
+
+// A change committed in a partition, as returned to change stream subscribers
+struct K23SIChange {
+    Key key;
+    // set for a range delete, which erased [key, endKey) of the schema. An empty partitionKey means the end of it
+    Key endKey;
+    // the commit timestamp
+    Timestamp timestamp;
+    bool isTombstone = false;
+    // the committed value. Empty for tombstones
+    SKVRecord::Storage value;
+    K2_PAYLOAD_FIELDS(key, endKey, timestamp, isTombstone, value);
+    K2_DEF_FMT(K23SIChange, key, endKey, timestamp, isTombstone);
+};
+
+// Polls the change stream of the partition which owns the key: the changes committed after fromTimestamp, in
+// commit timestamp order. The subscriber pulls the next changes once it is done with the previous ones, so it
+// never gets more than it asked for. If there are none yet, the partition waits up to `wait` for some
+struct K23SIChangesRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName;
+    // for routing only, any key of the partition
+    Key key;
+    // exclusive. The resolved timestamp of the previous response, or where to resume the stream from
+    Timestamp fromTimestamp;
+    // the response may go over this to include all changes of its last timestamp
+    uint32_t maxChanges = 1000;
+    Duration wait{0};
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, fromTimestamp, maxChanges, wait);
+    K2_DEF_FMT(K23SIChangesRequest, pvid, collectionName, key, fromTimestamp, maxChanges, wait);
+};
+
+struct K23SIChangesResponse {
+    std::vector<K23SIChange> changes;
+    // all changes at or below this timestamp have been returned. The next poll continues from it
+    Timestamp resolved;
+    // the first key of the next partition of a range partitioned collection, or an empty partitionKey for the last
+    // partition. Lets a subscriber find all partitions
+    Key nextKey;
+    K2_PAYLOAD_FIELDS(changes, resolved, nextKey);
+    K2_DEF_FMT(K23SIChangesResponse, resolved, nextKey);
+};
+
+// Runs a transaction routine registered on the nodes(see TxnRoutineService) on the node which owns the key. The
+// routine runs the whole transaction there, so its operations on the keys of that node don't leave the process
+struct K23SIRunRoutineRequest {
+    Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
+    String collectionName;
+    // for routing: the routine runs on the node of the partition which owns the key
+    Key key;
+    String routine;
+    // the parameters, as the routine reads them
+    Payload params;
+    // how long the routine may retry its transaction for. 0 uses the default deadline of a transaction
+    Duration timeout{0};
+    TxnPriority priority = TxnPriority::Medium;
+    K2_PAYLOAD_FIELDS(pvid, collectionName, key, routine, params, timeout, priority);
+    K2_DEF_FMT(K23SIRunRoutineRequest, pvid, collectionName, key, routine, timeout, priority);
+};
+
+struct K23SIRunRoutineResponse {
+    // false if the routine chose to abort its transaction
+    bool committed = false;
+    // what the routine wrote into its result
+    Payload result;
+    K2_PAYLOAD_FIELDS(committed, result);
+    K2_DEF_FMT(K23SIRunRoutineResponse, committed);
+};
+
+struct K23SISplitTransferRequest {
+    String collectionName;
+    Partition::PVID pvid; // the new partition
+    Payload entries;
+    bool done = false;
+    Timestamp readWatermark;
+    std::vector<K23SIMigratedTxn> txns;
+    K2_PAYLOAD_FIELDS(collectionName, pvid, entries, done, readWatermark, txns);
+    K2_DEF_FMT(K23SISplitTransferRequest, collectionName, pvid, done, readWatermark);
+};
+
+struct K23SISplitTransferResponse {
+    K2_PAYLOAD_EMPTY;
+    K2_DEF_FMT(K23SISplitTransferResponse);
+};
+
+// Sent by the CPO to move a partition to newPartition, the same partition assigned to another core with a bumped
+// assignmentVersion. The partition keeps serving while its keys are copied and the keys changed meanwhile are sent
+// again. It is only fenced for the last changes and its transaction records, and then retires
+struct K23SIMigrateRequest {
+    String collectionName;
+    Partition::PVID pvid; // the partition to move
+    Partition newPartition;
+    K2_PAYLOAD_FIELDS(collectionName, pvid, newPartition);
+    K2_DEF_FMT(K23SIMigrateRequest, collectionName, pvid, newPartition);
+};
+
+struct K23SIMigrateResponse {
+    // number of keys sent to the new partition, including the ones sent again as they changed
+    uint64_t movedKeys = 0;
+    uint64_t movedTxns = 0;
+    K2_PAYLOAD_FIELDS(movedKeys, movedTxns);
+    K2_DEF_FMT(K23SIMigrateResponse, movedKeys, movedTxns);
+};
+
+// Sent by the CPO to collect the load of a partition since the previous load request
+struct K23SIPartitionLoadRequest {
+    String collectionName;
+    Partition::PVID pvid;
+    K2_PAYLOAD_FIELDS(collectionName, pvid);
+    K2_DEF_FMT(K23SIPartitionLoadRequest, collectionName, pvid);
+};
+
+struct K23SIPartitionLoadResponse {
+    // reads, writes and queries per second
+    double requestRate = 0;
+    // the median partition key of the sampled requests, or empty if there is no key the partition could split at
+    String splitKey;
+    // the persistence endpoint the partition recovers from, which its followers replay the WAL from
+    String persistenceEndpoint;
+    // the snapshot reads and queries per second, which followers of the partition could serve instead
+    double snapshotReadRate = 0;
+    K2_PAYLOAD_FIELDS(requestRate, splitKey, persistenceEndpoint, snapshotReadRate);
+    K2_DEF_FMT(K23SIPartitionLoadResponse, requestRate, splitKey, persistenceEndpoint, snapshotReadRate);
+};
+
+// Exports the committed state of a partition as of a snapshot timestamp, e.g. for backups, one page at a time.
+// Each page holds the newest committed version at or below the snapshot of the keys which follow the cursor, without
+// tombstones. The snapshot is admitted like a snapshot read, so no writes can land underneath it while the export
+// runs, and followers can serve exports too. The pages are paced to k23si_export_bytes_per_sec on each partition.
+// The records of a page can be restored with a K23SIBulkIngestRequest at the snapshot timestamp
+struct K23SIExportRequest {
+    Partition::PVID pvid;
+    String collectionName;
+    // the snapshot to export. If unset, the newest timestamp the partition can serve snapshot reads at is used,
+    // and returned in the response to be passed along with the following pages
+    Timestamp snapshot;
+    // where the previous page stopped, from its response. Both are zero/empty for the first page
+    uint32_t schemaId = 0;
+    Key cursor;
+    // the approximate size of a page. 0 uses k23si_export_page_bytes
+    uint64_t pageBytes = 0;
+    // If set, the partition writes the export from the cursor on into this file on its node instead of returning the
+    // pages, and responds once the export is complete. Each page is written as its serialized size(uint64_t), followed
+    // by the page serialized as a K23SIExportResponse. Only one export to a file runs on a partition at a time
+    String path;
+    K2_PAYLOAD_FIELDS(pvid, collectionName, snapshot, schemaId, cursor, pageBytes, path);
+    K2_DEF_FMT(K23SIExportRequest, pvid, collectionName, snapshot, schemaId, cursor, pageBytes, path);
+};
+
+struct K23SIExportResponse {
+    Timestamp snapshot;
+    // the records of the page, sorted by key within each schema. Empty for an export to a file
+    std::vector<K23SIBulkIngestRecord> records;
+    // where the next page starts
+    uint32_t schemaId = 0;
+    Key cursor;
+    // set on the last page
+    bool done = false;
+    // the records and bytes of the page, or for an export to a file, of the whole export
+    uint64_t exportedRecords = 0;
+    uint64_t exportedBytes = 0;
+    K2_PAYLOAD_FIELDS(snapshot, records, schemaId, cursor, done, exportedRecords, exportedBytes);
+    K2_DEF_FMT(K23SIExportResponse, snapshot, schemaId, cursor, done, exportedRecords, exportedBytes);
+};
+
+// Rebuilds an empty partition from a file written by an export to a file(see K23SIExportRequest) on its node. The
+// records are installed as committed versions at the snapshot timestamp of the export, and the partition is
+// checkpointed before the restore completes, so that it doesn't depend on the file afterwards
+struct K23SIRestoreRequest {
+    Partition::PVID pvid;
+    String collectionName;
+    String path;
+    K2_PAYLOAD_FIELDS(pvid, collectionName, path);
+    K2_DEF_FMT(K23SIRestoreRequest, pvid, collectionName, path);
+};
+
+struct K23SIRestoreResponse {
+    Timestamp snapshot;
+    uint64_t restoredRecords = 0;
+    K2_PAYLOAD_FIELDS(snapshot, restoredRecords);
+    K2_DEF_FMT(K23SIRestoreResponse, snapshot, restoredRecords);
+};
+
 } // ns dto
 } // ns k2
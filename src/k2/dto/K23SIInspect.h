@@ -112,5 +112,38 @@ struct K23SIInspectAllKeysResponse {
     K2_DEF_FMT(K23SIInspectAllKeysResponse, keys);
 };
 
+// Requests the keys of the partition on a node which were involved in the most contention
+// since the previous reset. Reads and writes are sampled. All pushes and conflict aborts are counted
+struct K23SIInspectHotKeysRequest {
+    // start counting afresh once the current hot keys are returned
+    bool reset = false;
+    K2_PAYLOAD_FIELDS(reset);
+    K2_DEF_FMT(K23SIInspectHotKeysRequest, reset);
+};
+
+// A key and its estimated count. The count may be overestimated by up to error
+struct K23SIHotKey {
+    Key key;
+    uint64_t count = 0;
+    uint64_t error = 0;
+    K2_PAYLOAD_FIELDS(key, count, error);
+    K2_DEF_FMT(K23SIHotKey, key, count, error);
+};
+
+// The hot keys of each kind, with the hottest first
+struct K23SIInspectHotKeysResponse {
+    std::vector<K23SIHotKey> reads;
+    std::vector<K23SIHotKey> writes;
+    // the keys whose write intents challengers pushed against
+    std::vector<K23SIHotKey> pushes;
+    // the keys for which the challenger lost a push and had to abort
+    std::vector<K23SIHotKey> aborts;
+    // the number of pushes and of lost pushes over all keys, hot or not
+    uint64_t totalPushes = 0;
+    uint64_t totalAborts = 0;
+    K2_PAYLOAD_FIELDS(reads, writes, pushes, aborts, totalPushes, totalAborts);
+    K2_DEF_FMT(K23SIInspectHotKeysResponse, reads, writes, pushes, aborts, totalPushes, totalAborts);
+};
+
 } // ns dto
 } // ns k2
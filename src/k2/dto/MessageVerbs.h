@@ -40,12 +40,24 @@ enum Verbs : k2::Verb {
     CPO_PERSISTENCE_CLUSTER_GET,
     CPO_SCHEMA_CREATE,
     CPO_SCHEMAS_GET,
+    // ControlPlaneOracle: asked to split a partition
+    CPO_PARTITION_SPLIT,
+    // ControlPlaneOracle: asked to move a partition to another k2 core
+    CPO_PARTITION_MIGRATE,
+    // ControlPlaneOracle: pushes a change of the partition map of a collection to its subscribers
+    CPO_COLLECTION_CHANGE,
+    // ControlPlaneOracle: asked to add a read-only follower of a partition
+    CPO_PARTITION_ADD_FOLLOWER,
+    // ControlPlaneOracle: receives the periodic health and load report of a k2 node
+    CPO_NODE_HEARTBEAT,
 
     /************ Assignment *****************/
     // K2Assignment: CPO asks K2 to assign a partition
     K2_ASSIGNMENT_CREATE = 20,
     // K2Assignment: CPO asks K2 to offload a partition
     K2_ASSIGNMENT_OFFLOAD,
+    // K2Assignment: CPO asks a K2 core for its load
+    K2_ASSIGNMENT_LOAD,
 
     /************ K23SI *****************/
     // K23SI reads
@@ -62,6 +74,10 @@ enum Verbs : k2::Verb {
     K23SI_TXN_FINALIZE,
     K23SI_PUSH_SCHEMA,
     K23SI_QUERY,
+    // K23SI batched reads of multiple keys in the same partition
+    K23SI_READ_MULTI,
+    // K23SI batched writes of multiple keys in the same partition
+    K23SI_WRITE_MULTI,
 
     /************ K23SI Persistence *****************/
     K23SI_Persist = 40,
@@ -76,7 +92,64 @@ enum Verbs : k2::Verb {
     K23SI_INSPECT_WIS,
     K23SI_INSPECT_ALL_TXNS,
     K23SI_INSPECT_ALL_KEYS,
-    
+
+    /************ K23SI batched operations *****************/
+    // sent to finalize keys from multiple K23SI transactions in one partition
+    K23SI_TXN_FINALIZE_MULTI = 50,
+    // sent before committing a transaction with pipelined writes, to wait until they are durable in a partition
+    K23SI_TXN_AWAIT_DURABLE,
+
+    /************ K23SI Checkpoints and Recovery *****************/
+    K23SI_CHECKPOINT_BEGIN,
+    K23SI_CHECKPOINT_CHUNK,
+    K23SI_CHECKPOINT_END,
+    K23SI_RECOVER_CHECKPOINT,
+    K23SI_RECOVER_WAL,
+
+    /************ K23SI Query streaming *****************/
+    // sent to fetch the next page of a streaming query from the partition which holds the stream
+    K23SI_QUERY_NEXT,
+
+    /************ K23SI Partition split *****************/
+    // CPO asks a partition to split off the keys at and past a split key into a new partition
+    K23SI_SPLIT,
+    // sent by the partition being split to move its keys into the new partition
+    K23SI_SPLIT_TRANSFER,
+    // CPO asks a partition for its recent load, to decide whether to split it
+    K23SI_PARTITION_LOAD,
+    // CPO asks a partition to move to another core. Its keys are sent with K23SI_SPLIT_TRANSFER
+    K23SI_MIGRATE,
+
+    /************ K23SI Contention analytics *****************/
+    // returns the keys of a partition with the most reads, writes, pushes and conflict aborts
+    K23SI_INSPECT_HOT_KEYS,
+
+    /************ K23SI Bulk load *****************/
+    // installs records as committed versions without transactions, for the initial load of a collection
+    K23SI_BULK_INGEST,
+
+    /************ K23SI Backups *****************/
+    // exports the committed state of a partition as of a snapshot timestamp, one page at a time
+    K23SI_EXPORT,
+    // rebuilds an empty partition from an export file
+    K23SI_RESTORE,
+
+    /************ K23SI batched heartbeats *****************/
+    // heartbeats multiple K23SI transactions whose TRHs are in the same partition
+    K23SI_TXN_HEARTBEAT_MULTI,
+
+    /************ K23SI range deletes *****************/
+    // erases a range of keys with a single range tombstone per partition
+    K23SI_RANGE_DELETE,
+
+    /************ K23SI change streams *****************/
+    // polls the changes committed in a partition after a timestamp
+    K23SI_CHANGES,
+
+    /************ K23SI transaction routines *****************/
+    // runs a transaction routine registered on the node of a partition
+    K23SI_RUN_ROUTINE,
+
     /************* TSO *******************/
     // API from TSO client to any TSO server to get all healthy TSO server URLs in the TSO server cluster
     GET_TSO_SERVER_URLS    = 100,  
@@ -84,6 +157,8 @@ enum Verbs : k2::Verb {
     GET_TSO_SERVICE_NODE_URLS,       
     // API from TSO client to get timestamp batch from any TSO worker cores          
     GET_TSO_TIMESTAMP_BATCH,             
+    // API to get several timestamp batches (e.g. coalesced from many clients) from any TSO worker core in one call
+    GET_TSO_TIMESTAMP_BATCHES,
 
     /************ END OF RESERVED BLOCK *****************/
     END=200
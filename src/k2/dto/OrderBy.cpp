@@ -0,0 +1,82 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "OrderBy.h"
+
+namespace k2 {
+namespace dto {
+
+RankKeyReader::RankKeyReader(String fieldName) : _fieldName(std::move(fieldName)) {
+}
+
+RankKey RankKeyReader::read(SKVRecord& rec) {
+    RankKey key;
+    if (rec.schema != _schema) {
+        _schema = rec.schema;
+        _fieldIndex = rec.schema->fieldIndex(_fieldName);
+    }
+    if (_fieldIndex < 0) {
+        return key;
+    }
+    const SchemaField& field = rec.schema->fields[_fieldIndex];
+    key.nullLast = field.nullLast;
+    K2_DTO_CAST_APPLY_FIELD_VALUE(_readField, field, rec, _fieldIndex, key);
+    return key;
+}
+
+template <typename T>
+void RankKeyReader::_readField(const SchemaField& field, SKVRecord& rec, uint32_t fieldIndex, RankKey& key) {
+    std::optional<T> value = rec.deserializeField<T>(fieldIndex);
+    if (!value) {
+        return;
+    }
+    if (_type == FieldType::NULL_T) {
+        _type = field.type;
+    }
+    else if (_type != field.type) {
+        throw TypeMismatchException(fmt::format("order by field {} over different types", _fieldName));
+    }
+    key.value = std::move(*value);
+}
+
+int RankKeyReader::compare(const RankKey& a, const RankKey& b) {
+    bool aNull = std::holds_alternative<std::monostate>(a.value);
+    bool bNull = std::holds_alternative<std::monostate>(b.value);
+    if (aNull && bNull) {
+        return 0;
+    }
+    if (aNull) {
+        return a.nullLast ? 1 : -1;
+    }
+    if (bNull) {
+        return b.nullLast ? -1 : 1;
+    }
+    // the reader only returns values of one type
+    if (a.value < b.value) {
+        return -1;
+    }
+    return b.value < a.value ? 1 : 0;
+}
+
+} // ns dto
+} // ns k2
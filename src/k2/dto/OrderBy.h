@@ -0,0 +1,151 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <variant>
+#include <vector>
+
+#include <k2/common/Common.h>
+#include <k2/transport/PayloadSerialization.h>
+#include "Expression.h"
+#include "FieldTypes.h"
+#include "SKVRecord.h"
+
+namespace k2 {
+namespace dto {
+
+// Orders the records which pass the filter of a query by the value of a field, and keeps only the first of them
+struct OrderBy {
+    String fieldName; // empty for a query which isn't ordered by a field
+    bool descending = false;
+    uint32_t limit = 0; // the number of records kept. Must not be 0 for a field
+
+    K2_PAYLOAD_FIELDS(fieldName, descending, limit);
+    K2_DEF_FMT(OrderBy, fieldName, descending, limit);
+};
+
+// The value of the ordering field of a record
+struct RankKey {
+    std::variant<std::monostate, String, int16_t, int32_t, int64_t, float, double, bool,
+                 std::decimal::decimal64, std::decimal::decimal128, FieldType> value; // monostate for NULL
+    bool nullLast = false;
+};
+
+// Reads the RankKey of records. Null fields, and fields which don't exist in the schema version of a record, are
+// NULL. Throws TypeMismatchException if different records have different types for the field
+class RankKeyReader {
+public:
+    RankKeyReader(String fieldName);
+
+    RankKey read(SKVRecord& rec);
+
+    // Compares two keys read by the same reader: negative if a is before b in ascending order, 0 if they are
+    // equal, positive otherwise. NULLs are before the values, or after them for fields with nullLast set
+    static int compare(const RankKey& a, const RankKey& b);
+
+private:
+    template <typename T>
+    void _readField(const SchemaField& field, SKVRecord& rec, uint32_t fieldIndex, RankKey& key);
+
+    String _fieldName;
+    FieldType _type = FieldType::NULL_T; // the type of the first value read
+
+    // the field index for the last schema we've seen. Queries rarely see more than one schema version
+    std::shared_ptr<Schema> _schema;
+    int32_t _fieldIndex = -1;
+};
+
+// Keeps the first OrderBy::limit items added to it, in the order of an OrderBy. The order of the items is that of
+// the records they were added with, and the order in which they were added for equal values. The server ranks
+// the records of each page of a query, and the client ranks the records of all the pages and partitions.
+// Throws InvalidExpressionException for an OrderBy without a field or a limit
+template <typename T>
+class RecordRanker {
+public:
+    RecordRanker(const OrderBy& orderBy) : _reader(orderBy.fieldName), _descending(orderBy.descending),
+                                           _limit(orderBy.limit) {
+        if (orderBy.fieldName.empty() || _limit == 0) {
+            throw InvalidExpressionException();
+        }
+    }
+
+    // Ranks the item of the given record, which may be the record itself. Items which are past the limit are
+    // dropped right away
+    void add(SKVRecord& rec, T&& item) {
+        RankKey key = _reader.read(rec);
+        _Entry entry{.key = std::move(key), .seq = _seq++, .item = std::move(item)};
+        auto before = [this](const _Entry& a, const _Entry& b) { return _before(a, b); };
+        if (_heap.size() < _limit) {
+            _heap.push_back(std::move(entry));
+            std::push_heap(_heap.begin(), _heap.end(), before);
+            return;
+        }
+        // the top of the heap is the last of the items kept
+        if (!_before(entry, _heap.front())) {
+            return;
+        }
+        std::pop_heap(_heap.begin(), _heap.end(), before);
+        _heap.back() = std::move(entry);
+        std::push_heap(_heap.begin(), _heap.end(), before);
+    }
+
+    size_t size() const { return _heap.size(); }
+
+    // Returns the items in order and clears the ranker
+    std::vector<T> take() {
+        std::sort_heap(_heap.begin(), _heap.end(), [this](const _Entry& a, const _Entry& b) { return _before(a, b); });
+        std::vector<T> result;
+        result.reserve(_heap.size());
+        for (_Entry& entry : _heap) {
+            result.push_back(std::move(entry.item));
+        }
+        _heap.clear();
+        return result;
+    }
+
+private:
+    struct _Entry {
+        RankKey key;
+        uint64_t seq = 0;
+        T item;
+    };
+
+    bool _before(const _Entry& a, const _Entry& b) const {
+        int cmp = RankKeyReader::compare(a.key, b.key);
+        if (_descending) {
+            cmp = -cmp;
+        }
+        return cmp < 0 || (cmp == 0 && a.seq < b.seq);
+    }
+
+    RankKeyReader _reader;
+    bool _descending = false;
+    uint32_t _limit = 0;
+    uint64_t _seq = 0;
+    std::vector<_Entry> _heap;
+};
+
+} // ns dto
+} // ns k2
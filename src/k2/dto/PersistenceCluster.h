@@ -28,7 +28,12 @@ namespace dto {
 struct PersistenceGroup{
     String name;
     std::vector<String> plogServerEndpoints;
-    K2_PAYLOAD_FIELDS(name, plogServerEndpoints);
+    // 0 for a group which keeps a full copy of each plog on every plog server. Otherwise the group is erasure-coded:
+    // plogs are striped over the first (plogServerEndpoints.size() - parityFragments) servers in cells of cellSize
+    // bytes, and the remaining servers hold the Reed-Solomon parity of each stripe
+    uint32_t parityFragments = 0;
+    uint32_t cellSize = 0;
+    K2_PAYLOAD_FIELDS(name, plogServerEndpoints, parityFragments, cellSize);
 };
 
 
@@ -35,23 +35,17 @@ void SKVRecord::serializeNull() {
         throw NoFieldFoundException();
     }
 
-    for (size_t i = 0; i < schema->partitionKeyFields.size(); ++i) {
-        if (schema->partitionKeyFields[i] == fieldCursor) {
-            partitionKeys[i] = schema->fields[fieldCursor].nullLast ? NullLastToKeyString() : NullFirstToKeyString();
-        }
-    }
-
-    for (size_t i = 0; i < schema->rangeKeyFields.size(); ++i) {
-        if (schema->rangeKeyFields[i] == fieldCursor) {
-            rangeKeys[i] = schema->fields[fieldCursor].nullLast ? NullLastToKeyString() : NullFirstToKeyString();
-        }
+    int32_t keySlot = schema->keySlots()[fieldCursor];
+    if (keySlot >= 0) {
+        keyString(keySlot) = schema->fields[fieldCursor].nullLast ? NullLastToKeyString() : NullFirstToKeyString();
     }
 
     if (storage.excludedFields.size() == 0) {
-        storage.excludedFields = std::vector<bool>(schema->fields.size(), false);
+        storage.excludedFields = FieldBitmap(schema->fields.size(), false);
     }
 
     storage.excludedFields[fieldCursor] = true;
+    storage.fieldOffsets.push_back(storage.fieldData.getCurrentPosition().offset);
     ++fieldCursor;
 }
 
@@ -76,6 +70,18 @@ void SKVRecord::seekField(uint32_t fieldIndex) {
         return;
     }
 
+    if (fieldIndex < schema->fields.size()) {
+        if (storage.fieldOffsets.empty()) {
+            // first random access into this record. Index it so that this and any later seek are O(1)
+            storage.indexFields(*schema);
+        }
+        if (fieldIndex < storage.fieldOffsets.size()) {
+            storage.fieldData.seek(storage.fieldOffsets[fieldIndex]);
+            fieldCursor = fieldIndex;
+            return;
+        }
+    }
+
     if (fieldIndex < fieldCursor) {
         fieldCursor = 0;
         storage.fieldData.seek(0);
@@ -116,26 +122,16 @@ void SKVRecord::makeKeyString(std::optional<T> value, const String& fieldName, i
     // tmp variable is need for vararg macro expansion
     (void) tmp;
     (void) fieldName;
-    for (size_t i = 0; i < schema->partitionKeyFields.size(); ++i) {
-        // Subtracting 1 from fieldCursor here and below because this function gets called
-        // after the deserialize function moves the fieldCursor
-        if (schema->partitionKeyFields[i] == fieldCursor-1) {
-            if (value.has_value()) {
-                partitionKeys[i] = FieldToKeyString<T>(*value);
-            } else {
-                partitionKeys[i] = schema->fields[fieldCursor-1].nullLast ? NullLastToKeyString() : NullFirstToKeyString();
-            }
-        }
+    // Subtracting 1 from fieldCursor because this function gets called after the deserialize function
+    // moves the fieldCursor
+    int32_t keySlot = schema->keySlots()[fieldCursor-1];
+    if (keySlot < 0) {
+        return;
     }
-
-    for (size_t i = 0; i < schema->rangeKeyFields.size(); ++i) {
-         if (schema->rangeKeyFields[i] == fieldCursor-1) {
-            if (value.has_value()) {
-                rangeKeys[i] = FieldToKeyString<T>(*value);
-            } else {
-                rangeKeys[i] = schema->fields[fieldCursor-1].nullLast ? NullLastToKeyString() : NullFirstToKeyString();
-            }
-        }
+    if (value.has_value()) {
+        keyString(keySlot) = FieldToKeyString<T>(*value);
+    } else {
+        keyString(keySlot) = schema->fields[fieldCursor-1].nullLast ? NullLastToKeyString() : NullFirstToKeyString();
     }
 }
 
@@ -220,11 +216,32 @@ dto::Key SKVRecord::getKey() {
     };
 }
 
+std::optional<std::string_view> SKVRecord::deserializeStringViewUnchecked(uint32_t fieldIndex, String& scratch) {
+    if (fieldIndex != fieldCursor) {
+        seekField(fieldIndex);
+    }
+
+    ++fieldCursor;
+
+    if (storage.excludedFields.size() > 0 && storage.excludedFields[fieldIndex]) {
+        return std::nullopt;
+    }
+
+    // strings are serialized as their size, including the terminating '\0', followed by the bytes
+    uint32_t size = 0;
+    const char* data = nullptr;
+    if (!storage.fieldData.read(size) || size == 0 || !storage.fieldData.readView(data, size, scratch)) {
+        throw DeserializationError("Deserialization of payload in SKVRecord failed");
+    }
+    return std::string_view(data, size - 1);
+}
+
 SKVRecord::Storage SKVRecord::Storage::share() {
     return SKVRecord::Storage {
         excludedFields,
         fieldData.shareAll(),
-        schemaVersion
+        schemaVersion,
+        fieldOffsets
     };
 }
 
@@ -232,10 +249,45 @@ SKVRecord::Storage SKVRecord::Storage::copy() {
     return SKVRecord::Storage {
         excludedFields,
         fieldData.copy(),
-        schemaVersion
+        schemaVersion,
+        fieldOffsets
     };
 }
 
+template <typename T>
+void _skipField(const SchemaField& field, Payload& payload, bool& success) {
+    (void) field;
+    T value{};
+    success = payload.read(value);
+}
+
+bool SKVRecord::Storage::indexFields(const Schema& schema) {
+    if (fieldOffsets.size() == schema.fields.size()) {
+        return true;
+    }
+
+    std::vector<uint32_t> offsets;
+    offsets.reserve(schema.fields.size());
+    auto pos = fieldData.getCurrentPosition();
+    fieldData.seek(0);
+    for (size_t i = 0; i < schema.fields.size(); ++i) {
+        offsets.push_back(fieldData.getCurrentPosition().offset);
+        if (excludedFields.size() > 0 && excludedFields[i]) {
+            // excluded fields take no space in the payload
+            continue;
+        }
+        bool success = false;
+        K2_DTO_CAST_APPLY_FIELD_VALUE(_skipField, schema.fields[i], fieldData, success);
+        if (!success) {
+            fieldData.seek(pos);
+            return false;
+        }
+    }
+    fieldData.seek(pos);
+    fieldOffsets = std::move(offsets);
+    return true;
+}
+
 SKVRecord SKVRecord::cloneToOtherSchema(const String& collection, std::shared_ptr<Schema> other_schema) {
     // Check schema compatibility (same number of fields and same types in order)
     if (other_schema->fields.size() != schema->fields.size()) {
@@ -250,6 +302,32 @@ SKVRecord SKVRecord::cloneToOtherSchema(const String& collection, std::shared_pt
     return SKVRecord(collection, other_schema, storage.share(), keyValuesAvailable);
 }
 
+template <typename T>
+void _copyField(const SchemaField& field, SKVRecord& from, uint32_t fieldIndex, SKVRecord& to) {
+    (void) field;
+    std::optional<T> value = from.deserializeField<T>(fieldIndex);
+    if (value) {
+        to.serializeNext<T>(std::move(*value));
+    } else {
+        to.serializeNull();
+    }
+}
+
+SKVRecord SKVRecord::copyFieldsToSchema(std::shared_ptr<Schema> other) {
+    SKVRecord result(collectionName, other);
+    for (const SchemaField& otherField : other->fields) {
+        uint32_t fieldIndex = 0;
+        while (fieldIndex < schema->fields.size() && schema->fields[fieldIndex].name != otherField.name) {
+            ++fieldIndex;
+        }
+        if (fieldIndex == schema->fields.size()) {
+            throw NoFieldFoundException(fmt::format("field {} not found in record", otherField.name));
+        }
+        K2_DTO_CAST_APPLY_FIELD_VALUE(_copyField, schema->fields[fieldIndex], *this, fieldIndex, result);
+    }
+    return result;
+}
+
 // deepCopies an SKVRecord including copying (not sharing) the storage payload
 SKVRecord SKVRecord::deepCopy() {
     Storage new_storage = storage.copy();
@@ -24,8 +24,10 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 #include <optional>
+#include <string_view>
 
 #include <k2/dto/Collection.h>
+#include <k2/dto/FieldBitmap.h>
 #include <k2/dto/FieldTypes.h>
 #include <k2/dto/ControlPlaneOracle.h>
 #include "Log.h"
@@ -34,6 +36,7 @@ namespace k2 {
 class K2TxnHandle;
 class txn_testing;
 class K23SITest;
+class K23SIEngineBench;
 
 namespace dto {
 
@@ -69,18 +72,19 @@ public:
             throw TypeMismatchException("Schema not followed in record serialization");
         }
 
-        for (size_t i = 0; i < schema->partitionKeyFields.size(); ++i) {
-            if (schema->partitionKeyFields[i] == fieldCursor) {
-                partitionKeys[i] = FieldToKeyString<T>(field);
-            }
-        }
+        serializeNextUnchecked<T>(field);
+    }
 
-        for (size_t i = 0; i < schema->rangeKeyFields.size(); ++i) {
-            if (schema->rangeKeyFields[i] == fieldCursor) {
-                rangeKeys[i] = FieldToKeyString<T>(field);
-            }
+    // Same as serializeNext but without the schema check, for the callers which have already checked that
+    // the type of the next field is T, e.g. the SKV_RECORD_FIELDS types after bindLayout
+    template <typename T>
+    void serializeNextUnchecked(T field) {
+        int32_t keySlot = schema->keySlots()[fieldCursor];
+        if (keySlot >= 0) {
+            keyString(keySlot) = FieldToKeyString<T>(field);
         }
 
+        storage.fieldOffsets.push_back(storage.fieldData.getCurrentPosition().offset);
         storage.fieldData.write(field);
         ++fieldCursor;
     }
@@ -108,13 +112,61 @@ public:
     // no-arg version to satisfy the template expansion above in the terminal case
     void writeMany() {}
 
+    // The writeMany for the types whose layout was checked with bindLayout
+    template <typename T, typename... ArgsT>
+    void writeManyUnchecked(T& value, ArgsT&... args) {
+        if constexpr(isPayloadSerializableType<T>()) {
+            value.__writeFieldsUnchecked(*this);
+        } else if (!value) {
+            serializeNull();
+        } else {
+            serializeNextUnchecked<typename std::decay_t<decltype(value)>::value_type>(*value);
+        }
+        writeManyUnchecked(args...);
+    }
+    void writeManyUnchecked() {}
+
+    // Appends the field types of the given SKV_RECORD_FIELDS values to types, in serialization order
+    template <typename T, typename... ArgsT>
+    static void appendLayout(std::vector<FieldType>& types, const T& value, const ArgsT&... args) {
+        if constexpr(isPayloadSerializableType<T>()) {
+            value.__appendLayout(types);
+        } else {
+            types.push_back(TToFieldType<typename std::decay_t<T>::value_type>());
+        }
+        appendLayout(types, args...);
+    }
+    static void appendLayout(std::vector<FieldType>&) {}
+
+    // Checks that the fields of the SKV_RECORD_FIELDS type T are a prefix of the fields of this record's schema,
+    // so that T can be converted to or from this record without checking each field. The result is cached per
+    // thread for the last schema seen with T, so the layout of a type is only walked when it is bound to a
+    // new schema. Only a record at its first field can be bound; the nested types are covered by their parent
+    template <typename T>
+    bool bindLayout(const T& value) {
+        thread_local std::shared_ptr<Schema> boundSchema;
+        thread_local bool layoutMatches = false;
+        if (fieldCursor != 0 || !schema) {
+            return false;
+        }
+        if (boundSchema != schema) {
+            std::vector<FieldType> types;
+            value.__appendLayout(types);
+            layoutMatches = types.size() <= schema->fields.size();
+            for (size_t i = 0; layoutMatches && i < types.size(); ++i) {
+                layoutMatches = types[i] == schema->fields[i].type;
+            }
+            boundSchema = schema;
+        }
+        return layoutMatches;
+    }
+
     // Deserialization can be in any order, but the preferred method is in-order
     template <typename T>
     std::optional<T> deserializeField(const String& name) {
-        for (size_t i = 0; i < schema->fields.size(); ++i) {
-            if (schema->fields[i].name == name) {
-                return deserializeField<T>(i);
-            }
+        int32_t i = schema->fieldIndex(name);
+        if (i >= 0) {
+            return deserializeField<T>((uint32_t)i);
         }
 
         throw NoFieldFoundException(fmt::format("schema not followed in record deserialization for name {}", name));
@@ -125,13 +177,20 @@ public:
     template <typename T>
     std::optional<T> deserializeField(uint32_t fieldIndex) {
         FieldType ft = TToFieldType<T>();
-        std::optional<T> null_val = std::nullopt;
-
         if (fieldIndex >= schema->fields.size() || ft != schema->fields[fieldIndex].type) {
 
             throw TypeMismatchException(fmt::format("schema not followed in record deserialization for index {}", fieldIndex));
         }
 
+        return deserializeFieldUnchecked<T>(fieldIndex);
+    }
+
+    // Same as deserializeField but without the schema check, for the callers which have already checked that
+    // the type of the field is T
+    template <typename T>
+    std::optional<T> deserializeFieldUnchecked(uint32_t fieldIndex) {
+        std::optional<T> null_val = std::nullopt;
+
         if (fieldIndex != fieldCursor) {
             seekField(fieldIndex);
         }
@@ -151,6 +210,11 @@ public:
         return value;
     }
 
+    // Reads a STRING field in place, for the callers which have already checked the type of the field: the view
+    // is of the bytes in the record's payload, and is valid as long as the record is. The bytes are copied
+    // into scratch only if they are split across buffers. Returns nullopt for a null field
+    std::optional<std::string_view> deserializeStringViewUnchecked(uint32_t fieldIndex, String& scratch);
+
     template <typename T>
     std::optional<T> deserializeNext() {
         return deserializeField<T>(fieldCursor);
@@ -172,6 +236,18 @@ public:
     // no-arg version to satisfy the template expansion above in the terminal case
     void readMany() {}
 
+    // The readMany for the types whose layout was checked with bindLayout
+    template <typename T, typename... ArgsT>
+    void readManyUnchecked(T& value, ArgsT&... args) {
+        if constexpr(isPayloadSerializableType<T>()) {
+            value.__readFieldsUnchecked(*this);
+        } else {
+            value = deserializeFieldUnchecked<typename std::decay_t<decltype(value)>::value_type>(fieldCursor);
+        }
+        readManyUnchecked(args...);
+    }
+    void readManyUnchecked() {}
+
     // We expose a shared payload in case the user wants to write it to file or otherwise
     // store it on their own. For normal K23SI operations the user does not need to touch this
     Payload getSharedPayload();
@@ -191,12 +267,18 @@ public:
     // by a read request
     struct Storage {
         // Bitmap of fields that are excluded because they are optional or this is for a partial update
-        std::vector<bool> excludedFields;
+        FieldBitmap excludedFields;
         Payload fieldData;
         uint32_t schemaVersion = 0;
+        // The offset of each field in fieldData, which makes access to any field O(1). This is a local cache
+        // and it is not serialized: it is filled in as the record is serialized, or by indexFields()
+        std::vector<uint32_t> fieldOffsets;
 
         Storage share();
         Storage copy();
+        // Computes the fieldOffsets for the given schema by walking the payload once, if not already known.
+        // Returns false if the payload cannot be walked, in which case no offsets are recorded
+        bool indexFields(const Schema& schema);
         K2_PAYLOAD_FIELDS(excludedFields, fieldData, schemaVersion);
         K2_DEF_FMT(Storage, excludedFields, schemaVersion);
     };
@@ -209,6 +291,10 @@ public:
     SKVRecord(const String& collection, std::shared_ptr<Schema> s, Storage&& storage, bool keyValuesAvailable);
 
     SKVRecord cloneToOtherSchema(const String& collection, std::shared_ptr<Schema> other_schema);
+    // Makes a record of the other schema with the values of the fields of this record which have the same names,
+    // e.g. the record of a secondary index(see Schema::makeIndexSchema). Throws NoFieldFoundException if this
+    // record's schema doesn't have one of the fields of the other schema
+    SKVRecord copyFieldsToSchema(std::shared_ptr<Schema> other);
     // deepCopies an SKVRecord including copying (not sharing) the storage payload
     SKVRecord deepCopy();
 
@@ -231,6 +317,10 @@ public:
     }
 
 private:
+    // the key string for the given key slot of the schema(see Schema::keySlots)
+    String& keyString(int32_t keySlot) {
+        return (size_t)keySlot < partitionKeys.size() ? partitionKeys[keySlot] : rangeKeys[keySlot - partitionKeys.size()];
+    }
     void constructKeyStrings();
     template <typename T>
     void makeKeyString(std::optional<T> value, const String& fieldName, int tmp);
@@ -245,6 +335,7 @@ private:
     friend class k2::K2TxnHandle;
     friend class k2::txn_testing;
     friend class k2::K23SITest;
+    friend class k2::K23SIEngineBench;
 };
 
 // Convience macro that does the switch statement on the record field type for the user
@@ -313,14 +404,33 @@ private:
 // This macro is used to implement the templated read and write operations that
 // automatically convert an SKVRecrod to a user-defined type. Fields must be declared
 // in order of the schema and each primitive field must be wrapped in std::optional. It
-// borrows the PayloadSerializableTrait machinery for nested support.
-#define SKV_RECORD_FIELDS(...)                                 \
-    struct __K2PayloadSerializableTraitTag__ {};               \
-    void __writeFields(k2::dto::SKVRecord& __record__) const { \
-        __record__.writeMany(__VA_ARGS__);                     \
-    }                                                          \
-    void __readFields(k2::dto::SKVRecord& __record__) {        \
-        return __record__.readMany(__VA_ARGS__);               \
+// borrows the PayloadSerializableTrait machinery for nested support. Once the layout of the type
+// is bound to the schema of the record(see SKVRecord::bindLayout), the fields are converted without
+// the per-field schema checks; otherwise each field is checked against the schema as it is converted.
+#define SKV_RECORD_FIELDS(...)                                                     \
+    struct __K2PayloadSerializableTraitTag__ {};                                   \
+    void __writeFields(k2::dto::SKVRecord& __record__) const {                     \
+        if (__record__.bindLayout(*this)) {                                        \
+            __record__.writeManyUnchecked(__VA_ARGS__);                            \
+        } else {                                                                   \
+            __record__.writeMany(__VA_ARGS__);                                     \
+        }                                                                          \
+    }                                                                              \
+    void __readFields(k2::dto::SKVRecord& __record__) {                            \
+        if (__record__.bindLayout(*this)) {                                        \
+            __record__.readManyUnchecked(__VA_ARGS__);                             \
+        } else {                                                                   \
+            __record__.readMany(__VA_ARGS__);                                      \
+        }                                                                          \
+    }                                                                              \
+    void __writeFieldsUnchecked(k2::dto::SKVRecord& __record__) const {            \
+        __record__.writeManyUnchecked(__VA_ARGS__);                                \
+    }                                                                              \
+    void __readFieldsUnchecked(k2::dto::SKVRecord& __record__) {                   \
+        __record__.readManyUnchecked(__VA_ARGS__);                                 \
+    }                                                                              \
+    void __appendLayout(std::vector<k2::dto::FieldType>& __types__) const {        \
+        k2::dto::SKVRecord::appendLayout(__types__, __VA_ARGS__);                  \
     }
 
 } // ns dto
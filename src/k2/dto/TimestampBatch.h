@@ -76,6 +76,24 @@ struct GetTimeStampBatchResponse
     K2_DEF_FMT(GetTimeStampBatchResponse, timeStampBatch);
 };
 
+struct GetTimeStampBatchesRequest
+{
+    // one entry per coalesced request
+    std::vector<uint16_t> batchSizesRequested;
+
+    K2_PAYLOAD_FIELDS(batchSizesRequested);
+    K2_DEF_FMT(GetTimeStampBatchesRequest, batchSizesRequested);
+};
+
+struct GetTimeStampBatchesResponse
+{
+    // in the same order as GetTimeStampBatchesRequest::batchSizesRequested
+    std::vector<TimestampBatch> timeStampBatches;
+
+    K2_PAYLOAD_FIELDS(timeStampBatches);
+    K2_DEF_FMT(GetTimeStampBatchesResponse, timeStampBatches);
+};
+
 struct GetTSOServerURLsRequest
 {
     K2_PAYLOAD_EMPTY;
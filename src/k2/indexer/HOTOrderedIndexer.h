@@ -0,0 +1,319 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include <boost/intrusive/list.hpp>
+
+#include <k2/common/ByteCompare.h>
+#include <k2/common/Common.h>
+#include <hot/singlethreaded/HOTSingleThreaded.hpp>
+
+namespace k2
+{
+
+// Helpers for building order-preserving binary keys out of multi-component keys.
+// Each component is escaped so that the encoded bytes never contain 0x00 and terminated with a marker
+// which sorts before any escaped byte. This makes the byte-wise order of the encoded keys identical to the
+// lexicographic order of the component tuples, and no encoded key is a prefix of another one, which is what
+// the HOT trie requires.
+//  0x00 -> 0x01 0x02
+//  0x01 -> 0x01 0x03
+//  end of component -> 0x01 0x01
+namespace ordered_key {
+inline size_t encodedSize(const String& component) {
+    size_t sz = component.size() + 2;
+    for (char c : component) {
+        if ((uint8_t)c <= 1) ++sz;
+    }
+    return sz;
+}
+
+inline char* encode(char* out, const String& component) {
+    for (char c : component) {
+        if ((uint8_t)c <= 1) {
+            *out++ = 0x01;
+            *out++ = (char)((uint8_t)c + 2);
+        } else {
+            *out++ = c;
+        }
+    }
+    *out++ = 0x01;
+    *out++ = 0x01;
+    return out;
+}
+} // ns ordered_key
+
+// HOT stores a fixed-size copy of the key bytes, so the trie holds at most this many bytes of each key
+inline constexpr size_t HOTMaxKeyLength = 255;
+
+template<typename NodePtrT>
+struct EncodedKeyExtractor {
+    inline size_t getKeyLength(NodePtrT const &node) const {
+        return std::min(node->encoded.size(), HOTMaxKeyLength);
+    }
+    inline const char* operator()(NodePtrT const &node) const {
+        return node->encoded.c_str();
+    }
+};
+
+// An ordered map from KeyT to ValueT which uses the HOT trie for lookups and maintains an intrusive
+// doubly-linked list of the entries in key order, so that it can be iterated in both directions.
+// The interface is the subset of std::map which the K23SI module needs, so the module can be compiled
+// with either engine.
+// KeyEncoderT must provide `void operator()(const KeyT&, String& out) const`, which should produce an
+// order-preserving encoding of the key (see ordered_key above) without any 0x00 bytes.
+// Keys whose encoding is longer than HOTMaxKeyLength go into the trie by their first HOTMaxKeyLength bytes. Such
+// keys with the same prefix are consecutive in the list, and only the first of them is in the trie; lookups walk
+// the list from there. Cutting at a fixed length keeps the trie keys prefix-free, since no encoding of a key is a
+// prefix of the encoding of another one.
+template <typename KeyT, typename ValueT, typename KeyEncoderT>
+class HOTOrderedIndexer {
+public:
+    typedef KeyT key_type;
+    typedef ValueT mapped_type;
+    typedef std::pair<const KeyT, ValueT> value_type;
+
+private:
+    struct Node : public boost::intrusive::list_base_hook<> {
+        template <typename K>
+        Node(String&& enc, K&& key) : encoded(std::move(enc)), kv(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple()) {}
+        String encoded;
+        value_type kv;
+    };
+    typedef boost::intrusive::list<Node, boost::intrusive::constant_time_size<true>> ListT;
+    typedef hot::singlethreaded::HOTSingleThreaded<Node*, EncodedKeyExtractor> TrieT;
+
+    template <typename ListIterT, typename RefT>
+    class IteratorBase {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename HOTOrderedIndexer::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef RefT& reference;
+        typedef RefT* pointer;
+
+        IteratorBase() = default;
+        IteratorBase(ListIterT it) : _it(it) {}
+        // allow iterator -> const_iterator conversion
+        template <typename OI, typename OR>
+        IteratorBase(const IteratorBase<OI, OR>& o) : _it(o._it) {}
+
+        reference operator*() const { return _it->kv; }
+        pointer operator->() const { return &_it->kv; }
+        IteratorBase& operator++() { ++_it; return *this; }
+        IteratorBase operator++(int) { auto tmp = *this; ++_it; return tmp; }
+        IteratorBase& operator--() { --_it; return *this; }
+        IteratorBase operator--(int) { auto tmp = *this; --_it; return tmp; }
+        bool operator==(const IteratorBase& o) const { return _it == o._it; }
+        bool operator!=(const IteratorBase& o) const { return _it != o._it; }
+
+    private:
+        template <typename, typename> friend class IteratorBase;
+        friend class HOTOrderedIndexer;
+        ListIterT _it;
+    };
+
+public:
+    typedef IteratorBase<typename ListT::iterator, value_type> iterator;
+    typedef IteratorBase<typename ListT::const_iterator, const value_type> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    HOTOrderedIndexer() = default;
+    ~HOTOrderedIndexer() { clear(); }
+    DISABLE_COPY_MOVE(HOTOrderedIndexer);
+
+    iterator begin() { return iterator(_list.begin()); }
+    iterator end() { return iterator(_list.end()); }
+    const_iterator begin() const { return const_iterator(_list.begin()); }
+    const_iterator end() const { return const_iterator(_list.end()); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    size_t size() const { return _list.size(); }
+    bool empty() const { return _list.empty(); }
+
+    iterator find(const KeyT& key) {
+        _encoder(key, _scratch);
+        auto res = _trie.lookup(_scratch.c_str(), _trieKeyLength(_scratch));
+        if (!res.mIsValid) {
+            return end();
+        }
+        auto it = _seekInGroup(_list.iterator_to(*res.mValue), _scratch);
+        if (it == _list.end() || it->encoded != _scratch) {
+            return end();
+        }
+        return iterator(it);
+    }
+
+    // first element whose key is not less than the given key
+    iterator lower_bound(const KeyT& key) {
+        _encoder(key, _scratch);
+        return iterator(_lowerBound(_scratch));
+    }
+
+    // first element whose key is greater than the given key
+    iterator upper_bound(const KeyT& key) {
+        _encoder(key, _scratch);
+        auto it = _lowerBound(_scratch);
+        if (it != _list.end() && it->encoded == _scratch) {
+            ++it;
+        }
+        return iterator(it);
+    }
+
+    // find the element with the given key, or insert a default-constructed value for it
+    ValueT& operator[](const KeyT& key) {
+        return _findOrInsert(key)->kv.second;
+    }
+
+    ValueT& operator[](KeyT&& key) {
+        return _findOrInsert(std::move(key))->kv.second;
+    }
+
+    // Same as operator[], without the search for the position of a key which is greater than all keys in the
+    // index, e.g. when building the index from sorted keys. Other keys are inserted as with operator[]
+    ValueT& append(KeyT&& key) {
+        _encoder(key, _scratch);
+        if (!_list.empty() && compareBytes(_list.back().encoded, _scratch) >= 0) {
+            return _findOrInsert(std::move(key))->kv.second;
+        }
+        Node* node = new Node(String(_scratch), std::move(key));
+        // a long key may join the group of the last key, whose first key stays in the trie
+        if (_list.empty() || !_sameTrieKey(_list.back().encoded, node->encoded)) {
+            _trie.insert(node, _trieKeyLength(node->encoded));
+        }
+        _list.push_back(*node);
+        return node->kv.second;
+    }
+
+    iterator erase(iterator it) {
+        Node* node = &(*it._it);
+        bool inTrie = node->encoded.size() <= HOTMaxKeyLength || it._it == _list.begin() ||
+                      !_sameTrieKey(std::prev(it._it)->encoded, node->encoded);
+        auto next = _list.erase(it._it);
+        if (inTrie) {
+            size_t len = _trieKeyLength(node->encoded);
+            _trie.remove(node->encoded.c_str(), len);
+            // the next key of the group takes over the trie entry
+            if (next != _list.end() && _sameTrieKey(next->encoded, node->encoded)) {
+                _trie.insert(&(*next), len);
+            }
+        }
+        delete node;
+        return iterator(next);
+    }
+
+    size_t erase(const KeyT& key) {
+        auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    void clear() {
+        while (!_list.empty()) {
+            erase(begin());
+        }
+    }
+
+private:
+    static size_t _trieKeyLength(const String& encoded) {
+        return std::min(encoded.size(), HOTMaxKeyLength);
+    }
+
+    // true if the two encoded keys share their trie entry, i.e. they are equal or long keys with the same prefix
+    static bool _sameTrieKey(const String& a, const String& b) {
+        size_t len = _trieKeyLength(a);
+        return len == _trieKeyLength(b) && std::memcmp(a.data(), b.data(), len) == 0;
+    }
+
+    // the first key which is not less than the given one, starting from a key in the trie which is not greater
+    // than it. Only long keys have to walk the group of that key
+    typename ListT::iterator _seekInGroup(typename ListT::iterator it, const String& encoded) {
+        while (it != _list.end() && _sameTrieKey(it->encoded, encoded) && compareBytes(it->encoded, encoded) < 0) {
+            ++it;
+        }
+        return it;
+    }
+
+    typename ListT::iterator _lowerBound(const String& encoded) {
+        auto it = _trie.end();
+        if (encoded.size() > HOTMaxKeyLength) {
+            _prefix.assign(encoded.data(), HOTMaxKeyLength);
+            it = _trie.lower_bound(_prefix.c_str());
+        }
+        else {
+            it = _trie.lower_bound(encoded.c_str());
+        }
+        if (it == _trie.end()) {
+            return _list.end();
+        }
+        return _seekInGroup(_list.iterator_to(**it), encoded);
+    }
+
+    template <typename K>
+    Node* _findOrInsert(K&& key) {
+        _encoder(key, _scratch);
+        size_t len = _trieKeyLength(_scratch);
+        auto res = _trie.lookup(_scratch.c_str(), len);
+        if (res.mIsValid && _scratch.size() <= HOTMaxKeyLength) {
+            return res.mValue;
+        }
+        // the successor has to be found before the new key is in the trie
+        auto pos = res.mIsValid ? _seekInGroup(_list.iterator_to(*res.mValue), _scratch) : _lowerBound(_scratch);
+        if (pos != _list.end() && pos->encoded == _scratch) {
+            return &(*pos);
+        }
+        Node* node = new Node(String(_scratch), std::forward<K>(key));
+        if (!res.mIsValid) {
+            _trie.insert(node, len);
+        }
+        else if (pos == _list.iterator_to(*res.mValue)) {
+            // the new key goes first in its group, so it takes over the trie entry
+            _trie.remove(res.mValue->encoded.c_str(), len);
+            _trie.insert(node, len);
+        }
+        _list.insert(pos, *node);
+        return node;
+    }
+
+    TrieT _trie;
+    ListT _list;
+    KeyEncoderT _encoder;
+    // reused buffers for encoding lookup keys and for the trie prefix of long ones
+    String _scratch;
+    String _prefix;
+};
+
+} // ns k2
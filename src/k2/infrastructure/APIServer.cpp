@@ -24,7 +24,9 @@ Copyright(c) 2020 Futurewei Cloud
 #include "APIServer.h"
 #include <k2/common/Log.h>
 #include <k2/common/Common.h>
+#include <k2/common/MemoryAccounting.h>
 #include <k2/dto/Collection.h>
+#include <k2/transport/RPCDispatcher.h>
 
 #include <seastar/core/shared_ptr.hh>
 #include <seastar/net/socket_defs.hh>
@@ -77,6 +79,7 @@ APIServer::start() {
         return seastar::make_ready_future<>();
     }
 
+    _profiler.start(_profilerFrequency());
     return add_routes()
     .then([this, listenAddr=std::move(listenAddr)]() {
         return _server.listen(listenAddr);
@@ -85,12 +88,41 @@ APIServer::start() {
 
 seastar::future<> APIServer::gracefulStop() {
     K2LOG_I(log::apisvr, "Stopping APIServer");
+    _profiler.stop();
     return  _server.stop();
 }
 
 seastar::future<> APIServer::add_routes() {
     _server._routes.put(seastar::httpd::GET, "/api",
             new get_routes_handler([this] () { return get_current_routes();}));
+
+    // the debug endpoints are GETs, listed along with the API paths
+    _registered_routes.emplace_back(std::make_pair("memory", "GET the memory accounted to each subsystem on this core, as json"));
+    _server._routes.put(seastar::httpd::GET, "/api/memory",
+            new get_routes_handler([] () { return mem::MemoryAccounting::toJSON();}));
+    _registered_routes.emplace_back(std::make_pair("profile",
+        "GET the CPU stacks of this core sampled since the previous GET, folded for flamegraph.pl"));
+    _server._routes.put(seastar::httpd::GET, "/api/profile",
+            new get_routes_handler([this] () {
+                if (!_profiler.running()) {
+                    return String("the profiler is disabled. Start the node with a non-zero profiler_frequency\n");
+                }
+                return _profiler.takeFoldedStacks();
+            }));
+
+    registerAPIObserver<ConfigReloadRequest, ConfigReloadResponse>("config",
+        "POST {name, value} to change a reloadable option on all cores of the process, without a restart",
+        [] (ConfigReloadRequest&& request) {
+            return config::reload(request.name, request.value)
+            .then([request] {
+                K2LOG_I(log::apisvr, "reloaded config {}={}", request.name, request.value);
+                return RPCResponse(Statuses::S200_OK("config reloaded"),
+                                   ConfigReloadResponse{.name = request.name, .value = request.value});
+            })
+            .handle_exception_type([] (std::invalid_argument& e) {
+                return RPCResponse(Statuses::S400_Bad_Request(e.what()), ConfigReloadResponse{});
+            });
+        });
     return seastar::make_ready_future<>();
 }
 
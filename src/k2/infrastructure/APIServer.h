@@ -24,6 +24,7 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 #include <k2/common/Common.h>
+#include <k2/common/Profiler.h>
 #include <k2/config/Config.h>
 #include <k2/transport/BaseTypes.h>
 
@@ -35,6 +36,20 @@ namespace log {
 inline thread_local k2::logging::Logger apisvr("k2::api_server");
 }
 
+// Sets a reloadable option(see config::reload) on all cores of the process, e.g.
+// {"name": "k23si_query_pagination_limit", "value": "500"}
+struct ConfigReloadRequest {
+    String name;
+    String value; // as it would be written on the command line
+    K2_DEF_FMT(ConfigReloadRequest, name, value);
+};
+
+struct ConfigReloadResponse {
+    String name;
+    String value;
+    K2_DEF_FMT(ConfigReloadResponse, name, value);
+};
+
 // Helper class for registering HTTP routes
 class api_route_handler : public seastar::httpd::handler_base  {
 public:
@@ -100,6 +115,10 @@ private:
     ConfigVar<std::vector<String>> _tcp_endpoints{"tcp_endpoints"};
 
     seastar::httpd::http_server _server;
+
+    // samples the CPU time of this core for the profile endpoint. 0 disables the profiler
+    profiling::Profiler _profiler;
+    ConfigVar<uint32_t> _profilerFrequency{"profiler_frequency", 0};
     std::vector<std::pair<String, String>> _registered_routes;
 
     seastar::future<> add_routes();
@@ -0,0 +1,310 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "ColdBlock.h"
+
+#include <cstring>
+#include <unordered_map>
+
+#include "Log.h"
+
+namespace k2 {
+
+namespace {
+
+void _putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+uint64_t _getVarint(const uint8_t*& p) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = *p++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+void _putValue(std::vector<uint8_t>& out, const String& value) {
+    _putVarint(out, value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+// skips a value written with _putValue and returns its length. p is left at the bytes of the value
+size_t _getValueSize(const uint8_t*& p) {
+    return _getVarint(p);
+}
+
+uint8_t _deltaWidth(dto::FieldType type) {
+    switch (type) {
+        case dto::FieldType::INT16T: return sizeof(int16_t);
+        case dto::FieldType::INT32T: return sizeof(int32_t);
+        case dto::FieldType::INT64T: return sizeof(int64_t);
+        default: return 0;
+    }
+}
+
+int64_t _readInt(const String& value, uint8_t width) {
+    switch (width) {
+        case sizeof(int16_t): { int16_t v; std::memcpy(&v, value.data(), width); return v; }
+        case sizeof(int32_t): { int32_t v; std::memcpy(&v, value.data(), width); return v; }
+        default: { int64_t v; std::memcpy(&v, value.data(), width); return v; }
+    }
+}
+
+void _writeInt(Payload& out, int64_t value, uint8_t width) {
+    switch (width) {
+        case sizeof(int16_t): { int16_t v = (int16_t)value; out.write(&v, width); break; }
+        case sizeof(int32_t): { int32_t v = (int32_t)value; out.write(&v, width); break; }
+        default: out.write(&value, width);
+    }
+}
+
+} // ns
+
+ColdBlock::ColdBlock(const dto::Schema& schema, const std::vector<dto::SKVRecord::Storage*>& rows) :
+    _rowCount((uint32_t)rows.size()),
+    _schemaVersion(schema.version) {
+    const size_t numFields = schema.fields.size();
+    _columns.resize(numFields);
+    std::vector<std::vector<String>> values(numFields);
+    for (auto& column : _columns) {
+        column.present = dto::FieldBitmap(rows.size(), false);
+    }
+
+    for (uint32_t row = 0; row < rows.size(); ++row) {
+        dto::SKVRecord::Storage& storage = *rows[row];
+        K2ASSERT(log::skvsvr, storage.fieldOffsets.size() == numFields, "cold rows must have their field offsets");
+        Payload payload = storage.fieldData.shareAll();
+        for (size_t field = 0; field < numFields; ++field) {
+            if (!storage.excludedFields.empty() && storage.excludedFields[field]) {
+                continue;
+            }
+            size_t start = storage.fieldOffsets[field];
+            size_t end = field + 1 < numFields ? storage.fieldOffsets[field + 1] : payload.getSize();
+            String value(String::initialized_later(), end - start);
+            payload.seek(start);
+            payload.read(value.data(), value.size());
+            _columns[field].present[row] = true;
+            values[field].push_back(std::move(value));
+        }
+    }
+
+    for (size_t field = 0; field < numFields; ++field) {
+        _encode(_columns[field], values[field], schema.fields[field].type);
+    }
+}
+
+void ColdBlock::_encode(Column& column, const std::vector<String>& values, dto::FieldType type) {
+    std::vector<uint8_t> plain;
+    for (auto& value : values) {
+        _putValue(plain, value);
+    }
+    column.encoding = Encoding::Plain;
+    column.data = std::move(plain);
+    auto consider = [&column] (Encoding encoding, std::vector<uint8_t>&& data, size_t overhead) {
+        if (data.size() + overhead < column.data.size() + column.dictionary.size() * sizeof(uint32_t)) {
+            column.encoding = encoding;
+            column.data = std::move(data);
+            return true;
+        }
+        return false;
+    };
+
+    std::vector<uint8_t> runs;
+    for (size_t i = 0; i < values.size();) {
+        size_t runEnd = i + 1;
+        while (runEnd < values.size() && values[runEnd] == values[i]) {
+            ++runEnd;
+        }
+        _putVarint(runs, runEnd - i);
+        _putValue(runs, values[i]);
+        i = runEnd;
+    }
+    consider(Encoding::RunLength, std::move(runs), 0);
+
+    std::unordered_map<String, uint32_t> distinct;
+    std::vector<uint8_t> dictData;
+    std::vector<uint32_t> dictOffsets;
+    std::vector<uint32_t> indexes;
+    indexes.reserve(values.size());
+    for (auto& value : values) {
+        auto [it, inserted] = distinct.try_emplace(value, (uint32_t)dictOffsets.size());
+        if (inserted) {
+            dictOffsets.push_back((uint32_t)dictData.size());
+            _putValue(dictData, value);
+        }
+        indexes.push_back(it->second);
+    }
+    dictOffsets.push_back((uint32_t)dictData.size());
+    for (uint32_t index : indexes) {
+        _putVarint(dictData, index);
+    }
+    if (consider(Encoding::Dictionary, std::move(dictData), dictOffsets.size() * sizeof(uint32_t))) {
+        column.dictionary = std::move(dictOffsets);
+    }
+
+    uint8_t width = _deltaWidth(type);
+    bool fixedWidth = width > 0;
+    for (size_t i = 0; fixedWidth && i < values.size(); ++i) {
+        fixedWidth = values[i].size() == width;
+    }
+    if (fixedWidth) {
+        std::vector<uint8_t> deltas;
+        uint64_t previous = 0;
+        for (auto& value : values) {
+            uint64_t current = (uint64_t)_readInt(value, width);
+            int64_t delta = (int64_t)(current - previous);
+            _putVarint(deltas, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63)); // zigzag
+            previous = current;
+        }
+        if (consider(Encoding::Delta, std::move(deltas), 0)) {
+            column.dictionary.clear();
+            column.width = width;
+        }
+    }
+    if (column.encoding != Encoding::Dictionary) {
+        column.dictionary.clear();
+    }
+    column.data.shrink_to_fit();
+    column.dictionary.shrink_to_fit();
+    column.bytes = column.data.data();
+    column.size = column.data.size();
+}
+
+bool ColdBlock::spill(ColdSpill& spill) {
+    size_t total = 0;
+    for (auto& column : _columns) {
+        total += column.size;
+    }
+    auto [segment, dest] = spill.allocate(total);
+    if (!segment) {
+        return false;
+    }
+    for (auto& column : _columns) {
+        if (column.size > 0) {
+            std::memcpy(dest, column.bytes, column.size);
+        }
+        column.bytes = dest;
+        dest += column.size;
+        column.data = std::vector<uint8_t>{};
+    }
+    _segment = std::move(segment);
+    return true;
+}
+
+size_t ColdBlock::encodedBytes() const {
+    size_t result = 0;
+    for (auto& column : _columns) {
+        result += column.size + column.dictionary.size() * sizeof(uint32_t) + column.present.size() / 8;
+    }
+    return result;
+}
+
+void ColdBlock::_decodeValue(const Column& column, uint32_t index, Payload& out) {
+    const uint8_t* p = column.bytes;
+    switch (column.encoding) {
+        case Encoding::Plain: {
+            for (uint32_t i = 0; i < index; ++i) {
+                p += _getValueSize(p);
+            }
+            size_t size = _getValueSize(p);
+            out.write(p, size);
+            break;
+        }
+        case Encoding::RunLength: {
+            while (true) {
+                uint64_t run = _getVarint(p);
+                size_t size = _getValueSize(p);
+                if (index < run) {
+                    out.write(p, size);
+                    break;
+                }
+                index -= run;
+                p += size;
+            }
+            break;
+        }
+        case Encoding::Dictionary: {
+            p += column.dictionary.back();
+            uint64_t entry = 0;
+            for (uint32_t i = 0; i <= index; ++i) {
+                entry = _getVarint(p);
+            }
+            const uint8_t* value = column.bytes + column.dictionary[entry];
+            size_t size = _getValueSize(value);
+            out.write(value, size);
+            break;
+        }
+        case Encoding::Delta: {
+            uint64_t current = 0;
+            for (uint32_t i = 0; i <= index; ++i) {
+                uint64_t zigzag = _getVarint(p);
+                current += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+            }
+            _writeInt(out, (int64_t)current, column.width);
+            break;
+        }
+    }
+}
+
+dto::SKVRecord::Storage ColdBlock::decode(uint32_t row) const {
+    K2ASSERT(log::skvsvr, row < _rowCount, "row out of range in cold block");
+    dto::SKVRecord::Storage storage;
+    storage.schemaVersion = _schemaVersion;
+    storage.fieldOffsets.reserve(_columns.size());
+    Payload payload(Payload::DefaultAllocator);
+    dto::FieldBitmap excludedFields(_columns.size(), false);
+    bool anyExcluded = false;
+
+    for (size_t field = 0; field < _columns.size(); ++field) {
+        const Column& column = _columns[field];
+        storage.fieldOffsets.push_back(payload.getCurrentPosition().offset);
+        if (!column.present[row]) {
+            excludedFields[field] = true;
+            anyExcluded = true;
+            continue;
+        }
+        // the index of the row's value among the values of the column
+        uint32_t index = 0;
+        for (uint32_t i = 0; i < row; ++i) {
+            index += column.present[i];
+        }
+        _decodeValue(column, index, payload);
+    }
+
+    if (anyExcluded) {
+        storage.excludedFields = std::move(excludedFields);
+    }
+    payload.truncateToCurrent();
+    storage.fieldData = std::move(payload);
+    return storage;
+}
+
+} // ns k2
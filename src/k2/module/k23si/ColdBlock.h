@@ -0,0 +1,102 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include <k2/common/Common.h>
+#include <k2/dto/FieldBitmap.h>
+#include <k2/dto/SKVRecord.h>
+
+#include "ColdSpill.h"
+
+namespace k2 {
+
+// A block of cold records of the same schema version, re-encoded column-wise to save memory.
+// Each field of the schema is a column holding the values of the rows which have the field, in row
+// order. A column is stored in whichever of its encodings is the smallest. The rows are decoded back
+// to the row format one at a time, when they are accessed(see VersionChain::freeze).
+// Decoding a row walks the columns up to the row, so blocks are capped at MaxRows rows.
+// The encoded columns can be moved out of memory into a ColdSpill, after which they are decoded from there
+class ColdBlock {
+public:
+    enum class Encoding : uint8_t {
+        Plain,      // the length and bytes of each value
+        RunLength,  // runs of equal values, as the run length and the value
+        Dictionary, // the distinct values, followed by the index of each value among them
+        Delta       // integer fields only: the difference of each value from the one before it
+    };
+
+    // Encodes the given rows, which must be payloads of the given schema with their field offsets
+    // (see SKVRecord::Storage::indexFields)
+    ColdBlock(const dto::Schema& schema, const std::vector<dto::SKVRecord::Storage*>& rows);
+    DISABLE_COPY_MOVE(ColdBlock);
+
+    // the most rows a block is made of. Each access to a frozen row pays for decoding up to this many values
+    static constexpr uint32_t MaxRows = 256;
+
+    uint32_t rowCount() const { return _rowCount; }
+
+    // the number of bytes held by the encoded columns
+    size_t encodedBytes() const;
+
+    // Moves the encoded data of the columns into the spill. Returns false if the spill has no space for them, in
+    // which case the block stays as it is. The presence bitmaps and dictionary offsets stay in memory
+    bool spill(ColdSpill& spill);
+    bool spilled() const { return (bool)_segment; }
+
+    Encoding encoding(uint32_t field) const { return _columns[field].encoding; }
+
+    // Decodes the given row back to the row format. The field offsets of the result are filled in
+    dto::SKVRecord::Storage decode(uint32_t row) const;
+
+private:
+    struct Column {
+        Encoding encoding = Encoding::Plain;
+        // by row, whether the row has a value for the field
+        dto::FieldBitmap present;
+        std::vector<uint8_t> data;
+        // the encoded data, which is either in data or in the spill segment of the block
+        const uint8_t* bytes = nullptr;
+        size_t size = 0;
+        // for Dictionary, the offset in data of each distinct value, followed by the offset of the indexes
+        std::vector<uint32_t> dictionary;
+        // for Delta, the size of the values
+        uint8_t width = 0;
+    };
+
+    // encodes the given values into the column with the smallest encoding which applies to them
+    static void _encode(Column& column, const std::vector<String>& values, dto::FieldType type);
+
+    // writes the index-th value of the column(counting only the rows which have a value) to the payload
+    static void _decodeValue(const Column& column, uint32_t index, Payload& out);
+
+    std::vector<Column> _columns;
+    uint32_t _rowCount = 0;
+    uint32_t _schemaVersion = 0;
+    // the spill segment which holds the data of the columns, if the block was spilled
+    seastar::lw_shared_ptr<ColdSpill::Segment> _segment;
+};
+
+} // ns k2
@@ -0,0 +1,97 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "ColdSpill.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "Log.h"
+
+namespace k2 {
+
+seastar::lw_shared_ptr<ColdSpill::Segment> ColdSpill::Segment::create(const String& directory, size_t capacity) {
+    int fd = ::open(directory.c_str(), O_TMPFILE | O_RDWR, 0600);
+    if (fd < 0) {
+        K2LOG_W(log::skvsvr, "unable to create a cold spill file in {}: {}", directory, std::strerror(errno));
+        return nullptr;
+    }
+    // reserve the blocks up front: running out of disk later would fault writes through the mapping
+    int err = ::posix_fallocate(fd, 0, capacity);
+    if (err != 0) {
+        K2LOG_W(log::skvsvr, "unable to allocate {} bytes for a cold spill file in {}: {}", capacity, directory, std::strerror(err));
+        ::close(fd);
+        return nullptr;
+    }
+    void* base = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        K2LOG_W(log::skvsvr, "unable to map a cold spill file in {}: {}", directory, std::strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+    // cold blocks are accessed by row, not sequentially
+    ::madvise(base, capacity, MADV_RANDOM);
+    return seastar::make_lw_shared<Segment>(fd, (uint8_t*)base, capacity);
+}
+
+ColdSpill::Segment::~Segment() {
+    ::munmap(_base, _capacity);
+    ::close(_fd);
+}
+
+uint8_t* ColdSpill::Segment::allocate(size_t size) {
+    if (_capacity - _used < size) {
+        return nullptr;
+    }
+    uint8_t* result = _base + _used;
+    _used += size;
+    return result;
+}
+
+std::pair<seastar::lw_shared_ptr<ColdSpill::Segment>, uint8_t*> ColdSpill::allocate(size_t size) {
+    if (size > _segmentBytes) {
+        return {nullptr, nullptr};
+    }
+    uint8_t* result = _current ? _current->allocate(size) : nullptr;
+    if (result == nullptr) {
+        if (Clock::now() < _retryAt) {
+            // don't try again for every block once the directory failed us
+            return {nullptr, nullptr};
+        }
+        _current = Segment::create(_directory, _segmentBytes);
+        if (!_current) {
+            _retryAt = Clock::now() + RETRY_DELAY;
+            return {nullptr, nullptr};
+        }
+        _segmentsCreated++;
+        result = _current->allocate(size);
+    }
+    return {_current, result};
+}
+
+} // ns k2
@@ -0,0 +1,84 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <utility>
+
+#include <seastar/core/shared_ptr.hh>
+
+#include <k2/common/Common.h>
+
+namespace k2 {
+
+// Holds the encoded columns of spilled cold blocks(see ColdBlock::spill) in files on local disk, so that a
+// partition can keep more cold values than fit in its memory. The files are mapped into memory: a block is written
+// by copying it into the mapping, which the kernel writes back in the background, and read by plain memory
+// accesses which the page cache serves or faults in from disk. The page cache is thus the block cache of the
+// spilled blocks, and the memory of the node beyond what the reactors are given is what it can use.
+// The files are anonymous(O_TMPFILE): spilled values are recovered from the WAL and the checkpoints like all other
+// values, so nothing is left to clean up after a restart. A file is freed once none of its blocks is alive
+class ColdSpill {
+public:
+    // a file of spilled blocks. The blocks in it keep it alive
+    class Segment {
+    public:
+        // creates a file of the given size in the directory. Returns nullptr if that fails
+        static seastar::lw_shared_ptr<Segment> create(const String& directory, size_t capacity);
+        Segment(int fd, uint8_t* base, size_t capacity) : _fd(fd), _base(base), _capacity(capacity) {}
+        ~Segment();
+        DISABLE_COPY_MOVE(Segment);
+
+        // space for the given number of bytes, or nullptr if the segment is full
+        uint8_t* allocate(size_t size);
+
+    private:
+        int _fd = -1;
+        uint8_t* _base = nullptr;
+        size_t _capacity = 0;
+        size_t _used = 0;
+    };
+
+    ColdSpill(String directory, size_t segmentBytes) : _directory(std::move(directory)), _segmentBytes(segmentBytes) {}
+    DISABLE_COPY_MOVE(ColdSpill);
+
+    // space for the given number of bytes in a segment, and the segment which has to be kept alive while the space
+    // is used. The segment is null if the bytes don't fit in a segment or a new segment can't be created
+    std::pair<seastar::lw_shared_ptr<Segment>, uint8_t*> allocate(size_t size);
+
+    // the number of segments created so far
+    uint64_t segmentsCreated() const { return _segmentsCreated; }
+
+private:
+    String _directory;
+    size_t _segmentBytes;
+    // the segment new blocks go to
+    seastar::lw_shared_ptr<Segment> _current;
+    uint64_t _segmentsCreated = 0;
+    // after a failure to create a segment, blocks stay in memory for a while before we try again
+    static constexpr Duration RETRY_DELAY = 10s;
+    TimePoint _retryAt{};
+};
+
+} // ns k2
@@ -47,28 +47,220 @@ struct K23SIConfig {
     // timeout for write requests (including potential PUSH operations)
     ConfigDuration writeTimeout{"write_timeout", 150ms};
 
+    // how long a read or write which finds a WI of another transaction waits for it to be finalized before it
+    // PUSHes, bounded by its deadline. The PUSH then resolves deadlocks and stuck incumbents. 0 PUSHes right away
+    ConfigDuration conflictWaitTimeout{"k23si_conflict_wait_timeout", 20ms};
+
     // what is our read cache size in number of entries
     ConfigVar<uint64_t> readCacheSize{"k23si_read_cache_size", 1000000};
 
+    // max number of key ranges the snapshot read cache keeps, before their timestamps are folded into its watermark
+    ConfigVar<uint64_t> snapshotReadCacheSize{"k23si_snapshot_read_cache_size", 100000};
+
+    // read cache timestamps are rounded up to a multiple of this duration. Zero disables bucketing
+    ConfigDuration readCacheTimestampBucket{"k23si_read_cache_ts_bucket", 0s};
+
+    // whether to merge read cache intervals into overlapping ranges with close timestamps
+    ConfigVar<bool> readCacheCoalesce{"k23si_read_cache_coalesce", false};
+
+    // timestamps within this window of each other are considered close for coalescing
+    ConfigDuration readCacheCoalesceWindow{"k23si_read_cache_coalesce_window", 0s};
+
+    // snapshot(bounded-staleness) reads must be at least this far behind the current TSO time. Writes to a key at or
+    // below the newest snapshot read of that key are rejected, so this bounds how far back snapshot reads fence writers
+    ConfigDuration snapshotReadMinStaleness{"k23si_snapshot_read_min_staleness", 1s};
+
     // how many times to try and finalize a transaction
     ConfigVar<uint64_t> finalizeRetries{"k23si_txn_finalize_retries", 10};
 
-    // how many writes to finalize in parallel
-    ConfigVar<uint64_t> finalizeBatchSize{"k23si_txn_finalize_batch_size", 20};
+    // max number of keys carried in a single batched finalize request
+    ConfigVar<uint64_t> finalizeBatchSize{"k23si_txn_finalize_batch_size", 100};
 
-    // Max number of records to return in a single query response
-    ConfigVar<uint32_t> paginationLimit{"k23si_query_pagination_limit", 10};
+    // max number of batched finalize requests in flight from this shard
+    ConfigVar<uint64_t> finalizeMaxInflight{"k23si_txn_finalize_max_inflight", 32};
+
+    // A transaction which wrote up to this many keys, all in the partition of its TRH, is committed in one phase: End
+    // persists the commit together with the finalized WIs and commits them in place, without the finalizer.
+    // 0 disables one-phase commits
+    ConfigVar<uint64_t> onePhaseCommitMaxKeys{"k23si_one_phase_commit_max_keys", 1000};
+
+    // how many expired transactions(heartbeat or retention window) are processed concurrently before yielding
+    ConfigVar<uint32_t> txnExpiryBatchSize{"k23si_txn_expiry_batch_size", 64};
+
+    // how long a finalized transaction record is kept(without its write keys) so that late PUSH/End requests
+    // still see the final outcome. 0 deletes the record as soon as it is finalized
+    ConfigDuration finalizedTxnLinger{"k23si_txn_finalized_linger", 0s};
+
+    // Max number of records to return in a single query response. Pages are normally sized by
+    // queryPageBytes below and this only caps pages of very small records
+    ConfigVar<uint32_t> paginationLimit{"k23si_query_pagination_limit", 1000};
+
+    // Target size in bytes of the records in a single query response. The page ends with the record
+    // which reaches it. Requests can ask for a different size. 0 means pages are only limited by record count
+    ConfigVar<uint32_t> queryPageBytes{"k23si_query_page_bytes", 64*1024};
 
     // Min records in response needed to avoid a push during query processing,
     // and instead returning a paginated response early
     // Default is > paginiationLimit so it will always push
-    ConfigVar<uint32_t> queryPushLimit{"k23si_query_push_limit", 11};
+    ConfigVar<uint32_t> queryPushLimit{"k23si_query_push_limit", 1001};
+
+    // Number of records a query scan gathers before applying its filter to all of them at once.
+    // 1 applies the filter to each record as it is found
+    ConfigVar<uint32_t> queryFilterBatchSize{"k23si_query_filter_batch_size", 64};
+
+    // Max number of pages a streaming query may have prepared ahead of its client. Requests for more credits
+    // than this are capped
+    ConfigVar<uint32_t> queryStreamMaxCredits{"k23si_query_stream_max_credits", 4};
+
+    // A streaming query whose client hasn't asked for a page in this long is dropped, along with its pages
+    ConfigDuration queryStreamIdleTimeout{"k23si_query_stream_idle_timeout", 10s};
+
+    // Max number of prepared queries(filters and projections registered by clients) a partition keeps. The least
+    // recently used ones are dropped past this
+    ConfigVar<uint32_t> preparedQueriesMax{"k23si_prepared_queries_max", 1024};
+
+    // size of the slabs used to store record payloads
+    ConfigVar<uint64_t> recordArenaSlabSize{"k23si_record_arena_slab_size", 1024*1024};
+
+    // records in slabs which have less than this fraction of live data are relocated during compaction
+    ConfigVar<double> recordArenaCompactionThreshold{"k23si_record_arena_compaction_threshold", 0.25};
+
+    // how often to run the background garbage collection of versions which fall out of the retention window
+    ConfigDuration gcInterval{"k23si_gc_interval", 10s};
+
+    // how many keys the garbage collector examines before checking if it should yield
+    ConfigVar<uint32_t> gcChunkSize{"k23si_gc_chunk_size", 1000};
+
+    // bits per key of the per-schema filters which let reads of absent keys skip the index lookup. The filters
+    // are rebuilt by the garbage collector. 0 disables them
+    ConfigVar<uint32_t> keyFilterBitsPerKey{"k23si_key_filter_bits_per_key", 10};
+
+    // keep a hash index of the keys of each schema next to the ordered one, for the point reads, writes and
+    // finalizes. It costs a copy of each key, and scans still use the ordered index
+    ConfigVar<bool> pointIndexes{"k23si_point_indexes", false};
+
+    // the garbage collector re-encodes cold records column-wise in blocks of up to this many records of the same
+    // schema version(see ColdBlock). A record is cold when its only version is older than the retention window
+    // and it wasn't accessed since the previous pass. Capped at ColdBlock::MaxRows. 0 disables cold blocks
+    ConfigVar<uint32_t> coldBlockRows{"k23si_cold_block_rows", 0};
+
+    // a directory on local disk where the cold blocks are spilled out of memory(see ColdSpill). The spilled blocks
+    // are cached by the page cache, so the reactors should leave memory to it(see --memory). Empty keeps cold
+    // blocks in memory
+    ConfigVar<String> coldSpillDir{"k23si_cold_spill_dir", ""};
+
+    // the size of the files the cold blocks are spilled into
+    ConfigVar<uint64_t> coldSpillSegmentBytes{"k23si_cold_spill_segment_bytes", 64*1024*1024};
+
+    // how often to checkpoint the partition into persistence so that the WAL can be truncated. 0 disables checkpoints
+    ConfigDuration checkpointInterval{"k23si_checkpoint_interval", 0s};
+
+    // checkpoints are streamed in chunks of about this many bytes. This must stay below the chunk size of the
+    // persistence volume
+    ConfigVar<uint64_t> checkpointChunkBytes{"k23si_checkpoint_chunk_bytes", 16*1024};
+
+    // how many checkpoint chunks or WAL ranges are fetched concurrently during recovery
+    ConfigVar<uint32_t> recoveryParallelism{"k23si_recovery_parallelism", 8};
+
+    // how many WAL records(LSNs) are requested at a time during recovery
+    ConfigVar<uint64_t> recoveryWALRange{"k23si_recovery_wal_range", 1024};
+
+    // how often a partition closes a timestamp(the current TSO time minus snapshotReadMinStaleness) and writes it to
+    // the WAL, which lets its followers serve snapshot reads up to it. 0 disables closed timestamps
+    ConfigDuration closedTimestampInterval{"k23si_closed_timestamp_interval", 0s};
+
+    // how often a follower partition polls persistence for new WAL records of the partition it follows
+    ConfigDuration followerPollInterval{"k23si_follower_poll_interval", 50ms};
+
+    // timeout for each chunk of keys sent to the new partition when a partition is split
+    ConfigDuration splitTransferTimeout{"k23si_split_transfer_timeout", 1s};
+
+    // how many partition keys of recent requests are sampled to pick a split key for the partition
+    ConfigVar<uint32_t> loadKeySamples{"k23si_load_key_samples", 128};
+
+    // how many of the keys with the most reads, writes, pushes and conflict aborts each partition tracks for the
+    // hot keys inspect request. Only one in hotKeysSampleInterval reads and writes is counted. 0 disables tracking
+    ConfigVar<uint32_t> hotKeys{"k23si_hot_keys", 32};
+    ConfigVar<uint32_t> hotKeysSampleInterval{"k23si_hot_keys_sample_interval", 16};
+
+    // A migrated partition sends the keys changed while it was sending the previous round again, for up to this
+    // many rounds. It is fenced for the last round once that has no more than migrationFenceKeys keys
+    ConfigVar<uint32_t> migrationCatchUpRounds{"k23si_migration_catch_up_rounds", 5};
+    ConfigVar<uint32_t> migrationFenceKeys{"k23si_migration_fence_keys", 1000};
+
+    // partition exports(see K23SIExportRequest) are paced to this many bytes per second on each partition, so that
+    // backups leave the core to the foreground requests. 0 disables the pacing
+    ConfigVar<uint64_t> exportBytesPerSec{"k23si_export_bytes_per_sec", 32*1024*1024};
+    // the size of an exported page, unless the request asks for another
+    ConfigVar<uint64_t> exportPageBytes{"k23si_export_page_bytes", 256*1024};
+
+    // how many committed changes each partition keeps for change stream subscribers(see K23SIChangesRequest). A
+    // subscriber which falls further behind has to resume from a snapshot. 0 disables change streams
+    ConfigVar<uint64_t> changesRetained{"k23si_changes_retained", 100000};
+    // how often a change poll without changes to return checks for new ones while it waits, and the longest it waits
+    ConfigDuration changesPollInterval{"k23si_changes_poll_interval", 10ms};
+    ConfigDuration changesMaxWait{"k23si_changes_max_wait", 1s};
 
     // the endpoint for our persistence
     ConfigVar<std::vector<String>> persistenceEndpoint{"k23si_persistence_endpoints"};
     ConfigDuration persistenceTimeout{"k23si_persistence_timeout", 10s};
 
+    // how many of the persistence endpoints each core replicates its writes to, and how many of them must
+    // acknowledge a write before it is durable. A write quorum of 0 means a majority of the replicas
+    ConfigVar<uint32_t> persistenceReplicas{"k23si_persistence_replicas", 1};
+    ConfigVar<uint32_t> persistenceWriteQuorum{"k23si_persistence_write_quorum", 0};
+
+    // values persisted concurrently from the same shard are batched into a single persistence request. The batch
+    // is sent once it holds this many bytes or the window expires, whichever comes first
+    ConfigVar<uint64_t> persistenceBatchBytes{"k23si_persistence_batch_bytes", 16*1024};
+    ConfigDuration persistenceBatchWindow{"k23si_persistence_batch_window", 50us};
+
+    // for in-process benchmarks: persistence calls succeed right away without going anywhere. Nothing is durable
+    ConfigVar<bool> persistenceMock{"k23si_persistence_mock", false};
+
     // the endpoint for the CPO
     ConfigVar<String> cpoEndpoint{"k23si_cpo_endpoint", "tcp+k2rpc://127.0.0.1:12345"};
+
+    // The values which are read for every request or record, as plain typed fields(see K23SIHotConfig)
+    struct Snapshot {
+        Duration readTimeout;
+        Duration writeTimeout;
+        Duration persistenceTimeout;
+        uint64_t finalizeBatchSize;
+        uint32_t paginationLimit;
+        uint32_t queryPageBytes;
+        uint32_t queryPushLimit;
+        uint32_t queryFilterBatchSize;
+    };
+
+    Snapshot snapshot() const {
+        return Snapshot{
+            .readTimeout = readTimeout(),
+            .writeTimeout = writeTimeout(),
+            .persistenceTimeout = persistenceTimeout(),
+            .finalizeBatchSize = finalizeBatchSize(),
+            .paginationLimit = paginationLimit(),
+            .queryPageBytes = queryPageBytes(),
+            .queryPushLimit = queryPushLimit(),
+            .queryFilterBatchSize = queryFilterBatchSize()
+        };
+    }
+};
+
+// The snapshot of the hot path values of a K23SIConfig, for the subsystems which read them in their request and
+// record loops. It is taken again when the config is reloaded on its core, so reading a value is a plain load
+// with no reload check
+class K23SIHotConfig {
+public:
+    explicit K23SIHotConfig(const K23SIConfig& config) : _config(config), _values(config.snapshot()) {}
+    K23SIHotConfig(const K23SIHotConfig&) = delete;
+    K23SIHotConfig& operator=(const K23SIHotConfig&) = delete;
+
+    const K23SIConfig::Snapshot* operator->() const { return &_values; }
+
+private:
+    const K23SIConfig& _config;
+    K23SIConfig::Snapshot _values;
+    ConfigReloadObserver _observer{[this] { _values = _config.snapshot(); }};
 };
 }
@@ -0,0 +1,248 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "FinalizeScheduler.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace k2 {
+
+FinalizeScheduler::FinalizeScheduler(CPOClient& cpo) :
+    _cpo(cpo), _inflight(_config.finalizeMaxInflight()) {
+}
+
+void FinalizeScheduler::start(String collectionName) {
+    _collectionName = std::move(collectionName);
+}
+
+void FinalizeScheduler::setLocalPartition(std::function<bool(const dto::Key&)> owns, LocalFinalizeFunc finalize) {
+    _ownsLocal = std::move(owns);
+    _finalizeLocal = std::move(finalize);
+}
+
+seastar::future<> FinalizeScheduler::gracefulStop() {
+    K2LOG_I(log::skvsvr, "stopping finalize scheduler for coll={}", _collectionName);
+    return _gate.close();
+}
+
+seastar::future<Status> FinalizeScheduler::finalize(const dto::TxnId& txnId, dto::EndAction action,
+                                                    std::vector<dto::Key> keys, FastDeadline deadline) {
+    if (keys.empty()) {
+        return seastar::make_ready_future<Status>(dto::K23SIStatus::OK("nothing to finalize"));
+    }
+    if (_gate.is_closed()) {
+        return seastar::make_ready_future<Status>(dto::K23SIStatus::InternalError("finalize scheduler is stopped"));
+    }
+    bool allLocal = _ownsLocal && std::all_of(keys.begin(), keys.end(), _ownsLocal);
+    if (!allLocal && _cpo.collections.find(_collectionName) == _cpo.collections.end()) {
+        // we need the partition map in order to group the keys by partition. If we can't get it, the keys go out in
+        // a batch of unknown partitions and are retried individually if needed
+        return _cpo.GetAssignedPartitionWithRetry(deadline, _collectionName, keys[0])
+            .then([this, txnId, action, keys=std::move(keys), deadline] (auto&& status) mutable {
+                K2LOG_D(log::skvsvr, "Collection fetch for finalize completed with status={}", status);
+                return _enqueueAll(txnId, action, std::move(keys), deadline);
+            });
+    }
+    return _enqueueAll(txnId, action, std::move(keys), deadline);
+}
+
+seastar::future<Status> FinalizeScheduler::_enqueueAll(const dto::TxnId& txnId, dto::EndAction action,
+                                                       std::vector<dto::Key> keys, FastDeadline deadline) {
+    auto txn = seastar::make_lw_shared<TxnFinalize>();
+    txn->remaining = keys.size();
+    auto fut = txn->done.get_future();
+
+    auto it = _cpo.collections.find(_collectionName);
+    for (auto& key : keys) {
+        uint64_t partition = UnknownPartition;
+        if (_ownsLocal && _ownsLocal(key)) {
+            partition = LocalPartition;
+        }
+        else if (it != _cpo.collections.end()) {
+            auto* p = it->second.getPartitionForKey(key).partition;
+            if (p) {
+                partition = p->pvid.id;
+            }
+        }
+        _enqueue(partition, _makePending(txnId, action, std::move(key), deadline, txn));
+    }
+    return fut;
+}
+
+seastar::future<Status> FinalizeScheduler::finalize(const dto::TxnId& txnId, dto::EndAction action,
+                                                    std::vector<dto::K23SIWriteKeyGroup> groups, FastDeadline deadline) {
+    if (_gate.is_closed()) {
+        return seastar::make_ready_future<Status>(dto::K23SIStatus::InternalError("finalize scheduler is stopped"));
+    }
+    auto txn = seastar::make_lw_shared<TxnFinalize>();
+    for (auto& group : groups) {
+        txn->remaining += group.keys.size();
+    }
+    if (txn->remaining == 0) {
+        return seastar::make_ready_future<Status>(dto::K23SIStatus::OK("nothing to finalize"));
+    }
+    auto fut = txn->done.get_future();
+
+    for (auto& group : groups) {
+        if (group.keys.empty()) {
+            continue;
+        }
+        uint64_t partition = group.pvid.id;
+        if (_ownsLocal && _ownsLocal(group.keys[0])) {
+            partition = LocalPartition;
+        }
+        for (auto& key : group.keys) {
+            _enqueue(partition, _makePending(txnId, action, std::move(key), deadline, txn));
+        }
+    }
+    return fut;
+}
+
+FinalizeScheduler::Pending FinalizeScheduler::_makePending(const dto::TxnId& txnId, dto::EndAction action,
+                                                           dto::Key&& key, FastDeadline deadline,
+                                                           seastar::lw_shared_ptr<TxnFinalize> txn) {
+    dto::K23SITxnFinalizeRequest request{};
+    request.collectionName = _collectionName;
+    request.trh = txnId.trh;
+    request.mtr = txnId.mtr;
+    request.key = std::move(key);
+    request.action = action;
+    return Pending{.request = std::move(request), .deadline = deadline, .txn = std::move(txn)};
+}
+
+void FinalizeScheduler::_enqueue(uint64_t partition, Pending&& pending) {
+    auto& queue = _queues[partition];
+    queue.items.push_back(std::move(pending));
+    if (!queue.draining) {
+        queue.draining = true;
+        (void)seastar::with_gate(_gate, [this, partition] { return _drain(partition); });
+    }
+}
+
+seastar::future<> FinalizeScheduler::_drain(uint64_t partition) {
+    return seastar::repeat([this, partition] {
+        if (_queues[partition].items.empty()) {
+            _queues[partition].draining = false;
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+        }
+        return seastar::get_units(_inflight, 1).then([this, partition] (auto units) {
+            // we take the batch only once we have a slot, so that everything which was queued while we were
+            // waiting goes out in the same request
+            auto& queue = _queues[partition];
+            size_t count = std::min<size_t>(queue.items.size(), _hot->finalizeBatchSize);
+            std::vector<Pending> batch(std::make_move_iterator(queue.items.begin()),
+                                       std::make_move_iterator(queue.items.begin() + count));
+            queue.items.erase(queue.items.begin(), queue.items.begin() + count);
+            K2LOG_D(log::skvsvr, "Sending finalize batch of {} keys, {} remaining in queue", count, queue.items.size());
+
+            (void)seastar::with_gate(_gate, [this, partition, batch=std::move(batch), units=std::move(units)] () mutable {
+                return _sendBatch(std::move(batch), partition == LocalPartition).finally([units=std::move(units)] {});
+            });
+            return seastar::stop_iteration::no;
+        });
+    });
+}
+
+seastar::future<> FinalizeScheduler::_sendBatch(std::vector<Pending> batch, bool local) {
+    dto::K23SITxnFinalizeMultiRequest request{};
+    request.collectionName = _collectionName;
+    request.key = batch[0].request.key;
+    request.finalizes.reserve(batch.size());
+    // the batch has to go out within the most urgent deadline of its keys
+    FastDeadline deadline = batch[0].deadline;
+    for (auto& pending : batch) {
+        request.finalizes.push_back(pending.request);
+        if (pending.deadline.getRemaining() < deadline.getRemaining()) {
+            deadline = pending.deadline;
+        }
+    }
+
+    return seastar::do_with(std::move(request), std::move(batch), [this, deadline, local] (auto& request, auto& batch) {
+        // keys in our own partition are finalized directly, without going through the RPC layer
+        auto fut = local ?
+            _finalizeLocal(std::move(request)) :
+            _cpo.PartitionRequest<dto::K23SITxnFinalizeMultiRequest,
+                                  dto::K23SITxnFinalizeMultiResponse,
+                                  dto::Verbs::K23SI_TXN_FINALIZE_MULTI>
+                (deadline, request, false, false, (uint8_t)_config.finalizeRetries());
+        return fut.then([this, &batch] (auto&& responsePair) {
+            auto& [status, response] = responsePair;
+            std::vector<seastar::future<>> retries;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (!status.is2xxOK() || i >= response.statuses.size()) {
+                    K2LOG_E(log::skvsvr, "Finalize request did not succeed for {}, status={}", batch[i].request, status);
+                    _complete(batch[i], status);
+                    continue;
+                }
+                auto& keyStatus = response.statuses[i];
+                if (keyStatus == dto::K23SIStatus::RefreshCollection) {
+                    // the key was routed with a stale partition map. Retry on its own, which refreshes the map
+                    retries.push_back(_sendSingle(batch[i]));
+                    continue;
+                }
+                if (!keyStatus.is2xxOK()) {
+                    K2LOG_E(log::skvsvr, "Finalize request did not succeed for {}, status={}", batch[i].request, keyStatus);
+                }
+                _complete(batch[i], std::move(keyStatus));
+            }
+            return seastar::when_all_succeed(retries.begin(), retries.end());
+        })
+        .handle_exception([&batch] (auto exc) {
+            K2LOG_W_EXC(log::skvsvr, exc, "caught exception in batched finalize");
+            for (auto& pending : batch) {
+                _complete(pending, dto::K23SIStatus::InternalError("batched finalize failed"));
+            }
+        });
+    });
+}
+
+seastar::future<> FinalizeScheduler::_sendSingle(Pending& pending) {
+    return _cpo.PartitionRequest<dto::K23SITxnFinalizeRequest,
+                                 dto::K23SITxnFinalizeResponse,
+                                 dto::Verbs::K23SI_TXN_FINALIZE>
+        (pending.deadline, pending.request, false, false, (uint8_t)_config.finalizeRetries())
+    .then([&pending] (auto&& responsePair) {
+        auto& [status, response] = responsePair;
+        if (!status.is2xxOK()) {
+            K2LOG_E(log::skvsvr, "Finalize request did not succeed for {}, status={}", pending.request, status);
+        }
+        _complete(pending, std::move(status));
+    });
+}
+
+void FinalizeScheduler::_complete(Pending& pending, Status status) {
+    if (pending.completed) {
+        return;
+    }
+    pending.completed = true;
+    auto& txn = *pending.txn;
+    if (!status.is2xxOK() && txn.status.is2xxOK()) {
+        txn.status = std::move(status);
+    }
+    if (--txn.remaining == 0) {
+        txn.done.set_value(std::move(txn.status));
+    }
+}
+
+} // ns k2
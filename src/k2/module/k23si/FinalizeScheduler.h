@@ -0,0 +1,121 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include <seastar/core/gate.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include <k2/common/Chrono.h>
+#include <k2/cpo/client/CPOClient.h>
+#include <k2/dto/K23SI.h>
+#include <k2/dto/MessageVerbs.h>
+#include "Config.h"
+#include "Log.h"
+
+namespace k2 {
+
+// Schedules the finalization of write intents for all transactions owned by a TxnManager. Since we run one
+// partition module per core, this is the finalize scheduler for the whole shard.
+// Keys are queued per destination partition, and each queue is drained in batches which are sent as a single
+// K23SI_TXN_FINALIZE_MULTI request. While a queue waits for a free slot, finalizes from other transactions
+// for the same partition keep accumulating, so bursts of commits are coalesced into a few large requests.
+// The number of batches in flight is bounded by k23si_txn_finalize_max_inflight.
+class FinalizeScheduler {
+public:
+    FinalizeScheduler(CPOClient& cpo);
+
+    void start(String collectionName);
+
+    typedef std::function<seastar::future<std::tuple<Status, dto::K23SITxnFinalizeMultiResponse>>
+                          (dto::K23SITxnFinalizeMultiRequest&&)> LocalFinalizeFunc;
+    // Registers the partition served on this shard. Keys for which owns() returns true are finalized by calling
+    // the given function directly, skipping the partition map lookup and the RPC
+    void setLocalPartition(std::function<bool(const dto::Key&)> owns, LocalFinalizeFunc finalize);
+    seastar::future<> gracefulStop();
+
+    // Finalizes the given keys of a transaction with the given action. The returned status is OK once all keys
+    // have been finalized, or the error we got for one of the keys otherwise.
+    // The keys are moved into the queued requests so that we don't hold two copies while finalizing
+    seastar::future<Status> finalize(const dto::TxnId& txnId, dto::EndAction action,
+                                     std::vector<dto::Key> keys, FastDeadline deadline);
+
+    // Same as above, but for keys which the client already grouped by partition. Each group is queued for its
+    // partition without looking up the partition of each key. Groups routed with a stale partition map are
+    // retried key-by-key as usual
+    seastar::future<Status> finalize(const dto::TxnId& txnId, dto::EndAction action,
+                                     std::vector<dto::K23SIWriteKeyGroup> groups, FastDeadline deadline);
+
+private:
+    // tracks the completion of a single finalize() call
+    struct TxnFinalize {
+        size_t remaining = 0;
+        Status status = dto::K23SIStatus::OK("finalize succeeded");
+        seastar::promise<Status> done;
+    };
+
+    struct Pending {
+        dto::K23SITxnFinalizeRequest request;
+        FastDeadline deadline;
+        seastar::lw_shared_ptr<TxnFinalize> txn;
+        bool completed = false;
+    };
+
+    struct Queue {
+        std::vector<Pending> items;
+        bool draining = false;
+    };
+
+    seastar::future<Status> _enqueueAll(const dto::TxnId& txnId, dto::EndAction action,
+                                        std::vector<dto::Key> keys, FastDeadline deadline);
+    void _enqueue(uint64_t partition, Pending&& pending);
+    Pending _makePending(const dto::TxnId& txnId, dto::EndAction action, dto::Key&& key, FastDeadline deadline,
+                         seastar::lw_shared_ptr<TxnFinalize> txn);
+    seastar::future<> _drain(uint64_t partition);
+    seastar::future<> _sendBatch(std::vector<Pending> batch, bool local);
+    seastar::future<> _sendSingle(Pending& pending);
+    static void _complete(Pending& pending, Status status);
+
+    K23SIConfig _config;
+    K23SIHotConfig _hot{_config};
+    CPOClient& _cpo;
+    String _collectionName;
+    seastar::semaphore _inflight;
+    seastar::gate _gate;
+    // keyed by the partition id. Keys with unknown partitions go in a queue of their own, and the server tells
+    // us if any of them need to be retried individually
+    std::unordered_map<uint64_t, Queue> _queues;
+    static constexpr uint64_t UnknownPartition = std::numeric_limits<uint64_t>::max();
+    static constexpr uint64_t LocalPartition = UnknownPartition - 1;
+
+    std::function<bool(const dto::Key&)> _ownsLocal;
+    LocalFinalizeFunc _finalizeLocal;
+};
+
+} // ns k2
@@ -0,0 +1,451 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/unordered_set.hpp>
+
+#include "NodeArena.h"
+
+namespace k2 {
+
+// A read cache with the same semantics as ReadCache, built for the read path of the K23SI module:
+// - entries come from a per-thread pool and are linked into an intrusive LRU list, so inserting a new interval
+//   costs no general-purpose allocation
+// - the bounds of an interval are stored exactly once, in its entry
+// - point intervals(low == high) are kept in an intrusive hash table. Only real ranges are placed in the
+//   interval treap, which is ordered by (low, high) and augmented with the max high bound of each subtree
+// Optionally, timestamps can be rounded up into buckets, and intervals which overlap a range with a close
+// timestamp can be merged into that range. Both only ever raise the timestamp reported for a key, so they trade
+// some precision for being able to represent many more reads in the same number of entries
+template <typename KeyT, typename TimestampT, typename HashT = std::hash<KeyT>>
+class FlatReadCache {
+public:
+    FlatReadCache(TimestampT min_timestamp, size_t cache_size) :
+        _min(min_timestamp), _pointMax(min_timestamp), _max_size(cache_size), _buckets(InitialBuckets),
+        _points(typename PointSet::bucket_traits(_buckets.data(), _buckets.size())) {}
+
+    ~FlatReadCache() {
+        _points.clear();
+        _root = nullptr;
+        _lru.clear_and_dispose([](Entry* e) { ArenaT::local().destroy(e); });
+    }
+
+    FlatReadCache(const FlatReadCache&) = delete;
+    FlatReadCache& operator=(const FlatReadCache&) = delete;
+
+    // Returns the most recent read timestamp for any interval overlapping [low, high].
+    // Point entries are not ordered, so for a range check we conservatively account for them via the max timestamp
+    // of all points ever inserted. The K23SI module only checks single keys, which are answered exactly
+    TimestampT checkInterval(const KeyT& low, const KeyT& high) {
+        TimestampT most_recent = _min;
+        if (low == high) {
+            auto it = _points.find(low, HashT(), PointKeyEqual());
+            if (it != _points.end()) {
+                most_recent = do_max(most_recent, it->timestamp);
+            }
+        }
+        else if (_points.size() > 0) {
+            most_recent = do_max(most_recent, _pointMax);
+        }
+        _maxOverlap(_root, low, high, most_recent);
+        return most_recent;
+    }
+
+    const TimestampT min_TimeStamp() { return _min; }
+
+    // Rounds up every inserted timestamp with the given function. The function must never return a timestamp
+    // lower than its input
+    void setTimestampBucketing(std::function<TimestampT(const TimestampT&)> roundUp) {
+        _roundUp = std::move(roundUp);
+    }
+
+    // Enables merging of inserted intervals into overlapping ranges whose timestamps are close to the inserted
+    // timestamp, as decided by the given predicate
+    void setCoalescing(std::function<bool(const TimestampT&, const TimestampT&)> isClose) {
+        _isClose = std::move(isClose);
+    }
+
+    // Changes the number of entries the cache holds. When it shrinks, the least recently used entries are
+    // evicted right away, which raises the minimum timestamp the same way as evictions on insert
+    void setMaxSize(size_t maxSize) {
+        _max_size = maxSize;
+        while (_lru.size() > _max_size) {
+            _evict();
+        }
+    }
+
+    void insertInterval(const KeyT& low, const KeyT& high, TimestampT timestamp) {
+        if (_roundUp) {
+            timestamp = _roundUp(timestamp);
+        }
+        bool isPoint = low == high;
+        Entry* found = nullptr;
+        if (isPoint) {
+            auto it = _points.find(low, HashT(), PointKeyEqual());
+            found = it == _points.end() ? nullptr : &*it;
+        }
+        else {
+            found = _findRange(low, high);
+        }
+
+        if (found) {
+            found->timestamp = do_max(timestamp, found->timestamp);
+            if (isPoint) {
+                _pointMax = do_max(_pointMax, found->timestamp);
+            }
+            _touch(*found);
+            return;
+        }
+
+        if (_isClose && _coalesce(low, high, timestamp)) {
+            return;
+        }
+
+        Entry* e = isPoint ? ArenaT::local().make(low, timestamp) : ArenaT::local().make(low, high, timestamp);
+        if (isPoint) {
+            _pointMax = do_max(_pointMax, timestamp);
+            _insertPoint(*e);
+        }
+        else {
+            e->priority = _nextPriority();
+            _insertRange(e);
+        }
+        _lru.push_front(*e);
+
+        if (_lru.size() > _max_size) {
+            _evict();
+        }
+    }
+
+    // Grows the range [low, high], inserted earlier, to [newLow, newHigh] which covers it, and raises its timestamp
+    // to the given one. This lets a read which continues from the edge of its own range, e.g. the next page of a
+    // query, keep a single entry. If the range is no longer in the cache, because it was evicted or merged into
+    // another range, [newLow, newHigh] is inserted instead
+    void extendInterval(const KeyT& low, const KeyT& high, const KeyT& newLow, const KeyT& newHigh, TimestampT timestamp) {
+        Entry* found = low == high ? nullptr : _findRange(low, high);
+        if (!found || newLow == newHigh) {
+            insertInterval(newLow, newHigh, timestamp);
+            return;
+        }
+        if (_roundUp) {
+            timestamp = _roundUp(timestamp);
+        }
+        ++_extended;
+        _root = _eraseRange(_root, found);
+        found->low = newLow;
+        found->high = newHigh;
+        found->timestamp = do_max(found->timestamp, timestamp);
+        found->left = found->right = nullptr;
+        _update(found);
+        _insertRange(found);
+        _touch(*found);
+    }
+
+    size_t size() const { return _lru.size(); }
+
+    // the number of ranges grown in place by extendInterval
+    uint64_t extended() const { return _extended; }
+
+    // the number of inserted intervals which were merged into existing ranges
+    uint64_t coalesced() const { return _coalesced; }
+
+    // the number of entries evicted from the cache. Each eviction may raise the min timestamp
+    uint64_t evictions() const { return _evictions; }
+
+private:
+    static TimestampT do_max(const TimestampT& x, const TimestampT& y) {
+        using std::max;
+        return max(x, y);
+    }
+
+    struct Entry {
+        // point entry
+        Entry(const KeyT& l, TimestampT ts) : low(l), timestamp(std::move(ts)), isPoint(true) {}
+        // range entry
+        Entry(const KeyT& l, const KeyT& h, TimestampT ts) : low(l), high(h), timestamp(std::move(ts)), isPoint(false) {}
+
+        KeyT low;
+        KeyT high; // not used by point entries
+        TimestampT timestamp;
+        bool isPoint;
+
+        boost::intrusive::list_member_hook<> lruHook;
+        boost::intrusive::unordered_set_member_hook<> pointHook;
+
+        // treap links, only used by range entries
+        Entry* left = nullptr;
+        Entry* right = nullptr;
+        const KeyT* maxHigh = &high; // the max high bound in this subtree
+        uint32_t priority = 0;
+    };
+    typedef NodeArena<Entry, mem::Subsystem::ReadCache> ArenaT;
+
+    struct PointHash {
+        size_t operator()(const Entry& e) const { return HashT()(e.low); }
+    };
+    struct PointEqual {
+        bool operator()(const Entry& a, const Entry& b) const { return a.low == b.low; }
+    };
+    struct PointKeyEqual {
+        bool operator()(const KeyT& k, const Entry& e) const { return k == e.low; }
+        bool operator()(const Entry& e, const KeyT& k) const { return k == e.low; }
+    };
+
+    typedef boost::intrusive::list<Entry,
+        boost::intrusive::member_hook<Entry, boost::intrusive::list_member_hook<>, &Entry::lruHook>> LRUList;
+    typedef boost::intrusive::unordered_set<Entry,
+        boost::intrusive::member_hook<Entry, boost::intrusive::unordered_set_member_hook<>, &Entry::pointHook>,
+        boost::intrusive::hash<PointHash>,
+        boost::intrusive::equal<PointEqual>,
+        boost::intrusive::power_2_buckets<true>> PointSet;
+
+    typedef std::vector<typename PointSet::bucket_type,
+        mem::TrackedAllocator<typename PointSet::bucket_type, mem::Subsystem::ReadCache>> BucketsT;
+
+    static constexpr size_t InitialBuckets = 64;
+
+    void _insertPoint(Entry& e) {
+        // keep the load factor at or below 1. The table never grows past the cache size
+        if (_points.size() + 1 > _buckets.size()) {
+            BucketsT buckets(_buckets.size() * 2);
+            _points.rehash(typename PointSet::bucket_traits(buckets.data(), buckets.size()));
+            _buckets.swap(buckets);
+        }
+        _points.insert(e);
+    }
+
+    void _touch(Entry& e) {
+        _lru.erase(_lru.iterator_to(e));
+        _lru.push_front(e);
+    }
+
+    // merges [low, high] with all overlapping ranges whose timestamps are close to the given timestamp.
+    // Returns false if there are no such ranges, in which case nothing is changed
+    bool _coalesce(const KeyT& low, const KeyT& high, const TimestampT& timestamp) {
+        _scratch.clear();
+        _collectClose(_root, low, high, timestamp, _scratch);
+        if (_scratch.empty()) {
+            return false;
+        }
+        ++_coalesced;
+
+        Entry* keep = _scratch[0];
+        if (_scratch.size() == 1 && !(low < keep->low) && !(keep->high < high)) {
+            // already covered by the range - just bump its timestamp
+            keep->timestamp = do_max(keep->timestamp, timestamp);
+            _touch(*keep);
+            return true;
+        }
+
+        // the bounds of the ranges change, so take them all out of the treap before modifying them
+        for (auto* e : _scratch) {
+            _root = _eraseRange(_root, e);
+        }
+        if (low < keep->low) {
+            keep->low = low;
+        }
+        if (keep->high < high) {
+            keep->high = high;
+        }
+        keep->timestamp = do_max(keep->timestamp, timestamp);
+        for (size_t i = 1; i < _scratch.size(); ++i) {
+            Entry* e = _scratch[i];
+            if (e->low < keep->low) {
+                keep->low = e->low;
+            }
+            if (keep->high < e->high) {
+                keep->high = e->high;
+            }
+            keep->timestamp = do_max(keep->timestamp, e->timestamp);
+            _lru.erase(_lru.iterator_to(*e));
+            ArenaT::local().destroy(e);
+        }
+        keep->left = keep->right = nullptr;
+        _update(keep);
+        _insertRange(keep);
+        _touch(*keep);
+        return true;
+    }
+
+    // collects the ranges which overlap [low, high] and have timestamps close to the given timestamp
+    void _collectClose(Entry* t, const KeyT& low, const KeyT& high, const TimestampT& timestamp,
+                       std::vector<Entry*>& result) {
+        while (t && !(*t->maxHigh < low)) {
+            _collectClose(t->left, low, high, timestamp, result);
+            if (high < t->low) {
+                return;
+            }
+            if (!(t->high < low) && _isClose(t->timestamp, timestamp)) {
+                result.push_back(t);
+            }
+            t = t->right;
+        }
+    }
+
+    void _evict() {
+        Entry& victim = _lru.back();
+        _lru.pop_back();
+        if (victim.isPoint) {
+            _points.erase(_points.iterator_to(victim));
+        }
+        else {
+            _root = _eraseRange(_root, &victim);
+        }
+        _min = do_max(_min, victim.timestamp);
+        ++_evictions;
+        ArenaT::local().destroy(&victim);
+    }
+
+    uint32_t _nextPriority() {
+        // xorshift32 is plenty for treap balancing
+        _rand ^= _rand << 13;
+        _rand ^= _rand >> 17;
+        _rand ^= _rand << 5;
+        return _rand;
+    }
+
+    // ordering of range entries in the treap
+    static bool _before(const KeyT& alow, const KeyT& ahigh, const KeyT& blow, const KeyT& bhigh) {
+        return alow < blow || (!(blow < alow) && ahigh < bhigh);
+    }
+    static bool _before(const Entry* a, const Entry* b) {
+        return _before(a->low, a->high, b->low, b->high);
+    }
+
+    static void _update(Entry* t) {
+        t->maxHigh = &t->high;
+        if (t->left && *t->maxHigh < *t->left->maxHigh) {
+            t->maxHigh = t->left->maxHigh;
+        }
+        if (t->right && *t->maxHigh < *t->right->maxHigh) {
+            t->maxHigh = t->right->maxHigh;
+        }
+    }
+
+    // splits the treap t into the entries ordered before e(l) and the rest(r)
+    static void _split(Entry* t, const Entry* e, Entry*& l, Entry*& r) {
+        if (!t) {
+            l = r = nullptr;
+            return;
+        }
+        if (_before(t, e)) {
+            _split(t->right, e, t->right, r);
+            l = t;
+        }
+        else {
+            _split(t->left, e, l, t->left);
+            r = t;
+        }
+        _update(t);
+    }
+
+    // merges treaps l and r, where all entries in l are ordered before all entries in r
+    static Entry* _merge(Entry* l, Entry* r) {
+        if (!l) return r;
+        if (!r) return l;
+        if (l->priority > r->priority) {
+            l->right = _merge(l->right, r);
+            _update(l);
+            return l;
+        }
+        r->left = _merge(l, r->left);
+        _update(r);
+        return r;
+    }
+
+    void _insertRange(Entry* e) {
+        Entry* l;
+        Entry* r;
+        _split(_root, e, l, r);
+        _root = _merge(_merge(l, e), r);
+    }
+
+    static Entry* _eraseRange(Entry* t, const Entry* e) {
+        if (t == e) {
+            return _merge(t->left, t->right);
+        }
+        if (_before(e, t)) {
+            t->left = _eraseRange(t->left, e);
+        }
+        else {
+            t->right = _eraseRange(t->right, e);
+        }
+        _update(t);
+        return t;
+    }
+
+    Entry* _findRange(const KeyT& low, const KeyT& high) const {
+        Entry* t = _root;
+        while (t) {
+            if (_before(low, high, t->low, t->high)) {
+                t = t->left;
+            }
+            else if (_before(t->low, t->high, low, high)) {
+                t = t->right;
+            }
+            else {
+                return t;
+            }
+        }
+        return nullptr;
+    }
+
+    static void _maxOverlap(const Entry* t, const KeyT& low, const KeyT& high, TimestampT& most_recent) {
+        while (t && !(*t->maxHigh < low)) {
+            _maxOverlap(t->left, low, high, most_recent);
+            if (high < t->low) {
+                // this entry and everything to its right start after the interval
+                return;
+            }
+            if (!(t->high < low)) {
+                most_recent = do_max(most_recent, t->timestamp);
+            }
+            t = t->right;
+        }
+    }
+
+    TimestampT _min;
+    TimestampT _pointMax; // max timestamp of all point entries ever inserted
+    size_t _max_size;
+    uint32_t _rand = 2463534242;
+    uint64_t _coalesced = 0;
+    uint64_t _extended = 0;
+    uint64_t _evictions = 0;
+    std::function<TimestampT(const TimestampT&)> _roundUp;
+    std::function<bool(const TimestampT&, const TimestampT&)> _isClose;
+    std::vector<Entry*> _scratch;
+
+    LRUList _lru;
+    BucketsT _buckets;
+    PointSet _points;
+    Entry* _root = nullptr;
+};
+
+} // ns k2
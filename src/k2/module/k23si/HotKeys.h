@@ -0,0 +1,117 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <k2/dto/Collection.h>
+#include <k2/dto/K23SI.h>
+#include <k2/dto/K23SIInspect.h>
+
+namespace k2 {
+
+// Tracks the most frequent keys of a stream of keys in constant space, using the space-saving algorithm: up to
+// capacity keys are counted, and a key which isn't counted yet replaces the key with the lowest count, inheriting
+// its count as the error of the new key's count. Any key which occurs more than total/capacity times is
+// guaranteed to be in the top keys.
+// Keys can be sampled so that only one in every sampleInterval keys is counted, with a count of sampleInterval
+class HotKeys {
+public:
+    HotKeys(uint32_t capacity, uint32_t sampleInterval=1) :
+        _capacity(capacity), _sampleInterval(std::max<uint32_t>(sampleInterval, 1)) {
+        _entries.reserve(_capacity);
+        _index.reserve(_capacity);
+    }
+
+    // counts the key if it is sampled
+    void sample(const dto::Key& key) {
+        if (++_seen < _sampleInterval) {
+            return;
+        }
+        _seen = 0;
+        add(key, _sampleInterval);
+    }
+
+    // counts the key, bypassing the sampling
+    void add(const dto::Key& key, uint64_t weight=1) {
+        if (_capacity == 0) {
+            return;
+        }
+        _total += weight;
+        auto it = _index.find(key);
+        if (it != _index.end()) {
+            _entries[it->second].count += weight;
+            return;
+        }
+        if (_entries.size() < _capacity) {
+            _index.emplace(key, _entries.size());
+            _entries.push_back(dto::K23SIHotKey{.key=key, .count=weight, .error=0});
+            return;
+        }
+        // the capacity is small, so a scan is cheaper than maintaining a heap on every add
+        size_t minIdx = 0;
+        for (size_t i = 1; i < _entries.size(); ++i) {
+            if (_entries[i].count < _entries[minIdx].count) {
+                minIdx = i;
+            }
+        }
+        auto& victim = _entries[minIdx];
+        _index.erase(victim.key);
+        victim.key = key;
+        victim.error = victim.count;
+        victim.count += weight;
+        _index.emplace(key, minIdx);
+    }
+
+    // the counted keys, with the highest count first
+    std::vector<dto::K23SIHotKey> top() const {
+        std::vector<dto::K23SIHotKey> result = _entries;
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) { return a.count > b.count; });
+        return result;
+    }
+
+    // the total count of all keys, including the ones which aren't in the top keys
+    uint64_t total() const { return _total; }
+
+    void clear() {
+        _entries.clear();
+        _index.clear();
+        _seen = 0;
+        _total = 0;
+    }
+
+private:
+    uint32_t _capacity;
+    uint32_t _sampleInterval;
+    uint32_t _seen = 0;
+    uint64_t _total = 0;
+    std::vector<dto::K23SIHotKey> _entries;
+    // the index of each counted key in _entries
+    std::unordered_map<dto::Key, size_t> _index;
+};
+
+} // ns k2
@@ -0,0 +1,324 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <k2/common/ByteCompare.h>
+#include <k2/common/MemoryAccounting.h>
+#include <k2/dto/Collection.h>
+#include <k2/dto/K23SI.h>
+#include <k2/indexer/HOTOrderedIndexer.h>
+
+#include "KeyFilter.h"
+#include "NodeArena.h"
+#include "VersionChain.h"
+
+namespace k2 {
+
+// Keys in an index are always from the same schema (see SchemaIndexer below), so the key ordering
+// and encoding for the indexes only need to look at the partition and range keys
+
+// Orders keys from the same schema
+struct SchemaLocalKeyCompare {
+    bool operator()(const dto::Key& a, const dto::Key& b) const noexcept {
+        int pkc = compareBytes(a.partitionKey, b.partitionKey);
+        if (pkc != 0) {
+            return pkc < 0;
+        }
+        return compareBytes(a.rangeKey, b.rangeKey) < 0;
+    }
+};
+
+// Hashes and compares keys from the same schema, for the point indexes
+struct SchemaLocalKeyHash {
+    size_t operator()(const dto::Key& key) const noexcept {
+        size_t h = std::hash<String>()(key.partitionKey);
+        return h ^ (std::hash<String>()(key.rangeKey) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+    }
+};
+
+struct SchemaLocalKeyEqual {
+    bool operator()(const dto::Key& a, const dto::Key& b) const noexcept {
+        return a.partitionKey == b.partitionKey && a.rangeKey == b.rangeKey;
+    }
+};
+
+// Produces an order-preserving binary encoding of a dto::Key from a given schema, i.e. for any two keys a and b
+// from the same schema, a.compare(b) has the same sign as the byte-wise comparison of their encodings
+struct SchemaLocalKeyEncoder {
+    void operator()(const dto::Key& key, String& out) const {
+        out.resize(ordered_key::encodedSize(key.partitionKey) + ordered_key::encodedSize(key.rangeKey));
+        char* pos = out.data();
+        pos = ordered_key::encode(pos, key.partitionKey);
+        ordered_key::encode(pos, key.rangeKey);
+    }
+};
+
+// the type holding multiple versions of a key
+typedef VersionChain VersionsT;
+
+// the type holding versions for all keys in a schema. The engine is selected at build time via
+// K2_HOT_INDEXER. Both engines provide ordered, bidirectional iteration with std::map semantics.
+#if K2_HOT_INDEXER
+typedef HOTOrderedIndexer<dto::Key, VersionsT, SchemaLocalKeyEncoder> IndexerT;
+#else
+typedef std::map<dto::Key, VersionsT, SchemaLocalKeyCompare,
+                 NodeArenaAllocator<std::pair<const dto::Key, VersionsT>, mem::Subsystem::Indexer>> IndexerT;
+#endif
+typedef IndexerT::iterator IndexerIterator;
+
+// maps the keys of a schema to their versions in the ordered index of the schema. The versions stay where they
+// are in their index until the key is erased, so the pointers remain valid
+typedef std::unordered_map<dto::Key, VersionsT*, SchemaLocalKeyHash, SchemaLocalKeyEqual,
+                           NodeArenaAllocator<std::pair<const dto::Key, VersionsT*>, mem::Subsystem::Indexer>> PointIndexT;
+
+// Positions a reverse scan with a single seek: returns the last key which is not greater than the given key(or,
+// if exclusive, which is less than it), or end() if there is none. An empty partition key starts from the last key
+template <typename IndexT>
+inline typename IndexT::iterator reverseSeek(IndexT& index, const dto::Key& key, bool exclusive) {
+    auto it = key.partitionKey == "" ? index.end() : exclusive ? index.lower_bound(key) : index.upper_bound(key);
+    return it == index.begin() ? index.end() : std::prev(it);
+}
+
+// The indexer for a partition. It holds a separate ordered index for each schema, which keeps comparisons short
+// and makes schema-bounded scans naturally bounded by the index.
+// Schemas are interned on first use and assigned a dense id, which can be used to iterate over all indexes.
+// Optionally, each schema also has a KeyFilter of the keys which were added through getOrCreateVersions, so that
+// point lookups of absent keys can be rejected with mayContain, and a hash PointIndexT, so that point lookups of
+// present keys don't search the ordered index. Keys must then be erased through the indexer, to keep them in sync
+class SchemaIndexer {
+public:
+    // The number of keys the filter of a new schema, or the rebuilt filter of a small one, is sized for
+    static constexpr size_t MinFilterKeys = 64 * 1024;
+
+    // Enables the key filters with the given bits per key. 0 disables them. This must be called before any
+    // schemas are indexed
+    void enableKeyFilters(uint32_t bitsPerKey) {
+        _filterBitsPerKey = bitsPerKey;
+    }
+
+    // Enables the point indexes. This must be called before any schemas are indexed
+    void enablePointIndexes(bool enabled) {
+        _pointIndexesEnabled = enabled;
+    }
+
+    // The id returned by findId for schemas which have not been interned
+    static constexpr uint32_t NoSchemaId = std::numeric_limits<uint32_t>::max();
+
+    // returns the id of the given schema, interning it with an empty index if needed
+    uint32_t getOrCreateId(const String& schemaName) {
+        auto it = _ids.find(schemaName);
+        if (it != _ids.end()) {
+            return it->second;
+        }
+        uint32_t id = (uint32_t)_indexes.size();
+        _ids.emplace(schemaName, id);
+        _indexes.push_back(std::make_unique<IndexerT>());
+        _filters.push_back(_makeFilter());
+        _rebuilds.emplace_back();
+        _points.emplace_back(_pointIndexesEnabled ? std::make_unique<PointIndexT>() : nullptr);
+        return id;
+    }
+
+    // returns the id of the given schema or NoSchemaId if it has not been interned
+    uint32_t findId(const String& schemaName) const {
+        auto it = _ids.find(schemaName);
+        return it == _ids.end() ? NoSchemaId : it->second;
+    }
+
+    // returns the index for the given schema, creating an empty one if needed
+    IndexerT& getOrCreate(const String& schemaName) {
+        return *_indexes[getOrCreateId(schemaName)];
+    }
+
+    // returns the versions of the given key, creating the key in the index of its schema if needed.
+    // All keys must be added through here for the key filter to be correct
+    VersionsT& getOrCreateVersions(const dto::Key& key) {
+        return getOrCreateVersions(getOrCreateId(key.schemaName), key);
+    }
+
+    // same as above, for a key of the schema with the given id, which saves the lookup of the schema name
+    VersionsT& getOrCreateVersions(uint32_t id, const dto::Key& key) {
+        if (_points[id]) {
+            // an indexed key is already in the filters
+            if (auto it = _points[id]->find(key); it != _points[id]->end()) {
+                return *it->second;
+            }
+        }
+        if (_filters[id]) {
+            _filters[id]->add(key);
+        }
+        if (_rebuilds[id]) {
+            _rebuilds[id]->add(key);
+        }
+        auto& versions = (*_indexes[id])[key];
+        if (_points[id]) {
+            _points[id]->emplace(key, &versions);
+        }
+        return versions;
+    }
+
+    // Same as above, for keys which mostly come in ascending order within their schema, e.g. when the partition
+    // is restored. A key past the last key of its index is added at the end without searching the index
+    VersionsT& appendVersions(uint32_t id, dto::Key&& key) {
+        if (_filters[id]) {
+            _filters[id]->add(key);
+        }
+        if (_rebuilds[id]) {
+            _rebuilds[id]->add(key);
+        }
+        auto& index = *_indexes[id];
+        if (_points[id]) {
+            auto [it, inserted] = _points[id]->emplace(key, nullptr);
+            if (!inserted) {
+                return *it->second;
+            }
+#if K2_HOT_INDEXER
+            return *(it->second = &index.append(std::move(key)));
+#else
+            return *(it->second = &index.emplace_hint(index.end(), std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple())->second);
+#endif
+        }
+#if K2_HOT_INDEXER
+        return index.append(std::move(key));
+#else
+        // the hint makes the insert constant time when the key goes at the end
+        return index.emplace_hint(index.end(), std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple())->second;
+#endif
+    }
+
+    // returns the versions of the given key of the schema with the given id, or nullptr if the key is not indexed
+    VersionsT* findVersions(uint32_t id, const dto::Key& key) {
+        if (_points[id]) {
+            auto it = _points[id]->find(key);
+            return it == _points[id]->end() ? nullptr : it->second;
+        }
+        auto& index = *_indexes[id];
+        auto it = index.find(key);
+        return it == index.end() ? nullptr : &it->second;
+    }
+
+    // erases the key at the given position of the index of the schema with the given id. Returns the next position
+    IndexerIterator erase(uint32_t id, IndexerIterator it) {
+        if (_points[id]) {
+            _points[id]->erase(it->first);
+        }
+        return _indexes[id]->erase(it);
+    }
+
+    // returns false if the given key is definitely not in the indexer
+    bool mayContain(const dto::Key& key) const {
+        return mayContain(findId(key.schemaName), key);
+    }
+
+    // same as above, for a key of the schema with the given id(which may be NoSchemaId)
+    bool mayContain(uint32_t schemaId, const dto::Key& key) const {
+        if (schemaId == NoSchemaId) {
+            return false;
+        }
+        return !_filters[schemaId] || _filters[schemaId]->mayContain(key);
+    }
+
+    // Starts building a new key filter for the given schema, sized for its current number of keys. Keys added
+    // from now on go into both filters. The caller adds all the other keys which remain in the index with
+    // filterRebuild(), and then replaces the filter with finishFilterRebuild()
+    void startFilterRebuild(uint32_t schemaId) {
+        if (_filterBitsPerKey > 0) {
+            // leave room for the index to grow until the next rebuild
+            size_t keys = std::max(_indexes[schemaId]->size() * 2, MinFilterKeys);
+            _rebuilds[schemaId] = std::make_unique<KeyFilter>(keys, _filterBitsPerKey);
+        }
+    }
+
+    // the filter being rebuilt for the given schema or nullptr if there is no rebuild in progress
+    KeyFilter* filterRebuild(uint32_t schemaId) { return _rebuilds[schemaId].get(); }
+
+    void finishFilterRebuild(uint32_t schemaId) {
+        if (_rebuilds[schemaId]) {
+            _filters[schemaId] = std::move(_rebuilds[schemaId]);
+        }
+    }
+
+    // returns the index for the given schema or nullptr if no such schema has been indexed
+    IndexerT* find(const String& schemaName) {
+        auto it = _ids.find(schemaName);
+        return it == _ids.end() ? nullptr : _indexes[it->second].get();
+    }
+
+    // the number of interned schemas. Ids are in the range [0, schemaCount())
+    uint32_t schemaCount() const { return (uint32_t)_indexes.size(); }
+
+    // access index by schema id
+    IndexerT& at(uint32_t schemaId) { return *_indexes[schemaId]; }
+
+    // total number of keys across all schemas
+    size_t size() const {
+        size_t result = 0;
+        for (auto& idx : _indexes) {
+            result += idx->size();
+        }
+        return result;
+    }
+
+    // drop all data for the given schema
+    void clear(const String& schemaName) {
+        auto it = _ids.find(schemaName);
+        if (it != _ids.end()) {
+            clear(it->second);
+        }
+    }
+
+    // same as above, for the schema with the given id
+    void clear(uint32_t schemaId) {
+        _indexes[schemaId]->clear();
+        if (_points[schemaId]) {
+            _points[schemaId]->clear();
+        }
+        _filters[schemaId] = _makeFilter();
+        _rebuilds[schemaId].reset();
+    }
+
+private:
+    std::unique_ptr<KeyFilter> _makeFilter() const {
+        return _filterBitsPerKey > 0 ? std::make_unique<KeyFilter>(MinFilterKeys, _filterBitsPerKey) : nullptr;
+    }
+
+    std::unordered_map<String, uint32_t> _ids;
+    std::vector<std::unique_ptr<IndexerT>> _indexes;
+    // by schema id, the key filter(nullptr when disabled) and the filter being rebuilt, if any
+    std::vector<std::unique_ptr<KeyFilter>> _filters;
+    std::vector<std::unique_ptr<KeyFilter>> _rebuilds;
+    uint32_t _filterBitsPerKey = 0;
+    // by schema id, the point index or nullptr when disabled
+    std::vector<std::unique_ptr<PointIndexT>> _points;
+    bool _pointIndexesEnabled = false;
+};
+
+} // ns k2
@@ -0,0 +1,96 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <k2/dto/Collection.h>
+
+namespace k2 {
+
+// A bloom filter over the keys of one schema. It answers whether a key may be present in the schema's index, so
+// that lookups for keys which were never written can be rejected without walking the index.
+// There are no false negatives. Keys which are removed from the index keep matching the filter, and the false
+// positive rate goes up once more keys are added than the filter was sized for, until it is rebuilt
+class KeyFilter {
+public:
+    // A filter for about expectedKeys keys with bitsPerKey bits each
+    KeyFilter(size_t expectedKeys, uint32_t bitsPerKey) :
+        _bits((std::max<size_t>(expectedKeys, 1) * bitsPerKey + 63) / 64, 0),
+        // the optimal number of probes is ln(2) * bitsPerKey
+        _probes(std::clamp<uint32_t>((bitsPerKey * 69 + 50) / 100, 1, 30)) {}
+
+    void add(const dto::Key& key) {
+        uint64_t h = _hash(key);
+        uint64_t delta = (h >> 32) | 1;
+        size_t nbits = _bits.size() * 64;
+        for (uint32_t i = 0; i < _probes; ++i, h += delta) {
+            size_t bit = h % nbits;
+            _bits[bit / 64] |= (uint64_t(1) << (bit % 64));
+        }
+        _keys++;
+    }
+
+    bool mayContain(const dto::Key& key) const {
+        uint64_t h = _hash(key);
+        uint64_t delta = (h >> 32) | 1;
+        size_t nbits = _bits.size() * 64;
+        for (uint32_t i = 0; i < _probes; ++i, h += delta) {
+            size_t bit = h % nbits;
+            if ((_bits[bit / 64] & (uint64_t(1) << (bit % 64))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the number of keys added to the filter
+    size_t size() const { return _keys; }
+
+private:
+    // Keys in the filter are always from the same schema, so only the partition and range keys are hashed.
+    // The two hashes are mixed(rather than added as in dto::Key::hash) so that swapping bytes between the
+    // partition and range keys doesn't collide
+    static uint64_t _hash(const dto::Key& key) {
+        uint64_t h = std::hash<String>()(key.partitionKey) * 0x9E3779B97F4A7C15ull;
+        h ^= std::hash<String>()(key.rangeKey) + (h << 6) + (h >> 2);
+        // splitmix64 finalizer, so that the high bits used for the probe step are well distributed
+        h ^= h >> 30;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 27;
+        h *= 0x94D049BB133111EBull;
+        h ^= h >> 31;
+        return h;
+    }
+
+    std::vector<uint64_t> _bits;
+    uint32_t _probes;
+    size_t _keys = 0;
+};
+
+} // ns k2
@@ -23,7 +23,15 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include "Module.h"
 
+#include <boost/range/irange.hpp>
+
+#include <seastar/core/fstream.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/sleep.hh>
+
 #include <k2/appbase/AppEssentials.h>
+#include <k2/collectionMetadataCache/CollectionMetadataCache.h>
 #include <k2/dto/MessageVerbs.h>
 #include <k2/infrastructure/APIServer.h>
 
@@ -36,15 +44,20 @@ namespace dto {
     }
 } // ns dto
 
-K23SIPartitionModule::K23SIPartitionModule(dto::CollectionMetadata cmeta, dto::Partition partition) :
+K23SIPartitionModule::K23SIPartitionModule(dto::CollectionMetadata cmeta, dto::Partition partition, bool migrationTarget, String followPersistence,
+                                           seastar::scheduling_group group) :
     _cmeta(std::move(cmeta)),
     _partition(std::move(partition), _cmeta.hashScheme),
+    // NB: only the address of the persistence is taken here, before it is constructed
+    _txnMgr(_persistence),
+    _arena(_config.recordArenaSlabSize(), _config.recordArenaCompactionThreshold()),
     _retentionUpdateTimer([this] {
         K2LOG_D(log::skvsvr, "Partition {}, refreshing retention timestamp", _partition);
         _retentionRefresh = _retentionRefresh.then([this]{
             return getTimeNow();
         })
         .then([this](dto::Timestamp&& ts) {
+            _tsoClockOffset = ts.tEndTSECount() - now_nsec_count();
             // set the retention timestamp (the time of the oldest entry we should keep)
             _retentionTimestamp = ts - _cmeta.retentionPeriod;
             _txnMgr.updateRetentionTimestamp(_retentionTimestamp);
@@ -53,84 +66,362 @@ K23SIPartitionModule::K23SIPartitionModule(dto::CollectionMetadata cmeta, dto::P
             _retentionUpdateTimer.arm(_config.retentionTimestampUpdateInterval());
         });
     }),
-    _cpo(_config.cpoEndpoint()) {
-    K2LOG_I(log::skvsvr, "ctor for cname={}, part={}", _cmeta.name, _partition);
+    _cpo(_config.cpoEndpoint()),
+    _routes(_cmeta.name, _partition().pvid.id, group) {
+    K2LOG_I(log::skvsvr, "ctor for cname={}, part={}, migrationTarget={}, followPersistence={}", _cmeta.name, _partition, migrationTarget, followPersistence);
+    _migrationTarget = migrationTarget;
+    if (!followPersistence.empty()) {
+        _follower = true;
+        _persistence.followEndpoint(followPersistence);
+    }
+    _registerMetrics();
+}
+
+void K23SIPartitionModule::_registerMetrics() {
+    _metricGroups.clear();
+    std::vector<sm::label_instance> labels;
+    labels.push_back(sm::label_instance("collection", _cmeta.name));
+    labels.push_back(sm::label_instance("partition", _partition().pvid.id));
+    _metricGroups.add_group("K23SI_partition", {
+        sm::make_counter("gc_versions_reclaimed", _gcVersionsReclaimed, sm::description("Total versions removed by the garbage collector"), labels),
+        sm::make_counter("gc_bytes_reclaimed", _gcBytesReclaimed, sm::description("Total value bytes removed by the garbage collector"), labels),
+        sm::make_counter("gc_keys_removed", _gcKeysRemoved, sm::description("Total tombstoned keys removed by the garbage collector"), labels),
+        sm::make_counter("gc_keys_expired", _gcKeysExpired, sm::description("Keys removed by GC because their records expired"), labels),
+        sm::make_counter("gc_bytes_relocated", _gcBytesRelocated, sm::description("Total value bytes relocated out of sparse arena slabs"), labels),
+        sm::make_counter("cold_records_frozen", _coldRecordsFrozen, sm::description("Total records re-encoded into cold blocks"), labels),
+        sm::make_counter("cold_bytes_frozen", _coldBytesFrozen, sm::description("Total value bytes of the records re-encoded into cold blocks"), labels),
+        sm::make_counter("cold_bytes_encoded", _coldBytesEncoded, sm::description("Total bytes of the cold blocks the records were re-encoded into"), labels),
+        sm::make_counter("cold_bytes_spilled", _coldBytesSpilled, sm::description("Total bytes of the cold blocks spilled to local disk"), labels),
+        sm::make_counter("cold_spill_segments", [this]{ return _coldSpill ? _coldSpill->segmentsCreated() : 0;}, sm::description("Files created for spilling cold blocks"), labels),
+        sm::make_gauge("arena_allocated_bytes", [this]{ return _arena.allocatedBytes();}, sm::description("Bytes allocated in arena slabs for record values"), labels),
+        sm::make_gauge("indexer_keys", [this]{ return _indexer.size();}, sm::description("Number of keys in the indexer"), labels),
+        sm::make_counter("key_filter_rejects", _keyFilterRejects, sm::description("Point lookups of absent keys rejected by the key filter without an index lookup"), labels),
+        sm::make_gauge("write_intents", [this]{ return _wiIndex.size();}, sm::description("Number of outstanding write intents"), labels),
+        sm::make_gauge("read_cache_size", [this]{ return _readCache ? _readCache->size() : 0;}, sm::description("Number of entries in the read cache"), labels),
+        sm::make_counter("read_cache_evictions", [this]{ return _readCache ? _readCache->evictions() : 0;}, sm::description("Total entries evicted from the read cache"), labels),
+        sm::make_counter("read_cache_coalesced", [this]{ return _readCache ? _readCache->coalesced() : 0;}, sm::description("Total read cache inserts merged into existing ranges"), labels),
+        sm::make_gauge("read_cache_watermark_lag_ns", [this]{ return _readCacheWatermarkLag();}, sm::description("How far the read cache watermark lags behind the current time, in nanoseconds"), labels),
+        sm::make_counter("write_rejects_read_conflict", _readCacheConflictRejects, sm::description("Writes rejected because an overlapping read was newer than the write"), labels),
+        sm::make_counter("write_rejects_below_watermark", _readCacheWatermarkRejects, sm::description("Writes rejected only because they were below the read cache watermark"), labels),
+        sm::make_counter("write_rejects_below_snapshot_horizon", _snapshotHorizonRejects, sm::description("Writes rejected because they were below the closed timestamp"), labels),
+        sm::make_counter("write_rejects_snapshot_read_conflict", _snapshotReadConflictRejects, sm::description("Writes rejected because an overlapping snapshot read was at or above the write"), labels),
+        sm::make_gauge("snapshot_read_cache_size", [this]{ return _snapshotReadCache ? _snapshotReadCache->size() : 0;}, sm::description("Number of entries in the snapshot read cache"), labels),
+        sm::make_counter("snapshot_reads", _snapshotReads, sm::description("Total snapshot(bounded-staleness) reads and queries served"), labels),
+        sm::make_counter("checkpoints_completed", _checkpointsCompleted, sm::description("Checkpoints of the partition which completed"), labels),
+        sm::make_counter("checkpoints_failed", _checkpointsFailed, sm::description("Checkpoints of the partition which failed"), labels),
+        sm::make_counter("recovered_keys", _recoveredKeys, sm::description("Keys loaded from the checkpoint on recovery"), labels),
+        sm::make_counter("bulk_ingested_records", _bulkIngestedRecords, sm::description("Records installed as committed versions by bulk ingests"), labels),
+        sm::make_counter("range_deletes", _rangeDeletes, sm::description("Range deletes installed as range tombstones"), labels),
+        sm::make_counter("range_tombstones_applied", _rangeTombstonesApplied, sm::description("Tombstones inserted into the versions of keys covered by range deletes"), labels),
+        sm::make_gauge("range_tombstones", [this] { return _rangeTombstones.size(); }, sm::description("Range tombstones which may not be applied to all of their keys yet"), labels),
+        sm::make_counter("exported_records", _exportedRecords, sm::description("Records exported by partition exports"), labels),
+        sm::make_counter("exported_bytes", _exportedBytes, sm::description("Bytes of the pages of partition exports"), labels),
+        sm::make_counter("restored_records", _restoredRecords, sm::description("Records installed by partition restores"), labels),
+        sm::make_counter("replayed_wal_records", _replayedWALRecords, sm::description("WAL records replayed on recovery"), labels),
+        sm::make_counter("pipelined_writes", _pipelinedWritesCount, sm::description("Writes acknowledged before their WI was persisted"), labels),
+        sm::make_counter("pipelined_write_failures", _pipelinedWriteFailures, sm::description("Pipelined writes which failed to persist"), labels),
+        sm::make_counter("shared_pushes", _sharedPushes, sm::description("Pushes which joined a push of the same incumbent already in flight"), labels),
+        sm::make_counter("conflict_waits", _conflictWaits, sm::description("Requests which waited for a conflicting WI to be finalized"), labels),
+        sm::make_counter("conflict_wait_timeouts", _conflictWaitTimeouts, sm::description("Conflict waits which timed out and resorted to a push"), labels),
+        sm::make_counter("parallel_commits", _parallelCommits, sm::description("Transactions committed while their pipelined writes were in flight"), labels),
+        sm::make_counter("parallel_commit_aborts", _parallelCommitAborts, sm::description("Parallel commits aborted since some of their writes failed to persist"), labels),
+        sm::make_counter("conditional_write_rejects", _conditionalWriteRejects, sm::description("Writes rejected because the latest version of their record failed their condition"), labels),
+        sm::make_counter("field_ops", _fieldOps, sm::description("Field operations applied by writes against the latest version of their record"), labels),
+        sm::make_counter("one_phase_commits", _onePhaseCommits, sm::description("Transactions committed in one phase, with all of their writes in the TRH partition"), labels),
+        sm::make_counter("query_streams_started", _queryStreamsStarted, sm::description("Streaming queries which prepared pages ahead of the client"), labels),
+        sm::make_counter("query_streams_expired", _queryStreamsExpired, sm::description("Streaming queries dropped because their client stopped asking for pages"), labels),
+        sm::make_gauge("query_streams_open", [this]{ return _queryStreams.size();}, sm::description("Streaming queries currently open"), labels),
+        sm::make_gauge("prepared_queries", [this]{ return _preparedQueries.size();}, sm::description("Prepared queries registered with the partition"), labels),
+        sm::make_counter("prepared_query_misses", _preparedQueryMisses, sm::description("Prepared queries which had to be registered again because the partition dropped them"), labels),
+        sm::make_counter("query_read_ranges_extended", _queryReadRangesExtended, sm::description("Query pages whose reads extended the read cache range of the previous page"), labels),
+        sm::make_counter("splits_completed", _splitsCompleted, sm::description("Splits of the partition which completed"), labels),
+        sm::make_counter("splits_refused", _splitsRefused, sm::description("Splits of the partition refused or rolled back because of transactions in the upper half"), labels),
+        sm::make_counter("split_keys_moved", _splitKeysMoved, sm::description("Keys moved out of the partition by splits"), labels),
+        sm::make_counter("migrations_completed", _migrationsCompleted, sm::description("Migrations of the partition to another core which completed"), labels),
+        sm::make_counter("migration_keys_moved", _migrationKeysMoved, sm::description("Keys sent to the new core by migrations, including the ones sent again as they changed"), labels),
+        sm::make_counter("follower_resyncs", _followerResyncs, sm::description("Reloads of a follower from the checkpoint because the WAL it had yet to replay was truncated"), labels),
+        sm::make_counter("changes_recorded", _changesRecorded, sm::description("Committed changes recorded for change streams"), labels),
+        sm::make_counter("change_polls", _changePolls, sm::description("Polls of the change stream of the partition"), labels),
+        sm::make_gauge("changes_retained", [this]{ return _changes.size() + _changesPending.size();}, sm::description("Changes kept for change streams, including the ones not resolved yet"), labels),
+        sm::make_counter("closed_timestamps_written", _closedTimestampsWritten, sm::description("Closed timestamps written to the WAL for the followers of the partition"), labels),
+        sm::make_gauge("follower_lag_ns", [this]{ return _follower ? (int64_t)(now_nsec_count() + _tsoClockOffset - _closedTimestamp.tEndTSECount()) : 0; },
+                sm::description("How far the closed timestamp of a follower is behind the current time, in nanoseconds"), labels),
+        sm::make_counter("pushes_incumbent_aborted", _pushesIncumbentAborted, sm::description("Pushes to transactions of this TRH which the challenger won, or whose incumbent had already aborted"), labels),
+        sm::make_counter("pushes_incumbent_won", _pushesIncumbentWon, sm::description("Pushes to transactions of this TRH in progress which the incumbent won"), labels),
+        sm::make_counter("pushes_incumbent_committed", _pushesIncumbentCommitted, sm::description("Pushes to transactions of this TRH which had already committed or ended"), labels),
+        sm::make_gauge("indexed_versions", [this]{ return _indexedVersions;}, sm::description("Number of versions of all keys, as of the last complete GC pass"), labels),
+        sm::make_gauge("indexed_value_bytes", [this]{ return _indexedValueBytes;}, sm::description("Bytes of the record values which are not in cold blocks, as of the last complete GC pass"), labels),
+    });
+
+    std::pair<const char*, _VerbMetrics*> verbs[] = {
+        {"read", &_readMetrics}, {"read_multi", &_readMultiMetrics}, {"query", &_queryMetrics},
+        {"write", &_writeMetrics}, {"write_multi", &_writeMultiMetrics}, {"push", &_pushMetrics},
+        {"end", &_endMetrics}, {"finalize", &_finalizeMetrics}, {"heartbeat", &_heartbeatMetrics},
+    };
+    for (auto& [verb, metrics] : verbs) {
+        _metricGroups.add_group("K23SI_partition", _verbMetricDefinitions(verb, *metrics, labels));
+    }
+}
+
+std::vector<sm::metric_definition>
+K23SIPartitionModule::_verbMetricDefinitions(const char* verb, _VerbMetrics& metrics,
+                                             const std::vector<sm::label_instance>& labels) {
+    std::vector<sm::label_instance> verbLabels = labels;
+    verbLabels.push_back(sm::label_instance("verb", verb));
+    std::vector<sm::metric_definition> result = metrics.latency.metricDefinitions("request_latency",
+                                                                                 "Latency of the requests in usecs", verbLabels);
+    for (size_t i = 0; i < metrics.responses.size(); ++i) {
+        std::vector<sm::label_instance> statusLabels = verbLabels;
+        String code = i < std::size(_countedStatusCodes) ? std::to_string(_countedStatusCodes[i]) : String("other");
+        statusLabels.push_back(sm::label_instance("status", code));
+        result.push_back(sm::make_counter("responses", metrics.responses[i],
+                                          sm::description("Responses to the requests, by status code"), statusLabels));
+    }
+    return result;
 }
 
 seastar::future<> K23SIPartitionModule::start() {
     K2LOG_D(log::skvsvr, "Starting for partition: {}", _partition);
 
-    APIServer& api_server = AppBase().getDist<APIServer>().local();
+    // the cores of the node share one copy of the partition maps
+    CollectionMetadataCache& metadataCache = AppBase().getLocal<CollectionMetadataCache>();
+    metadataCache.attach(_cpo);
+    metadataCache.attach(_txnMgr._cpo);
 
-    RPC().registerRPCObserver<dto::K23SIReadRequest, dto::K23SIReadResponse>
+    _routes.registerRPCObserver<dto::K23SIReadRequest, dto::K23SIReadResponse>
     (dto::Verbs::K23SI_READ, [this](dto::K23SIReadRequest&& request) {
-        return handleRead(std::move(request), FastDeadline(_config.readTimeout()));
+        _hotReads.sample(request.key);
+        _loadSnapshotReads += request.snapshotRead;
+        return _withLoad(request.key, request.mtr, [&] {
+            return _measured(_readMetrics, [&] {
+                return handleRead(std::move(request), FastDeadline(_hot->readTimeout));
+            });
+        });
+    });
+
+    _routes.registerRPCObserver<dto::K23SIReadMultiRequest, dto::K23SIReadMultiResponse>
+    (dto::Verbs::K23SI_READ_MULTI, [this](dto::K23SIReadMultiRequest&& request) {
+        _hotReads.sample(request.key);
+        _loadSnapshotReads += request.snapshotRead;
+        return _withLoad(request.key, request.mtr, [&] {
+            return _measured(_readMultiMetrics, [&] {
+                return handleReadMulti(std::move(request), FastDeadline(_hot->readTimeout));
+            });
+        });
     });
 
-    RPC().registerRPCObserver<dto::K23SIQueryRequest, dto::K23SIQueryResponse>
+    _routes.registerRPCObserver<dto::K23SIQueryRequest, dto::K23SIQueryResponse>
     (dto::Verbs::K23SI_QUERY, [this](dto::K23SIQueryRequest&& request) {
-        return handleQuery(std::move(request), dto::K23SIQueryResponse{}, FastDeadline(_config.readTimeout()));
+        _loadSnapshotReads += request.snapshotRead;
+        return _withLoad(request.key, request.mtr, [&] {
+            return _measured(_queryMetrics, [&] {
+                return handleQuery(std::move(request), dto::K23SIQueryResponse{}, FastDeadline(_hot->readTimeout));
+            });
+        });
+    });
+
+    _routes.registerRPCObserver<dto::K23SIQueryNextRequest, dto::K23SIQueryResponse>
+    (dto::Verbs::K23SI_QUERY_NEXT, [this](dto::K23SIQueryNextRequest&& request) {
+        return _measured(_queryMetrics, [&] {
+            return handleQueryNext(std::move(request));
+        });
     });
 
-    RPC().registerRPCObserver<dto::K23SIWriteRequest, dto::K23SIWriteResponse>
+    _routes.registerRPCObserver<dto::K23SIWriteRequest, dto::K23SIWriteResponse>
     (dto::Verbs::K23SI_WRITE, [this](dto::K23SIWriteRequest&& request) {
-        return handleWrite(std::move(request), FastDeadline(_config.writeTimeout()));
+        _hotWrites.sample(request.key);
+        return _withLoad(request.key, request.mtr, [&] {
+            return _measured(_writeMetrics, [&] {
+                return handleWrite(std::move(request), FastDeadline(_hot->writeTimeout));
+            });
+        });
+    });
+
+    _routes.registerRPCObserver<dto::K23SIWriteMultiRequest, dto::K23SIWriteMultiResponse>
+    (dto::Verbs::K23SI_WRITE_MULTI, [this](dto::K23SIWriteMultiRequest&& request) {
+        _hotWrites.sample(request.key);
+        return _withLoad(request.key, request.mtr, [&] {
+            return _measured(_writeMultiMetrics, [&] {
+                return handleWriteMulti(std::move(request), FastDeadline(_hot->writeTimeout));
+            });
+        });
     });
 
-    RPC().registerRPCObserver<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse>
+    _routes.registerRPCObserver<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse>
     (dto::Verbs::K23SI_TXN_PUSH, [this](dto::K23SITxnPushRequest&& request) {
-        return handleTxnPush(std::move(request));
+        return _inFlight([&] {
+            return _measured(_pushMetrics, [&] {
+                return handleTxnPush(std::move(request));
+            })
+            .then([this] (auto&& result) {
+                auto& [status, response] = result;
+                if (status.is2xxOK()) {
+                    switch (response.incumbentState) {
+                        case dto::TxnRecordState::Aborted:
+                            _pushesIncumbentAborted++;
+                            break;
+                        case dto::TxnRecordState::InProgress:
+                            _pushesIncumbentWon++;
+                            break;
+                        default:
+                            _pushesIncumbentCommitted++;
+                    }
+                }
+                return std::move(result);
+            });
+        });
     });
 
-    RPC().registerRPCObserver<dto::K23SITxnEndRequest, dto::K23SITxnEndResponse>
+    _routes.registerRPCObserver<dto::K23SITxnEndRequest, dto::K23SITxnEndResponse>
     (dto::Verbs::K23SI_TXN_END, [this](dto::K23SITxnEndRequest&& request) {
-        return handleTxnEnd(std::move(request));
+        return _inFlight([&] {
+            return _measured(_endMetrics, [&] {
+                return handleTxnEnd(std::move(request));
+            });
+        });
     });
 
-    RPC().registerRPCObserver<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse>
+    _routes.registerRPCObserver<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse>
     (dto::Verbs::K23SI_TXN_HEARTBEAT, [this](dto::K23SITxnHeartbeatRequest&& request) {
-        return handleTxnHeartbeat(std::move(request));
+        return _inFlight([&] {
+            return _measured(_heartbeatMetrics, [&] {
+                return handleTxnHeartbeat(std::move(request));
+            });
+        });
+    });
+
+    _routes.registerRPCObserver<dto::K23SITxnHeartbeatMultiRequest, dto::K23SITxnHeartbeatMultiResponse>
+    (dto::Verbs::K23SI_TXN_HEARTBEAT_MULTI, [this](dto::K23SITxnHeartbeatMultiRequest&& request) {
+        return _inFlight([&] {
+            return _measured(_heartbeatMetrics, [&] {
+                return handleTxnHeartbeatMulti(std::move(request));
+            });
+        });
     });
 
-    RPC().registerRPCObserver<dto::K23SITxnFinalizeRequest, dto::K23SITxnFinalizeResponse>
+    _routes.registerRPCObserver<dto::K23SITxnFinalizeRequest, dto::K23SITxnFinalizeResponse>
     (dto::Verbs::K23SI_TXN_FINALIZE, [this](dto::K23SITxnFinalizeRequest&& request) {
-        return handleTxnFinalize(std::move(request));
+        return _inFlight([&] {
+            return _measured(_finalizeMetrics, [&] {
+                return handleTxnFinalize(std::move(request));
+            });
+        });
+    });
+
+    _routes.registerRPCObserver<dto::K23SITxnFinalizeMultiRequest, dto::K23SITxnFinalizeMultiResponse>
+    (dto::Verbs::K23SI_TXN_FINALIZE_MULTI, [this](dto::K23SITxnFinalizeMultiRequest&& request) {
+        return _inFlight([&] {
+            return _measured(_finalizeMetrics, [&] {
+                return handleTxnFinalizeMulti(std::move(request));
+            });
+        });
     });
 
-    RPC().registerRPCObserver<dto::K23SIPushSchemaRequest, dto::K23SIPushSchemaResponse>
+    _routes.registerRPCObserver<dto::K23SITxnAwaitDurableRequest, dto::K23SITxnAwaitDurableResponse>
+    (dto::Verbs::K23SI_TXN_AWAIT_DURABLE, [this](dto::K23SITxnAwaitDurableRequest&& request) {
+        return handleTxnAwaitDurable(std::move(request));
+    });
+
+    _routes.registerRPCObserver<dto::K23SIPushSchemaRequest, dto::K23SIPushSchemaResponse>
     (dto::Verbs::K23SI_PUSH_SCHEMA, [this](dto::K23SIPushSchemaRequest&& request) {
         return handlePushSchema(std::move(request));
     });
 
-    RPC().registerRPCObserver<dto::K23SIInspectRecordsRequest, dto::K23SIInspectRecordsResponse>
+    _routes.registerRPCObserver<dto::K23SISplitRequest, dto::K23SISplitResponse>
+    (dto::Verbs::K23SI_SPLIT, [this](dto::K23SISplitRequest&& request) {
+        return handleSplit(std::move(request));
+    });
+
+    _routes.registerRPCObserver<dto::K23SISplitTransferRequest, dto::K23SISplitTransferResponse>
+    (dto::Verbs::K23SI_SPLIT_TRANSFER, [this](dto::K23SISplitTransferRequest&& request) {
+        return handleSplitTransfer(std::move(request));
+    });
+
+    _routes.registerRPCObserver<dto::K23SIBulkIngestRequest, dto::K23SIBulkIngestResponse>
+    (dto::Verbs::K23SI_BULK_INGEST, [this](dto::K23SIBulkIngestRequest&& request) {
+        return _inFlight([&] {
+            return handleBulkIngest(std::move(request), FastDeadline(_hot->persistenceTimeout));
+        });
+    });
+
+    _routes.registerRPCObserver<dto::K23SIRangeDeleteRequest, dto::K23SIRangeDeleteResponse>
+    (dto::Verbs::K23SI_RANGE_DELETE, [this](dto::K23SIRangeDeleteRequest&& request) {
+        return _inFlight([&] {
+            return handleRangeDelete(std::move(request), FastDeadline(_hot->persistenceTimeout));
+        });
+    });
+
+    _routes.registerRPCObserver<dto::K23SIChangesRequest, dto::K23SIChangesResponse>
+    (dto::Verbs::K23SI_CHANGES, [this](dto::K23SIChangesRequest&& request) {
+        return handleChanges(std::move(request));
+    });
+
+    _routes.registerRPCObserver<dto::K23SIExportRequest, dto::K23SIExportResponse>
+    (dto::Verbs::K23SI_EXPORT, [this](dto::K23SIExportRequest&& request) {
+        return handleExport(std::move(request));
+    });
+    _routes.registerAPIObserver<dto::K23SIExportRequest, dto::K23SIExportResponse>
+    ("ExportPartition", "Exports the partition as of a snapshot timestamp into a file on its node", [this](dto::K23SIExportRequest&& request) {
+        return handleExport(std::move(request));
+    });
+
+    _routes.registerRPCObserver<dto::K23SIRestoreRequest, dto::K23SIRestoreResponse>
+    (dto::Verbs::K23SI_RESTORE, [this](dto::K23SIRestoreRequest&& request) {
+        return handleRestore(std::move(request));
+    });
+    _routes.registerAPIObserver<dto::K23SIRestoreRequest, dto::K23SIRestoreResponse>
+    ("RestorePartition", "Rebuilds the empty partition from an export file on its node", [this](dto::K23SIRestoreRequest&& request) {
+        return handleRestore(std::move(request));
+    });
+
+    _routes.registerRPCObserver<dto::K23SIPartitionLoadRequest, dto::K23SIPartitionLoadResponse>
+    (dto::Verbs::K23SI_PARTITION_LOAD, [this](dto::K23SIPartitionLoadRequest&& request) {
+        return handlePartitionLoad(std::move(request));
+    });
+
+    _routes.registerRPCObserver<dto::K23SIMigrateRequest, dto::K23SIMigrateResponse>
+    (dto::Verbs::K23SI_MIGRATE, [this](dto::K23SIMigrateRequest&& request) {
+        return handleMigrate(std::move(request));
+    });
+
+    _routes.registerRPCObserver<dto::K23SIInspectRecordsRequest, dto::K23SIInspectRecordsResponse>
     (dto::Verbs::K23SI_INSPECT_RECORDS, [this](dto::K23SIInspectRecordsRequest&& request) {
         return handleInspectRecords(std::move(request));
     });
 
-    RPC().registerRPCObserver<dto::K23SIInspectTxnRequest, dto::K23SIInspectTxnResponse>
+    _routes.registerRPCObserver<dto::K23SIInspectTxnRequest, dto::K23SIInspectTxnResponse>
     (dto::Verbs::K23SI_INSPECT_TXN, [this](dto::K23SIInspectTxnRequest&& request) {
         return handleInspectTxn(std::move(request));
     });
 
-    RPC().registerRPCObserver<dto::K23SIInspectWIsRequest, dto::K23SIInspectWIsResponse>
+    _routes.registerRPCObserver<dto::K23SIInspectWIsRequest, dto::K23SIInspectWIsResponse>
     (dto::Verbs::K23SI_INSPECT_WIS, [this](dto::K23SIInspectWIsRequest&& request) {
         return handleInspectWIs(std::move(request));
     });
 
-    RPC().registerRPCObserver<dto::K23SIInspectAllTxnsRequest, dto::K23SIInspectAllTxnsResponse>
+    _routes.registerRPCObserver<dto::K23SIInspectAllTxnsRequest, dto::K23SIInspectAllTxnsResponse>
     (dto::Verbs::K23SI_INSPECT_ALL_TXNS, [this](dto::K23SIInspectAllTxnsRequest&& request) {
         return handleInspectAllTxns(std::move(request));
     });
 
-    RPC().registerRPCObserver<dto::K23SIInspectAllKeysRequest, dto::K23SIInspectAllKeysResponse>
+    _routes.registerRPCObserver<dto::K23SIInspectAllKeysRequest, dto::K23SIInspectAllKeysResponse>
     (dto::Verbs::K23SI_INSPECT_ALL_KEYS, [this](dto::K23SIInspectAllKeysRequest&& request) {
         return handleInspectAllKeys(std::move(request));
     });
-    api_server.registerAPIObserver<dto::K23SIInspectAllKeysRequest, dto::K23SIInspectAllKeysResponse>
+    _routes.registerAPIObserver<dto::K23SIInspectAllKeysRequest, dto::K23SIInspectAllKeysResponse>
     ("InspectAllKeys", "Returns ALL keys on the partition", [this](dto::K23SIInspectAllKeysRequest&& request) {
         return handleInspectAllKeys(std::move(request));
     });
 
+    _routes.registerRPCObserver<dto::K23SIInspectHotKeysRequest, dto::K23SIInspectHotKeysResponse>
+    (dto::Verbs::K23SI_INSPECT_HOT_KEYS, [this](dto::K23SIInspectHotKeysRequest&& request) {
+        return handleInspectHotKeys(std::move(request));
+    });
+    _routes.registerAPIObserver<dto::K23SIInspectHotKeysRequest, dto::K23SIInspectHotKeysResponse>
+    ("InspectHotKeys", "Returns the keys of the partition with the most contention", [this](dto::K23SIInspectHotKeysRequest&& request) {
+        return handleInspectHotKeys(std::move(request));
+    });
+
 
     if (_cmeta.retentionPeriod < _config.minimumRetentionPeriod()) {
         K2LOG_W(log::skvsvr,
@@ -139,210 +430,2100 @@ seastar::future<> K23SIPartitionModule::start() {
         _cmeta.retentionPeriod = _config.minimumRetentionPeriod();
     }
 
+    // before recovery, so that the recovered keys go into the key filters and the point indexes
+    _indexer.enableKeyFilters(_config.keyFilterBitsPerKey());
+    _indexer.enablePointIndexes(_config.pointIndexes());
+
+    // the data and the transaction records of the partition go to the same WAL, and are recovered together. The
+    // transaction records resume once the data is recovered, so that their finalization finds the WIs
+    _persistence.setSource(fmt::format("{}:{}", _cmeta.name, _partition().pvid.id));
+
     // todo call TSO to get a timestamp
     return getTimeNow()
         .then([this](dto::Timestamp&& watermark) {
             K2LOG_D(log::skvsvr, "Cache watermark: {}, period={}", watermark, _cmeta.retentionPeriod);
+            _tsoClockOffset = watermark.tEndTSECount() - now_nsec_count();
             _retentionTimestamp = watermark - _cmeta.retentionPeriod;
-            _readCache = std::make_unique<ReadCache<dto::Key, dto::Timestamp>>(watermark, _config.readCacheSize());
+            _readCache = std::make_unique<FlatReadCache<dto::Key, dto::Timestamp>>(watermark, _config.readCacheSize());
+            _snapshotReadCache = std::make_unique<FlatReadCache<dto::Key, dto::Timestamp>>(watermark, _config.snapshotReadCacheSize());
+            _configureReadCache();
             _retentionUpdateTimer.arm(_config.retentionTimestampUpdateInterval());
-            return seastar::when_all_succeed(_recovery(), _txnMgr.start(_cmeta.name, _retentionTimestamp, _cmeta.heartbeatDeadline)).discard_result();
+            _gcTimer.setCallback([this] {
+                return _gcPass();
+            });
+            _gcTimer.armPeriodic(_config.gcInterval());
+            _queryStreamTimer.setCallback([this] {
+                _expireQueryReadRanges();
+                return _expireQueryStreams();
+            });
+            _queryStreamTimer.armPeriodic(_config.queryStreamIdleTimeout());
+            // finalize keys of our own transactions which live in this partition without going through RPC
+            _txnMgr.setLocalPartition(
+                [this] (const dto::Key& key) { return _partition.owns(key); },
+                [this] (dto::K23SITxnFinalizeMultiRequest&& request) {
+                    request.pvid = _partition().pvid;
+                    return handleTxnFinalizeMulti(std::move(request));
+                });
+            // a migration target gets its state from the partition it replaces
+            auto recovery = _migrationTarget ? seastar::make_ready_future() : _recovery();
+            return seastar::when_all_succeed(std::move(recovery), _txnMgr.start(_cmeta.name, _retentionTimestamp, _cmeta.heartbeatDeadline)).discard_result();
+        })
+        .then([this] {
+            return _txnMgr.resumeRecovered();
+        })
+        .then([this] {
+            if (_follower) {
+                // the partition keeps writing to its WAL, and we keep replaying it
+                _walTimer.setCallback([this] {
+                    return _followWAL();
+                });
+                _walTimer.armPeriodic(_config.followerPollInterval());
+            }
+            else if (!_migrationTarget) {
+                _startCheckpoints();
+            }
+            return _follower ? seastar::make_ready_future() : _startChanges();
+        });
+}
+
+void K23SIPartitionModule::_startCheckpoints() {
+    if (_config.checkpointInterval() > 0s) {
+        _checkpointTimer.setCallback([this] {
+            return _checkpoint().discard_result();
         });
+        _checkpointTimer.armPeriodic(_config.checkpointInterval());
+    }
+    if (_config.closedTimestampInterval() > 0s) {
+        _walTimer.setCallback([this] {
+            return _closeTimestamp();
+        });
+        _walTimer.armPeriodic(_config.closedTimestampInterval());
+    }
 }
 
 K23SIPartitionModule::~K23SIPartitionModule() {
     K2LOG_I(log::skvsvr, "dtor for cname={}, part={}", _cmeta.name, _partition);
 }
 
+int64_t K23SIPartitionModule::_readCacheWatermarkLag() const {
+    if (!_readCache) {
+        return 0;
+    }
+    int64_t now = now_nsec_count() + _tsoClockOffset;
+    return now - (int64_t)_readCache->min_TimeStamp().tEndTSECount();
+}
+
+void K23SIPartitionModule::_onConfigReload() {
+    if (_readCache) {
+        _readCache->setMaxSize(_config.readCacheSize());
+    }
+    if (_snapshotReadCache) {
+        _snapshotReadCache->setMaxSize(_config.snapshotReadCacheSize());
+    }
+}
+
+void K23SIPartitionModule::_configureReadCache() {
+    uint64_t bucket = nsec(_config.readCacheTimestampBucket()).count();
+    if (bucket > 0) {
+        _readCache->setTimestampBucketing([bucket] (const dto::Timestamp& ts) {
+            uint64_t end = ts.tEndTSECount();
+            uint64_t rounded = (end + bucket - 1) / bucket * bucket;
+            return ts + (rounded - end)*1ns;
+        });
+    }
+    if (_config.readCacheCoalesce()) {
+        uint64_t window = nsec(_config.readCacheCoalesceWindow()).count();
+        _readCache->setCoalescing([window] (const dto::Timestamp& a, const dto::Timestamp& b) {
+            uint64_t ea = a.tEndTSECount();
+            uint64_t eb = b.tEndTSECount();
+            return (ea > eb ? ea - eb : eb - ea) <= window;
+        });
+    }
+}
+
 seastar::future<> K23SIPartitionModule::_recovery() {
-    //TODO perform recovery
-    K2LOG_D(log::skvsvr, "Partition: {}, recovery", _partition);
-    return _persistence.makeCall(dto::K23SI_PersistenceRecoveryRequest{}, _config.persistenceTimeout());
+    K2LOG_I(log::skvsvr, "Partition: {}, recovery from source {}", _partition, _persistence.source());
+    return seastar::do_with(uint64_t(0), [this] (uint64_t& walStart) {
+        return _recoverCheckpoint(walStart)
+        .then([this, &walStart] {
+            return _recoverWAL(walStart);
+        })
+        .then([this] (uint64_t walEnd) {
+            _walReplayedLSN = walEnd;
+        });
+    })
+    .then([this] {
+        K2LOG_I(log::skvsvr, "Partition: {}, recovered {} keys from checkpoint and replayed {} WAL records",
+                _partition, _recoveredKeys, _replayedWALRecords);
+    });
 }
 
-seastar::future<> K23SIPartitionModule::gracefulStop() {
-    K2LOG_I(log::skvsvr, "stop for cname={}, part={}", _cmeta.name, _partition);
-    _retentionUpdateTimer.cancel();
-    return seastar::when_all_succeed(std::move(_retentionRefresh), _txnMgr.gracefulStop()).discard_result().then([]{K2LOG_I(log::skvsvr, "stopped");});
+seastar::future<> K23SIPartitionModule::_recoverCheckpoint(uint64_t& walStart) {
+    dto::K23SIRecoverCheckpointRequest request{.source=_persistence.source(), .chunkIndex=0};
+    return _persistence.call<dto::K23SIRecoverCheckpointRequest, dto::K23SIRecoverCheckpointResponse, dto::Verbs::K23SI_RECOVER_CHECKPOINT>
+        (std::move(request), _hot->persistenceTimeout)
+    .then([this, &walStart] (auto&& result) {
+        auto& status = std::get<0>(result);
+        auto& response = std::get<1>(result);
+        if (!status.is2xxOK()) {
+            return seastar::make_exception_future(std::runtime_error(fmt::format("unable to recover checkpoint: {}", status)));
+        }
+        if (!response.found) {
+            K2LOG_I(log::skvsvr, "Partition: {}, no checkpoint to recover", _partition);
+            return seastar::make_ready_future();
+        }
+        K2LOG_I(log::skvsvr, "Partition: {}, recovering checkpoint {} with {} chunks at lsn={}",
+                _partition, response.checkpointId, response.chunkCount, response.lsn);
+        walStart = response.lsn;
+        if (response.chunkCount == 0) {
+            return seastar::make_ready_future();
+        }
+        _applyCheckpointChunk(response.entries);
+
+        // the chunks hold disjoint keys, so the rest of them can be fetched and applied in any order
+        return seastar::do_with(uint64_t(1), response.chunkCount, response.checkpointId,
+            [this] (uint64_t& next, uint64_t& chunkCount, uint64_t& checkpointId) {
+            return seastar::repeat([this, &next, &chunkCount, &checkpointId] {
+                if (next >= chunkCount) {
+                    return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                }
+                std::vector<uint64_t> chunks;
+                for (; next < chunkCount && chunks.size() < _config.recoveryParallelism(); ++next) {
+                    chunks.push_back(next);
+                }
+                return seastar::do_with(std::move(chunks), [this, &checkpointId] (auto& chunks) {
+                    return seastar::parallel_for_each(chunks, [this, &checkpointId] (uint64_t chunkIndex) {
+                        dto::K23SIRecoverCheckpointRequest request{.source=_persistence.source(), .chunkIndex=chunkIndex};
+                        return _persistence.call<dto::K23SIRecoverCheckpointRequest, dto::K23SIRecoverCheckpointResponse, dto::Verbs::K23SI_RECOVER_CHECKPOINT>
+                            (std::move(request), _hot->persistenceTimeout)
+                        .then([this, &checkpointId] (auto&& result) {
+                            auto& status = std::get<0>(result);
+                            auto& response = std::get<1>(result);
+                            if (!status.is2xxOK() || response.checkpointId != checkpointId) {
+                                throw std::runtime_error(fmt::format("unable to recover checkpoint chunk: {}", status));
+                            }
+                            _applyCheckpointChunk(response.entries);
+                        });
+                    });
+                })
+                .then([] {
+                    return seastar::stop_iteration::no;
+                });
+            });
+        });
+    });
 }
 
-seastar::future<std::tuple<Status, dto::K23SIReadResponse>>
-_makeReadOK(dto::DataRecord* rec) {
-    if (rec == nullptr || rec->isTombstone) {
-        return RPCResponse(dto::K23SIStatus::KeyNotFound("read did not find key"), dto::K23SIReadResponse{});
+seastar::future<uint64_t> K23SIPartitionModule::_recoverWAL(uint64_t walStart) {
+    // The tail is fetched in waves of concurrent LSN ranges. Each wave is applied in LSN order since later records
+    // of a key depend on earlier ones. We only replay up to the end of the WAL as of the first response so that
+    // we don't chase records which are written while we recover
+    return seastar::do_with(walStart, std::optional<uint64_t>(), [this] (uint64_t& next, std::optional<uint64_t>& walEnd) {
+        return seastar::repeat([this, &next, &walEnd] {
+            if (walEnd && next >= *walEnd) {
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            auto range = std::max<uint64_t>(_config.recoveryWALRange(), 1);
+            // until we know where the WAL ends, only fetch a single range
+            size_t count = walEnd ? std::min<uint64_t>(_config.recoveryParallelism(), (*walEnd - next + range - 1) / range) : 1;
+            std::vector<dto::K23SIRecoverWALRequest> requests;
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t to = walEnd ? std::min(next + range, *walEnd) : next + range;
+                requests.push_back(dto::K23SIRecoverWALRequest{.source=_persistence.source(), .fromLSN=next, .toLSN=to});
+                next = to;
+            }
+            auto responses = seastar::make_lw_shared<std::vector<dto::K23SIRecoverWALResponse>>(requests.size());
+            return seastar::do_with(std::move(requests), [this, responses] (auto& requests) {
+                return seastar::parallel_for_each(boost::irange<size_t>(0, requests.size()), [this, &requests, responses] (size_t i) {
+                    return _persistence.call<dto::K23SIRecoverWALRequest, dto::K23SIRecoverWALResponse, dto::Verbs::K23SI_RECOVER_WAL>
+                        (std::move(requests[i]), _hot->persistenceTimeout)
+                    .then([i, responses] (auto&& result) {
+                        auto& status = std::get<0>(result);
+                        if (!status.is2xxOK()) {
+                            throw std::runtime_error(fmt::format("unable to recover WAL: {}", status));
+                        }
+                        (*responses)[i] = std::move(std::get<1>(result));
+                    });
+                });
+            })
+            .then([this, responses, &walEnd] {
+                TaskTimer timer(dto::Verbs::K23SI_RECOVER_WAL);
+                for (auto& response : *responses) {
+                    if (!walEnd) {
+                        walEnd = response.endLSN;
+                    }
+                    for (auto& batch : response.records) {
+                        _replayWALBatch(batch);
+                    }
+                }
+                return seastar::stop_iteration::no;
+            });
+        })
+        .then([&walEnd] {
+            return *walEnd;
+        });
+    });
+}
+
+seastar::future<> K23SIPartitionModule::_followWAL() {
+    return seastar::repeat([this] {
+        if (_stopped) {
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+        }
+        uint64_t toLSN = _walReplayedLSN + std::max<uint64_t>(_config.recoveryWALRange(), 1);
+        dto::K23SIRecoverWALRequest request{.source=_persistence.source(), .fromLSN=_walReplayedLSN, .toLSN=toLSN};
+        return _persistence.call<dto::K23SIRecoverWALRequest, dto::K23SIRecoverWALResponse, dto::Verbs::K23SI_RECOVER_WAL>
+            (std::move(request), _hot->persistenceTimeout)
+        .then([this, toLSN] (auto&& result) {
+            auto& status = std::get<0>(result);
+            auto& response = std::get<1>(result);
+            if (status.code == 410) {
+                // the partition checkpointed past the records we have yet to replay
+                K2LOG_I(log::skvsvr, "Partition: {}, WAL truncated past lsn={}, reloading follower from checkpoint", _partition, _walReplayedLSN);
+                _followerResyncs++;
+                return _recovery().then([] { return seastar::stop_iteration::yes; });
+            }
+            if (!status.is2xxOK()) {
+                throw std::runtime_error(fmt::format("unable to poll WAL: {}", status));
+            }
+            // a follower replays while it serves reads, so a long replay delays them
+            TaskTimer timer(dto::Verbs::K23SI_RECOVER_WAL);
+            for (auto& batch : response.records) {
+                _replayWALBatch(batch);
+            }
+            _walReplayedLSN = std::min(toLSN, response.endLSN);
+            // keep going while we are behind, without waiting for the next poll
+            return seastar::make_ready_future<seastar::stop_iteration>(
+                _walReplayedLSN < response.endLSN ? seastar::stop_iteration::no : seastar::stop_iteration::yes);
+        });
+    })
+    .handle_exception([this] (auto exc) {
+        // the next poll continues from where we stopped
+        K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, follower WAL poll failed", _partition);
+    });
+}
+
+seastar::future<> K23SIPartitionModule::_closeTimestamp() {
+    return getTimeNow()
+    .then([this] (dto::Timestamp&& now) {
+        _tsoClockOffset = now.tEndTSECount() - now_nsec_count();
+        dto::K23SI_PersistenceClosedTimestamp record{.closed = now - _config.snapshotReadMinStaleness()};
+        // a pending write below the closed timestamp may still commit, so we can only close up to just below it
+        auto oldest = _oldestPendingWrite();
+        if (oldest && oldest->compareCertain(record.closed) <= 0) {
+            record.closed = *oldest - 1ns;
+        }
+        // from now on writes at or below the closed timestamp are rejected
+        if (record.closed.compareCertain(_snapshotHorizon) > 0) {
+            _snapshotHorizon = record.closed;
+        }
+        return _persistence.makeCall(record, _hot->persistenceTimeout);
+    })
+    .then([this] {
+        _closedTimestampsWritten++;
+    })
+    .handle_exception([this] (auto exc) {
+        K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, unable to write closed timestamp", _partition);
+    });
+}
+
+void K23SIPartitionModule::_applyCheckpointChunk(Payload& entries) {
+    // chunks are applied from continuations during recovery, which the dispatcher doesn't time
+    TaskTimer timer(dto::Verbs::K23SI_RECOVER_CHECKPOINT);
+    entries.seek(0);
+    while (entries.getDataRemaining() > 0) {
+        dto::Key key;
+        uint32_t count = 0;
+        if (!entries.read(key) || !entries.read(count)) {
+            throw std::runtime_error("corrupted checkpoint chunk");
+        }
+        std::vector<dto::DataRecord> records(count);
+        for (auto& rec : records) {
+            if (!entries.read(rec)) {
+                throw std::runtime_error("corrupted checkpoint chunk");
+            }
+        }
+        if (count == 0) {
+            // the key is gone from the partition which sent it
+            uint32_t schemaId = _indexer.findId(key.schemaName);
+            if (schemaId == SchemaIndexer::NoSchemaId) continue;
+            auto& index = _indexer.at(schemaId);
+            auto kiter = index.find(key);
+            if (kiter != index.end()) {
+                _dropChunkWIs(key, kiter->second);
+                _indexer.erase(schemaId, kiter);
+            }
+            continue;
+        }
+        auto& versions = _indexer.getOrCreateVersions(key);
+        // a migration sends changed keys again
+        _dropChunkWIs(key, versions);
+        versions.clear();
+        // versions are stored newest first
+        for (auto rit = records.rbegin(); rit != records.rend(); ++rit) {
+            rit->value = _arena.copy(rit->value);
+            if (rit->status == dto::DataRecord::WriteIntent) {
+                _wiIndex.add(rit->txnId, key);
+            }
+            versions.push_front(std::move(*rit));
+        }
+        _recoveredKeys++;
     }
+}
 
-    auto response = dto::K23SIReadResponse();
-    response.value = rec->value.share();
-    return RPCResponse(dto::K23SIStatus::OK("read succeeded"), std::move(response));
+void K23SIPartitionModule::_dropChunkWIs(const dto::Key& key, VersionsT& versions) {
+    if (versions.empty() || versions.front().status != dto::DataRecord::WriteIntent) {
+        return;
+    }
+    _wiIndex.remove(versions.front().txnId, key);
+}
+
+void K23SIPartitionModule::_replayWALBatch(Payload& batch) {
+    batch.seek(0);
+    while (batch.getDataRemaining() > 0) {
+        dto::PersistenceRecordType type;
+        if (!batch.read(type)) {
+            throw std::runtime_error("corrupted WAL batch");
+        }
+        bool ok = false;
+        switch (type) {
+            case dto::PersistenceRecordType::DataRecord: {
+                dto::DataRecord rec;
+                ok = batch.read(rec);
+                if (ok) _replayDataRecord(std::move(rec));
+                break;
+            }
+            case dto::PersistenceRecordType::PartialUpdate: {
+                dto::K23SI_PersistencePartialUpdate update;
+                ok = batch.read(update);
+                if (ok) _replayPartialUpdate(update);
+                break;
+            }
+            case dto::PersistenceRecordType::TxnRecord: {
+                TxnRecord rec;
+                ok = batch.read(rec);
+                // a follower doesn't hold transaction records. It resolves WIs through the TRH like any reader
+                if (ok && !_follower) _txnMgr.recoverRecord(std::move(rec));
+                break;
+            }
+            case dto::PersistenceRecordType::Recovery: {
+                dto::K23SI_PersistenceRecoveryRequest rec;
+                ok = batch.read(rec);
+                break;
+            }
+            case dto::PersistenceRecordType::ClosedTimestamp: {
+                dto::K23SI_PersistenceClosedTimestamp rec;
+                ok = batch.read(rec);
+                if (ok && rec.closed.compareCertain(_closedTimestamp) > 0) {
+                    _closedTimestamp = rec.closed;
+                    // the partition promised not to accept writes at or below it, which holds across restarts too
+                    if (_closedTimestamp.compareCertain(_snapshotHorizon) > 0) {
+                        _snapshotHorizon = _closedTimestamp;
+                    }
+                }
+                break;
+            }
+            case dto::PersistenceRecordType::RangeTombstone: {
+                dto::K23SI_PersistenceRangeTombstone rec;
+                ok = batch.read(rec);
+                if (ok) _addRangeTombstone(std::move(rec));
+                break;
+            }
+        }
+        if (!ok) {
+            throw std::runtime_error("corrupted WAL batch");
+        }
+        _replayedWALRecords++;
+    }
+}
+
+void K23SIPartitionModule::_replayDataRecord(dto::DataRecord&& rec) {
+    dto::Key key = std::move(rec.key);
+    auto& versions = _indexer.getOrCreateVersions(key);
+    _applyRangeTombstones(key, versions);
+    if (!versions.empty() && versions.front().txnId.mtr == rec.txnId.mtr) {
+        // the txn wrote the key again, which replaces its WI
+        _wiIndex.remove(versions.front().txnId, key);
+        versions.pop_front();
+    }
+    else if (!versions.empty() && versions.front().txnId.mtr.timestamp.compareCertain(rec.txnId.mtr.timestamp) >= 0) {
+        // we have this or a newer version already, e.g. from the checkpoint
+        K2LOG_D(log::skvsvr, "Partition: {}, skipping replay of older version for key {} in txn {}", _partition, key, rec.txnId);
+        return;
+    }
+    rec.value = _arena.copy(rec.value);
+    auto& version = versions.push_front(std::move(rec));
+    // bulk ingested records are committed when they are written
+    if (version.status == dto::DataRecord::WriteIntent) {
+        _wiIndex.add(version.txnId, key);
+    }
+}
+
+void K23SIPartitionModule::_replayPartialUpdate(dto::K23SI_PersistencePartialUpdate& update) {
+    for (auto& finalized : update.finalized) {
+        auto index = _indexer.find(finalized.key.schemaName);
+        if (index == nullptr) continue;
+        auto kiter = index->find(finalized.key);
+        if (kiter == index->end()) continue;
+        auto viter = _getVersion(kiter->second, finalized.timestamp);
+        if (viter == kiter->second.end() || viter->status != dto::DataRecord::WriteIntent ||
+            viter->txnId.mtr.timestamp.compareCertain(finalized.timestamp) != 0) {
+            // already finalized in the checkpoint
+            continue;
+        }
+        _wiIndex.remove(viter->txnId, finalized.key);
+        viter->status = finalized.status;
+        if (finalized.status == dto::DataRecord::Aborted) {
+            _removeRecord(finalized.key, *viter);
+        }
+    }
+}
+
+seastar::future<bool> K23SIPartitionModule::_checkpoint() {
+    return seastar::with_semaphore(_checkpointSem, 1, [this] {
+        return _checkpointPass();
+    });
+}
+
+seastar::future<bool> K23SIPartitionModule::_checkpointPass() {
+    if (_stopped) {
+        return seastar::make_ready_future<bool>(false);
+    }
+    dto::K23SICheckpointBeginRequest request{.source=_persistence.source()};
+    return _persistence.call<dto::K23SICheckpointBeginRequest, dto::K23SICheckpointBeginResponse, dto::Verbs::K23SI_CHECKPOINT_BEGIN>
+        (std::move(request), _hot->persistenceTimeout)
+    .then([this] (auto&& result) {
+        auto& status = std::get<0>(result);
+        if (!status.is2xxOK()) {
+            return seastar::make_exception_future<bool>(std::runtime_error(fmt::format("unable to begin checkpoint: {}", status)));
+        }
+        auto checkpointId = std::get<1>(result).checkpointId;
+        K2LOG_D(log::skvsvr, "Partition: {}, starting checkpoint {} at lsn={}", _partition, checkpointId, std::get<1>(result).lsn);
+        // the chunks carry the range tombstones of the keys we have. Keys written later still need them
+        return _persistRangeTombstones()
+        .then([this] {
+            // the WIs in the chunks need the records of their transactions, whose earlier states the checkpoint truncates
+            return _txnMgr.persistRecords();
+        })
+        .then([this, checkpointId] {
+            return seastar::do_with(uint32_t(0), dto::Key{}, checkpointId, [this] (uint32_t& schemaId, dto::Key& cursor, uint64_t& checkpointId) {
+                // the cursor is a key rather than an iterator since the indexer may be modified while we yield
+                return seastar::repeat([this, &schemaId, &cursor, &checkpointId] {
+                    if (_stopped) {
+                        return seastar::make_exception_future<seastar::stop_iteration>(std::runtime_error("stopped during checkpoint"));
+                    }
+                    if (schemaId >= _indexer.schemaCount()) {
+                        return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                    }
+                    dto::K23SICheckpointChunkRequest chunk{.source=_persistence.source(), .checkpointId=checkpointId,
+                                                           .entries=Payload(Payload::DefaultAllocator)};
+                    if (_checkpointChunk(_indexer.at(schemaId), cursor, chunk.entries)) {
+                        // done with this schema
+                        ++schemaId;
+                        cursor = dto::Key{};
+                    }
+                    if (chunk.entries.getSize() == 0) {
+                        return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::no);
+                    }
+                    return _persistence.call<dto::K23SICheckpointChunkRequest, dto::K23SICheckpointChunkResponse, dto::Verbs::K23SI_CHECKPOINT_CHUNK>
+                        (std::move(chunk), _hot->persistenceTimeout)
+                    .then([] (auto&& result) {
+                        auto& status = std::get<0>(result);
+                        if (!status.is2xxOK()) {
+                            throw std::runtime_error(fmt::format("unable to write checkpoint chunk: {}", status));
+                        }
+                        return seastar::stop_iteration::no;
+                    });
+                })
+                .then([this, &checkpointId] {
+                    dto::K23SICheckpointEndRequest request{.source=_persistence.source(), .checkpointId=checkpointId};
+                    return _persistence.call<dto::K23SICheckpointEndRequest, dto::K23SICheckpointEndResponse, dto::Verbs::K23SI_CHECKPOINT_END>
+                        (std::move(request), _hot->persistenceTimeout);
+                })
+                .then([this, &checkpointId] (auto&& result) {
+                    auto& status = std::get<0>(result);
+                    if (!status.is2xxOK()) {
+                        throw std::runtime_error(fmt::format("unable to complete checkpoint: {}", status));
+                    }
+                    _checkpointsCompleted++;
+                    K2LOG_D(log::skvsvr, "Partition: {}, completed checkpoint {}, WAL truncated to lsn={}",
+                            _partition, checkpointId, std::get<1>(result).truncatedLSN);
+                    return true;
+                });
+            });
+        });
+    })
+    .handle_exception([this] (auto exc) {
+        // the next pass takes a new checkpoint
+        _checkpointsFailed++;
+        K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, checkpoint failed", _partition);
+        return false;
+    });
+}
+
+bool K23SIPartitionModule::_checkpointChunk(IndexerT& index, dto::Key& cursor, Payload& chunk, const dto::OwnerPartition* owner) {
+    auto it = index.lower_bound(cursor);
+    uint32_t examined = 0;
+    while (it != index.end() && chunk.getSize() < _config.checkpointChunkBytes()) {
+        if (owner) {
+            if (examined++ >= _config.gcChunkSize()) {
+                break;
+            }
+            if (!owner->owns(it->first)) {
+                ++it;
+                continue;
+            }
+        }
+        _writeChunkEntry(it->first, it->second, chunk);
+        ++it;
+    }
+    if (it == index.end()) {
+        return true;
+    }
+    cursor = it->first;
+    return false;
+}
+
+bool K23SIPartitionModule::_changedKeysChunk(const std::vector<dto::Key>& keys, size_t& next, Payload& chunk) {
+    while (next < keys.size() && chunk.getSize() < _config.checkpointChunkBytes()) {
+        const dto::Key& key = keys[next++];
+        auto index = _indexer.find(key.schemaName);
+        if (index != nullptr) {
+            auto it = index->find(key);
+            if (it != index->end() && !it->second.empty()) {
+                _writeChunkEntry(it->first, it->second, chunk);
+                continue;
+            }
+        }
+        chunk.write(key);
+        chunk.write(uint32_t(0));
+    }
+    return next >= keys.size();
+}
+
+void K23SIPartitionModule::_writeChunkEntry(const dto::Key& key, VersionsT& versions, Payload& chunk) {
+    _applyRangeTombstones(key, versions);
+    chunk.write(key);
+    chunk.write((uint32_t)versions.size());
+    if (versions.isCold()) {
+        // don't thaw cold keys just to persist them
+        chunk.write(versions.coldCopy());
+    } else {
+        for (auto& rec : versions) {
+            chunk.write(rec);
+        }
+    }
+}
+
+seastar::future<std::tuple<Status, dto::K23SIExportResponse>>
+K23SIPartitionModule::handleExport(dto::K23SIExportRequest&& request) {
+    K2LOG_D(log::skvsvr, "Partition: {}, handle export: {}", _partition, request);
+    if (_fenced || request.collectionName != _cmeta.name || request.pvid != _partition().pvid) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("export of a partition which is not assigned here"), dto::K23SIExportResponse{});
+    }
+    auto snapshotFut = seastar::make_ready_future<dto::Timestamp>(request.snapshot);
+    if (request.snapshot.tEndTSECount() == 0) {
+        // the newest snapshot we can serve
+        if (_follower) {
+            snapshotFut = seastar::make_ready_future<dto::Timestamp>(_closedTimestamp);
+        } else {
+            snapshotFut = getTimeNow().then([this] (dto::Timestamp&& now) {
+                // the snapshot is admitted against the same offset, so it is stale enough by then
+                _tsoClockOffset = now.tEndTSECount() - now_nsec_count();
+                return now - _config.snapshotReadMinStaleness();
+            });
+        }
+    }
+    return snapshotFut.then([this, request=std::move(request)] (dto::Timestamp&& snapshot) mutable {
+        request.snapshot = snapshot;
+        if (!request.path.empty()) {
+            return _exportToFile(std::move(request));
+        }
+        dto::K23SIExportResponse page;
+        bool pending = false;
+        auto status = _exportPage(request, page, pending);
+        if (!status.is2xxOK()) {
+            return RPCResponse(std::move(status), dto::K23SIExportResponse{});
+        }
+        if (pending && page.records.empty()) {
+            // the page stopped right at a pending write within the snapshot. Wait for it to be finalized and go again
+            request.schemaId = page.schemaId;
+            request.cursor = page.cursor;
+            return _waitForFinalize(page.cursor, _config.conflictWaitTimeout())
+            .then([this, request=std::move(request)] (bool finalized) mutable {
+                if (!finalized) {
+                    return RPCResponse(dto::K23SIStatus::AbortConflict("export of a key with a pending write"), dto::K23SIExportResponse{});
+                }
+                return handleExport(std::move(request));
+            });
+        }
+        auto bytes = page.exportedBytes;
+        return _paceExport(bytes).then([page=std::move(page)] () mutable {
+            return RPCResponse(dto::K23SIStatus::OK("export page"), std::move(page));
+        });
+    });
+}
+
+Status K23SIPartitionModule::_exportPage(const dto::K23SIExportRequest& request, dto::K23SIExportResponse& page) {
+    if (_fenced) {
+        return dto::K23SIStatus::RefreshCollection("export of a partition which is not assigned here");
+    }
+    if (request.snapshot.compareCertain(_retentionTimestamp) < 0) {
+        return dto::K23SIStatus::AbortRequestTooOld("export snapshot is older than the retention window");
+    }
+    auto status = _admitSnapshotRead(request.snapshot);
+    if (!status.is2xxOK()) {
+        return status;
+    }
+    page.snapshot = request.snapshot;
+    page.schemaId = request.schemaId;
+    page.cursor = request.cursor;
+    pending = false;
+    uint64_t limit = request.pageBytes > 0 ? request.pageBytes : _config.exportPageBytes();
+    while (page.schemaId < _indexer.schemaCount() && page.exportedBytes < limit) {
+        IndexerT& index = _indexer.at(page.schemaId);
+        auto it = index.lower_bound(page.cursor);
+        auto first = it;
+        auto last = index.end();
+        for (; it != index.end() && page.exportedBytes < limit; ++it) {
+            _applyRangeTombstones(it->first, it->second);
+            if (it->second.isCold()) {
+                // the only version is older than the retention window and so visible in the snapshot
+                last = it;
+                page.records.push_back(dto::K23SIBulkIngestRecord{.key=it->first, .value=it->second.coldValue()});
+                page.exportedBytes += Payload::serializedSize(page.records.back());
+                continue;
+            }
+            auto viter = _getSnapshotVersion(it->second, request.snapshot);
+            if (viter != it->second.end() && viter->status == dto::DataRecord::WriteIntent) {
+                pending = true;
+                break;
+            }
+            last = it;
+            if (viter == it->second.end() || viter->isDeletedAt(request.snapshot)) {
+                // keys without a record in the snapshot count towards the page as well, which keeps it bounded
+                page.exportedBytes += Payload::serializedSize(it->first);
+                continue;
+            }
+            page.records.push_back(dto::K23SIBulkIngestRecord{.key=it->first, .value=viter->value.share()});
+            page.exportedBytes += Payload::serializedSize(page.records.back());
+        }
+        if (last != index.end()) {
+            // writers can't go under the snapshot of the keys we exported
+            _snapshotReadCache->insertInterval(first->first, last->first, request.snapshot);
+        }
+        if (it != index.end()) {
+            page.cursor = it->first;
+            break;
+        }
+        ++page.schemaId;
+        page.cursor = dto::Key{};
+    }
+    page.done = page.schemaId >= _indexer.schemaCount();
+    page.exportedRecords = page.records.size();
+    _exportedRecords += page.exportedRecords;
+    _exportedBytes += page.exportedBytes;
+    return dto::K23SIStatus::OK("");
+}
+
+// writes the size of the frame followed by its bytes
+seastar::future<> _writeExportFrame(seastar::output_stream<char>& out, Payload&& frame) {
+    uint64_t size = frame.getSize();
+    return seastar::do_with(std::move(frame), size, [&out] (Payload& frame, uint64_t& size) {
+        return out.write(reinterpret_cast<const char*>(&size), sizeof(size))
+        .then([&out, &frame, &size] {
+            return seastar::do_with(size_t(size), [&out, &frame] (size_t& remaining) {
+                // the buffers may have room past the data
+                return seastar::do_for_each(frame.getBuffers(), [&out, &remaining] (const Binary& buf) {
+                    size_t len = std::min(buf.size(), remaining);
+                    remaining -= len;
+                    return out.write(buf.get(), len);
+                });
+            });
+        });
+    });
 }
 
-// Helper for iterating over the indexer, modifies it to end() if iterator would go past the target schema
-// or if it would go past begin() for reverse scan. Starting iterator must not be end() and must
-// point to a record with the target schema
-void K23SIPartitionModule::_scanAdvance(IndexerIterator& it, bool reverseDirection, const String& schema) {
-    if (!reverseDirection) {
-        ++it;
-        if (it != _indexer.end() && it->first.schemaName != schema) {
-            it = _indexer.end();
+seastar::future<std::tuple<Status, dto::K23SIExportResponse>>
+K23SIPartitionModule::_exportToFile(dto::K23SIExportRequest&& request) {
+    if (_stopped) {
+        return RPCResponse(Statuses::S503_Service_Unavailable("partition is stopping"), dto::K23SIExportResponse{});
+    }
+    if (_exportToFileInProgress) {
+        return RPCResponse(Statuses::S409_Conflict("an export to a file is already running on the partition"), dto::K23SIExportResponse{});
+    }
+    _exportToFileInProgress = true;
+    K2LOG_I(log::skvsvr, "Partition: {}, exporting snapshot {} into {}", _partition, request.snapshot, request.path);
+    auto path = request.path;
+    return seastar::with_gate(_backupGate, [this, path=std::move(path), request=std::move(request)] () mutable {
+        return seastar::open_file_dma(path, seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate)
+        .then([] (seastar::file&& file) {
+            return seastar::make_file_output_stream(std::move(file));
+        })
+        .then([this, request=std::move(request)] (seastar::output_stream<char>&& out) mutable {
+            return seastar::do_with(std::move(out), std::move(request), dto::K23SIExportResponse{}, dto::K23SIStatus::OK("export completed"),
+                [this] (auto& out, auto& request, auto& total, auto& status) {
+                return seastar::repeat([this, &out, &request, &total, &status] {
+                    if (_stopped) {
+                        status = Statuses::S503_Service_Unavailable("partition stopped during export");
+                        return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                    }
+                    dto::K23SIExportResponse page;
+                    bool pending = false;
+                    status = _exportPage(request, page, pending);
+                    if (!status.is2xxOK()) {
+                        return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                    }
+                    request.schemaId = page.schemaId;
+                    request.cursor = page.cursor;
+                    total.snapshot = page.snapshot;
+                    total.schemaId = page.schemaId;
+                    total.cursor = page.cursor;
+                    total.done = page.done;
+                    total.exportedRecords += page.exportedRecords;
+                    total.exportedBytes += page.exportedBytes;
+                    auto bytes = page.exportedBytes;
+                    Payload frame(Payload::DefaultAllocator);
+                    frame.write(page);
+                    return _paceExport(bytes).then([&out, frame=std::move(frame)] () mutable {
+                        return _writeExportFrame(out, std::move(frame));
+                    })
+                    .then([this, &request, &total, &status, pending] {
+                        if (!pending) {
+                            return seastar::make_ready_future<bool>(true);
+                        }
+                        // the page stopped at a pending write within the snapshot
+                        return _waitForFinalize(request.cursor, _config.conflictWaitTimeout())
+                        .then([&status] (bool finalized) {
+                            if (!finalized) {
+                                status = dto::K23SIStatus::AbortConflict("export of a key with a pending write");
+                            }
+                            return finalized;
+                        });
+                    })
+                    .then([&total] (bool proceed) {
+                        return !proceed || total.done ? seastar::stop_iteration::yes : seastar::stop_iteration::no;
+                    });
+                })
+                .finally([&out] {
+                    return out.close();
+                })
+                .then([this, &request, &total, &status] {
+                    K2LOG_I(log::skvsvr, "Partition: {}, export into {} stopped with {}, exported {} records in {} bytes",
+                            _partition, request.path, status, total.exportedRecords, total.exportedBytes);
+                    return RPCResponse(std::move(status), std::move(total));
+                });
+            });
+        });
+    })
+    .handle_exception([this] (auto exc) {
+        K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, export into a file failed", _partition);
+        return RPCResponse(dto::K23SIStatus::InternalError("unable to write the export file"), dto::K23SIExportResponse{});
+    })
+    .finally([this] {
+        _exportToFileInProgress = false;
+    });
+}
+
+seastar::future<> K23SIPartitionModule::_paceExport(uint64_t bytes) {
+    auto rate = _config.exportBytesPerSec();
+    if (rate == 0) {
+        return seastar::make_ready_future();
+    }
+    // each page waits for the time the pages before it take at the rate. Idle time doesn't build up a burst
+    auto now = Clock::now();
+    if (_exportPace < now) {
+        _exportPace = now;
+    }
+    auto wait = _exportPace - now;
+    _exportPace += std::chrono::duration_cast<Duration>(std::chrono::duration<double>((double)bytes / rate));
+    if (wait <= Duration(0)) {
+        return seastar::make_ready_future();
+    }
+    return seastar::sleep(wait);
+}
+
+seastar::future<std::tuple<Status, dto::K23SIRestoreResponse>>
+K23SIPartitionModule::handleRestore(dto::K23SIRestoreRequest&& request) {
+    K2LOG_I(log::skvsvr, "Partition: {}, received restore request {}", _partition, request);
+    if (_fenced || _follower || request.collectionName != _cmeta.name || request.pvid != _partition().pvid) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("restore of a partition which is not assigned here"), dto::K23SIRestoreResponse{});
+    }
+    if (_stopped) {
+        return RPCResponse(Statuses::S503_Service_Unavailable("partition is stopping"), dto::K23SIRestoreResponse{});
+    }
+    if (_restoreInProgress || _splitInProgress) {
+        return RPCResponse(Statuses::S409_Conflict("restore, split or migration already in progress"), dto::K23SIRestoreResponse{});
+    }
+    if (_indexer.size() > 0) {
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("restore into a partition which has keys"), dto::K23SIRestoreResponse{});
+    }
+    _restoreInProgress = true;
+    auto path = request.path;
+    return seastar::with_gate(_backupGate, [this, path=std::move(path)] {
+        return seastar::open_file_dma(path, seastar::open_flags::ro)
+        .then([this] (seastar::file&& file) {
+            // large sequential reads, with the next ones in flight while a page is applied
+            seastar::file_input_stream_options options;
+            options.buffer_size = 1024*1024;
+            options.read_ahead = 4;
+            return seastar::do_with(seastar::make_file_input_stream(std::move(file), options), dto::K23SIRestoreResponse{},
+                [this] (seastar::input_stream<char>& in, dto::K23SIRestoreResponse& response) {
+                return seastar::repeat([this, &in, &response] {
+                    if (_stopped) {
+                        throw std::runtime_error("stopped during restore");
+                    }
+                    return in.read_exactly(sizeof(uint64_t))
+                    .then([&in] (Binary&& header) {
+                        if (header.empty()) {
+                            // end of the file
+                            return seastar::make_ready_future<Binary>();
+                        }
+                        if (header.size() != sizeof(uint64_t)) {
+                            throw std::runtime_error("truncated export file");
+                        }
+                        uint64_t size = 0;
+                        std::memcpy(&size, header.get(), sizeof(size));
+                        return in.read_exactly(size).then([size] (Binary&& frame) {
+                            if (frame.size() != size || size == 0) {
+                                throw std::runtime_error("truncated export file");
+                            }
+                            return std::move(frame);
+                        });
+                    })
+                    .then([this, &response] (Binary&& frame) {
+                        if (frame.empty()) {
+                            return seastar::stop_iteration::yes;
+                        }
+                        // the page is read in place: its values are slices of the frame until they go in the arena
+                        size_t size = frame.size();
+                        std::vector<Binary> buffers;
+                        buffers.push_back(std::move(frame));
+                        Payload payload(std::move(buffers), size);
+                        dto::K23SIExportResponse page;
+                        if (!payload.read(page)) {
+                            throw std::runtime_error("corrupted export file");
+                        }
+                        _applyRestorePage(page);
+                        response.snapshot = page.snapshot;
+                        response.restoredRecords += page.records.size();
+                        return seastar::stop_iteration::no;
+                    });
+                })
+                .finally([&in] {
+                    return in.close();
+                })
+                .then([&response] {
+                    return std::move(response);
+                });
+            });
+        })
+        .then([this] (dto::K23SIRestoreResponse&& response) {
+            // the restored versions are older than everything the partition may have served, and they are only in
+            // memory until they are in our checkpoint
+            if (response.snapshot.compareCertain(_snapshotHorizon) > 0) {
+                _snapshotHorizon = response.snapshot;
+            }
+            return _checkpoint().then([this, response=std::move(response)] (bool completed) mutable {
+                if (!completed) {
+                    throw std::runtime_error("unable to checkpoint the restored keys");
+                }
+                K2LOG_I(log::skvsvr, "Partition: {}, restored {} records at snapshot {}", _partition, response.restoredRecords, response.snapshot);
+                return RPCResponse(dto::K23SIStatus::OK("restore completed"), std::move(response));
+            });
+        });
+    })
+    .handle_exception([this] (auto exc) {
+        K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, restore failed", _partition);
+        // drop what was restored so far, so that the restore can be retried
+        for (uint32_t schemaId = 0; schemaId < _indexer.schemaCount(); ++schemaId) {
+            _indexer.clear(schemaId);
+        }
+        return RPCResponse(dto::K23SIStatus::InternalError("unable to restore from the export file"), dto::K23SIRestoreResponse{});
+    })
+    .finally([this] {
+        _restoreInProgress = false;
+    });
+}
+
+void K23SIPartitionModule::_applyRestorePage(dto::K23SIExportResponse& page) {
+    for (auto& rec : page.records) {
+        if (!_partition.owns(rec.key)) {
+            throw std::runtime_error(fmt::format("restored key {} is not owned by the partition", rec.key));
+        }
+        uint32_t schemaId = _findSchemaId(rec.key.schemaName);
+        if (schemaId == SchemaIndexer::NoSchemaId) {
+            throw std::runtime_error(fmt::format("restored key {} is of a schema which does not exist", rec.key));
+        }
+        auto& versions = _indexer.appendVersions(schemaId, std::move(rec.key));
+        if (!versions.empty()) {
+            throw std::runtime_error("export file has duplicate keys");
+        }
+        dto::DataRecord version;
+        version.value = _arena.copy(rec.value);
+        version.txnId.mtr.timestamp = page.snapshot;
+        version.status = dto::DataRecord::Committed;
+        versions.push_front(std::move(version));
+    }
+    _restoredRecords += page.records.size();
+}
+
+seastar::future<std::tuple<Status, dto::K23SISplitResponse>>
+K23SIPartitionModule::handleSplit(dto::K23SISplitRequest&& request) {
+    K2LOG_I(log::skvsvr, "Partition: {}, received split request {}", _partition, request);
+    if (_follower || request.collectionName != _cmeta.name || request.pvid != _partition().pvid) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("split of a partition which is not assigned here"), dto::K23SISplitResponse{});
+    }
+    if (_splitInProgress) {
+        return RPCResponse(Statuses::S409_Conflict("split already in progress"), dto::K23SISplitResponse{});
+    }
+    const dto::Partition& current = _partition();
+    if (!_partition.canSplitAt(request.splitKey) || request.partition.startKey != current.startKey || request.partition.endKey != request.splitKey ||
+        request.newPartition.startKey != request.splitKey || request.newPartition.endKey != current.endKey ||
+        request.newPartition.endpoints.empty()) {
+        return RPCResponse(dto::K23SIStatus::BadParameter("split key or partitions do not match the partition"), dto::K23SISplitResponse{});
+    }
+
+    // only committed versions are moved, so the upper half must not have any transactions in progress
+    auto upper = seastar::make_lw_shared<dto::OwnerPartition>(dto::Partition(request.newPartition), _cmeta.hashScheme);
+    auto upperHasTxns = [this, upper] {
+        for (auto& [mtr, keys] : _wiIndex) {
+            for (auto& key : keys) {
+                if (upper->owns(key)) {
+                    return true;
+                }
+            }
+        }
+        for (auto& [mtr, rec] : _txnMgr._transactions) {
+            if (!rec.finalized && upper->owns(rec.txnId.trh)) {
+                return true;
+            }
+        }
+        return false;
+    };
+    if (upperHasTxns()) {
+        _splitsRefused++;
+        return RPCResponse(Statuses::S503_Service_Unavailable("transactions in progress in the upper half"), dto::K23SISplitResponse{});
+    }
+    if (request.checkOnly) {
+        return RPCResponse(dto::K23SIStatus::OK("partition can be split"), dto::K23SISplitResponse{});
+    }
+
+    // Fence off the upper half. Its requests are told to refresh the collection, which sends them back here until
+    // the CPO publishes the split. Query streams validate each page, so they stop at the fence as well
+    _splitInProgress = true;
+    auto original = current;
+    dto::Partition fenced = current;
+    fenced.endKey = request.splitKey;
+    _partition = dto::OwnerPartition(std::move(fenced), _cmeta.hashScheme);
+
+    return getTimeNow()
+    .then([this, splitKey=request.splitKey, newPartition=request.newPartition] (dto::Timestamp&& now) mutable {
+        // all reads(snapshot reads included) we served in the upper half are below now, and so is the closed timestamp
+        auto watermark = now.compareCertain(_snapshotHorizon) < 0 ? _snapshotHorizon : now;
+        if (_cmeta.hashScheme != dto::HashScheme::Range) {
+            splitKey = "";
+        }
+        return _transferKeys(std::move(splitKey), newPartition)
+        .then([this, newPartition, watermark] {
+            dto::K23SISplitTransferRequest request{.entries=Payload(Payload::DefaultAllocator), .done=true, .readWatermark=watermark};
+            return _sendTransfer(newPartition, request);
+        });
+    })
+    .then([this, upperHasTxns, partition=std::move(request.partition), newPartition=request.newPartition] () mutable {
+        // writes which were validated before the fence may have created write intents since
+        if (upperHasTxns()) {
+            _splitsRefused++;
+            throw std::runtime_error("transactions started in the upper half during the split");
+        }
+        _partition = dto::OwnerPartition(std::move(partition), _cmeta.hashScheme);
+        return _dropMovedKeys(std::move(newPartition));
+    })
+    .then([this] (uint64_t moved) {
+        _splitsCompleted++;
+        _splitKeysMoved += moved;
+        _splitInProgress = false;
+        K2LOG_I(log::skvsvr, "Partition: {}, split completed, moved {} keys", _partition, moved);
+        // the moved keys are still in our checkpoint. If this checkpoint fails they are recovered here again, which
+        // is harmless since we don't own them anymore
+        return _checkpoint().then([moved] (bool) {
+            return RPCResponse(dto::K23SIStatus::OK("split completed"), dto::K23SISplitResponse{.movedKeys=moved});
+        });
+    })
+    .handle_exception([this, original=std::move(original)] (auto exc) mutable {
+        K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, split failed", _partition);
+        _partition = dto::OwnerPartition(std::move(original), _cmeta.hashScheme);
+        _splitInProgress = false;
+        return RPCResponse(dto::K23SIStatus::InternalError("split failed"), dto::K23SISplitResponse{});
+    });
+}
+
+seastar::future<> K23SIPartitionModule::_sendTransfer(const dto::Partition& target, dto::K23SISplitTransferRequest& request) {
+    auto txep = RPC().getTXEndpoint(*target.endpoints.begin());
+    if (!txep) {
+        return seastar::make_exception_future(std::runtime_error("unable to obtain endpoint of the new partition"));
+    }
+    request.collectionName = _cmeta.name;
+    request.pvid = target.pvid;
+    return seastar::do_with(std::move(txep), [this, &request] (auto& txep) {
+        return RPC().callRPC<dto::K23SISplitTransferRequest, dto::K23SISplitTransferResponse>
+            (dto::Verbs::K23SI_SPLIT_TRANSFER, request, *txep, _config.splitTransferTimeout())
+        .then([] (auto&& result) {
+            auto& status = std::get<0>(result);
+            if (!status.is2xxOK()) {
+                throw std::runtime_error(fmt::format("unable to transfer chunk of keys: {}", status));
+            }
+        });
+    });
+}
+
+seastar::future<> K23SIPartitionModule::_transferKeys(String fromKey, dto::Partition target) {
+    dto::Key start{.schemaName="", .partitionKey=std::move(fromKey), .rangeKey=""};
+    std::optional<dto::OwnerPartition> owner;
+    if (_cmeta.hashScheme != dto::HashScheme::Range) {
+        owner.emplace(dto::Partition(target), _cmeta.hashScheme);
+    }
+    return seastar::do_with(uint32_t(0), dto::Key(start), std::move(start), std::move(target), std::move(owner),
+        [this] (uint32_t& schemaId, dto::Key& cursor, dto::Key& start, dto::Partition& target, auto& owner) {
+        // The index is ordered by partition and range key only, so the same start key works for all schemas.
+        // All keys from it to the end of each index are sent
+        return seastar::repeat([this, &schemaId, &cursor, &start, &target, &owner] {
+            if (_stopped) {
+                return seastar::make_exception_future<seastar::stop_iteration>(std::runtime_error("stopped during transfer"));
+            }
+            if (schemaId >= _indexer.schemaCount()) {
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            dto::K23SISplitTransferRequest request{.entries=Payload(Payload::DefaultAllocator)};
+            if (_checkpointChunk(_indexer.at(schemaId), cursor, request.entries, owner ? &*owner : nullptr)) {
+                // done with this schema
+                ++schemaId;
+                cursor = start;
+            }
+            if (request.entries.getSize() == 0) {
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::no);
+            }
+            return _sendTransfer(target, request).then([] {
+                return seastar::stop_iteration::no;
+            });
+        });
+    });
+}
+
+seastar::future<uint64_t> K23SIPartitionModule::_transferChanges(dto::Partition target) {
+    auto changed = _wiIndex.takeChanges();
+    std::vector<dto::Key> keys(changed.begin(), changed.end());
+    uint64_t count = keys.size();
+    return seastar::do_with(std::move(keys), size_t(0), std::move(target),
+        [this] (std::vector<dto::Key>& keys, size_t& next, dto::Partition& target) {
+        return seastar::repeat([this, &keys, &next, &target] {
+            if (next >= keys.size()) {
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            // the keys are written with their versions as of now, so keys which change again before their
+            // chunk is serialized are only sent again if they change after it
+            dto::K23SISplitTransferRequest request{.entries=Payload(Payload::DefaultAllocator)};
+            _changedKeysChunk(keys, next, request.entries);
+            return _sendTransfer(target, request).then([] {
+                return seastar::stop_iteration::no;
+            });
+        });
+    })
+    .then([count] {
+        return count;
+    });
+}
+
+seastar::future<> K23SIPartitionModule::_drainRequests() {
+    if (_requestsInFlight == 0) {
+        return seastar::make_ready_future();
+    }
+    _requestsDrained.emplace();
+    return _requestsDrained->get_future();
+}
+
+seastar::future<uint64_t> K23SIPartitionModule::_dropMovedKeys(dto::Partition moved) {
+    // the keys of a range split are all the keys from the start of the moved range on. Hash partitions have
+    // theirs scattered over the whole index
+    bool range = _cmeta.hashScheme == dto::HashScheme::Range;
+    dto::Key start{.schemaName="", .partitionKey=range ? moved.startKey : String(""), .rangeKey=""};
+    dto::OwnerPartition owner(std::move(moved), _cmeta.hashScheme);
+    return seastar::do_with(uint32_t(0), uint64_t(0), dto::Key(start), std::move(start), std::move(owner),
+        [this] (uint32_t& schemaId, uint64_t& dropped, dto::Key& cursor, dto::Key& start, dto::OwnerPartition& owner) {
+        return seastar::repeat([this, &schemaId, &dropped, &cursor, &start, &owner] {
+            if (schemaId >= _indexer.schemaCount()) {
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            IndexerT& index = _indexer.at(schemaId);
+            auto it = index.lower_bound(cursor);
+            for (uint32_t i = 0; i < _config.gcChunkSize() && it != index.end(); ++i) {
+                if (owner.owns(it->first)) {
+                    it = _indexer.erase(schemaId, it);
+                    ++dropped;
+                } else {
+                    ++it;
+                }
+            }
+            if (it == index.end()) {
+                ++schemaId;
+                cursor = start;
+            } else {
+                cursor = it->first;
+            }
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::no);
+        })
+        .then([&dropped] {
+            return dropped;
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SISplitTransferResponse>>
+K23SIPartitionModule::handleSplitTransfer(dto::K23SISplitTransferRequest&& request) {
+    K2LOG_D(log::skvsvr, "Partition: {}, received split transfer {}", _partition, request);
+    if (_follower || request.collectionName != _cmeta.name || request.pvid != _partition().pvid) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("split transfer to a partition which is not assigned here"), dto::K23SISplitTransferResponse{});
+    }
+    try {
+        _applyCheckpointChunk(request.entries);
+    } catch (std::exception& exc) {
+        K2LOG_W(log::skvsvr, "Partition: {}, bad split transfer chunk: {}", _partition, exc.what());
+        return RPCResponse(dto::K23SIStatus::BadParameter("corrupted split transfer chunk"), dto::K23SISplitTransferResponse{});
+    }
+    if (!request.done) {
+        return RPCResponse(dto::K23SIStatus::OK(""), dto::K23SISplitTransferResponse{});
+    }
+    // we were started before the old partition was fenced, so raise our watermark above the reads it served
+    if (_readCache->min_TimeStamp().compareCertain(request.readWatermark) < 0) {
+        _readCache = std::make_unique<FlatReadCache<dto::Key, dto::Timestamp>>(request.readWatermark, _config.readCacheSize());
+        _configureReadCache();
+    }
+    if (_snapshotReadCache->min_TimeStamp().compareCertain(request.readWatermark) < 0) {
+        _snapshotReadCache = std::make_unique<FlatReadCache<dto::Key, dto::Timestamp>>(request.readWatermark, _config.snapshotReadCacheSize());
+    }
+    std::vector<seastar::future<>> adopted;
+    for (auto& txn : request.txns) {
+        adopted.push_back(_txnMgr.adoptRecord(std::move(txn)));
+    }
+    auto txns = request.txns.size();
+    return seastar::when_all_succeed(adopted.begin(), adopted.end()).discard_result()
+    .then([this] {
+        // the moved keys are only in memory until they are in our checkpoint
+        return _checkpoint();
+    })
+    .then([this, txns] (bool completed) {
+        if (!completed) {
+            return RPCResponse(dto::K23SIStatus::InternalError("unable to checkpoint the moved keys"), dto::K23SISplitTransferResponse{});
+        }
+        if (_migrationTarget) {
+            // we own the partition from now on
+            _migrationTarget = false;
+            _startCheckpoints();
+        }
+        K2LOG_I(log::skvsvr, "Partition: {}, received all keys of the split or migration, and {} txn records", _partition, txns);
+        return RPCResponse(dto::K23SIStatus::OK("split transfer completed"), dto::K23SISplitTransferResponse{});
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIMigrateResponse>>
+K23SIPartitionModule::handleMigrate(dto::K23SIMigrateRequest&& request) {
+    K2LOG_I(log::skvsvr, "Partition: {}, received migrate request {}", _partition, request);
+    if (_fenced || _follower || request.collectionName != _cmeta.name || request.pvid != _partition().pvid) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("migration of a partition which is not assigned here"), dto::K23SIMigrateResponse{});
+    }
+    if (_splitInProgress) {
+        return RPCResponse(Statuses::S409_Conflict("split or migration already in progress"), dto::K23SIMigrateResponse{});
+    }
+    const dto::Partition& current = _partition();
+    const dto::Partition& target = request.newPartition;
+    if (target.pvid.id != current.pvid.id || target.pvid.rangeVersion != current.pvid.rangeVersion ||
+        target.pvid.assignmentVersion <= current.pvid.assignmentVersion || target.startKey != current.startKey ||
+        target.endKey != current.endKey || target.endpoints.empty()) {
+        return RPCResponse(dto::K23SIStatus::BadParameter("new partition does not match the partition"), dto::K23SIMigrateResponse{});
+    }
+
+    _splitInProgress = true;
+    _wiIndex.trackChanges(true);
+    auto moved = seastar::make_lw_shared<dto::K23SIMigrateResponse>();
+    moved->movedKeys = _indexer.size();
+    return _transferKeys("", target)
+    .then([this, target, moved] {
+        // catch up while serving, until a round is small enough to send while fenced
+        return seastar::do_with(uint32_t(0), [this, target, moved] (uint32_t& round) {
+            return seastar::repeat([this, &round, target, moved] {
+                if (round++ >= _config.migrationCatchUpRounds()) {
+                    return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                }
+                return _transferChanges(target).then([this, moved] (uint64_t count) {
+                    moved->movedKeys += count;
+                    return count <= _config.migrationFenceKeys() ? seastar::stop_iteration::yes : seastar::stop_iteration::no;
+                });
+            });
+        });
+    })
+    .then([this] {
+        // Requests are told to refresh the collection, which sends them back here until the CPO publishes the new
+        // assignment. Requests which were validated before may still change keys and transactions
+        _fenced = true;
+        return _drainRequests();
+    })
+    .then([this] {
+        return getTimeNow();
+    })
+    .then([this, target, moved] (dto::Timestamp&& now) {
+        // all reads(snapshot reads included) we served are below now, and so is the closed timestamp
+        auto watermark = now.compareCertain(_snapshotHorizon) < 0 ? _snapshotHorizon : now;
+        return _transferChanges(target).then([this, target, moved, watermark] (uint64_t count) {
+            moved->movedKeys += count;
+            dto::K23SISplitTransferRequest request{.entries=Payload(Payload::DefaultAllocator), .done=true, .readWatermark=watermark};
+            for (auto& [mtr, rec] : _txnMgr._transactions) {
+                if (rec.state == dto::TxnRecordState::Deleted) {
+                    continue;
+                }
+                request.txns.push_back(dto::K23SIMigratedTxn{
+                    .txnId=rec.txnId,
+                    .state=rec.state,
+                    .finalized=rec.finalized,
+                    .writeKeys=rec.writeKeys,
+                    .writeKeyGroups=rec.writeKeyGroups,
+                    .hbDeadline=rec.hbDeadline,
+                    .syncFinalize=rec.syncFinalize,
+                    .clientFinalize=rec.clientFinalize,
+                    .timeToFinalize=rec.timeToFinalize
+                });
+            }
+            moved->movedTxns = request.txns.size();
+            return _sendTransfer(target, request);
+        });
+    })
+    .then_wrapped([this, moved] (auto&& fut) {
+        _wiIndex.trackChanges(false);
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::skvsvr, fut.get_exception(), "Partition: {}, migration failed", _partition);
+            _fenced = false;
+            _splitInProgress = false;
+            return RPCResponse(dto::K23SIStatus::InternalError("migration failed"), dto::K23SIMigrateResponse{});
+        }
+        _migrationsCompleted++;
+        _migrationKeysMoved += moved->movedKeys;
+        K2LOG_I(log::skvsvr, "Partition: {}, migration completed, moved {} keys and {} txn records",
+                _partition, moved->movedKeys, moved->movedTxns);
+        // The new partition owns our persistence source now, so we stop for good and keep refusing requests.
+        // The partition manager waits for the stop when the node shuts down
+        (void) gracefulStop();
+        return RPCResponse(dto::K23SIStatus::OK("migration completed"), std::move(*moved));
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIPartitionLoadResponse>>
+K23SIPartitionModule::handlePartitionLoad(dto::K23SIPartitionLoadRequest&& request) {
+    if (_follower || request.collectionName != _cmeta.name || request.pvid != _partition().pvid) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("load of a partition which is not assigned here"), dto::K23SIPartitionLoadResponse{});
+    }
+    auto now = CachedSteadyClock::now();
+    dto::K23SIPartitionLoadResponse response;
+    response.persistenceEndpoint = _persistence.endpoint();
+    double elapsed = std::chrono::duration<double>(now - _loadSince).count();
+    if (elapsed > 0) {
+        response.requestRate = _loadRequests / elapsed;
+        response.snapshotReadRate = _loadSnapshotReads / elapsed;
+    }
+    if (!_loadKeySamples.empty() && _cmeta.hashScheme == dto::HashScheme::Range) {
+        auto median = _loadKeySamples.begin() + _loadKeySamples.size() / 2;
+        std::nth_element(_loadKeySamples.begin(), median, _loadKeySamples.end());
+        // both halves of a split must be non-empty ranges
+        if (_partition.canSplitAt(*median)) {
+            response.splitKey = *median;
+        }
+    } else if (!_loadKeySamples.empty()) {
+        // split hash partitions at the median hash of the sampled keys
+        std::vector<uint64_t> hashes;
+        hashes.reserve(_loadKeySamples.size());
+        for (auto& pkey : _loadKeySamples) {
+            hashes.push_back(dto::Key{.schemaName="", .partitionKey=pkey, .rangeKey=""}.partitionHash());
+        }
+        auto median = hashes.begin() + hashes.size() / 2;
+        std::nth_element(hashes.begin(), median, hashes.end());
+        String splitKey = std::to_string(*median);
+        if (_partition.canSplitAt(splitKey)) {
+            response.splitKey = std::move(splitKey);
+        }
+    }
+    _loadRequests = 0;
+    _loadSnapshotReads = 0;
+    _loadSince = now;
+    _loadKeySamples.clear();
+    return RPCResponse(dto::K23SIStatus::OK(""), std::move(response));
+}
+
+void K23SIPartitionModule::getLoad(dto::AssignmentLoadResponse& load) const {
+    load.assigned = true;
+    if (_fenced || _follower) {
+        // the partition moved away, or this is a follower which only the partition itself is balanced by.
+        // The core stays taken until the node restarts
+        return;
+    }
+    load.collectionName = _cmeta.name;
+    load.partition = _partition();
+    load.requests = _requestsServed;
+    load.p99LatencyUs = usec(_requestLatency.percentile(0.99)).count();
+}
+
+void K23SIPartitionModule::_recordLoad(const dto::Key& key) {
+    ++_loadRequests;
+    ++_requestsServed;
+    uint32_t capacity = _config.loadKeySamples();
+    if (_loadKeySamples.size() < capacity) {
+        _loadKeySamples.push_back(key.partitionKey);
+        return;
+    }
+    // reservoir sampling, so that every request since the last load request is equally likely to be sampled
+    std::uniform_int_distribution<uint64_t> slots(0, _loadRequests - 1);
+    uint64_t slot = slots(_loadRng);
+    if (slot < capacity) {
+        _loadKeySamples[slot] = key.partitionKey;
+    }
+}
+
+seastar::future<> K23SIPartitionModule::gracefulStop() {
+    if (!_stopFuture) {
+        _stopFuture.emplace(_stop());
+    }
+    return _stopFuture->get_future();
+}
+
+seastar::future<> K23SIPartitionModule::_stop() {
+    K2LOG_I(log::skvsvr, "stop for cname={}, part={}", _cmeta.name, _partition);
+    _retentionUpdateTimer.cancel();
+    _stopped = true;
+    // wake up clients waiting on streams. The producers stop after their current page
+    for (auto& [id, stream] : _queryStreams) {
+        stream->done = true;
+        if (stream->pageWaiter) {
+            stream->pageWaiter->set_value();
+            stream->pageWaiter.reset();
+        }
+    }
+    // and the requests waiting on conflicts, which retry and push
+    for (auto& [key, waiters] : _conflictWaiters) {
+        for (auto& waiter : waiters) {
+            waiter.promise.set_value();
+        }
+    }
+    _conflictWaiters.clear();
+    return seastar::when_all_succeed(std::move(_retentionRefresh), _gcTimer.stop(), _checkpointTimer.stop(),
+                                     _walTimer.stop(), _queryStreamTimer.stop(), _queryStreamGate.close(), _backupGate.close(),
+                                     _txnMgr.gracefulStop()).discard_result()
+    .then([this] { _queryStreams.clear(); _queryReadRanges.clear(); _preparedQueries.clear(); _preparedQueriesLRU.clear(); })
+    .then([this] { return _persistence.gracefulStop(); }).then([]{K2LOG_I(log::skvsvr, "stopped");});
+}
+
+seastar::future<std::tuple<Status, dto::K23SIReadResponse>>
+K23SIPartitionModule::_makeReadOK(dto::DataRecord* rec, const dto::K23SIReadRequest& request, uint32_t schemaId) {
+    if (rec == nullptr || rec->isDeletedAt(request.mtr.timestamp)) {
+        return RPCResponse(dto::K23SIStatus::KeyNotFound("read did not find key"), dto::K23SIReadResponse{});
+    }
+
+    auto response = dto::K23SIReadResponse();
+    if (request.projection.empty()) {
+        response.value = rec->value.share();
+        return RPCResponse(dto::K23SIStatus::OK("read succeeded"), std::move(response));
+    }
+
+    const SchemaVersionsT& schemaVersions = _schemas[schemaId];
+    auto versionIt = schemaVersions.find(rec->value.schemaVersion);
+    if (versionIt == schemaVersions.end()) {
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("Schema version of found record does not exist"), dto::K23SIReadResponse{});
+    }
+    // with the field offsets, the projection shares the bytes of the stored record instead of copying them
+    rec->value.indexFields(*versionIt->second);
+    if (!_makeProjection(rec->value, request.projection, schemaVersions, response.value)) {
+        K2LOG_W(log::skvsvr, "Error making projection!");
+        return RPCResponse(dto::K23SIStatus::InternalError("Error making projection"), dto::K23SIReadResponse{});
+    }
+    return RPCResponse(dto::K23SIStatus::OK("read succeeded"), std::move(response));
+}
+
+// Helper for iterating over the schema index, modifies it to end() if iterator would go past begin()
+// for reverse scan. Starting iterator must not be end()
+void K23SIPartitionModule::_scanAdvance(IndexerT& index, IndexerIterator& it, bool reverseDirection) {
+    if (!reverseDirection) {
+        ++it;
+        return;
+    }
+
+    if (it == index.begin()) {
+        it = index.end();
+    } else {
+        --it;
+    }
+}
+
+// Helper for handleQuery. Returns an iterator in the schema index to start the scan at, accounting for
+// reverse direction scan
+IndexerIterator K23SIPartitionModule::_initializeScan(IndexerT& index, const dto::Key& start, bool reverse, bool exclusiveKey) {
+    // A forward scan starts at the first key not less than start. A reverse scan starts at the last key not
+    // greater than start(or less than start, if exclusiveKey), which the indexer finds with one seek
+    if (reverse) {
+        return reverseSeek(index, start, exclusiveKey);
+    }
+    return index.lower_bound(start);
+}
+
+// Helper for handleQuery. Checks to see if the indexer scan should stop.
+bool K23SIPartitionModule::_isScanDone(IndexerT& index, const IndexerIterator& it, const dto::K23SIQueryRequest& request,
+                                       size_t response_size, size_t response_bytes) {
+    if (it == index.end()) {
+        return true;
+    } else if (it->first == request.key) {
+        // Start key as inclusive overrides end key as exclusive
+        return false;
+    } else if (!request.reverseDirection && it->first >= request.endKey &&
+               request.endKey.partitionKey != "") {
+        return true;
+    } else if (request.reverseDirection && it->first <= request.endKey) {
+        return true;
+    }
+
+    return _isQueryResponseFull(request, response_size, response_bytes);
+}
+
+bool K23SIPartitionModule::_isQueryResponseFull(const dto::K23SIQueryRequest& request, size_t response_size,
+                                                size_t response_bytes) {
+    // the page ends with the record which reaches the byte budget, so that a page always makes progress
+    size_t bytesLimit = request.responseBytesLimit > 0 ? request.responseBytesLimit : _hot->queryPageBytes;
+    return (request.recordLimit >= 0 && response_size == (uint32_t)request.recordLimit) ||
+           response_size == _hot->paginationLimit ||
+           (bytesLimit > 0 && response_bytes >= bytesLimit);
+}
+
+// Helper for handleQuery. Returns continuation token (aka response.nextToScan)
+dto::Key K23SIPartitionModule::_getContinuationToken(IndexerT& index, const IndexerIterator& it,
+                    const dto::K23SIQueryRequest& request, dto::K23SIQueryResponse& response, size_t response_size) {
+    // Three cases where scan is for sure done:
+    // 1. Record limit is reached
+    // 2. Iterator is not end() but is >= user endKey
+    // 3. Iterator is at end() and partition bounds contains endKey
+    if ((request.recordLimit >= 0 && response_size == (uint32_t)request.recordLimit) ||
+        // Test for past user endKey:
+        (it != index.end() &&
+            (request.reverseDirection ? it->first <= request.endKey : it->first >= request.endKey && request.endKey.partitionKey != "")) ||
+        // Test for partition bounds contains endKey and we are at end()
+        (it == index.end() &&
+            (request.reverseDirection ?
+            _partition().startKey <= request.endKey.partitionKey :
+            request.endKey.partitionKey <= _partition().endKey && request.endKey.partitionKey != ""))) {
+        return dto::Key();
+    }
+    else if (it != index.end()) {
+        // This is the paginated case
+        response.exclusiveToken = false;
+        return it->first;
+    }
+
+    // This is the multi-partition case
+    if (request.reverseDirection) {
+        response.exclusiveToken = true;
+        return dto::Key {
+            request.key.schemaName,
+            _partition().startKey,
+            ""
+        };
+    } else {
+        response.exclusiveToken = false;
+        return dto::Key {
+            request.key.schemaName,
+            _partition().endKey,
+            ""
+        };
+    }
+}
+
+// Makes the SKVRecord and applies the request's filter to it. If the returned Status is not OK,
+// the caller should return the status in the query response. Otherwise bool in tuple is whether
+// the filter passed
+std::tuple<Status, bool> K23SIPartitionModule::_doQueryFilter(dto::K23SIQueryRequest& request,
+                                                              const SchemaVersionsT& schemaVersions,
+                                                              dto::expression::CompiledExpression& filter,
+                                                              dto::SKVRecord::Storage& storage) {
+    auto versionIt = schemaVersions.find(storage.schemaVersion);
+    if (versionIt == schemaVersions.end()) {
+        return std::make_tuple(dto::K23SIStatus::OperationNotAllowed(
+            "Schema version of found record does not exist"), false);
+    }
+
+    if (request.filterExpression.op != dto::expression::Operation::UNKNOWN || request.projection.size() > 0) {
+        // Filters and projections access fields out of order. The offsets are kept with the stored
+        // record so that it is only walked once, however many queries scan it
+        storage.indexFields(*versionIt->second);
+    }
+    dto::SKVRecord record(request.collectionName, versionIt->second, storage.share(), true);
+    bool keep = false;
+    Status status = dto::K23SIStatus::OK("");
+
+    try {
+        keep = filter.evaluate(record);
+    }
+    catch(dto::NoFieldFoundException&) {}
+    catch(dto::TypeMismatchException&) {}
+    catch (dto::DeserializationError&) {
+        status = dto::K23SIStatus::OperationNotAllowed("DeserializationError in query filter");
+    }
+    catch (dto::InvalidExpressionException&) {
+        status = dto::K23SIStatus::OperationNotAllowed("InvalidExpression in query filter");
+    }
+
+    return std::make_tuple(std::move(status), keep);
+}
+
+bool K23SIPartitionModule::_doQueryFilterBatch(dto::K23SIQueryRequest& request,
+                                               const SchemaVersionsT& schemaVersions,
+                                               dto::expression::CompiledExpression& filter,
+                                               std::vector<_QueryCandidate>& candidates,
+                                               std::vector<uint8_t>& selection) {
+    std::vector<dto::SKVRecord> records;
+    records.reserve(candidates.size());
+    for (auto& candidate : candidates) {
+        auto versionIt = schemaVersions.find(candidate.value->schemaVersion);
+        if (versionIt == schemaVersions.end()) {
+            return false;
+        }
+        candidate.value->indexFields(*versionIt->second);
+        records.emplace_back(request.collectionName, versionIt->second, candidate.value->share(), true);
+    }
+
+    try {
+        return filter.evaluate(records, selection);
+    }
+    catch (...) {
+        // the per-record filter reports the error, for the same record as it would without batching
+        return false;
+    }
+}
+
+std::tuple<Status, bool> K23SIPartitionModule::_flushQueryCandidates(dto::K23SIQueryRequest& request,
+                                                                     const SchemaVersionsT& schemaVersions,
+                                                                     dto::expression::CompiledExpression& filter,
+                                                                     std::vector<dto::Aggregator>& aggregators,
+                                                                     std::optional<_QueryRanker>& ranker,
+                                                                     std::vector<_QueryCandidate>& candidates,
+                                                                     dto::K23SIQueryResponse& response,
+                                                                     size_t& responseBytes,
+                                                                     IndexerIterator& it) {
+    std::vector<uint8_t> selection;
+    bool batched = candidates.size() > 1 && _doQueryFilterBatch(request, schemaVersions, filter, candidates, selection);
+    Status status = dto::K23SIStatus::OK("");
+    bool full = false;
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        bool keep = false;
+        if (batched) {
+            keep = selection[i];
+        }
+        else {
+            auto [filterStatus, filterKeep] = _doQueryFilter(request, schemaVersions, filter, *candidates[i].value);
+            if (!filterStatus.is2xxOK()) {
+                status = std::move(filterStatus);
+                break;
+            }
+            keep = filterKeep;
+        }
+        if (!keep) {
+            continue;
+        }
+
+        status = _addQueryResult(request, schemaVersions, aggregators, ranker, *candidates[i].value, response, responseBytes);
+        if (!status.is2xxOK()) {
+            break;
+        }
+        if (_isQueryResponseFull(request, _queryResponseSize(response), responseBytes)) {
+            // the scan would have stopped right after this record. Candidates past it are not part of the response
+            it = candidates[i].it;
+            full = true;
+            break;
+        }
+    }
+
+    candidates.clear();
+    return std::make_tuple(std::move(status), full);
+}
+
+Status K23SIPartitionModule::_addQueryResult(dto::K23SIQueryRequest& request,
+                                             const SchemaVersionsT& schemaVersions,
+                                             std::vector<dto::Aggregator>& aggregators,
+                                             std::optional<_QueryRanker>& ranker,
+                                             dto::SKVRecord::Storage& value,
+                                             dto::K23SIQueryResponse& response, size_t& responseBytes) {
+    if (!aggregators.empty()) {
+        return _aggregateQueryResult(request, schemaVersions, aggregators, value, response);
+    }
+    if (ranker) {
+        // the ranker keeps at most the limit of the records, so they don't count towards the response bytes
+        Status status = _rankQueryResult(request, schemaVersions, *ranker, value, false);
+        if (status.is2xxOK()) {
+            response.rankedRecords++;
+        }
+        return status;
+    }
+
+    // apply projection if the user call addProjection. Columnar queries project when the columns are made
+    if (request.projection.size() == 0 || request.columnar) {
+        // want all fields
+        response.results.push_back(value.share());
+        responseBytes += response.results.back().fieldData.getSize();
+        return dto::K23SIStatus::OK("");
+    }
+
+    // serialize partial SKVRecord according to projection
+    dto::SKVRecord::Storage storage;
+    bool success = _makeProjection(value, request.projection, schemaVersions, storage);
+    if (!success) {
+        K2LOG_W(log::skvsvr, "Error making projection!");
+        return dto::K23SIStatus::InternalError("Error making projection");
+    }
+
+    response.results.push_back(std::move(storage));
+    responseBytes += response.results.back().fieldData.getSize();
+    return dto::K23SIStatus::OK("");
+}
+
+Status K23SIPartitionModule::_aggregateQueryResult(dto::K23SIQueryRequest& request,
+                                                   const SchemaVersionsT& schemaVersions,
+                                                   std::vector<dto::Aggregator>& aggregators,
+                                                   dto::SKVRecord::Storage& value,
+                                                   dto::K23SIQueryResponse& response) {
+    auto versionIt = schemaVersions.find(value.schemaVersion);
+    if (versionIt == schemaVersions.end()) {
+        return dto::K23SIStatus::OperationNotAllowed("Schema version of found record does not exist");
+    }
+    value.indexFields(*versionIt->second);
+    dto::SKVRecord record(request.collectionName, versionIt->second, value.share(), true);
+
+    try {
+        for (auto& aggregator : aggregators) {
+            aggregator.add(record);
+        }
+    }
+    catch (dto::TypeMismatchException&) {
+        return dto::K23SIStatus::OperationNotAllowed("TypeMismatch in query aggregate");
+    }
+    catch (dto::DeserializationError&) {
+        return dto::K23SIStatus::OperationNotAllowed("DeserializationError in query aggregate");
+    }
+    response.aggregatedRecords++;
+    return dto::K23SIStatus::OK("");
+}
+
+Status K23SIPartitionModule::_rankQueryResult(dto::K23SIQueryRequest& request,
+                                              const SchemaVersionsT& schemaVersions,
+                                              _QueryRanker& ranker,
+                                              dto::SKVRecord::Storage& value, bool fromResponse) {
+    auto versionIt = schemaVersions.find(value.schemaVersion);
+    if (versionIt == schemaVersions.end()) {
+        return dto::K23SIStatus::OperationNotAllowed("Schema version of found record does not exist");
+    }
+    value.indexFields(*versionIt->second);
+    dto::SKVRecord record(request.collectionName, versionIt->second, value.share(), true);
+
+    // the record is kept as it would be added to the response. Columnar queries project when the columns are made
+    dto::SKVRecord::Storage storage;
+    if (fromResponse || request.projection.size() == 0 || request.columnar) {
+        storage = value.share();
+    }
+    else if (!_makeProjection(value, request.projection, schemaVersions, storage)) {
+        K2LOG_W(log::skvsvr, "Error making projection!");
+        return dto::K23SIStatus::InternalError("Error making projection");
+    }
+
+    try {
+        ranker.add(record, std::move(storage));
+    }
+    catch (dto::TypeMismatchException&) {
+        return dto::K23SIStatus::OperationNotAllowed("TypeMismatch in query order by");
+    }
+    catch (dto::DeserializationError&) {
+        return dto::K23SIStatus::OperationNotAllowed("DeserializationError in query order by");
+    }
+    return dto::K23SIStatus::OK("");
+}
+
+void K23SIPartitionModule::_setQueryAggregates(std::vector<dto::Aggregator>& aggregators, dto::K23SIQueryResponse& response) {
+    response.aggregates.clear();
+    for (auto& aggregator : aggregators) {
+        response.aggregates.push_back(aggregator.result());
+    }
+}
+
+Status K23SIPartitionModule::_makeQueryColumns(dto::K23SIQueryRequest& request,
+                                               const SchemaVersionsT& schemaVersions,
+                                               dto::K23SIQueryResponse& response) {
+    dto::ColumnBatchBuilder builder(request.projection);
+    try {
+        for (auto& storage : response.results) {
+            auto versionIt = schemaVersions.find(storage.schemaVersion);
+            if (versionIt == schemaVersions.end()) {
+                return dto::K23SIStatus::OperationNotAllowed("Schema version of found record does not exist");
+            }
+            storage.indexFields(*versionIt->second);
+            dto::SKVRecord record(request.collectionName, versionIt->second, storage.share(), true);
+            builder.add(record);
+        }
+    }
+    catch (dto::DeserializationError&) {
+        return dto::K23SIStatus::OperationNotAllowed("DeserializationError in columnar query");
+    }
+    response.results.clear();
+    response.columns = builder.finish();
+    return dto::K23SIStatus::OK("");
+}
+
+seastar::future<std::tuple<Status, dto::K23SIQueryResponse>>
+K23SIPartitionModule::handleQuery(dto::K23SIQueryRequest&& request, dto::K23SIQueryResponse&& response, FastDeadline deadline) {
+    K2LOG_D(log::skvsvr, "Partition: {}, received query {}", _partition, request);
+    if (request.preparedQueryId != 0) {
+        Status status = _bindPreparedQuery(request);
+        if (!status.is2xxOK()) {
+            return RPCResponse(std::move(status), dto::K23SIQueryResponse{});
+        }
+    }
+    uint32_t credits = std::min(request.streamCredits, _config.queryStreamMaxCredits());
+    if (credits == 0 || _stopped) {
+        return seastar::do_with(std::move(request), [this, response=std::move(response), deadline] (auto& request) mutable {
+            return _queryPage(request, std::move(response), deadline);
+        });
+    }
+
+    // Streaming query. The first page is scanned as usual, and then the stream keeps the request
+    // to scan the pages after it ahead of the client
+    auto stream = seastar::make_lw_shared<_QueryStream>();
+    stream->request = std::move(request);
+    stream->credits = credits;
+    return _queryPage(stream->request, std::move(response), deadline)
+    .then([this, stream] (auto&& result) {
+        auto& [status, response] = result;
+        if (!_advanceQueryStream(*stream, status, response) || _stopped) {
+            // nothing more to stream from this partition
+            return std::move(result);
+        }
+        stream->id = _nextQueryStreamId++;
+        stream->lastAccess = CachedSteadyClock::now();
+        response.streamId = stream->id;
+        _queryStreams[stream->id] = stream;
+        _queryStreamsStarted++;
+        _produceQueryPages(stream);
+        return std::move(result);
+    });
+}
+
+Status K23SIPartitionModule::_bindPreparedQuery(dto::K23SIQueryRequest& request) {
+    auto it = _preparedQueries.find(request.preparedQueryId);
+    if (request.prepare) {
+        if (it == _preparedQueries.end()) {
+            if (_preparedQueries.size() >= std::max(1u, _config.preparedQueriesMax())) {
+                _preparedQueries.erase(_preparedQueriesLRU.back());
+                _preparedQueriesLRU.pop_back();
+            }
+            _preparedQueriesLRU.push_front(request.preparedQueryId);
+            it = _preparedQueries.emplace(request.preparedQueryId, _PreparedQuery{.lru = _preparedQueriesLRU.begin()}).first;
+        }
+        // the literals are replaced by the parameters of each use, so only the shape of the filter matters.
+        // The copy doesn't hold on to the buffers of this request
+        it->second.filter = dto::expression::copyExpression(request.filterExpression);
+        it->second.projection = request.projection;
+        return dto::K23SIStatus::OK("");
+    }
+    if (it == _preparedQueries.end()) {
+        _preparedQueryMisses++;
+        return dto::K23SIStatus::KeyNotFound("prepared query not found");
+    }
+    _preparedQueriesLRU.splice(_preparedQueriesLRU.begin(), _preparedQueriesLRU, it->second.lru);
+    try {
+        request.filterExpression = dto::expression::bindLiterals(it->second.filter, request.parameters);
+    }
+    catch (dto::InvalidExpressionException&) {
+        return dto::K23SIStatus::BadParameter("parameters don't match the prepared query");
+    }
+    request.projection = it->second.projection;
+    return dto::K23SIStatus::OK("");
+}
+
+seastar::future<std::tuple<Status, dto::K23SIQueryResponse>>
+K23SIPartitionModule::handleQueryNext(dto::K23SIQueryNextRequest&& request) {
+    K2LOG_D(log::skvsvr, "Partition: {}, received query next {}", _partition, request);
+    if (!_validateRequestPartition(request)) {
+        // tell client their collection partition is gone
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in query next"), dto::K23SIQueryResponse{});
+    }
+    auto it = _queryStreams.find(request.streamId);
+    if (it == _queryStreams.end()) {
+        return RPCResponse(dto::K23SIStatus::KeyNotFound("query stream not found"), dto::K23SIQueryResponse{});
+    }
+    auto stream = it->second;
+    if (stream->pageWaiter) {
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("query stream already has a pending request"), dto::K23SIQueryResponse{});
+    }
+    stream->lastAccess = CachedSteadyClock::now();
+
+    // The credits are capped so that no more than the max pages are prepared and not yet taken. We always
+    // grant at least one so that the producer can get to the page this request is waiting for
+    uint32_t window = std::max(1u, _config.queryStreamMaxCredits());
+    uint32_t outstanding = stream->credits + stream->pages.size();
+    if (outstanding < window) {
+        stream->credits += std::min(std::max(1u, request.credits), window - outstanding);
+    }
+    _produceQueryPages(stream);
+
+    if (!stream->pages.empty()) {
+        return seastar::make_ready_future<std::tuple<Status, dto::K23SIQueryResponse>>(_takeQueryStreamPage(*stream));
+    }
+    if (stream->done) {
+        // only happens when the stream was dropped while we still had a reference, e.g. on shutdown
+        return RPCResponse(dto::K23SIStatus::KeyNotFound("query stream closed"), dto::K23SIQueryResponse{});
+    }
+
+    stream->pageWaiter.emplace();
+    return stream->pageWaiter->get_future().then([this, stream] {
+        if (stream->pages.empty()) {
+            return RPCResponse(dto::K23SIStatus::KeyNotFound("query stream closed"), dto::K23SIQueryResponse{});
         }
+        return seastar::make_ready_future<std::tuple<Status, dto::K23SIQueryResponse>>(_takeQueryStreamPage(*stream));
+    });
+}
 
+void K23SIPartitionModule::_produceQueryPages(seastar::lw_shared_ptr<_QueryStream> stream) {
+    if (stream->producing || stream->done || stream->credits == 0 || _stopped) {
         return;
     }
-
-    if (it == _indexer.begin()) {
-        it = _indexer.end();
-    } else {
-        --it;
-
-        if (it->first.schemaName != schema) {
-            it = _indexer.end();
+    stream->producing = true;
+    (void)seastar::with_gate(_queryStreamGate, [this, stream] {
+        return seastar::do_until(
+            [this, stream] { return stream->done || stream->credits == 0 || _stopped; },
+            [this, stream] {
+                return _queryPage(stream->request, dto::K23SIQueryResponse{}, FastDeadline(_hot->readTimeout))
+                .handle_exception([this] (auto exc) {
+                    K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, query stream page failed", _partition);
+                    return std::make_tuple(dto::K23SIStatus::InternalError("query stream page failed"), dto::K23SIQueryResponse{});
+                })
+                .then([this, stream] (auto&& result) {
+                    auto& [status, response] = result;
+                    stream->credits--;
+                    // the stream may have been dropped while the page was scanned
+                    if (!_advanceQueryStream(*stream, status, response)) {
+                        stream->done = true;
+                    }
+                    if (!stream->done) {
+                        response.streamId = stream->id;
+                    }
+                    stream->pages.push_back(std::move(result));
+                    if (stream->pageWaiter) {
+                        stream->pageWaiter->set_value();
+                        stream->pageWaiter.reset();
+                    }
+                });
+            });
+    })
+    .finally([stream] {
+        stream->producing = false;
+        if (stream->pageWaiter) {
+            // stopped before getting to the page the client waits for
+            stream->pageWaiter->set_value();
+            stream->pageWaiter.reset();
         }
-    }
+    });
 }
 
-// Helper for handleQuery. Returns an iterator to start the scan at, accounting for
-// desired schema and (eventually) reverse direction scan
-IndexerIterator K23SIPartitionModule::_initializeScan(const dto::Key& start, bool reverse, bool exclusiveKey) {
-    auto key_it = _indexer.lower_bound(start);
-
-    // For reverse direction scan, key_it may not be in range because of how lower_bound works, so fix that here.
-    // IF start key is empty, it means this reverse scan start from end of table OR
-    //      if lower_bound returns a _indexer.end(), it also means reverse scan should start from end of table;
-    // ELSE IF lower_bound returns a key equal to start AND exclusiveKey is true, reverse advance key_it once;
-    // ELSE IF lower_bound returns a key bigger than start, find the first key not bigger than start;
-    if (reverse) {
-        if (start.partitionKey == "" || key_it == _indexer.end()) {
-            key_it = (++_indexer.rbegin()).base();
-        } else if (key_it->first == start && exclusiveKey) {
-            _scanAdvance(key_it, reverse, start.schemaName);
-        } else if (key_it->first > start) {
-            while (key_it->first > start) {
-                _scanAdvance(key_it, reverse, start.schemaName);
-            }
+bool K23SIPartitionModule::_advanceQueryStream(_QueryStream& stream, const Status& status, const dto::K23SIQueryResponse& response) {
+    dto::K23SIQueryRequest& request = stream.request;
+    if (!status.is2xxOK() || response.nextToScan.partitionKey == "") {
+        return false;
+    }
+    if (request.recordLimit >= 0) {
+        request.recordLimit -= _queryResponseSize(response);
+        if (request.recordLimit <= 0) {
+            return false;
         }
     }
-
-    if (key_it != _indexer.end() && key_it->first.schemaName != start.schemaName) {
-        key_it = _indexer.end();
+    // The rest of the scan is in another partition, which the client queries on its own.
+    // This is the multi-partition case of _getContinuationToken
+    if (request.reverseDirection ? response.exclusiveToken : !_partition.owns(response.nextToScan)) {
+        return false;
     }
 
-    return key_it;
+    request.key = response.nextToScan;
+    request.exclusiveKey = response.exclusiveToken;
+    return true;
 }
 
-// Helper for handleQuery. Checks to see if the indexer scan should stop.
-bool K23SIPartitionModule::_isScanDone(const IndexerIterator& it, const dto::K23SIQueryRequest& request,
-                                       size_t response_size) {
-    if (it == _indexer.end()) {
-        return true;
-    } else if (it->first == request.key) {
-        // Start key as inclusive overrides end key as exclusive
-        return false;
-    } else if (!request.reverseDirection && it->first >= request.endKey &&
-               request.endKey.partitionKey != "") {
-        return true;
-    } else if (request.reverseDirection && it->first <= request.endKey) {
-        return true;
-    } else if (request.recordLimit >= 0 && response_size == (uint32_t)request.recordLimit) {
-        return true;
-    } else if (response_size == _config.paginationLimit()) {
-        return true;
+std::tuple<Status, dto::K23SIQueryResponse> K23SIPartitionModule::_takeQueryStreamPage(_QueryStream& stream) {
+    auto page = std::move(stream.pages.front());
+    stream.pages.pop_front();
+    stream.lastAccess = CachedSteadyClock::now();
+    if (stream.done && stream.pages.empty()) {
+        _queryStreams.erase(stream.id);
     }
-
-    return false;
+    return page;
 }
 
-// Helper for handleQuery. Returns continuation token (aka response.nextToScan)
-dto::Key K23SIPartitionModule::_getContinuationToken(const IndexerIterator& it,
-                    const dto::K23SIQueryRequest& request, dto::K23SIQueryResponse& response, size_t response_size) {
-    // Three cases where scan is for sure done:
-    // 1. Record limit is reached
-    // 2. Iterator is not end() but is >= user endKey
-    // 3. Iterator is at end() and partition bounds contains endKey
-    if ((request.recordLimit >= 0 && response_size == (uint32_t)request.recordLimit) ||
-        // Test for past user endKey:
-        (it != _indexer.end() &&
-            (request.reverseDirection ? it->first <= request.endKey : it->first >= request.endKey && request.endKey.partitionKey != "")) ||
-        // Test for partition bounds contains endKey and we are at end()
-        (it == _indexer.end() &&
-            (request.reverseDirection ?
-            _partition().startKey <= request.endKey.partitionKey :
-            request.endKey.partitionKey <= _partition().endKey && request.endKey.partitionKey != ""))) {
-        return dto::Key();
+void K23SIPartitionModule::_recordQueryRead(const dto::K23SIQueryRequest& request, const dto::Key& low,
+                                            const dto::Key& high, bool continues) {
+    auto& ranges = _queryReadRanges[request.mtr];
+    // the range of the previous page ends where this page starts
+    auto it = std::find_if(ranges.begin(), ranges.end(), [&request] (const _QueryReadRange& range) {
+        return request.reverseDirection ? range.low == request.key : range.high == request.key;
+    });
+    if (it != ranges.end()) {
+        dto::Key newLow = request.reverseDirection ? low : it->low;
+        dto::Key newHigh = request.reverseDirection ? it->high : high;
+        _readCache->extendInterval(it->low, it->high, newLow, newHigh, request.mtr.timestamp);
+        it->low = std::move(newLow);
+        it->high = std::move(newHigh);
+        _queryReadRangesExtended++;
     }
-    else if (it != _indexer.end()) {
-        // This is the paginated case
-        response.exclusiveToken = false;
-        return it->first;
+    else {
+        _readCache->insertInterval(low, high, request.mtr.timestamp);
+        it = ranges.insert(ranges.end(), _QueryReadRange{.low = low, .high = high, .lastAccess = TimePoint{}});
     }
 
-    // This is the multi-partition case
-    if (request.reverseDirection) {
-        response.exclusiveToken = true;
-        return dto::Key {
-            request.key.schemaName,
-            _partition().startKey,
-            ""
-        };
-    } else {
-        response.exclusiveToken = false;
-        return dto::Key {
-            request.key.schemaName,
-            _partition().endKey,
-            ""
-        };
+    if (continues) {
+        it->lastAccess = CachedSteadyClock::now();
+        return;
+    }
+    ranges.erase(it);
+    if (ranges.empty()) {
+        _queryReadRanges.erase(request.mtr);
     }
 }
 
-// Makes the SKVRecord and applies the request's filter to it. If the returned Status is not OK,
-// the caller should return the status in the query response. Otherwise bool in tuple is whether
-// the filter passed
-std::tuple<Status, bool> K23SIPartitionModule::_doQueryFilter(dto::K23SIQueryRequest& request,
-                                                              dto::SKVRecord::Storage& storage) {
-    // We know the schema name exists because it is validated at the beginning of handleQuery
-    auto schemaIt = _schemas.find(request.key.schemaName);
-    auto versionIt = schemaIt->second.find(storage.schemaVersion);
-    if (versionIt == schemaIt->second.end()) {
-        return std::make_tuple(dto::K23SIStatus::OperationNotAllowed(
-            "Schema version of found record does not exist"), false);
+void K23SIPartitionModule::_expireQueryReadRanges() {
+    auto now = CachedSteadyClock::now();
+    for (auto it = _queryReadRanges.begin(); it != _queryReadRanges.end();) {
+        auto& ranges = it->second;
+        ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [this, now] (const _QueryReadRange& range) {
+            return now - range.lastAccess >= _config.queryStreamIdleTimeout();
+        }), ranges.end());
+        it = ranges.empty() ? _queryReadRanges.erase(it) : std::next(it);
     }
+}
 
-    dto::SKVRecord record(request.collectionName, versionIt->second, storage.share(), true);
-    bool keep = false;
-    Status status = dto::K23SIStatus::OK("");
-
-    try {
-        keep = request.filterExpression.evaluate(record);
-    }
-    catch(dto::NoFieldFoundException&) {}
-    catch(dto::TypeMismatchException&) {}
-    catch (dto::DeserializationError&) {
-        status = dto::K23SIStatus::OperationNotAllowed("DeserializationError in query filter");
-    }
-    catch (dto::InvalidExpressionException&) {
-        status = dto::K23SIStatus::OperationNotAllowed("InvalidExpression in query filter");
+seastar::future<> K23SIPartitionModule::_expireQueryStreams() {
+    auto now = CachedSteadyClock::now();
+    for (auto it = _queryStreams.begin(); it != _queryStreams.end();) {
+        auto& stream = it->second;
+        if (!stream->pageWaiter && now - stream->lastAccess >= _config.queryStreamIdleTimeout()) {
+            K2LOG_D(log::skvsvr, "Partition: {}, dropping idle query stream {}", _partition, stream->id);
+            stream->done = true;
+            it = _queryStreams.erase(it);
+            _queryStreamsExpired++;
+        } else {
+            ++it;
+        }
     }
-
-    return std::make_tuple(std::move(status), keep);
+    return seastar::make_ready_future();
 }
 
 seastar::future<std::tuple<Status, dto::K23SIQueryResponse>>
-K23SIPartitionModule::handleQuery(dto::K23SIQueryRequest&& request, dto::K23SIQueryResponse&& response, FastDeadline deadline) {
-    K2LOG_D(log::skvsvr, "Partition: {}, received query {}", _partition, request);
+K23SIPartitionModule::_queryPage(dto::K23SIQueryRequest& request, dto::K23SIQueryResponse&& response, FastDeadline deadline) {
+    // pages are also scanned from continuations(after a push, or ahead of a stream), which the dispatcher doesn't time
+    TaskTimer timer(dto::Verbs::K23SI_QUERY);
 
-    Status validateStatus = _validateReadRequest(request);
+    uint32_t schemaId = SchemaIndexer::NoSchemaId;
+    Status validateStatus = _validateReadRequest(request, schemaId);
     if (!validateStatus.is2xxOK()) {
         return RPCResponse(std::move(validateStatus), dto::K23SIQueryResponse{});
     }
     if (_partition.getHashScheme() != dto::HashScheme::Range) {
             return RPCResponse(dto::K23SIStatus::OperationNotAllowed("Query not implemented for hash partitioned collection"), dto::K23SIQueryResponse{});
     }
+    if (request.snapshotRead) {
+        Status snapshotStatus = _admitSnapshotRead(request.mtr.timestamp);
+        if (!snapshotStatus.is2xxOK()) {
+            return RPCResponse(std::move(snapshotStatus), dto::K23SIQueryResponse{});
+        }
+    }
 
-    IndexerIterator key_it = _initializeScan(request.key, request.reverseDirection, request.exclusiveKey);
-    for (; !_isScanDone(key_it, request, response.results.size());
-                        _scanAdvance(key_it, request.reverseDirection, request.key.schemaName)) {
+    IndexerT& index = _indexer.at(schemaId);
+    const SchemaVersionsT& schemaVersions = _schemas[schemaId];
+    if (!schemaVersions.empty()) {
+        // all versions of a schema have the same key fields
+        dto::expression::narrowKeyRange(request.filterExpression, *schemaVersions.begin()->second,
+                                        request.reverseDirection, request.key, request.endKey);
+    }
+    IndexerIterator key_it = _initializeScan(index, request.key, request.reverseDirection, request.exclusiveKey);
+    // the filter is compiled once for the scan rather than interpreted for every record
+    dto::expression::CompiledExpression filter(request.filterExpression);
+    // For aggregate queries, records are folded into the aggregators instead of being added to the response.
+    // Partials from before a push are carried in the response
+    std::vector<dto::Aggregator> aggregators;
+    try {
+        for (auto& aggregate : request.aggregates) {
+            aggregators.emplace_back(aggregate);
+        }
+        for (size_t i = 0; i < response.aggregates.size() && i < aggregators.size(); ++i) {
+            aggregators[i].merge(response.aggregates[i]);
+        }
+    }
+    catch (dto::InvalidExpressionException&) {
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("Invalid aggregate in query"), dto::K23SIQueryResponse{});
+    }
+    // For ordered queries, records are ranked instead of being added to the response. The records ranked
+    // before a push are carried in the response
+    std::optional<_QueryRanker> ranker;
+    if (!request.orderBy.fieldName.empty()) {
+        if (!aggregators.empty()) {
+            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("Order by in aggregate query"), dto::K23SIQueryResponse{});
+        }
+        if (request.projection.size() > 0 &&
+            std::find(request.projection.begin(), request.projection.end(), request.orderBy.fieldName) == request.projection.end()) {
+            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("Order by field is not projected"), dto::K23SIQueryResponse{});
+        }
+        try {
+            ranker.emplace(request.orderBy);
+        }
+        catch (dto::InvalidExpressionException&) {
+            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("Invalid order by in query"), dto::K23SIQueryResponse{});
+        }
+        for (auto& result : response.results) {
+            Status status = _rankQueryResult(request, schemaVersions, *ranker, result, true);
+            if (!status.is2xxOK()) {
+                return RPCResponse(std::move(status), dto::K23SIQueryResponse{});
+            }
+        }
+        response.results.clear();
+    }
+    // Visible records are gathered and filtered in batches. Records are only added to the response
+    // when their batch is flushed, so the batch is flushed before anything which depends on the response size
+    std::vector<_QueryCandidate> candidates;
+    // the decoded values of the cold candidates
+    std::deque<dto::SKVRecord::Storage> coldValues;
+    size_t batchSize = request.filterExpression.op == dto::expression::Operation::UNKNOWN ?
+                       1 : std::max(1u, _hot->queryFilterBatchSize);
+    // the size of the records in the response so far, including those from before a push
+    size_t responseBytes = 0;
+    for (auto& result : response.results) {
+        responseBytes += result.fieldData.getSize();
+    }
+    for (; !_isScanDone(index, key_it, request, _queryResponseSize(response), responseBytes);
+                        _scanAdvance(index, key_it, request.reverseDirection)) {
         auto& versions = key_it->second;
-        auto viter = _getVersion(versions, request.mtr.timestamp);
+        _applyRangeTombstones(key_it->first, versions);
+        if (versions.isCold()) {
+            // the only version is committed, not a tombstone and has no TTL(see _freezeColdKeys). Its value is
+            // decoded without thawing the chain, since a scan doesn't make the key hot
+            if (request.mtr.timestamp.compareCertain(versions.coldHead().txnId.mtr.timestamp) >= 0) {
+                coldValues.push_back(versions.coldValue());
+                candidates.push_back(_QueryCandidate{.it = key_it, .value = &coldValues.back()});
+                if (candidates.size() >= batchSize) {
+                    auto [status, full] = _flushQueryCandidates(request, schemaVersions, filter, aggregators, ranker, candidates, response, responseBytes, key_it);
+                    if (!status.is2xxOK()) {
+                        return RPCResponse(std::move(status), dto::K23SIQueryResponse{});
+                    }
+                }
+            }
+            continue;
+        }
+        // snapshot queries skip aborted versions, but have to wait for the WIs within their snapshot below
+        auto viter = request.snapshotRead ? _getSnapshotVersion(versions, request.mtr.timestamp) :
+                                            _getVersion(versions, request.mtr.timestamp);
 
         if (viter == versions.end()) {
             // happy case: we either had no versions, or all versions were newer than the requested timestamp
@@ -351,67 +2532,98 @@ K23SIPartitionModule::handleQuery(dto::K23SIQueryRequest&& request, dto::K23SIQu
 
         // happy case: either committed, or txn is reading its own write
         if (viter->status == dto::DataRecord::Committed || viter->txnId.mtr == request.mtr) {
-            if (!viter->isTombstone) {
-                auto [status, keep] = _doQueryFilter(request, viter->value);
-                if (!status.is2xxOK()) {
-                    return RPCResponse(std::move(status), dto::K23SIQueryResponse{});
-                }
-                if (!keep) {
-                    continue;
-                }
-
-                // apply projection if the user call addProjection
-                if (request.projection.size() == 0) {
-                    // want all fields
-                    response.results.push_back(viter->value.share());
-                } else {
-                    // serialize partial SKVRecord according to projection
-                    dto::SKVRecord::Storage storage;
-                    bool success = _makeProjection(viter->value, request, storage);
-                    if (!success) {
-                        K2LOG_W(log::skvsvr, "Error making projection!");
-                        return RPCResponse(dto::K23SIStatus::InternalError("Error making projection"),
-                                                dto::K23SIQueryResponse{});
+            if (!viter->isDeletedAt(request.mtr.timestamp)) {
+                candidates.push_back(_QueryCandidate{.it = key_it, .value = &viter->value});
+                if (candidates.size() >= batchSize) {
+                    // if the response fills up, key_it is moved back and the scan stops after advancing it
+                    auto [status, full] = _flushQueryCandidates(request, schemaVersions, filter, aggregators, ranker, candidates, response, responseBytes, key_it);
+                    if (!status.is2xxOK()) {
+                        return RPCResponse(std::move(status), dto::K23SIQueryResponse{});
                     }
-
-                    response.results.push_back(std::move(storage));
                 }
             }
 
             continue;
         }
 
-        // If we get here it is a conflict, first decide to push or return early
-        if (response.results.size() >= _config.queryPushLimit()) {
+        // If we get here it is a conflict. Bring the response up to date with the records before it
+        if (!candidates.empty()) {
+            auto [status, full] = _flushQueryCandidates(request, schemaVersions, filter, aggregators, ranker, candidates, response, responseBytes, key_it);
+            if (!status.is2xxOK()) {
+                return RPCResponse(std::move(status), dto::K23SIQueryResponse{});
+            }
+            if (full) {
+                // the scan stops before reaching the conflict
+                continue;
+            }
+        }
+
+        // first decide to push or return early
+        if (_queryResponseSize(response) >= _hot->queryPushLimit) {
             break;
         }
+        if (request.snapshotRead) {
+            // a snapshot query doesn't push. It waits for the WI to be finalized and continues from it
+            if (request.reverseDirection) {
+                _snapshotReadCache->insertInterval(key_it->first, request.key, request.mtr.timestamp);
+            } else {
+                _snapshotReadCache->insertInterval(request.key, key_it->first, request.mtr.timestamp);
+            }
+            request.key = key_it->first;
+            _setQueryAggregates(aggregators, response);
+            if (ranker) {
+                response.results = ranker->take();
+            }
+            auto wait = std::min<Duration>(_config.conflictWaitTimeout(), deadline.getRemaining());
+            return _waitForFinalize(key_it->first, wait)
+            .then([this, &request, resp=std::move(response), deadline](bool finalized) mutable {
+                if (!finalized) {
+                    return RPCResponse(dto::K23SIStatus::AbortConflict("snapshot query of a key with a pending write"), dto::K23SIQueryResponse{});
+                }
+                return _queryPage(request, std::move(resp), deadline);
+            });
+        }
         K2LOG_D(log::skvsvr, "Partition {}, query from txn {}, updates read cache for key range {} - {}",
                 _partition, request.mtr, request.key, key_it->first);
 
         // Do a push but we need to save our place in the query
         // TODO we can test the filter condition against the WI and last committed version and possibly
         // avoid a push
-        // Must update read cache before doing an async operation
+        // Must update read cache before doing an async operation. The retry continues from here
         request.reverseDirection ?
-            _readCache->insertInterval(key_it->first, request.key, request.mtr.timestamp) :
-            _readCache->insertInterval(request.key, key_it->first, request.mtr.timestamp);
+            _recordQueryRead(request, key_it->first, request.key, true) :
+            _recordQueryRead(request, request.key, key_it->first, true);
 
         K2LOG_D(log::skvsvr, "About to PUSH in query request");
         request.key = key_it->first; // if we retry, do so with the key we're currently iterating on
-        return _doPush(request.collectionName, viter->key, viter->txnId, request.mtr, deadline)
-        .then([this, request=std::move(request),
-                        resp=std::move(response), deadline](bool retryChallenger) mutable {
+        _setQueryAggregates(aggregators, response);
+        if (ranker) {
+            response.results = ranker->take();
+        }
+        return _doPush(request.collectionName, key_it->first, viter->txnId, request.mtr, deadline)
+        .then([this, &request, resp=std::move(response), deadline](bool retryChallenger) mutable {
             if (!retryChallenger) {
                 // sitting transaction won. Abort the incoming request
                 return RPCResponse(dto::K23SIStatus::AbortConflict("incumbent txn won in query push"), dto::K23SIQueryResponse{});
             }
-            return handleQuery(std::move(request), std::move(resp), deadline);
+            return _queryPage(request, std::move(resp), deadline);
         });
     }
 
+    if (!candidates.empty()) {
+        auto [status, full] = _flushQueryCandidates(request, schemaVersions, filter, aggregators, ranker, candidates, response, responseBytes, key_it);
+        if (!status.is2xxOK()) {
+            return RPCResponse(std::move(status), dto::K23SIQueryResponse{});
+        }
+        if (full) {
+            // same position as if the scan had stopped right after the record which filled the response
+            _scanAdvance(index, key_it, request.reverseDirection);
+        }
+    }
+
     // Read cache update block
     dto::Key endInterval;
-    if (key_it == _indexer.end()) {
+    if (key_it == index.end()) {
         // For forward direction we need to lock the whole range of the schema, which we do
         // by appending a character, which may overshoot the range but is correct
         endInterval.schemaName = request.reverseDirection ? request.key.schemaName : request.key.schemaName + "a";
@@ -421,15 +2633,35 @@ K23SIPartitionModule::handleQuery(dto::K23SIQueryRequest&& request, dto::K23SIQu
         endInterval = key_it->first;
     }
 
-    K2LOG_D(log::skvsvr, "Partition {}, query from txn {}, updates read cache for key range {} - {}",
-                _partition, request.mtr, request.key, endInterval);
-    request.reverseDirection ?
-        _readCache->insertInterval(endInterval, request.key, request.mtr.timestamp) :
-        _readCache->insertInterval(request.key, endInterval, request.mtr.timestamp);
-
-
-    response.nextToScan = _getContinuationToken(key_it, request, response, response.results.size());
+    _setQueryAggregates(aggregators, response);
+    if (ranker) {
+        response.results = ranker->take();
+    }
+    response.nextToScan = _getContinuationToken(index, key_it, request, response, _queryResponseSize(response));
+    if (request.snapshotRead) {
+        // writers can't go under the snapshot of the range we scanned from now on, so the query is repeatable
+        if (request.reverseDirection) {
+            _snapshotReadCache->insertInterval(endInterval, request.key, request.mtr.timestamp);
+        } else {
+            _snapshotReadCache->insertInterval(request.key, endInterval, request.mtr.timestamp);
+        }
+    }
+    else {
+        K2LOG_D(log::skvsvr, "Partition {}, query from txn {}, updates read cache for key range {} - {}",
+                    _partition, request.mtr, request.key, endInterval);
+        // the next page continues in this partition only if this one stopped short of the partition's end
+        bool continues = key_it != index.end() && response.nextToScan.partitionKey != "";
+        request.reverseDirection ?
+            _recordQueryRead(request, endInterval, request.key, continues) :
+            _recordQueryRead(request, request.key, endInterval, continues);
+    }
     K2LOG_D(log::skvsvr, "nextToScan: {}, exclusiveToken: {}", response.nextToScan, response.exclusiveToken);
+    if (request.columnar && request.aggregates.empty()) {
+        Status status = _makeQueryColumns(request, schemaVersions, response);
+        if (!status.is2xxOK()) {
+            return RPCResponse(std::move(status), dto::K23SIQueryResponse{});
+        }
+    }
     return RPCResponse(dto::K23SIStatus::OK("Query success"), std::move(response));
 }
 
@@ -437,11 +2669,35 @@ seastar::future<std::tuple<Status, dto::K23SIReadResponse>>
 K23SIPartitionModule::handleRead(dto::K23SIReadRequest&& request, FastDeadline deadline) {
     K2LOG_D(log::skvsvr, "Partition: {}, received read {}", _partition, request);
 
-    Status validateStatus = _validateReadRequest(request);
+    uint32_t schemaId = SchemaIndexer::NoSchemaId;
+    Status validateStatus = _validateReadRequest(request, schemaId);
     if (!validateStatus.is2xxOK()) {
         return RPCResponse(std::move(validateStatus), dto::K23SIReadResponse{});
     }
 
+    if (request.snapshotRead) {
+        Status snapshotStatus = _admitSnapshotRead(request.mtr.timestamp);
+        if (!snapshotStatus.is2xxOK()) {
+            return RPCResponse(std::move(snapshotStatus), dto::K23SIReadResponse{});
+        }
+        auto* rec = _getSnapshotRecord(schemaId, request.key, request.mtr.timestamp);
+        if (rec && rec->status == dto::DataRecord::WriteIntent && rec->txnId.mtr != request.mtr) {
+            // the WI may still commit into the snapshot. Snapshot reads don't push, they wait for it to be finalized
+            auto wait = std::min<Duration>(_config.conflictWaitTimeout(), deadline.getRemaining());
+            auto key = request.key;
+            return _waitForFinalize(key, wait)
+                .then([this, request=std::move(request), deadline] (bool finalized) mutable {
+                    if (!finalized) {
+                        return RPCResponse(dto::K23SIStatus::AbortConflict("snapshot read of a key with a pending write"), dto::K23SIReadResponse{});
+                    }
+                    return handleRead(std::move(request), deadline);
+                });
+        }
+        // writers can't go under the snapshot from now on, so the read is repeatable
+        _snapshotReadCache->insertInterval(request.key, request.key, request.mtr.timestamp);
+        return _makeReadOK(rec, request, schemaId);
+    }
+
     K2LOG_D(log::skvsvr, "Partition {}, read from txn {}, updates read cache for key {}",
                 _partition, request.mtr, request.key);
     // update the read cache to lock out any future writers which may attempt to modify the key range
@@ -449,14 +2705,14 @@ K23SIPartitionModule::handleRead(dto::K23SIReadRequest&& request, FastDeadline d
     _readCache->insertInterval(request.key, request.key, request.mtr.timestamp);
 
     // find the record we should return
-    auto* rec = _getDataRecord(request.key, request.mtr.timestamp);
+    auto* rec = _getDataRecord(schemaId, request.key, request.mtr.timestamp);
     if (!rec) {
-        return _makeReadOK(nullptr);
+        return _makeReadOK(nullptr, request, schemaId);
     }
 
     // happy case: either committed, or txn is reading its own write
     if (rec->status == dto::DataRecord::Committed || rec->txnId.mtr == request.mtr) {
-        return _makeReadOK(rec);
+        return _makeReadOK(rec, request, schemaId);
     }
     // record is still pending and isn't from same transaction.
     return _doPush(request.collectionName, request.key, rec->txnId, request.mtr, deadline)
@@ -468,12 +2724,112 @@ K23SIPartitionModule::handleRead(dto::K23SIReadRequest&& request, FastDeadline d
         });
 }
 
+seastar::future<std::tuple<Status, dto::K23SIReadMultiResponse>>
+K23SIPartitionModule::handleReadMulti(dto::K23SIReadMultiRequest&& request, FastDeadline deadline) {
+    K2LOG_D(log::skvsvr, "Partition: {}, received read multi {}", _partition, request);
+
+    // the keys may be of different schemas, so they are resolved one by one below
+    uint32_t schemaId = SchemaIndexer::NoSchemaId;
+    Status validateStatus = _validateReadRequest(request, schemaId);
+    if (!validateStatus.is2xxOK()) {
+        return RPCResponse(std::move(validateStatus), dto::K23SIReadMultiResponse{});
+    }
+
+    if (request.snapshotRead) {
+        Status snapshotStatus = _admitSnapshotRead(request.mtr.timestamp);
+        if (!snapshotStatus.is2xxOK()) {
+            return RPCResponse(std::move(snapshotStatus), dto::K23SIReadMultiResponse{});
+        }
+    }
+
+    dto::K23SIReadMultiResponse response;
+    response.statuses.resize(request.keys.size());
+    response.values.resize(request.keys.size());
+
+    // validate the individual keys and update the read cache for all of them before we do any async work
+    for (size_t i = 0; i < request.keys.size(); ++i) {
+        auto& key = request.keys[i];
+        if (!_partition.owns(key)) {
+            response.statuses[i] = dto::K23SIStatus::RefreshCollection("key not owned by partition in read multi");
+        }
+        else if (key.partitionKey.empty()) {
+            response.statuses[i] = dto::K23SIStatus::BadParameter("missing partition key in read multi");
+        }
+        else {
+            if (!request.snapshotRead) {
+                _readCache->insertInterval(key, key, request.mtr.timestamp);
+            }
+            response.statuses[i] = dto::K23SIStatus::OK("");
+        }
+    }
+
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < request.keys.size(); ++i) {
+        if (!response.statuses[i].is2xxOK()) {
+            continue;
+        }
+        auto* rec = request.snapshotRead ? _getSnapshotRecord(request.keys[i], request.mtr.timestamp) :
+                                           _getDataRecord(request.keys[i], request.mtr.timestamp);
+        if (request.snapshotRead && (rec == nullptr || rec->status == dto::DataRecord::Committed || rec->txnId.mtr == request.mtr)) {
+            _snapshotReadCache->insertInterval(request.keys[i], request.keys[i], request.mtr.timestamp);
+        }
+        if (rec == nullptr) {
+            response.statuses[i] = dto::K23SIStatus::KeyNotFound("read did not find key");
+        }
+        else if (rec->status == dto::DataRecord::Committed || rec->txnId.mtr == request.mtr) {
+            if (rec->isDeletedAt(request.mtr.timestamp)) {
+                response.statuses[i] = dto::K23SIStatus::KeyNotFound("read did not find key");
+            }
+            else {
+                response.statuses[i] = dto::K23SIStatus::OK("read succeeded");
+                response.values[i] = rec->value.share();
+            }
+        }
+        else {
+            // a WI from a different transaction. Resolve via the single-key read path, which will push(or wait for
+            // the WI, for a snapshot read)
+            pending.push_back(i);
+        }
+    }
+
+    if (pending.empty()) {
+        return RPCResponse(dto::K23SIStatus::OK("read multi succeeded"), std::move(response));
+    }
+
+    return seastar::do_with(std::move(request), std::move(response), std::move(pending),
+        [this, deadline] (auto& request, auto& response, auto& pending) {
+        return seastar::parallel_for_each(pending, [this, &request, &response, deadline] (size_t i) {
+            dto::K23SIReadRequest single(request.pvid, request.collectionName, request.mtr, request.keys[i]);
+            single.snapshotRead = request.snapshotRead;
+            return handleRead(std::move(single), deadline)
+                .then([&response, i](auto&& result) {
+                    auto& [status, k2response] = result;
+                    response.statuses[i] = std::move(status);
+                    response.values[i] = std::move(k2response.value);
+                });
+        })
+        .then([&response] {
+            return RPCResponse(dto::K23SIStatus::OK("read multi succeeded"), std::move(response));
+        });
+    });
+}
+
 template <typename RequestT>
 Status K23SIPartitionModule::_validateStaleWrite(const RequestT& request, VersionsT& versions) {
     if (!_validateRetentionWindow(request)) {
         // the request is outside the retention window
         return dto::K23SIStatus::AbortRequestTooOld("write request is outside retention window");
     }
+    // the followers(and change streams) may have seen everything at or below the closed timestamp already
+    if (request.mtr.timestamp.compareCertain(_snapshotHorizon) <= 0) {
+        _snapshotHorizonRejects++;
+        return dto::K23SIStatus::AbortRequestTooOld("write request cannot be allowed as it is older than the closed timestamp");
+    }
+    // a snapshot read of the key at or above the write must not see it appear
+    if (request.mtr.timestamp.compareCertain(_snapshotReadCache->checkInterval(request.key, request.key)) <= 0) {
+        _snapshotReadConflictRejects++;
+        return dto::K23SIStatus::AbortRequestTooOld("write request cannot be allowed as the key was observed by a snapshot read");
+    }
     // check read cache for R->W conflicts
     auto ts = _readCache->checkInterval(request.key, request.key);
     if (request.mtr.timestamp.compareCertain(ts) < 0) {
@@ -482,16 +2838,18 @@ Status K23SIPartitionModule::_validateStaleWrite(const RequestT& request, Versio
         bool belowReadCacheWaterMark = (request.mtr.timestamp.compareCertain(_readCache->min_TimeStamp()) <= 0);
         if (belowReadCacheWaterMark)
         {
+            _readCacheWatermarkRejects++;
             return dto::K23SIStatus::AbortRequestTooOld("write request cannot be allowed as this key (or key range) is older than min timestamp(watermark) server maintains.");
         }
         else
         {
+            _readCacheConflictRejects++;
             return dto::K23SIStatus::AbortRequestTooOld("write request cannot be allowed as this key (or key range) has been observed by another transaction");
         }
     }
 
     // check if we have a committed value newer than the request. The latest committed
-    // is either the first or second in deque as we may have at most one outstanding WI
+    // is either the first or second in the chain as we may have at most one outstanding WI
     // NB(1) if we try to place a WI over a committed value from different transaction with same ts.end
     // (even if from different TSO), reject the incoming write in order to avoid weird read-my-write problem
     // for in-progress transactions
@@ -518,14 +2876,9 @@ Status K23SIPartitionModule::_validateStaleWrite(const RequestT& request, Versio
     return dto::K23SIStatus::OK("");
 }
 
-std::size_t K23SIPartitionModule::_findField(const dto::Schema schema, k2::String fieldName ,dto::FieldType fieldtype) {
-    std::size_t fieldNumber = -1;
-    for (std::size_t i = 0; i < schema.fields.size(); ++i) {
-        if (schema.fields[i].name == fieldName && schema.fields[i].type == fieldtype) {
-            return i;
-        }
-    }
-    return fieldNumber;
+std::size_t K23SIPartitionModule::_findField(const dto::Schema& schema, const k2::String& fieldName, dto::FieldType fieldtype) {
+    int32_t idx = schema.fieldIndex(fieldName, fieldtype);
+    return idx < 0 ? (std::size_t)-1 : (std::size_t)idx;
 }
 
 template <typename T>
@@ -557,108 +2910,211 @@ void _getNextPayloadOffset(const dto::SchemaField& field, Payload& base, uint32_
     success = true;
 }
 
-template <>
-void _getNextPayloadOffset<String>(const dto::SchemaField& field, Payload& base, uint32_t baseCursor,
-                           std::vector<uint32_t>& fieldsOffset, bool& success) {
-    (void) field;
-    uint32_t strLen;
-    base.seek(fieldsOffset[baseCursor]);
-    success = base.read(strLen);
-    if (!success) return;
-    uint32_t tmpOffset = fieldsOffset[baseCursor] + sizeof(uint32_t) + strLen; // uint32_t for length; '\0' doesn't count
-    fieldsOffset.push_back(tmpOffset);
+template <>
+void _getNextPayloadOffset<String>(const dto::SchemaField& field, Payload& base, uint32_t baseCursor,
+                           std::vector<uint32_t>& fieldsOffset, bool& success) {
+    (void) field;
+    uint32_t strLen;
+    base.seek(fieldsOffset[baseCursor]);
+    success = base.read(strLen);
+    if (!success) return;
+    uint32_t tmpOffset = fieldsOffset[baseCursor] + sizeof(uint32_t) + strLen; // uint32_t for length; '\0' doesn't count
+    fieldsOffset.push_back(tmpOffset);
+}
+
+Status K23SIPartitionModule::_checkWriteCondition(dto::K23SIWriteRequest& request, const SchemaVersionsT& schemaVersions,
+                                                  VersionsT& versions) {
+    if (!versions.size() || versions[0].isDeletedAt(request.mtr.timestamp)) {
+        return dto::K23SIStatus::ConditionFailed("no record for the write condition");
+    }
+    dto::SKVRecord::Storage& storage = versions[0].value;
+    auto versionIt = schemaVersions.find(storage.schemaVersion);
+    if (versionIt == schemaVersions.end()) {
+        return dto::K23SIStatus::OperationNotAllowed("Schema version of found record does not exist");
+    }
+    // conditions access fields out of order, see _doQueryFilter
+    storage.indexFields(*versionIt->second);
+    dto::SKVRecord record(request.collectionName, versionIt->second, storage.share(), true);
+
+    bool passed = false;
+    try {
+        passed = request.condition.evaluate(record);
+    }
+    catch(dto::NoFieldFoundException&) {}
+    catch(dto::TypeMismatchException&) {}
+    catch (dto::DeserializationError&) {
+        return dto::K23SIStatus::OperationNotAllowed("DeserializationError in write condition");
+    }
+    catch (dto::InvalidExpressionException&) {
+        return dto::K23SIStatus::OperationNotAllowed("InvalidExpression in write condition");
+    }
+
+    return passed ? dto::K23SIStatus::OK("") : dto::K23SIStatus::ConditionFailed("write condition not met");
+}
+
+template <typename T>
+void _applyFieldOp(const dto::SchemaField& field, dto::FieldOperation op, Payload* latest, Payload* expected,
+                   Payload& operand, Status& status) {
+    // latest and expected are positioned at the field, or null if the field has no value in them
+    T latestValue{};
+    if (latest && !latest->read(latestValue)) {
+        status = dto::K23SIStatus::BadParameter("can not read the latest version of the field");
+        return;
+    }
+    if (op == dto::FieldOperation::CompareAndSet) {
+        T expectedValue{};
+        if (expected && !expected->read(expectedValue)) {
+            status = dto::K23SIStatus::BadParameter("can not read the expected value of the field");
+            return;
+        }
+        bool matches = latest && expected ? latestValue == expectedValue : latest == expected;
+        status = matches ? dto::K23SIStatus::OK("") :
+            dto::K23SIStatus::ConditionFailed(fmt::format("field {} does not have the expected value", field.name));
+        return;
+    }
+    if constexpr ((std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) ||
+                  std::is_same_v<T, std::decimal::decimal64> || std::is_same_v<T, std::decimal::decimal128>) {
+        if (!latest) {
+            status = dto::K23SIStatus::BadParameter(fmt::format("{} of field {} which has no value", op, field.name));
+            return;
+        }
+        auto position = operand.getCurrentPosition();
+        T value{};
+        if (!operand.read(value)) {
+            status = dto::K23SIStatus::BadParameter("can not read the operand of the field");
+            return;
+        }
+        T result = op == dto::FieldOperation::Add ? static_cast<T>(latestValue + value) :
+                   op == dto::FieldOperation::Min ? std::min(latestValue, value) : std::max(latestValue, value);
+        // the operand has the size of the result, so the result is written over it
+        operand.seek(position);
+        operand.write(result);
+        status = dto::K23SIStatus::OK("");
+    } else {
+        status = dto::K23SIStatus::BadParameter(fmt::format("{} of non-numeric field {}", op, field.name));
+    }
+}
+
+Status K23SIPartitionModule::_applyFieldOps(dto::K23SIWriteRequest& request, const SchemaVersionsT& schemaVersions,
+                                            dto::DataRecord& previous) {
+    // We already know the schema version exists because it is validated at the begin of handleWrite
+    dto::Schema& schema = *(schemaVersions.find(request.value.schemaVersion)->second);
+    auto latestSchemaVer = schemaVersions.find(previous.value.schemaVersion);
+    if (latestSchemaVer == schemaVersions.end()) {
+        return dto::K23SIStatus::BadParameter("unknown schema version of the latest version");
+    }
+    dto::Schema& latestSchema = *(latestSchemaVer->second);
+
+    bool needsExpected = std::any_of(request.fieldOps.begin(), request.fieldOps.end(), [] (const auto& fieldOp) {
+        return fieldOp.op == dto::FieldOperation::CompareAndSet;
+    });
+    if (!request.value.indexFields(schema) || !previous.value.indexFields(latestSchema) ||
+        (needsExpected && !request.expected.indexFields(schema))) {
+        return dto::K23SIStatus::BadParameter("can not interpret the fields of the field operations");
+    }
+    auto hasValue = [] (const dto::SKVRecord::Storage& storage, size_t fieldIdx) {
+        return storage.excludedFields.empty() || !storage.excludedFields[fieldIdx];
+    };
+
+    Status status = dto::K23SIStatus::OK("");
+    for (const dto::K23SIFieldOp& fieldOp : request.fieldOps) {
+        uint32_t fieldIdx = fieldOp.fieldIdx;
+        bool updated = std::find(request.fieldsForPartialUpdate.begin(), request.fieldsForPartialUpdate.end(),
+                                 fieldIdx) != request.fieldsForPartialUpdate.end();
+        if (fieldIdx >= schema.fields.size() || !updated || schema.keySlots()[fieldIdx] >= 0) {
+            status = dto::K23SIStatus::BadParameter("field operation on a key field or a field which is not updated");
+            break;
+        }
+        const dto::SchemaField& field = schema.fields[fieldIdx];
+        if (fieldOp.op != dto::FieldOperation::CompareAndSet && !hasValue(request.value, fieldIdx)) {
+            status = dto::K23SIStatus::BadParameter(fmt::format("missing operand for field {}", field.name));
+            break;
+        }
+
+        Payload* latest = nullptr;
+        std::size_t latestIdx = _findField(latestSchema, field.name, field.type);
+        if (latestIdx != (std::size_t)-1 && hasValue(previous.value, latestIdx)) {
+            previous.value.fieldData.seek(previous.value.fieldOffsets[latestIdx]);
+            latest = &previous.value.fieldData;
+        }
+        Payload* expected = nullptr;
+        if (needsExpected && hasValue(request.expected, fieldIdx)) {
+            request.expected.fieldData.seek(request.expected.fieldOffsets[fieldIdx]);
+            expected = &request.expected.fieldData;
+        }
+        request.value.fieldData.seek(request.value.fieldOffsets[fieldIdx]);
+        K2_DTO_CAST_APPLY_FIELD_VALUE(_applyFieldOp, field, fieldOp.op, latest, expected, request.value.fieldData, status);
+        if (!status.is2xxOK()) {
+            break;
+        }
+    }
+
+    request.value.fieldData.seek(0);
+    previous.value.fieldData.seek(0);
+    return status;
 }
 
-bool K23SIPartitionModule::_isUpdatedField(uint32_t fieldIdx, std::vector<uint32_t> fieldsForPartialUpdate) {
-    for(std::size_t i = 0; i < fieldsForPartialUpdate.size(); ++i) {
-        if (fieldIdx == fieldsForPartialUpdate[i]) return true;
+bool K23SIPartitionModule::_makeFieldsForSameVersion(dto::Schema& schema, dto::K23SIWriteRequest& request,
+                                                     dto::DataRecord& version, const dto::FieldBitmap& updatedFields) {
+    // Each field of the new record comes whole from the request if it is updated, or from the base version
+    // otherwise, including whether it is excluded. With the field offsets of both records known, the unchanged
+    // fields are copied as byte ranges, and consecutive fields from the same record are copied in one range
+    if (!version.value.indexFields(schema) || !request.value.indexFields(schema)) {
+        return false;
     }
-    return false;
-}
+    dto::SKVRecord::Storage base = version.value.share();
+
+    const size_t numFields = schema.fields.size();
+    Payload payload(Payload::DefaultAllocator);     // payload for new record
+    dto::FieldBitmap excludedFields(numFields, false);
+    std::vector<uint32_t> fieldOffsets;
+    fieldOffsets.reserve(numFields);
+
+    dto::SKVRecord::Storage* runSource = nullptr;   // the record of the range being copied
+    size_t runStart = 0;
+    size_t runEnd = 0;
+    auto copyRun = [&payload, &runSource, &runStart, &runEnd] () {
+        if (runSource == nullptr || runEnd == runStart) {
+            return true;
+        }
+        runSource->fieldData.seek(runStart);
+        return payload.copyFromPayload(runSource->fieldData, runEnd - runStart);
+    };
 
-bool K23SIPartitionModule::_makeFieldsForSameVersion(dto::Schema& schema, dto::K23SIWriteRequest& request, dto::DataRecord& version) {
-    Payload basePayload = version.value.fieldData.shareAll();   // base payload
-    Payload payload(Payload::DefaultAllocator);                     // payload for new record
+    for (size_t i = 0; i < numFields; ++i) {
+        dto::SKVRecord::Storage& source = updatedFields[i] ? request.value : base;
+        fieldOffsets.push_back(payload.getCurrentPosition().offset + (runEnd - runStart));
+        if (!source.excludedFields.empty() && source.excludedFields[i]) {
+            excludedFields[i] = true;
+            continue;
+        }
 
-    for (std::size_t i = 0; i < schema.fields.size(); ++i) {
-        if (_isUpdatedField(i, request.fieldsForPartialUpdate)) {
-            // this field is updated
-            if (request.value.excludedFields[i] == 0 &&
-                    (version.value.excludedFields.empty() || version.value.excludedFields[i] == 0)) {
-                // Request's payload has new value, AND
-                // base payload also has this field (empty()==true indicate that base payload contains every fields).
-                // Then use 'req' payload, at the mean time _advancePosition of base payload.
-                bool success = false;
-                K2_DTO_CAST_APPLY_FIELD_VALUE(_copyPayloadBaseToUpdate, schema.fields[i], request.value.fieldData, payload, success);
-                if (!success) return false;
-                K2_DTO_CAST_APPLY_FIELD_VALUE(_advancePayloadPosition, schema.fields[i], basePayload, success);
-                if (!success) return false;
-            } else if (request.value.excludedFields[i] == 0 &&
-                    (!version.value.excludedFields.empty() && version.value.excludedFields[i] == 1)) {
-                // Request's payload has new value, AND
-                // base payload skipped this field.
-                // Then use 'req' value, do not _advancePosition of base payload.
-                bool success = false;
-                K2_DTO_CAST_APPLY_FIELD_VALUE(_copyPayloadBaseToUpdate, schema.fields[i], request.value.fieldData, payload, success);
-                if (!success) return false;
-            } else if (request.value.excludedFields[i] == 1 &&
-                    (version.value.excludedFields.empty() || version.value.excludedFields[i] == 0)) {
-                // Request's payload skipped this value(means the field is updated to NULL), AND
-                // base payload has this field.
-                // Then exclude this field, at the mean time _advancePosition of base payload.
-                request.value.excludedFields[i] = true;
-                bool success = false;
-                K2_DTO_CAST_APPLY_FIELD_VALUE(_advancePayloadPosition, schema.fields[i], basePayload, success);
-                if (!success) return false;
-            } else {
-                // Request's payload skipped this value, AND base payload also skipped this field.
-                // set excludedFields[i]
-                request.value.excludedFields[i] = true;
-            }
-        } else {
-            // this field is NOT updated
-            if (request.value.excludedFields[i] == 0 &&
-                    (version.value.excludedFields.empty() || version.value.excludedFields[i] == 0)) {
-                // Request's payload contains this field, AND
-                // base SKVRecord also has value of this field.
-                // copy 'base skvRecord' value, at the mean time _advancePosition of 'req' payload.
-                bool success = false;
-                K2_DTO_CAST_APPLY_FIELD_VALUE(_copyPayloadBaseToUpdate, schema.fields[i], basePayload, payload, success);
-                if (!success) return false;
-                K2_DTO_CAST_APPLY_FIELD_VALUE(_advancePayloadPosition, schema.fields[i], request.value.fieldData, success);
-                if (!success) return false;
-            } else if (request.value.excludedFields[i] == 0 &&
-                    (!version.value.excludedFields.empty() && version.value.excludedFields[i] == 1)) {
-                // Request's payload contains this field, AND
-                // base SKVRecord do NOT has this field.
-                // skip this field, at the mean time _advancePosition of 'req' payload.
-                request.value.excludedFields[i] = true;
-                bool success;
-                K2_DTO_CAST_APPLY_FIELD_VALUE(_advancePayloadPosition, schema.fields[i], request.value.fieldData, success);
-                if (!success) return false;
-            } else if (request.value.excludedFields[i] == 1 &&
-                    (version.value.excludedFields.empty() || version.value.excludedFields[i] == 0)) {
-                // Request's payload do NOT contain this field, AND
-                // base SKVRecord has value of this field.
-                // copy 'base skvRecord' value.
-                bool success = false;
-                K2_DTO_CAST_APPLY_FIELD_VALUE(_copyPayloadBaseToUpdate, schema.fields[i], basePayload, payload, success);
-                if (!success) return false;
-                request.value.excludedFields[i] = false;
-            } else {
-                // else, request payload skipped this field, AND base SKVRecord also skipped this field,
-                // set excludedFields[i]
-                request.value.excludedFields[i] = true;
-            }
+        size_t start = source.fieldOffsets[i];
+        size_t end = i + 1 < numFields ? source.fieldOffsets[i + 1] : source.fieldData.getSize();
+        if (runSource == &source && runEnd == start) {
+            runEnd = end;
+            continue;
+        }
+        if (!copyRun()) {
+            return false;
         }
+        runSource = &source;
+        runStart = start;
+        runEnd = end;
+    }
+    if (!copyRun()) {
+        return false;
     }
 
     request.value.fieldData = std::move(payload);
     request.value.fieldData.truncateToCurrent();
+    request.value.excludedFields = std::move(excludedFields);
+    request.value.fieldOffsets = std::move(fieldOffsets);
     return true;
 }
 
-bool K23SIPartitionModule::_makeFieldsForDiffVersion(dto::Schema& schema, dto::Schema& baseSchema, dto::K23SIWriteRequest& request, dto::DataRecord& version) {
+bool K23SIPartitionModule::_makeFieldsForDiffVersion(dto::Schema& schema, dto::Schema& baseSchema, dto::K23SIWriteRequest& request,
+                                                     dto::DataRecord& version, const dto::FieldBitmap& updatedFields) {
     std::size_t findField; // find field index of base SKVRecord
     std::vector<uint32_t> fieldsOffset(1); // every fields offset of base SKVRecord
     std::size_t baseCursor = 0; // indicate fieldsOffset cursor
@@ -669,7 +3125,7 @@ bool K23SIPartitionModule::_makeFieldsForDiffVersion(dto::Schema& schema, dto::S
     // make every fields in schema for new full-record-WI
     for (std::size_t i = 0; i < schema.fields.size(); ++i) {
         findField = -1;
-        if (!_isUpdatedField(i, request.fieldsForPartialUpdate)) {
+        if (!updatedFields[i]) {
             // if this field is NOT updated, payload value comes from base SKVRecord.
             findField = _findField(baseSchema, schema.fields[i].name, schema.fields[i].type);
             if (findField == (std::size_t)-1) {
@@ -746,36 +3202,44 @@ bool K23SIPartitionModule::_makeFieldsForDiffVersion(dto::Schema& schema, dto::S
     }
 
     request.value.fieldData = std::move(payload);
+    request.value.fieldOffsets.clear();
     request.value.fieldData.truncateToCurrent();
     return true;
 }
 
-bool K23SIPartitionModule::_parsePartialRecord(dto::K23SIWriteRequest& request, dto::DataRecord& previous) {
+bool K23SIPartitionModule::_parsePartialRecord(dto::K23SIWriteRequest& request, const SchemaVersionsT& schemaVersions,
+                                               dto::DataRecord& previous) {
     // We already know the schema version exists because it is validated at the begin of handleWrite
-    auto schemaIt = _schemas.find(request.key.schemaName);
-    auto schemaVer = schemaIt->second.find(request.value.schemaVersion);
+    auto schemaVer = schemaVersions.find(request.value.schemaVersion);
     dto::Schema& schema = *(schemaVer->second);
 
     if (!request.value.excludedFields.size()) {
-        request.value.excludedFields = std::vector<bool>(schema.fields.size(), false);
+        request.value.excludedFields = dto::FieldBitmap(schema.fields.size(), false);
+    }
+
+    dto::FieldBitmap updatedFields(schema.fields.size(), false);
+    for (uint32_t fieldIdx : request.fieldsForPartialUpdate) {
+        if (fieldIdx < schema.fields.size()) {
+            updatedFields[fieldIdx] = true;
+        }
     }
 
     // based on the latest version to construct the new SKVRecord
     if (request.value.schemaVersion == previous.value.schemaVersion) {
         // quick path --same schema version.
         // make every fields in schema for new SKVRecord
-        if(!_makeFieldsForSameVersion(schema, request, previous)) {
+        if(!_makeFieldsForSameVersion(schema, request, previous, updatedFields)) {
             return false;
         }
     } else {
         // slow path --different schema version.
-        auto latestSchemaVer = schemaIt->second.find(previous.value.schemaVersion);
-        if (latestSchemaVer == schemaIt->second.end()) {
+        auto latestSchemaVer = schemaVersions.find(previous.value.schemaVersion);
+        if (latestSchemaVer == schemaVersions.end()) {
             return false;
         }
         dto::Schema& baseSchema = *(latestSchemaVer->second);
 
-        if (!_makeFieldsForDiffVersion(schema, baseSchema, request, previous)) {
+        if (!_makeFieldsForDiffVersion(schema, baseSchema, request, previous, updatedFields)) {
             return false;
         }
     }
@@ -783,23 +3247,66 @@ bool K23SIPartitionModule::_parsePartialRecord(dto::K23SIWriteRequest& request,
     return true;
 }
 
-bool K23SIPartitionModule::_makeProjection(dto::SKVRecord::Storage& fullRec, dto::K23SIQueryRequest& request,
-        dto::SKVRecord::Storage& projectionRec) {
-    auto schemaIt = _schemas.find(request.key.schemaName);
-    auto schemaVer = schemaIt->second.find(fullRec.schemaVersion);
+bool K23SIPartitionModule::_makeProjection(dto::SKVRecord::Storage& fullRec, const std::vector<String>& projection,
+        const SchemaVersionsT& schemaVersions, dto::SKVRecord::Storage& projectionRec) {
+    auto schemaVer = schemaVersions.find(fullRec.schemaVersion);
     dto::Schema& schema = *(schemaVer->second);
-    std::vector<bool> excludedFields(schema.fields.size(), true);   // excludedFields for projection
-    Payload projectedPayload(Payload::DefaultAllocator);            // payload for projection
+    dto::FieldBitmap excludedFields(schema.fields.size(), true);   // excludedFields for projection
+    // the projected fields, resolved once rather than searched for each field
+    std::vector<bool> projected(schema.fields.size(), false);
+    for (const String& name : projection) {
+        int32_t idx = schema.fieldIndex(name);
+        if (idx >= 0) {
+            projected[idx] = true;
+        }
+    }
+
+    if (fullRec.fieldOffsets.size() == schema.fields.size()) {
+        // The field offsets tell us where each field's bytes are, so the projection can share them with the
+        // stored record instead of copying. Adjacent projected fields are shared as one region
+        Payload projectedPayload;
+        size_t regionStart = 0;
+        size_t regionEnd = 0;
+        auto shareRegion = [&] {
+            if (regionEnd > regionStart) {
+                for (auto& buf : fullRec.fieldData.shareRegion(regionStart, regionEnd - regionStart).release()) {
+                    projectedPayload.appendBinary(std::move(buf));
+                }
+            }
+        };
+        for (uint32_t i = 0; i < schema.fields.size(); ++i) {
+            if (fullRec.excludedFields.size() && fullRec.excludedFields[i]) {
+                // excluded fields take no space in the payload so they don't break up a region
+                continue;
+            }
+            if (!projected[i]) {
+                continue;
+            }
+            size_t start = fullRec.fieldOffsets[i];
+            size_t end = i + 1 < schema.fields.size() ? fullRec.fieldOffsets[i + 1] : fullRec.fieldData.getSize();
+            if (start != regionEnd) {
+                shareRegion();
+                regionStart = start;
+            }
+            regionEnd = end;
+            excludedFields[i] = false;
+        }
+        shareRegion();
 
+        projectionRec.excludedFields = std::move(excludedFields);
+        projectionRec.fieldData = std::move(projectedPayload);
+        projectionRec.schemaVersion = fullRec.schemaVersion;
+        return true;
+    }
+
+    Payload projectedPayload(Payload::DefaultAllocator);            // payload for projection
     for (uint32_t i = 0; i < schema.fields.size(); ++i) {
         if (fullRec.excludedFields.size() && fullRec.excludedFields[i]) {
             // A value of NULL in the record is treated the same as if the field doesn't exist in the record
             continue;
         }
 
-        std::vector<k2::String>::iterator fieldIt;
-        fieldIt = std::find(request.projection.begin(), request.projection.end(), schema.fields[i].name);
-        if (fieldIt == request.projection.end()) {
+        if (!projected[i]) {
             // advance base payload
             bool success = false;
             K2_DTO_CAST_APPLY_FIELD_VALUE(_advancePayloadPosition, schema.fields[i], fullRec.fieldData,
@@ -835,6 +3342,348 @@ bool K23SIPartitionModule::_makeProjection(dto::SKVRecord::Storage& fullRec, dto
 
 seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
 K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest&& request, FastDeadline deadline) {
+    return _handleWrite(std::move(request), deadline, nullptr);
+}
+
+seastar::future<std::tuple<Status, dto::K23SIWriteMultiResponse>>
+K23SIPartitionModule::handleWriteMulti(dto::K23SIWriteMultiRequest&& request, FastDeadline deadline) {
+    K2LOG_D(log::skvsvr, "Partition: {}, handle write multi: {}", _partition, request);
+    if (!_validateRequestPartition(request)) {
+        // tell client their collection partition is gone
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in write multi"), dto::K23SIWriteMultiResponse{});
+    }
+    auto batch = _persistence.newBatch();
+    if (!batch) {
+        return RPCResponse(dto::K23SIStatus::InternalError("persistence not available"), dto::K23SIWriteMultiResponse{});
+    }
+
+    return seastar::do_with(std::move(request), std::move(batch), dto::K23SIWriteMultiResponse{},
+        [this, deadline] (auto& request, auto& batch, auto& response) {
+        response.statuses.reserve(request.writes.size());
+        return seastar::do_for_each(request.writes, [this, &request, &batch, &response, deadline] (auto& write) {
+            if (!_partition.owns(write.key)) {
+                // the client should retry this write against the correct partition
+                response.statuses.push_back(dto::K23SIStatus::RefreshCollection("key not owned by partition in write multi"));
+                return seastar::make_ready_future();
+            }
+            write.pvid = request.pvid;
+            write.collectionName = request.collectionName;
+            write.mtr = request.mtr;
+            return _handleWrite(std::move(write), deadline, batch.get())
+                .then([&response] (auto&& result) {
+                    response.statuses.push_back(std::move(std::get<0>(result)));
+                });
+        })
+        .then([this, &batch, &response, deadline] {
+            if (batch->getSize() == 0) {
+                // no WIs were created
+                return RPCResponse(dto::K23SIStatus::OK("write multi processed"), std::move(response));
+            }
+            // persist all WIs from the batch with a single call
+            return SlowLog::timed(&SlowOp::persistence, _persistence.flush(std::move(*batch), deadline)).then([&response] {
+                return RPCResponse(dto::K23SIStatus::OK("write multi processed"), std::move(response));
+            });
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIBulkIngestResponse>>
+K23SIPartitionModule::handleBulkIngest(dto::K23SIBulkIngestRequest&& request, FastDeadline deadline) {
+    K2LOG_D(log::skvsvr, "Partition: {}, handle bulk ingest: {}", _partition, request);
+    if (!_validateRequestPartition(request)) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in bulk ingest"), dto::K23SIBulkIngestResponse{});
+    }
+    if (!_cmeta.bulkLoad) {
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("bulk ingest into a collection which is not loading"), dto::K23SIBulkIngestResponse{});
+    }
+    if (request.timestamp.compareCertain(_retentionTimestamp) < 0 || request.timestamp.compareCertain(_snapshotHorizon) <= 0) {
+        return RPCResponse(dto::K23SIStatus::AbortRequestTooOld("bulk ingest timestamp is too old"), dto::K23SIBulkIngestResponse{});
+    }
+    // validate the whole batch before installing any of it
+    for (size_t i = 0; i < request.records.size(); ++i) {
+        auto& rec = request.records[i];
+        if (rec.key.partitionKey.empty() || (i > 0 && !(request.records[i - 1].key < rec.key))) {
+            return RPCResponse(dto::K23SIStatus::BadParameter("bulk ingest records must have distinct sorted keys"), dto::K23SIBulkIngestResponse{});
+        }
+        if (!_partition.owns(rec.key)) {
+            return RPCResponse(dto::K23SIStatus::BadParameter("bulk ingest record not owned by partition"), dto::K23SIBulkIngestResponse{});
+        }
+        uint32_t schemaId = _findSchemaId(rec.key.schemaName);
+        if (schemaId == SchemaIndexer::NoSchemaId) {
+            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("schema does not exist"), dto::K23SIBulkIngestResponse{});
+        }
+        if (request.timestamp.compareCertain(_readCache->checkInterval(rec.key, rec.key)) < 0 ||
+            request.timestamp.compareCertain(_snapshotReadCache->checkInterval(rec.key, rec.key)) <= 0) {
+            return RPCResponse(dto::K23SIStatus::AbortRequestTooOld("bulk ingest of a key which was read after the timestamp"), dto::K23SIBulkIngestResponse{});
+        }
+        auto* versions = _findVersions(schemaId, rec.key);
+        if (versions && versions->size() > 0 && ((*versions)[0].status == dto::DataRecord::WriteIntent ||
+                (*versions)[0].txnId.mtr.timestamp.compareCertain(request.timestamp) >= 0)) {
+            return RPCResponse(dto::K23SIStatus::AbortRequestTooOld("bulk ingest of a key with a WI or a newer version"), dto::K23SIBulkIngestResponse{});
+        }
+    }
+    auto batch = _persistence.newBatch();
+    if (!batch) {
+        return RPCResponse(dto::K23SIStatus::InternalError("persistence not available"), dto::K23SIBulkIngestResponse{});
+    }
+    // all records are persisted with one append, and only become visible once they are durable
+    std::vector<dto::DataRecord> records;
+    records.reserve(request.records.size());
+    for (auto& ingest : request.records) {
+        dto::DataRecord rec;
+        rec.key = std::move(ingest.key);
+        rec.value = std::move(ingest.value);
+        rec.txnId.mtr.timestamp = request.timestamp;
+        rec.status = dto::DataRecord::Committed;
+        rec.ttl = _schemaTTL(_schemas[_findSchemaId(rec.key.schemaName)], rec.value.schemaVersion);
+        Persistence::append(*batch, rec);
+        records.push_back(std::move(rec));
+    }
+    auto flushFut = records.empty() ? seastar::make_ready_future() : _persistence.flush(std::move(*batch), deadline);
+    // the records commit once they are durable, so the change streams can't go past them meanwhile
+    _changesHeld.push_back(request.timestamp);
+    return SlowLog::timed(&SlowOp::persistence, std::move(flushFut))
+    .finally([this, timestamp=request.timestamp] {
+        auto it = std::find_if(_changesHeld.begin(), _changesHeld.end(), [&timestamp] (const dto::Timestamp& held) {
+            return held.compareCertain(timestamp) == dto::Timestamp::EQ;
+        });
+        _changesHeld.erase(it);
+    })
+    .then([this, records=std::move(records)] () mutable {
+        dto::K23SIBulkIngestResponse response;
+        for (auto& rec : records) {
+            auto& versions = _indexer.getOrCreateVersions(rec.key);
+            if (versions.size() > 0 && (versions[0].status == dto::DataRecord::WriteIntent ||
+                    versions[0].txnId.mtr.timestamp.compareCertain(rec.txnId.mtr.timestamp) >= 0)) {
+                // a transaction wrote the key while we were persisting
+                continue;
+            }
+            rec.value = _arena.copy(rec.value);
+            _recordChange(rec.key, rec);
+            // the key is owned by the indexer
+            rec.key = dto::Key{};
+            versions.push_front(std::move(rec));
+            response.ingested++;
+        }
+        _bulkIngestedRecords += response.ingested;
+        return RPCResponse(dto::K23SIStatus::OK("bulk ingest succeeded"), std::move(response));
+    });
+}
+
+seastar::future<> K23SIPartitionModule::_startChanges() {
+    if (_config.changesRetained() == 0) {
+        return seastar::make_ready_future();
+    }
+    return getTimeNow()
+    .then([this] (dto::Timestamp&& now) {
+        _changesStart = now;
+        _changesResolved = now;
+    })
+    .handle_exception([this] (auto exc) {
+        // the changes aren't recorded, and the polls are refused
+        K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, unable to start the change stream", _partition);
+    });
+}
+
+void K23SIPartitionModule::_recordChange(const dto::Key& key, dto::DataRecord& rec) {
+    // a commit at or below the resolved watermark can only be a WI from before the change log started
+    if (!_changesStart || _config.changesRetained() == 0 ||
+        rec.txnId.mtr.timestamp.compareCertain(_changesResolved) <= 0) {
+        return;
+    }
+    _changesPending.push_back(dto::K23SIChange{.key=key, .endKey={}, .timestamp=rec.txnId.mtr.timestamp,
+                                               .isTombstone=rec.isTombstone,
+                                               .value=rec.isTombstone ? dto::SKVRecord::Storage{} : rec.value.share()});
+    _changesRecorded++;
+}
+
+std::optional<dto::Timestamp> K23SIPartitionModule::_oldestPendingWrite() const {
+    const dto::Timestamp* oldest = nullptr;
+    for (auto& [mtr, keys] : _wiIndex) {
+        if (!oldest || mtr.timestamp.compareCertain(*oldest) < 0) {
+            oldest = &mtr.timestamp;
+        }
+    }
+    for (auto& held : _changesHeld) {
+        if (!oldest || held.compareCertain(*oldest) < 0) {
+            oldest = &held;
+        }
+    }
+    if (!oldest) {
+        return std::nullopt;
+    }
+    return *oldest;
+}
+
+void K23SIPartitionModule::_resolveChanges() {
+    auto oldest = _oldestPendingWrite();
+    dto::Timestamp watermark = _snapshotHorizon;
+    if (oldest && oldest->compareCertain(watermark) <= 0) {
+        watermark = *oldest - 1ns;
+    }
+    if (watermark.compareCertain(_changesResolved) <= 0) {
+        return;
+    }
+    _changesResolved = watermark;
+
+    // the pending changes the watermark passed all come after the ones in the log
+    auto resolved = std::stable_partition(_changesPending.begin(), _changesPending.end(), [this] (const dto::K23SIChange& change) {
+        return change.timestamp.compareCertain(_changesResolved) <= 0;
+    });
+    std::stable_sort(_changesPending.begin(), resolved, [] (const dto::K23SIChange& a, const dto::K23SIChange& b) {
+        return a.timestamp.compareCertain(b.timestamp) < 0;
+    });
+    std::move(_changesPending.begin(), resolved, std::back_inserter(_changes));
+    _changesPending.erase(_changesPending.begin(), resolved);
+
+    while (_changes.size() > _config.changesRetained()) {
+        _changesStart = _changes.front().timestamp;
+        _changes.pop_front();
+    }
+}
+
+seastar::future<std::tuple<Status, dto::K23SIChangesResponse>>
+K23SIPartitionModule::handleChanges(dto::K23SIChangesRequest&& request) {
+    K2LOG_D(log::skvsvr, "Partition: {}, handle changes: {}", _partition, request);
+    if (!_validateRequestPartition(request) || !_partition.owns(request.key)) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in changes"), dto::K23SIChangesResponse{});
+    }
+    if (_follower || _config.changesRetained() == 0) {
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("change streams are not served by this partition"), dto::K23SIChangesResponse{});
+    }
+    _changePolls++;
+    FastDeadline deadline(std::min(request.wait, _config.changesMaxWait()));
+    return seastar::do_with(std::move(request), dto::K23SIChangesResponse{}, [this, deadline] (auto& request, auto& response) {
+        return seastar::repeat([this, deadline, &request, &response] {
+            if (!_changesStart || request.fromTimestamp.compareCertain(*_changesStart) < 0) {
+                // checked again after each wait, since the log may have been trimmed meanwhile
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            return getTimeNow()
+            .then([this, deadline, &request, &response] (dto::Timestamp&& now) {
+                // A poll closes the same timestamp as a snapshot read at the stalest time allowed, so that the changes
+                // up to it resolve. Snapshot reads have to be at least that stale anyway
+                auto closed = now - _config.snapshotReadMinStaleness();
+                if (closed.compareCertain(_snapshotHorizon) > 0) {
+                    _snapshotHorizon = closed;
+                }
+                _resolveChanges();
+
+                auto it = std::partition_point(_changes.begin(), _changes.end(), [&request] (const dto::K23SIChange& change) {
+                    return change.timestamp.compareCertain(request.fromTimestamp) <= 0;
+                });
+                // the changes of one timestamp are never split between responses, so that the next poll can
+                // continue from the timestamp of the last change
+                for (; it != _changes.end(); ++it) {
+                    if (!response.changes.empty() && response.changes.size() >= request.maxChanges &&
+                        it->timestamp.compareCertain(response.changes.back().timestamp) != dto::Timestamp::EQ) {
+                        break;
+                    }
+                    response.changes.push_back(dto::K23SIChange{.key=it->key, .endKey=it->endKey,
+                        .timestamp=it->timestamp, .isTombstone=it->isTombstone, .value=it->value.share()});
+                }
+                if (it != _changes.end()) {
+                    // stopped at maxChanges
+                    response.resolved = response.changes.back().timestamp;
+                }
+                else {
+                    response.resolved = _changesResolved.compareCertain(request.fromTimestamp) > 0 ? _changesResolved : request.fromTimestamp;
+                }
+                if (!response.changes.empty() || deadline.isOver()) {
+                    return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                }
+                return seastar::sleep(std::min(_config.changesPollInterval(), deadline.getRemaining()))
+                    .then([] { return seastar::stop_iteration::no; });
+            });
+        })
+        .then([this, &request, &response] {
+            if (!_changesStart || request.fromTimestamp.compareCertain(*_changesStart) < 0) {
+                return RPCResponse(dto::K23SIStatus::AbortRequestTooOld("the changes after the timestamp are no longer retained"), dto::K23SIChangesResponse{});
+            }
+            if (_cmeta.hashScheme == dto::HashScheme::Range && _partition().endKey != "") {
+                response.nextKey = dto::Key{request.key.schemaName, _partition().endKey, ""};
+            }
+            return RPCResponse(dto::K23SIStatus::OK("changes returned"), std::move(response));
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIRangeDeleteResponse>>
+K23SIPartitionModule::handleRangeDelete(dto::K23SIRangeDeleteRequest&& request, FastDeadline deadline) {
+    K2LOG_D(log::skvsvr, "Partition: {}, handle range delete: {}", _partition, request);
+    if (!_validateRequestPartition(request) || !_partition.owns(request.key)) {
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in range delete"), dto::K23SIRangeDeleteResponse{});
+    }
+    if (_cmeta.hashScheme != dto::HashScheme::Range) {
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("range delete in a hash partitioned collection"), dto::K23SIRangeDeleteResponse{});
+    }
+    bool toEnd = request.endKey.partitionKey.empty();
+    if (!toEnd && (request.endKey.schemaName != request.key.schemaName || !(request.key < request.endKey))) {
+        return RPCResponse(dto::K23SIStatus::BadParameter("range delete needs a non-empty range in one schema"), dto::K23SIRangeDeleteResponse{});
+    }
+    uint32_t schemaId = _findSchemaId(request.key.schemaName);
+    if (schemaId == SchemaIndexer::NoSchemaId) {
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("schema does not exist"), dto::K23SIRangeDeleteResponse{});
+    }
+    if (request.timestamp.compareCertain(_retentionTimestamp) < 0 || request.timestamp.compareCertain(_snapshotHorizon) <= 0) {
+        return RPCResponse(dto::K23SIStatus::AbortRequestTooOld("range delete timestamp is too old"), dto::K23SIRangeDeleteResponse{});
+    }
+    auto covers = [&request, toEnd] (const dto::Key& key) {
+        return key.schemaName == request.key.schemaName && !(key < request.key) && (toEnd || key < request.endKey);
+    };
+    // a WI not newer than the delete would end up under its tombstone. There are few WIs compared to the keys of a range
+    for (auto& [mtr, keys] : _wiIndex) {
+        if (mtr.timestamp.compareCertain(request.timestamp) > 0) {
+            continue;
+        }
+        for (auto& key : keys) {
+            if (covers(key)) {
+                return RPCResponse(dto::K23SIStatus::AbortConflict("range delete over a WI"), dto::K23SIRangeDeleteResponse{});
+            }
+        }
+    }
+    // reads of keys we don't have see the same with and without the delete, so only the existing keys of the range
+    // need to be checked against the read cache
+    IndexerT& index = _indexer.at(schemaId);
+    auto first = index.lower_bound(request.key);
+    auto last = toEnd ? index.end() : index.lower_bound(request.endKey);
+    if (first != last) {
+        --last;
+        if (request.timestamp.compareCertain(_readCache->checkInterval(first->first, last->first)) < 0 ||
+            request.timestamp.compareCertain(_snapshotReadCache->checkInterval(first->first, last->first)) <= 0) {
+            return RPCResponse(dto::K23SIStatus::AbortRequestTooOld("range delete of keys which were read after the timestamp"), dto::K23SIRangeDeleteResponse{});
+        }
+    }
+
+    dto::K23SIRangeDeleteResponse response;
+    if (_partition().endKey != "" && (toEnd || _partition().endKey < request.endKey.partitionKey)) {
+        // the range continues in the next partition
+        response.nextKey = dto::Key{request.key.schemaName, _partition().endKey, ""};
+    }
+    // The tombstone is active right away, so that no write can go under it while we persist. Unlike single key
+    // erases we can't undo it if the persistence fails, so the client has to consider the range deleted
+    dto::K23SI_PersistenceRangeTombstone range{.key=std::move(request.key), .endKey=std::move(request.endKey),
+                                               .timestamp=request.timestamp};
+    _rangeTombstones.push_back(range);
+    _rangeDeletes++;
+    if (_changesStart && _config.changesRetained() > 0) {
+        _changesPending.push_back(dto::K23SIChange{.key=range.key, .endKey=range.endKey, .timestamp=range.timestamp,
+                                                   .isTombstone=true});
+        _changesRecorded++;
+    }
+    return SlowLog::timed(&SlowOp::persistence, _persistence.makeCall(range, deadline))
+    .then_wrapped([this, response=std::move(response)] (auto&& fut) mutable {
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::skvsvr, fut.get_exception(), "Partition: {}, failed to persist range delete", _partition);
+            return RPCResponse(dto::K23SIStatus::InternalError("range delete may not be durable"), dto::K23SIRangeDeleteResponse{});
+        }
+        fut.ignore_ready_future();
+        return RPCResponse(dto::K23SIStatus::OK("range delete succeeded"), std::move(response));
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
+K23SIPartitionModule::_handleWrite(dto::K23SIWriteRequest&& request, FastDeadline deadline, Payload* batch) {
     // NB: failures in processing a write do not require that we set the TR state to aborted at the TRH. We rely on
     //     the client to do the correct thing and issue an abort on a failure.
     K2LOG_D(log::skvsvr, "Partition: {}, handle write: {}", _partition, request);
@@ -848,11 +3697,12 @@ K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest&& request, FastDeadline
         return RPCResponse(dto::K23SIStatus::BadParameter("missing partition key in write"), dto::K23SIWriteResponse{});
     }
 
-    auto schemaIt = _schemas.find(request.key.schemaName);
-    if (schemaIt == _schemas.end()) {
+    uint32_t schemaId = _findSchemaId(request.key.schemaName);
+    if (schemaId == SchemaIndexer::NoSchemaId) {
         return RPCResponse(dto::K23SIStatus::OperationNotAllowed("schema does not exist"), dto::K23SIWriteResponse{});
     }
-    if (schemaIt->second.find(request.value.schemaVersion) == schemaIt->second.end()) {
+    const SchemaVersionsT& schemaVersions = _schemas[schemaId];
+    if (schemaVersions.find(request.value.schemaVersion) == schemaVersions.end()) {
         // server does not have schema
         return RPCResponse(dto::K23SIStatus::OperationNotAllowed("schema does not exist"), dto::K23SIWriteResponse{});
     }
@@ -862,11 +3712,11 @@ K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest&& request, FastDeadline
     // of such failure, the client is expected to come in and end the transaction with Abort
     if (request.designateTRH) {
         K2LOG_D(log::skvsvr, "Partition: {}, designating trh for key {}", _partition, request.key);
-        return _txnMgr.onAction(TxnRecord::Action::onCreate, {.trh=request.trh, .mtr=request.mtr})
-        .then([this, request=std::move(request), deadline]() mutable {
+        return _txnMgr.onAction(TxnRecord::Action::onCreate, {.trh=request.trh, .mtr=request.mtr}, request.trhHeartbeatDeadline)
+        .then([this, request=std::move(request), deadline, batch]() mutable {
             K2LOG_D(log::skvsvr, "Partition: {}, tr created and re-driving request for key {}", _partition, request.key);
             request.designateTRH = false; // unset the flag and re-run
-            return handleWrite(std::move(request), deadline);
+            return _handleWrite(std::move(request), deadline, batch);
         })
         .handle_exception_type([this](TxnManager::ClientError&) {
             // Failed to create
@@ -875,7 +3725,8 @@ K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest&& request, FastDeadline
         });
     }
 
-    auto& versions = _indexer[request.key];
+    auto& versions = _indexer.getOrCreateVersions(schemaId, request.key);
+    _applyRangeTombstones(request.key, versions);
     // in this situation, return AbortRequestTooOld error.
     {
         Status validateStatus = _validateStaleWrite(request, versions);
@@ -895,11 +3746,11 @@ K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest&& request, FastDeadline
             // this is a write request finding a WI from a different transaction. Do a push with the remaining
             // deadline time.
             K2LOG_D(log::skvsvr, "Partition: {}, different WI found for key {}", _partition, request.key);
-            return _doPush(request.collectionName, rec.key, rec.txnId, request.mtr, deadline)
-                .then([this, request = std::move(request), deadline](auto&& retryChallenger) mutable {
+            return _doPush(request.collectionName, request.key, rec.txnId, request.mtr, deadline)
+                .then([this, request = std::move(request), deadline, batch](auto&& retryChallenger) mutable {
                     if (retryChallenger) {
                         K2LOG_D(log::skvsvr, "Partition: {}, write push retry for key {}", _partition, request.key);
-                        return handleWrite(std::move(request), deadline);
+                        return _handleWrite(std::move(request), deadline, batch);
                     }
                     // challenger must fail
                     K2LOG_D(log::skvsvr, "Partition: {}, write push challenger lost for key {}", _partition, request.key);
@@ -908,7 +3759,7 @@ K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest&& request, FastDeadline
         }
     }
 
-    if (request.rejectIfExists && versions.size() > 0 && !versions[0].isTombstone) {
+    if (request.rejectIfExists && versions.size() > 0 && !versions[0].isDeletedAt(request.mtr.timestamp)) {
         // Need to add to read cache to prevent an erase coming in before this requests timestamp
         // If the condition passes (ie, there was no previous version and the insert succeeds) then
         // we do not need to insert into the read cache because the write intent will handle conflicts
@@ -921,13 +3772,43 @@ K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest&& request, FastDeadline
         return RPCResponse(dto::K23SIStatus::ConditionFailed("Previous record exists"), dto::K23SIWriteResponse{});
     }
 
+    if (request.condition.op != dto::expression::Operation::UNKNOWN) {
+        auto condStatus = _checkWriteCondition(request, schemaVersions, versions);
+        if (condStatus == dto::K23SIStatus::ConditionFailed) {
+            // as with rejectIfExists, the failed condition observed the latest version and the write doesn't
+            // place a WI to protect it
+            _readCache->insertInterval(request.key, request.key, request.mtr.timestamp);
+            _conditionalWriteRejects++;
+        }
+        if (!condStatus.is2xxOK()) {
+            return RPCResponse(std::move(condStatus), dto::K23SIWriteResponse{});
+        }
+    }
+
+    if (!request.fieldOps.empty() && (request.fieldsForPartialUpdate.empty() || request.isDelete)) {
+        return RPCResponse(dto::K23SIStatus::BadParameter("field operations need a partial update"), dto::K23SIWriteResponse{});
+    }
+
     if (request.fieldsForPartialUpdate.size() > 0) {
         // parse the partial record to full record
-        if ( !versions.size() || versions[0].isTombstone) {
+        if ( !versions.size() || versions[0].isDeletedAt(request.mtr.timestamp)) {
             // cannot parse partial record without a version
             return RPCResponse(dto::K23SIStatus::KeyNotFound("can not partial update with no/deleted version"), dto::K23SIWriteResponse{});
         }
-        if (!_parsePartialRecord(request, versions[0])) {
+        if (!request.fieldOps.empty()) {
+            auto opStatus = _applyFieldOps(request, schemaVersions, versions[0]);
+            if (opStatus == dto::K23SIStatus::ConditionFailed) {
+                // as with rejectIfExists, the failed condition observed the latest version and the write
+                // doesn't place a WI to protect it
+                _readCache->insertInterval(request.key, request.key, request.mtr.timestamp);
+            }
+            if (!opStatus.is2xxOK()) {
+                K2LOG_D(log::skvsvr, "Partition: {}, field operations failed for key {}: {}", _partition, request.key, opStatus);
+                return RPCResponse(std::move(opStatus), dto::K23SIWriteResponse{});
+            }
+            _fieldOps += request.fieldOps.size();
+        }
+        if (!_parsePartialRecord(request, schemaVersions, versions[0])) {
             K2LOG_D(log::skvsvr, "Partition: {}, can not parse partial record for key {}", _partition, request.key);
             versions[0].value.fieldData.seek(0);
             return RPCResponse(dto::K23SIStatus::BadParameter("missing fields or can not interpret partialUpdate"), dto::K23SIWriteResponse{});
@@ -939,10 +3820,27 @@ K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest&& request, FastDeadline
         versions.pop_front();
     }
 
-    // all checks passed - we're ready to place this WI as the latest version(at head of versions deque)
-    return _createWI(std::move(request), versions, deadline).then([this]() mutable {
+    if (request.ttl == Duration(0) && !request.isDelete) {
+        request.ttl = _schemaTTL(schemaVersions, request.value.schemaVersion);
+    }
+
+    // all checks passed - we're ready to place this WI as the latest version(at head of versions chain)
+    dto::K23SIWriteResponse response;
+    if (!request.fieldOps.empty()) {
+        // the client doesn't know the results of the field operations
+        response.value = request.value.share();
+    }
+    if (request.pipelined && !batch) {
+        // the WI is visible to conflict detection as soon as it is created. The client collects the durability
+        // of its pipelined writes before committing, so we don't hold the response for the persistence call
+        auto mtr = request.mtr;
+        _trackPipelinedWrite(std::move(mtr), _createWI(std::move(request), versions, deadline, nullptr));
+        K2LOG_D(log::skvsvr, "Partition: {}, pipelined WI created", _partition);
+        return RPCResponse(dto::K23SIStatus::Created("wi created"), std::move(response));
+    }
+    return _createWI(std::move(request), versions, deadline, batch).then([this, response=std::move(response)]() mutable {
         K2LOG_D(log::skvsvr, "Partition: {}, WI created", _partition);
-        return RPCResponse(dto::K23SIStatus::Created("wi created"), dto::K23SIWriteResponse{});
+        return RPCResponse(dto::K23SIStatus::Created("wi created"), std::move(response));
     });
 }
 
@@ -1032,6 +3930,14 @@ K23SIPartitionModule::handleTxnPush(dto::K23SITxnPushRequest&& request) {
                                           .incumbentState=dto::TxnRecordState::Aborted, // incumbent is now aborted
                                           .allowChallengerRetry=true} // let the challenger retry
             );
+        case dto::TxnRecordState::Staging:
+            // the incumbent is committed if all of its writes are durable. Push again once we know
+            return _stagedTxns[txnId.mtr].get_shared_future()
+                .then([this, txnId=std::move(txnId), request=std::move(request)] () mutable {
+                    request.key = std::move(txnId.trh);
+                    request.incumbentMTR = std::move(txnId.mtr);
+                    return handleTxnPush(std::move(request));
+                });
         case dto::TxnRecordState::Committed:
             return RPCResponse(dto::K23SIStatus::OK("incumbent won in push"),
                 dto::K23SITxnPushResponse{.winnerMTR = std::move(txnId.mtr),
@@ -1076,23 +3982,262 @@ K23SIPartitionModule::handleTxnEnd(dto::K23SITxnEndRequest&& request) {
     // receives an error response which is telling them that the transaction has been aborted
     auto action = request.action == dto::EndAction::Commit ? TxnRecord::Action::onEndCommit : TxnRecord::Action::onEndAbort;
 
-    // store the write keys into the txnrecord
+    // store the write keys into the txnrecord. If the transaction has already ended, this is a re-entrant End and the
+    // record already has its keys(which may be in use by finalize, or released after finalization)
     TxnRecord& rec = _txnMgr.getTxnRecord(txnId);
-    rec.writeKeys = std::move(request.writeKeys);
-    rec.syncFinalize = request.syncFinalize;
-    rec.timeToFinalize = request.timeToFinalize;
+    if (rec.state == dto::TxnRecordState::Staging) {
+        // re-entrant End of a parallel commit. Its outcome decides what we tell the client
+        return _stagedTxns[txnId.mtr].get_shared_future()
+            .then([this, action, txnId=std::move(txnId)] () mutable {
+                return _txnMgr.onAction(action, std::move(txnId));
+            })
+            .then([] {
+                return RPCResponse(dto::K23SIStatus::OK("transaction ended"), dto::K23SITxnEndResponse());
+            })
+            .handle_exception_type([](TxnManager::ClientError&) {
+                return RPCResponse(dto::K23SIStatus::OperationNotAllowed("transaction state transition not allowed in end"), dto::K23SITxnEndResponse());
+            });
+    }
+    if (rec.state != dto::TxnRecordState::Committed && rec.state != dto::TxnRecordState::Aborted) {
+        if (request.writeKeyGroups.empty()) {
+            rec.writeKeys = std::move(request.writeKeys);
+        }
+        else {
+            rec.writeKeyGroups = std::move(request.writeKeyGroups);
+        }
+        rec.syncFinalize = request.syncFinalize;
+        rec.clientFinalize = request.clientFinalize;
+        rec.timeToFinalize = request.timeToFinalize;
+    }
+
+    if (action == TxnRecord::Action::onEndCommit && rec.state == dto::TxnRecordState::InProgress && _canCommitOnePhase(rec)) {
+        return _commitOnePhase(rec);
+    }
+    if (action == TxnRecord::Action::onEndCommit && rec.state == dto::TxnRecordState::InProgress && request.parallelCommit) {
+        return _parallelCommit(rec);
+    }
+
+    // and just execute the transition
+    return _txnMgr.onAction(action, std::move(txnId))
+        .then([this] {
+            // action was successful
+            K2LOG_D(log::skvsvr, "Partition: {}, transaction ended", _partition);
+            return RPCResponse(dto::K23SIStatus::OK("transaction ended"), dto::K23SITxnEndResponse());
+        })
+        .handle_exception_type([this](TxnManager::ClientError&) {
+            K2LOG_D(log::skvsvr, "Partition: {}, failed transaction end", _partition);
+            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("transaction state transition not allowed in end"), dto::K23SITxnEndResponse());
+        });
+}
+
+bool K23SIPartitionModule::_canCommitOnePhase(const TxnRecord& rec) {
+    auto maxKeys = _config.onePhaseCommitMaxKeys();
+    if (maxKeys == 0 || rec.writeKeyCount() > maxKeys) {
+        return false;
+    }
+    if (_pipelinedWrites.find(rec.txnId.mtr) != _pipelinedWrites.end()) {
+        // WIs still staged for persistence could land after our single append
+        return false;
+    }
+    auto isLocalWI = [this, &rec] (const dto::Key& key) {
+        if (!_partition.owns(key)) {
+            return false;
+        }
+        auto* wi = _getDataRecord(key, rec.txnId.mtr.timestamp);
+        return wi != nullptr && wi->status == dto::DataRecord::WriteIntent && wi->txnId == rec.txnId;
+    };
+    for (auto& key : rec.writeKeys) {
+        if (!isLocalWI(key)) return false;
+    }
+    for (auto& group : rec.writeKeyGroups) {
+        for (auto& key : group.keys) {
+            if (!isLocalWI(key)) return false;
+        }
+    }
+    return true;
+}
+
+seastar::future<std::tuple<Status, dto::K23SITxnEndResponse>>
+K23SIPartitionModule::_commitOnePhase(TxnRecord& rec) {
+    K2LOG_D(log::skvsvr, "Partition: {}, one-phase commit of {}", _partition, rec);
+    auto batch = _persistence.newBatch();
+    if (!batch) {
+        return RPCResponse(dto::K23SIStatus::InternalError("persistence not available"), dto::K23SITxnEndResponse());
+    }
+    auto txnId = rec.txnId;
+    _stagedTxns[txnId.mtr];
+    _txnMgr.stageOnePhase(rec, *batch);
+
+    // the WIs are persisted as committed along with the record, and only committed in memory once the batch is
+    // persisted, so that a failed batch leaves nothing committed behind
+    dto::K23SI_PersistencePartialUpdate update;
+    auto addFinalized = [&rec, &update] (const dto::Key& key) {
+        update.finalized.push_back(dto::K23SIFinalizedRecord{.key=key, .timestamp=rec.txnId.mtr.timestamp, .status=dto::DataRecord::Committed});
+    };
+    for (auto& key : rec.writeKeys) {
+        addFinalized(key);
+    }
+    for (auto& group : rec.writeKeyGroups) {
+        for (auto& key : group.keys) {
+            addFinalized(key);
+        }
+    }
+    Persistence::append(*batch, update);
+
+    return _persistence.flush(std::move(*batch), FastDeadline(_hot->persistenceTimeout))
+    .then_wrapped([this, &rec, txnId] (auto&& fut) {
+        // wakes up whoever waits for the outcome. It is called as soon as the record is committed or aborted, while
+        // they can still find it
+        auto wakeStaged = [this, txnId] {
+            if (auto it = _stagedTxns.find(txnId.mtr); it != _stagedTxns.end()) {
+                it->second.set_value();
+                _stagedTxns.erase(it);
+            }
+        };
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::skvsvr, fut.get_exception(), "Partition: {}, failed to persist one-phase commit of {}", _partition, txnId);
+            // the WIs are untouched, and the abort finalizes them in the background
+            auto abortFut = _txnMgr.onAction(TxnRecord::Action::onEndAbort, txnId);
+            wakeStaged();
+            return std::move(abortFut)
+                .handle_exception([this, txnId] (auto exc) {
+                    K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, failed to persist abort of {}", _partition, txnId);
+                })
+                .then([] {
+                    return false;
+                });
+        }
+        // the WIs were all checked, and nothing but the finalize of their transaction removes them
+        auto finalize = [this, &rec] (const dto::Key& key) {
+            dto::K23SITxnFinalizeRequest request{};
+            request.pvid = _partition().pvid;
+            request.collectionName = _cmeta.name;
+            request.trh = rec.txnId.trh;
+            request.mtr = rec.txnId.mtr;
+            request.key = key;
+            request.action = dto::EndAction::Commit;
+            // the finalized WIs are in the batch already
+            bool needsPersist = false;
+            dto::K23SI_PersistencePartialUpdate persisted;
+            _applyFinalize(request, needsPersist, persisted);
+        };
+        for (auto& key : rec.writeKeys) {
+            finalize(key);
+        }
+        for (auto& group : rec.writeKeyGroups) {
+            for (auto& key : group.keys) {
+                finalize(key);
+            }
+        }
+        _onePhaseCommits++;
+        auto commitFut = _txnMgr.commitOnePhase(rec);
+        wakeStaged();
+        return std::move(commitFut)
+            .handle_exception([this, txnId] (auto exc) {
+                // the commit is persisted already. Only the removal of the finalized record failed
+                K2LOG_W_EXC(log::skvsvr, exc, "Partition: {}, failed to remove record of {}", _partition, txnId);
+            })
+            .then([] {
+                return true;
+            });
+    })
+    .then([this] (bool committed) {
+        if (!committed) {
+            return RPCResponse(dto::K23SIStatus::InternalError("failed to persist one-phase commit"), dto::K23SITxnEndResponse());
+        }
+        K2LOG_D(log::skvsvr, "Partition: {}, transaction committed in one phase", _partition);
+        return RPCResponse(dto::K23SIStatus::OK("transaction ended"), dto::K23SITxnEndResponse());
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SITxnEndResponse>>
+K23SIPartitionModule::_parallelCommit(TxnRecord& rec) {
+    K2LOG_D(log::skvsvr, "Partition: {}, parallel commit of {}", _partition, rec);
+    _parallelCommits++;
+    auto txnId = rec.txnId;
+    _stagedTxns[txnId.mtr];
+    return _txnMgr.onAction(TxnRecord::Action::onEndStage, txnId)
+    .then([this, &rec] {
+        // nothing can remove the record while it is in Staging
+        return _awaitDurableWrites(rec);
+    })
+    .then_wrapped([this, txnId] (auto&& fut) {
+        auto action = TxnRecord::Action::onEndCommit;
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::skvsvr, fut.get_exception(), "Partition: {}, aborting parallel commit of {}", _partition, txnId);
+            _parallelCommitAborts++;
+            action = TxnRecord::Action::onEndAbort;
+        }
+        return _txnMgr.onAction(action, txnId)
+        .then([action] {
+            if (action == TxnRecord::Action::onEndAbort) {
+                // respond with failure since we had to abort but were asked to commit
+                return seastar::make_exception_future(TxnManager::ClientError());
+            }
+            return seastar::make_ready_future();
+        });
+    })
+    .finally([this, txnId] {
+        // wake up whoever waits for the outcome. They find the txn either committed or aborted
+        if (auto it = _stagedTxns.find(txnId.mtr); it != _stagedTxns.end()) {
+            it->second.set_value();
+            _stagedTxns.erase(it);
+        }
+    })
+    .then([this] {
+        K2LOG_D(log::skvsvr, "Partition: {}, transaction committed in parallel", _partition);
+        return RPCResponse(dto::K23SIStatus::OK("transaction ended"), dto::K23SITxnEndResponse());
+    })
+    .handle_exception_type([this](TxnManager::ClientError&) {
+        K2LOG_D(log::skvsvr, "Partition: {}, failed parallel commit", _partition);
+        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("transaction aborted since its writes are not durable"), dto::K23SITxnEndResponse());
+    });
+}
 
-    // and just execute the transition
-    return _txnMgr.onAction(action, std::move(txnId))
-        .then([this] {
-            // action was successful
-            K2LOG_D(log::skvsvr, "Partition: {}, transaction ended", _partition);
-            return RPCResponse(dto::K23SIStatus::OK("transaction ended"), dto::K23SITxnEndResponse());
-        })
-        .handle_exception_type([this](TxnManager::ClientError&) {
-            K2LOG_D(log::skvsvr, "Partition: {}, failed transaction end", _partition);
-            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("transaction state transition not allowed in end"), dto::K23SITxnEndResponse());
+seastar::future<> K23SIPartitionModule::_awaitDurableWrites(const TxnRecord& rec) {
+    // one request for each partition the txn wrote to, routed by any key it wrote there
+    auto deadline = FastDeadline(_hot->writeTimeout);
+    auto keysFut = seastar::make_ready_future<std::vector<dto::Key>>();
+    if (rec.writeKeyGroups.empty()) {
+        // the client couldn't group its keys, so we group them by our partition map
+        keysFut = _cpo.PartitionRoutingKeys(deadline, _cmeta.name, rec.writeKeys);
+    }
+    else {
+        std::vector<dto::Key> routingKeys;
+        for (auto& group : rec.writeKeyGroups) {
+            routingKeys.push_back(group.keys[0]);
+        }
+        keysFut = seastar::make_ready_future<std::vector<dto::Key>>(std::move(routingKeys));
+    }
+    return keysFut.then([this, &rec, deadline] (std::vector<dto::Key>&& keys) {
+        return seastar::do_with(std::move(keys), [this, &rec, deadline] (auto& routingKeys) {
+            return seastar::parallel_for_each(routingKeys, [this, &rec, deadline] (dto::Key& key) {
+                dto::K23SITxnAwaitDurableRequest request{};
+                request.collectionName = _cmeta.name;
+                request.key = key;
+                request.mtr = rec.txnId.mtr;
+                auto fut = seastar::make_ready_future<std::tuple<Status, dto::K23SITxnAwaitDurableResponse>>();
+                if (_partition.owns(key)) {
+                    // our own writes don't need to go through RPC
+                    request.pvid = _partition().pvid;
+                    fut = handleTxnAwaitDurable(std::move(request));
+                }
+                else {
+                    fut = seastar::do_with(std::move(request), [this, deadline] (auto& request) {
+                        return _cpo.PartitionRequest<dto::K23SITxnAwaitDurableRequest, dto::K23SITxnAwaitDurableResponse,
+                                                     dto::Verbs::K23SI_TXN_AWAIT_DURABLE>(deadline, request);
+                    });
+                }
+                return fut.then([] (auto&& response) {
+                    auto& [status, k2response] = response;
+                    if (!status.is2xxOK()) {
+                        return seastar::make_exception_future(std::runtime_error(fmt::format("writes not durable: {}", status)));
+                    }
+                    return seastar::make_ready_future();
+                });
+            });
         });
+    });
 }
 
 seastar::future<std::tuple<Status, dto::K23SITxnHeartbeatResponse>>
@@ -1109,7 +4254,7 @@ K23SIPartitionModule::handleTxnHeartbeat(dto::K23SITxnHeartbeatRequest&& request
         return RPCResponse(dto::K23SIStatus::AbortRequestTooOld("txn too old in hb"), dto::K23SITxnHeartbeatResponse());
     }
 
-    return _txnMgr.onAction(TxnRecord::Action::onHeartbeat, dto::TxnId{.trh=std::move(request.key), .mtr=std::move(request.mtr)})
+    return _txnMgr.onAction(TxnRecord::Action::onHeartbeat, dto::TxnId{.trh=std::move(request.key), .mtr=std::move(request.mtr)}, request.heartbeatDeadline)
     .then([this]() {
         // heartbeat was applied successfully
         K2LOG_D(log::skvsvr, "Partition: {}, txn hb success", _partition);
@@ -1122,110 +4267,395 @@ K23SIPartitionModule::handleTxnHeartbeat(dto::K23SITxnHeartbeatRequest&& request
     });
 }
 
+seastar::future<std::tuple<Status, dto::K23SITxnHeartbeatMultiResponse>>
+K23SIPartitionModule::handleTxnHeartbeatMulti(dto::K23SITxnHeartbeatMultiRequest&& request) {
+    K2LOG_D(log::skvsvr, "Partition: {}, transaction hb multi with {} heartbeats", _partition, request.heartbeats.size());
+    if (!_validateRequestPartition(request)) {
+        // tell client their collection partition is gone
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in hb multi"), dto::K23SITxnHeartbeatMultiResponse());
+    }
+
+    return seastar::do_with(std::move(request), dto::K23SITxnHeartbeatMultiResponse{}, [this] (auto& request, auto& response) {
+        response.statuses.reserve(request.heartbeats.size());
+        return seastar::do_for_each(request.heartbeats, [this, &request, &response] (dto::K23SITxnHeartbeatRequest& hb) {
+            if (!_partition.owns(hb.key)) {
+                // the sender should retry this heartbeat against the correct partition
+                response.statuses.push_back(dto::K23SIStatus::RefreshCollection("TRH not owned by partition in hb multi"));
+                return seastar::make_ready_future();
+            }
+            hb.pvid = request.pvid;
+            hb.collectionName = request.collectionName;
+            return handleTxnHeartbeat(std::move(hb)).then([&response] (auto&& result) {
+                auto& [status, hbResponse] = result;
+                response.statuses.push_back(std::move(status));
+            });
+        })
+        .then([&response] {
+            return RPCResponse(dto::K23SIStatus::OK("hb multi processed"), std::move(response));
+        });
+    });
+}
+
 seastar::future<bool>
 K23SIPartitionModule::_doPush(String collectionName, dto::Key key, dto::TxnId incumbentTxnId, dto::K23SI_MTR challengerMTR, FastDeadline deadline) {
+    Duration wait = std::min<Duration>(_config.conflictWaitTimeout(), deadline.getRemaining());
+    if (wait == Duration(0)) {
+        return _sendPush(std::move(collectionName), std::move(key), std::move(incumbentTxnId), std::move(challengerMTR), deadline);
+    }
+    // most conflicts resolve on their own once the incumbent ends. Only push if it doesn't in time
+    K2LOG_D(log::skvsvr, "partition: {}, waiting {} for txnid={}, for mtr={}", _partition, wait, incumbentTxnId, challengerMTR);
+    _conflictWaits++;
+    auto fut = _waitForFinalize(key, wait);
+    return fut.then([this, collectionName=std::move(collectionName), key=std::move(key), incumbentTxnId=std::move(incumbentTxnId),
+                     challengerMTR=std::move(challengerMTR), deadline] (bool finalized) mutable {
+        if (finalized) {
+            // the WI is gone, so the challenger retries against whatever replaced it
+            return seastar::make_ready_future<bool>(true);
+        }
+        _conflictWaitTimeouts++;
+        return _sendPush(std::move(collectionName), std::move(key), std::move(incumbentTxnId), std::move(challengerMTR), deadline);
+    });
+}
+
+seastar::future<bool> K23SIPartitionModule::_waitForFinalize(const dto::Key& key, Duration timeout) {
+    auto id = _nextConflictWaiterId++;
+    auto& waiters = _conflictWaiters[key];
+    waiters.push_back(ConflictWaiter{.id = id, .promise = seastar::promise<>()});
+    return seastar::with_timeout(seastar::timer<>::clock::now() + timeout, waiters.back().promise.get_future())
+    .then_wrapped([this, key, id] (auto&& fut) {
+        if (!fut.failed()) {
+            return true;
+        }
+        fut.ignore_ready_future();
+        // timed out. The waiter is still here unless the key was woken up since
+        auto it = _conflictWaiters.find(key);
+        if (it != _conflictWaiters.end()) {
+            auto& waiters = it->second;
+            waiters.erase(std::remove_if(waiters.begin(), waiters.end(), [id] (auto& waiter) { return waiter.id == id; }), waiters.end());
+            if (waiters.empty()) {
+                _conflictWaiters.erase(it);
+            }
+        }
+        return false;
+    });
+}
+
+void K23SIPartitionModule::_wakeConflictWaiters(const dto::Key& key) {
+    if (_conflictWaiters.empty()) {
+        return;
+    }
+    auto it = _conflictWaiters.find(key);
+    if (it == _conflictWaiters.end()) {
+        return;
+    }
+    auto waiters = std::move(it->second);
+    _conflictWaiters.erase(it);
+    for (auto& waiter : waiters) {
+        waiter.promise.set_value();
+    }
+}
+
+seastar::future<bool>
+K23SIPartitionModule::_sendPush(String collectionName, dto::Key key, dto::TxnId incumbentTxnId, dto::K23SI_MTR challengerMTR, FastDeadline deadline) {
+    auto it = _inflightPushes.find(incumbentTxnId.mtr);
+    if (it == _inflightPushes.end()) {
+        return _pushTRH(std::move(collectionName), std::move(key), std::move(incumbentTxnId), std::move(challengerMTR), deadline);
+    }
+    // another challenger is pushing the same incumbent. Its outcome is ours too if the incumbent has ended
+    K2LOG_D(log::skvsvr, "partition: {}, joining push against txnid={}, for mtr={}", _partition, incumbentTxnId, challengerMTR);
+    _sharedPushes++;
+    return it->second.get_future()
+    .then([this, collectionName=std::move(collectionName), key=std::move(key), incumbentTxnId=std::move(incumbentTxnId),
+           challengerMTR=std::move(challengerMTR), deadline] (auto&& responsePair) mutable {
+        auto& [status, response] = responsePair;
+        if (status == dto::K23SIStatus::OK && response.incumbentState != dto::TxnRecordState::InProgress) {
+            // the WIs of the incumbent were updated when the push completed
+            return seastar::make_ready_future<bool>(response.allowChallengerRetry);
+        }
+        // the incumbent is still running, and who wins depends on the challenger
+        return _pushTRH(std::move(collectionName), std::move(key), std::move(incumbentTxnId), std::move(challengerMTR), deadline);
+    });
+}
+
+seastar::future<bool>
+K23SIPartitionModule::_pushTRH(String collectionName, dto::Key key, dto::TxnId incumbentTxnId, dto::K23SI_MTR challengerMTR, FastDeadline deadline) {
     K2LOG_D(log::skvsvr, "partition: {}, executing push against txnid={}, for mtr={}", _partition, incumbentTxnId, challengerMTR);
     dto::K23SITxnPushRequest request{};
     request.collectionName = std::move(collectionName);
-    request.incumbentMTR = std::move(incumbentTxnId.mtr);
-    request.key = std::move(incumbentTxnId.trh); // this is the routing key - should be the TRH key
+    request.incumbentMTR = incumbentTxnId.mtr;
+    request.key = incumbentTxnId.trh; // this is the routing key - should be the TRH key
     request.challengerMTR = std::move(challengerMTR);
-    return seastar::do_with(std::move(request), std::move(key), [this, deadline] (auto& request, auto& key) {
-        return _cpo.PartitionRequest<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse, dto::Verbs::K23SI_TXN_PUSH>(deadline, request)
-        .then([this, &key, &request](auto&& responsePair) {
-            auto& [status, response] = responsePair;
-            K2LOG_D(log::skvsvr, "Push request completed with status={} and response={}", status, response);
-            if (status != dto::K23SIStatus::OK) {
-                K2LOG_E(log::skvsvr, "Partition: {}, txn push failed: {}", _partition, status);
-                return seastar::make_exception_future<bool>(TxnManager::ServerError());
-            }
-
-            // update the write intent if necessary
-            auto* rec = _getDataRecord(key, request.incumbentMTR.timestamp);
-            if (rec && rec->status == dto::DataRecord::WriteIntent && rec->txnId.mtr == request.incumbentMTR) {
-                switch (response.incumbentState) {
-                    case dto::TxnRecordState::InProgress: {
-                        break;
-                    }
-                    case dto::TxnRecordState::Aborted: {
-                        rec->status = dto::DataRecord::Aborted;
-                        //NB this call invalidates rec since we're modifying the indexer
-                        _removeRecord(*rec); // TODO-persistence: This shouldn't be done here but after successful persist, probably during txn finalization and/or GC for abandoned WIs
-                        break;
-                    }
-                    case dto::TxnRecordState::Committed: {
-                        // TODO-persistence this needs to be persisted
-                        rec->status = dto::DataRecord::Committed;
-                        break;
-                    }
-                    case dto::TxnRecordState::Deleted: {
-                        K2LOG_E(log::skvsvr, "Invalid write intent. Transaction is in state Deleted but WI is still present and not finalized in txn {}", rec->txnId);
-                        break;
-                    }
-                    default:
-                        K2LOG_E(log::skvsvr, "Unable to convert WI state based on txn state: {}, in txn: {}", response.incumbentState, rec->txnId);
-                }
-            }
+    _hotPushes.add(key);
 
-            // signal the caller what to do with the challenger
-            return seastar::make_ready_future<bool>(response.allowChallengerRetry);
+    auto fut = seastar::make_ready_future<std::tuple<Status, dto::K23SITxnPushResponse>>();
+    if (_partition.owns(request.key)) {
+        // we are the TRH for the incumbent, so we can resolve the push without going through RPC
+        request.pvid = _partition().pvid;
+        fut = handleTxnPush(std::move(request));
+    }
+    else {
+        fut = seastar::do_with(std::move(request), [this, deadline] (auto& request) {
+            return _cpo.PartitionRequest<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse, dto::Verbs::K23SI_TXN_PUSH>(deadline, request);
         });
+    }
+    // concurrent challengers of the same incumbent share this push
+    seastar::shared_future<std::tuple<Status, dto::K23SITxnPushResponse>> shared(std::move(fut));
+    bool sharing = _inflightPushes.emplace(incumbentTxnId.mtr, shared).second;
+
+    auto push = shared.get_future()
+    .then([this, key=std::move(key), incumbentTxnId=std::move(incumbentTxnId), sharing] (auto&& responsePair) {
+        if (sharing) {
+            _inflightPushes.erase(incumbentTxnId.mtr);
+        }
+        auto& [status, response] = responsePair;
+        K2LOG_D(log::skvsvr, "Push request completed with status={} and response={}", status, response);
+        if (status != dto::K23SIStatus::OK) {
+            K2LOG_E(log::skvsvr, "Partition: {}, txn push failed: {}", _partition, status);
+            return seastar::make_exception_future<bool>(TxnManager::ServerError());
+        }
+
+        // update the write intents if necessary. Once the incumbent has ended, this applies to all of its WIs here,
+        // so that challengers of its other keys don't have to push again
+        if (response.incumbentState != dto::TxnRecordState::InProgress) {
+            auto* wiKeys = _wiIndex.find(incumbentTxnId);
+            // the index changes as we update the WIs
+            auto keys = wiKeys ? std::vector<dto::Key>(wiKeys->begin(), wiKeys->end()) : std::vector<dto::Key>{};
+            for (auto& wiKey : keys) {
+                _applyPushOutcome(wiKey, incumbentTxnId, response.incumbentState);
+            }
+        }
+
+        if (!response.allowChallengerRetry) {
+            _hotAborts.add(key);
+        }
+        // signal the caller what to do with the challenger
+        return seastar::make_ready_future<bool>(response.allowChallengerRetry);
     });
+    return SlowLog::timed(&SlowOp::push, std::move(push));
+}
+
+void K23SIPartitionModule::_applyPushOutcome(const dto::Key& key, const dto::TxnId& incumbentTxnId, dto::TxnRecordState incumbentState) {
+    auto* rec = _getDataRecord(key, incumbentTxnId.mtr.timestamp);
+    if (!rec || rec->status != dto::DataRecord::WriteIntent || rec->txnId.mtr != incumbentTxnId.mtr) {
+        return;
+    }
+    switch (incumbentState) {
+        case dto::TxnRecordState::Aborted: {
+            _wiIndex.remove(rec->txnId, key);
+            rec->status = dto::DataRecord::Aborted;
+            //NB this call invalidates rec since we're modifying the indexer
+            _removeRecord(key, *rec); // TODO-persistence: This shouldn't be done here but after successful persist, probably during txn finalization and/or GC for abandoned WIs
+            _wakeConflictWaiters(key);
+            break;
+        }
+        case dto::TxnRecordState::Committed: {
+            // TODO-persistence this needs to be persisted
+            _wiIndex.remove(rec->txnId, key);
+            rec->status = dto::DataRecord::Committed;
+            _recordChange(key, *rec);
+            _wakeConflictWaiters(key);
+            break;
+        }
+        case dto::TxnRecordState::Deleted: {
+            K2LOG_E(log::skvsvr, "Invalid write intent. Transaction is in state Deleted but WI is still present and not finalized in txn {}", rec->txnId);
+            break;
+        }
+        default:
+            K2LOG_E(log::skvsvr, "Unable to convert WI state based on txn state: {}, in txn: {}", incumbentState, rec->txnId);
+    }
 }
 
 seastar::future<>
-K23SIPartitionModule::_createWI(dto::K23SIWriteRequest&& request, VersionsT& versions, FastDeadline deadline) {
+K23SIPartitionModule::_createWI(dto::K23SIWriteRequest&& request, VersionsT& versions, FastDeadline deadline, Payload* batch) {
     K2LOG_D(log::skvsvr, "Partition: {}, Write Request creating WI: {}", _partition, request);
     dto::DataRecord rec;
     rec.key = std::move(request.key);
     // we need to copy this data into a new memory block so that we don't hold onto and fragment the transport memory
-    rec.value = request.value.copy();
+    rec.value = _arena.copy(request.value);
     rec.isTombstone = request.isDelete;
     rec.txnId = dto::TxnId{.trh = std::move(request.trh), .mtr = std::move(request.mtr)};
     rec.status = dto::DataRecord::WriteIntent;
+    rec.ttl = request.ttl;
+
+    auto& wi = versions.push_front(std::move(rec));
+    // the persistence call serializes the record(including its key) before returning
+    auto fut = seastar::make_ready_future();
+    if (batch) {
+        // the caller persists the batch once all of its writes are processed
+        Persistence::append(*batch, wi);
+    }
+    else {
+        fut = _persistence.makeCall(wi, deadline);
+    }
+    // the key is owned by the indexer, so we don't keep a copy of it in each version
+    _wiIndex.add(wi.txnId, wi.key);
+    wi.key = dto::Key{};
+    return fut;
+}
+
+void K23SIPartitionModule::_trackPipelinedWrite(dto::K23SI_MTR mtr, seastar::future<> persistFut) {
+    _pipelinedWritesCount++;
+    _pipelinedWrites[mtr].pending++;
+    (void)persistFut.then_wrapped([this, mtr=std::move(mtr)] (auto&& fut) {
+        auto it = _pipelinedWrites.find(mtr);
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::skvsvr, fut.get_exception(), "Partition: {}, pipelined write failed to persist in txn {}", _partition, mtr);
+            _pipelinedWriteFailures++;
+            if (it != _pipelinedWrites.end()) {
+                it->second.failed = true;
+            }
+        }
+        else {
+            fut.ignore_ready_future();
+        }
+        // the txn may have been finalized already, in which case nobody is interested in the outcome
+        if (it == _pipelinedWrites.end() || --it->second.pending > 0) {
+            return;
+        }
+        auto waiters = std::move(it->second.waiters);
+        bool failed = it->second.failed;
+        if (!failed) {
+            _pipelinedWrites.erase(it);
+        }
+        for (auto& waiter : waiters) {
+            if (failed) {
+                waiter.set_exception(std::runtime_error("pipelined write failed to persist"));
+            }
+            else {
+                waiter.set_value();
+            }
+        }
+    });
+}
 
-    versions.push_front(std::move(rec));
-    // TODO write to WAL
-    return _persistence.makeCall(versions.front(), deadline);
+seastar::future<std::tuple<Status, dto::K23SITxnAwaitDurableResponse>>
+K23SIPartitionModule::handleTxnAwaitDurable(dto::K23SITxnAwaitDurableRequest&& request) {
+    K2LOG_D(log::skvsvr, "Partition: {}, await durable: {}", _partition, request);
+    if (!_validateRequestPartition(request)) {
+        // tell client their collection partition is gone
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in await durable"), dto::K23SITxnAwaitDurableResponse{});
+    }
+    auto it = _pipelinedWrites.find(request.mtr);
+    if (it == _pipelinedWrites.end()) {
+        // No pipelined writes of the txn are pending, and none failed. Its WIs here are then durable: they were either
+        // persisted before their write was acknowledged, or recovered from persistence. Without WIs we can't tell what
+        // happened to the writes, e.g. the txn was aborted, so we don't vouch for them
+        if (_wiIndex.find(dto::TxnId{.trh={}, .mtr=request.mtr}) == nullptr) {
+            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("no write intents of the txn"), dto::K23SITxnAwaitDurableResponse{});
+        }
+        return RPCResponse(dto::K23SIStatus::OK("writes durable"), dto::K23SITxnAwaitDurableResponse{});
+    }
+    if (it->second.pending == 0) {
+        // the only way to still have an entry without pending writes is a failure. It is kept until the txn is
+        // finalized, so that every retry gets the same answer
+        return RPCResponse(dto::K23SIStatus::InternalError("pipelined write failed to persist"), dto::K23SITxnAwaitDurableResponse{});
+    }
+    it->second.waiters.emplace_back();
+    return it->second.waiters.back().get_future()
+    .then_wrapped([] (auto&& fut) {
+        if (fut.failed()) {
+            fut.ignore_ready_future();
+            return RPCResponse(dto::K23SIStatus::InternalError("pipelined write failed to persist"), dto::K23SITxnAwaitDurableResponse{});
+        }
+        return RPCResponse(dto::K23SIStatus::OK("writes durable"), dto::K23SITxnAwaitDurableResponse{});
+    });
 }
 
 seastar::future<std::tuple<Status, dto::K23SITxnFinalizeResponse>>
 K23SIPartitionModule::handleTxnFinalize(dto::K23SITxnFinalizeRequest&& request) {
-    // find the version deque for the key
     K2LOG_D(log::skvsvr, "Partition: {}, txn finalize: {}", _partition, request);
+    bool needsPersist = false;
+    dto::K23SI_PersistencePartialUpdate update;
+    auto status = _applyFinalize(request, needsPersist, update);
+    if (!needsPersist) {
+        return RPCResponse(std::move(status), dto::K23SITxnFinalizeResponse());
+    }
+
+    // send a partial update for updating the status of the record
+    return _persistence.makeCall(update, _hot->persistenceTimeout).then([] {
+        return RPCResponse(dto::K23SIStatus::OK("persistence call succeeded"), dto::K23SITxnFinalizeResponse{});
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SITxnFinalizeMultiResponse>>
+K23SIPartitionModule::handleTxnFinalizeMulti(dto::K23SITxnFinalizeMultiRequest&& request) {
+    K2LOG_D(log::skvsvr, "Partition: {}, txn finalize multi: {}", _partition, request);
+    if (!_validateRequestPartition(request)) {
+        // tell client their collection partition is gone
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in finalize multi"), dto::K23SITxnFinalizeMultiResponse());
+    }
+
+    dto::K23SITxnFinalizeMultiResponse response;
+    response.statuses.reserve(request.finalizes.size());
+    bool needsPersist = false;
+    dto::K23SI_PersistencePartialUpdate update;
+    for (auto& finalize : request.finalizes) {
+        if (!_partition.owns(finalize.key)) {
+            // the sender should retry this key against the correct partition
+            response.statuses.push_back(dto::K23SIStatus::RefreshCollection("key not owned by partition in finalize multi"));
+            continue;
+        }
+        finalize.pvid = request.pvid;
+        finalize.collectionName = request.collectionName;
+        bool keyNeedsPersist = false;
+        response.statuses.push_back(_applyFinalize(finalize, keyNeedsPersist, update));
+        needsPersist = needsPersist || keyNeedsPersist;
+    }
+    if (!needsPersist) {
+        return RPCResponse(dto::K23SIStatus::OK("finalize multi processed"), std::move(response));
+    }
+
+    // a single partial update covers the status changes of all records in the batch
+    return _persistence.makeCall(update, _hot->persistenceTimeout)
+    .then([response=std::move(response)] () mutable {
+        return RPCResponse(dto::K23SIStatus::OK("finalize multi processed"), std::move(response));
+    });
+}
+
+Status K23SIPartitionModule::_applyFinalize(dto::K23SITxnFinalizeRequest& request, bool& needsPersist,
+                                            dto::K23SI_PersistencePartialUpdate& update) {
+    needsPersist = false;
     if (!_validateRequestPartition(request)) {
         // tell client their collection partition is gone
-        return RPCResponse(dto::K23SIStatus::RefreshCollection("collection refresh needed in finalize"), dto::K23SITxnFinalizeResponse());
+        return dto::K23SIStatus::RefreshCollection("collection refresh needed in finalize");
     }
     if (!_validateRequestPartitionKey(request)){
         // do not allow empty partition key
-        return RPCResponse(dto::K23SIStatus::BadParameter("missing partition key in finalize"), dto::K23SITxnFinalizeResponse());
+        return dto::K23SIStatus::BadParameter("missing partition key in finalize");
     }
 
     // get the data record for this key
     // TODO-persistence We should handle the cases when the record is updated in-memory but not persisted yet
     auto* rec = _getDataRecord(request.key, request.mtr.timestamp);
 
+    // the txn is over, so we no longer need to track the outcome of its pipelined writes
+    if (auto pit = _pipelinedWrites.find(request.mtr); pit != _pipelinedWrites.end() && pit->second.waiters.empty()) {
+        _pipelinedWrites.erase(pit);
+    }
+
     dto::TxnId txnId{.trh=std::move(request.trh), .mtr=std::move(request.mtr)};
     if (!rec || rec->txnId != txnId || rec->txnId.trh != txnId.trh) {
         // we don't have a record from this transaction
         if (request.action == dto::EndAction::Abort) {
             // we don't have it but it was an abort anyway
             K2LOG_D(log::skvsvr, "Partition: {}, abort for missing version {}, in txn {}", _partition, request.key, txnId);
-            return RPCResponse(dto::K23SIStatus::OK("finalize key missing in abort"), dto::K23SITxnFinalizeResponse());
+            return dto::K23SIStatus::OK("finalize key missing in abort");
         }
         // we can't allow the commit since we don't have the write intent and we don't have a committed version
         K2LOG_D(log::skvsvr, "Partition: {}, rejecting commit for missing version {}, in txn {}", _partition, request.key, txnId);
-        return RPCResponse(dto::K23SIStatus::OperationNotAllowed("cannot commit missing key"), dto::K23SITxnFinalizeResponse());
+        return dto::K23SIStatus::OperationNotAllowed("cannot commit missing key");
     }
 
     // we found a record from this transaction
     switch(rec->status) {
         case dto::DataRecord::WriteIntent: {
             // if it is currently a write intent, modify as needed
+            _wiIndex.remove(rec->txnId, request.key);
+            _wakeConflictWaiters(request.key);
             if (request.action == dto::EndAction::Commit) {
                 K2LOG_D(log::skvsvr, "Partition: {}, committing {}, in txn {}", _partition, request.key, txnId);
                 rec->status = dto::DataRecord::Committed;
+                _recordChange(request.key, *rec);
             }
             else {
                 K2LOG_D(log::skvsvr, "Partition: {}, aborting {}, in txn {}", _partition, request.key, txnId);
@@ -1237,32 +4667,33 @@ K23SIPartitionModule::handleTxnFinalize(dto::K23SITxnFinalizeRequest&& request)
             // don't trigger the failure response if the action matches the state
             if (request.action == dto::EndAction::Commit) break;
             K2LOG_D(log::skvsvr, "Partition: {}, cannot abort committed record: {}", _partition, *rec);
-            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("cannot finalize txn"), dto::K23SITxnFinalizeResponse());
+            return dto::K23SIStatus::OperationNotAllowed("cannot finalize txn");
         case dto::DataRecord::Aborted:
             // don't trigger the failure response if the action matches the state
             if (request.action == dto::EndAction::Abort) break;
             K2LOG_D(log::skvsvr, "Partition: {}, cannot commit aborted record: {}", _partition, *rec);
-            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("cannot finalize txn"), dto::K23SITxnFinalizeResponse());
+            return dto::K23SIStatus::OperationNotAllowed("cannot finalize txn");
         default:
             // the action did not match the state
             K2LOG_D(log::skvsvr,
                 "Partition: {}, failing finalize due to action mismatch {}, in txn {}, have status={}, asked={}",
                 _partition, request.key, txnId, rec->status, request.action);
-            return RPCResponse(dto::K23SIStatus::OperationNotAllowed("cannot finalize txn"), dto::K23SITxnFinalizeResponse());
+            return dto::K23SIStatus::OperationNotAllowed("cannot finalize txn");
     }
 
+    update.finalized.push_back(dto::K23SIFinalizedRecord{.key=request.key, .timestamp=txnId.mtr.timestamp, .status=rec->status});
+
     // TODO-persistence: For now, remove aborted records right-away. With persistence we should do so after successfully
     // persisting
     if (rec->status == dto::DataRecord::Aborted) {
-        _removeRecord(*rec); // NB: rec is now invalid since we're modifying the indexer
+        _removeRecord(request.key, *rec); // NB: rec is now invalid since we're modifying the indexer
     }
 
-    // send a partial update for updating the status of the record
-    return _persistence.makeCall(dto::K23SI_PersistencePartialUpdate{}, _config.persistenceTimeout()).then([] {
-        return RPCResponse(dto::K23SIStatus::OK("persistence call succeeded"), dto::K23SITxnFinalizeResponse{});
-    });
+    needsPersist = true;
+    return dto::K23SIStatus::OK("finalized");
 }
 
+
 seastar::future<std::tuple<Status, dto::K23SIPushSchemaResponse>>
 K23SIPartitionModule::handlePushSchema(dto::K23SIPushSchemaRequest&& request) {
     K2LOG_D(log::skvsvr, "handlePushSchema for schema: {}", request.schema.name);
@@ -1270,7 +4701,13 @@ K23SIPartitionModule::handlePushSchema(dto::K23SIPushSchemaRequest&& request) {
         return RPCResponse(Statuses::S403_Forbidden("Collection names in partition and request do not match"), dto::K23SIPushSchemaResponse{});
     }
 
-    _schemas[request.schema.name][request.schema.version] = std::make_shared<dto::Schema>(request.schema);
+    uint32_t schemaId = _indexer.getOrCreateId(request.schema.name);
+    if (schemaId >= _schemas.size()) {
+        _schemas.resize(schemaId + 1);
+    }
+    auto schema = std::make_shared<dto::Schema>(std::move(request.schema));
+    schema->indexFields();
+    _schemas[schemaId][schema->version] = std::move(schema);
 
     return RPCResponse(Statuses::S200_OK("push schema success"), dto::K23SIPushSchemaResponse{});
 }
@@ -1281,8 +4718,9 @@ seastar::future<std::tuple<Status, dto::K23SIInspectRecordsResponse>>
 K23SIPartitionModule::handleInspectRecords(dto::K23SIInspectRecordsRequest&& request) {
     K2LOG_D(log::skvsvr, "handleInspectRecords for: {}", request.key);
 
-    auto it = _indexer.find(request.key);
-    if (it == _indexer.end()) {
+    auto index = _indexer.find(request.key.schemaName);
+    auto it = index ? index->find(request.key) : IndexerIterator{};
+    if (index == nullptr || it == index->end()) {
         return RPCResponse(dto::K23SIStatus::KeyNotFound("Key not found in indexer"), dto::K23SIInspectRecordsResponse{});
     }
     auto& versions = it->second;
@@ -1292,11 +4730,12 @@ K23SIPartitionModule::handleInspectRecords(dto::K23SIInspectRecordsRequest&& req
 
     for (dto::DataRecord& rec : versions) {
         dto::DataRecord copy {
-            rec.key,
+            it->first,
             rec.value.share(),
             rec.isTombstone,
             rec.txnId,
-            rec.status
+            rec.status,
+            rec.ttl
         };
 
         records.push_back(std::move(copy));
@@ -1322,7 +4761,7 @@ K23SIPartitionModule::handleInspectTxn(dto::K23SIInspectTxnRequest&& request) {
 
     K23SIInspectTxnResponse response {
         txn->txnId,
-        txn->writeKeys,
+        txn->allWriteKeys(),
         txn->rwExpiry,
         txn->syncFinalize,
         txn->state
@@ -1338,19 +4777,23 @@ K23SIPartitionModule::handleInspectWIs(dto::K23SIInspectWIsRequest&& request) {
     K2LOG_D(log::skvsvr, "handleInspectWIs");
     std::vector<dto::DataRecord> records;
 
-    for (auto it = _indexer.begin(); it != _indexer.end(); ++it) {
-        auto& versions = it->second;
-        for (dto::DataRecord& rec : versions) {
-            if (rec.status != dto::DataRecord::Status::WriteIntent) {
+    records.reserve(_wiIndex.size());
+
+    for (auto& [mtr, keys] : _wiIndex) {
+        for (auto& key : keys) {
+            auto* rec = _getDataRecord(key, mtr.timestamp);
+            if (rec == nullptr || rec->status != dto::DataRecord::Status::WriteIntent || rec->txnId.mtr != mtr) {
+                K2LOG_W(log::skvsvr, "Partition: {}, WI index out of sync for key {} in txn {}", _partition, key, mtr);
                 continue;
             }
 
             dto::DataRecord copy {
-                rec.key,
-                rec.value.share(),
-                rec.isTombstone,
-                rec.txnId,
-                rec.status
+                key,
+                rec->value.share(),
+                rec->isTombstone,
+                rec->txnId,
+                rec->status,
+                rec->ttl
             };
 
             records.push_back(std::move(copy));
@@ -1372,7 +4815,7 @@ K23SIPartitionModule::handleInspectAllTxns(dto::K23SIInspectAllTxnsRequest&& req
     for (auto it = _txnMgr._transactions.begin(); it != _txnMgr._transactions.end(); ++it) {
         K23SIInspectTxnResponse copy {
             it->second.txnId,
-            it->second.writeKeys,
+            it->second.allWriteKeys(),
             it->second.rwExpiry,
             it->second.syncFinalize,
             it->second.state
@@ -1394,14 +4837,39 @@ K23SIPartitionModule::handleInspectAllKeys(dto::K23SIInspectAllKeysRequest&& req
     std::vector<dto::Key> keys;
     keys.reserve(_indexer.size());
 
-    for (auto it = _indexer.begin(); it != _indexer.end(); ++it) {
-        keys.push_back(it->first);
+    for (uint32_t schemaId = 0; schemaId < _indexer.schemaCount(); ++schemaId) {
+        auto& index = _indexer.at(schemaId);
+        for (auto it = index.begin(); it != index.end(); ++it) {
+            keys.push_back(it->first);
+        }
     }
 
     dto::K23SIInspectAllKeysResponse response { std::move(keys) };
     return RPCResponse(dto::K23SIStatus::OK("Inspect AllKeys success"), std::move(response));
 }
 
+// Returns the keys with the most contention since the last reset. The counts of reads and writes are estimates
+// scaled up from the sampled requests
+seastar::future<std::tuple<Status, dto::K23SIInspectHotKeysResponse>>
+K23SIPartitionModule::handleInspectHotKeys(dto::K23SIInspectHotKeysRequest&& request) {
+    K2LOG_D(log::skvsvr, "handleInspectHotKeys: {}", request);
+    dto::K23SIInspectHotKeysResponse response {
+        .reads=_hotReads.top(),
+        .writes=_hotWrites.top(),
+        .pushes=_hotPushes.top(),
+        .aborts=_hotAborts.top(),
+        .totalPushes=_hotPushes.total(),
+        .totalAborts=_hotAborts.total()
+    };
+    if (request.reset) {
+        _hotReads.clear();
+        _hotWrites.clear();
+        _hotPushes.clear();
+        _hotAborts.clear();
+    }
+    return RPCResponse(dto::K23SIStatus::OK("Inspect HotKeys success"), std::move(response));
+}
+
 
 // get the data record from the given versions which is not newer than the given timestamp
 VersionsT::iterator
@@ -1418,27 +4886,331 @@ K23SIPartitionModule::_getVersion(VersionsT& versions, const dto::Timestamp& tim
 // get the data record with the given key which is not newer than the given timestsamp
 dto::DataRecord*
 K23SIPartitionModule::_getDataRecord(const dto::Key& key, const dto::Timestamp& timestamp) {
-    auto versions = _indexer.find(key);
-    if (versions == _indexer.end()) {
+    return _getDataRecord(_indexer.findId(key.schemaName), key, timestamp);
+}
+
+VersionsT* K23SIPartitionModule::_findVersions(uint32_t schemaId, const dto::Key& key) {
+    if (!_indexer.mayContain(schemaId, key)) {
+        _keyFilterRejects++;
+        return nullptr;
+    }
+    auto versions = _indexer.findVersions(schemaId, key);
+    if (versions == nullptr) {
+        return nullptr;
+    }
+    _applyRangeTombstones(key, *versions);
+    return versions;
+}
+
+Duration K23SIPartitionModule::_schemaTTL(const SchemaVersionsT& schemaVersions, uint32_t schemaVersion) {
+    auto versionIt = schemaVersions.find(schemaVersion);
+    return versionIt == schemaVersions.end() ? Duration(0) : versionIt->second->ttl;
+}
+
+void K23SIPartitionModule::_materializeRangeTombstones(const dto::Key& key, VersionsT& versions) {
+    for (auto& range : _rangeTombstones) {
+        if (key.schemaName != range.key.schemaName || key < range.key ||
+            (!range.endKey.partitionKey.empty() && !(key < range.endKey))) {
+            continue;
+        }
+        // the tombstone goes right before the first version older than it. The versions at or after it were
+        // written after the range delete, except for the tombstone itself if we applied it already
+        VersionsT::iterator newer = versions.end();
+        VersionsT::iterator viter = versions.begin();
+        bool applied = false;
+        for (; viter != versions.end(); newer = viter++) {
+            auto cmp = viter->txnId.mtr.timestamp.compareCertain(range.timestamp);
+            if (cmp == dto::Timestamp::LT) {
+                break;
+            }
+            if (cmp == dto::Timestamp::EQ) {
+                applied = viter->isTombstone && viter->status == dto::DataRecord::Committed;
+                break;
+            }
+        }
+        if (applied) {
+            continue;
+        }
+        dto::DataRecord rec;
+        rec.isTombstone = true;
+        rec.txnId.mtr.timestamp = range.timestamp;
+        rec.status = dto::DataRecord::Committed;
+        if (newer == versions.end()) {
+            versions.push_front(std::move(rec));
+        } else {
+            versions.insertAfter(newer, std::move(rec));
+        }
+        _rangeTombstonesApplied++;
+    }
+}
+
+void K23SIPartitionModule::_addRangeTombstone(dto::K23SI_PersistenceRangeTombstone&& range) {
+    if (std::find(_rangeTombstones.begin(), _rangeTombstones.end(), range) == _rangeTombstones.end()) {
+        _rangeTombstones.push_back(std::move(range));
+    }
+}
+
+seastar::future<> K23SIPartitionModule::_persistRangeTombstones() {
+    if (_rangeTombstones.empty()) {
+        return seastar::make_ready_future();
+    }
+    auto batch = _persistence.newBatch();
+    if (!batch) {
+        return seastar::make_exception_future(std::runtime_error("persistence not available"));
+    }
+    for (auto& range : _rangeTombstones) {
+        Persistence::append(*batch, range);
+    }
+    return _persistence.flush(std::move(*batch), FastDeadline(_hot->persistenceTimeout));
+}
+
+dto::DataRecord*
+K23SIPartitionModule::_getDataRecord(uint32_t schemaId, const dto::Key& key, const dto::Timestamp& timestamp) {
+    auto versions = _findVersions(schemaId, key);
+    if (versions == nullptr) {
+        return nullptr;
+    }
+    auto viter = _getVersion(*versions, timestamp);
+    if (viter == versions->end()) {
+        return nullptr;
+    }
+    return &(*viter);
+}
+
+VersionsT::iterator
+K23SIPartitionModule::_getSnapshotVersion(VersionsT& versions, const dto::Timestamp& timestamp) {
+    auto viter = _getVersion(versions, timestamp);
+    while (viter != versions.end() && viter->status == dto::DataRecord::Aborted) {
+        // skip aborted versions which haven't been removed yet
+        ++viter;
+    }
+    return viter;
+}
+
+dto::DataRecord*
+K23SIPartitionModule::_getSnapshotRecord(const dto::Key& key, const dto::Timestamp& timestamp) {
+    return _getSnapshotRecord(_indexer.findId(key.schemaName), key, timestamp);
+}
+
+dto::DataRecord*
+K23SIPartitionModule::_getSnapshotRecord(uint32_t schemaId, const dto::Key& key, const dto::Timestamp& timestamp) {
+    auto versions = _findVersions(schemaId, key);
+    if (versions == nullptr) {
         return nullptr;
     }
-    auto viter = _getVersion(versions->second, timestamp);
-    if (viter == versions->second.end()) {
+    auto viter = _getSnapshotVersion(*versions, timestamp);
+    if (viter == versions->end()) {
         return nullptr;
     }
     return &(*viter);
 }
 
-void K23SIPartitionModule::_removeRecord(dto::DataRecord& rec) {
-    auto kiter = _indexer.find(rec.key);
-    if (kiter != _indexer.end() && !kiter->second.empty()) {
+Status K23SIPartitionModule::_admitSnapshotRead(const dto::Timestamp& timestamp) {
+    int64_t now = now_nsec_count() + _tsoClockOffset;
+    int64_t newest = now - nsec(_config.snapshotReadMinStaleness()).count();
+    if ((int64_t)timestamp.tEndTSECount() > newest) {
+        K2LOG_D(log::skvsvr, "Partition: {}, rejecting snapshot read at {} which is too recent", _partition, timestamp);
+        return dto::K23SIStatus::BadParameter("snapshot read timestamp is too recent");
+    }
+    if (_follower && timestamp.compareCertain(_closedTimestamp) > 0) {
+        // we may not have replayed all writes at or below the timestamp yet
+        K2LOG_D(log::skvsvr, "Partition: {}, rejecting snapshot read at {} above closed timestamp {}", _partition, timestamp, _closedTimestamp);
+        return dto::K23SIStatus::BadParameter("snapshot read timestamp is not closed on the follower yet");
+    }
+    _snapshotReads++;
+    return dto::K23SIStatus::OK("");
+}
+
+void K23SIPartitionModule::_removeRecord(const dto::Key& key, dto::DataRecord& rec) {
+    uint32_t schemaId = _indexer.findId(key.schemaName);
+    if (schemaId == SchemaIndexer::NoSchemaId) {
+        return;
+    }
+    auto& index = _indexer.at(schemaId);
+    auto kiter = index.find(key);
+    if (kiter != index.end() && !kiter->second.empty()) {
         auto viter = _getVersion(kiter->second, rec.txnId.mtr.timestamp);
         if (viter != kiter->second.end()) {
-            K2LOG_D(log::skvsvr, "Partition: {}, removing aborted version for key={}, from txn={}", _partition, rec.key, rec.txnId);
+            K2LOG_D(log::skvsvr, "Partition: {}, removing aborted version for key={}, from txn={}", _partition, key, rec.txnId);
             K2ASSERT(log::skvsvr, viter->status == dto::DataRecord::Aborted, "Record not in Aborted state: {}", (*viter));
             kiter->second.erase(viter);
             if (kiter->second.empty()) {
-                _indexer.erase(kiter);
+                _indexer.erase(schemaId, kiter);
+            }
+        }
+    }
+}
+
+seastar::future<> K23SIPartitionModule::_gcPass() {
+    K2LOG_D(log::skvsvr, "Partition: {}, starting gc pass with retention={}", _partition, _retentionTimestamp);
+    _gcPassVersions = 0;
+    _gcPassValueBytes = 0;
+    return seastar::do_with(uint32_t(0), dto::Key{}, false, [this] (uint32_t& schemaId, dto::Key& cursor, bool& started) {
+        // the cursor is a key rather than an iterator since the indexer may be modified while we yield
+        return seastar::repeat([this, &schemaId, &cursor, &started, retention=_retentionTimestamp] {
+            if (_stopped || schemaId >= _indexer.schemaCount()) {
+                if (!_stopped) {
+                    _indexedVersions = _gcPassVersions;
+                    _indexedValueBytes = _gcPassValueBytes;
+                    // the pass applied the range tombstones to all keys, and no write can go below the retention
+                    // window anymore, so the old ones aren't needed
+                    _rangeTombstones.erase(std::remove_if(_rangeTombstones.begin(), _rangeTombstones.end(),
+                        [&retention] (auto& range) { return range.timestamp.compareCertain(retention) < 0; }),
+                        _rangeTombstones.end());
+                }
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            if (!started) {
+                // the key filter of the schema is rebuilt from the keys which survive this pass
+                _indexer.startFilterRebuild(schemaId);
+                started = true;
+            }
+            if (_gcChunk(schemaId, _indexer.filterRebuild(schemaId), cursor)) {
+                // done with this schema
+                _indexer.finishFilterRebuild(schemaId);
+                ++schemaId;
+                cursor = dto::Key{};
+                started = false;
+            }
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::no);
+        });
+    });
+}
+
+bool K23SIPartitionModule::_gcChunk(uint32_t schemaId, KeyFilter* filter, dto::Key& cursor) {
+    IndexerT& index = _indexer.at(schemaId);
+    auto it = index.lower_bound(cursor);
+    for (uint32_t i = 0; i < _config.gcChunkSize() && it != index.end(); ++i) {
+        it = _gcKey(schemaId, filter, it);
+    }
+    if (_config.coldBlockRows() > 0) {
+        _freezeColdKeys(schemaId, index.lower_bound(cursor), it);
+    }
+    if (it == index.end()) {
+        return true;
+    }
+    cursor = it->first;
+    return false;
+}
+
+IndexerIterator K23SIPartitionModule::_gcKey(uint32_t schemaId, KeyFilter* filter, IndexerIterator it) {
+    auto& versions = it->second;
+    _applyRangeTombstones(it->first, versions);
+    if (versions.isCold()) {
+        // a single committed version outside of the retention window: nothing to collect
+        _gcPassVersions += versions.size();
+        if (filter) {
+            filter->add(it->first);
+        }
+        return ++it;
+    }
+    // find the newest committed version which is older than the retention window. No transaction can read
+    // anything older than that version, so all older versions can go
+    auto viter = versions.begin();
+    while (viter != versions.end() &&
+           (viter->status != dto::DataRecord::Committed ||
+            viter->txnId.mtr.timestamp.compareCertain(_retentionTimestamp) >= 0)) {
+        ++viter;
+    }
+
+    if (viter != versions.end()) {
+        auto dropped = viter;
+        for (++dropped; dropped != versions.end(); ++dropped) {
+            _gcVersionsReclaimed++;
+            _gcBytesReclaimed += dropped->value.fieldData.getSize();
+        }
+        versions.eraseAfter(viter);
+
+        // a committed tombstone(or a record which expired) outside of the retention window which is not shadowed
+        // by anything newer is not visible to anyone and we can drop the key
+        if (viter == versions.begin() && viter->isDeletedAt(_retentionTimestamp)) {
+            K2LOG_D(log::skvsvr, "Partition: {}, gc removing tombstoned key {}", _partition, it->first);
+            _gcVersionsReclaimed++;
+            _gcKeysRemoved++;
+            if (!viter->isTombstone) {
+                _gcKeysExpired++;
+            }
+            return _indexer.erase(schemaId, it);
+        }
+    }
+
+    // move the surviving versions out of sparse arena slabs so that the slabs can be released
+    for (auto& rec : versions) {
+        if (_arena.shouldRelocate(rec.value.fieldData)) {
+            _gcBytesRelocated += rec.value.fieldData.getSize();
+            rec.value = _arena.copy(rec.value);
+        }
+        _gcPassValueBytes += rec.value.fieldData.getSize();
+    }
+    _gcPassVersions += versions.size();
+    if (filter) {
+        filter->add(it->first);
+    }
+    return ++it;
+}
+
+void K23SIPartitionModule::_freezeColdKeys(uint32_t schemaId, IndexerIterator begin, IndexerIterator end) {
+    if (schemaId >= _schemas.size()) {
+        return;
+    }
+    // the cold keys, by the schema version of their value
+    std::unordered_map<uint32_t, std::vector<VersionsT*>> cold;
+    for (auto it = begin; it != end; ++it) {
+        VersionsT& versions = it->second;
+        // keys thawed since the last pass were accessed recently, and get another pass before freezing again
+        if (versions.isCold() || versions.takeThawed() || versions.size() != 1) {
+            continue;
+        }
+        dto::DataRecord& rec = versions.front();
+        // records with a TTL stay thawed, so that the GC can see when they expire
+        if (rec.status == dto::DataRecord::Committed && !rec.isTombstone && rec.ttl == Duration(0) &&
+            rec.txnId.mtr.timestamp.compareCertain(_retentionTimestamp) < 0) {
+            cold[rec.value.schemaVersion].push_back(&versions);
+        }
+    }
+
+    if (!_coldSpill && !_config.coldSpillDir().empty()) {
+        _coldSpill = std::make_unique<ColdSpill>(_config.coldSpillDir(), _config.coldSpillSegmentBytes());
+    }
+    size_t blockRows = std::min<size_t>(_config.coldBlockRows(), ColdBlock::MaxRows);
+    for (auto& [schemaVersion, keys] : cold) {
+        auto versionIt = _schemas[schemaId].find(schemaVersion);
+        if (versionIt == _schemas[schemaId].end()) {
+            continue;
+        }
+        const dto::Schema& schema = *versionIt->second;
+        for (size_t first = 0; first < keys.size(); first += blockRows) {
+            size_t count = std::min(blockRows, keys.size() - first);
+            if (count < std::max<size_t>(blockRows / 2, 2)) {
+                // too few records for a block to pay off. They are considered again in the next pass
+                break;
+            }
+            std::vector<dto::SKVRecord::Storage*> rows;
+            rows.reserve(count);
+            size_t rowBytes = 0;
+            for (size_t i = first; i < first + count; ++i) {
+                auto& value = keys[i]->front().value;
+                if (!value.indexFields(schema)) {
+                    break;
+                }
+                rows.push_back(&value);
+                rowBytes += value.fieldData.getSize();
+            }
+            if (rows.size() != count) {
+                continue;
+            }
+            auto block = seastar::make_lw_shared<ColdBlock>(schema, rows);
+            if (block->encodedBytes() >= rowBytes) {
+                continue;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                keys[first + i]->freeze(block, (uint16_t)i);
+            }
+            _coldRecordsFrozen += count;
+            _coldBytesFrozen += rowBytes;
+            _coldBytesEncoded += block->encodedBytes();
+            if (_coldSpill && block->spill(*_coldSpill)) {
+                _coldBytesSpilled += block->encodedBytes();
             }
         }
     }
@@ -23,36 +23,54 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <array>
+#include <deque>
+#include <iterator>
+#include <list>
 #include <map>
+#include <optional>
+#include <random>
 #include <unordered_map>
-#include <deque>
+
+#include <seastar/core/gate.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/shared_ptr.hh>
 
 #include <k2/appbase/AppEssentials.h>
 #include <k2/dto/Collection.h>
 #include <k2/dto/K23SI.h>
+#include <k2/dto/AssignmentManager.h>
 #include <k2/dto/K23SIInspect.h>
 #include <k2/common/Chrono.h>
+#include <k2/common/Timer.h>
 #include <k2/cpo/client/CPOClient.h>
+#include <k2/transport/RetryStrategy.h>
 #include <k2/tso/client/tso_clientlib.h>
 
-#include "ReadCache.h"
+#include "Indexer.h"
+#include "ColdSpill.h"
+#include "FlatReadCache.h"
+#include "HotKeys.h"
+#include "RecordArena.h"
 #include "TxnManager.h"
+#include "WIIndex.h"
 #include "Config.h"
 #include "Persistence.h"
 #include "Log.h"
+#include "PartitionTable.h"
 
 namespace k2 {
 
-
-// the type holding multiple versions of a key
-typedef std::deque<dto::DataRecord> VersionsT;
-// the type holding versions for all keys, i.e. the indexer
-typedef std::map<dto::Key, VersionsT> IndexerT;
-typedef IndexerT::iterator IndexerIterator;
+// schema version -> schema, for all versions of a schema
+typedef std::unordered_map<uint32_t, std::shared_ptr<dto::Schema>> SchemaVersionsT;
 
 class K23SIPartitionModule {
 public: // lifecycle
-    K23SIPartitionModule(dto::CollectionMetadata cmeta, dto::Partition partition);
+    // A migration target takes its state from the migration instead of recovering it from persistence
+    // The requests of the partition are handled in the given scheduling group
+    K23SIPartitionModule(dto::CollectionMetadata cmeta, dto::Partition partition, bool migrationTarget=false, String followPersistence="",
+                         seastar::scheduling_group group=seastar::default_scheduling_group());
     ~K23SIPartitionModule();
 
     seastar::future<> start();
@@ -66,12 +84,27 @@ public: // lifecycle
     seastar::future<std::tuple<Status, dto::K23SIReadResponse>>
     handleRead(dto::K23SIReadRequest&& request, FastDeadline deadline);
 
+    // Batched read of multiple keys from this partition. The request is validated and the read cache is updated
+    // for all keys up front. Any PUSH operations needed for individual keys are performed concurrently
+    seastar::future<std::tuple<Status, dto::K23SIReadMultiResponse>>
+    handleReadMulti(dto::K23SIReadMultiRequest&& request, FastDeadline deadline);
+
     seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
     handleWrite(dto::K23SIWriteRequest&& request, FastDeadline deadline);
 
+    // Batched write of multiple keys into this partition. The writes are applied in order, and all WIs created
+    // by the batch are persisted with a single persistence call before the response is sent
+    seastar::future<std::tuple<Status, dto::K23SIWriteMultiResponse>>
+    handleWriteMulti(dto::K23SIWriteMultiRequest&& request, FastDeadline deadline);
+
     seastar::future<std::tuple<Status, dto::K23SIQueryResponse>>
     handleQuery(dto::K23SIQueryRequest&& request, dto::K23SIQueryResponse&& response, FastDeadline deadline);
 
+    // Returns the next page of a streaming query started by handleQuery, waiting for it to be prepared if needed.
+    // KeyNotFound means the stream is gone and the client should continue with a plain query from nextToScan
+    seastar::future<std::tuple<Status, dto::K23SIQueryResponse>>
+    handleQueryNext(dto::K23SIQueryNextRequest&& request);
+
     seastar::future<std::tuple<Status, dto::K23SITxnPushResponse>>
     handleTxnPush(dto::K23SITxnPushRequest&& request);
 
@@ -81,12 +114,74 @@ public: // lifecycle
     seastar::future<std::tuple<Status, dto::K23SITxnHeartbeatResponse>>
     handleTxnHeartbeat(dto::K23SITxnHeartbeatRequest&& request);
 
+    // heartbeats all of the transactions in the batch, each of which has to have its TRH in this partition
+    seastar::future<std::tuple<Status, dto::K23SITxnHeartbeatMultiResponse>>
+    handleTxnHeartbeatMulti(dto::K23SITxnHeartbeatMultiRequest&& request);
+
     seastar::future<std::tuple<Status, dto::K23SITxnFinalizeResponse>>
     handleTxnFinalize(dto::K23SITxnFinalizeRequest&& request);
 
+    // Finalizes a batch of keys in this partition, possibly from different transactions. The keys are applied one
+    // after another in memory, each gets its own status in the response, and a single persistence call covers them all
+    seastar::future<std::tuple<Status, dto::K23SITxnFinalizeMultiResponse>>
+    handleTxnFinalizeMulti(dto::K23SITxnFinalizeMultiRequest&& request);
+
+    // Responds once all pipelined writes of the transaction in this partition are durable
+    seastar::future<std::tuple<Status, dto::K23SITxnAwaitDurableResponse>>
+    handleTxnAwaitDurable(dto::K23SITxnAwaitDurableRequest&& request);
+
     seastar::future<std::tuple<Status, dto::K23SIPushSchemaResponse>>
     handlePushSchema(dto::K23SIPushSchemaRequest&& request);
 
+    // Splits off the keys at and past the split key into the new partition. The split is refused while any
+    // write intents or unfinalized transaction records are in the upper half. Requests for the upper half
+    // are refused from the start of the split, and the lower half moves to the new pvid once the keys are
+    // durable in the new partition
+    seastar::future<std::tuple<Status, dto::K23SISplitResponse>>
+    handleSplit(dto::K23SISplitRequest&& request);
+
+    // Applies a chunk of keys moved from the partition being split or migrated into this one
+    seastar::future<std::tuple<Status, dto::K23SISplitTransferResponse>>
+    handleSplitTransfer(dto::K23SISplitTransferRequest&& request);
+
+    // Moves the partition to its new core. All keys are sent while we keep serving, followed by rounds of the keys
+    // changed meanwhile. Requests are only refused for the last round, after the requests in flight drained. The
+    // last round carries the transaction records, and the partition then stops for good
+    seastar::future<std::tuple<Status, dto::K23SIMigrateResponse>>
+    handleMigrate(dto::K23SIMigrateRequest&& request);
+
+    // Installs a sorted batch of records as committed versions, persisted with a single append. The whole batch is
+    // refused if any of its records would be older than a version or a read of its key
+    seastar::future<std::tuple<Status, dto::K23SIBulkIngestResponse>>
+    handleBulkIngest(dto::K23SIBulkIngestRequest&& request, FastDeadline deadline);
+
+    // Erases the part of the request range owned by the partition with a single range tombstone. The range is
+    // refused if it has a WI older than the timestamp or was read after it
+    seastar::future<std::tuple<Status, dto::K23SIRangeDeleteResponse>>
+    handleRangeDelete(dto::K23SIRangeDeleteRequest&& request, FastDeadline deadline);
+
+    // Returns the changes committed in the partition after the timestamp of the request, in commit timestamp order,
+    // once no more changes can commit at or below them. Waits for changes if there are none yet
+    seastar::future<std::tuple<Status, dto::K23SIChangesResponse>>
+    handleChanges(dto::K23SIChangesRequest&& request);
+
+    // Exports the committed state of the partition as of a snapshot timestamp, one page per request or into a
+    // file on this node(see K23SIExportRequest). The pages are paced to exportBytesPerSec
+    seastar::future<std::tuple<Status, dto::K23SIExportResponse>>
+    handleExport(dto::K23SIExportRequest&& request);
+
+    // Restores the partition, which must be empty, from an export file on this node. The records are appended to
+    // the index in the order of the file, which is the index order, and copied into the arena one page at a time
+    seastar::future<std::tuple<Status, dto::K23SIRestoreResponse>>
+    handleRestore(dto::K23SIRestoreRequest&& request);
+
+    // Returns the request rate and a split key of the partition since the previous load request
+    seastar::future<std::tuple<Status, dto::K23SIPartitionLoadResponse>>
+    handlePartitionLoad(dto::K23SIPartitionLoadRequest&& request);
+
+    // fills in the partition and its load for the CPO's placement of partitions
+    void getLoad(dto::AssignmentLoadResponse& load) const;
+
     // For test and debug purposes, not normal transaction processsing
     seastar::future<std::tuple<Status, dto::K23SIInspectRecordsResponse>>
     handleInspectRecords(dto::K23SIInspectRecordsRequest&& request);
@@ -107,6 +202,10 @@ public: // lifecycle
     seastar::future<std::tuple<Status, dto::K23SIInspectAllKeysResponse>>
     handleInspectAllKeys(dto::K23SIInspectAllKeysRequest&& request);
 
+    // Returns the keys of the partition with the most reads, writes, pushes and conflict aborts
+    seastar::future<std::tuple<Status, dto::K23SIInspectHotKeysResponse>>
+    handleInspectHotKeys(dto::K23SIInspectHotKeysRequest&& request);
+
 private: // methods
     // this method executes a push operation at the TRH for the given incumbentTxnID in order to
     // determine if the challengerMTR should be allowed to proceed.
@@ -117,13 +216,41 @@ private: // methods
     // In cases where this push operation caused the incumbent transaction to be aborted, the
     // incumbent transaction state at the TRH will be updated to reflect the abort decision.
     // The incumbent transaction will discover upon commit that the txn has been aborted.
+    // Before pushing, the challenger waits up to k23si_conflict_wait_timeout for the WI to be finalized, in which
+    // case it is allowed to proceed without a push.
     seastar::future<bool>
     _doPush(String collectionName, dto::Key key, dto::TxnId incumbentTxnId, dto::K23SI_MTR challengerMTR, FastDeadline deadline);
 
+    // the push of _doPush. Challengers of an incumbent which is already being pushed share that push, unless it
+    // finds the incumbent still in progress
+    seastar::future<bool>
+    _sendPush(String collectionName, dto::Key key, dto::TxnId incumbentTxnId, dto::K23SI_MTR challengerMTR, FastDeadline deadline);
+
+    // sends a push to the TRH of the incumbent. If the incumbent has ended, the outcome is applied to all of its
+    // WIs in this partition
+    seastar::future<bool>
+    _pushTRH(String collectionName, dto::Key key, dto::TxnId incumbentTxnId, dto::K23SI_MTR challengerMTR, FastDeadline deadline);
+
+    // commits or aborts the WI of the incumbent on the given key, according to the state of the incumbent
+    void _applyPushOutcome(const dto::Key& key, const dto::TxnId& incumbentTxnId, dto::TxnRecordState incumbentState);
+
+    // Waits for the WI on the given key to be finalized, for up to the given duration. Returns true if it was
+    seastar::future<bool> _waitForFinalize(const dto::Key& key, Duration timeout);
+
+    // wakes up the challengers waiting for the WI on the given key, once it is finalized
+    void _wakeConflictWaiters(const dto::Key& key);
+
     // validate requests are coming to the correct partition. return true if request is valid
     template<typename RequestT>
     bool _validateRequestPartition(const RequestT& req) const {
-        auto result = req.collectionName == _cmeta.name && req.pvid == _partition().pvid;
+        // a partition being restored doesn't serve until its keys are all in
+        auto result = !_fenced && !_restoreInProgress && req.collectionName == _cmeta.name && req.pvid == _partition().pvid;
+        // a follower only serves snapshot reads
+        if constexpr (std::is_same<RequestT, dto::K23SIReadRequest>::value || std::is_same<RequestT, dto::K23SIReadMultiRequest>::value) {
+            result = result && (!_follower || req.snapshotRead);
+        } else {
+            result = result && !_follower;
+        }
         // validate partition owns the requests' key.
         // 1. common case assumes RequestT a Read request;
         // 2. now for the other cases, only Query request is implemented.
@@ -169,8 +296,18 @@ private: // methods
     template <typename RequestT>
     Status _validateStaleWrite(const RequestT& req, VersionsT& versions);
 
+    // returns the id of the given schema, or SchemaIndexer::NoSchemaId if no version of it was pushed
+    uint32_t _findSchemaId(const String& schemaName) const {
+        uint32_t schemaId = _indexer.findId(schemaName);
+        if (schemaId >= _schemas.size() || _schemas[schemaId].empty()) {
+            return SchemaIndexer::NoSchemaId;
+        }
+        return schemaId;
+    }
+
+    // validates the request and resolves its schema to the schema id
     template <class RequestT>
-    Status _validateReadRequest(const RequestT& request) const {
+    Status _validateReadRequest(const RequestT& request, uint32_t& schemaId) const {
         if (!_validateRequestPartition(request)) {
             // tell client their collection partition is gone
             return dto::K23SIStatus::RefreshCollection("collection refresh needed in read-type request");
@@ -183,7 +320,8 @@ private: // methods
             // the request is outside the retention window
             return dto::K23SIStatus::AbortRequestTooOld("request too old in read-type request");
         }
-        if (_schemas.find(request.key.schemaName) == _schemas.end()) {
+        schemaId = _findSchemaId(request.key.schemaName);
+        if (schemaId == SchemaIndexer::NoSchemaId) {
             // server does not have schema
             return dto::K23SIStatus::OperationNotAllowed("schema does not exist in read-type request");
         }
@@ -191,46 +329,230 @@ private: // methods
         return dto::K23SIStatus::OK("");
     }
 
-    // helper method used to create and persist a WriteIntent
-    seastar::future<> _createWI(dto::K23SIWriteRequest&& request, VersionsT& versions, FastDeadline deadline);
+    // processes a single write. If a batch is given, the created WI is serialized into the batch and it is up
+    // to the caller to persist the batch. Otherwise, the WI is persisted before the returned future completes
+    seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
+    _handleWrite(dto::K23SIWriteRequest&& request, FastDeadline deadline, Payload* batch);
+
+    // applies a finalize request to the record for its key. Sets needsPersist if the record status changed and
+    // the change has to be persisted before responding
+    // The status change of the finalized record, if any, is added to the given update
+    Status _applyFinalize(dto::K23SITxnFinalizeRequest& request, bool& needsPersist, dto::K23SI_PersistencePartialUpdate& update);
+
+    // true if the given ending transaction can be committed in one phase: it wrote no more than onePhaseCommitMaxKeys
+    // keys, and all of them are WIs of the transaction in this partition
+    bool _canCommitOnePhase(const TxnRecord& rec);
+
+    // Commits the transaction in one phase. Its WIs are committed in place, and the commit is persisted along with
+    // them in a single append. There is no finalize, so End completes once the append is durable
+    seastar::future<std::tuple<Status, dto::K23SITxnEndResponse>> _commitOnePhase(TxnRecord& rec);
+
+    // Parallel commit of a transaction whose pipelined writes may still be in flight. The transaction is held in
+    // Staging until the writes are durable in all partitions it wrote to, and is then committed, or aborted if any
+    // of the writes failed
+    seastar::future<std::tuple<Status, dto::K23SITxnEndResponse>> _parallelCommit(TxnRecord& rec);
+
+    // Completes once the writes of the transaction are durable in every partition it wrote to. Fails if any of them
+    // failed to persist
+    seastar::future<> _awaitDurableWrites(const TxnRecord& rec);
+
+    // applies the bucketing and coalescing options from the config to the read cache
+    void _configureReadCache();
+
+    // applies the reloadable options which size the partition's structures, after a config reload
+    void _onConfigReload();
+
+    // estimated distance in nanoseconds between the current TSO time and the read cache watermark
+    int64_t _readCacheWatermarkLag() const;
+
+    // helper method used to create and persist a WriteIntent. See _handleWrite for the meaning of batch
+    seastar::future<> _createWI(dto::K23SIWriteRequest&& request, VersionsT& versions, FastDeadline deadline, Payload* batch);
+
+    // tracks the persistence of a pipelined write until an AwaitDurable request for its transaction collects it
+    void _trackPipelinedWrite(dto::K23SI_MTR mtr, seastar::future<> persistFut);
 
     // helper method used to make a projection SKVRecord payload
-    bool _makeProjection(dto::SKVRecord::Storage& fullRec, dto::K23SIQueryRequest& request, dto::SKVRecord::Storage& projectionRec);
+    bool _makeProjection(dto::SKVRecord::Storage& fullRec, const std::vector<String>& projection,
+                         const SchemaVersionsT& schemaVersions, dto::SKVRecord::Storage& projectionRec);
 
-    // method to parse the partial record to full record, return turn if parse successful
-    bool _parsePartialRecord(dto::K23SIWriteRequest& request, dto::DataRecord& previous);
+    // Makes the response of a read which found the given record(or none), applying the request's projection
+    seastar::future<std::tuple<Status, dto::K23SIReadResponse>>
+    _makeReadOK(dto::DataRecord* rec, const dto::K23SIReadRequest& request, uint32_t schemaId);
 
-    // make every fields for a partial update request in the condition of same schema and same version
-    bool _makeFieldsForSameVersion(dto::Schema& schema, dto::K23SIWriteRequest& request, dto::DataRecord& version);
+    // method to parse the partial record to full record, return turn if parse successful
+    bool _parsePartialRecord(dto::K23SIWriteRequest& request, const SchemaVersionsT& schemaVersions,
+                             dto::DataRecord& previous);
+
+    // evaluates the condition of a write request against the latest version of its record. Returns
+    // ConditionFailed if the condition isn't met
+    Status _checkWriteCondition(dto::K23SIWriteRequest& request, const SchemaVersionsT& schemaVersions,
+                                VersionsT& versions);
+
+    // applies the fieldOps of a partial update request to the values of their fields in the request, against the
+    // latest version of the record. Returns ConditionFailed if a CompareAndSet doesn't match
+    Status _applyFieldOps(dto::K23SIWriteRequest& request, const SchemaVersionsT& schemaVersions,
+                          dto::DataRecord& previous);
+
+    // make every fields for a partial update request in the condition of same schema and same version.
+    // updatedFields has the bits of the fields in request.fieldsForPartialUpdate set
+    bool _makeFieldsForSameVersion(dto::Schema& schema, dto::K23SIWriteRequest& request, dto::DataRecord& version,
+                                   const dto::FieldBitmap& updatedFields);
     // make every fields for a partial update request in the condition of same schema and different versions
-    bool _makeFieldsForDiffVersion(dto::Schema& schema, dto::Schema& baseSchema, dto::K23SIWriteRequest& request, dto::DataRecord& version);
+    bool _makeFieldsForDiffVersion(dto::Schema& schema, dto::Schema& baseSchema, dto::K23SIWriteRequest& request,
+                                   dto::DataRecord& version, const dto::FieldBitmap& updatedFields);
 
     // find field number matches to 'fieldName'and'fieldtype' in schema, return -1 if do not find
-    std::size_t _findField(const dto::Schema schema, k2::String fieldName ,dto::FieldType fieldtype);
-
-    // judge whether fieldIdx is in fieldsForPartialUpdate. return true if yes(is in fieldsForPartialUpdate).
-    bool _isUpdatedField(uint32_t fieldIdx, std::vector<uint32_t> fieldsForPartialUpdate);
+    std::size_t _findField(const dto::Schema& schema, const k2::String& fieldName, dto::FieldType fieldtype);
 
     // recover data upon startup
     seastar::future<> _recovery();
 
-    // Helper for iterating over the indexer, modifies it to end() if iterator would go past the target schema
-    // or if it would go past begin() for reverse scan. Starting iterator must not be end() and must
-    // point to a record with the target schema
-    void _scanAdvance(IndexerIterator& it, bool reverseDirection, const String& schema);
+    // Helper for iterating over the schema index, modifies it to end() if iterator would go past begin()
+    // for reverse scan. Starting iterator must not be end()
+    void _scanAdvance(IndexerT& index, IndexerIterator& it, bool reverseDirection);
 
-    // Helper for handleQuery. Returns an iterator to start the scan at, accounting for
-    // desired schema and (eventually) reverse direction scan
-    IndexerIterator _initializeScan(const dto::Key& start, bool reverse, bool exclusiveKey);
+    // Scans one page of a query. The request is updated as the scan goes (e.g. its key across a push),
+    // so the caller must keep it alive until the returned future is ready
+    seastar::future<std::tuple<Status, dto::K23SIQueryResponse>>
+    _queryPage(dto::K23SIQueryRequest& request, dto::K23SIQueryResponse&& response, FastDeadline deadline);
+
+    // The rest of a streaming query in this partition. Pages are prepared ahead of the client, with an
+    // owned copy of the request, as long as the client has given credits for them
+    struct _QueryStream {
+        uint64_t id = 0;
+        // the request for the next page to prepare
+        dto::K23SIQueryRequest request;
+        // prepared pages, in scan order
+        std::deque<std::tuple<Status, dto::K23SIQueryResponse>> pages;
+        // number of pages which may still be prepared ahead of the client
+        uint32_t credits = 0;
+        bool producing = false;
+        // true once the last page of the partition has been prepared
+        bool done = false;
+        // set while a client waits for a page
+        std::optional<seastar::promise<>> pageWaiter;
+        TimePoint lastAccess;
+    };
+
+    // A query filter and projection registered by a client(see K23SIQueryRequest::preparedQueryId)
+    struct _PreparedQuery {
+        dto::expression::Expression filter;
+        std::vector<String> projection;
+        // position in _preparedQueriesLRU
+        std::list<uint64_t>::iterator lru;
+    };
+
+    // Registers the filter and projection of a prepared query, or fills them in from a registered one
+    Status _bindPreparedQuery(dto::K23SIQueryRequest& request);
+
+    // Background loop which prepares pages of the stream until it is done or runs out of credits
+    void _produceQueryPages(seastar::lw_shared_ptr<_QueryStream> stream);
+
+    // Moves the stream's request past the given page. Returns true if the stream has more pages to prepare
+    bool _advanceQueryStream(_QueryStream& stream, const Status& status, const dto::K23SIQueryResponse& response);
+
+    // Hands the first prepared page of the stream to the client, forgetting the stream after its last page
+    std::tuple<Status, dto::K23SIQueryResponse> _takeQueryStreamPage(_QueryStream& stream);
+
+    // Drops streams which no client has asked for a page in a while
+    seastar::future<> _expireQueryStreams();
+
+    // The read cache range of a query whose next page may continue in this partition. The next page starts at
+    // the edge of the range, so it extends the range instead of inserting one of its own
+    struct _QueryReadRange {
+        dto::Key low;
+        dto::Key high;
+        TimePoint lastAccess;
+    };
+
+    // Records the read of [low, high] by a page of the given query in the read cache. continues tells
+    // whether the query may continue with another page in this partition
+    void _recordQueryRead(const dto::K23SIQueryRequest& request, const dto::Key& low, const dto::Key& high, bool continues);
+
+    // Forgets the ranges of the queries which haven't continued in a while
+    void _expireQueryReadRanges();
+
+    // Helper for handleQuery. Returns an iterator in the schema index to start the scan at, accounting for
+    // reverse direction scan
+    IndexerIterator _initializeScan(IndexerT& index, const dto::Key& start, bool reverse, bool exclusiveKey);
 
     // Helper for handleQuery. Checks to see if the indexer scan should stop.
-    bool _isScanDone(const IndexerIterator& it, const dto::K23SIQueryRequest& request, size_t response_size);
+    bool _isScanDone(IndexerT& index, const IndexerIterator& it, const dto::K23SIQueryRequest& request,
+                     size_t response_size, size_t response_bytes);
 
     // Helper for handleQuery. Returns continuation token (aka response.nextToScan)
-    dto::Key _getContinuationToken(const IndexerIterator& it, const dto::K23SIQueryRequest& request,
+    dto::Key _getContinuationToken(IndexerT& index, const IndexerIterator& it, const dto::K23SIQueryRequest& request,
                                             dto::K23SIQueryResponse& response, size_t response_size);
 
-    std::tuple<Status, bool> _doQueryFilter(dto::K23SIQueryRequest& request, dto::SKVRecord::Storage& storage);
+    std::tuple<Status, bool> _doQueryFilter(dto::K23SIQueryRequest& request,
+                                            const SchemaVersionsT& schemaVersions,
+                                            dto::expression::CompiledExpression& filter,
+                                            dto::SKVRecord::Storage& storage);
+
+    // A visible record found by a query scan, waiting for the filter to be applied to it
+    struct _QueryCandidate {
+        IndexerIterator it;
+        dto::SKVRecord::Storage* value;
+    };
+
+    // Ranks the records of an ordered query
+    typedef dto::RecordRanker<dto::SKVRecord::Storage> _QueryRanker;
+
+    // Helper for handleQuery. Applies the filter to the given candidates as a batch and fills in the selection.
+    // Returns false if the batch could not be evaluated as a whole, and so each candidate must be filtered
+    // on its own with _doQueryFilter
+    bool _doQueryFilterBatch(dto::K23SIQueryRequest& request, const SchemaVersionsT& schemaVersions,
+                             dto::expression::CompiledExpression& filter,
+                             std::vector<_QueryCandidate>& candidates, std::vector<uint8_t>& selection);
+
+    // Helper for handleQuery. Filters the pending candidates in scan order, adds the ones which pass to
+    // the response, accounting their size in responseBytes, and clears the candidates.
+    // If the response fills up, the iterator is moved to the candidate
+    // which filled it and the bool in the tuple is true. If the returned Status is not OK, the caller should
+    // return the status in the query response
+    std::tuple<Status, bool> _flushQueryCandidates(dto::K23SIQueryRequest& request,
+                                                   const SchemaVersionsT& schemaVersions,
+                                                   dto::expression::CompiledExpression& filter,
+                                                   std::vector<dto::Aggregator>& aggregators,
+                                                   std::optional<_QueryRanker>& ranker,
+                                                   std::vector<_QueryCandidate>& candidates,
+                                                   dto::K23SIQueryResponse& response, size_t& responseBytes,
+                                                   IndexerIterator& it);
+
+    // Helper for handleQuery. Adds the given record to the response, applying the request's projection
+    // and accounting its size in responseBytes. For aggregate queries it is aggregated instead, and for
+    // ordered queries it is ranked
+    Status _addQueryResult(dto::K23SIQueryRequest& request, const SchemaVersionsT& schemaVersions,
+                           std::vector<dto::Aggregator>& aggregators, std::optional<_QueryRanker>& ranker,
+                           dto::SKVRecord::Storage& value, dto::K23SIQueryResponse& response, size_t& responseBytes);
+
+    // Helper for handleQuery. Ranks the given record, or its projection, unless it comes from the
+    // response(the records ranked before a push)
+    Status _rankQueryResult(dto::K23SIQueryRequest& request, const SchemaVersionsT& schemaVersions,
+                            _QueryRanker& ranker, dto::SKVRecord::Storage& value, bool fromResponse);
+
+    // Helper for handleQuery. Folds the given record into the aggregators of an aggregate query
+    Status _aggregateQueryResult(dto::K23SIQueryRequest& request, const SchemaVersionsT& schemaVersions,
+                                 std::vector<dto::Aggregator>& aggregators,
+                                 dto::SKVRecord::Storage& value, dto::K23SIQueryResponse& response);
+
+    // Helper for handleQuery. Sets the response's partial aggregates to the current results of the aggregators
+    void _setQueryAggregates(std::vector<dto::Aggregator>& aggregators, dto::K23SIQueryResponse& response);
+
+    // Helper for handleQuery. Moves the records of the response of a columnar query into its columns
+    Status _makeQueryColumns(dto::K23SIQueryRequest& request, const SchemaVersionsT& schemaVersions,
+                             dto::K23SIQueryResponse& response);
+
+    // Number of records in the query response, including those folded into aggregates or columns, and those
+    // which were ranked but didn't make it to the results
+    static size_t _queryResponseSize(const dto::K23SIQueryResponse& response) {
+        return std::max<size_t>(response.results.size(), response.rankedRecords) + response.aggregatedRecords +
+               response.columns.numRows;
+    }
+
+    // Helper for handleQuery. Checks to see if the response has as many records, or as many bytes of records,
+    // as it may hold
+    bool _isQueryResponseFull(const dto::K23SIQueryRequest& request, size_t response_size, size_t response_bytes);
 
 private: // members
     // the metadata of our collection
@@ -246,26 +568,266 @@ private: // members
     // the the data record with the given key which is not newer than the given timestsamp
     // The returned pointer is invalid if any modifications are made to the indexer;
     dto::DataRecord* _getDataRecord(const dto::Key& key, const dto::Timestamp& timestamp);
+    // same as above, for a key of the schema with the given id(which may be SchemaIndexer::NoSchemaId)
+    dto::DataRecord* _getDataRecord(uint32_t schemaId, const dto::Key& key, const dto::Timestamp& timestamp);
 
-    // utility method used to update the indexer when removing a record
-    void _removeRecord(dto::DataRecord& rec);
+    // the versions of the given key of the schema with the given id, or nullptr if the key is not in the indexer
+    VersionsT* _findVersions(uint32_t schemaId, const dto::Key& key);
 
-    // to store data. The deque contains versions of a key, sorted in decreasing order of their ts.end.
-    // (newest item is at front of the deque)
+    // the TTL of the records written with the given version of a schema
+    static Duration _schemaTTL(const SchemaVersionsT& schemaVersions, uint32_t schemaVersion);
+
+    // Inserts the range tombstones covering the key into its versions, as committed tombstones at their
+    // timestamps. After that the range delete looks like a per-key erase to everything which uses the versions
+    void _applyRangeTombstones(const dto::Key& key, VersionsT& versions) {
+        if (!_rangeTombstones.empty()) {
+            _materializeRangeTombstones(key, versions);
+        }
+    }
+    void _materializeRangeTombstones(const dto::Key& key, VersionsT& versions);
+    // adds a range tombstone unless we have it already, e.g. from a replay of an earlier checkpoint
+    void _addRangeTombstone(dto::K23SI_PersistenceRangeTombstone&& range);
+    // appends the range tombstones to the WAL, so that they outlive the truncation of the WAL by a checkpoint
+    seastar::future<> _persistRangeTombstones();
+
+    // Change streams. Commits are recorded as pending changes, and move into the change log in timestamp order once
+    // the watermark passed them: the newest timestamp at or below which nothing else can commit. That is the snapshot
+    // horizon, or just below the oldest WI or in-flight bulk ingest if that is older
+    void _recordChange(const dto::Key& key, dto::DataRecord& rec);
+    void _resolveChanges();
+    // starts the change log at the current time, since the commits before it may have been lost with a previous
+    // incarnation of the partition
+    seastar::future<> _startChanges();
+
+    // the version a snapshot read sees: same as above, but skips over aborted versions. A WI is returned as it is,
+    // since it may still commit into the snapshot, so the read has to wait for it to be finalized
+    VersionsT::iterator _getSnapshotVersion(VersionsT& versions, const dto::Timestamp& timestamp);
+    dto::DataRecord* _getSnapshotRecord(const dto::Key& key, const dto::Timestamp& timestamp);
+    dto::DataRecord* _getSnapshotRecord(uint32_t schemaId, const dto::Key& key, const dto::Timestamp& timestamp);
+
+    // checks that a snapshot read at the given timestamp is stale enough. The keys it reads are recorded in the
+    // snapshot read cache by the caller, so that no writes can land underneath the snapshot
+    Status _admitSnapshotRead(const dto::Timestamp& timestamp);
+
+    // the timestamp of the oldest WI or in-flight bulk ingest, which may still commit at it
+    std::optional<dto::Timestamp> _oldestPendingWrite() const;
+
+    // utility method used to update the indexer when removing a record for the given key
+    void _removeRecord(const dto::Key& key, dto::DataRecord& rec);
+
+    // Run one pass of the background garbage collector over the entire indexer. The pass processes the
+    // indexer in chunks, yielding between them, and may be interleaved with request processing
+    seastar::future<> _gcPass();
+
+    // Garbage-collect up to gcChunkSize keys in the index of the given schema, starting at the given key. Updates
+    // the key to the next key to process and returns true if the end of the index was reached.
+    // The keys which remain are added to the given key filter, if any, and the cold ones are frozen
+    bool _gcChunk(uint32_t schemaId, KeyFilter* filter, dto::Key& cursor);
+
+    // Freezes the cold keys in the given range of the index of the given schema into ColdBlocks
+    void _freezeColdKeys(uint32_t schemaId, IndexerIterator begin, IndexerIterator end);
+
+    // Garbage-collect the versions of the given key of the given schema. Returns the iterator to the next key
+    IndexerIterator _gcKey(uint32_t schemaId, KeyFilter* filter, IndexerIterator it);
+
+    // Take a checkpoint of the partition. The indexer is streamed in key order to persistence in chunks, yielding
+    // between them. Once the checkpoint completes, the persistence can drop the WAL records below its LSN.
+    // Returns true if the checkpoint completed
+    seastar::future<bool> _checkpointPass();
+
+    // Same as above, after any checkpoint already in progress, so that an older checkpoint never replaces a newer one
+    seastar::future<bool> _checkpoint();
+
+    // arms the checkpoint timer, if checkpoints are configured
+    void _startCheckpoints();
+
+    // Serialize the versions of keys in the given schema index, starting at the given key, until the chunk reaches
+    // checkpointChunkBytes. Updates the key to the next key to process and returns true if the end of the index was reached.
+    // If owner is given, only the keys it owns are written, and at most gcChunkSize keys are looked at
+    bool _checkpointChunk(IndexerT& index, dto::Key& cursor, Payload& chunk, const dto::OwnerPartition* owner=nullptr);
+
+    // Same as above for the given keys, starting at keys[next]. Keys which are not in the indexer are written
+    // without versions. Returns true once all keys were written
+    bool _changedKeysChunk(const std::vector<dto::Key>& keys, size_t& next, Payload& chunk);
+
+    // serialize one key and its versions into a checkpoint chunk
+    void _writeChunkEntry(const dto::Key& key, VersionsT& versions, Payload& chunk);
+
+    // Fills in the next page of an export from the schema and cursor of the request, which must have its snapshot
+    // set. The snapshot is admitted again for each page, since the retention window moves while the export runs.
+    // The page stops at a WI within the snapshot and sets pending, with the cursor at the key of the WI
+    Status _exportPage(const dto::K23SIExportRequest& request, dto::K23SIExportResponse& page, bool& pending);
+
+    // exports the pages of the request into its file, and returns the totals
+    seastar::future<std::tuple<Status, dto::K23SIExportResponse>> _exportToFile(dto::K23SIExportRequest&& request);
+
+    // Returns the future to wait on before handing out an exported page of the given size, which keeps the
+    // exports of the partition to exportBytesPerSec
+    seastar::future<> _paceExport(uint64_t bytes);
+
+    // installs the records of an exported page as committed versions at its snapshot
+    void _applyRestorePage(dto::K23SIExportResponse& page);
+
+    // Recovery loads the latest checkpoint and then replays the WAL records written since the checkpoint.
+    // walStart is set to the LSN at which the WAL replay has to start
+    seastar::future<> _recoverCheckpoint(uint64_t& walStart);
+    // Replays the WAL up to its end as of the first response. Returns the LSN at which the next replay has to start
+    seastar::future<uint64_t> _recoverWAL(uint64_t walStart);
+
+    // A follower polls persistence for the WAL records written since its last replay. If the records were
+    // truncated in the meantime, it reloads the partition from the latest checkpoint instead
+    seastar::future<> _followWAL();
+
+    // Closes the current TSO time minus snapshotReadMinStaleness, or just below the oldest pending write if that is
+    // older: writes at or below it are rejected from now on, and the closed timestamp is written to the WAL for the
+    // followers of the partition
+    seastar::future<> _closeTimestamp();
+
+    // helpers used to apply recovered state to the indexer
+    void _applyCheckpointChunk(Payload& entries);
+    // removes the WI of a key whose versions are replaced or dropped by a chunk
+    void _dropChunkWIs(const dto::Key& key, VersionsT& versions);
+    void _replayWALBatch(Payload& batch);
+    void _replayDataRecord(dto::DataRecord&& rec);
+    void _replayPartialUpdate(dto::K23SI_PersistencePartialUpdate& update);
+
+    void _registerMetrics();
+
+    // counts a request for the given key towards the load of the partition, and samples its partition key
+    void _recordLoad(const dto::Key& key);
+
+    // runs the handler of a request for the given key from the given transaction, recording its load and latency,
+    // and setting them as the context of the request for the slow request log
+    template <typename Func>
+    auto _withLoad(const dto::Key& key, const dto::K23SI_MTR& mtr, Func&& handler) {
+        _recordLoad(key);
+        if (SlowLog::current()) {
+            SlowLog::annotate(_partition().pvid.id, key.partitionHash(), mtr.txnid, mtr.timestamp.tEndTSECount());
+        }
+        auto start = TSCClock::now();
+        return _inFlight(std::forward<Func>(handler)).finally([this, start] {
+            _requestLatency.add(TSCClock::now() - start);
+        });
+    }
+
+    // the status codes of the responses which are counted separately for each verb. The other codes are counted together
+    static constexpr int _countedStatusCodes[] = {200, 201, 403, 404, 405, 406, 409, 410, 412, 422, 500};
+
+    // the latency and the response status codes of the requests of one verb
+    struct _VerbMetrics {
+        LogLinearHistogram latency;
+        // by the index of the code in _countedStatusCodes, with the other codes in the last slot
+        std::array<uint64_t, std::size(_countedStatusCodes) + 1> responses{};
+
+        void count(const Status& status) {
+            size_t i = 0;
+            while (i < std::size(_countedStatusCodes) && _countedStatusCodes[i] != status.code) {
+                ++i;
+            }
+            responses[i]++;
+        }
+    };
+
+    // runs the handler of a request, recording its latency and the status of its response in the metrics of its verb
+    template <typename Func>
+    auto _measured(_VerbMetrics& metrics, Func&& handler) {
+        auto start = TSCClock::now();
+        return handler().then([&metrics, start] (auto&& result) {
+            metrics.latency.add(TSCClock::now() - start);
+            metrics.count(std::get<0>(result));
+            return std::move(result);
+        });
+    }
+
+    // the metric definitions of a verb, see _VerbMetrics
+    static std::vector<sm::metric_definition> _verbMetricDefinitions(const char* verb, _VerbMetrics& metrics,
+                                                                     const std::vector<sm::label_instance>& labels);
+
+    // runs the handler of a request which may change the partition, counting it as in flight until it completes
+    template <typename Func>
+    auto _inFlight(Func&& handler) {
+        ++_requestsInFlight;
+        return handler().finally([this] {
+            if (--_requestsInFlight == 0 && _requestsDrained) {
+                _requestsDrained->set_value();
+                _requestsDrained.reset();
+            }
+        });
+    }
+
+    // resolves once no requests are in flight
+    seastar::future<> _drainRequests();
+
+    // sends a chunk of keys to a new partition of a split or migration, failing if it isn't accepted
+    seastar::future<> _sendTransfer(const dto::Partition& target, dto::K23SISplitTransferRequest& request);
+
+    // streams the keys at and past fromKey to the target partition of a split or migration. Keys of hash
+    // partitions are not ordered by their hash, so for them the whole index is scanned for the keys the target owns
+    seastar::future<> _transferKeys(String fromKey, dto::Partition target);
+
+    // streams the keys changed since the previous call to the target partition of a migration. Returns their number
+    seastar::future<uint64_t> _transferChanges(dto::Partition target);
+
+    // removes the keys owned by the new partition of a split from the indexer, yielding every gcChunkSize keys.
+    // Returns the number of keys removed
+    seastar::future<uint64_t> _dropMovedKeys(dto::Partition moved);
+
+    // to store data. The version chain contains versions of a key, sorted in decreasing order of their ts.end.
+    // (newest item is at front of the chain)
     // Duplicates are not allowed
-    IndexerT _indexer;
+    // The key is only stored in the index. The DataRecords in the version chains have an empty key and users
+    // should use the key from the index instead
+    SchemaIndexer _indexer;
+
+    // the outstanding write intents in this partition, grouped by transaction
+    WIIndex _wiIndex;
+
+    // the persistence state of the pipelined writes of a transaction in this partition. The entry of a txn whose
+    // writes all became durable is dropped, and that of a txn with a failed write is kept until it is finalized
+    struct PipelinedWrites {
+        uint64_t pending = 0;
+        bool failed = false;
+        // AwaitDurable requests waiting for the pending writes
+        std::vector<seastar::promise<>> waiters;
+    };
+    std::unordered_map<dto::K23SI_MTR, PipelinedWrites> _pipelinedWrites;
+
+    // the transactions in Staging, for the pushes and re-entrant ends which wait for their outcome
+    std::unordered_map<dto::K23SI_MTR, seastar::shared_promise<>> _stagedTxns;
+
+    // a challenger waiting for the WI on a key to be finalized
+    struct ConflictWaiter {
+        uint64_t id;
+        seastar::promise<> promise;
+    };
+    // by key: the challengers waiting for the WI on the key to be finalized. A waiter which times out removes itself,
+    // since the WI may go away without a finalize, e.g. by GC or with a range which is split or migrated away
+    std::unordered_map<dto::Key, std::vector<ConflictWaiter>> _conflictWaiters;
+    uint64_t _nextConflictWaiterId = 0;
+
+    // by incumbent: the pushes in flight from this partition
+    std::unordered_map<dto::K23SI_MTR, seastar::shared_future<std::tuple<Status, dto::K23SITxnPushResponse>>> _inflightPushes;
 
     // to store transactions
     TxnManager _txnMgr;
 
     // read cache for keeping track of latest reads
-    std::unique_ptr<ReadCache<dto::Key, dto::Timestamp>> _readCache;
+    std::unique_ptr<FlatReadCache<dto::Key, dto::Timestamp>> _readCache;
+    // the key ranges read by snapshot reads, at their snapshot. Kept apart from the read cache so that reporting
+    // reads don't churn it, and checked by writers the same way
+    std::unique_ptr<FlatReadCache<dto::Key, dto::Timestamp>> _snapshotReadCache;
+    ConfigReloadObserver _configObserver{[this] { _onConfigReload(); }};
 
-    // schema name -> (schema version -> schema)
-    std::unordered_map<String, std::unordered_map<uint32_t, std::shared_ptr<dto::Schema>>> _schemas;
+    // by schema id(the id of the schema name in _indexer): schema version -> schema.
+    // Requests resolve their schema name once, and then use the id for all lookups of the schema and its index
+    std::vector<SchemaVersionsT> _schemas;
 
     // config
     K23SIConfig _config;
+    K23SIHotConfig _hot{_config};
+
+    // memory for the record payloads in this partition
+    RecordArena _arena;
 
     // the timestamp of the end of the retention window. We do not allow operations to occur before this timestamp
     dto::Timestamp _retentionTimestamp;
@@ -276,15 +838,178 @@ private: // members
     // used to tell if there is a refresh in progress so that we don't stop() too early
     seastar::future<> _retentionRefresh = seastar::make_ready_future();
 
+    // timer used to drive the background garbage collection
+    PeriodicTimer _gcTimer;
+
+    // timer used to drive the periodic checkpoints
+    PeriodicTimer _checkpointTimer;
+    seastar::semaphore _checkpointSem{1};
+
+    // timer used to drive the WAL polling of a follower, or the closed timestamps of a partition with followers
+    PeriodicTimer _walTimer;
+    bool _stopped = false;
+    // the stop started by a migration or by the partition manager, whichever comes first
+    std::optional<seastar::shared_future<>> _stopFuture;
+    seastar::future<> _stop();
+
+    // streaming queries by stream id
+    std::unordered_map<uint64_t, seastar::lw_shared_ptr<_QueryStream>> _queryStreams;
+    uint64_t _nextQueryStreamId = 1;
+    // held by the background page producers of the streams
+    seastar::gate _queryStreamGate;
+    // prepared queries by id, and their ids from the most to the least recently used
+    std::unordered_map<uint64_t, _PreparedQuery> _preparedQueries;
+    std::list<uint64_t> _preparedQueriesLRU;
+    uint64_t _preparedQueryMisses = 0;
+    // timer used to drop idle query streams and read ranges
+    PeriodicTimer _queryStreamTimer;
+    // the read cache ranges of queries which may continue with another page, by transaction
+    std::unordered_map<dto::K23SI_MTR, std::vector<_QueryReadRange>> _queryReadRanges;
+
+    // metrics
+    sm::metric_groups _metricGroups;
+    uint64_t _readCacheConflictRejects = 0;
+    uint64_t _readCacheWatermarkRejects = 0;
+    uint64_t _snapshotHorizonRejects = 0;
+    uint64_t _snapshotReadConflictRejects = 0;
+    uint64_t _snapshotReads = 0;
+    uint64_t _pipelinedWritesCount = 0;
+    uint64_t _pipelinedWriteFailures = 0;
+    uint64_t _onePhaseCommits = 0;
+    uint64_t _parallelCommits = 0;
+    uint64_t _parallelCommitAborts = 0;
+    uint64_t _conflictWaits = 0;
+    uint64_t _conflictWaitTimeouts = 0;
+    uint64_t _sharedPushes = 0;
+    uint64_t _fieldOps = 0;
+    uint64_t _conditionalWriteRejects = 0;
+    uint64_t _rangeDeletes = 0;
+    uint64_t _rangeTombstonesApplied = 0;
+    // the range deletes which may not be applied to all of their keys yet, in the order they were made. They are
+    // dropped once the retention window passed them and a GC pass applied them to all keys
+    std::vector<dto::K23SI_PersistenceRangeTombstone> _rangeTombstones;
+    // the recorded changes which the watermark hasn't passed yet, in commit order
+    std::vector<dto::K23SIChange> _changesPending;
+    // the change log, sorted by timestamp. It holds all changes committed after _changesStart and at or below
+    // _changesResolved, the watermark as of the last poll
+    std::deque<dto::K23SIChange> _changes;
+    std::optional<dto::Timestamp> _changesStart;
+    dto::Timestamp _changesResolved;
+    // the timestamps of the bulk ingests which are being persisted
+    std::vector<dto::Timestamp> _changesHeld;
+    uint64_t _changesRecorded = 0;
+    uint64_t _changePolls = 0;
+    // the newest timestamp the partition closed, for its followers, a change stream poll or a restore. Writes at or
+    // below it are rejected. Snapshot reads don't move it, they are tracked per key range in _snapshotReadCache
+    dto::Timestamp _snapshotHorizon;
+    // offset from our local clock to TSO time, as of the last timestamp we got from the TSO. Used to estimate
+    // how far the read cache watermark lags behind the current time
+    int64_t _tsoClockOffset = 0;
+    uint64_t _gcVersionsReclaimed = 0;
+    uint64_t _gcBytesReclaimed = 0;
+    uint64_t _gcKeysRemoved = 0;
+    uint64_t _gcKeysExpired = 0;
+    uint64_t _keyFilterRejects = 0;
+    uint64_t _gcBytesRelocated = 0;
+    uint64_t _coldRecordsFrozen = 0;
+    uint64_t _coldBytesFrozen = 0;
+    uint64_t _coldBytesEncoded = 0;
+    uint64_t _coldBytesSpilled = 0;
+    // where the cold blocks are spilled to, if k23si_cold_spill_dir is set
+    std::unique_ptr<ColdSpill> _coldSpill;
+    uint64_t _checkpointsCompleted = 0;
+    uint64_t _checkpointsFailed = 0;
+    uint64_t _recoveredKeys = 0;
+    uint64_t _bulkIngestedRecords = 0;
+    uint64_t _exportedRecords = 0;
+    uint64_t _exportedBytes = 0;
+    uint64_t _restoredRecords = 0;
+    uint64_t _replayedWALRecords = 0;
+    uint64_t _queryStreamsStarted = 0;
+    uint64_t _queryStreamsExpired = 0;
+    uint64_t _queryReadRangesExtended = 0;
+    uint64_t _splitsCompleted = 0;
+    uint64_t _splitsRefused = 0;
+    uint64_t _splitKeysMoved = 0;
+    _VerbMetrics _readMetrics;
+    _VerbMetrics _readMultiMetrics;
+    _VerbMetrics _queryMetrics;
+    _VerbMetrics _writeMetrics;
+    _VerbMetrics _writeMultiMetrics;
+    _VerbMetrics _pushMetrics;
+    _VerbMetrics _endMetrics;
+    _VerbMetrics _finalizeMetrics;
+    _VerbMetrics _heartbeatMetrics;
+    // the outcomes of the pushes to the transactions of this TRH, by the state of the incumbent
+    uint64_t _pushesIncumbentAborted = 0;
+    uint64_t _pushesIncumbentWon = 0;
+    uint64_t _pushesIncumbentCommitted = 0;
+    // the versions of all keys and the bytes of their values which are not in cold blocks, as of the last
+    // complete GC pass, and the counts of the pass in progress
+    uint64_t _indexedVersions = 0;
+    uint64_t _indexedValueBytes = 0;
+    uint64_t _gcPassVersions = 0;
+    uint64_t _gcPassValueBytes = 0;
+
+    // set while the partition is being split or migrated
+    bool _splitInProgress = false;
+
+    // set while an export into a file runs
+    bool _exportToFileInProgress = false;
+    // set while a restore runs
+    bool _restoreInProgress = false;
+    // closed on stop, once the exports into and restores from files are done
+    seastar::gate _backupGate;
+    // exported pages are handed out no earlier than this, to pace the exports
+    TimePoint _exportPace = Clock::now();
+
+    // set until the migration which moves this partition here completes. We don't checkpoint the partial state
+    bool _migrationTarget = false;
+    // set once a migration starts handing the partition over to its new core. All requests are refused from then on
+    bool _fenced = false;
+    uint64_t _migrationsCompleted = 0;
+    uint64_t _migrationKeysMoved = 0;
+
+    // set if this is a read-only follower of the partition. It replays the WAL of the partition from persistence
+    // and serves snapshot reads at or below the newest closed timestamp it replayed
+    bool _follower = false;
+    dto::Timestamp _closedTimestamp;
+    // the LSN at which the next WAL replay of a follower starts
+    uint64_t _walReplayedLSN = 0;
+    uint64_t _followerResyncs = 0;
+    uint64_t _closedTimestampsWritten = 0;
+
+    // the requests which may still change the partition, and the waiter for them to complete
+    uint64_t _requestsInFlight = 0;
+    std::optional<seastar::promise<>> _requestsDrained;
+
+    // the load since the previous load request: the number of requests and a reservoir sample of their keys
+    uint64_t _loadRequests = 0;
+    uint64_t _requestsServed = 0;
+    // the part of _loadRequests which were snapshot reads and queries
+    uint64_t _loadSnapshotReads = 0;
+    LatencyTracker _requestLatency{1024};
+    TimePoint _loadSince = CachedSteadyClock::now();
+    std::vector<String> _loadKeySamples;
+    std::mt19937 _loadRng{std::random_device{}()};
+
+    // the keys with the most contention since the previous reset, for the hot keys inspect request
+    HotKeys _hotReads{_config.hotKeys(), _config.hotKeysSampleInterval()};
+    HotKeys _hotWrites{_config.hotKeys(), _config.hotKeysSampleInterval()};
+    HotKeys _hotPushes{_config.hotKeys()};
+    HotKeys _hotAborts{_config.hotKeys()};
+
     // TODO persistence
     Persistence _persistence;
 
     CPOClient _cpo;
 
+    // our request handlers in the partition table of the core. Declared last so that they are removed first
+    K23SIPartitionTable::Routes _routes;
+
     // get timeNow Timestamp from TSO
     seastar::future<dto::Timestamp> getTimeNow() {
-        thread_local TSO_ClientLib& tsoClient = AppBase().getDist<TSO_ClientLib>().local();
-        return tsoClient.GetTimestampFromTSO(Clock::now());
+        return AppBase().getLocal<TSO_ClientLib>().GetTimestampFromTSO(Clock::now());
     }
 };
 
@@ -0,0 +1,135 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <k2/common/HugePagePool.h>
+#include <k2/common/MemoryAccounting.h>
+
+namespace k2 {
+
+// A per-thread arena for fixed-size objects. Memory is carved out of large slabs and recycled via a free-list,
+// so we don't pay for a general-purpose allocation(and its header) per object. Slabs are never released, and they
+// are accounted to the given subsystem. Slabs come from the huge page pool of the core when it is enabled.
+template <typename T, mem::Subsystem S, size_t SlabSize = 256>
+class NodeArena {
+public:
+    static NodeArena& local() {
+        static thread_local NodeArena arena;
+        return arena;
+    }
+
+    template <typename... Args>
+    T* make(Args&&... args) {
+        return new (allocate()) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* obj) {
+        obj->~T();
+        deallocate(obj);
+    }
+
+    // uninitialized storage for one T, e.g. for the nodes of a container(see NodeArenaAllocator)
+    void* allocate() {
+        if (_free == nullptr) {
+            _grow();
+        }
+        auto* slot = _free;
+        _free = slot->next;
+        return slot->storage();
+    }
+
+    void deallocate(void* ptr) {
+        auto* slot = reinterpret_cast<Slot*>(ptr);
+        slot->next = _free;
+        _free = slot;
+    }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) char data[sizeof(T)];
+        void* storage() { return data; }
+    };
+
+    void _grow() {
+        Slot* slab = static_cast<Slot*>(mem::HugePagePool::local().allocatePermanent(sizeof(Slot) * SlabSize, alignof(Slot)));
+        if (slab == nullptr) {
+            _slabs.emplace_back(new Slot[SlabSize]);
+            slab = _slabs.back().get();
+        }
+        mem::MemoryAccounting::allocated(S, sizeof(Slot) * SlabSize);
+        for (size_t i = 0; i < SlabSize; ++i) {
+            slab[i].next = _free;
+            _free = &slab[i];
+        }
+    }
+
+    Slot* _free = nullptr;
+    // the slabs from the heap. Slabs from the huge page pool belong to the pool
+    std::vector<std::unique_ptr<Slot[]>> _slabs;
+};
+
+// A std allocator for node-based containers(e.g. std::map) which takes single nodes from the NodeArena of their
+// type, so that the nodes are packed into the arena's slabs instead of being allocated one by one. Arrays(which
+// node-based containers don't allocate) go to the heap. Nodes must be released on the core which allocated them
+template <typename T, mem::Subsystem S>
+struct NodeArenaAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef NodeArenaAllocator<U, S> other;
+    };
+
+    NodeArenaAllocator() noexcept = default;
+    template <typename U>
+    NodeArenaAllocator(const NodeArenaAllocator<U, S>&) noexcept {}
+
+    T* allocate(size_t n) {
+        if (n == 1) {
+            return static_cast<T*>(NodeArena<T, S>::local().allocate());
+        }
+        return mem::TrackedAllocator<T, S>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if (n == 1) {
+            NodeArena<T, S>::local().deallocate(p);
+            return;
+        }
+        mem::TrackedAllocator<T, S>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const NodeArenaAllocator<U, S>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const NodeArenaAllocator<U, S>&) const noexcept { return false; }
+};
+
+} // ns k2
@@ -0,0 +1,57 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "PartitionTable.h"
+
+namespace k2 {
+
+K23SIPartitionTable::Routes::Routes(String collectionName, uint64_t pvidId, seastar::scheduling_group group) :
+    _key{std::move(collectionName), pvidId}, _group(group) {
+}
+
+K23SIPartitionTable::Routes::~Routes() {
+    PartitionTable()._remove(_key);
+}
+
+bool K23SIPartitionTable::hosts(const PartitionKey& key) const {
+    return std::find(_partitions.begin(), _partitions.end(), key) != _partitions.end();
+}
+
+void K23SIPartitionTable::_add(const PartitionKey& key) {
+    if (!hosts(key)) {
+        _partitions.push_back(key);
+    }
+}
+
+void K23SIPartitionTable::_remove(const PartitionKey& key) {
+    // the verbs stay registered with RPC(), and answer with a refresh once no partition handles them
+    for (auto& [verb, handlers] : _rpcHandlers) {
+        handlers->remove(key);
+    }
+    for (auto& [path, handlers] : _apiHandlers) {
+        handlers->remove(key);
+    }
+    _partitions.erase(std::remove(_partitions.begin(), _partitions.end(), key), _partitions.end());
+}
+
+} // namespace k2
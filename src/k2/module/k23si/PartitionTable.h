@@ -0,0 +1,234 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <seastar/core/scheduling.hh>
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <k2/common/Common.h>
+#include <k2/dto/K23SI.h>
+#include <k2/infrastructure/APIServer.h>
+#include <k2/transport/RPCDispatcher.h>
+#include <k2/transport/Status.h>
+
+namespace k2 {
+
+// The K23SI partitions hosted on this core. The partitions register their request handlers here instead of with
+// RPC() directly: the table registers a single observer per verb, which finds the partition by the collection
+// and the PVID id of the request and calls its handler in the scheduling group of the partition, so that the
+// partitions of a core get a fair share of it. Requests for a collection but no partition(e.g. schema pushes)
+// go to every partition of the collection on the core, and requests for neither(the whole-core inspect requests)
+// go to the partition which registered first
+class K23SIPartitionTable {
+public:
+    // The PVID id of a partition stays the same across its splits and moves
+    struct PartitionKey {
+        String collectionName;
+        uint64_t pvidId = 0;
+        bool operator==(const PartitionKey& o) const { return pvidId == o.pvidId && collectionName == o.collectionName; }
+        K2_DEF_FMT(PartitionKey, collectionName, pvidId);
+    };
+
+    // The handlers of one partition, with the same interface as RPC() and the APIServer. They are removed from
+    // the table when this is destroyed
+    class Routes {
+    public:
+        Routes(String collectionName, uint64_t pvidId, seastar::scheduling_group group);
+        ~Routes();
+
+        template <class Request_t, class Response_t>
+        void registerRPCObserver(Verb verb, RPCRequestObserver_t<Request_t, Response_t> observer);
+
+        template <class Request_t, class Response_t>
+        void registerAPIObserver(String pathSuffix, String description, RPCRequestObserver_t<Request_t, Response_t> observer);
+
+    private:
+        PartitionKey _key;
+        seastar::scheduling_group _group;
+    };
+
+    // whether a partition of the given key is hosted on this core
+    bool hosts(const PartitionKey& key) const;
+
+    // the number of partitions hosted on this core
+    size_t size() const { return _partitions.size(); }
+
+private:
+    // whether the requests of a type address a partition, or else a collection
+    template <typename T, typename = void>
+    struct _HasPartition : std::false_type {};
+    template <typename T>
+    struct _HasPartition<T, std::void_t<decltype(std::declval<T>().pvid.id), decltype(std::declval<T>().collectionName)>> : std::true_type {};
+    template <typename T, typename = void>
+    struct _HasCollection : std::false_type {};
+    template <typename T>
+    struct _HasCollection<T, std::void_t<decltype(std::declval<T>().collectionName)>> : std::true_type {};
+
+    template <class Request_t, class Response_t>
+    struct _Handlers;
+
+    struct _HandlersBase {
+        virtual ~_HandlersBase() = default;
+        virtual void remove(const PartitionKey& key) = 0;
+    };
+
+    template <class Request_t, class Response_t>
+    _Handlers<Request_t, Response_t>& _handlers(std::shared_ptr<_HandlersBase>& slot, bool& created);
+
+    void _add(const PartitionKey& key);
+    void _remove(const PartitionKey& key);
+
+    // the handlers are shared with the observers registered with RPC() and the APIServer, which may outlive us
+    std::unordered_map<Verb, std::shared_ptr<_HandlersBase>> _rpcHandlers;
+    std::unordered_map<String, std::shared_ptr<_HandlersBase>> _apiHandlers;
+    // the partitions with at least one handler, in the order they registered
+    std::vector<PartitionKey> _partitions;
+};
+
+// per-thread/reactor instance of the partition table
+inline thread_local K23SIPartitionTable __local_partitionTable;
+inline K23SIPartitionTable& PartitionTable() { return __local_partitionTable; }
+
+template <class Request_t, class Response_t>
+struct K23SIPartitionTable::_Handlers : public K23SIPartitionTable::_HandlersBase {
+    struct Entry {
+        PartitionKey key;
+        seastar::scheduling_group group;
+        RPCRequestObserver_t<Request_t, Response_t> observer;
+    };
+    // few partitions share a core, so a scan is cheap
+    std::vector<Entry> entries;
+
+    void remove(const PartitionKey& key) override {
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [&key] (const Entry& entry) { return entry.key == key; }),
+                      entries.end());
+    }
+
+    static seastar::future<std::tuple<Status, Response_t>> call(Entry& entry, Request_t&& request) {
+        // stay in the group of the request if it was already given one(e.g. the low-priority verbs)
+        if (entry.group == seastar::current_scheduling_group() ||
+            seastar::current_scheduling_group() != seastar::default_scheduling_group()) {
+            return entry.observer(std::move(request));
+        }
+        return seastar::with_scheduling_group(entry.group, [observer=entry.observer, request=std::move(request)] () mutable {
+            return observer(std::move(request));
+        });
+    }
+
+    seastar::future<std::tuple<Status, Response_t>> dispatch(Request_t&& request) {
+        if constexpr (_HasPartition<Request_t>::value) {
+            for (auto& entry : entries) {
+                if (entry.key.pvidId == request.pvid.id && entry.key.collectionName == request.collectionName) {
+                    return call(entry, std::move(request));
+                }
+            }
+        }
+        else if constexpr (_HasCollection<Request_t>::value) {
+            // copies, since the partitions may come and go while the request is handled
+            std::vector<Entry> matching;
+            for (auto& entry : entries) {
+                if (entry.key.collectionName == request.collectionName) {
+                    matching.push_back(entry);
+                }
+            }
+            if (matching.size() == 1) {
+                return call(matching[0], std::move(request));
+            }
+            if (!matching.empty()) {
+                // the first failure, or else the response of the last partition
+                return seastar::do_with(std::move(matching), std::move(request), std::optional<std::tuple<Status, Response_t>>{},
+                    [] (auto& matching, auto& request, auto& result) {
+                        return seastar::do_for_each(matching, [&request, &result] (Entry& entry) {
+                            return call(entry, Request_t(request)).then([&result] (auto&& partResult) {
+                                if (!result || std::get<0>(*result).is2xxOK()) {
+                                    result = std::move(partResult);
+                                }
+                            });
+                        })
+                        .then([&result] { return std::move(*result); });
+                    });
+            }
+        }
+        else {
+            if (!entries.empty()) {
+                return call(entries.front(), std::move(request));
+            }
+        }
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("partition is not hosted on this core"), Response_t{});
+    }
+};
+
+template <class Request_t, class Response_t>
+K23SIPartitionTable::_Handlers<Request_t, Response_t>&
+K23SIPartitionTable::_handlers(std::shared_ptr<_HandlersBase>& slot, bool& created) {
+    created = !slot;
+    if (created) {
+        slot = std::make_shared<_Handlers<Request_t, Response_t>>();
+    }
+    return static_cast<_Handlers<Request_t, Response_t>&>(*slot);
+}
+
+template <class Request_t, class Response_t>
+void K23SIPartitionTable::Routes::registerRPCObserver(Verb verb, RPCRequestObserver_t<Request_t, Response_t> observer) {
+    auto& table = PartitionTable();
+    auto& slot = table._rpcHandlers[verb];
+    bool created = false;
+    auto& handlers = table._handlers<Request_t, Response_t>(slot, created);
+    handlers.remove(_key);
+    handlers.entries.push_back({_key, _group, std::move(observer)});
+    table._add(_key);
+    if (created) {
+        RPC().registerRPCObserver<Request_t, Response_t>(verb,
+            [handlers=std::static_pointer_cast<_Handlers<Request_t, Response_t>>(slot)] (Request_t&& request) {
+                return handlers->dispatch(std::move(request));
+            });
+    }
+}
+
+template <class Request_t, class Response_t>
+void K23SIPartitionTable::Routes::registerAPIObserver(String pathSuffix, String description, RPCRequestObserver_t<Request_t, Response_t> observer) {
+    auto& table = PartitionTable();
+    auto& slot = table._apiHandlers[pathSuffix];
+    bool created = false;
+    auto& handlers = table._handlers<Request_t, Response_t>(slot, created);
+    handlers.remove(_key);
+    handlers.entries.push_back({_key, _group, std::move(observer)});
+    table._add(_key);
+    if (created) {
+        AppBase().getLocal<APIServer>().registerAPIObserver<Request_t, Response_t>(std::move(pathSuffix), std::move(description),
+            [handlers=std::static_pointer_cast<_Handlers<Request_t, Response_t>>(slot)] (Request_t&& request) {
+                return handlers->dispatch(std::move(request));
+            });
+    }
+}
+
+} // namespace k2
@@ -26,10 +26,150 @@ Copyright(c) 2020 Futurewei Cloud
 namespace k2 {
 
 Persistence::Persistence() {
+    _flushTimer.set_callback([this] { _flushStage(); });
+    _mock = _config.persistenceMock();
+    if (_mock) {
+        K2LOG_W(log::skvsvr, "running with mock persistence: nothing will be persisted");
+        return;
+    }
     int id = seastar::this_shard_id();
-    String endpoint = _config.persistenceEndpoint()[id % _config.persistenceEndpoint().size()];
-    _remoteEndpoint = RPC().getTXEndpoint(endpoint);
-    K2LOG_I(log::skvsvr, "ctor with endpoint: {}", _remoteEndpoint->url);
+    auto& endpoints = _config.persistenceEndpoint();
+    // each core replicates to a window of consecutive endpoints, starting with its own
+    size_t replicas = std::min<size_t>(std::max<uint32_t>(_config.persistenceReplicas(), 1), endpoints.size());
+    for (size_t i = 0; i < replicas; ++i) {
+        Replica replica;
+        replica.endpoint = RPC().getTXEndpoint(endpoints[(id + i) % endpoints.size()]);
+        K2LOG_I(log::skvsvr, "ctor with endpoint: {}", replica.endpoint->url);
+        _replicas.push_back(std::move(replica));
+    }
+    // majority by default
+    _quorum = _config.persistenceWriteQuorum() > 0 ?
+        std::min<size_t>(_config.persistenceWriteQuorum(), _replicas.size()) : _replicas.size() / 2 + 1;
+    K2LOG_I(log::skvsvr, "persisting to {} replicas with write quorum {}", _replicas.size(), _quorum);
+}
+
+void Persistence::followEndpoint(const String& url) {
+    _replicas.clear();
+    Replica replica;
+    replica.endpoint = RPC().getTXEndpoint(url);
+    if (!replica.endpoint) {
+        throw std::runtime_error(fmt::format("invalid persistence endpoint {}", url));
+    }
+    K2LOG_I(log::skvsvr, "following endpoint: {}", url);
+    _replicas.push_back(std::move(replica));
+    _quorum = 1;
+    _following = true;
+}
+
+seastar::future<> Persistence::flush(Payload&& batch, FastDeadline deadline) {
+    if ((_replicas.empty() && !_mock) || _stopGate.is_closed()) {
+        return seastar::make_exception_future(std::runtime_error("Persistence not availabe"));
+    }
+    if (_mock) {
+        return seastar::make_ready_future();
+    }
+    // the outcome of the batch across all replicas
+    struct QuorumState {
+        seastar::promise<> done;
+        size_t acks = 0;
+        size_t failures = 0;
+        bool resolved = false;
+    };
+    auto state = seastar::make_lw_shared<QuorumState>();
+    auto fut = state->done.get_future();
+
+    for (size_t i = 0; i < _replicas.size(); ++i) {
+        dto::K23SI_PersistenceRequest<Payload> request{};
+        request.source = _source;
+        // all replicas share the buffers of the batch
+        request.value.val = i + 1 < _replicas.size() ? batch.shareAll() : std::move(batch);
+        K2LOG_D(log::skvsvr, "making persistence call to endpoint: {}, with deadline={}", _replicas[i].endpoint->url, deadline.getRemaining());
+        _replicas[i].inflight++;
+
+        (void)seastar::with_gate(_stopGate, [this, i, state, deadline, request=std::move(request)] () mutable {
+            return seastar::do_with(std::move(request), [this, i, deadline] (auto& request) {
+                return RPC().callRPC<dto::K23SI_PersistenceRequest<Payload>, dto::K23SI_PersistenceResponse>
+                    (dto::Verbs::K23SI_Persist, request, *_replicas[i].endpoint, deadline.getRemaining());
+            })
+            .then_wrapped([this, i, state, start=TSCClock::now()] (auto&& fut) {
+                auto& replica = _replicas[i];
+                replica.inflight--;
+                bool ok = false;
+                if (fut.failed()) {
+                    K2LOG_W_EXC(log::skvsvr, fut.get_exception(), "persistence call to {} failed", replica.endpoint->url);
+                }
+                else {
+                    auto [status, resp] = fut.get0();
+                    ok = status.is2xxOK();
+                    if (!ok) {
+                        K2LOG_W(log::skvsvr, "persistence call to {} failed with status: {}", replica.endpoint->url, status);
+                    }
+                }
+                if (ok) {
+                    auto elapsed = TSCClock::now() - start;
+                    replica.latency = replica.latency.count() == 0 ? elapsed : (replica.latency * 7 + elapsed) / 8;
+                    state->acks++;
+                }
+                else {
+                    replica.failures++;
+                    state->failures++;
+                }
+
+                if (state->resolved) {
+                    return;
+                }
+                if (state->acks >= _quorum) {
+                    state->resolved = true;
+                    // we don't wait for the slow replicas. Keep track of how far behind they are
+                    for (auto& lagging : _replicas) {
+                        if (lagging.inflight > 0) {
+                            K2LOG_D(log::skvsvr, "persistence replica {} lagging with {} batches in flight, latency={}, failures={}",
+                                    lagging.endpoint->url, lagging.inflight, lagging.latency, lagging.failures);
+                        }
+                    }
+                    state->done.set_value();
+                }
+                else if (state->failures > _replicas.size() - _quorum) {
+                    state->resolved = true;
+                    state->done.set_exception(std::runtime_error("Persistence call failed"));
+                }
+            });
+        });
+    }
+    return fut;
+}
+
+seastar::future<> Persistence::gracefulStop() {
+    _flushTimer.cancel();
+    _flushStage();
+    return _stopGate.close();
+}
+
+void Persistence::_flushStage() {
+    if (!_stage) {
+        return;
+    }
+    auto batch = std::move(_stage);
+    auto acks = std::move(_stageAcks);
+    _stageAcks = std::vector<seastar::promise<>>();
+    K2LOG_D(log::skvsvr, "flushing persistence batch of {} values, {} bytes", acks.size(), batch->getSize());
+
+    (void)seastar::with_gate(_stopGate, [this, batch=std::move(batch), acks=std::move(acks), deadline=*_stageDeadline] () mutable {
+        return flush(std::move(*batch), deadline)
+        .then_wrapped([acks=std::move(acks)] (auto&& fut) mutable {
+            if (fut.failed()) {
+                auto exc = fut.get_exception();
+                for (auto& ack : acks) {
+                    ack.set_exception(exc);
+                }
+                return;
+            }
+            fut.ignore_ready_future();
+            for (auto& ack : acks) {
+                ack.set_value();
+            }
+        });
+    });
 }
 
 }
@@ -22,6 +22,9 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #pragma once
+#include <seastar/core/gate.hh>
+#include <seastar/core/timer.hh>
+
 #include <k2/appbase/AppEssentials.h>
 #include <k2/dto/K23SI.h>
 #include <k2/dto/MessageVerbs.h>
@@ -32,25 +35,141 @@ namespace k2 {
 class Persistence {
 public:
     Persistence();
+
+    // Flushes any staged values and waits for all outstanding persistence calls
+    seastar::future<> gracefulStop();
+
+    // Sets the source which is recorded with each persisted batch. The WAL is replayed by source on recovery
+    void setSource(String source) { _source = std::move(source); }
+    const String& source() const { return _source; }
+
+    // Reads the checkpoints and the WAL from the given persistence endpoint instead of our replicas. Used by the
+    // followers of a partition, which never write
+    void followEndpoint(const String& url);
+    bool following() const { return _following; }
+
+    // the endpoint recovery reads from
+    String endpoint() const { return _replicas.empty() ? String() : _replicas[0].endpoint->url; }
+
+    // Serializes the value into the batch, preceded by its record type
     template<typename ValueType>
-    seastar::future<> makeCall(const ValueType& val, FastDeadline deadline) {
-        if (_remoteEndpoint) {
-            auto payload = _remoteEndpoint->newPayload();
-            payload->write(val);
-            dto::K23SI_PersistenceRequest<Payload> request{};
-            request.value.val = std::move(*payload);
-            K2LOG_D(log::skvsvr, "making persistence call to endpoint: {}, with deadline={}", _remoteEndpoint->url, deadline.getRemaining());
-            return seastar::do_with(std::move(request), [this, deadline] (auto& request) {
-                return RPC().callRPC<dto::K23SI_PersistenceRequest<Payload>, dto::K23SI_PersistenceResponse>
-                    (dto::Verbs::K23SI_Persist, request, *_remoteEndpoint, deadline.getRemaining()).discard_result();
-            });
+    static void append(Payload& batch, const ValueType& val) {
+        batch.write(_recordType<ValueType>());
+        batch.write(val);
+    }
+
+    // Sends a checkpoint or recovery request to the first persistence replica
+    template <typename RequestT, typename ResponseT, Verb verb>
+    seastar::future<std::tuple<Status, ResponseT>> call(RequestT&& request, FastDeadline deadline) {
+        if (_mock) {
+            // nothing was ever persisted: no checkpoint and an empty WAL
+            return seastar::make_ready_future<std::tuple<Status, ResponseT>>(std::tuple<Status, ResponseT>(Statuses::S200_OK(""), ResponseT{}));
         }
-        else {
+        if (_replicas.empty()) {
+            return seastar::make_exception_future<std::tuple<Status, ResponseT>>(std::runtime_error("Persistence not availabe"));
+        }
+        return seastar::do_with(std::move(request), [this, deadline] (auto& request) {
+            return RPC().callRPC<RequestT, ResponseT>(verb, request, *_replicas[0].endpoint, deadline.getRemaining());
+        });
+    }
+
+    // Persists a single value. Concurrent calls are staged into a shared batch which is sent as one persistence
+    // request once it reaches k23si_persistence_batch_bytes or k23si_persistence_batch_window expires.
+    // The returned future completes when the batch carrying the value is acknowledged
+    template<typename ValueType>
+    seastar::future<> makeCall(const ValueType& val, FastDeadline deadline) {
+        if ((_replicas.empty() && !_mock) || _stopGate.is_closed()) {
             return seastar::make_exception_future(std::runtime_error("Persistence not availabe"));
         }
+        if (!_stage) {
+            _stage = newBatch();
+            _stageDeadline = deadline;
+        }
+        else if (deadline.getRemaining() < _stageDeadline->getRemaining()) {
+            // the batch has to make it in time for its most urgent value
+            _stageDeadline = deadline;
+        }
+        append(*_stage, val);
+        _stageAcks.emplace_back();
+        auto fut = _stageAcks.back().get_future();
+
+        if (_stage->getSize() >= _config.persistenceBatchBytes()) {
+            _flushTimer.cancel();
+            _flushStage();
+        }
+        else if (!_flushTimer.armed()) {
+            _flushTimer.arm(_config.persistenceBatchWindow());
+        }
+        return SlowLog::timed(&SlowOp::persistence, std::move(fut));
     }
+
+    // Creates an empty batch. Any number of values can be serialized into the batch and then persisted
+    // with a single call to flush()
+    std::unique_ptr<Payload> newBatch() {
+        if (_mock) {
+            auto batch = std::make_unique<Payload>(Payload::DefaultAllocator);
+            batch->skip(txconstants::MAX_HEADER_SIZE);
+            return batch;
+        }
+        return _replicas.empty() ? nullptr : _replicas[0].endpoint->newPayload();
+    }
+
+    // Persists all values in the given batch with a single persistence call to each replica. Completes once a
+    // write quorum of replicas has acknowledged the batch. The remaining replicas complete in the background
+    seastar::future<> flush(Payload&& batch, FastDeadline deadline);
 private:
-    std::unique_ptr<TXEndpoint> _remoteEndpoint;
+    // sends the staged batch and resolves the futures of all values in it
+    void _flushStage();
+
+    // the record type of a value. Anything which isn't a dto type is a transaction record
+    template<typename ValueType>
+    static dto::PersistenceRecordType _recordType() {
+        if constexpr (std::is_same_v<ValueType, dto::DataRecord>) {
+            return dto::PersistenceRecordType::DataRecord;
+        }
+        else if constexpr (std::is_same_v<ValueType, dto::K23SI_PersistencePartialUpdate>) {
+            return dto::PersistenceRecordType::PartialUpdate;
+        }
+        else if constexpr (std::is_same_v<ValueType, dto::K23SI_PersistenceRecoveryRequest>) {
+            return dto::PersistenceRecordType::Recovery;
+        }
+        else if constexpr (std::is_same_v<ValueType, dto::K23SI_PersistenceClosedTimestamp>) {
+            return dto::PersistenceRecordType::ClosedTimestamp;
+        }
+        else if constexpr (std::is_same_v<ValueType, dto::K23SI_PersistenceRangeTombstone>) {
+            return dto::PersistenceRecordType::RangeTombstone;
+        }
+        else {
+            return dto::PersistenceRecordType::TxnRecord;
+        }
+    }
+
+    String _source;
+
+    // a persistence endpoint which receives a copy of every batch
+    struct Replica {
+        std::unique_ptr<TXEndpoint> endpoint;
+        // moving average of the time it takes the replica to acknowledge a batch
+        Duration latency{0};
+        // batches sent to the replica and not yet acknowledged
+        uint64_t inflight = 0;
+        uint64_t failures = 0;
+    };
+    std::vector<Replica> _replicas;
+    // how many replicas must acknowledge a batch before it is considered durable
+    size_t _quorum = 0;
     K23SIConfig _config;
+    // k23si_persistence_mock: batches are serialized as usual and then dropped
+    bool _mock = false;
+    bool _following = false;
+
+    // the batch currently accepting values from makeCall
+    std::unique_ptr<Payload> _stage;
+    std::optional<FastDeadline> _stageDeadline;
+    std::vector<seastar::promise<>> _stageAcks;
+    seastar::timer<> _flushTimer;
+
+    // tracks batches which have been sent but not yet acknowledged
+    seastar::gate _stopGate;
 };
 }
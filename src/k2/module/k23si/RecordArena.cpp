@@ -0,0 +1,149 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "RecordArena.h"
+
+#include <seastar/core/deleter.hh>
+
+#include <k2/common/HugePagePool.h>
+#include <k2/common/MemoryAccounting.h>
+
+#include "Log.h"
+
+namespace k2 {
+
+// slices are aligned so that records don't straddle words
+static constexpr size_t SLICE_ALIGNMENT = 8;
+
+RecordArena::RecordArena(size_t slabSize, double compactionThreshold):
+    _slabSize(slabSize), _compactionThreshold(compactionThreshold) {
+}
+
+RecordArena::~RecordArena() {
+    // outstanding slices keep their slab alive and only reference the slab stats, so nothing to do here
+}
+
+Payload RecordArena::copy(Payload& payload) {
+    size_t size = payload.getSize();
+    if (size == 0) {
+        return Payload(Payload::DefaultAllocator);
+    }
+
+    auto pos = payload.getCurrentPosition();
+    payload.seek(0);
+
+    Binary data;
+    if (size > _slabSize / 4) {
+        // large records get their own buffer
+        data = mem::tracked(Binary(size), mem::Subsystem::Records);
+        payload.read(data.get_write(), size);
+    }
+    else {
+        size_t reserved = (size + SLICE_ALIGNMENT - 1) & ~(SLICE_ALIGNMENT - 1);
+        if (_current.empty() || _offset + reserved > _current.size()) {
+            _newSlab(reserved);
+        }
+        auto slice = _current.share(_offset, size);
+        _offset += reserved;
+        _currentSlab->live += reserved;
+        payload.read(slice.get_write(), size);
+
+        // wrap the slice so that we can track when it is released
+        char* ptr = slice.get_write();
+        data = Binary(ptr, size, seastar::make_deleter(slice.release(), [slab=_currentSlab, reserved] {
+            slab->live -= reserved;
+        }));
+    }
+    payload.seek(pos);
+
+    std::vector<Binary> buffers;
+    buffers.push_back(std::move(data));
+    return Payload(std::move(buffers), size);
+}
+
+dto::SKVRecord::Storage RecordArena::copy(dto::SKVRecord::Storage& storage) {
+    return dto::SKVRecord::Storage {
+        storage.excludedFields,
+        copy(storage.fieldData),
+        storage.schemaVersion,
+        storage.fieldOffsets
+    };
+}
+
+bool RecordArena::shouldRelocate(const Payload& payload) const {
+    auto& buffers = payload.getBuffers();
+    if (buffers.empty() || _slabs.empty()) {
+        return false;
+    }
+    const char* ptr = buffers[0].get();
+    auto it = _slabs.upper_bound(ptr);
+    if (it == _slabs.begin()) {
+        return false;
+    }
+    --it;
+    auto& slab = it->second;
+    if (slab == _currentSlab || ptr >= slab->base + slab->size) {
+        return false;
+    }
+    return slab->live < _compactionThreshold * slab->size;
+}
+
+size_t RecordArena::liveBytes() const {
+    size_t result = 0;
+    for (auto& [base, slab] : _slabs) {
+        result += slab->live;
+    }
+    return result;
+}
+
+void RecordArena::_newSlab(size_t minSize) {
+    _reap();
+    size_t size = std::max(minSize, _slabSize);
+    // slabs come from the huge page pool when it is enabled, and go back to it once released. Slabs larger than
+    // the regular size, for large records, are reused for the other slabs of their size class
+    Binary slab = mem::HugePagePool::local().allocateBuffer(size);
+    _current = mem::tracked(slab.empty() ? Binary(size) : std::move(slab), mem::Subsystem::Records);
+    _offset = 0;
+    _currentSlab = seastar::make_lw_shared<Slab>();
+    _currentSlab->base = _current.get();
+    _currentSlab->size = _current.size();
+    _slabs[_currentSlab->base] = _currentSlab;
+    _allocatedBytes += _current.size();
+    K2LOG_D(log::skvsvr, "allocated new record slab of size {}, total slabs={}", _current.size(), _slabs.size());
+}
+
+void RecordArena::_reap() {
+    // forget about slabs which have no records left. Their memory is released by the slice deleters when
+    // the last record goes away, and by releasing _current for the slab being filled
+    for (auto it = _slabs.begin(); it != _slabs.end();) {
+        if (it->second->live == 0) {
+            _allocatedBytes -= it->second->size;
+            it = _slabs.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+} // ns k2
@@ -0,0 +1,87 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <map>
+
+#include <seastar/core/shared_ptr.hh>
+
+#include <k2/common/Common.h>
+#include <k2/dto/SKVRecord.h>
+#include <k2/transport/Payload.h>
+
+namespace k2 {
+
+// A per-partition slab arena for record payloads.
+// Records are copied into large slabs, each record getting an exactly-sized slice of a slab. Slices hold a reference
+// to their slab, so a slab's memory is returned when the last record in it goes away. We also track the number of
+// live bytes in each slab, which allows the owner to find records which sit in mostly-empty slabs and relocate them
+// (see shouldRelocate()) so that the sparse slabs can be released.
+class RecordArena {
+public:
+    // slabSize: the size of each slab we allocate. Records larger than 1/4 of the slab size are allocated separately
+    // compactionThreshold: fraction of live bytes below which records in a slab should be relocated
+    RecordArena(size_t slabSize, double compactionThreshold);
+    ~RecordArena();
+    DISABLE_COPY_MOVE(RecordArena);
+
+    // copy the given payload/storage into arena memory
+    Payload copy(Payload& payload);
+    dto::SKVRecord::Storage copy(dto::SKVRecord::Storage& storage);
+
+    // returns true if the given payload lives in a slab, which is used below the compaction threshold.
+    // Copying such payloads again via copy() will eventually free up the slab.
+    bool shouldRelocate(const Payload& payload) const;
+
+    // total bytes held in slabs
+    size_t allocatedBytes() const { return _allocatedBytes; }
+    // total bytes in slabs still used by records
+    size_t liveBytes() const;
+    // number of tracked slabs
+    size_t slabCount() const { return _slabs.size(); }
+
+private:
+    struct Slab {
+        const char* base = nullptr;
+        size_t size = 0;
+        size_t live = 0;
+    };
+
+    void _newSlab(size_t minSize);
+    void _reap();
+
+    size_t _slabSize;
+    double _compactionThreshold;
+    size_t _allocatedBytes = 0;
+
+    // slab being filled
+    Binary _current;
+    size_t _offset = 0;
+    seastar::lw_shared_ptr<Slab> _currentSlab;
+
+    // all tracked slabs, by their base address
+    std::map<const char*, seastar::lw_shared_ptr<Slab>> _slabs;
+};
+
+} // ns k2
@@ -0,0 +1,166 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <boost/intrusive/list.hpp>
+
+namespace k2 {
+
+namespace nsbi = boost::intrusive;
+
+// The hook an item must carry in order to be scheduled in a TimerWheel. Hooks unlink themselves on destruction,
+// which is what gives us O(1) cancel without needing a reference to the wheel
+typedef nsbi::list_member_hook<nsbi::link_mode<nsbi::auto_unlink>> TimerWheelHook;
+
+// A hierarchical timer wheel for intrusively-linked items.
+// Positions are plain 64-bit counts in some monotonic unit(e.g. nanoseconds of steady clock, or TSO nanoseconds)
+// which the wheel quantizes into ticks of a configurable width. Level L of the wheel covers Slots^(L+1) ticks and
+// items cascade down a level as the wheel turns, so schedule/cancel are O(1) regardless of how far in the future
+// the item expires. Items never expire early: they become due on the first tick at or after their expiry, so they
+// are at most one tick late.
+// Due items are moved into an expired list, which the caller drains at its own pace via popExpired().
+// The item type must provide the hook and a uint64_t field used by the wheel to remember the item's expiry tick.
+template <typename T, TimerWheelHook T::*HookPtr, uint64_t T::*TickPtr>
+class TimerWheel {
+public:
+    static constexpr uint32_t SlotBits = 6;
+    static constexpr uint32_t Slots = 1u << SlotBits;
+    static constexpr uint32_t Levels = 4;
+
+    typedef nsbi::list<T, nsbi::member_hook<T, TimerWheelHook, HookPtr>, nsbi::constant_time_size<false>> List;
+
+    // (re)start the wheel at the given origin, turning once every tickWidth units. Must be called before use
+    void start(uint64_t origin, uint64_t tickWidth) {
+        _origin = origin;
+        _tickWidth = tickWidth == 0 ? 1 : tickWidth;
+        _current = 0;
+    }
+
+    // schedule the item to expire at the given position. If the item is already scheduled, it is rescheduled
+    void schedule(T& item, uint64_t expiry) {
+        cancel(item);
+        item.*TickPtr = _ceilTick(expiry);
+        _place(item);
+    }
+
+    // remove the item from the wheel(or from the expired list). No-op if the item isn't scheduled
+    static void cancel(T& item) {
+        (item.*HookPtr).unlink();
+    }
+
+    static bool isScheduled(const T& item) {
+        return (item.*HookPtr).is_linked();
+    }
+
+    // turn the wheel up to the given position, moving all items which are now due into the expired list.
+    // The cost is proportional to the number of ticks elapsed since the last call plus the number of items moved
+    void advance(uint64_t now) {
+        uint64_t target = _floorTick(now);
+        while (_current < target) {
+            ++_current;
+            // cascade from the top down so that items dropped from a higher level can land in this tick's slot
+            for (uint32_t level = Levels - 1; level > 0; --level) {
+                if ((_current & ((uint64_t(1) << (SlotBits * level)) - 1)) == 0) {
+                    _cascade(level);
+                }
+            }
+            _expired.splice(_expired.end(), _slots[0][_current & (Slots - 1)]);
+        }
+    }
+
+    bool hasExpired() const {
+        return !_expired.empty();
+    }
+
+    // returns the next expired item(unlinked from the wheel), or nullptr if there are no expired items
+    T* popExpired() {
+        if (_expired.empty()) {
+            return nullptr;
+        }
+        T& item = _expired.front();
+        _expired.pop_front();
+        return &item;
+    }
+
+    // unlink all scheduled and expired items
+    void clear() {
+        for (auto& level : _slots) {
+            for (auto& slot : level) {
+                slot.clear();
+            }
+        }
+        _expired.clear();
+    }
+
+    ~TimerWheel() {
+        clear();
+    }
+
+private:
+    uint64_t _floorTick(uint64_t pos) const {
+        return pos <= _origin ? 0 : (pos - _origin) / _tickWidth;
+    }
+
+    uint64_t _ceilTick(uint64_t pos) const {
+        return pos <= _origin ? 0 : (pos - _origin + _tickWidth - 1) / _tickWidth;
+    }
+
+    void _place(T& item) {
+        uint64_t tick = item.*TickPtr;
+        if (tick <= _current) {
+            _expired.push_back(item);
+            return;
+        }
+        uint64_t delta = tick - _current;
+        uint32_t level = 0;
+        while (level < Levels - 1 && delta >= (uint64_t(1) << (SlotBits * (level + 1)))) {
+            ++level;
+        }
+        if (delta >= (uint64_t(1) << (SlotBits * Levels))) {
+            // beyond the wheel's horizon. Park in the furthest top-level slot; we'll re-place it when it cascades
+            tick = _current + (uint64_t(1) << (SlotBits * Levels)) - 1;
+        }
+        _slots[level][(tick >> (SlotBits * level)) & (Slots - 1)].push_back(item);
+    }
+
+    void _cascade(uint32_t level) {
+        List items;
+        items.splice(items.end(), _slots[level][(_current >> (SlotBits * level)) & (Slots - 1)]);
+        while (!items.empty()) {
+            T& item = items.front();
+            items.pop_front();
+            _place(item);
+        }
+    }
+
+    List _slots[Levels][Slots];
+    List _expired;
+    uint64_t _origin = 0;
+    uint64_t _tickWidth = 1;
+    // the last tick we've processed
+    uint64_t _current = 0;
+};
+
+} // ns k2
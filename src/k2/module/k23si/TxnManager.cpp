@@ -25,19 +25,35 @@ Copyright(c) 2020 Futurewei Cloud
 
 namespace k2 {
 
-TxnManager::TxnManager():
-    _cpo(_config.cpoEndpoint()) {
+TxnManager::TxnManager(Persistence& persistence):
+    _persistence(&persistence),
+    _cpo(_config.cpoEndpoint()),
+    _finalizer(_cpo) {
 }
 
-void TxnRecord::unlinkHB(HBList& hblist) {
-    if (hbLink.is_linked()) {
-        hblist.erase(hblist.iterator_to(*this));
+size_t TxnRecord::writeKeyCount() const {
+    size_t count = writeKeys.size();
+    for (auto& group : writeKeyGroups) {
+        count += group.keys.size();
     }
+    return count;
 }
-void TxnRecord::unlinkRW(RWList& rwlist) {
-    if (rwLink.is_linked()) {
-        rwlist.erase(rwlist.iterator_to(*this));
+
+std::vector<dto::Key> TxnRecord::allWriteKeys() const {
+    std::vector<dto::Key> result;
+    result.reserve(writeKeyCount());
+    result.insert(result.end(), writeKeys.begin(), writeKeys.end());
+    for (auto& group : writeKeyGroups) {
+        result.insert(result.end(), group.keys.begin(), group.keys.end());
     }
+    return result;
+}
+
+void TxnRecord::unlinkHB() {
+    HBWheel::cancel(*this);
+}
+void TxnRecord::unlinkRW() {
+    RWWheel::cancel(*this);
 }
 void TxnRecord::unlinkBG(BGList& bglist) {
     if (bgTaskLink.is_linked()) {
@@ -47,8 +63,8 @@ void TxnRecord::unlinkBG(BGList& bglist) {
 
 TxnManager::~TxnManager() {
     K2LOG_I(log::skvsvr, "dtor for cname={}", _collectionName);
-    _hblist.clear();
-    _rwlist.clear();
+    _hbwheel.clear();
+    _rwwheel.clear();
     _bgTasks.clear();
     for (auto& [key, trec]: _transactions) {
         K2LOG_W(log::skvsvr, "Shutdown dropping transaction: {}", trec);
@@ -58,39 +74,22 @@ TxnManager::~TxnManager() {
 seastar::future<> TxnManager::start(const String& collectionName, dto::Timestamp rts, Duration hbDeadline) {
     K2LOG_D(log::skvsvr, "start");
     _collectionName = collectionName;
+    _finalizer.start(collectionName);
     _hbDeadline = hbDeadline;
     updateRetentionTimestamp(rts);
     // We need to call this now so that a recent time is used for a new
     // transaction's heartbeat expiry if it comes in before the first heartbeat timer callback
-    CachedSteadyClock::now(true);
+    auto now = CachedSteadyClock::now(true);
+    _hbwheel.start(nsec_count(now), nsec(_hbDeadline).count());
+    _rwwheel.start(rts.tEndTSECount(), nsec(_hbDeadline).count());
 
     _hbTimer.set_callback([this] {
         K2LOG_D(log::skvsvr, "txn manager check hb");
         _hbTask = _hbTask.then([this] {
-            // refresh the clock
-            auto now = CachedSteadyClock::now(true);
-            return seastar::do_until(
-                [this, now] {
-                    auto noHB = _hblist.empty() || _hblist.front().hbExpiry > now;
-                    auto noRW = _rwlist.empty() || _rwlist.front().rwExpiry.compareCertain(_retentionTs) > 0;
-                    return noHB && noRW;
-                },
-                [this, now] {
-                    if (!_hblist.empty() && _hblist.front().hbExpiry <= now) {
-                        auto& tr = _hblist.front();
-                        K2LOG_W(log::skvsvr, "heartbeat expired on: {}", tr);
-                        _hblist.pop_front();
-                        return onAction(TxnRecord::Action::onHeartbeatExpire, tr.txnId);
-                    }
-                    else if (!_rwlist.empty() && _rwlist.front().rwExpiry.compareCertain(_retentionTs) <= 0) {
-                        auto& tr = _rwlist.front();
-                        K2LOG_W(log::skvsvr, "rw expired on: {}", tr);
-                        _rwlist.pop_front();
-                        return onAction(TxnRecord::Action::onRetentionWindowExpire, tr.txnId);
-                    }
-                    K2LOG_E(log::skvsvr, "Heartbeat processing failure - expected to find either hb or rw expired item but none found");
-                    return seastar::make_ready_future();
-            })
+            // refresh the clock and turn the wheels
+            _hbwheel.advance(nsec_count(CachedSteadyClock::now(true)));
+            _rwwheel.advance(_retentionTs.tEndTSECount());
+            return _processExpired()
             .then([this] {
                 _hbTimer.arm(_hbDeadline);
             })
@@ -101,8 +100,11 @@ seastar::future<> TxnManager::start(const String& collectionName, dto::Timestamp
         });
     });
     _hbTimer.arm(_hbDeadline);
-    // TODO recover transaction state
-    return _persistence.makeCall(dto::K23SI_PersistenceRecoveryRequest{}, _config.persistenceTimeout());
+    if (_persistence->following()) {
+        // the WAL belongs to the partition we follow
+        return seastar::make_ready_future();
+    }
+    return _persistence->makeCall(dto::K23SI_PersistenceRecoveryRequest{}, _hot->persistenceTimeout);
 }
 
 seastar::future<> TxnManager::gracefulStop() {
@@ -117,6 +119,9 @@ seastar::future<> TxnManager::gracefulStop() {
             _bgFuts.push_back(std::move(txn.bgTaskFut));
         }
         return seastar::when_all_succeed(_bgFuts.begin(), _bgFuts.end()).discard_result()
+        .then([this] {
+            return _finalizer.gracefulStop();
+        })
         .then([]{
             K2LOG_I(log::skvsvr, "stopped");
         })
@@ -132,8 +137,149 @@ void TxnManager::updateRetentionTimestamp(dto::Timestamp rts) {
     _retentionTs = rts;
 }
 
+void TxnManager::setLocalPartition(std::function<bool(const dto::Key&)> owns, FinalizeScheduler::LocalFinalizeFunc finalize) {
+    _finalizer.setLocalPartition(std::move(owns), std::move(finalize));
+}
+
+seastar::future<> TxnManager::_processExpired() {
+    return seastar::repeat([this] {
+        // pull out a batch of expired transactions. We collect the ids up front since the records may go away
+        // while the batch is being processed
+        std::vector<std::pair<TxnRecord::Action, dto::TxnId>> batch;
+        while (batch.size() < _config.txnExpiryBatchSize()) {
+            if (auto* hbtr = _hbwheel.popExpired(); hbtr != nullptr) {
+                if (hbtr->finalized) {
+                    K2LOG_D(log::skvsvr, "linger expired on: {}", *hbtr);
+                }
+                else {
+                    K2LOG_W(log::skvsvr, "heartbeat expired on: {}", *hbtr);
+                }
+                batch.emplace_back(TxnRecord::Action::onHeartbeatExpire, hbtr->txnId);
+            }
+            else if (auto* rwtr = _rwwheel.popExpired(); rwtr != nullptr) {
+                K2LOG_W(log::skvsvr, "rw expired on: {}", *rwtr);
+                batch.emplace_back(TxnRecord::Action::onRetentionWindowExpire, rwtr->txnId);
+            }
+            else {
+                break;
+            }
+        }
+        if (batch.empty()) {
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+        }
+        return seastar::do_with(std::move(batch), [this] (auto& batch) {
+            return seastar::parallel_for_each(batch, [this] (auto& item) {
+                return onAction(item.first, item.second)
+                    .handle_exception([] (auto exc) {
+                        K2LOG_W_EXC(log::skvsvr, exc, "caught exception while processing txn expiry");
+                        return seastar::make_ready_future();
+                    });
+            });
+        })
+        .then([] {
+            // seastar::repeat yields to the reactor between iterations if there is other work pending
+            return seastar::stop_iteration::no;
+        });
+    });
+}
+
+seastar::future<> TxnManager::adoptRecord(dto::K23SIMigratedTxn&& txn) {
+    TxnRecord& rec = _createRecord(txn.txnId);
+    // the record may have been sent before, or created here by a request which raced with the migration
+    rec.unlinkHB();
+    rec.unlinkRW();
+    rec.state = txn.state;
+    rec.writeKeys = std::move(txn.writeKeys);
+    rec.writeKeyGroups = std::move(txn.writeKeyGroups);
+    rec.hbDeadline = txn.hbDeadline;
+    rec.syncFinalize = txn.syncFinalize;
+    rec.clientFinalize = txn.clientFinalize;
+    rec.timeToFinalize = txn.timeToFinalize;
+    K2LOG_D(log::skvsvr, "adopting migrated txn record: {}", rec);
+
+    if (txn.finalized) {
+        rec.finalized = true;
+        rec.hbExpiry = CachedSteadyClock::now() + _config.finalizedTxnLinger();
+        _hbwheel.schedule(rec, nsec_count(rec.hbExpiry));
+        return seastar::make_ready_future();
+    }
+    switch (rec.state) {
+        case dto::TxnRecordState::Created:
+        case dto::TxnRecordState::InProgress:
+            _rwwheel.schedule(rec, rec.rwExpiry.tEndTSECount());
+            _scheduleHB(rec);
+            return seastar::make_ready_future();
+        case dto::TxnRecordState::ForceAborted:
+            _rwwheel.schedule(rec, rec.rwExpiry.tEndTSECount());
+            return seastar::make_ready_future();
+        case dto::TxnRecordState::Committed:
+        case dto::TxnRecordState::Aborted:
+            // finalizing is idempotent, so it doesn't matter how far the old partition got
+            return _end(rec, rec.state);
+        default:
+            return seastar::make_ready_future();
+    }
+}
+
+void TxnManager::recoverRecord(TxnRecord&& rec) {
+    K2LOG_D(log::skvsvr, "recovering txn record: {}", rec);
+    if (rec.state == dto::TxnRecordState::Deleted) {
+        _recovered.erase(rec.txnId.mtr);
+        return;
+    }
+    auto& txn = _recovered[rec.txnId.mtr];
+    txn.state = rec.state;
+    // only the end of a transaction persists its write keys. A force abort before it persists the record without them
+    if (!rec.writeKeys.empty() || !rec.writeKeyGroups.empty()) {
+        txn.writeKeys = std::move(rec.writeKeys);
+        txn.writeKeyGroups = std::move(rec.writeKeyGroups);
+    }
+    txn.txnId = std::move(rec.txnId);
+}
+
+seastar::future<> TxnManager::resumeRecovered() {
+    K2LOG_I(log::skvsvr, "resuming {} recovered txn records for coll={}", _recovered.size(), _collectionName);
+    std::vector<dto::K23SIMigratedTxn> txns;
+    txns.reserve(_recovered.size());
+    for (auto& [mtr, txn] : _recovered) {
+        txns.push_back(std::move(txn));
+    }
+    _recovered.clear();
+    return seastar::do_with(std::move(txns), [this] (auto& txns) {
+        return seastar::parallel_for_each(txns, [this] (dto::K23SIMigratedTxn& txn) {
+            // the client which was to finalize may be gone with the restart, so we finalize right away
+            return adoptRecord(std::move(txn))
+                .handle_exception([] (auto exc) {
+                    K2LOG_W_EXC(log::skvsvr, exc, "caught exception while resuming recovered txn record");
+                    return seastar::make_ready_future();
+                });
+        });
+    });
+}
+
+seastar::future<> TxnManager::persistRecords() {
+    auto batch = _persistence->newBatch();
+    if (!batch) {
+        return seastar::make_exception_future(std::runtime_error("persistence not available"));
+    }
+    size_t count = 0;
+    for (auto& [mtr, rec] : _transactions) {
+        // records which didn't end are aborted when they are pushed after a restart, and finalized ones have no WIs
+        if (rec.finalized || (rec.state != dto::TxnRecordState::ForceAborted && rec.state != dto::TxnRecordState::Committed &&
+                              rec.state != dto::TxnRecordState::Aborted)) {
+            continue;
+        }
+        Persistence::append(*batch, rec);
+        ++count;
+    }
+    if (count == 0) {
+        return seastar::make_ready_future();
+    }
+    return _persistence->flush(std::move(*batch), FastDeadline(_hot->persistenceTimeout));
+}
+
 TxnRecord* TxnManager::getTxnRecordNoCreate(const dto::TxnId& txnId) {
-    auto it = _transactions.find(txnId);
+    auto it = _transactions.find(txnId.mtr);
     if (it != _transactions.end()) {
         K2LOG_D(log::skvsvr, "found existing record: {}", it->second);
         return &(it->second);
@@ -144,7 +290,7 @@ TxnRecord* TxnManager::getTxnRecordNoCreate(const dto::TxnId& txnId) {
 }
 
 TxnRecord& TxnManager::getTxnRecord(const dto::TxnId& txnId) {
-    auto it = _transactions.find(txnId);
+    auto it = _transactions.find(txnId.mtr);
     if (it != _transactions.end()) {
         K2LOG_D(log::skvsvr, "found existing record: {}", it->second);
         return it->second;
@@ -154,7 +300,7 @@ TxnRecord& TxnManager::getTxnRecord(const dto::TxnId& txnId) {
 }
 
 TxnRecord& TxnManager::getTxnRecord(dto::TxnId&& txnId) {
-    auto it = _transactions.find(txnId);
+    auto it = _transactions.find(txnId.mtr);
     if (it != _transactions.end()) {
         K2LOG_D(log::skvsvr, "found existing record for {}: {}", txnId, it->second);
         return it->second;
@@ -166,24 +312,34 @@ TxnRecord& TxnManager::getTxnRecord(dto::TxnId&& txnId) {
 TxnRecord& TxnManager::_createRecord(dto::TxnId txnId) {
     // we don't persist the record on create. If we have a sudden failure, we'd just abort the transaction when
     // it comes to commit.
-    auto it = _transactions.insert({std::move(txnId), TxnRecord{}});
+    auto it = _transactions.try_emplace(txnId.mtr);
     if (it.second) {
         TxnRecord& rec = it.first->second;
-        rec.txnId = it.first->first;
+        rec.txnId = std::move(txnId);
         rec.state = dto::TxnRecordState::Created;
-        rec.rwExpiry = txnId.mtr.timestamp;
-        rec.hbExpiry = CachedSteadyClock::now() + 2*_hbDeadline;
-
-        _hblist.push_back(rec);
-        _rwlist.push_back(rec);
+        rec.rwExpiry = rec.txnId.mtr.timestamp;
+        _rwwheel.schedule(rec, rec.rwExpiry.tEndTSECount());
+        _scheduleHB(rec);
     }
     K2LOG_D(log::skvsvr, "created new txn record: {}", it.first->second);
     return it.first->second;
 }
 
-seastar::future<> TxnManager::onAction(TxnRecord::Action action, dto::TxnId txnId) {
+void TxnManager::_scheduleHB(TxnRecord& rec) {
+    auto deadline = rec.hbDeadline > Duration(0) ? rec.hbDeadline : _hbDeadline;
+    rec.hbExpiry = CachedSteadyClock::now() + 2*deadline;
+    _hbwheel.schedule(rec, nsec_count(rec.hbExpiry));
+}
+
+seastar::future<> TxnManager::onAction(TxnRecord::Action action, dto::TxnId txnId, Duration hbDeadline) {
     // This method's responsibility is to execute valid state transitions.
     TxnRecord& rec = getTxnRecord(std::move(txnId));
+    if (hbDeadline > Duration(0) && hbDeadline != rec.hbDeadline) {
+        rec.hbDeadline = hbDeadline;
+        if (TxnRecord::HBWheel::isScheduled(rec)) {
+            _scheduleHB(rec);
+        }
+    }
     auto state = rec.state;
     K2LOG_D(log::skvsvr, "Processing action {}, for state {}, in txn {}", action, state, rec);
     switch (state) {
@@ -201,6 +357,7 @@ seastar::future<> TxnManager::onAction(TxnRecord::Action action, dto::TxnId txnI
                             return seastar::make_exception_future(ClientError());
                         });
                 case TxnRecord::Action::onEndCommit:  // create an entry in Aborted state so that it can be finalized
+                case TxnRecord::Action::onEndStage:
                     return _end(rec, dto::TxnRecordState::Aborted)
                         .then([] {
                             // respond with failure since we had to abort but were asked to commit
@@ -225,6 +382,8 @@ seastar::future<> TxnManager::onAction(TxnRecord::Action action, dto::TxnId txnI
                     return _end(rec, dto::TxnRecordState::Committed);
                 case TxnRecord::Action::onEndAbort:
                     return _end(rec, dto::TxnRecordState::Aborted);
+                case TxnRecord::Action::onEndStage: // parallel commit: wait for the in-flight writes
+                    return _staging(rec);
                 case TxnRecord::Action::onForceAbort:             // asked to force-abort (e.g. on PUSH)
                 case TxnRecord::Action::onRetentionWindowExpire:  // we've had this transaction for too long
                 case TxnRecord::Action::onHeartbeatExpire:        // originator didn't hearbeat on time
@@ -243,6 +402,7 @@ seastar::future<> TxnManager::onAction(TxnRecord::Action action, dto::TxnId txnI
                 case TxnRecord::Action::onRetentionWindowExpire:
                     return _deleted(rec);
                 case TxnRecord::Action::onEndCommit:
+                case TxnRecord::Action::onEndStage:
                     return _end(rec, dto::TxnRecordState::Aborted)
                         .then([] {
                             // respond with failure since we had to abort but were asked to commit
@@ -265,12 +425,17 @@ seastar::future<> TxnManager::onAction(TxnRecord::Action action, dto::TxnId txnI
                 case TxnRecord::Action::onHeartbeat:
                     return seastar::make_ready_future();  // allow as no-op
                 case TxnRecord::Action::onEndCommit:
+                case TxnRecord::Action::onEndStage:
                     return seastar::make_exception_future(ClientError());
                 case TxnRecord::Action::onEndAbort: // accept this to be re-entrant
                     return seastar::make_ready_future();
-                case TxnRecord::Action::onFinalizeComplete: // on to deleting this record
-                    return _deleted(rec);
+                case TxnRecord::Action::onFinalizeComplete: // on to compacting this record
+                    return _finalized(rec);
                 case TxnRecord::Action::onHeartbeatExpire:
+                    if (rec.finalized) { // the compacted record has lingered long enough
+                        return _deleted(rec);
+                    }
+                    [[fallthrough]];
                 case TxnRecord::Action::onRetentionWindowExpire:
                 default:
                     K2LOG_E(log::skvsvr, "Invalid transition for txnid: {}", txnId);
@@ -285,15 +450,39 @@ seastar::future<> TxnManager::onAction(TxnRecord::Action action, dto::TxnId txnI
                 case TxnRecord::Action::onEndAbort:
                     return seastar::make_exception_future(ClientError());
                 case TxnRecord::Action::onEndCommit: // accept this to be re-entrant
+                case TxnRecord::Action::onEndStage:
                     return seastar::make_ready_future();
                 case TxnRecord::Action::onFinalizeComplete:
-                    return _deleted(rec);
+                    return _finalized(rec);
                 case TxnRecord::Action::onHeartbeatExpire:
+                    if (rec.finalized) { // the compacted record has lingered long enough
+                        return _deleted(rec);
+                    }
+                    [[fallthrough]];
                 case TxnRecord::Action::onRetentionWindowExpire:
                 default:
                     K2LOG_E(log::skvsvr, "Invalid transition for txnid: {}", txnId);
                     return seastar::make_exception_future(ServerError());
             };
+        case dto::TxnRecordState::Staging:
+            switch (action) {
+                case TxnRecord::Action::onForceAbort: // the txn may already be committed by its durable writes
+                case TxnRecord::Action::onHeartbeat:
+                case TxnRecord::Action::onEndStage:   // accept this to be re-entrant
+                    return seastar::make_ready_future();  // allow as no-op
+                case TxnRecord::Action::onEndCommit:  // all in-flight writes are durable
+                    return _end(rec, dto::TxnRecordState::Committed);
+                case TxnRecord::Action::onEndAbort:   // some in-flight write failed
+                    return _end(rec, dto::TxnRecordState::Aborted);
+                case TxnRecord::Action::onCreate:     // no writes are allowed after end
+                    return seastar::make_exception_future(ClientError());
+                case TxnRecord::Action::onHeartbeatExpire:
+                case TxnRecord::Action::onRetentionWindowExpire:
+                case TxnRecord::Action::onFinalizeComplete:
+                default:
+                    K2LOG_E(log::skvsvr, "Invalid transition for txnid: {}", txnId);
+                    return seastar::make_exception_future(ServerError());
+            };
         default:
             K2LOG_E(log::skvsvr, "Invalid record state ({}), for action: {}, in txnid: {}", state, action, txnId);
             return seastar::make_exception_future(ServerError());
@@ -315,10 +504,23 @@ seastar::future<> TxnManager::_forceAborted(TxnRecord& rec) {
     // set state
     rec.state = dto::TxnRecordState::ForceAborted;
     // manage hb expiry
-    rec.unlinkHB(_hblist);
+    rec.unlinkHB();
     // manage rw expiry: we want to track expiration on retention window
     // persist if needed
-    return _persistence.makeCall(rec, _config.persistenceTimeout());
+    return _persistence->makeCall(rec, _hot->persistenceTimeout);
+}
+
+seastar::future<> TxnManager::_staging(TxnRecord& rec) {
+    K2LOG_D(log::skvsvr, "Setting status to staging for {}", rec);
+    // set state
+    rec.state = dto::TxnRecordState::Staging;
+    // manage hb expiry: the client is done, and the staging is resolved by the TRH
+    rec.unlinkHB();
+    // manage rw expiry: the record ends, either committed or aborted, once its writes are checked
+    rec.unlinkRW();
+    // persist if needed: no need - the commit is only acknowledged once the committed record is persisted. If we
+    // fail before that, recovery doesn't find the txn committed, and it is aborted
+    return seastar::make_ready_future();
 }
 
 seastar::future<> TxnManager::_end(TxnRecord& rec, dto::TxnRecordState state) {
@@ -326,17 +528,18 @@ seastar::future<> TxnManager::_end(TxnRecord& rec, dto::TxnRecordState state) {
     // set state
     rec.state = state;
     // manage hb expiry
-    rec.unlinkHB(_hblist);
+    rec.unlinkHB();
     // manage rw expiry
-    rec.unlinkRW(_rwlist);
+    rec.unlinkRW();
     // manage bg expiry
     rec.unlinkBG(_bgTasks);
     _bgTasks.push_back(rec);
 
-    auto timeout = (10s + _config.writeTimeout() * rec.writeKeys.size()) / _config.finalizeBatchSize();
+    auto timeout = (10s + _hot->writeTimeout * rec.writeKeyCount()) / _hot->finalizeBatchSize;
 
-    if (rec.syncFinalize) {
-        return _persistence.makeCall(rec, _config.persistenceTimeout())
+    // when the client finalizes on its own, we still finalize in the background in case the client fails to
+    if (rec.syncFinalize && !rec.clientFinalize) {
+        return _persistence->makeCall(rec, _hot->persistenceTimeout)
         .then([timeout, this, &rec] {
             return _finalizeTransaction(rec, FastDeadline(timeout));
         });
@@ -349,12 +552,59 @@ seastar::future<> TxnManager::_end(TxnRecord& rec, dto::TxnRecordState state) {
             })
             .then([this, &rec]() {
                 // TODO Deadline based on transaction size
-                auto timeout = (10s + _config.writeTimeout() * rec.writeKeys.size())/_config.finalizeBatchSize();
+                auto timeout = (10s + _hot->writeTimeout * rec.writeKeyCount())/_hot->finalizeBatchSize;
                 return _finalizeTransaction(rec, FastDeadline(timeout));
             });
         // persist if needed
-        return _persistence.makeCall(rec, _config.persistenceTimeout());
+        return _persistence->makeCall(rec, _hot->persistenceTimeout);
+    }
+}
+
+void TxnManager::stageOnePhase(TxnRecord& rec, Payload& batch) {
+    K2LOG_D(log::skvsvr, "One-phase commit for {}", rec);
+    // the batch holds the record as committed
+    rec.state = dto::TxnRecordState::Committed;
+    Persistence::append(batch, rec);
+    // set state: the pushes and re-entrant ends wait for the outcome of the batch, like they do for a parallel commit
+    rec.state = dto::TxnRecordState::Staging;
+    // manage hb expiry
+    rec.unlinkHB();
+    // manage rw expiry
+    rec.unlinkRW();
+    // manage bg expiry: there is no background finalize
+    rec.unlinkBG(_bgTasks);
+    // persist if needed: the caller persists the batch along with the finalized WIs
+}
+
+seastar::future<> TxnManager::commitOnePhase(TxnRecord& rec) {
+    K2LOG_D(log::skvsvr, "One-phase commit persisted for {}", rec);
+    // set state
+    rec.state = dto::TxnRecordState::Committed;
+    // manage hb/rw/bg expiry: unlinked when staged
+    // persist if needed: no need - the caller persisted the record. Nothing is left to finalize
+    return _finalized(rec);
+}
+
+seastar::future<> TxnManager::_finalized(TxnRecord& rec) {
+    K2LOG_D(log::skvsvr, "Finalized {}", rec);
+    if (rec.finalized) {
+        // re-entrant: the record is already compacted
+        return seastar::make_ready_future();
     }
+    // set state: no change. We keep reporting Committed/Aborted to anyone who asks
+    rec.finalized = true;
+    // release the write keys - they are no longer needed since there are no write intents left to finalize
+    std::vector<dto::Key>().swap(rec.writeKeys);
+    std::vector<dto::K23SIWriteKeyGroup>().swap(rec.writeKeyGroups);
+    auto linger = _config.finalizedTxnLinger();
+    if (linger == Duration(0)) {
+        return _deleted(rec);
+    }
+    // manage hb expiry: reuse the heartbeat wheel to expire the compacted record
+    rec.hbExpiry = CachedSteadyClock::now() + linger;
+    _hbwheel.schedule(rec, nsec_count(rec.hbExpiry));
+    // persist if needed: no need - the state is unchanged
+    return seastar::make_ready_future();
 }
 
 seastar::future<> TxnManager::_deleted(TxnRecord& rec) {
@@ -362,17 +612,19 @@ seastar::future<> TxnManager::_deleted(TxnRecord& rec) {
     // set state
     rec.state = dto::TxnRecordState::Deleted;
     // manage hb expiry
-    rec.unlinkHB(_hblist);
+    rec.unlinkHB();
     // manage rw expiry
-    rec.unlinkRW(_rwlist);
+    rec.unlinkRW();
     // persist if needed
 
-    return _persistence.makeCall(rec, _config.persistenceTimeout()).then([this, &rec]{
+    return _persistence->makeCall(rec, _hot->persistenceTimeout).then([this, &rec]{
         K2LOG_D(log::skvsvr, "Erasing txn record: {}", rec);
         rec.unlinkBG(_bgTasks);
-        rec.unlinkRW(_rwlist);
-        rec.unlinkHB(_hblist);
-        _transactions.erase(rec.txnId);
+        rec.unlinkRW();
+        rec.unlinkHB();
+        // the key must outlive the erase of the record it is in
+        auto mtr = rec.txnId.mtr;
+        _transactions.erase(mtr);
     });
 }
 
@@ -380,9 +632,7 @@ seastar::future<> TxnManager::_heartbeat(TxnRecord& rec) {
     K2LOG_D(log::skvsvr, "Processing heartbeat for {}", rec);
     // set state: no change
     // manage hb expiry
-    rec.unlinkHB(_hblist);
-    rec.hbExpiry = CachedSteadyClock::now() + 2*_hbDeadline;
-    _hblist.push_back(rec);
+    _scheduleHB(rec);
     // manage rw expiry: no change
     // persist if needed: no need
     return seastar::make_ready_future();
@@ -391,44 +641,18 @@ seastar::future<> TxnManager::_heartbeat(TxnRecord& rec) {
 seastar::future<> TxnManager::_finalizeTransaction(TxnRecord& rec, FastDeadline deadline) {
     K2LOG_D(log::skvsvr, "Finalizing {}", rec);
     //TODO we need to keep trying to finalize in cases of failures.
-    // this needs to be done in a rate-limited fashion. For now, we just try some configurable number of times and give up
-    return seastar::do_with((uint64_t)0, [this, &rec, deadline] (auto& batchStart) {
-        return seastar::do_until(
-            [this, &rec, &batchStart] { return batchStart >= rec.writeKeys.size(); },
-            [this, &rec, &batchStart, deadline] {
-                auto start = rec.writeKeys.begin() + batchStart;
-                batchStart += std::min(_config.finalizeBatchSize(), rec.writeKeys.size() - batchStart);
-                auto end = rec.writeKeys.begin() + batchStart;
-                return seastar::parallel_for_each(start, end, [&rec, this, deadline](dto::Key& key) {
-                    dto::K23SITxnFinalizeRequest request{};
-                    request.key = key;
-                    request.collectionName = _collectionName;
-                    request.mtr = rec.txnId.mtr;
-                    request.trh = rec.txnId.trh;
-                    request.action = rec.state == dto::TxnRecordState::Committed ? dto::EndAction::Commit : dto::EndAction::Abort;
-                    K2LOG_D(log::skvsvr, "Finalizing req={}", request);
-                    return seastar::do_with(std::move(request), [&rec, this, deadline](auto& request) {
-                        return _cpo.PartitionRequest<dto::K23SITxnFinalizeRequest,
-                                                    dto::K23SITxnFinalizeResponse,
-                                                    dto::Verbs::K23SI_TXN_FINALIZE>
-                        (deadline, request, _config.finalizeRetries())
-                        .then([&request](auto&& responsePair) {
-                            auto& [status, response] = responsePair;
-                            if (!status.is2xxOK()) {
-                                K2LOG_E(log::skvsvr, "Finalize request did not succeed for {}, status={}", request, status);
-                                return seastar::make_exception_future<>(TxnManager::ServerError());
-                            }
-                            K2LOG_D(log::skvsvr, "Finalize request succeeded for {}", request);
-                            return seastar::make_ready_future<>();
-                        }).finally([]{ K2LOG_D(log::skvsvr, "finalize call finished");});
-                    });
-                }).then([&batchStart, &rec]{
-                    K2LOG_D(log::skvsvr, "Batch done, now at: {}, in {}", batchStart, rec);
-                });
-            }
-        );
-    })
-    .then([this, &rec] {
+    // For now, the scheduler tries each key some configurable number of times and gives up
+    auto action = rec.state == dto::TxnRecordState::Committed ? dto::EndAction::Commit : dto::EndAction::Abort;
+    // hand the keys over to the finalizer so that they are only held once while finalizing
+    auto fut = rec.writeKeyGroups.empty() ?
+        _finalizer.finalize(rec.txnId, action, std::move(rec.writeKeys), deadline) :
+        _finalizer.finalize(rec.txnId, action, std::move(rec.writeKeyGroups), deadline);
+    return std::move(fut)
+    .then([this, &rec] (Status&& status) {
+        if (!status.is2xxOK()) {
+            K2LOG_E(log::skvsvr, "Finalize did not succeed for {}, status={}", rec, status);
+            return seastar::make_exception_future<>(TxnManager::ServerError());
+        }
         K2LOG_D(log::skvsvr, "finalize completed for: {}", rec);
         return onAction(TxnRecord::Action::onFinalizeComplete, rec.txnId);
     });
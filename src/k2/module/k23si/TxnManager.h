@@ -24,11 +24,14 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 #include <k2/dto/K23SI.h>
+#include <k2/common/MemoryAccounting.h>
 #include <k2/cpo/client/CPOClient.h>
 #include <boost/intrusive/list.hpp>
 #include <seastar/core/shared_ptr.hh>
 #include "Config.h"
+#include "FinalizeScheduler.h"
 #include "Persistence.h"
+#include "TimerWheel.h"
 #include "Log.h"
 
 namespace k2 {
@@ -41,29 +44,41 @@ struct TxnRecord {
     dto::TxnId txnId;
 
     // the keys to which this transaction wrote. These are delivered as part of the End request and we have to ensure
-    // that the corresponding write intents are converted appropriately
+    // that the corresponding write intents are converted appropriately. Handed over to the finalizer on finalize
     std::vector<dto::Key> writeKeys;
+    // same as above, but grouped by partition by the client. Used instead of writeKeys when the client sends them
+    std::vector<dto::K23SIWriteKeyGroup> writeKeyGroups;
+
+    // set once all write intents have been finalized. The record is then kept in compact form(no write keys) in its
+    // Committed/Aborted state until it lingers out, so that late PUSH/End requests still see the correct outcome
+    bool finalized = false;
 
     // Expiry time point for retention window - these are driven off each TSO clock update
     dto::Timestamp rwExpiry;
-    nsbi::list_member_hook<> rwLink;
+    TimerWheelHook rwLink;
+    uint64_t rwTick = 0;
 
     // for the heartbeat timer set - these are driven off local time
     TimePoint hbExpiry;
-    nsbi::list_member_hook<> hbLink;
+    TimerWheelHook hbLink;
+    uint64_t hbTick = 0;
+    // the heartbeat deadline requested by the client for this transaction. Zero means the collection default
+    Duration hbDeadline{0};
 
     // this link and future are used to track this transaction when it enters background processing(e.g. finalize or delete)
     nsbi::list_member_hook<> bgTaskLink;
     seastar::future<> bgTaskFut = seastar::make_ready_future();
 
     bool syncFinalize = false;
+    // the client finalizes the write intents itself. We only finalize in the background as a safety net
+    bool clientFinalize = false;
     // The interval from end to Finalize for a transaction
     Duration timeToFinalize{0};
 
     dto::TxnRecordState state = dto::TxnRecordState::Created;
 
-    K2_PAYLOAD_FIELDS(txnId, writeKeys, state);
-    K2_DEF_FMT(TxnRecord, txnId, writeKeys, state);
+    K2_PAYLOAD_FIELDS(txnId, writeKeys, writeKeyGroups, state);
+    K2_DEF_FMT(TxnRecord, txnId, writeKeys, writeKeyGroups, state, finalized);
 
     // The last action on this TR (the action that put us into the above state)
     K2_DEF_ENUM_IC(Action,
@@ -75,15 +90,20 @@ struct TxnRecord {
         onHeartbeatExpire,
         onEndCommit,
         onEndAbort,
-        onFinalizeComplete
+        onFinalizeComplete,
+        onEndStage
     );
 
-    typedef nsbi::list<TxnRecord, nsbi::member_hook<TxnRecord, nsbi::list_member_hook<>, &TxnRecord::rwLink>> RWList;
-    typedef nsbi::list<TxnRecord, nsbi::member_hook<TxnRecord, nsbi::list_member_hook<>, &TxnRecord::hbLink>> HBList;
+    typedef TimerWheel<TxnRecord, &TxnRecord::rwLink, &TxnRecord::rwTick> RWWheel;
+    typedef TimerWheel<TxnRecord, &TxnRecord::hbLink, &TxnRecord::hbTick> HBWheel;
     typedef nsbi::list<TxnRecord, nsbi::member_hook<TxnRecord, nsbi::list_member_hook<>, &TxnRecord::bgTaskLink>> BGList;
 
-    void unlinkHB(HBList& hblist);
-    void unlinkRW(RWList& hblist);
+    // the number of keys this transaction wrote, and all of them flattened into a single vector
+    size_t writeKeyCount() const;
+    std::vector<dto::Key> allWriteKeys() const;
+
+    void unlinkHB();
+    void unlinkRW();
     void unlinkBG(BGList& hblist);
 };  // class TxnRecord
 
@@ -97,7 +117,8 @@ struct TxnRecord {
 // - txn recovery
 class TxnManager {
 public: // lifecycle
-    TxnManager();
+    // The persistence is that of the partition, which outlives us. It is only used once we are started
+    explicit TxnManager(Persistence& persistence);
     ~TxnManager();
 
     // When started, we need to be told:
@@ -112,6 +133,9 @@ public: // lifecycle
     // We cache this value and use it to expire transactions when they are outside retention window.
     void updateRetentionTimestamp(dto::Timestamp rts);
 
+    // Registers the partition served on this shard with the finalizer, so that its keys are finalized locally
+    void setLocalPartition(std::function<bool(const dto::Key&)> owns, FinalizeScheduler::LocalFinalizeFunc finalize);
+
     TxnRecord* getTxnRecordNoCreate(const dto::TxnId& txnId);
     // returns the record for an id. Creates a new record in Created state if one does not exist
     TxnRecord& getTxnRecord(const dto::TxnId& txnId);
@@ -121,7 +145,30 @@ public: // lifecycle
     // If there is a failure we return an exception future with:
     // ClientError: indicates the client has attempted an invalid action and so the transaction should abort
     // ServerError: indicates that we had trouble processing the transaction. The client should abort.
-    seastar::future<> onAction(TxnRecord::Action action, dto::TxnId txnId);
+    // A non-zero hbDeadline overrides the collection heartbeat deadline for this transaction from now on.
+    seastar::future<> onAction(TxnRecord::Action action, dto::TxnId txnId, Duration hbDeadline=Duration(0));
+
+    // One-phase commit of an InProgress transaction whose write intents the caller finalizes itself, and persists
+    // together with the record. The record goes into Staging, and is appended to the batch as committed. Once the
+    // batch is persisted, the caller finalizes the WIs and completes the transaction with commitOnePhase. If the
+    // batch fails, it aborts the transaction with onEndAbort instead, which finalizes the WIs like any other abort
+    void stageOnePhase(TxnRecord& rec, Payload& batch);
+    seastar::future<> commitOnePhase(TxnRecord& rec);
+
+    // Installs a transaction record moved here with its partition by a migration, or rebuilt by recovery, and
+    // resumes its timers. Records which ended but were not finalized yet are finalized again here
+    seastar::future<> adoptRecord(dto::K23SIMigratedTxn&& txn);
+
+    // Rebuilds the record of a transaction from a state of it replayed from the WAL while the partition recovers.
+    // Later states replace earlier ones and deleted records are dropped. Nothing is scheduled until resumeRecovered()
+    void recoverRecord(TxnRecord&& rec);
+
+    // Installs the records rebuilt by recoverRecord() once the recovery of the partition completes
+    seastar::future<> resumeRecovered();
+
+    // Persists the records of the transactions which ended but were not finalized yet, so that a checkpoint can
+    // truncate the WAL which holds their earlier states
+    seastar::future<> persistRecords();
 
     // onAction can complete successfully or with one of these errors
     struct ClientError: public std::exception{
@@ -137,19 +184,28 @@ private: // methods driving the state machine
     // but no other validation has been performed. Upon problem, we return either a ClientError or ServerError
     seastar::future<> _inProgress(TxnRecord& rec);
     seastar::future<> _forceAborted(TxnRecord& rec);
+    seastar::future<> _staging(TxnRecord& rec);
     seastar::future<> _end(TxnRecord& rec, dto::TxnRecordState state);
+    seastar::future<> _finalized(TxnRecord& rec);
     seastar::future<> _deleted(TxnRecord& rec);
     seastar::future<> _heartbeat(TxnRecord& rec);
     seastar::future<> _finalizeTransaction(TxnRecord& rec, FastDeadline deadline);
 
     TxnRecord& _createRecord(dto::TxnId txnId);
 
+    // (re)schedule the heartbeat expiry of the given record based on its heartbeat deadline
+    void _scheduleHB(TxnRecord& rec);
+
+    // process the expired items in the heartbeat and retention wheels, a batch at a time
+    seastar::future<> _processExpired();
+
 private: // fields
     friend class K23SIPartitionModule;
 
-    // Expiry lists. The order in the list is ascending so that the oldest item would be in the front
-    TxnRecord::RWList _rwlist;
-    TxnRecord::HBList _hblist;
+    // Expiry wheels. The heartbeat wheel is driven off local steady time, and the retention wheel is driven off
+    // TSO time via the retention timestamp. Both turn once per heartbeat deadline.
+    TxnRecord::RWWheel _rwwheel;
+    TxnRecord::HBWheel _hbwheel;
 
     // this list holds the transactions which are doing some background task.
     TxnRecord::BGList _bgTasks;
@@ -158,11 +214,14 @@ private: // fields
     seastar::timer<> _hbTimer;
     seastar::future<> _hbTask = seastar::make_ready_future();
 
-    // the primary store for transaction records
-    std::unordered_map<dto::TxnId, TxnRecord> _transactions;
+    // the primary store for transaction records, by MTR. The MTR identifies a transaction completely, so the TRH
+    // key, which is only needed for routing, is kept once in the record instead of in the map key as well
+    std::unordered_map<dto::K23SI_MTR, TxnRecord, std::hash<dto::K23SI_MTR>, std::equal_to<dto::K23SI_MTR>,
+                       mem::TrackedAllocator<std::pair<const dto::K23SI_MTR, TxnRecord>, mem::Subsystem::Txns>> _transactions;
 
     // the configuration for the k23si module
     K23SIConfig _config;
+    K23SIHotConfig _hot{_config};
 
     // the collection-wide deadline for heartbeating of transactions
     Duration _hbDeadline;
@@ -170,12 +229,21 @@ private: // fields
     // this is the retention window timestamp we should use for new transactions
     dto::Timestamp _retentionTs;
 
-    Persistence _persistence;
+    // the transaction records replayed from the WAL, until recovery completes
+    std::unordered_map<dto::K23SI_MTR, dto::K23SIMigratedTxn> _recovered;
+
+    // the persistence of the partition. Sharing it with the data records of the partition puts the state changes of
+    // the transactions in the same batches as the writes and finalizes which lead to them, and the module stops it
+    // once we have stopped
+    Persistence* _persistence = nullptr;
 
     bool _stopping = false;
 
     String _collectionName;
     CPOClient _cpo;
+
+    // batches the finalize requests of all transactions
+    FinalizeScheduler _finalizer;
 }; // class TxnManager
 
 }  // namespace k2
@@ -0,0 +1,257 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include <seastar/core/shared_ptr.hh>
+
+#include <k2/common/Common.h>
+#include <k2/dto/K23SI.h>
+
+#include "ColdBlock.h"
+#include "NodeArena.h"
+
+namespace k2 {
+
+// The versions of a single key, ordered newest first. The newest version(which for most keys is the only
+// version) is stored inline and older versions spill over into a singly-linked list of arena-allocated nodes.
+// The interface mirrors the subset of std::deque used by the K23SI module. Unlike with a deque, push_front and
+// pop_front move the newest record in and out of the inline slot, so both invalidate references to the front
+// record: a reference taken before push_front refers to the new record afterwards. Use the reference which
+// push_front returns, and take references to records again after modifying the chain.
+// A chain with a single version can be frozen, which moves the value of the version into a shared ColdBlock.
+// The value is decoded back(thawed) the next time the versions are accessed, except by read-only scans, which
+// use coldHead() and coldValue() instead.
+class VersionChain {
+    struct Node {
+        dto::DataRecord rec;
+        Node* next = nullptr;
+    };
+    typedef NodeArena<Node, mem::Subsystem::Versions> ArenaT;
+
+    template <typename NodeT, typename RecT>
+    class IteratorBase {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef dto::DataRecord value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef RecT& reference;
+        typedef RecT* pointer;
+
+        IteratorBase() = default;
+        IteratorBase(NodeT* node) : _node(node) {}
+        template <typename ON, typename OR>
+        IteratorBase(const IteratorBase<ON, OR>& o) : _node(o._node) {}
+
+        reference operator*() const { return _node->rec; }
+        pointer operator->() const { return &_node->rec; }
+        IteratorBase& operator++() { _node = _node->next; return *this; }
+        IteratorBase operator++(int) { auto tmp = *this; _node = _node->next; return tmp; }
+        bool operator==(const IteratorBase& o) const { return _node == o._node; }
+        bool operator!=(const IteratorBase& o) const { return _node != o._node; }
+
+    private:
+        template <typename, typename> friend class IteratorBase;
+        friend class VersionChain;
+        NodeT* _node = nullptr;
+    };
+
+public:
+    typedef dto::DataRecord value_type;
+    typedef IteratorBase<Node, dto::DataRecord> iterator;
+    typedef IteratorBase<const Node, const dto::DataRecord> const_iterator;
+
+    VersionChain() = default;
+    ~VersionChain() { clear(); }
+    VersionChain(const VersionChain&) = delete;
+    VersionChain& operator=(const VersionChain&) = delete;
+    VersionChain(VersionChain&& o) noexcept : _head{std::move(o._head.rec), o._head.next}, _size(o._size),
+        _coldRow(o._coldRow), _thawed(o._thawed), _cold(std::move(o._cold)) {
+        o._head.next = nullptr;
+        o._size = 0;
+    }
+    VersionChain& operator=(VersionChain&& o) noexcept {
+        if (this != &o) {
+            clear();
+            _head.rec = std::move(o._head.rec);
+            _head.next = o._head.next;
+            _size = o._size;
+            _coldRow = o._coldRow;
+            _thawed = o._thawed;
+            _cold = std::move(o._cold);
+            o._head.next = nullptr;
+            o._size = 0;
+        }
+        return *this;
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    iterator begin() { _thaw(); return iterator(_size > 0 ? &_head : nullptr); }
+    iterator end() { return iterator(); }
+    const_iterator begin() const { _thaw(); return const_iterator(_size > 0 ? &_head : nullptr); }
+    const_iterator end() const { return const_iterator(); }
+
+    dto::DataRecord& front() { _thaw(); return _head.rec; }
+    const dto::DataRecord& front() const { _thaw(); return _head.rec; }
+
+    // linear access; versions are normally examined from the front
+    dto::DataRecord& operator[](size_t idx) {
+        _thaw();
+        Node* node = &_head;
+        while (idx-- > 0) node = node->next;
+        return node->rec;
+    }
+
+    // returns the inserted record, which is the front of the chain
+    dto::DataRecord& push_front(dto::DataRecord&& rec) {
+        _thaw();
+        if (_size > 0) {
+            Node* spill = ArenaT::local().make();
+            spill->rec = std::move(_head.rec);
+            spill->next = _head.next;
+            _head.next = spill;
+        }
+        _head.rec = std::move(rec);
+        ++_size;
+        return _head.rec;
+    }
+
+    void pop_front() { erase(begin()); }
+
+    // insert a version right after the given one, i.e. as the next older version. Returns an iterator to it
+    iterator insertAfter(iterator it, dto::DataRecord&& rec) {
+        _thaw();
+        Node* node = ArenaT::local().make();
+        node->rec = std::move(rec);
+        node->next = it._node->next;
+        it._node->next = node;
+        ++_size;
+        return iterator(node);
+    }
+
+    // erase the given version. Returns an iterator to the version following the erased one
+    iterator erase(iterator it) {
+        Node* target = it._node;
+        if (target == &_head) {
+            --_size;
+            Node* next = _head.next;
+            if (next == nullptr) {
+                _head.rec = dto::DataRecord{};
+                return end();
+            }
+            _head.rec = std::move(next->rec);
+            _head.next = next->next;
+            ArenaT::local().destroy(next);
+            return begin();
+        }
+
+        Node* prev = &_head;
+        while (prev->next != target) prev = prev->next;
+        prev->next = target->next;
+        ArenaT::local().destroy(target);
+        --_size;
+        return iterator(prev->next);
+    }
+
+    // erase all versions older than the given one(the given version is kept)
+    void eraseAfter(iterator it) {
+        Node* last = it._node;
+        Node* node = last->next;
+        last->next = nullptr;
+        while (node != nullptr) {
+            Node* next = node->next;
+            ArenaT::local().destroy(node);
+            --_size;
+            node = next;
+        }
+    }
+
+    void clear() {
+        _cold = nullptr;
+        if (_size > 0) {
+            eraseAfter(begin());
+            _head.rec = dto::DataRecord{};
+            _size = 0;
+        }
+    }
+
+    // Moves the value of the only version into the given row of the block, which must hold the same value.
+    // The chain must have a single version
+    void freeze(seastar::lw_shared_ptr<ColdBlock> block, uint16_t row) {
+        _head.rec.value = dto::SKVRecord::Storage{.schemaVersion = _head.rec.value.schemaVersion};
+        _cold = std::move(block);
+        _coldRow = row;
+    }
+
+    // true if the value of the only version is in a ColdBlock
+    bool isCold() const { return bool(_cold); }
+
+    // returns whether the chain was thawed since the last call, which tells whether a frozen chain was
+    // accessed recently
+    bool takeThawed() {
+        bool result = _thawed;
+        _thawed = false;
+        return result;
+    }
+
+    // the only version of a cold chain without its value, and the decoded value, without thawing the chain.
+    // Scans read cold chains through these so that a scan over frozen keys doesn't undo the freezing
+    const dto::DataRecord& coldHead() const { return _head.rec; }
+    dto::SKVRecord::Storage coldValue() const { return _cold->decode(_coldRow); }
+
+    // a copy of the only version of a cold chain with the value decoded, without thawing the chain,
+    // e.g. to persist it
+    dto::DataRecord coldCopy() const {
+        return dto::DataRecord{
+            .value = coldValue(),
+            .isTombstone = _head.rec.isTombstone,
+            .txnId = _head.rec.txnId,
+            .status = _head.rec.status,
+            .ttl = _head.rec.ttl
+        };
+    }
+
+private:
+    void _thaw() const {
+        if (_cold) {
+            _head.rec.value = _cold->decode(_coldRow);
+            _cold = nullptr;
+            _thawed = true;
+        }
+    }
+
+    // the head and the cold state are mutable so that the value can be thawed on const access
+    mutable Node _head;
+    uint32_t _size = 0;
+    mutable uint16_t _coldRow = 0;
+    mutable bool _thawed = false;
+    mutable seastar::lw_shared_ptr<ColdBlock> _cold;
+};
+
+} // ns k2
@@ -0,0 +1,107 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include <k2/dto/Collection.h>
+#include <k2/dto/K23SI.h>
+
+namespace k2 {
+
+// Secondary index of the outstanding write intents in a partition, grouped by transaction.
+// It allows enumerating WIs without scanning the entire indexer. The index only tracks keys; the WI
+// records themselves are found via the indexer. Transactions are identified by their MTR alone.
+// The keys of a transaction are hashed, so that large transactions add and remove their WIs in constant time.
+class WIIndex {
+public:
+    typedef std::unordered_set<dto::Key> KeySetT;
+    typedef std::unordered_map<dto::K23SI_MTR, KeySetT> MapT;
+
+    // record that the given transaction has a WI on the given key
+    void add(const dto::TxnId& txnId, const dto::Key& key) {
+        if (_wis[txnId.mtr].insert(key).second) {
+            ++_size;
+        }
+        if (_tracking) {
+            _changed.insert(key);
+        }
+    }
+
+    // record that the WI for the given transaction and key is no longer outstanding
+    void remove(const dto::TxnId& txnId, const dto::Key& key) {
+        if (_tracking) {
+            _changed.insert(key);
+        }
+        auto it = _wis.find(txnId.mtr);
+        if (it == _wis.end()) {
+            return;
+        }
+        auto& keys = it->second;
+        if (keys.erase(key) > 0) {
+            --_size;
+        }
+        if (keys.empty()) {
+            _wis.erase(it);
+        }
+    }
+
+    // the keys with outstanding WIs for the given transaction, or nullptr if there are none
+    const KeySetT* find(const dto::TxnId& txnId) const {
+        auto it = _wis.find(txnId.mtr);
+        return it == _wis.end() ? nullptr : &it->second;
+    }
+
+    MapT::const_iterator begin() const { return _wis.begin(); }
+    MapT::const_iterator end() const { return _wis.end(); }
+
+    // total number of outstanding WIs
+    size_t size() const { return _size; }
+
+    // number of transactions with outstanding WIs
+    size_t txnCount() const { return _wis.size(); }
+
+    // Every write creates a WI and every WI is removed when it is finalized, so while tracking, the keys of all
+    // added or removed WIs are the keys whose versions changed
+    void trackChanges(bool tracking) {
+        _tracking = tracking;
+        _changed.clear();
+    }
+
+    // the keys changed since tracking started or since the previous call
+    KeySetT takeChanges() {
+        KeySetT changed;
+        changed.swap(_changed);
+        return changed;
+    }
+
+private:
+    MapT _wis;
+    size_t _size = 0;
+    bool _tracking = false;
+    KeySetT _changed;
+};
+
+} // ns k2
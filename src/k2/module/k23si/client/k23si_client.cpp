@@ -24,12 +24,50 @@ Copyright(c) 2020 Futurewei Cloud
 #include "k23si_client.h"
 #include "query.h"
 
+#include <k2/transport/TCPRPCProtocol.h>
+
 namespace k2 {
 
-K2TxnHandle::K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint start_time) noexcept : _mtr(std::move(mtr)), _options(std::move(options)), _cpo_client(cpo), _client(client), _valid(true), _failed(false), _failed_status(Statuses::S200_OK("default fail status")), _txn_end_deadline(d), _start_time(start_time) {
+K2TxnHandle::K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint start_time, tracing::TraceContext trace) noexcept : _mtr(std::move(mtr)), _options(std::move(options)), _cpo_client(cpo), _client(client), _valid(true), _failed(false), _failed_status(Statuses::S200_OK("default fail status")), _txn_end_deadline(d), _start_time(start_time), _trace(trace) {
     K2LOG_D(log::skvclient, "ctor, mtr={}", _mtr);
 }
 
+K2TxnHandle::K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint start_time,
+                         tracing::TraceContext trace, seastar::shared_future<dto::Timestamp> pendingTimestamp) noexcept :
+    K2TxnHandle(std::move(mtr), std::move(options), cpo, client, d, start_time, trace) {
+    _pending_timestamp = std::move(pendingTimestamp);
+}
+
+seastar::future<> K2TxnHandle::awaitTimestamp(const String& collection, const dto::Key& key) {
+    std::vector<seastar::future<>> lookups;
+    if (!collection.empty() && _cpo_client->collections.find(collection) == _cpo_client->collections.end()) {
+        lookups.push_back(_cpo_client->GetAssignedPartitionWithRetry(_options.deadline, collection, key)
+            .discard_result()
+            .handle_exception([] (auto) {
+                // the operation refreshes the collection itself
+            }));
+    }
+    if (!collection.empty() && !key.schemaName.empty()) {
+        lookups.push_back(_client->getSchema(collection, key.schemaName, K23SIClient::ANY_VERSION)
+            .discard_result()
+            .handle_exception([] (auto) {
+                // the schema is looked up again when the response comes
+            }));
+    }
+    auto timestamp = _pending_timestamp->get_future();
+    return seastar::when_all_succeed(lookups.begin(), lookups.end())
+    .then([timestamp=std::move(timestamp)] () mutable {
+        return std::move(timestamp);
+    })
+    .then([this] (dto::Timestamp&& timestamp) {
+        if (_pending_timestamp) {
+            _mtr.timestamp = std::move(timestamp);
+            _pending_timestamp.reset();
+            K2LOG_D(log::skvclient, "got timestamp, mtr={}", _mtr);
+        }
+    });
+}
+
 void K2TxnHandle::checkResponseStatus(Status& status) {
     if (status == dto::K23SIStatus::AbortConflict ||
         status == dto::K23SIStatus::AbortRequestTooOld ||
@@ -49,43 +87,56 @@ void K2TxnHandle::checkResponseStatus(Status& status) {
     }
 }
 
+void K2TxnHandle::startHeartbeat() {
+    if (_heartbeat_timer.isArmed()) {
+        return;
+    }
+    K2ASSERT(log::skvclient, _cpo_client->collections.find(_trh_collection) != _cpo_client->collections.end(), "collection not present after successful write");
+    K2LOG_D(log::skvclient, "Starting hb, mtr={}", _mtr);
+    auto hbDeadline = _options.heartbeatDeadline > Duration(0) ? _options.heartbeatDeadline :
+                      _cpo_client->collections[_trh_collection].collection.metadata.heartbeatDeadline;
+    _heartbeat_interval = hbDeadline / 2;
+    makeHeartbeatTimer();
+    _heartbeat_timer.armPeriodic(_heartbeat_interval);
+}
+
 void K2TxnHandle::makeHeartbeatTimer() {
     K2LOG_D(log::skvclient, "makehb, mtr={}", _mtr);
     _heartbeat_timer.setCallback([this] {
         _client->heartbeats++;
 
-        auto request = std::make_unique<dto::K23SITxnHeartbeatRequest>(dto::K23SITxnHeartbeatRequest{
+        dto::K23SITxnHeartbeatRequest request{
             dto::Partition::PVID(), // Will be filled in by PartitionRequest
             _trh_collection,
             _trh_key,
-            _mtr
-        });
+            _mtr,
+            _options.heartbeatDeadline
+        };
 
         K2LOG_D(log::skvclient, "send hb for mtr={}", _mtr);
 
-        return _cpo_client->PartitionRequest<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse, dto::Verbs::K23SI_TXN_HEARTBEAT>(Deadline(_heartbeat_interval), *request)
-        .then([this] (auto&& response) {
-            auto& [status, k2response] = response;
+        // batched with the heartbeats of the other transactions of this core with their TRH in the same partition
+        return _client->heartbeat(std::move(request), _heartbeat_interval)
+        .then([this] (Status&& status) {
             checkResponseStatus(status);
             if (_failed) {
                 K2LOG_D(log::skvclient, "txn failed: cancelling hb in mtr={}", _mtr);
                 _heartbeat_timer.cancel();
             }
-        }).finally([request=std::move(request)] {
-            (void)request;
-            // Memory freed after request is out of scope
         });
     });
 }
 
 std::unique_ptr<dto::K23SIReadRequest> K2TxnHandle::makeReadRequest(
                         const dto::Key& key, const String& collection) const {
-    return std::make_unique<dto::K23SIReadRequest>(
+    auto request = std::make_unique<dto::K23SIReadRequest>(
         dto::Partition::PVID(), // Will be filled in by PartitionRequest
         collection,
         _mtr,
         key
     );
+    request->snapshotRead = _options.snapshotRead;
+    return request;
 }
 
 template <>
@@ -105,6 +156,21 @@ seastar::future<ReadResult<dto::SKVRecord>> K2TxnHandle::read(dto::SKVRecord rec
 }
 
 seastar::future<ReadResult<dto::SKVRecord>> K2TxnHandle::read(dto::Key key, String collection) {
+    return read(std::move(key), std::move(collection), std::vector<String>{});
+}
+
+// True if all key fields of the schema are in the (non-empty) projection, so that the key of a projected record
+// can be read from its fields
+static bool keyFieldsProjected(const dto::Schema& schema, const std::vector<String>& projection) {
+    auto projected = [&projection, &schema] (uint32_t idx) {
+        return std::find(projection.begin(), projection.end(), schema.fields[idx].name) != projection.end();
+    };
+    return std::all_of(schema.partitionKeyFields.begin(), schema.partitionKeyFields.end(), projected) &&
+           std::all_of(schema.rangeKeyFields.begin(), schema.rangeKeyFields.end(), projected);
+}
+
+seastar::future<ReadResult<dto::SKVRecord>>
+K2TxnHandle::read(dto::Key key, String collection, std::vector<String> projection) {
     if (!_valid) {
         return seastar::make_exception_future<ReadResult<dto::SKVRecord>>(
                 K23SIClientException("Invalid use of K2TxnHandle"));
@@ -114,48 +180,571 @@ seastar::future<ReadResult<dto::SKVRecord>> K2TxnHandle::read(dto::Key key, Stri
                 ReadResult<dto::SKVRecord>(_failed_status, dto::SKVRecord()));
     }
 
+    if (auto local = readLocally(collection, key)) {
+        _client->read_ops++;
+        return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(std::move(*local));
+    }
+    if (_pending_timestamp) {
+        return awaitTimestamp(collection, key).then([this, key=std::move(key), collection=std::move(collection),
+                                                     projection=std::move(projection)] () mutable {
+            return read(std::move(key), std::move(collection), std::move(projection));
+        });
+    }
+
     K2LOG_D(log::skvclient, "making request for: schema={}, collection={}", key.schemaName, collection);
     std::unique_ptr<dto::K23SIReadRequest> request = makeReadRequest(key, collection);
+    request->projection = std::move(projection);
 
     _client->read_ops++;
     _ongoing_ops++;
 
+    tracing::Scope trace(_trace);
     return _cpo_client->PartitionRequest
         <dto::K23SIReadRequest, dto::K23SIReadResponse, dto::Verbs::K23SI_READ>
         (_options.deadline, *request).
-        then([this, schemaName=std::move(key.schemaName), &collName=request->collectionName] (auto&& response) {
+        then([this, request=std::move(request)] (auto&& response) {
             auto& [status, k2response] = response;
             checkResponseStatus(status);
             _ongoing_ops--;
 
             K2LOG_D(log::skvclient, "got status={}", status);
-            if (!status.is2xxOK()) {
-                return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(
-                            ReadResult<dto::SKVRecord>(std::move(status), SKVRecord()));
+            return makeReadResult(std::move(status), std::move(k2response.value), request->collectionName, request->key,
+                                  request->projection);
+        });
+}
+
+seastar::future<ReadResult<dto::SKVRecord>> K2TxnHandle::makeReadResult(Status&& status, dto::SKVRecord::Storage&& storage,
+                                                                         const String& collName, const dto::Key& key,
+                                                                         const std::vector<String>& projection) {
+    if (!status.is2xxOK()) {
+        cacheRecord(collName, key, status, nullptr);
+        return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(
+                    ReadResult<dto::SKVRecord>(std::move(status), SKVRecord()));
+    }
+
+    // most reads find the schema in the cache, so there is no need to wait for getSchema
+    if (auto schema_ptr = _client->getCachedSchema(collName, key.schemaName, storage.schemaVersion)) {
+        if (!projection.empty()) {
+            bool keysAvailable = keyFieldsProjected(*schema_ptr, projection);
+            return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(ReadResult<dto::SKVRecord>(std::move(status),
+                        SKVRecord(collName, std::move(schema_ptr), std::move(storage), keysAvailable)));
+        }
+        SKVRecord skv_record(collName, std::move(schema_ptr), std::move(storage), true);
+        cacheRecord(collName, key, status, &skv_record);
+        return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(
+                ReadResult<dto::SKVRecord>(std::move(status), std::move(skv_record)));
+    }
+
+    return _client->getSchema(collName, key.schemaName, storage.schemaVersion)
+    .then([this, s=std::move(status), storage=std::move(storage), collName, key, projection] (auto&& response) mutable {
+        auto& [status, schema_ptr] = response;
+        K2LOG_D(log::skvclient, "got status for getSchema: {}", status);
+
+        if (!status.is2xxOK()) {
+            Status notFound = dto::K23SIStatus::OperationNotAllowed("Matching schema could not be found");
+            cacheRecord(collName, key, notFound, nullptr);
+            return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(
+                ReadResult<dto::SKVRecord>(std::move(notFound), SKVRecord()));
+        }
+
+        if (!projection.empty()) {
+            bool keysAvailable = keyFieldsProjected(*schema_ptr, projection);
+            return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(ReadResult<dto::SKVRecord>(std::move(s),
+                        SKVRecord(collName, schema_ptr, std::move(storage), keysAvailable)));
+        }
+        SKVRecord skv_record(collName, schema_ptr, std::move(storage), true);
+        cacheRecord(collName, key, s, &skv_record);
+        return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(
+                ReadResult<dto::SKVRecord>(std::move(s), std::move(skv_record)));
+    });
+}
+
+seastar::future<std::vector<ReadResult<dto::SKVRecord>>>
+K2TxnHandle::readMany(std::vector<dto::Key> keys, String collection) {
+    if (!_valid) {
+        return seastar::make_exception_future<std::vector<ReadResult<dto::SKVRecord>>>(
+                K23SIClientException("Invalid use of K2TxnHandle"));
+    }
+    if (_failed) {
+        std::vector<ReadResult<dto::SKVRecord>> failed;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            failed.emplace_back(_failed_status, dto::SKVRecord());
+        }
+        return seastar::make_ready_future<std::vector<ReadResult<dto::SKVRecord>>>(std::move(failed));
+    }
+    if (_pending_timestamp) {
+        auto first = keys.empty() ? dto::Key{} : keys[0];
+        return awaitTimestamp(collection, first).then([this, keys=std::move(keys), collection=std::move(collection)] () mutable {
+            return readMany(std::move(keys), std::move(collection));
+        });
+    }
+
+    auto promises = seastar::make_lw_shared<std::vector<seastar::promise<ReadResult<dto::SKVRecord>>>>(keys.size());
+    std::vector<seastar::future<ReadResult<dto::SKVRecord>>> futures;
+    futures.reserve(keys.size());
+    for (auto& p : *promises) {
+        futures.push_back(p.get_future());
+    }
+
+    // group the keys by partition. If we don't have the partition map yet, we send all keys to the partition
+    // of the first key. Keys which turn out to be owned by a different partition are retried individually.
+    // Keys with a deferred write or a cached record are read locally
+    std::map<uint64_t, std::vector<size_t>> groups;
+    auto cit = _cpo_client->collections.find(collection);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (auto local = readLocally(collection, keys[i])) {
+            _client->read_ops++;
+            (*promises)[i].set_value(std::move(*local));
+            continue;
+        }
+        uint64_t group = 0;
+        if (cit != _cpo_client->collections.end()) {
+            auto& pwe = cit->second.getPartitionForKey(keys[i]);
+            if (pwe.partition) {
+                group = pwe.partition->pvid.id;
             }
+        }
+        groups[group].push_back(i);
+    }
 
-            return _client->getSchema(collName, schemaName, k2response.value.schemaVersion)
-            .then([s=std::move(status), storage=std::move(k2response.value), &collName] (auto&& response) mutable {
-                auto& [status, schema_ptr] = response;
-                K2LOG_D(log::skvclient, "got status for getSchema: {}", status);
+    std::vector<std::pair<std::unique_ptr<dto::K23SIReadMultiRequest>, std::vector<size_t>>> requests;
+    for (auto& [group, indexes] : groups) {
+        _client->read_ops += indexes.size();
+        auto request = std::make_unique<dto::K23SIReadMultiRequest>();
+        request->collectionName = collection;
+        request->mtr = _mtr;
+        request->snapshotRead = _options.snapshotRead;
+        request->key = keys[indexes[0]];
+        request->keys.reserve(indexes.size());
+        for (auto i : indexes) {
+            request->keys.push_back(keys[i]);
+        }
+        requests.emplace_back(std::move(request), std::move(indexes));
+    }
 
-                if (!status.is2xxOK()) {
-                    return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(
-                        ReadResult<dto::SKVRecord>(
-                        dto::K23SIStatus::OperationNotAllowed("Matching schema could not be found"),
-                        SKVRecord()));
+    return seastar::do_with(std::move(requests), [this, promises] (auto& requests) {
+        return seastar::parallel_for_each(requests.begin(), requests.end(), [this, promises] (auto& group) {
+            auto& [request, indexes] = group;
+            _ongoing_ops++;
+            tracing::Scope trace(_trace);
+            return _cpo_client->PartitionRequest
+                <dto::K23SIReadMultiRequest, dto::K23SIReadMultiResponse, dto::Verbs::K23SI_READ_MULTI>
+                (_options.deadline, *request).
+                then_wrapped([this, promises, &request, &indexes] (auto&& fut) {
+                    _ongoing_ops--;
+                    if (fut.failed()) {
+                        // fail the reads of the group, rather than leaving their promises behind
+                        auto exc = fut.get_exception();
+                        for (auto i : indexes) {
+                            (*promises)[i].set_exception(exc);
+                        }
+                        return;
+                    }
+                    auto response = fut.get0();
+                    auto& [status, k2response] = response;
+                    checkResponseStatus(status);
+
+                    for (size_t j = 0; j < indexes.size(); ++j) {
+                        auto& promise = (*promises)[indexes[j]];
+                        if (!status.is2xxOK() || j >= k2response.statuses.size()) {
+                            promise.set_value(ReadResult<dto::SKVRecord>(Status(status), dto::SKVRecord()));
+                            continue;
+                        }
+                        auto& keyStatus = k2response.statuses[j];
+                        if (keyStatus == dto::K23SIStatus::RefreshCollection) {
+                            // our partition map is stale for this key. Retry on its own, which refreshes the map
+                            _client->read_ops--;
+                            read(request->keys[j], request->collectionName).forward_to(std::move(promise));
+                            continue;
+                        }
+                        checkResponseStatus(keyStatus);
+                        makeReadResult(std::move(keyStatus), std::move(k2response.values[j]), request->collectionName, request->keys[j])
+                            .forward_to(std::move(promise));
+                    }
+                });
+        });
+    })
+    .then([futures=std::move(futures)] () mutable {
+        return seastar::when_all_succeed(futures.begin(), futures.end());
+    });
+}
+
+seastar::future<std::vector<WriteResult>>
+K2TxnHandle::writeMany(std::vector<dto::SKVRecord>& records, bool erase, bool rejectIfExists) {
+    if (!_valid) {
+        return seastar::make_exception_future<std::vector<WriteResult>>(K23SIClientException("Invalid use of K2TxnHandle"));
+    }
+    if (_options.readOnly) {
+        return seastar::make_exception_future<std::vector<WriteResult>>(K23SIClientException("Write in a read-only transaction"));
+    }
+    std::vector<WriteResult> results;
+    results.reserve(records.size());
+    if (_failed) {
+        for (size_t i = 0; i < records.size(); ++i) {
+            results.emplace_back(_failed_status, dto::K23SIWriteResponse());
+        }
+        return seastar::make_ready_future<std::vector<WriteResult>>(std::move(results));
+    }
+    if (records.empty()) {
+        return seastar::make_ready_future<std::vector<WriteResult>>(std::move(results));
+    }
+    if (_pending_timestamp) {
+        return awaitTimestamp(records[0].collectionName, records[0].getKey()).then([this, &records, erase, rejectIfExists] {
+            return writeMany(records, erase, rejectIfExists);
+        });
+    }
+    const String& collection = records[0].collectionName;
+    for (auto& record : records) {
+        if (record.collectionName != collection) {
+            return seastar::make_exception_future<std::vector<WriteResult>>(
+                K23SIClientException("All records in writeMany must belong to the same collection"));
+        }
+    }
+
+    if (_options.deferWrites) {
+        for (auto& record : records) {
+            results.emplace_back(bufferWrite(record, erase, rejectIfExists), dto::K23SIWriteResponse());
+        }
+        _client->write_ops += records.size();
+        return flushDeferredWritesIfFull()
+        .then([this, results=std::move(results)] () mutable {
+            if (_failed) {
+                for (auto& result : results) {
+                    result.status = _failed_status;
                 }
+            }
+            return std::move(results);
+        });
+    }
 
-                SKVRecord skv_record(collName, schema_ptr, std::move(storage), true);
-                return seastar::make_ready_future<ReadResult<dto::SKVRecord>>(
-                        ReadResult<dto::SKVRecord>(std::move(s), std::move(skv_record)));
+    // if this is the first write in the txn, the TRH has to be created before we send any other writes.
+    // The batch which contains the TRH write is therefore sent out before the rest
+    bool needTRH = _write_set.empty();
+    std::vector<std::unique_ptr<dto::K23SIWriteRequest>> writes;
+    writes.reserve(records.size());
+    for (auto& record : records) {
+        writes.push_back(makeWriteRequest(record, erase, rejectIfExists));
+    }
+    _client->write_ops += records.size();
+    return sendWrites(std::move(writes), needTRH);
+}
+
+seastar::future<std::vector<WriteResult>>
+K2TxnHandle::sendWrites(std::vector<std::unique_ptr<dto::K23SIWriteRequest>>&& writes, bool needTRH) {
+    String collection = writes[0]->collectionName;
+    std::vector<WriteResult> results;
+    results.reserve(writes.size());
+    for (size_t i = 0; i < writes.size(); ++i) {
+        results.emplace_back(dto::K23SIStatus::OK(""), dto::K23SIWriteResponse());
+        // the records are read from the server again once they are written
+        invalidateCachedRecord(collection, writes[i]->key);
+    }
+
+    // group the writes by partition. See readMany for handling of unknown partition maps
+    std::map<uint64_t, std::vector<size_t>> groups;
+    auto cit = _cpo_client->collections.find(collection);
+    for (size_t i = 0; i < writes.size(); ++i) {
+        uint64_t group = 0;
+        if (cit != _cpo_client->collections.end()) {
+            auto& pwe = cit->second.getPartitionForKey(writes[i]->key);
+            if (pwe.partition) {
+                group = pwe.partition->pvid.id;
+            }
+        }
+        groups[group].push_back(i);
+    }
+
+    std::vector<std::unique_ptr<dto::K23SIWriteMultiRequest>> requests;
+    std::vector<std::vector<size_t>> requestIndexes;
+    size_t trhRequest = 0;
+    for (auto& [group, indexes] : groups) {
+        auto request = std::make_unique<dto::K23SIWriteMultiRequest>();
+        request->collectionName = collection;
+        request->mtr = _mtr;
+        request->key = writes[indexes[0]]->key;
+        request->writes.reserve(indexes.size());
+        for (auto i : indexes) {
+            if (i == 0) {
+                trhRequest = requests.size();
+            }
+            request->writes.push_back(std::move(*writes[i]));
+        }
+        requests.push_back(std::move(request));
+        requestIndexes.push_back(std::move(indexes));
+    }
+
+    return seastar::do_with(std::move(requests), std::move(requestIndexes), std::move(results),
+        [this, needTRH, trhRequest] (auto& requests, auto& requestIndexes, auto& results) {
+        auto first = seastar::make_ready_future();
+        if (needTRH) {
+            first = writeMultiGroup(*requests[trhRequest], requestIndexes[trhRequest], results);
+        }
+        return first.then([this, needTRH, trhRequest, &requests, &requestIndexes, &results] {
+            std::vector<seastar::future<>> futs;
+            for (size_t i = 0; i < requests.size(); ++i) {
+                if (needTRH && i == trhRequest) {
+                    continue;
+                }
+                futs.push_back(writeMultiGroup(*requests[i], requestIndexes[i], results));
+            }
+            return seastar::when_all_succeed(futs.begin(), futs.end());
+        })
+        .then([&results] {
+            return std::move(results);
+        });
+    });
+}
+
+bool K2TxnHandle::resolveFieldNames(const dto::Schema& schema, const std::vector<k2::String>& fieldsName,
+                                    std::vector<uint32_t>& fieldsForPartialUpdate) {
+    fieldsForPartialUpdate.reserve(fieldsName.size());
+    for (const k2::String& name : fieldsName) {
+        int32_t field = schema.fieldIndex(name);
+        if (field < 0) {
+            return false;
+        }
+        fieldsForPartialUpdate.push_back((uint32_t)field);
+    }
+    return true;
+}
+
+bool K2TxnHandle::checkIndexedFields(const dto::Schema& schema, const std::vector<uint32_t>& fieldsForPartialUpdate) {
+    for (const auto& index : schema.secondaryIndexes) {
+        bool updated = false;
+        bool missing = false;
+        for (const String& name : index.fields) {
+            int32_t field = schema.fieldIndex(name);
+            if (field < 0 || schema.keySlots()[field] >= 0) {
+                // key fields are always in the record
+                continue;
+            }
+            bool inUpdate = std::find(fieldsForPartialUpdate.begin(), fieldsForPartialUpdate.end(), (uint32_t)field) !=
+                            fieldsForPartialUpdate.end();
+            updated = updated || inUpdate;
+            missing = missing || !inUpdate;
+        }
+        if (updated && missing) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool K2TxnHandle::checkFieldOps(const dto::Schema& schema, const std::vector<dto::K23SIFieldOp>& fieldOps,
+                                std::vector<uint32_t>& fieldsForPartialUpdate) {
+    if (fieldOps.empty()) {
+        return false;
+    }
+    for (const dto::K23SIFieldOp& fieldOp : fieldOps) {
+        if (fieldOp.fieldIdx >= schema.fields.size() || schema.keySlots()[fieldOp.fieldIdx] >= 0) {
+            return false;
+        }
+        // the index records are made in the client, which doesn't know the results of the operations
+        const String& name = schema.fields[fieldOp.fieldIdx].name;
+        for (const auto& index : schema.secondaryIndexes) {
+            if (std::find(index.fields.begin(), index.fields.end(), name) != index.fields.end()) {
+                return false;
+            }
+        }
+        if (std::find(fieldsForPartialUpdate.begin(), fieldsForPartialUpdate.end(), fieldOp.fieldIdx) ==
+            fieldsForPartialUpdate.end()) {
+            fieldsForPartialUpdate.push_back(fieldOp.fieldIdx);
+        }
+    }
+    return true;
+}
+
+seastar::future<std::vector<PartialUpdateResult>>
+K2TxnHandle::partialUpdateMany(std::vector<dto::SKVRecord>& records, const std::vector<k2::String>& fieldsName) {
+    std::vector<std::vector<uint32_t>> fieldsForPartialUpdate;
+    fieldsForPartialUpdate.reserve(records.size());
+    for (auto& record : records) {
+        std::vector<uint32_t> fields;
+        if (!resolveFieldNames(*record.schema, fieldsName, fields)) {
+            std::vector<PartialUpdateResult> results(records.size(),
+                PartialUpdateResult(dto::K23SIStatus::BadParameter("error parameter: fieldsForPartialUpdate")));
+            return seastar::make_ready_future<std::vector<PartialUpdateResult>>(std::move(results));
+        }
+        fieldsForPartialUpdate.push_back(std::move(fields));
+    }
+    return partialUpdateMany(records, std::move(fieldsForPartialUpdate));
+}
+
+seastar::future<std::vector<PartialUpdateResult>>
+K2TxnHandle::partialUpdateMany(std::vector<dto::SKVRecord>& records,
+                               std::vector<std::vector<uint32_t>> fieldsForPartialUpdate) {
+    if (!_valid) {
+        return seastar::make_exception_future<std::vector<PartialUpdateResult>>(K23SIClientException("Invalid use of K2TxnHandle"));
+    }
+    if (_options.readOnly) {
+        return seastar::make_exception_future<std::vector<PartialUpdateResult>>(K23SIClientException("Write in a read-only transaction"));
+    }
+    if (records.size() != fieldsForPartialUpdate.size()) {
+        return seastar::make_exception_future<std::vector<PartialUpdateResult>>(
+            K23SIClientException("partialUpdateMany needs the fields to update for each record"));
+    }
+    std::vector<PartialUpdateResult> results;
+    results.reserve(records.size());
+    if (_failed) {
+        for (size_t i = 0; i < records.size(); ++i) {
+            results.emplace_back(_failed_status);
+        }
+        return seastar::make_ready_future<std::vector<PartialUpdateResult>>(std::move(results));
+    }
+    if (records.empty()) {
+        return seastar::make_ready_future<std::vector<PartialUpdateResult>>(std::move(results));
+    }
+    if (_pending_timestamp) {
+        return awaitTimestamp(records[0].collectionName, records[0].getKey())
+        .then([this, &records, fields=std::move(fieldsForPartialUpdate)] () mutable {
+            return partialUpdateMany(records, std::move(fields));
+        });
+    }
+    const String& collection = records[0].collectionName;
+    for (auto& record : records) {
+        if (record.collectionName != collection) {
+            return seastar::make_exception_future<std::vector<PartialUpdateResult>>(
+                K23SIClientException("All records in partialUpdateMany must belong to the same collection"));
+        }
+    }
+    if (!_deferred_writes.empty()) {
+        // the updates are applied to the stored records, so the buffered writes have to be there first
+        return flushDeferredWrites()
+        .then([this, &records, fields=std::move(fieldsForPartialUpdate)] () mutable {
+            return partialUpdateMany(records, std::move(fields));
+        });
+    }
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (!checkIndexedFields(*records[i].schema, fieldsForPartialUpdate[i])) {
+            std::vector<PartialUpdateResult> failed(records.size(),
+                PartialUpdateResult(dto::K23SIStatus::BadParameter("partial update of some of the fields of a secondary index")));
+            return seastar::make_ready_future<std::vector<PartialUpdateResult>>(std::move(failed));
+        }
+    }
+
+    bool needTRH = _write_set.empty();
+    std::vector<std::unique_ptr<dto::K23SIWriteRequest>> writes;
+    writes.reserve(records.size());
+    // the index records of all updates, and the update each of them belongs to
+    std::vector<dto::SKVRecord> indexRecords;
+    std::vector<size_t> indexOwners;
+    for (size_t i = 0; i < records.size(); ++i) {
+        for (auto& indexRecord : makeIndexRecords(records[i], &fieldsForPartialUpdate[i])) {
+            indexRecords.push_back(std::move(indexRecord));
+            indexOwners.push_back(i);
+        }
+        writes.push_back(makePartialUpdateRequest(records[i], fieldsForPartialUpdate[i], records[i].getKey()));
+    }
+    _client->write_ops += records.size();
+
+    return sendWrites(std::move(writes), needTRH)
+    .then([this, indexRecords=std::move(indexRecords), indexOwners=std::move(indexOwners)] (std::vector<WriteResult>&& writeResults) mutable {
+        // as with partialUpdate, only the index records of the updates which succeeded are written
+        std::vector<dto::SKVRecord> toWrite;
+        std::vector<size_t> owners;
+        for (size_t i = 0; i < indexRecords.size(); ++i) {
+            if (writeResults[indexOwners[i]].status.is2xxOK()) {
+                toWrite.push_back(std::move(indexRecords[i]));
+                owners.push_back(indexOwners[i]);
+            }
+        }
+        return seastar::do_with(std::move(writeResults), std::move(toWrite), std::move(owners),
+            [this] (auto& writeResults, auto& toWrite, auto& owners) {
+            auto indexWrites = toWrite.empty() ?
+                seastar::make_ready_future<std::vector<WriteResult>>(std::vector<WriteResult>()) : writeMany(toWrite);
+            return indexWrites.then([&writeResults, &owners] (std::vector<WriteResult>&& indexResults) {
+                for (size_t i = 0; i < indexResults.size(); ++i) {
+                    auto& result = writeResults[owners[i]];
+                    if (result.status.is2xxOK() && !indexResults[i].status.is2xxOK()) {
+                        K2LOG_D(log::skvclient, "index write failed: {}", indexResults[i].status);
+                        result.status = std::move(indexResults[i].status);
+                    }
+                }
+                std::vector<PartialUpdateResult> results;
+                results.reserve(writeResults.size());
+                for (auto& result : writeResults) {
+                    results.emplace_back(std::move(result.status));
+                }
+                return results;
             });
-        }).finally([r = std::move(request)] () { (void)r; });
+        });
+    });
 }
 
+seastar::future<> K2TxnHandle::writeMultiGroup(dto::K23SIWriteMultiRequest& request, const std::vector<size_t>& indexes,
+                                               std::vector<WriteResult>& results) {
+    _ongoing_ops++;
+    tracing::Scope trace(_trace);
+    return _cpo_client->PartitionRequest
+        <dto::K23SIWriteMultiRequest, dto::K23SIWriteMultiResponse, dto::Verbs::K23SI_WRITE_MULTI>
+        (_options.deadline, request).
+        then_wrapped([this, &request, &indexes, &results] (auto&& fut) {
+            _ongoing_ops--;
+            if (fut.failed()) {
+                return seastar::make_exception_future<>(fut.get_exception());
+            }
+            auto response = fut.get0();
+            auto& [status, k2response] = response;
+            checkResponseStatus(status);
 
-std::unique_ptr<dto::K23SIWriteRequest> K2TxnHandle::makeWriteRequest(dto::SKVRecord& record, bool erase,
-                                                                      bool rejectIfExists) {
+            std::vector<seastar::future<>> retries;
+            for (size_t j = 0; j < indexes.size(); ++j) {
+                auto& result = results[indexes[j]];
+                if (!status.is2xxOK() || j >= k2response.statuses.size()) {
+                    result = WriteResult(status, dto::K23SIWriteResponse());
+                    continue;
+                }
+                auto& writeStatus = k2response.statuses[j];
+                if (writeStatus == dto::K23SIStatus::RefreshCollection) {
+                    // our partition map is stale for this key. Retry on its own, which refreshes the map
+                    _ongoing_ops++;
+                    tracing::Scope trace(_trace);
+                    retries.push_back(_cpo_client->PartitionRequest
+                        <dto::K23SIWriteRequest, dto::K23SIWriteResponse, dto::Verbs::K23SI_WRITE>
+                        (_options.deadline, request.writes[j]).
+                        then_wrapped([this, &result] (auto&& fut) {
+                            _ongoing_ops--;
+                            if (fut.failed()) {
+                                return seastar::make_exception_future<>(fut.get_exception());
+                            }
+                            auto response = fut.get0();
+                            auto& [status, k2response] = response;
+                            checkResponseStatus(status);
+                            if (status.is2xxOK()) {
+                                startHeartbeat();
+                            }
+                            result = WriteResult(std::move(status), std::move(k2response));
+                            return seastar::make_ready_future<>();
+                        }));
+                    continue;
+                }
+                checkResponseStatus(writeStatus);
+                if (writeStatus.is2xxOK()) {
+                    startHeartbeat();
+                }
+                result = WriteResult(std::move(writeStatus), dto::K23SIWriteResponse());
+            }
+            return seastar::when_all_succeed(retries.begin(), retries.end());
+        });
+}
+
+seastar::future<WriteResult> K2TxnHandle::deferWrite(dto::SKVRecord& record, bool erase, bool rejectIfExists) {
+    Status status = bufferWrite(record, erase, rejectIfExists);
+    if (status.is2xxOK() && !erase) {
+        // erased records leave their index records behind. See dto::SecondaryIndex
+        for (auto& indexRecord : makeIndexRecords(record)) {
+            bufferWrite(indexRecord, false, false);
+        }
+    }
+    _client->write_ops++;
+    return flushDeferredWritesIfFull()
+    .then([this, status=std::move(status)] () mutable {
+        return WriteResult(_failed ? _failed_status : std::move(status), dto::K23SIWriteResponse());
+    });
+}
+
+void K2TxnHandle::checkWriteKeyFields(dto::SKVRecord& record) {
     for (const String& key : record.partitionKeys) {
         if (key == "") {
             throw K23SIClientException("Partition key field not set for write request");
@@ -166,6 +755,165 @@ std::unique_ptr<dto::K23SIWriteRequest> K2TxnHandle::makeWriteRequest(dto::SKVRe
             throw K23SIClientException("Range key field not set for read request");
         }
     }
+}
+
+Status K2TxnHandle::bufferWrite(dto::SKVRecord& record, bool erase, bool rejectIfExists) {
+    checkWriteKeyFields(record);
+    auto [it, inserted] = _deferred_writes.try_emplace(std::make_tuple(record.collectionName, record.getKey()));
+    DeferredWrite& write = it->second;
+    if (!inserted) {
+        if (rejectIfExists && !write.erase) {
+            return dto::K23SIStatus::ConditionFailed("record already written in this transaction");
+        }
+        // the condition of a buffered write still has to hold against the stored version of the record. A
+        // record erased in this transaction does not exist any more for a conditional write
+        rejectIfExists = !erase && !write.erase && write.rejectIfExists;
+    }
+    write.record = record.deepCopy();
+    write.erase = erase;
+    write.rejectIfExists = rejectIfExists;
+    return dto::K23SIStatus::OK("write deferred");
+}
+
+K2TxnHandle::DeferredWrite* K2TxnHandle::findDeferredWrite(const String& collection, const dto::Key& key) {
+    if (_deferred_writes.empty()) {
+        return nullptr;
+    }
+    auto it = _deferred_writes.find(std::make_tuple(collection, key));
+    return it == _deferred_writes.end() ? nullptr : &it->second;
+}
+
+std::optional<ReadResult<dto::SKVRecord>> K2TxnHandle::readLocally(const String& collection, const dto::Key& key) {
+    if (auto* write = findDeferredWrite(collection, key)) {
+        if (write->erase) {
+            return ReadResult<dto::SKVRecord>(dto::K23SIStatus::KeyNotFound("record erased in this transaction"), dto::SKVRecord());
+        }
+        dto::SKVRecord record(write->record.collectionName, write->record.schema, write->record.storage.share(), true);
+        return ReadResult<dto::SKVRecord>(dto::K23SIStatus::OK("read from the write buffer"), std::move(record));
+    }
+    if (_record_cache.empty()) {
+        return std::nullopt;
+    }
+    auto it = _record_cache.find(std::make_tuple(collection, key));
+    if (it == _record_cache.end()) {
+        return std::nullopt;
+    }
+    CachedRecord& cached = it->second;
+    if (!cached.exists) {
+        return ReadResult<dto::SKVRecord>(dto::K23SIStatus::KeyNotFound("record not found"), dto::SKVRecord());
+    }
+    dto::SKVRecord record(collection, cached.record.schema, cached.record.storage.share(), true);
+    return ReadResult<dto::SKVRecord>(dto::K23SIStatus::OK("read from the record cache"), std::move(record));
+}
+
+void K2TxnHandle::cacheRecord(const String& collection, const dto::Key& key, const Status& status, dto::SKVRecord* record) {
+    if (!_options.cacheRecords) {
+        return;
+    }
+    bool exists = status.is2xxOK();
+    if ((!exists && status.code != dto::K23SIStatus::KeyNotFound.code) || (exists && (!record || !record->schema))) {
+        invalidateCachedRecord(collection, key);
+        return;
+    }
+    CachedRecord& cached = _record_cache[std::make_tuple(collection, key)];
+    cached.exists = exists;
+    cached.record = exists ? dto::SKVRecord(collection, record->schema, record->storage.share(), true) : dto::SKVRecord();
+}
+
+void K2TxnHandle::invalidateCachedRecord(const String& collection, const dto::Key& key) {
+    if (!_record_cache.empty()) {
+        _record_cache.erase(std::make_tuple(collection, key));
+    }
+}
+
+seastar::future<> K2TxnHandle::flushDeferredWritesIfFull() {
+    if (_options.deferredWriteLimit == 0 || _deferred_writes.size() < _options.deferredWriteLimit) {
+        return seastar::make_ready_future();
+    }
+    return flushDeferredWrites();
+}
+
+seastar::future<> K2TxnHandle::flushDeferredWrites() {
+    if (_deferred_writes.empty()) {
+        return seastar::make_ready_future();
+    }
+    _client->deferred_write_flushes++;
+    // the writes of each collection are sent as one writeMany. The TRH is created by the first of them, so
+    // the collection of the TRH goes first and the other collections follow once it is in place
+    bool needTRH = _write_set.empty();
+    std::vector<std::vector<std::unique_ptr<dto::K23SIWriteRequest>>> collectionWrites;
+    for (auto& [key, write] : _deferred_writes) {
+        if (collectionWrites.empty() || collectionWrites.back()[0]->collectionName != write.record.collectionName) {
+            collectionWrites.emplace_back();
+        }
+        collectionWrites.back().push_back(makeWriteRequest(write.record, write.erase, write.rejectIfExists));
+    }
+    _deferred_writes.clear();
+
+    return seastar::do_with(std::move(collectionWrites), [this, needTRH] (auto& collectionWrites) {
+        auto first = needTRH ? sendWrites(std::move(collectionWrites[0]), true) :
+                               seastar::make_ready_future<std::vector<WriteResult>>();
+        return first.then([this, needTRH, &collectionWrites] (std::vector<WriteResult>&& results) {
+            std::vector<seastar::future<std::vector<WriteResult>>> futs;
+            futs.push_back(seastar::make_ready_future<std::vector<WriteResult>>(std::move(results)));
+            for (size_t i = needTRH ? 1 : 0; i < collectionWrites.size(); ++i) {
+                futs.push_back(sendWrites(std::move(collectionWrites[i]), false));
+            }
+            return seastar::when_all_succeed(futs.begin(), futs.end());
+        });
+    })
+    .then([this] (std::vector<std::vector<WriteResult>>&& collectionResults) {
+        // the user was told that the writes succeeded, so any failure has to fail the transaction
+        for (auto& results : collectionResults) {
+            for (auto& result : results) {
+                failOnWriteError(result.status);
+            }
+        }
+    });
+}
+
+void K2TxnHandle::failOnWriteError(const Status& status) {
+    if (!status.is2xxOK() && !_failed) {
+        K2LOG_D(log::skvclient, "write failed: status={}, mtr={}", status, _mtr);
+        _failed = true;
+        _failed_status = status;
+    }
+}
+
+seastar::future<> K2TxnHandle::writeAsync(dto::SKVRecord& record, bool erase, bool rejectIfExists) {
+    if (!_valid) {
+        return seastar::make_exception_future<>(K23SIClientException("Invalid use of K2TxnHandle"));
+    }
+    if (_options.readOnly) {
+        return seastar::make_exception_future<>(K23SIClientException("Write in a read-only transaction"));
+    }
+    checkWriteKeyFields(record);
+    if (!_async_write_slots) {
+        _async_write_slots = std::make_unique<seastar::semaphore>(std::max<size_t>(1, _options.asyncWriteLimit));
+    }
+
+    return seastar::get_units(*_async_write_slots, 1)
+    .then([this, &record, erase, rejectIfExists] (auto&& units) {
+        bool createsTRH = _write_set.empty() && !_options.deferWrites;
+        auto fut = write(record, erase, rejectIfExists)
+        .then([this, units=std::move(units)] (WriteResult&& result) {
+            failOnWriteError(result.status);
+        })
+        .handle_exception([this] (auto exc) {
+            K2LOG_W_EXC(log::skvclient, exc, "async write failed, mtr={}", _mtr);
+            failOnWriteError(dto::K23SIStatus::InternalError("async write failed"));
+        });
+        if (createsTRH) {
+            return fut;
+        }
+        // the write continues in the background and holds its slot until it is done
+        return seastar::make_ready_future();
+    });
+}
+
+std::unique_ptr<dto::K23SIWriteRequest> K2TxnHandle::makeWriteRequest(dto::SKVRecord& record, bool erase,
+                                                                      bool rejectIfExists) {
+    checkWriteKeyFields(record);
 
     dto::Key key = record.getKey();
 
@@ -175,7 +923,7 @@ std::unique_ptr<dto::K23SIWriteRequest> K2TxnHandle::makeWriteRequest(dto::SKVRe
     }
     _write_set.push_back(key);
 
-    return std::make_unique<dto::K23SIWriteRequest>(
+    auto request = std::make_unique<dto::K23SIWriteRequest>(
         dto::Partition::PVID(), // Will be filled in by PartitionRequest
         record.collectionName,
         _mtr,
@@ -187,6 +935,9 @@ std::unique_ptr<dto::K23SIWriteRequest> K2TxnHandle::makeWriteRequest(dto::SKVRe
         record.storage.share(),
         std::vector<uint32_t>()
     );
+    request->trhHeartbeatDeadline = _options.heartbeatDeadline;
+    request->pipelined = _options.pipelineWrites;
+    return request;
 }
 
 std::unique_ptr<dto::K23SIWriteRequest> K2TxnHandle::makePartialUpdateRequest(dto::SKVRecord& record,
@@ -197,7 +948,7 @@ std::unique_ptr<dto::K23SIWriteRequest> K2TxnHandle::makePartialUpdateRequest(dt
         }
         _write_set.push_back(key);
 
-        return std::make_unique<dto::K23SIWriteRequest>(dto::K23SIWriteRequest{
+        auto request = std::make_unique<dto::K23SIWriteRequest>(dto::K23SIWriteRequest{
             dto::Partition::PVID(), // Will be filled in by PartitionRequest
             record.collectionName,
             _mtr,
@@ -209,12 +960,188 @@ std::unique_ptr<dto::K23SIWriteRequest> K2TxnHandle::makePartialUpdateRequest(dt
             record.storage.share(),
             fieldsForPartialUpdate
         });
+        request->trhHeartbeatDeadline = _options.heartbeatDeadline;
+        request->pipelined = _options.pipelineWrites;
+        return request;
     }
 
+std::vector<dto::SKVRecord> K2TxnHandle::makeIndexRecords(dto::SKVRecord& record,
+                                                          const std::vector<uint32_t>* fieldsForPartialUpdate) {
+    std::vector<dto::SKVRecord> indexRecords;
+    if (record.schema->secondaryIndexes.empty()) {
+        return indexRecords;
+    }
+    auto& indexSchemas = _client->getIndexSchemas(record.collectionName, *record.schema);
+    for (size_t i = 0; i < indexSchemas.size(); ++i) {
+        if (fieldsForPartialUpdate) {
+            bool updated = false;
+            for (uint32_t field : *fieldsForPartialUpdate) {
+                const auto& indexFields = record.schema->secondaryIndexes[i].fields;
+                updated = updated || std::find(indexFields.begin(), indexFields.end(),
+                                               record.schema->fields[field].name) != indexFields.end();
+            }
+            if (!updated) {
+                continue;
+            }
+        }
+        indexRecords.push_back(record.copyFieldsToSchema(indexSchemas[i]));
+    }
+    return indexRecords;
+}
+
+seastar::future<WriteResult>
+K2TxnHandle::writeIndexRecords(WriteResult&& result, std::vector<dto::SKVRecord>&& indexRecords) {
+    return seastar::do_with(std::move(result), std::move(indexRecords),
+    [this] (WriteResult& result, std::vector<dto::SKVRecord>& indexRecords) {
+        // an index record may already exist, e.g. when a record is written again with the same indexed values
+        return writeMany(indexRecords)
+        .then([&result] (std::vector<WriteResult>&& indexResults) {
+            for (WriteResult& indexResult : indexResults) {
+                if (!indexResult.status.is2xxOK()) {
+                    K2LOG_D(log::skvclient, "index write failed: {}", indexResult.status);
+                    return std::move(indexResult);
+                }
+            }
+            return std::move(result);
+        });
+    });
+}
+
+std::vector<dto::K23SIWriteKeyGroup> K2TxnHandle::groupWriteSet() {
+    std::vector<dto::K23SIWriteKeyGroup> groups;
+    auto cit = _cpo_client->collections.find(_trh_collection);
+    if (cit == _cpo_client->collections.end()) {
+        return groups;
+    }
+    // find the group of each key first, so that we can still fall back to sending the keys ungrouped
+    std::map<uint64_t, size_t> groupIndexes;
+    std::vector<size_t> keyGroups;
+    keyGroups.reserve(_write_set.size());
+    for (auto& key : _write_set) {
+        auto& pwe = cit->second.getPartitionForKey(key);
+        if (!pwe.partition) {
+            K2LOG_D(log::skvclient, "Unable to group write keys by partition for mtr={}", _mtr);
+            return {};
+        }
+        auto [it, inserted] = groupIndexes.try_emplace(pwe.partition->pvid.id, groups.size());
+        if (inserted) {
+            groups.emplace_back();
+            groups.back().pvid = pwe.partition->pvid;
+        }
+        keyGroups.push_back(it->second);
+    }
+    for (size_t i = 0; i < _write_set.size(); ++i) {
+        groups[keyGroups[i]].keys.push_back(std::move(_write_set[i]));
+    }
+    _write_set.clear();
+    return groups;
+}
+
+seastar::future<> K2TxnHandle::finalizeWriteKeys(dto::K23SITxnEndRequest& endRequest) {
+    return seastar::parallel_for_each(endRequest.writeKeyGroups, [this, &endRequest] (dto::K23SIWriteKeyGroup& group) {
+        auto request = std::make_unique<dto::K23SITxnFinalizeMultiRequest>();
+        request->collectionName = endRequest.collectionName;
+        request->key = group.keys[0];
+        request->finalizes.reserve(group.keys.size());
+        for (auto& key : group.keys) {
+            dto::K23SITxnFinalizeRequest finalize{};
+            finalize.collectionName = endRequest.collectionName;
+            finalize.trh = endRequest.key;
+            finalize.mtr = endRequest.mtr;
+            finalize.key = key;
+            finalize.action = endRequest.action;
+            request->finalizes.push_back(std::move(finalize));
+        }
+        tracing::Scope trace(_trace);
+        return _cpo_client->PartitionRequest
+            <dto::K23SITxnFinalizeMultiRequest, dto::K23SITxnFinalizeMultiResponse, dto::Verbs::K23SI_TXN_FINALIZE_MULTI>
+            (Deadline<>(_txn_end_deadline), *request)
+        .then([this] (auto&& response) {
+            auto& [status, k2response] = response;
+            // failures here are not fatal - the TRH finalizes in the background anything we couldn't
+            if (!status.is2xxOK()) {
+                K2LOG_W(log::skvclient, "Client finalize failed: status={}, mtr={}", status, _mtr);
+                return;
+            }
+            for (auto& keyStatus : k2response.statuses) {
+                if (!keyStatus.is2xxOK()) {
+                    K2LOG_D(log::skvclient, "Client finalize failed for a key: status={}, mtr={}", keyStatus, _mtr);
+                }
+            }
+        })
+        .finally([request=std::move(request)] {
+            (void)request;
+        });
+    });
+}
+
+seastar::future<> K2TxnHandle::awaitDurableWrites(dto::K23SITxnEndRequest& endRequest) {
+    // one request for each partition we wrote to, routed by any key we wrote there
+    auto keysFut = seastar::make_ready_future<std::vector<dto::Key>>();
+    if (endRequest.writeKeyGroups.empty()) {
+        // we couldn't group the write set by partition, so group it once the collection is fetched
+        keysFut = _cpo_client->PartitionRoutingKeys(Deadline<>(_txn_end_deadline), endRequest.collectionName, endRequest.writeKeys);
+    }
+    else {
+        std::vector<dto::Key> routingKeys;
+        for (auto& group : endRequest.writeKeyGroups) {
+            routingKeys.push_back(group.keys[0]);
+        }
+        keysFut = seastar::make_ready_future<std::vector<dto::Key>>(std::move(routingKeys));
+    }
+    return keysFut.then([this, &endRequest] (std::vector<dto::Key>&& keys) {
+        return seastar::do_with(std::move(keys), [this, &endRequest] (auto& routingKeys) {
+            return seastar::parallel_for_each(routingKeys, [this, &endRequest] (dto::Key& key) {
+                auto request = std::make_unique<dto::K23SITxnAwaitDurableRequest>();
+                request->collectionName = endRequest.collectionName;
+                request->key = key;
+                request->mtr = endRequest.mtr;
+                tracing::Scope trace(_trace);
+                return _cpo_client->PartitionRequest
+                    <dto::K23SITxnAwaitDurableRequest, dto::K23SITxnAwaitDurableResponse, dto::Verbs::K23SI_TXN_AWAIT_DURABLE>
+                    (Deadline<>(_txn_end_deadline), *request)
+                .then([this] (auto&& response) {
+                    auto& [status, k2response] = response;
+                    if (!status.is2xxOK() && !_failed) {
+                        K2LOG_W(log::skvclient, "Pipelined writes not durable: status={}, mtr={}", status, _mtr);
+                        _failed = true;
+                        _failed_status = std::move(status);
+                    }
+                })
+                .finally([request=std::move(request)] {
+                    (void)request;
+                });
+            });
+        });
+    });
+}
+
 seastar::future<EndResult> K2TxnHandle::end(bool shouldCommit) {
     if (!_valid) {
         return seastar::make_exception_future<EndResult>(K23SIClientException("Tried to end() an invalid TxnHandle"));
     }
+    if (_pending_timestamp) {
+        return awaitTimestamp("", dto::Key{}).then([this, shouldCommit] {
+            return end(shouldCommit);
+        });
+    }
+    if (_async_write_slots) {
+        // wait for the async writes, including the ones still waiting for a slot
+        size_t slots = std::max<size_t>(1, _options.asyncWriteLimit);
+        return _async_write_slots->wait(slots)
+        .then([this, shouldCommit] {
+            _async_write_slots.reset();
+            return end(shouldCommit);
+        });
+    }
+    if (_readahead_gate) {
+        // wait for the pages which queries are still fetching ahead
+        auto gate = std::move(_readahead_gate);
+        auto closed = gate->close();
+        return closed.then([this, shouldCommit, gate=std::move(gate)] {
+            return end(shouldCommit);
+        });
+    }
     // User is not allowed to call anything else on this TxnHandle after end()
     _valid = false;
 
@@ -222,6 +1149,20 @@ seastar::future<EndResult> K2TxnHandle::end(bool shouldCommit) {
         return seastar::make_exception_future<EndResult>(K23SIClientException("Tried to end() with ongoing ops"));
     }
 
+    if (!_deferred_writes.empty()) {
+        if (shouldCommit && !_failed) {
+            return flushDeferredWrites()
+            .then([this, shouldCommit] {
+                return sendEnd(shouldCommit);
+            });
+        }
+        // the buffered writes were never sent, so there is nothing to abort for them
+        _deferred_writes.clear();
+    }
+    return sendEnd(shouldCommit);
+}
+
+seastar::future<EndResult> K2TxnHandle::sendEnd(bool shouldCommit) {
     if (!_write_set.size()) {
         _client->successful_txns++;
 
@@ -235,24 +1176,46 @@ seastar::future<EndResult> K2TxnHandle::end(bool shouldCommit) {
         return seastar::make_ready_future<EndResult>(EndResult(Statuses::S200_OK("default end result")));
     }
 
+    auto groups = groupWriteSet();
     auto* request  = new dto::K23SITxnEndRequest {
         dto::Partition::PVID(), // Will be filled in by PartitionRequest
         _trh_collection,
         _trh_key,
         _mtr,
         shouldCommit && !_failed ? dto::EndAction::Commit : dto::EndAction::Abort,
-        std::move(_write_set),
+        groups.empty() ? std::move(_write_set) : std::vector<dto::Key>(),
         _options.syncFinalize
     };
+    request->writeKeyGroups = std::move(groups);
+    if (_options.syncFinalize && _options.clientFinalize && request->writeKeyGroups.size() > 1) {
+        // we finalize ourselves. Give ourselves until the end deadline before the TRH steps in.
+        // A single group holds only keys in the TRH partition, which commits them in one phase
+        request->clientFinalize = true;
+        request->timeToFinalize = _txn_end_deadline;
+    }
 
-    K2LOG_D(log::skvclient, "Cancel hb for {}", _mtr);
-    _heartbeat_timer.cancel();
+    // we can only commit once all pipelined writes are durable. The heartbeat keeps going while we wait. With
+    // parallelCommit, the TRH waits for them instead
+    bool pipelinedCommit = _options.pipelineWrites && request->action == dto::EndAction::Commit;
+    request->parallelCommit = pipelinedCommit && _options.parallelCommit;
+    auto durableFut = pipelinedCommit && !request->parallelCommit ?
+        awaitDurableWrites(*request) : seastar::make_ready_future();
 
-    return _cpo_client->PartitionRequest
-        <dto::K23SITxnEndRequest, dto::K23SITxnEndResponse, dto::Verbs::K23SI_TXN_END>
-        (Deadline<>(_txn_end_deadline), *request).
-        then([this, shouldCommit] (auto&& response) {
+    return durableFut.then([this, request] {
+        if (_failed) {
+            request->action = dto::EndAction::Abort;
+        }
+        K2LOG_D(log::skvclient, "Cancel hb for {}", _mtr);
+        _heartbeat_timer.cancel();
+
+        tracing::Scope trace(_trace);
+        return _cpo_client->PartitionRequest
+            <dto::K23SITxnEndRequest, dto::K23SITxnEndResponse, dto::Verbs::K23SI_TXN_END>
+            (Deadline<>(_txn_end_deadline), *request);
+    }).
+        then([this, shouldCommit, request] (auto&& response) {
             auto& [status, k2response] = response;
+            bool finalize = status.is2xxOK() && request->clientFinalize;
             if (status.is2xxOK() && !_failed) {
                 _client->successful_txns++;
             } else if (!status.is2xxOK()){
@@ -270,7 +1233,11 @@ seastar::future<EndResult> K2TxnHandle::end(bool shouldCommit) {
                 status = _failed_status;
             }
 
-            return _heartbeat_timer.stop().then([this, s=std::move(status)] () {
+            auto fut = finalize ? finalizeWriteKeys(*request) : seastar::make_ready_future();
+            return fut.then([this] {
+                return _heartbeat_timer.stop();
+            })
+            .then([this, s=std::move(status)] () {
                 // TODO get min transaction time from TSO client
                 auto time_spent = Clock::now() - _start_time;
                 if (time_spent < 10us) {
@@ -289,35 +1256,156 @@ seastar::future<WriteResult> K2TxnHandle::erase(SKVRecord& record) {
     return write(record, true);
 }
 
-K23SIClient::K23SIClient(const K23SIClientConfig &) :
-        _tsoClient(AppBase().getDist<TSO_ClientLib>().local()), _gen(std::random_device()()) {
+K23SIClient::K23SIClient(const K23SIClientConfig& config) :
+        _tsoClient(AppBase().getLocal<TSO_ClientLib>()), _gen(std::random_device()()), _clientConfig(config) {
     _metric_groups.clear();
     std::vector<sm::label_instance> labels;
     _metric_groups.add_group("K23SI_client", {
         sm::make_counter("read_ops", read_ops, sm::description("Total K23SI Read operations"), labels),
         sm::make_counter("write_ops", write_ops, sm::description("Total K23SI Write/Delete operations"), labels),
         sm::make_counter("total_txns", total_txns, sm::description("Total K23SI transactions began"), labels),
+        sm::make_counter("local_timestamp_txns", local_timestamp_txns, sm::description("Total K23SI transactions began with a local clock timestamp"), labels),
         sm::make_counter("successful_txns", successful_txns, sm::description("Total K23SI transactions ended successfully (committed or user aborted)"), labels),
         sm::make_counter("abort_conflicts", abort_conflicts, sm::description("Total K23SI transactions aborted due to conflict"), labels),
         sm::make_counter("abort_too_old", abort_too_old, sm::description("Total K23SI transactions aborted due to retention window expiration"), labels),
         sm::make_counter("heartbeats", heartbeats, sm::description("Total K23SI transaction heartbeats sent"), labels),
+        sm::make_counter("heartbeat_batches", heartbeat_batches, sm::description("Total K23SI batched heartbeat requests sent"), labels),
+        sm::make_counter("txn_retries", txn_retries, sm::description("Total K23SI transaction retries by runTxn"), labels),
+        sm::make_counter("txn_retries_exhausted", txn_retries_exhausted, sm::description("Total K23SI transactions run with runTxn which aborted on their last allowed attempt"), labels),
+        sm::make_counter("schema_cache_misses", schema_cache_misses, sm::description("Total K23SI schema lookups which were not found in the schema cache or at the CPO"), labels),
+        sm::make_counter("schema_negative_hits", schema_negative_hits, sm::description("Total K23SI schema lookups answered as not found from the negative schema cache"), labels),
+        sm::make_counter("deferred_write_flushes", deferred_write_flushes, sm::description("Total flushes of the write buffers of K23SI transactions with deferred writes"), labels),
     });
+    _heartbeatFlushTimer.set_callback([this] { flushHeartbeats(); });
 }
 
 seastar::future<> K23SIClient::start() {
     for (auto it = _tcpRemotes().begin(); it != _tcpRemotes().end(); ++it) {
         _k2endpoints.push_back(String(*it));
     }
-    K2LOG_I(log::skvclient, "_cpo={}", _cpo());
-    cpo_client = CPOClient(String(_cpo()));
+    String cpo = _clientConfig.cpoEndpoint.empty() ? String(_cpo()) : _clientConfig.cpoEndpoint;
+    K2LOG_I(log::skvclient, "_cpo={}", cpo);
+    cpo_client = CPOClient(cpo);
+
+    auto ep = RPC().getServerEndpoint(TCPRPCProtocol::proto);
+    if (subscribe_collection_changes() && _clientConfig.subscribeCollectionChanges && ep) {
+        cpo_client.subscriber = ep->url;
+        RPC().registerRPCObserver<dto::CollectionChangeRequest, dto::CollectionChangeResponse>
+        (dto::Verbs::CPO_COLLECTION_CHANGE, [this] (dto::CollectionChangeRequest&& request) {
+            K2LOG_D(log::skvclient, "received collection change {}", request);
+            cpo_client.applyCollectionChange(std::move(request));
+            return RPCResponse(Statuses::S200_OK("change applied"), dto::CollectionChangeResponse{});
+        });
+    }
 
-    return seastar::make_ready_future<>();
+    // Warm up the schema cache, and the connections to the partitions. Failures are not fatal: the schemas and
+    // the partition maps are fetched again on first use
+    cpo_client.warmupConnections = warmup_connections();
+    return seastar::parallel_for_each(schema_prefetch_collections(), [this] (const String& collectionName) {
+        auto partitions = !warmup_connections() ? seastar::make_ready_future<Status>(Statuses::S200_OK("")) :
+            cpo_client.GetAssignedPartitionWithRetry(Deadline<>(cpo_client.schema_request_timeout()), collectionName, dto::Key{});
+        return partitions.then([this, collectionName] (Status&& status) {
+            if (!status.is2xxOK()) {
+                K2LOG_W(log::skvclient, "Failed to prefetch the partition map of collection {}: {}", collectionName, status);
+            }
+            return refreshSchemaCache(collectionName);
+        })
+        .then([collectionName] (Status&& status) {
+            if (!status.is2xxOK()) {
+                K2LOG_W(log::skvclient, "Failed to prefetch schemas of collection {}: {}", collectionName, status);
+            }
+        })
+        .handle_exception([collectionName] (auto exc) {
+            K2LOG_W_EXC(log::skvclient, exc, "Failed to prefetch schemas of collection {}", collectionName);
+        });
+    });
 }
 
 seastar::future<> K23SIClient::gracefulStop() {
+    if (!cpo_client.subscriber.empty()) {
+        RPC().registerMessageObserver(dto::Verbs::CPO_COLLECTION_CHANGE, nullptr);
+    }
+    // don't leave any transaction waiting for its heartbeat
+    _heartbeatFlushTimer.cancel();
+    flushHeartbeats();
     return seastar::make_ready_future<>();
 }
 
+seastar::future<Status> K23SIClient::heartbeat(dto::K23SITxnHeartbeatRequest&& request, Duration timeout) {
+    if (heartbeat_batch_window() == Duration(0)) {
+        return sendHeartbeat(std::move(request), timeout);
+    }
+    auto cit = cpo_client.collections.find(request.collectionName);
+    if (cit == cpo_client.collections.end()) {
+        return sendHeartbeat(std::move(request), timeout);
+    }
+    auto& pwe = cit->second.getPartitionForKey(request.key);
+    if (!pwe.partition) {
+        return sendHeartbeat(std::move(request), timeout);
+    }
+
+    auto& batch = _heartbeatBatches[std::make_tuple(request.collectionName, pwe.partition->pvid.id)];
+    if (batch.request.heartbeats.empty()) {
+        batch.request.collectionName = request.collectionName;
+        batch.request.key = request.key;
+        batch.timeout = timeout;
+    }
+    else {
+        // the batch has to make it in time for its most urgent heartbeat
+        batch.timeout = std::min(batch.timeout, timeout);
+    }
+    batch.request.heartbeats.push_back(std::move(request));
+    batch.waiters.emplace_back();
+    auto fut = batch.waiters.back().get_future();
+    if (!_heartbeatFlushTimer.armed()) {
+        _heartbeatFlushTimer.arm(heartbeat_batch_window());
+    }
+    return fut;
+}
+
+void K23SIClient::flushHeartbeats() {
+    auto batches = std::move(_heartbeatBatches);
+    _heartbeatBatches.clear();
+    for (auto& [id, batch] : batches) {
+        K2LOG_D(log::skvclient, "send hb multi for {} txns to {}", batch.request.heartbeats.size(), id);
+        heartbeat_batches++;
+        auto pending = std::make_unique<HeartbeatBatch>(std::move(batch));
+        auto& request = pending->request;
+        (void)cpo_client.PartitionRequest
+            <dto::K23SITxnHeartbeatMultiRequest, dto::K23SITxnHeartbeatMultiResponse, dto::Verbs::K23SI_TXN_HEARTBEAT_MULTI>
+            (Deadline<>(pending->timeout), request)
+        .then([this, pending=std::move(pending)] (auto&& response) {
+            auto& [status, k2response] = response;
+            for (size_t i = 0; i < pending->waiters.size(); ++i) {
+                if (!status.is2xxOK()) {
+                    pending->waiters[i].set_value(status);
+                }
+                else if (i >= k2response.statuses.size()) {
+                    pending->waiters[i].set_value(dto::K23SIStatus::InternalError("missing status in hb multi"));
+                }
+                else if (k2response.statuses[i] == dto::K23SIStatus::RefreshCollection) {
+                    // the TRH moved to another partition since we grouped the heartbeat
+                    sendHeartbeat(std::move(pending->request.heartbeats[i]), pending->timeout)
+                        .forward_to(std::move(pending->waiters[i]));
+                }
+                else {
+                    pending->waiters[i].set_value(std::move(k2response.statuses[i]));
+                }
+            }
+        });
+    }
+}
+
+seastar::future<Status> K23SIClient::sendHeartbeat(dto::K23SITxnHeartbeatRequest&& request, Duration timeout) {
+    auto pending = std::make_unique<dto::K23SITxnHeartbeatRequest>(std::move(request));
+    auto& ref = *pending;
+    return cpo_client.PartitionRequest<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse, dto::Verbs::K23SI_TXN_HEARTBEAT>(Deadline<>(timeout), ref)
+    .then([pending=std::move(pending)] (auto&& response) {
+        auto& [status, k2response] = response;
+        return std::move(status);
+    });
+}
+
 seastar::future<Status> K23SIClient::makeCollection(const String& collection, std::vector<String>&& rangeEnds) {
     std::vector<String> endpoints = _k2endpoints;
     dto::HashScheme scheme = rangeEnds.size() ? dto::HashScheme::Range : dto::HashScheme::HashCRC32C;
@@ -337,10 +1425,163 @@ seastar::future<Status> K23SIClient::makeCollection(dto::CollectionMetadata&& me
     return cpo_client.CreateAndWaitForCollection(Deadline<>(create_collection_deadline()), std::move(metadata), std::move(endpoints), std::move(rangeEnds));
 }
 
+seastar::future<Status> K23SIClient::bulkIngest(std::vector<dto::SKVRecord>& records) {
+    if (records.empty()) {
+        return seastar::make_ready_future<Status>(dto::K23SIStatus::OK("nothing to ingest"));
+    }
+    String collection = records[0].collectionName;
+    for (auto& record : records) {
+        if (record.collectionName != collection) {
+            return seastar::make_exception_future<Status>(K23SIClientException("All records in bulkIngest must belong to the same collection"));
+        }
+    }
+    Deadline<> deadline(bulk_ingest_deadline());
+    // we need the partition map to group the records by partition
+    return cpo_client.GetAssignedPartitionWithRetry(deadline, collection, records[0].getKey())
+    .then([this, &records, collection, deadline] (Status&& status) {
+        if (!status.is2xxOK()) {
+            return seastar::make_ready_future<Status>(std::move(status));
+        }
+        return _tsoClient.GetTimestampFromTSO(Clock::now())
+        .then([this, &records, collection, deadline] (dto::Timestamp&& timestamp) {
+            std::map<uint64_t, dto::K23SIBulkIngestRequest> requests;
+            auto& partitions = cpo_client.collections[collection];
+            for (auto& record : records) {
+                dto::Key key = record.getKey();
+                auto& pwe = partitions.getPartitionForKey(key);
+                auto& request = requests[pwe.partition ? pwe.partition->pvid.id : 0];
+                request.records.push_back(dto::K23SIBulkIngestRecord{.key=std::move(key), .value=record.storage.share()});
+            }
+            for (auto& [id, request] : requests) {
+                std::sort(request.records.begin(), request.records.end(), [] (const auto& a, const auto& b) { return a.key < b.key; });
+                request.collectionName = collection;
+                request.timestamp = timestamp;
+                request.key = request.records[0].key;
+            }
+            write_ops += records.size();
+            return seastar::do_with(std::move(requests), Status(dto::K23SIStatus::OK("bulk ingest succeeded")),
+                [this, deadline] (auto& requests, auto& result) {
+                return seastar::parallel_for_each(requests, [this, deadline, &result] (auto& entry) {
+                    return cpo_client.PartitionRequest
+                        <dto::K23SIBulkIngestRequest, dto::K23SIBulkIngestResponse, dto::Verbs::K23SI_BULK_INGEST>
+                        (deadline, entry.second)
+                    .then([&result] (auto&& response) {
+                        auto& [status, k2response] = response;
+                        if (!status.is2xxOK() && result.is2xxOK()) {
+                            result = std::move(status);
+                        }
+                    });
+                })
+                .then([&result] {
+                    return std::move(result);
+                });
+            });
+        });
+    });
+}
+
+seastar::future<Status> K23SIClient::deleteRange(const String& collection, dto::Key start, dto::Key end) {
+    if (start.partitionKey.empty() || (!end.partitionKey.empty() && (end.schemaName != start.schemaName || !(start < end)))) {
+        return seastar::make_exception_future<Status>(K23SIClientException("deleteRange needs a non-empty range in one schema"));
+    }
+    Deadline<> deadline(range_delete_deadline());
+    return _tsoClient.GetTimestampFromTSO(Clock::now())
+    .then([this, collection, start=std::move(start), end=std::move(end), deadline] (dto::Timestamp&& timestamp) mutable {
+        dto::K23SIRangeDeleteRequest request{.pvid={}, .collectionName=collection, .key=std::move(start),
+                                             .endKey=std::move(end), .timestamp=timestamp};
+        return seastar::do_with(std::move(request), Status(dto::K23SIStatus::OK("range delete succeeded")),
+            [this, deadline] (auto& request, auto& result) {
+            // one partition at a time, each one tells us where the range continues
+            return seastar::repeat([this, deadline, &request, &result] {
+                return cpo_client.PartitionRequest
+                    <dto::K23SIRangeDeleteRequest, dto::K23SIRangeDeleteResponse, dto::Verbs::K23SI_RANGE_DELETE>
+                    (deadline, request)
+                .then([&request, &result] (auto&& response) {
+                    auto& [status, k2response] = response;
+                    if (!status.is2xxOK()) {
+                        result = std::move(status);
+                        return seastar::stop_iteration::yes;
+                    }
+                    if (k2response.nextKey.partitionKey.empty()) {
+                        return seastar::stop_iteration::yes;
+                    }
+                    request.key = std::move(k2response.nextKey);
+                    return seastar::stop_iteration::no;
+                });
+            })
+            .then([&result] {
+                return std::move(result);
+            });
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIChangesResponse>>
+K23SIClient::pollChanges(const String& collection, dto::Key key, dto::Timestamp fromTimestamp, uint32_t maxChanges) {
+    Deadline<> deadline(changes_poll_deadline());
+    dto::K23SIChangesRequest request{.pvid={}, .collectionName=collection, .key=std::move(key),
+                                     .fromTimestamp=fromTimestamp, .maxChanges=maxChanges,
+                                     .wait=std::min(changes_poll_wait(), cpo_client.partition_request_timeout() / 2)};
+    return seastar::do_with(std::move(request), [this, deadline] (auto& request) {
+        return cpo_client.PartitionRequest
+            <dto::K23SIChangesRequest, dto::K23SIChangesResponse, dto::Verbs::K23SI_CHANGES>
+            (deadline, request);
+    });
+}
+
+seastar::future<Status> K23SIClient::streamChanges(const String& collection, dto::Key key, dto::Timestamp fromTimestamp,
+                                                   std::function<seastar::future<bool>(dto::K23SIChangesResponse&&)> consumer) {
+    return seastar::do_with(std::move(key), std::move(fromTimestamp), std::move(consumer), Status(dto::K23SIStatus::OK("change stream ended")),
+        [this, collection] (auto& key, auto& fromTimestamp, auto& consumer, auto& result) {
+        return seastar::repeat([this, collection, &key, &fromTimestamp, &consumer, &result] {
+            return pollChanges(collection, key, fromTimestamp)
+            .then([&fromTimestamp, &consumer, &result] (auto&& response) {
+                auto& [status, k2response] = response;
+                if (!status.is2xxOK()) {
+                    result = std::move(status);
+                    return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                }
+                fromTimestamp = k2response.resolved;
+                return consumer(std::move(k2response))
+                .then([] (bool more) {
+                    return more ? seastar::stop_iteration::no : seastar::stop_iteration::yes;
+                });
+            });
+        })
+        .then([&result] {
+            return std::move(result);
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIRunRoutineResponse>>
+K23SIClient::runRoutine(const String& collection, dto::Key key, String routine, Payload params, Duration timeout) {
+    // NB each attempt of the request is still bounded by partition_request_timeout
+    Deadline<> deadline(timeout + cpo_client.partition_request_timeout());
+    dto::K23SIRunRoutineRequest request{.pvid={}, .collectionName=collection, .key=std::move(key),
+                                        .routine=std::move(routine), .params=std::move(params), .timeout=timeout};
+    return seastar::do_with(std::move(request), [this, deadline] (auto& request) {
+        return cpo_client.PartitionRequest
+            <dto::K23SIRunRoutineRequest, dto::K23SIRunRoutineResponse, dto::Verbs::K23SI_RUN_ROUTINE>
+            (deadline, request);
+    });
+}
+
 seastar::future<K2TxnHandle> K23SIClient::beginTxn(const K2TxnOptions& options) {
+    if (options.snapshotRead && !options.readOnly) {
+        return seastar::make_exception_future<K2TxnHandle>(K23SIClientException("Snapshot reads require a read-only transaction"));
+    }
+    if (options.localTimestamp && !options.snapshotRead) {
+        return seastar::make_exception_future<K2TxnHandle>(K23SIClientException("Local clock timestamps require snapshot reads"));
+    }
     auto start_time = Clock::now();
-    return _tsoClient.GetTimestampFromTSO(start_time)
-    .then([this, start_time, options] (auto&& timestamp) {
+    // head-based sampling: the decision is made here, and follows the transaction to every node it touches
+    auto trace = RPC().tracer().startTrace();
+    tracing::Scope scope(trace);
+    auto makeHandle = [this, start_time, options, trace] (dto::Timestamp&& timestamp) {
+        if (options.readOnly && options.readOnlyStaleness > Duration(0)) {
+            timestamp = timestamp - options.readOnlyStaleness;
+        }
         dto::K23SI_MTR mtr{
             _rnd(_gen),
             std::move(timestamp),
@@ -348,16 +1589,83 @@ seastar::future<K2TxnHandle> K23SIClient::beginTxn(const K2TxnOptions& options)
         };
 
         total_txns++;
-        return seastar::make_ready_future<K2TxnHandle>(K2TxnHandle(std::move(mtr), std::move(options), &cpo_client, this, txn_end_deadline(), start_time));
+        return K2TxnHandle(std::move(mtr), std::move(options), &cpo_client, this, txn_end_deadline(), start_time, trace);
+    };
+
+    if (options.localTimestamp) {
+        auto timestamp = _tsoClient.GetLocalTimestamp(start_time);
+        if (timestamp) {
+            local_timestamp_txns++;
+            return seastar::make_ready_future<K2TxnHandle>(makeHandle(std::move(*timestamp)));
+        }
+        // no recent enough TSO timestamp to extrapolate from. Fall back to the TSO
+    }
+    if (options.eagerBegin) {
+        auto timestamp = _tsoClient.GetTimestampFromTSO(start_time)
+        .then([options] (dto::Timestamp&& timestamp) {
+            if (options.readOnly && options.readOnlyStaleness > Duration(0)) {
+                timestamp = timestamp - options.readOnlyStaleness;
+            }
+            return std::move(timestamp);
+        });
+        dto::K23SI_MTR mtr{
+            _rnd(_gen),
+            dto::Timestamp(), // set once the timestamp comes from the TSO
+            options.priority
+        };
+        total_txns++;
+        return seastar::make_ready_future<K2TxnHandle>(K2TxnHandle(std::move(mtr), options, &cpo_client, this,
+                txn_end_deadline(), start_time, trace, seastar::shared_future<dto::Timestamp>(std::move(timestamp))));
+    }
+    return _tsoClient.GetTimestampFromTSO(start_time)
+    .then([makeHandle=std::move(makeHandle)] (auto&& timestamp) mutable {
+        return seastar::make_ready_future<K2TxnHandle>(makeHandle(std::move(timestamp)));
     });
 }
 
+Duration K23SIClient::retryBackoff(uint32_t retry) {
+    Duration ceiling = txn_retry_backoff();
+    for (uint32_t i = 1; i < retry && ceiling < txn_retry_max_backoff(); ++i) {
+        ceiling *= 2;
+    }
+    ceiling = std::min(ceiling, txn_retry_max_backoff());
+    // full jitter, so that transactions which conflicted with each other don't retry in lockstep
+    return Duration(std::uniform_int_distribution<Duration::rep>(0, ceiling.count())(_gen));
+}
+
+dto::TxnPriority K23SIClient::escalatePriority(dto::TxnPriority priority) {
+    switch (priority) {
+        case dto::TxnPriority::Lowest: return dto::TxnPriority::Low;
+        case dto::TxnPriority::Low: return dto::TxnPriority::Medium;
+        case dto::TxnPriority::Medium: return dto::TxnPriority::High;
+        default: return dto::TxnPriority::Highest;
+    }
+}
+
 seastar::future<CreateSchemaResult> K23SIClient::createSchema(const String& collectionName, dto::Schema schema) {
-    return cpo_client.createSchema(collectionName, std::move(schema)).then([](auto&& status) {
+    return cpo_client.createSchema(collectionName, std::move(schema)).then([this, collectionName](auto&& status) {
+        if (status.is2xxOK()) {
+            _schemaMisses.erase(collectionName);
+        }
         return CreateSchemaResult{.status=std::move(status)};
     });
 }
 
+const std::vector<std::shared_ptr<dto::Schema>>&
+K23SIClient::getIndexSchemas(const String& collectionName, const dto::Schema& schema) {
+    auto& cached = indexSchemas[collectionName][schema.name];
+    auto it = cached.find(schema.version);
+    if (it == cached.end()) {
+        std::vector<std::shared_ptr<dto::Schema>> made;
+        for (const dto::SecondaryIndex& index : schema.secondaryIndexes) {
+            made.push_back(std::make_shared<dto::Schema>(schema.makeIndexSchema(index)));
+            made.back()->indexFields();
+        }
+        it = cached.emplace(schema.version, std::move(made)).first;
+    }
+    return it->second;
+}
+
 seastar::future<Status> K23SIClient::refreshSchemaCache(const String& collectionName) {
     return cpo_client.getSchemas(collectionName)
     .then([this, collectionName] (auto&& response) {
@@ -370,16 +1678,65 @@ seastar::future<Status> K23SIClient::refreshSchemaCache(const String& collection
 
         auto& schemaMap = schemas[collectionName];
         for (const Schema& schema : collSchemas) {
-            schemaMap[schema.name][schema.version] = std::make_shared<dto::Schema>(schema);
+            auto cached = std::make_shared<dto::Schema>(schema);
+            cached->indexFields();
+            schemaMap[schema.name][schema.version] = std::move(cached);
         }
 
         return status;
     });
 }
 
+std::shared_ptr<dto::Schema> K23SIClient::getCachedSchema(const String& collectionName, const String& schemaName,
+                                                          uint32_t schemaVersion) const {
+    auto cIt = schemas.find(collectionName);
+    if (cIt == schemas.end()) {
+        return nullptr;
+    }
+    auto sIt = cIt->second.find(schemaName);
+    if (sIt == cIt->second.end()) {
+        return nullptr;
+    }
+    auto vIt = sIt->second.find(schemaVersion);
+    return vIt == sIt->second.end() ? nullptr : vIt->second;
+}
+
+bool K23SIClient::isKnownMissingSchema(const String& collectionName, const String& schemaName, int64_t schemaVersion) {
+    auto cIt = _schemaMisses.find(collectionName);
+    if (cIt == _schemaMisses.end()) {
+        return false;
+    }
+    auto mIt = cIt->second.find(std::make_tuple(schemaName, schemaVersion));
+    if (mIt == cIt->second.end()) {
+        return false;
+    }
+    if (Clock::now() >= mIt->second) {
+        cIt->second.erase(mIt);
+        if (cIt->second.empty()) {
+            _schemaMisses.erase(cIt);
+        }
+        return false;
+    }
+    return true;
+}
+
 seastar::future<GetSchemaResult> K23SIClient::getSchema(const String& collectionName, const String& schemaName, int64_t schemaVersion) {
-    return getSchemaInternal(collectionName, schemaName, schemaVersion, true).then([](auto&& result) {
+    // A schema which the CPO recently did not have is still served from the cache if it got there since,
+    // but we don't ask the CPO for it again until the negative entry expires
+    bool knownMissing = isKnownMissingSchema(collectionName, schemaName, schemaVersion);
+    return getSchemaInternal(collectionName, schemaName, schemaVersion, !knownMissing)
+    .then([this, knownMissing, collectionName, schemaName, schemaVersion](auto&& result) {
         auto&& [status, schema] = std::move(result);
+        if (status.code == 404) {
+            if (knownMissing) {
+                schema_negative_hits++;
+            } else {
+                schema_cache_misses++;
+                if (schema_negative_cache_ttl() > 0s) {
+                    _schemaMisses[collectionName][std::make_tuple(schemaName, schemaVersion)] = Clock::now() + schema_negative_cache_ttl();
+                }
+            }
+        }
         return GetSchemaResult{.status=std::move(status), .schema=std::move(schema)};
     });
 }
@@ -533,11 +1890,446 @@ void K2TxnHandle::prepareQueryRequest(Query& query) {
                 query.request.key.partitionKey != "") {
         throw K23SIClientException("End key is greater than start key for reverse direction query");
     }
+    // the filter may constrain the key fields more tightly than the start and end records do, and the
+    // narrower range also routes the request past the partitions which cannot have matching records
+    if (query.schema) {
+        dto::expression::narrowKeyRange(query.request.filterExpression, *query.schema, query.request.reverseDirection,
+                                        query.request.key, query.request.endKey);
+    }
+
+    // the records of an ordered query are ranked by the client as well, which needs the field in them
+    auto& projection = query.request.projection;
+    const String& orderField = query.request.orderBy.fieldName;
+    if (!orderField.empty() && !projection.empty() &&
+        std::find(projection.begin(), projection.end(), orderField) == projection.end()) {
+        projection.push_back(orderField);
+    }
+
+    // A prepared query only sends the literals of its filter to the partitions which already have it, so that
+    // the id has to tell apart the queries with different filter shapes or projections
+    if (query.prepared) {
+        size_t id = dto::expression::shapeHash(query.request.filterExpression);
+        for (const String& field : projection) {
+            id ^= std::hash<String>()(field) + 0x9e3779b97f4a7c15ULL + (id << 6) + (id >> 2);
+        }
+        query.request.preparedQueryId = std::max<uint64_t>(id, 1);
+        query.request.parameters.clear();
+        dto::expression::collectLiterals(query.request.filterExpression, query.request.parameters);
+        query.preparedFilter = std::move(query.request.filterExpression);
+        query.request.filterExpression = dto::expression::Expression{};
+        query.preparedProjection = std::move(projection);
+        query.request.projection.clear();
+    }
 
     query.request.mtr = _mtr;
+    query.request.snapshotRead = _options.snapshotRead;
     query.inprogress = true;
 }
 
+seastar::future<std::tuple<Status, dto::K23SIQueryResponse>> K2TxnHandle::sendQueryRequest(Query& query) {
+    dto::K23SIQueryRequest& request = query.request;
+    if (request.preparedQueryId != 0) {
+        // a partition we haven't sent the query to needs its filter and projection
+        auto it = _cpo_client->collections.find(request.collectionName);
+        auto known = _client->prepared_queries.find(request.preparedQueryId);
+        if (it == _cpo_client->collections.end() || known == _client->prepared_queries.end()) {
+            return sendPreparingQueryRequest(query);
+        }
+        dto::Partition* partition = it->second.getPartitionForKey(request.key, request.reverseDirection,
+                                                                  request.exclusiveKey).partition;
+        if (!partition || std::find(known->second.begin(), known->second.end(), partition->pvid) == known->second.end()) {
+            return sendPreparingQueryRequest(query);
+        }
+    }
+
+    tracing::Scope trace(_trace);
+    return _cpo_client->PartitionRequest
+        <dto::K23SIQueryRequest, dto::K23SIQueryResponse, dto::Verbs::K23SI_QUERY>
+        (_options.deadline, request, request.reverseDirection, request.exclusiveKey)
+    .then([this, &query] (auto&& response) {
+        auto& [status, k2response] = response;
+        if (query.request.preparedQueryId == 0 || status != dto::K23SIStatus::KeyNotFound) {
+            return seastar::make_ready_future<std::tuple<Status, dto::K23SIQueryResponse>>(std::move(response));
+        }
+        // The partition has dropped the prepared query (e.g. evicted or restarted), so we prepare it again
+        K2LOG_D(log::skvclient, "prepared query {} is gone from {}", query.request.preparedQueryId, query.request.pvid);
+        auto& known = _client->prepared_queries[query.request.preparedQueryId];
+        known.erase(std::remove(known.begin(), known.end(), query.request.pvid), known.end());
+        return sendPreparingQueryRequest(query);
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIQueryResponse>> K2TxnHandle::sendPreparingQueryRequest(Query& query) {
+    // the partition registers the query and runs it with the filter and projection we send along
+    query.request.prepare = true;
+    query.request.filterExpression = dto::expression::copyExpression(query.preparedFilter);
+    query.request.projection = query.preparedProjection;
+
+    tracing::Scope trace(_trace);
+    return _cpo_client->PartitionRequest
+        <dto::K23SIQueryRequest, dto::K23SIQueryResponse, dto::Verbs::K23SI_QUERY>
+        (_options.deadline, query.request, query.request.reverseDirection, query.request.exclusiveKey)
+    .then_wrapped([this, &query] (auto&& fut) {
+        query.request.prepare = false;
+        query.request.filterExpression = dto::expression::Expression{};
+        query.request.projection.clear();
+        if (fut.failed()) {
+            return std::move(fut);
+        }
+        auto response = fut.get0();
+        if (std::get<0>(response).is2xxOK()) {
+            auto& known = _client->prepared_queries[query.request.preparedQueryId];
+            if (std::find(known.begin(), known.end(), query.request.pvid) == known.end()) {
+                known.push_back(query.request.pvid);
+            }
+        }
+        return seastar::make_ready_future<std::tuple<Status, dto::K23SIQueryResponse>>(std::move(response));
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIQueryResponse>> K2TxnHandle::queryStreamPage(Query& query) {
+    query.nextRequest.collectionName = query.request.collectionName;
+    query.nextRequest.key = query.request.key;
+    query.nextRequest.streamId = query.streamId;
+    // one more page may be prepared in place of the one we're taking
+    query.nextRequest.credits = 1;
+
+    tracing::Scope trace(_trace);
+    return _cpo_client->PartitionRequest
+        <dto::K23SIQueryNextRequest, dto::K23SIQueryResponse, dto::Verbs::K23SI_QUERY_NEXT>
+        (_options.deadline, query.nextRequest, query.request.reverseDirection, query.request.exclusiveKey)
+    .then([this, &query] (auto&& response) {
+        auto& [status, k2response] = response;
+        if (status != dto::K23SIStatus::KeyNotFound) {
+            return seastar::make_ready_future<std::tuple<Status, dto::K23SIQueryResponse>>(std::move(response));
+        }
+
+        // The server no longer has the stream (e.g. it expired or the partition moved), but the query
+        // is up to date with the last page we got so we continue with a plain request
+        K2LOG_D(log::skvclient, "query stream {} is gone, continuing from {}", query.streamId, query.request.key);
+        query.streamId = 0;
+        return sendQueryRequest(query);
+    });
+}
+
+void K2TxnHandle::planPartitionScans(Query& query) {
+    dto::K23SIQueryRequest& request = query.request;
+    dto::PartitionGetter& getter = _cpo_client->collections[request.collectionName];
+    dto::Partition* first = getter.getPartitionForKey(request.key, request.reverseDirection, request.exclusiveKey).partition;
+
+    std::vector<dto::Partition*> partitions;
+    for (dto::Partition& partition : getter.collection.partitionMap.partitions) {
+        partitions.push_back(&partition);
+    }
+    std::sort(partitions.begin(), partitions.end(), [reverse=request.reverseDirection] (dto::Partition* a, dto::Partition* b) {
+        return reverse ? *b < *a : *a < *b;
+    });
+
+    const String& end = request.endKey.partitionKey;
+    bool inRange = false;
+    for (dto::Partition* partition : partitions) {
+        inRange = inRange || partition == first;
+        if (!inRange) {
+            continue;
+        }
+        // the partitions past the (exclusive) end key have nothing to scan
+        if (end != "" && (request.reverseDirection ? partition->endKey != "" && partition->endKey <= end :
+                                                     end <= partition->startKey)) {
+            break;
+        }
+
+        Query& scan = query.partitionScans.emplace_back();
+        scan.schema = query.schema;
+        scan.inprogress = true;
+        scan.keysProjected = query.keysProjected;
+        scan.partitionScan = true;
+        scan.partitionStart = partition->startKey;
+        scan.partitionEnd = partition->endKey;
+
+        scan.request.collectionName = request.collectionName;
+        scan.request.mtr = request.mtr;
+        scan.request.endKey = request.endKey;
+        scan.request.recordLimit = request.recordLimit;
+        scan.request.responseBytesLimit = request.responseBytesLimit;
+        scan.request.includeVersionMismatch = request.includeVersionMismatch;
+        scan.request.reverseDirection = request.reverseDirection;
+        scan.request.filterExpression = dto::expression::copyExpression(request.filterExpression);
+        scan.request.projection = request.projection;
+        scan.request.snapshotRead = request.snapshotRead;
+        scan.request.streamCredits = request.streamCredits;
+        scan.request.aggregates = request.aggregates;
+        scan.request.columnar = request.columnar;
+        scan.request.orderBy = request.orderBy;
+        scan.prepared = query.prepared;
+        scan.preparedFilter = dto::expression::copyExpression(query.preparedFilter);
+        scan.preparedProjection = query.preparedProjection;
+        scan.request.preparedQueryId = request.preparedQueryId;
+        for (const dto::expression::Value& parameter : request.parameters) {
+            dto::expression::Value& copy = scan.request.parameters.emplace_back();
+            copy.fieldName = parameter.fieldName;
+            copy.type = parameter.type;
+            copy.literal = const_cast<Payload&>(parameter.literal).copy();
+        }
+        for (dto::Aggregate& aggregate : scan.request.aggregates) {
+            scan.aggregators.emplace_back(aggregate);
+        }
+        if (query.ranker) {
+            scan.ranker.emplace(request.orderBy);
+        }
+
+        if (partition == first) {
+            scan.request.key = request.key;
+            scan.request.exclusiveKey = request.exclusiveKey;
+        } else if (request.reverseDirection) {
+            // from the end of the partition, same as the continuation token the previous partition would return
+            scan.request.key = dto::Key{request.key.schemaName, partition->endKey, ""};
+            scan.request.exclusiveKey = true;
+        } else {
+            scan.request.key = dto::Key{request.key.schemaName, partition->startKey, ""};
+            scan.request.exclusiveKey = false;
+        }
+    }
+    K2LOG_D(log::skvclient, "parallel query over {} partitions, fanout={}", query.partitionScans.size(), query.fanout);
+}
+
+QueryResult K2TxnHandle::collectPartitionPages(Query& query) {
+    // the first failed page in scan order fails the whole query
+    for (size_t i = query.scanHead; i < query.partitionScans.size(); ++i) {
+        Query& scan = query.partitionScans[i];
+        if (!scan.pages.empty() && !scan.pages.front().status.is2xxOK()) {
+            query.done = true;
+            return QueryResult(std::move(scan.pages.front().status));
+        }
+    }
+
+    QueryResult result(dto::K23SIStatus::OK("Query success"));
+    for (size_t i = query.scanHead; i < query.partitionScans.size(); ++i) {
+        Query& scan = query.partitionScans[i];
+        for (QueryResult& page : scan.pages) {
+            std::move(page.records.begin(), page.records.end(), std::back_inserter(result.records));
+            result.columns.append(std::move(page.columns));
+        }
+        scan.pages.clear();
+        if (query.ordered && !scan.done) {
+            // the records of the partitions after this one have to wait until it is done
+            break;
+        }
+    }
+    while (query.scanHead < query.partitionScans.size() && query.partitionScans[query.scanHead].done &&
+           query.partitionScans[query.scanHead].pages.empty()) {
+        query.scanHead++;
+    }
+    if (query.scanHead == query.partitionScans.size()) {
+        query.done = true;
+    }
+
+    if (query.ranker) {
+        // each partition scan returns its ranked records when it is done, and the record limit is only
+        // applied by the partition scans
+        query.rankPage(result);
+    }
+    else if (query.request.recordLimit >= 0) {
+        if (result.records.size() > (size_t)query.request.recordLimit) {
+            result.records.resize(query.request.recordLimit);
+        }
+        result.columns.truncate(query.request.recordLimit);
+        query.request.recordLimit -= result.records.size() + result.columns.numRows;
+        if (query.request.recordLimit == 0) {
+            query.done = true;
+        }
+    }
+
+    // the aggregates over all partitions are the merge of the aggregates of each partition scan
+    for (size_t i = 0; i < query.request.aggregates.size(); ++i) {
+        dto::Aggregator aggregator(query.request.aggregates[i]);
+        for (Query& scan : query.partitionScans) {
+            aggregator.merge(scan.aggregators[i].result());
+        }
+        result.aggregates.push_back(aggregator.result());
+    }
+    return result;
+}
+
+seastar::future<QueryResult> K2TxnHandle::parallelQuery(Query& query) {
+    auto planned = seastar::make_ready_future<Status>(dto::K23SIStatus::OK(""));
+    if (query.partitionScans.empty()) {
+        // make sure we have the partition map of the collection
+        planned = _cpo_client->GetAssignedPartitionWithRetry(_options.deadline, query.request.collectionName,
+                    query.request.key, query.request.reverseDirection, query.request.exclusiveKey)
+        .then([this, &query] (Status&& status) {
+            if (status.is2xxOK()) {
+                planPartitionScans(query);
+            }
+            return std::move(status);
+        });
+    }
+
+    return planned.then([this, &query] (Status&& status) {
+        if (!status.is2xxOK()) {
+            query.done = true;
+            return seastar::make_ready_future<QueryResult>(QueryResult(std::move(status)));
+        }
+
+        // The window is the first fanout partition scans with pages left to return. Those of them which
+        // don't have a page waiting get their next page now
+        std::vector<size_t> fetches;
+        uint32_t window = 0;
+        for (size_t i = query.scanHead; i < query.partitionScans.size() && window < query.fanout; ++i) {
+            Query& scan = query.partitionScans[i];
+            if (scan.done && scan.pages.empty()) {
+                continue;
+            }
+            window++;
+            if (!scan.done && scan.pages.empty()) {
+                fetches.push_back(i);
+            }
+        }
+
+        return seastar::do_with(std::move(fetches), [this, &query] (std::vector<size_t>& fetches) {
+            return seastar::parallel_for_each(fetches, [this, &query] (size_t i) {
+                return this->query(query.partitionScans[i])
+                .then([&query, i] (QueryResult&& page) {
+                    query.partitionScans[i].pages.push_back(std::move(page));
+                });
+            });
+        })
+        .then([this, &query] {
+            return collectPartitionPages(query);
+        });
+    });
+}
+
+seastar::future<QueryResult> K2TxnHandle::readaheadQuery(Query& query) {
+    if (!query.ahead) {
+        // the user's query only hands out the pages, which are fetched by its copy
+        query.ahead = std::make_shared<QueryReadahead>();
+        Query& ahead = query.ahead->query;
+        ahead.schema = query.schema;
+        ahead.inprogress = true;
+        ahead.keysProjected = query.keysProjected;
+        ahead.request = std::move(query.request);
+        query.request.collectionName = ahead.request.collectionName;
+        ahead.aggregators = std::move(query.aggregators);
+        ahead.ranker = std::move(query.ranker);
+        ahead.fanout = query.fanout;
+        ahead.ordered = query.ordered;
+        ahead.prepared = query.prepared;
+        ahead.preparedFilter = std::move(query.preparedFilter);
+        ahead.preparedProjection = std::move(query.preparedProjection);
+    }
+    if (!_readahead_gate) {
+        _readahead_gate = std::make_unique<seastar::gate>();
+    }
+    auto& state = query.ahead;
+    fillReadahead(state, query.readahead);
+
+    if (state->pages.empty() && state->error) {
+        query.done = true;
+        return seastar::make_exception_future<QueryResult>(state->error);
+    }
+    if (state->pages.empty()) {
+        K2ASSERT(log::skvclient, state->fetching, "readahead query has no pages and no fetch");
+        state->waiter.emplace();
+        return state->waiter->get_future().then([this, &query] {
+            return readaheadQuery(query);
+        });
+    }
+
+    QueryResult page = std::move(state->pages.front());
+    state->pages.pop_front();
+    // keep the window full while the user processes this page
+    fillReadahead(state, query.readahead);
+    query.done = !page.status.is2xxOK() ||
+                 (state->query.done && state->pages.empty() && !state->fetching && !state->error);
+    return seastar::make_ready_future<QueryResult>(std::move(page));
+}
+
+void K2TxnHandle::fillReadahead(const std::shared_ptr<QueryReadahead>& state, uint32_t window) {
+    // after end() has taken the gate, no more pages are fetched
+    if (!_readahead_gate || state->fetching || state->error || state->query.done || state->pages.size() >= window) {
+        return;
+    }
+    state->fetching = true;
+    (void) seastar::with_gate(*_readahead_gate, [this, state, window] {
+        return this->query(state->query)
+        .then_wrapped([this, state, window] (auto&& fut) {
+            state->fetching = false;
+            if (fut.failed()) {
+                state->error = fut.get_exception();
+            } else {
+                state->pages.push_back(fut.get0());
+            }
+            if (state->waiter) {
+                state->waiter->set_value();
+                state->waiter.reset();
+            }
+            fillReadahead(state, window);
+        });
+    });
+}
+
+seastar::future<QueryResult> K2TxnHandle::queryIndex(Query& indexQuery) {
+    if (!indexQuery.schema) {
+        return seastar::make_exception_future<QueryResult>(K23SIClientException("Query was not created by createQuery"));
+    }
+    if (indexQuery.request.columnar) {
+        // the index records are only used to look up the records of the schema, which are not columnar
+        return seastar::make_ready_future<QueryResult>(
+            QueryResult(dto::K23SIStatus::BadParameter("columnar queries are not supported on secondary indexes")));
+    }
+    const String& indexSchemaName = indexQuery.schema->name;
+    size_t separator = indexSchemaName.rfind('.');
+    if (separator == String::npos) {
+        return seastar::make_ready_future<QueryResult>(
+            QueryResult(dto::K23SIStatus::BadParameter("query is not on the schema of a secondary index")));
+    }
+    String collectionName = indexQuery.request.collectionName;
+
+    return _client->getSchema(collectionName, indexSchemaName.substr(0, separator), K23SIClient::ANY_VERSION)
+    .then([this, &indexQuery, collectionName] (GetSchemaResult&& schemaResult) {
+        if (!schemaResult.status.is2xxOK()) {
+            return seastar::make_ready_future<QueryResult>(QueryResult(std::move(schemaResult.status)));
+        }
+        // the key of an indexed record is made from its key fields, which come first in the schema
+        auto keySchema = std::make_shared<dto::Schema>(*schemaResult.schema);
+        keySchema->fields.resize(keySchema->partitionKeyFields.size() + keySchema->rangeKeyFields.size());
+        keySchema->indexFields();
+
+        return query(indexQuery)
+        .then([this, &indexQuery, collectionName, keySchema] (QueryResult&& page) {
+            if (!page.status.is2xxOK()) {
+                return seastar::make_ready_future<QueryResult>(std::move(page));
+            }
+            std::vector<dto::Key> keys;
+            keys.reserve(page.records.size());
+            for (dto::SKVRecord& indexRecord : page.records) {
+                keys.push_back(indexRecord.copyFieldsToSchema(keySchema).getKey());
+            }
+
+            return seastar::do_with(std::move(page), [this, &indexQuery, collectionName, keys=std::move(keys)] (QueryResult& page) mutable {
+                return readMany(std::move(keys), collectionName)
+                .then([&indexQuery, &page] (std::vector<ReadResult<dto::SKVRecord>>&& reads) {
+                    QueryResult result(std::move(page.status));
+                    for (size_t i = 0; i < reads.size(); ++i) {
+                        if (reads[i].status == dto::K23SIStatus::KeyNotFound) {
+                            // erased since the index record was written
+                            continue;
+                        }
+                        if (!reads[i].status.is2xxOK()) {
+                            return QueryResult(std::move(reads[i].status));
+                        }
+                        dto::Key indexKey = reads[i].value.copyFieldsToSchema(indexQuery.schema).getKey();
+                        if (indexKey == page.records[i].getKey()) {
+                            result.records.push_back(std::move(reads[i].value));
+                        }
+                    }
+                    return result;
+                });
+            });
+        });
+    });
+}
+
 // Get one set of paginated results for a query. User may need to call again with same query
 // object to get more results
 seastar::future<QueryResult> K2TxnHandle::query(Query& query) {
@@ -547,6 +2339,18 @@ seastar::future<QueryResult> K2TxnHandle::query(Query& query) {
     if (_failed) {
         return seastar::make_ready_future<QueryResult>(QueryResult(_failed_status));
     }
+    if (_pending_timestamp) {
+        return awaitTimestamp(query.request.collectionName, dto::Key{}).then([this, &query] {
+            return this->query(query);
+        });
+    }
+    if (!_deferred_writes.empty()) {
+        // the server has to see our writes for the query to return them
+        return flushDeferredWrites()
+        .then([this, &query] {
+            return this->query(query);
+        });
+    }
 
     if (query.done) {
         return seastar::make_exception_future<QueryResult>(K23SIClientException("Tried to use Query that is done"));
@@ -554,14 +2358,18 @@ seastar::future<QueryResult> K2TxnHandle::query(Query& query) {
     if (!query.inprogress) {
         prepareQueryRequest(query);
     }
+    if (query.readahead > 0) {
+        return readaheadQuery(query);
+    }
+    if (query.fanout > 0) {
+        return parallelQuery(query);
+    }
 
     _client->query_ops++;
     _ongoing_ops++;
 
-    return _cpo_client->PartitionRequest
-        <dto::K23SIQueryRequest, dto::K23SIQueryResponse, dto::Verbs::K23SI_QUERY>
-        (_options.deadline, query.request, query.request.reverseDirection, query.request.exclusiveKey)
-    .then([this, &query] (auto&& response) {
+    auto page = query.streamId != 0 ? queryStreamPage(query) : sendQueryRequest(query);
+    return page.then([this, &query] (auto&& response) {
         auto& [status, k2response] = response;
         checkResponseStatus(status);
         _ongoing_ops--;
@@ -571,21 +2379,39 @@ seastar::future<QueryResult> K2TxnHandle::query(Query& query) {
             return seastar::make_ready_future<QueryResult>(QueryResult(status));
         }
 
+        query.streamId = k2response.streamId;
         if (k2response.nextToScan.partitionKey == "") {
             query.done = true;
         } else {
             query.request.key = std::move(k2response.nextToScan);
             query.request.exclusiveKey = std::move(k2response.exclusiveToken);
+            if (query.partitionScan && query.isPastPartition()) {
+                // the rest of the range belongs to the other partition scans of the parallel query
+                query.done = true;
+            }
+        }
+
+        for (size_t i = 0; i < k2response.aggregates.size() && i < query.aggregators.size(); ++i) {
+            query.aggregators[i].merge(k2response.aggregates[i]);
         }
 
         if (query.request.recordLimit >= 0) {
-            query.request.recordLimit -= k2response.results.size();
+            // the results of an ordered query are some of the records which were ranked
+            query.request.recordLimit -= std::max<size_t>(k2response.results.size(), k2response.rankedRecords) +
+                                         k2response.aggregatedRecords + k2response.columns.numRows;
             if (query.request.recordLimit == 0) {
                 query.done = true;
             }
         }
 
-        return QueryResult::makeQueryResult(_client, query, std::move(status), std::move(k2response));
+        auto result = QueryResult::makeQueryResult(_client, query, std::move(status), std::move(k2response));
+        if (!query.ranker) {
+            return result;
+        }
+        return result.then([&query] (QueryResult&& page) {
+            query.rankPage(page);
+            return std::move(page);
+        });
     });
 }
 
@@ -23,11 +23,19 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <map>
+#include <optional>
 #include <random>
+#include <tuple>
 #include <vector>
 
 #include <seastar/core/future.hh>
 #include <seastar/core/future-util.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/timer.hh>
 
 #include <k2/appbase/Appbase.h>
 #include <k2/appbase/AppEssentials.h>
@@ -62,7 +70,50 @@ public:
     Deadline<> deadline;
     dto::TxnPriority priority;
     bool syncFinalize = false;
-    K2_DEF_FMT(K2TxnOptions, deadline, priority, syncFinalize);
+    // with syncFinalize, finalize the write intents from the client in parallel(one batch per partition) instead
+    // of waiting for the TRH to do it
+    bool clientFinalize = false;
+    // a read-only transaction never writes, so it never designates a TRH, never heartbeats and doesn't send End.
+    // Writes in a read-only transaction fail with K23SIClientException
+    bool readOnly = false;
+    // for read-only transactions, read at a snapshot this much older than the TSO timestamp. A slightly stale
+    // snapshot makes it unlikely to run into write intents of in-progress transactions and so to have to PUSH
+    Duration readOnlyStaleness{0};
+    // perform all reads and queries as snapshot(bounded-staleness) reads: the server returns committed versions only,
+    // without updating its read cache or pushing in-progress transactions. Requires readOnly with a readOnlyStaleness
+    // of at least the server's k23si_snapshot_read_min_staleness. Transactions which are still in progress at the
+    // snapshot timestamp are not visible, even if they commit later
+    bool snapshotRead = false;
+    // how often the transaction must heartbeat before the server aborts it. Zero means the collection's heartbeat
+    // deadline. Long-running transactions(e.g. analytics) can use a longer deadline to heartbeat less often
+    Duration heartbeatDeadline{0};
+    // writes are acknowledged as soon as their WIs are in place, without waiting for persistence. Before committing,
+    // end() waits for the writes to become durable in every partition, and aborts instead if any of them failed.
+    // Multiple writes of the transaction can then be in flight without each paying for a persistence round trip
+    bool pipelineWrites = false;
+    // with pipelineWrites, end() sends the commit without waiting for the writes to become durable. The TRH holds
+    // the transaction in Staging while it checks their durability with the partitions, and commits once all of them
+    // are durable. This saves the client a round trip to all partitions before the commit
+    bool parallelCommit = true;
+    // start the transaction with a timestamp from the TSO client's local clock (see TSO_ClientLib::GetLocalTimestamp)
+    // instead of a TSO timestamp, if one with small enough uncertainty is available. Requires snapshotRead
+    bool localTimestamp = false;
+    // buffer the writes in the handle instead of sending each of them. The transaction reads its buffered writes
+    // back from the buffer, and the buffer is sent at end() as one batched write per partition. Writes only report
+    // errors which can be detected in the client; a write which fails when the buffer is sent fails the
+    // transaction. Queries and partial updates send the buffer first
+    bool deferWrites = false;
+    // with deferWrites, send the buffer once it has this many writes. 0 sends it only when it has to be
+    size_t deferredWriteLimit = 0;
+    // max number of writeAsync() writes of the transaction in flight
+    size_t asyncWriteLimit = 64;
+    // keep the records this transaction read or wrote and serve repeated reads of them from the handle. All reads
+    // of a transaction are at its timestamp, so a key reads the same until the transaction writes it again
+    bool cacheRecords = true;
+    // beginTxn returns the handle without waiting for the TSO timestamp. Operations wait for the timestamp before
+    // they are sent, and the partition routing and schema lookup of the first of them run while it is on its way
+    bool eagerBegin = false;
+    K2_DEF_FMT(K2TxnOptions, deadline, priority, syncFinalize, clientFinalize, readOnly, readOnlyStaleness, snapshotRead, heartbeatDeadline, pipelineWrites, parallelCommit, localTimestamp, deferWrites, deferredWriteLimit, asyncWriteLimit, cacheRecords, eagerBegin);
 };
 
 template<typename ValueType>
@@ -82,9 +133,21 @@ public:
     K2_DEF_FMT(WriteResult, status);
 
 private:
+    friend class K2TxnHandle;
     dto::K23SIWriteResponse response;
 };
 
+// The result of K2TxnHandle::updateFields
+template<typename ValueType>
+class FieldOpsResult {
+public:
+    FieldOpsResult(Status s, ValueType&& v) : status(std::move(s)), value(std::move(v)) {}
+
+    Status status;
+    ValueType value; // the record as written, with the results of the field operations
+    K2_DEF_FMT(FieldOpsResult, status);
+};
+
 class PartialUpdateResult{
 public:
     PartialUpdateResult(Status s) : status(std::move(s)) {}
@@ -115,6 +178,10 @@ struct CreateSchemaResult {
 class K23SIClientConfig {
 public:
     K23SIClientConfig(){};
+    // the CPO to use instead of the cpo config option, if set
+    String cpoEndpoint;
+    // false for clients in a process which already receives the collection changes the CPO pushes, e.g. a nodepool
+    bool subscribeCollectionChanges = true;
 };
 
 struct CreateQueryResult {
@@ -139,38 +206,153 @@ public:
     seastar::future<Status> makeCollection(const String& collection, std::vector<String>&& rangeEnds=std::vector<String>());
     seastar::future<Status> makeCollection(dto::CollectionMetadata&& metadata, std::vector<String>&& endpoints, std::vector<String>&& rangeEnds=std::vector<String>());
     seastar::future<K2TxnHandle> beginTxn(const K2TxnOptions& options);
+
+    // Loads the records into a collection created with bulkLoad, outside of any transaction. The records are
+    // grouped by partition and each partition gets one K23SI_BULK_INGEST with its records sorted by key. They are
+    // all committed at one timestamp from the TSO. Returns the first failure of a partition, if any. The records
+    // have to be of one collection, with distinct keys which nothing else writes during the load
+    seastar::future<Status> bulkIngest(std::vector<dto::SKVRecord>& records);
+
+    // Erases all keys in [start, end) of a range partitioned collection, outside of any transaction, as of one
+    // timestamp from the TSO. An empty end.partitionKey means the end of the schema. The partitions of the range
+    // get a K23SI_RANGE_DELETE one after the other, each of which records its part with a single range tombstone.
+    // On a failure, the partitions before the failed one stay deleted
+    seastar::future<Status> deleteRange(const String& collection, dto::Key start, dto::Key end);
+
+    // Polls the change stream of the partition which owns the key(see K23SIChangesRequest) for the changes committed
+    // after fromTimestamp. The partition waits up to changes_poll_wait for changes if it has none yet
+    seastar::future<std::tuple<Status, dto::K23SIChangesResponse>>
+    pollChanges(const String& collection, dto::Key key, dto::Timestamp fromTimestamp, uint32_t maxChanges=1000);
+
+    // Streams the changes of the partition which owns the key, from after fromTimestamp on. Each poll response is
+    // passed to the consumer, and the next poll is only made once the future the consumer returns resolves, which
+    // paces the stream to the consumer. The stream ends with OK once the consumer returns false, or with the status
+    // of the first failed poll. AbortRequestTooOld means the partition no longer has the changes after the timestamp
+    // of the stream, and the subscriber has to read a snapshot and start a new stream from the snapshot timestamp.
+    // RefreshCollection after a split or move of the partition means the same
+    seastar::future<Status> streamChanges(const String& collection, dto::Key key, dto::Timestamp fromTimestamp,
+                                          std::function<seastar::future<bool>(dto::K23SIChangesResponse&&)> consumer);
+
+    // Runs the named transaction routine with the given parameters on the node which owns the key(see
+    // TxnRoutineService), in a single round trip. The routine retries its transaction on the node for up to the
+    // timeout, but like any partition request the call itself times out after partition_request_timeout. Returns the
+    // status of the end of the transaction, whether it committed and the result of the routine
+    seastar::future<std::tuple<Status, dto::K23SIRunRoutineResponse>>
+    runRoutine(const String& collection, dto::Key key, String routine, Payload params, Duration timeout=1s);
+
+    // Runs a transaction and retries it while it aborts because of a conflict or because it became too old.
+    // func(K2TxnHandle&) performs the operations of the transaction and returns a future<bool> which tells whether
+    // to commit; runTxn ends the transaction. Each retry begins a new transaction after a jittered exponential
+    // backoff, one priority level higher than the previous attempt so that a transaction which keeps losing PUSH
+    // conflicts eventually wins them. Retries stop at the deadline of the options or after txn_retry_limit
+    // attempts. Returns the result of the last end(). If func fails, the transaction is aborted and the exception
+    // is returned without retrying
+    template <typename Func>
+    seastar::future<EndResult> runTxn(K2TxnOptions options, Func&& func);
     static constexpr int64_t ANY_VERSION = -1;
     seastar::future<GetSchemaResult> getSchema(const String& collectionName, const String& schemaName, int64_t schemaVersion);
+    // The given version of the schema if it is in the schema cache, nullptr if not. Lets the callers which
+    // have a schema version from a response skip the future of getSchema when the schema is already here
+    std::shared_ptr<dto::Schema> getCachedSchema(const String& collectionName, const String& schemaName, uint32_t schemaVersion) const;
     seastar::future<CreateSchemaResult> createSchema(const String& collectionName, dto::Schema schema);
     seastar::future<CreateQueryResult> createQuery(const String& collectionName, const String& schemaName);
 
+    // Heartbeats a transaction. Heartbeats of transactions with their TRHs in the same partition are collected for
+    // heartbeat_batch_window and then sent together in one K23SI_TXN_HEARTBEAT_MULTI. Returns the status of the
+    // heartbeat of this transaction
+    seastar::future<Status> heartbeat(dto::K23SITxnHeartbeatRequest&& request, Duration timeout);
+
     ConfigVar<std::vector<String>> _tcpRemotes{"tcp_remotes"};
     ConfigVar<String> _cpo{"cpo"};
     ConfigDuration create_collection_deadline{"create_collection_deadline", 1s};
     ConfigDuration retention_window{"retention_window", 600s};
     ConfigDuration txn_end_deadline{"txn_end_deadline", 60s};
+    ConfigDuration bulk_ingest_deadline{"bulk_ingest_deadline", 60s};
+    ConfigDuration range_delete_deadline{"range_delete_deadline", 60s};
+    // how long a change poll waits for changes on the partition. Capped to half of partition_request_timeout so that
+    // the poll doesn't time out
+    ConfigDuration changes_poll_wait{"changes_poll_wait", 50ms};
+    ConfigDuration changes_poll_deadline{"changes_poll_deadline", 10s};
+    // have the CPO push partition map changes of the collections we use, instead of refreshing them on RefreshCollection
+    ConfigVar<bool> subscribe_collection_changes{"subscribe_collection_changes", true};
+    // max number of attempts of a transaction run with runTxn
+    ConfigVar<uint32_t> txn_retry_limit{"txn_retry_limit", 10};
+    // the backoff before the first retry of runTxn. It doubles with every further retry up to txn_retry_max_backoff
+    ConfigDuration txn_retry_backoff{"txn_retry_backoff", 1ms};
+    ConfigDuration txn_retry_max_backoff{"txn_retry_max_backoff", 100ms};
+    // how long a schema which the CPO did not have is reported as not found without asking the CPO again
+    ConfigDuration schema_negative_cache_ttl{"schema_negative_cache_ttl", 1s};
+    // collections whose schemas are fetched from the CPO on start, so that the first transactions don't have to
+    ConfigVar<std::vector<String>> schema_prefetch_collections{"schema_prefetch_collections"};
+    // open the connections to all partitions of the collections we use as soon as we get their partition maps, and
+    // on start for the schema_prefetch_collections, so that the first requests after a start or a failover don't
+    // wait for connections
+    ConfigVar<bool> warmup_connections{"warmup_connections", false};
+    // how long heartbeats wait for the heartbeats of other transactions with their TRHs in the same partition, to be
+    // sent with them in one request. 0 sends each heartbeat on its own
+    ConfigDuration heartbeat_batch_window{"heartbeat_batch_window", 1ms};
 
     uint64_t read_ops{0};
     uint64_t write_ops{0};
     uint64_t query_ops{0};
     uint64_t total_txns{0};
+    uint64_t local_timestamp_txns{0};
     uint64_t successful_txns{0};
     uint64_t abort_conflicts{0};
     uint64_t abort_too_old{0};
     uint64_t heartbeats{0};
+    uint64_t heartbeat_batches{0};
+    uint64_t deferred_write_flushes{0};
+    uint64_t txn_retries{0};
+    uint64_t txn_retries_exhausted{0};
+    uint64_t schema_cache_misses{0};
+    uint64_t schema_negative_hits{0};
 
     CPOClient cpo_client;
     // collection name -> (schema name -> (schema version -> schemaPtr))
     std::unordered_map<String, std::unordered_map<String, std::unordered_map<uint32_t, std::shared_ptr<dto::Schema>>>> schemas;
 
+    // Returns the schemas of the secondary indexes of the given schema, in the order of its secondaryIndexes.
+    // They are made with dto::Schema::makeIndexSchema, the same as the CPO does when it creates the schema
+    const std::vector<std::shared_ptr<dto::Schema>>& getIndexSchemas(const String& collectionName, const dto::Schema& schema);
+    // prepared query id -> the partitions which have registered it(see Query::setPrepared)
+    std::unordered_map<uint64_t, std::vector<dto::Partition::PVID>> prepared_queries;
+    // collection name -> (schema name -> (schema version -> index schemaPtrs))
+    std::unordered_map<String, std::unordered_map<String, std::unordered_map<uint32_t, std::vector<std::shared_ptr<dto::Schema>>>>> indexSchemas;
+
 private:
+    // the jittered backoff before the given retry of runTxn
+    Duration retryBackoff(uint32_t retry);
+    // the priority of the next attempt of a transaction which was aborted at the given priority
+    static dto::TxnPriority escalatePriority(dto::TxnPriority priority);
+
     seastar::future<Status> refreshSchemaCache(const String& collectionName);
     seastar::future<std::tuple<Status, std::shared_ptr<dto::Schema>>> getSchemaInternal(const String& collectionName, const String& schemaName, int64_t schemaVersion, bool doCPORefresh = true);
+    // true if the CPO did not have the given schema within the last schema_negative_cache_ttl
+    bool isKnownMissingSchema(const String& collectionName, const String& schemaName, int64_t schemaVersion);
+
+    // collection name -> ((schema name, schema version) -> time until which the schema is known to be missing)
+    std::unordered_map<String, std::map<std::tuple<String, int64_t>, TimePoint>> _schemaMisses;
+
+    // the heartbeats waiting to be sent to one TRH partition
+    struct HeartbeatBatch {
+        dto::K23SITxnHeartbeatMultiRequest request;
+        std::vector<seastar::promise<Status>> waiters;
+        Duration timeout{0};
+    };
+    // (collection name, pvid id of the TRH partition) -> the heartbeats to send there
+    std::map<std::tuple<String, uint64_t>, HeartbeatBatch> _heartbeatBatches;
+    seastar::timer<> _heartbeatFlushTimer;
+    // sends all collected heartbeats, one request per TRH partition
+    void flushHeartbeats();
+    // sends a single heartbeat on its own
+    seastar::future<Status> sendHeartbeat(dto::K23SITxnHeartbeatRequest&& request, Duration timeout);
 
     sm::metric_groups _metric_groups;
     std::mt19937 _gen;
     std::uniform_int_distribution<uint64_t> _rnd;
     std::vector<String> _k2endpoints;
+    K23SIClientConfig _clientConfig;
 };
 
 
@@ -195,18 +377,344 @@ private:
     std::unique_ptr<dto::K23SIWriteRequest> makePartialUpdateRequest(dto::SKVRecord& record,
             std::vector<uint32_t> fieldsForPartialUpdate, dto::Key&& key);
 
+    // sends a write, with the given condition if it isn't null and the given TTL. See write, writeIf and writeWithTTL
+    template <class T>
+    seastar::future<WriteResult> sendWrite(T& record, bool erase, bool rejectIfExists,
+                                           dto::expression::Expression* condition, Duration ttl=Duration(0)) {
+        if (!_valid) {
+            return seastar::make_exception_future<WriteResult>(K23SIClientException("Invalid use of K2TxnHandle"));
+        }
+        if (_options.readOnly) {
+            return seastar::make_exception_future<WriteResult>(K23SIClientException("Write in a read-only transaction"));
+        }
+        if (_failed) {
+            return seastar::make_ready_future<WriteResult>(WriteResult(_failed_status, dto::K23SIWriteResponse()));
+        }
+        if (_pending_timestamp) {
+            return awaitTimestamp(record.collectionName, dto::Key{}).then([this, &record, erase, rejectIfExists, condition, ttl] {
+                return sendWrite(record, erase, rejectIfExists, condition, ttl);
+            });
+        }
+        if (condition && !_deferred_writes.empty()) {
+            // the condition is evaluated against the stored record, so the buffered writes have to be there first
+            return flushDeferredWrites().then([this, &record, erase, condition] {
+                return sendWrite(record, erase, false, condition);
+            });
+        }
+
+        // deferred writes don't carry a TTL
+        if (_options.deferWrites && !condition && ttl == Duration(0)) {
+            if constexpr (std::is_same<T, dto::SKVRecord>()) {
+                return deferWrite(record, erase, rejectIfExists);
+            } else {
+                SKVRecord skv_record(record.collectionName, record.schema);
+                record.__writeFields(skv_record);
+                return deferWrite(skv_record, erase, rejectIfExists);
+            }
+        }
+
+        std::unique_ptr<dto::K23SIWriteRequest> request = nullptr;
+        // erased records leave their index records behind. See dto::SecondaryIndex
+        std::vector<dto::SKVRecord> indexRecords;
+        if constexpr (std::is_same<T, dto::SKVRecord>()) {
+            request = makeWriteRequest(record, erase, rejectIfExists);
+            if (!erase) {
+                indexRecords = makeIndexRecords(record);
+            }
+        } else {
+            SKVRecord skv_record(record.collectionName, record.schema);
+            record.__writeFields(skv_record);
+            request = makeWriteRequest(skv_record, erase, rejectIfExists);
+            if (!erase) {
+                indexRecords = makeIndexRecords(skv_record);
+            }
+        }
+
+        if (condition) {
+            request->condition = std::move(*condition);
+        }
+        request->ttl = ttl;
+
+        _client->write_ops++;
+        _ongoing_ops++;
+
+        tracing::Scope trace(_trace);
+        return _cpo_client->PartitionRequest
+            <dto::K23SIWriteRequest, dto::K23SIWriteResponse, dto::Verbs::K23SI_WRITE>
+            (_options.deadline, *request).
+            then([this, indexRecords=std::move(indexRecords), schema=record.schema, value=request->value.share(), request=std::move(request)] (auto&& response) mutable {
+                auto& [status, k2response] = response;
+                checkResponseStatus(status);
+                _ongoing_ops--;
+
+                if (status.is2xxOK()) {
+                    startHeartbeat();
+                    // the transaction now reads the record as written
+                    dto::SKVRecord written(request->collectionName, schema, std::move(value), true);
+                    cacheRecord(request->collectionName, request->key,
+                                request->isDelete ? dto::K23SIStatus::KeyNotFound("") : dto::K23SIStatus::OK(""), &written);
+                } else {
+                    invalidateCachedRecord(request->collectionName, request->key);
+                }
+
+                WriteResult result(std::move(status), std::move(k2response));
+                if (result.status.is2xxOK() && !indexRecords.empty()) {
+                    return writeIndexRecords(std::move(result), std::move(indexRecords));
+                }
+                return seastar::make_ready_future<WriteResult>(std::move(result));
+            });
+    }
+
+    // Checks that the field operations are on fields of the schema which aren't key or secondary index fields,
+    // and adds their fields to fieldsForPartialUpdate
+    static bool checkFieldOps(const dto::Schema& schema, const std::vector<dto::K23SIFieldOp>& fieldOps,
+                              std::vector<uint32_t>& fieldsForPartialUpdate);
+
+    // sends a partial update, with the given field operations. See partialUpdate and updateFields
+    template <typename T1>
+    seastar::future<WriteResult> sendPartialUpdate(T1& record, std::vector<uint32_t> fieldsForPartialUpdate,
+                                                   std::vector<dto::K23SIFieldOp> fieldOps,
+                                                   dto::SKVRecord::Storage expected, dto::Key key=dto::Key()) {
+        if (!_valid) {
+            return seastar::make_exception_future<WriteResult>(K23SIClientException("Invalid use of K2TxnHandle"));
+        }
+        if (_options.readOnly) {
+            return seastar::make_exception_future<WriteResult>(K23SIClientException("Write in a read-only transaction"));
+        }
+        if (_failed) {
+            return seastar::make_ready_future<WriteResult>(WriteResult(_failed_status, dto::K23SIWriteResponse()));
+        }
+        if (!checkIndexedFields(*record.schema, fieldsForPartialUpdate)) {
+            return seastar::make_ready_future<WriteResult>(WriteResult(
+                dto::K23SIStatus::BadParameter("partial update of some of the fields of a secondary index"), dto::K23SIWriteResponse()));
+        }
+        if (_pending_timestamp) {
+            return awaitTimestamp(record.collectionName, key)
+            .then([this, &record, fields=std::move(fieldsForPartialUpdate), fieldOps=std::move(fieldOps),
+                   expected=std::move(expected), key=std::move(key)] () mutable {
+                return sendPartialUpdate(record, std::move(fields), std::move(fieldOps), std::move(expected), std::move(key));
+            });
+        }
+        if (!_deferred_writes.empty()) {
+            // the update is applied to the stored record, so the buffered writes have to be there first
+            dto::SKVRecord owned;
+            if constexpr (std::is_same<T1, dto::SKVRecord>()) {
+                owned = record.deepCopy();
+            } else {
+                owned = SKVRecord(record.collectionName, record.schema);
+                record.__writeFields(owned);
+            }
+            return flushDeferredWrites()
+            .then([this, owned=std::move(owned), fields=std::move(fieldsForPartialUpdate), fieldOps=std::move(fieldOps),
+                   expected=std::move(expected), key=std::move(key)] () mutable {
+                return seastar::do_with(std::move(owned), [this, fields=std::move(fields), fieldOps=std::move(fieldOps),
+                                        expected=std::move(expected), key=std::move(key)] (auto& owned) mutable {
+                    return sendPartialUpdate(owned, std::move(fields), std::move(fieldOps), std::move(expected), std::move(key));
+                });
+            });
+        }
+        _client->write_ops++;
+        _ongoing_ops++;
+
+        std::unique_ptr<dto::K23SIWriteRequest> request = nullptr;
+        // all fields of the updated indexes are in the update, see checkIndexedFields
+        std::vector<dto::SKVRecord> indexRecords;
+        if constexpr (std::is_same<T1, dto::SKVRecord>()) {
+            if (key.partitionKey == "") {
+                key = record.getKey();
+            }
+
+            indexRecords = makeIndexRecords(record, &fieldsForPartialUpdate);
+            request = makePartialUpdateRequest(record, fieldsForPartialUpdate, std::move(key));
+        } else {
+            SKVRecord skv_record(record.collectionName, record.schema);
+            record.__writeFields(skv_record);
+            if (key.partitionKey == "") {
+                key = skv_record.getKey();
+            }
+
+            indexRecords = makeIndexRecords(skv_record, &fieldsForPartialUpdate);
+            request = makePartialUpdateRequest(skv_record, fieldsForPartialUpdate, std::move(key));
+        }
+        if (request == nullptr) {
+            return seastar::make_ready_future<WriteResult> (
+                    WriteResult(dto::K23SIStatus::BadParameter("error makePartialUpdateRequest()"), dto::K23SIWriteResponse()) );
+        }
+        request->fieldOps = std::move(fieldOps);
+        request->expected = std::move(expected);
+        // the cached record doesn't have the fields which aren't updated
+        invalidateCachedRecord(request->collectionName, request->key);
+
+        tracing::Scope trace(_trace);
+        return _cpo_client->PartitionRequest
+            <dto::K23SIWriteRequest, dto::K23SIWriteResponse, dto::Verbs::K23SI_WRITE>
+            (_options.deadline, *request).
+            then([this, schema=record.schema, indexRecords=std::move(indexRecords), request=std::move(request)] (auto&& response) mutable {
+                auto& [status, k2response] = response;
+                checkResponseStatus(status);
+                _ongoing_ops--;
+
+                if (status.is2xxOK()) {
+                    startHeartbeat();
+                    if (!request->fieldOps.empty()) {
+                        // the response has the whole record as written
+                        dto::SKVRecord written(request->collectionName, schema, k2response.value.share(), true);
+                        cacheRecord(request->collectionName, request->key, dto::K23SIStatus::OK(""), &written);
+                    }
+                }
+
+                WriteResult result(std::move(status), std::move(k2response));
+                if (result.status.is2xxOK() && !indexRecords.empty()) {
+                    return writeIndexRecords(std::move(result), std::move(indexRecords));
+                }
+                return seastar::make_ready_future<WriteResult>(std::move(result));
+            });
+    }
+
+    // Looks up the indexes of the named fields in the schema. Returns false if one of them isn't in the schema
+    static bool resolveFieldNames(const dto::Schema& schema, const std::vector<k2::String>& fieldsName,
+                                  std::vector<uint32_t>& fieldsForPartialUpdate);
+
+    // Checks that a partial update which updates a field of a secondary index updates all of its non-key fields,
+    // since the index record is made from the values in the update
+    static bool checkIndexedFields(const dto::Schema& schema, const std::vector<uint32_t>& fieldsForPartialUpdate);
+
     void prepareQueryRequest(Query& query);
 
+    // Sends the request for the next page of a query. A prepared query is sent with its filter and projection
+    // to partitions which aren't known to have them, or which turn out to have dropped them
+    seastar::future<std::tuple<Status, dto::K23SIQueryResponse>> sendQueryRequest(Query& query);
+    seastar::future<std::tuple<Status, dto::K23SIQueryResponse>> sendPreparingQueryRequest(Query& query);
+
+    // Fetches the next page of a streaming query from the server's stream, or with a plain query request
+    // if the server has dropped the stream
+    seastar::future<std::tuple<Status, dto::K23SIQueryResponse>> queryStreamPage(Query& query);
+
+    // Gets one set of results of a parallel query: fetches a page for each partition scan in the fanout window
+    // which doesn't have one, and returns the pages which can be returned in the query's order
+    seastar::future<QueryResult> parallelQuery(Query& query);
+
+    // Gets one set of results of a query with readahead, from the pages fetched ahead or by waiting for the
+    // one being fetched
+    seastar::future<QueryResult> readaheadQuery(Query& query);
+
+    // Starts fetching the next page of a query with readahead, unless one is being fetched or the window is full
+    void fillReadahead(const std::shared_ptr<QueryReadahead>& state, uint32_t window);
+
+    // Splits the query range of a parallel query into one partition scan for each partition in it
+    void planPartitionScans(Query& query);
+
+    // Takes the pages of the partition scans which can be returned to the user
+    QueryResult collectPartitionPages(Query& query);
+
+    // Starts the heartbeat timer for this transaction, if it isn't running yet. Called after a successful write
+    void startHeartbeat();
+
+    // Sends writes of the same collection with one batch per partition. With needTRH, the first write designates
+    // the TRH and its batch is sent before the others
+    seastar::future<std::vector<WriteResult>> sendWrites(std::vector<std::unique_ptr<dto::K23SIWriteRequest>>&& writes,
+                                                         bool needTRH);
+
+    // Sends one batch of writes of a writeMany() call and fills in the results for the writes in the batch
+    seastar::future<> writeMultiGroup(dto::K23SIWriteMultiRequest& request, const std::vector<size_t>& indexes,
+                                      std::vector<WriteResult>& results);
+
+    // Groups the write set by partition for the End request. Returns an empty vector if we can't place a key in the
+    // current partition map, in which case the keys are sent ungrouped
+    std::vector<dto::K23SIWriteKeyGroup> groupWriteSet();
+
+    // Finalizes the write intents of an ended transaction from the client, with one batch per partition group
+    seastar::future<> finalizeWriteKeys(dto::K23SITxnEndRequest& endRequest);
+
+    // Waits until the pipelined writes of the transaction are durable in all partitions it wrote to. Marks the
+    // transaction as failed if any of them could not be persisted
+    seastar::future<> awaitDurableWrites(dto::K23SITxnEndRequest& endRequest);
+
+    // Makes the records of the secondary indexes of the given record. For a partial update, only the indexes with
+    // one of the updated fields are written
+    std::vector<dto::SKVRecord> makeIndexRecords(dto::SKVRecord& record,
+                                                 const std::vector<uint32_t>* fieldsForPartialUpdate=nullptr);
+
+    // Writes the records of the secondary indexes of a record after the record itself was written. Returns the
+    // result of the record's write, or the first failed index write
+    seastar::future<WriteResult> writeIndexRecords(WriteResult&& result, std::vector<dto::SKVRecord>&& indexRecords);
+
+    // A write buffered by a transaction with deferWrites
+    struct DeferredWrite {
+        dto::SKVRecord record;
+        bool erase = false;
+        bool rejectIfExists = false;
+    };
+
+    // throws K23SIClientException if a key field of the record isn't set
+    static void checkWriteKeyFields(dto::SKVRecord& record);
+
+    // Buffers the write of a record and of its secondary index records
+    seastar::future<WriteResult> deferWrite(dto::SKVRecord& record, bool erase, bool rejectIfExists);
+
+    // Adds a write to the buffer, replacing an earlier buffered write of the same key
+    Status bufferWrite(dto::SKVRecord& record, bool erase, bool rejectIfExists);
+
+    // the buffered write of the key, or nullptr
+    DeferredWrite* findDeferredWrite(const String& collection, const dto::Key& key);
+
+    // The result of reading a key without going to the server: from its buffered write, or from the record cache
+    std::optional<ReadResult<dto::SKVRecord>> readLocally(const String& collection, const dto::Key& key);
+
+    // A record read or written by the transaction, for cacheRecords. The key had no record if !exists
+    struct CachedRecord {
+        bool exists = false;
+        dto::SKVRecord record;
+    };
+
+    // Caches the result of reading or writing the key. Results other than OK and KeyNotFound drop the key
+    void cacheRecord(const String& collection, const dto::Key& key, const Status& status, dto::SKVRecord* record);
+    void invalidateCachedRecord(const String& collection, const dto::Key& key);
+
+    // Fails the transaction with the status of a write whose result the user doesn't see
+    void failOnWriteError(const Status& status);
+
+    // Sends the buffered writes. A write which fails marks the transaction as failed
+    seastar::future<> flushDeferredWrites();
+    seastar::future<> flushDeferredWritesIfFull();
+
+    // Ends the transaction once there are no buffered writes
+    seastar::future<EndResult> sendEnd(bool shouldCommit);
+
+    // With eagerBegin, waits for the timestamp of the transaction and sets it in the MTR. The collection and the
+    // schema of the key are fetched meanwhile if we don't have them yet
+    seastar::future<> awaitTimestamp(const String& collection, const dto::Key& key);
+
+    // Converts the read response of the given key into a ReadResult, resolving the schema of the returned record,
+    // and caches the result unless it is a projection. Returns a ready future unless the schema has to be fetched
+    seastar::future<ReadResult<dto::SKVRecord>> makeReadResult(Status&& status, dto::SKVRecord::Storage&& storage,
+                                                               const String& collName, const dto::Key& key,
+                                                               const std::vector<String>& projection={});
+
 public:
     K2TxnHandle() = default;
     K2TxnHandle(K2TxnHandle&& o) noexcept = default;
     K2TxnHandle& operator=(K2TxnHandle&& o) noexcept = default;
-    K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint start_time) noexcept;
+    // The requests of the transaction are traced under the given context when it is sampled
+    K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint start_time,
+                tracing::TraceContext trace) noexcept;
+    // A handle whose MTR gets its timestamp once pendingTimestamp resolves. See K2TxnOptions::eagerBegin
+    K2TxnHandle(dto::K23SI_MTR&& mtr, K2TxnOptions options, CPOClient* cpo, K23SIClient* client, Duration d, TimePoint start_time,
+                tracing::TraceContext trace, seastar::shared_future<dto::Timestamp> pendingTimestamp) noexcept;
 
     // The dto::Key oriented interface for read. The key should be one obtained from SKVRecord::getKey()
     // and not directly created by the user
     seastar::future<ReadResult<dto::SKVRecord>> read(dto::Key key, String collection);
 
+    // Reads only the given fields of the key, by name, like a query projection. The fields which are not
+    // projected are null in the result, unless the read is served from the transaction's own records, which have
+    // all of the fields. An empty projection reads all fields
+    seastar::future<ReadResult<dto::SKVRecord>> read(dto::Key key, String collection, std::vector<String> projection);
+
+    // Batched read interface. The keys are grouped by partition and each group is read with a single request.
+    // The results are returned in the same order as the given keys
+    seastar::future<std::vector<ReadResult<dto::SKVRecord>>> readMany(std::vector<dto::Key> keys, String collection);
+
     // The read interface for user-defined classes with the SKV_RECORD_FIELDS macro defined
     // The class instance is automatically serialized and deserialized from an SKVRecord
     // Note that there is an explicit template instantiation of this function for the normal SKVRecord
@@ -219,16 +727,30 @@ public:
         if (_failed) {
             return seastar::make_ready_future<ReadResult<T>>(ReadResult<T>(_failed_status, T()));
         }
+        if (_pending_timestamp) {
+            return awaitTimestamp(record.collectionName, dto::Key{}).then([this, record=std::move(record)] () mutable {
+                return read(std::move(record));
+            });
+        }
 
         std::unique_ptr<dto::K23SIReadRequest> request = makeReadRequest(record);
+        if (auto local = readLocally(request->collectionName, request->key)) {
+            _client->read_ops++;
+            T userResponseRecord{};
+            if (local->status.is2xxOK()) {
+                userResponseRecord.__readFields(local->value);
+            }
+            return seastar::make_ready_future<ReadResult<T>>(ReadResult<T>(std::move(local->status), std::move(userResponseRecord)));
+        }
 
         _client->read_ops++;
         _ongoing_ops++;
 
+        tracing::Scope trace(_trace);
         return _cpo_client->PartitionRequest
             <dto::K23SIReadRequest, dto::K23SIReadResponse, dto::Verbs::K23SI_READ>
             (_options.deadline, *request).
-            then([this, request_schema=record.schema, &collName=request->collectionName] (auto&& response) {
+            then([this, request_schema=record.schema, request=std::move(request)] (auto&& response) {
                 auto& [status, k2response] = response;
                 checkResponseStatus(status);
                 _ongoing_ops--;
@@ -236,128 +758,123 @@ public:
                 T userResponseRecord{};
 
                 if (status.is2xxOK()) {
-                    SKVRecord skv_record(collName, request_schema, std::move(k2response.value), true);
+                    SKVRecord skv_record(request->collectionName, request_schema, std::move(k2response.value), true);
+                    cacheRecord(request->collectionName, request->key, status, &skv_record);
                     userResponseRecord.__readFields(skv_record);
+                } else {
+                    cacheRecord(request->collectionName, request->key, status, nullptr);
                 }
 
                 return ReadResult<T>(std::move(status), std::move(userResponseRecord));
-            }).finally([r = std::move(request)] () { (void)r; });
+            });
     }
 
     template <class T>
     seastar::future<WriteResult> write(T& record, bool erase=false, bool rejectIfExists=false) {
-        if (!_valid) {
-            return seastar::make_exception_future<WriteResult>(K23SIClientException("Invalid use of K2TxnHandle"));
-        }
-        if (_failed) {
-            return seastar::make_ready_future<WriteResult>(WriteResult(_failed_status, dto::K23SIWriteResponse()));
-        }
-
-        std::unique_ptr<dto::K23SIWriteRequest> request = nullptr;
-        if constexpr (std::is_same<T, dto::SKVRecord>()) {
-            request = makeWriteRequest(record, erase, rejectIfExists);
-        } else {
-            SKVRecord skv_record(record.collectionName, record.schema);
-            record.__writeFields(skv_record);
-            request = makeWriteRequest(skv_record, erase, rejectIfExists);
-        }
+        return sendWrite(record, erase, rejectIfExists, nullptr);
+    }
 
-        _client->write_ops++;
-        _ongoing_ops++;
+    // Writes the record only if the latest version of it passes the condition, which is evaluated on the server
+    // like a query filter. Returns ConditionFailed if it doesn't, or if the record doesn't exist. As with
+    // rejectIfExists, it is up to the caller to decide whether to abort then. Sends the deferred writes first
+    template <class T>
+    seastar::future<WriteResult> writeIf(T& record, dto::expression::Expression condition, bool erase=false) {
+        return seastar::do_with(std::move(condition), [this, &record, erase] (auto& condition) {
+            return sendWrite(record, erase, false, &condition);
+        });
+    }
 
-        return _cpo_client->PartitionRequest
-            <dto::K23SIWriteRequest, dto::K23SIWriteResponse, dto::Verbs::K23SI_WRITE>
-            (_options.deadline, *request).
-            then([this] (auto&& response) {
-                auto& [status, k2response] = response;
-                checkResponseStatus(status);
-                _ongoing_ops--;
+    // Writes the record with its own TTL instead of the TTL of its schema. The record is invisible to reads at or
+    // after its timestamp plus the TTL, until it is written again
+    template <class T>
+    seastar::future<WriteResult> writeWithTTL(T& record, Duration ttl) {
+        if (ttl <= Duration(0)) {
+            return seastar::make_exception_future<WriteResult>(K23SIClientException("writeWithTTL needs a positive TTL"));
+        }
+        return sendWrite(record, false, false, nullptr, ttl);
+    }
 
-                if (status.is2xxOK() && !_heartbeat_timer.isArmed()) {
-                    K2ASSERT(log::skvclient, _cpo_client->collections.find(_trh_collection) != _cpo_client->collections.end(), "collection not present after successful write");
-                    K2LOG_D(log::skvclient, "Starting hb, mtr={}", _mtr);
-                    _heartbeat_interval = _cpo_client->collections[_trh_collection].collection.metadata.heartbeatDeadline / 2;
-                    makeHeartbeatTimer();
-                    _heartbeat_timer.armPeriodic(_heartbeat_interval);
-                }
+    // Batched write interface. All records must belong to the same collection. The records are grouped by
+    // partition and each group is written with a single request. The results are returned in the same order
+    // as the given records
+    seastar::future<std::vector<WriteResult>> writeMany(std::vector<dto::SKVRecord>& records, bool erase=false,
+                                                        bool rejectIfExists=false);
 
-                return seastar::make_ready_future<WriteResult>(WriteResult(std::move(status), std::move(k2response)));
-            }).finally([r = std::move(request)] () { (void) r; });
-    }
+    // Fire-and-forget write, e.g. for bulk loads. The returned future resolves once the write is sent, which waits
+    // while asyncWriteLimit writes are in flight, and the first write of the transaction is waited for since it
+    // creates the TRH. The record must stay valid until then. A failed write fails the transaction: end() waits
+    // for all outstanding async writes and returns the status of the first one which failed
+    seastar::future<> writeAsync(dto::SKVRecord& record, bool erase=false, bool rejectIfExists=false);
 
     template <typename T1>
     seastar::future<PartialUpdateResult> partialUpdate(T1& record, std::vector<k2::String> fieldsName,
                                                        dto::Key key=dto::Key()) {
         std::vector<uint32_t> fieldsForPartialUpdate;
-        bool find = false;
-        for (std::size_t i = 0; i < fieldsName.size(); ++i) {
-            find = false;
-            for (std::size_t j = 0; j < record.schema->fields.size(); ++j) {
-                if (fieldsName[i] == record.schema->fields[j].name) {
-                    fieldsForPartialUpdate.push_back(j);
-                    find = true;
-                    break;
-                }
-            }
-            if (find == false) return seastar::make_ready_future<PartialUpdateResult>(
+        if (!resolveFieldNames(*record.schema, fieldsName, fieldsForPartialUpdate)) {
+            return seastar::make_ready_future<PartialUpdateResult>(
                     PartialUpdateResult(dto::K23SIStatus::BadParameter("error parameter: fieldsForPartialUpdate")) );
         }
 
         return partialUpdate(record, std::move(fieldsForPartialUpdate), std::move(key));
     }
 
+    // Batched partial updates. All records must belong to the same collection; record i is updated with the fields
+    // in fieldsForPartialUpdate[i], see partialUpdate. The updates are grouped by partition and each group is sent
+    // with a single request, like writeMany. The results are returned in the same order as the given records
+    seastar::future<std::vector<PartialUpdateResult>>
+    partialUpdateMany(std::vector<dto::SKVRecord>& records, std::vector<std::vector<uint32_t>> fieldsForPartialUpdate);
+
+    // Batched partial updates of the same named fields in every record
+    seastar::future<std::vector<PartialUpdateResult>>
+    partialUpdateMany(std::vector<dto::SKVRecord>& records, const std::vector<k2::String>& fieldsName);
+
     template <typename T1>
     seastar::future<PartialUpdateResult> partialUpdate(T1& record,
                                                        std::vector<uint32_t> fieldsForPartialUpdate,
                                                        dto::Key key=dto::Key()) {
-        if (!_valid) {
-            return seastar::make_exception_future<PartialUpdateResult>(K23SIClientException("Invalid use of K2TxnHandle"));
-        }
-        if (_failed) {
-            return seastar::make_ready_future<PartialUpdateResult>(PartialUpdateResult(_failed_status));
-        }
-        _client->write_ops++;
-        _ongoing_ops++;
-
-        std::unique_ptr<dto::K23SIWriteRequest> request = nullptr;
-        if constexpr (std::is_same<T1, dto::SKVRecord>()) {
-            if (key.partitionKey == "") {
-                key = record.getKey();
-            }
-
-            request = makePartialUpdateRequest(record, fieldsForPartialUpdate, std::move(key));
-        } else {
-            SKVRecord skv_record(record.collectionName, record.schema);
-            record.__writeFields(skv_record);
-            if (key.partitionKey == "") {
-                key = skv_record.getKey();
-            }
+        return sendPartialUpdate(record, std::move(fieldsForPartialUpdate), {}, dto::SKVRecord::Storage{}, std::move(key))
+        .then([] (WriteResult&& result) {
+            return PartialUpdateResult(std::move(result.status));
+        });
+    }
 
-            request = makePartialUpdateRequest(skv_record, fieldsForPartialUpdate, std::move(key));
+    // Applies the field operations(see dto::FieldOperation) to the latest version of the record on the server, as
+    // part of a partial update of fieldsForPartialUpdate, e.g. to increment a counter without reading it first. The
+    // operands are the values of their fields in record, and the expected values of the CompareAndSet operations
+    // are the values of their fields in expected. The result has the record as written. The fields of the
+    // operations can't be key fields or fields of a secondary index
+    template <typename T1>
+    seastar::future<FieldOpsResult<T1>> updateFields(T1& record, std::vector<dto::K23SIFieldOp> fieldOps,
+                                                     std::vector<uint32_t> fieldsForPartialUpdate={},
+                                                     const T1* expected=nullptr) {
+        if (!checkFieldOps(*record.schema, fieldOps, fieldsForPartialUpdate)) {
+            return seastar::make_ready_future<FieldOpsResult<T1>>(
+                    FieldOpsResult<T1>(dto::K23SIStatus::BadParameter("error parameter: fieldOps"), T1{}));
         }
-        if (request == nullptr) {
-            return seastar::make_ready_future<PartialUpdateResult> (
-                    PartialUpdateResult(dto::K23SIStatus::BadParameter("error makePartialUpdateRequest()")) );
+        dto::SKVRecord::Storage expectedValues;
+        if (expected) {
+            if constexpr (std::is_same<T1, dto::SKVRecord>()) {
+                expectedValues = const_cast<T1*>(expected)->storage.share();
+            } else {
+                SKVRecord expectedRecord(expected->collectionName, expected->schema);
+                expected->__writeFields(expectedRecord);
+                expectedValues = std::move(expectedRecord.storage);
+            }
         }
 
-        return _cpo_client->PartitionRequest
-            <dto::K23SIWriteRequest, dto::K23SIWriteResponse, dto::Verbs::K23SI_WRITE>
-            (_options.deadline, *request).
-            then([this] (auto&& response) {
-                auto& [status, k2response] = response;
-                checkResponseStatus(status);
-                _ongoing_ops--;
-
-                if (status.is2xxOK() && !_heartbeat_timer.isArmed()) {
-                    K2ASSERT(log::skvclient, _cpo_client->collections.find(_trh_collection) != _cpo_client->collections.end(), "collection not present after successful partial update");
-                    K2LOG_D(log::skvclient, "Starting hb, mtr={}", _mtr)
-                    _heartbeat_interval = _cpo_client->collections[_trh_collection].collection.metadata.heartbeatDeadline / 2;
-                    makeHeartbeatTimer();
-                    _heartbeat_timer.armPeriodic(_heartbeat_interval);
+        return sendPartialUpdate(record, std::move(fieldsForPartialUpdate), std::move(fieldOps), std::move(expectedValues))
+        .then([collectionName=record.collectionName, schema=record.schema] (WriteResult&& result) {
+            T1 value{};
+            if (result.status.is2xxOK()) {
+                dto::SKVRecord written(collectionName, schema, std::move(result.response.value), true);
+                if constexpr (std::is_same<T1, dto::SKVRecord>()) {
+                    value = std::move(written);
+                } else {
+                    value.__readFields(written);
                 }
-
-                return seastar::make_ready_future<PartialUpdateResult>(PartialUpdateResult(std::move(status)));
-            }).finally([r = std::move(request)] () { (void) r; });
+            }
+            return FieldOpsResult<T1>(std::move(result.status), std::move(value));
+        });
     }
 
     seastar::future<WriteResult> erase(SKVRecord& record);
@@ -366,13 +883,25 @@ public:
     // object to get more results
     seastar::future<QueryResult> query(Query& query);
 
+    // Gets one set of paginated results of a schema through one of its secondary indexes. The query is created with
+    // createQuery on the schema of the index(see dto::Schema::indexSchemaName) and scans index records, whose
+    // indexed records are then read with readMany and returned in index order. Records which were erased, or whose
+    // indexed fields changed, since their index record was written are left out
+    seastar::future<QueryResult> queryIndex(Query& indexQuery);
+
     // Must be called exactly once by application code and after all ongoing read and write
     // operations are completed
     seastar::future<EndResult> end(bool shouldCommit);
 
-    // use to obtain the MTR(which acts as a unique transaction identifier) for this transaction
+    // use to obtain the MTR(which acts as a unique transaction identifier) for this transaction. With eagerBegin,
+    // the timestamp of the MTR is only set once the first operation was sent
     const dto::K23SI_MTR& mtr() const;
 
+    // Whether the transaction failed, e.g. because one of its operations or its heartbeat was aborted, and the
+    // status which failed it. A failed transaction can only be aborted
+    bool failed() const { return _failed; }
+    const Status& failedStatus() const { return _failed_status; }
+
     K2_DEF_FMT(K2TxnHandle, _mtr);
 
 private:
@@ -385,15 +914,75 @@ private:
     Status _failed_status;
     Duration _txn_end_deadline;
     TimePoint _start_time;
+    // the trace of the transaction. Each request is sent in a Scope of it
+    tracing::TraceContext _trace;
     uint64_t _ongoing_ops = 0; // Used to track if there are operations in flight when end() is called
 
     Duration _heartbeat_interval;
     PeriodicTimer _heartbeat_timer;
     std::vector<dto::Key> _write_set;
+    // (collection name, key) -> the buffered write of the key, with deferWrites
+    std::map<std::tuple<String, dto::Key>, DeferredWrite> _deferred_writes;
+    // (collection name, key) -> the record as the transaction last read or wrote it, with cacheRecords
+    std::map<std::tuple<String, dto::Key>, CachedRecord> _record_cache;
+    // the timestamp of the transaction while it is on its way, with eagerBegin
+    std::optional<seastar::shared_future<dto::Timestamp>> _pending_timestamp;
+    // limits the writeAsync() writes in flight. Made on the first of them
+    std::unique_ptr<seastar::semaphore> _async_write_slots;
+    // the readahead fetches of queries, which end() waits for. Made on the first of them
+    std::unique_ptr<seastar::gate> _readahead_gate;
     dto::Key _trh_key;
     String _trh_collection;
 };
 
+template <typename Func>
+seastar::future<EndResult> K23SIClient::runTxn(K2TxnOptions options, Func&& func) {
+    return seastar::do_with(std::move(options), std::forward<Func>(func), uint32_t(0), std::optional<EndResult>(),
+        [this] (K2TxnOptions& options, auto& func, uint32_t& attempts, std::optional<EndResult>& result) {
+        return seastar::repeat([this, &options, &func, &attempts, &result] {
+            return beginTxn(options)
+            .then([&func] (K2TxnHandle&& txn) {
+                return seastar::do_with(std::move(txn), [&func] (K2TxnHandle& txn) {
+                    return seastar::futurize_invoke(func, txn)
+                    .then_wrapped([&txn] (auto&& fut) {
+                        if (fut.failed()) {
+                            auto exc = fut.get_exception();
+                            return txn.end(false)
+                            .then_wrapped([exc=std::move(exc)] (auto&& endFut) {
+                                endFut.ignore_ready_future();
+                                return seastar::make_exception_future<EndResult>(exc);
+                            });
+                        }
+                        return txn.end(fut.get0());
+                    });
+                });
+            })
+            .then([this, &options, &attempts, &result] (EndResult&& endResult) {
+                ++attempts;
+                bool retryable = endResult.status == dto::K23SIStatus::AbortConflict ||
+                                 endResult.status == dto::K23SIStatus::AbortRequestTooOld;
+                if (!retryable || attempts >= txn_retry_limit() || options.deadline.isOver()) {
+                    if (retryable) {
+                        txn_retries_exhausted++;
+                    }
+                    result = std::move(endResult);
+                    return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                }
+                txn_retries++;
+                options.priority = escalatePriority(options.priority);
+                K2LOG_D(log::skvclient, "retrying txn after {}, attempt={}, priority={}", endResult.status, attempts, options.priority);
+                return seastar::sleep(std::min(retryBackoff(attempts), options.deadline.getRemaining()))
+                .then([] {
+                    return seastar::stop_iteration::no;
+                });
+            });
+        })
+        .then([&result] {
+            return std::move(*result);
+        });
+    });
+}
+
 // Normal use-case read interface, where the key fields of the user's SKVRecord are
 // serialized and converted into a dto::Key
 template <>
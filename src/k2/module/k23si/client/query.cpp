@@ -43,6 +43,14 @@ void Query::setLimit(int32_t limit) {
     request.recordLimit = limit;
 }
 
+void Query::setResponseBytesLimit(uint32_t bytes) {
+    request.responseBytesLimit = bytes;
+}
+
+void Query::setStreamCredits(uint32_t credits) {
+    request.streamCredits = credits;
+}
+
 void Query::addProjection(const String& fieldName) {
     request.projection.push_back(fieldName);
     checkKeysProjected();
@@ -55,6 +63,42 @@ void Query::addProjection(const std::vector<String>& fieldNames) {
     checkKeysProjected();
 }
 
+void Query::addAggregate(dto::AggregateOp op, const String& fieldName) {
+    request.aggregates.push_back(dto::Aggregate{.op = op, .fieldName = fieldName});
+    aggregators.emplace_back(request.aggregates.back());
+}
+
+void Query::setOrderBy(const String& fieldName, uint32_t limit, bool descending) {
+    request.orderBy = dto::OrderBy{.fieldName = fieldName, .descending = descending, .limit = limit};
+    ranker.emplace(request.orderBy);
+}
+
+void Query::setColumnar(bool columnar) {
+    request.columnar = columnar;
+}
+
+void Query::setParallelScan(uint32_t maxFanout, bool keyOrder) {
+    fanout = maxFanout;
+    ordered = keyOrder;
+}
+
+void Query::setReadahead(uint32_t pages) {
+    readahead = pages;
+}
+
+void Query::setPrepared(bool isPrepared) {
+    prepared = isPrepared;
+}
+
+bool Query::isPastPartition() const {
+    const String& next = request.key.partitionKey;
+    if (request.reverseDirection) {
+        // the continuation token into the previous partition is its end key, which is our start key
+        return next < partitionStart || (next == partitionStart && request.exclusiveKey);
+    }
+    return partitionEnd != "" && next >= partitionEnd;
+}
+
 void Query::checkKeysProjected() {
     keysProjected = false;
     for (uint32_t idx : schema->partitionKeyFields) {
@@ -87,11 +131,58 @@ void Query::checkKeysProjected() {
     keysProjected = true;
 }
 
+void Query::rankPage(QueryResult& page) {
+    if (!ranker || !page.status.is2xxOK()) {
+        return;
+    }
+    try {
+        for (dto::SKVRecord& record : page.records) {
+            ranker->add(record, std::move(record));
+        }
+    }
+    catch (dto::TypeMismatchException&) {
+        page.status = dto::K23SIStatus::OperationNotAllowed("TypeMismatch in query order by");
+        done = true;
+    }
+    catch (dto::DeserializationError&) {
+        page.status = dto::K23SIStatus::OperationNotAllowed("DeserializationError in query order by");
+        done = true;
+    }
+    page.records.clear();
+    if (done && page.status.is2xxOK()) {
+        page.records = ranker->take();
+    }
+}
+
 bool Query::isDone() {
     return done;
 }
 
 seastar::future<QueryResult> QueryResult::makeQueryResult(K23SIClient* client, const Query& query, Status status, dto::K23SIQueryResponse&& response) {
+    // Usually all the schemas of the page are cached, and the result is made without a future per record
+    std::vector<std::shared_ptr<dto::Schema>> cachedSchemas;
+    cachedSchemas.reserve(response.results.size());
+    for (SKVRecord::Storage& storage : response.results) {
+        auto schema = client->getCachedSchema(query.request.collectionName, query.schema->name, storage.schemaVersion);
+        if (!schema) {
+            break;
+        }
+        cachedSchemas.push_back(std::move(schema));
+    }
+    if (cachedSchemas.size() == response.results.size()) {
+        QueryResult result(std::move(status));
+        result.records.reserve(response.results.size());
+        for (size_t i = 0; i < response.results.size(); ++i) {
+            result.records.emplace_back(query.request.collectionName, std::move(cachedSchemas[i]),
+                                        std::move(response.results[i]), query.keysProjected);
+        }
+        result.columns = std::move(response.columns);
+        for (const dto::Aggregator& aggregator : query.aggregators) {
+            result.aggregates.push_back(aggregator.result());
+        }
+        return seastar::make_ready_future<QueryResult>(std::move(result));
+    }
+
     std::vector<seastar::future<>> futures;
     QueryResult* result = new QueryResult(std::move(status));
 
@@ -110,6 +201,10 @@ seastar::future<QueryResult> QueryResult::makeQueryResult(K23SIClient* client, c
         }));
     }
 
+    for (const dto::Aggregator& aggregator : query.aggregators) {
+        result->aggregates.push_back(aggregator.result());
+    }
+
     return seastar::when_all_succeed(futures.begin(), futures.end())
     .then([result] () {
         return seastar::make_ready_future<QueryResult>(std::move(*result));
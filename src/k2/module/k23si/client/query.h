@@ -23,6 +23,10 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
 #include <vector>
 
 #include <seastar/core/future.hh>
@@ -32,6 +36,9 @@ Copyright(c) 2020 Futurewei Cloud
 
 namespace k2 {
 
+class QueryResult;
+struct QueryReadahead;
+
 // Represents a new or in-progress query (aka read scan with predicate and projection)
 class Query {
 public:
@@ -39,10 +46,51 @@ public:
     void setReverseDirection(bool reverseDirection);
     void setIncludeVersionMismatch(bool includeVersionMismatch);
     void setLimit(int32_t limit);
+    // Sets the target size in bytes of each page of results. 0 uses the server's default
+    void setResponseBytesLimit(uint32_t bytes);
+    // Lets the server prepare up to the given number of pages ahead of the user, so that the following
+    // pages in the same partition are ready when query() is called for them. 0 disables streaming
+    void setStreamCredits(uint32_t credits);
 
     void addProjection(const String& fieldName);
     void addProjection(const std::vector<String>& fieldNames);
 
+    // Makes this an aggregate query: instead of the records which pass the filter, each page only has the
+    // results of the aggregates (in the order they were added) over all the records the query has seen so far.
+    // The aggregates are computed by the partitions and the partial results are merged by the client.
+    // Throws InvalidExpressionException for SUM, MIN or MAX without a field name
+    void addAggregate(dto::AggregateOp op, const String& fieldName="");
+
+    // Makes this a top-K query: only the first limit records which pass the filter, in the order of the given
+    // field, are returned. They are all in the last page of the query, in that order, and the pages before it
+    // have no records. Each partition ranks the records it scans and the client merges them, so that only up to
+    // limit records per page are transferred. The record limit applies to the number of records ranked.
+    // Throws InvalidExpressionException without a field name or a limit. Aggregate queries cannot be ordered
+    void setOrderBy(const String& fieldName, uint32_t limit, bool descending=false);
+
+    // Returns the records of each page as columns(see dto::ColumnBatch) in QueryResult::columns instead of
+    // as records. The columns are the projected fields, or all the fields of the schema without a projection.
+    // Aggregate queries are not columnar
+    void setColumnar(bool columnar);
+
+    // Scans the partitions of the query range concurrently, querying up to maxFanout partitions at a time,
+    // instead of one after the other. If keyOrder, the records are returned in key order. Otherwise each page
+    // has whatever records the partitions returned and pages are larger. The record limit is still applied
+    // to the records returned, but for aggregate queries it is only applied by each partition.
+    // A maxFanout of 0 is a sequential scan
+    void setParallelScan(uint32_t maxFanout, bool keyOrder=true);
+
+    // Fetches up to the given number of pages ahead of the user: the next page is requested as soon as the
+    // previous one arrives, so that query() can return pages which are already here while the user processes
+    // the last one. Works with parallel scans, where each page fetched ahead is a page of the parallel query.
+    // The transaction's end() waits for the pages still being fetched. 0 disables readahead
+    void setReadahead(uint32_t pages);
+
+    // Makes this a prepared query: each partition gets the filter and projection once, and after that the queries
+    // with the same projection and filter shape(the same filter, but possibly with other literals) only send the
+    // literals of the filter. Useful for queries which are run often with different literals
+    void setPrepared(bool prepared);
+
     bool isDone(); // If false, more results may be available
 
     // Recursively copies the payloads if the expression's values and children. This is used so that the
@@ -59,16 +107,51 @@ public:
     // {ID = 1, NAME = J} is valid.
     dto::SKVRecord startScanRecord;
     dto::SKVRecord endScanRecord;
-    K2_DEF_FMT(Query, startScanRecord, endScanRecord, done, inprogress, keysProjected, request);
+    K2_DEF_FMT(Query, startScanRecord, endScanRecord, done, inprogress, keysProjected, request, streamId);
 
 private:
     void checkKeysProjected();
+    // For ordered queries, ranks the records of the page with those of the pages before it. The page has the
+    // ranked records once the query is done, and no records before that
+    void rankPage(QueryResult& page);
+    // For a partition scan of a parallel query, returns true if the next key to scan is outside the partition
+    bool isPastPartition() const;
 
     std::shared_ptr<dto::Schema> schema = nullptr;
     bool done = false;
     bool inprogress = false; // Used to prevent user from changing predicates after query has started
     bool keysProjected = true;
     dto::K23SIQueryRequest request;
+    // the server's stream for the rest of the current partition, 0 if there is none
+    uint64_t streamId = 0;
+    dto::K23SIQueryNextRequest nextRequest;
+    // merge the partial aggregates from each response
+    std::vector<dto::Aggregator> aggregators;
+    // for ordered queries, merges the ranked records from each response
+    std::optional<dto::RecordRanker<dto::SKVRecord>> ranker;
+
+    // Parallel scans: the user's query has a sub-query for each partition in the query range, in scan order.
+    // Pages of the sub-queries are fetched, fanout at a time, and kept until they are returned to the user
+    uint32_t fanout = 0;
+    bool ordered = true;
+    std::vector<Query> partitionScans;
+    size_t scanHead = 0; // the partition scans before this one are done and all of their pages returned
+    // for a partition scan, the range of the partition it is limited to, and its page which is not returned yet
+    bool partitionScan = false;
+    String partitionStart;
+    String partitionEnd;
+    std::vector<QueryResult> pages;
+
+    // Readahead: the pages are fetched by a copy of the query which is shared with its fetches in flight,
+    // so that they can finish even if the user drops the query
+    uint32_t readahead = 0;
+    std::shared_ptr<QueryReadahead> ahead;
+
+    // Prepared queries: once the query has started, the request has the literals of the filter as its parameters
+    // instead of the filter and projection, which are kept here and only sent to the partitions which don't have them
+    bool prepared = false;
+    dto::expression::Expression preparedFilter;
+    std::vector<String> preparedProjection;
 
     friend class K2TxnHandle;
     friend class K23SIClient;
@@ -84,7 +167,20 @@ public:
 
     Status status;
     std::vector<dto::SKVRecord> records;
-    K2_DEF_FMT(QueryResult, status);
+    // for aggregate queries, the results of the aggregates so far. They are final once the query is done
+    std::vector<dto::expression::Value> aggregates;
+    // for columnar queries, the records of this page
+    dto::ColumnBatch columns;
+    K2_DEF_FMT(QueryResult, status, aggregates, columns);
+};
+
+// The state of the readahead of a query
+struct QueryReadahead {
+    Query query; // the query which fetches the pages
+    std::deque<QueryResult> pages; // fetched and not returned yet, in order
+    bool fetching = false; // a page is being fetched
+    std::exception_ptr error; // the failure of the last fetch
+    std::optional<seastar::promise<>> waiter; // set when the user waits for the page being fetched
 };
 
 } // namespace k2
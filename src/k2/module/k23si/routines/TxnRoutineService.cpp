@@ -0,0 +1,136 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "TxnRoutineService.h"
+
+#include <k2/collectionMetadataCache/CollectionMetadataCache.h>
+#include <k2/dto/MessageVerbs.h>
+#include <k2/transport/RPCDispatcher.h>
+
+namespace k2 {
+
+std::unordered_map<String, TxnRoutine>& TxnRoutines::_routines() {
+    static std::unordered_map<String, TxnRoutine> routines;
+    return routines;
+}
+
+void TxnRoutines::add(String name, TxnRoutine routine) {
+    _routines()[std::move(name)] = std::move(routine);
+}
+
+const TxnRoutine* TxnRoutines::find(const String& name) {
+    auto it = _routines().find(name);
+    return it == _routines().end() ? nullptr : &it->second;
+}
+
+static K23SIClientConfig _makeClientConfig(const String& cpoEndpoint) {
+    K23SIClientConfig config;
+    config.cpoEndpoint = cpoEndpoint;
+    // the collection metadata cache of the node receives the changes, and our client is attached to it
+    config.subscribeCollectionChanges = false;
+    return config;
+}
+
+TxnRoutineService::TxnRoutineService() : _client(_makeClientConfig(_cpoEndpoint())) {
+    K2LOG_I(log::routines, "ctor");
+}
+
+TxnRoutineService::~TxnRoutineService() {
+    K2LOG_I(log::routines, "dtor");
+}
+
+seastar::future<> TxnRoutineService::gracefulStop() {
+    K2LOG_I(log::routines, "stop");
+    RPC().registerMessageObserver(dto::Verbs::K23SI_RUN_ROUTINE, nullptr);
+    return _gate.close().then([this] {
+        return _client.gracefulStop();
+    });
+}
+
+seastar::future<> TxnRoutineService::start() {
+    _metricGroups.add_group("txn_routines", {
+        sm::make_counter("run", _routinesRun, sm::description("Transaction routines run on this core")),
+        sm::make_counter("committed", _routinesCommitted, sm::description("Transaction routines which committed their transaction")),
+        sm::make_counter("failed", _routinesFailed, sm::description("Transaction routines which failed or whose transaction could not be committed")),
+    });
+
+    return _client.start()
+    .then([this] {
+        AppBase().getLocal<CollectionMetadataCache>().attach(_client.cpo_client);
+        RPC().registerRPCObserver<dto::K23SIRunRoutineRequest, dto::K23SIRunRoutineResponse>
+        (dto::Verbs::K23SI_RUN_ROUTINE, [this] (dto::K23SIRunRoutineRequest&& request) {
+            if (_gate.is_closed()) {
+                return RPCResponse(Statuses::S503_Service_Unavailable("shutting down"), dto::K23SIRunRoutineResponse{});
+            }
+            return seastar::with_gate(_gate, [this, request=std::move(request)] () mutable {
+                return _handleRunRoutine(std::move(request));
+            });
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIRunRoutineResponse>>
+TxnRoutineService::_handleRunRoutine(dto::K23SIRunRoutineRequest&& request) {
+    K2LOG_D(log::routines, "run routine {}", request);
+    const TxnRoutine* routine = TxnRoutines::find(request.routine);
+    if (routine == nullptr) {
+        return RPCResponse(Statuses::S404_Not_Found("no such routine"), dto::K23SIRunRoutineResponse{});
+    }
+    _routinesRun++;
+
+    K2TxnOptions options;
+    if (request.timeout > Duration(0)) {
+        options.deadline = Deadline<>(request.timeout);
+    }
+    options.priority = request.priority;
+    return seastar::do_with(std::move(request), dto::K23SIRunRoutineResponse{}, [this, routine, options] (auto& request, auto& response) {
+        return _client.runTxn(options, [routine, &request, &response] (K2TxnHandle& txn) {
+            request.params.seek(0);
+            response.result = Payload(Payload::DefaultAllocator);
+            return (*routine)(txn, request.params, response.result)
+            .then([&response] (bool commit) {
+                response.committed = commit;
+                return commit;
+            });
+        })
+        .then_wrapped([this, &request, &response] (auto&& fut) {
+            if (fut.failed()) {
+                auto exc = fut.get_exception();
+                K2LOG_W_EXC(log::routines, exc, "routine {} failed", request.routine);
+                _routinesFailed++;
+                return RPCResponse(Statuses::S500_Internal_Server_Error("routine failed"), dto::K23SIRunRoutineResponse{});
+            }
+            EndResult result = fut.get0();
+            if (!result.status.is2xxOK()) {
+                response.committed = false;
+                _routinesFailed++;
+            }
+            else if (response.committed) {
+                _routinesCommitted++;
+            }
+            return RPCResponse(std::move(result.status), std::move(response));
+        });
+    });
+}
+
+} // namespace k2
@@ -0,0 +1,93 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+
+#include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/dto/K23SI.h>
+#include <k2/module/k23si/client/k23si_client.h>
+
+namespace k2 {
+namespace log {
+inline thread_local k2::logging::Logger routines("k2::txn_routines");
+}
+
+// A transaction routine runs a whole transaction on a node, next to its data. It gets the transaction and the
+// parameters of the call, and writes what it wants to return into the result. Like the func of
+// K23SIClient::runTxn, it returns whether to commit. The routine runs again when its transaction is retried,
+// each time with the parameters rewound and an empty result
+typedef std::function<seastar::future<bool>(K2TxnHandle& txn, Payload& params, Payload& result)> TxnRoutine;
+
+// The routines compiled into the binary, by name. They are registered before the app starts, e.g. with a static
+// TxnRoutines::Registrar in the file which defines them, and are shared by all cores
+class TxnRoutines {
+public:
+    static void add(String name, TxnRoutine routine);
+    // nullptr if there is no such routine
+    static const TxnRoutine* find(const String& name);
+
+    struct Registrar {
+        Registrar(String name, TxnRoutine routine) { add(std::move(name), std::move(routine)); }
+    };
+
+private:
+    static std::unordered_map<String, TxnRoutine>& _routines();
+};
+
+// Runs the transaction routines which clients call with K23SI_RUN_ROUTINE. Calls are routed like any partition
+// request, so a routine runs on the core of the partition which owns the key of the call. The routine's
+// transaction goes through a K23SI client on that core, whose requests to the partitions of the core are
+// dispatched in-process by the transport, and only the operations on keys of other cores or nodes are RPCs.
+// A routine whose keys are all local, including its TRH, runs with no network round trip besides the call
+class TxnRoutineService {
+public:  // application lifespan
+    TxnRoutineService();
+    ~TxnRoutineService();
+
+    // required for seastar::distributed interface
+    seastar::future<> gracefulStop();
+    seastar::future<> start();
+
+private:
+    seastar::future<std::tuple<Status, dto::K23SIRunRoutineResponse>>
+    _handleRunRoutine(dto::K23SIRunRoutineRequest&& request);
+
+    // declared ahead of the client, which is configured with it
+    ConfigVar<String> _cpoEndpoint{"k23si_cpo_endpoint", "tcp+k2rpc://127.0.0.1:12345"};
+
+    K23SIClient _client;
+    seastar::gate _gate;
+
+    sm::metric_groups _metricGroups;
+    uint64_t _routinesRun = 0;
+    uint64_t _routinesCommitted = 0;
+    uint64_t _routinesFailed = 0;
+};  // class TxnRoutineService
+
+} // namespace k2
@@ -22,6 +22,14 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include <k2/common/Log.h>
+#include <k2/dto/MessageVerbs.h>
+#include <k2/partitionManager/PartitionManager.h>
+#include <k2/transport/RPCDispatcher.h>
+#include <k2/transport/TCPRPCProtocol.h>
+
+#include <seastar/core/memory.hh>
+#include <seastar/core/reactor.hh>
+
 #include "NodePoolMonitor.h"
 
 namespace k2 {
@@ -36,11 +44,82 @@ NodePoolMonitor::~NodePoolMonitor() {
 
 seastar::future<> NodePoolMonitor::gracefulStop() {
     K2LOG_I(log::nodepool, "stop");
-    return seastar::make_ready_future<>();
+    return _heartbeatTimer.stop();
 }
 
 seastar::future<> NodePoolMonitor::start() {
+    _lastSample = Clock::now();
+    _lastBusy = seastar::engine().total_busy_time();
+    if (seastar::this_shard_id() != 0 || _heartbeatInterval() == 0s) {
+        return seastar::make_ready_future<>();
+    }
+    _cpo = RPC().getTXEndpoint(_cpoEndpoint());
+    if (!_cpo) {
+        K2LOG_W(log::nodepool, "invalid CPO endpoint {}, not sending heartbeats", _cpoEndpoint());
+        return seastar::make_ready_future<>();
+    }
+    _heartbeatTimer.setCallback([this] {
+        return _heartbeat();
+    });
+    _heartbeatTimer.armPeriodic(_heartbeatInterval());
     return seastar::make_ready_future<>();
 }
 
+dto::CoreHeartbeat NodePoolMonitor::_sample() {
+    dto::CoreHeartbeat hb;
+    auto ep = RPC().getServerEndpoint(TCPRPCProtocol::proto);
+    if (ep) {
+        hb.endpoint = ep->url;
+    }
+    auto now = Clock::now();
+    Duration busy = seastar::engine().total_busy_time();
+    auto elapsed = nsec(now - _lastSample).count();
+    if (elapsed > 0) {
+        hb.reactorUtilization = std::min(1.0, double(nsec(busy - _lastBusy).count()) / elapsed);
+    }
+    _lastSample = now;
+    _lastBusy = busy;
+    hb.memoryBytes = seastar::memory::stats().allocated_memory();
+    hb.pendingRequests = RPC().pendingRequests();
+    if (__local_pmanager) {
+        auto load = PManager().getLoad();
+        hb.assigned = load.assigned;
+        hb.collectionName = std::move(load.collectionName);
+        hb.pvid = load.partition.pvid;
+        hb.requests = load.requests;
+        hb.p99LatencyUs = load.p99LatencyUs;
+    }
+    return hb;
+}
+
+seastar::future<> NodePoolMonitor::_heartbeat() {
+    return AppBase().getDist<NodePoolMonitor>().map_reduce0(
+        [] (NodePoolMonitor& monitor) {
+            return monitor._sample();
+        },
+        dto::NodeHeartbeatRequest{},
+        [] (dto::NodeHeartbeatRequest&& request, dto::CoreHeartbeat&& hb) {
+            if (!hb.endpoint.empty()) {
+                request.cores.push_back(std::move(hb));
+            }
+            return std::move(request);
+        })
+    .then([this] (dto::NodeHeartbeatRequest&& request) {
+        return seastar::do_with(std::move(request), [this] (auto& request) {
+            return RPC().callRPC<dto::NodeHeartbeatRequest, dto::NodeHeartbeatResponse>
+                (dto::Verbs::CPO_NODE_HEARTBEAT, request, *_cpo, _heartbeatTimeout());
+        });
+    })
+    .then([] (auto&& result) {
+        auto& [status, response] = result;
+        if (!status.is2xxOK()) {
+            K2LOG_D(log::nodepool, "heartbeat failed: {}", status);
+        }
+    })
+    .handle_exception([] (auto exc) {
+        // the next heartbeat goes out on schedule
+        K2LOG_W_EXC(log::nodepool, exc, "unable to send heartbeat");
+    });
+}
+
 }  // namespace k2
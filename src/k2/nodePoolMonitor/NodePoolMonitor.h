@@ -23,13 +23,25 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <memory>
+
 // third-party
 #include <seastar/core/future.hh>  // for future stuff
 
+#include <k2/appbase/AppEssentials.h>
+#include <k2/common/Log.h>
+#include <k2/common/Timer.h>
+#include <k2/dto/ControlPlaneOracle.h>
+#include <k2/transport/TXEndpoint.h>
+
 namespace k2 {
 namespace log {
 inline thread_local k2::logging::Logger nodepool("k2::nodepool_mon");
 }
+
+// Samples the health and load of the cores of the node: reactor utilization, memory, the requests and latency
+// of the assigned partitions and the replies we wait for. Core 0 sends them to the CPO in one heartbeat every
+// nodepool_heartbeat_interval
 class NodePoolMonitor {
 public:  // application lifespan
     NodePoolMonitor();
@@ -38,6 +50,24 @@ public:  // application lifespan
     // required for seastar::distributed interface
     seastar::future<> gracefulStop();
     seastar::future<> start();
+
+private:
+    // samples this core. The utilization is over the time since the previous sample
+    dto::CoreHeartbeat _sample();
+
+    // core 0 only: samples all cores and reports them to the CPO
+    seastar::future<> _heartbeat();
+
+    ConfigVar<String> _cpoEndpoint{"k23si_cpo_endpoint", "tcp+k2rpc://127.0.0.1:12345"};
+    // 0 disables the heartbeats
+    ConfigDuration _heartbeatInterval{"nodepool_heartbeat_interval", 1s};
+    ConfigDuration _heartbeatTimeout{"nodepool_heartbeat_timeout", 500ms};
+
+    PeriodicTimer _heartbeatTimer;
+    std::unique_ptr<TXEndpoint> _cpo;
+
+    TimePoint _lastSample;
+    Duration _lastBusy{0};
 };  // class NodePoolMonitor
 
 } // namespace k2
@@ -27,6 +27,10 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/transport/RRDMARPCProtocol.h>
 #include <k2/transport/TCPRPCProtocol.h>
 
+#include <boost/range/irange.hpp>
+#include <seastar/core/memory.hh>
+#include <k2/appbase/Appbase.h>
+
 namespace k2 {
 
 PartitionManager::PartitionManager() {
@@ -39,23 +43,60 @@ PartitionManager::~PartitionManager() {
 
 seastar::future<> PartitionManager::gracefulStop() {
     K2LOG_I(log::partmgr, "stop");
-    // signal the partition module that we're stopping
-    if (_pmodule) {
-        K2LOG_I(log::partmgr, "stopping module");
-        return _pmodule->gracefulStop();
-    }
-    return seastar::make_ready_future<>();
+    // signal the partition modules that we're stopping
+    K2LOG_I(log::partmgr, "stopping {} modules", _pmodules.size());
+    return seastar::parallel_for_each(_pmodules, [] (_Hosted& hosted) {
+        return hosted.module->gracefulStop();
+    });
 }
 
 seastar::future<> PartitionManager::start() {
     __local_pmanager = this;
-    return seastar::make_ready_future<>();
+    // the scheduling groups are process-wide and seastar has a few of them only, so core 0 creates a small pool
+    // which every core spreads its partitions over
+    uint32_t count = std::min(_partitionsPerCore(), _schedulingGroups());
+    if (seastar::this_shard_id() != 0 || count <= 1) {
+        return seastar::make_ready_future<>();
+    }
+    K2LOG_I(log::partmgr, "creating {} scheduling groups for {} partitions per core", count, _partitionsPerCore());
+    return seastar::do_with(std::vector<seastar::scheduling_group>{}, [count] (auto& groups) {
+        return seastar::do_for_each(boost::irange<uint32_t>(0, count), [&groups] (uint32_t i) {
+            return seastar::create_scheduling_group(fmt::format("k23si_partition_{}", i), 1000)
+                .then([&groups] (seastar::scheduling_group group) {
+                    groups.push_back(group);
+                });
+        })
+        .then([&groups] {
+            return AppBase().getDist<PartitionManager>().invoke_on_all([groups] (PartitionManager& pmanager) {
+                pmanager._groups = groups;
+            });
+        });
+    });
+}
+
+seastar::scheduling_group PartitionManager::_pickGroup() const {
+    if (_groups.empty()) {
+        return seastar::default_scheduling_group();
+    }
+    std::vector<size_t> used(_groups.size(), 0);
+    for (auto& hosted : _pmodules) {
+        auto it = std::find(_groups.begin(), _groups.end(), hosted.group);
+        if (it != _groups.end()) {
+            ++used[it - _groups.begin()];
+        }
+    }
+    return _groups[std::min_element(used.begin(), used.end()) - used.begin()];
 }
 
 seastar::future<dto::Partition>
-PartitionManager::assignPartition(dto::CollectionMetadata meta, dto::Partition partition) {
-    if (_pmodule) {
-        K2LOG_W(log::partmgr, "Partition already assigned");
+PartitionManager::assignPartition(dto::CollectionMetadata meta, dto::Partition partition, bool migrationTarget, String followPersistence) {
+    if (_pmodules.size() >= _partitionsPerCore()) {
+        K2LOG_W(log::partmgr, "Core already hosts {} partitions", _pmodules.size());
+        partition.astate = dto::AssignmentState::FailedAssignment;
+        return seastar::make_ready_future<dto::Partition>(std::move(partition));
+    }
+    if (PartitionTable().hosts({meta.name, partition.pvid.id})) {
+        K2LOG_W(log::partmgr, "Partition {} of {} already assigned", partition.pvid, meta.name);
         partition.astate = dto::AssignmentState::FailedAssignment;
         return seastar::make_ready_future<dto::Partition>(std::move(partition));
     }
@@ -73,8 +114,11 @@ PartitionManager::assignPartition(dto::CollectionMetadata meta, dto::Partition p
             partition.endpoints.insert(rdma_ep->url);
         }
 
-        _pmodule = std::make_unique<K23SIPartitionModule>(std::move(meta), partition);
-        return _pmodule->start().then([partition = std::move(partition)] () mutable {
+        auto group = _pickGroup();
+        auto pmodule = std::make_unique<K23SIPartitionModule>(std::move(meta), partition, migrationTarget, std::move(followPersistence), group);
+        auto& module = *pmodule;
+        _pmodules.push_back(_Hosted{std::move(pmodule), group});
+        return module.start().then([partition = std::move(partition)] () mutable {
             if (partition.endpoints.size() > 0) {
                 partition.astate = dto::AssignmentState::Assigned;
                 K2LOG_I(log::partmgr, "Assigned partition for driver k23si");
@@ -92,4 +136,23 @@ PartitionManager::assignPartition(dto::CollectionMetadata meta, dto::Partition p
     return seastar::make_ready_future<dto::Partition>(std::move(partition));
 }
 
+dto::AssignmentLoadResponse PartitionManager::getLoad() {
+    dto::AssignmentLoadResponse load;
+    load.memoryBytes = seastar::memory::stats().allocated_memory();
+    load.partitions = _pmodules.size();
+    // the balancer moves and splits partitions by their load, so report the busiest one
+    for (auto& hosted : _pmodules) {
+        dto::AssignmentLoadResponse partLoad;
+        hosted.module->getLoad(partLoad);
+        if (!load.assigned || partLoad.requests > load.requests) {
+            load.assigned = true;
+            load.collectionName = std::move(partLoad.collectionName);
+            load.partition = std::move(partLoad.partition);
+            load.requests = partLoad.requests;
+            load.p99LatencyUs = partLoad.p99LatencyUs;
+        }
+    }
+    return load;
+}
+
 }  // namespace k2
@@ -25,6 +25,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 // third-party
 #include <k2/common/Common.h>
+#include <k2/dto/AssignmentManager.h>
 #include <k2/dto/Collection.h>
 #include <k2/module/k23si/Module.h>
 #include <seastar/core/distributed.hh>  // for dist stuff
@@ -35,18 +36,38 @@ namespace log {
 inline thread_local k2::logging::Logger partmgr("k2::partition_manager");
 }
 
+// Hosts the partitions assigned to this core, up to k23si_partitions_per_core of them. Their requests are routed by
+// the partition table of the core(see K23SIPartitionTable), and with more than one partition per core each
+// partition runs its requests in one of a pool of equal-share scheduling groups, so that a busy partition can't
+// starve the others on its core
 class PartitionManager {
 public: // application lifespan
     PartitionManager();
     ~PartitionManager();
-    seastar::future<dto::Partition> assignPartition(dto::CollectionMetadata meta, dto::Partition partition);
+    // A migration target takes its state from the partition it replaces, instead of recovering it
+    seastar::future<dto::Partition> assignPartition(dto::CollectionMetadata meta, dto::Partition partition, bool migrationTarget=false, String followPersistence="");
+
+    // the load of this core and of its busiest partition, if any
+    dto::AssignmentLoadResponse getLoad();
 
     // required for seastar::distributed interface
     seastar::future<> gracefulStop();
     seastar::future<> start();
 
 private:
-    std::unique_ptr<K23SIPartitionModule> _pmodule;
+    // the least used scheduling group on this core
+    seastar::scheduling_group _pickGroup() const;
+
+    struct _Hosted {
+        std::unique_ptr<K23SIPartitionModule> module;
+        seastar::scheduling_group group;
+    };
+    std::vector<_Hosted> _pmodules;
+    // the scheduling groups for the partitions, the same on all cores. Empty with one partition per core
+    std::vector<seastar::scheduling_group> _groups;
+
+    ConfigVar<uint32_t> _partitionsPerCore{"k23si_partitions_per_core", 1};
+    ConfigVar<uint32_t> _schedulingGroups{"k23si_partition_scheduling_groups", 8};
 }; // class PartitionManager
 
 // per-thread/reactor instance of the partition manager
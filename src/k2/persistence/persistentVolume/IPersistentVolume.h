@@ -23,6 +23,11 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <deque>
+#include <optional>
+
+#include <boost/range/irange.hpp>
+
 #include <k2/common/Common.h>
 #include <k2/persistence/plog/IPlog.h>
 
@@ -114,6 +119,115 @@ public:
     virtual std::unique_ptr<IIterator> getChunks() = 0;
     virtual seastar::future<> close() = 0;
     virtual ~IPersistentVolume() {}
+
+    //
+    //  Append the buffers as a single record so that they become durable together
+    //
+    virtual seastar::future<RecordPosition> appendMany(std::vector<Binary> bufferList)
+    {
+        size_t totalSize = 0;
+        for(Binary& bin : bufferList)
+            totalSize += bin.size();
+
+        Binary buffer(totalSize);
+        char* ptr = buffer.get_write();
+        for(Binary& bin : bufferList)
+        {
+            std::memcpy(ptr, bin.get(), bin.size());
+            ptr += bin.size();
+        }
+
+        return append(std::move(buffer));
+    }
+
+    //
+    //  Read the given regions, each of them given as a position and a size to read. The reads are issued
+    //  concurrently and the buffers are returned in the order of the regions
+    //
+    virtual seastar::future<std::vector<Binary>> readMany(std::vector<std::pair<RecordPosition, uint32_t>> regions)
+    {
+        auto count = regions.size();
+        return seastar::do_with(std::move(regions), std::vector<Binary>(count), [this](auto& regions, auto& buffers)
+        {
+            return seastar::parallel_for_each(boost::irange<size_t>(0, regions.size()), [this, &regions, &buffers](size_t i)
+            {
+                return read(regions[i].first, regions[i].second, buffers[i]).discard_result();
+            })
+            .then([&buffers] { return std::move(buffers); });
+        });
+    }
+};
+
+//
+//  Reads the content of the chunks of a volume in chunk order, keeping up to readAhead chunks in flight so that
+//  the reads of the next chunks overlap with the processing of the current one.
+//  The chunks are the ones in the volume at the time the reader is created. The volume must outlive the reader
+//  and all of its outstanding reads
+//
+class ChunkReader
+{
+public:
+    ChunkReader(IPersistentVolume& volume, size_t readAhead) : m_volume(volume), m_readAhead(std::max<size_t>(readAhead, 1))
+    {
+        for(auto it = volume.getChunks(); it->isValid(); it->advance())
+            m_chunks.push_back(it->getCurrent());
+    }
+
+    //
+    //  Return the next chunk and its content, or nothing once all chunks have been read
+    //
+    seastar::future<std::optional<std::pair<ChunkInfo, Binary>>> next()
+    {
+        using ResultT = std::optional<std::pair<ChunkInfo, Binary>>;
+        prefetch();
+        if(m_pending.empty())
+            return seastar::make_ready_future<ResultT>(std::nullopt);
+
+        auto fut = std::move(m_pending.front());
+        m_pending.pop_front();
+        auto chunk = m_chunks[m_nextChunk++];
+        prefetch();
+        return fut.then([chunk](Binary&& buffer) {
+            return ResultT(std::make_pair(chunk, std::move(buffer)));
+        });
+    }
+
+private:
+    //  Issue a single readMany for all chunks needed to bring the number of in-flight chunks up to m_readAhead
+    void prefetch()
+    {
+        size_t first = m_nextChunk + m_pending.size();
+        std::vector<std::pair<RecordPosition, uint32_t>> regions;
+        for(size_t i = first; i < m_chunks.size() && m_pending.size() + regions.size() < m_readAhead; i++)
+            regions.emplace_back(RecordPosition{m_chunks[i].chunkId, 0}, m_chunks[i].size);
+        if(regions.empty())
+            return;
+
+        auto promises = seastar::make_lw_shared<std::vector<seastar::promise<Binary>>>(regions.size());
+        for(auto& promise : *promises)
+            m_pending.push_back(promise.get_future());
+
+        (void) m_volume.readMany(std::move(regions)).then_wrapped([promises](auto&& fut) {
+            if(fut.failed())
+            {
+                auto exc = fut.get_exception();
+                for(auto& promise : *promises)
+                    promise.set_exception(exc);
+                return;
+            }
+            auto buffers = fut.get0();
+            for(size_t i = 0; i < buffers.size(); i++)
+                (*promises)[i].set_value(std::move(buffers[i]));
+        });
+    }
+
+    IPersistentVolume& m_volume;
+    size_t m_readAhead;
+    std::vector<ChunkInfo> m_chunks;
+    // the index in m_chunks of the chunk returned by the next call to next()
+    size_t m_nextChunk = 0;
+    // the reads for the chunks starting at m_nextChunk
+    std::deque<seastar::future<Binary>> m_pending;
 };
 
 }   //  namespace k2
@@ -137,7 +137,68 @@ const uint32_t MaxPlogSize = 32*1024;
 
 seastar::future<RecordPosition> PersistentVolume::append(Binary binary)
 {
-    auto appendSize = binary.size();
+    Payload payload;
+    payload.appendBinary(std::move(binary));
+    return appendPayload(std::move(payload));
+}
+
+seastar::future<RecordPosition> PersistentVolume::appendMany(std::vector<Binary> bufferList)
+{
+    Payload payload;
+    for(auto& bin : bufferList)
+        payload.appendBinary(std::move(bin));
+    return appendPayload(std::move(payload));
+}
+
+uint32_t PersistentVolume::maxRecordSize()
+{
+    return MaxPlogSize - plogInfoSize;
+}
+
+seastar::future<std::vector<std::pair<RecordPosition, uint32_t>>> PersistentVolume::appendSplit(std::vector<Binary> bufferList)
+{
+    // cut the buffers into records, sharing the data of the buffers which straddle the record boundaries
+    std::vector<std::vector<Binary>> records(1);
+    std::vector<uint32_t> sizes(1, 0);
+    for(auto& bin : bufferList)
+    {
+        size_t offset = 0;
+        while(offset < bin.size())
+        {
+            if(sizes.back() == maxRecordSize())
+            {
+                records.emplace_back();
+                sizes.push_back(0);
+            }
+            size_t len = std::min<size_t>(bin.size() - offset, maxRecordSize() - sizes.back());
+            records.back().push_back(bin.share(offset, len));
+            sizes.back() += len;
+            offset += len;
+        }
+    }
+    if(sizes.back() == 0)
+    {
+        records.pop_back();
+        sizes.pop_back();
+    }
+
+    // the records go out one at a time so that they land in the volume in order
+    return seastar::do_with(std::move(records), std::move(sizes), std::vector<std::pair<RecordPosition, uint32_t>>{},
+        [this](auto& records, auto& sizes, auto& positions)
+    {
+        return seastar::do_for_each(boost::irange<size_t>(0, records.size()), [this, &records, &sizes, &positions](size_t i)
+        {
+            return appendMany(std::move(records[i])).then([&sizes, &positions, i](RecordPosition position) {
+                positions.emplace_back(position, sizes[i]);
+            });
+        })
+        .then([&positions] { return std::move(positions); });
+    });
+}
+
+seastar::future<RecordPosition> PersistentVolume::appendPayload(Payload&& payload)
+{
+    auto appendSize = payload.getSize();
     return [appendSize, this] {
         if(m_chunkList.empty())
         {
@@ -147,25 +208,26 @@ seastar::future<RecordPosition> PersistentVolume::append(Binary binary)
             // retrieve last chunk information
             auto& plogId = m_chunkList.back().plogId;
             return m_plog->getInfo(plogId)
-            .then([&plogId, appendSize, this](auto&& plogInfo){
+            .then([plogId, appendSize, this](auto&& plogInfo){
                 if(plogInfo.sealed || plogInfo.size+appendSize > MaxPlogSize)
-                    // current chunk doesn't have enough space, need a new chunk to append
-                    return m_plog->seal(plogId).then([this]{ return addNewChunk(); });
+                    // current chunk doesn't have enough space, need a new chunk to append. The new chunk normally
+                    // comes from the preallocated plogs, and we don't need to wait for the seal before using it
+                    return seastar::when_all_succeed(m_plog->seal(plogId), addNewChunk()).discard_result();
                 else
                     // current chunk has enough space to append
                     return seastar::make_ready_future<>();
             });
         }
     }()
-    .then([appendSize, binary=std::move(binary), this] () mutable {
+    .then([appendSize, payload=std::move(payload), this] () mutable {
         if(appendSize+plogInfoSize > MaxPlogSize)
         {
             // the binary buffer is too large to append to plog, throw a ChunkException.
-            auto msg = "Append buffer[" + std::to_string(binary.size())
+            auto msg = "Append buffer[" + std::to_string(appendSize)
                        + "] exceeds the limit of chunk capability: " + std::to_string(MaxPlogSize-plogInfoSize);
             return seastar::make_exception_future<uint32_t>(ChunkException(msg, m_chunkList.back().chunkId));
         }else
-            return m_plog->append(m_chunkList.back().plogId, std::move(binary));
+            return m_plog->append(m_chunkList.back().plogId, std::move(payload));
     })
     .then([appendSize, this](auto&& offset) {
         // update chunk Information
@@ -273,7 +335,12 @@ std::unique_ptr<IPersistentVolume::IIterator> PersistentVolume::getChunks()
 
 seastar::future<> PersistentVolume::addNewChunk()
 {
-    return m_plog->create(1)
+    auto plogFuture = m_sparePlogs.empty() ?
+        m_plog->create(1) : seastar::make_ready_future<std::vector<PlogId>>(std::vector<PlogId>{m_sparePlogs.back()});
+    if(!m_sparePlogs.empty())
+        m_sparePlogs.pop_back();
+
+    return plogFuture
         .then([this](std::vector<PlogId>&& plogIds)
         {
             EntryRecord record;
@@ -286,12 +353,49 @@ seastar::future<> PersistentVolume::addNewChunk()
                     ChunkInfo chunkInfo{plogId};
                     chunkInfo.chunkId = m_chunkList.size()==0 ? 1 : (m_chunkList.back().chunkId + 1);
                     m_chunkList.push_back(std::move(chunkInfo));
+                    preallocateChunk();
 
                     return seastar::make_ready_future<>();
                 });
             });
 }
 
+void PersistentVolume::preallocateChunk()
+{
+    if(m_preallocating || !m_sparePlogs.empty() || m_background.is_closed())
+        return;
+
+    m_preallocating = true;
+    (void) seastar::with_gate(m_background, [this] {
+        return m_plog->create(1)
+            .then([this](std::vector<PlogId>&& plogIds) {
+                m_sparePlogs.push_back(plogIds[0]);
+            })
+            .handle_exception([](auto exc) {
+                // the next chunk will be created inline
+                K2LOG_W_EXC(log::iplog, exc, "failed to preallocate chunk");
+            })
+            .finally([this] {
+                m_preallocating = false;
+            });
+    });
+}
+
+seastar::future<> PersistentVolume::close()
+{
+    return m_background.close()
+        .then([this] {
+            // the spare plogs were never added to the volume
+            return seastar::parallel_for_each(m_sparePlogs, [this](const PlogId& plogId) {
+                return m_plog->drop(plogId);
+            });
+        })
+        .then([this] {
+            m_sparePlogs.clear();
+            return m_plog->close();
+        });
+}
+
 namespace {
 
 struct PersistentVolumeWithConstructorAccess : public PersistentVolume
@@ -311,6 +415,7 @@ seastar::future<std::shared_ptr<PersistentVolume>> PersistentVolume::create(std:
 
             return volume->entryService->init().then([volume](std::vector<EntryRecord>&&)
             {
+                volume->preallocateChunk();
                 return std::dynamic_pointer_cast<PersistentVolume>(volume);
             });
         });
@@ -25,6 +25,9 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <algorithm>
 #include <numeric>
+
+#include <seastar/core/gate.hh>
+
 #include "IPersistentVolume.h"
 
 #ifdef EXPOSE_PRIVATES
@@ -88,13 +91,25 @@ PROTECTED:
     // append a new chunk to the chunk set, the chunk id is monotonically increased,
     seastar::future<> addNewChunk();
 
+    // append the payload to the last chunk as a single record, adding a new chunk if it doesn't fit
+    seastar::future<RecordPosition> appendPayload(Payload&& payload);
+
+    // create the plog for the next chunk in the background, so that a full chunk doesn't stall the appender
+    void preallocateChunk();
+
+    // plogs created ahead of time for the next chunks
+    std::vector<PlogId> m_sparePlogs;
+    bool m_preallocating = false;
+    // tracks the background preallocation
+    seastar::gate m_background;
+
     PersistentVolume();
 
     PersistentVolume(std::shared_ptr<IPlog> plog);
 
     PersistentVolume(String plogPath);
 
-    seastar::future<> close() {return m_plog->close();};
+    seastar::future<> close();
 
     DISABLE_COPY_MOVE(PersistentVolume);
 
@@ -107,6 +122,23 @@ public:
     //
     seastar::future<RecordPosition> append(Binary binary) override;
 
+    //
+    // append the buffers to chunk as a single record. The buffers are handed to the plog as they are, so there is no
+    // intermediate copy into a concatenated buffer
+    //
+    seastar::future<RecordPosition> appendMany(std::vector<Binary> bufferList) override;
+
+    //
+    // append the buffers as consecutive records of at most maxRecordSize() bytes each, so that the data doesn't
+    // need to fit in a chunk. Reading the records back in order gives the data as it was appended
+    // bufferList - the buffers to append
+    // return - the position and size of each record
+    //
+    seastar::future<std::vector<std::pair<RecordPosition, uint32_t>>> appendSplit(std::vector<Binary> bufferList);
+
+    // the size of the largest record which fits in a chunk
+    static uint32_t maxRecordSize();
+
     //
     // read a binary data to buffer from given chunk
     // position - indicates the chunk Id and offset to read
@@ -198,6 +198,16 @@ public:
     //
     virtual seastar::future<uint32_t> append(const PlogId& plogId, Binary buffer) = 0;
 
+    //
+    //  Append the data of the payload to the end of PLOG. Implementations can write the underlying buffers of the
+    //  payload as they are. The default implementation concatenates them
+    //
+    virtual seastar::future<uint32_t> append(const PlogId& plogId, Payload&& payload)
+    {
+        // the shared payload is trimmed to exactly the data
+        return appendMany(plogId, payload.shareAll().release());
+    }
+
     //
     //  Read the region from PLOG
     //
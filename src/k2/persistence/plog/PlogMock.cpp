@@ -38,9 +38,9 @@ seastar::future<> PlogFileDescriptor::close(){
 //      Data
 //
 
-PlogMock::PlogMock(String plogPath) {
+PlogMock::PlogMock(String plogPath, uint32_t plogMaxSize) {
     m_plogPath = plogPath;
-    m_plogMaxSize = PLOG_MAX_SIZE;
+    m_plogMaxSize = plogMaxSize;
     m_plogFileNamePrefix = String{"plogid_"};
 
     std::random_device rd;
@@ -112,8 +112,6 @@ seastar::future<PlogFileDescriptor*> PlogMock::getDescriptor(const PlogId& plogI
     if (it != m_plogFileDescriptors.end())
         return seastar::make_ready_future<PlogFileDescriptor*>(&it->second);
 
-    //  TODO: need to handle concurrency, e.g. another task access PLOG while we still loading buffers.
-    // Can be done by storing future in PlogFileDescriptor
     auto plogFileName = getPlogFileName(plogId);
     return seastar::file_exists(plogFileName)
         .then([plogId, plogFileName, this](bool isFound) mutable
@@ -142,6 +140,13 @@ seastar::future<PlogFileDescriptor*> PlogMock::getDescriptor(const PlogId& plogI
                         })
                         .then([plogId{std::move(plogId)}, plogFileDescriptor, new_ssfile, this]() mutable {
                             plogFileDescriptor->ssfile = std::move(new_ssfile);
+                            auto it = m_plogFileDescriptors.find(plogId);
+                            if (it != m_plogFileDescriptors.end()) {
+                                // loaded by another task meanwhile, which may already have appends queued on it
+                                return plogFileDescriptor->ssfile.close().then([plogFileDescriptor, descr=&it->second] {
+                                    return descr;
+                                });
+                            }
                             m_plogFileDescriptors[plogId] = std::move(*(plogFileDescriptor.release()));
                             return seastar::make_ready_future<PlogFileDescriptor*>(&m_plogFileDescriptors[plogId]);
                         });
@@ -156,8 +161,48 @@ seastar::future<PlogInfo> PlogMock::getInfo(const PlogId& plogId)
 
 seastar::future<uint32_t> PlogMock::append(const PlogId& plogId, Binary bin)
 {
-    return getDescriptor(plogId)    //  TODO: concurency
-        .then([bin=std::move(bin), plogId, this](PlogFileDescriptor* descr) mutable
+    Payload payload;
+    payload.appendBinary(std::move(bin));
+    return append(plogId, std::move(payload));
+}
+
+namespace {
+// A read cursor over a list of buffers
+struct BufferCursor {
+    std::vector<Binary>& buffers;
+    size_t index = 0;
+    size_t offset = 0;
+
+    // the contiguous bytes left in the current buffer
+    size_t contiguous() {
+        while (index < buffers.size() && offset == buffers[index].size()) {
+            ++index;
+            offset = 0;
+        }
+        return index < buffers.size() ? buffers[index].size() - offset : 0;
+    }
+
+    const char* current() const { return buffers[index].get() + offset; }
+
+    void copyOut(char* dest, size_t size) {
+        while (size > 0) {
+            auto n = std::min(size, contiguous());
+            std::memcpy(dest, current(), n);
+            dest += n;
+            size -= n;
+            offset += n;
+        }
+    }
+};
+
+// the largest buffer into which unaligned data is staged
+constexpr size_t MAX_STAGING_SIZE = 128 * 1024;
+}
+
+seastar::future<uint32_t> PlogMock::append(const PlogId& plogId, Payload&& payload)
+{
+    return getDescriptor(plogId)
+        .then([payload=std::move(payload), plogId, this](PlogFileDescriptor* descr) mutable
         {
             if(descr->getInfo().sealed)
             {
@@ -165,63 +210,147 @@ seastar::future<uint32_t> PlogMock::append(const PlogId& plogId, Binary bin)
                 return seastar::make_exception_future<uint32_t>(PlogException(msg, P_PLOG_SEALED));
             }
 
-            if(descr->getInfo().size + bin.size() > m_plogMaxSize)
-            {
-                auto msg = "PLogId "+String(plogId.id, PLOG_ID_LEN)+" exceeds PLog limit.";
-                return seastar::make_exception_future<uint32_t>(PlogException(msg, P_EXCEED_PLOGID_LIMIT));
-            }
+            descr->pending.push_back(PendingAppend{.payload=std::move(payload)});
+            auto result = descr->pending.back().promise.get_future();
+            if(!descr->writing)
+                writeBatches(plogId, descr);
+            return result;
+        });
+}
 
-            //
-            //  Buffer needs to be split into 3 parts: part that can be fit into current tail buffer up to DMA_ALIGNMENT,
-            //  central part having size proportional to DMA_ALIGNMENT, last part that is less thatn DMA_ALIGNMENT and
-            //  which will become new tail buffer
-            //
-            size_t size = bin.size();
-            size_t remainingWriteSize = size;
+void PlogMock::writeBatches(PlogId plogId, PlogFileDescriptor* descr)
+{
+    descr->writing = true;
+    (void)seastar::do_until([descr] { return descr->pending.empty(); }, [plogId, descr, this]
+        {
+            std::vector<PendingAppend> batch;
+            batch.swap(descr->pending);
+            return writeBatch(plogId, descr, std::move(batch));
+        })
+        .finally([descr] { descr->writing = false; });
+}
 
-            //  Part that needs to be written in current head segment
-            size_t leftTailSize = std::min(descr->getTailRemaining(), remainingWriteSize);
-            remainingWriteSize -= leftTailSize;
+seastar::future<> PlogMock::writeBatch(const PlogId& plogId, PlogFileDescriptor* descr, std::vector<PendingAppend> batch)
+{
+    //
+    //  The offsets are assigned in queue order. An append which doesn't fit into the plog(or finds it sealed) fails on
+    //  its own, and the data of the rest is concatenated for a single write
+    //
+    std::vector<Binary> buffers;
+    std::vector<std::pair<seastar::promise<uint32_t>, uint32_t>> accepted;
+    size_t size = 0;
+    for(auto& pendingAppend : batch)
+    {
+        size_t appendSize = pendingAppend.payload.getSize();
+        if(descr->getInfo().sealed)
+        {
+            auto msg = "PLogId "+String(plogId.id, PLOG_ID_LEN)+" is sealed.";
+            pendingAppend.promise.set_exception(PlogException(msg, P_PLOG_SEALED));
+            continue;
+        }
+        if(descr->getInfo().size + size + appendSize > m_plogMaxSize)
+        {
+            auto msg = "PLogId "+String(plogId.id, PLOG_ID_LEN)+" exceeds PLog limit.";
+            pendingAppend.promise.set_exception(PlogException(msg, P_EXCEED_PLOGID_LIMIT));
+            continue;
+        }
+        accepted.emplace_back(std::move(pendingAppend.promise), descr->getInfo().size + size);
+        size += appendSize;
+        for(auto& bin : pendingAppend.payload.shareAll().release())
+        {
+            if(bin.size() > appendSize)
+                bin.trim(appendSize);
+            appendSize -= bin.size();
+            if(bin.size())
+                buffers.push_back(std::move(bin));
+        }
+    }
 
-            //  Part needed to be written as a last tail
-            size_t rightTailSize = remainingWriteSize % DMA_ALIGNMENT;
-            remainingWriteSize -= rightTailSize;
+    if(!size)
+    {
+        for(auto& [promise, offset] : accepted)
+            promise.set_value(offset);
+        return seastar::make_ready_future<>();
+    }
 
-            if(leftTailSize)
-                std::memcpy(descr->tailBuffer.get_write()+descr->getTailSize(), bin.get(), leftTailSize);
+    //
+    //  The data is split into 3 parts: the part which fits into the current tail block, the aligned middle part and
+    //  the last part which becomes the new tail block. All three are written with one vectored write starting at the
+    //  current tail block. Middle buffers which are DMA aligned are written in place, the rest is staged
+    //
+    BufferCursor cursor{.buffers=buffers};
 
-            seastar::future<size_t> writeTail = leftTailSize ?
-                descr->ssfile.dma_write(descr->getTailOffsetInFile(), descr->tailBuffer.get(), DMA_ALIGNMENT) :
-                seastar::make_ready_future<size_t>(0);
+    size_t leftTailSize = std::min(descr->getTailRemaining(), size);
+    size_t middleSize = seastar::align_down(size - leftTailSize, (size_t)DMA_ALIGNMENT);
+    size_t rightTailSize = size - leftTailSize - middleSize;
 
-            return writeTail
-                .then([remainingWriteSize, buf = bin.get()+leftTailSize, descr](auto&&)
-                {
-                    return remainingWriteSize ?
-                        descr->ssfile.dma_write(descr->getTailOffsetInFile()+DMA_ALIGNMENT, buf, remainingWriteSize) :
-                        seastar::make_ready_future<size_t>(0);
-                })
-                .then([rightTailSize, leftTailSize, bin = std::move(bin), remainingWriteSize, descr](size_t writtenSize)
-                {
-                    assert(writtenSize == remainingWriteSize);
+    cursor.copyOut(descr->tailBuffer.get_write()+descr->getTailSize(), leftTailSize);
+
+    std::vector<iovec> iovs{iovec{descr->tailBuffer.get_write(), DMA_ALIGNMENT}};
+    std::vector<Binary> staging;
+    for (size_t remaining = middleSize; remaining > 0;)
+    {
+        auto contiguous = cursor.contiguous();
+        if((reinterpret_cast<uintptr_t>(cursor.current()) % DMA_ALIGNMENT) == 0 && contiguous >= DMA_ALIGNMENT)
+        {
+            // write this buffer in place
+            size_t n = std::min(remaining, seastar::align_down(contiguous, (size_t)DMA_ALIGNMENT));
+            iovs.push_back(iovec{const_cast<char*>(cursor.current()), n});
+            cursor.offset += n;
+            remaining -= n;
+            continue;
+        }
+        size_t n = std::min(remaining, MAX_STAGING_SIZE);
+        staging.push_back(Binary::aligned(DMA_ALIGNMENT, n));
+        cursor.copyOut(staging.back().get_write(), n);
+        iovs.push_back(iovec{staging.back().get_write(), n});
+        remaining -= n;
+    }
 
-                    if(!rightTailSize)
-                        return seastar::make_ready_future<size_t>(0);
+    Binary rightTail;
+    if(rightTailSize)
+    {
+        rightTail = Binary::aligned(DMA_ALIGNMENT, DMA_ALIGNMENT);
+        memset(rightTail.get_write(), (int)0, DMA_ALIGNMENT);
+        cursor.copyOut(rightTail.get_write(), rightTailSize);
+        iovs.push_back(iovec{rightTail.get_write(), DMA_ALIGNMENT});
+    }
+    size_t writeSize = DMA_ALIGNMENT + middleSize + (rightTailSize ? DMA_ALIGNMENT : 0);
 
-                    std::memcpy(descr->tailBuffer.get_write(), bin.get()+leftTailSize+remainingWriteSize, rightTailSize);
+    return withIoSlot([position=descr->getTailOffsetInFile(), iovs=std::move(iovs), descr]() mutable
+        {
+            return descr->ssfile.dma_write(position, std::move(iovs));
+        })
+        .then([rightTail=std::move(rightTail), writeSize, size, descr, this](size_t writtenSize)
+        {
+            if(writtenSize != writeSize)
+                return seastar::make_exception_future<>(PlogException("Write failure: short dma_write", P_ERROR));
 
-                    return descr->ssfile.dma_write(descr->getTailOffsetInFile()+DMA_ALIGNMENT+remainingWriteSize, descr->tailBuffer.get(), DMA_ALIGNMENT);
-                })
-                .then([descr, size](auto&&)
-                {
-                    descr->getInfo().size += size;
-                    return descr->ssfile.dma_write(0, descr->headBuffer.get(), DMA_ALIGNMENT).discard_result();
-                })
-                .then([descr] { return descr->ssfile.flush(); })
-                .then([descr, size]
-                {
-                    return seastar::make_ready_future<uint32_t>(descr->getInfo().size-size);
-                });
+            if(rightTail.size())
+                std::memcpy(descr->tailBuffer.get_write(), rightTail.get(), DMA_ALIGNMENT);
+
+            descr->getInfo().size += size;
+            return withIoSlot([descr]
+            {
+                return descr->ssfile.dma_write(0, descr->headBuffer.get(), DMA_ALIGNMENT).discard_result();
+            });
+        })
+        .then([descr] { return descr->ssfile.flush(); })
+        // the written buffers must stay alive until the writes complete
+        .then_wrapped([accepted=std::move(accepted), buffers=std::move(buffers), staging=std::move(staging)](auto&& fut) mutable
+        {
+            if(fut.failed())
+            {
+                auto ex = fut.get_exception();
+                for(auto& [promise, offset] : accepted)
+                    promise.set_exception(ex);
+            }
+            else
+            {
+                for(auto& [promise, offset] : accepted)
+                    promise.set_value(offset);
+            }
+            return seastar::make_ready_future<>();
         });
 }
 
@@ -260,38 +389,51 @@ seastar::future<ReadRegion> PlogMock::read(const PlogId& plogId, ReadRegion regi
     assert(region.size && (!region.buffer || region.buffer.size() >= region.size));
 
     return getDescriptor(plogId)
-        .then([region = std::move(region), plogId] (PlogFileDescriptor* descr) mutable
+        .then([region = std::move(region), this] (PlogFileDescriptor* descr) mutable
         {
             if(region.offset >= descr->getInfo().size)
                 return seastar::make_exception_future<ReadRegion>(PlogException("Plog doesn't have data at such offset", P_CAPACITY_NOT_ENOUGH));
 
             size_t sizeToRead = std::min(region.size, descr->getInfo().size-region.offset);
-            if(!region.buffer)
-                region.buffer = Binary(sizeToRead);
-            else
-            {
-                if(region.buffer.size() > sizeToRead)
-                    region.buffer.trim(sizeToRead);
-            }
+            if(region.buffer && region.buffer.size() > sizeToRead)
+                region.buffer.trim(sizeToRead);
 
-            //  TODO: can be optimized
             size_t blockOffset = seastar::align_down(region.offset, DMA_ALIGNMENT);
             size_t offsetInBlock = region.offset - blockOffset;
             size_t blockSize = seastar::align_up(region.offset+sizeToRead, (size_t)DMA_ALIGNMENT) - blockOffset;
 
             blockOffset += DMA_ALIGNMENT;   //  Skip header
 
-            Binary blockBuffer(blockSize);
-
-            return seastar::do_with(std::move(region), std::move(blockBuffer), [descr, plogId, blockOffset, blockSize, offsetInBlock](auto& region, auto& blockBuffer) mutable
+            //  An aligned caller buffer which covers whole blocks is read into directly
+            if(region.buffer && offsetInBlock == 0 && blockSize == sizeToRead &&
+               (reinterpret_cast<uintptr_t>(region.buffer.get()) % DMA_ALIGNMENT) == 0)
             {
-                return readFull(descr->ssfile, blockOffset, blockBuffer.get_write(), blockSize)
-                    .then([&region, &blockBuffer, offsetInBlock, blockSize]
-                    {
+                return seastar::do_with(std::move(region), [descr, blockOffset, blockSize, this](auto& region)
+                {
+                    return withIoSlot([&region, descr, blockOffset, blockSize]
+                        {
+                            return readFull(descr->ssfile, blockOffset, region.buffer.get_write(), blockSize);
+                        })
+                        .then([&region] { return seastar::make_ready_future<ReadRegion>(std::move(region)); });
+                });
+            }
+
+            //  Otherwise the blocks are read into an aligned buffer, which is shared with the caller unless the
+            //  caller provided its own buffer
+            Binary blockBuffer = Binary::aligned(DMA_ALIGNMENT, blockSize);
+            char* blockData = blockBuffer.get_write();
+            return withIoSlot([descr, blockOffset, blockData, blockSize]
+                {
+                    return readFull(descr->ssfile, blockOffset, blockData, blockSize);
+                })
+                .then([region = std::move(region), blockBuffer = std::move(blockBuffer), offsetInBlock, sizeToRead]() mutable
+                {
+                    if(!region.buffer)
+                        region.buffer = blockBuffer.share(offsetInBlock, sizeToRead);
+                    else
                         std::memcpy(region.buffer.get_write(), blockBuffer.get()+offsetInBlock, region.buffer.size());
-                        return seastar::make_ready_future<ReadRegion>(std::move(region));
-                    });
-            });
+                    return seastar::make_ready_future<ReadRegion>(std::move(region));
+                });
         });
 }
 
@@ -302,7 +444,9 @@ seastar::future<>  PlogMock::seal(const PlogId& plogId)
         auto ptr = reinterpret_cast<PlogInfo*>(m_plogFileDescriptors[plogId].headBuffer.get_write());
         ptr->sealed = true;
 
-        return m_plogFileDescriptors[plogId].ssfile.dma_write(0, m_plogFileDescriptors[plogId].headBuffer.get(), DMA_ALIGNMENT).then([plogId, this](auto&&) mutable {
+        return withIoSlot([plogId, this] {
+            return m_plogFileDescriptors[plogId].ssfile.dma_write(0, m_plogFileDescriptors[plogId].headBuffer.get(), DMA_ALIGNMENT);
+        }).then([plogId, this](auto&&) mutable {
             return m_plogFileDescriptors[plogId].ssfile.flush();
         });
     });
@@ -34,6 +34,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <seastar/core/reactor.hh>
 #include <seastar/core/future-util.hh>
 #include <seastar/core/align.hh>
+#include <seastar/core/semaphore.hh>
 
 #include <k2/common/Common.h>
 #include "IPlog.h"
@@ -61,11 +62,23 @@ struct PlogIdComp {
 };
 
 
+// an append which waits to be written together with the other appends queued on its plog
+struct PendingAppend
+{
+    Payload payload;
+    seastar::promise<uint32_t> promise;
+};
+
 struct PlogFileDescriptor
 {
     seastar::file ssfile;                  // plog file descriptor
-    Binary headBuffer{DMA_ALIGNMENT}; // sync up first 4k(=DMA_ALIGNMENT) with plog file
-    Binary tailBuffer{DMA_ALIGNMENT}; // sync up last 4k(=DMA_ALIGNMENT) with plog file when plog size (head+log_blocks) is not aligned.
+    Binary headBuffer = Binary::aligned(DMA_ALIGNMENT, DMA_ALIGNMENT); // sync up first 4k(=DMA_ALIGNMENT) with plog file
+    Binary tailBuffer = Binary::aligned(DMA_ALIGNMENT, DMA_ALIGNMENT); // sync up last 4k(=DMA_ALIGNMENT) with plog file when plog size (head+log_blocks) is not aligned.
+
+    // appends queued while a batch is being written. They are all written with the next batch
+    std::vector<PendingAppend> pending;
+    // true while a batch of appends is being written
+    bool writing = false;
 
     PlogFileDescriptor()
     {
@@ -120,6 +133,10 @@ public:
     /**
      * append a list of buffers to plog file for given plog id
      *
+     * Appends to the same plog are written in order. The appends issued while a write to the plog is in flight are
+     * queued, and are then written together as one batch: a single vectored DMA write of their data, followed by a
+     * single header write and flush.
+     *
      * plogId - plog id for append
      * bufferList - a list of log blocks to append
      * return - the file position starting to append log blocks
@@ -130,6 +147,19 @@ public:
      **/
     seastar::future<uint32_t> append(const PlogId& plogId, Binary buffer) override;
 
+    /**
+     * append the data of a payload to the plog, without first concatenating its buffers
+     *
+     * The data is written with vectored DMA writes. Buffers which are DMA aligned are written in place, while the
+     * unaligned parts are staged into aligned buffers.
+     *
+     * plogId - plog id to append
+     * payload - the payload to append
+     * return - the offset in the plog at which the data was appended
+     * Exception - same as append(const PlogId&, Binary)
+     */
+    seastar::future<uint32_t> append(const PlogId& plogId, Payload&& payload) override;
+
     /**
      * retrive a set of plog blocks for given plog id
      *
@@ -164,6 +194,17 @@ public:
         m_plogMaxSize = plogMaxSize;
     }
 
+    // the number of DMA reads and writes which may be in flight at once, default: PLOG_IO_QUEUE_DEPTH
+    void setIoQueueDepth(size_t ioQueueDepth) {
+        assert(ioQueueDepth > 0);
+        if (ioQueueDepth > m_ioQueueDepth) {
+            m_ioSlots.signal(ioQueueDepth - m_ioQueueDepth);
+        } else {
+            m_ioSlots.consume(m_ioQueueDepth - ioQueueDepth);
+        }
+        m_ioQueueDepth = ioQueueDepth;
+    }
+
     void setPlogFileNamePrefix(String plogFileNamePrefix) {
         m_plogFileNamePrefix = plogFileNamePrefix;
     }
@@ -180,7 +221,7 @@ public:
         return m_plogFileNamePrefix;
     }
 
-    PlogMock(String plogPath = String("./plogData"));
+    PlogMock(String plogPath = String("./plogData"), uint32_t plogMaxSize = PLOG_MAX_SIZE);
 
     ~PlogMock();
 
@@ -190,6 +231,18 @@ PRIVATE:
 
     seastar::future<PlogFileDescriptor*> getDescriptor(const PlogId& plogId);
 
+    // writes the queued appends of the plog in batches, until none are left
+    void writeBatches(PlogId plogId, PlogFileDescriptor* descr);
+
+    // writes the given appends with a single data write and completes their promises
+    seastar::future<> writeBatch(const PlogId& plogId, PlogFileDescriptor* descr, std::vector<PendingAppend> batch);
+
+    // runs the given DMA operation once a slot in the I/O queue is available
+    template <typename Func>
+    auto withIoSlot(Func&& func) {
+        return seastar::with_semaphore(m_ioSlots, 1, std::forward<Func>(func));
+    }
+
     PlogId generatePlogId();
 
     String getPlogFileName(const PlogId& plogId) {
@@ -205,6 +258,10 @@ PRIVATE:
     // the path to store plog files, default: "./plogData", can be initialized when an instance is created from the class
     String m_plogPath;
 
+    // limits the DMA reads and writes in flight to m_ioQueueDepth, can be customized by setIoQueueDepth()
+    size_t m_ioQueueDepth = PLOG_IO_QUEUE_DEPTH;
+    seastar::semaphore m_ioSlots{PLOG_IO_QUEUE_DEPTH};
+
     // keep active plog ids and their information
     std::map<PlogId, PlogFileDescriptor, PlogIdComp> m_plogFileDescriptors;
 
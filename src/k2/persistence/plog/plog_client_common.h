@@ -525,6 +525,9 @@ constexpr uint32_t PLOG_MAX_SIZE = 2 * 1024 * 1024;
 
 constexpr uint32_t DMA_ALIGNMENT = 4096;
 
+// the default number of DMA reads and writes a PlogMock keeps in flight
+constexpr size_t PLOG_IO_QUEUE_DEPTH = 32;
+
 constexpr uint32_t plogInfoSize = sizeof(PlogInfo);
 
 } // ns k2
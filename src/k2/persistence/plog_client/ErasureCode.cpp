@@ -0,0 +1,189 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "ErasureCode.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace k2 {
+
+namespace {
+// log/exp tables of GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 and generator 2
+struct GaloisField {
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    GaloisField() {
+        uint32_t x = 1;
+        for (uint32_t i = 0; i < 255; ++i) {
+            exp[i] = (uint8_t)x;
+            log[x] = (uint8_t)i;
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= 0x11d;
+            }
+        }
+        // doubled, so that products can index with the sum of two logs
+        for (uint32_t i = 255; i < 512; ++i) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+    }
+
+    uint8_t mul(uint8_t a, uint8_t b) const {
+        return (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+    }
+
+    uint8_t inv(uint8_t a) const {
+        return exp[255 - log[a]];
+    }
+};
+
+const GaloisField& gf() {
+    static const GaloisField field;
+    return field;
+}
+}
+
+ErasureCode::ErasureCode(uint32_t dataFragments, uint32_t parityFragments) :
+    _k(dataFragments),
+    _m(parityFragments) {
+    if (_k == 0 || _k + _m > 256) {
+        throw std::invalid_argument("unsupported erasure code geometry");
+    }
+    // Cauchy matrix with x_i = k + i and y_j = j. The two sets don't intersect, so x_i + y_j is never 0
+    _parityMatrix.resize(_m * _k);
+    for (uint32_t i = 0; i < _m; ++i) {
+        for (uint32_t j = 0; j < _k; ++j) {
+            _parityMatrix[i * _k + j] = gf().inv((uint8_t)((_k + i) ^ j));
+        }
+    }
+}
+
+void ErasureCode::_mulAdd(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size) {
+    if (c == 0) {
+        return;
+    }
+    if (c == 1) {
+        for (size_t i = 0; i < size; ++i) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    // one multiplication table per coefficient keeps the loop to a lookup and an xor per byte
+    uint8_t table[256];
+    for (uint32_t v = 0; v < 256; ++v) {
+        table[v] = gf().mul(c, (uint8_t)v);
+    }
+    for (size_t i = 0; i < size; ++i) {
+        dst[i] ^= table[src[i]];
+    }
+}
+
+void ErasureCode::encode(const std::vector<const uint8_t*>& data, const std::vector<uint8_t*>& parity, size_t size) const {
+    for (uint32_t i = 0; i < _m; ++i) {
+        std::memset(parity[i], 0, size);
+        for (uint32_t j = 0; j < _k; ++j) {
+            _mulAdd(_parityMatrix[i * _k + j], data[j], parity[i], size);
+        }
+    }
+}
+
+bool ErasureCode::decode(const std::vector<const uint8_t*>& fragments, const std::vector<uint8_t*>& data, size_t size) const {
+    // rebuild from the first k fragments we have. Data fragments come first, so we use as few parities as we can
+    std::vector<uint32_t> rows;
+    bool missingData = false;
+    for (uint32_t f = 0; f < _k + _m && rows.size() < _k; ++f) {
+        if (fragments[f]) {
+            rows.push_back(f);
+        }
+        else if (f < _k) {
+            missingData = true;
+        }
+    }
+    if (!missingData) {
+        return true;
+    }
+    if (rows.size() < _k) {
+        return false;
+    }
+
+    // the rows of the generator matrix for the fragments we have, inverted in place with Gauss-Jordan elimination
+    std::vector<uint8_t> a(_k * _k, 0);
+    std::vector<uint8_t> inv(_k * _k, 0);
+    for (uint32_t r = 0; r < _k; ++r) {
+        if (rows[r] < _k) {
+            a[r * _k + rows[r]] = 1;
+        }
+        else {
+            std::memcpy(&a[r * _k], &_parityMatrix[(rows[r] - _k) * _k], _k);
+        }
+        inv[r * _k + r] = 1;
+    }
+    for (uint32_t col = 0; col < _k; ++col) {
+        uint32_t pivot = col;
+        while (pivot < _k && a[pivot * _k + col] == 0) {
+            ++pivot;
+        }
+        if (pivot == _k) {
+            // can't happen for a Cauchy code
+            return false;
+        }
+        if (pivot != col) {
+            for (uint32_t c = 0; c < _k; ++c) {
+                std::swap(a[pivot * _k + c], a[col * _k + c]);
+                std::swap(inv[pivot * _k + c], inv[col * _k + c]);
+            }
+        }
+        auto scale = gf().inv(a[col * _k + col]);
+        for (uint32_t c = 0; c < _k; ++c) {
+            a[col * _k + c] = gf().mul(a[col * _k + c], scale);
+            inv[col * _k + c] = gf().mul(inv[col * _k + c], scale);
+        }
+        for (uint32_t r = 0; r < _k; ++r) {
+            auto factor = a[r * _k + col];
+            if (r == col || factor == 0) {
+                continue;
+            }
+            for (uint32_t c = 0; c < _k; ++c) {
+                a[r * _k + c] ^= gf().mul(factor, a[col * _k + c]);
+                inv[r * _k + c] ^= gf().mul(factor, inv[col * _k + c]);
+            }
+        }
+    }
+
+    for (uint32_t j = 0; j < _k; ++j) {
+        if (fragments[j]) {
+            continue;
+        }
+        std::memset(data[j], 0, size);
+        for (uint32_t r = 0; r < _k; ++r) {
+            _mulAdd(inv[j * _k + r], fragments[rows[r]], data[j], size);
+        }
+    }
+    return true;
+}
+
+} // namespace k2
@@ -0,0 +1,63 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace k2 {
+
+// A systematic Reed-Solomon code over GF(2^8), for any number of data fragments k and parity fragments m
+// with k + m <= 256. The parity rows of the generator matrix form a Cauchy matrix, so that any k of the
+// k + m fragments are enough to rebuild the data.
+// The code is linear and bytewise: byte i of every parity fragment is computed from byte i of the data fragments,
+// so a fragment can hold any number of stripe cells, back to back.
+class ErasureCode {
+public:
+    ErasureCode(uint32_t dataFragments, uint32_t parityFragments);
+
+    uint32_t dataFragments() const { return _k; }
+    uint32_t parityFragments() const { return _m; }
+
+    // compute the m parity fragments from the k data fragments. All fragments are size bytes long
+    void encode(const std::vector<const uint8_t*>& data, const std::vector<uint8_t*>& parity, size_t size) const;
+
+    // Rebuild missing data fragments. fragments holds all k + m fragments, in order, with nullptr for the ones
+    // we don't have. Each missing data fragment j is written to data[j], which must hold size bytes.
+    // Returns false if fewer than k fragments are present
+    bool decode(const std::vector<const uint8_t*>& fragments, const std::vector<uint8_t*>& data, size_t size) const;
+
+private:
+    // dst[i] ^= c * src[i] for i in [0, size)
+    static void _mulAdd(uint8_t c, const uint8_t* src, uint8_t* dst, size_t size);
+
+    uint32_t _k;
+    uint32_t _m;
+    // the parity rows of the generator matrix, m x k, row-major
+    std::vector<uint8_t> _parityMatrix;
+};
+
+} // namespace k2
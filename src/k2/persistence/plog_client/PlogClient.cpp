@@ -34,7 +34,9 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/dto/MessageVerbs.h>
 #include <cstdlib>
 #include <cctype>
+#include <cstring>
 #include <algorithm>
+#include <numeric>
 #include <random>
 
 namespace k2 {
@@ -50,7 +52,15 @@ PlogClient::~PlogClient() {
 
 seastar::future<>
 PlogClient::init(String clusterName){
-    return _getPersistenceCluster(clusterName);
+    _idleTimer.set_callback([this] { _releaseIdle(); });
+    return _getPersistenceCluster(clusterName)
+    .then([this] {
+        // fill the pool of the group we start with. The other groups fill once they're used
+        if (_plog_pool_size() > 0) {
+            _refill(_persistenceMapPointer);
+            _idleTimer.arm(_plog_pool_idle_timeout());
+        }
+    });
 }
 
 seastar::future<>
@@ -61,17 +71,32 @@ PlogClient::_getPlogServerEndpoints() {
         _persistenceNameList.push_back(v.name);
 
         std::vector<std::unique_ptr<TXEndpoint>> endpoints;
+        _replicaStats.emplace_back();
         for (auto& url: v.plogServerEndpoints){
             K2LOG_I(log::plogcl, "Plog Server Url: {}", url);
             auto ep = RPC().getTXEndpoint(url);
             if (ep){
                 endpoints.push_back(std::move(ep));
+                _replicaStats.back().emplace_back();
             }
         }
         if (endpoints.size() == 0){
             K2LOG_I(log::plogcl, "Failed to obtain the Endpoint of Plog Servers");
             return seastar::make_exception_future<>(std::runtime_error("Failed to obtain the Endpoint of Plog Servers"));
         }
+        _pools.emplace_back();
+        _striping.emplace_back();
+        if (v.parityFragments > 0) {
+            // each server holds a specific fragment, so we can't do without any of them
+            if (endpoints.size() != v.plogServerEndpoints.size() || endpoints.size() <= v.parityFragments || v.cellSize == 0) {
+                K2LOG_E(log::plogcl, "Invalid erasure-coded persistence group {}: {} servers, {} parities, cell size {}",
+                        v.name, endpoints.size(), v.parityFragments, v.cellSize);
+                return seastar::make_exception_future<>(std::runtime_error("Invalid erasure-coded persistence group"));
+            }
+            _striping.back().emplace(Striping{
+                .code=ErasureCode((uint32_t)endpoints.size() - v.parityFragments, v.parityFragments),
+                .cellSize=v.cellSize});
+        }
         _persistenceMapEndpoints[std::move(v.name)] = std::move(endpoints);
     }
     return seastar::make_ready_future<>();
@@ -96,17 +121,104 @@ PlogClient::_getPersistenceCluster(String clusterName){
     });
 }
 
-// TODO: If the create call fails, we should try and create the plog in another persistence group.
 seastar::future<std::tuple<Status, String>> PlogClient::create(uint8_t retries){
+    auto group = _persistenceMapPointer;
+    auto& pool = _pools[group];
+    if (_plog_pool_size() == 0) {
+        return _create(group, retries);
+    }
+    _idleTimer.cancel();
+    _idleTimer.arm(_plog_pool_idle_timeout());
+    if (pool.plogIds.empty()) {
+        // the pool ran dry, or was released while idle. Create this one on the spot, and refill in the background
+        _refill(group);
+        return _create(group, retries);
+    }
+    String plogId = std::move(pool.plogIds.front());
+    pool.plogIds.pop_front();
+    _refill(group);
+    return seastar::make_ready_future<std::tuple<Status, String>>(std::make_tuple(Statuses::S201_Created("plog created"), std::move(plogId)));
+}
+
+void PlogClient::_refill(uint32_t group) {
+    auto& pool = _pools[group];
+    if (pool.refilling || pool.plogIds.size() >= _plog_pool_size() || _background.is_closed()) {
+        return;
+    }
+    pool.refilling = true;
+    // one creation at a time is enough to keep up with plog rollover, and doesn't burst the plog servers
+    (void) seastar::with_gate(_background, [this, group] {
+        return _create(group, 1)
+        .then_wrapped([this, group] (auto&& fut) {
+            auto& pool = _pools[group];
+            pool.refilling = false;
+            if (fut.failed()) {
+                K2LOG_W_EXC(log::plogcl, fut.get_exception(), "failed to pre-create plog");
+                return seastar::make_ready_future();
+            }
+            auto [status, plogId] = fut.get0();
+            if (!status.is2xxOK()) {
+                // we try again on the next create()
+                K2LOG_W(log::plogcl, "failed to pre-create plog: {}", status);
+                return seastar::make_ready_future();
+            }
+            pool.plogIds.push_back(std::move(plogId));
+            if (!_idleTimer.armed()) {
+                // we went idle, or started closing, while the plog was being created
+                return _releasePool(group);
+            }
+            _refill(group);
+            return seastar::make_ready_future();
+        });
+    });
+}
+
+seastar::future<> PlogClient::_releasePool(uint32_t group) {
+    auto& pool = _pools[group];
+    if (!pool.plogIds.empty()) {
+        K2LOG_I(log::plogcl, "releasing {} pre-created plogs of group {}", pool.plogIds.size(), _persistenceNameList[group]);
+    }
+    std::vector<seastar::future<>> seals;
+    while (!pool.plogIds.empty()) {
+        // a sealed empty plog can't be appended to, so nobody can pick it up by mistake
+        seals.push_back(_seal(group, std::move(pool.plogIds.front()), 0)
+            .then_wrapped([] (auto&& fut) {
+                if (fut.failed()) {
+                    K2LOG_W_EXC(log::plogcl, fut.get_exception(), "failed to seal pre-created plog");
+                }
+            }));
+        pool.plogIds.pop_front();
+    }
+    return seastar::when_all_succeed(seals.begin(), seals.end()).discard_result();
+}
+
+void PlogClient::_releaseIdle() {
+    for (uint32_t group = 0; group < _pools.size(); ++group) {
+        (void) seastar::with_gate(_background, [this, group] {
+            return _releasePool(group);
+        });
+    }
+}
+
+seastar::future<> PlogClient::close() {
+    _idleTimer.cancel();
+    if (!_background.is_closed()) {
+        _releaseIdle();
+    }
+    return _background.is_closed() ? seastar::make_ready_future() : _background.close();
+}
+
+// TODO: If the create call fails, we should try and create the plog in another persistence group.
+seastar::future<std::tuple<Status, String>> PlogClient::_create(uint32_t group, uint8_t retries){
     String plogId = _generatePlogId();
     dto::PlogCreateRequest request{.plogId = plogId};
 
     std::vector<seastar::future<std::tuple<Status, dto::PlogCreateResponse> > > createFutures;
-    for (auto& ep:_persistenceMapEndpoints[_persistenceNameList[_persistenceMapPointer]]){
+    for (auto& ep:_persistenceMapEndpoints[_persistenceNameList[group]]){
         createFutures.push_back(RPC().callRPC<dto::PlogCreateRequest, dto::PlogCreateResponse>(dto::Verbs::PERSISTENT_CREATE, request, *ep, _plog_timeout()));
     }
     return seastar::when_all_succeed(createFutures.begin(), createFutures.end())
-        .then([this, plogId, retries](std::vector<std::tuple<Status, dto::PlogCreateResponse> >&& results) {
+        .then([this, group, plogId, retries](std::vector<std::tuple<Status, dto::PlogCreateResponse> >&& results) {
             Status return_status;
             for (auto& result: results){
                 auto& [status, response] = result;
@@ -115,20 +227,35 @@ seastar::future<std::tuple<Status, String>> PlogClient::create(uint8_t retries){
                     break;
             }
             if (return_status.code == 409 && retries > 0){
-                    return create(retries-1);
+                    return _create(group, retries-1);
             }
             return seastar::make_ready_future<std::tuple<Status, String> >(std::tuple<Status, String>(std::move(return_status), std::move(plogId)));
         });
 }
 
 seastar::future<std::tuple<Status, uint32_t>> PlogClient::append(String plogId, uint32_t offset, Payload payload){
+    if (_striping[_persistenceMapPointer]) {
+        return _appendStriped(_persistenceMapPointer, std::move(plogId), offset, std::move(payload));
+    }
     uint32_t expected_offset = offset + payload.getSize();
     uint32_t appended_offset = payload.getSize();
     dto::PlogAppendRequest request{.plogId = std::move(plogId), .offset=offset, .payload=std::move(payload)};
 
+    // the append is sent to all replicas in parallel. A failure of one replica is reported as a status so that
+    // we still wait for, and record the latency of, the others
+    auto group = _persistenceMapPointer;
+    auto& endpoints = _persistenceMapEndpoints[_persistenceNameList[group]];
     std::vector<seastar::future<std::tuple<Status, dto::PlogAppendResponse> > > appendFutures;
-    for (auto& ep:_persistenceMapEndpoints[_persistenceNameList[_persistenceMapPointer]]){
-        appendFutures.push_back(RPC().callRPC<dto::PlogAppendRequest, dto::PlogAppendResponse>(dto::Verbs::PERSISTENT_APPEND, request, *ep, _plog_timeout()));
+    for (size_t i = 0; i < endpoints.size(); ++i){
+        appendFutures.push_back(RPC().callRPC<dto::PlogAppendRequest, dto::PlogAppendResponse>(dto::Verbs::PERSISTENT_APPEND, request, *endpoints[i], _plog_timeout())
+            .then_wrapped([this, group, i, start=Clock::now()] (auto&& fut) {
+                if (fut.failed()) {
+                    K2LOG_W_EXC(log::plogcl, fut.get_exception(), "append to plog server {} failed", _persistenceMapEndpoints[_persistenceNameList[group]][i]->url);
+                    return std::make_tuple(Statuses::S503_Service_Unavailable("plog server unavailable"), dto::PlogAppendResponse{});
+                }
+                _replicaStats[group][i].add(Clock::now() - start);
+                return fut.get0();
+            }));
     }
 
     return seastar::when_all_succeed(appendFutures.begin(), appendFutures.end())
@@ -139,7 +266,9 @@ seastar::future<std::tuple<Status, uint32_t>> PlogClient::append(String plogId,
                 return_status = std::move(status);
                 if (!return_status.is2xxOK())
                     break;
+                // all replicas must agree on where the appended data ends
                 if (response.newOffset != expected_offset){
+                    K2LOG_W(log::plogcl, "replica offset {} differs from expected offset {}", response.newOffset, expected_offset);
                     return_status = Statuses::S500_Internal_Server_Error("offset inconsistent");
                     break;
                 }
@@ -150,32 +279,327 @@ seastar::future<std::tuple<Status, uint32_t>> PlogClient::append(String plogId,
 
 
 seastar::future<std::tuple<Status, Payload>> PlogClient::read(String plogId, uint32_t offset, uint32_t size){
-    dto::PlogReadRequest request{.plogId = std::move(plogId), .offset=offset, .size=size};
+    auto group = _persistenceMapPointer;
+    if (_striping[group]) {
+        return _readStriped(group, std::move(plogId), offset, size);
+    }
+    auto& stats = _replicaStats[group];
+    auto state = seastar::make_lw_shared<ReadState>();
+    state->request = dto::PlogReadRequest{.plogId = std::move(plogId), .offset=offset, .size=size};
+    state->lastStatus = Statuses::S503_Service_Unavailable("no plog server available");
+    state->order.resize(stats.size());
+    std::iota(state->order.begin(), state->order.end(), 0);
+    // replicas we have no samples for yet sort first, so that we learn their latency
+    std::stable_sort(state->order.begin(), state->order.end(), [&stats] (size_t a, size_t b) {
+        return stats[a].latency < stats[b].latency;
+    });
+    if (state->order.empty()) {
+        return seastar::make_ready_future<std::tuple<Status, Payload>>(std::make_tuple(std::move(state->lastStatus), Payload()));
+    }
 
-    return RPC().callRPC<dto::PlogReadRequest, dto::PlogReadResponse>(dto::Verbs::PERSISTENT_READ, request, *_persistenceMapEndpoints[_persistenceNameList[_persistenceMapPointer]][0], _plog_timeout()).
-        then([this] (auto&& result) {
-            auto& [status, response] = result;
+    auto result = state->result.get_future();
+    if (state->order.size() > 1) {
+        state->hedgeTimer.set_callback([this, state, group] {
+            if (!state->done && state->next < state->order.size()) {
+                K2LOG_D(log::plogcl, "hedging read of {}", state->request);
+                _sendRead(state, group);
+            }
+        });
+        state->hedgeTimer.arm(std::max(_plog_read_hedge_min_delay(), stats[state->order[0]].p99()));
+    }
+    _sendRead(state, group);
+    return result;
+}
 
-            return seastar::make_ready_future<std::tuple<Status, Payload> >(std::tuple<Status, Payload>(std::move(status), std::move(response.payload)));
+void PlogClient::_sendRead(seastar::lw_shared_ptr<ReadState> state, uint32_t group) {
+    auto replica = state->order[state->next++];
+    state->outstanding++;
+    auto& ep = *_persistenceMapEndpoints[_persistenceNameList[group]][replica];
+    (void) RPC().callRPC<dto::PlogReadRequest, dto::PlogReadResponse>(dto::Verbs::PERSISTENT_READ, state->request, ep, _plog_timeout())
+        .then_wrapped([this, state, group, replica, start=Clock::now()] (auto&& fut) {
+            state->outstanding--;
+            Status status;
+            dto::PlogReadResponse response;
+            if (fut.failed()) {
+                K2LOG_W_EXC(log::plogcl, fut.get_exception(), "read from plog server failed");
+                status = Statuses::S503_Service_Unavailable("plog server unavailable");
+            }
+            else {
+                _replicaStats[group][replica].add(Clock::now() - start);
+                std::tie(status, response) = fut.get0();
+            }
+            if (state->done) {
+                // another replica already answered
+                return;
+            }
+            // only a server error is worth retrying elsewhere. Other statuses, e.g. reading past the
+            // end of the plog, would be the same on every replica
+            if (status.is2xxOK() || status.code < 500) {
+                state->done = true;
+                state->hedgeTimer.cancel();
+                // drop the callback since it holds a reference to the state
+                state->hedgeTimer.set_callback([] {});
+                state->result.set_value(std::make_tuple(std::move(status), std::move(response.payload)));
+                return;
+            }
+            state->lastStatus = std::move(status);
+            if (state->next < state->order.size()) {
+                // fail over right away rather than waiting for the hedge delay
+                state->hedgeTimer.cancel();
+                _sendRead(state, group);
+            }
+            else if (state->outstanding == 0) {
+                state->done = true;
+                state->hedgeTimer.set_callback([] {});
+                state->result.set_value(std::make_tuple(std::move(state->lastStatus), Payload()));
+            }
         });
 }
 
+uint32_t PlogClient::appendedSize(uint32_t size) const {
+    auto& striping = _striping[_persistenceMapPointer];
+    if (!striping) {
+        return size;
+    }
+    uint32_t stripeSize = striping->stripeSize();
+    return (size + stripeSize - 1) / stripeSize * stripeSize;
+}
+
+seastar::future<std::tuple<Status, uint32_t>>
+PlogClient::_appendStriped(uint32_t group, String plogId, uint32_t offset, Payload payload) {
+    auto& striping = *_striping[group];
+    uint32_t k = striping.code.dataFragments();
+    uint32_t m = striping.code.parityFragments();
+    uint32_t cellSize = striping.cellSize;
+    if (offset % striping.stripeSize() != 0) {
+        return seastar::make_ready_future<std::tuple<Status, uint32_t>>(
+            std::make_tuple(Statuses::S400_Bad_Request("append offset is not at a stripe boundary"), 0u));
+    }
+    uint32_t size = payload.getSize();
+    uint32_t stripes = appendedSize(size) / striping.stripeSize();
+    uint32_t fragmentSize = stripes * cellSize;
+
+    // lay out the cells of each stripe, the last one padded with zeros, and compute the parity fragments
+    std::vector<Binary> fragments;
+    for (uint32_t f = 0; f < k + m; ++f) {
+        fragments.emplace_back(fragmentSize);
+    }
+    payload.seek(0);
+    for (uint32_t s = 0; s < stripes; ++s) {
+        for (uint32_t j = 0; j < k; ++j) {
+            char* cell = fragments[j].get_write() + s * cellSize;
+            uint32_t n = std::min<uint32_t>(cellSize, payload.getDataRemaining());
+            payload.read(cell, n);
+            std::memset(cell + n, 0, cellSize - n);
+        }
+    }
+    std::vector<const uint8_t*> data;
+    std::vector<uint8_t*> parity;
+    for (uint32_t f = 0; f < k + m; ++f) {
+        if (f < k) {
+            data.push_back((const uint8_t*)fragments[f].get());
+        }
+        else {
+            parity.push_back((uint8_t*)fragments[f].get_write());
+        }
+    }
+    striping.code.encode(data, parity, fragmentSize);
+
+    // every server must take its fragment, just like all replicas must take a replicated append
+    uint32_t serverOffset = offset / k;
+    uint32_t expectedServerOffset = serverOffset + fragmentSize;
+    auto& endpoints = _persistenceMapEndpoints[_persistenceNameList[group]];
+    std::vector<seastar::future<std::tuple<Status, dto::PlogAppendResponse> > > appendFutures;
+    for (uint32_t f = 0; f < k + m; ++f) {
+        std::vector<Binary> buffers;
+        buffers.push_back(std::move(fragments[f]));
+        dto::PlogAppendRequest request{.plogId = plogId, .offset=serverOffset, .payload=Payload(std::move(buffers), fragmentSize)};
+        appendFutures.push_back(RPC().callRPC<dto::PlogAppendRequest, dto::PlogAppendResponse>(dto::Verbs::PERSISTENT_APPEND, request, *endpoints[f], _plog_timeout())
+            .then_wrapped([this, group, f, start=Clock::now()] (auto&& fut) {
+                if (fut.failed()) {
+                    K2LOG_W_EXC(log::plogcl, fut.get_exception(), "append to plog server {} failed", _persistenceMapEndpoints[_persistenceNameList[group]][f]->url);
+                    return std::make_tuple(Statuses::S503_Service_Unavailable("plog server unavailable"), dto::PlogAppendResponse{});
+                }
+                _replicaStats[group][f].add(Clock::now() - start);
+                return fut.get0();
+            }));
+    }
+
+    return seastar::when_all_succeed(appendFutures.begin(), appendFutures.end())
+        .then([expectedServerOffset, expected_offset=offset + stripes * striping.stripeSize()](std::vector<std::tuple<Status, dto::PlogAppendResponse> >&& results) {
+            Status return_status;
+            for (auto& result: results){
+                auto& [status, response] = result;
+                return_status = std::move(status);
+                if (!return_status.is2xxOK())
+                    break;
+                if (response.newOffset != expectedServerOffset){
+                    K2LOG_W(log::plogcl, "fragment offset {} differs from expected offset {}", response.newOffset, expectedServerOffset);
+                    return_status = Statuses::S500_Internal_Server_Error("offset inconsistent");
+                    break;
+                }
+            }
+            return seastar::make_ready_future<std::tuple<Status, uint32_t> >(std::tuple<Status, uint32_t>(std::move(return_status), expected_offset));
+        });
+}
+
+seastar::future<std::vector<std::tuple<Status, dto::PlogReadResponse>>>
+PlogClient::_readFragments(uint32_t group, const dto::PlogReadRequest& request, uint32_t begin, uint32_t end) {
+    auto& endpoints = _persistenceMapEndpoints[_persistenceNameList[group]];
+    std::vector<seastar::future<std::tuple<Status, dto::PlogReadResponse>>> readFutures;
+    for (uint32_t f = begin; f < end; ++f) {
+        readFutures.push_back(RPC().callRPC<dto::PlogReadRequest, dto::PlogReadResponse>(dto::Verbs::PERSISTENT_READ, request, *endpoints[f], _plog_timeout())
+            .then_wrapped([this, group, f, start=Clock::now()] (auto&& fut) {
+                if (fut.failed()) {
+                    K2LOG_W_EXC(log::plogcl, fut.get_exception(), "read from plog server {} failed", _persistenceMapEndpoints[_persistenceNameList[group]][f]->url);
+                    return std::make_tuple(Statuses::S503_Service_Unavailable("plog server unavailable"), dto::PlogReadResponse{});
+                }
+                _replicaStats[group][f].add(Clock::now() - start);
+                return fut.get0();
+            }));
+    }
+    return seastar::when_all_succeed(readFutures.begin(), readFutures.end());
+}
+
+seastar::future<std::tuple<Status, Payload>>
+PlogClient::_readStriped(uint32_t group, String plogId, uint32_t offset, uint32_t size) {
+    auto& striping = *_striping[group];
+    uint32_t k = striping.code.dataFragments();
+    uint32_t m = striping.code.parityFragments();
+    uint32_t stripeSize = striping.stripeSize();
+    // we read whole stripes, so that the parity can rebuild any of them
+    uint32_t firstStripe = offset / stripeSize;
+    uint32_t endStripe = (offset + size + stripeSize - 1) / stripeSize;
+    uint32_t fragmentSize = (endStripe - firstStripe) * striping.cellSize;
+    dto::PlogReadRequest request{.plogId = std::move(plogId), .offset=firstStripe * striping.cellSize, .size=fragmentSize};
+
+    struct StripedRead {
+        std::vector<Binary> fragments;
+        Status status = Statuses::S200_OK("read success");
+        bool missing = false;
+    };
+    auto state = seastar::make_lw_shared<StripedRead>();
+    state->fragments.resize(k + m);
+    // keep the fragments which came back, and the status to report if we can't rebuild the rest
+    auto collect = [state, fragmentSize] (uint32_t begin, auto&& results) {
+        for (uint32_t i = 0; i < results.size(); ++i) {
+            auto& [status, response] = results[i];
+            if (status.is2xxOK() && response.payload.getSize() == fragmentSize) {
+                Binary fragment(fragmentSize);
+                response.payload.seek(0);
+                response.payload.read(fragment, fragmentSize);
+                state->fragments[begin + i] = std::move(fragment);
+                continue;
+            }
+            if (!status.is2xxOK() && status.code < 500) {
+                // e.g. reading past the end of the plog, which all servers would agree on
+                state->status = std::move(status);
+            }
+            else if (state->status.is2xxOK()) {
+                state->status = status.is2xxOK() ? Statuses::S500_Internal_Server_Error("fragment size inconsistent") : std::move(status);
+            }
+            if (begin + i < k) {
+                state->missing = true;
+            }
+        }
+    };
+
+    return _readFragments(group, request, 0, k)
+    .then([this, group, request, state, collect, k, m] (auto&& results) mutable {
+        collect(0, results);
+        bool serverError = !state->status.is2xxOK() && state->status.code >= 500;
+        if (!state->missing || !serverError || m == 0) {
+            return seastar::make_ready_future();
+        }
+        K2LOG_D(log::plogcl, "rebuilding read of {} from the parity fragments", request);
+        return _readFragments(group, request, k, k + m)
+        .then([state, collect, k] (auto&& results) mutable {
+            collect(k, results);
+        });
+    })
+    .then([state, k, m, offset, size, fragmentSize, firstStripe, cellSize=striping.cellSize, &code=striping.code] {
+        if (state->missing) {
+            if (state->status.code < 500) {
+                return std::make_tuple(std::move(state->status), Payload());
+            }
+            std::vector<const uint8_t*> fragments;
+            std::vector<uint8_t*> rebuilt;
+            for (uint32_t f = 0; f < k + m; ++f) {
+                fragments.push_back(state->fragments[f].size() > 0 ? (const uint8_t*)state->fragments[f].get() : nullptr);
+                if (f < k) {
+                    if (state->fragments[f].size() == 0) {
+                        state->fragments[f] = Binary(fragmentSize);
+                    }
+                    rebuilt.push_back((uint8_t*)state->fragments[f].get_write());
+                }
+            }
+            if (!code.decode(fragments, rebuilt, fragmentSize)) {
+                K2LOG_W(log::plogcl, "too many fragments are missing to rebuild the read: {}", state->status);
+                return std::make_tuple(std::move(state->status), Payload());
+            }
+        }
+
+        // assemble the requested range from the cells of the stripes
+        Binary result(size);
+        uint32_t stripeSize = k * cellSize;
+        for (uint32_t pos = offset; pos < offset + size;) {
+            uint32_t stripe = pos / stripeSize;
+            uint32_t fragment = (pos % stripeSize) / cellSize;
+            uint32_t inCell = pos % cellSize;
+            uint32_t n = std::min(cellSize - inCell, offset + size - pos);
+            std::memcpy(result.get_write() + (pos - offset),
+                        state->fragments[fragment].get() + (stripe - firstStripe) * cellSize + inCell, n);
+            pos += n;
+        }
+        std::vector<Binary> buffers;
+        buffers.push_back(std::move(result));
+        return std::make_tuple(Statuses::S200_OK("read success"), Payload(std::move(buffers), size));
+    });
+}
+
+void PlogClient::ReplicaStats::add(Duration sample) {
+    latency = latency.count() == 0 ? sample : (latency * 7 + sample) / 8;
+    if (samples.size() < MAX_SAMPLES) {
+        samples.push_back(sample);
+    }
+    else {
+        samples[nextSample] = sample;
+    }
+    nextSample = (nextSample + 1) % MAX_SAMPLES;
+}
+
+Duration PlogClient::ReplicaStats::p99() const {
+    if (samples.empty()) {
+        return Duration(0);
+    }
+    auto sorted = samples;
+    auto nth = sorted.begin() + (sorted.size() * 99) / 100;
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    return *nth;
+}
+
 seastar::future<std::tuple<Status, uint32_t>> PlogClient::seal(String plogId, uint32_t offset){
-    dto::PlogSealRequest request{.plogId = std::move(plogId), .truncateOffset=offset};
+    return _seal(_persistenceMapPointer, std::move(plogId), offset);
+}
+
+seastar::future<std::tuple<Status, uint32_t>> PlogClient::_seal(uint32_t group, String plogId, uint32_t offset){
+    // the servers of an erasure-coded group each hold 1/k of the plog offsets
+    uint32_t scale = _striping[group] ? _striping[group]->code.dataFragments() : 1;
+    dto::PlogSealRequest request{.plogId = std::move(plogId), .truncateOffset=offset / scale};
 
     std::vector<seastar::future<std::tuple<Status, dto::PlogSealResponse> > > sealFutures;
-    for (auto& ep:_persistenceMapEndpoints[_persistenceNameList[_persistenceMapPointer]]){
+    for (auto& ep:_persistenceMapEndpoints[_persistenceNameList[group]]){
         sealFutures.push_back(RPC().callRPC<dto::PlogSealRequest, dto::PlogSealResponse>(dto::Verbs::PERSISTENT_SEAL, request, *ep, _plog_timeout()));
     }
 
     return seastar::when_all_succeed(sealFutures.begin(), sealFutures.end())
-        .then([this](std::vector<std::tuple<Status, dto::PlogSealResponse> >&& results) {
+        .then([this, scale](std::vector<std::tuple<Status, dto::PlogSealResponse> >&& results) {
             Status return_status;
             uint32_t sealed_offset;
             for (auto& result: results){
                 auto& [status, response] = result;
                 return_status = std::move(status);
-                sealed_offset = response.sealedOffset;
+                sealed_offset = response.sealedOffset * scale;
                 if (!return_status.is2xxOK())
                     break;
             }
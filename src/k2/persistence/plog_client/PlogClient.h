@@ -25,6 +25,8 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <k2/transport/PayloadSerialization.h>
 #include <seastar/core/sharded.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/timer.hh>
 #include <k2/transport/Payload.h>
 #include <k2/transport/Status.h>
 #include <k2/dto/Persistence.h>
@@ -36,6 +38,11 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/appbase/AppEssentials.h>
 #include <k2/appbase/Appbase.h>
 
+#include <deque>
+#include <optional>
+
+#include "ErasureCode.h"
+
 
 namespace k2 {
 namespace log {
@@ -54,17 +61,29 @@ public:
 
     // create a plog with retry times
     // TODO: revise this method, making this retry as an internal config variable instead of parameter.
+    // With plog_pool_size set, the plog is taken from a pool of plogs created ahead of time in the background
     seastar::future<std::tuple<Status, String>> create(uint8_t retries = 1);
 
     // append a payload into a plog at the given offset
     seastar::future<std::tuple<Status, uint32_t>> append(String plogId, uint32_t offset, Payload payload);
 
-    // read a payload
+    // The number of plog offsets an append of the given size takes up. This is the size itself, except in
+    // erasure-coded groups where each append starts a new stripe, so the append is padded to whole stripes
+    uint32_t appendedSize(uint32_t size) const;
+
+    // read a payload. The read goes to the replica with the lowest recent latency, and is hedged to the next fastest
+    // replica if no response arrives within that replica's recent p99 latency.
+    // In an erasure-coded group, the read goes to the servers holding the data cells, and is rebuilt from the
+    // parity servers only if some of these fail. A read across appends there also returns their padding
     seastar::future<std::tuple<Status, Payload>> read(String plogId, uint32_t offset, uint32_t size);
 
     // seal a payload
     seastar::future<std::tuple<Status, uint32_t>> seal(String plogId, uint32_t offset);
 
+    // release the pooled plogs and wait for the background plog creations. Must be called before the client
+    // is destroyed when the pool is enabled
+    seastar::future<> close();
+
 private:
     dto::PersistenceCluster _persistenceCluster; // the current persistence cluster the client holds
     std::unordered_map<String, std::vector<std::unique_ptr<TXEndpoint>>> _persistenceMapEndpoints; // the map of persistence group name and plog server endpoints
@@ -72,6 +91,74 @@ private:
     std::vector<String> _persistenceNameList; // a list to store all the names of persistence groups in current persistence cluster
     uint32_t _persistenceMapPointer; // indicate the current used persistence group
 
+    // recent latencies of a plog server, used to pick the replica to read from and when to hedge the read
+    struct ReplicaStats {
+        static constexpr size_t MAX_SAMPLES = 64;
+        // moving average of the response time
+        Duration latency{0};
+        // ring of the most recent response times
+        std::vector<Duration> samples;
+        size_t nextSample = 0;
+
+        void add(Duration sample);
+        // the 99th percentile of the recent samples, or 0 if we have none
+        Duration p99() const;
+    };
+    std::vector<std::vector<ReplicaStats>> _replicaStats; // indexed like _persistenceNameList, then like the endpoints
+
+    // state shared by the attempts of a single hedged read
+    struct ReadState {
+        dto::PlogReadRequest request;
+        // replicas in the order in which they should be tried
+        std::vector<size_t> order;
+        size_t next = 0;
+        size_t outstanding = 0;
+        bool done = false;
+        Status lastStatus;
+        seastar::promise<std::tuple<Status, Payload>> result;
+        seastar::timer<> hedgeTimer;
+    };
+
+    // send the read to the next replica in the order
+    void _sendRead(seastar::lw_shared_ptr<ReadState> state, uint32_t group);
+
+    // the layout of an erasure-coded group. A stripe is one cell on each of the data servers, and plog offset
+    // o of the stripes lives at offset o / dataFragments of the servers
+    struct Striping {
+        ErasureCode code;
+        uint32_t cellSize;
+        uint32_t stripeSize() const { return code.dataFragments() * cellSize; }
+    };
+    std::vector<std::optional<Striping>> _striping; // indexed like _persistenceNameList
+
+    seastar::future<std::tuple<Status, uint32_t>> _appendStriped(uint32_t group, String plogId, uint32_t offset, Payload payload);
+    seastar::future<std::tuple<Status, Payload>> _readStriped(uint32_t group, String plogId, uint32_t offset, uint32_t size);
+
+    // read the given fragments of a stripe range. Failures are reported as 503 statuses
+    seastar::future<std::vector<std::tuple<Status, dto::PlogReadResponse>>>
+    _readFragments(uint32_t group, const dto::PlogReadRequest& request, uint32_t begin, uint32_t end);
+
+    // Plogs created ahead of time. create() takes one and starts creating its replacement, so that plog rollover
+    // in RollingPlog never waits for the plog servers. When create() isn't called for plog_pool_idle_timeout,
+    // the pooled plogs are sealed empty and the pool stays empty until the next create()
+    struct PlogPool {
+        std::deque<String> plogIds;
+        bool refilling = false;
+    };
+    std::vector<PlogPool> _pools; // indexed like _persistenceNameList
+    seastar::gate _background;
+    seastar::timer<> _idleTimer;
+
+    // create plogs in the background until the pool of the group is full
+    void _refill(uint32_t group);
+    // seal the pooled plogs of the group
+    seastar::future<> _releasePool(uint32_t group);
+    // seal the pooled plogs of all groups, in the background
+    void _releaseIdle();
+
+    seastar::future<std::tuple<Status, String>> _create(uint32_t group, uint8_t retries);
+    seastar::future<std::tuple<Status, uint32_t>> _seal(uint32_t group, String plogId, uint32_t offset);
+
     CPOClient _cpo;
 
     // generate the plog id
@@ -86,7 +173,12 @@ private:
 
     ConfigDuration _cpo_timeout {"cpo_timeout", 1s};
     ConfigDuration _plog_timeout{"plog_timeout", 100ms};
+    // reads are never hedged sooner than this, regardless of how fast the replicas have been
+    ConfigDuration _plog_read_hedge_min_delay{"plog_read_hedge_min_delay", 200us};
     ConfigVar<String> _cpo_url{"cpo_url", ""};
+    // the number of plogs to keep created ahead of time in the current persistence group. 0 disables the pool
+    ConfigVar<uint32_t> _plog_pool_size{"plog_pool_size", 0};
+    ConfigDuration _plog_pool_idle_timeout{"plog_pool_idle_timeout", 10s};
 
 };
 
@@ -0,0 +1,152 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "RollingPlog.h"
+
+namespace k2 {
+
+RollingPlog::RollingPlog(PlogClient& client): _client(client) {
+}
+
+seastar::future<> RollingPlog::init() {
+    _active = _newSegment();
+    _spare = _newSegment();
+    return _active->id.get_future().then([] (auto&& result) {
+        auto& status = std::get<0>(result);
+        if (!status.is2xxOK()) {
+            K2LOG_E(log::plogcl, "unable to create the first plog of the log: {}", status);
+            return seastar::make_exception_future(std::runtime_error("unable to create plog"));
+        }
+        return seastar::make_ready_future();
+    });
+}
+
+seastar::lw_shared_ptr<RollingPlog::Segment> RollingPlog::_newSegment() {
+    auto segment = seastar::make_lw_shared<Segment>();
+    auto fut = seastar::with_gate(_background, [this] {
+        return _client.create();
+    })
+    .then_wrapped([segment] (auto&& fut) {
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::plogcl, fut.get_exception(), "failed to create plog");
+            segment->failed = true;
+            return std::make_tuple(Statuses::S503_Service_Unavailable("unable to create plog"), String());
+        }
+        auto result = fut.get0();
+        if (!std::get<0>(result).is2xxOK()) {
+            K2LOG_W(log::plogcl, "failed to create plog: {}", std::get<0>(result));
+            segment->failed = true;
+        }
+        return result;
+    });
+    segment->id = seastar::shared_future<std::tuple<Status, String>>(std::move(fut));
+    return segment;
+}
+
+void RollingPlog::_roll() {
+    auto previous = std::move(_active);
+    _active = std::move(_spare);
+    _spare = _newSegment();
+    (void) seastar::with_gate(_background, [this, previous=std::move(previous)] {
+        return _seal(std::move(previous));
+    });
+}
+
+seastar::future<> RollingPlog::_seal(seastar::lw_shared_ptr<Segment> segment) {
+    // the server rejects appends to a sealed plog, so wait for the ones in flight
+    return segment->appends.close()
+    .then([segment] {
+        return segment->id.get_future();
+    })
+    .then([this, segment] (auto&& result) {
+        if (segment->failed) {
+            return seastar::make_ready_future();
+        }
+        auto& plogId = std::get<1>(result);
+        return _client.seal(plogId, segment->offset)
+        .then([plogId] (auto&& result) {
+            auto& status = std::get<0>(result);
+            if (!status.is2xxOK()) {
+                K2LOG_W(log::plogcl, "failed to seal plog {}: {}", plogId, status);
+            }
+        });
+    })
+    .handle_exception([] (auto exc) {
+        K2LOG_W_EXC(log::plogcl, exc, "failed to seal plog");
+    });
+}
+
+seastar::future<std::tuple<Status, RollingPlog::Position>> RollingPlog::append(Payload payload) {
+    // the plog offsets the payload takes up, which include the stripe padding in erasure-coded groups
+    if (!_active) {
+        // closed, or never initialized
+        return seastar::make_ready_future<std::tuple<Status, Position>>(
+            std::make_tuple(Statuses::S410_Gone("the log is closed"), Position{}));
+    }
+    uint32_t size = _client.appendedSize(payload.getSize());
+    if (size > _plogMaxSize()) {
+        return seastar::make_ready_future<std::tuple<Status, Position>>(
+            std::make_tuple(Statuses::S413_Payload_Too_Large("append exceeds the plog size"), Position{}));
+    }
+    if (_active->failed || _active->broken || _active->offset + size > _plogMaxSize()) {
+        _roll();
+    }
+    // reserve our spot in the active plog right away, so that concurrent appends get consecutive offsets
+    auto segment = _active;
+    uint32_t offset = segment->offset;
+    segment->offset += size;
+
+    return seastar::with_gate(segment->appends, [this, segment, offset, payload=std::move(payload)] () mutable {
+        return segment->id.get_future()
+        .then([this, segment, offset, payload=std::move(payload)] (auto&& result) mutable {
+            auto& status = std::get<0>(result);
+            if (!status.is2xxOK()) {
+                return seastar::make_ready_future<std::tuple<Status, Position>>(std::make_tuple(std::move(status), Position{}));
+            }
+            auto plogId = std::get<1>(result);
+            return _client.append(plogId, offset, std::move(payload))
+            .then([segment, plogId, offset] (auto&& result) mutable {
+                auto& status = std::get<0>(result);
+                if (!status.is2xxOK()) {
+                    segment->broken = true;
+                }
+                return std::make_tuple(std::move(status), Position{.plogId=std::move(plogId), .offset=offset});
+            });
+        });
+    });
+}
+
+seastar::future<> RollingPlog::close() {
+    if (!_active) {
+        return seastar::make_ready_future();
+    }
+    // the spare is sealed empty so that it can't be appended to later
+    auto active = std::move(_active);
+    auto spare = std::move(_spare);
+    return seastar::when_all_succeed(_seal(std::move(active)), _seal(std::move(spare))).discard_result()
+    .then([this] {
+        return _background.close();
+    });
+}
+
+} // namespace k2
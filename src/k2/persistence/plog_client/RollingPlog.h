@@ -0,0 +1,96 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <seastar/core/gate.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include <k2/common/Common.h>
+#include <k2/config/Config.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/Status.h>
+
+#include "PlogClient.h"
+
+namespace k2 {
+
+// A log of unbounded size on top of fixed-size plogs.
+// Appends go to the active plog until it is full, at which point the log rolls over to the next plog and seals the
+// previous one in the background. The next plog is always created ahead of time, so appends don't wait for plog
+// creation unless they outrun it.
+// Appends to the active plog are sent as soon as they are issued, without waiting for previous appends to complete.
+class RollingPlog {
+public:
+    // where an appended payload was written
+    struct Position {
+        String plogId;
+        uint32_t offset = 0;
+        K2_DEF_FMT(Position, plogId, offset);
+    };
+
+    RollingPlog(PlogClient& client);
+
+    // creates the active plog and starts creating the next one
+    seastar::future<> init();
+
+    // append the payload at the end of the log. Fails with S410_Gone once the log is closed
+    seastar::future<std::tuple<Status, Position>> append(Payload payload);
+
+    // wait for all outstanding appends and seal all plogs of this log
+    seastar::future<> close();
+
+private:
+    struct Segment {
+        // resolves with the status of the plog creation and the plog id
+        seastar::shared_future<std::tuple<Status, String>> id;
+        // the offset at which the next append goes
+        uint32_t offset = 0;
+        // set once the plog creation failed. Such a segment is skipped
+        bool failed = false;
+        // set once an append failed. The later offsets of the plog can't be written, so we move to the next plog
+        bool broken = false;
+        // tracks the appends sent to this plog, which must all land before we can seal it
+        seastar::gate appends;
+    };
+
+    // start creating a new plog
+    seastar::lw_shared_ptr<Segment> _newSegment();
+
+    // make the spare segment the active one and seal the previous active segment in the background
+    void _roll();
+
+    // seal the given segment once all of its appends complete
+    seastar::future<> _seal(seastar::lw_shared_ptr<Segment> segment);
+
+    PlogClient& _client;
+    seastar::lw_shared_ptr<Segment> _active;
+    seastar::lw_shared_ptr<Segment> _spare;
+    // keeps track of plog creations and seals
+    seastar::gate _background;
+
+    ConfigVar<uint32_t> _plogMaxSize{"plog_max_size", 2 * 1024 * 1024};
+};
+
+} // namespace k2
@@ -0,0 +1,379 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "PlogDiskStore.h"
+
+#include <boost/range/irange.hpp>
+#include <seastar/core/align.hh>
+#include <seastar/core/fstream.hh>
+#include <seastar/core/seastar.hh>
+
+#include <k2/appbase/AppEssentials.h>
+
+namespace k2 {
+namespace log {
+inline thread_local k2::logging::Logger plogdisk("k2::plog_disk_store");
+}
+
+namespace {
+// Extent header layout. A header without the magic marks a free extent
+constexpr uint32_t EXTENT_MAGIC = 0x504c4f47;  // "PLOG"
+struct ExtentHeader {
+    uint32_t magic;
+    uint32_t sealed;
+    uint32_t offset;
+    uint32_t idSize;
+    uint32_t plogMaxSize;
+};
+constexpr size_t MAX_PLOG_ID_SIZE = PlogDiskStore::DMA_ALIGNMENT - sizeof(ExtentHeader);
+
+Binary _alignedBuffer(size_t size) {
+    auto buf = Binary::aligned(PlogDiskStore::DMA_ALIGNMENT, size);
+    std::memset(buf.get_write(), 0, size);
+    return buf;
+}
+}
+
+PlogDiskStore::PlogDiskStore(String fileName, uint32_t plogMaxSize, uint64_t preallocatedExtents):
+    _fileName(std::move(fileName)),
+    _plogMaxSize(plogMaxSize),
+    _extentSize(DMA_ALIGNMENT + seastar::align_up<uint64_t>(plogMaxSize, DMA_ALIGNMENT)),
+    _preallocatedExtents(std::max<uint64_t>(preallocatedExtents, 1)) {
+}
+
+seastar::future<> PlogDiskStore::open() {
+    K2LOG_I(log::plogdisk, "opening plog store {}", _fileName);
+    return seastar::open_file_dma(_fileName, seastar::open_flags::rw | seastar::open_flags::create)
+    .then([this] (seastar::file&& file) {
+        _file = std::move(file);
+        _opened = true;
+        return _file.size();
+    })
+    .then([this] (uint64_t size) {
+        _extentCount = size / _extentSize;
+        return seastar::parallel_for_each(boost::irange<uint64_t>(0, _extentCount), [this] (uint64_t index) {
+            return _loadExtent(index);
+        });
+    })
+    .then([this] {
+        // hand out the lower extents first
+        std::sort(_freeExtents.begin(), _freeExtents.end(), std::greater<uint64_t>());
+        K2LOG_I(log::plogdisk, "loaded {} plogs from {} extents in {}", _plogs.size(), _extentCount, _fileName);
+        if (_freeExtents.empty()) {
+            return _grow();
+        }
+        return seastar::make_ready_future();
+    });
+}
+
+seastar::future<> PlogDiskStore::close() {
+    std::vector<seastar::future<>> futs;
+    for (auto& [id, extent] : _plogs) {
+        futs.push_back(std::move(extent->chain));
+    }
+    return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result()
+    .then([this] {
+        _plogs.clear();
+        if (!_opened) {
+            return seastar::make_ready_future();
+        }
+        _opened = false;
+        return _file.flush().then([this] { return _file.close(); });
+    });
+}
+
+seastar::future<> PlogDiskStore::_loadExtent(uint64_t index) {
+    return _file.dma_read_bulk<char>(_headerPosition(index), DMA_ALIGNMENT)
+    .then([this, index] (Binary&& buf) {
+        ExtentHeader header{};
+        if (buf.size() >= sizeof(header)) {
+            std::memcpy(&header, buf.get(), sizeof(header));
+        }
+        if (header.magic != EXTENT_MAGIC || header.idSize > MAX_PLOG_ID_SIZE) {
+            _freeExtents.push_back(index);
+            return seastar::make_ready_future();
+        }
+        if (header.plogMaxSize != _plogMaxSize || header.offset > _plogMaxSize) {
+            return seastar::make_exception_future(std::runtime_error(
+                fmt::format("plog store {} was created with plog size {}, but plog size {} is configured",
+                            _fileName, header.plogMaxSize, _plogMaxSize)));
+        }
+        auto extent = seastar::make_lw_shared<Extent>();
+        extent->index = index;
+        extent->plogId = String(buf.get() + sizeof(header), header.idSize);
+        extent->sealed = header.sealed;
+        extent->offset = header.offset;
+        extent->durableOffset = header.offset;
+        extent->tail = _alignedBuffer(DMA_ALIGNMENT);
+        _plogs[extent->plogId] = extent;
+
+        auto tailSize = extent->offset % DMA_ALIGNMENT;
+        if (tailSize == 0) {
+            return seastar::make_ready_future();
+        }
+        auto tailStart = seastar::align_down(extent->offset, DMA_ALIGNMENT);
+        return _file.dma_read_bulk<char>(_dataPosition(index) + tailStart, DMA_ALIGNMENT)
+        .then([extent, tailSize] (Binary&& data) {
+            if (data.size() < tailSize) {
+                throw std::runtime_error(fmt::format("unable to load tail of plog {}", extent->plogId));
+            }
+            std::memcpy(extent->tail.get_write(), data.get(), tailSize);
+        });
+    });
+}
+
+seastar::future<> PlogDiskStore::_grow() {
+    auto start = _extentCount * _extentSize;
+    auto length = _preallocatedExtents * _extentSize;
+    K2LOG_I(log::plogdisk, "growing {} by {} extents", _fileName, _preallocatedExtents);
+    // the new extents read as zeroes, which marks them as free
+    return _file.truncate(start + length)
+    .then([this, start, length] {
+        return _file.allocate(start, length);
+    })
+    .then([this] {
+        return _file.flush();
+    })
+    .then([this] {
+        auto newCount = _extentCount + _preallocatedExtents;
+        for (auto index = newCount; index > _extentCount; --index) {
+            _freeExtents.push_back(index - 1);
+        }
+        _extentCount = newCount;
+    });
+}
+
+seastar::future<uint64_t> PlogDiskStore::_allocateExtent() {
+    if (!_freeExtents.empty()) {
+        auto index = _freeExtents.back();
+        _freeExtents.pop_back();
+        return seastar::make_ready_future<uint64_t>(index);
+    }
+    return seastar::with_semaphore(_growLock, 1, [this] {
+        // someone else may have grown the file while we waited
+        return _freeExtents.empty() ? _grow() : seastar::make_ready_future();
+    })
+    .then([this] {
+        return _allocateExtent();
+    });
+}
+
+seastar::future<> PlogDiskStore::_writeHeader(Extent& extent, uint32_t offset) {
+    auto buf = _alignedBuffer(DMA_ALIGNMENT);
+    ExtentHeader header{.magic=EXTENT_MAGIC, .sealed=extent.sealed, .offset=offset, .idSize=(uint32_t)extent.plogId.size(), .plogMaxSize=_plogMaxSize};
+    std::memcpy(buf.get_write(), &header, sizeof(header));
+    std::memcpy(buf.get_write() + sizeof(header), extent.plogId.data(), extent.plogId.size());
+    return seastar::do_with(std::move(buf), [this, &extent] (auto& buf) {
+        return _file.dma_write(_headerPosition(extent.index), buf.get(), buf.size())
+        .then([this, &buf] (size_t written) {
+            if (written != buf.size()) {
+                throw std::runtime_error("short write of plog header");
+            }
+            return _file.flush();
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::PlogCreateResponse>>
+PlogDiskStore::create(dto::PlogCreateRequest&& request) {
+    if (request.plogId.size() > MAX_PLOG_ID_SIZE) {
+        return RPCResponse(Statuses::S400_Bad_Request("plog id too long"), dto::PlogCreateResponse());
+    }
+    if (_plogs.find(request.plogId) != _plogs.end()) {
+        return RPCResponse(Statuses::S409_Conflict("plog id already exists"), dto::PlogCreateResponse());
+    }
+    // reserve the id right away so that concurrent creates of the same id conflict
+    auto extent = seastar::make_lw_shared<Extent>();
+    extent->plogId = request.plogId;
+    extent->tail = _alignedBuffer(DMA_ALIGNMENT);
+    _plogs[extent->plogId] = extent;
+
+    return _allocateExtent()
+    .then([this, extent] (uint64_t index) {
+        extent->index = index;
+        return _writeHeader(*extent, 0)
+        .handle_exception([this, extent, index] (auto exc) {
+            _freeExtents.push_back(index);
+            return seastar::make_exception_future(exc);
+        });
+    })
+    .then_wrapped([this, extent] (auto&& fut) {
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::plogdisk, fut.get_exception(), "failed to create plog {}", extent->plogId);
+            _plogs.erase(extent->plogId);
+            return RPCResponse(Statuses::S500_Internal_Server_Error("unable to create plog"), dto::PlogCreateResponse());
+        }
+        return RPCResponse(Statuses::S201_Created("plog created"), dto::PlogCreateResponse());
+    });
+}
+
+seastar::future<std::tuple<Status, dto::PlogAppendResponse>>
+PlogDiskStore::append(dto::PlogAppendRequest&& request) {
+    auto iter = _plogs.find(request.plogId);
+    if (iter == _plogs.end()) {
+        return RPCResponse(Statuses::S404_Not_Found("plog does not exist"), dto::PlogAppendResponse());
+    }
+    auto extent = iter->second;
+    if (extent->broken) {
+        return RPCResponse(Statuses::S500_Internal_Server_Error("plog failed a previous append"), dto::PlogAppendResponse());
+    }
+    if (extent->sealed) {
+        return RPCResponse(Statuses::S409_Conflict("plog is sealed"), dto::PlogAppendResponse());
+    }
+    if (extent->offset != request.offset) {
+        return RPCResponse(Statuses::S403_Forbidden("offset inconsistent"), dto::PlogAppendResponse());
+    }
+    auto size = request.payload.getSize();
+    if (extent->offset + size > _plogMaxSize) {
+        return RPCResponse(Statuses::S413_Payload_Too_Large("exceeds pLog limit"), dto::PlogAppendResponse());
+    }
+
+    // Build an aligned buffer which starts with the current tail block, followed by the appended data.
+    // This is the only copy of the data on the write path
+    uint32_t blockStart = seastar::align_down(extent->offset, DMA_ALIGNMENT);
+    uint32_t tailSize = extent->offset - blockStart;
+    uint32_t newOffset = extent->offset + size;
+    auto buf = _alignedBuffer(seastar::align_up(newOffset, DMA_ALIGNMENT) - blockStart);
+    std::memcpy(buf.get_write(), extent->tail.get(), tailSize);
+    request.payload.seek(0);
+    request.payload.read(buf.get_write() + tailSize, size);
+
+    // the last partial block becomes the new tail
+    std::memset(extent->tail.get_write(), 0, DMA_ALIGNMENT);
+    if (auto newTailSize = newOffset % DMA_ALIGNMENT; newTailSize > 0) {
+        std::memcpy(extent->tail.get_write(), buf.get() + buf.size() - DMA_ALIGNMENT, newTailSize);
+    }
+    extent->offset = newOffset;
+
+    seastar::promise<Status> done;
+    auto result = done.get_future();
+    extent->chain = extent->chain.then([this, extent, blockStart, newOffset, buf=std::move(buf), done=std::move(done)] () mutable {
+        if (extent->broken) {
+            // an append ahead of us failed, and our data follows the range it left undefined
+            done.set_value(Statuses::S500_Internal_Server_Error("plog failed a previous append"));
+            return seastar::make_ready_future();
+        }
+        return seastar::do_with(std::move(buf), [this, extent, blockStart, newOffset] (auto& buf) {
+            return _file.dma_write(_dataPosition(extent->index) + blockStart, buf.get(), buf.size())
+            .then([this, extent, newOffset, &buf] (size_t written) {
+                if (written != buf.size()) {
+                    throw std::runtime_error("short write of plog data");
+                }
+                return _writeHeader(*extent, newOffset);
+            });
+        })
+        .then_wrapped([extent, newOffset, done=std::move(done)] (auto&& fut) mutable {
+            if (fut.failed()) {
+                // we don't know what made it to disk past the durable offset, so no further appends are allowed
+                K2LOG_W_EXC(log::plogdisk, fut.get_exception(), "failed to append to plog {}", extent->plogId);
+                extent->broken = true;
+                extent->sealed = true;
+                extent->offset = extent->durableOffset;
+                done.set_value(Statuses::S500_Internal_Server_Error("unable to append to plog"));
+                return;
+            }
+            extent->durableOffset = newOffset;
+            done.set_value(Statuses::S200_OK("append scuccess"));
+        });
+    });
+
+    return result.then([newOffset] (Status&& status) {
+        return RPCResponse(std::move(status), dto::PlogAppendResponse{.newOffset=newOffset});
+    });
+}
+
+seastar::future<std::tuple<Status, dto::PlogReadResponse>>
+PlogDiskStore::read(dto::PlogReadRequest&& request) {
+    auto iter = _plogs.find(request.plogId);
+    if (iter == _plogs.end()) {
+        return RPCResponse(Statuses::S404_Not_Found("plog does not exist"), dto::PlogReadResponse());
+    }
+    auto extent = iter->second;
+    if (extent->durableOffset < request.offset + request.size) {
+        return RPCResponse(Statuses::S413_Payload_Too_Large("exceed the maximun length"), dto::PlogReadResponse());
+    }
+    if (request.size == 0) {
+        return RPCResponse(Statuses::S200_OK("read success"), dto::PlogReadResponse{.payload=Payload()});
+    }
+
+    uint64_t blockStart = seastar::align_down(request.offset, DMA_ALIGNMENT);
+    uint64_t blockEnd = seastar::align_up(request.offset + request.size, DMA_ALIGNMENT);
+    return _file.dma_read_bulk<char>(_dataPosition(extent->index) + blockStart, blockEnd - blockStart)
+    .then_wrapped([extent, blockStart, offset=request.offset, size=request.size] (auto&& fut) {
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::plogdisk, fut.get_exception(), "failed to read plog {}", extent->plogId);
+            return RPCResponse(Statuses::S500_Internal_Server_Error("unable to read plog"), dto::PlogReadResponse());
+        }
+        auto buf = fut.get0();
+        if (buf.size() < offset - blockStart + size) {
+            return RPCResponse(Statuses::S500_Internal_Server_Error("short read of plog"), dto::PlogReadResponse());
+        }
+        // the response shares the DMA buffer rather than copying out of it
+        dto::PlogReadResponse response{.payload=Payload()};
+        response.payload.appendBinary(buf.share(offset - blockStart, size));
+        return RPCResponse(Statuses::S200_OK("read success"), std::move(response));
+    });
+}
+
+seastar::future<std::tuple<Status, dto::PlogSealResponse>>
+PlogDiskStore::seal(dto::PlogSealRequest&& request) {
+    auto iter = _plogs.find(request.plogId);
+    if (iter == _plogs.end()) {
+        return RPCResponse(Statuses::S404_Not_Found("plog does not exist"), dto::PlogSealResponse());
+    }
+    auto extent = iter->second;
+    bool wasSealed = extent->sealed;
+    // stop accepting appends right away. The seal itself is applied once the pending appends are written
+    extent->sealed = true;
+
+    seastar::promise<std::tuple<Status, dto::PlogSealResponse>> done;
+    auto result = done.get_future();
+    extent->chain = extent->chain.then([this, extent, wasSealed, truncateOffset=request.truncateOffset, done=std::move(done)] () mutable {
+        dto::PlogSealResponse response{.sealedOffset=extent->offset};
+        if (wasSealed) {
+            auto status = (truncateOffset == extent->offset) ?
+                Statuses::S200_OK("sealed success") : Statuses::S409_Conflict("plog already sealed");
+            done.set_value(std::make_tuple(std::move(status), std::move(response)));
+            return seastar::make_ready_future();
+        }
+        auto status = Statuses::S200_OK("sealed offset inconsistent");
+        if (extent->offset >= truncateOffset) {
+            extent->offset = truncateOffset;
+            extent->durableOffset = std::min(extent->durableOffset, truncateOffset);
+            response.sealedOffset = truncateOffset;
+            status = Statuses::S200_OK("sealed success");
+        }
+        return _writeHeader(*extent, extent->offset)
+        .then_wrapped([extent, status=std::move(status), response=std::move(response), done=std::move(done)] (auto&& fut) mutable {
+            if (fut.failed()) {
+                K2LOG_W_EXC(log::plogdisk, fut.get_exception(), "failed to seal plog {}", extent->plogId);
+                done.set_value(std::make_tuple(Statuses::S500_Internal_Server_Error("unable to seal plog"), std::move(response)));
+                return;
+            }
+            done.set_value(std::make_tuple(std::move(status), std::move(response)));
+        });
+    });
+    return result;
+}
+
+} // namespace k2
@@ -0,0 +1,112 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <seastar/core/file.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include <k2/common/Common.h>
+#include <k2/dto/Persistence.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/Status.h>
+
+#ifdef EXPOSE_PRIVATES
+#define PRIVATE public
+#else
+#define PRIVATE private
+#endif
+
+namespace k2 {
+
+// Disk-backed storage for the plogs of a single shard.
+// All plogs of the shard live in one file, which is split into preallocated extents of fixed size:
+//      HEADER of size DMA_ALIGNMENT (plog id, sealed flag, committed offset, plog size)
+//      Data of size plogMaxSize, rounded up to DMA_ALIGNMENT
+// The file grows by preallocatedExtents extents whenever we run out of free extents. On start, the headers of all
+// extents are scanned to rebuild the plog map, so plogs survive a restart of the server. Since the layout depends
+// on the plog size, a store can only be reopened with the plog size it was created with.
+class PlogDiskStore {
+public:
+    static constexpr uint32_t DMA_ALIGNMENT = 4096;
+
+    PlogDiskStore(String fileName, uint32_t plogMaxSize, uint64_t preallocatedExtents);
+
+    // open(or create) the shard file and load the plogs stored in it
+    seastar::future<> open();
+    seastar::future<> close();
+
+    // These follow the semantics of the in-memory plog handlers of the PlogServer
+    seastar::future<std::tuple<Status, dto::PlogCreateResponse>> create(dto::PlogCreateRequest&& request);
+    seastar::future<std::tuple<Status, dto::PlogAppendResponse>> append(dto::PlogAppendRequest&& request);
+    seastar::future<std::tuple<Status, dto::PlogReadResponse>> read(dto::PlogReadRequest&& request);
+    seastar::future<std::tuple<Status, dto::PlogSealResponse>> seal(dto::PlogSealRequest&& request);
+
+PRIVATE:
+    struct Extent {
+        uint64_t index = 0;
+        String plogId;
+        bool sealed = false;
+        // set when a write fails. We don't know what made it to disk past durableOffset, so the appends queued
+        // behind the failed one and all later appends fail as well
+        bool broken = false;
+        // the offset including appends which are still being written. Used to validate new appends
+        uint32_t offset = 0;
+        // the offset up to which data is durable on disk. Only data below it can be read
+        uint32_t durableOffset = 0;
+        // the last partially filled block of the plog. Appends rewrite it since DMA writes must be aligned
+        Binary tail;
+        // writes to an extent are applied in order, since consecutive appends share the tail block
+        seastar::future<> chain = seastar::make_ready_future();
+    };
+
+    uint64_t _headerPosition(uint64_t index) const { return index * _extentSize; }
+    uint64_t _dataPosition(uint64_t index) const { return index * _extentSize + DMA_ALIGNMENT; }
+
+    // writes the header of the given extent and flushes the file
+    seastar::future<> _writeHeader(Extent& extent, uint32_t offset);
+
+    // loads the extent header at the given index into the plog map, or marks the extent as free
+    seastar::future<> _loadExtent(uint64_t index);
+
+    // extends the file by _preallocatedExtents extents and adds them to the free list
+    seastar::future<> _grow();
+
+    // obtain a free extent, growing the file if needed
+    seastar::future<uint64_t> _allocateExtent();
+
+    String _fileName;
+    uint32_t _plogMaxSize;
+    uint64_t _extentSize;
+    uint64_t _preallocatedExtents;
+    seastar::file _file;
+    bool _opened = false;
+    uint64_t _extentCount = 0;
+    std::unordered_map<String, seastar::lw_shared_ptr<Extent>> _plogs;
+    std::vector<uint64_t> _freeExtents;
+    // serializes file growth
+    seastar::semaphore _growLock{1};
+};
+
+} // namespace k2
@@ -35,6 +35,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/appbase/AppEssentials.h>
 #include <k2/appbase/Appbase.h>
 
+#include <filesystem>
 
 namespace k2 {
 
@@ -49,6 +50,9 @@ PlogServer::~PlogServer() {
 seastar::future<> PlogServer::gracefulStop() {
     K2LOG_I(log::plogsvr, "stop");
     _plogMap.clear();
+    if (_diskStore) {
+        return _diskStore->close();
+    }
     return seastar::make_ready_future<>();
 }
 
@@ -71,12 +75,25 @@ seastar::future<> PlogServer::start() {
     });
     _plogMap.clear();
 
-    return seastar::make_ready_future<>();
+    if (_dataDir().empty()) {
+        K2LOG_I(log::plogsvr, "No data directory configured. Plogs are kept in memory");
+        return seastar::make_ready_future<>();
+    }
+    std::filesystem::path dir{_dataDir()};
+    if (!std::filesystem::exists(dir)) {
+        std::filesystem::create_directories(dir);
+    }
+    _diskStore = std::make_unique<PlogDiskStore>(fmt::format("{}/shard_{}.plog", _dataDir(), seastar::this_shard_id()),
+                                                  _plogMaxSize(), _preallocatedExtents());
+    return _diskStore->open();
 }
 
 seastar::future<std::tuple<Status, dto::PlogCreateResponse>>
 PlogServer::_handleCreate(dto::PlogCreateRequest&& request){
     K2LOG_D(log::plogsvr, "Received create request for {}", request.plogId);
+    if (_diskStore) {
+        return _diskStore->create(std::move(request));
+    }
     auto iter = _plogMap.find(request.plogId);
     if (iter != _plogMap.end()) {
         return RPCResponse(Statuses::S409_Conflict("plog id already exists"), dto::PlogCreateResponse());
@@ -88,6 +105,9 @@ PlogServer::_handleCreate(dto::PlogCreateRequest&& request){
 seastar::future<std::tuple<Status, dto::PlogAppendResponse>>
 PlogServer::_handleAppend(dto::PlogAppendRequest&& request){
     K2LOG_D(log::plogsvr, "Received append request {}", request);
+    if (_diskStore) {
+        return _diskStore->append(std::move(request));
+    }
     auto iter = _plogMap.find(request.plogId);
     if (iter == _plogMap.end()) {
         return RPCResponse(Statuses::S404_Not_Found("plog does not exist"), dto::PlogAppendResponse());
@@ -98,7 +118,7 @@ PlogServer::_handleAppend(dto::PlogAppendRequest&& request){
     if (iter->second.offset != request.offset){
         return RPCResponse(Statuses::S403_Forbidden("offset inconsistent"), dto::PlogAppendResponse());
     }
-    if (iter->second.offset + request.payload.getSize() > PLOG_MAX_SIZE){
+    if (iter->second.offset + request.payload.getSize() > _plogMaxSize()){
          return RPCResponse(Statuses::S413_Payload_Too_Large("exceeds pLog limit"), dto::PlogAppendResponse());
     }
 
@@ -116,6 +136,9 @@ PlogServer::_handleAppend(dto::PlogAppendRequest&& request){
 seastar::future<std::tuple<Status, dto::PlogReadResponse>>
 PlogServer::_handleRead(dto::PlogReadRequest&& request){
     K2LOG_D(log::plogsvr, "Received read request for {}", request);
+    if (_diskStore) {
+        return _diskStore->read(std::move(request));
+    }
     auto iter = _plogMap.find(request.plogId);
     if (iter == _plogMap.end()) {
         return RPCResponse(Statuses::S404_Not_Found("plog does not exist"), dto::PlogReadResponse());
@@ -132,6 +155,9 @@ PlogServer::_handleRead(dto::PlogReadRequest&& request){
 seastar::future<std::tuple<Status, dto::PlogSealResponse>>
 PlogServer::_handleSeal(dto::PlogSealRequest&& request){
     K2LOG_D(log::plogsvr, "Received seal request for {}", request);
+    if (_diskStore) {
+        return _diskStore->seal(std::move(request));
+    }
     dto::PlogSealResponse response;
     auto iter = _plogMap.find(request.plogId);
     if (iter == _plogMap.end()) {
@@ -36,6 +36,8 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/transport/BaseTypes.h>
 #include <k2/transport/TXEndpoint.h>
 
+#include "PlogDiskStore.h"
+
 namespace k2
 {
 namespace log {
@@ -57,12 +59,20 @@ struct PlogPage {
 class PlogServer
 {
 private:
-    // the maximum size of each plog
-    const uint32_t PLOG_MAX_SIZE = 2 * 1024 * 1024;
+    // the maximum size of each plog. Offsets are 32-bit, so plogs can't grow past 4GB
+    ConfigVar<uint32_t> _plogMaxSize{"plog_max_size", 2 * 1024 * 1024};
 
     // a map to store all the plogs based on plog id
     std::unordered_map<String, PlogPage> _plogMap;
 
+    // When a data directory is configured, plogs are stored on disk in a per-shard file instead of _plogMap
+    ConfigVar<String> _dataDir{"plog_data_dir", ""};
+
+    // the number of plog extents by which the per-shard file is grown when it runs out of space
+    ConfigVar<uint64_t> _preallocatedExtents{"plog_preallocated_extents", 64};
+
+    std::unique_ptr<PlogDiskStore> _diskStore;
+
     //handle the create request
     seastar::future<std::tuple<Status, dto::PlogCreateResponse>>
     _handleCreate(dto::PlogCreateRequest&& request);
@@ -27,11 +27,13 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <k2/common/Log.h>
 #include <k2/transport/RPCDispatcher.h>  // for RPC
+#include <k2/persistence/plog/PlogMock.h>
 
 namespace k2 {
 
 PersistenceService::PersistenceService() {
     K2LOG_I(log::psvc, "ctor");
+    _flushTimer.set_callback([this] { _flush(); });
 }
 
 PersistenceService::~PersistenceService() {
@@ -40,18 +42,349 @@ PersistenceService::~PersistenceService() {
 
 seastar::future<> PersistenceService::gracefulStop() {
     K2LOG_I(log::psvc, "stop");
-    return seastar::make_ready_future();
+    _flushTimer.cancel();
+    // commit whatever is still staged before closing the volume
+    _flush();
+    return seastar::when_all_succeed(std::move(_flushChain), std::move(_checkpointChain)).discard_result()
+    .then([this] {
+        return seastar::when_all_succeed(
+            _volume ? _volume->close() : seastar::make_ready_future(),
+            _checkpointVolume ? _checkpointVolume->close() : seastar::make_ready_future()).discard_result();
+    });
 }
 
 seastar::future<> PersistenceService::start() {
-    K2LOG_I(log::psvc, "Registering message handlers");
-    RPC().registerRPCObserver<dto::K23SI_PersistenceRequest<Payload>, dto::K23SI_PersistenceResponse>
-    (dto::Verbs::K23SI_Persist, [this](dto::K23SI_PersistenceRequest<Payload>&& request) {
-        (void) request;
-        return RPCResponse(Statuses::S200_OK("persistence success"), dto::K23SI_PersistenceResponse{});
+    auto path = fmt::format("{}/shard_{}", _walPath(), seastar::this_shard_id());
+    K2LOG_I(log::psvc, "Creating WAL volume at {}", path);
+    return seastar::when_all_succeed(
+        PersistentVolume::create(std::make_shared<PlogMock>(path)),
+        PersistentVolume::create(std::make_shared<PlogMock>(path + "/checkpoints")))
+    .then([this](auto&& volumes) {
+        _volume = std::move(std::get<0>(volumes));
+        _checkpointVolume = std::move(std::get<1>(volumes));
+
+        K2LOG_I(log::psvc, "Registering message handlers");
+        RPC().registerRPCObserver<dto::K23SI_PersistenceRequest<Payload>, dto::K23SI_PersistenceResponse>
+        (dto::Verbs::K23SI_Persist, [this](dto::K23SI_PersistenceRequest<Payload>&& request) {
+            // frame the record with its source and size so that the WAL can be parsed back record by record
+            Payload record(Payload::DefaultAllocator);
+            record.write(request.source);
+            record.write(request.value.val);
+            _walSources.insert(std::move(request.source));
+            return _append(std::move(record))
+            .then_wrapped([](auto&& fut) {
+                if (fut.failed()) {
+                    K2LOG_W_EXC(log::psvc, fut.get_exception(), "failed to append to WAL");
+                    return RPCResponse(Statuses::S500_Internal_Server_Error("persistence failed"), dto::K23SI_PersistenceResponse{});
+                }
+                fut.ignore_ready_future();
+                return RPCResponse(Statuses::S200_OK("persistence success"), dto::K23SI_PersistenceResponse{});
+            });
+        });
+
+        RPC().registerRPCObserver<dto::K23SICheckpointBeginRequest, dto::K23SICheckpointBeginResponse>
+        (dto::Verbs::K23SI_CHECKPOINT_BEGIN, [this](dto::K23SICheckpointBeginRequest&& request) {
+            return _handleCheckpointBegin(std::move(request));
+        });
+
+        RPC().registerRPCObserver<dto::K23SICheckpointChunkRequest, dto::K23SICheckpointChunkResponse>
+        (dto::Verbs::K23SI_CHECKPOINT_CHUNK, [this](dto::K23SICheckpointChunkRequest&& request) {
+            return _handleCheckpointChunk(std::move(request));
+        });
+
+        RPC().registerRPCObserver<dto::K23SICheckpointEndRequest, dto::K23SICheckpointEndResponse>
+        (dto::Verbs::K23SI_CHECKPOINT_END, [this](dto::K23SICheckpointEndRequest&& request) {
+            return _handleCheckpointEnd(std::move(request));
+        });
+
+        RPC().registerRPCObserver<dto::K23SIRecoverCheckpointRequest, dto::K23SIRecoverCheckpointResponse>
+        (dto::Verbs::K23SI_RECOVER_CHECKPOINT, [this](dto::K23SIRecoverCheckpointRequest&& request) {
+            return _handleRecoverCheckpoint(std::move(request));
+        });
+
+        RPC().registerRPCObserver<dto::K23SIRecoverWALRequest, dto::K23SIRecoverWALResponse>
+        (dto::Verbs::K23SI_RECOVER_WAL, [this](dto::K23SIRecoverWALRequest&& request) {
+            return _handleRecoverWAL(std::move(request));
+        });
+    });
+}
+
+seastar::future<> PersistenceService::_append(Payload&& record) {
+    auto size = record.getSize();
+    // close the open group early if this record would push it over the byte budget
+    if (_pendingBytes > 0 && _pendingBytes + size > _groupCommitBytes()) {
+        _flushTimer.cancel();
+        _flush();
+    }
+
+    if (_pendingAcks.empty()) {
+        _pendingFirstLSN = _nextLSN;
+    }
+    _nextLSN++;
+    for (auto& buf : record.release()) {
+        _pendingBuffers.push_back(std::move(buf));
+    }
+    _pendingBytes += size;
+    _pendingAcks.emplace_back();
+    auto fut = _pendingAcks.back().get_future();
+
+    if (_pendingBytes >= _groupCommitBytes()) {
+        _flushTimer.cancel();
+        _flush();
+    }
+    else if (!_flushTimer.armed()) {
+        _flushTimer.arm(_groupCommitWindow());
+    }
+    return fut;
+}
+
+void PersistenceService::_flush() {
+    if (_pendingAcks.empty()) {
+        return;
+    }
+    K2LOG_D(log::psvc, "committing group of {} records, {} bytes", _pendingAcks.size(), _pendingBytes);
+    WALGroup group{.firstLSN=_pendingFirstLSN, .count=_pendingAcks.size(), .records={}};
+    _flushChain = std::move(_flushChain)
+    .then([this, group, buffers = std::move(_pendingBuffers), acks = std::move(_pendingAcks)]() mutable {
+        // a group larger than a chunk, e.g. from a single large persist request, spans several volume records
+        return _volume->appendSplit(std::move(buffers))
+        .then_wrapped([this, group, acks = std::move(acks)](auto&& fut) mutable {
+            if (fut.failed()) {
+                auto exc = fut.get_exception();
+                for (auto& ack : acks) {
+                    ack.set_exception(exc);
+                }
+                return;
+            }
+            group.records = fut.get0();
+            _walGroups.push_back(group);
+            for (auto& ack : acks) {
+                ack.set_value();
+            }
+        });
+    });
+    _pendingBuffers = std::vector<Binary>();
+    _pendingAcks = std::vector<seastar::promise<>>();
+    _pendingBytes = 0;
+}
+
+seastar::future<std::tuple<Status, dto::K23SICheckpointBeginResponse>>
+PersistenceService::_handleCheckpointBegin(dto::K23SICheckpointBeginRequest&& request) {
+    auto& cps = _checkpoints[request.source];
+    // a new checkpoint replaces an abandoned one
+    cps.inProgress = Checkpoint{.id=_nextCheckpointId++, .lsn=_nextLSN, .chunks={}};
+    K2LOG_D(log::psvc, "begin checkpoint {} for {} at lsn={}", cps.inProgress->id, request.source, cps.inProgress->lsn);
+    return RPCResponse(Statuses::S201_Created("checkpoint started"),
+                       dto::K23SICheckpointBeginResponse{.checkpointId=cps.inProgress->id, .lsn=cps.inProgress->lsn});
+}
+
+seastar::future<std::tuple<Status, dto::K23SICheckpointChunkResponse>>
+PersistenceService::_handleCheckpointChunk(dto::K23SICheckpointChunkRequest&& request) {
+    auto it = _checkpoints.find(request.source);
+    if (it == _checkpoints.end() || !it->second.inProgress || it->second.inProgress->id != request.checkpointId) {
+        return RPCResponse(Statuses::S410_Gone("checkpoint not in progress"), dto::K23SICheckpointChunkResponse{});
+    }
+    // the shared payload is trimmed to exactly its data, so its buffers can be appended as they are
+    auto buffers = request.entries.shareAll().release();
+    auto done = seastar::make_lw_shared<seastar::promise<std::vector<std::pair<RecordPosition, uint32_t>>>>();
+    auto fut = done->get_future();
+    _checkpointChain = std::move(_checkpointChain).then([this, done, buffers=std::move(buffers)] () mutable {
+        return _checkpointVolume->appendSplit(std::move(buffers))
+        .then_wrapped([done] (auto&& fut) {
+            fut.forward_to(std::move(*done));
+        });
+    });
+    return std::move(fut)
+    .then_wrapped([this, source=std::move(request.source), id=request.checkpointId] (auto&& fut) {
+        if (fut.failed()) {
+            K2LOG_W_EXC(log::psvc, fut.get_exception(), "failed to append checkpoint chunk for {}", source);
+            return RPCResponse(Statuses::S500_Internal_Server_Error("checkpoint chunk append failed"), dto::K23SICheckpointChunkResponse{});
+        }
+        auto records = fut.get0();
+        auto it = _checkpoints.find(source);
+        if (it == _checkpoints.end() || !it->second.inProgress || it->second.inProgress->id != id) {
+            return RPCResponse(Statuses::S410_Gone("checkpoint abandoned"), dto::K23SICheckpointChunkResponse{});
+        }
+        it->second.inProgress->chunks.push_back(std::move(records));
+        return RPCResponse(Statuses::S201_Created("chunk appended"), dto::K23SICheckpointChunkResponse{});
     });
+}
 
-    return seastar::make_ready_future();
+seastar::future<std::tuple<Status, dto::K23SICheckpointEndResponse>>
+PersistenceService::_handleCheckpointEnd(dto::K23SICheckpointEndRequest&& request) {
+    auto it = _checkpoints.find(request.source);
+    if (it == _checkpoints.end() || !it->second.inProgress || it->second.inProgress->id != request.checkpointId) {
+        return RPCResponse(Statuses::S410_Gone("checkpoint not in progress"), dto::K23SICheckpointEndResponse{});
+    }
+    it->second.completed = std::move(it->second.inProgress);
+    it->second.inProgress.reset();
+    K2LOG_I(log::psvc, "completed checkpoint {} for {} at lsn={} with {} chunks",
+            it->second.completed->id, request.source, it->second.completed->lsn, it->second.completed->chunks.size());
+    _reclaimCheckpoints();
+    _truncateWAL();
+    return RPCResponse(Statuses::S200_OK("checkpoint completed"), dto::K23SICheckpointEndResponse{.truncatedLSN=_truncatedLSN});
+}
+
+void PersistenceService::_truncateWAL() {
+    // we can only drop what every source has checkpointed
+    uint64_t truncateLSN = _nextLSN;
+    for (auto& source : _walSources) {
+        auto it = _checkpoints.find(source);
+        if (it == _checkpoints.end() || !it->second.completed) {
+            return;
+        }
+        truncateLSN = std::min(truncateLSN, it->second.completed->lsn);
+    }
+    if (truncateLSN <= _truncatedLSN) {
+        return;
+    }
+    _truncatedLSN = truncateLSN;
+    K2LOG_D(log::psvc, "truncating WAL below lsn={}", truncateLSN);
+
+    // the drop has to be ordered with the appends since both modify the chunk list of the volume
+    _flushChain = std::move(_flushChain).then([this, truncateLSN] {
+        while (!_walGroups.empty() && _walGroups.front().firstLSN + _walGroups.front().count <= truncateLSN) {
+            _walGroups.pop_front();
+        }
+        // chunks before the first live group only hold dropped groups. The last chunk is still being appended to
+        std::vector<ChunkId> dropped;
+        for (auto it = _volume->getChunks(); it->isValid(); it->advance()) {
+            auto chunkId = it->getCurrent().chunkId;
+            if (!_walGroups.empty() && chunkId >= _walGroups.front().records.front().first.chunkId) {
+                break;
+            }
+            dropped.push_back(chunkId);
+        }
+        if (_walGroups.empty() && !dropped.empty()) {
+            dropped.pop_back();
+        }
+        return seastar::do_with(std::move(dropped), [this] (auto& dropped) {
+            return seastar::do_for_each(dropped, [this] (ChunkId chunkId) {
+                return _volume->drop(chunkId);
+            });
+        })
+        .handle_exception([] (auto exc) {
+            K2LOG_W_EXC(log::psvc, exc, "failed to drop truncated WAL chunks");
+        });
+    });
+}
+
+void PersistenceService::_reclaimCheckpoints() {
+    std::unordered_set<ChunkId> live;
+    for (auto& [source, cps] : _checkpoints) {
+        for (auto* cp : {cps.completed ? &*cps.completed : nullptr, cps.inProgress ? &*cps.inProgress : nullptr}) {
+            if (!cp) continue;
+            for (auto& records : cp->chunks) {
+                for (auto& [position, size] : records) {
+                    live.insert(position.chunkId);
+                }
+            }
+        }
+    }
+    _checkpointChain = std::move(_checkpointChain).then([this, live=std::move(live)] {
+        std::vector<ChunkId> dropped;
+        std::optional<ChunkId> last;
+        for (auto it = _checkpointVolume->getChunks(); it->isValid(); it->advance()) {
+            auto chunkId = it->getCurrent().chunkId;
+            if (last && live.count(*last) == 0) {
+                dropped.push_back(*last);
+            }
+            // the last chunk is still being appended to, so it is never dropped
+            last = chunkId;
+        }
+        return seastar::do_with(std::move(dropped), [this] (auto& dropped) {
+            return seastar::do_for_each(dropped, [this] (ChunkId chunkId) {
+                return _checkpointVolume->drop(chunkId);
+            });
+        })
+        .handle_exception([] (auto exc) {
+            K2LOG_W_EXC(log::psvc, exc, "failed to drop unused checkpoint chunks");
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIRecoverCheckpointResponse>>
+PersistenceService::_handleRecoverCheckpoint(dto::K23SIRecoverCheckpointRequest&& request) {
+    auto it = _checkpoints.find(request.source);
+    if (it == _checkpoints.end() || !it->second.completed) {
+        return RPCResponse(Statuses::S200_OK("no checkpoint"), dto::K23SIRecoverCheckpointResponse{});
+    }
+    auto& cp = *it->second.completed;
+    dto::K23SIRecoverCheckpointResponse response{.found=true, .checkpointId=cp.id, .lsn=cp.lsn, .chunkCount=cp.chunks.size(), .entries={}};
+    if (cp.chunks.empty()) {
+        return RPCResponse(Statuses::S200_OK("empty checkpoint"), std::move(response));
+    }
+    if (request.chunkIndex >= cp.chunks.size()) {
+        return RPCResponse(Statuses::S416_Range_Not_Satisfiable("no such checkpoint chunk"), std::move(response));
+    }
+    auto records = cp.chunks[request.chunkIndex];
+    return seastar::do_with(std::move(response), [this, records=std::move(records)] (auto& response) mutable {
+        return _checkpointVolume->readMany(std::move(records))
+        .then_wrapped([&response] (auto&& fut) {
+            if (fut.failed()) {
+                K2LOG_W_EXC(log::psvc, fut.get_exception(), "failed to read checkpoint chunk");
+                return RPCResponse(Statuses::S500_Internal_Server_Error("failed to read checkpoint chunk"), dto::K23SIRecoverCheckpointResponse{});
+            }
+            for (auto& buffer : fut.get0()) {
+                response.entries.appendBinary(std::move(buffer));
+            }
+            return RPCResponse(Statuses::S200_OK("checkpoint chunk"), std::move(response));
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::K23SIRecoverWALResponse>>
+PersistenceService::_handleRecoverWAL(dto::K23SIRecoverWALRequest&& request) {
+    if (request.fromLSN < _truncatedLSN) {
+        // the records have been dropped. The caller should have started from its checkpoint
+        return RPCResponse(Statuses::S410_Gone("WAL truncated"), dto::K23SIRecoverWALResponse{.endLSN=_nextLSN, .records={}});
+    }
+    // the groups which overlap the requested range
+    std::vector<WALGroup> groups;
+    for (auto& group : _walGroups) {
+        if (group.firstLSN >= request.toLSN) break;
+        if (group.firstLSN + group.count > request.fromLSN) {
+            groups.push_back(group);
+        }
+    }
+    dto::K23SIRecoverWALResponse response{.endLSN=_nextLSN, .records={}};
+    // the groups are read concurrently and then parsed in LSN order
+    std::vector<std::pair<RecordPosition, uint32_t>> regions;
+    for (auto& group : groups) {
+        regions.insert(regions.end(), group.records.begin(), group.records.end());
+    }
+    return seastar::do_with(std::move(groups), std::move(request), std::move(response),
+        [this, regions=std::move(regions)] (auto& groups, auto& request, auto& response) mutable {
+        return _volume->readMany(std::move(regions))
+        .then([&groups, &request, &response] (std::vector<Binary>&& buffers) {
+            size_t next = 0;
+            for (auto& group : groups) {
+                Payload frames;
+                for (size_t i = 0; i < group.records.size(); ++i) {
+                    frames.appendBinary(std::move(buffers[next++]));
+                }
+                frames.seek(0);
+                for (uint64_t lsn = group.firstLSN; lsn < group.firstLSN + group.count; ++lsn) {
+                    String source;
+                    Payload value;
+                    if (!frames.read(source) || !frames.read(value)) {
+                        throw std::runtime_error("corrupted WAL group");
+                    }
+                    if (lsn >= request.fromLSN && lsn < request.toLSN && source == request.source) {
+                        response.records.push_back(std::move(value));
+                    }
+                }
+            }
+        })
+        .then_wrapped([&response] (auto&& fut) {
+            if (fut.failed()) {
+                K2LOG_W_EXC(log::psvc, fut.get_exception(), "failed to read WAL");
+                return RPCResponse(Statuses::S500_Internal_Server_Error("failed to read WAL"), dto::K23SIRecoverWALResponse{});
+            }
+            fut.ignore_ready_future();
+            return RPCResponse(Statuses::S200_OK("WAL records"), std::move(response));
+        });
+    });
 }
 
 } // namespace k2
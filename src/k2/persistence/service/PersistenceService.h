@@ -26,7 +26,17 @@ Copyright(c) 2020 Futurewei Cloud
 // third-party
 #include <seastar/core/distributed.hh>  // for distributed<>
 #include <seastar/core/future.hh>       // for future stuff
+#include <seastar/core/timer.hh>        // for timer
+
+#include <deque>
+#include <optional>
+#include <unordered_set>
+
 #include <k2/common/Log.h>
+#include <k2/config/Config.h>
+#include <k2/dto/K23SI.h>
+#include <k2/persistence/persistentVolume/PersistentVolume.h>
+#include <k2/transport/Payload.h>
 
 namespace k2 {
 namespace log {
@@ -41,6 +51,94 @@ public :  // application lifespan
     // required for seastar::distributed interface
     seastar::future<> gracefulStop();
     seastar::future<> start();
+
+private:
+    // Stage the given WAL record into the currently open commit group. The returned future completes once the
+    // group containing the record has been durably appended to the volume
+    seastar::future<> _append(Payload&& record);
+
+    // Close the currently open commit group and append it to the volume with a single appendMany
+    void _flush();
+
+    seastar::future<std::tuple<Status, dto::K23SICheckpointBeginResponse>>
+    _handleCheckpointBegin(dto::K23SICheckpointBeginRequest&& request);
+
+    seastar::future<std::tuple<Status, dto::K23SICheckpointChunkResponse>>
+    _handleCheckpointChunk(dto::K23SICheckpointChunkRequest&& request);
+
+    seastar::future<std::tuple<Status, dto::K23SICheckpointEndResponse>>
+    _handleCheckpointEnd(dto::K23SICheckpointEndRequest&& request);
+
+    seastar::future<std::tuple<Status, dto::K23SIRecoverCheckpointResponse>>
+    _handleRecoverCheckpoint(dto::K23SIRecoverCheckpointRequest&& request);
+
+    seastar::future<std::tuple<Status, dto::K23SIRecoverWALResponse>>
+    _handleRecoverWAL(dto::K23SIRecoverWALRequest&& request);
+
+    // Drops the WAL records which are covered by the checkpoints of all sources that wrote to the WAL
+    void _truncateWAL();
+
+    // Drops the checkpoint chunks which are no longer referenced by any checkpoint
+    void _reclaimCheckpoints();
+
+    // Where the WAL plogs for this shard are placed. The shard id is appended to the path
+    ConfigVar<String> _walPath{"persistence_wal_path", "./k2wal"};
+
+    // All records which arrive within this window after the first record of a group are committed together
+    ConfigDuration _groupCommitWindow{"persistence_group_commit_window", 200us};
+
+    // A commit group is closed early once it holds this many bytes. Larger groups are split across volume records
+    ConfigVar<uint64_t> _groupCommitBytes{"persistence_group_commit_bytes", 16*1024};
+
+    std::shared_ptr<PersistentVolume> _volume;
+
+    // the currently open commit group
+    std::vector<Binary> _pendingBuffers;
+    std::vector<seastar::promise<>> _pendingAcks;
+    size_t _pendingBytes{0};
+    uint64_t _pendingFirstLSN{0};
+
+    // fires when the group commit window of the open group expires
+    seastar::timer<> _flushTimer;
+
+    // groups are appended in order, one at a time
+    seastar::future<> _flushChain = seastar::make_ready_future();
+
+    // A commit group which made it to the WAL. Each record in the WAL is identified by its LSN, which is
+    // assigned in the order in which records are staged
+    struct WALGroup {
+        uint64_t firstLSN = 0;
+        uint64_t count = 0;
+        // the position and size of the volume records holding the group, in order
+        std::vector<std::pair<RecordPosition, uint32_t>> records;
+    };
+    // the durable groups, in LSN order
+    std::deque<WALGroup> _walGroups;
+    // the LSN of the next staged record
+    uint64_t _nextLSN{0};
+    // all records below this LSN have been dropped
+    uint64_t _truncatedLSN{0};
+    // the sources which wrote to the WAL. Truncation waits for a checkpoint from each of them
+    std::unordered_set<String> _walSources;
+
+    // A checkpoint of a source. It covers all records of the source below its LSN
+    struct Checkpoint {
+        uint64_t id = 0;
+        uint64_t lsn = 0;
+        // the volume records holding each chunk in the checkpoint volume
+        std::vector<std::vector<std::pair<RecordPosition, uint32_t>>> chunks;
+    };
+    struct SourceCheckpoints {
+        std::optional<Checkpoint> completed;
+        std::optional<Checkpoint> inProgress;
+    };
+    std::unordered_map<String, SourceCheckpoints> _checkpoints;
+    uint64_t _nextCheckpointId{1};
+
+    // checkpoint chunks are kept apart from the WAL, so that they can be reclaimed independently
+    std::shared_ptr<PersistentVolume> _checkpointVolume;
+    // appends to and drops from the checkpoint volume happen one at a time
+    seastar::future<> _checkpointChain = seastar::make_ready_future();
 };  // class PersistenceService
 
 } // namespace k2
@@ -0,0 +1,98 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "AdmissionControl.h"
+
+#include <algorithm>
+
+#include <seastar/core/metrics.hh>
+#include <seastar/core/smp.hh>
+
+namespace k2 {
+namespace sm = seastar::metrics;
+
+// the factor by which the limit of a verb is cut when its requests are too slow
+static constexpr double LimitBackoff = 0.9;
+// the weight of a new sample in the moving average of the handler time
+static constexpr int LatencySmoothing = 8;
+
+void AdmissionControl::start() {
+    std::vector<sm::label_instance> labels;
+    labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+    _metricGroups.add_group("transport", {
+        sm::make_counter("admission_rejected_deadline", _rejectedDeadline, sm::description("Requests rejected because they couldn't be handled before their deadline"), labels),
+        sm::make_counter("admission_rejected_concurrency", _rejectedConcurrency, sm::description("Requests rejected because their verb was at its concurrency limit"), labels),
+    });
+}
+
+void AdmissionControl::stop() {
+    _metricGroups.clear();
+}
+
+bool AdmissionControl::admit(Verb verb, TimePoint deadline, Status& rejection) {
+    if (!_enabled()) {
+        return true;
+    }
+    auto& state = _verbs[verb];
+    if (state.limit == 0) {
+        state.limit = _initialLimit();
+    }
+    auto now = TSCClock::now();
+    if (deadline != TimePoint::max() && now + state.latency >= deadline) {
+        _rejectedDeadline++;
+        rejection = Statuses::S503_Service_Unavailable("request can't be handled before its deadline");
+        return false;
+    }
+    if (state.inflight >= state.limit) {
+        _rejectedConcurrency++;
+        rejection = Statuses::S503_Service_Unavailable("server is overloaded");
+        return false;
+    }
+    state.inflight++;
+    return true;
+}
+
+void AdmissionControl::finish(Verb verb, TimePoint received, TimePoint started) {
+    if (!_enabled()) {
+        return;
+    }
+    auto& state = _verbs[verb];
+    if (state.inflight == 0) {
+        // admitted before the control was enabled
+        return;
+    }
+    state.inflight--;
+    auto now = TSCClock::now();
+    state.latency += (now - started - state.latency) / LatencySmoothing;
+
+    if (now - received <= _targetLatency()) {
+        state.limit = std::min<double>(state.limit + 1 / state.limit, _maxLimit());
+    }
+    else if (now - state.lastDecrease >= state.latency) {
+        // the requests in progress when we cut the limit complete slowly too, so cut once per latency period
+        state.lastDecrease = now;
+        state.limit = std::max<double>(state.limit * LimitBackoff, _minLimit());
+    }
+}
+
+} // ns k2
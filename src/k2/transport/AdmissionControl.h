@@ -0,0 +1,83 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+#include <seastar/core/metrics_registration.hh>
+
+#include <k2/common/Chrono.h>
+#include <k2/config/Config.h>
+#include "RPCTypes.h"
+#include "Status.h"
+
+namespace k2 {
+
+// Per-core admission control of the requests for the RPC observers, so that an overloaded server sheds load
+// early instead of queueing every request until it expires after doing partial work. A request is rejected with a
+// retryable 503 when
+// - the deadline its sender gave it(see MessageMetadata::setDeadline) has passed, or will pass before the typical
+//   handler time of its verb, or
+// - its verb already has as many requests in progress as its concurrency limit.
+// The limit of each verb adapts to the latency of its requests, AIMD-style: it grows by about one for each limit
+// requests which complete within tx_admission_target_latency of being received, and it is cut by a fixed factor,
+// at most once per typical latency, when one of them takes longer.
+class AdmissionControl {
+public:
+    void start();
+    void stop();
+
+    // Decides whether to handle a request for the given verb, which has to be answered by the given
+    // deadline(TimePoint::max() when there is none). Admitted requests must be completed with finish().
+    // Otherwise, the status to reply with is set in rejection
+    bool admit(Verb verb, TimePoint deadline, Status& rejection);
+
+    // completes an admitted request which was received and started at the given times
+    void finish(Verb verb, TimePoint received, TimePoint started);
+
+private:
+    struct VerbState {
+        // 0 until the first request of the verb sets it to the initial limit
+        double limit = 0;
+        uint32_t inflight = 0;
+        // moving average of the handler time
+        Duration latency{0};
+        TimePoint lastDecrease;
+    };
+    std::array<VerbState, std::numeric_limits<Verb>::max() + 1> _verbs;
+
+    uint64_t _rejectedDeadline = 0;
+    uint64_t _rejectedConcurrency = 0;
+    seastar::metrics::metric_groups _metricGroups;
+
+    ConfigVar<bool> _enabled{"tx_admission_control", false};
+    ConfigDuration _targetLatency{"tx_admission_target_latency", 20ms};
+    ConfigVar<uint32_t> _initialLimit{"tx_admission_initial_limit", 256};
+    ConfigVar<uint32_t> _minLimit{"tx_admission_min_limit", 8};
+    ConfigVar<uint32_t> _maxLimit{"tx_admission_max_limit", 4096};
+};
+
+} // ns k2
@@ -0,0 +1,169 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "BenchResult.h"
+
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <seastar/core/smp.hh>
+
+#include "Util.h"
+
+#ifndef K2_GIT_SHA
+#define K2_GIT_SHA "unknown"
+#endif
+
+namespace k2 {
+
+BenchResult BenchResult::make(std::string benchmark, std::string name) {
+    BenchResult result;
+    result.benchmark = std::move(benchmark);
+    result.name = std::move(name);
+    result.host = getHostName().c_str();
+    result.gitSha = K2_GIT_SHA;
+    result.cores = seastar::smp::count;
+    result.startTimeNs = sys_now_nsec_count();
+    return result;
+}
+
+void BenchResult::merge(const BenchResult& other) {
+    for (auto& [name, count] : other.counters) {
+        counters[name] += count;
+    }
+    for (auto& [name, histogram] : other.histograms) {
+        auto it = histograms.find(name);
+        if (it == histograms.end()) {
+            histograms.emplace(name, histogram);
+        } else {
+            it->second.merge(histogram);
+        }
+    }
+    elapsed = std::max(elapsed, other.elapsed);
+    startTimeNs = startTimeNs == 0 ? other.startTimeNs : std::min(startTimeNs, other.startTimeNs);
+    cores += other.cores;
+    clients += other.clients;
+    if (host != other.host) {
+        host = "multiple";
+    }
+    if (gitSha != other.gitSha) {
+        gitSha = "multiple";
+    }
+}
+
+nlohmann::json BenchResult::toJson() const {
+    double secs = std::max<double>(usec(elapsed).count(), 1) / 1'000'000;
+    nlohmann::json json = {
+        {"benchmark", benchmark}, {"name", name}, {"config", config}, {"elapsed_us", usec(elapsed).count()},
+        {"host", host}, {"git_sha", gitSha}, {"cores", cores}, {"clients", clients}, {"start_time_ns", startTimeNs}
+    };
+    json["counters"] = counters;
+    for (auto& [name, count] : counters) {
+        json["derived"][name + "_per_sec"] = count / secs;
+    }
+    json["histograms"] = nlohmann::json::object();
+    for (auto& [name, histogram] : histograms) {
+        json["histograms"][name] = {
+            {"max_value", histogram.maxValue()}, {"sub_bucket_bits", histogram.subBucketBits()},
+            {"sum", histogram.sum()}, {"counts", histogram.bucketCounts()}
+        };
+        json["derived"][name + "_p50_us"] = histogram.percentile(0.5);
+        json["derived"][name + "_p90_us"] = histogram.percentile(0.9);
+        json["derived"][name + "_p99_us"] = histogram.percentile(0.99);
+        json["derived"][name + "_p999_us"] = histogram.percentile(0.999);
+    }
+    return json;
+}
+
+BenchResult BenchResult::fromJson(const nlohmann::json& json) {
+    BenchResult result;
+    result.benchmark = json.at("benchmark").get<std::string>();
+    result.name = json.at("name").get<std::string>();
+    result.config = json.value("config", std::map<std::string, std::string>{});
+    result.counters = json.value("counters", std::map<std::string, uint64_t>{});
+    result.elapsed = std::chrono::microseconds(json.value("elapsed_us", int64_t(0)));
+    result.host = json.value("host", std::string());
+    result.gitSha = json.value("git_sha", std::string());
+    result.cores = json.value("cores", uint32_t(0));
+    result.clients = json.value("clients", uint32_t(1));
+    result.startTimeNs = json.value("start_time_ns", uint64_t(0));
+    if (json.contains("histograms")) {
+        for (auto& [name, exported] : json.at("histograms").items()) {
+            LogLinearHistogram histogram(exported.at("max_value").get<uint64_t>(), exported.at("sub_bucket_bits").get<uint8_t>());
+            auto counts = exported.at("counts").get<std::vector<uint64_t>>();
+            if (counts.size() != histogram.bucketCounts().size()) {
+                throw std::runtime_error("histogram " + name + " of " + result.key() + " has the wrong number of buckets");
+            }
+            histogram.addBuckets(counts, exported.value("sum", uint64_t(0)));
+            result.histograms.emplace(name, std::move(histogram));
+        }
+    }
+    return result;
+}
+
+bool appendBenchResults(const String& path, const std::vector<BenchResult>& results) {
+    // the cores of a benchmark may report at the same time
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream out(path.c_str(), std::ios::app);
+    for (auto& result : results) {
+        out << result.toJson().dump() << "\n";
+    }
+    return bool(out);
+}
+
+std::vector<BenchResult> readBenchResults(const String& path) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        throw std::runtime_error("unable to open " + std::string(path.c_str()));
+    }
+    std::vector<BenchResult> results;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        try {
+            results.push_back(BenchResult::fromJson(nlohmann::json::parse(line)));
+        } catch (nlohmann::json::exception& exc) {
+            throw std::runtime_error("malformed benchmark result in " + std::string(path.c_str()) + ": " + exc.what());
+        }
+    }
+    return results;
+}
+
+std::vector<BenchResult> combineBenchResults(std::vector<BenchResult>&& results) {
+    std::vector<BenchResult> combined;
+    std::unordered_map<std::string, size_t> index;
+    for (auto& result : results) {
+        auto [it, inserted] = index.try_emplace(result.key(), combined.size());
+        if (inserted) {
+            combined.push_back(std::move(result));
+        } else {
+            combined[it->second].merge(result);
+        }
+    }
+    return combined;
+}
+
+} // namespace k2
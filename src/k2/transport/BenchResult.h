@@ -0,0 +1,89 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <k2/common/Chrono.h>
+#include <k2/common/Common.h>
+
+#include "Prometheus.h"
+
+namespace k2 {
+
+// The result of one measurement(a workload, a cell of a sweep, a step) of one benchmark client, in the schema all
+// K2 benchmarks write with --bench_results, one JSON object per line. The results of the clients of a multi-client
+// run are combined with merge(): the counters add up and the latency histograms are merged bucket by bucket, so
+// that the combined percentiles are the percentiles of all samples rather than an average of percentiles
+struct BenchResult {
+    // the benchmark, e.g. "rpcbench", and what it measured, e.g. the workload or the cell
+    std::string benchmark;
+    std::string name;
+    // the parameters of the run
+    std::map<std::string, std::string> config;
+    // counts which add up across clients, e.g. of operations, errors and bytes
+    std::map<std::string, uint64_t> counters;
+    // latencies, in microseconds
+    std::map<std::string, LogLinearHistogram> histograms;
+    // how long the measurement ran. Concurrent clients combine into the longest of them
+    Duration elapsed{0};
+
+    // metadata of the clients which produced the result
+    std::string host;
+    std::string gitSha;
+    uint32_t cores = 0;
+    uint32_t clients = 1;
+    // when the measurement started, in nanoseconds since the epoch
+    uint64_t startTimeNs = 0;
+
+    // A result of the given benchmark with the metadata of this process filled in
+    static BenchResult make(std::string benchmark, std::string name);
+
+    // results of the same measurement have the same key
+    std::string key() const { return benchmark + "/" + name; }
+
+    void merge(const BenchResult& other);
+
+    // The JSON object of the result. Besides the raw counters and histogram buckets, it has the derived values
+    // <counter>_per_sec and <histogram>_p50_us, _p90_us, _p99_us and _p999_us for readers which don't combine
+    nlohmann::json toJson() const;
+    static BenchResult fromJson(const nlohmann::json& json);
+};
+
+// Appends the results as JSON lines to the given file. Safe to call from several cores at once, but blocks the
+// calling core for the file write, so it is meant for the end of a benchmark. Returns false if the file couldn't
+// be written
+bool appendBenchResults(const String& path, const std::vector<BenchResult>& results);
+
+// Reads the JSON lines written by appendBenchResults. Throws std::runtime_error if the file is malformed
+std::vector<BenchResult> readBenchResults(const String& path);
+
+// Merges the results with the same key, keeping the order in which the keys first appear
+std::vector<BenchResult> combineBenchResults(std::vector<BenchResult>&& results);
+
+} // namespace k2
@@ -0,0 +1,69 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "BinaryPool.h"
+
+// third-party
+#include <seastar/core/smp.hh>
+
+#include "Log.h"
+
+namespace k2 {
+
+BinaryPool::BinaryPool(size_t segmentSize, size_t segmentCount) :
+    _segmentSize(segmentSize),
+    _segmentCount(segmentCount),
+    _region(new char[segmentSize * segmentCount]),
+    _shard(seastar::this_shard_id()) {
+    _free.reserve(segmentCount);
+    // hand out the low segments first
+    for (size_t i = segmentCount; i > 0; --i) {
+        _free.push_back(uint32_t(i - 1));
+    }
+    K2LOG_D(log::tx, "created binary pool with {} segments of {} bytes", segmentCount, segmentSize);
+}
+
+Binary BinaryPool::allocate() {
+    if (_free.empty() || seastar::this_shard_id() != _shard) {
+        ++_fallbacks;
+        return Binary(_segmentSize);
+    }
+    auto segment = _free.back();
+    _free.pop_back();
+    return Binary(_region.get() + segment * _segmentSize, _segmentSize,
+        seastar::make_deleter([this, segment] {
+            if (seastar::this_shard_id() == _shard) {
+                _release(segment);
+            }
+            else {
+                (void) seastar::smp::submit_to(_shard, [this, segment] { _release(segment); });
+            }
+        }));
+}
+
+void BinaryPool::_release(uint32_t segment) {
+    _free.push_back(segment);
+}
+
+}  // namespace k2
@@ -0,0 +1,69 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+// k2
+#include <k2/common/Common.h>
+
+namespace k2 {
+
+// A per-core pool of fixed-size binaries, carved out of one contiguous region which is allocated up front.
+// Having all buffers in a single region means that it can be registered with a NIC once, so that payloads
+// serialized into pool binaries are sent without being copied or registered on the fly.
+// Binaries return to the pool when they are released, even if that happens on another core. When the pool is
+// empty, or when used from another core, allocate() falls back to a plain heap binary.
+// A pool should live for the lifetime of the process: allocators which refer to it are copied along with
+// endpoints, possibly to other cores, and may be used or released at any point until exit.
+class BinaryPool {
+public:
+    BinaryPool(size_t segmentSize, size_t segmentCount);
+
+    // Returns a binary of segmentSize bytes
+    Binary allocate();
+
+    // the region which backs the pool, e.g. for memory registration
+    const char* regionStart() const { return _region.get(); }
+    size_t regionSize() const { return _segmentSize * _segmentCount; }
+
+    size_t segmentSize() const { return _segmentSize; }
+    size_t available() const { return _free.size(); }
+    uint64_t fallbacks() const { return _fallbacks; }
+
+private:
+    // called on the owning core when a binary comes back
+    void _release(uint32_t segment);
+
+    size_t _segmentSize;
+    size_t _segmentCount;
+    std::unique_ptr<char[]> _region;
+    std::vector<uint32_t> _free;
+    unsigned _shard;
+    uint64_t _fallbacks = 0;
+};
+
+}  // namespace k2
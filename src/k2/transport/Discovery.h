@@ -71,6 +71,27 @@ public :  // application lifespan
         // no match
         return nullptr;
     }
+    // Same as selectBestEndpoint, but the endpoints come from the per-core registry of shared endpoints. See
+    // RPCDispatcher::getSharedTXEndpoint
+    template<typename StringContainer>
+    static seastar::lw_shared_ptr<TXEndpoint> selectBestSharedEndpoint(const StringContainer& urls) {
+        seastar::lw_shared_ptr<TXEndpoint> tcp;
+        for (auto& url: urls) {
+            auto ep = RPC().getSharedTXEndpoint(url);
+            if (!ep) {
+                continue;
+            }
+            // rdma is preferred if we support it
+            if (seastar::engine()._rdma_stack && ep->protocol == RRDMARPCProtocol::proto) {
+                return ep;
+            }
+            if (!tcp && ep->protocol == TCPRPCProtocol::proto) {
+                tcp = std::move(ep);
+            }
+        }
+        return tcp;
+    }
+
     // required for seastar::distributed interface
     seastar::future<> gracefulStop();
     seastar::future<> start();
@@ -102,6 +102,10 @@ public: // API
     // This is an asyncronous API. No guarantees are made on the delivery of the payload after the call returns.
     virtual void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) = 0;
 
+    // Starts opening the connection to the given endpoint, if the protocol has connections and there is none yet,
+    // so that the first message to the endpoint doesn't wait for the connection. By default this does nothing
+    virtual void connect(TXEndpoint& endpoint) { (void)endpoint; }
+
     // Returns the endpoint where this protocol accepts incoming connections.
     virtual seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() = 0;
 
@@ -40,6 +40,10 @@ Payload::Payload(BinaryAllocatorFunctor allocator):
     _size(0), _capacity(0), _allocator(allocator) {
 }
 
+Payload::Payload(std::function<Binary()> fixedSizeAllocator):
+    _size(0), _capacity(0), _allocator([alloc=std::move(fixedSizeAllocator)](size_t) { return alloc(); }) {
+}
+
 Payload::Payload(std::vector<Binary>&& externallyAllocatedBuffers, size_t containedDataSize):
     _buffers(std::move(externallyAllocatedBuffers)),
     _size(containedDataSize),
@@ -53,8 +57,12 @@ Payload::Payload():
     _allocator(nullptr) {
 }
 
-Binary Payload::DefaultAllocator() {
-    return Binary(8192);
+Binary Payload::DefaultAllocator(size_t size) {
+    return Binary(std::max(size, size_t(1)));
+}
+
+const std::vector<Binary>& Payload::getBuffers() const {
+    return _buffers;
 }
 
 bool Payload::isEmpty() const {
@@ -73,7 +81,7 @@ void Payload::ensureCapacity(size_t totalCapacity) {
     if (totalCapacity <= _capacity) return;
     // we're asked to make sure there is certain total capacity. Make sure we have it allocated
     while (_capacity < totalCapacity) {
-        bool canAllocate = _allocateBuffer();
+        bool canAllocate = _allocateBuffer(totalCapacity - _capacity);
         K2ASSERT(log::tx, canAllocate, "unable to increase capacity");
     }
     // NB, if our cursor was past the end of the payload before this call, it will now be valid
@@ -164,6 +172,23 @@ bool Payload::read(Binary& binary, size_t size) {
     return true;
 }
 
+bool Payload::readView(const char*& data, size_t size, String& scratch) {
+    if (getDataRemaining() < size) {
+        return false;
+    }
+    if (size > 0) {
+        const Binary& buffer = _buffers[_currentPosition.bufferIndex];
+        if (buffer.size() - _currentPosition.bufferOffset >= size) {
+            data = buffer.get() + _currentPosition.bufferOffset;
+            _advancePosition(size);
+            return true;
+        }
+    }
+    scratch.resize(size);
+    data = scratch.data();
+    return read((void*)scratch.data(), size);
+}
+
 bool Payload::read(char& b) {
     if (getDataRemaining() == 0) return false;
 
@@ -179,6 +204,26 @@ bool Payload::read(String& value) {
     return read((void*)value.data(), size);
 }
 
+bool Payload::read(StringView& value) {
+    _Size size;
+    if (!read(size) || size == 0 || getDataRemaining() < size) return false;
+
+    // the serialized size counts the '\0', which is not part of the view
+    Binary& buffer = _buffers[_currentPosition.bufferIndex];
+    if (buffer.size() - _currentPosition.bufferOffset >= size) {
+        value = StringView(buffer.share(_currentPosition.bufferOffset, size - 1));
+        _advancePosition(size);
+        return true;
+    }
+
+    // the string spans buffers - copy it out
+    Binary data(size - 1);
+    if (!read(data.get_write(), size - 1)) return false;
+    _advancePosition(1);
+    value = StringView(std::move(data));
+    return true;
+}
+
 bool Payload::read(std::decimal::decimal64& value) {
     std::decimal::decimal64::__decfloat64 data;
     bool success = read((void*)&data, sizeof(data));
@@ -291,6 +336,13 @@ void Payload::write(const String& value) {
     write(value.data(), size);
 }
 
+void Payload::write(const StringView& value) {
+    _Size size = value.size() + 1; // count the null character too
+    write(size);
+    write(value.data(), value.size());
+    write('\0');
+}
+
 void Payload::write(const std::decimal::decimal64& value) {
     std::decimal::decimal64::__decfloat64 data = const_cast<std::decimal::decimal64&>(value).__getval();
     write((const void*)&data, sizeof(data));
@@ -328,9 +380,11 @@ void Payload::writeMany() {
     // this is needed for the base case of the recursive template version
 }
 
-bool Payload::_allocateBuffer() {
+bool Payload::_allocateBuffer(size_t needed) {
     K2ASSERT(log::tx, _allocator, "cannot allocate buffer without allocator");
-    Binary buf = _allocator();
+    // grow geometrically: each new buffer is as big as everything we have so far, or as big as what we need now
+    auto suggested = std::clamp(std::max(_capacity, needed), MIN_BUFFER_SIZE, MAX_BUFFER_SIZE);
+    Binary buf = _allocator(suggested);
     if (!buf) {
         return false;
     }
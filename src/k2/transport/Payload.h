@@ -94,7 +94,18 @@ public: // types
 public: // Lifecycle
     // Create a blank payload which can grow by allocating with the given allocator
     Payload(BinaryAllocatorFunctor allocator);
-    static Binary DefaultAllocator();
+
+    // Create a blank payload which can grow by allocating with an allocator which doesn't take a size
+    Payload(std::function<Binary()> fixedSizeAllocator);
+
+    // Allocates binaries of exactly the suggested size. Used with a Payload, the buffers grow geometrically
+    // from MIN_BUFFER_SIZE to MAX_BUFFER_SIZE, so small messages don't carry a large buffer and large ones
+    // don't get chopped into many small buffers
+    static Binary DefaultAllocator(size_t size);
+
+    // bounds of the buffer sizes the payload suggests to its allocator
+    static constexpr size_t MIN_BUFFER_SIZE = 512;
+    static constexpr size_t MAX_BUFFER_SIZE = 64 * 1024;
 
     Payload(Payload&&) = default;
     Payload& operator=(Payload&& other) = default;
@@ -114,6 +125,9 @@ public: // memory management
     // release the underlying buffers
     std::vector<Binary> release();
 
+    // read-only access to the underlying buffers, e.g. to determine where the data was allocated
+    const std::vector<Binary>& getBuffers() const;
+
     // Returns a ref-counted shared view of the payload. The new payload will have its own cursor and will
     // share the data which was present here at time of share.
     // - any new data appended to either payload will not be visible to any other payload
@@ -171,12 +185,20 @@ public:  // Read API
     // Read some bytes into the given binary
     bool read(Binary& binary, size_t size);
 
+    // Read some bytes without copying them: data points to them in the payload when they are in a single
+    // buffer, and stays valid for as long as the payload data does. Otherwise they are copied into scratch
+    bool readView(const char*& data, size_t size, String& scratch);
+
     // read a single character
     bool read(char& b);
 
     // read a string
     bool read(String& value);
 
+    // read a string without copying it: the view shares the payload buffer when the string is inside a single
+    // buffer (otherwise the bytes are copied). Reads data written by either write(String) or write(StringView)
+    bool read(StringView& value);
+
     // read primitive decimal types
     bool read(std::decimal::decimal64& value);
     bool read(std::decimal::decimal128& value);
@@ -324,6 +346,94 @@ public:  // Read API
     // no-arg version to satisfy the template expansion above in the terminal case
     bool readMany();
 
+public: // Size API
+    // The number of bytes write(value) adds to a payload. Use it to allocate a payload of the right size up front
+    static size_t serializedSize(char) { return 1; }
+    static size_t serializedSize(const String& value) { return sizeof(_Size) + value.size() + 1; }
+    static size_t serializedSize(const StringView& value) { return sizeof(_Size) + value.size() + 1; }
+    static size_t serializedSize(const std::decimal::decimal64&) { return sizeof(std::decimal::decimal64::__decfloat64); }
+    static size_t serializedSize(const std::decimal::decimal128&) { return sizeof(std::decimal::decimal128::__decfloat128); }
+    static size_t serializedSize(const Payload& other) { return sizeof(size_t) + other.getSize(); }
+    static size_t serializedSize(const Duration& dur) { return sizeof(dur.count()); }
+
+    template <typename KeyT, typename ValueT>
+    static size_t serializedSize(const std::map<KeyT, ValueT>& m) {
+        size_t result = sizeof(_Size);
+        for (auto& kvp : m) {
+            result += serializedSize(kvp.first) + serializedSize(kvp.second);
+        }
+        return result;
+    }
+
+    template <typename KeyT, typename ValueT>
+    static size_t serializedSize(const std::unordered_map<KeyT, ValueT>& m) {
+        size_t result = sizeof(_Size);
+        for (auto& kvp : m) {
+            result += serializedSize(kvp.first) + serializedSize(kvp.second);
+        }
+        return result;
+    }
+
+    template <typename ValueT>
+    static size_t serializedSize(const std::vector<ValueT>& vec) {
+        if constexpr (isNumericType<ValueT>() || isPayloadCopyableType<ValueT>()) {
+            return sizeof(_Size) + vec.size() * sizeof(ValueT);
+        }
+        size_t result = sizeof(_Size);
+        for (const ValueT& value : vec) {
+            result += serializedSize(value);
+        }
+        return result;
+    }
+
+    template <typename T>
+    static size_t serializedSize(const std::set<T>& s) {
+        size_t result = sizeof(_Size);
+        for (auto& key : s) {
+            result += serializedSize(key);
+        }
+        return result;
+    }
+
+    template <typename T>
+    static size_t serializedSize(const std::unordered_set<T>& s) {
+        size_t result = sizeof(_Size);
+        for (auto& key : s) {
+            result += serializedSize(key);
+        }
+        return result;
+    }
+
+    template <typename T>
+    static size_t serializedSize(const SerializeAsPayload<T>& value) {
+        if constexpr(std::is_same<T, Payload>::value || std::is_same<T, const Payload>::value) {
+            return serializedSize(value.val);
+        }
+        return sizeof(uint64_t) + serializedSize(value.val);
+    }
+
+    template <typename T>
+    static std::enable_if_t<isNumericType<T>(), size_t> serializedSize(const T) {
+        return sizeof(T);
+    }
+
+    template <typename T>
+    static std::enable_if_t<isPayloadCopyableType<T>(), size_t> serializedSize(const T&) {
+        return sizeof(T);
+    }
+
+    template <typename T>
+    static std::enable_if_t<isPayloadSerializableType<T>(), size_t> serializedSize(const T& value) {
+        return value.__serializedSize();
+    }
+
+    template <typename T, typename... ArgsT>
+    static size_t serializedSizeMany(const T& value, const ArgsT&... args) {
+        return serializedSize(value) + serializedSizeMany(args...);
+    }
+
+    static size_t serializedSizeMany() { return 0; }
+
 public: // Write API
     // copy size bytes from the given payload into this payload
     bool copyFromPayload(Payload& src, size_t toCopy);
@@ -343,6 +453,9 @@ public: // Write API
     // write a string
     void write(const String& value);
 
+    // write a string view. The wire format is the same as for String
+    void write(const StringView& value);
+
     // write primitive decimal types
     void write(const std::decimal::decimal64& value);
     void write(const std::decimal::decimal128& value);
@@ -472,8 +585,9 @@ private:  // types and fields
     PayloadPosition _currentPosition;
 
 private: // helper methods
-    // used to allocate additional space
-    bool _allocateBuffer();
+    // used to allocate additional space. We need at least `needed` more bytes, which is only a hint for the size
+    // of the new buffer
+    bool _allocateBuffer(size_t needed);
 
     // advances the current position by the given number
     void _advancePosition(size_t advance);
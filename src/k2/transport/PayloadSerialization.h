@@ -36,6 +36,9 @@ Copyright(c) 2020 Futurewei Cloud
     }                                              \
     bool __readFields(k2::Payload& ___payload_local_macro_var___) {          \
         return ___payload_local_macro_var___.readMany(__VA_ARGS__);      \
+    }                                              \
+    size_t __serializedSize() const {              \
+        return k2::Payload::serializedSizeMany(__VA_ARGS__); \
     }
 
 // This is a macro which can be put on structures which are directly copyable
@@ -0,0 +1,215 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <k2/common/Chrono.h>
+
+namespace k2 {
+
+// Bookkeeping for outstanding request-reply messages, keyed by their 32-bit sequence id.
+// Entries live in a ring indexed by the low bits of the id. Since ids are handed out sequentially, the ring
+// holds every outstanding request without hashing as long as the ids in flight are no further apart than
+// the ring capacity. The ring doubles on a collision up to maxRingCapacity, and anything which still collides
+// after that goes to an overflow map.
+// Timeouts are tracked with a coarse timer wheel: each entry is filed in the bucket of its deadline tick, and
+// expire() walks the buckets whose ticks have elapsed since the previous call. Entries which complete before
+// their deadline are not removed from the wheel; they are skipped when their bucket comes up.
+template <typename T>
+class PendingRequestTable {
+public:
+    PendingRequestTable(Duration tick, size_t wheelSize = 1024, size_t initialCapacity = 1024,
+                        size_t maxRingCapacity = 1 << 16) :
+        _tick(tick > Duration::zero() ? tick : 1ms),
+        _wheel(_roundUpPow2(wheelSize)),
+        _ring(_roundUpPow2(initialCapacity)),
+        _maxRingCapacity(_roundUpPow2(maxRingCapacity)) {
+    }
+
+    // Track a new request which times out at the given deadline. The id must not be outstanding already.
+    void insert(uint32_t id, TimePoint deadline, T value) {
+        // never file an entry into a bucket we've already walked past
+        uint64_t deadlineTick = std::max(_ceilTick(deadline), _lastTick + 1);
+        Slot* slot = &_ring[id & (_ring.size() - 1)];
+        while (slot->value && _ring.size() < _maxRingCapacity) {
+            _grow();
+            slot = &_ring[id & (_ring.size() - 1)];
+        }
+        if (slot->value) {
+            slot = &_overflow[id];
+        }
+        slot->id = id;
+        slot->deadlineTick = deadlineTick;
+        slot->value.emplace(std::move(value));
+        _wheel[deadlineTick & (_wheel.size() - 1)].push_back(id);
+        ++_size;
+    }
+
+    // Remove the request with the given id, returning its value, or nullopt if it's not outstanding
+    // (e.g. it has already timed out)
+    std::optional<T> take(uint32_t id) {
+        Slot& slot = _ring[id & (_ring.size() - 1)];
+        if (slot.value && slot.id == id) {
+            return _release(slot);
+        }
+        auto iter = _overflow.find(id);
+        if (iter == _overflow.end()) {
+            return std::nullopt;
+        }
+        auto result = _release(iter->second);
+        _overflow.erase(iter);
+        return result;
+    }
+
+    // Remove all requests whose deadline tick has elapsed by the given time and call onExpired(id, T&&) for each
+    template <typename Func>
+    void expire(TimePoint now, Func&& onExpired) {
+        uint64_t nowTick = _floorTick(now);
+        if (nowTick <= _lastTick) {
+            return;
+        }
+        // after a full revolution, every bucket has been visited once
+        uint64_t first = std::max(_lastTick + 1, nowTick >= _wheel.size() ? nowTick - _wheel.size() + 1 : 0);
+        _lastTick = nowTick;
+
+        std::vector<std::pair<uint32_t, T>> expired;
+        for (uint64_t tick = first; tick <= nowTick; ++tick) {
+            auto& bucket = _wheel[tick & (_wheel.size() - 1)];
+            if (bucket.empty()) {
+                continue;
+            }
+            std::vector<uint32_t> ids;
+            ids.swap(bucket);
+            for (auto id : ids) {
+                Slot* slot = _find(id);
+                if (slot == nullptr) {
+                    continue; // completed already
+                }
+                if (slot->deadlineTick > nowTick) {
+                    bucket.push_back(id); // due on a later revolution of the wheel
+                    continue;
+                }
+                expired.emplace_back(id, *_release(*slot));
+                if (slot != &_ring[id & (_ring.size() - 1)]) {
+                    _overflow.erase(id);
+                }
+            }
+        }
+        // callbacks run after the walk so that they are free to insert new requests
+        for (auto& [id, value] : expired) {
+            onExpired(id, std::move(value));
+        }
+    }
+
+    // Remove all requests and call onEach(id, T&&) for each, e.g. to fail them on shutdown
+    template <typename Func>
+    void clear(Func&& onEach) {
+        std::vector<std::pair<uint32_t, T>> all;
+        all.reserve(_size);
+        for (auto& slot : _ring) {
+            if (slot.value) {
+                all.emplace_back(slot.id, *_release(slot));
+            }
+        }
+        for (auto& [id, slot] : _overflow) {
+            all.emplace_back(id, *_release(slot));
+        }
+        _overflow.clear();
+        for (auto& bucket : _wheel) {
+            bucket.clear();
+        }
+        for (auto& [id, value] : all) {
+            onEach(id, std::move(value));
+        }
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    size_t ringCapacity() const { return _ring.size(); }
+    size_t overflowSize() const { return _overflow.size(); }
+
+private:
+    struct Slot {
+        uint32_t id = 0;
+        uint64_t deadlineTick = 0;
+        std::optional<T> value;
+    };
+
+    static size_t _roundUpPow2(size_t n) {
+        size_t result = 1;
+        while (result < n) result <<= 1;
+        return result;
+    }
+
+    uint64_t _floorTick(TimePoint tp) const {
+        return uint64_t(tp.time_since_epoch() / _tick);
+    }
+
+    uint64_t _ceilTick(TimePoint tp) const {
+        auto since = tp.time_since_epoch();
+        uint64_t ticks = uint64_t(since / _tick);
+        return since % _tick == Duration::zero() ? ticks : ticks + 1;
+    }
+
+    Slot* _find(uint32_t id) {
+        Slot& slot = _ring[id & (_ring.size() - 1)];
+        if (slot.value && slot.id == id) {
+            return &slot;
+        }
+        auto iter = _overflow.find(id);
+        return iter == _overflow.end() ? nullptr : &iter->second;
+    }
+
+    std::optional<T> _release(Slot& slot) {
+        std::optional<T> result(std::move(slot.value));
+        slot.value.reset();
+        --_size;
+        return result;
+    }
+
+    // double the ring. Ids which differ in their low bits keep doing so with more bits, so nothing collides
+    void _grow() {
+        std::vector<Slot> ring(_ring.size() * 2);
+        for (auto& slot : _ring) {
+            if (slot.value) {
+                ring[slot.id & (ring.size() - 1)] = std::move(slot);
+            }
+        }
+        _ring.swap(ring);
+    }
+
+    Duration _tick;
+    std::vector<std::vector<uint32_t>> _wheel;
+    std::vector<Slot> _ring;
+    std::unordered_map<uint32_t, Slot> _overflow;
+    size_t _maxRingCapacity;
+    uint64_t _lastTick = 0;
+    size_t _size = 0;
+};
+
+} // ns k2
@@ -23,6 +23,8 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include "Prometheus.h"
 #include "Util.h"
+
+#include <algorithm>
 #include "VirtualNetworkStack.h"
 #include <k2/common/Log.h>
 
@@ -220,4 +222,89 @@ void ExponentialHistogram::add(double sample) {
     _histogram.sample_count += 1;           // global count
     _histogram.sample_sum += sample;        // global sum
 }
+LogLinearHistogram::LogLinearHistogram(uint64_t maxValue, uint8_t subBucketBits) :
+    _subBucketBits(subBucketBits), _subBucketMask((uint64_t(1) << subBucketBits) - 1) {
+    K2ASSERT(log::prom, subBucketBits >= 1 && subBucketBits <= 8, "invalid sub-bucket bits");
+    K2ASSERT(log::prom, maxValue >= 1, "invalid max value");
+    size_t numbuckets = _bucketIndex(maxValue) + 1;
+    K2ASSERT(log::prom, numbuckets <= MAX_NUM_BUCKETS, "invalid number of buckets");
+    _counts.resize(numbuckets);
+    _promHistogram.buckets.resize(numbuckets);
+    for (size_t i = 0; i < numbuckets; ++i) {
+        _promHistogram.buckets[i].upper_bound = _bucketUpperBound(i);
+    }
+}
+
+uint64_t LogLinearHistogram::_bucketUpperBound(size_t index) const {
+    if (index < (size_t(1) << _subBucketBits)) {
+        return index;
+    }
+    uint32_t shift = (index >> _subBucketBits) - 1;
+    uint64_t lower = ((uint64_t(1) << _subBucketBits) + (index & _subBucketMask)) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+void LogLinearHistogram::merge(const LogLinearHistogram& other) {
+    K2ASSERT(log::prom, other._counts.size() == _counts.size() && other._subBucketBits == _subBucketBits,
+             "cannot merge histograms with different layouts");
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        _counts[i] += other._counts[i];
+    }
+    _count += other._count;
+    _sum += other._sum;
+}
+
+void LogLinearHistogram::addBuckets(const std::vector<uint64_t>& counts, uint64_t sum) {
+    K2ASSERT(log::prom, counts.size() == _counts.size(), "cannot add buckets of a different layout");
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        _counts[i] += counts[i];
+        _count += counts[i];
+    }
+    _sum += sum;
+}
+
+uint64_t LogLinearHistogram::percentile(double fraction) const {
+    if (_count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(std::clamp(fraction, 0.0, 1.0) * _count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < _counts.size(); ++i) {
+        seen += _counts[i];
+        if (seen >= rank) {
+            return _bucketUpperBound(i);
+        }
+    }
+    return _bucketUpperBound(_counts.size() - 1);
+}
+
+seastar::metrics::histogram& LogLinearHistogram::getHistogram() {
+    if (_promHistogram.sample_count != _count) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < _counts.size(); ++i) {
+            total += _counts[i];
+            _promHistogram.buckets[i].count = total;
+        }
+        _promHistogram.sample_count = _count;
+        _promHistogram.sample_sum = _sum;
+    }
+    return _promHistogram;
+}
+
+std::vector<seastar::metrics::metric_definition>
+LogLinearHistogram::metricDefinitions(const String& name, const String& description,
+                                      const std::vector<seastar::metrics::label_instance>& labels,
+                                      const std::vector<double>& percentiles) {
+    namespace sm = seastar::metrics;
+    std::vector<sm::metric_definition> result;
+    result.push_back(sm::make_histogram(name, [this] { return getHistogram(); }, sm::description(description), labels));
+    for (double p : percentiles) {
+        std::vector<sm::label_instance> quantileLabels = labels;
+        quantileLabels.push_back(sm::label_instance("quantile", fmt::format("{}", p)));
+        result.push_back(sm::make_gauge(name + "_percentile", [this, p] { return percentile(p); },
+                                        sm::description(description + ", at the given quantile"), quantileLabels));
+    }
+    return result;
+}
+
 }// namespace k2
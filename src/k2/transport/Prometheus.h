@@ -29,6 +29,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <cmath>
 #include <seastar/core/future.hh>
+#include <seastar/core/metrics.hh>
 #include <seastar/core/metrics_types.hh>
 #include <seastar/http/httpd.hh>
 
@@ -177,4 +178,82 @@ private:
     seastar::metrics::histogram _promHistogram;
 
 }; // class ExponentialHistogram
+
+// A histogram of integer samples(e.g. latencies in usecs) with log-linear buckets in the style of HDR histograms.
+// Each power of 2 range is split into 2^subBucketBits equal buckets, so a bucket is at most 1/2^subBucketBits
+// wider than its lower bound. The bucket of a sample comes from a bit scan and a shift, with no floating point
+// math, and the scraped cumulative histogram is only recomputed when there are new samples. This makes it cheap
+// enough to record every request.
+// Histograms with the same layout can be merged, e.g. to get the percentiles of all cores
+class LogLinearHistogram {
+public:
+    // Samples >= maxValue end up in the last bucket. With the defaults(1usec to 10sec, 8 buckets per power of 2)
+    // there are 170 buckets
+    LogLinearHistogram(uint64_t maxValue=10'000'000, uint8_t subBucketBits=3);
+
+    // report a new sample
+    void add(uint64_t sample) {
+        _counts[std::min(_bucketIndex(sample), _counts.size() - 1)]++;
+        _count++;
+        _sum += sample;
+    }
+
+    // Convenience method we can use to record time durations.
+    // The durations are recorded with microsecond resolution by default.
+    template<typename Resolution=std::micro>
+    void add(std::chrono::steady_clock::duration sample) {
+        add(uint64_t(std::chrono::duration_cast<std::chrono::duration<uint64_t, Resolution>>(sample).count()));
+    }
+
+    // adds the samples of the given histogram, which must have the same layout
+    void merge(const LogLinearHistogram& other);
+
+    // The value which the given fraction(0..1) of the samples don't exceed, as the upper bound of its bucket.
+    // 0 if there are no samples
+    uint64_t percentile(double fraction) const;
+
+    uint64_t count() const { return _count; }
+    uint64_t sum() const { return _sum; }
+
+    // The layout and the per-bucket counts, so that the histogram can be exported and rebuilt elsewhere with
+    // LogLinearHistogram(maxValue(), subBucketBits()) and addBuckets()
+    uint64_t maxValue() const { return _bucketUpperBound(_counts.size() - 1); }
+    uint8_t subBucketBits() const { return _subBucketBits; }
+    const std::vector<uint64_t>& bucketCounts() const { return _counts; }
+    // adds exported bucket counts, which must be of the same layout, and the sum of their samples
+    void addBuckets(const std::vector<uint64_t>& counts, uint64_t sum);
+
+    // the cumulative histogram(vector<bucket>) which we need to provide to the metrics subsystem for reporting
+    seastar::metrics::histogram& getHistogram();
+
+    // The metrics for this histogram: the histogram itself under the given name, and a gauge named
+    // <name>_percentile with a "quantile" label for each of the given percentiles, for dashboards which can't
+    // compute quantiles from buckets. The histogram must outlive the metrics
+    std::vector<seastar::metrics::metric_definition>
+    metricDefinitions(const String& name, const String& description,
+                      const std::vector<seastar::metrics::label_instance>& labels,
+                      const std::vector<double>& percentiles={0.5, 0.9, 0.99, 0.999});
+
+private:
+    size_t _bucketIndex(uint64_t sample) const {
+        if (sample < (uint64_t(1) << _subBucketBits)) {
+            // the first buckets hold a single value each
+            return sample;
+        }
+        uint32_t msb = 63 - __builtin_clzll(sample);
+        uint32_t shift = msb - _subBucketBits;
+        return (size_t(shift + 1) << _subBucketBits) + ((sample >> shift) & _subBucketMask);
+    }
+
+    // the largest value in the given bucket
+    uint64_t _bucketUpperBound(size_t index) const;
+
+    uint8_t _subBucketBits;
+    uint64_t _subBucketMask;
+    std::vector<uint64_t> _counts;
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+
+    seastar::metrics::histogram _promHistogram;
+}; // class LogLinearHistogram
 } // k2 namespace
@@ -32,6 +32,15 @@ namespace k2{
 
 RPCDispatcher::RPCDispatcher() : _msgSequenceID(uint32_t(std::rand())) {
     K2LOG_D(log::tx, "ctor");
+    _rrTimeoutTimer.set_callback([this] { _expireRequests(); });
+    std::call_once(_crossCoreChannelsInit, [] {
+        auto count = seastar::smp::count * seastar::smp::count;
+        _crossCoreChannels = new std::atomic<CrossCoreChannel*>[count];
+        for (size_t i = 0; i < count; ++i) {
+            _crossCoreChannels[i].store(nullptr);
+        }
+    });
+    _crossCoreSpills.resize(seastar::smp::count, 0);
     registerLowTransportMemoryObserver(nullptr);
 }
 
@@ -86,6 +95,7 @@ void RPCDispatcher::registerMessageObserver(Verb verb, RequestObserver_t observe
     K2LOG_D(log::tx, "registering message observer for verb: {}", int(verb));
     if (observer == nullptr) {
         _observers.erase(verb);
+        _localObservers.erase(verb);
         K2LOG_D(log::tx, "Removing message observer for verb: {}", int(verb));
         return;
     }
@@ -100,8 +110,19 @@ void RPCDispatcher::registerMessageObserver(Verb verb, RequestObserver_t observe
     }
 }
 
+void RPCDispatcher::setVerbSchedulingGroup(Verb verb, seastar::scheduling_group group) {
+    K2LOG_D(log::tx, "running verb {} in scheduling group {}", int(verb), group.name());
+    _verbGroups[verb] = group;
+}
+
 void RPCDispatcher::start() {
     K2LOG_D(log::tx, "start");
+    _tracer.start();
+    _taskProfiler.start();
+    _metrics.start([this] { return _rrPromises.size(); });
+    _memory.start();
+    _slowLog.start();
+    _admission.start();
 }
 
 seastar::future<> RPCDispatcher::stop() {
@@ -112,37 +133,60 @@ seastar::future<> RPCDispatcher::stop() {
         proto.second->setMessageObserver(nullptr);
     }
     _protocols.clear();
+    _sharedEndpoints.clear();
 
     // complete all promises
-    for(auto&& promise: _rrPromises) {
-        promise.second.promise.set_exception(DispatcherShutdown());
-    }
-    _rrPromises.clear();
+    _rrTimeoutTimer.cancel();
+    _rrPromises.clear([](uint32_t, PayloadPromise&& promise) {
+        promise.set_exception(DispatcherShutdown());
+    });
+    _tracer.stop();
+    _taskProfiler.stop();
+    _metrics.stop();
+    _memory.stop();
+    _slowLog.stop();
+    _admission.stop();
     return seastar::make_ready_future<>();
 }
 
 // Process new messages received from protocols
 void RPCDispatcher::_handleNewMessage(Request&& request) {
     K2LOG_D(log::tx, "handling request for verb={}, from ep={}", int(request.verb), request.endpoint.url);
+    _metrics.countIn(request.verb, request.payload ? request.payload->getSize() : 0);
     // see if this is a response
     if (request.metadata.isResponseIDSet()) {
         // process as a response
-        auto nodei = _rrPromises.find(request.metadata.responseID);
-        if (nodei == _rrPromises.end()) {
+        auto promise = _rrPromises.take(request.metadata.responseID);
+        if (!promise) {
             K2LOG_D(log::tx, "no handler for response for msgid: {}", request.metadata.responseID )
-            // TODO emit metric for RR without msid
+            _metrics.unmatchedResponses++;
             return;
         }
         // we have a response
-        nodei->second.timer.cancel();
-        nodei->second.promise.set_value(std::move(request.payload));
-        _rrPromises.erase(nodei);
+        promise->set_value(std::move(request.payload));
+        return;
+    }
+    request.received = TSCClock::now();
+    auto group = _verbGroups.find(request.verb);
+    if (group != _verbGroups.end() && group->second != seastar::current_scheduling_group()) {
+        // queue the request in its verb's group
+        (void)seastar::with_scheduling_group(group->second,
+            [request=std::move(request), disp=weak_from_this()] () mutable {
+                if (disp) {
+                    disp->_dispatchRequest(std::move(request));
+                }
+            });
         return;
     }
+    _dispatchRequest(std::move(request));
+}
+
+void RPCDispatcher::_dispatchRequest(Request&& request) {
     auto iter = _observers.find(request.verb);
     if (iter != _observers.end()) {
         K2LOG_D(log::tx, "Dispatching request for verb={}, from ep={}", int(request.verb), request.endpoint.url);
-        // TODO emit verb-dimension metric for duration of handling
+        // the synchronous part of the observer runs in this task
+        TaskTimer timer(request.verb);
         try {
             iter->second(std::move(request));
         } catch (std::exception& exc) {
@@ -153,7 +197,7 @@ void RPCDispatcher::_handleNewMessage(Request&& request) {
     }
     else {
         K2LOG_D(log::tx, "no observer for verb {}, from {}", request.verb, request.endpoint.url);
-        // TODO emit metric
+        _metrics.unobservedMessages++;
     }
 }
 
@@ -171,6 +215,8 @@ RPCDispatcher::_send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& en
         "sending message for verb={}, to endpoint={}, with server endpoint={}, payload size={}, payload capacity={}",
         int(verb), endpoint.url, (serverep ? serverep->url : String("none")),
         (payload ? payload->getSize() : 0), (payload ? payload->getCapacity() : 0));
+    _metrics.countOut(verb, payload && payload->getSize() > txconstants::MAX_HEADER_SIZE ?
+                            payload->getSize() - txconstants::MAX_HEADER_SIZE : 0);
     if (_txUseCrossCoreLoopback()) {
         auto core = _url_cores.find(endpoint.url);
         if (core != _url_cores.end()){
@@ -182,12 +228,7 @@ RPCDispatcher::_send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& en
                 _handleNewMessage(Request(verb, *RPC().getServerEndpoint(endpoint.protocol), std::move(meta), std::move(payload)));
             }
             else{
-                //We don't care about the result of this call since we don't make a promise that we're going to deliver the data.
-                (void) RPCDist().invoke_on(core->second, &k2::RPCDispatcher::_handleNewMessage, Request(verb, *RPC().getServerEndpoint(endpoint.protocol), std::move(meta), std::move(payload))).
-                handle_exception([&](auto exc) mutable {
-                    K2LOG_W_EXC(log::tx, exc, "invoke_on failed");
-                    return seastar::make_ready_future();
-                });
+                _sendCrossCore(core->second, Request(verb, *RPC().getServerEndpoint(endpoint.protocol), std::move(meta), std::move(payload)));
             }
             return seastar::make_ready_future<>();
         }
@@ -197,12 +238,93 @@ RPCDispatcher::_send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& en
 }
 
 
+void RPCDispatcher::_sendCrossCore(unsigned dstCore, Request&& request) {
+    if (!_txUseCrossCoreRings()) {
+        //We don't care about the result of this call since we don't make a promise that we're going to deliver the data.
+        (void) RPCDist().invoke_on(dstCore, &k2::RPCDispatcher::_handleNewMessage, std::move(request)).
+        handle_exception([&](auto exc) mutable {
+            K2LOG_W_EXC(log::tx, exc, "invoke_on failed");
+            return seastar::make_ready_future();
+        });
+        return;
+    }
+    auto srcCore = seastar::this_shard_id();
+    auto& slot = _crossCoreChannels[srcCore * seastar::smp::count + dstCore];
+    auto* channel = slot.load(std::memory_order_acquire);
+    if (channel == nullptr) {
+        channel = new CrossCoreChannel(_txCrossCoreRingSize());
+        slot.store(channel, std::memory_order_release);
+    }
+
+    if (_crossCoreSpills[dstCore] == 0 && channel->ring.push(std::move(request))) {
+        if (!channel->doorbell.exchange(true)) {
+            // the destination isn't draining this ring. Wake it up
+            (void) RPCDist().invoke_on(dstCore, [srcCore](RPCDispatcher& disp) {
+                disp._onCrossCoreDoorbell(srcCore);
+            }).
+            handle_exception([](auto exc) {
+                K2LOG_W_EXC(log::tx, exc, "cross-core doorbell failed");
+            });
+        }
+        return;
+    }
+
+    // The ring is full, or earlier messages are still on their way around it. Go through the smp queue, which
+    // is FIFO, and drain the ring on the other side first so that the message is handled in send order
+    K2LOG_D(log::tx, "cross-core ring to core {} is full. Spilling, with {} already spilled", dstCore, _crossCoreSpills[dstCore]);
+    ++_crossCoreSpills[dstCore];
+    (void) RPCDist().invoke_on(dstCore, [srcCore, request = std::move(request)](RPCDispatcher& disp) mutable {
+        disp._drainCrossCoreRing(srcCore);
+        disp._handleNewMessage(std::move(request));
+    }).
+    handle_exception([](auto exc) {
+        K2LOG_W_EXC(log::tx, exc, "invoke_on failed");
+    }).
+    finally([this, dstCore] {
+        --_crossCoreSpills[dstCore];
+    });
+}
+
+void RPCDispatcher::_drainCrossCoreRing(unsigned srcCore) {
+    auto* channel = _crossCoreChannels[srcCore * seastar::smp::count + seastar::this_shard_id()].load(std::memory_order_acquire);
+    if (channel == nullptr) {
+        return;
+    }
+    channel->ring.drain([this](Request&& request) {
+        _handleNewMessage(std::move(request));
+    });
+}
+
+void RPCDispatcher::_onCrossCoreDoorbell(unsigned srcCore) {
+    auto* channel = _crossCoreChannels[srcCore * seastar::smp::count + seastar::this_shard_id()].load(std::memory_order_acquire);
+    while (true) {
+        _drainCrossCoreRing(srcCore);
+        channel->doorbell.store(false);
+        // the source may have pushed after we drained but before it saw the doorbell cleared, in which case
+        // it didn't ring again and it's up to us to pick the message up
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (channel->ring.empty() || channel->doorbell.exchange(true)) {
+            return;
+        }
+    }
+}
+
 seastar::future<>
 RPCDispatcher::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint) {
     MessageMetadata metadata;
     return _send(verb, std::move(payload), endpoint, std::move(metadata));
 }
 
+void RPCDispatcher::connect(TXEndpoint& endpoint) {
+    if (_txUseCrossCoreLoopback() && _url_cores.find(endpoint.url) != _url_cores.end()) {
+        return;
+    }
+    auto protoi = _protocols.find(endpoint.protocol);
+    if (protoi != _protocols.end()) {
+        protoi->second->connect(endpoint);
+    }
+}
+
 seastar::future<>
 RPCDispatcher::setAddressCore(std::pair<String, int> url_core) {
     _url_cores.insert(std::move(url_core));
@@ -217,8 +339,9 @@ RPCDispatcher::sendReply(std::unique_ptr<Payload> payload, Request& forRequest)
 }
 
 seastar::future<std::unique_ptr<Payload>>
-RPCDispatcher::sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout) {
-    uint64_t msgid = _msgSequenceID++;
+RPCDispatcher::sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout,
+                           tracing::TraceContext trace) {
+    uint32_t msgid = _msgSequenceID++;
     K2LOG_D(log::tx, "Request send with msgid={}, timeout={}, ep={}", msgid, timeout, endpoint.url);
 
     // the promise gets fulfilled when prom for this msgid comes back.
@@ -226,29 +349,60 @@ RPCDispatcher::sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoi
     // record the promise so that we can fulfil it if we get a response
     MessageMetadata metadata;
     metadata.setRequestID(msgid);
-
-    seastar::timer<> timer([this, msgid] {
-        // raise an exception in the promise for this request.
-        K2LOG_D(log::tx, "send request timed out for msgid={}", msgid);
-        // TODO emit metric for timeout
-        auto iter = this->_rrPromises.find(msgid);
-        K2ASSERT(log::tx, iter != this->_rrPromises.end(), "unable to find promise for timer");
-        iter->second.promise.set_exception(RequestTimeoutException());
-        this->_rrPromises.erase(iter);
-    });
-    timer.arm(timeout);
+    if (trace.sampled()) {
+        metadata.setTraceContext(trace.traceID, trace.spanID);
+    }
+    metadata.setDeadline(timeout);
 
     auto fut = prom.get_future();
-    _rrPromises.emplace(msgid, ResponseTracker{std::move(prom), std::move(timer)});
+    auto now = TSCClock::now();
+    _rrPromises.insert(msgid, now + timeout, std::move(prom));
+    if (!_rrTimeoutTimer.armed()) {
+        _rrTimeoutTimer.arm(_rrTimeoutTick());
+    }
 
+    auto* rtt = _metrics.peerRTT(endpoint.url);
     return _send(verb, std::move(payload), endpoint, std::move(metadata)).
-    then([fut=std::move(fut)] () mutable {
-        return std::move(fut);
+    then([fut=std::move(fut), rtt, now] () mutable {
+        if (!rtt) {
+            return std::move(fut);
+        }
+        // the histogram lives as long as the dispatcher, and the promises are failed when it stops
+        return fut.then([rtt, now] (std::unique_ptr<Payload>&& payload) {
+            rtt->add(TSCClock::now() - now);
+            return std::move(payload);
+        });
     });
 
 
 }
 
+void RPCDispatcher::_recordSpan(tracing::SpanKind kind, Verb verb, const tracing::TraceContext& trace,
+                                uint64_t parentSpanID, uint64_t startNanos, int32_t status) {
+    _tracer.record(tracing::Span{
+        .traceID = trace.traceID,
+        .spanID = trace.spanID,
+        .parentSpanID = parentSpanID,
+        .startNanos = startNanos,
+        .endNanos = sys_now_nsec_count(),
+        .verb = verb,
+        .kind = kind,
+        .status = status
+    });
+}
+
+void RPCDispatcher::_expireRequests() {
+    _rrPromises.expire(TSCClock::now(), [this](uint32_t msgid, PayloadPromise&& promise) {
+        // raise an exception in the promise for this request.
+        K2LOG_D(log::tx, "send request timed out for msgid={}", msgid);
+        _metrics.requestTimeouts++;
+        promise.set_exception(RequestTimeoutException());
+    });
+    if (!_rrPromises.empty()) {
+        _rrTimeoutTimer.arm(_rrTimeoutTick());
+    }
+}
+
 void RPCDispatcher::registerLowTransportMemoryObserver(LowTransportMemoryObserver_t observer) {
     K2LOG_D(log::tx, "register low mem observer");
     if (observer == nullptr) {
@@ -279,6 +433,20 @@ std::unique_ptr<TXEndpoint> RPCDispatcher::getTXEndpoint(String url) {
     return protoi->second->getTXEndpoint(std::move(url));
 }
 
+seastar::lw_shared_ptr<TXEndpoint> RPCDispatcher::getSharedTXEndpoint(const String& url) {
+    auto it = _sharedEndpoints.find(url);
+    if (it != _sharedEndpoints.end()) {
+        return it->second;
+    }
+    auto ep = getTXEndpoint(url);
+    if (!ep) {
+        return nullptr;
+    }
+    auto shared = seastar::make_lw_shared<TXEndpoint>(std::move(*ep));
+    _sharedEndpoints.emplace(url, shared);
+    return shared;
+}
+
 seastar::lw_shared_ptr<TXEndpoint> RPCDispatcher::getServerEndpoint(const String& protocol) {
     auto protoi = _protocols.find(protocol);
     if (protoi == _protocols.end()) {
@@ -24,23 +24,36 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 // stl
+#include <atomic>
 #include <functional>
+#include <mutex>
 #include <unordered_map>
 #include <exception>
+#include <type_traits>
 
 // third party
 #include <seastar/core/distributed.hh>
+#include <seastar/core/scheduling.hh>
 #include <seastar/core/shared_ptr.hh>
 #include <seastar/core/weak_ptr.hh>
+#include <seastar/core/future-util.hh>
 #include <seastar/util/reference_wrapper.hh> // for seastar::ref
 
 // k2
 #include <k2/common/Common.h>
+#include <k2/common/MemoryAccounting.h>
 #include <k2/config/Config.h>
 #include "RPCProtocolFactory.h"
 #include "Request.h"
 #include "Status.h"
 #include "Log.h"
+#include "PendingRequestTable.h"
+#include "SlowLog.h"
+#include "AdmissionControl.h"
+#include "TaskProfiler.h"
+#include "TransportMetrics.h"
+#include "Tracing.h"
+#include <k2/common/SPSCRing.h>
 
 namespace k2 {
 
@@ -108,6 +121,12 @@ public: // message-oriented API
     // thrown if there is an observer already installed for this verb
     void registerMessageObserver(Verb verb, RequestObserver_t observer);
 
+    // Run the observer for the given verb in the given scheduling group. Each group has its own task queue, and
+    // the reactor divides CPU time between the queued groups in proportion to their shares, so heavy low-priority
+    // verbs (e.g. queries) don't delay latency-critical ones. Verbs without a group run in the group which
+    // delivered the message (normally the main group)
+    void setVerbSchedulingGroup(Verb verb, seastar::scheduling_group group);
+
     // registerLowTransportMemoryObserver allows the user to register an observer which will be called when
     // a transport becomes low on memory.
     // The call is triggered every time a transport has to perform allocation of its buffers, and
@@ -127,6 +146,12 @@ public: // message-oriented API
     // returns blank pointer if we failed to parse the url or if the protocol is not supported
     std::unique_ptr<TXEndpoint> getTXEndpoint(String url);
 
+    // Returns the endpoint for the given URL from a per-core registry, creating it on first use. Code which routes
+    // many requests to the same URLs(e.g. the partition maps of the clients) shares one endpoint per URL instead
+    // of parsing the URL and allocating an endpoint for each user.
+    // returns blank pointer if we failed to parse the url or if the protocol is not supported
+    seastar::lw_shared_ptr<TXEndpoint> getSharedTXEndpoint(const String& url);
+
     // Returns the listener endpoint for the given protocol (or empty pointer if not supported)
     seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint(const String& protocol);
 
@@ -144,8 +169,10 @@ public: // message-oriented API
     // The method provides a future<> based callback support via the return value.
     // The future will complete with exception if the given timeout is reached before we receive a response.
     // if we receive a response after the timeout is reached, we will ignore it internally.
+    // If the given trace context is sampled, the request carries it in its header
     seastar::future<std::unique_ptr<Payload>>
-    sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout);
+    sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout,
+                tracing::TraceContext trace = {});
 
     // Use this method to reply to a given Request, with the given payload. This method should be normally used
     // in message observers to respond to clients.
@@ -153,86 +180,120 @@ public: // message-oriented API
 
     seastar::future<> setAddressCore(std::pair<String, int> url_core);
 
+    // Starts opening the connection to the given endpoint(see IRPCProtocol::connect), unless the endpoint is one
+    // of the cores of this process, which messages reach without a connection
+    void connect(TXEndpoint& endpoint);
+
+    // the number of requests we sent which are still waiting for their replies
+    size_t pendingRequests() const { return _rrPromises.size(); }
+
+    // the span recorder of this core
+    tracing::Tracer& tracer() { return _tracer; }
+
 
 
 public: // RPC-oriented interface. Small convenience so that users don't have to deal with Payloads directly
     // Same as sendRequest but for RPC types, not raw payloads
+    // If the current trace context is sampled, the call is recorded as a span under it
+    // Calls to an endpoint of this core whose verb has an observer registered with registerRPCObserver for the same
+    // types don't go through the transport: the observer gets a copy of the request and its response is handed back
+    // as is, with no serialization on either side. Requests which can't be copied(e.g. which carry Payloads) are
+    // serialized as usual, since the request may be sent again on retry
     template<class Request_t, class Response_t>
     seastar::future<std::tuple<Status, Response_t>> callRPC(Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout) {
-        auto payload = endpoint.newPayload();
-        payload->write(request);
         K2LOG_D(log::tx, "RPC Request call to endpoint: {}", endpoint.url);
 
-        return sendRequest(verb, std::move(payload), endpoint, timeout)
-            .then([](std::unique_ptr<Payload>&& responsePayload) {
-                // parse status
-                auto result = std::make_tuple<Status, Response_t>(Status(), Response_t());
-                if (!responsePayload->read(std::get<0>(result))) {
-                    std::get<0>(result) = Statuses::S500_Internal_Server_Error("unable to parse status from response");
-                }
-                else {
-                    if (!responsePayload->read(std::get<1>(result))) {
-                        // failed to parse a Response_t
-                        std::get<0>(result) = Statuses::S500_Internal_Server_Error("unable to parse response object");
+        auto parent = tracing::current();
+        if (parent.sampled()) {
+            auto trace = _tracer.newSpan(parent);
+            auto startNanos = sys_now_nsec_count();
+            return _call<Request_t, Response_t>(verb, request, endpoint, timeout, trace)
+                .then([verb, trace, parentSpanID=parent.spanID, startNanos, disp=weak_from_this()] (auto&& result) {
+                    if (disp) {
+                        disp->_recordSpan(tracing::SpanKind::Client, verb, trace, parentSpanID, startNanos, std::get<0>(result).code);
                     }
-                }
-                return result;
-            })
-            .handle_exception([](auto exc) {
-                try {
-                    std::rethrow_exception(exc);
-                }
-                catch (const RPCDispatcher::RequestTimeoutException&) {
-                    return std::make_tuple<Status, Response_t>(Statuses::S503_Service_Unavailable("client timed out"), Response_t());
-                }
-                catch (const std::exception &e) {
-                    K2LOG_E(log::tx, "RPC send failed with uncaught exception: {}", e.what());
-                }
-                catch (...) {
-                    K2LOG_E(log::tx, "RPC send failed with unknown exception");
-                }
-
-                return std::make_tuple<Status, Response_t>(Statuses::S500_Internal_Server_Error("unknown exception while sending request"), Response_t());
-            });
+                    return std::move(result);
+                });
+        }
+        return _call<Request_t, Response_t>(verb, request, endpoint, timeout, tracing::TraceContext{});
     }
 
     // Register a handler for requests of type Request_t. You are required to respond with an object of type Response_t
     // and a Status for your request
+    // If the sender is traced, the request is handled in a span under the sender's, which is the current context
+    // while the observer is called
     template <class Request_t, class Response_t>
     void registerRPCObserver(Verb verb, RPCRequestObserver_t<Request_t, Response_t> observer) {
+        // the observer is shared by the message observer and the local calls of callRPC
+        auto local = seastar::make_shared<_LocalObserver<Request_t, Response_t>>(std::move(observer));
         // wrap the RPC observer into a message observer
-        registerMessageObserver(verb, [this, observer=std::move(observer)](Request&& request) mutable {
+        registerMessageObserver(verb, [this, local](Request&& request) mutable {
             // we're ignoring the returned future here so we can't wait for it before the rpc dispatcher exits
             // to guard against segv on shutdown, obtain a weak pointer
             (void)seastar::do_with(std::move(request), Request_t{}, weak_from_this(),
-                [&observer](auto& request, auto& rpcRequest, auto& disp) {
+                [&observer=local->observer](auto& request, auto& rpcRequest, auto& disp) {
                     if (!disp) return seastar::make_ready_future();
 
+                    Status rejection;
+                    if (!disp->_admission.admit(request.verb, request.deadline(), rejection)) {
+                        auto reply = request.endpoint.newPayload();
+                        reply->write(rejection);
+                        reply->write(Response_t());
+                        return disp->sendReply(std::move(reply), request);
+                    }
+                    auto started = TSCClock::now();
                     if (!request.payload->read(rpcRequest)) {
+                        disp->_admission.finish(request.verb, request.received, started);
                         auto reply = request.endpoint.newPayload();
                         reply->write(Statuses::S400_Bad_Request("unable to parse incoming request"));
                         reply->write(Response_t());
                         return disp->sendReply(std::move(reply), request);
                     }
+                    tracing::TraceContext trace;
+                    uint64_t startNanos = 0;
+                    if (request.metadata.isTraceContextSet()) {
+                        trace = disp->_tracer.newSpan(tracing::TraceContext{request.metadata.traceID, request.metadata.spanID});
+                        startNanos = sys_now_nsec_count();
+                    }
+                    tracing::Scope scope(trace);
+                    auto slowOp = disp->_slowLog.begin(request.verb, request.received);
+                    SlowLog::Scope slowScope(slowOp);
                     // if disp was still alive, it's safe to call observer
                     return observer(std::move(rpcRequest))
-                        .then([&](auto&& result) mutable {
+                        .finally([&, started] {
+                            if (disp) {
+                                disp->_admission.finish(request.verb, request.received, started);
+                            }
+                        })
+                        .then([&, trace, startNanos, slowOp](auto&& result) mutable {
                             if (!disp) {
                                 K2LOG_W(log::tx, "dispatcher is going down: unable to send response to {}", request.endpoint.url);
                                 return seastar::make_ready_future();
                             }
 
                             auto& [status, response] = result;
+                            if (trace.sampled()) {
+                                disp->_recordSpan(tracing::SpanKind::Server, request.verb, trace, request.metadata.spanID, startNanos, status.code);
+                            }
+                            if (slowOp) {
+                                disp->_slowLog.finish(*slowOp, status.code, request.endpoint.url);
+                            }
                             // write out the status first
-                            auto reply = request.endpoint.newPayload();
+                            auto reply = request.endpoint.newPayload(Payload::serializedSizeMany(status, response));
                             reply->write(status);
                             // write out the Response_t
                             reply->write(response);
                             return disp->sendReply(std::move(reply), request);
                         })
-                        .handle_exception([&](auto exc) mutable {
+                        .handle_exception([&, trace, startNanos, slowOp](auto exc) mutable {
                             K2LOG_W_EXC(log::tx, exc, "RPC handler failed with uncaught exception");
                             if (disp) {
+                                if (trace.sampled()) {
+                                    disp->_recordSpan(tracing::SpanKind::Server, request.verb, trace, request.metadata.spanID, startNanos, 500);
+                                }
+                                if (slowOp) {
+                                    disp->_slowLog.finish(*slowOp, 500, request.endpoint.url);
+                                }
                                 auto reply = request.endpoint.newPayload();
                                 reply->write(Statuses::S500_Internal_Server_Error("server caught exception processing request"));
                                 reply->write(Response_t{});
@@ -242,15 +303,159 @@ public: // RPC-oriented interface. Small convenience so that users don't have to
                         });
                });
         });
+        _localObservers[verb] = std::move(local);
     }
 
 private:  // methods
+    // an observer registered with registerRPCObserver, for the local calls of callRPC
+    struct _LocalObserverBase {
+        virtual ~_LocalObserverBase() = default;
+    };
+    template <class Request_t, class Response_t>
+    struct _LocalObserver : public _LocalObserverBase {
+        explicit _LocalObserver(RPCRequestObserver_t<Request_t, Response_t> o) : observer(std::move(o)) {}
+        RPCRequestObserver_t<Request_t, Response_t> observer;
+    };
+
+    // makes the call of callRPC, locally if we can
+    template<class Request_t, class Response_t>
+    seastar::future<std::tuple<Status, Response_t>>
+    _call(Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout, tracing::TraceContext trace) {
+        if constexpr (std::is_copy_constructible_v<Request_t>) {
+            if (_txUseLocalDispatch() && _isLocalEndpoint(endpoint)) {
+                auto it = _localObservers.find(verb);
+                if (it != _localObservers.end()) {
+                    auto local = seastar::dynamic_pointer_cast<_LocalObserver<Request_t, Response_t>>(it->second);
+                    if (local) {
+                        return _callLocal<Request_t, Response_t>(std::move(local), verb, Request_t(request), timeout, trace);
+                    }
+                    // registered with other types. Let the observer deal with it as it would for a remote caller
+                    K2LOG_W(log::tx, "local call for verb {} with types different from its observer", verb);
+                }
+            }
+        }
+        auto payload = endpoint.newPayload(Payload::serializedSize(request));
+        payload->write(request);
+        return _callRPC<Response_t>(verb, std::move(payload), endpoint, timeout, trace);
+    }
+
+    // Runs the observer of a local call the way the message observer of registerRPCObserver would, in the
+    // scheduling group of the verb, with a server span and the slow request log. The call times out like a
+    // remote one, in which case the observer still runs to completion but its response is dropped
+    template<class Request_t, class Response_t>
+    seastar::future<std::tuple<Status, Response_t>>
+    _callLocal(seastar::shared_ptr<_LocalObserver<Request_t, Response_t>> local, Verb verb, Request_t&& request,
+               Duration timeout, tracing::TraceContext trace) {
+        _metrics.localCalls++;
+        auto run = [this, local, verb, request=std::move(request), trace] () mutable {
+            tracing::TraceContext serverTrace;
+            uint64_t startNanos = 0;
+            if (trace.sampled()) {
+                serverTrace = _tracer.newSpan(trace);
+                startNanos = sys_now_nsec_count();
+            }
+            tracing::Scope scope(serverTrace);
+            auto slowOp = _slowLog.begin(verb, TSCClock::now());
+            SlowLog::Scope slowScope(slowOp);
+            return seastar::futurize_invoke(local->observer, std::move(request))
+                .handle_exception([](auto exc) {
+                    K2LOG_W_EXC(log::tx, exc, "RPC handler failed with uncaught exception");
+                    return std::make_tuple<Status, Response_t>(Statuses::S500_Internal_Server_Error("server caught exception processing request"), Response_t{});
+                })
+                .then([local, verb, serverTrace, parentSpanID=trace.spanID, startNanos, slowOp, disp=weak_from_this()] (auto&& result) {
+                    if (disp) {
+                        auto code = std::get<0>(result).code;
+                        if (serverTrace.sampled()) {
+                            disp->_recordSpan(tracing::SpanKind::Server, verb, serverTrace, parentSpanID, startNanos, code);
+                        }
+                        if (slowOp) {
+                            disp->_slowLog.finish(*slowOp, code, "local");
+                        }
+                    }
+                    return std::move(result);
+                });
+        };
+
+        auto group = _verbGroups.find(verb);
+        auto fut = group != _verbGroups.end() && group->second != seastar::current_scheduling_group() ?
+            seastar::with_scheduling_group(group->second, std::move(run)) : run();
+        if (fut.available()) {
+            return fut;
+        }
+        return seastar::with_timeout(seastar::timer<>::clock::now() + timeout, std::move(fut))
+            .handle_exception_type([disp=weak_from_this()] (seastar::timed_out_error&) {
+                if (disp) {
+                    disp->_metrics.requestTimeouts++;
+                }
+                return std::make_tuple<Status, Response_t>(Statuses::S503_Service_Unavailable("client timed out"), Response_t());
+            });
+    }
+
+    // true if the endpoint is a listener of this core
+    bool _isLocalEndpoint(const TXEndpoint& endpoint) const {
+        auto core = _url_cores.find(endpoint.url);
+        return core != _url_cores.end() && core->second == int(seastar::this_shard_id());
+    }
+
+    // sends the request and parses the response of callRPC
+    template<class Response_t>
+    seastar::future<std::tuple<Status, Response_t>>
+    _callRPC(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout, tracing::TraceContext trace) {
+        return sendRequest(verb, std::move(payload), endpoint, timeout, trace)
+            .then([](std::unique_ptr<Payload>&& responsePayload) {
+                // parse status
+                auto result = std::make_tuple<Status, Response_t>(Status(), Response_t());
+                if (!responsePayload->read(std::get<0>(result))) {
+                    std::get<0>(result) = Statuses::S500_Internal_Server_Error("unable to parse status from response");
+                }
+                else {
+                    if (!responsePayload->read(std::get<1>(result))) {
+                        // failed to parse a Response_t
+                        std::get<0>(result) = Statuses::S500_Internal_Server_Error("unable to parse response object");
+                    }
+                }
+                return result;
+            })
+            .handle_exception([](auto exc) {
+                try {
+                    std::rethrow_exception(exc);
+                }
+                catch (const RPCDispatcher::RequestTimeoutException&) {
+                    return std::make_tuple<Status, Response_t>(Statuses::S503_Service_Unavailable("client timed out"), Response_t());
+                }
+                catch (const std::exception &e) {
+                    K2LOG_E(log::tx, "RPC send failed with uncaught exception: {}", e.what());
+                }
+                catch (...) {
+                    K2LOG_E(log::tx, "RPC send failed with unknown exception");
+                }
+
+                return std::make_tuple<Status, Response_t>(Statuses::S500_Internal_Server_Error("unknown exception while sending request"), Response_t());
+            });
+    }
+
     // Process new messages received from protocols
     void _handleNewMessage(Request&& request);
 
+    // records a finished span which started at startNanos
+    void _recordSpan(tracing::SpanKind kind, Verb verb, const tracing::TraceContext& trace, uint64_t parentSpanID,
+                     uint64_t startNanos, int32_t status);
+
+    // Hands a new request to the observer for its verb
+    void _dispatchRequest(Request&& request);
+
     // Helper method useds to send messages
     seastar::future<> _send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata meta);
 
+    // Helper method used to deliver a message to the dispatcher on another core in this process
+    void _sendCrossCore(unsigned dstCore, Request&& request);
+
+    // handles all messages which the given core has queued for us in its cross-core ring
+    void _drainCrossCoreRing(unsigned srcCore);
+
+    // called on the destination core when the source core rings the doorbell of a cross-core ring
+    void _onCrossCoreDoorbell(unsigned srcCore);
+
 private: // fields
     // the protocols this dispatcher will be able to support
     std::unordered_map<String, seastar::shared_ptr<IRPCProtocol>> _protocols;
@@ -258,26 +463,78 @@ private: // fields
     // the mapping we use to discover whether the given URL is owned by the other cores in the same process in order to perform in process loopback
     std::unordered_map<String, int> _url_cores;
 
+    // url -> the endpoint shared by all users of the url on this core. See getSharedTXEndpoint
+    std::unordered_map<String, seastar::lw_shared_ptr<TXEndpoint>> _sharedEndpoints;
+
     // the message observers
     std::unordered_map<Verb, RequestObserver_t> _observers;
 
+    // the observers registered with registerRPCObserver, for the local calls of callRPC
+    std::unordered_map<Verb, seastar::shared_ptr<_LocalObserverBase>> _localObservers;
+
+    // the scheduling groups the observers for some verbs run in
+    std::unordered_map<Verb, seastar::scheduling_group> _verbGroups;
+
     // to track the request-reply promises and timeouts
     typedef seastar::promise<std::unique_ptr<Payload>> PayloadPromise;
-    struct ResponseTracker {
-        PayloadPromise promise;
-        seastar::timer<> timer;
-    };
 
-    // map of all pending request-reply
-    std::unordered_map<uint64_t, ResponseTracker> _rrPromises;
+    // granularity of request-reply timeouts. Requests time out up to one tick after their deadline
+    ConfigDuration _rrTimeoutTick{"tx_request_timeout_tick", 1ms};
+
+    // all pending request-reply, indexed by message sequence id
+    PendingRequestTable<PayloadPromise> _rrPromises{_rrTimeoutTick()};
+
+    // fires once per tick while there are pending request-reply, to expire the ones past their deadline
+    seastar::timer<> _rrTimeoutTimer;
+
+    // called by _rrTimeoutTimer
+    void _expireRequests();
 
     // our observer for low memory events
     LowTransportMemoryObserver_t _lowMemObserver;
 
+    // records the spans of the traced requests
+    tracing::Tracer _tracer;
+
+    // times the tasks which handle incoming requests
+    TaskProfiler _taskProfiler;
+
+    // the transport metrics of this core, which the channels of the protocols also count into
+    TransportMetrics _metrics;
+
+    // exports the per-subsystem memory accounting of this core
+    mem::MemoryAccounting _memory;
+
+    // logs the requests whose handlers are slow
+    SlowLog _slowLog;
+
+    // sheds the requests of the RPC observers which can't be handled in time
+    AdmissionControl _admission;
+
     // sequence id used for request-reply
     // TODO use something a bit stronger than simple increment integer
     uint32_t _msgSequenceID;
 
+    // Messages from one core to another in this process go through a lock-free SPSC ring per (source, destination)
+    // pair. The source core only sends an smp message (the doorbell) when the ring goes from idle to busy, and the
+    // destination drains everything queued by then in one go.
+    struct CrossCoreChannel {
+        explicit CrossCoreChannel(size_t capacity) : ring(capacity) {}
+        SPSCRing<Request> ring;
+        // set by the source when it sends a doorbell, cleared by the destination once it has drained the ring
+        std::atomic<bool> doorbell{false};
+    };
+
+    // the channels for all core pairs, indexed by src * smp::count + dst. A channel is created by its source core
+    // on first use and lives for the lifetime of the process, since the other core may still be looking at it
+    // while we shut down
+    static inline std::once_flag _crossCoreChannelsInit;
+    static inline std::atomic<CrossCoreChannel*>* _crossCoreChannels = nullptr;
+
+    // per destination core, the number of messages we've sent around a full ring via submit_to which haven't been
+    // handled yet. While there are any, all messages to that core take the same path so that they stay in order
+    std::vector<uint32_t> _crossCoreSpills;
+
 private: // don't need
     RPCDispatcher(const RPCDispatcher& o) = delete;
     RPCDispatcher(RPCDispatcher&& o) = delete;
@@ -285,6 +542,15 @@ private: // don't need
     RPCDispatcher& operator=(RPCDispatcher&& o) = delete;
 
     ConfigVar<bool> _txUseCrossCoreLoopback{"tx_xcore_loopback", true};
+
+    // hand the requests of callRPC to the observers of this core directly, without serializing them
+    ConfigVar<bool> _txUseLocalDispatch{"tx_local_dispatch", true};
+
+    // use the SPSC rings for the cross-core loopback, rather than an smp message per message
+    ConfigVar<bool> _txUseCrossCoreRings{"tx_xcore_rings", true};
+
+    // the number of messages each cross-core ring holds
+    ConfigVar<size_t> _txCrossCoreRingSize{"tx_xcore_ring_size", 1024};
 };
 
 // global RPC dist container which can be initialized by main() of an application so that
@@ -23,6 +23,9 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include "RPCHeader.h"
 
+#include <algorithm>
+#include <limits>
+
 namespace k2 {
 
 void MessageMetadata::setPayloadSize(uint32_t payloadSize) {
@@ -63,11 +66,43 @@ bool MessageMetadata::isChecksumSet() const {
     return this->features & (1 << 3);  // bit3
 }
 
+void MessageMetadata::setUncompressedSize(uint32_t uncompressedSize) {
+    this->uncompressedSize = uncompressedSize;
+    this->features |= (1 << 4);  // bit4
+}
+
+bool MessageMetadata::isCompressed() const {
+    return this->features & (1 << 4);  // bit4
+}
+
+void MessageMetadata::setTraceContext(uint64_t traceID, uint64_t spanID) {
+    this->traceID = traceID;
+    this->spanID = spanID;
+    this->features |= (1 << 5);  // bit5
+}
+
+bool MessageMetadata::isTraceContextSet() const {
+    return this->features & (1 << 5);  // bit5
+}
+
+void MessageMetadata::setDeadline(Duration timeout) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(timeout).count();
+    this->deadlineMicros = (uint32_t)std::clamp<int64_t>(micros, 0, std::numeric_limits<uint32_t>::max());
+    this->features |= (1 << 6);  // bit6
+}
+
+bool MessageMetadata::isDeadlineSet() const {
+    return this->features & (1 << 6);  // bit6
+}
+
 size_t MessageMetadata::wireByteCount() {
     return isPayloadSizeSet() * sizeof(payloadSize) +
             isRequestIDSet() * sizeof(requestID) +
             isResponseIDSet() * sizeof(responseID) +
-            isChecksumSet() * sizeof(checksum);
+            isChecksumSet() * sizeof(checksum) +
+            isCompressed() * sizeof(uncompressedSize) +
+            isTraceContextSet() * (sizeof(traceID) + sizeof(spanID)) +
+            isDeadlineSet() * sizeof(deadlineMicros);
 }
 
 } // namespace k2
@@ -28,6 +28,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <cstring> // for size_t types
 
 // k2
+#include <k2/common/Chrono.h>
 #include <k2/common/Log.h>
 #include "Payload.h"
 #include "RPCTypes.h"
@@ -57,6 +58,12 @@ constexpr uint8_t MAX_HEADER_SIZE = 128;
 // | 4          | RequestID       | The request message ID - short-term unique number
 // | 4          | ResponseID      | The response message ID - repeat from a previous msg.RequestID
 // | 4          | Checksum        | The optional checksum for the message
+// | 4          | UncompressedSize| Set when the payload is LZ4-compressed: the payload size before compression.
+//                                  The payload size and checksum above are for the compressed (wire) bytes
+// | 8          | TraceID         | Set when the message is part of a sampled trace: the trace it belongs to
+// | 8          | SpanID          | The span of the sender, which is the parent of any span the receiver records
+// | 4          | Deadline        | Set on requests: the microseconds the sender waits for the reply. It is relative
+//                                  so that the receiver doesn't depend on the clocks being in sync
 //
 // Note that since the message is likely to be binaried, the payload will be stored and presented as
 // a Payload, which is basically an iovec which exposes the binaries for the payload.
@@ -92,6 +99,18 @@ public: // API
     void setChecksum(uint32_t checksum);
     bool isChecksumSet() const;
 
+    // uncompressed size at position 4. Set when the payload is compressed
+    void setUncompressedSize(uint32_t uncompressedSize);
+    bool isCompressed() const;
+
+    // trace context at position 5. Set when the message is part of a sampled trace
+    void setTraceContext(uint64_t traceID, uint64_t spanID);
+    bool isTraceContextSet() const;
+
+    // deadline at position 6. The time the sender waits for the reply, which is capped to what fits
+    void setDeadline(Duration timeout);
+    bool isDeadlineSet() const;
+
     // this method is used to determine how many wire bytes are needed given the set features
     size_t wireByteCount();
 
@@ -101,6 +120,10 @@ public: // fields
     uint32_t requestID = 0;
     uint32_t responseID = 0;
     uint32_t checksum = 0;
+    uint32_t uncompressedSize = 0;
+    uint64_t traceID = 0;
+    uint64_t spanID = 0;
+    uint32_t deadlineMicros = 0;
     // MAYBE TODO  crypto, sender endpoint
 };
 } // k2
@@ -22,6 +22,10 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include "RPCParser.h"
+
+#include <crc32c/crc32c.h>
+#include <lz4.h>
+
 namespace k2 {
 
 bool RPCParser::append(Binary& binary, size_t& writeOffset, const void* data, size_t size) {
@@ -51,6 +55,10 @@ RPCParser::RPCParser(std::function<bool()> preemptor, bool useChecksum) :
 RPCParser::~RPCParser() {
 }
 
+void RPCParser::enableCompression(size_t threshold) {
+    _compressionThreshold = threshold;
+}
+
 size_t RPCParser::serializeHeader(Binary& binary, Verb verb, MessageMetadata meta) {
     // we need to write a header of this many bytes:
     auto headerSize = sizeof(FixedHeader) + meta.wireByteCount();
@@ -97,6 +105,18 @@ bool RPCParser::writeHeader(Binary& binary, Verb verb, MessageMetadata meta) {
         if (!appendRaw(binary, writeOffset, meta.checksum))
             return false;
     }
+    if (meta.isCompressed()) {
+        if (!appendRaw(binary, writeOffset, meta.uncompressedSize))
+            return false;
+    }
+    if (meta.isTraceContextSet()) {
+        if (!appendRaw(binary, writeOffset, meta.traceID) || !appendRaw(binary, writeOffset, meta.spanID))
+            return false;
+    }
+    if (meta.isDeadlineSet()) {
+        if (!appendRaw(binary, writeOffset, meta.deadlineMicros))
+            return false;
+    }
     // all done.
 
     return true;
@@ -187,6 +207,7 @@ void RPCParser::_stWAIT_FOR_FIXED_HEADER() {
     // we come to this state when we think we have enough data to parse a new message from
     // the current binary.
     _payload.reset();  // get rid of any previous payload
+    _payloadChecksum = 0;
 
     if (_currentBinary.size() == 0) {
         _shouldParse = false;  // stop trying to parse
@@ -288,6 +309,20 @@ void RPCParser::_stWAIT_FOR_VARIABLE_HEADER() {
         std::memcpy((char*)&_metadata.checksum, _currentBinary.get_write(), sizeof(_metadata.checksum));
         _currentBinary.trim_front(sizeof(_metadata.checksum));
     }
+    if (_metadata.isCompressed()) {
+        std::memcpy((char*)&_metadata.uncompressedSize, _currentBinary.get_write(), sizeof(_metadata.uncompressedSize));
+        _currentBinary.trim_front(sizeof(_metadata.uncompressedSize));
+    }
+    if (_metadata.isTraceContextSet()) {
+        std::memcpy((char*)&_metadata.traceID, _currentBinary.get_write(), sizeof(_metadata.traceID));
+        _currentBinary.trim_front(sizeof(_metadata.traceID));
+        std::memcpy((char*)&_metadata.spanID, _currentBinary.get_write(), sizeof(_metadata.spanID));
+        _currentBinary.trim_front(sizeof(_metadata.spanID));
+    }
+    if (_metadata.isDeadlineSet()) {
+        std::memcpy((char*)&_metadata.deadlineMicros, _currentBinary.get_write(), sizeof(_metadata.deadlineMicros));
+        _currentBinary.trim_front(sizeof(_metadata.deadlineMicros));
+    }
     _pState = ParseState::WAIT_FOR_PAYLOAD;  // onto getting the payload
 }
 
@@ -341,6 +376,20 @@ void RPCParser::_stIN_PARTIAL_VARIABLE_HEADER() {
         std::memcpy((char*)&_metadata.checksum, data, sizeof(_metadata.checksum));
         data += sizeof(_metadata.checksum);
     }
+    if (_metadata.isCompressed()) {
+        std::memcpy((char*)&_metadata.uncompressedSize, data, sizeof(_metadata.uncompressedSize));
+        data += sizeof(_metadata.uncompressedSize);
+    }
+    if (_metadata.isTraceContextSet()) {
+        std::memcpy((char*)&_metadata.traceID, data, sizeof(_metadata.traceID));
+        data += sizeof(_metadata.traceID);
+        std::memcpy((char*)&_metadata.spanID, data, sizeof(_metadata.spanID));
+        data += sizeof(_metadata.spanID);
+    }
+    if (_metadata.isDeadlineSet()) {
+        std::memcpy((char*)&_metadata.deadlineMicros, data, sizeof(_metadata.deadlineMicros));
+        data += sizeof(_metadata.deadlineMicros);
+    }
     _pState = ParseState::WAIT_FOR_PAYLOAD;  // onto getting the payload
 }
 
@@ -371,6 +420,10 @@ void RPCParser::_stWAIT_FOR_PAYLOAD() {
     // get whatever we can from the current binary. Let the state machine run again in this state
     // to determine if we had enough, or we need more
     auto bytesThisRound = std::min(needed, available);
+    if (_useChecksum && _metadata.isChecksumSet()) {
+        // checksum the slice now while it's still hot in cache, rather than re-reading the payload at dispatch
+        _payloadChecksum = crc32c::Extend(_payloadChecksum, reinterpret_cast<const uint8_t*>(_currentBinary.get()), bytesThisRound);
+    }
     // last case, we have more data than we need. Extract a slice from the binary
     _payload->appendBinary(_currentBinary.share(0, bytesThisRound));
     // rewind the binary
@@ -379,12 +432,15 @@ void RPCParser::_stWAIT_FOR_PAYLOAD() {
 
 void RPCParser::_stREADY_TO_DISPATCH() {
     if (_useChecksum && _payload && _metadata.isChecksumSet()) {
-        auto checksum = _payload->computeCrc32c();
-        if (checksum != _metadata.checksum) {
+        if (_payloadChecksum != _metadata.checksum) {
             _setParserFailure(ChecksumValidationException());
             return;
         }
     }
+    if (_metadata.isCompressed() && !_decompress()) {
+        _setParserFailure(DecompressionException());
+        return;
+    }
     _messageObserver(_fixedHeader.verb, std::move(_metadata), std::move(_payload));
 
     // only now we're ready to process the next message
@@ -418,10 +474,63 @@ RPCParser::serializeMessage(Payload&& message, Verb verb, MessageMetadata metada
     return std::make_unique<Payload>(std::move(buffers), headerSize + metaPayloadSize);
 }
 
+std::unique_ptr<Payload>
+RPCParser::_compress(std::unique_ptr<Payload> payload, size_t dataSize, MessageMetadata& metadata) {
+    if (dataSize > size_t(LZ4_MAX_INPUT_SIZE)) {
+        return payload;
+    }
+    // LZ4 needs contiguous input. It is only copied if it spans buffers
+    payload->seek(txconstants::MAX_HEADER_SIZE);
+    const char* data = nullptr;
+    String scratch;
+    if (!payload->readView(data, dataSize, scratch)) {
+        return payload;
+    }
+    int bound = LZ4_compressBound(int(dataSize));
+    Binary compressed(txconstants::MAX_HEADER_SIZE + bound);
+    int compressedSize = LZ4_compress_default(data, compressed.get_write() + txconstants::MAX_HEADER_SIZE, int(dataSize), bound);
+    if (compressedSize <= 0 || size_t(compressedSize) >= dataSize) {
+        K2LOG_D(log::tx, "payload of size {} does not compress; sending it uncompressed", dataSize);
+        return payload;
+    }
+    K2LOG_D(log::tx, "compressed payload of size {} to {}", dataSize, compressedSize);
+    metadata.setUncompressedSize(uint32_t(dataSize));
+    compressed.trim(txconstants::MAX_HEADER_SIZE + compressedSize);
+    std::vector<Binary> buffers;
+    buffers.push_back(std::move(compressed));
+    return std::make_unique<Payload>(std::move(buffers), txconstants::MAX_HEADER_SIZE + compressedSize);
+}
+
+bool RPCParser::_decompress() {
+    if (!_payload || _metadata.uncompressedSize > uint32_t(LZ4_MAX_INPUT_SIZE)) {
+        return false;
+    }
+    auto compressedSize = _payload->getSize();
+    _payload->seek(0);
+    const char* data = nullptr;
+    String scratch;
+    if (!_payload->readView(data, compressedSize, scratch)) {
+        return false;
+    }
+    Binary decompressed(_metadata.uncompressedSize);
+    int size = LZ4_decompress_safe(data, decompressed.get_write(), int(compressedSize), int(decompressed.size()));
+    if (size < 0 || uint32_t(size) != _metadata.uncompressedSize) {
+        return false;
+    }
+    std::vector<Binary> buffers;
+    buffers.push_back(std::move(decompressed));
+    _payload = std::make_unique<Payload>(std::move(buffers), size_t(size));
+    return true;
+}
+
 std::vector<Binary>
 RPCParser::prepareForSend(Verb verb, std::unique_ptr<Payload> payload, MessageMetadata metadata) {
     K2ASSERT(log::tx, payload->getSize() >= txconstants::MAX_HEADER_SIZE, "payload size too big");
     auto dataSize = payload->getSize() - txconstants::MAX_HEADER_SIZE;
+    if (_compressionThreshold > 0 && dataSize >= _compressionThreshold) {
+        payload = _compress(std::move(payload), dataSize, metadata);
+        dataSize = payload->getSize() - txconstants::MAX_HEADER_SIZE;
+    }
     metadata.setPayloadSize(dataSize);
     if (_useChecksum) {
         // compute checksum starting at MAX_HEADER_SIZE until end of payload
@@ -51,13 +51,17 @@ public: // types
     // indicates that checksum validation has failed
     class ChecksumValidationException : public std::exception {};
 
+    // indicates that a compressed payload could not be decompressed
+    class DecompressionException : public std::exception {};
+
     // indicates that we expected to receive the second segment for partial header, but
     // the segment we received did not have enough data.
     class NonContinuationSegmentException : public std::exception {};
 
    public:
-    // creates an RPC parser with the given preemptor function. Users can request that we validate/generate checksums
-    // at the expense of extra read pass over the data
+    // creates an RPC parser with the given preemptor function. Users can request that we validate/generate checksums.
+    // Generating costs an extra read pass over outgoing data. Validation is done incrementally as the payload
+    // binaries arrive, so incoming data is not read twice
     RPCParser(std::function<bool()> preemptor, bool useChecksum);
 
     // destructor. Any incomplete messages are dropped
@@ -80,6 +84,11 @@ public: // types
     // The user can also provide features via the metadata field
     static std::unique_ptr<Payload> serializeMessage(Payload&& message, Verb verb, MessageMetadata metadata);
 
+    // Compress (LZ4) the payloads of outgoing messages with at least threshold bytes, when that makes them smaller.
+    // Off by default: it costs a copy and CPU, and only pays off on bandwidth-constrained links. Compressed
+    // incoming messages are always decompressed, so only the sending side has to enable it
+    void enableCompression(size_t threshold);
+
     // This method is used to prepare a given mesage for sending. The resulting iovec can be passed to lower-level
     // transport as packets to send.
     std::vector<Binary> prepareForSend(Verb verb, std::unique_ptr<Payload> payload, MessageMetadata metadata);
@@ -134,6 +143,13 @@ private: // methods
 
     void _setParserFailure(std::exception&& exc);
 
+    // returns the compressed version of the given outgoing payload (with header room), or the payload itself if
+    // compression doesn't make it smaller
+    static std::unique_ptr<Payload> _compress(std::unique_ptr<Payload> payload, size_t dataSize, MessageMetadata& metadata);
+
+    // decompresses the payload of the current message. Returns false if the payload is corrupted
+    bool _decompress();
+
     static bool append(Binary& binary, size_t& writeOffset, const void* data, size_t size);
 
     template <typename T>
@@ -159,6 +175,9 @@ private: // methods
     // flag used to determine if we should compute/validate checksums
     bool _useChecksum;
 
+    // outgoing payloads with at least this many bytes are compressed. 0 means no compression
+    size_t _compressionThreshold = 0;
+
     // the parser state
     ParseState _pState;
 
@@ -171,6 +190,9 @@ private: // methods
     // the payload for the current message;
     std::unique_ptr<Payload> _payload;
 
+    // running crc32c over the payload bytes received so far for the current message
+    uint32_t _payloadChecksum = 0;
+
     // partial binary left over from previous parsing. Only used when header(variable or fixed) spans two binarys
     Binary _partialBinary;
 
@@ -25,6 +25,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <k2/config/Config.h>
 #include "Log.h"
+#include "TransportMetrics.h"
 
 namespace k2 {
 
@@ -52,7 +53,13 @@ void RRDMARPCChannel::send(Verb verb, std::unique_ptr<Payload> payload, MessageM
         K2LOG_W(log::tx, "channel is going down. ignoring send");
         return;
     }
-    _rconn->send(_rpcParser.prepareForSend(verb, std::move(payload), std::move(metadata)));
+    auto buffers = _rpcParser.prepareForSend(verb, std::move(payload), std::move(metadata));
+    if (auto* metrics = TransportMetrics::local(); metrics) {
+        for (auto& buf : buffers) {
+            metrics->rrdma.bytesOut += buf.size();
+        }
+    }
+    _rconn->send(std::move(buffers));
 }
 
 void RRDMARPCChannel::run() {
@@ -66,6 +73,9 @@ void RRDMARPCChannel::run() {
     _rpcParser.registerParserFailureObserver(
         [this](std::exception_ptr exc) {
             K2LOG_W_EXC(log::tx, exc, "Received parser exception");
+            if (auto* metrics = TransportMetrics::local(); metrics) {
+                metrics->rrdma.parseErrors++;
+            }
             this->_failureObserver(this->_endpoint, exc);
         }
     );
@@ -85,6 +95,9 @@ void RRDMARPCChannel::run() {
                         K2LOG_D(log::tx, "remote end closed connection");
                         return; // just say we're done so the loop can evaluate the end condition
                     }
+                    if (auto* metrics = TransportMetrics::local(); metrics) {
+                        metrics->rrdma.bytesIn += packet.size();
+                    }
                     _rpcParser.feed(std::move(packet));
                     // process some messages from the packet
                     _rpcParser.dispatchSome();
@@ -156,6 +156,12 @@ void RRDMARPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpo
     chan->send(verb, std::move(payload), std::move(metadata));
 }
 
+void RRDMARPCProtocol::connect(TXEndpoint& endpoint) {
+    if (!_stopped) {
+        _getOrMakeChannel(endpoint);
+    }
+}
+
 seastar::lw_shared_ptr<RRDMARPCChannel> RRDMARPCProtocol::_getOrMakeChannel(TXEndpoint& endpoint) {
     // look for an existing channel
     auto iter = _channels.find(endpoint);
@@ -68,6 +68,9 @@ public: // API
     // The RPC message is configured with the given metadata
     void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) override;
 
+    // Opens a channel to the endpoint unless there is one
+    void connect(TXEndpoint& endpoint) override;
+
     // Returns the endpoint where this protocol accepts incoming connections.
     seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
 
@@ -43,7 +43,8 @@ Request::Request(Request&& o):
     verb(o.verb),
     endpoint(std::move(o.endpoint)),
     metadata(std::move(o.metadata)),
-    payload(std::move(o.payload)) {
+    payload(std::move(o.payload)),
+    received(o.received) {
     o.verb = InternalVerbs::NIL;
     K2LOG_D(log::tx, "move Request @{}, with verb={}, from {}", ((void*)this), int(verb), endpoint.url);
 }
@@ -24,6 +24,7 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 #include <memory>
 
+#include <k2/common/Chrono.h>
 #include <k2/common/Common.h>
 #include "RPCHeader.h"
 #include "RPCTypes.h"
@@ -57,6 +58,14 @@ public: // fields
     // the payload of this request
     std::unique_ptr<Payload> payload;
 
+    // when the dispatcher received the request. Used for the queueing time of slow requests
+    TimePoint received;
+
+    // when the sender stops waiting for the reply, or TimePoint::max() if it didn't say
+    TimePoint deadline() const {
+        return metadata.isDeadlineSet() ? received + std::chrono::microseconds(metadata.deadlineMicros) : TimePoint::max();
+    }
+
 private: // don't need
     Request() = delete;
     Request(const Request& o) = delete;
@@ -60,4 +60,82 @@ ExponentialBackoffStrategy& ExponentialBackoffStrategy::withStartTimeout(Duratio
     return *this;
 }
 
+LatencyTracker::LatencyTracker(size_t windowSize) : _windowSize(std::max(size_t(1), windowSize)) {
+    _window.reserve(_windowSize);
+}
+
+void LatencyTracker::add(Duration latency) {
+    if (_window.size() < _windowSize) {
+        _window.push_back(latency);
+        return;
+    }
+    _window[_next] = latency;
+    _next = (_next + 1) % _windowSize;
+}
+
+size_t LatencyTracker::size() const {
+    return _window.size();
+}
+
+Duration LatencyTracker::percentile(double p) const {
+    if (_window.empty()) {
+        return Duration(0);
+    }
+    auto sorted = _window;
+    size_t idx = std::min(sorted.size() - 1, size_t(std::max(0.0, p) * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+    return sorted[idx];
+}
+
+HedgingStrategy::HedgingStrategy() : _maxAttempts(2),
+                                     _timeout(1s),
+                                     _fixedHedgeDelay(10ms),
+                                     _percentile(0.95),
+                                     _used(false) {
+    K2LOG_D(log::tx, "ctor maxAttempts {}, timeout {}ms, hedgeDelay {}ms", _maxAttempts, k2::msec(_timeout).count(), k2::msec(_fixedHedgeDelay).count());
+}
+
+// destructor
+HedgingStrategy::~HedgingStrategy() {
+    K2LOG_D(log::tx, "dtor");
+}
+
+// Set the total number of attempts
+HedgingStrategy& HedgingStrategy::withMaxAttempts(int maxAttempts) {
+    K2LOG_D(log::tx, "maxAttempts: {}", maxAttempts);
+    _maxAttempts = maxAttempts;
+    return *this;
+}
+
+// Set the timeout for each attempt
+HedgingStrategy& HedgingStrategy::withTimeout(Duration timeout) {
+    K2LOG_D(log::tx, "timeout: {}ms", k2::msec(timeout).count());
+    _timeout = timeout;
+    return *this;
+}
+
+// Set the fixed hedge delay
+HedgingStrategy& HedgingStrategy::withHedgeDelay(Duration hedgeDelay) {
+    K2LOG_D(log::tx, "hedgeDelay: {}ms", k2::msec(hedgeDelay).count());
+    _fixedHedgeDelay = hedgeDelay;
+    return *this;
+}
+
+// Set the latency tracker for the adaptive hedge delay
+HedgingStrategy& HedgingStrategy::withLatencyPercentile(seastar::lw_shared_ptr<LatencyTracker> tracker, double percentile) {
+    K2LOG_D(log::tx, "percentile: {}", percentile);
+    _tracker = std::move(tracker);
+    _percentile = percentile;
+    return *this;
+}
+
+Duration HedgingStrategy::_hedgeDelay() const {
+    // with too few latencies, the percentile is mostly noise
+    static constexpr size_t minLatencies = 16;
+    if (_tracker && _tracker->size() >= minLatencies) {
+        return _tracker->percentile(_percentile);
+    }
+    return _fixedHedgeDelay;
+}
+
 }  // namespace k2
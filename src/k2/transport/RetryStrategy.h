@@ -26,6 +26,8 @@ Copyright(c) 2020 Futurewei Cloud
 // third-party
 #include <seastar/core/future.hh>
 #include <seastar/core/future-util.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/timer.hh>
 
 // k2
 #include <k2/common/Common.h>
@@ -119,4 +121,175 @@ private: // fields
     bool _used;
 }; // ExponentialBackoffStrategy
 
+// Keeps the latencies of the last few calls of some kind, to compute latency percentiles over them
+class LatencyTracker {
+public:
+    // track the latencies of the last windowSize calls
+    LatencyTracker(size_t windowSize=128);
+
+    // record the latency of a call
+    void add(Duration latency);
+
+    // the number of latencies we have
+    size_t size() const;
+
+    // the latency under which the given fraction (e.g. 0.95) of the tracked calls completed
+    Duration percentile(double p) const;
+
+private:
+    std::vector<Duration> _window;
+    size_t _next = 0;
+    size_t _windowSize;
+};
+
+// A hedging strategy, for idempotent requests (e.g. reads, CPO gets, TSO batches) only.
+// When run() is invoked with some function, the function is called with the attempt index and the timeout
+// it should use. If the attempt doesn't complete within the hedge delay, the function is called again (a hedge)
+// without waiting for the first attempt. A failed attempt is re-tried right away, up to the max number of attempts.
+// The first successful result is returned, and the results of the other attempts are ignored.
+// Note that we cannot abort the RPC of a losing attempt. We only make sure that no more attempts are started once
+// we have a result.
+// The hedge delay is the given percentile of the latencies in the latency tracker when it has enough of them,
+// so that only the slowest calls are hedged. The successful calls are added to the tracker.
+class HedgingStrategy {
+public: // types
+    // this is returned in an exceptional future if you attempt to call run() more than once
+    class DuplicateExecutionException : public std::exception {};
+
+public: // lifecycle
+    // create a new HedgingStrategy
+    HedgingStrategy();
+
+    // destructor
+    ~HedgingStrategy();
+
+    // Set the total number of attempts, including the first one
+    HedgingStrategy& withMaxAttempts(int maxAttempts);
+
+    // Set the timeout to give to each attempt
+    HedgingStrategy& withTimeout(Duration timeout);
+
+    // Set the hedge delay to use while the latency tracker doesn't have enough latencies
+    HedgingStrategy& withHedgeDelay(Duration hedgeDelay);
+
+    // Derive the hedge delay from the given percentile of the latencies in the given tracker.
+    // The tracker is normally shared by all calls of the same kind
+    HedgingStrategy& withLatencyPercentile(seastar::lw_shared_ptr<LatencyTracker> tracker, double percentile);
+
+public: // API
+    // Execute the given function until one of the attempts succeeds or all attempts fail. If they all fail, we
+    // return the exception tossed from the last attempt to finish. The function must return a future, and the
+    // value of the first successful attempt is returned in the resulting future.
+    // The function may still be called after the returned future is ready (while the other attempts complete),
+    // so it must not refer to state owned by the caller of run()
+    template<typename Func>
+    auto run(Func&& func) {
+        using Future_t = std::invoke_result_t<Func&, int, Duration>;
+        if (_used) {
+            K2LOG_W(log::tx, "This strategy has already been used");
+            return seastar::futurize<Future_t>::make_exception_future(DuplicateExecutionException());
+        }
+        _used = true;
+        auto state = seastar::make_lw_shared<_State<std::decay_t<Func>, Future_t>>(std::forward<Func>(func));
+        state->maxAttempts = std::max(1, _maxAttempts);
+        state->timeout = _timeout;
+        state->hedgeDelay = _hedgeDelay();
+        state->tracker = _tracker;
+        auto result = state->promise.get_future();
+        _launch(state);
+        return result;
+    }
+
+private: // types
+    template<typename Func, typename Future_t>
+    struct _State : public seastar::enable_lw_shared_from_this<_State<Func, Future_t>> {
+        template<typename F>
+        _State(F&& f) : func(std::forward<F>(f)) {}
+        Func func;
+        typename Future_t::promise_type promise;
+        seastar::lw_shared_ptr<LatencyTracker> tracker;
+        // fires after the hedge delay, to start another attempt
+        seastar::timer<> hedgeTimer;
+        Duration hedgeDelay;
+        Duration timeout;
+        int maxAttempts = 1;
+        int launched = 0;
+        int running = 0;
+        bool done = false;
+        bool shutdown = false;
+    };
+
+private: // methods
+    // the hedge delay for a new run
+    Duration _hedgeDelay() const;
+
+    // start the next attempt, and arm the hedge timer if more attempts are allowed
+    template<typename State_t>
+    static void _launch(seastar::lw_shared_ptr<State_t> state) {
+        int attempt = state->launched++;
+        state->running++;
+        auto start = TSCClock::now();
+        K2LOG_D(log::tx, "running attempt {}, with timeout {}ms", attempt, k2::msec(state->timeout).count());
+        (void)seastar::futurize_invoke(state->func, attempt, state->timeout)
+            .then_wrapped([state, start](auto&& fut) {
+                state->running--;
+                if (state->done) {
+                    // we already have a result
+                    fut.ignore_ready_future();
+                    return;
+                }
+                if (!fut.failed()) {
+                    K2LOG_D(log::tx, "attempt succeeded after {} attempts", state->launched);
+                    if (state->tracker) {
+                        state->tracker->add(TSCClock::now() - start);
+                    }
+                    state->done = true;
+                    state->hedgeTimer.cancel();
+                    fut.forward_to(std::move(state->promise));
+                    return;
+                }
+                auto exc = fut.get_exception();
+                try {
+                    std::rethrow_exception(exc);
+                } catch (RPCDispatcher::DispatcherShutdown&) {
+                    K2LOG_D(log::tx, "Dispatcher has shut down. Stopping hedging");
+                    state->shutdown = true;
+                } catch (...) {
+                }
+                if (!state->shutdown && state->launched < state->maxAttempts) {
+                    // re-try the failed attempt right away
+                    state->hedgeTimer.cancel();
+                    _launch(state);
+                } else if (state->running == 0) {
+                    state->done = true;
+                    state->hedgeTimer.cancel();
+                    state->promise.set_exception(exc);
+                }
+            });
+        if (!state->done && state->launched < state->maxAttempts && !state->hedgeTimer.armed()) {
+            // the timer is owned by the state, so it can't outlive it
+            state->hedgeTimer.set_callback([st = state.get()] {
+                if (!st->done && !st->shutdown && st->launched < st->maxAttempts) {
+                    K2LOG_D(log::tx, "attempt {} is taking too long; hedging", st->launched - 1);
+                    _launch(st->shared_from_this());
+                }
+            });
+            state->hedgeTimer.arm(state->hedgeDelay);
+        }
+    }
+
+private: // fields
+    // how many attempts we can start
+    int _maxAttempts;
+    // the timeout for each attempt
+    Duration _timeout;
+    // the fixed hedge delay
+    Duration _fixedHedgeDelay;
+    // the tracker and percentile for the adaptive hedge delay
+    seastar::lw_shared_ptr<LatencyTracker> _tracker;
+    double _percentile;
+    // indicate if this strategy has been used already so that we can reject duplicate attempts to use it
+    bool _used;
+}; // HedgingStrategy
+
 } // k2
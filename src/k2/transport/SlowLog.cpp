@@ -0,0 +1,85 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "SlowLog.h"
+
+#include <seastar/core/metrics.hh>
+#include <seastar/core/smp.hh>
+
+#include "Log.h"
+
+namespace k2 {
+namespace sm = seastar::metrics;
+
+void SlowLog::start() {
+    _local = this;
+    std::vector<sm::label_instance> labels;
+    labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+    _metricGroups.add_group("transport", {
+        sm::make_counter("slow_requests", _slowRequests, sm::description("Requests whose handlers took longer than the slow request threshold"), labels),
+        sm::make_counter("slow_requests_not_logged", _suppressed, sm::description("Slow requests which weren't logged because of the log rate limit"), labels),
+    });
+}
+
+void SlowLog::stop() {
+    _metricGroups.clear();
+    if (_local == this) {
+        _local = nullptr;
+    }
+}
+
+seastar::lw_shared_ptr<SlowOp> SlowLog::begin(Verb verb, TimePoint received) {
+    if (_threshold() == Duration(0)) {
+        return nullptr;
+    }
+    auto op = seastar::make_lw_shared<SlowOp>();
+    op->verb = verb;
+    op->received = received;
+    op->started = TSCClock::now();
+    return op;
+}
+
+void SlowLog::finish(const SlowOp& op, int status, const String& from) {
+    auto now = TSCClock::now();
+    auto handler = now - op.started;
+    if (handler <= _threshold()) {
+        return;
+    }
+    _slowRequests++;
+    if (now - _windowStart >= 1s) {
+        _windowStart = now;
+        _windowLogged = 0;
+    }
+    if (_windowLogged >= _maxPerSecond()) {
+        _suppressed++;
+        return;
+    }
+    _windowLogged++;
+    K2LOG_W(log::tx,
+        "slow request verb={} status={} from={} partition={} keyHash={} txnId={} txnTimestamp={}: total={}, queueing={}, handler={}, push={}, persistence={}, not logged since last={}",
+        int(op.verb), status, from, op.partition, op.keyHash, op.txnId, op.txnTimestamp,
+        now - op.received, op.started - op.received, handler, op.push, op.persistence, _suppressed - _reportedSuppressed);
+    _reportedSuppressed = _suppressed;
+}
+
+} // ns k2
@@ -0,0 +1,132 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#include <seastar/core/future.hh>
+#include <seastar/core/metrics_registration.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include <k2/common/Chrono.h>
+#include <k2/config/Config.h>
+#include "RPCTypes.h"
+
+namespace k2 {
+
+// The time breakdown and the context of one incoming request, kept while the request is handled
+struct SlowOp {
+    Verb verb = 0;
+    // when the dispatcher received the request and when its observer was called
+    TimePoint received;
+    TimePoint started;
+    // the parts of the handler time spent waiting on pushes and on persistence
+    Duration push{0};
+    Duration persistence{0};
+    // what the request is about, as set by the handler with SlowLog::annotate()
+    uint64_t partition = 0;
+    uint64_t keyHash = 0;
+    uint64_t txnId = 0;
+    uint64_t txnTimestamp = 0;
+};
+
+// Per-core log of the requests whose handlers take longer than tx_slow_request_threshold. They are logged with
+// their verb, status, context and time breakdown at WARN level, which goes through the async log backend when
+// it is enabled. At most tx_slow_request_log_rate requests are logged per second, and the count of the requests
+// which weren't logged over the limit is included in the next line.
+// The dispatcher tracks the requests of its RPC observers. Handlers add their context and the time they spend in
+// pushes and persistence to the current request, which they have to capture before their first continuation
+// since seastar doesn't carry it across continuations(see timed())
+class SlowLog {
+public:
+    void start();
+    void stop();
+
+    // the log of this core, or nullptr if it isn't running
+    static SlowLog* local() { return _local; }
+
+    // starts tracking a request which the dispatcher received at the given time. Returns nullptr if the slow log
+    // is disabled
+    seastar::lw_shared_ptr<SlowOp> begin(Verb verb, TimePoint received);
+
+    // completes the tracking of a request, logging it if it was slow
+    void finish(const SlowOp& op, int status, const String& from);
+
+    // the request whose handler is running on this core right now, or nullptr. Set with a Scope
+    static const seastar::lw_shared_ptr<SlowOp>& current() { return _current; }
+
+    // sets the context of the current request, if there is one
+    static void annotate(uint64_t partition, uint64_t keyHash, uint64_t txnId, uint64_t txnTimestamp) {
+        if (_current) {
+            _current->partition = partition;
+            _current->keyHash = keyHash;
+            _current->txnId = txnId;
+            _current->txnTimestamp = txnTimestamp;
+        }
+    }
+
+    // adds the time until the given future resolves to a part of the breakdown of the current request
+    template <typename Fut>
+    static Fut timed(Duration SlowOp::* part, Fut&& fut) {
+        if (!_current) {
+            return std::move(fut);
+        }
+        return fut.finally([op=_current, part, start=TSCClock::now()] {
+            (*op).*part += TSCClock::now() - start;
+        });
+    }
+
+    // Makes the given request the current one for the lifetime of the scope
+    class Scope {
+    public:
+        explicit Scope(seastar::lw_shared_ptr<SlowOp> op) : _previous(std::move(_current)) {
+            _current = std::move(op);
+        }
+        ~Scope() { _current = std::move(_previous); }
+
+    private:
+        seastar::lw_shared_ptr<SlowOp> _previous;
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+private:
+    static inline thread_local SlowLog* _local = nullptr;
+    static inline thread_local seastar::lw_shared_ptr<SlowOp> _current;
+
+    // the requests logged in the current second, and the ones over the limit which weren't logged
+    TimePoint _windowStart;
+    uint32_t _windowLogged = 0;
+    uint64_t _suppressed = 0;
+    uint64_t _reportedSuppressed = 0;
+
+    uint64_t _slowRequests = 0;
+    seastar::metrics::metric_groups _metricGroups;
+
+    // 0 disables the slow log
+    ConfigDuration _threshold{"tx_slow_request_threshold", 100ms};
+    ConfigVar<uint32_t> _maxPerSecond{"tx_slow_request_log_rate", 10};
+};
+
+} // ns k2
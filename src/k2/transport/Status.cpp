@@ -29,7 +29,7 @@ bool Status::operator==(const Status& o) { return code == o.code; }
 bool Status::operator!=(const Status& o) { return !(code == o.code); }
 
 Status Status::operator()(String message) const {
-    return Status{this->code, message};
+    return Status{this->code, StatusMessage(std::move(message))};
 }
 
 bool Status::is1xxInProgress() const { return code >= 100 && code <= 199; }
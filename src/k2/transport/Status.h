@@ -25,25 +25,90 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <signal.h>
 #include <iostream>
+#include <string_view>
 
 #include <k2/common/Log.h>
 #include <k2/transport/PayloadSerialization.h>
 namespace k2 {
 
+// The message of a Status. A message given as a string literal, which is how nearly all responses are built
+// (e.g. K23SIStatus::OK("read succeeded")), is kept as a pointer to the literal, so creating, copying and
+// serializing the status doesn't allocate. Other messages(e.g. formatted error details) are kept in a String.
+// Either way the message goes on the wire as a String, so the format is the same as before for all peers.
+// Received messages are always dynamic
+class StatusMessage {
+public:
+    StatusMessage() = default;
+    StatusMessage(String message) : _dynamic(std::move(message)) {}
+    // only for string literals and other arrays of static storage duration: the bytes are not copied
+    template <size_t N>
+    StatusMessage(const char (&literal)[N]) : _static(literal), _staticSize(N - 1) {}
+
+    const char* data() const { return _static ? _static : _dynamic.data(); }
+    size_t size() const { return _static ? _staticSize : _dynamic.size(); }
+    bool empty() const { return size() == 0; }
+    std::string_view view() const { return std::string_view(data(), size()); }
+    String str() const { return _static ? String(_static, _staticSize) : _dynamic; }
+    // true if the message refers to a literal rather than owning its bytes
+    bool isStatic() const { return _static != nullptr; }
+
+    bool operator==(std::string_view o) const { return view() == o; }
+    bool operator!=(std::string_view o) const { return view() != o; }
+
+    // serialized exactly like a String
+    struct __K2PayloadSerializableTraitTag__ {};
+    void __writeFields(Payload& payload) const {
+        payload.write(uint32_t(size() + 1));
+        // both literals and Strings are null-terminated
+        payload.write(data(), size() + 1);
+    }
+    bool __readFields(Payload& payload) {
+        _static = nullptr;
+        _staticSize = 0;
+        return payload.read(_dynamic);
+    }
+    size_t __serializedSize() const { return sizeof(uint32_t) + size() + 1; }
+
+    template <typename OStream_T>
+    friend OStream_T& operator<<(OStream_T& os, const StatusMessage& o) {
+        if constexpr (std::is_same<OStream_T, std::ostream>::value) {
+            fmt::print(os, "{}", o.str());
+        } else {
+            fmt::format_to(os.out(), "{}", o.str());
+        }
+        return os;
+    }
+    friend void to_json(nlohmann::json& j, const StatusMessage& o) {
+        j = o.str();
+    }
+    friend void from_json(const nlohmann::json& j, StatusMessage& o) {
+        o = StatusMessage(j.get<String>());
+    }
+
+private:
+    const char* _static = nullptr;
+    size_t _staticSize = 0;
+    String _dynamic;
+};
+
 // A status in K2 follows established HTTP codes. API writers should use the status generators below to produce
 // status codes as desired. The code and description are standard HTTP, but a custom message can be also delivered
 // with each such code.
 struct Status {
     int code;
-    String message;
+    StatusMessage message;
     K2_PAYLOAD_FIELDS(code, message);
     // two Statuses are equal if they have the same code
     bool operator==(const Status& o);
     bool operator!=(const Status& o);
 
     // Create a new status object with different message but same code. This is useful for the staticly
-    // defined codes below
+    // defined codes below. A literal message is referenced rather than copied(see StatusMessage)
     Status operator()(String message) const;
+    template <size_t N>
+    Status operator()(const char (&message)[N]) const {
+        return Status{code, StatusMessage(message)};
+    }
 
     // 1xx series codes for in-progress work
     bool is1xxInProgress() const;
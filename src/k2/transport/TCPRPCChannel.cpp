@@ -27,8 +27,10 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/config/Config.h>
 
 // third-party
+#include <seastar/core/future-util.hh>
 #include <seastar/net/inet_address.hh>
 #include "Log.h"
+#include "TransportMetrics.h"
 
 namespace k2 {
 
@@ -42,6 +44,11 @@ TCPRPCChannel::TCPRPCChannel(seastar::future<seastar::connected_socket> futureSo
     _futureSocket(std::move(futureSocket)),
     _sendFuture(seastar::make_ready_future<>()){
     K2LOG_D(log::tx, "new future channel");
+    const auto& hosts = _compressedHosts();
+    if (std::find(hosts.begin(), hosts.end(), _endpoint.ip) != hosts.end()) {
+        K2LOG_D(log::tx, "compressing messages to {}", _endpoint.url);
+        _rpcParser.enableCompression(_compressionThreshold());
+    }
     registerMessageObserver(requestObserver);
     registerFailureObserver(failureObserver);
 }
@@ -51,6 +58,10 @@ TCPRPCChannel::~TCPRPCChannel(){
     if (!_closingInProgress) {
         K2LOG_W(log::tx, "destructor without graceful close");
     }
+    if (auto* metrics = TransportMetrics::local(); metrics) {
+        // writes which were still waiting for the connection are dropped with us
+        metrics->tcpConnectingMessages -= _pendingWrites.size();
+    }
 }
 
 void TCPRPCChannel::run() {
@@ -83,16 +94,95 @@ void TCPRPCChannel::send(Verb verb, std::unique_ptr<Payload> payload, MessageMet
         // we don't have a connected socket yet. Queue up the request
         K2LOG_D(log::tx, "send: not connected yet. Buffering the write, have buffered already {}", _pendingWrites.size());
         _pendingWrites.push_back(std::move(packet));
+        if (auto* metrics = TransportMetrics::local(); metrics) {
+            metrics->tcpConnectingMessages++;
+        }
         return;
     }
     _sendPacket(std::move(packet));
 }
 
 void TCPRPCChannel::_sendPacket(seastar::net::packet&& packet) {
-    _sendFuture = _sendFuture->then([packet = std::move(packet), this]() mutable {
-        return _out.write(std::move(packet));
-    }).then([this]() {
-        return _out.flush();
+    if (_openBatchMessages == 0) {
+        _openBatchStart = CachedSteadyClock::now();
+    }
+    if (auto* metrics = TransportMetrics::local(); metrics) {
+        metrics->tcpQueuedBytes += packet.len();
+    }
+    _openBatch = seastar::net::packet(std::move(_openBatch), std::move(packet));
+    ++_openBatchMessages;
+
+    if (_openBatch.len() >= _maxBatchBytes() || _openBatchMessages >= _maxBatchMessages() ||
+        CachedSteadyClock::now() - _openBatchStart >= _maxBatchLatency()) {
+        _sealBatch();
+    }
+
+    if (_flushInProgress) {
+        // the drain loop will pick this message up once the in-flight flush completes
+        return;
+    }
+    _flushInProgress = true;
+    _sendFuture = _sendFuture->then([this] {
+        return _drainBatches();
+    }).then_wrapped([this](auto&& fut) {
+        _flushInProgress = false;
+        if (fut.failed()) {
+            // the stream is broken. Nothing queued from here on can be delivered
+            K2LOG_D(log::tx, "dropping {} sealed batches and {} open messages after send failure", _sealedBatches.size(), _openBatchMessages);
+            if (auto* metrics = TransportMetrics::local(); metrics) {
+                size_t dropped = _openBatch.len();
+                for (auto& batch : _sealedBatches) {
+                    dropped += batch.packet.len();
+                }
+                metrics->tcpQueuedBytes -= dropped;
+            }
+            _sealedBatches.clear();
+            _openBatch = seastar::net::packet();
+            _openBatchMessages = 0;
+        }
+        return std::move(fut);
+    });
+}
+
+void TCPRPCChannel::_sealBatch() {
+    if (_openBatchMessages == 0) {
+        return;
+    }
+    K2LOG_D(log::tx, "sealing batch with {} messages, {} bytes", _openBatchMessages, _openBatch.len());
+    _sealedBatches.push_back(_SealedBatch{std::move(_openBatch), _openBatchMessages});
+    _openBatch = seastar::net::packet();
+    _openBatchMessages = 0;
+}
+
+seastar::future<> TCPRPCChannel::_drainBatches() {
+    return seastar::repeat([this] {
+        if (_sealedBatches.empty()) {
+            // whatever accumulated during the last flush goes out as one batch
+            _sealBatch();
+        }
+        if (_sealedBatches.empty()) {
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+        }
+        auto batch = std::move(_sealedBatches.front());
+        _sealedBatches.pop_front();
+        size_t bytes = batch.packet.len();
+        size_t messages = batch.messages;
+        if (auto* metrics = TransportMetrics::local(); metrics) {
+            // the batch is no longer queued, whether the write succeeds or not
+            metrics->tcpQueuedBytes -= bytes;
+        }
+        return _out.write(std::move(batch.packet))
+            .then([this] {
+                return _out.flush();
+            })
+            .then([bytes, messages] {
+                if (auto* metrics = TransportMetrics::local(); metrics) {
+                    metrics->tcp.bytesOut += bytes;
+                    metrics->tcpBatches++;
+                    metrics->tcpBatchedMessages += messages;
+                }
+                return seastar::stop_iteration::no;
+            });
     });
 }
 
@@ -111,6 +201,9 @@ seastar::future<> TCPRPCChannel::_setConnectedSocket(seastar::connected_socket s
     _rpcParser.registerParserFailureObserver(
         [this](std::exception_ptr exc) {
             K2LOG_D(log::tx, "Received parser exception");
+            if (auto* metrics = TransportMetrics::local(); metrics) {
+                metrics->tcp.parseErrors++;
+            }
             this->_failureObserver(this->_endpoint, exc);
         }
     );
@@ -130,6 +223,9 @@ seastar::future<> TCPRPCChannel::_setConnectedSocket(seastar::connected_socket s
                         K2LOG_D(log::tx, "remote end closed connection");
                         return; // just say we're done so the loop can evaluate the end condition
                     }
+                    if (auto* metrics = TransportMetrics::local(); metrics) {
+                        metrics->tcp.bytesIn += packet.size();
+                    }
                     _rpcParser.feed(std::move(packet));
                     // process some messages from the packet
                     _rpcParser.dispatchSome();
@@ -179,6 +275,9 @@ void TCPRPCChannel::registerFailureObserver(FailureObserver_t observer) {
 
 void TCPRPCChannel::_processQueuedWrites() {
     K2LOG_D(log::tx, "pending writes: {}", _pendingWrites.size());
+    if (auto* metrics = TransportMetrics::local(); metrics) {
+        metrics->tcpConnectingMessages -= _pendingWrites.size();
+    }
     for(auto& packet: _pendingWrites) {
         _sendPacket(std::move(packet));
     }
@@ -24,12 +24,16 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+#include <deque>
+
 // third-party
 #include <seastar/net/api.hh> // seastar's network stuff
 #include <seastar/net/packet.hh>
 
 // k2
+#include <k2/common/Chrono.h>
 #include <k2/common/Common.h>
+#include <k2/config/Config.h>
 #include "BaseTypes.h"
 #include "RPCHeader.h"
 #include "RPCParser.h"
@@ -82,9 +86,16 @@ private: // methods
     // helper method to setup an incoming connected socket
     seastar::future<> _setConnectedSocket(seastar::connected_socket sock);
 
-    // helper method used to send a packet
+    // helper method used to send a packet. Packets sent while a flush is in flight are coalesced into
+    // a batch which goes out with a single write+flush once the in-flight flush completes
     void _sendPacket(seastar::net::packet&& packet);
 
+    // moves the open batch into the queue of batches ready to be written
+    void _sealBatch();
+
+    // writes and flushes queued batches, one at a time, until there is nothing left to send
+    seastar::future<> _drainBatches();
+
 private: // fields
     // this is the RPC message parser
     RPCParser _rpcParser;
@@ -134,6 +145,31 @@ private: // fields
     // used to properly chain sends
     std::optional<seastar::future<>> _sendFuture;
 
+    // true while the drain loop is writing/flushing. Sends made during this time join the open batch
+    bool _flushInProgress = false;
+
+    // the batch currently accumulating messages, and its size, message count and age
+    seastar::net::packet _openBatch;
+    size_t _openBatchMessages = 0;
+    TimePoint _openBatchStart;
+
+    // batches which are closed for appending and are waiting to be written, in send order
+    struct _SealedBatch {
+        seastar::net::packet packet;
+        size_t messages = 0;
+    };
+    std::deque<_SealedBatch> _sealedBatches;
+
+    // a batch is sealed once it reaches either of these limits...
+    ConfigVar<size_t> _maxBatchBytes{"tcp_max_batch_bytes", 256 * 1024};
+    ConfigVar<size_t> _maxBatchMessages{"tcp_max_batch_messages", 64};
+    // ... or once its oldest message has waited this long, so that it doesn't keep growing behind a slow flush
+    ConfigDuration _maxBatchLatency{"tcp_max_batch_latency", 1ms};
+
+    // messages over bandwidth-constrained links (to these hosts) are compressed if they have at least this many bytes
+    ConfigVar<std::vector<String>> _compressedHosts{"tcp_compressed_hosts"};
+    ConfigVar<size_t> _compressionThreshold{"tcp_compression_threshold", 4096};
+
 private: // Not needed
     TCPRPCChannel(const TCPRPCChannel& o) = delete;
     TCPRPCChannel(TCPRPCChannel&& o) = delete;
@@ -27,6 +27,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <seastar/core/future-util.hh>
 #include <seastar/net/api.hh>
 #include <arpa/inet.h> // for inet_ntop
+#include <random>
 #include <seastar/net/inet_address.hh> // for inet_address
 
 //k2
@@ -38,14 +39,21 @@ TCPRPCProtocol::TCPRPCProtocol(VirtualNetworkStack::Dist_t& vnet):
     IRPCProtocol(vnet, proto),
     _stopped(true) {
     K2LOG_D(log::tx, "ctor");
+    for (auto verb: _bulkVerbs()) {
+        _isBulkVerb[Verb(verb)] = true;
+    }
 }
 
-TCPRPCProtocol::TCPRPCProtocol(VirtualNetworkStack::Dist_t& vnet, SocketAddress addr):
+TCPRPCProtocol::TCPRPCProtocol(VirtualNetworkStack::Dist_t& vnet, SocketAddress addr, bool sharedPort):
     IRPCProtocol(vnet, proto),
     _addr(addr),
     _svrEndpoint(seastar::make_lw_shared<TXEndpoint>(_endpointFromAddress(_addr))),
+    _sharedPort(sharedPort),
     _stopped(true) {
     K2LOG_D(log::tx, "ctor");
+    for (auto verb: _bulkVerbs()) {
+        _isBulkVerb[Verb(verb)] = true;
+    }
 }
 
 TCPRPCProtocol::~TCPRPCProtocol() {
@@ -67,6 +75,12 @@ void TCPRPCProtocol::start() {
             _svrEndpoint = seastar::make_lw_shared<>(_endpointFromAddress(_listen_socket->local_address()));
             K2LOG_I(log::tx, "Effective listening TCP Proto on: {}", _svrEndpoint->url);
         }
+        if (_sharedPort && _portSteering() && seastar::smp::count > 1) {
+            // connections are assigned to cores by source port (see lba above), which clients can choose
+            _svrEndpoint = seastar::make_lw_shared<TXEndpoint>(String(proto), String(_svrEndpoint->ip), _svrEndpoint->port,
+                _vnet.local().getTCPAllocator(), seastar::this_shard_id(), seastar::smp::count);
+            K2LOG_I(log::tx, "Steered listening TCP Proto on: {}", _svrEndpoint->url);
+        }
 
         _listenerClosed = seastar::do_until(
             [this] { return _stopped;},
@@ -74,7 +88,7 @@ void TCPRPCProtocol::start() {
             return _listen_socket->accept().then(
                 [this] (seastar::accept_result&& result) {
                     K2LOG_D(log::tx, "Accepted connection from {}", result.remote_address);
-                    _handleNewChannel(seastar::make_ready_future<seastar::connected_socket>(std::move(result.connection)),  _endpointFromAddress(std::move(result.remote_address)));
+                    _handleNewChannel(seastar::make_ready_future<seastar::connected_socket>(std::move(result.connection)),  _endpointFromAddress(std::move(result.remote_address)), 0, 1);
                     return seastar::make_ready_future();
                 }
             )
@@ -109,7 +123,7 @@ RPCProtocolFactory::BuilderFunc_t TCPRPCProtocol::builder(VirtualNetworkStack::D
     return [&vnet, port]() mutable -> seastar::shared_ptr<IRPCProtocol> {
         K2LOG_D(log::tx, "builder running");
         return seastar::static_pointer_cast<IRPCProtocol>(
-            seastar::make_shared<TCPRPCProtocol>(vnet, port));
+            seastar::make_shared<TCPRPCProtocol>(vnet, port, true));
     };
 }
 
@@ -135,7 +149,11 @@ seastar::future<> TCPRPCProtocol::stop() {
     // place all channels in a list so that we can clear the map
     std::vector<seastar::lw_shared_ptr<TCPRPCChannel>> channels;
     for (auto&& iter: _channels) {
-        channels.push_back(iter.second);
+        for (auto& chan: iter.second.channels) {
+            if (chan) {
+                channels.push_back(chan);
+            }
+        }
     }
     _channels.clear();
 
@@ -179,7 +197,7 @@ void TCPRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoin
         return;
     }
 
-    auto&& chan = _getOrMakeChannel(endpoint);
+    auto&& chan = _getOrMakeChannel(endpoint, verb);
     if (!chan) {
         K2LOG_W(log::tx, "Dropping message: Unable to create connection for endpoint {}", endpoint.url);
         return;
@@ -187,29 +205,62 @@ void TCPRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoin
     chan->send(verb, std::move(payload), std::move(metadata));
 }
 
-seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_getOrMakeChannel(TXEndpoint& endpoint) {
+size_t TCPRPCProtocol::_pickStripe(Stripes& stripes, Verb verb) {
+    auto count = stripes.channels.size();
+    if (count <= 1) {
+        return 0;
+    }
+    if (_bulkVerbs().empty()) {
+        return stripes.next++ % count;
+    }
+    if (!_isBulkVerb[verb]) {
+        return 0;
+    }
+    return 1 + stripes.next++ % (count - 1);
+}
+
+void TCPRPCProtocol::connect(TXEndpoint& endpoint) {
+    if (!_stopped) {
+        _getOrMakeChannel(endpoint, InternalVerbs::NIL);
+    }
+}
+
+seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_getOrMakeChannel(TXEndpoint& endpoint, Verb verb) {
     // look for an existing channel
+    size_t stripeCount = std::max(size_t(1), _connectionsPerEndpoint());
+    size_t stripe = 0;
     auto iter = _channels.find(endpoint);
     if (iter != _channels.end()) {
-        return iter->second;
+        stripeCount = iter->second.channels.size();
+        stripe = _pickStripe(iter->second, verb);
+        if (iter->second.channels[stripe]) {
+            return iter->second.channels[stripe];
+        }
+    }
+    else if (stripeCount > 1) {
+        Stripes stripes;
+        stripes.channels.resize(stripeCount);
+        stripe = _pickStripe(stripes, verb);
+        _channels.emplace(endpoint, std::move(stripes));
     }
-    K2LOG_D(log::tx, "creating new channel for {}", endpoint.url);
+    K2LOG_D(log::tx, "creating new channel for {}, stripe {}/{}", endpoint.url, stripe, stripeCount);
 
     // TODO support for IPv6?
     auto address = seastar::make_ipv4_address({endpoint.ip.c_str(), uint16_t(endpoint.port)});
 
     // we can only get a future for a connection at some point.
-    auto futureConn = _vnet.local().connectTCP(address);
+    auto futureConn = endpoint.cores > 0 ? _connectToCore(address, endpoint) : _vnet.local().connectTCP(address);
     if (futureConn.failed()) {
         // the conn failed immediately
         return nullptr;
     }
     // wrap the connection into a TCPChannel
-    return _handleNewChannel(std::move(futureConn), endpoint);
+    return _handleNewChannel(std::move(futureConn), endpoint, stripe, stripeCount);
 }
 
 seastar::lw_shared_ptr<TCPRPCChannel>
-TCPRPCProtocol::_handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint) {
+TCPRPCProtocol::_handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint,
+                                  size_t stripe, size_t stripeCount) {
     K2LOG_D(log::tx, "processing channel: {}", endpoint.url);
     auto chan = seastar::make_lw_shared<TCPRPCChannel>(std::move(futureSocket), endpoint,
         [this] (Request&& request) {
@@ -217,26 +268,56 @@ TCPRPCProtocol::_handleNewChannel(seastar::future<seastar::connected_socket> fut
                 _messageObserver(std::move(request));
             }
         },
-        [this] (TXEndpoint& endpoint, auto exc) {
+        nullptr);
+    chan->registerFailureObserver(
+        [this, rawChan=chan.get()] (TXEndpoint& endpoint, auto exc) {
             if (!_stopped) {
                 if (exc) {
 
                     K2LOG_W_EXC(log::tx, exc, "Channel {} failed", endpoint.url);
                 }
-                auto chanIter = _channels.find(endpoint);
-                if (chanIter != _channels.end()) {
-                    auto chan = chanIter->second;
-                    _channels.erase(chanIter);
-                    return chan->gracefulClose().then([chan] {});
+                auto stripesIter = _channels.find(endpoint);
+                if (stripesIter != _channels.end()) {
+                    // only this stripe goes away. The other connections to the endpoint are still good
+                    auto& channels = stripesIter->second.channels;
+                    auto chanIter = std::find_if(channels.begin(), channels.end(), [rawChan](auto& c) { return c.get() == rawChan; });
+                    if (chanIter != channels.end()) {
+                        auto chan = std::move(*chanIter);
+                        *chanIter = nullptr;
+                        if (std::all_of(channels.begin(), channels.end(), [](auto& c) { return !c; })) {
+                            _channels.erase(stripesIter);
+                        }
+                        return chan->gracefulClose().then([chan] {});
+                    }
                 }
             }
             return seastar::make_ready_future();
         });
-    _channels.emplace(chan->getTXEndpoint(), chan);
+    auto& stripes = _channels[chan->getTXEndpoint()];
+    if (stripes.channels.size() < stripeCount) {
+        stripes.channels.resize(stripeCount);
+    }
+    stripes.channels[stripe] = chan;
     chan->run();
     return chan;
 }
 
+seastar::future<seastar::connected_socket>
+TCPRPCProtocol::_connectToCore(SocketAddress address, const TXEndpoint& endpoint) {
+    // pick a random port in the usual ephemeral range, which maps to the target core. If it is taken, the
+    // connection fails and the next send to this endpoint tries another one
+    static constexpr uint32_t minPort = 32768;
+    static constexpr uint32_t maxPort = 60999;
+    static thread_local std::mt19937 gen{std::random_device{}()};
+    uint32_t port = std::uniform_int_distribution<uint32_t>(minPort, maxPort)(gen);
+    port = port - port % endpoint.cores + endpoint.core;
+    if (port > maxPort) {
+        port -= endpoint.cores;
+    }
+    K2LOG_D(log::tx, "connecting to core {} of {} from port {}", endpoint.core, endpoint.url, port);
+    return _vnet.local().connectTCP(address, seastar::ipv4_addr(uint16_t(port)));
+}
+
 TXEndpoint TCPRPCProtocol::_endpointFromAddress(SocketAddress addr) {
     const size_t bufsize = 64;
     char buffer[bufsize];
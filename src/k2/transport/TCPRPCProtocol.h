@@ -22,6 +22,10 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #pragma once
+
+#include <array>
+#include <limits>
+
 #include <seastar/core/future.hh>
 #include <seastar/core/shared_ptr.hh>
 // k2
@@ -30,6 +34,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include "RPCProtocolFactory.h"
 #include "TCPRPCChannel.h"
 #include "RPCHeader.h"
+#include <k2/config/Config.h>
 
 namespace k2 {
 
@@ -53,8 +58,9 @@ public: // types
     static inline const String proto{"tcp+k2rpc"};
 
    public:  // lifecycle
-    // Construct the protocol with a vnet which supports TCP and listens on the given address
-    TCPRPCProtocol(VirtualNetworkStack::Dist_t& vnet, SocketAddress addr);
+    // Construct the protocol with a vnet which supports TCP and listens on the given address. The sharedPort flag
+    // indicates that all cores listen on the same port
+    TCPRPCProtocol(VirtualNetworkStack::Dist_t& vnet, SocketAddress addr, bool sharedPort=false);
 
     // Construct the protocol with a vnet which supports TCP and no ability to accept incoming connections
     TCPRPCProtocol(VirtualNetworkStack::Dist_t& vnet);
@@ -75,6 +81,9 @@ public: // API
     // The RPC message is configured with the given metadata
     void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) override;
 
+    // Opens a channel to the endpoint unless there is one
+    void connect(TXEndpoint& endpoint) override;
+
     // Returns the endpoint where this protocol accepts incoming connections.
     seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
 
@@ -87,16 +96,22 @@ public: // distributed<> interface
     void start() override;
 
 private: // methods
-    // utility method which ew use to obtain a connection(either existing or new) for the given endpoint
-    seastar::lw_shared_ptr<TCPRPCChannel> _getOrMakeChannel(TXEndpoint& endpoint);
+    // utility method which ew use to obtain a connection(either existing or new) for the given endpoint, on which
+    // to send a message with the given verb
+    seastar::lw_shared_ptr<TCPRPCChannel> _getOrMakeChannel(TXEndpoint& endpoint, Verb verb);
 
-    // process a new channel creation
+    // process a new channel creation. The channel is placed in the given stripe slot for the endpoint
     seastar::lw_shared_ptr<TCPRPCChannel>
-    _handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint);
+    _handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint,
+                      size_t stripe, size_t stripeCount);
 
     // Helper method to create an TXEndpoint from a socket address
     TXEndpoint _endpointFromAddress(SocketAddress addr);
 
+    // connect to the target core of a server whose cores share a port. The server assigns incoming
+    // connections to its cores by the source port, so we pick a source port which maps to the target core
+    seastar::future<seastar::connected_socket> _connectToCore(SocketAddress address, const TXEndpoint& endpoint);
+
 private: // fields
     // the address we're listening on
     SocketAddress _addr;
@@ -104,14 +119,44 @@ private: // fields
     // the endpoint version of the address we're listening on
     seastar::lw_shared_ptr<TXEndpoint> _svrEndpoint;
 
+    // set when all cores listen on the same port
+    bool _sharedPort = false;
+
+    // With a shared port, tag our server endpoint with our core so that clients connect straight to the core
+    // which owns their target (e.g. a partition), instead of to whichever core the kernel picks
+    ConfigVar<bool> _portSteering{"tcp_port_steering", false};
+
     // we use this flag to signal exit
     bool _stopped;
     // our listening socket
     seastar::lw_shared_ptr<seastar::server_socket> _listen_socket;
     seastar::future<> _listenerClosed = seastar::make_ready_future();
 
+    // The connections to a single endpoint. Outgoing traffic to an endpoint can be striped over several
+    // connections so that bulk messages (e.g. query pages) don't hold up small ones behind them in one stream.
+    // Incoming connections are keyed by the remote address, so they always have exactly one stripe
+    struct Stripes {
+        // a slot is empty until we need to send on it, or after its connection fails
+        std::vector<seastar::lw_shared_ptr<TCPRPCChannel>> channels;
+        // round-robin cursor
+        size_t next = 0;
+    };
+
+    // determine which stripe a message with the given verb goes on
+    size_t _pickStripe(Stripes& stripes, Verb verb);
+
     // the underlying TCP channels we're dealing with
-    std::unordered_map<TXEndpoint, seastar::lw_shared_ptr<TCPRPCChannel>> _channels;
+    std::unordered_map<TXEndpoint, Stripes> _channels;
+
+    // number of connections we open to each remote endpoint
+    ConfigVar<size_t> _connectionsPerEndpoint{"tcp_connections_per_endpoint", 1};
+
+    // Verbs which are sent round-robin over stripes 1..N-1, leaving stripe 0 to all other verbs.
+    // When empty, all verbs are sent round-robin over all stripes
+    ConfigVar<std::vector<int>> _bulkVerbs{"tcp_bulk_verbs"};
+
+    // lookup table built from _bulkVerbs
+    std::array<bool, std::numeric_limits<Verb>::max() + 1> _isBulkVerb{};
 
 private: // not needed
     TCPRPCProtocol() = delete;
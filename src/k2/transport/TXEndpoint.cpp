@@ -35,8 +35,10 @@ namespace k2 {
 // simple regex to help parse
 // 1. ipv6 format, e.g. "rdma+k2rpc://[abcd::aabc:23]:1234567"
 // 2. or ipv4, e.g. "tcp+k2rpc://1.2.3.4:12345"
+// 3. optionally followed by a target core, e.g. "tcp+k2rpc://1.2.3.4:12345?core=3&cores=8"
 // must have: protocol(group1), ip(group2==ipv4, group3==ipv6), port(group4)
-const std::regex urlregex{"(.+)://(?:([^:\\[\\]]+)|\\[(.+)\\]):(\\d+)"};
+// may have: core(group5), cores(group6)
+const std::regex urlregex{"(.+)://(?:([^:\\[\\]]+)|\\[(.+)\\]):(\\d+)(?:\\?core=(\\d+)&cores=(\\d+))?"};
 
 std::unique_ptr<TXEndpoint> TXEndpoint::fromURL(const String& url, BinaryAllocatorFunctor&& allocator) {
     K2LOG_D(log::tx, "Parsing url {}", url);
@@ -54,6 +56,18 @@ std::unique_ptr<TXEndpoint> TXEndpoint::fromURL(const String& url, BinaryAllocat
         return nullptr;
     }
     uint32_t port = (uint32_t) parsedport;
+    uint32_t core = 0;
+    uint32_t cores = 0;
+    if (matches[6].length() > 0) {
+        int64_t parsedcore = std::stoll(matches[5].str());
+        int64_t parsedcores = std::stoll(matches[6].str());
+        if (parsedcores <= 0 || parsedcore >= parsedcores || parsedcores > std::numeric_limits<uint16_t>::max()) {
+            K2LOG_W(log::tx, "invalid target core in {}", url);
+            return nullptr;
+        }
+        core = (uint32_t) parsedcore;
+        cores = (uint32_t) parsedcores;
+    }
 
     if (ip.size() == 0) {
         K2LOG_W(log::tx, "unable to find an ip portion in {}", url);
@@ -72,7 +86,7 @@ std::unique_ptr<TXEndpoint> TXEndpoint::fromURL(const String& url, BinaryAllocat
         }
         ip = seastar::rdma::EndPoint::GIDToString(tmpip6);
     }
-    return std::make_unique<TXEndpoint>(std::move(protocol), std::move(ip), port, std::move(allocator));
+    return std::make_unique<TXEndpoint>(std::move(protocol), std::move(ip), port, std::move(allocator), core, cores);
 }
 
 TXEndpoint::~TXEndpoint() {
@@ -80,13 +94,23 @@ TXEndpoint::~TXEndpoint() {
 }
 
 TXEndpoint::TXEndpoint(String&& pprotocol, String&& pip, uint32_t pport, BinaryAllocatorFunctor&& allocator):
+    TXEndpoint(std::move(pprotocol), std::move(pip), pport, std::move(allocator), 0, 0) {
+}
+
+TXEndpoint::TXEndpoint(String&& pprotocol, String&& pip, uint32_t pport, BinaryAllocatorFunctor&& allocator,
+                       uint32_t pcore, uint32_t pcores):
     protocol(std::move(pprotocol)),
     ip(std::move(pip)),
     port(pport),
+    core(pcore),
+    cores(pcores),
     _allocator(std::move(allocator)) {
     bool isIpv6 = ip.find(":") != String::npos;
     url = protocol + "://" + (isIpv6?"[":"") + ip + (isIpv6?"]":"");
     url += ":" + std::to_string(port);
+    if (cores > 0) {
+        url += "?core=" + std::to_string(core) + "&cores=" + std::to_string(cores);
+    }
     _hash = std::hash<String>()(url);
 
     K2LOG_D(log::tx, "Created endpoint {}", url);
@@ -96,6 +120,8 @@ TXEndpoint::TXEndpoint(const TXEndpoint& o) {
     protocol = o.protocol;
     ip = o.ip;
     port = o.port;
+    core = o.core;
+    cores = o.cores;
     url = o.url;
     _hash = o._hash;
     _allocator = o._allocator;
@@ -112,6 +138,8 @@ TXEndpoint::TXEndpoint(TXEndpoint&& o) {
     protocol = std::move(o.protocol);
     ip = std::move(o.ip);
     port = o.port; o.port = 0;
+    core = o.core; o.core = 0;
+    cores = o.cores; o.cores = 0;
     url = std::move(o.url);
     _hash = o._hash; o._hash = 0;
     _allocator = std::move(o._allocator);
@@ -134,6 +162,14 @@ std::unique_ptr<Payload> TXEndpoint::newPayload() {
     return result;
 }
 
+std::unique_ptr<Payload> TXEndpoint::newPayload(size_t dataSize) {
+    K2ASSERT(log::tx, _allocator != nullptr, "asked to create payload from non-allocating endpoint");
+    auto result = std::make_unique<Payload>(_allocator);
+    result->ensureCapacity(txconstants::MAX_HEADER_SIZE + dataSize);
+    result->skip(txconstants::MAX_HEADER_SIZE);
+    return result;
+}
+
 bool TXEndpoint::canAllocate() const {
     return _allocator != nullptr;
 }
@@ -39,6 +39,9 @@ namespace k2 {
 //      proto=tcp+k2rpc, ip=10.0.0.1, port=12345
 // e.g. ipv6/rdma: rdma+k2rpc://[2001:db8:85a3::8a2e:370:7334]:1234567
 //      proto=rdma+k2rpc, ip=2001:db8:85a3::8a2e:370:7334, port=1234567
+// An endpoint can also name one of the cores of a server which listens on the same port on all of its cores:
+// e.g. tcp+k2rpc://10.0.0.1:12345?core=3&cores=8
+//      proto=tcp+k2rpc, ip=10.0.0.1, port=12345, core=3, cores=8
 class TXEndpoint {
 
 public: // lifecycle
@@ -58,6 +61,9 @@ public: // lifecycle
     // construct an endpoint from the tuple (protocol, ip, port) with the given allocator and protocol
     TXEndpoint(String&& protocol, String&& ip, uint32_t port, BinaryAllocatorFunctor&& allocator);
 
+    // same as above, for the given core of a server with the given number of cores
+    TXEndpoint(String&& protocol, String&& ip, uint32_t port, BinaryAllocatorFunctor&& allocator, uint32_t core, uint32_t cores);
+
     // copy constructor
     TXEndpoint(const TXEndpoint& o);
 
@@ -79,6 +85,10 @@ public: // API
     // with the transport for the protocol of this endpoint
     std::unique_ptr<Payload> newPayload();
 
+    // Same as above, but the payload is created with room for dataSize bytes past the header, so that a message
+    // of known size (see Payload::serializedSize) is written without growing the payload
+    std::unique_ptr<Payload> newPayload(size_t dataSize);
+
     // Use to determine if this endpoint can allocate
     bool canAllocate() const;
 
@@ -87,6 +97,9 @@ public: // API
     String protocol;
     String ip;
     uint32_t port;
+    // the target core, when the server's cores share the port. cores is 0 otherwise
+    uint32_t core = 0;
+    uint32_t cores = 0;
 
     K2_DEF_FMT(TXEndpoint, url);
 
@@ -0,0 +1,82 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "TaskProfiler.h"
+
+#include <seastar/core/metrics.hh>
+
+#include "Log.h"
+
+namespace k2 {
+namespace sm = seastar::metrics;
+
+void TaskProfiler::start() {
+    _local = this;
+    _windowTimer.set_callback([this] { _rotateWindow(); });
+    _windowTimer.arm_periodic(_window());
+}
+
+void TaskProfiler::stop() {
+    _windowTimer.cancel();
+    _metricGroups.clear();
+    if (_local == this) {
+        _local = nullptr;
+    }
+}
+
+void TaskProfiler::record(Verb verb, Duration runTime) {
+    auto& stats = _verbs[verb];
+    if (!stats.registered) {
+        _registerMetrics(verb, stats);
+    }
+    stats.tasks++;
+    stats.windowMax = std::max(stats.windowMax, runTime);
+    if (runTime > _stallThreshold()) {
+        stats.stalls++;
+        K2LOG_W(log::tx, "task for verb {} ran for {} without yielding, over the stall threshold of {}",
+                int(verb), runTime, _stallThreshold());
+    }
+}
+
+void TaskProfiler::_registerMetrics(Verb verb, _VerbStats& stats) {
+    stats.registered = true;
+    std::vector<sm::label_instance> labels;
+    labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+    labels.push_back(sm::label_instance("verb", int(verb)));
+    _metricGroups.add_group("tasks", {
+        sm::make_gauge("max_task_time", [&stats] { return usec(std::max(stats.windowMax, stats.lastWindowMax)).count(); },
+                       sm::description("The longest time in usecs a task for the verb ran without yielding, over the last one to two time windows"), labels),
+        sm::make_counter("tasks", stats.tasks, sm::description("Timed tasks for the verb"), labels),
+        sm::make_counter("stalls", stats.stalls, sm::description("Tasks for the verb which ran longer than the stall threshold"), labels),
+    });
+}
+
+void TaskProfiler::_rotateWindow() {
+    for (auto& stats : _verbs) {
+        stats.lastWindowMax = stats.windowMax;
+        stats.windowMax = Duration(0);
+    }
+}
+
+} // ns k2
@@ -0,0 +1,108 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <seastar/core/metrics_registration.hh>
+#include <seastar/core/timer.hh>
+
+#include <k2/common/Chrono.h>
+#include <k2/config/Config.h>
+#include "RPCTypes.h"
+
+namespace k2 {
+
+// Per-core stats of how long the tasks which handle each verb run without yielding to the reactor. A task which
+// runs for longer than tx_task_stall_threshold stalls everything else on the core, and is logged with its verb.
+// The longest task of each verb over the last tx_task_time_window is exported as a metric, so that latency spikes
+// can be tied to the verbs which caused them.
+// The dispatcher times the task which calls the observer of each incoming request. Handlers which do heavy work in
+// their continuations(e.g. long scans after a push) time those tasks with a TaskTimer of their own
+class TaskProfiler {
+public:
+    void start();
+    void stop();
+
+    void record(Verb verb, Duration runTime);
+
+    // the profiler of this core, or nullptr if it isn't running
+    static TaskProfiler* local() { return _local; }
+
+private:
+    struct _VerbStats {
+        // the longest task in the current and in the previous window
+        Duration windowMax{0};
+        Duration lastWindowMax{0};
+        uint64_t tasks = 0;
+        uint64_t stalls = 0;
+        bool registered = false;
+    };
+
+    void _registerMetrics(Verb verb, _VerbStats& stats);
+    void _rotateWindow();
+
+    static inline thread_local TaskProfiler* _local = nullptr;
+
+    std::array<_VerbStats, 256> _verbs;
+    seastar::metrics::metric_groups _metricGroups;
+    seastar::timer<> _windowTimer;
+
+    ConfigDuration _stallThreshold{"tx_task_stall_threshold", 10ms};
+    ConfigDuration _window{"tx_task_time_window", 10s};
+};
+
+// Times the task which runs while it's in scope, as a task for the given verb. Timers nest: only the outermost one
+// on the core records, so that a handler can time its continuations without counting the tasks which the
+// dispatcher already times
+class TaskTimer {
+public:
+    explicit TaskTimer(Verb verb) : _verb(verb), _outermost(_depth++ == 0) {
+        if (_outermost) {
+            _start = TSCClock::now();
+        }
+    }
+
+    ~TaskTimer() {
+        --_depth;
+        if (_outermost) {
+            if (auto* profiler = TaskProfiler::local(); profiler) {
+                profiler->record(_verb, TSCClock::now() - _start);
+            }
+        }
+    }
+
+private:
+    Verb _verb;
+    bool _outermost;
+    TimePoint _start;
+    static inline thread_local uint32_t _depth = 0;
+
+    TaskTimer(const TaskTimer&) = delete;
+    TaskTimer& operator=(const TaskTimer&) = delete;
+};
+
+} // ns k2
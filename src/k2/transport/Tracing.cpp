@@ -0,0 +1,144 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "Tracing.h"
+
+#include <iterator>
+
+#include <seastar/core/reactor.hh>
+
+#include <fmt/format.h>
+
+#include "Log.h"
+
+namespace k2 {
+namespace log {
+inline thread_local logging::Logger trace("k2::trace");
+}
+
+namespace tracing {
+
+namespace {
+thread_local TraceContext _current;
+
+void appendSpan(std::string& out, const Span& span) {
+    // OTLP/JSON has 16-byte trace ids. Ours are the low 8 bytes
+    fmt::format_to(std::back_inserter(out),
+        R"({{"traceId":"{:032x}","spanId":"{:016x}",)", span.traceID, span.spanID);
+    if (span.parentSpanID != 0) {
+        fmt::format_to(std::back_inserter(out), R"("parentSpanId":"{:016x}",)", span.parentSpanID);
+    }
+    // kind 2 is SPAN_KIND_SERVER and 3 is SPAN_KIND_CLIENT. Status code 2 is STATUS_CODE_ERROR
+    fmt::format_to(std::back_inserter(out),
+        R"("name":"{} verb {}","kind":{},"startTimeUnixNano":"{}","endTimeUnixNano":"{}",)"
+        R"("attributes":[{{"key":"k2.verb","value":{{"intValue":"{}"}}}},)"
+        R"({{"key":"k2.status","value":{{"intValue":"{}"}}}}],"status":{{"code":{}}}}})",
+        span.kind == SpanKind::Server ? "handle" : "call", int(span.verb), span.kind == SpanKind::Server ? 2 : 3,
+        span.startNanos, span.endNanos, int(span.verb), span.status, span.status / 100 == 2 ? 0 : 2);
+}
+}
+
+TraceContext current() {
+    return _current;
+}
+
+Scope::Scope(const TraceContext& ctx) : _previous(_current) {
+    _current = ctx;
+}
+
+Scope::~Scope() {
+    _current = _previous;
+}
+
+void Tracer::start() {
+    _spans.resize(std::max<size_t>(1, _ringSize()));
+    if (_sampleRate() > 0) {
+        K2LOG_I(log::trace, "tracing {} of transactions, exporting every {}", _sampleRate(), _exportInterval());
+        _exportTimer.set_callback([this] { _export(); });
+        _exportTimer.arm_periodic(_exportInterval());
+    }
+}
+
+void Tracer::stop() {
+    _exportTimer.cancel();
+    _export();
+}
+
+TraceContext Tracer::startTrace() {
+    if (_sampleRate() <= 0 || _sampleDist(_gen) >= _sampleRate()) {
+        return TraceContext{};
+    }
+    TraceContext ctx;
+    while (ctx.traceID == 0) {
+        ctx.traceID = _gen();
+    }
+    ctx.spanID = _gen();
+    return ctx;
+}
+
+TraceContext Tracer::newSpan(const TraceContext& parent) {
+    return TraceContext{.traceID = parent.traceID, .spanID = _gen()};
+}
+
+void Tracer::record(const Span& span) {
+    if (_spans.empty()) {
+        // not started(e.g. the dispatcher is going down)
+        return;
+    }
+    if (_size == _spans.size()) {
+        // overwrite the oldest span
+        _head = (_head + 1) % _spans.size();
+        --_size;
+        ++_dropped;
+    }
+    _spans[(_head + _size) % _spans.size()] = span;
+    ++_size;
+}
+
+void Tracer::_export() {
+    if (_dropped > _reportedDrops) {
+        K2LOG_W(log::trace, "lost {} spans to a full trace ring since the last export", _dropped - _reportedDrops);
+        _reportedDrops = _dropped;
+    }
+    if (_size == 0) {
+        return;
+    }
+    std::string out = fmt::format(
+        R"({{"resourceSpans":[{{"resource":{{"attributes":[{{"key":"service.name","value":{{"stringValue":"k2"}}}},)"
+        R"({{"key":"k2.core","value":{{"intValue":"{}"}}}}]}},"scopeSpans":[{{"scope":{{"name":"k2"}},"spans":[)",
+        seastar::this_shard_id());
+    for (size_t i = 0; i < _size; ++i) {
+        if (i > 0) {
+            out.push_back(',');
+        }
+        appendSpan(out, _spans[(_head + i) % _spans.size()]);
+    }
+    out.append("]}]}]}");
+    _head = 0;
+    _size = 0;
+    K2LOG_I(log::trace, "{}", out);
+}
+
+} // ns tracing
+} // ns k2
@@ -0,0 +1,123 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include <seastar/core/timer.hh>
+
+#include <k2/common/Chrono.h>
+#include <k2/config/Config.h>
+#include "RPCTypes.h"
+
+namespace k2::tracing {
+
+// Identifies one span of a trace. Messages sent on behalf of a sampled trace carry the context of the span which
+// sent them in their header(see MessageMetadata), so that the receiver can record its own span under it.
+// A zero traceID means that the work isn't traced
+struct TraceContext {
+    uint64_t traceID = 0;
+    uint64_t spanID = 0;
+    bool sampled() const { return traceID != 0; }
+};
+
+// The context of the work which is running on this core right now. RPCs sent while it is sampled
+// are traced as its children. Use a Scope to set it
+TraceContext current();
+
+// Makes the given context the current one for the lifetime of the scope. Seastar doesn't carry state across
+// continuations, so code which sends RPCs from a continuation should capture current() beforehand and re-enter
+// it with a Scope of its own
+class Scope {
+public:
+    explicit Scope(const TraceContext& ctx);
+    ~Scope();
+
+private:
+    TraceContext _previous;
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+};
+
+enum class SpanKind : uint8_t {
+    Server,
+    Client
+};
+
+// A finished span. Timestamps are in nanoseconds since the unix epoch
+struct Span {
+    uint64_t traceID = 0;
+    uint64_t spanID = 0;
+    uint64_t parentSpanID = 0;
+    uint64_t startNanos = 0;
+    uint64_t endNanos = 0;
+    Verb verb = 0;
+    SpanKind kind = SpanKind::Server;
+    int32_t status = 0;
+};
+
+// Records the spans of one core. Traces are sampled when they start(see startTrace), and everything which happens
+// on their behalf is recorded, on any node. Spans are kept in a ring until they are exported, and the oldest span
+// is lost when the ring is full. Every trace_export_interval the spans in the ring are written to the k2::trace
+// log at INFO level, as one OTLP/JSON ExportTraceServiceRequest per line, so that a collector can pick them up
+class Tracer {
+public:
+    void start();
+    void stop();
+
+    // Starts a new trace, or returns an unsampled context if the trace isn't picked by the trace_sample_rate
+    TraceContext startTrace();
+
+    // Returns the context for a new span under the given one
+    TraceContext newSpan(const TraceContext& parent);
+
+    void record(const Span& span);
+
+    // the number of spans lost to a full ring so far
+    uint64_t dropped() const { return _dropped; }
+
+private:
+    // writes out the spans in the ring
+    void _export();
+
+    std::mt19937_64 _gen{std::random_device{}()};
+    std::uniform_real_distribution<double> _sampleDist{0.0, 1.0};
+
+    std::vector<Span> _spans;
+    // the position in _spans of the oldest span, and the number of spans held
+    size_t _head = 0;
+    size_t _size = 0;
+    uint64_t _dropped = 0;
+    uint64_t _reportedDrops = 0;
+    seastar::timer<> _exportTimer;
+
+    // the fraction(0..1) of the transactions to trace. 0 turns tracing off
+    ConfigVar<double> _sampleRate{"trace_sample_rate", 0.0};
+    ConfigVar<size_t> _ringSize{"trace_ring_size", 4096};
+    ConfigDuration _exportInterval{"trace_export_interval", 1s};
+};
+
+} // ns k2::tracing
@@ -0,0 +1,124 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include "TransportMetrics.h"
+
+#include <algorithm>
+
+#include <seastar/core/metrics.hh>
+
+namespace k2 {
+namespace sm = seastar::metrics;
+
+void TransportMetrics::start(std::function<size_t()> pendingRequests) {
+    _local = this;
+    const auto& perVerb = _perVerb();
+    for (size_t verb = 0; verb < _verbSlots.size(); ++verb) {
+        bool own = perVerb.empty() || std::find(perVerb.begin(), perVerb.end(), int(verb)) != perVerb.end();
+        _verbSlots[verb] = own ? verb : _otherVerbSlot;
+    }
+
+    _labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+    std::vector<sm::label_instance> tcpLabels = _labels;
+    tcpLabels.push_back(sm::label_instance("protocol", "tcp"));
+    std::vector<sm::label_instance> rrdmaLabels = _labels;
+    rrdmaLabels.push_back(sm::label_instance("protocol", "rrdma"));
+
+    _metricGroups.add_group("transport", {
+        sm::make_gauge("pending_requests", [pendingRequests=std::move(pendingRequests)] { return pendingRequests(); },
+                       sm::description("Requests waiting for their replies"), _labels),
+        sm::make_counter("request_timeouts", requestTimeouts, sm::description("Requests which timed out"), _labels),
+        sm::make_counter("unmatched_responses", unmatchedResponses,
+                         sm::description("Responses which came after their request timed out"), _labels),
+        sm::make_counter("unobserved_messages", unobservedMessages,
+                         sm::description("Messages for verbs without an observer"), _labels),
+        sm::make_counter("local_calls", localCalls,
+                         sm::description("RPCs handed to an observer of this core without serialization"), _labels),
+
+        sm::make_counter("wire_bytes_in", tcp.bytesIn, sm::description("Bytes read from the network"), tcpLabels),
+        sm::make_counter("wire_bytes_out", tcp.bytesOut, sm::description("Bytes written to the network"), tcpLabels),
+        sm::make_counter("parse_errors", tcp.parseErrors, sm::description("Connections dropped on malformed messages"), tcpLabels),
+        sm::make_counter("wire_bytes_in", rrdma.bytesIn, sm::description("Bytes read from the network"), rrdmaLabels),
+        sm::make_counter("wire_bytes_out", rrdma.bytesOut, sm::description("Bytes written to the network"), rrdmaLabels),
+        sm::make_counter("parse_errors", rrdma.parseErrors, sm::description("Connections dropped on malformed messages"), rrdmaLabels),
+
+        sm::make_counter("tcp_batches", tcpBatches, sm::description("TCP writes(each followed by a flush)"), _labels),
+        sm::make_counter("tcp_batched_messages", tcpBatchedMessages,
+                         sm::description("Messages in the TCP writes. Divide by tcp_batches for the messages per write"), _labels),
+        sm::make_gauge("tcp_queued_bytes", tcpQueuedBytes, sm::description("Bytes in TCP batches waiting to be written"), _labels),
+        sm::make_gauge("tcp_connecting_messages", tcpConnectingMessages,
+                       sm::description("Messages queued on TCP channels which are still connecting"), _labels),
+    });
+}
+
+void TransportMetrics::stop() {
+    _metricGroups.clear();
+    if (_local == this) {
+        _local = nullptr;
+    }
+}
+
+LogLinearHistogram* TransportMetrics::peerRTT(const String& url) {
+    if (_maxPeers() == 0) {
+        return nullptr;
+    }
+    auto it = _peers.find(url);
+    if (it != _peers.end()) {
+        return it->second.get();
+    }
+    if (_peers.size() < _maxPeers()) {
+        auto& rtt = _peers[url];
+        rtt = std::make_unique<LogLinearHistogram>();
+        _registerPeer(url, *rtt);
+        return rtt.get();
+    }
+    if (!_otherPeers) {
+        _otherPeers = std::make_unique<LogLinearHistogram>();
+        _registerPeer("other", *_otherPeers);
+    }
+    return _otherPeers.get();
+}
+
+void TransportMetrics::_registerVerb(size_t slot, _VerbStats& stats) {
+    stats.registered = true;
+    std::vector<sm::label_instance> labels = _labels;
+    String verb = slot == _otherVerbSlot ? String("other") :
+                  slot == InternalVerbs::NIL ? String("reply") : std::to_string(slot);
+    labels.push_back(sm::label_instance("verb", verb));
+    _metricGroups.add_group("transport", {
+        sm::make_counter("messages_in", stats.messagesIn, sm::description("Messages received, by verb"), labels),
+        sm::make_counter("bytes_in", stats.bytesIn, sm::description("Payload bytes received, by verb"), labels),
+        sm::make_counter("messages_out", stats.messagesOut, sm::description("Messages sent, by verb"), labels),
+        sm::make_counter("bytes_out", stats.bytesOut, sm::description("Payload bytes sent, by verb"), labels),
+    });
+}
+
+void TransportMetrics::_registerPeer(const String& peer, LogLinearHistogram& rtt) {
+    std::vector<sm::label_instance> labels = _labels;
+    labels.push_back(sm::label_instance("peer", peer));
+    _metricGroups.add_group("transport", rtt.metricDefinitions("request_rtt",
+        "Time in usecs from sending a request to receiving its reply, by peer", labels));
+}
+
+} // ns k2
@@ -0,0 +1,132 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include <seastar/core/metrics_registration.hh>
+
+#include <k2/common/Common.h>
+#include <k2/config/Config.h>
+#include "Prometheus.h"
+#include "RPCTypes.h"
+
+namespace k2 {
+
+// The transport metrics of one core: messages and bytes by verb, wire bytes and parse errors by protocol, TCP
+// batching and queueing, and the round-trip time of requests by peer. Together with the server-side request
+// latencies, they tell network time apart from server time.
+// The number of series is bounded by tx_metrics_verbs(the verbs which get series of their own, all others are
+// counted under verb="other", and replies are counted under verb="reply") and tx_metrics_max_peers(the peers which get an RTT histogram of their own, after
+// which new peers are counted under peer="other")
+class TransportMetrics {
+public:
+    // registers the metrics. pendingRequests reports the number of requests waiting for their replies
+    void start(std::function<size_t()> pendingRequests);
+    void stop();
+
+    // the metrics of this core, or nullptr if they aren't running
+    static TransportMetrics* local() { return _local; }
+
+    // a message handed to or by the dispatcher. Replies have the NIL verb
+    void countIn(Verb verb, size_t bytes) {
+        auto& stats = _verbStats(verb);
+        stats.messagesIn++;
+        stats.bytesIn += bytes;
+    }
+    void countOut(Verb verb, size_t bytes) {
+        auto& stats = _verbStats(verb);
+        stats.messagesOut++;
+        stats.bytesOut += bytes;
+    }
+
+    // the RTT histogram(in usecs) of the given peer, or nullptr if peers aren't tracked
+    LogLinearHistogram* peerRTT(const String& url);
+
+    struct ProtocolStats {
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        uint64_t parseErrors = 0;
+    };
+    ProtocolStats tcp;
+    ProtocolStats rrdma;
+
+    // TCP writes, and the messages they carried
+    uint64_t tcpBatches = 0;
+    uint64_t tcpBatchedMessages = 0;
+    // bytes in TCP batches which haven't been written yet
+    uint64_t tcpQueuedBytes = 0;
+    // messages queued on TCP channels which are still connecting
+    uint64_t tcpConnectingMessages = 0;
+
+    uint64_t requestTimeouts = 0;
+    // responses which came after their request timed out
+    uint64_t unmatchedResponses = 0;
+    // messages for verbs without an observer
+    uint64_t unobservedMessages = 0;
+    // RPCs handed to an observer of this core without serialization
+    uint64_t localCalls = 0;
+
+private:
+    struct _VerbStats {
+        uint64_t messagesIn = 0;
+        uint64_t bytesIn = 0;
+        uint64_t messagesOut = 0;
+        uint64_t bytesOut = 0;
+        bool registered = false;
+    };
+
+    static constexpr size_t _otherVerbSlot = 256;
+
+    _VerbStats& _verbStats(Verb verb) {
+        auto& stats = _verbs[_verbSlots[verb]];
+        if (!stats.registered) {
+            _registerVerb(_verbSlots[verb], stats);
+        }
+        return stats;
+    }
+
+    void _registerVerb(size_t slot, _VerbStats& stats);
+    void _registerPeer(const String& peer, LogLinearHistogram& rtt);
+
+    static inline thread_local TransportMetrics* _local = nullptr;
+
+    // verb -> the slot in _verbs which counts it
+    std::array<uint16_t, 256> _verbSlots{};
+    std::array<_VerbStats, 257> _verbs;
+    std::unordered_map<String, std::unique_ptr<LogLinearHistogram>> _peers;
+    std::unique_ptr<LogLinearHistogram> _otherPeers;
+
+    std::vector<seastar::metrics::label_instance> _labels;
+    seastar::metrics::metric_groups _metricGroups;
+
+    ConfigVar<std::vector<int>> _perVerb{"tx_metrics_verbs"};
+    ConfigVar<size_t> _maxPeers{"tx_metrics_max_peers", 16};
+};
+
+} // ns k2
@@ -26,6 +26,7 @@ Copyright(c) 2020 Futurewei Cloud
 // third-party
 #include <seastar/core/reactor.hh>
 #include <seastar/net/net.hh>
+#include <k2/common/MemoryAccounting.h>
 
 // k2
 #include "Log.h"
@@ -70,15 +71,16 @@ void VirtualNetworkStack::start(){
 BinaryAllocatorFunctor VirtualNetworkStack::getTCPAllocator() {
     // The seastar stacks don't expose allocation mechanism so we just allocate
     // the binaries in user space
-    return []() {
+    return [](size_t size) {
         //NB at some point, we'll have to capture the underlying network stack here in order
         // to pass on allocations. This should be done with weakly_referencable and weak_from_this()
 
         // TODO: it seems only ipv4 is supported via the seastar's network_stack, so just use ipv6 header size here
 
         // NB, there is no performance benefit of allocating smaller chunks. Chunks up to 16384 are allocated from
-        // seastar pool allocator and overhead is the same regardless of size(~10ns per allocation)
-        return Binary(tcpsegsize);
+        // seastar pool allocator and overhead is the same regardless of size(~10ns per allocation).
+        // We go with the size the payload suggests, but not below a segment
+        return mem::tracked(Binary(std::max(size, size_t(tcpsegsize))), mem::Subsystem::Transport);
     };
 }
 
@@ -111,8 +113,19 @@ VirtualNetworkStack::connectRRDMA(seastar::rdma::EndPoint remoteAddress) {
 }
 
 BinaryAllocatorFunctor VirtualNetworkStack::getRRDMAAllocator() {
-    return []() {
-        return Binary(rrdmasegsize);
+    if (_rrdmaPoolSegments() == 0) {
+        return [](size_t) {
+            return mem::tracked(Binary(rrdmasegsize), mem::Subsystem::Transport);
+        };
+    }
+    if (_rrdmaPool == nullptr) {
+        _rrdmaPool = new BinaryPool(rrdmasegsize, _rrdmaPoolSegments());
+        // the pool is held for the life of the process, so its region is accounted once, in full
+        mem::MemoryAccounting::allocated(mem::Subsystem::Transport, rrdmasegsize * _rrdmaPoolSegments());
+    }
+    // the pool hands out fixed-size segments, regardless of the suggested size
+    return [pool=_rrdmaPool](size_t) {
+        return pool->allocate();
     };
 }
 
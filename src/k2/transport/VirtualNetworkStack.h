@@ -31,7 +31,9 @@ Copyright(c) 2020 Futurewei Cloud
 
 // k2
 #include <k2/common/Common.h>
+#include <k2/config/Config.h>
 #include "BaseTypes.h"
+#include "BinaryPool.h"
 
 namespace k2 {
 
@@ -87,7 +89,8 @@ public: // RDMA API
     // Create an RRDMA connection to connect to a given remote address.
     std::unique_ptr<seastar::rdma::RDMAConnection> connectRRDMA(seastar::rdma::EndPoint remoteAddress);
 
-    // Create a binary from the RRDMA provider
+    // Create a binary from the RRDMA provider. Binaries come out of a per-core pool with a single backing region
+    // (see BinaryPool), falling back to the heap when the pool is exhausted
     BinaryAllocatorFunctor getRRDMAAllocator();
 
     // RegisterLowRRDMAMemoryObserver allows the user to register a observer which will be called when
@@ -111,6 +114,12 @@ private: // fields
     LowMemoryObserver_t _lowTCPMemObserver;
     LowMemoryObserver_t _lowRRDMAMemObserver;
 
+    // the RRDMA binary pool for this core. Created on first use and never freed(see BinaryPool)
+    static inline thread_local BinaryPool* _rrdmaPool = nullptr;
+
+    // the number of segments in each core's RRDMA binary pool. 0 disables the pool
+    ConfigVar<size_t> _rrdmaPoolSegments{"rrdma_pool_segments", 256};
+
 private: // Not needed
     VirtualNetworkStack(const VirtualNetworkStack& o) = delete;
     VirtualNetworkStack(VirtualNetworkStack&& o) = delete;
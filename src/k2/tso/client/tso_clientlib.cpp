@@ -24,6 +24,8 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <random>
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 #include <seastar/core/sleep.hh>
 
@@ -40,10 +42,55 @@ seastar::future<> TSO_ClientLib::start()
     // TODO: instead of using config value TSOServerURL, we need to change later to CPO URL and get URLs of TSO servers from there instead.
     K2LOG_I(log::tsoclient, "start with server url: {}", TSOServerURL());
     _stopped = false;
+    RegisterMetrics();
+
+    if (_mock()) {
+        K2LOG_W(log::tsoclient, "running with a mock TSO: timestamps are issued from the local clock");
+        _readyToServe = true;
+        return seastar::make_ready_future<>();
+    }
 
     _tSOServerURLs.emplace_back(TSOServerURL());
+    return Discover();
+}
+
+seastar::future<> TSO_ClientLib::Discover()
+{
+    _discovering = true;
     // for now we use the first server URL only, in the future, allow to check other server in case first one is not available
-    return DiscoverServiceNodes(_tSOServerURLs[0]);
+    return DiscoverServiceNodes(_tSOServerURLs[0])
+        .then_wrapped([this](auto&& fut) {
+            _discovering = false;
+            if (fut.failed() && !_stopped) {
+                auto exc = fut.get_exception();
+                K2LOG_W_EXC(log::tsoclient, exc, "TSO discovery failed, failing {} waiting requests", _promiseReadyToServe.size());
+                for (auto&& readyPromise : _promiseReadyToServe)
+                {
+                    readyPromise.set_exception(exc);
+                }
+                _promiseReadyToServe.clear();
+                return seastar::make_exception_future<>(exc);
+            }
+            return std::move(fut);
+        });
+}
+
+void TSO_ClientLib::RegisterMetrics()
+{
+    _metricGroups.clear();
+    std::vector<sm::label_instance> labels;
+    _metricGroups.add_group("TSO_client", {
+        sm::make_histogram("request_latency", [this]{ return _requestLatency.getHistogram();}, sm::description("Latency of timestamp requests in usecs"), labels),
+        sm::make_histogram("batch_latency", [this]{ return _batchRoundTripLatency.getHistogram();}, sm::description("Latency of timestamp batch requests to the TSO in usecs"), labels),
+        sm::make_counter("timestamps_received", _timestampsReceived, sm::description("Total timestamps in the batches accepted from the TSO"), labels),
+        sm::make_counter("timestamps_issued", _timestampsIssued, sm::description("Total timestamps from batches issued to client requests"), labels),
+        sm::make_counter("local_timestamps_issued", _localTimestampsIssued, sm::description("Total timestamps issued from the local clock"), labels),
+        sm::make_counter("batches_expired", _batchesExpired, sm::description("Total batches discarded because their TTL expired"), labels),
+        sm::make_counter("batches_out_of_order", _batchesOutOfOrder, sm::description("Total batches discarded because they were returned out of order"), labels),
+        sm::make_counter("batches_replaced", _batchesReplaced, sm::description("Total replacement batch requests"), labels),
+        sm::make_gauge("pending_requests", [this]{ return _pendingClientRequests.size();}, sm::description("Number of client requests waiting for a batch"), labels),
+        sm::make_gauge("batch_queue_depth", [this]{ return _timestampBatchQue.size();}, sm::description("Number of batches held or requested"), labels),
+    });
 }
 
 seastar::future<> TSO_ClientLib::gracefulStop() {
@@ -64,7 +111,8 @@ seastar::future<> TSO_ClientLib::gracefulStop() {
     //currently, only in its continuation do nothing if stop is called. Should be ok except if this object is quickly deleted.
 
 
-    return seastar::make_ready_future<>();
+    // the background local clock sync, if any, was just failed above or waits on a batch which we don't track
+    return seastar::when_all_succeed(std::move(_localClockSync), std::move(_rediscovery)).discard_result();
 }
 
 seastar::future<> TSO_ClientLib::DiscoverServiceNodes(const k2::String& serverURL)
@@ -98,7 +146,7 @@ seastar::future<> TSO_ClientLib::DiscoverServiceNodes(const k2::String& serverUR
             {
                 K2LOG_E(log::tsoclient, "Error during get TSO node URLs, status:{}", status);
                 // currently, it is not expected 
-                return seastar::make_exception_future<>(std::runtime_error(status.message));
+                return seastar::make_exception_future<>(std::runtime_error(status.message.str()));
             }
 
             auto& nodeURLs = r.serviceNodeURLs;
@@ -170,10 +218,25 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
         // if not ready to serve yet, wait on a new ready promise then call get this function self, as each promise can only chain one then lamda
         K2LOG_W(log::tsoclient, "TSO Timestamp requested when not ready to serve, request pending...");
         _promiseReadyToServe.emplace_back();
-        return _promiseReadyToServe.back().get_future()
+        auto ready = _promiseReadyToServe.back().get_future();
+        if (!_discovering && !_tSOServerURLs.empty())
+        {
+            // the last discovery failed
+            _rediscovery = Discover().handle_exception([] (auto) {
+                // already logged, and the waiting requests were failed
+            });
+        }
+        return std::move(ready)
             .then([this, triggeredTime = requestLocalTime] { return GetTimestampFromTSO(triggeredTime); });
     }
 
+    if (_mock())
+    {
+        _lastMockTEnd = std::max(_lastMockTEnd + 1, uint64_t(sys_now_nsec_count()));
+        _timestampsIssued++;
+        return seastar::make_ready_future<Timestamp>(Timestamp(_lastMockTEnd, 1, 1000));
+    }
+
 
     // step 1/4 - sanity check if we got out of order client timestamp request
     if (requestLocalTime < _lastSeenRequestTime)
@@ -183,6 +246,7 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
     }
     else
     {
+        UpdateRequestRate(requestLocalTime);
         _lastSeenRequestTime = requestLocalTime;
     }
 
@@ -205,6 +269,7 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
             if (headBatch.ExpirationTime() < requestLocalTime)
             {
                 K2LOG_W(log::tsoclient, "Detected and discarded existing obsolete batch when issuing TS. headBatch.ExpirationTime() < requestLocalTime.");
+                _batchesExpired++;
                 _timestampBatchQue.pop_front();
                 continue;
             }
@@ -212,6 +277,9 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
             // we are here means that the headBatch has timestamp ready to issue
             Timestamp result = TimestampBatch::GenerateTimeStampFromBatch(headBatch._batch, headBatch._usedCount);
             headBatch._usedCount++;
+            UpdateLocalClockAnchor(result, requestLocalTime, headBatch._batch.TTLNanoSec);
+            _timestampsIssued++;
+            _requestLatency.add(TSCClock::now() - requestLocalTime);
             K2LOG_D(log::tsoclient, "Issued TS from existing batch.");
             // update _lastIssuedBatchTriggeredTime
             _lastIssuedBatchTriggeredTime = _lastIssuedBatchTriggeredTime < headBatch._triggeredTime ? headBatch._triggeredTime : _lastIssuedBatchTriggeredTime;
@@ -221,6 +289,7 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
                 _timestampBatchQue.pop_front();
             }
 
+            MaybePrefetch(requestLocalTime);
             return seastar::make_ready_future<Timestamp>(result);
         }
         else
@@ -234,8 +303,7 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
     ClientRequest curRequest;
     curRequest._requestTime = requestLocalTime;
     curRequest._promise = seastar::make_lw_shared<seastar::promise<Timestamp>>();
-    // TODO: get config from appBase and use min batch size, default 4
-    uint16_t batchSizeToRequest = 4;
+    uint16_t batchSizeToRequest = AdaptiveBatchSize();
 
     // step 3/4 - there was no ready timestamp to issue. First check if there is already outgoing batch request and we can piggy back
     //        - If not, issue a new batch request and return a promise.
@@ -274,8 +342,7 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
             // in this case, we double the size of next batch from last one
             if (pendingRequestCountForBackBatch >= backBatch._expectedBatchSize)
             {
-                // TODO: get config from appBase and use max batch size, default 32
-                batchSizeToRequest = std::min(backBatch._expectedBatchSize * 2, 32);
+                batchSizeToRequest = std::max(batchSizeToRequest, std::min(uint16_t(backBatch._expectedBatchSize * 2), _maxBatchSize()));
             }
         }
 
@@ -284,31 +351,15 @@ seastar::future<Timestamp> TSO_ClientLib::GetTimestampFromTSO(const TimePoint& r
             curRequest._triggeredBatchRequest = false; // no op, just for readability
             _pendingClientRequests.push_back(std::move(curRequest));
             K2LOG_D(log::tsoclient, "Piggy Back on outgoing batch.");
-            return _pendingClientRequests.back()._promise->get_future();
+            auto result = _pendingClientRequests.back()._promise->get_future();
+            MaybePrefetch(requestLocalTime);
+            return result;
         }
     }
 
     // step 4/4 - we are here as _timestampBatchQue.empty() or we can't PiggyBack the last batch request,
     //          issue a new batch request to TSO server and return the future for the request.
-    TimestampBatchInfo newBatchRequest;
-    newBatchRequest._triggeredTime = requestLocalTime;  // same as curRequest._requestTime
-    newBatchRequest._expectedBatchSize = batchSizeToRequest;
-    newBatchRequest._expectedTTL = 8000;    // in nanosecond, TODO: use config value instead.
-    _timestampBatchQue.emplace_back(std::move(newBatchRequest));
-
-    (void) GetTimestampBatch(batchSizeToRequest)
-        .then([this, triggeredTime = requestLocalTime](TimestampBatch&& newBatch) {
-            ProcessReturnedBatch(std::move(newBatch), triggeredTime);
-        }).handle_exception([this] (auto exc) {
-            // Set exception for all pending client requests
-            for (auto&& clientRequest : _pendingClientRequests)
-            {
-                clientRequest._promise->set_exception(exc);
-            }
-            _pendingClientRequests.clear();
-
-            K2LOG_W_EXC(log::tsoclient, exc, "GetTimestampBatch failed");
-        });
+    RequestBatch(batchSizeToRequest, requestLocalTime, false);  // triggered time same as curRequest._requestTime
 
     K2LOG_D(log::tsoclient, "Request new Batch for this TS.");
 
@@ -324,6 +375,7 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
         K2LOG_I(log::tsoclient, "Stopping process timestampbatch since we were stopped");
         return;
     }
+    _lastBatchTTL = batch.TTLNanoSec;
 
     // step 1/4 - check if the incoming batch is obsolete one, if yes, discard it and do nothing more.
     // We check obsoleteness by meeting one of two conditions
@@ -335,6 +387,7 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
     {
         //TODO: log more detailed infor
         K2LOG_W(log::tsoclient, "TimestampBatch comes in out of order, discarded");
+        _batchesOutOfOrder++;
         return;
     }
     bool hasPendingCR= !_pendingClientRequests.empty();
@@ -343,6 +396,7 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
     {
         //TODO: log more detailed infor
         K2LOG_W(log::tsoclient, "TimestampBatch comes in late, discarded. hasPendingClientRequest: {}",(hasPendingCR ? "TRUE" : "FALSE"));
+        _batchesExpired++;
         return;
     }
 
@@ -360,19 +414,26 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
     {
         K2ASSERT(log::tsoclient, ite->_usedCount < ite->_batch.TSCount, "we should not have used-up batch still kept around!");
         K2LOG_D(log::tsoclient, "Discard existing obosolete available Front batch.");
+        _batchesExpired++;
 
         _timestampBatchQue.pop_front();
         ite = _timestampBatchQue.begin();
     }
-    // remove case b)
+    // skip the available batches which are still in use (there is no pending client request then). This batch
+    // goes behind them, e.g. when it was prefetched
     ite = _timestampBatchQue.begin();
+    while (ite != _timestampBatchQue.end() && ite->_isAvailable)
+    {
+        K2ASSERT(log::tsoclient, _pendingClientRequests.empty(), "Available timestamp batch when there is pending client request");
+        ++ite;
+    }
+    // remove case b)
     while (ite != _timestampBatchQue.end() &&
         !ite->_isAvailable &&
         ite->_triggeredTime < batchTriggeredTime)
     {
         K2LOG_D(log::tsoclient, "Discard existing unavailable older Front batch.");
-        _timestampBatchQue.pop_front();
-        ite = _timestampBatchQue.begin();
+        ite = _timestampBatchQue.erase(ite);
     }
     // now match it, if we don't find a match, this must be a bug. But we can still use it, so log error and insert it in production and crash in debug.
     K2ASSERT(log::tsoclient, ite != _timestampBatchQue.end(), "")
@@ -387,7 +448,7 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
         batchInfo._triggeredTime = batchTriggeredTime;
         batchInfo._expectedBatchSize = batch.TSCount;
         batchInfo._expectedTTL = batch.TTLNanoSec;
-        _timestampBatchQue.emplace_front(std::move(batchInfo));
+        _timestampBatchQue.insert(ite, std::move(batchInfo));
     }
     else
     {
@@ -397,6 +458,8 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
         ite->_isAvailable = true;
     }
 
+    _timestampsReceived += batch.TSCount;
+
     // step 3/4 if any pending client request in _pendingClientRequests, start to fulfil them in order with the existing batch(es)
     if (!_pendingClientRequests.empty())
     {
@@ -417,13 +480,20 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
                 break;
             }
 
-            _pendingClientRequests.front()._promise->set_value(TimestampBatch::GenerateTimeStampFromBatch(batchInfo._batch, batchInfo._usedCount));
+            auto timestamp = TimestampBatch::GenerateTimeStampFromBatch(batchInfo._batch, batchInfo._usedCount);
+            UpdateLocalClockAnchor(timestamp, _pendingClientRequests.front()._requestTime, batchInfo._batch.TTLNanoSec);
+            _requestLatency.add(TSCClock::now() - _pendingClientRequests.front()._requestTime);
+            _timestampsIssued++;
+            _pendingClientRequests.front()._promise->set_value(std::move(timestamp));
             _pendingClientRequests.pop_front();
             batchInfo._usedCount++;
         }
 
-       // TODO: optimize this to keep the current front batch if there is still valid TS in it.
-        _timestampBatchQue.pop_front();
+        // keep the batch if it still has timestamps for upcoming requests (e.g. it was prefetched)
+        if (batchInfo._usedCount == batchInfo._batch.TSCount || !_pendingClientRequests.empty())
+        {
+            _timestampBatchQue.pop_front();
+        }
     }
 
     // step 4/4 if all available batches are used up and existing unavailable/outgoing batches is not enough to fulfill all the pending client request
@@ -445,88 +515,298 @@ void TSO_ClientLib::ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTr
         if (batchSizeToRequest > 0)
         {
             K2LOG_D(log::tsoclient, "Need to request more batch due to unfulfilled pending client requests, count: {}", batchSizeToRequest);
-            // TODO: get config from appBase and use max batch size, default 32
-            batchSizeToRequest = std::min(batchSizeToRequest, (uint16_t)32);
-
-            TimePoint curTime = Clock::now();
-            TimestampBatchInfo newBatchRequest;
-            newBatchRequest._triggeredTime = curTime;
-            newBatchRequest._expectedBatchSize = batchSizeToRequest;
-            newBatchRequest._expectedTTL = 8000;    // in nanosecond, TODO: use config value instead.
-            newBatchRequest._isTriggeredByReplacement = true;  // this is a replacement
-            _timestampBatchQue.emplace_back(std::move(newBatchRequest));
-
-            (void) GetTimestampBatch(batchSizeToRequest)
-                .then([this, triggeredTime = curTime](TimestampBatch newBatch) {
-                    ProcessReturnedBatch(newBatch, triggeredTime);
-            }).handle_exception([this] (auto exc) {
-                // Set exception for all pending client requests
-                for (auto&& clientRequest : _pendingClientRequests)
+            batchSizeToRequest = std::min(std::max(batchSizeToRequest, AdaptiveBatchSize()), _maxBatchSize());
+
+            RequestBatch(batchSizeToRequest, Clock::now(), true);  // this is a replacement
+        }
+    }
+}
+
+void TSO_ClientLib::RequestBatch(uint16_t batchSize, TimePoint triggeredTime, bool isReplacement)
+{
+    TimestampBatchInfo newBatchRequest;
+    newBatchRequest._triggeredTime = triggeredTime;
+    newBatchRequest._expectedBatchSize = batchSize;
+    newBatchRequest._expectedTTL = _lastBatchTTL;    // in nanosecond
+    newBatchRequest._isTriggeredByReplacement = isReplacement;
+    _timestampBatchQue.emplace_back(std::move(newBatchRequest));
+    if (isReplacement)
+    {
+        _batchesReplaced++;
+    }
+
+    auto batchFut = _brokerCores() > 0 ? GetBatchFromBroker(batchSize, triggeredTime) : GetTimestampBatch(batchSize);
+    (void) std::move(batchFut)
+        .then([this, triggeredTime](TimestampBatch&& newBatch) {
+            _batchRoundTripLatency.add(TSCClock::now() - triggeredTime);
+            ProcessReturnedBatch(std::move(newBatch), triggeredTime);
+        }).handle_exception([this] (auto exc) {
+            // Set exception for all pending client requests
+            for (auto&& clientRequest : _pendingClientRequests)
+            {
+                clientRequest._promise->set_exception(exc);
+            }
+            _pendingClientRequests.clear();
+
+            K2LOG_W_EXC(log::tsoclient, exc, "GetTimestampBatch failed");
+        });
+}
+
+seastar::future<TimestampBatch> TSO_ClientLib::GetBatchFromBroker(uint16_t batchSize, TimePoint triggeredTime)
+{
+    auto broker = seastar::this_shard_id() % std::min(_brokerCores(), seastar::smp::count);
+    if (broker == seastar::this_shard_id())
+    {
+        return ServeBrokeredBatch(batchSize, triggeredTime);
+    }
+    return AppBase().getDist<TSO_ClientLib>().invoke_on(broker, &TSO_ClientLib::ServeBrokeredBatch, batchSize, triggeredTime);
+}
+
+seastar::future<TimestampBatch> TSO_ClientLib::ServeBrokeredBatch(uint16_t batchSize, TimePoint triggeredTime)
+{
+    if (_stopped)
+    {
+        return seastar::make_exception_future<TimestampBatch>(TSOClientLibShutdownException());
+    }
+    // drop the batches which have expired for any request still likely to come in (requests are triggered on
+    // other cores shortly before they reach us)
+    auto oldestRequestTime = Clock::now() - 1ms;
+    while (!_brokerPool.empty() && _brokerPool.front().ExpirationTime() < oldestRequestTime)
+    {
+        _batchesExpired++;
+        _brokerPool.pop_front();
+    }
+    for (auto it = _brokerPool.begin(); it != _brokerPool.end(); ++it)
+    {
+        if (it->ExpirationTime() > triggeredTime)
+        {
+            auto slice = TakeSlice(*it, batchSize, triggeredTime);
+            if (it->_usedCount == it->_batch.TSCount)
+            {
+                _brokerPool.erase(it);
+            }
+            return seastar::make_ready_future<TimestampBatch>(slice);
+        }
+    }
+
+    if (_brokerFetch && _brokerFetch->available())
+    {
+        // the last fetch is done, and its batch is already in the pool (or used up)
+        _brokerFetch.reset();
+    }
+    if (!_brokerFetch)
+    {
+        auto fetchTime = Clock::now();
+        uint16_t fetchSize = std::min(std::max(batchSize, _brokerBatchSize()), uint16_t(std::numeric_limits<uint8_t>::max()));
+        K2LOG_D(log::tsoclient, "broker fetching batch of size {}", fetchSize);
+        _brokerFetch.emplace(GetTimestampBatch(fetchSize)
+            .then([this, fetchTime](TimestampBatch&& batch) {
+                if (batch.TSCount == 0 || batch.TTLNanoSec == 0)
                 {
-                    clientRequest._promise->set_exception(exc);
+                    return seastar::make_exception_future<>(std::runtime_error("empty timestamp batch"));
                 }
-                _pendingClientRequests.clear();
+                _lastBatchTTL = batch.TTLNanoSec;
+                BrokerBatch brokerBatch;
+                brokerBatch._batch = batch;
+                brokerBatch._triggeredTime = fetchTime;
+                _brokerPool.push_back(std::move(brokerBatch));
+                return seastar::make_ready_future<>();
+            }));
+    }
+    return _brokerFetch->get_future().then([this, batchSize, triggeredTime] {
+        // the request was triggered before the fetch, so the fetched batch is valid for it, unless other requests
+        // have used it up. Then we fetch again
+        return ServeBrokeredBatch(batchSize, triggeredTime);
+    });
+}
 
-                K2LOG_W_EXC(log::tsoclient, exc, "GetTimestampBatch failed");
-            });
+TimestampBatch TSO_ClientLib::TakeSlice(BrokerBatch& brokerBatch, uint16_t batchSize, TimePoint triggeredTime)
+{
+    K2ASSERT(log::tsoclient, brokerBatch.ExpirationTime() > triggeredTime, "broker batch has expired for the request");
+    auto count = std::min<uint16_t>(batchSize, brokerBatch._batch.TSCount - brokerBatch._usedCount);
+    uint16_t offset = brokerBatch._usedCount * brokerBatch._batch.TBENanoSecStep;
+
+    // the slice yields the same timestamps as the next count timestamps of the batch
+    TimestampBatch slice = brokerBatch._batch;
+    slice.TBEBase += offset;
+    slice.TsDelta += offset;
+    slice.TSCount = uint8_t(count);
+    // the requesting core counts the TTL from the time it triggered its request, so make the slice expire when
+    // the batch does
+    auto ttl = k2::nsec(brokerBatch.ExpirationTime() - triggeredTime).count();
+    slice.TTLNanoSec = uint16_t(std::min<int64_t>(ttl, brokerBatch._batch.TTLNanoSec));
+    brokerBatch._usedCount += count;
+    return slice;
+}
+
+std::optional<Timestamp> TSO_ClientLib::GetLocalTimestamp(const TimePoint& requestLocalTime)
+{
+    if (_stopped)
+    {
+        return std::nullopt;
+    }
+    if (!_anchorTimestamp || requestLocalTime < _anchorLocalTime)
+    {
+        SyncLocalClock();
+        return std::nullopt;
+    }
+
+    auto elapsed = requestLocalTime - _anchorLocalTime;
+    if (elapsed >= _localClockSyncInterval())
+    {
+        SyncLocalClock();
+    }
+
+    // the TSO time at the anchor's request was in [tStart - TTL, tEnd + TTL]. Since then, the TSO clock advanced by
+    // elapsed, give or take the drift allowance
+    uint64_t elapsedNs = k2::nsec(elapsed).count();
+    uint64_t driftNs = elapsedNs * _localClockDriftPPM() / 1'000'000 + 1;
+    uint64_t low = _anchorTimestamp->tStartTSECount() - _anchorTTL + elapsedNs - driftNs;
+    uint64_t high = _anchorTimestamp->tEndTSECount() + _anchorTTL + elapsedNs + driftNs;
+    // logical component: never repeat or go back from a timestamp we've issued. This only widens the window
+    high = std::max(high, _lastLocalTEnd + 1);
+
+    if (high - low > uint64_t(k2::nsec(_localClockMaxUncertainty()).count()))
+    {
+        K2LOG_D(log::tsoclient, "local clock uncertainty {}ns is too large", high - low);
+        return std::nullopt;
+    }
+    _lastLocalTEnd = high;
+    _localTimestampsIssued++;
+    return Timestamp(high, _anchorTimestamp->tsoId(), uint32_t(high - low));
+}
+
+void TSO_ClientLib::UpdateLocalClockAnchor(const Timestamp& timestamp, const TimePoint& requestLocalTime, uint16_t batchTTL)
+{
+    if (_anchorTimestamp && requestLocalTime < _anchorLocalTime)
+    {
+        return;
+    }
+    _anchorTimestamp = timestamp;
+    _anchorLocalTime = requestLocalTime;
+    _anchorTTL = batchTTL;
+}
+
+void TSO_ClientLib::SyncLocalClock()
+{
+    if (_localClockSyncInFlight || _stopped)
+    {
+        return;
+    }
+    _localClockSyncInFlight = true;
+    // the returned timestamp re-anchors the local clock when it is issued
+    _localClockSync = GetTimestampFromTSO(Clock::now())
+        .discard_result()
+        .handle_exception([](auto exc) {
+            K2LOG_W_EXC(log::tsoclient, exc, "local clock sync failed");
+        })
+        .finally([this] {
+            _localClockSyncInFlight = false;
+        });
+}
+
+void TSO_ClientLib::UpdateRequestRate(const TimePoint& requestLocalTime)
+{
+    if (_lastSeenRequestTime == TimePoint{})
+    {
+        return;  // first request
+    }
+    double gap = std::max(1.0, double(k2::nsec(requestLocalTime - _lastSeenRequestTime).count()));
+    _avgRequestGapNs = _avgRequestGapNs == 0 ? gap : 0.9 * _avgRequestGapNs + 0.1 * gap;
+}
+
+double TSO_ClientLib::ExpectedRequestsPerTTL() const
+{
+    return _avgRequestGapNs > 0 ? _lastBatchTTL / _avgRequestGapNs : 0;
+}
+
+uint16_t TSO_ClientLib::AdaptiveBatchSize() const
+{
+    // leave some headroom for bursts. A batch can't have more than 255 timestamps
+    uint16_t maxSize = std::min(_maxBatchSize(), uint16_t(std::numeric_limits<uint8_t>::max()));
+    uint16_t minSize = std::min(_minBatchSize(), maxSize);
+    double wanted = std::ceil(ExpectedRequestsPerTTL() * 1.5);
+    return wanted >= maxSize ? maxSize : std::max(minSize, uint16_t(wanted));
+}
+
+void TSO_ClientLib::MaybePrefetch(const TimePoint& now)
+{
+    double expected = ExpectedRequestsPerTTL();
+    if (!_prefetchEnabled() || _stopped || expected < 1)
+    {
+        // with sparse requests, a batch expires before it would serve any request besides the one which triggers it
+        return;
+    }
+    // count the timestamps which the batches we have or expect can still give to requests arriving from now on
+    double covered = -double(_pendingClientRequests.size());
+    for (auto& batchInfo : _timestampBatchQue)
+    {
+        if (batchInfo._isAvailable)
+        {
+            if (batchInfo.ExpirationTime() > now)
+            {
+                covered += batchInfo._batch.TSCount - batchInfo._usedCount;
+            }
+        }
+        else if (batchInfo.ExpectedExpirationTime() > now)
+        {
+            covered += batchInfo._expectedBatchSize;
         }
     }
+    if (covered >= expected)
+    {
+        return;
+    }
+    auto batchSize = AdaptiveBatchSize();
+    K2LOG_D(log::tsoclient, "prefetching batch of size {}: expecting {} requests per TTL, covered {}", batchSize, expected, covered);
+    RequestBatch(batchSize, now, false);
 }
 
 seastar::future<TimestampBatch> TSO_ClientLib::GetTimestampBatch(uint16_t batchSize)
 {
-    auto retryStrategy = k2::ExponentialBackoffStrategy();
+    // getting a batch is idempotent (an unused batch is just dropped), so a slow call is hedged on another worker
+    auto hedgingStrategy = k2::HedgingStrategy();
     //TODO: need to find out if the TSO is local or remote and get the timeout config accordingly
-    retryStrategy.withRetries(3).withStartTimeout(10ms).withRate(5);
+    hedgingStrategy.withMaxAttempts(3).withTimeout(10ms).withHedgeDelay(5ms).withLatencyPercentile(_batchLatency, 0.95);
 
-    return seastar::do_with(std::move(retryStrategy), TimestampBatch(), [this, batchSize]
-        (ExponentialBackoffStrategy& rs, TimestampBatch& batch) mutable
+    return hedgingStrategy.run([this, batchSize](int attempt, k2::Duration timeout)  mutable
     {
-        return rs.run([this, batchSize, &batch](int retriesLeft, k2::Duration timeout)  mutable
+        if (_stopped)
         {
+            K2LOG_I(log::tsoclient, "Stopping retry since we were stopped");
+            return seastar::make_exception_future<TimestampBatch>(TSOClientLibShutdownException());
+        }
+
+        K2ASSERT(log::tsoclient, !_curTSOServiceNodes.empty(), "we should have workers");
+        // pick next worker (effecitvely random one, as _curTSOServiceNodes is shuffled already when it is populated)
+        if (attempt != 0) {_curWorkerIdx++;}  // if this is not first try, we had an error or a slow call, thus change to a new service node.
+        int randNode = _curWorkerIdx %  _curTSOServiceNodes.size();
+        auto& myRemote = _curTSOServiceNodes[randNode];
+
+        GetTimeStampBatchRequest request{.batchSizeRequested = batchSize};
+        K2LOG_D(log::tsoclient, "Requesting timestampBatch of batchsize:{} with attempt:{} and timeout:{} to node:{}", batchSize, attempt, timeout, randNode);
+
+        return k2::RPC().callRPC<dto::GetTimeStampBatchRequest, dto::GetTimeStampBatchResponse>(dto::Verbs::GET_TSO_TIMESTAMP_BATCH, request, *myRemote, timeout)
+        .then([this](auto&& response) {
             if (_stopped)
             {
                 K2LOG_I(log::tsoclient, "Stopping retry since we were stopped");
-                return seastar::make_exception_future<>(TSOClientLibShutdownException());
+                return seastar::make_exception_future<TimestampBatch>(TSOClientLibShutdownException());
             }
 
-            K2ASSERT(log::tsoclient, !_curTSOServiceNodes.empty(), "we should have workers");
-            // pick next worker (effecitvely random one, as _curTSOServiceNodes is shuffled already when it is populated)
-            if (retriesLeft != 2) {_curWorkerIdx++;}  // if this is not first try, it means we had error and are retrying, thus change to a new service node. 
-            int randNode = _curWorkerIdx %  _curTSOServiceNodes.size();
-            auto& myRemote = _curTSOServiceNodes[randNode];
-
-            GetTimeStampBatchRequest request{.batchSizeRequested = batchSize};
-            K2LOG_D(log::tsoclient, "Requesting timestampBatch of batchsize:{} with retriesLeft:{} and timeout:{} to node:{}", batchSize, retriesLeft, timeout, randNode);
-
-            return k2::RPC().callRPC<dto::GetTimeStampBatchRequest, dto::GetTimeStampBatchResponse>(dto::Verbs::GET_TSO_TIMESTAMP_BATCH, request, *myRemote, timeout)
-            .then([this, &batch](auto&& response) {
-                if (_stopped)
-                {
-                    K2LOG_I(log::tsoclient, "Stopping retry since we were stopped");
-                    return seastar::make_exception_future<>(TSOClientLibShutdownException());
-                }
-
-                auto& [status, r] = response;
-                if (!status.is2xxOK())
-                {
-                    K2LOG_E(log::tsoclient, "Error during get timestampBatch, status:{}", status);
-                    // currently, we should only have 5xx retryable error, assert to confirm here to make sure future other error status added is handled.
-                    K2ASSERT(log::tsoclient, status.is5xxRetryable(), "GetTimeStampBatch error should be 5xxRetryable.");
-                    return seastar::make_exception_future<>(std::runtime_error(status.message));
-                }
+            auto& [status, r] = response;
+            if (!status.is2xxOK())
+            {
+                K2LOG_E(log::tsoclient, "Error during get timestampBatch, status:{}", status);
+                // currently, we should only have 5xx retryable error, assert to confirm here to make sure future other error status added is handled.
+                K2ASSERT(log::tsoclient, status.is5xxRetryable(), "GetTimeStampBatch error should be 5xxRetryable.");
+                return seastar::make_exception_future<TimestampBatch>(std::runtime_error(status.message.str()));
+            }
 
-                K2LOG_V(log::tsoclient, "got timestampBatch:{}", r.timeStampBatch);
-                batch = r.timeStampBatch;
-                return seastar::make_ready_future();
-            });
-        })
-        .then([&batch] () mutable
-        {
-            return std::move(batch);
+            K2LOG_V(log::tsoclient, "got timestampBatch:{}", r.timeStampBatch);
+            return seastar::make_ready_future<TimestampBatch>(r.timeStampBatch);
         });
     });
-
 }
 
 }
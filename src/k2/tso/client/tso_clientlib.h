@@ -24,16 +24,21 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 #include <chrono>
 #include <climits>
+#include <deque>
+#include <optional>
 #include <tuple>
 
 // third-party
 #include <seastar/core/distributed.hh>  // for distributed<>
 #include <seastar/core/future.hh>       // for future stuff
+#include <seastar/core/shared_future.hh>
 
 #include <k2/appbase/Appbase.h>
 #include <k2/common/Chrono.h>
+#include <k2/common/MemoryAccounting.h>
 #include <k2/dto/MessageVerbs.h>
 #include <k2/dto/TimestampBatch.h>
+#include <k2/transport/RetryStrategy.h>
 
 namespace k2
 {
@@ -56,27 +61,145 @@ public:
 
     // get the timestamp from TSO (distributed from TSOClient Timestamp batch)
     seastar::future<Timestamp> GetTimestampFromTSO(const TimePoint& requestLocalTime);
+    // Local clock mode: get a timestamp from the local steady clock, extrapolated from the last timestamp this core
+    // got from the TSO, without any TSO interaction. Its uncertainty window grows with the time since that last TSO
+    // timestamp by the clock drift allowance, and is guaranteed to contain the TSO time at requestLocalTime.
+    // Successive local timestamps are strictly increasing, hybrid-logical-clock style.
+    // Returns nullopt if we have no recent enough TSO timestamp to keep the window under tso_client_local_clock_max_uncertainty.
+    // These timestamps are only suitable for snapshot reads which tolerate bounded uncertainty: they are not ordered
+    // with regard to TSO timestamps issued meanwhile.
+    std::optional<Timestamp> GetLocalTimestamp(const TimePoint& requestLocalTime);
+
     // get the timestamp with MTL(Minimum Transaction Latency) - alternatively instead of this new API, consider put MTL inside timestamp.
     // seastar::future<std::tuple<Timestamp, Duration>> GetTimeStampWithMTLFromTSO(const TimePoint& requestLocalTime);
 
 private:
 
+    void RegisterMetrics();
+
     // discover TSO service end points by a node/server url, as each TSO server/node in general has multiple service end points(each worker CPU core have one), 
     // to populate _curTSOServiceNodes, during start() and server change.
     seastar::future<> DiscoverServiceNodes(const k2::String& serverURL);
 
+    // Discovery is lazy: when it fails, the requests waiting for it fail, and the next request retries it. This
+    // way the client can start in the background(see App::startInBackground) without the TSO being reachable yet
+    seastar::future<> Discover();
+
     seastar::future<TimestampBatch> GetTimestampBatch(uint16_t batchSize);
 
     // process returned batch from TSO server
     void ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTriggeredTime);
 
+    // add the placeholder for a new batch request triggered at the given time into _timestampBatchQue, and send the request
+    void RequestBatch(uint16_t batchSize, TimePoint triggeredTime, bool isReplacement);
+
+    // Prefetching: we track the rate of timestamp requests on this core, and keep enough outstanding batch requests
+    // to cover the requests expected during the next batch TTL, so that they don't each wait for a TSO round trip.
+    // The size of the batches we request adapts to the same estimate.
+    void UpdateRequestRate(const TimePoint& requestLocalTime);
+
+    // the expected number of timestamp requests during one batch TTL, at the recent request rate
+    double ExpectedRequestsPerTTL() const;
+
+    // the batch size to request for the recent request rate
+    uint16_t AdaptiveBatchSize() const;
+
+    // request a batch ahead of demand if the batches we have or expect don't cover the next TTL window
+    void MaybePrefetch(const TimePoint& now);
+
+    // Batch broker: with tso_client_broker_cores set, only the first few cores (the brokers) get batches from the TSO.
+    // They get large ones, and hand out slices of them to the other cores in this process over seastar's lock-free
+    // cross-core queues. A slice is only handed out for requests it is valid for, with its TTL adjusted to the time
+    // the requesting core triggered its request, so the uncertainty guarantees of the original batch hold.
+
+    // get a batch for a request triggered at the given time from our broker core
+    seastar::future<TimestampBatch> GetBatchFromBroker(uint16_t batchSize, TimePoint triggeredTime);
+
+    // runs on a broker core: hand out a slice of a pooled batch, fetching a new batch if none is valid for the request
+    seastar::future<TimestampBatch> ServeBrokeredBatch(uint16_t batchSize, TimePoint triggeredTime);
+
+    // a batch in the broker pool, and how many of its timestamps have been handed out
+    struct BrokerBatch
+    {
+        TimestampBatch _batch;
+        TimePoint _triggeredTime;
+        uint8_t _usedCount{0};
+
+        TimePoint ExpirationTime() const { return _triggeredTime + std::chrono::nanoseconds(_batch.TTLNanoSec); }
+    };
+
+    // take a slice of up to batchSize timestamps which a request triggered at the given time can use
+    TimestampBatch TakeSlice(BrokerBatch& brokerBatch, uint16_t batchSize, TimePoint triggeredTime);
+
+    // remember the latest TSO timestamp issued on this core and the local time of its request, to extrapolate local timestamps from
+    void UpdateLocalClockAnchor(const Timestamp& timestamp, const TimePoint& requestLocalTime, uint16_t batchTTL);
+
+    // get a fresh TSO timestamp in the background to re-anchor the local clock, unless we're already doing so
+    void SyncLocalClock();
+
     ConfigVar<k2::String> TSOServerURL{"tso_endpoint"};
+    ConfigVar<bool> _prefetchEnabled{"tso_client_prefetch", true};
+    // mock mode, for in-process benchmarks: no TSO is contacted and timestamps come straight from the local clock.
+    // They are strictly increasing on each core but carry no cross-core or cross-process ordering guarantee
+    ConfigVar<bool> _mock{"tso_client_mock", false};
+    ConfigVar<uint16_t> _minBatchSize{"tso_client_min_batch_size", 4};
+    ConfigVar<uint16_t> _maxBatchSize{"tso_client_max_batch_size", 32};
+
+    // smoothed gap between consecutive timestamp requests, in nanoseconds. 0 until we've seen two requests
+    double _avgRequestGapNs{0};
+
+    // the TTL of the last batch returned by the server, in nanoseconds. Used as the expected TTL of new batches
+    uint16_t _lastBatchTTL{8000};
+
+    // the number of broker cores. 0 means that every core gets its own batches from the TSO
+    ConfigVar<uint32_t> _brokerCores{"tso_client_broker_cores", 0};
+    ConfigVar<uint16_t> _brokerBatchSize{"tso_client_broker_batch_size", 128};
+
+    // on a broker core: the batches we've got from the TSO which still have timestamps to hand out, oldest first
+    std::deque<BrokerBatch, mem::TrackedAllocator<BrokerBatch, mem::Subsystem::TSO>> _brokerPool;
+    // the fetch in flight, if any. Requests which arrive meanwhile wait for it instead of starting another one
+    std::optional<seastar::shared_future<>> _brokerFetch;
+
+    // local clock mode: max drift of the local steady clock against the TSO time, in parts per million
+    ConfigVar<uint32_t> _localClockDriftPPM{"tso_client_local_clock_drift_ppm", 200};
+    // local clock mode: local timestamps with a larger uncertainty window are not issued
+    ConfigDuration _localClockMaxUncertainty{"tso_client_local_clock_max_uncertainty", 1ms};
+    // local clock mode: re-anchor in the background when the anchor is older than this
+    ConfigDuration _localClockSyncInterval{"tso_client_local_clock_sync_interval", 10ms};
+
+    // the latest TSO timestamp issued on this core, the local time of its request, and the TTL of its batch.
+    // The TSO time at the local time of the request is within the timestamp's uncertainty window widened by the TTL
+    std::optional<Timestamp> _anchorTimestamp;
+    TimePoint _anchorLocalTime{};
+    uint16_t _anchorTTL{0};
+    // the end of the last local timestamp, to keep local timestamps strictly increasing
+    uint64_t _lastLocalTEnd{0};
+    // mock mode: the end of the last mock timestamp issued on this core
+    uint64_t _lastMockTEnd{0};
+    bool _localClockSyncInFlight{false};
+    seastar::future<> _localClockSync = seastar::make_ready_future<>();
 
     bool _stopped{false};
 
+    // metrics
+    sm::metric_groups _metricGroups;
+    // time from a client request to its timestamp being issued, in usecs
+    ExponentialHistogram _requestLatency;
+    // time from triggering a batch request to its batch being returned, in usecs
+    ExponentialHistogram _batchRoundTripLatency;
+    uint64_t _timestampsReceived{0};      // timestamps in the batches we've accepted
+    uint64_t _timestampsIssued{0};        // timestamps from batches given out to client requests
+    uint64_t _localTimestampsIssued{0};   // timestamps given out from the local clock
+    uint64_t _batchesExpired{0};          // batches discarded because their TTL ran out, when returned or later
+    uint64_t _batchesOutOfOrder{0};       // returned batches discarded because a newer batch was already in use
+    uint64_t _batchesReplaced{0};         // batch requests sent to replace discarded or partially fulfilled batches
+
     // a promise/signal for ready to serve request when they come earlier than TSO server end point set up
     bool _readyToServe {false};
     std::vector<seastar::promise<>> _promiseReadyToServe;  // have to use a seperate promise/future for each early request to hold on
+    bool _discovering{false};
+    // a discovery retried by a request after the one of start() failed
+    seastar::future<> _rediscovery = seastar::make_ready_future<>();
 
     // a vector of TSO servers
     // TODO: currently just use one, we will use multiple later, with more info like location(local or remote), availability status etc. Also get them from CPO instead.
@@ -88,6 +211,9 @@ private:
     // Try to use the same endpoint untill there is an error to minimize connection usage
     size_t _curWorkerIdx{0};  
 
+    // latencies of recent GetTimestampBatch calls. Slow calls are hedged on another worker
+    seastar::lw_shared_ptr<k2::LatencyTracker> _batchLatency{seastar::make_lw_shared<k2::LatencyTracker>()};
+
     // For debugging and verification purpose, as we are processing request with steady clock, use this to verify
     // the requet we see are always coming in with bigger value steady clock.
     TimePoint _lastSeenRequestTime{};
@@ -167,8 +293,8 @@ private:
     // 8. When a client request comes in, if there is batches available in _timestampBatchQue, try to issue timestamp from availalbe batch. If these batches are obsolete,
     //    discard them from _timestampBatchQue and issue new batch request asynchronously.
 
-    std::deque<ClientRequest>  _pendingClientRequests;
-    std::deque<TimestampBatchInfo> _timestampBatchQue;
+    std::deque<ClientRequest, mem::TrackedAllocator<ClientRequest, mem::Subsystem::TSO>> _pendingClientRequests;
+    std::deque<TimestampBatchInfo, mem::TrackedAllocator<TimestampBatchInfo, mem::Subsystem::TSO>> _timestampBatchQue;
 };
 
 class TimeStampRequestOutOfOrderException : public std::exception {
@@ -173,7 +173,7 @@ TSOService::TSOController::handleGetTSOServiceNodeURLs(dto::GetTSOServiceNodeURL
     return RPCResponse(Statuses::S200_OK("OK"), std::move(response));
 }
 
-// really send the _controlInfoToSend to worker, and only place to set IsReadyToIssueTS inside _controlInfoToSend based on current state
+// really publish the _controlInfoToSend to workers, and only place to set IsReadyToIssueTS inside _controlInfoToSend based on current state
 seastar::future<> TSOService::TSOController::SendWorkersControlInfo()
 {
     // step 1/3 decide IsReadyToIssueTS to be true or not
@@ -197,12 +197,9 @@ seastar::future<> TSOService::TSOController::SendWorkersControlInfo()
     // step 2/3 update _lastSentControlInfo
     _lastSentControlInfo = _controlInfoToSend;
 
-    // step 3/3 submit to workers
-    auto& dist = AppBase().getDist<k2::TSOService>();
-    return dist.invoke_on_others(
-        [info=_controlInfoToSend] (auto& worker) {
-            worker.UpdateWorkerControlInfo(info);
-        });
+    // step 3/3 publish to workers, which pick it up before issuing their next batch
+    TSOService::SharedControlInfo().store(_controlInfoToSend);
+    return seastar::make_ready_future<>();
 }
 
 void TSOService::TSOController::TimeSync()
@@ -85,18 +85,11 @@ seastar::future<> TSOService::start()
     }
 }
 
-void TSOService::UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo)
+SeqLock<TSOService::TSOWorkerControlInfo>& TSOService::SharedControlInfo()
 {
-    K2ASSERT(log::tsoserver, seastar::this_shard_id() != 0, "UpdateWorkerControlInfo should be on worker core only!");
-
-    if (_worker == nullptr)
-    {
-        // This situation could happen during service starting up, worker core is not yet ready when controller trying to update.
-        K2LOG_I(log::tsoserver, "TSOWorker is not yet started, ignore UpdateWorkerControlInfo.");
-        return;
-    }
-
-    return _worker->UpdateWorkerControlInfo(controlInfo);
+    // one instance per process, written only by the controller on core 0
+    static SeqLock<TSOWorkerControlInfo> controlInfo;
+    return controlInfo;
 }
 
 std::vector<k2::String> TSOService::GetWorkerURLs()
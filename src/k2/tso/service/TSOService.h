@@ -32,6 +32,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <k2/appbase/Appbase.h>
 #include <k2/common/Chrono.h>
+#include <k2/common/SeqLock.h>
 #include <k2/dto/MessageVerbs.h>
 #include <k2/dto/TimestampBatch.h>
 #include "Log.h"
@@ -74,9 +75,9 @@ public :  // application lifespan
     //TODO: implement this
     uint32_t TSOId() {return 1;};
 
-    // worker public APIs
-    // worker API updating the controlInfo, triggered from controller through SS cross-core communication
-    void UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo);
+    // the control info published by the controller and polled by the workers on their request path.
+    // It is shared by all cores of this process so that an update does not need a cross-core message.
+    static SeqLock<TSOWorkerControlInfo>& SharedControlInfo();
 
     // get worker endpoint URLs of all transport stack, TCP/IP, RDMA, etc.
     std::vector<k2::String> GetWorkerURLs();
@@ -185,7 +186,7 @@ class TSOService::TSOController
     seastar::future<std::tuple<uint64_t, uint64_t>> CheckAtomicGPSClock();
 
     // Once we have updated controlInfo due to any reason, e.g. role change, ReservedTimeThreshold or drift from atomic clock,
-    // propagate the update to all workers and
+    // publish the update to all workers through SharedControlInfo(). Workers pick it up on their next request.
     // The control into to send is at member _controlInfoToSend, except IsReadyToIssueTS, which will be set inside this fn based on the current state
     seastar::future<> SendWorkersControlInfo();
 
@@ -265,7 +266,7 @@ class TSOService::TSOController
 // TSOWorker - worker cores of TSO service that take TSO client requests and issue Timestamp (batch).
 // responsible to handle following three things, if this TSO is master instance role.
 // 1. handle TSO client request, issuing time stamp (batch). This is a normal priority task.
-// 2. handle config data(TSOWorkerControlInfo below) update task issued from the control core. This is a high priority task.
+// 2. pick up config data(TSOWorkerControlInfo below) published by the control core, checked before issuing each timestamp batch.
 // 3. collect and aggregate statistics data of this core for control core to collect. This is a low priority task.
 class TSOService::TSOWorker
 {
@@ -277,9 +278,6 @@ class TSOService::TSOWorker
 
     DISABLE_COPY_MOVE(TSOWorker);
 
-    // get updated controlInfo from controller and update local copy
-    void UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo);
-
     // periodical task to send statistics to controller core
     seastar::future<> SendWorkderStatistics() {return seastar::make_ready_future<>();};
 
@@ -290,6 +288,8 @@ class TSOService::TSOWorker
 
     // current worker control info
     TSOWorkerControlInfo _curControlInfo;
+    // version of SharedControlInfo() that _curControlInfo was taken from
+    uint64_t _controlInfoVersion{0};
 
     // last request's TBE(Timestamp Batch End) time rounded at microsecond level
     uint64_t _lastRequestTBEMicroSecRounded{0};
@@ -299,10 +299,43 @@ class TSOService::TSOWorker
 
     // TODO: statistics structure
 
+    // a request waiting to be carved from the range issued for all requests of the current poll
+    struct PendingBatchRequest
+    {
+        uint16_t batchSizeRequested;
+        TimePoint receivedTime;
+        seastar::promise<std::tuple<Status, dto::GetTimeStampBatchResponse>> promise;
+    };
+
+    // requests that arrived since the last flush, and whether a flush is already scheduled
+    std::vector<PendingBatchRequest> _pendingRequests;
+    bool _flushScheduled{false};
+    seastar::future<> _flushFuture = seastar::make_ready_future<>();  // need to keep track of flush task future for proper shutdown
+
+    // coalesce GET_TSO_TIMESTAMP_BATCH requests arriving in the same reactor poll and serve them from one range
+    ConfigVar<bool> _coalesceRequests{"tso.worker_coalesce_requests", true};
+
+    // metrics
+    sm::metric_groups _metricGroups;
+    // time from receiving a batch request to replying, including coalescing and waits for the next microsecond, in usecs
+    ExponentialHistogram _requestLatency;
+    // number of requests served by each coalesced flush
+    ExponentialHistogram _flushSize{1, 10'000, 1.5};
+    uint64_t _requests{0};              // batch requests received, counting each entry of a multi-batch request
+    uint64_t _batchesIssued{0};         // batches returned to clients
+    uint64_t _timestampsIssued{0};      // timestamps in the batches returned to clients
+    uint64_t _timestampsRequested{0};   // timestamps requested, which may be more than issued as requests can be partially fulfilled
+    uint64_t _microsecondWaits{0};      // busy waits for the next microsecond because the current one ran out of timestamps
+    uint64_t _notReadyErrors{0};        // requests rejected because the worker wasn't ready to issue timestamps
+
     // APIs to TSO clients
     seastar::future<std::tuple<Status, dto::GetTimeStampBatchResponse>>
     handleGetTSOTimestampBatch(dto::GetTimeStampBatchRequest&& request);
 
+    // serve several batch requests, e.g. coalesced by a proxy from many clients, with one reply
+    seastar::future<std::tuple<Status, dto::GetTimeStampBatchesResponse>>
+    handleGetTSOTimestampBatches(dto::GetTimeStampBatchesRequest&& request);
+
     // the main API for TSO client to get timestamp in batch
     // batchSizeRequested may be partically fulfilled based on server side timestamp availability
     TimestampBatch GetTimestampFromTSO(uint16_t batchSizeRequested);
@@ -310,6 +343,15 @@ class TSOService::TSOWorker
     TimestampBatch GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t nowMicroSecRounded);
 
     // private helper
+    void RegisterMetrics();
+    // account for a batch issued for a request of the given size, received at the given time
+    inline void RecordIssuedBatch(const TimestampBatch& batch, uint16_t batchSizeRequested, TimePoint receivedTime);
+    // issue one timestamp range for all _pendingRequests and carve each request's batch from it
+    void FlushPendingRequests();
+    // check SharedControlInfo() and apply it if the controller has published a new version. Cheap when nothing changed.
+    inline void RefreshControlInfo();
+    // apply updated controlInfo from controller to the local copy
+    void UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo);
     // helpers for updateWorkerControlInfo
     void AdjustWorker(const TSOWorkerControlInfo& controlInfo);
 
@@ -22,7 +22,9 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include <algorithm>    // std::min
+#include <limits>
 #include "seastar/core/sleep.hh"
+#include <seastar/core/future-util.hh>  // for later()
 
 #include <k2/common/Log.h>
 #include <k2/common/Chrono.h>
@@ -39,19 +41,27 @@ namespace k2
 seastar::future<> TSOService::TSOWorker::start()
 {
     _tsoId = _outer.TSOId();
+    RegisterMetrics();
 
     RPC().registerRPCObserver<dto::GetTimeStampBatchRequest, dto::GetTimeStampBatchResponse>
     (dto::Verbs::GET_TSO_TIMESTAMP_BATCH, [this](dto::GetTimeStampBatchRequest&& request) {
         return handleGetTSOTimestampBatch(std::move(request));
     });
+    RPC().registerRPCObserver<dto::GetTimeStampBatchesRequest, dto::GetTimeStampBatchesResponse>
+    (dto::Verbs::GET_TSO_TIMESTAMP_BATCHES, [this](dto::GetTimeStampBatchesRequest&& request) {
+        return handleGetTSOTimestampBatches(std::move(request));
+    });
     return seastar::make_ready_future<>();
 }
 
 seastar::future<> TSOService::TSOWorker::gracefulStop()
 {
+    _metricGroups.clear();
     // unregistar all APIs
     RPC().registerMessageObserver(dto::Verbs::GET_TSO_TIMESTAMP_BATCH, nullptr);
-    return seastar::make_ready_future<>();
+    RPC().registerMessageObserver(dto::Verbs::GET_TSO_TIMESTAMP_BATCHES, nullptr);
+    // let the scheduled flush answer whatever is still pending
+    return std::move(_flushFuture);
 }
 
 seastar::future<std::tuple<Status, dto::GetTimeStampBatchResponse>>
@@ -60,9 +70,26 @@ TSOService::TSOWorker::handleGetTSOTimestampBatch(dto::GetTimeStampBatchRequest&
     K2LOG_D(log::tsoserver, "request batchsize: {}", request);
     K2ASSERT(log::tsoserver, request.batchSizeRequested > 0, "request batch size must be greater than 0.");
 
+    auto receivedTime = Clock::now();
+    _requests++;
+    if (_coalesceRequests())
+    {
+        _pendingRequests.push_back(PendingBatchRequest{.batchSizeRequested = request.batchSizeRequested, .receivedTime = receivedTime, .promise = {}});
+        auto fut = _pendingRequests.back().promise.get_future();
+        if (!_flushScheduled)
+        {
+            // yield so that the other requests already received in this poll get queued up before we issue
+            _flushScheduled = true;
+            _flushFuture = seastar::later().then([this] { FlushPendingRequests(); });
+        }
+        return fut;
+    }
+
     try
     {
+        RefreshControlInfo();
         auto timestampBatchGot = GetTimestampFromTSO(request.batchSizeRequested);
+        RecordIssuedBatch(timestampBatchGot, request.batchSizeRequested, receivedTime);
         GetTimeStampBatchResponse response{.timeStampBatch = timestampBatchGot};
         K2LOG_D(log::tsoserver, "returned timeStampBatch: {}", timestampBatchGot);
         return RPCResponse(Statuses::S200_OK("OK"), std::move(response));
@@ -70,6 +97,7 @@ TSOService::TSOWorker::handleGetTSOTimestampBatch(dto::GetTimeStampBatchRequest&
     catch(const TSONotReadyException& e)
     {
         K2LOG_E(log::tsoserver, "TSO Not Ready:{}", e.what());
+        _notReadyErrors++;
         return RPCResponse(Statuses::S503_Service_Unavailable(e.what()), GetTimeStampBatchResponse());
     }
     catch(const std::exception& e)
@@ -79,6 +107,157 @@ TSOService::TSOWorker::handleGetTSOTimestampBatch(dto::GetTimeStampBatchRequest&
     }
 }
 
+seastar::future<std::tuple<Status, dto::GetTimeStampBatchesResponse>>
+TSOService::TSOWorker::handleGetTSOTimestampBatches(dto::GetTimeStampBatchesRequest&& request)
+{
+    K2LOG_D(log::tsoserver, "request batches: {}", request);
+    if (request.batchSizesRequested.empty() ||
+        std::find(request.batchSizesRequested.begin(), request.batchSizesRequested.end(), 0) != request.batchSizesRequested.end())
+    {
+        return RPCResponse(Statuses::S400_Bad_Request("request batch sizes must be non-empty and greater than 0."), GetTimeStampBatchesResponse());
+    }
+    auto receivedTime = Clock::now();
+    _requests += request.batchSizesRequested.size();
+
+    try
+    {
+        // all batches in one reply are issued under the same control info
+        RefreshControlInfo();
+        GetTimeStampBatchesResponse response;
+        response.timeStampBatches.reserve(request.batchSizesRequested.size());
+        for (auto batchSize : request.batchSizesRequested)
+        {
+            response.timeStampBatches.push_back(GetTimestampFromTSO(batchSize));
+            RecordIssuedBatch(response.timeStampBatches.back(), batchSize, receivedTime);
+        }
+        K2LOG_D(log::tsoserver, "returned timeStampBatches: {}", response.timeStampBatches.size());
+        return RPCResponse(Statuses::S200_OK("OK"), std::move(response));
+    }
+    catch(const TSONotReadyException& e)
+    {
+        K2LOG_E(log::tsoserver, "TSO Not Ready:{}", e.what());
+        _notReadyErrors += request.batchSizesRequested.size();
+        return RPCResponse(Statuses::S503_Service_Unavailable(e.what()), GetTimeStampBatchesResponse());
+    }
+    catch(const std::exception& e)
+    {
+        K2LOG_E(log::tsoserver, "Unknown Error:{}", e.what());
+        return RPCResponse(Statuses::S500_Internal_Server_Error(e.what()), GetTimeStampBatchesResponse());
+    }
+}
+
+void TSOService::TSOWorker::FlushPendingRequests()
+{
+    auto pending = std::move(_pendingRequests);
+    _pendingRequests.clear();
+    _flushScheduled = false;
+    K2LOG_D(log::tsoserver, "flushing {} coalesced requests", pending.size());
+    _flushSize.add(pending.size());
+
+    RefreshControlInfo();
+    size_t next = 0;
+    while (next < pending.size())
+    {
+        // ask for enough timestamps for everyone left. We may get fewer, e.g. at most (1000/TBENanoSecStep) per microsecond,
+        // in which case the requests which don't fit go into the next range
+        uint32_t totalRequested = 0;
+        for (size_t i = next; i < pending.size(); ++i)
+        {
+            totalRequested += pending[i].batchSizeRequested;
+        }
+        uint16_t rangeSize = (uint16_t)std::min<uint32_t>(totalRequested, std::numeric_limits<decltype(TimestampBatch::TSCount)>::max());
+
+        TimestampBatch range;
+        try
+        {
+            range = GetTimestampFromTSO(rangeSize);
+        }
+        catch(const TSONotReadyException& e)
+        {
+            K2LOG_E(log::tsoserver, "TSO Not Ready:{}", e.what());
+            _notReadyErrors += pending.size() - next;
+            for (; next < pending.size(); ++next)
+            {
+                pending[next].promise.set_value(std::make_tuple(Statuses::S503_Service_Unavailable(e.what()), GetTimeStampBatchResponse()));
+            }
+            return;
+        }
+        catch(const std::exception& e)
+        {
+            K2LOG_E(log::tsoserver, "Unknown Error:{}", e.what());
+            for (; next < pending.size(); ++next)
+            {
+                pending[next].promise.set_value(std::make_tuple(Statuses::S500_Internal_Server_Error(e.what()), GetTimeStampBatchResponse()));
+            }
+            return;
+        }
+
+        K2ASSERT(log::tsoserver, range.TSCount > 0, "issued an empty timestamp range");
+
+        // carve consecutive slices off the range. A slice yields the same timestamps as the corresponding
+        // part of the range, so the replies together cover the range exactly once
+        uint16_t used = 0;
+        while (next < pending.size() && used < range.TSCount)
+        {
+            uint16_t count = std::min<uint16_t>(pending[next].batchSizeRequested, range.TSCount - used);
+            uint16_t offset = used * range.TBENanoSecStep;
+            TimestampBatch slice = range;
+            slice.TBEBase += offset;
+            slice.TsDelta += offset;
+            slice.TSCount = count;
+            used += count;
+
+            K2LOG_D(log::tsoserver, "returned timeStampBatch: {}", slice);
+            RecordIssuedBatch(slice, pending[next].batchSizeRequested, pending[next].receivedTime);
+            // all replies are sent from this one task, so the transport writes them out together per connection
+            pending[next].promise.set_value(std::make_tuple(Statuses::S200_OK("OK"), GetTimeStampBatchResponse{.timeStampBatch = slice}));
+            ++next;
+        }
+    }
+}
+
+void TSOService::TSOWorker::RegisterMetrics()
+{
+    _metricGroups.clear();
+    std::vector<sm::label_instance> labels;
+    _metricGroups.add_group("TSO_worker", {
+        sm::make_histogram("request_latency", [this]{ return _requestLatency.getHistogram();}, sm::description("Latency of timestamp batch requests in usecs"), labels),
+        sm::make_histogram("flush_size", [this]{ return _flushSize.getHistogram();}, sm::description("Number of requests served by each coalesced flush"), labels),
+        sm::make_counter("requests", _requests, sm::description("Total timestamp batch requests"), labels),
+        sm::make_counter("batches_issued", _batchesIssued, sm::description("Total timestamp batches issued"), labels),
+        sm::make_counter("timestamps_issued", _timestampsIssued, sm::description("Total timestamps in the issued batches"), labels),
+        sm::make_counter("timestamps_requested", _timestampsRequested, sm::description("Total timestamps requested by the issued batches"), labels),
+        sm::make_counter("microsecond_waits", _microsecondWaits, sm::description("Total busy waits for the next microsecond after running out of timestamps"), labels),
+        sm::make_counter("not_ready_errors", _notReadyErrors, sm::description("Total requests rejected while not ready to issue timestamps"), labels),
+        sm::make_gauge("pending_requests", [this]{ return _pendingRequests.size();}, sm::description("Number of requests waiting for the coalesced flush"), labels),
+    });
+}
+
+void TSOService::TSOWorker::RecordIssuedBatch(const TimestampBatch& batch, uint16_t batchSizeRequested, TimePoint receivedTime)
+{
+    _batchesIssued++;
+    _timestampsIssued += batch.TSCount;
+    _timestampsRequested += batchSizeRequested;
+    _requestLatency.add(Clock::now() - receivedTime);
+}
+
+void TSOService::TSOWorker::RefreshControlInfo()
+{
+    TSOWorkerControlInfo controlInfo;
+    if (!SharedControlInfo().loadIfChanged(_controlInfoVersion, controlInfo))
+    {
+        return;
+    }
+    // the controller may have published several versions since we last looked, and only the latest is seen here.
+    // A not-ready -> ready -> not-ready sequence then looks like a noop, which is fine to skip.
+    if (!_curControlInfo.IsReadyToIssueTS && !controlInfo.IsReadyToIssueTS)
+    {
+        _curControlInfo = controlInfo;
+        return;
+    }
+    UpdateWorkerControlInfo(controlInfo);
+}
+
 void TSOService::TSOWorker::UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo)
 {
     if (_curControlInfo.IsReadyToIssueTS && controlInfo.IsReadyToIssueTS)
@@ -251,7 +430,8 @@ TimestampBatch TSOService::TSOWorker::GetTimestampFromTSO(uint16_t batchSizeRequ
 // helper function to issue timestamp (or check error situation)
 TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t curTBEMicroSecRounded)
 {
-    K2LOG_I(log::tsoserver, "getting a timestamp batch in helper");
+    // coalesced requests land here for every batch after the first one in a microsecond, so keep it quiet
+    K2LOG_D(log::tsoserver, "getting a timestamp batch in helper");
     // step 1/4 sanity check, check IsReadyToIssueTS and possible issued timestamp is within ReservedTimeThreshold
     if (!_curControlInfo.IsReadyToIssueTS)
     {
@@ -297,6 +477,7 @@ TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint
     {
         // not enough timestamp at current microsecond to issue out,
         // busy wait out and go through normal code path to issue timestamp on next microsecond
+        _microsecondWaits++;
         while (curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded)
         {
             curTBEMicroSecRounded = (now_nsec_count() +  _curControlInfo.TBEAdjustment) / 1000 * 1000;
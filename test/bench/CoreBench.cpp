@@ -0,0 +1,407 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Microbenchmarks of the core data structures. For machine-readable results, run with
+// --benchmark_format=json, or --benchmark_out=<file> --benchmark_out_format=json
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include <k2/dto/Expression.h>
+#include <k2/dto/SKVRecord.h>
+#include <k2/module/k23si/FlatReadCache.h>
+#include <k2/module/k23si/Indexer.h>
+#include <k2/module/k23si/ReadCache.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/PayloadSerialization.h>
+#include <k2/transport/RPCParser.h>
+
+using namespace k2;
+namespace k2e = k2::dto::expression;
+
+// keys shaped like those of the K23SI workloads: a 12-byte partition key and a short range key
+static std::vector<dto::Key> makeKeys(size_t count, bool sorted=false) {
+    std::mt19937_64 gen(42);
+    std::vector<dto::Key> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back(dto::Key{"schema", fmt::format("user{:08}", gen() % 100'000'000), std::to_string(gen() % 100)});
+    }
+    if (sorted) {
+        std::sort(keys.begin(), keys.end());
+    }
+    return keys;
+}
+
+static dto::Timestamp makeTimestamp(uint64_t t) {
+    return dto::Timestamp(t, 1, 1000);
+}
+
+static std::shared_ptr<dto::Schema> makeSchema() {
+    dto::Schema schema;
+    schema.name = "bench_schema";
+    schema.version = 1;
+    schema.fields = std::vector<dto::SchemaField> {
+            {dto::FieldType::STRING, "LastName", false, false},
+            {dto::FieldType::STRING, "FirstName", false, false},
+            {dto::FieldType::INT32T, "Balance", false, false},
+            {dto::FieldType::INT64T, "Updated", false, false},
+            {dto::FieldType::STRING, "Data", false, false}
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<String>{"LastName"});
+    schema.setRangeKeyFieldsByName(std::vector<String>{"FirstName"});
+    return std::make_shared<dto::Schema>(std::move(schema));
+}
+
+static dto::SKVRecord makeRecord(std::shared_ptr<dto::Schema> schema) {
+    dto::SKVRecord rec("collection", schema);
+    rec.serializeNext<String>("Baggins");
+    rec.serializeNext<String>("Bilbo");
+    rec.serializeNext<int32_t>(777);
+    rec.serializeNext<int64_t>(1234567890);
+    rec.serializeNext<String>(String(100, 'x'));
+    return rec;
+}
+
+//
+// Read caches: the legacy interval tree and the flat cache, filled to capacity with point reads
+//
+template <typename CacheT>
+static void BM_ReadCacheInsertPoint(benchmark::State& state) {
+    size_t capacity = state.range(0);
+    // more distinct keys than fit, so that inserts also evict
+    auto keys = makeKeys(capacity * 4);
+    CacheT cache(makeTimestamp(0), capacity);
+    uint64_t t = 1;
+    size_t i = 0;
+    for (auto _ : state) {
+        auto& key = keys[i++ % keys.size()];
+        cache.insertInterval(key, key, makeTimestamp(t++));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename CacheT>
+static void BM_ReadCacheInsertRange(benchmark::State& state) {
+    size_t capacity = state.range(0);
+    auto keys = makeKeys(capacity * 4, true);
+    CacheT cache(makeTimestamp(0), capacity);
+    uint64_t t = 1;
+    size_t i = 0;
+    for (auto _ : state) {
+        size_t low = i++ % (keys.size() - 1);
+        cache.insertInterval(keys[low], keys[low + 1], makeTimestamp(t++));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename CacheT>
+static void BM_ReadCacheCheckPoint(benchmark::State& state) {
+    size_t capacity = state.range(0);
+    auto keys = makeKeys(capacity * 2);
+    CacheT cache(makeTimestamp(0), capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        cache.insertInterval(keys[i], keys[i], makeTimestamp(i + 1));
+    }
+    // half of the checks hit
+    size_t i = 0;
+    for (auto _ : state) {
+        auto& key = keys[i++ % keys.size()];
+        benchmark::DoNotOptimize(cache.checkInterval(key, key));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+typedef ReadCache<dto::Key, dto::Timestamp> LegacyReadCacheT;
+typedef FlatReadCache<dto::Key, dto::Timestamp> FlatReadCacheT;
+
+BENCHMARK_TEMPLATE(BM_ReadCacheInsertPoint, LegacyReadCacheT)->Arg(10'000)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_ReadCacheInsertPoint, FlatReadCacheT)->Arg(10'000)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_ReadCacheInsertRange, LegacyReadCacheT)->Arg(10'000)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_ReadCacheInsertRange, FlatReadCacheT)->Arg(10'000)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_ReadCacheCheckPoint, LegacyReadCacheT)->Arg(10'000)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_ReadCacheCheckPoint, FlatReadCacheT)->Arg(10'000)->Arg(100'000);
+
+//
+// Indexers: std::map and the HOT trie, with the key ordering and encoding of the K23SI indexer
+//
+typedef std::map<dto::Key, int, SchemaLocalKeyCompare> MapIndexerT;
+typedef HOTOrderedIndexer<dto::Key, int, SchemaLocalKeyEncoder> HOTIndexerT;
+
+template <typename IndexT>
+static void BM_IndexerInsert(benchmark::State& state) {
+    auto keys = makeKeys(state.range(0));
+    for (auto _ : state) {
+        IndexT index;
+        for (auto& key : keys) {
+            index[key] = 1;
+        }
+        benchmark::DoNotOptimize(index);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <typename IndexT>
+static void BM_IndexerLookup(benchmark::State& state) {
+    auto keys = makeKeys(state.range(0));
+    IndexT index;
+    for (auto& key : keys) {
+        index[key] = 1;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(7));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(index.find(keys[i++ % keys.size()]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// scans of state.range(1) records from random keys
+template <typename IndexT>
+static void BM_IndexerScan(benchmark::State& state) {
+    auto keys = makeKeys(state.range(0));
+    IndexT index;
+    for (auto& key : keys) {
+        index[key] = 1;
+    }
+    int64_t length = state.range(1);
+    size_t i = 0;
+    int sum = 0;
+    for (auto _ : state) {
+        auto it = index.lower_bound(keys[i++ % keys.size()]);
+        for (int64_t n = 0; n < length && it != index.end(); ++n, ++it) {
+            sum += it->second;
+        }
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations() * length);
+}
+
+BENCHMARK_TEMPLATE(BM_IndexerInsert, MapIndexerT)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_IndexerInsert, HOTIndexerT)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_IndexerLookup, MapIndexerT)->Arg(100'000)->Arg(1'000'000);
+BENCHMARK_TEMPLATE(BM_IndexerLookup, HOTIndexerT)->Arg(100'000)->Arg(1'000'000);
+BENCHMARK_TEMPLATE(BM_IndexerScan, MapIndexerT)->Args({100'000, 10})->Args({100'000, 100});
+BENCHMARK_TEMPLATE(BM_IndexerScan, HOTIndexerT)->Args({100'000, 10})->Args({100'000, 100});
+
+//
+// Key comparisons, of random keys and of keys which only differ in the range key
+//
+static void BM_KeyCompare(benchmark::State& state) {
+    auto keys = makeKeys(1024);
+    if (state.range(0)) {
+        for (auto& key : keys) {
+            key.partitionKey = "user00000001";
+        }
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(keys[i % keys.size()].compare(keys[(i + 1) % keys.size()]));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KeyCompare)->ArgName("samePartitionKey")->Arg(0)->Arg(1);
+
+//
+// SKVRecord
+//
+static void BM_SKVRecordSerialize(benchmark::State& state) {
+    auto schema = makeSchema();
+    String data(100, 'x');
+    for (auto _ : state) {
+        dto::SKVRecord rec("collection", schema);
+        rec.serializeNext<String>("Baggins");
+        rec.serializeNext<String>("Bilbo");
+        rec.serializeNext<int32_t>(777);
+        rec.serializeNext<int64_t>(1234567890);
+        rec.serializeNext<String>(data);
+        benchmark::DoNotOptimize(rec);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SKVRecordSerialize);
+
+static void BM_SKVRecordDeserialize(benchmark::State& state) {
+    auto rec = makeRecord(makeSchema());
+    for (auto _ : state) {
+        rec.seekField(0);
+        benchmark::DoNotOptimize(rec.deserializeNext<String>());
+        benchmark::DoNotOptimize(rec.deserializeNext<String>());
+        benchmark::DoNotOptimize(rec.deserializeNext<int32_t>());
+        benchmark::DoNotOptimize(rec.deserializeNext<int64_t>());
+        benchmark::DoNotOptimize(rec.deserializeNext<String>());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SKVRecordDeserialize);
+
+// seeks to the given field and reads it
+static void BM_SKVRecordSeekField(benchmark::State& state) {
+    auto rec = makeRecord(makeSchema());
+    uint32_t field = state.range(0);
+    for (auto _ : state) {
+        rec.seekField(field);
+        benchmark::DoNotOptimize(rec.deserializeNext<String>());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SKVRecordSeekField)->Arg(1)->Arg(4);
+
+static void BM_SKVRecordGetKey(benchmark::State& state) {
+    auto rec = makeRecord(makeSchema());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(rec.getKey());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SKVRecordGetKey);
+
+//
+// Filter expressions, interpreted and compiled: Balance > 100 AND FirstName == "Bilbo"
+//
+static k2e::Expression makeFilter() {
+    std::vector<k2e::Expression> children;
+    children.push_back(k2e::makeExpression(k2e::Operation::GT,
+        make_vec<k2e::Value>(k2e::makeValueReference("Balance"), k2e::makeValueLiteral<int32_t>(100)), {}));
+    children.push_back(k2e::makeExpression(k2e::Operation::EQ,
+        make_vec<k2e::Value>(k2e::makeValueReference("FirstName"), k2e::makeValueLiteral<String>("Bilbo")), {}));
+    return k2e::makeExpression(k2e::Operation::AND, {}, std::move(children));
+}
+
+static void BM_ExpressionEvaluate(benchmark::State& state) {
+    auto rec = makeRecord(makeSchema());
+    auto filter = makeFilter();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(filter.evaluate(rec));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ExpressionEvaluate);
+
+static void BM_CompiledExpressionEvaluate(benchmark::State& state) {
+    auto rec = makeRecord(makeSchema());
+    auto filter = makeFilter();
+    k2e::CompiledExpression compiled(filter);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(compiled.evaluate(rec));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CompiledExpressionEvaluate);
+
+//
+// Payload serialization of a message shaped like a K23SI read request
+//
+struct BenchMessage {
+    uint64_t id = 0;
+    dto::Key key;
+    dto::Timestamp timestamp;
+    String value;
+    K2_PAYLOAD_FIELDS(id, key, timestamp, value);
+};
+
+static BenchMessage makeMessage(size_t valueSize) {
+    return BenchMessage{.id = 42, .key = makeKeys(1)[0], .timestamp = makeTimestamp(1), .value = String(valueSize, 'x')};
+}
+
+static void BM_PayloadWrite(benchmark::State& state) {
+    auto msg = makeMessage(state.range(0));
+    for (auto _ : state) {
+        Payload payload(Payload::DefaultAllocator);
+        payload.write(msg);
+        benchmark::DoNotOptimize(payload);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PayloadWrite)->Arg(16)->Arg(1024)->Arg(16 * 1024);
+
+static void BM_PayloadRead(benchmark::State& state) {
+    auto msg = makeMessage(state.range(0));
+    Payload payload(Payload::DefaultAllocator);
+    payload.write(msg);
+    for (auto _ : state) {
+        payload.seek(0);
+        BenchMessage read;
+        benchmark::DoNotOptimize(payload.read(read));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * payload.getSize());
+}
+BENCHMARK(BM_PayloadRead)->Arg(16)->Arg(1024)->Arg(16 * 1024);
+
+//
+// RPCParser: parsing a stream of state.range(1)-byte messages, with checksums if state.range(0)
+//
+static void BM_RPCParserParse(benchmark::State& state) {
+    bool useChecksum = state.range(0);
+    size_t messageSize = state.range(1);
+    constexpr size_t messagesPerFeed = 64;
+
+    // the stream of messages, as it would arrive in a single packet
+    RPCParser sender([] { return false; }, useChecksum);
+    std::vector<Binary> buffers;
+    size_t streamSize = 0;
+    String data(messageSize, 'x');
+    for (size_t i = 0; i < messagesPerFeed; ++i) {
+        auto payload = std::make_unique<Payload>(Payload::DefaultAllocator);
+        payload->skip(txconstants::MAX_HEADER_SIZE);
+        payload->write(data);
+        MessageMetadata metadata;
+        metadata.setRequestID(i);
+        for (auto& buf : sender.prepareForSend(100, std::move(payload), std::move(metadata))) {
+            streamSize += buf.size();
+            buffers.push_back(std::move(buf));
+        }
+    }
+    Binary stream(streamSize);
+    size_t offset = 0;
+    for (auto& buf : buffers) {
+        std::memcpy(stream.get_write() + offset, buf.get(), buf.size());
+        offset += buf.size();
+    }
+
+    RPCParser parser([] { return false; }, useChecksum);
+    size_t received = 0;
+    parser.registerMessageObserver([&received](Verb, MessageMetadata, std::unique_ptr<Payload> payload) {
+        benchmark::DoNotOptimize(payload);
+        ++received;
+    });
+    parser.registerParserFailureObserver([&state](std::exception_ptr) {
+        state.SkipWithError("failed to parse the messages");
+    });
+    for (auto _ : state) {
+        parser.feed(stream.share());
+        while (parser.canDispatch()) {
+            parser.dispatchSome();
+        }
+    }
+    benchmark::DoNotOptimize(received);
+    state.SetItemsProcessed(state.iterations() * messagesPerFeed);
+    state.SetBytesProcessed(state.iterations() * streamSize);
+}
+BENCHMARK(BM_RPCParserParse)->ArgNames({"checksum", "size"})->Args({0, 64})->Args({0, 4096})->Args({1, 64})->Args({1, 4096});
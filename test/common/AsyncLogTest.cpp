@@ -0,0 +1,49 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+
+#include <string>
+
+#include <k2/common/AsyncLog.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+using namespace std::chrono_literals;
+
+TEST_CASE("test async log drops lines when the ring is full") {
+    // the writer sleeps for the whole test, so at most the ring capacity of lines can be queued
+    logging::AsyncLog::start(4, 1h);
+    REQUIRE(logging::AsyncLog::enabled());
+
+    uint64_t droppedBefore = logging::AsyncLog::dropped();
+    uint64_t queued = 0;
+    for (int i = 0; i < 10; ++i) {
+        queued += logging::AsyncLog::write("async log test line " + std::to_string(i) + "\n");
+    }
+    // the writer may have taken some of the lines before it went to sleep
+    REQUIRE(queued >= 4);
+    REQUIRE(queued + (logging::AsyncLog::dropped() - droppedBefore) == 10);
+
+    // stopping doesn't wait for the flush interval
+    logging::AsyncLog::stop();
+    REQUIRE(!logging::AsyncLog::enabled());
+}
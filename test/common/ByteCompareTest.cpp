@@ -0,0 +1,73 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <random>
+
+#include <k2/common/ByteCompare.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+static int sign(int v) {
+    return (v > 0) - (v < 0);
+}
+
+SCENARIO("compareBytes orders like String::compare") {
+    std::vector<String> samples = {
+        "", "a", "ab", "abc", String("\0", 1), "\xff", "\x7f", "\x80",
+        "abcdefgh", "abcdefgi", "abcdefg",
+        String(40, 'x'), String(40, 'x') + "a", String(39, 'x') + "y", String(33, 'q'),
+    };
+    for (auto& a : samples) {
+        for (auto& b : samples) {
+            REQUIRE(sign(compareBytes(a, b)) == sign(a.compare(b)));
+        }
+    }
+
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> len(0, 80);
+    std::uniform_int_distribution<int> byte(0, 3);
+    for (int i = 0; i < 10000; ++i) {
+        String a(len(gen), 'a');
+        String b(len(gen), 'a');
+        for (auto& c : a) c = (char)(0x7e + byte(gen));
+        for (auto& c : b) c = (char)(0x7e + byte(gen));
+        REQUIRE(sign(compareBytes(a, b)) == sign(a.compare(b)));
+        REQUIRE(compareBytes(a, a) == 0);
+    }
+}
+
+SCENARIO("orderedPrefix64 orders like the strings it was taken from") {
+    std::vector<String> samples = {
+        "", "a", "ab", String("a\0", 2), "abcdefgh", "abcdefghz", "abcdefgi", "\xff", "\x01",
+    };
+    for (auto& a : samples) {
+        for (auto& b : samples) {
+            auto pa = orderedPrefix64(a);
+            auto pb = orderedPrefix64(b);
+            if (pa < pb) REQUIRE(a.compare(b) < 0);
+            if (pa > pb) REQUIRE(a.compare(b) > 0);
+        }
+    }
+    REQUIRE(orderedPrefix64("abcdefgh") == orderedPrefix64("abcdefghz"));
+}
@@ -0,0 +1,65 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <cstring>
+#include <random>
+
+#include <k2/common/ByteSearch.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+static size_t expectedFind(const String& haystack, const String& needle) {
+    auto pos = haystack.find(needle);
+    return pos == String::npos ? ByteNeedle::npos : pos;
+}
+
+SCENARIO("ByteNeedle finds the same positions as String::find") {
+    std::vector<String> samples = {
+        "", "a", "ab", "abc", String("\0", 1), String("a\0b", 3), "\xff",
+        String(40, 'x'), String(40, 'x') + "a", String(39, 'x') + "y", String(70, 'q') + "qa",
+    };
+    for (auto& haystack : samples) {
+        for (auto& needle : samples) {
+            ByteNeedle bn(needle);
+            REQUIRE(bn.find(haystack.data(), haystack.size()) == expectedFind(haystack, needle));
+            REQUIRE(bn.isPrefixOf(haystack.data(), haystack.size()) == (haystack.find(needle) == 0));
+            REQUIRE(bn.isSuffixOf(haystack.data(), haystack.size()) ==
+                    (haystack.size() >= needle.size() &&
+                     std::memcmp(haystack.data() + haystack.size() - needle.size(), needle.data(), needle.size()) == 0));
+        }
+    }
+
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> len(0, 100);
+    std::uniform_int_distribution<int> needleLen(0, 6);
+    std::uniform_int_distribution<int> byte(0, 2);
+    for (int i = 0; i < 10000; ++i) {
+        String haystack(len(gen), 'a');
+        String needle(needleLen(gen), 'a');
+        for (auto& c : haystack) c = (char)('a' + byte(gen));
+        for (auto& c : needle) c = (char)('a' + byte(gen));
+        ByteNeedle bn(needle);
+        REQUIRE(bn.find(haystack.data(), haystack.size()) == expectedFind(haystack, needle));
+    }
+}
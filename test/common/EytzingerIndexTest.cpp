@@ -0,0 +1,61 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include <algorithm>
+#include <random>
+
+#include <k2/common/EytzingerIndex.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+SCENARIO("EytzingerIndex bounds match the sorted array bounds") {
+    std::mt19937_64 gen(1);
+    for (size_t n : {0, 1, 2, 3, 7, 8, 9, 100, 1000, 10000}) {
+        std::vector<uint64_t> keys(n);
+        // a small key range gives plenty of duplicates
+        std::uniform_int_distribution<uint64_t> dist(0, n * 2);
+        for (auto& k : keys) k = dist(gen);
+        std::sort(keys.begin(), keys.end());
+        EytzingerIndex index(keys);
+        REQUIRE(index.size() == n);
+
+        for (uint64_t x = 0; x <= n * 2 + 1; ++x) {
+            size_t lb = std::lower_bound(keys.begin(), keys.end(), x) - keys.begin();
+            size_t ub = std::upper_bound(keys.begin(), keys.end(), x) - keys.begin();
+            REQUIRE(index.lowerBound(x) == lb);
+            REQUIRE(index.upperBound(x) == ub);
+        }
+    }
+}
+
+SCENARIO("EytzingerIndex handles extreme keys") {
+    std::vector<uint64_t> keys = {0, 0, 5, UINT64_MAX};
+    EytzingerIndex index(keys);
+    REQUIRE(index.lowerBound(0) == 0);
+    REQUIRE(index.upperBound(0) == 2);
+    REQUIRE(index.lowerBound(UINT64_MAX) == 3);
+    REQUIRE(index.upperBound(UINT64_MAX) == 4);
+    REQUIRE(EytzingerIndex().lowerBound(1) == 0);
+}
@@ -0,0 +1,108 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include <cstring>
+
+#include <k2/common/HugePagePool.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+// The pool is per core, so the test cases share it and run in order
+
+TEST_CASE("Test1: a disabled pool provides nothing") {
+    auto& pool = mem::HugePagePool::local();
+    REQUIRE(!pool.enabled());
+    REQUIRE(pool.allocatePermanent(1024, 64) == nullptr);
+    REQUIRE(pool.allocateBuffer(1024).empty());
+    REQUIRE(pool.mappedBytes() == 0);
+}
+
+TEST_CASE("Test2: regions fall back to regular pages without reserved huge pages") {
+    auto& pool = mem::HugePagePool::local();
+    // there are no huge pages of 64KB reserved, so the regions are mapped with regular pages
+    pool.configure(64 * 1024 * 1024, 64 * 1024, false);
+    REQUIRE(pool.enabled());
+
+    char* mem = static_cast<char*>(pool.allocatePermanent(1000, 64));
+    REQUIRE(mem != nullptr);
+    REQUIRE(reinterpret_cast<uintptr_t>(mem) % 64 == 0);
+    std::memset(mem, 0xab, 1000);
+    REQUIRE(pool.mappedBytes() > 0);
+    REQUIRE(pool.mappedBytes() % (64 * 1024) == 0);
+    REQUIRE(pool.hugetlbBytes() == 0);
+
+    char* next = static_cast<char*>(pool.allocatePermanent(1000, 64));
+    REQUIRE(next >= mem + 1000);
+    REQUIRE(reinterpret_cast<uintptr_t>(next) % 64 == 0);
+}
+
+TEST_CASE("Test3: released buffers are reused for any buffer of their size class") {
+    auto& pool = mem::HugePagePool::local();
+    REQUIRE(mem::HugePagePool::bufferCapacity(1) == mem::HugePagePool::MinBufferSize);
+    REQUIRE(mem::HugePagePool::bufferCapacity(4096) == 4096);
+    REQUIRE(mem::HugePagePool::bufferCapacity(4097) == 8192);
+    REQUIRE(mem::HugePagePool::bufferCapacity(5000) == 8192);
+    REQUIRE(mem::HugePagePool::bufferCapacity(1 << 20) == 1 << 20);
+
+    const char* first = nullptr;
+    {
+        auto buf = pool.allocateBuffer(5000);
+        REQUIRE(buf.size() == 5000);
+        first = buf.get();
+        std::memset(buf.get_write(), 1, buf.size());
+    }
+    REQUIRE(pool.freeBufferBytes() == 8192);
+
+    // same class, different size
+    auto reused = pool.allocateBuffer(6000);
+    REQUIRE(reused.get() == first);
+    REQUIRE(reused.size() == 6000);
+    REQUIRE(pool.freeBufferBytes() == 0);
+
+    // another class gets a buffer of its own
+    auto small = pool.allocateBuffer(3000);
+    REQUIRE(small.get() != first);
+    auto large = pool.allocateBuffer(9000);
+    REQUIRE(large.get() != first);
+
+    // a buffer returns to the pool with the last binary sharing it
+    auto shared = small.share();
+    small = Binary();
+    REQUIRE(pool.freeBufferBytes() == 0);
+    shared = Binary();
+    REQUIRE(pool.freeBufferBytes() == 4096);
+    reused = Binary();
+    large = Binary();
+    REQUIRE(pool.freeBufferBytes() == 4096 + 8192 + 16384);
+}
+
+TEST_CASE("Test4: buffers past the budget are left to the heap") {
+    auto& pool = mem::HugePagePool::local();
+    // no room for another region
+    pool.configure(pool.mappedBytes(), 64 * 1024, false);
+    REQUIRE(pool.allocateBuffer(128 * 1024 * 1024).empty());
+    // the released buffers are still there for reuse
+    REQUIRE(!pool.allocateBuffer(4000).empty());
+}
@@ -0,0 +1,60 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <vector>
+
+#include <k2/common/MemoryAccounting.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+TEST_CASE("Test1: containers with a tracked allocator are accounted to their subsystem") {
+    auto before = mem::MemoryAccounting::usage(mem::Subsystem::Txns);
+    {
+        std::vector<uint64_t, mem::TrackedAllocator<uint64_t, mem::Subsystem::Txns>> values;
+        values.reserve(100);
+        auto usage = mem::MemoryAccounting::usage(mem::Subsystem::Txns);
+        REQUIRE(usage.bytes - before.bytes == int64_t(100 * sizeof(uint64_t)));
+        REQUIRE(usage.blocks - before.blocks == 1);
+        // other subsystems are unaffected
+        REQUIRE(mem::MemoryAccounting::usage(mem::Subsystem::Indexer).bytes == 0);
+    }
+    auto after = mem::MemoryAccounting::usage(mem::Subsystem::Txns);
+    REQUIRE(after.bytes == before.bytes);
+    REQUIRE(after.blocks == before.blocks);
+}
+
+TEST_CASE("Test2: tracked binaries are released with their last share") {
+    auto before = mem::MemoryAccounting::usage(mem::Subsystem::Transport);
+    Binary shared;
+    {
+        Binary buf = mem::tracked(Binary(1000), mem::Subsystem::Transport);
+        REQUIRE(buf.size() == 1000);
+        shared = buf.share(10, 20);
+        REQUIRE(mem::MemoryAccounting::usage(mem::Subsystem::Transport).bytes - before.bytes == 1000);
+    }
+    REQUIRE(mem::MemoryAccounting::usage(mem::Subsystem::Transport).bytes - before.bytes == 1000);
+    shared = Binary();
+    REQUIRE(mem::MemoryAccounting::usage(mem::Subsystem::Transport).bytes == before.bytes);
+    REQUIRE(mem::MemoryAccounting::usage(mem::Subsystem::Transport).blocks == before.blocks);
+}
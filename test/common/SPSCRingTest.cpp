@@ -0,0 +1,90 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <k2/common/SPSCRing.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+TEST_CASE("test spsc ring push and pop") {
+    SPSCRing<std::unique_ptr<int>> ring(3);
+    REQUIRE(ring.capacity() == 4);
+    REQUIRE(ring.empty());
+    REQUIRE(!ring.pop());
+
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE(ring.push(std::make_unique<int>(i)));
+    }
+    // a failed push leaves the item with the caller
+    auto extra = std::make_unique<int>(4);
+    REQUIRE(!ring.push(std::move(extra)));
+    REQUIRE(extra);
+
+    REQUIRE(*ring.pop().value() == 0);
+    REQUIRE(ring.push(std::move(extra)));
+
+    std::vector<int> drained;
+    REQUIRE(ring.drain([&drained](std::unique_ptr<int>&& v) { drained.push_back(*v); }, 2) == 2);
+    REQUIRE(drained == std::vector<int>{1, 2});
+    REQUIRE(ring.drain([&drained](std::unique_ptr<int>&& v) { drained.push_back(*v); }) == 2);
+    REQUIRE(drained == std::vector<int>{1, 2, 3, 4});
+    REQUIRE(ring.empty());
+
+    // items left in the ring are destroyed with it
+    auto shared = std::make_shared<int>(0);
+    {
+        SPSCRing<std::shared_ptr<int>> other(4);
+        auto copy = shared;
+        REQUIRE(other.push(std::move(copy)));
+        REQUIRE(shared.use_count() == 2);
+    }
+    REQUIRE(shared.use_count() == 1);
+}
+
+TEST_CASE("test spsc ring across threads") {
+    const uint64_t count = 200000;
+    SPSCRing<uint64_t> ring(64);
+    std::thread producer([&ring, count] {
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t v = i;
+            while (!ring.push(std::move(v))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint64_t expected = 0;
+    bool inOrder = true;
+    while (expected < count) {
+        if (ring.drain([&](uint64_t&& v) { inOrder = inOrder && v == expected; ++expected; }) == 0) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    REQUIRE(inOrder);
+    REQUIRE(ring.empty());
+}
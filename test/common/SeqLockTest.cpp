@@ -0,0 +1,114 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <k2/common/SeqLock.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+namespace {
+// every field is derived from the same counter so that a torn read is detectable
+struct Snapshot {
+    uint64_t a{0};
+    uint64_t b{0};
+    uint16_t c{0};
+    bool even{true};
+};
+}
+
+TEST_CASE("test seqlock store and load") {
+    SeqLock<Snapshot> lock;
+    REQUIRE(lock.version() == 0);
+    REQUIRE(lock.load().a == 0);
+
+    uint64_t version = 0;
+    Snapshot out;
+    REQUIRE(!lock.loadIfChanged(version, out));
+
+    lock.store(Snapshot{.a = 1, .b = 2, .c = 3, .even = false});
+    REQUIRE(lock.version() == 2);
+    REQUIRE(lock.loadIfChanged(version, out));
+    REQUIRE(version == 2);
+    REQUIRE(out.a == 1);
+    REQUIRE(out.b == 2);
+    REQUIRE(out.c == 3);
+    REQUIRE(!out.even);
+    // nothing new since the last observed version
+    REQUIRE(!lock.loadIfChanged(version, out));
+
+    lock.store(Snapshot{.a = 4, .b = 5, .c = 6, .even = true});
+    lock.store(Snapshot{.a = 7, .b = 8, .c = 9, .even = false});
+    // intermediate values are skipped, only the latest is seen
+    REQUIRE(lock.loadIfChanged(version, out));
+    REQUIRE(version == 6);
+    REQUIRE(out.a == 7);
+    REQUIRE(lock.load().c == 9);
+}
+
+TEST_CASE("test seqlock readers never see torn values") {
+    const uint64_t count = 200000;
+    SeqLock<Snapshot> lock;
+    std::atomic<bool> done{false};
+
+    // catch2 assertions are not thread-safe, so readers only count what they saw
+    std::atomic<uint64_t> torn{0};
+    std::atomic<uint64_t> backwards{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&lock, &done, &torn, &backwards] {
+            uint64_t version = 0;
+            uint64_t last = 0;
+            Snapshot out;
+            while (!done.load(std::memory_order_acquire)) {
+                if (!lock.loadIfChanged(version, out)) {
+                    continue;
+                }
+                if (out.b != out.a * 3 || out.c != uint16_t(out.a) || out.even != (out.a % 2 == 0)) {
+                    ++torn;
+                }
+                if (out.a < last) {
+                    ++backwards;
+                }
+                last = out.a;
+            }
+        });
+    }
+
+    for (uint64_t i = 1; i <= count; ++i) {
+        lock.store(Snapshot{.a = i, .b = i * 3, .c = uint16_t(i), .even = (i % 2 == 0)});
+    }
+    done.store(true, std::memory_order_release);
+    for (auto& t : readers) {
+        t.join();
+    }
+    REQUIRE(torn == 0);
+    REQUIRE(backwards == 0);
+    auto last = lock.load();
+    REQUIRE(last.a == count);
+    REQUIRE(lock.version() == count * 2);
+}
@@ -0,0 +1,56 @@
+/*
+MIT License
+
+Copyright(c) 2021 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <thread>
+
+#include <k2/common/Chrono.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+TEST_CASE("test TSC clock is monotonic and tracks the steady clock") {
+    auto prev = TSCClock::now();
+    Duration maxSkew{0};
+    // long enough to re-anchor a few times
+    auto end = Clock::now() + 5 * TSCClock::kResyncInterval;
+    while (Clock::now() < end) {
+        auto before = Clock::now();
+        auto now = TSCClock::now();
+        auto after = Clock::now();
+        REQUIRE(now >= prev);
+        prev = now;
+        // outside of [before, after] only by the extrapolation error
+        if (now < before) maxSkew = std::max(maxSkew, before - now);
+        if (now > after) maxSkew = std::max(maxSkew, now - after);
+    }
+    REQUIRE(maxSkew < 1ms);
+
+    // measures the same durations as the steady clock
+    auto tscStart = TSCClock::now();
+    auto start = Clock::now();
+    std::this_thread::sleep_for(50ms);
+    auto elapsed = TSCClock::now() - tscStart;
+    auto expected = Clock::now() - start;
+    REQUIRE(elapsed > expected - 1ms);
+    REQUIRE(elapsed < expected + 1ms);
+}
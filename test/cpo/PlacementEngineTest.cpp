@@ -0,0 +1,106 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <k2/cpo/service/PlacementEngine.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+static CoreLoad core(const String& host, int port, bool assigned, double requestRate=0, uint64_t memoryBytes=0) {
+    CoreLoad load;
+    load.endpoint = "tcp+k2rpc://" + host + ":" + std::to_string(port);
+    load.assigned = assigned;
+    load.requestRate = requestRate;
+    load.memoryBytes = memoryBytes;
+    return load;
+}
+
+TEST_CASE("Test1: node of an endpoint") {
+    REQUIRE(PlacementEngine::nodeOf("tcp+k2rpc://10.0.0.1:10000") == "10.0.0.1");
+    REQUIRE(PlacementEngine::nodeOf("auto-rrdma+k2rpc://10.0.0.2:10001") == "10.0.0.2");
+    REQUIRE(PlacementEngine::nodeOf("10.0.0.3") == "10.0.0.3");
+}
+
+TEST_CASE("Test2: place on the node with the lowest load") {
+    PlacementEngine engine;
+    engine.update({core("10.0.0.1", 10000, true, 500, 1000), core("10.0.0.1", 10001, false),
+                   core("10.0.0.2", 10000, true, 100, 1000), core("10.0.0.2", 10001, false)});
+    auto placed = engine.place(1);
+    REQUIRE(placed.size() == 1);
+    REQUIRE(placed[0] == "tcp+k2rpc://10.0.0.2:10001");
+}
+
+TEST_CASE("Test3: an idle cluster is spread over the nodes") {
+    PlacementEngine engine;
+    engine.update({core("10.0.0.1", 10000, false), core("10.0.0.1", 10001, false),
+                   core("10.0.0.2", 10000, false), core("10.0.0.2", 10001, false)});
+    auto placed = engine.place(2);
+    REQUIRE(placed.size() == 2);
+    REQUIRE(PlacementEngine::nodeOf(placed[0]) != PlacementEngine::nodeOf(placed[1]));
+}
+
+TEST_CASE("Test4: placed partitions add the mean partition load to their node") {
+    PlacementEngine engine;
+    // the mean partition has 125 requests/sec, so after the first one the less loaded node is the busier one
+    engine.update({core("10.0.0.1", 10000, true, 100), core("10.0.0.1", 10001, false), core("10.0.0.1", 10002, false),
+                   core("10.0.0.2", 10000, true, 150), core("10.0.0.2", 10001, false), core("10.0.0.2", 10002, false)});
+    auto placed = engine.place(2);
+    REQUIRE(placed.size() == 2);
+    REQUIRE(placed[0] == "tcp+k2rpc://10.0.0.1:10001");
+    REQUIRE(placed[1] == "tcp+k2rpc://10.0.0.2:10001");
+}
+
+TEST_CASE("Test5: place is limited by the free cores") {
+    PlacementEngine engine;
+    engine.update({core("10.0.0.1", 10000, true, 10), core("10.0.0.1", 10001, false),
+                   core("10.0.0.2", 10000, false)});
+    auto placed = engine.place(5);
+    REQUIRE(placed.size() == 2);
+
+    engine.markAssigned("tcp+k2rpc://10.0.0.1:10001");
+    engine.markAssigned("tcp+k2rpc://10.0.0.2:10000");
+    REQUIRE(engine.place(1).empty());
+    REQUIRE(!engine.freeCoreOn("10.0.0.1"));
+}
+
+TEST_CASE("Test6: overloaded node") {
+    PlacementEngine engine;
+    REQUIRE(!engine.overloadedNode(1.5));
+
+    engine.update({core("10.0.0.1", 10000, true, 200), core("10.0.0.1", 10001, true, 100), core("10.0.0.1", 10002, false),
+                   core("10.0.0.2", 10000, true, 100)});
+    // the nodes have 300 and 100 requests/sec, so the mean is 200
+    auto node = engine.overloadedNode(1.1);
+    REQUIRE(node);
+    REQUIRE(*node == "10.0.0.1");
+    REQUIRE(!engine.overloadedNode(1.5));
+
+    REQUIRE(*engine.freeCoreOn("10.0.0.1") == "tcp+k2rpc://10.0.0.1:10002");
+    REQUIRE(!engine.freeCoreOn("10.0.0.2"));
+    auto cores = engine.assignedCores("10.0.0.1");
+    REQUIRE(cores.size() == 2);
+    REQUIRE(cores[0].requestRate == 200);
+    REQUIRE(cores[1].requestRate == 100);
+}
@@ -173,6 +173,45 @@ seastar::future<> runScenario01() {
         k2::dto::PartitionGetter::PartitionWithEndpoint& part = _pgetter.getPartitionForKey(key, true, true);
         K2LOG_D(log::ptest, "startkey: {}, endKey: {}, endpoint: {}, TxEndpoint:{}", part.partition->startKey, part.partition->endKey, *(part.partition->endpoints.begin()), (*part.preferredEndpoint));
         K2EXPECT(log::ptest, part.partition->startKey, "e");
+    })
+    .then([this] {
+        K2LOG_I(log::ptest, "case8: snapshot reads are routed to a follower only if the partition has one");
+
+        k2::dto::Key key{.schemaName = "schema", .partitionKey = "d", .rangeKey = ""};
+        K2EXPECT(log::ptest, _pgetter.getPartitionForKey(key).followerEndpoint == nullptr, true);
+
+        k2::dto::Collection collection;
+        collection.metadata.name = collname;
+        collection.metadata.hashScheme = k2::dto::HashScheme::Range;
+        collection.partitionMap.partitions.push_back(k2::dto::Partition{
+            .pvid{.id = 0, .rangeVersion = 1, .assignmentVersion = 1},
+            .startKey = "",
+            .endKey = "",
+            .endpoints = {_cpoConfigEp()},
+            .astate = k2::dto::AssignmentState::Assigned,
+            .followers = {_cpoConfigEp()}
+        });
+        k2::dto::PartitionGetter followed(std::move(collection));
+        auto& part = followed.getPartitionForKey(key);
+        K2EXPECT(log::ptest, part.followerEndpoint != nullptr, true);
+        K2EXPECT(log::ptest, part.followerEndpoint->url, _cpoConfigEp());
+
+        K2LOG_I(log::ptest, "case9: partitions share one endpoint per URL");
+        K2EXPECT(log::ptest, part.followerEndpoint.get() == part.preferredEndpoint.get(), true);
+        K2EXPECT(log::ptest, k2::RPC().getSharedTXEndpoint(_cpoConfigEp()).get() == part.preferredEndpoint.get(), true);
+
+        K2LOG_I(log::ptest, "case10: a key which is edited after it was hashed hashes and compares by its new fields");
+        auto partitionHash = key.partitionHash();
+        auto hash = key.hash();
+        k2::dto::Key copy = key;
+        K2EXPECT(log::ptest, copy == key, true);
+        copy.partitionKey = "e";
+        K2EXPECT(log::ptest, copy.partitionHash() == partitionHash, false);
+        K2EXPECT(log::ptest, copy.hash() == hash, false);
+        K2EXPECT(log::ptest, copy == key, false);
+        copy.partitionKey = key.partitionKey;
+        K2EXPECT(log::ptest, copy == key, true);
+        K2EXPECT(log::ptest, copy.hash(), hash);
     });
 }
 
@@ -4,7 +4,14 @@ cd ${topname}
 
 set -e
 
-for test in test_collection.sh test_k23si.sh test_3si_txn.sh test_schema_create.sh test_skv_client.sh test_query.sh; do
+if [ "$1" == "perf" ]; then
+    # performance regression check against the stored baselines
+    shift
+    ./test_perf.sh "$@"
+    exit
+fi
+
+for test in test_collection.sh test_k23si.sh test_3si_txn.sh test_schema_create.sh test_skv_client.sh test_query.sh test_split.sh test_cold_records.sh test_recovery.sh test_routines.sh test_pipelined_writes.sh test_persistence.sh test_persistence_quorum.sh; do
     echo ">>> Running integration test: ${test}";
     ./${test};
     echo ">>> Done running test ${test}";
@@ -0,0 +1,149 @@
+#!/bin/bash
+# Performance regression check. Boots the cluster like test_k23si_tpcc.sh, runs fixed-duration TPC-C and YCSB
+# workloads against it, and compares their throughput and p99 latency with the baselines in PERF_BASELINES.
+# Exits non-zero if a metric regressed by more than its tolerance.
+#   --update-baselines    record the results of this run as the new baselines instead of comparing
+# Environment:
+#   PERF_DURATION         seconds each workload runs for (default 30)
+#   PERF_BASELINES        the baselines file (default test/integration/perf_baselines.txt)
+#   PERF_RESULTS          where the results of this run are written (default /tmp/___perf_results.txt)
+#   PERF_TPUT_TOLERANCE   allowed throughput drop, in percent (default 10)
+#   PERF_P99_TOLERANCE    allowed p99 latency increase, in percent (default 20)
+topname=$(dirname "$0")
+cd ${topname}/../..
+set -e
+CPODIR=/tmp/___cpo_integ_test
+LOGDIR=/tmp/___perf_logs
+rm -rf ${CPODIR} ${LOGDIR}
+mkdir -p ${LOGDIR}
+EPS="tcp+k2rpc://0.0.0.0:10000"
+
+PERSISTENCE=tcp+k2rpc://0.0.0.0:12001
+CPO=tcp+k2rpc://0.0.0.0:9000
+TSO=tcp+k2rpc://0.0.0.0:13000
+COMMON_ARGS="--enable_tx_checksum true --thread-affinity false"
+
+DURATION=${PERF_DURATION:-30}
+BASELINES=${PERF_BASELINES:-test/integration/perf_baselines.txt}
+RESULTS=${PERF_RESULTS:-/tmp/___perf_results.txt}
+TPUT_TOLERANCE=${PERF_TPUT_TOLERANCE:-10}
+P99_TOLERANCE=${PERF_P99_TOLERANCE:-20}
+UPDATE_BASELINES=false
+if [ "$1" == "--update-baselines" ]; then
+    UPDATE_BASELINES=true
+fi
+
+# start CPO on 1 cores
+./build/src/k2/cmd/controlPlaneOracle/cpo_main -c1 --tcp_endpoints ${CPO} 9001 --data_dir ${CPODIR} ${COMMON_ARGS}  --prometheus_port 63000 --assignment_timeout=1s --reactor-backend epoll --heartbeat_deadline=1s &
+cpo_child_pid=$!
+
+# start nodepool on 1 cores
+./build/src/k2/cmd/nodepool/nodepool -c1 --tcp_endpoints ${EPS} --k23si_persistence_endpoint ${PERSISTENCE} ${COMMON_ARGS} --prometheus_port 63001 --k23si_cpo_endpoint ${CPO} --tso_endpoint ${TSO} --memory=3G --partition_request_timeout=6s &
+nodepool_child_pid=$!
+
+# start persistence on 1 cores
+./build/src/k2/cmd/persistence/persistence -c1 --tcp_endpoints ${PERSISTENCE} ${COMMON_ARGS} --prometheus_port 63002 &
+persistence_child_pid=$!
+
+# start tso on 2 cores
+./build/src/k2/cmd/tso/tso -c2 --tcp_endpoints ${TSO} 13001 ${COMMON_ARGS} --prometheus_port 63003 &
+tso_child_pid=$!
+
+function finish {
+  # cleanup code
+  rm -rf ${CPODIR}
+
+  kill ${nodepool_child_pid}
+  echo "Waiting for nodepool child pid: ${nodepool_child_pid}"
+  wait ${nodepool_child_pid}
+
+  kill ${cpo_child_pid}
+  echo "Waiting for cpo child pid: ${cpo_child_pid}"
+  wait ${cpo_child_pid}
+
+  kill ${persistence_child_pid}
+  echo "Waiting for persistence child pid: ${persistence_child_pid}"
+  wait ${persistence_child_pid}
+
+  kill ${tso_child_pid}
+  echo "Waiting for tso child pid: ${tso_child_pid}"
+  wait ${tso_child_pid}
+}
+trap finish EXIT
+
+# runs a benchmark client with its output in the given log, until it is done with its benchmark.
+# The clients which keep running after their benchmark(k23sibench_client) are stopped then
+function run_workload {
+    local log=$1
+    shift
+    "$@" > ${log} 2>&1 &
+    local pid=$!
+    while kill -0 ${pid} 2>/dev/null && ! grep -q "Done with benchmark" ${log}; do
+        sleep 1
+    done
+    kill -INT ${pid} 2>/dev/null || true
+    wait ${pid} || true
+}
+
+# the first value of the given key(e.g. "p99=") in the last log line matching the pattern
+function extract {
+    local log=$1
+    local pattern=$2
+    local key=$3
+    grep -o "${pattern}.*" ${log} | tail -1 | grep -o "${key}[0-9.e+]*" | head -1 | sed "s/^${key}//"
+}
+
+sleep 5
+> ${RESULTS}
+
+NUMWH=1
+NUMDIST=1
+echo ">>> Loading TPC-C ..."
+./build/src/k2/cmd/tpcc/tpcc_client -c1 --tcp_remotes ${EPS} --cpo ${CPO} --tso_endpoint ${TSO} --data_load true --num_warehouses ${NUMWH} --districts_per_warehouse ${NUMDIST} --prometheus_port 63100 ${COMMON_ARGS} --memory=512M --partition_request_timeout=6s --dataload_txn_timeout=600s --do_verification false --num_concurrent_txns=2
+
+sleep 1
+echo ">>> Running TPC-C for ${DURATION}s ..."
+run_workload ${LOGDIR}/tpcc.log ./build/src/k2/cmd/tpcc/tpcc_client -c1 --tcp_remotes ${EPS} --cpo ${CPO} --tso_endpoint ${TSO} --num_warehouses ${NUMWH} --districts_per_warehouse ${NUMDIST} --prometheus_port 63101 ${COMMON_ARGS} --memory=512M --partition_request_timeout=1s --num_concurrent_txns=2 --do_verification false --delivery_txn_batch_size=10 --test_duration_s=${DURATION}
+echo "tpcc_tpmC $(extract ${LOGDIR}/tpcc.log 'tpmC of all cores=' 'tpmC of all cores=')" >> ${RESULTS}
+echo "tpcc_neworder_p99_us $(extract ${LOGDIR}/tpcc.log 'NewOrder: committed=' 'p99=')" >> ${RESULTS}
+
+for workload in A C; do
+    echo ">>> Running YCSB workload ${workload} for ${DURATION}s ..."
+    run_workload ${LOGDIR}/ycsb_${workload}.log ./build/src/k2/cmd/txbench/k23sibench_client -c1 --tcp_remotes ${EPS} --cpo ${CPO} --tso_endpoint ${TSO} --prometheus_port 63102 ${COMMON_ARGS} --memory=512M --partition_request_timeout=1s --workload ${workload} --record_count 10000 --pipeline_depth 10 --test_duration ${DURATION}s
+    committed=$(extract ${LOGDIR}/ycsb_${workload}.log 'txns: committed=' 'committed=')
+    echo "ycsb_${workload}_txns_per_sec $(awk -v c=${committed:-0} -v d=${DURATION} 'BEGIN { printf "%.1f", c / d }')" >> ${RESULTS}
+    echo "ycsb_${workload}_p99_us $(extract ${LOGDIR}/ycsb_${workload}.log 'txns: committed=' 'p99=')" >> ${RESULTS}
+done
+
+echo ">>> Results (logs in ${LOGDIR}):"
+cat ${RESULTS}
+
+if [ "${UPDATE_BASELINES}" == "true" ]; then
+    grep "^#" ${BASELINES} > ${BASELINES}.new 2>/dev/null || true
+    cat ${RESULTS} >> ${BASELINES}.new
+    mv ${BASELINES}.new ${BASELINES}
+    echo ">>> Updated baselines in ${BASELINES}"
+    exit 0
+fi
+
+# metrics ending in _us are latencies, for which lower is better. For the rest higher is better.
+# A metric without a baseline is reported but doesn't fail the check
+echo ">>> Comparing with baselines in ${BASELINES}"
+awk -v tput_tol=${TPUT_TOLERANCE} -v p99_tol=${P99_TOLERANCE} '
+    FNR == NR { if ($1 !~ /^#/ && NF == 2) baseline[$1] = $2; next }
+    {
+        name = $1; value = $2
+        if (value == "") { printf "FAIL %s: no result\n", name; failed = 1; next }
+        if (!(name in baseline)) { printf "NEW  %s: %s (no baseline)\n", name, value; next }
+        base = baseline[name]
+        if (name ~ /_us$/) {
+            limit = base * (1 + p99_tol / 100); bad = value > limit
+        } else {
+            limit = base * (1 - tput_tol / 100); bad = value < limit
+        }
+        printf "%s %s: %s, baseline %s, limit %.1f\n", bad ? "FAIL" : "OK  ", name, value, base, limit
+        if (bad) failed = 1
+    }
+    END { exit failed }
+' ${BASELINES} ${RESULTS} || { echo ">>> Performance regression detected"; exit 1; }
+echo ">>> No performance regression"
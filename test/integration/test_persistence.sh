@@ -0,0 +1,26 @@
+#!/bin/bash
+topname=$(dirname "$0")
+cd ${topname}/../..
+set -e
+WALDIR=/tmp/___persistence_integ_test
+rm -rf ${WALDIR}
+
+PERSISTENCE=tcp+k2rpc://0.0.0.0:12001
+
+# start persistence on 1 cores
+./build/src/k2/cmd/persistence/persistence -c1 --tcp_endpoints ${PERSISTENCE} --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63002 --persistence_wal_path ${WALDIR} &
+persistence_child_pid=$!
+
+function finish {
+  # cleanup code
+  kill ${persistence_child_pid}
+  echo "Waiting for persistence child pid: ${persistence_child_pid}"
+  wait ${persistence_child_pid}
+
+  rm -rf ${WALDIR}
+}
+trap finish EXIT
+
+sleep 2
+
+./build/test/k23si/persistence_test --persistence_endpoint ${PERSISTENCE} --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100
@@ -0,0 +1,72 @@
+#!/bin/bash
+topname=$(dirname "$0")
+cd ${topname}/../..
+set -e
+CPODIR=/tmp/___cpo_integ_test
+WALDIR=/tmp/___persistence_integ_test
+rm -rf ${CPODIR} ${WALDIR}
+EPS="tcp+k2rpc://0.0.0.0:10000"
+
+PERSISTENCE1=tcp+k2rpc://0.0.0.0:12001
+PERSISTENCE2=tcp+k2rpc://0.0.0.0:12002
+CPO=tcp+k2rpc://0.0.0.0:9000
+TSO=tcp+k2rpc://0.0.0.0:13000
+
+# start CPO on 2 cores
+./build/src/k2/cmd/controlPlaneOracle/cpo_main -c1 --tcp_endpoints ${CPO} 9001 --data_dir ${CPODIR} --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63000 --assignment_timeout=1s &
+cpo_child_pid=$!
+
+# start nodepool on 1 core. Every batch has to be acknowledged by both persistence replicas
+./build/src/k2/cmd/nodepool/nodepool -c1 --tcp_endpoints ${EPS} --enable_tx_checksum true --k23si_persistence_endpoints ${PERSISTENCE1} ${PERSISTENCE2} --k23si_persistence_replicas 2 --k23si_persistence_write_quorum 2 --reactor-backend epoll --prometheus_port 63001 --k23si_cpo_endpoint ${CPO} --tso_endpoint ${TSO} --k23si_persistence_timeout 1s &
+nodepool_child_pid=$!
+
+# start the persistence replicas on 1 core each
+./build/src/k2/cmd/persistence/persistence -c1 --tcp_endpoints ${PERSISTENCE1} --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63002 --persistence_wal_path ${WALDIR}/1 &
+persistence1_child_pid=$!
+./build/src/k2/cmd/persistence/persistence -c1 --tcp_endpoints ${PERSISTENCE2} --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63004 --persistence_wal_path ${WALDIR}/2 &
+persistence2_child_pid=$!
+
+# start tso on 2 cores
+./build/src/k2/cmd/tso/tso -c2 --tcp_endpoints ${TSO} 13001 --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63003 &
+tso_child_pid=$!
+
+function finish {
+  # cleanup code
+  rm -rf ${CPODIR}
+
+  kill ${cpo_child_pid}
+  echo "Waiting for cpo child pid: ${cpo_child_pid}"
+  wait ${cpo_child_pid}
+
+  kill ${nodepool_child_pid}
+  echo "Waiting for nodepool child pid: ${nodepool_child_pid}"
+  wait ${nodepool_child_pid}
+
+  kill ${persistence1_child_pid}
+  echo "Waiting for persistence child pid: ${persistence1_child_pid}"
+  wait ${persistence1_child_pid}
+
+  # the second replica may still be paused if the failure phase failed
+  kill -CONT ${persistence2_child_pid}
+  kill ${persistence2_child_pid}
+  echo "Waiting for persistence child pid: ${persistence2_child_pid}"
+  wait ${persistence2_child_pid}
+
+  kill ${tso_child_pid}
+  echo "Waiting for tso child pid: ${tso_child_pid}"
+  wait ${tso_child_pid}
+
+  rm -rf ${WALDIR}
+}
+trap finish EXIT
+
+sleep 2
+
+./build/test/k23si/pipelined_writes_test --cpo_endpoint ${CPO} --k2_endpoint ${EPS} --phase durable --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100
+
+# pause one replica. The other one alone doesn't make the write quorum
+kill -STOP ${persistence2_child_pid}
+./build/test/k23si/pipelined_writes_test --cpo_endpoint ${CPO} --k2_endpoint ${EPS} --phase failure --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100
+kill -CONT ${persistence2_child_pid}
+
+./build/test/k23si/pipelined_writes_test --cpo_endpoint ${CPO} --k2_endpoint ${EPS} --phase resumed --enable_tx_checksum true --reactor-backend epoll --prometheus_port 63100
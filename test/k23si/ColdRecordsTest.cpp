@@ -0,0 +1,286 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <k2/cpo/client/CPOClient.h>
+#include <k2/module/k23si/client/k23si_client.h>
+#include <seastar/core/sleep.hh>
+#include <boost/range/irange.hpp>
+#include "Log.h"
+using namespace k2;
+
+const char* collname = "k23si_cold_collection";
+
+// Integration test for the freezing of cold records by the garbage collector. The nodepool runs with a short
+// retention window and GC interval, so the records written here are frozen into cold blocks shortly after they
+// are written. They are then read back with scans and point reads. The test script checks from the metrics of
+// the nodepool that the scans didn't thaw the records, which would have frozen them again
+class ColdRecordsTest {
+
+public:  // application lifespan
+    ColdRecordsTest() : _client(K23SIClientConfig()) { K2LOG_I(log::k23si, "ctor");}
+    ~ColdRecordsTest(){ K2LOG_I(log::k23si, "dtor");}
+
+    // required for seastar::distributed interface
+    seastar::future<> gracefulStop() {
+        K2LOG_I(log::k23si, "stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start(){
+        K2LOG_I(log::k23si, "start");
+
+        _testFuture = seastar::make_ready_future()
+        .then([this] () {
+            return _client.start();
+        })
+        .then([this] {
+            K2LOG_I(log::k23si, "Creating test collection...");
+            dto::CollectionMetadata metadata{
+                .name = collname,
+                .hashScheme = dto::HashScheme::HashCRC32C,
+                .storageDriver = dto::StorageDriver::K23SI,
+                .capacity = {},
+                .retentionPeriod = _retention()
+            };
+            return _client.makeCollection(std::move(metadata), std::vector<String>(_client._tcpRemotes()));
+        })
+        .then([](auto&& status) {
+            K2EXPECT(log::k23si, status.is2xxOK(), true);
+        })
+        .then([this] () {
+            dto::Schema schema;
+            schema.name = "schema";
+            schema.version = 1;
+            schema.fields = std::vector<dto::SchemaField> {
+                    {dto::FieldType::STRING, "partition", false, false},
+                    {dto::FieldType::STRING, "range", false, false},
+                    {dto::FieldType::STRING, "region", false, false},
+                    {dto::FieldType::INT32T, "balance", false, false},
+            };
+            schema.setPartitionKeyFieldsByName(std::vector<String>{"partition"});
+            schema.setRangeKeyFieldsByName(std::vector<String>{"range"});
+            return _client.createSchema(collname, std::move(schema));
+        })
+        .then([] (auto&& result) {
+            K2EXPECT(log::k23si, result.status.is2xxOK(), true);
+        })
+        .then([this] { return runScenario01(); })
+        .then([this] { return runScenario02(); })
+        .then([this] { return runScenario03(); })
+        .then([this] {
+            K2LOG_I(log::k23si, "======= All tests passed ========");
+            exitcode = 0;
+        })
+        .handle_exception([this](auto exc) {
+            try {
+                std::rethrow_exception(exc);
+            } catch (std::exception& e) {
+                K2LOG_E(log::k23si, "======= Test failed with exception [{}] ========", e.what());
+                exitcode = -1;
+            } catch (...) {
+                K2LOG_E(log::k23si, "Test failed with unknown exception");
+                exitcode = -1;
+            }
+        })
+        .finally([this] {
+            K2LOG_I(log::k23si, "======= Test ended ========");
+            seastar::engine().exit(exitcode);
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    int exitcode = -1;
+
+    ConfigDuration _retention{"collection_retention", 1s};
+    // how long to wait for the GC to freeze the records once they are out of the retention window
+    ConfigDuration _freezeWait{"freeze_wait", 3s};
+    ConfigVar<uint32_t> _recordCount{"record_count", 200};
+
+    seastar::future<> _testFuture = seastar::make_ready_future();
+
+    K23SIClient _client;
+    std::shared_ptr<dto::Schema> _schema;
+
+    static String _rangeKey(uint32_t i) {
+        return fmt::format("{:05}", i);
+    }
+
+    // the records repeat their regions and have increasing balances, so that they compress in the cold blocks
+    static String _region(uint32_t i) {
+        return i % 3 == 0 ? "north" : "south";
+    }
+
+    static int32_t _balance(uint32_t i) {
+        return 1000 + (int32_t)i * 10;
+    }
+
+    void _checkRecord(dto::SKVRecord& record, uint32_t i) {
+        K2EXPECT(log::k23si, *record.deserializeNext<String>(), "default");
+        K2EXPECT(log::k23si, *record.deserializeNext<String>(), _rangeKey(i));
+        K2EXPECT(log::k23si, *record.deserializeNext<String>(), _region(i));
+        K2EXPECT(log::k23si, *record.deserializeNext<int32_t>(), _balance(i));
+    }
+
+    // scans all records and checks them
+    seastar::future<> _scanAll() {
+        return _client.beginTxn(K2TxnOptions{})
+        .then([this] (K2TxnHandle&& t) {
+            return seastar::do_with(std::move(t), Query(), std::vector<dto::SKVRecord>(), false, [this] (auto& txn, auto& query, auto& records, bool& done) {
+                return _client.createQuery(collname, "schema")
+                .then([&] (auto&& response) {
+                    K2EXPECT(log::k23si, response.status.is2xxOK(), true);
+                    query = std::move(response.query);
+                    query.startScanRecord.template serializeNext<String>("default");
+                    query.endScanRecord.template serializeNext<String>("default");
+                    return seastar::do_until(
+                        [&done] { return done; },
+                        [&] {
+                            return txn.query(query)
+                            .then([&query, &records, &done] (auto&& response) {
+                                K2EXPECT(log::k23si, response.status, dto::K23SIStatus::OK);
+                                done = response.status.is2xxOK() ? query.isDone() : true;
+                                for (auto& record : response.records) {
+                                    records.push_back(std::move(record));
+                                }
+                            });
+                        });
+                })
+                .then([this, &txn, &records] {
+                    K2EXPECT(log::k23si, records.size(), _recordCount());
+                    for (uint32_t i = 0; i < records.size(); ++i) {
+                        _checkRecord(records[i], i);
+                    }
+                    return txn.end(true);
+                })
+                .then([] (auto&& response) {
+                    K2EXPECT(log::k23si, response.status, dto::K23SIStatus::OK);
+                });
+            });
+        });
+    }
+
+public: // tests
+
+// All records are written in a single transaction, so that they all leave the retention window together and the
+// GC freezes them in full blocks
+seastar::future<> runScenario01() {
+    K2LOG_I(log::k23si, "Scenario 01: write the records and wait for the GC to freeze them");
+    return _client.getSchema(collname, "schema", 1)
+    .then([this] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        _schema = schemaPtr;
+        K2TxnOptions options{};
+        options.syncFinalize = true;
+        return _client.beginTxn(options);
+    })
+    .then([this] (K2TxnHandle&& t) {
+        return seastar::do_with(std::move(t), [this] (auto& txn) {
+            return seastar::do_for_each(boost::irange(0u, _recordCount()), [this, &txn] (uint32_t i) {
+                dto::SKVRecord record(collname, _schema);
+                record.serializeNext<String>("default");
+                record.serializeNext<String>(_rangeKey(i));
+                record.serializeNext<String>(_region(i));
+                record.serializeNext<int32_t>(_balance(i));
+                return seastar::do_with(std::move(record), [&txn] (auto& record) {
+                    return txn.write(record)
+                    .then([] (auto&& result) {
+                        K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                    });
+                });
+            })
+            .then([&txn] {
+                return txn.end(true);
+            })
+            .then([] (auto&& response) {
+                K2EXPECT(log::k23si, response.status, dto::K23SIStatus::OK);
+            });
+        });
+    })
+    .then([this] {
+        return seastar::sleep(_freezeWait());
+    });
+}
+
+// Scans read the frozen records. The GC passes between the scans would freeze the records again if the scans
+// thawed them
+seastar::future<> runScenario02() {
+    K2LOG_I(log::k23si, "Scenario 02: scan the frozen records");
+    return _scanAll()
+    .then([this] {
+        return seastar::sleep(_freezeWait());
+    })
+    .then([this] {
+        return _scanAll();
+    });
+}
+
+// Point reads thaw the records they read, which are all still there
+seastar::future<> runScenario03() {
+    K2LOG_I(log::k23si, "Scenario 03: read the frozen records");
+    return _client.beginTxn(K2TxnOptions{})
+    .then([this] (K2TxnHandle&& t) {
+        return seastar::do_with(std::move(t), [this] (auto& txn) {
+            return seastar::do_for_each(boost::irange(0u, _recordCount(), 20u), [this, &txn] (uint32_t i) {
+                dto::SKVRecord key(collname, _schema);
+                key.serializeNext<String>("default");
+                key.serializeNext<String>(_rangeKey(i));
+                return txn.read(std::move(key))
+                .then([this, i] (auto&& result) {
+                    K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                    _checkRecord(result.value, i);
+                });
+            })
+            .then([&txn] {
+                return txn.end(true);
+            })
+            .then([] (auto&& response) {
+                K2EXPECT(log::k23si, response.status, dto::K23SIStatus::OK);
+            });
+        });
+    })
+    .then([this] {
+        // the reads don't change what the scans see
+        return _scanAll();
+    });
+}
+
+};  // class ColdRecordsTest
+
+int main(int argc, char** argv) {
+    App app("ColdRecordsTest");
+    app.addOptions()
+        ("tcp_remotes", bpo::value<std::vector<String>>()->multitoken()->default_value(std::vector<String>()), "A list(space-delimited) of endpoints to assign in the test collection")
+        ("tso_endpoint", bpo::value<String>(), "URL of Timestamp Oracle (TSO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("cpo", bpo::value<String>(), "URL of Control Plane Oracle (CPO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("collection_retention", bpo::value<ParseableDuration>(), "The retention window of the test collection")
+        ("freeze_wait", bpo::value<ParseableDuration>(), "How long to wait for the GC to freeze the records")
+        ("record_count", bpo::value<uint32_t>(), "How many records to write");
+    app.addApplet<TSO_ClientLib>();
+    app.addApplet<ColdRecordsTest>();
+    return app.start(argc, argv);
+}
@@ -44,6 +44,32 @@ struct TestCase {
     bool run() {
         return expr.evaluate(rec);
     }
+    bool runCompiled() {
+        k2e::CompiledExpression compiled(expr);
+        // the second evaluation runs the program cached for the record's schema
+        compiled.evaluate(rec);
+        return compiled.evaluate(rec);
+    }
+    bool runBatched() {
+        k2e::CompiledExpression compiled(expr);
+        std::vector<k2d::SKVRecord> records;
+        records.push_back(rec.deepCopy());
+        records.push_back(rec.deepCopy());
+        std::vector<uint8_t> selection;
+        if (!compiled.evaluate(records, selection)) {
+            // the expression cannot be evaluated in batch for this schema
+            return compiled.evaluate(rec);
+        }
+        REQUIRE(selection.size() == 2);
+        REQUIRE(selection[0] == selection[1]);
+        return selection[0];
+    }
+};
+
+enum class RunMode {
+    Interpreted,
+    Compiled,
+    Batched
 };
 
 k2d::SKVRecord makeRec() {
@@ -127,11 +153,12 @@ k2d::SKVRecord makeRec() {
     return doc;
 }
 
-void runner(std::vector<TestCase>& tcases) {
+void runCases(std::vector<TestCase>& tcases, RunMode mode) {
     for (auto& tcase: tcases) {
-        K2LOG_I(log::k23si, "tcase name: {}", tcase.name);
+        K2LOG_I(log::k23si, "tcase name: {}, mode: {}", tcase.name, (int)mode);
         try {
-            bool result = tcase.run();
+            bool result = mode == RunMode::Interpreted ? tcase.run() :
+                          mode == RunMode::Compiled ? tcase.runCompiled() : tcase.runBatched();
             if (tcase.expectedResult.has_value()) {
                 REQUIRE(tcase.expectedResult.value() == result);
             }
@@ -169,6 +196,13 @@ void runner(std::vector<TestCase>& tcases) {
     }
 }
 
+void runner(std::vector<TestCase>& tcases) {
+    // every case must behave the same whether interpreted, compiled or evaluated in batch
+    runCases(tcases, RunMode::Interpreted);
+    runCases(tcases, RunMode::Compiled);
+    runCases(tcases, RunMode::Batched);
+}
+
 TEST_CASE("Empty expressions") {
     std::vector<TestCase> cases;
     cases.push_back(TestCase{
@@ -1968,6 +2002,69 @@ TEST_CASE("Test XOR") {
     runner(cases);
 }
 
+TEST_CASE("Test IN") {
+    std::vector<TestCase> cases;
+    auto in = [](K2Val a, std::vector<K2Val> literals) {
+        literals.insert(literals.begin(), std::move(a));
+        return k2e::makeExpression(k2e::Operation::IN, std::move(literals), {});
+    };
+    cases.push_back(TestCase{
+        .name = "in: reference in literals",
+        .expr = {in(k2e::makeValueReference("int32M"), k2::make_vec<K2Val>(k2e::makeValueLiteral<int32_t>(3), k2e::makeValueLiteral<int32_t>(0)))},
+        .rec = makeRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "in: reference not in literals",
+        .expr = {in(k2e::makeValueReference("int32M"), k2::make_vec<K2Val>(k2e::makeValueLiteral<int32_t>(3), k2e::makeValueLiteral<int32_t>(4)))},
+        .rec = makeRec(),
+        .expectedResult = {false},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "in: reference in literals of compatible types",
+        .expr = {in(k2e::makeValueReference("int16M"), k2::make_vec<K2Val>(k2e::makeValueLiteral<int16_t>(3), k2e::makeValueLiteral<int64_t>(-5)))},
+        .rec = makeRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "in: string reference",
+        .expr = {in(k2e::makeValueReference("str"), k2::make_vec<K2Val>(k2e::makeValueLiteral<String>("Bilbo"), k2e::makeValueLiteral<String>("Baggins")))},
+        .rec = makeRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "in: non-set reference",
+        .expr = {in(k2e::makeValueReference("int32NS"), k2::make_vec<K2Val>(k2e::makeValueLiteral<int32_t>(0)))},
+        .rec = makeRec(),
+        .expectedResult = {false},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "in: literal in literals",
+        .expr = {in(k2e::makeValueLiteral<double>(2.5), k2::make_vec<K2Val>(k2e::makeValueLiteral<double>(1.5), k2e::makeValueLiteral<double>(2.5)))},
+        .rec = makeRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "in: non-comparable literal",
+        .expr = {in(k2e::makeValueReference("int32M"), k2::make_vec<K2Val>(k2e::makeValueLiteral<int32_t>(0), k2e::makeValueLiteral<String>("0")))},
+        .rec = makeRec(),
+        .expectedResult = std::nullopt,
+        .expectedException = {std::make_exception_ptr(k2d::TypeMismatchException())}});
+    cases.push_back(TestCase{
+        .name = "in: reference in the set",
+        .expr = {in(k2e::makeValueReference("int32M"), k2::make_vec<K2Val>(k2e::makeValueLiteral<int32_t>(0), k2e::makeValueReference("int32M")))},
+        .rec = makeRec(),
+        .expectedResult = std::nullopt,
+        .expectedException = {std::make_exception_ptr(k2d::InvalidExpressionException())}});
+    cases.push_back(TestCase{
+        .name = "in: no literals",
+        .expr = {in(k2e::makeValueReference("int32M"), {})},
+        .rec = makeRec(),
+        .expectedResult = std::nullopt,
+        .expectedException = {std::make_exception_ptr(k2d::InvalidExpressionException())}});
+    runner(cases);
+}
+
 TEST_CASE("Test IS_NULL") {
     std::vector<TestCase> cases;
     cases.push_back(TestCase{
@@ -2098,3 +2195,277 @@ TEST_CASE("Test IS_EXACT_TYPE") {
         .expectedException = {std::make_exception_ptr(k2d::InvalidExpressionException())}});
     runner(cases);
 }
+
+k2d::SKVRecord makeDecimalRec() {
+    auto schema = std::make_shared<k2d::Schema>();
+    schema->name = "decimal_schema";
+    schema->version = 1;
+    schema->fields = std::vector<k2d::SchemaField>{
+        {k2d::FieldType::STRING, "str", false, false},
+        {k2d::FieldType::DECIMAL64, "dec64S", false, false},
+        {k2d::FieldType::DECIMAL64, "dec64M", false, false},
+        {k2d::FieldType::DECIMAL64, "dec64NS", false, false},
+        {k2d::FieldType::DECIMAL128, "dec128M", false, false},
+        {k2d::FieldType::DECIMAL128, "dec128NS", false, false},
+    };
+    schema->setPartitionKeyFieldsByName(std::vector<k2::String>{"str"});
+
+    k2d::SKVRecord doc("collection", schema);
+    doc.serializeNext<k2::String>("Baggins");
+    doc.serializeNext<std::decimal::decimal64>(std::decimal::make_decimal64(-15ll, -1));
+    doc.serializeNext<std::decimal::decimal64>(std::decimal::make_decimal64(150ll, -2));
+    doc.serializeNull();
+    doc.serializeNext<std::decimal::decimal128>(std::decimal::make_decimal128(225ll, -2));
+    doc.serializeNull();
+    return doc;
+}
+
+TEST_CASE("Test decimal comparisons") {
+    std::vector<TestCase> cases;
+    cases.push_back(TestCase{
+        .name = "decimal: equal values with different exponents",
+        .expr = {k2e::makeExpression(k2e::Operation::EQ, k2::make_vec<K2Val>(k2e::makeValueReference("dec64M"), k2e::makeValueLiteral<std::decimal::decimal64>(std::decimal::make_decimal64(15ll, -1))), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "decimal: two references gt",
+        .expr = {k2e::makeExpression(k2e::Operation::GT, k2::make_vec<K2Val>(k2e::makeValueReference("dec64M"), k2e::makeValueReference("dec64S")), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "decimal: reference not lt smaller literal",
+        .expr = {k2e::makeExpression(k2e::Operation::LT, k2::make_vec<K2Val>(k2e::makeValueReference("dec64M"), k2e::makeValueLiteral<std::decimal::decimal64>(std::decimal::make_decimal64(149ll, -2))), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {false},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "decimal: negative reference lt zero",
+        .expr = {k2e::makeExpression(k2e::Operation::LT, k2::make_vec<K2Val>(k2e::makeValueReference("dec64S"), k2e::makeValueLiteral<std::decimal::decimal64>(std::decimal::make_decimal64(0ll, 3))), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "decimal: decimal128 gte equal literal",
+        .expr = {k2e::makeExpression(k2e::Operation::GTE, k2::make_vec<K2Val>(k2e::makeValueReference("dec128M"), k2e::makeValueLiteral<std::decimal::decimal128>(std::decimal::make_decimal128(2250ll, -3))), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "decimal: non-set reference lte literal",
+        .expr = {k2e::makeExpression(k2e::Operation::LTE, k2::make_vec<K2Val>(k2e::makeValueReference("dec128NS"), k2e::makeValueLiteral<std::decimal::decimal128>(std::decimal::make_decimal128(-1ll, 0))), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "decimal: two non-set references equal",
+        .expr = {k2e::makeExpression(k2e::Operation::EQ, k2::make_vec<K2Val>(k2e::makeValueReference("dec64NS"), k2e::makeValueReference("dec64NS")), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    // NaN is unordered: it is neither equal to nor greater than any value
+    cases.push_back(TestCase{
+        .name = "decimal: reference not gte NaN",
+        .expr = {k2e::makeExpression(k2e::Operation::GTE, k2::make_vec<K2Val>(k2e::makeValueReference("dec64M"), k2e::makeValueLiteral<std::decimal::decimal64>(std::decimal::decimal64(0) / std::decimal::decimal64(0))), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {false},
+        .expectedException = {}});
+    cases.push_back(TestCase{
+        .name = "decimal: reference lt NaN",
+        .expr = {k2e::makeExpression(k2e::Operation::LT, k2::make_vec<K2Val>(k2e::makeValueReference("dec64M"), k2e::makeValueLiteral<std::decimal::decimal64>(std::decimal::decimal64(0) / std::decimal::decimal64(0))), {})},
+        .rec = makeDecimalRec(),
+        .expectedResult = {true},
+        .expectedException = {}});
+    runner(cases);
+}
+
+TEST_CASE("Test key range narrowing") {
+    auto schema = std::make_shared<k2d::Schema>();
+    schema->name = "narrow_schema";
+    schema->version = 1;
+    schema->fields = std::vector<k2d::SchemaField>{
+        {k2d::FieldType::STRING, "pk", false, false},
+        {k2d::FieldType::INT32T, "r1", false, false},
+        {k2d::FieldType::INT64T, "r2", false, false},
+        {k2d::FieldType::INT32T, "value", false, false},
+    };
+    schema->setPartitionKeyFieldsByName(std::vector<k2::String>{"pk"});
+    schema->setRangeKeyFieldsByName(std::vector<k2::String>{"r1", "r2"});
+
+    auto makeKey = [&schema](k2::String pk, int32_t r1, int64_t r2) {
+        k2d::SKVRecord rec("collection", schema);
+        rec.serializeNext<k2::String>(pk);
+        rec.serializeNext<int32_t>(r1);
+        rec.serializeNext<int64_t>(r2);
+        rec.serializeNext<int32_t>(0);
+        return rec.getKey();
+    };
+    auto inForward = [](const k2d::Key& key, const k2d::Key& start, const k2d::Key& end) {
+        return start <= key && (end.partitionKey == "" || key < end);
+    };
+    auto inReverse = [](const k2d::Key& key, const k2d::Key& start, const k2d::Key& end) {
+        return (start.partitionKey == "" || key <= start) && end < key;
+    };
+    auto eq = [](const char* field, auto literal) {
+        return k2e::makeExpression(k2e::Operation::EQ, k2::make_vec<K2Val>(k2e::makeValueReference(field), k2e::makeValueLiteral(std::move(literal))), {});
+    };
+    auto cmp = [](k2e::Operation op, const char* field, auto literal) {
+        return k2e::makeExpression(op, k2::make_vec<K2Val>(k2e::makeValueReference(field), k2e::makeValueLiteral(std::move(literal))), {});
+    };
+
+    std::vector<k2d::Key> keys;
+    for (auto pk : {"a", "b", "bb", "c"}) {
+        for (int32_t r1 : {-3, 0, 5, 6, 9}) {
+            for (int64_t r2 : {-1ll, 7ll}) {
+                keys.push_back(makeKey(pk, r1, r2));
+            }
+        }
+    }
+
+    SECTION("pinned partition key and bounded range key field") {
+        K2Exp filter = k2e::makeExpression(k2e::Operation::AND, {},
+            k2::make_vec<K2Exp>(eq("pk", k2::String("b")),
+                k2e::makeExpression(k2e::Operation::AND, {},
+                    k2::make_vec<K2Exp>(cmp(k2e::Operation::GT, "r1", int32_t(0)), cmp(k2e::Operation::LTE, "r1", int32_t(6))))));
+        for (bool reverse : {false, true}) {
+            k2d::Key start{schema->name, "", ""};
+            k2d::Key end{schema->name, "", ""};
+            k2e::narrowKeyRange(filter, *schema, reverse, start, end);
+            for (auto pk : {"a", "b", "bb", "c"}) {
+                for (int32_t r1 : {-3, 0, 5, 6, 9}) {
+                    for (int64_t r2 : {-1ll, 7ll}) {
+                        k2d::Key key = makeKey(pk, r1, r2);
+                        bool in = reverse ? inReverse(key, start, end) : inForward(key, start, end);
+                        if (k2::String(pk) == "b" && r1 > 0 && r1 <= 6) {
+                            // all matching keys are in the range
+                            REQUIRE(in);
+                        }
+                        else if (k2::String(pk) != "b" || r1 < 0 || r1 > 6) {
+                            // the range is tight up to the inclusive bounds
+                            REQUIRE(!in);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    SECTION("all key fields pinned, literal first") {
+        K2Exp filter = k2e::makeExpression(k2e::Operation::AND, {},
+            k2::make_vec<K2Exp>(eq("pk", k2::String("a")),
+                k2e::makeExpression(k2e::Operation::AND, {},
+                    k2::make_vec<K2Exp>(
+                        k2e::makeExpression(k2e::Operation::EQ, k2::make_vec<K2Val>(k2e::makeValueLiteral<int32_t>(5), k2e::makeValueReference("r1")), {}),
+                        eq("r2", int64_t(7))))));
+        for (bool reverse : {false, true}) {
+            k2d::Key start{schema->name, "", ""};
+            k2d::Key end{schema->name, "", ""};
+            k2e::narrowKeyRange(filter, *schema, reverse, start, end);
+            for (auto& key : keys) {
+                bool in = reverse ? inReverse(key, start, end) : inForward(key, start, end);
+                REQUIRE(in == (key == makeKey("a", 5, 7)));
+            }
+        }
+    }
+
+    SECTION("bounds on the partition key") {
+        K2Exp filter = k2e::makeExpression(k2e::Operation::AND, {},
+            k2::make_vec<K2Exp>(cmp(k2e::Operation::GTE, "pk", k2::String("b")), cmp(k2e::Operation::LT, "pk", k2::String("c"))));
+        k2d::Key start{schema->name, "", ""};
+        k2d::Key end{schema->name, "", ""};
+        k2e::narrowKeyRange(filter, *schema, false, start, end);
+        for (auto& key : keys) {
+            bool matches = key.partitionKey == makeKey("b", 0, 0).partitionKey || key.partitionKey == makeKey("bb", 0, 0).partitionKey;
+            bool isC = key.partitionKey == makeKey("c", 0, 0).partitionKey;
+            if (matches) REQUIRE(inForward(key, start, end));
+            if (!matches && !isC) REQUIRE(!inForward(key, start, end));
+        }
+    }
+
+    SECTION("partition key in a set of literals") {
+        K2Exp filter = k2e::makeExpression(k2e::Operation::IN,
+            k2::make_vec<K2Val>(k2e::makeValueReference("pk"), k2e::makeValueLiteral<k2::String>("bb"), k2e::makeValueLiteral<k2::String>("a")), {});
+        for (bool reverse : {false, true}) {
+            k2d::Key start{schema->name, "", ""};
+            k2d::Key end{schema->name, "", ""};
+            k2e::narrowKeyRange(filter, *schema, reverse, start, end);
+            for (auto& key : keys) {
+                bool in = reverse ? inReverse(key, start, end) : inForward(key, start, end);
+                bool matches = key.partitionKey == makeKey("a", 0, 0).partitionKey || key.partitionKey == makeKey("bb", 0, 0).partitionKey;
+                bool isC = key.partitionKey == makeKey("c", 0, 0).partitionKey;
+                if (matches) REQUIRE(in);
+                if (isC) REQUIRE(!in);
+            }
+        }
+    }
+
+    SECTION("the range is only narrowed") {
+        K2Exp filter = eq("pk", k2::String("b"));
+        k2d::Key start = makeKey("b", 5, 0);
+        k2d::Key end = makeKey("b", 6, 0);
+        k2d::Key origStart = start;
+        k2d::Key origEnd = end;
+        k2e::narrowKeyRange(filter, *schema, false, start, end);
+        REQUIRE(start == origStart);
+        REQUIRE(end == origEnd);
+    }
+
+    SECTION("filters which are not conjunctions of key comparisons leave the range as is") {
+        std::vector<K2Exp> filters;
+        filters.push_back(k2e::makeExpression(k2e::Operation::OR, {},
+            k2::make_vec<K2Exp>(eq("pk", k2::String("a")), eq("pk", k2::String("b")))));
+        filters.push_back(eq("value", int32_t(5)));
+        filters.push_back(eq("r1", int32_t(5)));
+        filters.push_back(eq("pk", int64_t(5)));
+        filters.push_back(k2e::makeExpression(k2e::Operation::NOT, {}, k2::make_vec<K2Exp>(eq("pk", k2::String("a")))));
+        for (auto& filter : filters) {
+            k2d::Key start{schema->name, "", ""};
+            k2d::Key end{schema->name, "", ""};
+            k2e::narrowKeyRange(filter, *schema, false, start, end);
+            REQUIRE(start == k2d::Key{schema->name, "", ""});
+            REQUIRE(end == k2d::Key{schema->name, "", ""});
+        }
+    }
+}
+
+TEST_CASE("Test binding the literals of a prepared filter") {
+    auto schema = std::make_shared<k2d::Schema>();
+    schema->name = "prepared_schema";
+    schema->version = 1;
+    schema->fields = std::vector<k2d::SchemaField>{
+        {k2d::FieldType::STRING, "pk", false, false},
+        {k2d::FieldType::INT32T, "value", false, false},
+    };
+    schema->setPartitionKeyFieldsByName(std::vector<k2::String>{"pk"});
+    schema->setRangeKeyFieldsByName(std::vector<k2::String>{});
+
+    auto makeFilter = [](k2::String pk, int32_t low) {
+        return k2e::makeExpression(k2e::Operation::AND, {},
+            k2::make_vec<K2Exp>(
+                k2e::makeExpression(k2e::Operation::EQ, k2::make_vec<K2Val>(k2e::makeValueReference("pk"), k2e::makeValueLiteral(std::move(pk))), {}),
+                k2e::makeExpression(k2e::Operation::GT, k2::make_vec<K2Val>(k2e::makeValueReference("value"), k2e::makeValueLiteral<int32_t>(std::move(low))), {})));
+    };
+    k2d::SKVRecord rec("collection", schema);
+    rec.serializeNext<k2::String>("b");
+    rec.serializeNext<int32_t>(10);
+
+    K2Exp prepared = makeFilter("a", 100);
+    K2Exp other = makeFilter("b", 5);
+    // only the literal values differ
+    REQUIRE(k2e::shapeHash(prepared) == k2e::shapeHash(other));
+    REQUIRE(k2e::shapeHash(prepared) != k2e::shapeHash(k2e::makeExpression(k2e::Operation::AND, {}, k2::make_vec<K2Exp>(makeFilter("a", 1)))));
+
+    std::vector<K2Val> parameters;
+    k2e::collectLiterals(other, parameters);
+    REQUIRE(parameters.size() == 2);
+    REQUIRE(!prepared.evaluate(rec));
+    K2Exp bound = k2e::bindLiterals(prepared, parameters);
+    REQUIRE(bound.evaluate(rec));
+    // the prepared filter keeps its own literals
+    REQUIRE(!prepared.evaluate(rec));
+
+    std::vector<K2Val> tooFew;
+    tooFew.push_back(k2e::makeValueLiteral<k2::String>("b"));
+    REQUIRE_THROWS_AS(k2e::bindLiterals(prepared, tooFew), k2d::InvalidExpressionException);
+}
@@ -0,0 +1,197 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <k2/module/k23si/FlatReadCache.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+SCENARIO("Basic flat read cache tests") {
+    auto cache = FlatReadCache<uint64_t, uint64_t>(10, 5);
+
+    // Not in cache, should return min value set at creation
+    uint64_t t = cache.checkInterval(15, 15);
+    REQUIRE(t == 10);
+
+    // Basic insert/check test
+    cache.insertInterval(15, 15, 12);
+    t = cache.checkInterval(15, 15);
+    REQUIRE(t == 12);
+
+    // Overlapping intervals, should get highest timestamp
+    cache.insertInterval(15, 25, 18);
+    cache.insertInterval(10, 20, 17);
+    t = cache.checkInterval(15, 15);
+    REQUIRE(t == 18);
+
+    // Fill up cache, inserts not in timestamp order
+    cache.insertInterval(50, 51, 23);
+    cache.insertInterval(40, 45, 20);
+    REQUIRE(cache.size() == 5);
+
+    // Not in cache, should return min value set at creation
+    t = cache.checkInterval(150, 150);
+    REQUIRE(t == 10);
+
+    // Add one more over cache size limit, forcing LRU eviction
+    cache.insertInterval(0, 5, 25);
+    REQUIRE(cache.size() == 5);
+    t = cache.checkInterval(0, 0);
+    REQUIRE(t == 25);
+
+    // Not in cache, should be new min of 12
+    t = cache.checkInterval(150, 150);
+    REQUIRE(t == 12);
+
+    // Exact interval as previous inseration, should be no LRU eviction
+    cache.insertInterval(0, 5, 33);
+    t = cache.checkInterval(0, 0);
+    REQUIRE(t == 33);
+    t = cache.checkInterval(150, 150);
+    REQUIRE(t == 12);
+
+    // Add one more causing eviction, evicted interval (15, 25, 18) was not in timestamp order
+    cache.insertInterval(80, 82, 34);
+    t = cache.checkInterval(10, 10);
+    REQUIRE(t == 18);
+
+    // Add one more causing eviction, evicted interval (10, 20, 17) was not in timestamp order
+    cache.insertInterval(90, 92, 35);
+    t = cache.checkInterval(150, 150);
+    REQUIRE(t == 18);
+
+    // Add exact interval with lower timestamp
+    cache.insertInterval(90, 92, 32);
+    t = cache.checkInterval(90, 90);
+    REQUIRE(t == 35);
+}
+
+SCENARIO("Flat read cache range checks") {
+    auto cache = FlatReadCache<uint64_t, uint64_t>(0, 1000);
+    for (uint64_t i = 0; i < 100; ++i) {
+        cache.insertInterval(i * 10, i * 10 + 5, i + 1);
+    }
+
+    // inside a range
+    REQUIRE(cache.checkInterval(13, 13) == 2);
+    // in a gap between ranges
+    REQUIRE(cache.checkInterval(17, 17) == 0);
+    // spanning several ranges
+    REQUIRE(cache.checkInterval(17, 42) == 5);
+    // a wide range which contains all others
+    cache.insertInterval(0, 2000, 7);
+    REQUIRE(cache.checkInterval(17, 17) == 7);
+    REQUIRE(cache.checkInterval(995, 995) == 100);
+
+    // point entries are answered exactly for point checks, and conservatively for range checks
+    cache.insertInterval(3000, 3000, 500);
+    REQUIRE(cache.checkInterval(3000, 3000) == 500);
+    REQUIRE(cache.checkInterval(3001, 3001) == 0);
+    REQUIRE(cache.checkInterval(2500, 2600) == 500);
+}
+
+SCENARIO("Flat read cache point table growth") {
+    auto cache = FlatReadCache<uint64_t, uint64_t>(0, 10000);
+    for (uint64_t i = 0; i < 5000; ++i) {
+        cache.insertInterval(i, i, i + 1);
+    }
+    REQUIRE(cache.size() == 5000);
+    for (uint64_t i = 0; i < 5000; ++i) {
+        REQUIRE(cache.checkInterval(i, i) == i + 1);
+    }
+    REQUIRE(cache.checkInterval(6000, 6000) == 0);
+}
+
+SCENARIO("Flat read cache coalescing") {
+    auto cache = FlatReadCache<uint64_t, uint64_t>(0, 1000);
+    // timestamps within 5 of each other are close, and timestamps are bucketed by 10
+    cache.setCoalescing([](uint64_t a, uint64_t b) { return (a > b ? a - b : b - a) <= 5; });
+    cache.setTimestampBucketing([](uint64_t ts) { return (ts + 9) / 10 * 10; });
+
+    // bucketing rounds up
+    cache.insertInterval(0, 10, 11);
+    REQUIRE(cache.checkInterval(5, 5) == 20);
+
+    // overlapping range with a close timestamp is merged into the existing one
+    cache.insertInterval(10, 20, 13);
+    REQUIRE(cache.size() == 1);
+    REQUIRE(cache.coalesced() == 1);
+    REQUIRE(cache.checkInterval(15, 15) == 20);
+
+    // a point that is covered by a close range doesn't take up an entry
+    cache.insertInterval(12, 12, 17);
+    REQUIRE(cache.size() == 1);
+
+    // timestamps which are not close are kept separately
+    cache.insertInterval(15, 30, 45);
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.checkInterval(5, 5) == 20);
+    REQUIRE(cache.checkInterval(25, 25) == 50);
+
+    // a range bridging two close ranges merges all of them
+    cache.insertInterval(40, 50, 41);
+    REQUIRE(cache.size() == 3);
+    cache.insertInterval(25, 45, 50);
+    REQUIRE(cache.size() == 2);
+    REQUIRE(cache.checkInterval(48, 48) == 50);
+    REQUIRE(cache.checkInterval(5, 5) == 20);
+    REQUIRE(cache.checkInterval(60, 60) == 0);
+}
+
+SCENARIO("Flat read cache range extension") {
+    auto cache = FlatReadCache<uint64_t, uint64_t>(0, 3);
+
+    // the pages of a query extend the range of the first page
+    cache.insertInterval(10, 20, 5);
+    cache.extendInterval(10, 20, 10, 30, 5);
+    cache.extendInterval(10, 30, 10, 40, 7);
+    REQUIRE(cache.size() == 1);
+    REQUIRE(cache.extended() == 2);
+    REQUIRE(cache.checkInterval(35, 35) == 7);
+    REQUIRE(cache.checkInterval(15, 15) == 7);
+    REQUIRE(cache.checkInterval(45, 45) == 0);
+
+    // reverse scans extend the low end
+    cache.extendInterval(10, 40, 0, 40, 7);
+    REQUIRE(cache.size() == 1);
+    REQUIRE(cache.extended() == 3);
+    REQUIRE(cache.checkInterval(5, 5) == 7);
+
+    // the ranges ordered around the extended range are still found
+    cache.insertInterval(50, 60, 9);
+    cache.insertInterval(1, 2, 8);
+    REQUIRE(cache.checkInterval(55, 55) == 9);
+    REQUIRE(cache.checkInterval(1, 1) == 8);
+    REQUIRE(cache.checkInterval(20, 20) == 7);
+
+    // a range which is no longer in the cache is inserted again
+    cache.insertInterval(70, 80, 10);
+    REQUIRE(cache.size() == 3);
+    REQUIRE(cache.checkInterval(20, 20) == 7); // evicted, so the min timestamp went up
+    cache.extendInterval(0, 40, 0, 45, 11);
+    REQUIRE(cache.extended() == 3);
+    REQUIRE(cache.checkInterval(42, 42) == 11);
+    REQUIRE(cache.size() == 3);
+}
@@ -0,0 +1,100 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <k2/module/k23si/HotKeys.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+static dto::Key key(const String& pkey) {
+    return dto::Key{.schemaName="schema", .partitionKey=pkey, .rangeKey=""};
+}
+
+TEST_CASE("Test1: keys under capacity are counted exactly") {
+    HotKeys hot(4);
+    for (int i = 0; i < 3; ++i) hot.add(key("a"));
+    hot.add(key("b"));
+    for (int i = 0; i < 2; ++i) hot.add(key("c"));
+
+    auto top = hot.top();
+    REQUIRE(top.size() == 3);
+    REQUIRE(top[0].key == key("a"));
+    REQUIRE(top[0].count == 3);
+    REQUIRE(top[1].key == key("c"));
+    REQUIRE(top[1].count == 2);
+    REQUIRE(top[2].key == key("b"));
+    REQUIRE(top[2].count == 1);
+    for (auto& hk : top) {
+        REQUIRE(hk.error == 0);
+    }
+}
+
+TEST_CASE("Test2: frequent keys survive a stream of distinct keys") {
+    HotKeys hot(8);
+    for (int i = 0; i < 1000; ++i) {
+        hot.add(key("hot"));
+        hot.add(key(std::to_string(i)));
+        if (i % 2 == 0) {
+            hot.add(key("warm"));
+        }
+    }
+
+    auto top = hot.top();
+    REQUIRE(top.size() == 8);
+    REQUIRE(top[0].key == key("hot"));
+    REQUIRE(top[1].key == key("warm"));
+    // counts are never underestimated, and overestimated by no more than the error
+    REQUIRE(top[0].count >= 1000);
+    REQUIRE(top[0].count - top[0].error <= 1000);
+    REQUIRE(top[1].count >= 500);
+    REQUIRE(top[1].count - top[1].error <= 500);
+    // the total includes the keys which were evicted
+    REQUIRE(hot.total() == 1000 + 500 + 1000);
+}
+
+TEST_CASE("Test3: sampling counts one key in every interval") {
+    HotKeys hot(4, 10);
+    for (int i = 0; i < 100; ++i) {
+        hot.sample(key("a"));
+    }
+    auto top = hot.top();
+    REQUIRE(top.size() == 1);
+    REQUIRE(top[0].count == 100);
+
+    for (int i = 0; i < 9; ++i) {
+        hot.sample(key("b"));
+    }
+    REQUIRE(hot.top().size() == 1);
+
+    hot.clear();
+    REQUIRE(hot.top().empty());
+    REQUIRE(hot.total() == 0);
+}
+
+TEST_CASE("Test4: zero capacity disables tracking") {
+    HotKeys hot(0);
+    hot.add(key("a"));
+    REQUIRE(hot.top().empty());
+}
@@ -0,0 +1,329 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <map>
+#include <random>
+
+#include <k2/module/k23si/Indexer.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+typedef HOTOrderedIndexer<dto::Key, int, SchemaLocalKeyEncoder> HOTIndexerT;
+
+SCENARIO("Key encoding preserves key order") {
+    std::vector<dto::Key> keys = {
+        {"s", "", ""},
+        {"s", "a", ""},
+        {"s", "a", String("\0", 1)},
+        {"s", "a", "\x01"},
+        {"s", "a", "b"},
+        {"s", String("a\0", 2), ""},
+        {"s", "a\x01", ""},
+        {"s", "ab", ""},
+    };
+    SchemaLocalKeyEncoder enc;
+    for (size_t i = 0; i + 1 < keys.size(); ++i) {
+        String a, b;
+        enc(keys[i], a);
+        enc(keys[i + 1], b);
+        REQUIRE(keys[i] < keys[i + 1]);
+        REQUIRE(a < b);
+        REQUIRE(std::find(a.begin(), a.end(), '\0') == a.end());
+    }
+}
+
+SCENARIO("Schema indexer keeps a separate index per schema") {
+    SchemaIndexer indexer;
+    REQUIRE(indexer.find("a") == nullptr);
+    indexer.getOrCreate("a")[dto::Key{"a", "1", ""}];
+    indexer.getOrCreate("b")[dto::Key{"b", "1", ""}];
+    indexer.getOrCreate("b")[dto::Key{"b", "2", ""}];
+    REQUIRE(indexer.schemaCount() == 2);
+    REQUIRE(indexer.find("a")->size() == 1);
+    REQUIRE(indexer.find("b")->size() == 2);
+    REQUIRE(indexer.size() == 3);
+    indexer.clear("b");
+    REQUIRE(indexer.size() == 1);
+}
+
+SCENARIO("Schema indexer interns schema names to dense ids") {
+    SchemaIndexer indexer;
+    REQUIRE(indexer.findId("a") == SchemaIndexer::NoSchemaId);
+    REQUIRE_FALSE(indexer.mayContain(SchemaIndexer::NoSchemaId, dto::Key{"a", "1", ""}));
+    uint32_t a = indexer.getOrCreateId("a");
+    uint32_t b = indexer.getOrCreateId("b");
+    REQUIRE(a == 0);
+    REQUIRE(b == 1);
+    REQUIRE(indexer.getOrCreateId("a") == a);
+    REQUIRE(indexer.findId("b") == b);
+
+    dto::Key key{"b", "1", ""};
+    indexer.getOrCreateVersions(b, key);
+    REQUIRE(indexer.mayContain(b, key));
+    REQUIRE(&indexer.at(b) == indexer.find("b"));
+    REQUIRE(indexer.at(b).size() == 1);
+    REQUIRE(indexer.at(a).size() == 0);
+}
+
+SCENARIO("Key filter has no false negatives and rejects most absent keys") {
+    KeyFilter filter(1000, 10);
+    for (int i = 0; i < 1000; ++i) {
+        filter.add(dto::Key{"s", std::to_string(i), "r"});
+    }
+    REQUIRE(filter.size() == 1000);
+    int falsePositives = 0;
+    for (int i = 0; i < 1000; ++i) {
+        REQUIRE(filter.mayContain(dto::Key{"s", std::to_string(i), "r"}));
+        falsePositives += filter.mayContain(dto::Key{"s", std::to_string(i + 1000), "r"});
+    }
+    // about 1% expected with 10 bits per key
+    REQUIRE(falsePositives < 50);
+}
+
+SCENARIO("Schema indexer key filters track the indexed keys") {
+    SchemaIndexer indexer;
+    indexer.enableKeyFilters(10);
+    dto::Key key{"a", "1", ""};
+    REQUIRE_FALSE(indexer.mayContain(key));
+    indexer.getOrCreateVersions(key);
+    REQUIRE(indexer.mayContain(key));
+    REQUIRE(indexer.find("a")->size() == 1);
+
+    // a key added during a rebuild is in the rebuilt filter, even if the rebuild didn't add it
+    indexer.startFilterRebuild(0);
+    dto::Key added{"a", "2", ""};
+    indexer.getOrCreateVersions(added);
+    indexer.finishFilterRebuild(0);
+    REQUIRE(indexer.mayContain(added));
+
+    indexer.clear("a");
+    REQUIRE_FALSE(indexer.mayContain(key));
+}
+
+SCENARIO("HOT indexer matches std::map ordering") {
+    HOTIndexerT idx;
+    std::map<dto::Key, int, SchemaLocalKeyCompare> ref;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, 500);
+
+    for (int i = 0; i < 2000; ++i) {
+        dto::Key key{"schema", std::to_string(dist(gen)), std::to_string(dist(gen) % 10)};
+        idx[key] = i;
+        ref[key] = i;
+    }
+    for (int i = 0; i < 300; ++i) {
+        dto::Key key{"schema", std::to_string(dist(gen)), std::to_string(dist(gen) % 10)};
+        REQUIRE(idx.erase(key) == ref.erase(key));
+    }
+    REQUIRE(idx.size() == ref.size());
+
+    // forward scan
+    auto it = idx.begin();
+    for (auto& [k, v] : ref) {
+        REQUIRE(it != idx.end());
+        REQUIRE(it->first == k);
+        REQUIRE(it->second == v);
+        ++it;
+    }
+    REQUIRE(it == idx.end());
+
+    // reverse scan
+    auto rit = idx.end();
+    for (auto refit = ref.rbegin(); refit != ref.rend(); ++refit) {
+        --rit;
+        REQUIRE(rit->first == refit->first);
+    }
+    REQUIRE(rit == idx.begin());
+
+    // point lookups and lower_bound
+    for (int i = 0; i < 500; ++i) {
+        dto::Key key{"schema", std::to_string(dist(gen)), ""};
+        auto lb = idx.lower_bound(key);
+        auto reflb = ref.lower_bound(key);
+        REQUIRE((lb == idx.end()) == (reflb == ref.end()));
+        if (reflb != ref.end()) {
+            REQUIRE(lb->first == reflb->first);
+        }
+        REQUIRE((idx.find(key) == idx.end()) == (ref.find(key) == ref.end()));
+    }
+}
+
+SCENARIO("HOT indexer supports keys longer than the trie key") {
+    HOTIndexerT idx;
+    std::map<dto::Key, int, SchemaLocalKeyCompare> ref;
+    std::mt19937 gen(42);
+    // most keys share their first HOTMaxKeyLength encoded bytes with other keys
+    auto makeKey = [&gen] {
+        String pk(gen() % 2 ? 100 : 300, 'k');
+        return dto::Key{"schema", pk + std::to_string(gen() % 50), std::to_string(gen() % 3)};
+    };
+    for (int i = 0; i < 2000; ++i) {
+        auto key = makeKey();
+        idx[key] = i;
+        ref[key] = i;
+    }
+    for (int i = 0; i < 500; ++i) {
+        auto key = makeKey();
+        REQUIRE(idx.erase(key) == ref.erase(key));
+    }
+    for (int i = 0; i < 100; ++i) {
+        dto::Key key{"schema", String(300, 'z') + String(fmt::format("{:03}", i)), ""};
+        idx.append(dto::Key(key)) = i;
+        ref[key] = i;
+    }
+    REQUIRE(idx.size() == ref.size());
+
+    auto it = idx.begin();
+    for (auto& [k, v] : ref) {
+        REQUIRE(it->first == k);
+        REQUIRE(it->second == v);
+        REQUIRE(idx.find(k) == it);
+        ++it;
+    }
+    REQUIRE(it == idx.end());
+
+    for (int i = 0; i < 500; ++i) {
+        auto key = makeKey();
+        auto lb = idx.lower_bound(key);
+        auto reflb = ref.lower_bound(key);
+        REQUIRE((lb == idx.end()) == (reflb == ref.end()));
+        if (reflb != ref.end()) {
+            REQUIRE(lb->first == reflb->first);
+        }
+        auto ub = idx.upper_bound(key);
+        auto refub = ref.upper_bound(key);
+        REQUIRE((ub == idx.end()) == (refub == ref.end()));
+        if (refub != ref.end()) {
+            REQUIRE(ub->first == refub->first);
+        }
+        REQUIRE((idx.find(key) == idx.end()) == (ref.find(key) == ref.end()));
+    }
+    idx.clear();
+    REQUIRE(idx.empty());
+}
+
+SCENARIO("Reverse seek finds the last key not past the start") {
+    HOTIndexerT idx;
+    std::map<dto::Key, int, SchemaLocalKeyCompare> ref;
+    REQUIRE(reverseSeek(idx, dto::Key{"schema", "", ""}, false) == idx.end());
+    for (int i = 0; i < 100; i += 2) {
+        dto::Key key{"schema", String(fmt::format("{:03}", i)), ""};
+        idx[key] = i;
+        ref[key] = i;
+    }
+
+    for (int i = -1; i <= 100; ++i) {
+        dto::Key start{"schema", i < 0 ? String("") : String(fmt::format("{:03}", i)), ""};
+        for (bool exclusive : {false, true}) {
+            auto it = reverseSeek(idx, start, exclusive);
+            auto refit = reverseSeek(ref, start, exclusive);
+            REQUIRE((it == idx.end()) == (refit == ref.end()));
+            if (refit != ref.end()) {
+                REQUIRE(it->first == refit->first);
+            }
+        }
+    }
+    REQUIRE(reverseSeek(idx, dto::Key{"schema", "", ""}, false)->second == 98);
+    REQUIRE(reverseSeek(idx, dto::Key{"schema", "010", ""}, false)->second == 10);
+    REQUIRE(reverseSeek(idx, dto::Key{"schema", "010", ""}, true)->second == 8);
+    REQUIRE(reverseSeek(idx, dto::Key{"schema", "011", ""}, true)->second == 10);
+    REQUIRE(reverseSeek(idx, dto::Key{"schema", "000", ""}, true) == idx.end());
+    REQUIRE(idx.upper_bound(dto::Key{"schema", "098", ""}) == idx.end());
+
+    // reverse iterators walk the keys in descending order
+    auto refit = ref.rbegin();
+    for (auto rit = idx.rbegin(); rit != idx.rend(); ++rit, ++refit) {
+        REQUIRE(rit->first == refit->first);
+    }
+    REQUIRE(refit == ref.rend());
+}
+
+SCENARIO("HOT indexer appends sorted keys") {
+    HOTIndexerT idx;
+    std::map<dto::Key, int, SchemaLocalKeyCompare> ref;
+    for (int i = 0; i < 1000; ++i) {
+        dto::Key key{"schema", String(fmt::format("{:04}", i)), String(std::to_string(i % 3))};
+        ref[key] = i;
+        idx.append(dto::Key(key)) = i;
+    }
+    // keys out of order and keys already in the index fall back to a regular insert
+    dto::Key early{"schema", "0000", "5"};
+    ref[early] = -1;
+    idx.append(dto::Key(early)) = -1;
+    REQUIRE(idx.append(dto::Key{"schema", "0500", "2"}) == 500);
+
+    REQUIRE(idx.size() == ref.size());
+    auto it = idx.begin();
+    for (auto& [k, v] : ref) {
+        REQUIRE(it->first == k);
+        REQUIRE(it->second == v);
+        REQUIRE(idx.find(k) == it);
+        ++it;
+    }
+    REQUIRE(it == idx.end());
+    dto::Key second{"schema", "0001", "1"};
+    REQUIRE(idx.lower_bound(dto::Key{"schema", "0001", ""})->first == second);
+}
+
+SCENARIO("Schema indexer appends versions of sorted keys") {
+    SchemaIndexer indexer;
+    indexer.enableKeyFilters(10);
+    uint32_t id = indexer.getOrCreateId("s");
+    for (int i = 0; i < 100; ++i) {
+        indexer.appendVersions(id, dto::Key{"s", String(fmt::format("{:03}", i)), ""});
+    }
+    REQUIRE(indexer.at(id).size() == 100);
+    dto::Key key{"s", "042", ""};
+    REQUIRE(indexer.mayContain(key));
+    REQUIRE(&indexer.appendVersions(id, dto::Key(key)) == &indexer.getOrCreateVersions(key));
+    REQUIRE(indexer.at(id).size() == 100);
+}
+
+SCENARIO("Schema indexer point indexes follow the ordered indexes") {
+    SchemaIndexer indexer;
+    indexer.enablePointIndexes(true);
+    uint32_t id = indexer.getOrCreateId("s");
+    dto::Key key{"s", "1", "a"};
+    REQUIRE(indexer.findVersions(id, key) == nullptr);
+    auto& versions = indexer.getOrCreateVersions(id, key);
+    REQUIRE(indexer.findVersions(id, key) == &versions);
+    REQUIRE(&indexer.getOrCreateVersions(id, key) == &versions);
+
+    for (int i = 0; i < 100; ++i) {
+        indexer.appendVersions(id, dto::Key{"s", String(fmt::format("{:03}", i)), ""});
+    }
+    dto::Key appended{"s", "042", ""};
+    REQUIRE(indexer.findVersions(id, appended) == &indexer.at(id).find(appended)->second);
+    REQUIRE(&indexer.appendVersions(id, dto::Key(appended)) == indexer.findVersions(id, appended));
+
+    auto next = indexer.erase(id, indexer.at(id).find(appended));
+    REQUIRE(next->first.partitionKey == "043");
+    REQUIRE(indexer.findVersions(id, appended) == nullptr);
+    REQUIRE(indexer.at(id).size() == 100);
+
+    indexer.clear(id);
+    REQUIRE(indexer.findVersions(id, key) == nullptr);
+    REQUIRE(indexer.at(id).size() == 0);
+}
@@ -45,7 +45,21 @@ struct DataRec {
     K2_DEF_FMT(DataRec, f1, f2);
 };
 
+struct CounterRec {
+    int64_t count;
+    String name;
+
+    bool operator==(const CounterRec& o) {
+        return count == o.count && name == o.name;
+    }
+    K2_DEF_FMT(CounterRec, count, name);
+};
+
 const char* collname = "k23si_test_collection";
+// a collection with a short retention window(see retention_minimum), whose versions the GC collects quickly
+const char* shortcollname = "k23si_short_retention_collection";
+// a range partitioned collection, for range deletes
+const char* rangecollname = "k23si_range_collection";
 
 class K23SITest {
 
@@ -142,6 +156,14 @@ public:  // application lifespan
             .then([this] { return runScenario03(); })
             .then([this] { return runScenario04(); })
             .then([this] { return runScenario05(); })
+            .then([this] { return runScenario06(); })
+            .then([this] { return runScenario07(); })
+            .then([this] { return runScenario08(); })
+            .then([this] { return runScenario09(); })
+            .then([this] { return runScenario10(); })
+            .then([this] { return runScenario11(); })
+            .then([this] { return runScenario12(); })
+            .then([this] { return runScenario13(); })
             .then([this] {
                 K2LOG_I(log::k23si, "======= All tests passed ========");
                 exitcode = 0;
@@ -181,6 +203,7 @@ private:
     CPOClient _cpo_client;
     dto::PartitionGetter _pgetter;
     dto::Schema _schema;
+    dto::Schema _counterSchema;     // schema of the field operation scenarios
     uint64_t txnids = 10000;
 
     seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
@@ -207,6 +230,39 @@ private:
         return RPC().callRPC<dto::K23SIWriteRequest, dto::K23SIWriteResponse>(dto::Verbs::K23SI_WRITE, request, *part.preferredEndpoint, 100ms);
     }
 
+    // a write which is applied only if the latest version of the record passes the condition
+    seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
+    doConditionalWrite(const dto::Key& key, const DataRec& data, const dto::K23SI_MTR& mtr, const dto::Key& trh, bool isTRH,
+                       dto::expression::Expression&& condition) {
+        SKVRecord record(collname, std::make_shared<k2::dto::Schema>(_schema));
+        record.serializeNext<String>(key.partitionKey);
+        record.serializeNext<String>(key.rangeKey);
+        record.serializeNext<String>(data.f1);
+        record.serializeNext<String>(data.f2);
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIWriteRequest request {
+            .pvid = part.partition->pvid,
+            .collectionName = collname,
+            .mtr = mtr,
+            .trh = trh,
+            .isDelete = false,
+            .designateTRH = isTRH,
+            .rejectIfExists = false,
+            .key = key,
+            .value = std::move(record.storage),
+            .fieldsForPartialUpdate = std::vector<uint32_t>()
+        };
+        request.condition = std::move(condition);
+        return RPC().callRPC<dto::K23SIWriteRequest, dto::K23SIWriteResponse>(dto::Verbs::K23SI_WRITE, request, *part.preferredEndpoint, 100ms);
+    }
+
+    static dto::expression::Expression f1Equals(String value) {
+        std::vector<dto::expression::Value> values;
+        values.emplace_back(dto::expression::makeValueReference("f1"));
+        values.emplace_back(dto::expression::makeValueLiteral<String>(std::move(value)));
+        return dto::expression::makeExpression(dto::expression::Operation::EQ, std::move(values), {});
+    }
+
     seastar::future<std::tuple<Status, DataRec>>
     doRead(const dto::Key& key, const dto::K23SI_MTR& mtr, const String& cname) {
         K2LOG_D(log::k23si, "key={}, phash={}", key, key.partitionHash())
@@ -233,6 +289,78 @@ private:
         });
     }
 
+    // a record of _counterSchema. A missing value is serialized as null
+    SKVRecord makeCounter(const dto::Key& key, std::optional<int64_t> count, std::optional<String> name) {
+        SKVRecord record(collname, std::make_shared<k2::dto::Schema>(_counterSchema));
+        record.serializeNext<String>(key.partitionKey);
+        record.serializeNext<String>(key.rangeKey);
+        if (count) {
+            record.serializeNext<int64_t>(*count);
+        } else {
+            record.serializeNull();
+        }
+        if (name) {
+            record.serializeNext<String>(*name);
+        } else {
+            record.serializeNull();
+        }
+        return record;
+    }
+
+    CounterRec toCounter(dto::SKVRecord::Storage&& storage) {
+        SKVRecord record(collname, std::make_shared<k2::dto::Schema>(_counterSchema), std::move(storage), true);
+        record.seekField(2);
+        auto count = record.deserializeNext<int64_t>();
+        auto name = record.deserializeNext<String>();
+        return CounterRec{.count = count ? *count : -1, .name = name ? *name : String("null")};
+    }
+
+    // writes a counter record. With field operations, this is a partial update of the fields of the operations
+    seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
+    doCounterWrite(const dto::Key& key, SKVRecord&& record, const dto::K23SI_MTR& mtr, const dto::Key& trh, bool isTRH,
+                   std::vector<dto::K23SIFieldOp> fieldOps={}, dto::SKVRecord::Storage expected={}) {
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIWriteRequest request {
+            .pvid = part.partition->pvid,
+            .collectionName = collname,
+            .mtr = mtr,
+            .trh = trh,
+            .isDelete = false,
+            .designateTRH = isTRH,
+            .rejectIfExists = false,
+            .key = key,
+            .value = std::move(record.storage),
+            .fieldsForPartialUpdate = std::vector<uint32_t>()
+        };
+        for (auto& fieldOp: fieldOps) {
+            request.fieldsForPartialUpdate.push_back(fieldOp.fieldIdx);
+        }
+        request.fieldOps = std::move(fieldOps);
+        request.expected = std::move(expected);
+        return RPC().callRPC<dto::K23SIWriteRequest, dto::K23SIWriteResponse>(dto::Verbs::K23SI_WRITE, request, *part.preferredEndpoint, 100ms);
+    }
+
+    seastar::future<std::tuple<Status, CounterRec>>
+    doReadCounter(const dto::Key& key, const dto::K23SI_MTR& mtr) {
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIReadRequest request {
+            .pvid = part.partition->pvid,
+            .collectionName = collname,
+            .mtr =mtr,
+            .key=key
+        };
+
+        return RPC().callRPC<dto::K23SIReadRequest, dto::K23SIReadResponse>
+            (dto::Verbs::K23SI_READ, request, *part.preferredEndpoint, 100ms)
+        .then([this] (auto&& response) {
+            auto& [status, resp] = response;
+            if (!status.is2xxOK()) {
+                return std::make_tuple(std::move(status), CounterRec{});
+            }
+            return std::make_tuple(std::move(status), toCounter(std::move(resp.value)));
+        });
+    }
+
     seastar::future<std::tuple<Status, dto::K23SITxnEndResponse>>
     doEnd(dto::Key trh, dto::K23SI_MTR mtr, const String& cname, bool isCommit, std::vector<dto::Key> wkeys) {
         K2LOG_D(log::k23si, "key={}, phash={}", trh, trh.partitionHash())
@@ -248,11 +376,118 @@ private:
     }
 
 
+    // a write which designates its key as the TRH, routed by the CPO client so that it can go to any collection. A
+    // zero TTL means the TTL of the schema
+    seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
+    doRoutedWrite(const dto::Key& key, const DataRec& data, const dto::K23SI_MTR& mtr, const String& cname, Duration ttl=Duration(0)) {
+        SKVRecord record(cname, std::make_shared<k2::dto::Schema>(_schema));
+        record.serializeNext<String>(key.partitionKey);
+        record.serializeNext<String>(key.rangeKey);
+        record.serializeNext<String>(data.f1);
+        record.serializeNext<String>(data.f2);
+        auto* request = new dto::K23SIWriteRequest {
+            .pvid = dto::Partition::PVID(), // Will be filled in by PartitionRequest
+            .collectionName = cname,
+            .mtr = mtr,
+            .trh = key,
+            .isDelete = false,
+            .designateTRH = true,
+            .rejectIfExists = false,
+            .key = key,
+            .value = std::move(record.storage),
+            .fieldsForPartialUpdate = std::vector<uint32_t>()
+        };
+        request->ttl = ttl;
+        return _cpo_client.PartitionRequest
+            <dto::K23SIWriteRequest, dto::K23SIWriteResponse, dto::Verbs::K23SI_WRITE>
+            (Deadline<>(1s), *request).
+            finally([request] () { delete request; });
+    }
+
+    seastar::future<Status> doRoutedRead(const dto::Key& key, const dto::K23SI_MTR& mtr, const String& cname) {
+        auto* request = new dto::K23SIReadRequest {
+            .pvid = dto::Partition::PVID(), // Will be filled in by PartitionRequest
+            .collectionName = cname,
+            .mtr = mtr,
+            .key = key
+        };
+        return _cpo_client.PartitionRequest
+            <dto::K23SIReadRequest, dto::K23SIReadResponse, dto::Verbs::K23SI_READ>
+            (Deadline<>(1s), *request).
+            then([] (auto&& response) {
+                auto& [status, resp] = response;
+                return std::move(status);
+            }).
+            finally([request] () { delete request; });
+    }
+
+    // deletes [key, endKey) in all partitions of the range, and returns the status of the first partition which
+    // refused it, or the number of partitions it went to
+    seastar::future<std::tuple<Status, int>>
+    doRangeDelete(dto::Key key, dto::Key endKey, dto::Timestamp timestamp, const String& cname) {
+        return seastar::do_with(dto::K23SIRangeDeleteRequest{}, Status{}, 0,
+            [this, key=std::move(key), endKey=std::move(endKey), timestamp, cname] (auto& request, auto& status, auto& partitions) mutable {
+            request.collectionName = cname;
+            request.key = std::move(key);
+            request.endKey = std::move(endKey);
+            request.timestamp = timestamp;
+            return seastar::repeat([this, &request, &status, &partitions] {
+                return _cpo_client.PartitionRequest
+                    <dto::K23SIRangeDeleteRequest, dto::K23SIRangeDeleteResponse, dto::Verbs::K23SI_RANGE_DELETE>
+                    (Deadline<>(1s), request)
+                .then([&request, &status, &partitions] (auto&& response) {
+                    auto& [rdStatus, resp] = response;
+                    status = std::move(rdStatus);
+                    if (!status.is2xxOK()) {
+                        return seastar::stop_iteration::yes;
+                    }
+                    partitions++;
+                    if (resp.nextKey.partitionKey.empty()) {
+                        return seastar::stop_iteration::yes;
+                    }
+                    request.key = std::move(resp.nextKey);
+                    return seastar::stop_iteration::no;
+                });
+            })
+            .then([&status, &partitions] {
+                return std::make_tuple(std::move(status), partitions);
+            });
+        });
+    }
+
+    seastar::future<std::tuple<Status, dto::K23SITxnEndResponse>>
+    doRoutedEnd(dto::Key trh, dto::K23SI_MTR mtr, const String& cname, bool isCommit, std::vector<dto::Key> wkeys) {
+        auto* request = new dto::K23SITxnEndRequest;
+        request->collectionName = cname;
+        request->mtr = mtr;
+        request->key = trh;
+        request->action = isCommit ? dto::EndAction::Commit : dto::EndAction::Abort;
+        request->writeKeys = wkeys;
+        return _cpo_client.PartitionRequest
+            <dto::K23SITxnEndRequest, dto::K23SITxnEndResponse, dto::Verbs::K23SI_TXN_END>
+            (Deadline<>(1s), *request).
+            finally([request] () { delete request; });
+    }
+
+    seastar::future<std::tuple<Status, dto::K23SIChangesResponse>>
+    doPollChanges(const dto::Key& key, dto::Timestamp fromTimestamp, Duration wait) {
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIChangesRequest request {
+            .pvid = part.partition->pvid,
+            .collectionName = collname,
+            .key = key,
+            .fromTimestamp = fromTimestamp,
+            .maxChanges = 1000,
+            .wait = wait
+        };
+        return RPC().callRPC<dto::K23SIChangesRequest, dto::K23SIChangesResponse>(dto::Verbs::K23SI_CHANGES, request, *part.preferredEndpoint, wait + 1s);
+    }
+
     seastar::future<std::tuple<Status, dto::K23SIInspectRecordsResponse>>
-    doRequestRecords(dto::Key key) {
+    doRequestRecords(dto::Key key, const String& cname=collname) {
         auto* request = new dto::K23SIInspectRecordsRequest {
             dto::Partition::PVID(), // Will be filled in by PartitionRequest
-            k2::String(collname),
+            cname,
             std::move(key)
         };
 
@@ -584,6 +819,728 @@ seastar::future<> runScenario05() {
         });
 }
 
+// The challenger has the lower priority, so it would lose a push. It waits instead, and the incumbent commits in the
+// meantime
+seastar::future<> runScenario06() {
+    K2LOG_I(log::k23si, "Scenario 06: a conflicting write waits for the incumbent to be finalized");
+    return seastar::do_with(
+        dto::K23SI_MTR{},
+        dto::K23SI_MTR{},
+        dto::Key{"schema", "s06-pkey1", "rkey1"},
+        [this](auto& m1, auto& m2, auto& k1) {
+            return getTimeNow()
+                .then([&](dto::Timestamp&& ts) {
+                    m1.txnid = txnids++;
+                    m1.timestamp = ts;
+                    m1.priority = dto::TxnPriority::Medium;
+                    return doWrite(k1, {"fk1","f2"}, m1, k1, collname, false, true);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    m2.txnid = txnids++;
+                    m2.timestamp = ts;
+                    m2.priority = dto::TxnPriority::Lowest;
+                    // the write finds the WI of m1, and waits while m1 ends
+                    return seastar::when_all(doWrite(k1, {"fk2", "f2"}, m2, k1, collname, false, true), doEnd(k1, m1, collname, true, {k1}));
+                })
+                .then([&](auto&& result) mutable {
+                    auto& [r1, r2] = result;
+                    auto [status1, result1] = r1.get0();
+                    auto [status2, result2] = r2.get0();
+                    K2EXPECT(log::k23si, status1, dto::K23SIStatus::Created);
+                    K2EXPECT(log::k23si, status2, dto::K23SIStatus::OK);
+                    return doEnd(k1, m2, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    dto::K23SI_MTR mtr{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Medium};
+                    return doRead(k1, mtr, collname);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, value] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    DataRec d{"fk2", "f2"};
+                    K2EXPECT(log::k23si, value, d);
+                });
+        });
+}
+
+// The incumbent never ends, so the challenger stops waiting and pushes it. The challenger has the higher priority and
+// wins
+seastar::future<> runScenario07() {
+    K2LOG_I(log::k23si, "Scenario 07: a conflicting write pushes once its wait times out");
+    return seastar::do_with(
+        dto::K23SI_MTR{},
+        dto::K23SI_MTR{},
+        dto::Key{"schema", "s07-pkey1", "rkey1"},
+        [this](auto& m1, auto& m2, auto& k1) {
+            return getTimeNow()
+                .then([&](dto::Timestamp&& ts) {
+                    m1.txnid = txnids++;
+                    m1.timestamp = ts;
+                    m1.priority = dto::TxnPriority::Lowest;
+                    return doWrite(k1, {"fk1","f2"}, m1, k1, collname, false, true);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    m2.txnid = txnids++;
+                    m2.timestamp = ts;
+                    m2.priority = dto::TxnPriority::Highest;
+                    return doWrite(k1, {"fk2", "f2"}, m2, k1, collname, false, true);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    // m1 was aborted by the push
+                    return doEnd(k1, m1, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OperationNotAllowed);
+                    return doEnd(k1, m2, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    dto::K23SI_MTR mtr{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Medium};
+                    return doRead(k1, mtr, collname);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, value] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    DataRec d{"fk2", "f2"};
+                    K2EXPECT(log::k23si, value, d);
+                });
+        });
+}
+
+// Field operations applied by the server to the latest version of a record, see K23SIWriteRequest::fieldOps
+seastar::future<> runScenario08() {
+    K2LOG_I(log::k23si, "Scenario 08: field operations");
+    return seastar::do_with(
+        dto::K23SI_MTR{},
+        dto::K23SI_MTR{},
+        dto::Key{"counter", "s08-pkey1", "rkey1"},
+        dto::Key{"counter", "s08-pkey2", "rkey1"},
+        [this](auto& m1, auto& m2, auto& k1, auto& k2) {
+            _counterSchema.name = "counter";
+            _counterSchema.version = 1;
+            _counterSchema.fields = std::vector<dto::SchemaField> {
+                    {dto::FieldType::STRING, "partition", false, false},
+                    {dto::FieldType::STRING, "range", false, false},
+                    {dto::FieldType::INT64T, "count", false, false},
+                    {dto::FieldType::STRING, "name", false, false},
+            };
+            _counterSchema.setPartitionKeyFieldsByName(std::vector<String>{"partition"});
+            _counterSchema.setRangeKeyFieldsByName(std::vector<String> {"range"});
+
+            dto::CreateSchemaRequest request{ collname, _counterSchema };
+            return RPC().callRPC<dto::CreateSchemaRequest, dto::CreateSchemaResponse>(dto::Verbs::CPO_SCHEMA_CREATE, request, *_cpoEndpoint, 1s)
+                .then([&](auto&& response) {
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, Statuses::S200_OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    m1.txnid = txnids++;
+                    m1.timestamp = ts;
+                    m1.priority = dto::TxnPriority::Medium;
+                    return doCounterWrite(k1, makeCounter(k1, 10, "a"), m1, k1, true);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    return doEnd(k1, m1, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    m2.txnid = txnids++;
+                    m2.timestamp = ts;
+                    m2.priority = dto::TxnPriority::Medium;
+                    return doCounterWrite(k1, makeCounter(k1, 5, std::nullopt), m2, k1, true, {{2, dto::FieldOperation::Add}});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    // the response has the record as written, with the fields which weren't updated
+                    CounterRec c{15, "a"};
+                    K2EXPECT(log::k23si, toCounter(std::move(r.value)), c);
+                    // the latest version is now the WI of the same transaction
+                    return doCounterWrite(k1, makeCounter(k1, 3, std::nullopt), m2, k1, false, {{2, dto::FieldOperation::Min}});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    CounterRec c{3, "a"};
+                    K2EXPECT(log::k23si, toCounter(std::move(r.value)), c);
+                    return doCounterWrite(k1, makeCounter(k1, 7, std::nullopt), m2, k1, false, {{2, dto::FieldOperation::Max}});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    CounterRec c{7, "a"};
+                    K2EXPECT(log::k23si, toCounter(std::move(r.value)), c);
+                    return doCounterWrite(k1, makeCounter(k1, std::nullopt, "b"), m2, k1, false,
+                                          {{3, dto::FieldOperation::CompareAndSet}}, makeCounter(k1, std::nullopt, "a").storage);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    CounterRec c{7, "b"};
+                    K2EXPECT(log::k23si, toCounter(std::move(r.value)), c);
+                    // the name is "b" now
+                    return doCounterWrite(k1, makeCounter(k1, std::nullopt, "c"), m2, k1, false,
+                                          {{3, dto::FieldOperation::CompareAndSet}}, makeCounter(k1, std::nullopt, "a").storage);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::ConditionFailed);
+                    // arithmetic on a string field
+                    return doCounterWrite(k1, makeCounter(k1, std::nullopt, "d"), m2, k1, false, {{3, dto::FieldOperation::Add}});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::BadParameter);
+                    // arithmetic on a key field
+                    return doCounterWrite(k1, makeCounter(k1, std::nullopt, std::nullopt), m2, k1, false, {{1, dto::FieldOperation::Max}});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::BadParameter);
+                    // there is no record to apply the operation to
+                    return doCounterWrite(k2, makeCounter(k2, 1, std::nullopt), m2, k1, false, {{2, dto::FieldOperation::Add}});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::KeyNotFound);
+                    return doEnd(k1, m2, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    dto::K23SI_MTR mtr{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Medium};
+                    return doReadCounter(k1, mtr);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, value] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    CounterRec c{7, "b"};
+                    K2EXPECT(log::k23si, value, c);
+                });
+        });
+}
+
+// A version with a TTL expires at its commit timestamp plus the TTL, for readers at any later timestamp. The GC drops
+// the key once the expired version falls out of the retention window
+seastar::future<> runScenario09() {
+    K2LOG_I(log::k23si, "Scenario 09: record TTL");
+    return seastar::do_with(
+        dto::K23SI_MTR{},
+        dto::K23SI_MTR{},
+        dto::Key{"schema", "s09-pkey1", "rkey1"},
+        [this](auto& m1, auto& m2, auto& k1) {
+            return getTimeNow()
+                .then([&](dto::Timestamp&& ts) {
+                    m1.txnid = txnids++;
+                    m1.timestamp = ts;
+                    m1.priority = dto::TxnPriority::Medium;
+                    return doRoutedWrite(k1, {"fk1", "f2"}, m1, collname, 1s);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    return doEnd(k1, m1, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    // the reads are at timestamps relative to the commit, so they don't depend on how long this takes
+                    dto::K23SI_MTR before{.txnid = txnids++, .timestamp = m1.timestamp + 999ms, .priority = dto::TxnPriority::Medium};
+                    dto::K23SI_MTR after{.txnid = txnids++, .timestamp = m1.timestamp + 1s, .priority = dto::TxnPriority::Medium};
+                    return seastar::when_all(doRead(k1, before, collname), doRead(k1, after, collname));
+                })
+                .then([&](auto&& result) mutable {
+                    auto& [r1, r2] = result;
+                    auto [status1, value1] = r1.get0();
+                    auto [status2, value2] = r2.get0();
+                    K2EXPECT(log::k23si, status1, dto::K23SIStatus::OK);
+                    DataRec d1{"fk1", "f2"};
+                    K2EXPECT(log::k23si, value1, d1);
+                    K2EXPECT(log::k23si, status2, dto::K23SIStatus::KeyNotFound);
+                })
+                .then([this] {
+                    auto request = dto::CollectionCreateRequest{
+                        .metadata{
+                            .name = shortcollname,
+                            .hashScheme = dto::HashScheme::HashCRC32C,
+                            .storageDriver = dto::StorageDriver::K23SI,
+                            .capacity{},
+                            .retentionPeriod = Duration(1s)
+                        },
+                        .clusterEndpoints = _k2ConfigEps(),
+                        .rangeEnds{}
+                    };
+                    return RPC().callRPC<dto::CollectionCreateRequest, dto::CollectionCreateResponse>
+                            (dto::Verbs::CPO_COLLECTION_CREATE, request, *_cpoEndpoint, 1s);
+                })
+                .then([this](auto&& response) {
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, Statuses::S201_Created);
+                    return seastar::sleep(100ms);
+                })
+                .then([this] {
+                    dto::CreateSchemaRequest request{ shortcollname, _schema };
+                    return RPC().callRPC<dto::CreateSchemaRequest, dto::CreateSchemaResponse>(dto::Verbs::CPO_SCHEMA_CREATE, request, *_cpoEndpoint, 1s);
+                })
+                .then([this](auto&& response) {
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, Statuses::S200_OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    m2.txnid = txnids++;
+                    m2.timestamp = ts;
+                    m2.priority = dto::TxnPriority::Medium;
+                    return doRoutedWrite(k1, {"fk1", "f2"}, m2, shortcollname, 100ms);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    return doRoutedEnd(k1, m2, shortcollname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return doRequestRecords(k1, shortcollname);
+                })
+                .then([&](auto&& response) {
+                    auto& [status, k2response] = response;
+                    K2EXPECT(log::k23si, status, Statuses::S200_OK);
+                    K2EXPECT(log::k23si, k2response.records.size(), 1);
+                    // long enough for the version to leave the retention window and for a GC pass to run after that
+                    return seastar::sleep(3s);
+                })
+                .then([&] {
+                    return doRequestRecords(k1, shortcollname);
+                })
+                .then([&](auto&& response) {
+                    auto& [status, k2response] = response;
+                    K2EXPECT(log::k23si, status, Statuses::S404_Not_Found);
+                    K2EXPECT(log::k23si, k2response.records.size(), 0);
+                });
+        });
+}
+
+// The change stream of a partition only returns a change once no commit can land at or below its timestamp. All keys
+// here are in one partition, which keeps 3 changes(see test_k23si.sh). The changes resolve once the snapshot horizon
+// passes them, which is k23si_snapshot_read_min_staleness behind the current time
+seastar::future<> runScenario10() {
+    K2LOG_I(log::k23si, "Scenario 10: change streams");
+    return seastar::do_with(
+        std::vector<dto::K23SI_MTR>(5),
+        std::vector<dto::Key>{{"schema", "s10-pkey1", "rkey1"}, {"schema", "s10-pkey1", "rkey2"}, {"schema", "s10-pkey1", "rkey3"},
+                              {"schema", "s10-pkey1", "rkey4"}, {"schema", "s10-pkey1", "rkey5"}},
+        dto::Timestamp{},
+        [this](auto& mtrs, auto& keys, auto& resolved) {
+            // writes keys[i] in its own transaction, which is committed unless it is left pending
+            auto write = [this, &mtrs, &keys] (size_t i, bool commit) {
+                return getTimeNow()
+                .then([this, &mtrs, &keys, i] (dto::Timestamp&& ts) {
+                    mtrs[i] = dto::K23SI_MTR{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Medium};
+                    return doWrite(keys[i], {"fk1", "f2"}, mtrs[i], keys[i], collname, false, true);
+                })
+                .then([this, &mtrs, &keys, i, commit] (auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    if (!commit) {
+                        return seastar::make_ready_future();
+                    }
+                    return doEnd(keys[i], mtrs[i], collname, true, {keys[i]})
+                    .then([] (auto&& result) {
+                        auto& [status, r] = result;
+                        K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    });
+                });
+            };
+            auto expectChanges = [&keys] (const dto::K23SIChangesResponse& response, std::vector<size_t> expected) {
+                K2EXPECT(log::k23si, response.changes.size(), expected.size());
+                for (size_t i = 0; i < expected.size() && i < response.changes.size(); ++i) {
+                    K2EXPECT(log::k23si, response.changes[i].key, keys[expected[i]]);
+                    K2EXPECT(log::k23si, response.changes[i].isTombstone, false);
+                }
+            };
+            return write(0, true)
+                .then([write] { return write(1, false); })
+                .then([write] { return write(2, true); })
+                .then([] { return seastar::sleep(1100ms); })
+                .then([&] {
+                    return doPollChanges(keys[0], mtrs[0].timestamp - 1ns, 1s);
+                })
+                .then([&, expectChanges](auto&& response) {
+                    // the WI of the second key holds back the third key, which committed after it
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    expectChanges(resp, {0});
+                    K2EXPECT(log::k23si, resp.resolved.compareCertain(mtrs[1].timestamp - 1ns) == dto::Timestamp::EQ, true);
+                    resolved = resp.resolved;
+                    return doEnd(keys[1], mtrs[1], collname, true, {keys[1]});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return doPollChanges(keys[0], resolved, 1s);
+                })
+                .then([&, write, expectChanges](auto&& response) {
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    expectChanges(resp, {1, 2});
+                    K2EXPECT(log::k23si, resp.resolved.compareCertain(mtrs[2].timestamp) >= 0, true);
+                    resolved = resp.resolved;
+                    return write(3, true).then([write] { return write(4, true); });
+                })
+                .then([] { return seastar::sleep(1100ms); })
+                .then([&] {
+                    // the first two changes are trimmed once the last two resolve
+                    return doPollChanges(keys[0], mtrs[0].timestamp, 1s);
+                })
+                .then([&](auto&& response) {
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::AbortRequestTooOld);
+                    return doPollChanges(keys[0], resolved, 1s);
+                })
+                .then([&, expectChanges](auto&& response) {
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    expectChanges(resp, {3, 4});
+                });
+        });
+}
+
+// A read and a write of two challengers find the WI of the same incumbent at the same time, and push it once their
+// waits time out. The TRH of the incumbent is in another partition than its WIs, so the first push goes out as an
+// RPC and the second one joins it. The abort is applied to all WIs of the incumbent in the partition
+seastar::future<> runScenario11() {
+    K2LOG_I(log::k23si, "Scenario 11: concurrent pushes of the same incumbent");
+    dto::Key trh{"schema", "s11-trh", "rkey1"};
+    dto::Key k1;
+    for (int i = 0; ; ++i) {
+        dto::Key key{"schema", "s11-pkey" + std::to_string(i), "rkey1"};
+        if (_pgetter.getPartitionForKey(key).partition->pvid.id != _pgetter.getPartitionForKey(trh).partition->pvid.id) {
+            k1 = std::move(key);
+            break;
+        }
+    }
+    dto::Key k2{"schema", k1.partitionKey, "rkey2"};
+    return seastar::do_with(
+        dto::K23SI_MTR{},
+        dto::K23SI_MTR{},
+        dto::K23SI_MTR{},
+        std::move(trh),
+        std::move(k1),
+        std::move(k2),
+        [this](auto& m1, auto& reader, auto& writer, auto& trh, auto& k1, auto& k2) {
+            return getTimeNow()
+                .then([&](dto::Timestamp&& ts) {
+                    m1.txnid = txnids++;
+                    m1.timestamp = ts;
+                    m1.priority = dto::TxnPriority::Lowest;
+                    return doWrite(trh, {"fk1", "f2"}, m1, trh, collname, false, true);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    return seastar::when_all(doWrite(k1, {"fk1", "f2"}, m1, trh, collname, false, false),
+                                             doWrite(k2, {"fk1", "f2"}, m1, trh, collname, false, false));
+                })
+                .then([&](auto&& result) mutable {
+                    auto& [r1, r2] = result;
+                    auto [status1, result1] = r1.get0();
+                    auto [status2, result2] = r2.get0();
+                    K2EXPECT(log::k23si, status1, dto::K23SIStatus::Created);
+                    K2EXPECT(log::k23si, status2, dto::K23SIStatus::Created);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    // the reader is older than the writer, so it doesn't conflict with the WI the writer places
+                    reader = dto::K23SI_MTR{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Highest};
+                    writer = dto::K23SI_MTR{.txnid = txnids++, .timestamp = ts + 1ms, .priority = dto::TxnPriority::Highest};
+                    return seastar::when_all(doRead(k1, reader, collname), doWrite(k1, {"fk2", "f2"}, writer, k1, collname, false, true));
+                })
+                .then([&](auto&& result) mutable {
+                    auto& [r1, r2] = result;
+                    auto [status1, value1] = r1.get0();
+                    auto [status2, result2] = r2.get0();
+                    K2EXPECT(log::k23si, status1, dto::K23SIStatus::KeyNotFound);
+                    K2EXPECT(log::k23si, status2, dto::K23SIStatus::Created);
+                    // the other WI of the incumbent was removed with the one which was pushed
+                    return doRequestRecords(k2);
+                })
+                .then([&](auto&& response) {
+                    auto& [status, k2response] = response;
+                    K2EXPECT(log::k23si, status, Statuses::S404_Not_Found);
+                    K2EXPECT(log::k23si, k2response.records.size(), 0);
+                    return doEnd(trh, m1, collname, true, {trh, k1, k2});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OperationNotAllowed);
+                    return doEnd(trh, m1, collname, false, {trh, k1, k2});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return doEnd(k1, writer, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    dto::K23SI_MTR mtr{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Medium};
+                    return doRead(k1, mtr, collname);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, value] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    DataRec d{"fk2", "f2"};
+                    K2EXPECT(log::k23si, value, d);
+                });
+        });
+}
+
+// A write condition is checked against the latest version of the record, including a WI of the same transaction. A
+// failed check is recorded in the read cache, since there is no WI to protect what it observed
+seastar::future<> runScenario12() {
+    K2LOG_I(log::k23si, "Scenario 12: write conditions");
+    return seastar::do_with(
+        dto::K23SI_MTR{},
+        dto::K23SI_MTR{},
+        dto::Key{"schema", "s12-pkey1", "rkey1"},
+        dto::Key{"schema", "s12-pkey1", "rkey2"},
+        [this](auto& m1, auto& m2, auto& k1, auto& k2) {
+            return getTimeNow()
+                .then([&](dto::Timestamp&& ts) {
+                    m1.txnid = txnids++;
+                    m1.timestamp = ts;
+                    m1.priority = dto::TxnPriority::Medium;
+                    return doWrite(k1, {"fk1", "f2"}, m1, k1, collname, false, true);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    return doEnd(k1, m1, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    m2.txnid = txnids++;
+                    m2.timestamp = ts;
+                    m2.priority = dto::TxnPriority::Medium;
+                    return doConditionalWrite(k1, {"fk2", "f2"}, m2, k1, true, f1Equals("fk1"));
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    // the latest version is the WI written above
+                    return doConditionalWrite(k1, {"fk3", "f2"}, m2, k1, false, f1Equals("fk1"));
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::ConditionFailed);
+                    std::vector<dto::expression::Value> values;
+                    values.emplace_back(dto::expression::makeValueReference("f1"));
+                    return doConditionalWrite(k1, {"fk3", "f2"}, m2, k1, false,
+                                              dto::expression::makeExpression(dto::expression::Operation::EQ, std::move(values), {}));
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OperationNotAllowed);
+                    // a record which doesn't exist doesn't pass
+                    return doConditionalWrite(k2, {"fk1", "f2"}, m2, k1, false, f1Equals("fk1"));
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::ConditionFailed);
+                    // an older transaction can't create the record the failed check saw as missing
+                    dto::K23SI_MTR older{.txnid = txnids++, .timestamp = m2.timestamp - 1ms, .priority = dto::TxnPriority::Medium};
+                    return doWrite(k2, {"fk1", "f2"}, older, k2, collname, false, true);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::AbortRequestTooOld);
+                    return doEnd(k1, m2, collname, true, {k1});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    dto::K23SI_MTR mtr{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Medium};
+                    return doRead(k1, mtr, collname);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, value] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    DataRec d{"fk2", "f2"};
+                    K2EXPECT(log::k23si, value, d);
+                });
+        });
+}
+
+// A range delete goes through all the partitions of its range, and hides the keys in it from readers after its
+// timestamp. It is refused over a WI which isn't newer, and over keys which were read after it
+seastar::future<> runScenario13() {
+    K2LOG_I(log::k23si, "Scenario 13: range deletes");
+    return seastar::do_with(
+        std::vector<dto::Key>{{"schema", "s13-pkey1", "rkey1"}, {"schema", "s13-pkey2", "rkey1"}, {"schema", "s13-pkey4", "rkey1"},
+                              {"schema", "s13-pkey5", "rkey1"}, {"schema", "s13-pkey7", "rkey1"}},
+        dto::Timestamp{},
+        dto::K23SI_MTR{},
+        [this](auto& keys, auto& deleted, auto& m1) {
+            auto request = dto::CollectionCreateRequest{
+                .metadata{
+                    .name = rangecollname,
+                    .hashScheme = dto::HashScheme::Range,
+                    .storageDriver = dto::StorageDriver::K23SI,
+                    .capacity{},
+                    .retentionPeriod = Duration(1h)*90*24
+                },
+                .clusterEndpoints = _k2ConfigEps(),
+                .rangeEnds{"s13-pkey3", "s13-pkey6", ""}
+            };
+            return RPC().callRPC<dto::CollectionCreateRequest, dto::CollectionCreateResponse>
+                    (dto::Verbs::CPO_COLLECTION_CREATE, request, *_cpoEndpoint, 1s)
+                .then([](auto&& response) {
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, Statuses::S201_Created);
+                    return seastar::sleep(100ms);
+                })
+                .then([this] {
+                    dto::CreateSchemaRequest request{ rangecollname, _schema };
+                    return RPC().callRPC<dto::CreateSchemaRequest, dto::CreateSchemaResponse>(dto::Verbs::CPO_SCHEMA_CREATE, request, *_cpoEndpoint, 1s);
+                })
+                .then([&](auto&& response) {
+                    auto& [status, resp] = response;
+                    K2EXPECT(log::k23si, status, Statuses::S200_OK);
+                    return seastar::do_for_each(keys, [this] (dto::Key& key) {
+                        return getTimeNow()
+                        .then([this, &key] (dto::Timestamp&& ts) {
+                            dto::K23SI_MTR mtr{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Medium};
+                            return doRoutedWrite(key, {"fk1", "f2"}, mtr, rangecollname)
+                            .then([this, &key, mtr] (auto&& result) {
+                                auto& [status, r] = result;
+                                K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                                return doRoutedEnd(key, mtr, rangecollname, true, {key});
+                            })
+                            .then([] (auto&& result) {
+                                auto& [status, r] = result;
+                                K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                            });
+                        });
+                    });
+                })
+                .then([] {
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    deleted = ts;
+                    // the range starts in the first partition and ends with the second one
+                    return doRangeDelete({"schema", "s13-pkey2", ""}, {"schema", "s13-pkey6", ""}, deleted, rangecollname);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, partitions] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    K2EXPECT(log::k23si, partitions, 2);
+                    dto::K23SI_MTR after{.txnid = txnids++, .timestamp = deleted + 1ns, .priority = dto::TxnPriority::Medium};
+                    dto::K23SI_MTR before{.txnid = txnids++, .timestamp = deleted - 1ns, .priority = dto::TxnPriority::Medium};
+                    return seastar::when_all(doRoutedRead(keys[0], after, rangecollname), doRoutedRead(keys[1], after, rangecollname),
+                                             doRoutedRead(keys[2], after, rangecollname), doRoutedRead(keys[3], after, rangecollname),
+                                             doRoutedRead(keys[4], after, rangecollname), doRoutedRead(keys[2], before, rangecollname));
+                })
+                .then([&](auto&& result) mutable {
+                    auto& [r0, r1, r2, r3, r4, r2before] = result;
+                    Status status0 = r0.get0(), status1 = r1.get0(), status2 = r2.get0(), status3 = r3.get0(), status4 = r4.get0();
+                    K2EXPECT(log::k23si, status0, dto::K23SIStatus::OK);
+                    K2EXPECT(log::k23si, status1, dto::K23SIStatus::KeyNotFound);
+                    K2EXPECT(log::k23si, status2, dto::K23SIStatus::KeyNotFound);
+                    K2EXPECT(log::k23si, status3, dto::K23SIStatus::KeyNotFound);
+                    K2EXPECT(log::k23si, status4, dto::K23SIStatus::OK);
+                    // older readers still see what was there
+                    Status statusBefore = r2before.get0();
+                    K2EXPECT(log::k23si, statusBefore, dto::K23SIStatus::OK);
+                    // and an older writer can't write under the delete, also where there was no key
+                    dto::K23SI_MTR older{.txnid = txnids++, .timestamp = deleted - 1ms, .priority = dto::TxnPriority::Medium};
+                    return doRoutedWrite({"schema", "s13-pkey3", "rkey1"}, {"fk1", "f2"}, older, rangecollname);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::AbortRequestTooOld);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    m1.txnid = txnids++;
+                    m1.timestamp = ts;
+                    m1.priority = dto::TxnPriority::Medium;
+                    return doRoutedWrite(keys[3], {"fk2", "f2"}, m1, rangecollname);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                    return doRangeDelete({"schema", "s13-pkey4", ""}, {"schema", "s13-pkey6", ""}, m1.timestamp + 1ms, rangecollname);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, partitions] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::AbortConflict);
+                    return doRoutedEnd(keys[3], m1, rangecollname, false, {keys[3]});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                    return getTimeNow();
+                })
+                .then([&](dto::Timestamp&& ts) {
+                    dto::K23SI_MTR reader{.txnid = txnids++, .timestamp = ts, .priority = dto::TxnPriority::Medium};
+                    return doRoutedRead(keys[4], reader, rangecollname)
+                    .then([&, reader] (Status&& status) {
+                        K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+                        // to the end of the schema
+                        return doRangeDelete({"schema", "s13-pkey7", ""}, {"schema", "", ""}, reader.timestamp - 1ms, rangecollname);
+                    });
+                })
+                .then([&](auto&& result) {
+                    auto& [status, partitions] = result;
+                    K2EXPECT(log::k23si, status, dto::K23SIStatus::AbortRequestTooOld);
+                });
+        });
+}
+
 };  // class K23SITest
 } // ns k2
 
@@ -226,3 +226,73 @@ TEST_CASE("Test5: bool key ordering") {
     REQUIRE(falseKey < trueKey);
 }
 
+
+TEST_CASE("Test6: key fields out of schema order") {
+    k2::dto::Schema schema;
+    schema.name = "test_schema";
+    schema.version = 1;
+    schema.fields = std::vector<k2::dto::SchemaField> {
+            {k2::dto::FieldType::INT32T, "ID", false, false},
+            {k2::dto::FieldType::STRING, "LastName", false, false},
+            {k2::dto::FieldType::INT64T, "Order", false, false},
+            {k2::dto::FieldType::STRING, "Value", false, false},
+    };
+
+    schema.setPartitionKeyFieldsByName(std::vector<k2::String>{"LastName", "ID"});
+    schema.setRangeKeyFieldsByName(std::vector<k2::String>{"Order"});
+    REQUIRE(schema.keySlots() == std::vector<int32_t>{1, 0, 2, -1});
+    std::shared_ptr<k2::dto::Schema> schema_ptr = std::make_shared<k2::dto::Schema>(std::move(schema));
+
+    k2::dto::SKVRecord doc("collection", schema_ptr);
+    doc.serializeNext<int32_t>(7);
+    doc.serializeNext<k2::String>("Smith");
+    doc.serializeNext<int64_t>(-3);
+    doc.serializeNext<k2::String>("not a key");
+
+    REQUIRE(doc.getPartitionKey() == k2::dto::FieldToKeyString<k2::String>("Smith") + k2::dto::FieldToKeyString<int32_t>(7));
+    REQUIRE(doc.getRangeKey() == k2::dto::FieldToKeyString<int64_t>(-3));
+
+    // the encoders write exactly the number of bytes they report
+    k2::String name("a\0b", 3);
+    k2::String buffer(k2::String::initialized_later(), k2::dto::KeyStringSize<k2::String>(name));
+    REQUIRE(k2::dto::EncodeKeyString<k2::String>(name, buffer.data()) == buffer.data() + buffer.size());
+    REQUIRE(buffer == k2::dto::FieldToKeyString<k2::String>(name));
+}
+
+TEST_CASE("Test7: decimal key ordering") {
+    k2::dto::Schema schema;
+    schema.name = "decimal";
+    schema.version = 1;
+    schema.fields = std::vector<k2::dto::SchemaField> {
+            {k2::dto::FieldType::DECIMAL64, "Amount", false, false},
+            {k2::dto::FieldType::DECIMAL128, "Total", false, false},
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<k2::String>{"Amount"});
+    schema.setRangeKeyFieldsByName(std::vector<k2::String>{"Total"});
+    std::shared_ptr<k2::dto::Schema> schema_ptr = std::make_shared<k2::dto::Schema>(std::move(schema));
+
+    // ascending values, with mixed exponents
+    std::vector<std::pair<long long, int>> values{
+        {-1, 3}, {-15, -1}, {-149, -2}, {0, 0}, {1, -10}, {149, -2}, {15, -1}, {16, -1}, {2, 0}, {1, 3}};
+    std::vector<k2::String> amounts;
+    std::vector<k2::String> totals;
+    for (auto& [coefficient, exponent] : values) {
+        k2::dto::SKVRecord doc("collection", schema_ptr);
+        doc.serializeNext<std::decimal::decimal64>(std::decimal::make_decimal64(coefficient, exponent));
+        doc.serializeNext<std::decimal::decimal128>(std::decimal::make_decimal128(coefficient, exponent));
+        amounts.push_back(doc.getPartitionKey());
+        totals.push_back(doc.getRangeKey());
+    }
+    for (size_t i = 1; i < values.size(); ++i) {
+        REQUIRE(amounts[i - 1] < amounts[i]);
+        REQUIRE(totals[i - 1] < totals[i]);
+    }
+
+    // all representations of a value have the same key
+    REQUIRE(k2::dto::FieldToKeyString(std::decimal::make_decimal64(15ll, -1)) ==
+            k2::dto::FieldToKeyString(std::decimal::make_decimal64(1500ll, -3)));
+    REQUIRE(k2::dto::FieldToKeyString(std::decimal::make_decimal128(0ll, 5)) ==
+            k2::dto::FieldToKeyString(std::decimal::make_decimal128(0ll, -5)));
+    REQUIRE_THROWS_AS(k2::dto::FieldToKeyString(std::decimal::decimal64(0) / std::decimal::decimal64(0)),
+                      k2::dto::SKVKeyEncodingException);
+}
@@ -0,0 +1,183 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+
+#include <limits>
+
+#include <k2/dto/K23SI.h>
+#include <k2/dto/MessageVerbs.h>
+#include "Log.h"
+
+namespace k2 {
+
+// Tests the WAL of the persistence service directly. Concurrent persistence requests are group-committed, each is
+// acknowledged once its group is durable, and the WAL replays the records of each source in order
+class PersistenceTest {
+
+public:  // application lifespan
+    PersistenceTest() { K2LOG_I(log::k23si, "ctor");}
+    ~PersistenceTest(){ K2LOG_I(log::k23si, "dtor");}
+
+    seastar::future<> gracefulStop() {
+        K2LOG_I(log::k23si, "stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start(){
+        K2LOG_I(log::k23si, "start");
+        _persistenceEndpoint = RPC().getTXEndpoint(_persistenceConfigEp());
+
+        _testFuture = seastar::make_ready_future()
+        .then([this] { return runScenario01(); })
+        .then([this] { return runScenario02(); })
+        .then([this] {
+            K2LOG_I(log::k23si, "======= All tests passed ========");
+            exitcode = 0;
+        })
+        .handle_exception([this](auto exc) {
+            try {
+                std::rethrow_exception(exc);
+            } catch (RPCDispatcher::RequestTimeoutException& exc) {
+                K2LOG_E(log::k23si, "======= Test failed due to timeout ========");
+                exitcode = -1;
+            } catch (std::exception& e) {
+                K2LOG_E(log::k23si, "======= Test failed with exception [{}] ========", e.what());
+                exitcode = -1;
+            }
+        })
+        .finally([this] {
+            K2LOG_I(log::k23si, "======= Test ended ========");
+            seastar::engine().exit(exitcode);
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    int exitcode = -1;
+    ConfigVar<String> _persistenceConfigEp{"persistence_endpoint"};
+
+    std::unique_ptr<k2::TXEndpoint> _persistenceEndpoint;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+
+    seastar::future<Status> doPersist(const String& source, const String& value) {
+        dto::K23SI_PersistenceRequest<Payload> request{};
+        request.source = source;
+        request.value.val = Payload(Payload::DefaultAllocator);
+        request.value.val.write(value);
+        return seastar::do_with(std::move(request), [this] (auto& request) {
+            return RPC().callRPC<dto::K23SI_PersistenceRequest<Payload>, dto::K23SI_PersistenceResponse>
+                (dto::Verbs::K23SI_Persist, request, *_persistenceEndpoint, 1s);
+        })
+        .then([] (auto&& response) {
+            return std::move(std::get<0>(response));
+        });
+    }
+
+    // Persists the given values concurrently, so that they arrive within one group commit window
+    seastar::future<> doPersistAll(const String& source, const std::vector<String>& values) {
+        std::vector<seastar::future<Status>> futs;
+        for (auto& value : values) {
+            futs.push_back(doPersist(source, value));
+        }
+        return seastar::when_all_succeed(futs.begin(), futs.end())
+        .then([] (std::vector<Status>&& statuses) {
+            for (auto& status : statuses) {
+                K2EXPECT(log::k23si, status, Statuses::S200_OK);
+            }
+        });
+    }
+
+    // Replays the whole WAL of the given source
+    seastar::future<std::vector<String>> doRecover(const String& source) {
+        dto::K23SIRecoverWALRequest request{.source = source, .fromLSN = 0, .toLSN = std::numeric_limits<uint64_t>::max()};
+        return RPC().callRPC<dto::K23SIRecoverWALRequest, dto::K23SIRecoverWALResponse>
+            (dto::Verbs::K23SI_RECOVER_WAL, request, *_persistenceEndpoint, 1s)
+        .then([] (auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status, Statuses::S200_OK);
+            std::vector<String> values;
+            for (auto& record : resp.records) {
+                String value;
+                record.seek(0);
+                K2EXPECT(log::k23si, record.read(value), true);
+                values.push_back(std::move(value));
+            }
+            return values;
+        });
+    }
+
+    seastar::future<> doExpectWAL(const String& source, const std::vector<String>& expected) {
+        return doRecover(source)
+        .then([expected] (std::vector<String>&& values) {
+            K2EXPECT(log::k23si, values.size(), expected.size());
+            for (size_t i = 0; i < expected.size(); ++i) {
+                K2EXPECT(log::k23si, values[i], expected[i]);
+            }
+        });
+    }
+
+public: // tests
+
+seastar::future<> runScenario01() {
+    K2LOG_I(log::k23si, "Scenario 01: concurrent requests are acknowledged and replayed in order");
+    // interleave two sources in the same groups. Each only gets its own records back
+    std::vector<String> values1, values2;
+    for (int i = 0; i < 50; ++i) {
+        values1.push_back("s01-a-" + std::to_string(i));
+        values2.push_back("s01-b-" + std::to_string(i));
+    }
+    return seastar::do_with(std::move(values1), std::move(values2), [this] (auto& values1, auto& values2) {
+        return seastar::when_all_succeed(doPersistAll("s01-a", values1), doPersistAll("s01-b", values2))
+        .then([this, &values1] {
+            return doExpectWAL("s01-a", values1);
+        })
+        .then([this, &values2] {
+            return doExpectWAL("s01-b", values2);
+        });
+    });
+}
+
+seastar::future<> runScenario02() {
+    K2LOG_I(log::k23si, "Scenario 02: records larger than a commit group and a volume chunk");
+    // the large record closes the open group early and is split across several volume records
+    std::vector<String> values{"s02-small-0", String(100*1024, 'x'), "s02-small-1", String(40*1024, 'y'), "s02-small-2"};
+    return seastar::do_with(std::move(values), [this] (auto& values) {
+        return doPersistAll("s02", values)
+        .then([this, &values] {
+            return doExpectWAL("s02", values);
+        });
+    });
+}
+
+};  // class PersistenceTest
+} // ns k2
+
+int main(int argc, char** argv) {
+    k2::App app("PersistenceTest");
+    app.addOptions()("persistence_endpoint", bpo::value<k2::String>(), "The endpoint of the persistence service");
+    app.addApplet<k2::PersistenceTest>();
+    return app.start(argc, argv);
+}
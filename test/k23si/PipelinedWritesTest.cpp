@@ -0,0 +1,391 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <seastar/core/sleep.hh>
+
+#include <k2/dto/K23SI.h>
+#include <k2/dto/Collection.h>
+#include <k2/dto/ControlPlaneOracle.h>
+#include <k2/dto/MessageVerbs.h>
+#include "Log.h"
+
+namespace k2 {
+
+const char* collname = "k23si_pipelined_collection";
+
+// Tests the durability checks of pipelined writes and parallel commits. The "durable" phase runs against a healthy
+// persistence. The test script then pauses the persistence process, and the "failure" phase checks that writes which
+// can't be persisted are reported as such, however many times they are asked about, and abort their transaction.
+// Writes which aren't pipelined are checked in both phases as they share the persistence batches. With replicated
+// persistence, pausing one replica is enough for a failure when the write quorum needs all of them, and the
+// "resumed" phase checks that writes succeed again once the replica is back
+class PipelinedWritesTest {
+
+public:  // application lifespan
+    PipelinedWritesTest() { K2LOG_I(log::k23si, "ctor");}
+    ~PipelinedWritesTest(){ K2LOG_I(log::k23si, "dtor");}
+
+    seastar::future<> gracefulStop() {
+        K2LOG_I(log::k23si, "stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start(){
+        K2LOG_I(log::k23si, "start");
+        _cpoEndpoint = RPC().getTXEndpoint(_cpoConfigEp());
+        _makeSchema();
+
+        _testFuture = seastar::make_ready_future()
+        .then([this] {
+            if (_phase() == "durable") {
+                return _createCollection()
+                .then([this] { return runScenario01(); })
+                .then([this] { return runScenario02(); })
+                .then([this] { return runScenario03(); })
+                .then([this] { return runScenario05(); });
+            }
+            if (_phase() == "resumed") {
+                return _getCollection()
+                .then([this] { return runScenario07(); });
+            }
+            K2EXPECT(log::k23si, _phase(), "failure");
+            return _getCollection()
+            .then([this] { return runScenario04(); })
+            .then([this] { return runScenario06(); });
+        })
+        .then([this] {
+            K2LOG_I(log::k23si, "======= All tests passed ========");
+            exitcode = 0;
+        })
+        .handle_exception([this](auto exc) {
+            try {
+                std::rethrow_exception(exc);
+            } catch (RPCDispatcher::RequestTimeoutException& exc) {
+                K2LOG_E(log::k23si, "======= Test failed due to timeout ========");
+                exitcode = -1;
+            } catch (std::exception& e) {
+                K2LOG_E(log::k23si, "======= Test failed with exception [{}] ========", e.what());
+                exitcode = -1;
+            }
+        })
+        .finally([this] {
+            K2LOG_I(log::k23si, "======= Test ended ========");
+            seastar::engine().exit(exitcode);
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    int exitcode = -1;
+    ConfigVar<String> _k2ConfigEp{"k2_endpoint"};
+    ConfigVar<String> _cpoConfigEp{"cpo_endpoint"};
+    ConfigVar<String> _phase{"phase"};
+
+    std::unique_ptr<k2::TXEndpoint> _cpoEndpoint;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+
+    dto::PartitionGetter _pgetter;
+    dto::Schema _schema;
+
+    void _makeSchema() {
+        _schema.name = "schema";
+        _schema.version = 1;
+        _schema.fields = std::vector<dto::SchemaField> {
+                {dto::FieldType::STRING, "partition", false, false},
+                {dto::FieldType::STRING, "range", false, false},
+                {dto::FieldType::STRING, "f1", false, false},
+        };
+        _schema.setPartitionKeyFieldsByName(std::vector<String>{"partition"});
+        _schema.setRangeKeyFieldsByName(std::vector<String>{"range"});
+    }
+
+    static dto::Key _key(const String& pkey) {
+        return dto::Key{.schemaName = "schema", .partitionKey = pkey, .rangeKey = ""};
+    }
+
+    static dto::K23SI_MTR _newMTR(dto::TxnPriority priority=dto::TxnPriority::Medium) {
+        // the phases run in processes of their own, so the ids come from the clock
+        auto nsecsSinceEpoch = sys_now_nsec_count();
+        return dto::K23SI_MTR{.txnid = nsecsSinceEpoch, .timestamp = dto::Timestamp(nsecsSinceEpoch, 1550647543, 1000),
+                              .priority = priority};
+    }
+
+    seastar::future<> _getCollection() {
+        auto request = dto::CollectionGetRequest{.name = collname};
+        return RPC().callRPC<dto::CollectionGetRequest, dto::CollectionGetResponse>
+            (dto::Verbs::CPO_COLLECTION_GET, request, *_cpoEndpoint, 1s)
+        .then([this](auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status, Statuses::S200_OK);
+            _pgetter = dto::PartitionGetter(std::move(resp.collection));
+        });
+    }
+
+    seastar::future<> _createCollection() {
+        auto request = dto::CollectionCreateRequest{
+            .metadata{
+                .name = collname,
+                .hashScheme = dto::HashScheme::HashCRC32C,
+                .storageDriver = dto::StorageDriver::K23SI,
+                .capacity{},
+                .retentionPeriod = Duration(1h)*90*24
+            },
+            .clusterEndpoints = {_k2ConfigEp()},
+            .rangeEnds{}
+        };
+        return RPC().callRPC<dto::CollectionCreateRequest, dto::CollectionCreateResponse>
+            (dto::Verbs::CPO_COLLECTION_CREATE, request, *_cpoEndpoint, 1s)
+        .then([](auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status, Statuses::S201_Created);
+            return seastar::sleep(100ms);
+        })
+        .then([this] {
+            return _getCollection();
+        })
+        .then([this] {
+            dto::CreateSchemaRequest request{ collname, _schema };
+            return RPC().callRPC<dto::CreateSchemaRequest, dto::CreateSchemaResponse>(dto::Verbs::CPO_SCHEMA_CREATE, request, *_cpoEndpoint, 1s);
+        })
+        .then([] (auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status, Statuses::S200_OK);
+        });
+    }
+
+    seastar::future<Status> doWrite(const dto::Key& key, const String& value, const dto::K23SI_MTR& mtr, const dto::Key& trh, bool pipelined) {
+        SKVRecord record(collname, std::make_shared<k2::dto::Schema>(_schema));
+        record.serializeNext<String>(key.partitionKey);
+        record.serializeNext<String>(key.rangeKey);
+        record.serializeNext<String>(value);
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIWriteRequest request {
+            .pvid = part.partition->pvid,
+            .collectionName = collname,
+            .mtr = mtr,
+            .trh = trh,
+            .isDelete = false,
+            .designateTRH = key == trh,
+            .rejectIfExists = false,
+            .key = key,
+            .value = std::move(record.storage),
+            .fieldsForPartialUpdate = std::vector<uint32_t>()
+        };
+        request.pipelined = pipelined;
+        // a write which isn't pipelined waits for the persistence, and fails once the persistence timeout expires
+        return RPC().callRPC<dto::K23SIWriteRequest, dto::K23SIWriteResponse>(dto::Verbs::K23SI_WRITE, request, *part.preferredEndpoint, 5s)
+        .then([] (auto&& response) {
+            return std::move(std::get<0>(response));
+        });
+    }
+
+    seastar::future<Status> doAwaitDurable(const dto::Key& key, const dto::K23SI_MTR& mtr) {
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SITxnAwaitDurableRequest request{.pvid = part.partition->pvid, .collectionName = collname, .key = key, .mtr = mtr};
+        // a write which can't be persisted fails once the persistence timeout of the node expires
+        return RPC().callRPC<dto::K23SITxnAwaitDurableRequest, dto::K23SITxnAwaitDurableResponse>
+            (dto::Verbs::K23SI_TXN_AWAIT_DURABLE, request, *part.preferredEndpoint, 5s)
+        .then([] (auto&& response) {
+            return std::move(std::get<0>(response));
+        });
+    }
+
+    seastar::future<Status> doParallelCommit(const dto::Key& trh, const dto::K23SI_MTR& mtr, std::vector<dto::Key> writeKeys) {
+        auto& part = _pgetter.getPartitionForKey(trh);
+        dto::K23SITxnEndRequest request;
+        request.pvid = part.partition->pvid;
+        request.collectionName = collname;
+        request.mtr = mtr;
+        request.key = trh;
+        request.action = dto::EndAction::Commit;
+        request.writeKeys = std::move(writeKeys);
+        request.syncFinalize = true;
+        request.parallelCommit = true;
+        return RPC().callRPC<dto::K23SITxnEndRequest, dto::K23SITxnEndResponse>(dto::Verbs::K23SI_TXN_END, request, *part.preferredEndpoint, 5s)
+        .then([] (auto&& response) {
+            return std::move(std::get<0>(response));
+        });
+    }
+
+    seastar::future<std::tuple<Status, String>> doRead(const dto::Key& key, const dto::K23SI_MTR& mtr) {
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIReadRequest request {
+            .pvid = part.partition->pvid,
+            .collectionName = collname,
+            .mtr = mtr,
+            .key = key
+        };
+        return RPC().callRPC<dto::K23SIReadRequest, dto::K23SIReadResponse>
+            (dto::Verbs::K23SI_READ, request, *part.preferredEndpoint, 5s)
+        .then([this] (auto&& response) {
+            auto& [status, resp] = response;
+            if (!status.is2xxOK()) {
+                return std::make_tuple(std::move(status), String());
+            }
+            SKVRecord record(collname, std::make_shared<k2::dto::Schema>(_schema), std::move(resp.value), true);
+            record.seekField(2);
+            return std::make_tuple(std::move(status), *(record.deserializeNext<String>()));
+        });
+    }
+
+public: // tests
+
+seastar::future<> runScenario01() {
+    K2LOG_I(log::k23si, "Scenario 01: a pipelined write becomes durable");
+    return seastar::do_with(_newMTR(), _key("s01-trh"), [this] (auto& mtr, auto& trh) {
+        return doWrite(trh, "v1", mtr, trh, true)
+        .then([this, &mtr, &trh] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+            return doAwaitDurable(trh, mtr);
+        })
+        .then([this, &mtr, &trh] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+            // the answer doesn't change once the write is durable
+            return doAwaitDurable(trh, mtr);
+        })
+        .then([] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+        });
+    });
+}
+
+seastar::future<> runScenario02() {
+    K2LOG_I(log::k23si, "Scenario 02: the durability of the writes of an unknown txn is not vouched for");
+    // e.g. the writes of a txn which was force-aborted, or which never reached the partition
+    return doAwaitDurable(_key("s02-trh"), _newMTR())
+    .then([] (Status&& status) {
+        K2EXPECT(log::k23si, status.is2xxOK(), false);
+    });
+}
+
+seastar::future<> runScenario03() {
+    K2LOG_I(log::k23si, "Scenario 03: parallel commit, with a push while the txn is in Staging");
+    return seastar::do_with(_newMTR(dto::TxnPriority::Lowest), _key("s03-trh"), _key("s03-key"), [this] (auto& mtr, auto& trh, auto& key) {
+        return doWrite(trh, "trh", mtr, trh, true)
+        .then([this, &mtr, &trh, &key] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+            return doWrite(key, "key", mtr, trh, true);
+        })
+        .then([this, &mtr, &trh, &key] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+            // The read of a newer txn with a higher priority pushes the incumbent, which would lose to it if it were
+            // still InProgress. The push finds the incumbent in Staging if it gets there before the commit is done, in
+            // which case it waits for the outcome. Either way, the read finds the txn committed
+            return seastar::when_all(doParallelCommit(trh, mtr, {trh, key}), doRead(key, _newMTR(dto::TxnPriority::Highest)));
+        })
+        .then([] (auto&& results) {
+            auto& [r1, r2] = results;
+            auto endStatus = r1.get0();
+            K2EXPECT(log::k23si, endStatus, dto::K23SIStatus::OK);
+            auto [readStatus, value] = r2.get0();
+            K2EXPECT(log::k23si, readStatus, dto::K23SIStatus::OK);
+            K2EXPECT(log::k23si, value, "key");
+        });
+    });
+}
+
+seastar::future<> runScenario04() {
+    K2LOG_I(log::k23si, "Scenario 04: a pipelined write which fails to persist");
+    return seastar::do_with(_newMTR(), _key("s04-trh"), [this] (auto& mtr, auto& trh) {
+        // the write is acknowledged before it is persisted
+        return doWrite(trh, "v1", mtr, trh, true)
+        .then([this, &mtr, &trh] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+            return doAwaitDurable(trh, mtr);
+        })
+        .then([this, &mtr, &trh] (Status&& status) {
+            K2EXPECT(log::k23si, status.is2xxOK(), false);
+            // a retry, e.g. after a lost response, gets the same answer
+            return doAwaitDurable(trh, mtr);
+        })
+        .then([this, &mtr, &trh] (Status&& status) {
+            K2EXPECT(log::k23si, status.is2xxOK(), false);
+            return doParallelCommit(trh, mtr, {trh});
+        })
+        .then([] (Status&& status) {
+            // the TRH aborts the txn, since one of its writes isn't durable
+            K2EXPECT(log::k23si, status.is2xxOK(), false);
+        });
+    });
+}
+
+// Writes of separate transactions, issued concurrently so that their values share persistence batches
+seastar::future<std::vector<Status>> doConcurrentWrites(const String& prefix, size_t count) {
+    std::vector<seastar::future<Status>> futs;
+    for (size_t i = 0; i < count; ++i) {
+        auto key = _key(prefix + std::to_string(i));
+        // the clock may not move between the iterations
+        auto mtr = _newMTR();
+        mtr.txnid += i;
+        futs.push_back(doWrite(key, "v" + std::to_string(i), mtr, key, false));
+    }
+    return seastar::when_all_succeed(futs.begin(), futs.end());
+}
+
+seastar::future<> runScenario05() {
+    K2LOG_I(log::k23si, "Scenario 05: concurrent writes are persisted in shared batches");
+    return doConcurrentWrites("s05-key", 20)
+    .then([] (std::vector<Status>&& statuses) {
+        K2EXPECT(log::k23si, statuses.size(), 20);
+        for (auto& status : statuses) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+        }
+    });
+}
+
+seastar::future<> runScenario06() {
+    K2LOG_I(log::k23si, "Scenario 06: a batch which fails to persist fails every write in it");
+    return doConcurrentWrites("s06-key", 20)
+    .then([] (std::vector<Status>&& statuses) {
+        K2EXPECT(log::k23si, statuses.size(), 20);
+        for (auto& status : statuses) {
+            K2EXPECT(log::k23si, status.is2xxOK(), false);
+        }
+    });
+}
+
+seastar::future<> runScenario07() {
+    K2LOG_I(log::k23si, "Scenario 07: writes are persisted again once the persistence is back");
+    return doConcurrentWrites("s07-key", 20)
+    .then([] (std::vector<Status>&& statuses) {
+        K2EXPECT(log::k23si, statuses.size(), 20);
+        for (auto& status : statuses) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+        }
+    });
+}
+
+};  // class PipelinedWritesTest
+} // ns k2
+
+int main(int argc, char** argv) {
+    k2::App app("PipelinedWritesTest");
+    app.addOptions()("k2_endpoint", bpo::value<k2::String>(), "The endpoint of the k2 core which holds the collection");
+    app.addOptions()("cpo_endpoint", bpo::value<k2::String>(), "The endpoint of the CPO");
+    app.addOptions()("phase", bpo::value<k2::String>(), "The phase of the test to run: durable, failure while the persistence is paused, or resumed after it");
+    app.addApplet<k2::PipelinedWritesTest>();
+    return app.start(argc, argv);
+}
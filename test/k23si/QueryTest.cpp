@@ -93,6 +93,8 @@ public:  // application lifespan
         .then([this] { return runScenario04(); })
         .then([this] { return runScenario05(); })
         .then([this] { return runScenario06(); })
+        .then([this] { return runScenario07(); })
+        .then([this] { return runScenario08(); })
         .then([this] {
             K2LOG_I(log::k23si, "======= All tests passed ========");
             exitcode = 0;
@@ -135,7 +137,8 @@ doQuery(const k2::String& start, const k2::String& end, int32_t limit, bool reve
                           k2::Status expectedStatus=k2::dto::K23SIStatus::OK,
                           k2e::Expression filterExpression=k2e::Expression{},
                           std::vector<k2::String> projection=std::vector<k2::String>(),
-                          bool doPrefixScan = false) {
+                          bool doPrefixScan = false, uint32_t streamCredits = 0, uint32_t parallelFanout = 0,
+                          uint32_t readahead = 0) {
     K2LOG_D(log::k23si, "doQuery from {} to {}", start, end);
     return _client.beginTxn(k2::K2TxnOptions{})
     .then([this] (k2::K2TxnHandle&& t) {
@@ -145,7 +148,7 @@ doQuery(const k2::String& start, const k2::String& end, int32_t limit, bool reve
     .then([this, start, end, limit, reverse, expectedRecords, expectedPaginations, expectedStatus,
                 filterExpression=std::move(filterExpression),
                 projection=std::move(projection),
-                doPrefixScan] (auto&& response) mutable {
+                doPrefixScan, streamCredits, parallelFanout, readahead] (auto&& response) mutable {
         K2EXPECT(log::k23si, response.status.is2xxOK(), true);
         query = std::move(response.query);
 
@@ -170,9 +173,12 @@ doQuery(const k2::String& start, const k2::String& end, int32_t limit, bool reve
         query.setReverseDirection(reverse);
         query.addProjection(projection);
         query.setFilterExpression(std::move(filterExpression));
+        query.setStreamCredits(streamCredits);
+        query.setParallelScan(parallelFanout);
+        query.setReadahead(readahead);
 
         return seastar::do_with(std::vector<std::vector<k2::dto::SKVRecord>>(), (uint32_t)0, false,
-        [this, expectedRecords, expectedPaginations, expectedStatus, projection] (
+        [this, expectedRecords, expectedPaginations, expectedStatus, projection, parallelFanout] (
                 std::vector<std::vector<k2::dto::SKVRecord>>& result_set, uint32_t& count, bool& done) {
             return seastar::do_until(
                 [this, &done] () { return done; },
@@ -185,7 +191,7 @@ doQuery(const k2::String& start, const k2::String& end, int32_t limit, bool reve
                         result_set.push_back(std::move(response.records));
                     });
             })
-            .then([&result_set, &count, expectedPaginations, expectedRecords, expectedStatus] () {
+            .then([&result_set, &count, expectedPaginations, expectedRecords, expectedStatus, parallelFanout] () {
                 if (!expectedStatus.is2xxOK()) {
                     return seastar::make_ready_future<std::vector<std::vector<k2::dto::SKVRecord>>>(std::move(result_set));
                 }
@@ -195,13 +201,70 @@ doQuery(const k2::String& start, const k2::String& end, int32_t limit, bool reve
                     record_count += set.size();
                 }
                 K2EXPECT(log::k23si, record_count, expectedRecords);
-                K2EXPECT(log::k23si, count, expectedPaginations);
+                // the number of pages of a parallel scan depends on the order in which the partitions respond
+                if (parallelFanout == 0) {
+                    K2EXPECT(log::k23si, count, expectedPaginations);
+                }
                 return seastar::make_ready_future<std::vector<std::vector<k2::dto::SKVRecord>>>(std::move(result_set));
             });
         });
     });
 }
 
+// Runs a full schema scan aggregate query to completion and returns the final aggregate results
+seastar::future<std::vector<k2e::Value>>
+doAggregateQuery(std::vector<k2::dto::Aggregate> aggregates,
+                 k2::Status expectedStatus=k2::dto::K23SIStatus::OK,
+                 k2e::Expression filterExpression=k2e::Expression{},
+                 uint32_t streamCredits = 0) {
+    K2LOG_D(log::k23si, "doAggregateQuery {}", aggregates);
+    return _client.beginTxn(k2::K2TxnOptions{})
+    .then([this] (k2::K2TxnHandle&& t) {
+        txn = std::move(t);
+        return _client.createQuery(collname, "schema");
+    })
+    .then([this, aggregates=std::move(aggregates), expectedStatus,
+                filterExpression=std::move(filterExpression), streamCredits] (auto&& response) mutable {
+        K2EXPECT(log::k23si, response.status.is2xxOK(), true);
+        query = std::move(response.query);
+        query.startScanRecord.serializeNext<k2::String>("default");
+        query.startScanRecord.serializeNext<k2::String>("");
+        query.startScanRecord.serializeNext<k2::String>("");
+        for (k2::dto::Aggregate& aggregate : aggregates) {
+            query.addAggregate(aggregate.op, aggregate.fieldName);
+        }
+        query.setFilterExpression(std::move(filterExpression));
+        query.setStreamCredits(streamCredits);
+
+        return seastar::do_with(std::vector<k2e::Value>(), false,
+        [this, expectedStatus] (std::vector<k2e::Value>& results, bool& done) {
+            return seastar::do_until(
+                [this, &done] () { return done; },
+                [this, &results, &done, expectedStatus] () {
+                    return txn.query(query)
+                    .then([this, &results, &done, expectedStatus] (auto&& response) {
+                        K2EXPECT(log::k23si, response.status, expectedStatus);
+                        K2EXPECT(log::k23si, response.records.size(), 0);
+                        done = response.status.is2xxOK() ? query.isDone() : true;
+                        results = std::move(response.aggregates);
+                    });
+            })
+            .then([&results] () {
+                return seastar::make_ready_future<std::vector<k2e::Value>>(std::move(results));
+            });
+        });
+    });
+}
+
+template <typename T>
+T readAggregate(k2e::Value& value) {
+    K2EXPECT(log::k23si, value.type == k2::dto::TToFieldType<T>(), true);
+    T result{};
+    value.literal.seek(0);
+    K2EXPECT(log::k23si, value.literal.read(result), true);
+    return result;
+}
+
 // Write six records with partition2 keys ("a"-"f"), three to each partition
 // Write additional two records with non-default partition1 key
 seastar::future<> runSetup() {
@@ -310,6 +373,65 @@ seastar::future<> runScenario01() {
     .then([this] () {
         K2LOG_I(log::k23si, "Multi partition full scan");
         return doQuery("", "", -1, false, 8, 5).discard_result();
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition full scan streamed");
+        return doQuery("", "", -1, false, 8, 5, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 2).discard_result();
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition with limit streamed");
+        return doQuery("a", "", 5, false, 5, 3, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 1).discard_result();
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition reverse full scan streamed");
+        return doQuery("", "", -1, true, 8, 5, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 2).discard_result();
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition full scan in parallel");
+        return doQuery("", "", -1, false, 8, 0, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 0, 2)
+        .then([] (std::vector<std::vector<k2::dto::SKVRecord>>&& result_set) {
+            // still in key order
+            std::optional<k2::String> last;
+            for (std::vector<k2::dto::SKVRecord>& set : result_set) {
+                for (k2::dto::SKVRecord& record : set) {
+                    record.seekField(1);
+                    k2::String range = *record.deserializeNext<k2::String>();
+                    if (last) {
+                        K2EXPECT(log::k23si, *last <= range, true);
+                    }
+                    last = range;
+                }
+            }
+        });
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition with limit in parallel");
+        return doQuery("a", "", 5, false, 5, 0, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 0, 3).discard_result();
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition reverse full scan in parallel");
+        return doQuery("", "", -1, true, 8, 0, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 0, 3).discard_result();
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition full scan with readahead");
+        return doQuery("", "", -1, false, 8, 5, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 0, 0, 2).discard_result();
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition with limit with readahead");
+        return doQuery("a", "", 5, false, 5, 3, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 0, 0, 1).discard_result();
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Multi partition full scan in parallel with readahead");
+        return doQuery("", "", -1, false, 8, 0, k2::dto::K23SIStatus::OK, k2e::Expression{},
+                       std::vector<k2::String>(), false, 0, 2, 2).discard_result();
     });
 }
 
@@ -514,10 +636,59 @@ seastar::future<> runScenario05() {
     });
 }
 
-// Query conflict cases
+// Aggregate queries. The six default records have data1 = data2 = 0..5, and the two
+// nondefault records have a null data1 and data2 = 777
 seastar::future<> runScenario06() {
     K2LOG_I(log::k23si, "runScenario06");
 
+    K2LOG_I(log::k23si, "Aggregates over all records");
+    std::vector<k2::dto::Aggregate> aggregates {
+        {.op = k2::dto::AggregateOp::COUNT, .fieldName = ""},
+        {.op = k2::dto::AggregateOp::COUNT, .fieldName = "data1"},
+        {.op = k2::dto::AggregateOp::SUM, .fieldName = "data1"},
+        {.op = k2::dto::AggregateOp::MIN, .fieldName = "data2"},
+        {.op = k2::dto::AggregateOp::MAX, .fieldName = "data2"}
+    };
+    return doAggregateQuery(std::move(aggregates))
+    .then([this] (auto&& results) {
+        K2EXPECT(log::k23si, results.size(), 5);
+        K2EXPECT(log::k23si, readAggregate<int64_t>(results[0]), 8);
+        K2EXPECT(log::k23si, readAggregate<int64_t>(results[1]), 6);
+        K2EXPECT(log::k23si, readAggregate<int64_t>(results[2]), 15);
+        K2EXPECT(log::k23si, readAggregate<int32_t>(results[3]), 0);
+        K2EXPECT(log::k23si, readAggregate<int32_t>(results[4]), 777);
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "Aggregates with filter, streamed");
+        std::vector<k2e::Value> values;
+        std::vector<k2e::Expression> exps;
+        values.emplace_back(k2e::makeValueReference("data1"));
+        values.emplace_back(k2e::makeValueLiteral<int32_t>(2));
+        k2e::Expression filter = k2e::makeExpression(k2e::Operation::GT, std::move(values), std::move(exps));
+        std::vector<k2::dto::Aggregate> aggregates {
+            {.op = k2::dto::AggregateOp::COUNT, .fieldName = ""},
+            {.op = k2::dto::AggregateOp::SUM, .fieldName = "data1"}
+        };
+        return doAggregateQuery(std::move(aggregates), k2::dto::K23SIStatus::OK, std::move(filter), 2)
+        .then([this] (auto&& results) {
+            K2EXPECT(log::k23si, results.size(), 2);
+            K2EXPECT(log::k23si, readAggregate<int64_t>(results[0]), 3);
+            K2EXPECT(log::k23si, readAggregate<int64_t>(results[1]), 12);
+        });
+    })
+    .then([this] () {
+        K2LOG_I(log::k23si, "SUM of a string field is not allowed");
+        std::vector<k2::dto::Aggregate> aggregates {
+            {.op = k2::dto::AggregateOp::SUM, .fieldName = "range"}
+        };
+        return doAggregateQuery(std::move(aggregates), k2::dto::K23SIStatus::OperationNotAllowed).discard_result();
+    });
+}
+
+// Query conflict cases
+seastar::future<> runScenario07() {
+    K2LOG_I(log::k23si, "runScenario07");
+
     K2LOG_I(log::k23si, "Starting write in range is blocked by readCache test");
     k2::K2TxnOptions options{};
     options.syncFinalize = true;
@@ -624,6 +795,134 @@ seastar::future<> runScenario06() {
     });
 }
 
+// Queries the records of the "indexed" schema with the given last name through its byName index, and checks that
+// the expected ids are returned, in the order of their first names
+seastar::future<> doIndexQuery(k2::String last, std::vector<k2::String> expectedIds) {
+    return _client.createQuery(collname, k2::dto::Schema::indexSchemaName("indexed", "byName"))
+    .then([this, last=std::move(last), expectedIds=std::move(expectedIds)] (auto&& response) mutable {
+        K2EXPECT(log::k23si, response.status.is2xxOK(), true);
+        query = std::move(response.query);
+        // prefix scan on the first indexed field
+        query.startScanRecord.serializeNext<k2::String>(last);
+        query.endScanRecord.serializeNext<k2::String>(last);
+
+        return seastar::do_with(std::vector<k2::String>(), false, std::move(expectedIds),
+        [this] (std::vector<k2::String>& ids, bool& done, std::vector<k2::String>& expectedIds) {
+            return seastar::do_until(
+                [&done] () { return done; },
+                [this, &ids, &done] () {
+                    return txn.queryIndex(query)
+                    .then([this, &ids, &done] (auto&& response) {
+                        K2EXPECT(log::k23si, response.status.is2xxOK(), true);
+                        done = response.status.is2xxOK() ? query.isDone() : true;
+                        for (auto& record : response.records) {
+                            ids.push_back(*record.template deserializeNext<k2::String>());
+                        }
+                    });
+            })
+            .then([&ids, &expectedIds] () {
+                K2EXPECT(log::k23si, ids, expectedIds);
+            });
+        });
+    });
+}
+
+// Secondary index: records are found through the index once written, a partial update of some of the fields of
+// an index is rejected, and records whose indexed fields were updated are only found under their new values
+seastar::future<> runScenario08() {
+    K2LOG_I(log::k23si, "runScenario08");
+    k2::dto::Schema schema;
+    schema.name = "indexed";
+    schema.version = 1;
+    schema.fields = std::vector<k2::dto::SchemaField> {
+            {k2::dto::FieldType::STRING, "id", false, false},
+            {k2::dto::FieldType::STRING, "first", false, false},
+            {k2::dto::FieldType::STRING, "last", false, false},
+            {k2::dto::FieldType::INT32T, "balance", false, false}
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<k2::String>{"id"});
+    schema.secondaryIndexes.push_back(k2::dto::SecondaryIndex{.name="byName", .fields={"last", "first"}});
+
+    return _client.createSchema(collname, std::move(schema))
+    .then([this] (auto&& result) {
+        K2EXPECT(log::k23si, result.status.is2xxOK(), true);
+        return _client.getSchema(collname, "indexed", 1);
+    })
+    .then([this] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        k2::K2TxnOptions options{};
+        options.syncFinalize = true;
+        return _client.beginTxn(options)
+        .then([this, schemaPtr] (k2::K2TxnHandle&& t) {
+            txn = std::move(t);
+            std::vector<seastar::future<>> write_futs;
+            std::vector<std::tuple<k2::String, k2::String, k2::String>> people = {
+                {"1", "Ann", "Smith"}, {"2", "Bob", "Smith"}, {"3", "Cal", "Jones"}};
+            for (auto& [id, first, last] : people) {
+                k2::dto::SKVRecord record(collname, schemaPtr);
+                record.serializeNext<k2::String>(id);
+                record.serializeNext<k2::String>(first);
+                record.serializeNext<k2::String>(last);
+                record.serializeNext<int32_t>(10);
+                write_futs.push_back(txn.write<k2::dto::SKVRecord>(record)
+                    .then([] (auto&& response) {
+                        K2EXPECT(log::k23si, response.status, k2::dto::K23SIStatus::Created);
+                    })
+                );
+            }
+            return seastar::when_all_succeed(write_futs.begin(), write_futs.end());
+        })
+        .then([this] () {
+            return txn.end(true);
+        })
+        .then([this] (auto&& response) {
+            K2EXPECT(log::k23si, response.status, k2::dto::K23SIStatus::OK);
+            k2::K2TxnOptions options{};
+            options.syncFinalize = true;
+            return _client.beginTxn(options);
+        })
+        .then([this] (k2::K2TxnHandle&& t) {
+            txn = std::move(t);
+            return doIndexQuery("Smith", {"1", "2"});
+        })
+        .then([this] () {
+            return doIndexQuery("Jones", {"3"});
+        })
+        .then([this, schemaPtr] () {
+            // Bob Smith becomes Bob Jones. Updating only the last name would leave the index record without the
+            // first name
+            return seastar::do_with(k2::dto::SKVRecord(collname, schemaPtr), [this] (auto& record) {
+                record.template serializeNext<k2::String>("2");
+                record.template serializeNext<k2::String>("Bob");
+                record.template serializeNext<k2::String>("Jones");
+                record.serializeNull();
+                return txn.partialUpdate(record, std::vector<k2::String>{"last"})
+                .then([this, &record] (auto&& response) {
+                    K2EXPECT(log::k23si, response.status, k2::dto::K23SIStatus::BadParameter);
+                    return txn.partialUpdate(record, std::vector<k2::String>{"first", "last"});
+                })
+                .then([] (auto&& response) {
+                    K2EXPECT(log::k23si, response.status.is2xxOK(), true);
+                });
+            });
+        })
+        .then([this] () {
+            // the stale Smith index record of Bob is left out
+            return doIndexQuery("Smith", {"1"});
+        })
+        .then([this] () {
+            return doIndexQuery("Jones", {"2", "3"});
+        })
+        .then([this] () {
+            return txn.end(true);
+        })
+        .then([] (auto&& response) {
+            K2EXPECT(log::k23si, response.status, k2::dto::K23SIStatus::OK);
+        });
+    });
+}
+
 // TODO: add test Scenario to deal with query request while change the partition map
 
 };  // class QueryTest
@@ -0,0 +1,76 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <k2/module/k23si/RecordArena.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+static Payload makePayload(size_t size, char fill) {
+    Payload p(Payload::DefaultAllocator);
+    for (size_t i = 0; i < size; ++i) {
+        p.write(fill);
+    }
+    p.seek(0);
+    return p;
+}
+
+SCENARIO("Record arena copies and tracks payloads") {
+    RecordArena arena(1024, 0.5);
+
+    auto src = makePayload(100, 'a');
+    auto copied = arena.copy(src);
+    REQUIRE(copied.getSize() == 100);
+    REQUIRE(copied == src);
+    REQUIRE(arena.slabCount() == 1);
+    REQUIRE(arena.liveBytes() == 104);
+
+    // large payloads are not placed into slabs
+    auto large = makePayload(600, 'b');
+    auto largeCopy = arena.copy(large);
+    REQUIRE(largeCopy == large);
+    REQUIRE(arena.slabCount() == 1);
+
+    // fill up the first slab and force a second one
+    std::vector<Payload> records;
+    for (int i = 0; i < 12; ++i) {
+        auto p = makePayload(100, 'c');
+        records.push_back(arena.copy(p));
+    }
+    REQUIRE(arena.slabCount() == 2);
+
+    // the current slab is never relocated
+    REQUIRE(!arena.shouldRelocate(records.back()));
+
+    // release most of the records in the first slab, which makes it sparse
+    REQUIRE(!arena.shouldRelocate(copied));
+    records.erase(records.begin(), records.begin() + 8);
+    REQUIRE(arena.shouldRelocate(copied));
+
+    // relocating moves the data into the current slab
+    auto relocated = arena.copy(copied);
+    REQUIRE(relocated == src);
+    REQUIRE(!arena.shouldRelocate(relocated));
+}
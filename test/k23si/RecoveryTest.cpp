@@ -0,0 +1,358 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <seastar/core/sleep.hh>
+
+#include <k2/dto/AssignmentManager.h>
+#include <k2/dto/K23SI.h>
+#include <k2/dto/K23SIInspect.h>
+#include <k2/dto/Collection.h>
+#include <k2/dto/ControlPlaneOracle.h>
+#include <k2/dto/MessageVerbs.h>
+#include "Log.h"
+
+namespace k2 {
+
+const char* collname = "k23si_recovery_collection";
+
+// Tests that a partition recovers the records of its transactions after a restart. The "write" phase leaves the WIs
+// of a committed and of an aborted transaction behind, which their clients were to finalize. The test script then
+// kills the node without a graceful stop and restarts it, and the "verify" phase assigns the partition again and
+// checks that the outcome of each transaction survived the restart
+class RecoveryTest {
+
+public:  // application lifespan
+    RecoveryTest() { K2LOG_I(log::k23si, "ctor");}
+    ~RecoveryTest(){ K2LOG_I(log::k23si, "dtor");}
+
+    seastar::future<> gracefulStop() {
+        K2LOG_I(log::k23si, "stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start(){
+        K2LOG_I(log::k23si, "start");
+        _cpoEndpoint = RPC().getTXEndpoint(_cpoConfigEp());
+        _makeSchema();
+
+        _testFuture = seastar::make_ready_future()
+        .then([this] {
+            if (_phase() == "write") {
+                return _createCollection().then([this] { return runWritePhase(); });
+            }
+            K2EXPECT(log::k23si, _phase(), "verify");
+            return _assignAgain().then([this] { return runVerifyPhase(); });
+        })
+        .then([this] {
+            K2LOG_I(log::k23si, "======= All tests passed ========");
+            exitcode = 0;
+        })
+        .handle_exception([this](auto exc) {
+            try {
+                std::rethrow_exception(exc);
+            } catch (RPCDispatcher::RequestTimeoutException& exc) {
+                K2LOG_E(log::k23si, "======= Test failed due to timeout ========");
+                exitcode = -1;
+            } catch (std::exception& e) {
+                K2LOG_E(log::k23si, "======= Test failed with exception [{}] ========", e.what());
+                exitcode = -1;
+            }
+        })
+        .finally([this] {
+            K2LOG_I(log::k23si, "======= Test ended ========");
+            seastar::engine().exit(exitcode);
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    int exitcode = -1;
+    ConfigVar<String> _k2ConfigEp{"k2_endpoint"};
+    ConfigVar<String> _cpoConfigEp{"cpo_endpoint"};
+    ConfigVar<String> _phase{"phase"};
+
+    std::unique_ptr<k2::TXEndpoint> _cpoEndpoint;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+
+    dto::PartitionGetter _pgetter;
+    dto::Schema _schema;
+
+    const dto::Key _committedKey{"schema", "committed", ""};
+    const dto::Key _abortedKey{"schema", "aborted", ""};
+    const dto::Key _inProgressKey{"schema", "inprogress", ""};
+
+    void _makeSchema() {
+        _schema.name = "schema";
+        _schema.version = 1;
+        _schema.fields = std::vector<dto::SchemaField> {
+                {dto::FieldType::STRING, "partition", false, false},
+                {dto::FieldType::STRING, "range", false, false},
+                {dto::FieldType::STRING, "f1", false, false},
+        };
+        _schema.setPartitionKeyFieldsByName(std::vector<String>{"partition"});
+        _schema.setRangeKeyFieldsByName(std::vector<String>{"range"});
+    }
+
+    static dto::K23SI_MTR _newMTR() {
+        // both phases run in processes of their own, so the ids come from the clock
+        auto nsecsSinceEpoch = sys_now_nsec_count();
+        return dto::K23SI_MTR{.txnid = nsecsSinceEpoch, .timestamp = dto::Timestamp(nsecsSinceEpoch, 1550647543, 1000),
+                              .priority = dto::TxnPriority::Medium};
+    }
+
+    seastar::future<> _getCollection() {
+        auto request = dto::CollectionGetRequest{.name = collname};
+        return RPC().callRPC<dto::CollectionGetRequest, dto::CollectionGetResponse>
+            (dto::Verbs::CPO_COLLECTION_GET, request, *_cpoEndpoint, 1s)
+        .then([this](auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status, Statuses::S200_OK);
+            _pgetter = dto::PartitionGetter(std::move(resp.collection));
+        });
+    }
+
+    seastar::future<> _createCollection() {
+        auto request = dto::CollectionCreateRequest{
+            .metadata{
+                .name = collname,
+                .hashScheme = dto::HashScheme::HashCRC32C,
+                .storageDriver = dto::StorageDriver::K23SI,
+                .capacity{},
+                .retentionPeriod = Duration(1h)*90*24
+            },
+            .clusterEndpoints = {_k2ConfigEp()},
+            .rangeEnds{}
+        };
+        return RPC().callRPC<dto::CollectionCreateRequest, dto::CollectionCreateResponse>
+            (dto::Verbs::CPO_COLLECTION_CREATE, request, *_cpoEndpoint, 1s)
+        .then([](auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status, Statuses::S201_Created);
+            return seastar::sleep(100ms);
+        })
+        .then([this] {
+            return _getCollection();
+        })
+        .then([this] {
+            dto::CreateSchemaRequest request{ collname, _schema };
+            return RPC().callRPC<dto::CreateSchemaRequest, dto::CreateSchemaResponse>(dto::Verbs::CPO_SCHEMA_CREATE, request, *_cpoEndpoint, 1s);
+        })
+        .then([] (auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status, Statuses::S200_OK);
+        });
+    }
+
+    // the restarted node doesn't know about the partition until the CPO assigns it again, which we do in its place
+    seastar::future<> _assignAgain() {
+        return _getCollection()
+        .then([this] {
+            K2EXPECT(log::k23si, _pgetter.collection.partitionMap.partitions.size(), 1);
+            dto::AssignmentCreateRequest assign;
+            assign.collectionMeta = _pgetter.collection.metadata;
+            assign.partition = _pgetter.collection.partitionMap.partitions[0];
+            return seastar::do_with(std::move(assign), RPC().getTXEndpoint(_k2ConfigEp()), [] (auto& assign, auto& ep) {
+                return RPC().callRPC<dto::AssignmentCreateRequest, dto::AssignmentCreateResponse>
+                    (dto::K2_ASSIGNMENT_CREATE, assign, *ep, 5s);
+            });
+        })
+        .then([this] (auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status, Statuses::S201_Created);
+            dto::K23SIPushSchemaRequest request{.collectionName = collname, .schema = _schema};
+            auto& part = _pgetter.getPartitionForKey(_committedKey);
+            return RPC().callRPC<dto::K23SIPushSchemaRequest, dto::K23SIPushSchemaResponse>
+                (dto::Verbs::K23SI_PUSH_SCHEMA, request, *part.preferredEndpoint, 1s);
+        })
+        .then([] (auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status.is2xxOK(), true);
+        });
+    }
+
+    seastar::future<Status> doWrite(const dto::Key& key, const String& value, const dto::K23SI_MTR& mtr) {
+        SKVRecord record(collname, std::make_shared<k2::dto::Schema>(_schema));
+        record.serializeNext<String>(key.partitionKey);
+        record.serializeNext<String>(key.rangeKey);
+        record.serializeNext<String>(value);
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIWriteRequest request {
+            .pvid = part.partition->pvid,
+            .collectionName = collname,
+            .mtr = mtr,
+            .trh = key,
+            .isDelete = false,
+            .designateTRH = true,
+            .rejectIfExists = false,
+            .key = key,
+            .value = std::move(record.storage),
+            .fieldsForPartialUpdate = std::vector<uint32_t>()
+        };
+        return RPC().callRPC<dto::K23SIWriteRequest, dto::K23SIWriteResponse>(dto::Verbs::K23SI_WRITE, request, *part.preferredEndpoint, 1s)
+        .then([] (auto&& response) {
+            return std::move(std::get<0>(response));
+        });
+    }
+
+    // ends the transaction on behalf of a client which finalizes on its own, and then never does
+    seastar::future<Status> doEnd(const dto::Key& trh, const dto::K23SI_MTR& mtr, bool isCommit) {
+        auto& part = _pgetter.getPartitionForKey(trh);
+        dto::K23SITxnEndRequest request;
+        request.pvid = part.partition->pvid;
+        request.collectionName = collname;
+        request.mtr = mtr;
+        request.key = trh;
+        request.action = isCommit ? dto::EndAction::Commit : dto::EndAction::Abort;
+        request.writeKeys = {trh};
+        request.clientFinalize = true;
+        request.timeToFinalize = 1h;
+        return RPC().callRPC<dto::K23SITxnEndRequest, dto::K23SITxnEndResponse>(dto::Verbs::K23SI_TXN_END, request, *part.preferredEndpoint, 1s)
+        .then([] (auto&& response) {
+            return std::move(std::get<0>(response));
+        });
+    }
+
+    seastar::future<std::tuple<Status, String>> doRead(const dto::Key& key) {
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIReadRequest request {
+            .pvid = part.partition->pvid,
+            .collectionName = collname,
+            .mtr = _newMTR(),
+            .key = key
+        };
+        return RPC().callRPC<dto::K23SIReadRequest, dto::K23SIReadResponse>
+            (dto::Verbs::K23SI_READ, request, *part.preferredEndpoint, 1s)
+        .then([this] (auto&& response) {
+            auto& [status, resp] = response;
+            if (!status.is2xxOK()) {
+                return std::make_tuple(std::move(status), String());
+            }
+            SKVRecord record(collname, std::make_shared<k2::dto::Schema>(_schema), std::move(resp.value), true);
+            record.seekField(2);
+            return std::make_tuple(std::move(status), *(record.deserializeNext<String>()));
+        });
+    }
+
+    seastar::future<std::vector<dto::DataRecord>> doRequestRecords(const dto::Key& key) {
+        auto& part = _pgetter.getPartitionForKey(key);
+        dto::K23SIInspectRecordsRequest request{.pvid = part.partition->pvid, .collectionName = collname, .key = key};
+        return RPC().callRPC<dto::K23SIInspectRecordsRequest, dto::K23SIInspectRecordsResponse>
+            (dto::Verbs::K23SI_INSPECT_RECORDS, request, *part.preferredEndpoint, 1s)
+        .then([] (auto&& response) {
+            return std::move(std::get<1>(response).records);
+        });
+    }
+
+public: // tests
+
+seastar::future<> runWritePhase() {
+    K2LOG_I(log::k23si, "Write phase: transactions which end without being finalized");
+    return seastar::do_with(_newMTR(), [this] (auto& mtr) {
+        return doWrite(_committedKey, "committed", mtr)
+        .then([this, &mtr] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+            return doEnd(_committedKey, mtr, true);
+        })
+        .then([] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+        });
+    })
+    .then([this] {
+        return seastar::do_with(_newMTR(), [this] (auto& mtr) {
+            return doWrite(_abortedKey, "aborted", mtr)
+            .then([this, &mtr] (Status&& status) {
+                K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+                return doEnd(_abortedKey, mtr, false);
+            })
+            .then([] (Status&& status) {
+                K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+            });
+        });
+    })
+    .then([this] {
+        // this one is still running when the node goes down
+        return doWrite(_inProgressKey, "inprogress", _newMTR())
+        .then([] (Status&& status) {
+            K2EXPECT(log::k23si, status, dto::K23SIStatus::Created);
+        });
+    })
+    .then([this] {
+        return doRequestRecords(_committedKey);
+    })
+    .then([this] (auto&& records) {
+        // nobody finalized the committed transaction
+        K2EXPECT(log::k23si, records.size(), 1);
+        K2EXPECT(log::k23si, records[0].status, dto::DataRecord::WriteIntent);
+        return doRequestRecords(_abortedKey);
+    })
+    .then([] (auto&& records) {
+        K2EXPECT(log::k23si, records.size(), 1);
+        K2EXPECT(log::k23si, records[0].status, dto::DataRecord::WriteIntent);
+    });
+}
+
+seastar::future<> runVerifyPhase() {
+    K2LOG_I(log::k23si, "Verify phase: the transactions have the same outcome after the restart");
+    return doRead(_committedKey)
+    .then([this] (auto&& result) {
+        // the read pushes the WI if recovery hasn't finalized it yet. The TRH knows the txn committed
+        auto& [status, value] = result;
+        K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+        K2EXPECT(log::k23si, value, "committed");
+        return doRead(_abortedKey);
+    })
+    .then([this] (auto&& result) {
+        auto& [status, value] = result;
+        K2EXPECT(log::k23si, status, dto::K23SIStatus::KeyNotFound);
+        // the record of a transaction which didn't end isn't persisted, so the push aborts it
+        return doRead(_inProgressKey);
+    })
+    .then([this] (auto&& result) {
+        auto& [status, value] = result;
+        K2EXPECT(log::k23si, status, dto::K23SIStatus::KeyNotFound);
+        // the recovered records are finalized in the background
+        return seastar::sleep(500ms);
+    })
+    .then([this] {
+        return doRequestRecords(_committedKey);
+    })
+    .then([] (auto&& records) {
+        K2EXPECT(log::k23si, records.size(), 1);
+        K2EXPECT(log::k23si, records[0].status, dto::DataRecord::Committed);
+    });
+}
+
+};  // class RecoveryTest
+} // ns k2
+
+int main(int argc, char** argv) {
+    k2::App app("RecoveryTest");
+    app.addOptions()("k2_endpoint", bpo::value<k2::String>(), "The endpoint of the k2 core which holds the collection");
+    app.addOptions()("cpo_endpoint", bpo::value<k2::String>(), "The endpoint of the CPO");
+    app.addOptions()("phase", bpo::value<k2::String>(), "The phase of the test to run: write, or verify after a restart");
+    app.addApplet<k2::RecoveryTest>();
+    return app.start(argc, argv);
+}
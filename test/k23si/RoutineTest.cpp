@@ -0,0 +1,264 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <k2/assignmentManager/AssignmentManager.h>
+#include <k2/collectionMetadataCache/CollectionMetadataCache.h>
+#include <k2/partitionManager/PartitionManager.h>
+#include <k2/module/k23si/client/k23si_client.h>
+#include <k2/module/k23si/routines/TxnRoutineService.h>
+#include <seastar/core/sleep.hh>
+using namespace k2;
+#include "Log.h"
+const char* collname = "k23si_routine_collection";
+
+// The routines are compiled into the node, so the test runs as a node of its own, which hosts the collection and
+// the routine service along with the test. The schema is set up by the test before any routine runs
+thread_local std::shared_ptr<dto::Schema> counterSchema;
+
+// Adds one to the counter under the key in the params, and returns the new count. The second param tells the
+// routine whether to commit its transaction
+static TxnRoutines::Registrar incrementRoutine("test.increment", [] (K2TxnHandle& txn, Payload& params, Payload& result) {
+    String key;
+    bool commit = false;
+    if (!params.read(key) || !params.read(commit)) {
+        return seastar::make_exception_future<bool>(std::runtime_error("bad params"));
+    }
+    dto::SKVRecord record(collname, counterSchema);
+    record.serializeNext<String>(key);
+    record.serializeNext<String>("");
+    return txn.read<dto::SKVRecord>(std::move(record))
+    .then([&txn, &result, key, commit] (ReadResult<dto::SKVRecord>&& response) {
+        int64_t count = 0;
+        if (response.status.is2xxOK()) {
+            response.value.seekField(2);
+            count = *(response.value.deserializeNext<int64_t>());
+        }
+        else if (response.status != dto::K23SIStatus::KeyNotFound) {
+            return seastar::make_exception_future<bool>(std::runtime_error(response.status.message));
+        }
+        ++count;
+        result.write(count);
+        dto::SKVRecord record(collname, counterSchema);
+        record.serializeNext<String>(key);
+        record.serializeNext<String>("");
+        record.serializeNext<int64_t>(count);
+        return txn.write<dto::SKVRecord>(record)
+        .then([commit] (WriteResult&& response) {
+            if (!response.status.is2xxOK()) {
+                return seastar::make_exception_future<bool>(std::runtime_error(response.status.message));
+            }
+            return seastar::make_ready_future<bool>(commit);
+        });
+    });
+});
+
+class RoutineTest {
+
+public:  // application lifespan
+    RoutineTest() : _client(_makeClientConfig()) { K2LOG_I(log::k23si, "ctor");}
+    ~RoutineTest(){ K2LOG_I(log::k23si, "dtor");}
+
+    // required for seastar::distributed interface
+    seastar::future<> gracefulStop() {
+        K2LOG_I(log::k23si, "stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start(){
+        K2LOG_I(log::k23si, "start");
+
+        _testTimer.set_callback([this] {
+            _testFuture = seastar::make_ready_future()
+            .then([this] () {
+                return _client.start();
+            })
+            .then([this] {
+                K2LOG_I(log::k23si, "Creating test collection...");
+                return _client.makeCollection(collname);
+            })
+            .then([](auto&& status) {
+                K2EXPECT(log::k23si, status.is2xxOK(), true);
+            })
+            .then([this] () {
+                dto::Schema schema;
+                schema.name = "schema";
+                schema.version = 1;
+                schema.fields = std::vector<dto::SchemaField> {
+                        {dto::FieldType::STRING, "partition", false, false},
+                        {dto::FieldType::STRING, "range", false, false},
+                        {dto::FieldType::INT64T, "count", false, false},
+                };
+
+                schema.setPartitionKeyFieldsByName(std::vector<String>{"partition"});
+                schema.setRangeKeyFieldsByName(std::vector<String> {"range"});
+                counterSchema = std::make_shared<dto::Schema>(schema);
+
+                return _client.createSchema(collname, std::move(schema));
+            })
+            .then([] (auto&& result) {
+                K2EXPECT(log::k23si, result.status.is2xxOK(), true);
+            })
+            .then([this] { return runScenario01(); })
+            .then([this] { return runScenario02(); })
+            .then([this] { return runScenario03(); })
+            .then([this] {
+                K2LOG_I(log::k23si, "======= All tests passed ========");
+                exitcode = 0;
+            })
+            .handle_exception([this](auto exc) {
+                try {
+                    std::rethrow_exception(exc);
+                } catch (std::exception& e) {
+                    K2LOG_E(log::k23si, "======= Test failed with exception [{}] ========", e.what());
+                    exitcode = -1;
+                } catch (...) {
+                    K2LOG_E(log::k23si, "Test failed with unknown exception");
+                    exitcode = -1;
+                }
+            })
+            .finally([this] {
+                K2LOG_I(log::k23si, "======= Test ended ========");
+                seastar::engine().exit(exitcode);
+            });
+        });
+
+        _testTimer.arm(0ms);
+        return seastar::make_ready_future();
+    }
+
+private:
+    static K23SIClientConfig _makeClientConfig() {
+        K23SIClientConfig config;
+        // the collection metadata cache of the node receives the changes pushed by the CPO
+        config.subscribeCollectionChanges = false;
+        return config;
+    }
+
+    static dto::Key _counterKey(const String& key) {
+        return dto::Key{.schemaName = "schema", .partitionKey = key, .rangeKey = ""};
+    }
+
+    // runs test.increment on the counter, and returns the status, whether the routine committed, and the count
+    seastar::future<std::tuple<Status, bool, int64_t>> _increment(const String& key, bool commit) {
+        Payload params(Payload::DefaultAllocator);
+        params.write(key);
+        params.write(commit);
+        return _client.runRoutine(collname, _counterKey(key), "test.increment", std::move(params))
+        .then([] (auto&& response) {
+            auto& [status, resp] = response;
+            int64_t count = 0;
+            if (status.is2xxOK()) {
+                resp.result.seek(0);
+                K2EXPECT(log::k23si, resp.result.read(count), true);
+            }
+            return std::make_tuple(std::move(status), resp.committed, count);
+        });
+    }
+
+    int exitcode = -1;
+
+    seastar::timer<> _testTimer;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+
+    K23SIClient _client;
+
+public: // tests
+
+// The routine runs its transaction on the node, and its result comes back to the caller
+seastar::future<> runScenario01() {
+    K2LOG_I(log::k23si, "Scenario 01: run a routine twice");
+    return _increment("counter01", true)
+    .then([this] (auto&& result) {
+        auto& [status, committed, count] = result;
+        K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+        K2EXPECT(log::k23si, committed, true);
+        K2EXPECT(log::k23si, count, 1);
+        return _increment("counter01", true);
+    })
+    .then([] (auto&& result) {
+        auto& [status, committed, count] = result;
+        K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+        K2EXPECT(log::k23si, committed, true);
+        K2EXPECT(log::k23si, count, 2);
+    });
+}
+
+// A routine which chooses to abort returns its result, but none of its writes stick
+seastar::future<> runScenario02() {
+    K2LOG_I(log::k23si, "Scenario 02: a routine which aborts its transaction");
+    return _increment("counter02", true)
+    .then([this] (auto&& result) {
+        auto& [status, committed, count] = result;
+        K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+        K2EXPECT(log::k23si, count, 1);
+        return _increment("counter02", false);
+    })
+    .then([this] (auto&& result) {
+        auto& [status, committed, count] = result;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        K2EXPECT(log::k23si, committed, false);
+        K2EXPECT(log::k23si, count, 2);
+        return _increment("counter02", true);
+    })
+    .then([] (auto&& result) {
+        auto& [status, committed, count] = result;
+        K2EXPECT(log::k23si, status, dto::K23SIStatus::OK);
+        K2EXPECT(log::k23si, committed, true);
+        K2EXPECT(log::k23si, count, 2);
+    });
+}
+
+seastar::future<> runScenario03() {
+    K2LOG_I(log::k23si, "Scenario 03: a routine which isn't registered");
+    return _client.runRoutine(collname, _counterKey("counter03"), "test.nosuchroutine", Payload(Payload::DefaultAllocator))
+    .then([] (auto&& response) {
+        auto& [status, resp] = response;
+        K2EXPECT(log::k23si, status, Statuses::S404_Not_Found);
+        K2EXPECT(log::k23si, resp.committed, false);
+    });
+}
+
+};
+
+int main(int argc, char** argv) {
+    App app("RoutineTest");
+    app.addOptions()
+        ("tcp_remotes", bpo::value<std::vector<String>>()->multitoken()->default_value(std::vector<String>()), "A list(space-delimited) of endpoints to assign in the test collection")
+        ("tso_endpoint", bpo::value<String>(), "URL of Timestamp Oracle (TSO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("cpo", bpo::value<String>(), "URL of Control Plane Oracle (CPO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("k23si_cpo_endpoint", bpo::value<String>(), "the endpoint for k2 CPO service")
+        ("k23si_persistence_endpoints", bpo::value<std::vector<String>>()->multitoken()->default_value(std::vector<String>()), "A space-delimited list of k2 persistence endpoints, each core will pick one endpoint");
+    // the applets of a nodepool which the partition and the routines need
+    app.addApplet<TSO_ClientLib>();
+    app.addApplet<CollectionMetadataCache>();
+    app.addApplet<AssignmentManager>();
+    app.addApplet<PartitionManager>();
+    app.addApplet<TxnRoutineService>();
+    app.addApplet<RoutineTest>();
+    app.startAfter<AssignmentManager, PartitionManager>();
+    // the collection is assigned to this node, and the routines run on it
+    app.startAfter<RoutineTest, AssignmentManager, TxnRoutineService>();
+    return app.start(argc, argv);
+}
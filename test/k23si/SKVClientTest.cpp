@@ -84,6 +84,11 @@ public:  // application lifespan
             .then([this] { return runScenario06(); })
             .then([this] { return runScenario07(); })
             .then([this] { return runScenario08(); })
+            .then([this] { return runScenario09(); })
+            .then([this] { return runScenario10(); })
+            .then([this] { return runScenario11(); })
+            .then([this] { return runScenario12(); })
+            .then([this] { return runScenario13(); })
             .then([this] {
                 K2LOG_I(log::k23si, "======= All tests passed ========");
                 exitcode = 0;
@@ -1118,6 +1123,525 @@ seastar::future<> runScenario08() {
         });
 }
 
+// Bulk ingest: refused in a collection which is not loading, and readable by transactions once ingested
+seastar::future<> runScenario09() {
+    K2LOG_I(log::k23si, "Scenario 09");
+    const char* bulkcoll = "k23si_bulk_collection";
+    return _client.getSchema(collname, "schema", 1)
+    .then([this] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        dto::SKVRecord record(collname, schemaPtr);
+        record.serializeNext<String>("partkey09");
+        record.serializeNext<String>("rangekey09");
+        record.serializeNext<String>("data1");
+        record.serializeNext<String>("data2");
+        return seastar::do_with(std::vector<dto::SKVRecord>{}, [this, record=std::move(record)] (auto& records) mutable {
+            records.push_back(std::move(record));
+            return _client.bulkIngest(records);
+        });
+    })
+    .then([] (Status&& status) {
+        K2EXPECT(log::k23si, status, dto::K23SIStatus::OperationNotAllowed);
+    })
+    .then([this, bulkcoll] {
+        dto::CollectionMetadata metadata{
+            .name = bulkcoll,
+            .hashScheme = dto::HashScheme::HashCRC32C,
+            .storageDriver = dto::StorageDriver::K23SI,
+            .capacity = {},
+            .retentionPeriod = Duration(_client.retention_window()),
+            .heartbeatDeadline = Duration(0),
+            .bulkLoad = true
+        };
+        return _client.makeCollection(std::move(metadata), std::vector<String>(_client._tcpRemotes()));
+    })
+    .then([this, bulkcoll] (auto&& status) {
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        dto::Schema schema;
+        schema.name = "schema";
+        schema.version = 1;
+        schema.fields = std::vector<dto::SchemaField> {
+                {dto::FieldType::STRING, "partition", false, false},
+                {dto::FieldType::STRING, "range", false, false},
+                {dto::FieldType::STRING, "f1", false, false},
+        };
+        schema.setPartitionKeyFieldsByName(std::vector<String>{"partition"});
+        schema.setRangeKeyFieldsByName(std::vector<String> {"range"});
+        return _client.createSchema(bulkcoll, std::move(schema));
+    })
+    .then([this, bulkcoll] (auto&& result) {
+        K2EXPECT(log::k23si, result.status.is2xxOK(), true);
+        return _client.getSchema(bulkcoll, "schema", 1);
+    })
+    .then([this, bulkcoll] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        std::vector<dto::SKVRecord> records;
+        for (int i = 0; i < 100; ++i) {
+            dto::SKVRecord record(bulkcoll, schemaPtr);
+            record.serializeNext<String>("partkey" + std::to_string(i));
+            record.serializeNext<String>("rangekey");
+            record.serializeNext<String>("value" + std::to_string(i));
+            records.push_back(std::move(record));
+        }
+        return seastar::do_with(std::move(records), schemaPtr, [this, bulkcoll] (auto& records, auto& schemaPtr) {
+            return _client.bulkIngest(records)
+            .then([this] (Status&& status) {
+                K2EXPECT(log::k23si, status.is2xxOK(), true);
+                K2TxnOptions options{};
+                options.syncFinalize = true;
+                return _client.beginTxn(options);
+            })
+            .then([bulkcoll, &schemaPtr] (K2TxnHandle&& txn) {
+                return seastar::do_with(std::move(txn), [bulkcoll, &schemaPtr] (auto& txn) {
+                    dto::SKVRecord key(bulkcoll, schemaPtr);
+                    key.serializeNext<String>("partkey42");
+                    key.serializeNext<String>("rangekey");
+                    return txn.read(std::move(key))
+                    .then([] (auto&& result) {
+                        K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                        result.value.template deserializeNext<String>();
+                        result.value.template deserializeNext<String>();
+                        K2EXPECT(log::k23si, *result.value.template deserializeNext<String>(), "value42");
+                    })
+                    .then([&txn] {
+                        return txn.end(true);
+                    })
+                    .then([] (auto&& response) {
+                        K2EXPECT(log::k23si, response.status, dto::K23SIStatus::OK);
+                    });
+                });
+            });
+        });
+    });
+}
+
+// Field operations through updateFields: the results come back in the written record, and are read back from the
+// transaction's cache and after commit
+seastar::future<> runScenario10() {
+    K2LOG_I(log::k23si, "Scenario 10");
+    dto::Schema schema;
+    schema.name = "counter";
+    schema.version = 1;
+    schema.fields = std::vector<dto::SchemaField> {
+            {dto::FieldType::STRING, "partition", false, false},
+            {dto::FieldType::STRING, "range", false, false},
+            {dto::FieldType::INT64T, "count", false, false},
+            {dto::FieldType::STRING, "name", false, false},
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<String>{"partition"});
+    schema.setRangeKeyFieldsByName(std::vector<String> {"range"});
+
+    return _client.createSchema(collname, std::move(schema))
+    .then([this] (auto&& result) {
+        K2EXPECT(log::k23si, result.status.is2xxOK(), true);
+        return _client.getSchema(collname, "counter", 1);
+    })
+    .then([this] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        K2TxnOptions options{};
+        options.syncFinalize = true;
+        return seastar::do_with(std::move(schemaPtr), K2TxnHandle(), K2TxnHandle(),
+            [this, options] (auto& schemaPtr, auto& setup, auto& txn) {
+            auto makeRecord = [&schemaPtr] (String pkey, std::optional<int64_t> count, std::optional<String> name) {
+                dto::SKVRecord record(collname, schemaPtr);
+                record.serializeNext<String>(pkey);
+                record.serializeNext<String>("rangekey10");
+                if (count) {
+                    record.serializeNext<int64_t>(*count);
+                } else {
+                    record.serializeNull();
+                }
+                if (name) {
+                    record.serializeNext<String>(*name);
+                } else {
+                    record.serializeNull();
+                }
+                return record;
+            };
+            auto expectRecord = [] (dto::SKVRecord& record, int64_t count, String name) {
+                record.seekField(2);
+                K2EXPECT(log::k23si, *record.deserializeNext<int64_t>(), count);
+                K2EXPECT(log::k23si, *record.deserializeNext<String>(), name);
+            };
+            return _client.beginTxn(options)
+            .then([&setup, makeRecord] (K2TxnHandle&& handle) {
+                setup = std::move(handle);
+                return seastar::do_with(makeRecord("partkey10", 10, "a"), [&setup] (auto& record) {
+                    return setup.write(record);
+                });
+            })
+            .then([&setup] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                return setup.end(true);
+            })
+            .then([this, options] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                return _client.beginTxn(options);
+            })
+            .then([&txn, makeRecord] (K2TxnHandle&& handle) {
+                txn = std::move(handle);
+                return seastar::do_with(makeRecord("partkey10", 5, std::nullopt), [&txn] (auto& record) {
+                    return txn.updateFields(record, {{2, dto::FieldOperation::Add}});
+                });
+            })
+            .then([&txn, makeRecord, expectRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                expectRecord(result.value, 15, "a");
+                return seastar::do_with(makeRecord("partkey10", 3, std::nullopt), [&txn] (auto& record) {
+                    return txn.updateFields(record, {{2, dto::FieldOperation::Min}});
+                });
+            })
+            .then([&txn, makeRecord, expectRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                expectRecord(result.value, 3, "a");
+                return seastar::do_with(makeRecord("partkey10", 7, std::nullopt), [&txn] (auto& record) {
+                    return txn.updateFields(record, {{2, dto::FieldOperation::Max}});
+                });
+            })
+            .then([&txn, makeRecord, expectRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                expectRecord(result.value, 7, "a");
+                return seastar::do_with(makeRecord("partkey10", std::nullopt, "b"), makeRecord("partkey10", std::nullopt, "a"),
+                    [&txn] (auto& record, auto& expected) {
+                    return txn.updateFields(record, {{3, dto::FieldOperation::CompareAndSet}}, {}, &expected);
+                });
+            })
+            .then([&txn, makeRecord, expectRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                expectRecord(result.value, 7, "b");
+                // the name isn't "a" anymore
+                return seastar::do_with(makeRecord("partkey10", std::nullopt, "c"), makeRecord("partkey10", std::nullopt, "a"),
+                    [&txn] (auto& record, auto& expected) {
+                    return txn.updateFields(record, {{3, dto::FieldOperation::CompareAndSet}}, {}, &expected);
+                });
+            })
+            .then([&txn, makeRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::ConditionFailed);
+                // arithmetic on a string field is refused by the server
+                return seastar::do_with(makeRecord("partkey10", std::nullopt, "d"), [&txn] (auto& record) {
+                    return txn.updateFields(record, {{3, dto::FieldOperation::Add}});
+                });
+            })
+            .then([&txn, makeRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::BadParameter);
+                // operations on key fields are refused by the client
+                return seastar::do_with(makeRecord("partkey10", std::nullopt, std::nullopt), [&txn] (auto& record) {
+                    return txn.updateFields(record, {{0, dto::FieldOperation::Max}});
+                });
+            })
+            .then([&txn, makeRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::BadParameter);
+                return seastar::do_with(makeRecord("missing10", 1, std::nullopt), [&txn] (auto& record) {
+                    return txn.updateFields(record, {{2, dto::FieldOperation::Add}});
+                });
+            })
+            .then([&txn, makeRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::KeyNotFound);
+                // the record as written was cached for reads in the transaction
+                return txn.read(makeRecord("partkey10", std::nullopt, std::nullopt));
+            })
+            .then([&txn, expectRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                expectRecord(result.value, 7, "b");
+                return txn.end(true);
+            })
+            .then([this, options] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                return _client.beginTxn(options);
+            })
+            .then([&setup, makeRecord] (K2TxnHandle&& handle) {
+                setup = std::move(handle);
+                return setup.read(makeRecord("partkey10", std::nullopt, std::nullopt));
+            })
+            .then([&setup, expectRecord] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                expectRecord(result.value, 7, "b");
+                return setup.end(true);
+            })
+            .then([] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+            });
+        });
+    });
+}
+
+// readMany of keys across partitions: the results come back in the order of the keys, with the keys not found
+// reported as such. Without a partition map the keys all go to the partition of the first key, and the ones it
+// doesn't own are retried after the RefreshCollection
+seastar::future<> runScenario11() {
+    K2LOG_I(log::k23si, "Scenario 11");
+    return _client.getSchema(collname, "schema", 1)
+    .then([this] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        K2TxnOptions options{};
+        options.syncFinalize = true;
+        return seastar::do_with(std::move(schemaPtr), std::vector<dto::SKVRecord>{}, K2TxnHandle(),
+            [this, options] (auto& schemaPtr, auto& records, auto& txn) {
+            for (int i = 0; i < 6; ++i) {
+                dto::SKVRecord record(collname, schemaPtr);
+                record.serializeNext<String>("partkey11_" + std::to_string(i));
+                record.serializeNext<String>("rangekey11");
+                record.serializeNext<String>("value" + std::to_string(i));
+                record.serializeNext<String>("data");
+                records.push_back(std::move(record));
+            }
+            // the keys to read, in mixed order and with a missing key. -1 is the missing key
+            std::vector<int> order{4, -1, 0, 5, 2, 1, 3};
+            auto makeKeys = [&schemaPtr, &records, order] {
+                std::vector<dto::Key> keys;
+                for (int i : order) {
+                    if (i < 0) {
+                        dto::SKVRecord missing(collname, schemaPtr);
+                        missing.serializeNext<String>("missing11");
+                        missing.serializeNext<String>("rangekey11");
+                        keys.push_back(missing.getKey());
+                    } else {
+                        keys.push_back(records[i].getKey());
+                    }
+                }
+                return keys;
+            };
+            auto expectResults = [order] (std::vector<ReadResult<dto::SKVRecord>>& results) {
+                K2EXPECT(log::k23si, results.size(), order.size());
+                for (size_t i = 0; i < order.size(); ++i) {
+                    if (order[i] < 0) {
+                        K2EXPECT(log::k23si, results[i].status, dto::K23SIStatus::KeyNotFound);
+                        continue;
+                    }
+                    K2EXPECT(log::k23si, results[i].status, dto::K23SIStatus::OK);
+                    results[i].value.seekField(2);
+                    auto value = results[i].value.deserializeNext<String>();
+                    K2EXPECT(log::k23si, *value, "value" + std::to_string(order[i]));
+                }
+            };
+            return _client.beginTxn(options)
+            .then([&txn, &records] (K2TxnHandle&& handle) {
+                txn = std::move(handle);
+                return seastar::do_for_each(records, [&txn] (dto::SKVRecord& record) {
+                    return txn.write(record)
+                    .then([] (auto&& result) {
+                        K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                    });
+                });
+            })
+            .then([&txn] {
+                return txn.end(true);
+            })
+            .then([this, &records, options] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                // the keys have to span partitions for the reads to be grouped
+                std::set<uint64_t> partitions;
+                auto& getter = _client.cpo_client.collections[collname];
+                for (auto& record : records) {
+                    partitions.insert(getter.getPartitionForKey(record.getKey()).partition->pvid.id);
+                }
+                K2EXPECT(log::k23si, partitions.size() > 1, true);
+                // drop the partition map so that the first readMany goes out without it
+                _client.cpo_client.collections.erase(collname);
+                return _client.beginTxn(options);
+            })
+            .then([&txn, makeKeys] (K2TxnHandle&& handle) {
+                txn = std::move(handle);
+                return txn.readMany(makeKeys(), collname);
+            })
+            .then([this, &txn, expectResults] (auto&& results) {
+                expectResults(results);
+                auto found = _client.cpo_client.collections.find(collname) != _client.cpo_client.collections.end();
+                K2EXPECT(log::k23si, found, true);
+                return txn.end(true);
+            })
+            .then([this, options] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                return _client.beginTxn(options);
+            })
+            .then([&txn, makeKeys] (K2TxnHandle&& handle) {
+                // and again with the partition map cached
+                txn = std::move(handle);
+                return txn.readMany(makeKeys(), collname);
+            })
+            .then([&txn, expectResults] (auto&& results) {
+                expectResults(results);
+                return txn.end(true);
+            })
+            .then([] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+            });
+        });
+    });
+}
+
+// writeMany of records across partitions: the results come back in the order of the records, with or without a
+// partition map, and conditional writes fail only for the records which exist
+seastar::future<> runScenario12() {
+    K2LOG_I(log::k23si, "Scenario 12");
+    return _client.getSchema(collname, "schema", 1)
+    .then([this] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        K2TxnOptions options{};
+        options.syncFinalize = true;
+        return seastar::do_with(std::move(schemaPtr), std::vector<dto::SKVRecord>{}, K2TxnHandle(),
+            [this, options] (auto& schemaPtr, auto& records, auto& txn) {
+            auto makeRecord = [&schemaPtr] (int i, String value) {
+                dto::SKVRecord record(collname, schemaPtr);
+                record.serializeNext<String>("partkey12_" + std::to_string(i));
+                record.serializeNext<String>("rangekey12");
+                record.serializeNext<String>(value);
+                record.serializeNext<String>("data");
+                return record;
+            };
+            for (int i = 0; i < 6; ++i) {
+                records.push_back(makeRecord(i, "value" + std::to_string(i)));
+            }
+            // drop the partition map so that the first writeMany goes out without it
+            _client.cpo_client.collections.erase(collname);
+            return _client.beginTxn(options)
+            .then([&txn, &records] (K2TxnHandle&& handle) {
+                txn = std::move(handle);
+                return txn.writeMany(records);
+            })
+            .then([this, &txn, &records] (auto&& results) {
+                K2EXPECT(log::k23si, results.size(), records.size());
+                for (auto& result : results) {
+                    K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                }
+                std::set<uint64_t> partitions;
+                auto& getter = _client.cpo_client.collections[collname];
+                for (auto& record : records) {
+                    partitions.insert(getter.getPartitionForKey(record.getKey()).partition->pvid.id);
+                }
+                K2EXPECT(log::k23si, partitions.size() > 1, true);
+                return txn.end(true);
+            })
+            .then([this, options] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                return _client.beginTxn(options);
+            })
+            .then([&txn, &records, makeRecord] (K2TxnHandle&& handle) {
+                txn = std::move(handle);
+                // the first record is new so that the TRH is created by a successful write
+                records.clear();
+                records.push_back(makeRecord(6, "new6"));
+                records.push_back(makeRecord(3, "new3"));
+                records.push_back(makeRecord(7, "new7"));
+                records.push_back(makeRecord(0, "new0"));
+                return txn.writeMany(records, false, true);
+            })
+            .then([&txn] (auto&& results) {
+                K2EXPECT(log::k23si, results.size(), 4);
+                K2EXPECT(log::k23si, results[0].status, dto::K23SIStatus::Created);
+                K2EXPECT(log::k23si, results[1].status, dto::K23SIStatus::ConditionFailed);
+                K2EXPECT(log::k23si, results[2].status, dto::K23SIStatus::Created);
+                K2EXPECT(log::k23si, results[3].status, dto::K23SIStatus::ConditionFailed);
+                return txn.end(true);
+            })
+            .then([this, options] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                return _client.beginTxn(options);
+            })
+            .then([&txn, &records] (K2TxnHandle&& handle) {
+                txn = std::move(handle);
+                std::vector<dto::Key> keys;
+                for (auto& record : records) {
+                    keys.push_back(record.getKey());
+                }
+                return txn.readMany(std::move(keys), collname);
+            })
+            .then([&txn] (auto&& results) {
+                std::vector<String> expected{"new6", "value3", "new7", "value0"};
+                K2EXPECT(log::k23si, results.size(), expected.size());
+                for (size_t i = 0; i < expected.size(); ++i) {
+                    K2EXPECT(log::k23si, results[i].status, dto::K23SIStatus::OK);
+                    results[i].value.seekField(2);
+                    auto value = results[i].value.template deserializeNext<String>();
+                    K2EXPECT(log::k23si, *value, expected[i]);
+                }
+                return txn.end(true);
+            })
+            .then([] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+            });
+        });
+    });
+}
+
+// Pipelined writes in flight together across partitions. The transaction commits once they are durable, waited for
+// by the client or by the TRH with a parallel commit, and the records are read back after the commit
+seastar::future<> runScenario13() {
+    K2LOG_I(log::k23si, "Scenario 13");
+    return _client.getSchema(collname, "schema", 1)
+    .then([this] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        return seastar::do_with(std::move(schemaPtr), [this] (auto& schemaPtr) {
+            return pipelinedTxn(schemaPtr, "partkey13_client_", false)
+            .then([this, &schemaPtr] {
+                return pipelinedTxn(schemaPtr, "partkey13_parallel_", true);
+            });
+        });
+    });
+}
+
+seastar::future<> pipelinedTxn(std::shared_ptr<dto::Schema> schemaPtr, String prefix, bool parallelCommit) {
+    K2TxnOptions options{};
+    options.syncFinalize = true;
+    options.pipelineWrites = true;
+    options.parallelCommit = parallelCommit;
+    std::vector<dto::SKVRecord> records;
+    for (int i = 0; i < 8; ++i) {
+        dto::SKVRecord record(collname, schemaPtr);
+        record.serializeNext<String>(prefix + std::to_string(i));
+        record.serializeNext<String>("rangekey13");
+        record.serializeNext<String>("value" + std::to_string(i));
+        record.serializeNext<String>("data");
+        records.push_back(std::move(record));
+    }
+    return seastar::do_with(std::move(records), K2TxnHandle(), [this, options] (auto& records, auto& txn) {
+        return _client.beginTxn(options)
+        .then([&txn, &records] (K2TxnHandle&& handle) {
+            txn = std::move(handle);
+            // the writes after the first are sent without waiting for the ones before them
+            return seastar::do_for_each(records, [&txn] (dto::SKVRecord& record) {
+                return txn.writeAsync(record);
+            });
+        })
+        .then([&txn] {
+            return txn.end(true);
+        })
+        .then([this] (auto&& result) {
+            K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+            K2TxnOptions options{};
+            options.syncFinalize = true;
+            return _client.beginTxn(options);
+        })
+        .then([&txn, &records] (K2TxnHandle&& handle) {
+            txn = std::move(handle);
+            std::vector<dto::Key> keys;
+            for (auto& record : records) {
+                keys.push_back(record.getKey());
+            }
+            return txn.readMany(std::move(keys), collname);
+        })
+        .then([&txn, &records] (auto&& results) {
+            K2EXPECT(log::k23si, results.size(), records.size());
+            for (size_t i = 0; i < results.size(); ++i) {
+                K2EXPECT(log::k23si, results[i].status, dto::K23SIStatus::OK);
+                results[i].value.seekField(2);
+                auto value = results[i].value.template deserializeNext<String>();
+                K2EXPECT(log::k23si, *value, "value" + std::to_string(i));
+            }
+            return txn.end(true);
+        })
+        .then([] (auto&& result) {
+            K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+        });
+    });
+}
+
 };  // class SKVClientTest
 
 int main(int argc, char** argv) {
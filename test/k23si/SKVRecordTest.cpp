@@ -23,6 +23,8 @@ Copyright(c) 2020 Futurewei Cloud
 
 #define CATCH_CONFIG_MAIN
 
+#include <k2/dto/Columnar.h>
+#include <k2/dto/OrderBy.h>
 #include <k2/dto/SKVRecord.h>
 
 #include "catch2/catch.hpp"
@@ -214,3 +216,328 @@ TEST_CASE("Test3: clone to other schema") {
         REQUIRE(false);
     } catch (...) {}
 }
+
+TEST_CASE("Test4: random field access") {
+    k2::dto::Schema schema;
+    schema.name = "test_schema";
+    schema.version = 1;
+    schema.fields = std::vector<k2::dto::SchemaField> {
+            {k2::dto::FieldType::STRING, "LastName", false, false},
+            {k2::dto::FieldType::STRING, "FirstName", false, false},
+            {k2::dto::FieldType::INT32T, "Balance", false, false},
+            {k2::dto::FieldType::STRING, "Address", false, false}
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<k2::String>{"LastName"});
+    schema.setRangeKeyFieldsByName(std::vector<k2::String>{"FirstName"});
+    auto schemaPtr = std::make_shared<k2::dto::Schema>(schema);
+
+    k2::dto::SKVRecord doc("collection", schemaPtr);
+    doc.serializeNext<k2::String>("Baggins");
+    doc.serializeNext<k2::String>("Bilbo");
+    doc.serializeNull();
+    doc.serializeNext<k2::String>("Bag End");
+
+    // out of order access on the serialized record uses the offsets recorded on write
+    REQUIRE(*doc.deserializeField<k2::String>(3) == "Bag End");
+    REQUIRE(*doc.deserializeField<k2::String>(1) == "Bilbo");
+    REQUIRE(!doc.deserializeField<int32_t>(2));
+    REQUIRE(*doc.deserializeField<k2::String>(0) == "Baggins");
+
+    // a record received from the wire has no offsets. They are computed on the first out of order access
+    k2::dto::SKVRecord::Storage storage{
+        .excludedFields = k2::dto::FieldBitmap{false, false, true, false},
+        .fieldData = doc.getSharedPayload(),
+        .schemaVersion = 1
+    };
+    REQUIRE(storage.fieldOffsets.empty());
+    k2::dto::SKVRecord received("collection", schemaPtr, std::move(storage), true);
+    REQUIRE(*received.deserializeField<k2::String>("Address") == "Bag End");
+    REQUIRE(*received.deserializeField<k2::String>("LastName") == "Baggins");
+    REQUIRE(!received.deserializeField<int32_t>("Balance"));
+    REQUIRE(*received.deserializeField<k2::String>("FirstName") == "Bilbo");
+    received.seekField(0);
+    REQUIRE(*received.deserializeNext<k2::String>() == "Baggins");
+    REQUIRE(*received.deserializeNext<k2::String>() == "Bilbo");
+
+    // indexing a storage directly gives the start of each field in the payload
+    k2::dto::SKVRecord::Storage indexed{
+        .excludedFields = k2::dto::FieldBitmap{false, false, true, false},
+        .fieldData = doc.getSharedPayload(),
+        .schemaVersion = 1
+    };
+    REQUIRE(indexed.indexFields(schema));
+    REQUIRE(indexed.fieldOffsets.size() == 4);
+    REQUIRE(indexed.fieldOffsets[0] == 0);
+    REQUIRE(indexed.fieldOffsets[2] == indexed.fieldOffsets[3]);
+
+    // a payload which is missing fields cannot be indexed
+    k2::dto::Schema wider = schema;
+    wider.fields.push_back({k2::dto::FieldType::INT32T, "Age", false, false});
+    k2::dto::SKVRecord::Storage truncated{
+        .excludedFields = k2::dto::FieldBitmap{false, false, true, false, false},
+        .fieldData = doc.getSharedPayload(),
+        .schemaVersion = 1
+    };
+    REQUIRE(!truncated.indexFields(wider));
+    REQUIRE(truncated.fieldOffsets.empty());
+}
+
+struct Test5Name {
+    std::optional<k2::String> LastName;
+    std::optional<k2::String> FirstName;
+    SKV_RECORD_FIELDS(LastName, FirstName);
+};
+
+struct Test5Person {
+    Test5Name name;
+    std::optional<int32_t> Balance;
+    SKV_RECORD_FIELDS(name, Balance);
+};
+
+struct Test5Mismatch {
+    std::optional<k2::String> LastName;
+    std::optional<int32_t> FirstName;
+    SKV_RECORD_FIELDS(LastName, FirstName);
+};
+
+TEST_CASE("Test5: user-defined types with bound layouts") {
+    k2::dto::Schema schema;
+    schema.name = "test_schema";
+    schema.version = 1;
+    schema.fields = std::vector<k2::dto::SchemaField> {
+            {k2::dto::FieldType::STRING, "LastName", false, false},
+            {k2::dto::FieldType::STRING, "FirstName", false, false},
+            {k2::dto::FieldType::INT32T, "Balance", false, false}
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<k2::String>{"LastName"});
+    schema.setRangeKeyFieldsByName(std::vector<k2::String>{"FirstName"});
+    auto schemaPtr = std::make_shared<k2::dto::Schema>(schema);
+
+    std::vector<k2::dto::FieldType> layout;
+    Test5Person person{.name = {.LastName = "Baggins", .FirstName = "Bilbo"}, .Balance = std::nullopt};
+    person.__appendLayout(layout);
+    REQUIRE(layout == std::vector<k2::dto::FieldType>{k2::dto::FieldType::STRING, k2::dto::FieldType::STRING,
+                                                      k2::dto::FieldType::INT32T});
+
+    // the bound path gives the same record as field by field serialization
+    k2::dto::SKVRecord doc("collection", schemaPtr);
+    REQUIRE(doc.bindLayout(person));
+    person.__writeFields(doc);
+    k2::dto::SKVRecord expected("collection", schemaPtr);
+    expected.serializeNext<k2::String>("Baggins");
+    expected.serializeNext<k2::String>("Bilbo");
+    expected.serializeNull();
+    REQUIRE(doc.getKey() == expected.getKey());
+    REQUIRE(doc.getFieldCursor() == 3);
+    // a nested type is not bound on its own in the middle of a record
+    REQUIRE(!doc.bindLayout(person.name));
+
+    k2::dto::SKVRecord::Storage storage{
+        .excludedFields = k2::dto::FieldBitmap{false, false, true},
+        .fieldData = doc.getSharedPayload(),
+        .schemaVersion = 1
+    };
+    k2::dto::SKVRecord received("collection", schemaPtr, std::move(storage), true);
+    Test5Person readBack{};
+    readBack.__readFields(received);
+    REQUIRE(*readBack.name.LastName == "Baggins");
+    REQUIRE(*readBack.name.FirstName == "Bilbo");
+    REQUIRE(!readBack.Balance);
+
+    // a type which doesn't match the schema takes the checked path and fails on the mismatching field
+    k2::dto::SKVRecord mismatch("collection", schemaPtr);
+    Test5Mismatch wrong{.LastName = "Baggins", .FirstName = 1};
+    REQUIRE(!mismatch.bindLayout(wrong));
+    REQUIRE_THROWS_AS(wrong.__writeFields(mismatch), k2::dto::TypeMismatchException);
+}
+
+TEST_CASE("Test6: field bitmaps") {
+    k2::dto::FieldBitmap small{false, true, false};
+    REQUIRE(small.size() == 3);
+    REQUIRE(!small[0]);
+    REQUIRE(small[1]);
+    small[2] = true;
+    small[1] = false;
+    REQUIRE(small.toString() == "001");
+
+    // bits past the inline word go to the overflow words
+    k2::dto::FieldBitmap wide(130, false);
+    wide[0] = true;
+    wide[64] = true;
+    wide[129] = true;
+    REQUIRE(wide[64]);
+    REQUIRE(!wide[65]);
+    REQUIRE(wide[129]);
+
+    // the wire format is the number of bits followed by the words
+    for (auto& bitmap : {k2::dto::FieldBitmap{}, small, wide}) {
+        k2::Payload payload(k2::Payload::DefaultAllocator);
+        payload.write(bitmap);
+        size_t words = (bitmap.size() + 63) / 64;
+        REQUIRE(payload.getSize() == sizeof(uint32_t) + words * sizeof(uint64_t));
+        payload.seek(0);
+        k2::dto::FieldBitmap readBack;
+        REQUIRE(payload.read(readBack));
+        REQUIRE(readBack == bitmap);
+    }
+}
+
+TEST_CASE("Test7: columnar batches") {
+    k2::dto::Schema schema;
+    schema.name = "test_schema";
+    schema.version = 1;
+    schema.fields = std::vector<k2::dto::SchemaField> {
+            {k2::dto::FieldType::STRING, "Name", false, false},
+            {k2::dto::FieldType::INT32T, "Balance", false, false},
+            {k2::dto::FieldType::BOOL, "Active", false, false}
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<k2::String>{"Name"});
+    schema.setRangeKeyFieldsByName(std::vector<k2::String>{});
+    auto schemaPtr = std::make_shared<k2::dto::Schema>(schema);
+
+    // version 2 drops Active and adds Note
+    k2::dto::Schema schema2 = schema;
+    schema2.version = 2;
+    schema2.fields[2] = {k2::dto::FieldType::STRING, "Note", false, false};
+    auto schema2Ptr = std::make_shared<k2::dto::Schema>(schema2);
+
+    auto makeRecord = [&] (const k2::String& name, std::optional<int32_t> balance, bool active) {
+        k2::dto::SKVRecord rec("collection", schemaPtr);
+        rec.serializeNext<k2::String>(name);
+        if (balance) {
+            rec.serializeNext<int32_t>(*balance);
+        } else {
+            rec.serializeNull();
+        }
+        rec.serializeNext<bool>(active);
+        return rec;
+    };
+
+    k2::dto::ColumnBatchBuilder builder(std::vector<k2::String>{"Name", "Balance", "Active", "Note"});
+    for (int32_t i = 0; i < 10; ++i) {
+        k2::dto::SKVRecord rec = makeRecord(k2::String("user" + std::to_string(i)),
+                                            i % 3 ? std::optional<int32_t>(i) : std::nullopt, i % 2);
+        builder.add(rec);
+    }
+    k2::dto::SKVRecord rec2("collection", schema2Ptr);
+    rec2.serializeNext<k2::String>("user10");
+    rec2.serializeNext<int32_t>(10);
+    rec2.serializeNext<k2::String>("new");
+    builder.add(rec2);
+    k2::dto::ColumnBatch batch = builder.finish();
+
+    REQUIRE(batch.numRows == 11);
+    REQUIRE(batch.columns.size() == 4);
+    const k2::dto::Column* name = batch.column("Name");
+    REQUIRE(name);
+    REQUIRE(name->type == k2::dto::FieldType::STRING);
+    REQUIRE(name->validity.empty());
+    REQUIRE(name->offsets.size() == 12 * sizeof(int32_t));
+    REQUIRE(name->stringValue(0) == "user0");
+    REQUIRE(name->stringValue(10) == "user10");
+
+    // the values of a fixed width column are contiguous, with zeroed slots for nulls
+    const k2::dto::Column* balance = batch.column("Balance");
+    REQUIRE(balance->nullCount == 4);
+    REQUIRE(balance->data.size() == 11 * sizeof(int32_t));
+    for (uint32_t i = 0; i < 11; ++i) {
+        REQUIRE(balance->isNull(i) == (i % 3 == 0 && i < 10));
+        REQUIRE(balance->value<int32_t>(i) == (balance->isNull(i) ? 0 : (int32_t)i));
+    }
+    REQUIRE_THROWS_AS(balance->value<int64_t>(0), k2::dto::TypeMismatchException);
+
+    // fields which a schema version doesn't have are null
+    const k2::dto::Column* active = batch.column("Active");
+    REQUIRE(active->type == k2::dto::FieldType::BOOL);
+    REQUIRE(active->nullCount == 1);
+    REQUIRE(active->boolValue(1));
+    REQUIRE(!active->boolValue(2));
+    REQUIRE(active->isNull(10));
+    const k2::dto::Column* note = batch.column("Note");
+    REQUIRE(note->nullCount == 10);
+    REQUIRE(note->isNull(0));
+    REQUIRE(note->stringValue(0) == "");
+    REQUIRE(note->stringValue(10) == "new");
+
+    // the batch survives the wire
+    k2::Payload payload(k2::Payload::DefaultAllocator);
+    payload.write(batch);
+    payload.seek(0);
+    k2::dto::ColumnBatch readBack;
+    REQUIRE(payload.read(readBack));
+    REQUIRE(readBack.numRows == 11);
+    REQUIRE(readBack.column("Name")->stringValue(3) == "user3");
+
+    // pages are appended by column name, and truncated to a record limit
+    k2::dto::ColumnBatchBuilder pageBuilder(std::vector<k2::String>{"Balance", "Extra"});
+    k2::dto::SKVRecord rec3 = makeRecord("user11", 11, true);
+    pageBuilder.add(rec3);
+    batch.append(pageBuilder.finish());
+    REQUIRE(batch.numRows == 12);
+    REQUIRE(batch.columns.size() == 5);
+    REQUIRE(batch.column("Balance")->value<int32_t>(11) == 11);
+    REQUIRE(batch.column("Name")->isNull(11));
+    REQUIRE(batch.column("Name")->stringValue(11) == "");
+    REQUIRE(batch.column("Extra")->type == k2::dto::FieldType::NULL_T);
+    REQUIRE(batch.column("Extra")->nullCount == 12);
+
+    batch.truncate(5);
+    REQUIRE(batch.numRows == 5);
+    REQUIRE(batch.column("Balance")->nullCount == 2);
+    REQUIRE(batch.column("Balance")->data.size() == 5 * sizeof(int32_t));
+    REQUIRE(batch.column("Name")->stringValue(4) == "user4");
+    REQUIRE(batch.column("Name")->validity.empty());
+}
+
+TEST_CASE("Test8: ranking records by a field") {
+    k2::dto::Schema schema;
+    schema.name = "test_schema";
+    schema.version = 1;
+    schema.fields = std::vector<k2::dto::SchemaField> {
+            {k2::dto::FieldType::STRING, "Name", false, false},
+            {k2::dto::FieldType::INT32T, "Balance", false, false}
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<k2::String>{"Name"});
+    schema.setRangeKeyFieldsByName(std::vector<k2::String>{});
+    auto schemaPtr = std::make_shared<k2::dto::Schema>(schema);
+
+    auto makeRecord = [&] (const k2::String& name, std::optional<int32_t> balance) {
+        k2::dto::SKVRecord rec("collection", schemaPtr);
+        rec.serializeNext<k2::String>(name);
+        if (balance) {
+            rec.serializeNext<int32_t>(*balance);
+        } else {
+            rec.serializeNull();
+        }
+        return rec;
+    };
+    std::vector<std::pair<k2::String, std::optional<int32_t>>> rows{
+        {"a", 5}, {"b", 1}, {"c", std::nullopt}, {"d", 9}, {"e", 1}, {"f", 7}};
+
+    auto rank = [&] (bool descending, uint32_t limit) {
+        k2::dto::RecordRanker<k2::String> ranker(k2::dto::OrderBy{.fieldName = "Balance", .descending = descending, .limit = limit});
+        for (auto& [name, balance] : rows) {
+            k2::dto::SKVRecord rec = makeRecord(name, balance);
+            ranker.add(rec, k2::String(name));
+        }
+        REQUIRE(ranker.size() == std::min<size_t>(limit, rows.size()));
+        return ranker.take();
+    };
+    // NULL sorts first, and equal values keep the order in which they were added
+    REQUIRE(rank(false, 3) == std::vector<k2::String>{"c", "b", "e"});
+    REQUIRE(rank(false, 10) == std::vector<k2::String>{"c", "b", "e", "a", "f", "d"});
+    REQUIRE(rank(true, 2) == std::vector<k2::String>{"d", "f"});
+
+    // a ranked record can be kept as is
+    k2::dto::RecordRanker<k2::dto::SKVRecord> records(k2::dto::OrderBy{.fieldName = "Balance", .limit = 1});
+    for (auto& [name, balance] : rows) {
+        k2::dto::SKVRecord rec = makeRecord(name, balance);
+        records.add(rec, std::move(rec));
+    }
+    auto kept = records.take();
+    REQUIRE(kept.size() == 1);
+    REQUIRE(*kept[0].deserializeField<k2::String>("Name") == "c");
+
+    REQUIRE_THROWS_AS(k2::dto::RecordRanker<k2::String>(k2::dto::OrderBy{.fieldName = "Balance"}), k2::dto::InvalidExpressionException);
+    REQUIRE_THROWS_AS(k2::dto::RecordRanker<k2::String>(k2::dto::OrderBy{.limit = 1}), k2::dto::InvalidExpressionException);
+}
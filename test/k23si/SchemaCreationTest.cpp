@@ -70,6 +70,7 @@ public: // application lifespan
         .then([this] { return runScenario07(); })
         .then([this] { return runScenario08(); })
         .then([this] { return runScenario09(); })
+        .then([this] { return runScenario10(); })
         .then([this] {
             K2LOG_I(log::k23si, "======= All tests passed ========");
             exitcode = 0;
@@ -550,6 +551,60 @@ seastar::future<> runScenario09(){
     });
 }
 
+seastar::future<> runScenario10(){
+    K2LOG_I(log::k23si, "+++++++ Schema Creation Test 10: Create a schema with a secondary index +++++++");
+
+    dto::Schema schema;
+    schema.name = "skv_schema_indexed";
+    schema.version = 1;
+    schema.fields = std::vector<dto::SchemaField> {
+            {dto::FieldType::STRING, "ID", false, false},
+            {dto::FieldType::STRING, "LastName", false, false},
+            {dto::FieldType::INT32T, "Balance", false, false}
+    };
+    schema.setPartitionKeyFieldsByName(std::vector<String>{"ID"});
+    schema.secondaryIndexes.push_back(dto::SecondaryIndex{.name="byLastName", .fields={"LastName"}});
+
+    dto::CreateSchemaRequest request{ collname, std::move(schema) };
+    return RPC().callRPC<dto::CreateSchemaRequest, dto::CreateSchemaResponse>(dto::Verbs::CPO_SCHEMA_CREATE, request, *_cpoEndpoint, 1s)
+    .then([this] (auto&& response) {
+        auto& [status, resp] = response;
+        K2EXPECT(log::k23si, status, Statuses::S200_OK);
+
+        dto::GetSchemasRequest request { collname };
+        return RPC().callRPC<dto::GetSchemasRequest, dto::GetSchemasResponse>(dto::Verbs::CPO_SCHEMAS_GET, request, *_cpoEndpoint, 1s);
+    })
+    .then([] (auto&& response) {
+        auto& [status, resp] = response;
+        K2EXPECT(log::k23si, status, Statuses::S200_OK);
+        bool found = false;
+        for (auto& schema : resp.schemas) {
+            if (schema.name == "skv_schema_indexed.byLastName") {
+                found = true;
+                // the indexed field is the partition key and the key of the indexed record is the range key
+                K2EXPECT(log::k23si, schema.version, 1);
+                K2EXPECT(log::k23si, schema.fields.size(), 2);
+                K2EXPECT(log::k23si, schema.fields[0].name, "LastName");
+                K2EXPECT(log::k23si, schema.fields[1].name, "ID");
+                K2EXPECT(log::k23si, schema.partitionKeyFields.size(), 1);
+                K2EXPECT(log::k23si, schema.partitionKeyFields[0], 0);
+                K2EXPECT(log::k23si, schema.rangeKeyFields.size(), 1);
+                K2EXPECT(log::k23si, schema.rangeKeyFields[0], 1);
+            }
+        }
+        K2EXPECT(log::k23si, found, true);
+
+        // an index on a field which isn't in the schema is rejected
+        dto::Schema bad;
+        bad.name = "skv_schema_bad_index";
+        bad.version = 1;
+        bad.fields = std::vector<dto::SchemaField> {{dto::FieldType::STRING, "ID", false, false}};
+        bad.setPartitionKeyFieldsByName(std::vector<String>{"ID"});
+        bad.secondaryIndexes.push_back(dto::SecondaryIndex{.name="byNothing", .fields={"Nothing"}});
+        K2EXPECT(log::k23si, bad.basicValidation().is2xxOK(), false);
+        return seastar::make_ready_future();
+    });
+}
 
 }; // class schemaCreation
 } //  ns k2
@@ -0,0 +1,403 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/AppEssentials.h>
+#include <k2/appbase/Appbase.h>
+#include <k2/cpo/client/CPOClient.h>
+#include <k2/module/k23si/client/k23si_client.h>
+#include <seastar/core/sleep.hh>
+#include "Log.h"
+using namespace k2;
+
+const char* collname = "k23si_split_collection";
+
+// Integration tests for online splits and migrations of partitions. The collection starts with a single range
+// partition on the first tcp_remote. Splits go to split_target and migrations to migration_target. This app
+// also plays a k2 core whose split transfers fail, to test that a failed split is rolled back
+class SplitTest {
+
+public:  // application lifespan
+    SplitTest() : _client(K23SIClientConfig()) { K2LOG_I(log::k23si, "ctor");}
+    ~SplitTest(){ K2LOG_I(log::k23si, "dtor");}
+
+    // required for seastar::distributed interface
+    seastar::future<> gracefulStop() {
+        K2LOG_I(log::k23si, "stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start(){
+        K2LOG_I(log::k23si, "start");
+        _cpoEndpoint = RPC().getTXEndpoint(_cpo());
+        _failingEndpoint = RPC().getServerEndpoint(TCPRPCProtocol::proto)->url;
+        _registerFailingTarget();
+
+        _testFuture = seastar::make_ready_future()
+        .then([this] () {
+            return _client.start();
+        })
+        .then([this] {
+            K2LOG_I(log::k23si, "Creating test collection...");
+            dto::CollectionMetadata metadata{
+                .name = collname,
+                .hashScheme = dto::HashScheme::Range,
+                .storageDriver = dto::StorageDriver::K23SI,
+                .capacity = {},
+                .retentionPeriod = Duration(_client.retention_window())
+            };
+            return _client.makeCollection(std::move(metadata), std::vector<String>{_client._tcpRemotes()[0]}, std::vector<String>{""});
+        })
+        .then([](auto&& status) {
+            K2EXPECT(log::k23si, status.is2xxOK(), true);
+        })
+        .then([this] () {
+            dto::Schema schema;
+            schema.name = "schema";
+            schema.version = 1;
+            schema.fields = std::vector<dto::SchemaField> {
+                    {dto::FieldType::STRING, "partition", false, false},
+                    {dto::FieldType::STRING, "range", false, false},
+                    {dto::FieldType::STRING, "f1", false, false},
+            };
+            schema.setPartitionKeyFieldsByName(std::vector<String>{"partition"});
+            schema.setRangeKeyFieldsByName(std::vector<String>{"range"});
+            return _client.createSchema(collname, std::move(schema));
+        })
+        .then([] (auto&& result) {
+            K2EXPECT(log::k23si, result.status.is2xxOK(), true);
+        })
+        .then([this] { return runSetup(); })
+        .then([this] { return runScenario01(); })
+        .then([this] { return runScenario02(); })
+        .then([this] { return runScenario03(); })
+        .then([this] { return runScenario04(); })
+        .then([this] {
+            K2LOG_I(log::k23si, "======= All tests passed ========");
+            exitcode = 0;
+        })
+        .handle_exception([this](auto exc) {
+            try {
+                std::rethrow_exception(exc);
+            } catch (std::exception& e) {
+                K2LOG_E(log::k23si, "======= Test failed with exception [{}] ========", e.what());
+                exitcode = -1;
+            } catch (...) {
+                K2LOG_E(log::k23si, "Test failed with unknown exception");
+                exitcode = -1;
+            }
+        })
+        .finally([this] {
+            K2LOG_I(log::k23si, "======= Test ended ========");
+            seastar::engine().exit(exitcode);
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    int exitcode = -1;
+
+    ConfigVar<String> _cpo{"cpo"};
+    ConfigVar<String> _splitTarget{"split_target"};
+    ConfigVar<String> _migrationTarget{"migration_target"};
+
+    seastar::future<> _testFuture = seastar::make_ready_future();
+    std::unique_ptr<TXEndpoint> _cpoEndpoint;
+    // our own endpoint, which accepts the assignment of a split partition but fails its transfers
+    String _failingEndpoint;
+    uint64_t _failedTransfers = 0;
+
+    K23SIClient _client;
+    std::shared_ptr<dto::Schema> _schema;
+
+    void _registerFailingTarget() {
+        RPC().registerRPCObserver<dto::AssignmentCreateRequest, dto::AssignmentCreateResponse>
+        (dto::Verbs::K2_ASSIGNMENT_CREATE, [this] (dto::AssignmentCreateRequest&& request) {
+            request.partition.astate = dto::AssignmentState::Assigned;
+            request.partition.endpoints = {_failingEndpoint};
+            return RPCResponse(Statuses::S201_Created("assigned"), dto::AssignmentCreateResponse{.assignedPartition=std::move(request.partition)});
+        });
+        RPC().registerRPCObserver<dto::K23SIPushSchemaRequest, dto::K23SIPushSchemaResponse>
+        (dto::Verbs::K23SI_PUSH_SCHEMA, [] (dto::K23SIPushSchemaRequest&&) {
+            return RPCResponse(Statuses::S200_OK("schema accepted"), dto::K23SIPushSchemaResponse{});
+        });
+        RPC().registerRPCObserver<dto::K23SISplitTransferRequest, dto::K23SISplitTransferResponse>
+        (dto::Verbs::K23SI_SPLIT_TRANSFER, [this] (dto::K23SISplitTransferRequest&&) {
+            _failedTransfers++;
+            return RPCResponse(dto::K23SIStatus::InternalError("transfer failed by the test"), dto::K23SISplitTransferResponse{});
+        });
+    }
+
+    dto::SKVRecord _makeRecord(const String& key, const String& value) {
+        dto::SKVRecord record(collname, _schema);
+        record.serializeNext<String>(key);
+        record.serializeNext<String>("");
+        record.serializeNext<String>(value);
+        return record;
+    }
+
+    dto::SKVRecord _makeKey(const String& key) {
+        dto::SKVRecord record(collname, _schema);
+        record.serializeNext<String>(key);
+        record.serializeNext<String>("");
+        return record;
+    }
+
+    static String _splitKey() {
+        return dto::FieldToKeyString<String>("m");
+    }
+
+    seastar::future<dto::PartitionMap> _getPartitionMap() {
+        auto request = dto::CollectionGetRequest{.name=collname};
+        return RPC().callRPC<dto::CollectionGetRequest, dto::CollectionGetResponse>
+            (dto::Verbs::CPO_COLLECTION_GET, request, *_cpoEndpoint, 1s)
+        .then([] (auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status.is2xxOK(), true);
+            return std::move(resp.collection.partitionMap);
+        });
+    }
+
+    // splits the first partition of the collection at _splitKey() onto the target
+    seastar::future<std::tuple<Status, dto::PartitionSplitResponse>> _split(String target) {
+        return _getPartitionMap()
+        .then([this, target=std::move(target)] (dto::PartitionMap&& map) {
+            K2EXPECT(log::k23si, map.partitions.size() > 0, true);
+            dto::PartitionSplitRequest request{.collectionName=collname, .pvid=map.partitions[0].pvid,
+                                               .splitKey=_splitKey(), .targetEndpoint=target};
+            return seastar::do_with(std::move(request), [this] (auto& request) {
+                return RPC().callRPC<dto::PartitionSplitRequest, dto::PartitionSplitResponse>
+                    (dto::Verbs::CPO_PARTITION_SPLIT, request, *_cpoEndpoint, 30s);
+            });
+        });
+    }
+
+    // reads the key in its own transaction and checks its value
+    seastar::future<> _expectValue(const String& key, const String& value) {
+        return _client.beginTxn(K2TxnOptions{})
+        .then([this, key, value] (K2TxnHandle&& t) {
+            return seastar::do_with(std::move(t), [this, key, value] (auto& txn) {
+                return txn.read(_makeKey(key))
+                .then([&txn, value] (auto&& result) {
+                    K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                    result.value.template deserializeNext<String>();
+                    result.value.template deserializeNext<String>();
+                    K2EXPECT(log::k23si, *result.value.template deserializeNext<String>(), value);
+                    return txn.end(true);
+                })
+                .then([] (auto&& response) {
+                    K2EXPECT(log::k23si, response.status, dto::K23SIStatus::OK);
+                });
+            });
+        });
+    }
+
+    // writes the key in its own transaction
+    seastar::future<> _writeValue(const String& key, const String& value) {
+        K2TxnOptions options{};
+        options.syncFinalize = true;
+        return _client.beginTxn(options)
+        .then([this, key, value] (K2TxnHandle&& t) {
+            return seastar::do_with(std::move(t), _makeRecord(key, value), [] (auto& txn, auto& record) {
+                return txn.write(record)
+                .then([&txn] (auto&& result) {
+                    K2EXPECT(log::k23si, result.status.is2xxOK(), true);
+                    return txn.end(true);
+                })
+                .then([] (auto&& response) {
+                    K2EXPECT(log::k23si, response.status, dto::K23SIStatus::OK);
+                });
+            });
+        });
+    }
+
+public: // tests
+
+// Write keys "a" to "e" into the lower half of the split and "p" to "t" into the upper half
+seastar::future<> runSetup() {
+    K2LOG_I(log::k23si, "SplitTest setup");
+    return _client.getSchema(collname, "schema", 1)
+    .then([this] (auto&& response) {
+        auto& [status, schemaPtr] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        _schema = schemaPtr;
+        return seastar::do_with(std::vector<String>{"a", "b", "c", "d", "e", "p", "q", "r", "s", "t"}, [this] (auto& keys) {
+            return seastar::do_for_each(keys.begin(), keys.end(), [this] (const String& key) {
+                return _writeValue(key, "v_" + key);
+            });
+        });
+    });
+}
+
+// A split is refused while a transaction has a WI in the upper half
+seastar::future<> runScenario01() {
+    K2LOG_I(log::k23si, "Scenario 01: split refused while WIs exist");
+    return _client.beginTxn(K2TxnOptions{})
+    .then([this] (K2TxnHandle&& t) {
+        return seastar::do_with(std::move(t), _makeRecord("r", "v_r2"), [this] (auto& txn, auto& record) {
+            return txn.write(record)
+            .then([this] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::Created);
+                return _split(_splitTarget());
+            })
+            .then([this] (auto&& response) {
+                auto& [status, resp] = response;
+                K2EXPECT(log::k23si, status, Statuses::S503_Service_Unavailable);
+                return _getPartitionMap();
+            })
+            .then([&txn] (dto::PartitionMap&& map) {
+                K2EXPECT(log::k23si, map.partitions.size(), 1);
+                return txn.end(true);
+            })
+            .then([] (auto&& response) {
+                K2EXPECT(log::k23si, response.status, dto::K23SIStatus::OK);
+            });
+        });
+    })
+    .then([this] {
+        return _expectValue("r", "v_r2");
+    });
+}
+
+// A split whose transfer fails is rolled back: the partition map is unchanged and the source keeps serving the
+// keys of the upper half
+seastar::future<> runScenario02() {
+    K2LOG_I(log::k23si, "Scenario 02: rollback after a failed transfer");
+    return _getPartitionMap()
+    .then([this] (dto::PartitionMap&& before) {
+        return _split(_failingEndpoint)
+        .then([this, before=std::move(before)] (auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(log::k23si, status.is2xxOK(), false);
+            K2EXPECT(log::k23si, _failedTransfers > 0, true);
+            return _getPartitionMap()
+            .then([before] (dto::PartitionMap&& after) {
+                K2EXPECT(log::k23si, after.version, before.version);
+                K2EXPECT(log::k23si, after.partitions.size(), 1);
+                K2EXPECT(log::k23si, after.partitions[0].pvid, before.partitions[0].pvid);
+            });
+        });
+    })
+    .then([this] {
+        return _expectValue("s", "v_s");
+    })
+    .then([this] {
+        return _writeValue("q", "v_q2");
+    })
+    .then([this] {
+        return _expectValue("q", "v_q2");
+    });
+}
+
+// A successful split moves the upper half, and the new partition rejects writes below the reads the source served
+seastar::future<> runScenario03() {
+    K2LOG_I(log::k23si, "Scenario 03: split and read watermark");
+    return _client.beginTxn(K2TxnOptions{})
+    .then([this] (K2TxnHandle&& t) {
+        return seastar::do_with(std::move(t), _makeRecord("s", "v_s2"), [this] (auto& oldTxn, auto& record) {
+            // the old txn has its timestamp from beginTxn, which is before the read of "s" below
+            return oldTxn.read(_makeKey("b"))
+            .then([this] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::OK);
+                return _expectValue("s", "v_s");
+            })
+            .then([this] {
+                return _split(_splitTarget());
+            })
+            .then([] (auto&& response) {
+                auto& [status, resp] = response;
+                K2EXPECT(log::k23si, status.is2xxOK(), true);
+                K2EXPECT(log::k23si, resp.partitionMap.partitions.size(), 2);
+                K2EXPECT(log::k23si, resp.partitionMap.partitions[1].startKey, _splitKey());
+            })
+            .then([&oldTxn, &record] {
+                // "s" was read in the source after the old txn started, so the write goes under the read watermark
+                return oldTxn.write(record);
+            })
+            .then([&oldTxn] (auto&& result) {
+                K2EXPECT(log::k23si, result.status, dto::K23SIStatus::AbortRequestTooOld);
+                return oldTxn.end(false);
+            })
+            .then([] (auto&& response) {
+                K2EXPECT(log::k23si, response.status.is2xxOK(), true);
+            });
+        });
+    })
+    .then([this] {
+        return _expectValue("a", "v_a");
+    })
+    .then([this] {
+        return _expectValue("s", "v_s");
+    })
+    .then([this] {
+        return _writeValue("t", "v_t2");
+    })
+    .then([this] {
+        return _expectValue("t", "v_t2");
+    });
+}
+
+// The lower half migrates to another core and keeps its keys
+seastar::future<> runScenario04() {
+    K2LOG_I(log::k23si, "Scenario 04: migration");
+    return _getPartitionMap()
+    .then([this] (dto::PartitionMap&& map) {
+        dto::PartitionMigrateRequest request{.collectionName=collname, .pvid=map.partitions[0].pvid,
+                                             .targetEndpoint=_migrationTarget()};
+        return seastar::do_with(std::move(request), [this] (auto& request) {
+            return RPC().callRPC<dto::PartitionMigrateRequest, dto::PartitionMigrateResponse>
+                (dto::Verbs::CPO_PARTITION_MIGRATE, request, *_cpoEndpoint, 60s);
+        });
+    })
+    .then([this] (auto&& response) {
+        auto& [status, resp] = response;
+        K2EXPECT(log::k23si, status.is2xxOK(), true);
+        K2EXPECT(log::k23si, resp.partitionMap.partitions.size(), 2);
+        K2EXPECT(log::k23si, resp.partitionMap.partitions[0].endpoints.count(_migrationTarget()), 1);
+        return _expectValue("c", "v_c");
+    })
+    .then([this] {
+        return _writeValue("c", "v_c2");
+    })
+    .then([this] {
+        return _expectValue("c", "v_c2");
+    })
+    .then([this] {
+        return _expectValue("r", "v_r2");
+    });
+}
+
+};  // class SplitTest
+
+int main(int argc, char** argv) {
+    App app("SplitTest");
+    app.addOptions()
+        ("tcp_remotes", bpo::value<std::vector<String>>()->multitoken()->default_value(std::vector<String>()), "A list(space-delimited) of endpoints to assign in the test collection")
+        ("tso_endpoint", bpo::value<String>(), "URL of Timestamp Oracle (TSO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("cpo", bpo::value<String>(), "URL of Control Plane Oracle (CPO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("split_target", bpo::value<String>(), "The k2 endpoint the split partitions are assigned to")
+        ("migration_target", bpo::value<String>(), "The k2 endpoint the partition is migrated to");
+    app.addApplet<TSO_ClientLib>();
+    app.addApplet<SplitTest>();
+    return app.start(argc, argv);
+}
@@ -0,0 +1,144 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <set>
+#include <vector>
+#include <k2/module/k23si/TimerWheel.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+struct Item {
+    uint64_t id = 0;
+    uint64_t expiry = 0;
+    TimerWheelHook link;
+    uint64_t tick = 0;
+};
+
+typedef TimerWheel<Item, &Item::link, &Item::tick> Wheel;
+
+static std::set<uint64_t> drain(Wheel& wheel) {
+    std::set<uint64_t> result;
+    while (auto* item = wheel.popExpired()) {
+        result.insert(item->id);
+    }
+    return result;
+}
+
+SCENARIO("Basic timer wheel tests") {
+    Wheel wheel;
+    wheel.start(1000, 10);
+
+    std::vector<Item> items(5);
+    for (uint64_t i = 0; i < items.size(); ++i) {
+        items[i].id = i;
+    }
+    wheel.schedule(items[0], 1005);
+    wheel.schedule(items[1], 1010);
+    wheel.schedule(items[2], 1011);
+    wheel.schedule(items[3], 2000);
+    wheel.schedule(items[4], 500); // already in the past
+
+    // in the past expires immediately
+    REQUIRE(wheel.hasExpired());
+    REQUIRE(drain(wheel) == std::set<uint64_t>{4});
+
+    // nothing expires early
+    wheel.advance(1009);
+    REQUIRE(!wheel.hasExpired());
+
+    wheel.advance(1010);
+    REQUIRE(drain(wheel) == std::set<uint64_t>{0, 1});
+
+    wheel.advance(1019);
+    REQUIRE(!wheel.hasExpired());
+    wheel.advance(1020);
+    REQUIRE(drain(wheel) == std::set<uint64_t>{2});
+
+    // cancel
+    Wheel::cancel(items[3]);
+    REQUIRE(!Wheel::isScheduled(items[3]));
+    wheel.advance(5000);
+    REQUIRE(!wheel.hasExpired());
+
+    // reschedule moves the item
+    wheel.schedule(items[0], 6000);
+    wheel.schedule(items[0], 7000);
+    wheel.advance(6500);
+    REQUIRE(!wheel.hasExpired());
+    wheel.advance(7000);
+    REQUIRE(drain(wheel) == std::set<uint64_t>{0});
+}
+
+SCENARIO("Timer wheel cascading and horizon") {
+    Wheel wheel;
+    wheel.start(0, 1);
+
+    // spread items over all levels and beyond the horizon of the wheel
+    std::vector<uint64_t> expiries = {1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 300000,
+                                      (1ull << 24) - 1, 1ull << 24, (1ull << 24) + 12345, 1ull << 26};
+    std::vector<Item> items(expiries.size());
+    for (uint64_t i = 0; i < items.size(); ++i) {
+        items[i].id = i;
+        items[i].expiry = expiries[i];
+        wheel.schedule(items[i], expiries[i]);
+    }
+
+    // turn the wheel in uneven steps and check each item expires exactly on its tick
+    uint64_t now = 0;
+    std::set<uint64_t> fired;
+    while (fired.size() < items.size()) {
+        uint64_t next = now + 1 + (now % 7) * 997;
+        // check every expiry within the step individually so we can make sure nothing is early or late
+        for (auto& item : items) {
+            if (item.expiry > now && item.expiry <= next) {
+                wheel.advance(item.expiry - 1);
+                REQUIRE(!wheel.hasExpired());
+                wheel.advance(item.expiry);
+                auto batch = drain(wheel);
+                REQUIRE(batch.count(item.id) == 1);
+                for (auto id : batch) {
+                    REQUIRE(items[id].expiry == item.expiry);
+                    fired.insert(id);
+                }
+            }
+        }
+        wheel.advance(next);
+        REQUIRE(!wheel.hasExpired());
+        now = next;
+    }
+}
+
+SCENARIO("Timer wheel items unlink on destruction") {
+    Wheel wheel;
+    wheel.start(0, 1);
+    {
+        Item item;
+        wheel.schedule(item, 100);
+        REQUIRE(Wheel::isScheduled(item));
+    }
+    wheel.advance(200);
+    REQUIRE(!wheel.hasExpired());
+}
@@ -0,0 +1,218 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <k2/module/k23si/VersionChain.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+static dto::DataRecord makeRec(uint64_t ts) {
+    dto::DataRecord rec;
+    rec.key = dto::Key{"s", std::to_string(ts), ""};
+    rec.txnId.mtr.timestamp = dto::Timestamp(ts, 1, 1000);
+    rec.status = dto::DataRecord::Committed;
+    return rec;
+}
+
+static std::vector<String> keys(VersionChain& chain) {
+    std::vector<String> result;
+    for (auto& rec: chain) {
+        result.push_back(rec.key.partitionKey);
+    }
+    return result;
+}
+
+SCENARIO("Version chain push/pop/erase") {
+    VersionChain chain;
+    REQUIRE(chain.empty());
+    REQUIRE(chain.begin() == chain.end());
+
+    chain.push_front(makeRec(10));
+    REQUIRE(chain.size() == 1);
+    REQUIRE(chain.front().key.partitionKey == "10");
+
+    chain.push_front(makeRec(20));
+    chain.push_front(makeRec(30));
+    REQUIRE(chain.size() == 3);
+    REQUIRE(keys(chain) == std::vector<String>{"30", "20", "10"});
+    REQUIRE(chain[1].key.partitionKey == "20");
+
+    // erase middle
+    auto it = chain.begin();
+    ++it;
+    it = chain.erase(it);
+    REQUIRE(it->key.partitionKey == "10");
+    REQUIRE(keys(chain) == std::vector<String>{"30", "10"});
+
+    // erase head
+    chain.pop_front();
+    REQUIRE(keys(chain) == std::vector<String>{"10"});
+    chain.pop_front();
+    REQUIRE(chain.empty());
+
+    for (uint64_t i = 0; i < 1000; ++i) {
+        chain.push_front(makeRec(i));
+    }
+    REQUIRE(chain.size() == 1000);
+    auto keep = chain.begin();
+    ++keep;
+    chain.eraseAfter(keep);
+    REQUIRE(keys(chain) == std::vector<String>{"999", "998"});
+
+    VersionChain moved(std::move(chain));
+    REQUIRE(chain.empty());
+    REQUIRE(moved.size() == 2);
+}
+
+SCENARIO("Version chain push_front moves the old front out of the inline slot") {
+    VersionChain chain;
+    auto& first = chain.push_front(makeRec(10));
+    REQUIRE(&first == &chain.front());
+
+    // the old front moves to a spilled node, and the inline slot now holds the new record
+    auto& second = chain.push_front(makeRec(20));
+    REQUIRE(&second == &chain.front());
+    REQUIRE(&first == &second);
+    REQUIRE(second.key.partitionKey == "20");
+    REQUIRE(&chain[1] != &chain.front());
+    REQUIRE(chain[1].key.partitionKey == "10");
+
+    // references to the spilled versions stay valid as newer versions are added
+    auto& spilled = chain[1];
+    chain.push_front(makeRec(30));
+    REQUIRE(&chain[2] == &spilled);
+    REQUIRE(spilled.key.partitionKey == "10");
+}
+
+SCENARIO("Version chain inserts older versions") {
+    VersionChain chain;
+    chain.push_front(makeRec(10));
+    auto it = chain.insertAfter(chain.begin(), makeRec(5));
+    REQUIRE(it->key.partitionKey == "5");
+    REQUIRE(keys(chain) == std::vector<String>{"10", "5"});
+
+    chain.push_front(makeRec(30));
+    chain.insertAfter(chain.begin(), makeRec(20));
+    REQUIRE(chain.size() == 4);
+    REQUIRE(keys(chain) == std::vector<String>{"30", "20", "10", "5"});
+
+    chain.eraseAfter(it);
+    REQUIRE(keys(chain) == std::vector<String>{"30", "20", "10", "5"});
+    chain.pop_front();
+    REQUIRE(keys(chain) == std::vector<String>{"20", "10", "5"});
+}
+
+SCENARIO("Version chain freezes values into cold blocks") {
+    auto schema = std::make_shared<dto::Schema>();
+    schema->name = "s";
+    schema->version = 1;
+    schema->fields = std::vector<dto::SchemaField> {
+        {dto::FieldType::INT32T, "ID", false, false},       // increasing: delta
+        {dto::FieldType::STRING, "Region", false, false},   // few distinct values: dictionary
+        {dto::FieldType::INT64T, "Flags", false, false},    // constant: run length
+        {dto::FieldType::STRING, "Note", false, false}      // unique, sometimes null: plain
+    };
+    schema->setPartitionKeyFieldsByName(std::vector<String>{"ID"});
+
+    const int numRows = 64;
+    std::vector<dto::SKVRecord::Storage> storages;
+    for (int i = 0; i < numRows; ++i) {
+        dto::SKVRecord rec("c", schema);
+        rec.serializeNext<int32_t>(1000 + i * 3);
+        rec.serializeNext<String>(i % 3 == 0 ? "north" : "south");
+        rec.serializeNext<int64_t>(7);
+        if (i % 4 == 0) {
+            rec.serializeNull();
+        } else {
+            rec.serializeNext<String>("note " + std::to_string(i));
+        }
+        dto::SKVRecord::Storage storage{
+            .excludedFields = i % 4 == 0 ? dto::FieldBitmap{false, false, false, true} : dto::FieldBitmap{},
+            .fieldData = rec.getSharedPayload(),
+            .schemaVersion = 1
+        };
+        REQUIRE(storage.indexFields(*schema));
+        storages.push_back(std::move(storage));
+    }
+    std::vector<dto::SKVRecord::Storage*> rows;
+    size_t rowBytes = 0;
+    for (auto& storage : storages) {
+        rows.push_back(&storage);
+        rowBytes += storage.fieldData.getSize();
+    }
+
+    auto block = seastar::make_lw_shared<ColdBlock>(*schema, rows);
+    REQUIRE(block->rowCount() == numRows);
+    REQUIRE(block->encodedBytes() < rowBytes);
+    REQUIRE(block->encoding(0) == ColdBlock::Encoding::Delta);
+    REQUIRE(block->encoding(1) == ColdBlock::Encoding::Dictionary);
+    REQUIRE(block->encoding(2) == ColdBlock::Encoding::RunLength);
+    REQUIRE(block->encoding(3) == ColdBlock::Encoding::Plain);
+
+    auto checkRows = [&] {
+        for (int i = 0; i < numRows; ++i) {
+            dto::SKVRecord rec("c", schema, block->decode(i), true);
+            REQUIRE(*rec.deserializeNext<int32_t>() == 1000 + i * 3);
+            REQUIRE(*rec.deserializeNext<String>() == (i % 3 == 0 ? "north" : "south"));
+            REQUIRE(*rec.deserializeNext<int64_t>() == 7);
+            auto note = rec.deserializeNext<String>();
+            REQUIRE(note.has_value() == (i % 4 != 0));
+            if (note) {
+                REQUIRE(*note == "note " + std::to_string(i));
+            }
+        }
+    };
+    checkRows();
+
+    // a spilled block decodes the same, from the spill file
+    ColdSpill spill("/tmp", 1024 * 1024);
+    REQUIRE(block->spill(spill));
+    REQUIRE(block->spilled());
+    REQUIRE(spill.segmentsCreated() == 1);
+    checkRows();
+
+    // a frozen chain is thawed on access, and a copy can be made without thawing it
+    VersionChain chain;
+    chain.push_front(makeRec(10));
+    chain.front().value = dto::SKVRecord::Storage{.schemaVersion = 1};
+    chain.freeze(block, 5);
+    REQUIRE(chain.isCold());
+    REQUIRE(!chain.takeThawed());
+    auto copy = chain.coldCopy();
+    REQUIRE(copy.value.fieldData.getSize() == storages[5].fieldData.getSize());
+    REQUIRE(chain.isCold());
+    // scans read the version and its value without thawing the chain
+    REQUIRE(chain.coldHead().txnId.mtr.timestamp.compareCertain(dto::Timestamp(10, 1, 1000)) == dto::Timestamp::EQ);
+    REQUIRE(chain.coldValue().fieldData.getSize() == storages[5].fieldData.getSize());
+    REQUIRE(chain.isCold());
+    REQUIRE(!chain.takeThawed());
+    REQUIRE(chain.size() == 1);
+
+    REQUIRE(chain.front().value.fieldData.getSize() == storages[5].fieldData.getSize());
+    REQUIRE(!chain.isCold());
+    REQUIRE(chain.front().key.partitionKey == "10");
+    REQUIRE(chain.takeThawed());
+    REQUIRE(!chain.takeThawed());
+}
@@ -325,6 +325,103 @@ SEASTAR_TEST_CASE(test_read)
         });
 }
 
+SEASTAR_TEST_CASE(test_chunkReader)
+{
+    uint32_t constexpr RECORDSIZE = 10000;
+    return INIT_TEST()
+        .then([](auto&& persistentVolume) {
+            return seastar::do_with(size_t(0), [persistentVolume](auto& recordCount) mutable {
+                       return seastar::repeat([&recordCount, persistentVolume]() mutable {
+                                  if (persistentVolume->m_chunkList.size() >= 4) {
+                                      return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+                                  }
+                                  Binary binary{RECORDSIZE};
+                                  std::fill(binary.get_write(), binary.get_write() + binary.size(), (uint8_t)(recordCount % 256));
+                                  return persistentVolume->append(std::move(binary))
+                                      .then([&recordCount](auto&&) {
+                                          recordCount++;
+                                          return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::no);
+                                      });
+                              })
+                           .then([&recordCount, persistentVolume] {
+                               // read the chunks back in order, with two chunks in flight
+                               return seastar::do_with(ChunkReader(*persistentVolume, 2), size_t(0), size_t(0),
+                                   [&recordCount](auto& reader, auto& chunks, auto& records) {
+                                   return seastar::repeat([&reader, &chunks, &records] {
+                                       return reader.next().then([&chunks, &records](auto&& chunk) {
+                                           if (!chunk) {
+                                               return seastar::stop_iteration::yes;
+                                           }
+                                           auto& [info, buffer] = *chunk;
+                                           BOOST_REQUIRE(buffer.size() == info.size);
+                                           BOOST_REQUIRE(buffer.size() % RECORDSIZE == 0);
+                                           for (size_t offset = 0; offset < buffer.size(); offset += RECORDSIZE, records++) {
+                                               BOOST_REQUIRE(std::all_of(buffer.begin() + offset, buffer.begin() + offset + RECORDSIZE,
+                                                   [expectedValue{uint8_t(records % 256)}](auto& value) { return (uint8_t)value == expectedValue; }));
+                                           }
+                                           chunks++;
+                                           return seastar::stop_iteration::no;
+                                       });
+                                   })
+                                   .then([&recordCount, &chunks, &records] {
+                                       BOOST_REQUIRE(chunks == 4);
+                                       BOOST_REQUIRE(records == recordCount);
+                                   });
+                               });
+                           });
+                   })
+                .finally([persistentVolume] {
+                    K2LOG_I(log::ptest, "done");
+                    return persistentVolume->close();
+                })
+                .then([persistentVolume]() {});
+        });
+}
+
+SEASTAR_TEST_CASE(test_appendSplit)
+{
+    // a batch larger than a chunk, as the persistence service gets for a large commit group
+    std::vector<size_t> sizes{100, 40*1024, 3, 70*1024};
+    return INIT_TEST()
+        .then([sizes](auto&& persistentVolume) {
+            std::vector<Binary> buffers;
+            size_t total = 0;
+            for (size_t size : sizes) {
+                Binary binary{size};
+                for (size_t i = 0; i < size; i++) {
+                    binary.get_write()[i] = (uint8_t)((total + i) % 251);
+                }
+                total += size;
+                buffers.push_back(std::move(binary));
+            }
+            return persistentVolume->appendSplit(std::move(buffers))
+                .then([persistentVolume, total](auto&& records) {
+                    BOOST_REQUIRE(records.size() > 1);
+                    size_t appended = 0;
+                    for (auto& [position, size] : records) {
+                        BOOST_REQUIRE(size <= PersistentVolume::maxRecordSize());
+                        appended += size;
+                    }
+                    BOOST_REQUIRE(appended == total);
+                    return persistentVolume->readMany(std::move(records));
+                })
+                .then([total](auto&& buffers) {
+                    size_t offset = 0;
+                    for (auto& buffer : buffers) {
+                        for (size_t i = 0; i < buffer.size(); i++, offset++) {
+                            BOOST_REQUIRE((uint8_t)buffer[i] == (uint8_t)(offset % 251));
+                        }
+                    }
+                    BOOST_REQUIRE(offset == total);
+                })
+                .finally([persistentVolume] {
+                    K2LOG_I(log::ptest, "done");
+                    return persistentVolume->close();
+                })
+                .then([persistentVolume]() {});
+        });
+}
+
 SEASTAR_TEST_CASE(test_read_ActualSize_LT_ExpectedSize)
 {
     return INIT_TEST()
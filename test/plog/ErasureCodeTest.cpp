@@ -0,0 +1,79 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+
+#include <k2/persistence/plog_client/ErasureCode.h>
+#include "catch2/catch.hpp"
+
+#include <cstdlib>
+
+using namespace k2;
+
+SCENARIO("Erasure code rebuilds the data from any k fragments") {
+    const size_t size = 100;
+    for (uint32_t k = 1; k <= 5; ++k) {
+        for (uint32_t m = 0; m <= 3; ++m) {
+            ErasureCode code(k, m);
+            std::vector<std::vector<uint8_t>> fragments(k + m, std::vector<uint8_t>(size));
+            std::vector<const uint8_t*> data;
+            std::vector<uint8_t*> parity;
+            for (uint32_t f = 0; f < k + m; ++f) {
+                if (f < k) {
+                    for (auto& b : fragments[f]) {
+                        b = (uint8_t)std::rand();
+                    }
+                    data.push_back(fragments[f].data());
+                }
+                else {
+                    parity.push_back(fragments[f].data());
+                }
+            }
+            code.encode(data, parity, size);
+
+            // every combination of lost fragments
+            for (uint32_t lost = 0; lost < (1u << (k + m)); ++lost) {
+                uint32_t numLost = __builtin_popcount(lost);
+                std::vector<const uint8_t*> have;
+                for (uint32_t f = 0; f < k + m; ++f) {
+                    have.push_back((lost & (1u << f)) ? nullptr : fragments[f].data());
+                }
+                std::vector<std::vector<uint8_t>> rebuilt(k, std::vector<uint8_t>(size));
+                std::vector<uint8_t*> out;
+                for (auto& r : rebuilt) {
+                    out.push_back(r.data());
+                }
+                bool decoded = code.decode(have, out, size);
+                REQUIRE(decoded == (numLost <= m));
+                if (!decoded) {
+                    continue;
+                }
+                for (uint32_t j = 0; j < k; ++j) {
+                    if (!have[j]) {
+                        REQUIRE(rebuilt[j] == fragments[j]);
+                    }
+                }
+            }
+        }
+    }
+}
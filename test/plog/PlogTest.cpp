@@ -27,6 +27,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/dto/PersistenceCluster.h>
 #include <k2/dto/MessageVerbs.h>
 #include <k2/appbase/AppEssentials.h>
+#include <boost/range/irange.hpp>
 
 using namespace k2;
 
@@ -52,6 +53,10 @@ seastar::future<> PlogTest::start() {
     _testTimer.set_callback([this] {
         _testFuture = runTest2()
         .then([this] { return runTest3(); })
+        .then([this] { return runTest4(); })
+        .then([this] { return runTest5(); })
+        .then([this] { return runTest6(); })
+        .then([this] { return runTest7(); })
         .then([this] {
             K2LOG_I(log::ptest, "======= All tests passed ========");
             exitcode = 0;
@@ -233,3 +238,162 @@ seastar::future<> PlogTest::runTest3() {
         return seastar::make_ready_future<>();
     });
 }
+
+seastar::future<> PlogTest::runTest4() {
+    K2LOG_I(log::ptest, ">>> Test4: roll a log over to the next plog");
+    _log = std::make_unique<RollingPlog>(_client);
+    return _log->init()
+    .then([this] {
+        // three appends of 768KB don't fit in a 2MB plog, so the third one goes to the next plog
+        return seastar::do_for_each(boost::irange(0, 3), [this] (int i) {
+            Payload payload([] { return Binary(4096); });
+            payload.write(String(768 * 1024, 'a' + i));
+            return _log->append(std::move(payload))
+            .then([this] (auto&& response) {
+                auto& [status, position] = response;
+                K2EXPECT(log::ptest, status, Statuses::S200_OK);
+                _positions.push_back(std::move(position));
+            });
+        });
+    })
+    .then([this] {
+        K2EXPECT(log::ptest, _positions[0].plogId, _positions[1].plogId);
+        K2EXPECT(log::ptest, _positions[0].offset, 0);
+        K2EXPECT(log::ptest, _positions[1].offset > 0, true);
+        K2EXPECT(log::ptest, _positions[2].plogId != _positions[0].plogId, true);
+        K2EXPECT(log::ptest, _positions[2].offset, 0);
+
+        K2LOG_I(log::ptest, "Test4.1: read back the append in the next plog");
+        return _client.read(_positions[2].plogId, _positions[2].offset, _positions[1].offset);
+    })
+    .then([this] (auto&& response) {
+        auto& [status, payload] = response;
+        K2EXPECT(log::ptest, status, Statuses::S200_OK);
+        String str;
+        payload.seek(0);
+        payload.read(str);
+        K2EXPECT(log::ptest, str, String(768 * 1024, 'c'));
+
+        K2LOG_I(log::ptest, "Test4.2: close the log");
+        return _log->close();
+    })
+    .then([this] {
+        // close seals the plogs of the log
+        Payload payload([] { return Binary(4096); });
+        payload.write("1234567890");
+        return _client.append(_positions[2].plogId, _positions[1].offset, std::move(payload));
+    })
+    .then([this] (auto&& response) {
+        auto& [status, offset] = response;
+        K2EXPECT(log::ptest, status, Statuses::S409_Conflict);
+
+        K2LOG_I(log::ptest, "Test4.3: append to a closed log");
+        Payload payload([] { return Binary(4096); });
+        payload.write("1234567890");
+        return _log->append(std::move(payload));
+    })
+    .then([] (auto&& response) {
+        auto& [status, position] = response;
+        K2EXPECT(log::ptest, status, Statuses::S410_Gone);
+    });
+}
+
+seastar::future<> PlogTest::runTest5() {
+    K2LOG_I(log::ptest, ">>> Test5: create a cluster for hedged reads");
+    RPC().registerRPCObserver<dto::PlogReadRequest, dto::PlogReadResponse>(dto::Verbs::PERSISTENT_READ, [this] (dto::PlogReadRequest&&) {
+        _fakeReads++;
+        if (!_slowReads) {
+            return RPCResponse(Statuses::S500_Internal_Server_Error("read failed by the test"), dto::PlogReadResponse{});
+        }
+        return seastar::sleep(500ms).then([] {
+            return RPCResponse(Statuses::S503_Service_Unavailable("slow read by the test"), dto::PlogReadResponse{});
+        });
+    });
+
+    // the plogs are written to the real servers, and read from groups in which this app is the first replica
+    auto self = RPC().getServerEndpoint(TCPRPCProtocol::proto)->url;
+    dto::PersistenceCluster cluster2;
+    cluster2.name="Cluster2";
+    cluster2.persistenceGroupVector.push_back(dto::PersistenceGroup{.name="Real", .plogServerEndpoints = _plogConfigEps()});
+    cluster2.persistenceGroupVector.push_back(dto::PersistenceGroup{.name="Hedged", .plogServerEndpoints = {self, _plogConfigEps()[0]}});
+    cluster2.persistenceGroupVector.push_back(dto::PersistenceGroup{.name="Failover", .plogServerEndpoints = {self, _plogConfigEps()[0]}});
+
+    auto request = dto::PersistenceClusterCreateRequest{.cluster=std::move(cluster2)};
+    return RPC()
+    .callRPC<dto::PersistenceClusterCreateRequest, dto::PersistenceClusterCreateResponse>(dto::Verbs::CPO_PERSISTENCE_CLUSTER_CREATE, request, *_cpoEndpoint, 1s)
+    .then([this] (auto&& response) {
+        auto& [status, resp] = response;
+        K2EXPECT(log::ptest, status, Statuses::S201_Created);
+        return _hedgeClient.init("Cluster2");
+    })
+    .then([this] {
+        K2EXPECT(log::ptest, _hedgeClient.selectPersistenceGroup("Real"), true);
+        return _hedgeClient.create();
+    })
+    .then([this] (auto&& response) {
+        auto& [status, plogId] = response;
+        K2EXPECT(log::ptest, status, Statuses::S201_Created);
+        _hedgePlogId = plogId;
+
+        Payload payload([] { return Binary(4096); });
+        payload.write("1234567890");
+        return _hedgeClient.append(_hedgePlogId, 0, std::move(payload));
+    })
+    .then([] (auto&& response) {
+        auto& [status, offset] = response;
+        K2EXPECT(log::ptest, status, Statuses::S200_OK);
+        K2EXPECT(log::ptest, offset, 15);
+    });
+}
+
+seastar::future<> PlogTest::runTest6() {
+    K2LOG_I(log::ptest, ">>> Test6: hedge a read to the next replica when the first one is slow");
+    K2EXPECT(log::ptest, _hedgeClient.selectPersistenceGroup("Hedged"), true);
+    _slowReads = true;
+    _fakeReads = 0;
+    auto start = Clock::now();
+    return _hedgeClient.read(_hedgePlogId, 0, 15)
+    .then([this, start] (auto&& response) {
+        auto& [status, payload] = response;
+        K2EXPECT(log::ptest, status, Statuses::S200_OK);
+        String str;
+        payload.seek(0);
+        payload.read(str);
+        K2EXPECT(log::ptest, str, "1234567890");
+        K2EXPECT(log::ptest, _fakeReads, 1);
+        // the read waited neither for the slow replica nor for the timeout of its request
+        K2EXPECT(log::ptest, Clock::now() - start < 100ms, true);
+
+        K2LOG_I(log::ptest, "Test6.1: the late answer of the slow replica is dropped");
+        return seastar::sleep(600ms);
+    })
+    .then([this] {
+        // the slow replica has no latency samples since its request timed out, so it still sorts first
+        return _hedgeClient.read(_hedgePlogId, 0, 15);
+    })
+    .then([this] (auto&& response) {
+        auto& [status, payload] = response;
+        K2EXPECT(log::ptest, status, Statuses::S200_OK);
+        K2EXPECT(log::ptest, _fakeReads, 2);
+    });
+}
+
+seastar::future<> PlogTest::runTest7() {
+    K2LOG_I(log::ptest, ">>> Test7: fall back to the next replica when the first one fails");
+    K2EXPECT(log::ptest, _hedgeClient.selectPersistenceGroup("Failover"), true);
+    _slowReads = false;
+    _fakeReads = 0;
+    auto start = Clock::now();
+    return _hedgeClient.read(_hedgePlogId, 0, 15)
+    .then([this, start] (auto&& response) {
+        auto& [status, payload] = response;
+        K2EXPECT(log::ptest, status, Statuses::S200_OK);
+        String str;
+        payload.seek(0);
+        payload.read(str);
+        K2EXPECT(log::ptest, str, "1234567890");
+        K2EXPECT(log::ptest, _fakeReads, 1);
+        // failed over right away instead of after the hedge delay or the timeout
+        K2EXPECT(log::ptest, Clock::now() - start < 100ms, true);
+    });
+}
@@ -25,6 +25,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/appbase/Appbase.h>
 #include <k2/appbase/AppEssentials.h>
 #include <k2/persistence/plog_client/PlogClient.h>
+#include <k2/persistence/plog_client/RollingPlog.h>
 
 using namespace k2;
 namespace k2::log {
@@ -42,6 +43,10 @@ public:  // application lifespan
     seastar::future<> runTest1();
     seastar::future<> runTest2();
     seastar::future<> runTest3();
+    seastar::future<> runTest4();
+    seastar::future<> runTest5();
+    seastar::future<> runTest6();
+    seastar::future<> runTest7();
 
 private:
     int exitcode = -1;
@@ -52,4 +57,13 @@ private:
     seastar::timer<> _testTimer;
 
     k2::String _plogId;
+    std::unique_ptr<k2::RollingPlog> _log;
+    std::vector<k2::RollingPlog::Position> _positions;
+
+    // a client of the cluster whose groups mix this app, playing a slow or failing plog server, with a real one
+    k2::PlogClient _hedgeClient;
+    k2::String _hedgePlogId;
+    // how the reads sent to this app are answered
+    bool _slowReads = false;
+    uint64_t _fakeReads = 0;
 };
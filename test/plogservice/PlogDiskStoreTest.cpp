@@ -0,0 +1,181 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define EXPOSE_PRIVATES
+#include <seastar/testing/test_case.hh>
+#include <TestUtil.h>
+
+#include <k2/persistence/plog_service/PlogDiskStore.h>
+
+using namespace k2;
+namespace k2::log {
+inline thread_local k2::logging::Logger pdtest("k2::plog_disk_store_test");
+}
+
+const auto storeBaseDir = generateTempFolderPath("plog_disk_store_test");
+uint32_t constexpr PLOGSIZE = 64*1024;
+
+seastar::lw_shared_ptr<PlogDiskStore> makeStore(const std::string& testName) {
+    std::filesystem::create_directories(storeBaseDir);
+    return seastar::make_lw_shared<PlogDiskStore>(storeBaseDir + testName, PLOGSIZE, 2);
+}
+
+dto::PlogAppendRequest appendRequest(const String& plogId, uint32_t offset, size_t size, char fill) {
+    dto::PlogAppendRequest request{.plogId=plogId, .offset=offset, .payload=Payload(Payload::DefaultAllocator)};
+    String data(size, fill);
+    request.payload.write(data.data(), data.size());
+    return request;
+}
+
+// the data of the response, as a string
+String readData(dto::PlogReadResponse& response) {
+    String data(response.payload.getSize(), '\0');
+    response.payload.seek(0);
+    response.payload.read(data.data(), data.size());
+    return data;
+}
+
+SEASTAR_TEST_CASE(test_append_read_reopen)
+{
+    K2LOG_I(log::pdtest, "{} ......", get_name());
+    auto fileName = get_name();
+    auto store = makeStore(fileName);
+    return store->open()
+    .then([store] {
+        return store->create(dto::PlogCreateRequest{.plogId="p1"});
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result).is2xxOK());
+        return store->append(appendRequest("p1", 0, 100, 'a'));
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result).is2xxOK());
+        BOOST_REQUIRE(std::get<1>(result).newOffset == 100);
+        // crosses the block boundaries, so the tail block gets rewritten
+        return store->append(appendRequest("p1", 100, 5000, 'b'));
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result).is2xxOK());
+        BOOST_REQUIRE(std::get<1>(result).newOffset == 5100);
+        return store->append(appendRequest("p1", 4000, 10, 'c'));
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result) == Statuses::S403_Forbidden);
+        return store->read(dto::PlogReadRequest{.plogId="p1", .offset=50, .size=100});
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result).is2xxOK());
+        BOOST_REQUIRE(readData(std::get<1>(result)) == String(50, 'a') + String(50, 'b'));
+        return store->read(dto::PlogReadRequest{.plogId="p1", .offset=5000, .size=200});
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result) == Statuses::S413_Payload_Too_Large);
+        return store->seal(dto::PlogSealRequest{.plogId="p1", .truncateOffset=5100});
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result).is2xxOK());
+        BOOST_REQUIRE(std::get<1>(result).sealedOffset == 5100);
+        return store->close();
+    })
+    .then([fileName] {
+        // the plog, its data and its seal survive a restart
+        auto reopened = makeStore(fileName);
+        return reopened->open()
+        .then([reopened] {
+            return reopened->read(dto::PlogReadRequest{.plogId="p1", .offset=0, .size=5100});
+        })
+        .then([reopened] (auto&& result) {
+            BOOST_REQUIRE(std::get<0>(result).is2xxOK());
+            BOOST_REQUIRE(readData(std::get<1>(result)) == String(100, 'a') + String(5000, 'b'));
+            return reopened->append(appendRequest("p1", 5100, 10, 'c'));
+        })
+        .then([reopened] (auto&& result) {
+            BOOST_REQUIRE(std::get<0>(result) == Statuses::S409_Conflict);
+            return reopened->close();
+        })
+        .then([reopened] {});
+    });
+}
+
+SEASTAR_TEST_CASE(test_append_failure)
+{
+    K2LOG_I(log::pdtest, "{} ......", get_name());
+    auto fileName = storeBaseDir + get_name();
+    auto store = makeStore(get_name());
+    return store->open()
+    .then([store] {
+        return store->create(dto::PlogCreateRequest{.plogId="p1"});
+    })
+    .then([store, fileName] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result).is2xxOK());
+        return seastar::open_file_dma(fileName, seastar::open_flags::ro);
+    })
+    .then([store] (seastar::file&& readOnly) {
+        // Hold the writes of the plog until both appends are queued. The first one is written through a read-only
+        // handle so that it fails, and the one queued behind it would go through the working file
+        auto extent = store->_plogs["p1"];
+        auto rw = store->_file;
+        store->_file = readOnly;
+        seastar::promise<> gate;
+        extent->chain = gate.get_future();
+        std::vector<seastar::future<std::tuple<Status, dto::PlogAppendResponse>>> appends;
+        appends.push_back(store->append(appendRequest("p1", 0, 100, 'a')));
+        extent->chain = extent->chain.then([store, rw] {
+            store->_file = rw;
+        });
+        appends.push_back(store->append(appendRequest("p1", 100, 100, 'b')));
+        gate.set_value();
+        return seastar::when_all_succeed(appends.begin(), appends.end())
+        .then([store, extent, readOnly] (auto&& results) mutable {
+            BOOST_REQUIRE(results.size() == 2);
+            BOOST_REQUIRE(std::get<0>(results[0]) == Statuses::S500_Internal_Server_Error);
+            BOOST_REQUIRE(std::get<0>(results[1]) == Statuses::S500_Internal_Server_Error);
+            BOOST_REQUIRE(extent->broken);
+            // nothing past the failed write may be exposed as durable
+            BOOST_REQUIRE(extent->durableOffset == 0);
+            return readOnly.close();
+        });
+    })
+    .then([store] {
+        return store->read(dto::PlogReadRequest{.plogId="p1", .offset=0, .size=100});
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result) == Statuses::S413_Payload_Too_Large);
+        // later appends fail as well, even at the durable offset
+        return store->append(appendRequest("p1", 0, 100, 'c'));
+    })
+    .then([store] (auto&& result) {
+        BOOST_REQUIRE(std::get<0>(result) == Statuses::S500_Internal_Server_Error);
+        return store->close();
+    })
+    .then([store] {});
+}
+
+SEASTAR_TEST_CASE(Remove_test_folders)
+{
+    K2LOG_I(log::pdtest, "{}...", get_name());
+    if (std::filesystem::exists(storeBaseDir)) {
+        std::filesystem::remove_all(storeBaseDir);
+    }
+    return seastar::make_ready_future<>();
+}
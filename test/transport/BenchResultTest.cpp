@@ -0,0 +1,92 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/transport/BenchResult.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+static BenchResult makeResult(uint64_t from, uint64_t to, Duration elapsed) {
+    BenchResult result;
+    result.benchmark = "rpcbench";
+    result.name = "tcp/512";
+    result.config = {{"transport", "tcp"}};
+    result.cores = 1;
+    result.elapsed = elapsed;
+    LogLinearHistogram latency;
+    for (uint64_t i = from; i < to; ++i) {
+        latency.add(i);
+    }
+    result.counters["msgs"] = to - from;
+    result.histograms.emplace("latency", std::move(latency));
+    return result;
+}
+
+TEST_CASE("test bench result JSON round trip") {
+    auto result = makeResult(0, 100, 2s);
+    auto parsed = BenchResult::fromJson(nlohmann::json::parse(result.toJson().dump()));
+    REQUIRE(parsed.key() == "rpcbench/tcp/512");
+    REQUIRE(parsed.config == result.config);
+    REQUIRE(parsed.counters == result.counters);
+    REQUIRE(parsed.elapsed == result.elapsed);
+    REQUIRE(parsed.cores == 1);
+    REQUIRE(parsed.clients == 1);
+    auto& latency = parsed.histograms.at("latency");
+    REQUIRE(latency.count() == 100);
+    REQUIRE(latency.sum() == result.histograms.at("latency").sum());
+    REQUIRE(latency.percentile(0.99) == result.histograms.at("latency").percentile(0.99));
+
+    auto json = result.toJson();
+    REQUIRE(json["derived"]["msgs_per_sec"].get<double>() == 50);
+    REQUIRE(json["derived"]["latency_p99_us"].get<uint64_t>() == latency.percentile(0.99));
+}
+
+TEST_CASE("test combining bench results") {
+    // a fast and a slow client: the combined p99 is the p99 of all samples, not the average of the two p99s
+    std::vector<BenchResult> results;
+    results.push_back(makeResult(0, 1000, 1s));
+    results.push_back(makeResult(10000, 11000, 2s));
+    auto other = makeResult(0, 10, 1s);
+    other.name = "tcp/4096";
+    results.push_back(other);
+
+    auto combined = combineBenchResults(std::move(results));
+    REQUIRE(combined.size() == 2);
+    REQUIRE(combined[0].key() == "rpcbench/tcp/512");
+    REQUIRE(combined[1].key() == "rpcbench/tcp/4096");
+
+    auto& merged = combined[0];
+    REQUIRE(merged.counters.at("msgs") == 2000);
+    REQUIRE(merged.elapsed == 2s);
+    REQUIRE(merged.cores == 2);
+    REQUIRE(merged.clients == 2);
+
+    LogLinearHistogram all;
+    for (uint64_t i = 0; i < 1000; ++i) all.add(i);
+    for (uint64_t i = 10000; i < 11000; ++i) all.add(i);
+    auto& latency = merged.histograms.at("latency");
+    REQUIRE(latency.count() == 2000);
+    REQUIRE(latency.percentile(0.5) == all.percentile(0.5));
+    REQUIRE(latency.percentile(0.99) == all.percentile(0.99));
+    REQUIRE(latency.percentile(0.99) >= 10000);
+}
@@ -0,0 +1,62 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include <k2/transport/BinaryPool.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+TEST_CASE("test binary pool allocation and release") {
+    auto* pool = new BinaryPool(100, 3);
+    REQUIRE(pool->regionSize() == 300);
+    REQUIRE(pool->available() == 3);
+
+    std::vector<Binary> bins;
+    for (int i = 0; i < 3; ++i) {
+        bins.push_back(pool->allocate());
+        REQUIRE(bins.back().size() == 100);
+        // pool binaries come out of the region
+        REQUIRE(bins.back().get() >= pool->regionStart());
+        REQUIRE(bins.back().get() + 100 <= pool->regionStart() + pool->regionSize());
+    }
+    REQUIRE(pool->available() == 0);
+
+    // exhausted: falls back to the heap
+    auto extra = pool->allocate();
+    REQUIRE(extra.size() == 100);
+    REQUIRE((extra.get() < pool->regionStart() || extra.get() >= pool->regionStart() + pool->regionSize()));
+    REQUIRE(pool->fallbacks() == 1);
+
+    // shared slices keep the segment out of the pool until the last one goes
+    auto slice = bins[0].share(10, 20);
+    bins.clear();
+    REQUIRE(pool->available() == 2);
+    slice = Binary();
+    REQUIRE(pool->available() == 3);
+
+    auto again = pool->allocate();
+    REQUIRE(again.get() >= pool->regionStart());
+    REQUIRE(pool->fallbacks() == 1);
+    // pools live for the lifetime of the process
+}
@@ -0,0 +1,84 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/transport/Prometheus.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+TEST_CASE("test log-linear histogram buckets") {
+    LogLinearHistogram hist(1000, 3);
+    // the first 8 values have a bucket each
+    for (uint64_t i = 0; i < 8; ++i) {
+        hist.add(i);
+    }
+    REQUIRE(hist.percentile(1.0) == 7);
+    REQUIRE(hist.percentile(0.5) == 3);
+
+    // every sample ends up in a bucket whose upper bound is no more than 1/8 above it
+    for (uint64_t sample : {8ull, 9ull, 15ull, 16ull, 17ull, 100ull, 127ull, 128ull, 999ull}) {
+        LogLinearHistogram single(1000, 3);
+        single.add(sample);
+        auto bound = single.percentile(1.0);
+        REQUIRE(bound >= sample);
+        REQUIRE(bound - sample <= sample / 8);
+    }
+
+    // samples past the max go into the last bucket
+    LogLinearHistogram clamped(1000, 3);
+    clamped.add(1'000'000);
+    REQUIRE(clamped.count() == 1);
+    REQUIRE(clamped.percentile(1.0) >= 1000);
+
+    // the scraped histogram is cumulative
+    auto& prom = hist.getHistogram();
+    REQUIRE(prom.sample_count == 8);
+    REQUIRE(prom.sample_sum == 28);
+    REQUIRE(prom.buckets[7].count == 8);
+    REQUIRE(prom.buckets.back().count == 8);
+}
+
+TEST_CASE("test log-linear histogram merge and percentiles") {
+    LogLinearHistogram a, b;
+    for (uint64_t i = 1; i <= 900; ++i) {
+        a.add(i);
+    }
+    for (uint64_t i = 0; i < 100; ++i) {
+        b.add(uint64_t(100'000));
+    }
+    a.merge(b);
+    REQUIRE(a.count() == 1000);
+    REQUIRE(a.percentile(0.0) == 1);
+    auto p50 = a.percentile(0.5);
+    REQUIRE(p50 >= 500);
+    REQUIRE(p50 <= 500 + 500 / 8);
+    auto p99 = a.percentile(0.99);
+    REQUIRE(p99 >= 100'000);
+    REQUIRE(p99 <= 100'000 + 100'000 / 8);
+
+    // a new sample shows up in the next scrape
+    REQUIRE(a.getHistogram().sample_count == 1000);
+    a.add(std::chrono::steady_clock::duration(5ms));
+    REQUIRE(a.getHistogram().sample_count == 1001);
+    REQUIRE(a.getHistogram().sample_sum == b.sum() + 900 * 901 / 2 + 5000);
+}
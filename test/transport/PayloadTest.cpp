@@ -368,6 +368,122 @@ SCENARIO("test shareAll() and shareRegion()") {
         }
 }
 
+SCENARIO("test serializedSize()") {
+    String s(20000, 'x');
+    std::vector<data<embeddedComplex>> testCases;
+    testCases.push_back(makeData(1, 2, 'a', 44, 'f', 123, "hya", 124121123, 's', nullptr, "", 11, Duration(10ms)));
+    testCases.push_back(makeData(1111, 22222, 'd', 44444, 'i', 123123456, s, 124123456, 's', s.c_str(), s, 109, Duration(21s)));
+
+    for (auto& d: testCases) {
+        Payload dst(Payload::DefaultAllocator);
+        dst.write(d);
+        REQUIRE(dst.getSize() == Payload::serializedSize(d));
+    }
+
+    std::map<String, std::vector<int32_t>> m{{"a", {1, 2, 3}}, {"bcd", {}}};
+    std::unordered_set<String> us{"x", "yy", ""};
+    std::vector<embeddedComplex> vec{embeddedComplex{.a="q", .b=1, .c='c'}, embeddedComplex{}};
+    blanks b;
+    std::decimal::decimal64 d64(1);
+    Payload dst(Payload::DefaultAllocator);
+    dst.writeMany(m, us, vec, b, d64);
+    REQUIRE(dst.getSize() == Payload::serializedSizeMany(m, us, vec, b, d64));
+
+    // sized up front, a flat message is held in a single buffer
+    Payload sized(Payload::DefaultAllocator);
+    sized.ensureCapacity(Payload::serializedSizeMany(m, us, vec, b, d64));
+    sized.writeMany(m, us, vec, b, d64);
+    REQUIRE(sized.getBuffers().size() == 1);
+}
+
+SCENARIO("test readView()") {
+    Payload dst([] { return Binary(16); });
+    dst.write((const void*)"0123456789abcdefghij", 20);
+    dst.seek(0);
+
+    String scratch;
+    const char* data = nullptr;
+    // inside the first buffer: no copy
+    REQUIRE(dst.readView(data, 10, scratch));
+    REQUIRE(String(data, 10) == "0123456789");
+    REQUIRE(data == dst.getBuffers()[0].get());
+    REQUIRE(scratch.empty());
+
+    // across the buffers: copied into scratch
+    REQUIRE(dst.readView(data, 8, scratch));
+    REQUIRE(String(data, 8) == "abcdefgh");
+    REQUIRE(data == scratch.data());
+
+    // not enough data
+    REQUIRE(!dst.readView(data, 3, scratch));
+    REQUIRE(dst.getDataRemaining() == 2);
+}
+
+SCENARIO("test StringView deserialization") {
+    Payload dst([] { return Binary(16); });
+    dst.write(String("hello"));
+    dst.write(String("0123456789"));
+    dst.write(StringView(Binary("abc", 3)));
+    dst.seek(0);
+
+    // inside the first buffer: shared, not copied
+    StringView v1;
+    REQUIRE(dst.read(v1));
+    REQUIRE(v1 == String("hello"));
+    REQUIRE(v1.data() == dst.getBuffers()[0].get() + sizeof(uint32_t));
+
+    // across the buffers: copied into its own binary
+    StringView v2;
+    REQUIRE(dst.read(v2));
+    REQUIRE(v2.view() == "0123456789");
+    REQUIRE(v2.data() != dst.getBuffers()[1].get());
+
+    // written as a view, read back as a String
+    String s3;
+    REQUIRE(dst.read(s3));
+    REQUIRE(s3 == "abc");
+    REQUIRE(dst.getDataRemaining() == 0);
+
+    // the views keep their bytes after the payload is gone
+    dst.clear();
+    String owned = v1.materialize();
+    REQUIRE(owned == "hello");
+    REQUIRE(v1.share() == v1);
+    REQUIRE(Payload::serializedSize(v2) == Payload::serializedSize(String("0123456789")));
+}
+
+SCENARIO("test geometric buffer growth") {
+    Payload dst(Payload::DefaultAllocator);
+    // a small message fits in one small buffer
+    dst.write((const void*)"0123456789", 10);
+    REQUIRE(dst.getBuffers().size() == 1);
+    REQUIRE(dst.getCapacity() == Payload::MIN_BUFFER_SIZE);
+
+    // each new buffer doubles the capacity
+    String s(Payload::MIN_BUFFER_SIZE, 'x');
+    dst.write((const void*)s.data(), s.size());
+    REQUIRE(dst.getBuffers().size() == 2);
+    REQUIRE(dst.getCapacity() == 2 * Payload::MIN_BUFFER_SIZE);
+
+    // a large write gets a buffer big enough for it, up to the max buffer size
+    String big(20000, 'y');
+    dst.write((const void*)big.data(), big.size());
+    REQUIRE(dst.getBuffers().size() == 3);
+    REQUIRE(dst.getBuffers()[2].size() == 20000 + 10 + Payload::MIN_BUFFER_SIZE - 2 * Payload::MIN_BUFFER_SIZE);
+
+    String huge(3 * Payload::MAX_BUFFER_SIZE, 'z');
+    dst.write((const void*)huge.data(), huge.size());
+    for (size_t i = 3; i < dst.getBuffers().size(); ++i) {
+        REQUIRE(dst.getBuffers()[i].size() == Payload::MAX_BUFFER_SIZE);
+    }
+    REQUIRE(dst.getSize() == 10 + s.size() + big.size() + huge.size());
+
+    // allocators which don't take a size are used as-is
+    Payload fixed([] { return Binary(100); });
+    fixed.write((const void*)big.data(), 250);
+    REQUIRE(fixed.getCapacity() == 300);
+}
+
 
 /*
 SCENARIO("rpc parsing") {
@@ -0,0 +1,115 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include <k2/transport/PendingRequestTable.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+TEST_CASE("test pending request insert and take") {
+    PendingRequestTable<int> table(1ms, 16, 4, 16);
+    TimePoint now(1s);
+    for (uint32_t id = 100; id < 110; ++id) {
+        table.insert(id, now + 10ms, id * 2);
+    }
+    REQUIRE(table.size() == 10);
+    // ids in flight span more than the initial capacity, so the ring had to grow
+    REQUIRE(table.ringCapacity() == 16);
+    REQUIRE(table.overflowSize() == 0);
+
+    REQUIRE(table.take(105) == 210);
+    REQUIRE(!table.take(105));
+    REQUIRE(!table.take(5));
+    REQUIRE(table.size() == 9);
+
+    // an id which collides in a full-size ring goes to the overflow map
+    table.insert(116, now + 10ms, 232);
+    REQUIRE(table.overflowSize() == 1);
+    REQUIRE(table.take(100) == 200);
+    REQUIRE(table.take(116) == 232);
+    REQUIRE(table.overflowSize() == 0);
+    REQUIRE(table.size() == 8);
+}
+
+TEST_CASE("test pending request expiry") {
+    PendingRequestTable<int> table(1ms, 8);
+    TimePoint now(1s);
+    table.expire(now, [](uint32_t, int&&) { FAIL("nothing to expire"); });
+
+    table.insert(1, now + 2ms, 1);
+    table.insert(2, now + 1500us, 2); // rounds up to the 2ms tick
+    table.insert(3, now + 5ms, 3);
+    table.insert(4, now + 20ms, 4); // more than a wheel revolution away
+    table.insert(5, now + 3ms, 5);
+    REQUIRE(table.take(5) == 5);
+
+    std::vector<uint32_t> expired;
+    auto collect = [&expired](uint32_t id, int&& value) {
+        REQUIRE(int(id) == value);
+        expired.push_back(id);
+    };
+
+    table.expire(now + 1ms, collect);
+    REQUIRE(expired.empty());
+
+    table.expire(now + 2ms, collect);
+    REQUIRE(expired == std::vector<uint32_t>{1, 2});
+
+    // request 5 completed, so nothing is due until request 3
+    expired.clear();
+    table.expire(now + 4ms, collect);
+    REQUIRE(expired.empty());
+    table.expire(now + 6ms, collect);
+    REQUIRE(expired == std::vector<uint32_t>{3});
+
+    // request 4 shares its bucket with the 12ms tick but only expires at 20ms
+    expired.clear();
+    table.expire(now + 12ms, collect);
+    REQUIRE(expired.empty());
+    table.expire(now + 1s, collect);
+    REQUIRE(expired == std::vector<uint32_t>{4});
+    REQUIRE(table.empty());
+
+    // deadlines in the past expire on the next call
+    table.insert(6, now, 6);
+    table.expire(now + 1s + 1ms, collect);
+    REQUIRE(expired.back() == 6);
+    REQUIRE(table.empty());
+}
+
+TEST_CASE("test pending request clear") {
+    PendingRequestTable<std::unique_ptr<int>> table(1ms, 8, 2, 4);
+    TimePoint now(1s);
+    for (uint32_t id = 0; id < 8; ++id) {
+        table.insert(id * 3, now + 1ms, std::make_unique<int>(id));
+    }
+    REQUIRE(table.overflowSize() > 0);
+    int sum = 0;
+    table.clear([&sum](uint32_t, std::unique_ptr<int>&& value) { sum += *value; });
+    REQUIRE(sum == 28);
+    REQUIRE(table.empty());
+    bool called = false;
+    table.expire(now + 1s, [&called](uint32_t, std::unique_ptr<int>&&) { called = true; });
+    REQUIRE(!called);
+}
@@ -0,0 +1,213 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+#include <limits>
+
+#include <k2/transport/Payload.h>
+#include <k2/transport/RPCParser.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+namespace {
+// serializes a message with the given number of payload bytes into the bytes which would go on the wire
+String wireMessage(RPCParser& sender, size_t payloadSize, MessageMetadata meta = {}) {
+    auto payload = std::make_unique<Payload>(Payload::DefaultAllocator);
+    payload->skip(txconstants::MAX_HEADER_SIZE);
+    for (size_t i = 0; i < payloadSize; ++i) {
+        payload->write(char(i % 251));
+    }
+    String result;
+    for (auto& buf : sender.prepareForSend(10, std::move(payload), std::move(meta))) {
+        result.append(buf.get(), buf.size());
+    }
+    return result;
+}
+
+// feeds the given bytes to the parser in chunks of the given size
+void feedInChunks(RPCParser& parser, const String& wire, size_t chunkSize) {
+    for (size_t offset = 0; offset < wire.size(); offset += chunkSize) {
+        auto len = std::min(chunkSize, wire.size() - offset);
+        parser.feed(Binary(wire.data() + offset, len));
+        while (parser.canDispatch()) {
+            parser.dispatchSome();
+        }
+    }
+}
+}
+
+TEST_CASE("test checksum validation across binaries") {
+    RPCParser sender([] { return false; }, true);
+    const size_t payloadSize = 20000;  // spans several allocated binaries
+    auto wire = wireMessage(sender, payloadSize);
+    wire += wireMessage(sender, 1);
+
+    for (size_t chunkSize : {size_t(1), size_t(7), size_t(4096), wire.size()}) {
+        RPCParser receiver([] { return false; }, true);
+        std::vector<size_t> received;
+        receiver.registerMessageObserver([&received](Verb verb, MessageMetadata meta, std::unique_ptr<Payload> payload) {
+            REQUIRE(verb == 10);
+            REQUIRE(meta.isChecksumSet());
+            REQUIRE(payload->getSize() == meta.payloadSize);
+            for (size_t i = 0; i < payload->getSize(); ++i) {
+                char c;
+                REQUIRE(payload->read(c));
+                REQUIRE(c == char(i % 251));
+            }
+            received.push_back(meta.payloadSize);
+        });
+        bool failed = false;
+        receiver.registerParserFailureObserver([&failed](std::exception_ptr) { failed = true; });
+        feedInChunks(receiver, wire, chunkSize);
+        REQUIRE(!failed);
+        REQUIRE(received == std::vector<size_t>{payloadSize, 1});
+    }
+}
+
+TEST_CASE("test checksum validation failure") {
+    RPCParser sender([] { return false; }, true);
+    auto wire = wireMessage(sender, 5000);
+    // corrupt one payload byte
+    wire[wire.size() - 100] ^= 0x10;
+
+    RPCParser receiver([] { return false; }, true);
+    bool dispatched = false;
+    receiver.registerMessageObserver([&dispatched](Verb, MessageMetadata, std::unique_ptr<Payload>) { dispatched = true; });
+    std::exception_ptr failure;
+    receiver.registerParserFailureObserver([&failure](std::exception_ptr exc) { failure = exc; });
+    feedInChunks(receiver, wire, 1000);
+    REQUIRE(!dispatched);
+    REQUIRE(failure);
+}
+
+TEST_CASE("test compressed messages") {
+    RPCParser sender([] { return false; }, true);
+    sender.enableCompression(1000);
+    const size_t payloadSize = 20000;
+    auto compressed = wireMessage(sender, payloadSize);
+    // the payload repeats, so it compresses well
+    REQUIRE(compressed.size() < payloadSize / 2);
+    // small messages are sent as they are
+    auto small = wireMessage(sender, 100);
+    REQUIRE(small.size() > 100);
+    auto wire = compressed + small;
+
+    for (size_t chunkSize : {size_t(1), size_t(333), wire.size()}) {
+        RPCParser receiver([] { return false; }, true);
+        std::vector<size_t> received;
+        receiver.registerMessageObserver([&received](Verb verb, MessageMetadata meta, std::unique_ptr<Payload> payload) {
+            REQUIRE(verb == 10);
+            for (size_t i = 0; i < payload->getSize(); ++i) {
+                char c;
+                REQUIRE(payload->read(c));
+                REQUIRE(c == char(i % 251));
+            }
+            received.push_back(payload->getSize());
+            REQUIRE(meta.isCompressed() == (payload->getSize() == payloadSize));
+        });
+        bool failed = false;
+        receiver.registerParserFailureObserver([&failed](std::exception_ptr) { failed = true; });
+        feedInChunks(receiver, wire, chunkSize);
+        REQUIRE(!failed);
+        REQUIRE(received == std::vector<size_t>{payloadSize, 100});
+    }
+}
+
+TEST_CASE("test trace context in the header") {
+    RPCParser sender([] { return false; }, true);
+    MessageMetadata meta;
+    meta.setRequestID(7);
+    meta.setTraceContext(0x0123456789abcdefull, 0xfedcba9876543210ull);
+    auto wire = wireMessage(sender, 100, meta);
+    wire += wireMessage(sender, 50);
+
+    // chunks of 1 byte go through the partial variable header path
+    for (size_t chunkSize : {size_t(1), wire.size()}) {
+        RPCParser receiver([] { return false; }, true);
+        std::vector<MessageMetadata> received;
+        receiver.registerMessageObserver([&received](Verb, MessageMetadata meta, std::unique_ptr<Payload>) {
+            received.push_back(meta);
+        });
+        bool failed = false;
+        receiver.registerParserFailureObserver([&failed](std::exception_ptr) { failed = true; });
+        feedInChunks(receiver, wire, chunkSize);
+        REQUIRE(!failed);
+        REQUIRE(received.size() == 2);
+        REQUIRE(received[0].isTraceContextSet());
+        REQUIRE(received[0].traceID == 0x0123456789abcdefull);
+        REQUIRE(received[0].spanID == 0xfedcba9876543210ull);
+        REQUIRE(received[0].requestID == 7);
+        REQUIRE(received[0].payloadSize == 100);
+        REQUIRE(!received[1].isTraceContextSet());
+        REQUIRE(received[1].payloadSize == 50);
+    }
+}
+
+TEST_CASE("test deadline in the header") {
+    RPCParser sender([] { return false; }, true);
+    MessageMetadata meta;
+    meta.setRequestID(7);
+    meta.setTraceContext(1, 2);
+    meta.setDeadline(250ms);
+    MessageMetadata capped;
+    capped.setDeadline(std::chrono::hours(24 * 365));
+    auto wire = wireMessage(sender, 100, meta) + wireMessage(sender, 50, capped) + wireMessage(sender, 10);
+
+    for (size_t chunkSize : {size_t(1), wire.size()}) {
+        RPCParser receiver([] { return false; }, true);
+        std::vector<MessageMetadata> received;
+        receiver.registerMessageObserver([&received](Verb, MessageMetadata meta, std::unique_ptr<Payload>) {
+            received.push_back(meta);
+        });
+        bool failed = false;
+        receiver.registerParserFailureObserver([&failed](std::exception_ptr) { failed = true; });
+        feedInChunks(receiver, wire, chunkSize);
+        REQUIRE(!failed);
+        REQUIRE(received.size() == 3);
+        REQUIRE(received[0].isDeadlineSet());
+        REQUIRE(received[0].deadlineMicros == 250000);
+        REQUIRE(received[0].spanID == 2);
+        REQUIRE(received[0].payloadSize == 100);
+        REQUIRE(received[1].deadlineMicros == std::numeric_limits<uint32_t>::max());
+        REQUIRE(received[1].payloadSize == 50);
+        REQUIRE(!received[2].isDeadlineSet());
+    }
+}
+
+TEST_CASE("test incompressible messages are sent uncompressed") {
+    RPCParser sender([] { return false; }, false);
+    sender.enableCompression(1000);
+    auto payload = std::make_unique<Payload>(Payload::DefaultAllocator);
+    payload->skip(txconstants::MAX_HEADER_SIZE);
+    uint32_t x = 12345;
+    for (size_t i = 0; i < 5000; ++i) {
+        x = x * 1103515245 + 12345;
+        payload->write(char(x >> 24));
+    }
+    size_t wireSize = 0;
+    for (auto& buf : sender.prepareForSend(10, std::move(payload), MessageMetadata{})) {
+        wireSize += buf.size();
+    }
+    REQUIRE(wireSize > 5000);
+}
@@ -0,0 +1,53 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+
+#include <k2/transport/RetryStrategy.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+TEST_CASE("test latency tracker percentiles") {
+    LatencyTracker tracker(10);
+    REQUIRE(tracker.size() == 0);
+    REQUIRE(tracker.percentile(0.95) == 0ms);
+
+    for (int i = 1; i <= 10; ++i) {
+        tracker.add(i * 1ms);
+    }
+    REQUIRE(tracker.size() == 10);
+    REQUIRE(tracker.percentile(0) == 1ms);
+    REQUIRE(tracker.percentile(0.5) == 6ms);
+    REQUIRE(tracker.percentile(0.95) == 10ms);
+    REQUIRE(tracker.percentile(1) == 10ms);
+
+    // only the latest calls are kept: the oldest latencies are replaced
+    for (int i = 0; i < 5; ++i) {
+        tracker.add(100ms);
+    }
+    REQUIRE(tracker.size() == 10);
+    REQUIRE(tracker.percentile(0) == 6ms);
+    REQUIRE(tracker.percentile(0.5) == 100ms);
+    REQUIRE(tracker.percentile(0.4) == 10ms);
+}
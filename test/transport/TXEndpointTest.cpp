@@ -0,0 +1,61 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+
+
+#include <k2/transport/TXEndpoint.h>
+#include "catch2/catch.hpp"
+
+using namespace k2;
+
+TEST_CASE("test endpoint url parsing") {
+    auto ep = TXEndpoint::fromURL("tcp+k2rpc://10.0.0.1:12345", nullptr);
+    REQUIRE(ep);
+    REQUIRE(ep->protocol == "tcp+k2rpc");
+    REQUIRE(ep->ip == "10.0.0.1");
+    REQUIRE(ep->port == 12345);
+    REQUIRE(ep->cores == 0);
+    REQUIRE(ep->url == "tcp+k2rpc://10.0.0.1:12345");
+
+    REQUIRE(!TXEndpoint::fromURL("tcp+k2rpc://10.0.0.1", nullptr));
+    REQUIRE(!TXEndpoint::fromURL("tcp+k2rpc://10.0.0.1:12345?core=1", nullptr));
+}
+
+TEST_CASE("test endpoint url with target core") {
+    auto ep = TXEndpoint::fromURL("tcp+k2rpc://10.0.0.1:12345?core=3&cores=8", nullptr);
+    REQUIRE(ep);
+    REQUIRE(ep->ip == "10.0.0.1");
+    REQUIRE(ep->port == 12345);
+    REQUIRE(ep->core == 3);
+    REQUIRE(ep->cores == 8);
+    REQUIRE(ep->url == "tcp+k2rpc://10.0.0.1:12345?core=3&cores=8");
+
+    // each core is a separate endpoint
+    TXEndpoint other(String("tcp+k2rpc"), String("10.0.0.1"), 12345, nullptr, 4, 8);
+    REQUIRE(!(other == *ep));
+    REQUIRE(other.url == "tcp+k2rpc://10.0.0.1:12345?core=4&cores=8");
+
+    // the core must be one of the server's cores
+    REQUIRE(!TXEndpoint::fromURL("tcp+k2rpc://10.0.0.1:12345?core=8&cores=8", nullptr));
+    REQUIRE(!TXEndpoint::fromURL("tcp+k2rpc://10.0.0.1:12345?core=0&cores=0", nullptr));
+}